@@ -13,6 +13,25 @@
 
 typedef void * SocketHandle;
 
+/**
+ * @brief 1 to impair the network, see sockets_wrapper_impairment.h.
+ *
+ * Set by the SAMPLE_NETWORK_IMPAIRMENT CMake option, so that every file agrees.
+ */
+#ifndef democonfigNETWORK_IMPAIRMENT
+    #define democonfigNETWORK_IMPAIRMENT    0
+#endif
+
+/* A wrapper of a network stack defines socketswrapperIMPLEMENTATION before
+ * including this header. With the impairment on, it then implements the
+ * unimpaired calls, and sockets_wrapper_impairment.c the calls made by the
+ * transports. */
+#if ( democonfigNETWORK_IMPAIRMENT == 1 ) && defined( socketswrapperIMPLEMENTATION )
+    #define Sockets_Close    SocketsImpairment_RawClose
+    #define Sockets_Recv     SocketsImpairment_RawRecv
+    #define Sockets_Send     SocketsImpairment_RawSend
+#endif
+
 #ifndef SOCKETS_MAX_HOST_NAME_LENGTH
     #define SOCKETS_MAX_HOST_NAME_LENGTH    ( 128 )
 #endif
@@ -41,6 +60,22 @@ typedef void * SocketHandle;
  */
 #define SOCKETS_SO_RCVTIMEO         ( 0 )          /**< Set the receive timeout. */
 #define SOCKETS_SO_SNDTIMEO         ( 1 )          /**< Set the send timeout. */
+#define SOCKETS_SO_NODELAY          ( 2 )          /**< Send small segments without delay (BaseType_t, pdTRUE disables Nagle). */
+#define SOCKETS_SO_KEEPALIVE        ( 3 )          /**< Probe idle connections (SocketsKeepAlive_t). */
+#define SOCKETS_SO_SNDBUF           ( 4 )          /**< Send buffer size hint in bytes (uint32_t), set before connecting. */
+#define SOCKETS_SO_RCVBUF           ( 5 )          /**< Receive buffer/window size hint in bytes (uint32_t), set before connecting. */
+
+/**
+ * @brief Value of the #SOCKETS_SO_KEEPALIVE option.
+ *
+ * Stacks that only support global keepalive settings ignore the timings.
+ */
+typedef struct SocketsKeepAlive
+{
+    uint32_t ulIdleSeconds;     /**< Idle time before the first probe, 0 disables keepalive. */
+    uint32_t ulIntervalSeconds; /**< Time between unanswered probes. */
+    uint32_t ulProbeCount;      /**< Unanswered probes before the connection is dropped. */
+} SocketsKeepAlive_t;
 
 /**
  * @brief Initialize the sockets
@@ -88,6 +123,13 @@ BaseType_t Sockets_Connect( SocketHandle xSocket,
                             const char * pcHostName,
                             uint16_t usPort );
 
+/**
+ * @brief Get the time the last Sockets_Connect() spent resolving the host name.
+ *
+ * @return A #TickType_t with the duration of the lookup in ticks.
+ */
+TickType_t Sockets_GetLastResolveTime( void );
+
 /**
  * @brief Disconnect socket handle.
  *
@@ -109,6 +151,31 @@ BaseType_t Sockets_Recv( SocketHandle xSocket,
                          uint8_t * pucReceiveBuffer,
                          size_t xReceiveBufferLength );
 
+/**
+ * @brief Wait until data can be received from socket handle.
+ *
+ * Lets a task sleep until the peer sends data instead of polling with
+ * Sockets_Recv() and a short receive timeout.
+ *
+ * @param[in] xSocket The #SocketHandle used for this call.
+ * @param[in] xTimeout Maximum time to wait, in ticks.
+ * @return A #BaseType_t with the result of the operation.
+ *        - 1 if data can be received, 0 if the wait timed out.
+ *        - On failure return negative error code.
+ */
+BaseType_t Sockets_WaitReadable( SocketHandle xSocket,
+                                 TickType_t xTimeout );
+
+/**
+ * @brief Get the number of bytes that can be received without blocking.
+ *
+ * @param[in] xSocket The #SocketHandle used for this call.
+ * @return A #BaseType_t with the result of the operation.
+ *        - The number of bytes queued on the socket, 0 if none or if the
+ *          network stack cannot tell.
+ */
+BaseType_t Sockets_RecvAvailable( SocketHandle xSocket );
+
 /**
  * @brief Send data to socket handle.
  *
@@ -6,6 +6,8 @@
  * @brief FreeRTOS Sockets wrapper implementation.
  */
 
+/* Implements the unimpaired calls when the network is impaired. */
+#define socketswrapperIMPLEMENTATION
 #include "sockets_wrapper.h"
 
 /* Standard includes. */
@@ -13,21 +15,55 @@
 
 /* FreeRTOS includes. */
 #include "FreeRTOS.h"
+#include "task.h"
 
 /* FreeRTOS+TCP includes. */
 #include "FreeRTOS_IP.h"
 #include "FreeRTOS_Sockets.h"
 #include "FreeRTOS_DNS.h"
+
+/* Trace points of the samples. */
+#include "azure_sample_trace.h"
 /*-----------------------------------------------------------*/
 
-/* Maximum number of times to call FreeRTOS_recv when initiating a graceful shutdown. */
-#ifndef FREERTOS_SOCKETS_WRAPPER_SHUTDOWN_LOOPS
-    #define FREERTOS_SOCKETS_WRAPPER_SHUTDOWN_LOOPS    ( 3 )
+/* Total time to wait for the peer to complete a graceful shutdown. Once it
+ * runs out the socket is left for Sockets_Close(), so reconnect latency does
+ * not depend on the receive timeout of the connection. */
+#ifndef FREERTOS_SOCKETS_WRAPPER_SHUTDOWN_TIMEOUT_MS
+    #define FREERTOS_SOCKETS_WRAPPER_SHUTDOWN_TIMEOUT_MS    ( 500U )
+#endif
+
+/* Receive timeout used for each wait while the shutdown completes. */
+#ifndef FREERTOS_SOCKETS_WRAPPER_SHUTDOWN_POLL_MS
+    #define FREERTOS_SOCKETS_WRAPPER_SHUTDOWN_POLL_MS    ( 50U )
 #endif
 
 /* A negative error code indicating a network failure. */
 #define FREERTOS_SOCKETS_WRAPPER_NETWORK_ERROR    ( -1 )
 
+/*
+ * A socket, with the socket set its waits for data select on.
+ */
+typedef struct FreeRTOSSocket
+{
+    Socket_t xTcpSocket;
+    #if ( ipconfigSUPPORT_SELECT_FUNCTION == 1 )
+        SocketSet_t xSocketSet; /* Created when the socket connects, NULL until then. */
+    #endif
+} FreeRTOSSocket_t;
+
+/* Duration of the last host name lookup. */
+static TickType_t xLastResolveTime = 0;
+
+/*-----------------------------------------------------------*/
+
+/*
+ * Get the FreeRTOS+TCP socket of a socket handle.
+ */
+static Socket_t prvTcpSocket( SocketHandle xSocket )
+{
+    return ( ( FreeRTOSSocket_t * ) xSocket )->xTcpSocket;
+}
 /*-----------------------------------------------------------*/
 
 BaseType_t Sockets_Init()
@@ -45,15 +81,25 @@ BaseType_t Sockets_DeInit()
 SocketHandle Sockets_Open()
 {
     Socket_t ulSocketNumber = FreeRTOS_socket( FREERTOS_AF_INET, FREERTOS_SOCK_STREAM, FREERTOS_IPPROTO_TCP );
+    FreeRTOSSocket_t * pxSocket;
     SocketHandle xSocket;
 
     if( ulSocketNumber == FREERTOS_INVALID_SOCKET )
     {
         xSocket = ( SocketHandle ) SOCKETS_INVALID_SOCKET;
     }
+    else if( ( pxSocket = pvPortMalloc( sizeof( FreeRTOSSocket_t ) ) ) == NULL )
+    {
+        ( void ) FreeRTOS_closesocket( ulSocketNumber );
+        xSocket = ( SocketHandle ) SOCKETS_INVALID_SOCKET;
+    }
     else
     {
-        xSocket = ( SocketHandle ) ulSocketNumber;
+        pxSocket->xTcpSocket = ulSocketNumber;
+        #if ( ipconfigSUPPORT_SELECT_FUNCTION == 1 )
+            pxSocket->xSocketSet = NULL;
+        #endif
+        xSocket = ( SocketHandle ) pxSocket;
     }
 
     return xSocket;
@@ -62,7 +108,28 @@ SocketHandle Sockets_Open()
 
 BaseType_t Sockets_Close( SocketHandle xSocket )
 {
-    return ( BaseType_t ) FreeRTOS_closesocket( ( Socket_t ) xSocket );
+    FreeRTOSSocket_t * pxSocket = ( FreeRTOSSocket_t * ) xSocket;
+    BaseType_t xRetVal;
+
+    #if ( ipconfigSUPPORT_SELECT_FUNCTION == 1 )
+        if( pxSocket->xSocketSet != NULL )
+        {
+            FreeRTOS_FD_CLR( pxSocket->xTcpSocket, pxSocket->xSocketSet, eSELECT_ALL );
+        }
+    #endif
+
+    xRetVal = ( BaseType_t ) FreeRTOS_closesocket( pxSocket->xTcpSocket );
+
+    #if ( ipconfigSUPPORT_SELECT_FUNCTION == 1 )
+        if( pxSocket->xSocketSet != NULL )
+        {
+            FreeRTOS_DeleteSocketSet( pxSocket->xSocketSet );
+        }
+    #endif
+
+    vPortFree( pxSocket );
+
+    return xRetVal;
 }
 /*-----------------------------------------------------------*/
 
@@ -70,13 +137,17 @@ BaseType_t Sockets_Connect( SocketHandle xSocket,
                             const char * pcHostName,
                             uint16_t usPort )
 {
-    Socket_t xTcpSocket = ( Socket_t ) xSocket;
+    FreeRTOSSocket_t * pxSocket = ( FreeRTOSSocket_t * ) xSocket;
     BaseType_t lRetVal = 0;
     struct freertos_sockaddr xServerAddress = { 0 };
     uint32_t ulIPAddres;
+    TickType_t xResolveStart = xTaskGetTickCount();
+
+    ulIPAddres = ( uint32_t ) FreeRTOS_gethostbyname( pcHostName );
+    xLastResolveTime = xTaskGetTickCount() - xResolveStart;
 
     /* Check for errors from DNS lookup. */
-    if( ( ulIPAddres = ( uint32_t ) FreeRTOS_gethostbyname( pcHostName ) ) == 0 )
+    if( ulIPAddres == 0 )
     {
         lRetVal = SOCKETS_SOCKET_ERROR;
     }
@@ -88,34 +159,69 @@ BaseType_t Sockets_Connect( SocketHandle xSocket,
         xServerAddress.sin_addr = ulIPAddres;
         xServerAddress.sin_len = ( uint8_t ) sizeof( xServerAddress );
 
-        if( FreeRTOS_connect( xTcpSocket, &xServerAddress, sizeof( xServerAddress ) ) != 0 )
+        if( FreeRTOS_connect( pxSocket->xTcpSocket, &xServerAddress, sizeof( xServerAddress ) ) != 0 )
         {
             lRetVal = SOCKETS_SOCKET_ERROR;
         }
     }
 
+    #if ( ipconfigSUPPORT_SELECT_FUNCTION == 1 )
+        /* Every wait for data selects on the same set, so it is made once. A
+         * closed connection also wakes up the select, the next receive then
+         * reports the error. */
+        if( ( lRetVal == 0 ) && ( pxSocket->xSocketSet == NULL ) )
+        {
+            if( ( pxSocket->xSocketSet = FreeRTOS_CreateSocketSet() ) == NULL )
+            {
+                lRetVal = SOCKETS_ENOMEM;
+            }
+            else
+            {
+                FreeRTOS_FD_SET( pxSocket->xTcpSocket, pxSocket->xSocketSet, eSELECT_READ | eSELECT_EXCEPT );
+            }
+        }
+    #endif /* ipconfigSUPPORT_SELECT_FUNCTION == 1 */
+
     return lRetVal;
 }
 /*-----------------------------------------------------------*/
 
+TickType_t Sockets_GetLastResolveTime( void )
+{
+    return xLastResolveTime;
+}
+/*-----------------------------------------------------------*/
+
 void Sockets_Disconnect( SocketHandle xSocket )
 {
-    BaseType_t xWaitForShutdownLoopCount = 0;
     uint8_t pucDummyBuffer[ 2 ];
-    Socket_t xTcpSocket = ( Socket_t ) xSocket;
+    Socket_t xTcpSocket = ( xSocket != SOCKETS_INVALID_SOCKET ) ? prvTcpSocket( xSocket ) : FREERTOS_INVALID_SOCKET;
+    TickType_t xPollTimeout = pdMS_TO_TICKS( FREERTOS_SOCKETS_WRAPPER_SHUTDOWN_POLL_MS );
+    TimeOut_t xTimeOut;
+    TickType_t xTicksToWait = pdMS_TO_TICKS( FREERTOS_SOCKETS_WRAPPER_SHUTDOWN_TIMEOUT_MS );
 
     if( xTcpSocket != FREERTOS_INVALID_SOCKET )
     {
         /* Initiate graceful shutdown. */
         ( void ) FreeRTOS_shutdown( xTcpSocket, FREERTOS_SHUT_RDWR );
 
+        /* The connection is going away, so its receive timeout can be
+         * shortened to keep every wait inside the shutdown budget. */
+        if( xPollTimeout == 0U )
+        {
+            xPollTimeout = 1U;
+        }
+
+        ( void ) FreeRTOS_setsockopt( xTcpSocket, 0, FREERTOS_SO_RCVTIMEO,
+                                      &xPollTimeout, sizeof( xPollTimeout ) );
+
+        vTaskSetTimeOutState( &xTimeOut );
+
         /* Wait for the socket to disconnect gracefully (indicated by FreeRTOS_recv()
          * returning a FREERTOS_EINVAL error) before closing the socket. */
         while( FreeRTOS_recv( xTcpSocket, pucDummyBuffer, sizeof( pucDummyBuffer ), 0 ) >= 0 )
         {
-            /* We don't need to delay since FreeRTOS_recv should already have a timeout. */
-
-            if( ++xWaitForShutdownLoopCount >= FREERTOS_SOCKETS_WRAPPER_SHUTDOWN_LOOPS )
+            if( xTaskCheckForTimeOut( &xTimeOut, &xTicksToWait ) != pdFALSE )
             {
                 break;
             }
@@ -128,8 +234,72 @@ BaseType_t Sockets_Recv( SocketHandle xSocket,
                          uint8_t * pucReceiveBuffer,
                          size_t xReceiveBufferLength )
 {
-    return ( BaseType_t ) FreeRTOS_recv( ( Socket_t ) xSocket,
-                                         pucReceiveBuffer, xReceiveBufferLength, 0 );
+    BaseType_t xRetVal;
+
+    sampletraceBEGIN( eSampleTraceSocketRecv, xReceiveBufferLength );
+    xRetVal = ( BaseType_t ) FreeRTOS_recv( prvTcpSocket( xSocket ),
+                                            pucReceiveBuffer, xReceiveBufferLength, 0 );
+    sampletraceEND( eSampleTraceSocketRecv, xRetVal );
+
+    return xRetVal;
+}
+/*-----------------------------------------------------------*/
+
+BaseType_t Sockets_WaitReadable( SocketHandle xSocket,
+                                 TickType_t xTimeout )
+{
+    Socket_t xTcpSocket = prvTcpSocket( xSocket );
+    BaseType_t xRetVal = 0;
+
+    #if ( ipconfigSUPPORT_SELECT_FUNCTION == 1 )
+        SocketSet_t xSocketSet = ( ( FreeRTOSSocket_t * ) xSocket )->xSocketSet;
+
+        if( FreeRTOS_rx_size( xTcpSocket ) > 0 )
+        {
+            xRetVal = 1;
+        }
+        else if( xSocketSet == NULL )
+        {
+            /* Not connected, there is nothing to wait for. */
+            xRetVal = SOCKETS_ENOTCONN;
+        }
+        else if( FreeRTOS_select( xSocketSet, xTimeout ) > 0 )
+        {
+            xRetVal = 1;
+        }
+    #else /* ipconfigSUPPORT_SELECT_FUNCTION == 1 */
+        TickType_t xTimeOnEntering = xTaskGetTickCount();
+
+        /* Without FreeRTOS_select(), poll the receive queue at tick granularity. */
+        for( ; ; )
+        {
+            xRetVal = FreeRTOS_rx_size( xTcpSocket );
+
+            if( xRetVal != 0 )
+            {
+                xRetVal = ( xRetVal > 0 ) ? 1 : SOCKETS_SOCKET_ERROR;
+                break;
+            }
+
+            if( ( xTaskGetTickCount() - xTimeOnEntering ) >= xTimeout )
+            {
+                break;
+            }
+
+            vTaskDelay( 1 );
+        }
+    #endif /* ipconfigSUPPORT_SELECT_FUNCTION == 1 */
+
+    return xRetVal;
+}
+/*-----------------------------------------------------------*/
+
+BaseType_t Sockets_RecvAvailable( SocketHandle xSocket )
+{
+    BaseType_t xAvailable = FreeRTOS_rx_size( prvTcpSocket( xSocket ) );
+
+    /* Negative values report an invalid or closed socket. */
+    return ( xAvailable > 0 ) ? xAvailable : 0;
 }
 /*-----------------------------------------------------------*/
 
@@ -137,8 +307,14 @@ BaseType_t Sockets_Send( SocketHandle xSocket,
                          const uint8_t * pucData,
                          size_t xDataLength )
 {
-    return ( BaseType_t ) FreeRTOS_send( ( Socket_t ) xSocket,
-                                         pucData, xDataLength, 0 );
+    BaseType_t xRetVal;
+
+    sampletraceBEGIN( eSampleTraceSocketSend, xDataLength );
+    xRetVal = ( BaseType_t ) FreeRTOS_send( prvTcpSocket( xSocket ),
+                                            pucData, xDataLength, 0 );
+    sampletraceEND( eSampleTraceSocketSend, xRetVal );
+
+    return xRetVal;
 }
 /*-----------------------------------------------------------*/
 
@@ -147,7 +323,7 @@ BaseType_t Sockets_SetSockOpt( SocketHandle xSocket,
                                const void * pvOptionValue,
                                size_t xOptionLength )
 {
-    Socket_t xTcpSocket = ( Socket_t ) xSocket;
+    Socket_t xTcpSocket = prvTcpSocket( xSocket );
     BaseType_t xRetVal;
     int ulRet = 0;
     TickType_t xTimeout;
@@ -181,6 +357,62 @@ BaseType_t Sockets_SetSockOpt( SocketHandle xSocket,
 
             break;
 
+        case SOCKETS_SO_NODELAY:
+           {
+               /* FreeRTOS+TCP holds back partial segments only when asked to
+                * send full-size segments, which is its form of Nagle. */
+               BaseType_t xFullSize = ( *( ( const BaseType_t * ) pvOptionValue ) == pdFALSE ) ? pdTRUE : pdFALSE;
+
+               ulRet = FreeRTOS_setsockopt( xTcpSocket, 0, FREERTOS_SO_SET_FULL_SIZE,
+                                            &xFullSize, sizeof( xFullSize ) );
+               xRetVal = ( ulRet != 0 ) ? SOCKETS_EINVAL : SOCKETS_ERROR_NONE;
+           }
+           break;
+
+        case SOCKETS_SO_KEEPALIVE:
+            /* Keepalive is configured for all sockets by ipconfigTCP_KEEP_ALIVE
+             * and ipconfigTCP_KEEP_ALIVE_INTERVAL. */
+            #if ( ipconfigTCP_KEEP_ALIVE == 1 )
+                xRetVal = ( ( ( const SocketsKeepAlive_t * ) pvOptionValue )->ulIdleSeconds != 0 ) ?
+                          SOCKETS_ERROR_NONE : SOCKETS_ENOPROTOOPT;
+            #else
+                xRetVal = SOCKETS_ENOPROTOOPT;
+            #endif
+            break;
+
+        case SOCKETS_SO_SNDBUF:
+        case SOCKETS_SO_RCVBUF:
+           {
+               uint32_t ulBufferSize = *( ( const uint32_t * ) pvOptionValue );
+
+               ulRet = FreeRTOS_setsockopt( xTcpSocket, 0,
+                                            ( lOptionName == SOCKETS_SO_SNDBUF ) ?
+                                            FREERTOS_SO_SNDBUF : FREERTOS_SO_RCVBUF,
+                                            &ulBufferSize, sizeof( ulBufferSize ) );
+
+               #if ( ipconfigUSE_TCP_WIN == 1 )
+                   /* The receive window is fixed at half of the default
+                    * buffer when the socket is created, so a larger buffer
+                    * also needs a matching window to be of any use. The send
+                    * side is given its defaults again. */
+                   if( ( ulRet == 0 ) && ( lOptionName == SOCKETS_SO_RCVBUF ) )
+                   {
+                       WinProperties_t xWinProperties;
+
+                       xWinProperties.lTxBufSize = ipconfigTCP_TX_BUFFER_LENGTH;
+                       xWinProperties.lTxWinSize = FreeRTOS_max_int32( 1, ( int32_t ) ( ipconfigTCP_TX_BUFFER_LENGTH / 2 ) / ipconfigTCP_MSS );
+                       xWinProperties.lRxBufSize = ( int32_t ) ulBufferSize;
+                       xWinProperties.lRxWinSize = FreeRTOS_max_int32( 1, ( int32_t ) ( ulBufferSize / 2U ) / ipconfigTCP_MSS );
+
+                       ulRet = FreeRTOS_setsockopt( xTcpSocket, 0, FREERTOS_SO_WIN_PROPERTIES,
+                                                    &xWinProperties, sizeof( xWinProperties ) );
+                   }
+               #endif /* ipconfigUSE_TCP_WIN == 1 */
+
+               xRetVal = ( ulRet != 0 ) ? SOCKETS_EINVAL : SOCKETS_ERROR_NONE;
+           }
+           break;
+
         default:
             xRetVal = SOCKETS_ENOPROTOOPT;
             break;
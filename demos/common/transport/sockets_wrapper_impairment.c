@@ -0,0 +1,287 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @file sockets_wrapper_impairment.c
+ * @brief Network impairment layered over the sockets wrapper.
+ */
+
+#include "sockets_wrapper_impairment.h"
+
+/* Standard includes. */
+#include <stdbool.h>
+
+/* FreeRTOS includes. */
+#include "FreeRTOS.h"
+#include "task.h"
+/*-----------------------------------------------------------*/
+
+/* Rate limit of one direction, shared by all sockets. */
+typedef struct SocketsImpairmentLink
+{
+    TickType_t xFreeAt;  /* When the data handed to the link so far is through. */
+    uint32_t ulCarryUs;  /* Time below a tick not yet added to xFreeAt. */
+} SocketsImpairmentLink_t;
+
+static SocketsImpairment_t xImpairment =
+{
+    democonfigNETWORK_IMPAIRMENT_LATENCY_MS,
+    democonfigNETWORK_IMPAIRMENT_JITTER_MS,
+    democonfigNETWORK_IMPAIRMENT_LOSS_PER_MILLE,
+    democonfigNETWORK_IMPAIRMENT_RETRANSMIT_MS,
+    democonfigNETWORK_IMPAIRMENT_UPLINK_BYTES_PER_SEC,
+    democonfigNETWORK_IMPAIRMENT_DOWNLINK_BYTES_PER_SEC,
+    democonfigNETWORK_IMPAIRMENT_RESET_PER_MILLE
+};
+
+#if ( democonfigNETWORK_IMPAIRMENT == 1 )
+    static SocketsImpairmentLink_t xUplink;
+    static SocketsImpairmentLink_t xDownlink;
+    static TickType_t xLastSendTime;
+    static bool xSentBefore;
+    static SocketHandle xResetSockets[ socketsimpairmentMAX_RESET_SOCKETS ];
+#endif /* democonfigNETWORK_IMPAIRMENT == 1 */
+/*-----------------------------------------------------------*/
+
+void SocketsImpairment_Set( const SocketsImpairment_t * pxImpairment )
+{
+    taskENTER_CRITICAL();
+    {
+        xImpairment = *pxImpairment;
+    }
+    taskEXIT_CRITICAL();
+}
+/*-----------------------------------------------------------*/
+
+void SocketsImpairment_Get( SocketsImpairment_t * pxImpairment )
+{
+    taskENTER_CRITICAL();
+    {
+        *pxImpairment = xImpairment;
+    }
+    taskEXIT_CRITICAL();
+}
+/*-----------------------------------------------------------*/
+
+#if ( democonfigNETWORK_IMPAIRMENT == 1 )
+
+    static bool prvChance( uint32_t ulPerMille )
+    {
+        return ( ulPerMille > 0U ) && ( ( ( uint32_t ) configRAND32() % 1000U ) < ulPerMille );
+    }
+/*-----------------------------------------------------------*/
+
+/* Whether a socket was reset, and optionally forget it, as when it is closed. */
+    static bool prvWasReset( SocketHandle xSocket,
+                             bool xForget )
+    {
+        bool xReset = false;
+        uint32_t ulIndex;
+
+        taskENTER_CRITICAL();
+        {
+            for( ulIndex = 0; ulIndex < socketsimpairmentMAX_RESET_SOCKETS; ulIndex++ )
+            {
+                if( xResetSockets[ ulIndex ] == xSocket )
+                {
+                    xReset = true;
+
+                    if( xForget )
+                    {
+                        xResetSockets[ ulIndex ] = NULL;
+                    }
+                }
+            }
+        }
+        taskEXIT_CRITICAL();
+
+        return xReset;
+    }
+/*-----------------------------------------------------------*/
+
+/* A socket that cannot be recorded fails this once. */
+    static void prvReset( SocketHandle xSocket )
+    {
+        uint32_t ulIndex;
+
+        taskENTER_CRITICAL();
+        {
+            for( ulIndex = 0; ulIndex < socketsimpairmentMAX_RESET_SOCKETS; ulIndex++ )
+            {
+                if( xResetSockets[ ulIndex ] == NULL )
+                {
+                    xResetSockets[ ulIndex ] = xSocket;
+                    break;
+                }
+            }
+        }
+        taskEXIT_CRITICAL();
+    }
+/*-----------------------------------------------------------*/
+
+/* Holds back the first send of a burst, a burst being sends closer together
+ * than the latency. */
+    static void prvHoldLatency( const SocketsImpairment_t * pxProfile )
+    {
+        TickType_t xLatency = pdMS_TO_TICKS( pxProfile->ulLatencyMs );
+        TickType_t xNow = xTaskGetTickCount();
+        bool xInBurst;
+
+        taskENTER_CRITICAL();
+        {
+            xInBurst = xSentBefore && ( ( xNow - xLastSendTime ) < xLatency );
+        }
+        taskEXIT_CRITICAL();
+
+        if( !xInBurst && ( ( pxProfile->ulLatencyMs > 0U ) || ( pxProfile->ulJitterMs > 0U ) ) )
+        {
+            vTaskDelay( pdMS_TO_TICKS( pxProfile->ulLatencyMs +
+                                       ( uint32_t ) configRAND32() % ( pxProfile->ulJitterMs + 1U ) ) );
+        }
+
+        taskENTER_CRITICAL();
+        {
+            xLastSendTime = xTaskGetTickCount();
+            xSentBefore = true;
+        }
+        taskEXIT_CRITICAL();
+    }
+/*-----------------------------------------------------------*/
+
+    static void prvHoldLoss( const SocketsImpairment_t * pxProfile,
+                             uint32_t ulBytes )
+    {
+        uint32_t ulSegments = ( ulBytes + socketsimpairmentSEGMENT_SIZE - 1U ) / socketsimpairmentSEGMENT_SIZE;
+        uint32_t ulDelayMs = 0;
+
+        while( ulSegments-- > 0U )
+        {
+            if( prvChance( pxProfile->ulLossPerMille ) )
+            {
+                ulDelayMs += pxProfile->ulRetransmitMs;
+            }
+        }
+
+        if( ulDelayMs > 0U )
+        {
+            vTaskDelay( pdMS_TO_TICKS( ulDelayMs ) );
+        }
+    }
+/*-----------------------------------------------------------*/
+
+/* Waits until the bytes are through the link, after those handed to it before. */
+    static void prvHoldBandwidth( SocketsImpairmentLink_t * pxLink,
+                                  uint32_t ulBytes,
+                                  uint32_t ulBytesPerSecond )
+    {
+        uint64_t ullUs;
+        TickType_t xTicks;
+        TickType_t xNow;
+        TickType_t xWait;
+
+        if( ulBytesPerSecond == 0U )
+        {
+            return;
+        }
+
+        taskENTER_CRITICAL();
+        {
+            ullUs = ( uint64_t ) ulBytes * 1000000ULL / ulBytesPerSecond + pxLink->ulCarryUs;
+            xTicks = ( TickType_t ) ( ullUs * configTICK_RATE_HZ / 1000000ULL );
+            pxLink->ulCarryUs = ( uint32_t ) ( ullUs - ( uint64_t ) xTicks * 1000000ULL / configTICK_RATE_HZ );
+
+            /* An idle link is free from now on. */
+            xNow = xTaskGetTickCount();
+
+            if( ( TickType_t ) ( xNow - pxLink->xFreeAt ) < ( portMAX_DELAY / 2U ) )
+            {
+                pxLink->xFreeAt = xNow;
+            }
+
+            pxLink->xFreeAt += xTicks;
+            xWait = pxLink->xFreeAt - xNow;
+        }
+        taskEXIT_CRITICAL();
+
+        if( xWait > 0U )
+        {
+            vTaskDelay( xWait );
+        }
+    }
+/*-----------------------------------------------------------*/
+
+    BaseType_t Sockets_Close( SocketHandle xSocket )
+    {
+        ( void ) prvWasReset( xSocket, true );
+
+        return SocketsImpairment_RawClose( xSocket );
+    }
+/*-----------------------------------------------------------*/
+
+    BaseType_t Sockets_Recv( SocketHandle xSocket,
+                             uint8_t * pucReceiveBuffer,
+                             size_t xReceiveBufferLength )
+    {
+        SocketsImpairment_t xProfile;
+        BaseType_t xRetVal;
+
+        SocketsImpairment_Get( &xProfile );
+
+        if( prvWasReset( xSocket, false ) )
+        {
+            return SOCKETS_ECLOSED;
+        }
+
+        if( prvChance( xProfile.ulResetPerMille ) )
+        {
+            prvReset( xSocket );
+            return SOCKETS_ECLOSED;
+        }
+
+        xRetVal = SocketsImpairment_RawRecv( xSocket, pucReceiveBuffer, xReceiveBufferLength );
+
+        if( xRetVal > 0 )
+        {
+            prvHoldLoss( &xProfile, ( uint32_t ) xRetVal );
+            prvHoldBandwidth( &xDownlink, ( uint32_t ) xRetVal, xProfile.ulDownlinkBytesPerSecond );
+        }
+
+        return xRetVal;
+    }
+/*-----------------------------------------------------------*/
+
+    BaseType_t Sockets_Send( SocketHandle xSocket,
+                             const uint8_t * pucData,
+                             size_t xDataLength )
+    {
+        SocketsImpairment_t xProfile;
+        BaseType_t xRetVal;
+
+        SocketsImpairment_Get( &xProfile );
+
+        if( prvWasReset( xSocket, false ) )
+        {
+            return SOCKETS_ECLOSED;
+        }
+
+        if( prvChance( xProfile.ulResetPerMille ) )
+        {
+            prvReset( xSocket );
+            return SOCKETS_ECLOSED;
+        }
+
+        prvHoldLatency( &xProfile );
+
+        xRetVal = SocketsImpairment_RawSend( xSocket, pucData, xDataLength );
+
+        if( xRetVal > 0 )
+        {
+            prvHoldLoss( &xProfile, ( uint32_t ) xRetVal );
+            prvHoldBandwidth( &xUplink, ( uint32_t ) xRetVal, xProfile.ulUplinkBytesPerSecond );
+        }
+
+        return xRetVal;
+    }
+/*-----------------------------------------------------------*/
+
+#endif /* democonfigNETWORK_IMPAIRMENT == 1 */
@@ -0,0 +1,149 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @file sockets_wrapper_impairment.h
+ * @brief Network impairment layered over the sockets wrapper.
+ *
+ * With democonfigNETWORK_IMPAIRMENT set, Sockets_Send(), Sockets_Recv() and
+ * Sockets_Close() go through this layer, which makes the network look like a
+ * slower, lossy one, to tune timeouts and backoff against:
+ * - Latency and jitter: the first send of a burst is held back by the
+ *   latency and a random part of the jitter, so each exchange pays it once.
+ * - Loss: each segment sent or received is lost with the given chance, and
+ *   then costs the retransmission time, which is how loss shows over TCP.
+ * - Bandwidth: sends and receives are held back to the rate of their link,
+ *   shared by all sockets.
+ * - Resets: each send or receive resets the connection with the given chance,
+ *   after which the socket fails until it is closed.
+ *
+ * The wrappers of the network stacks are unchanged when it is off, and only
+ * implement the unimpaired calls when it is on.
+ */
+
+#ifndef SOCKETS_WRAPPER_IMPAIRMENT_H
+#define SOCKETS_WRAPPER_IMPAIRMENT_H
+
+#include <stdint.h>
+
+#include "sockets_wrapper.h"
+
+/**
+ * @brief Latency added to an exchange, in milliseconds.
+ */
+#ifndef democonfigNETWORK_IMPAIRMENT_LATENCY_MS
+    #define democonfigNETWORK_IMPAIRMENT_LATENCY_MS    ( 0U )
+#endif
+
+/**
+ * @brief Largest random addition to the latency, in milliseconds.
+ */
+#ifndef democonfigNETWORK_IMPAIRMENT_JITTER_MS
+    #define democonfigNETWORK_IMPAIRMENT_JITTER_MS    ( 0U )
+#endif
+
+/**
+ * @brief Segments in a thousand that are lost.
+ */
+#ifndef democonfigNETWORK_IMPAIRMENT_LOSS_PER_MILLE
+    #define democonfigNETWORK_IMPAIRMENT_LOSS_PER_MILLE    ( 0U )
+#endif
+
+/**
+ * @brief Time a lost segment costs, as the TCP retransmission timeout.
+ */
+#ifndef democonfigNETWORK_IMPAIRMENT_RETRANSMIT_MS
+    #define democonfigNETWORK_IMPAIRMENT_RETRANSMIT_MS    ( 1000U )
+#endif
+
+/**
+ * @brief Rate of the link from the device, in bytes per second, 0 for no limit.
+ */
+#ifndef democonfigNETWORK_IMPAIRMENT_UPLINK_BYTES_PER_SEC
+    #define democonfigNETWORK_IMPAIRMENT_UPLINK_BYTES_PER_SEC    ( 0U )
+#endif
+
+/**
+ * @brief Rate of the link to the device, in bytes per second, 0 for no limit.
+ */
+#ifndef democonfigNETWORK_IMPAIRMENT_DOWNLINK_BYTES_PER_SEC
+    #define democonfigNETWORK_IMPAIRMENT_DOWNLINK_BYTES_PER_SEC    ( 0U )
+#endif
+
+/**
+ * @brief Sends and receives in a thousand that reset the connection.
+ */
+#ifndef democonfigNETWORK_IMPAIRMENT_RESET_PER_MILLE
+    #define democonfigNETWORK_IMPAIRMENT_RESET_PER_MILLE    ( 0U )
+#endif
+
+/**
+ * @brief Bytes of a segment, for the loss.
+ */
+#ifndef socketsimpairmentSEGMENT_SIZE
+    #define socketsimpairmentSEGMENT_SIZE    ( 1460U )
+#endif
+
+/**
+ * @brief Sockets that can be reset at the same time.
+ */
+#ifndef socketsimpairmentMAX_RESET_SOCKETS
+    #define socketsimpairmentMAX_RESET_SOCKETS    ( 4U )
+#endif
+
+/**
+ * @brief An impairment, the fields being those of the democonfigNETWORK_IMPAIRMENT_ defaults.
+ */
+typedef struct SocketsImpairment
+{
+    uint32_t ulLatencyMs;
+    uint32_t ulJitterMs;
+    uint32_t ulLossPerMille;
+    uint32_t ulRetransmitMs;
+    uint32_t ulUplinkBytesPerSecond;
+    uint32_t ulDownlinkBytesPerSecond;
+    uint32_t ulResetPerMille;
+} SocketsImpairment_t;
+
+/* Rough figures of cellular networks for IoT, to start from. */
+
+/**
+ * @brief LTE-M with fair coverage.
+ */
+#define socketsimpairmentPROFILE_LTE_M    { 100U, 50U, 5U, 1000U, 40000U, 60000U, 0U }
+
+/**
+ * @brief NB-IoT at the edge of coverage.
+ */
+#define socketsimpairmentPROFILE_NB_IOT    { 1500U, 1000U, 20U, 3000U, 2000U, 3000U, 1U }
+
+/**
+ * @brief Change the impairment, from the next send or receive on.
+ *
+ * @param[in] pxImpairment The impairment, copied.
+ */
+void SocketsImpairment_Set( const SocketsImpairment_t * pxImpairment );
+
+/**
+ * @brief Get the impairment in effect.
+ *
+ * @param[out] pxImpairment Receives a copy of the impairment.
+ */
+void SocketsImpairment_Get( SocketsImpairment_t * pxImpairment );
+
+#if ( democonfigNETWORK_IMPAIRMENT == 1 )
+
+/* The unimpaired calls, which the wrappers of the network stacks implement. */
+    BaseType_t SocketsImpairment_RawClose( SocketHandle xSocket );
+
+    BaseType_t SocketsImpairment_RawRecv( SocketHandle xSocket,
+                                          uint8_t * pucReceiveBuffer,
+                                          size_t xReceiveBufferLength );
+
+    BaseType_t SocketsImpairment_RawSend( SocketHandle xSocket,
+                                          const uint8_t * pucData,
+                                          size_t xDataLength );
+
+#endif /* democonfigNETWORK_IMPAIRMENT == 1 */
+
+#endif /* SOCKETS_WRAPPER_IMPAIRMENT_H */
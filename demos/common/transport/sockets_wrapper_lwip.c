@@ -6,6 +6,8 @@
  * @brief LWIP socket wrapper.
  */
 
+/* Implements the unimpaired calls when the network is impaired. */
+#define socketswrapperIMPLEMENTATION
 #include "sockets_wrapper.h"
 
 /* Standard includes. */
@@ -22,6 +24,13 @@
 /* FreeRTOS includes. */
 #include "FreeRTOS.h"
 #include "task.h"
+#include "semphr.h"
+
+/* Trace points of the samples. */
+#include "azure_sample_trace.h"
+
+/* The link of the board, lost connections failing at once. */
+#include "azure_sample_link.h"
 /*-----------------------------------------------------------*/
 
 /*
@@ -31,11 +40,50 @@
     #define lwipdnsresolverMAX_WAIT_SECONDS    ( 20 )
 #endif
 
-#define lwipdnsresolverLOOP_DELAY_MS           ( 250 )
-#define lwipdnsresolverLOOP_DELAY_TICKS        ( ( TickType_t ) lwipdnsresolverLOOP_DELAY_MS / portTICK_PERIOD_MS )
-#define lwipdnsresolverMAX_WAIT_CYCLES                 \
-    ( ( ( lwipdnsresolverMAX_WAIT_SECONDS ) * 1000 ) / \
-      ( lwipdnsresolverLOOP_DELAY_MS ) )
+#define lwipdnsresolverMAX_WAIT_TICKS      pdMS_TO_TICKS( ( lwipdnsresolverMAX_WAIT_SECONDS ) * 1000 )
+
+/*
+ * Dual-stack lwIP builds resolve both address families and race the IPv6 and
+ * IPv4 candidates when connecting (RFC 8305, Happy Eyeballs).
+ */
+#define lwipsocketsDUAL_STACK              ( LWIP_IPV4 && LWIP_IPV6 )
+
+#if lwipsocketsDUAL_STACK
+
+/*
+ * Time the lookup of the other address family gets to answer once the first
+ * one has, so both candidates usually take part in the connect race.
+ */
+    #ifndef lwipsocketsRESOLUTION_DELAY_MS
+        #define lwipsocketsRESOLUTION_DELAY_MS    ( 50 )
+    #endif
+
+/*
+ * Time the preferred IPv6 attempt gets before the IPv4 attempt is started.
+ */
+    #ifndef lwipsocketsCONNECTION_ATTEMPT_DELAY_MS
+        #define lwipsocketsCONNECTION_ATTEMPT_DELAY_MS    ( 250 )
+    #endif
+
+/*
+ * Time allowed for all connection attempts to complete.
+ */
+    #ifndef lwipsocketsCONNECT_TIMEOUT_MS
+        #define lwipsocketsCONNECT_TIMEOUT_MS    ( 20000 )
+    #endif
+
+/*
+ * Number of sockets that can be open at the same time.
+ */
+    #ifndef lwipsocketsMAX_SOCKETS
+        #define lwipsocketsMAX_SOCKETS    ( 4 )
+    #endif
+#endif /* lwipsocketsDUAL_STACK */
+
+/*
+ * Address families looked up together for a host name.
+ */
+#define lwipsocketsDNS_LOOKUPS    ( lwipsocketsDUAL_STACK ? 2 : 1 )
 
 /*
  * convert from system ticks to seconds.
@@ -46,87 +94,577 @@
  * convert from system ticks to micro seconds.
  */
 #define TICK_TO_US( _t_ )    ( ( _t_ ) * 1000 / configTICK_RATE_HZ * 1000 )
+
+/*
+ * Duration of the last host name lookup.
+ */
+static TickType_t xLastResolveTime = 0;
+
+/*
+ * State of the DNS lookups in progress, one per address family. Lookups are
+ * serialized by xDnsRequestMutex; xDnsDoneSemaphore is given by the lwIP DNS
+ * callback as each family answers. Callbacks for a lookup that already timed
+ * out carry a stale request id and are ignored.
+ */
+typedef struct DnsLookup
+{
+    ip_addr_t xAddress; /* Resolved address, valid if xFound. */
+    bool xFound;        /* Whether the host name was resolved. */
+    bool xDone;         /* Whether the lookup has answered. */
+} DnsLookup_t;
+
+static StaticSemaphore_t xDnsRequestMutexStorage;
+static StaticSemaphore_t xDnsDoneSemaphoreStorage;
+static SemaphoreHandle_t xDnsRequestMutex = NULL;
+static SemaphoreHandle_t xDnsDoneSemaphore = NULL;
+static uint32_t ulDnsRequestId = 0;
+static DnsLookup_t xDnsLookups[ lwipsocketsDNS_LOOKUPS ];
+
+#if lwipsocketsDUAL_STACK
+
+/*
+ * lwIP descriptors behind the socket handles. The handle is an index into
+ * this table, so the descriptor can change when the IPv4 attempt wins the
+ * connect race.
+ */
+    typedef struct LwipSocket
+    {
+        int lFd;               /* lwIP socket descriptor, -1 if closed. */
+        uint8_t ucInUse;       /* Whether the handle is allocated. */
+        uint32_t ulLinkLosses; /* Link_Losses() when connected. */
+    } LwipSocket_t;
+
+    static LwipSocket_t xLwipSockets[ lwipsocketsMAX_SOCKETS ];
+#else
+
+/*
+ * Link_Losses() when each lwIP socket descriptor connected.
+ */
+    static uint32_t ulSocketLinkLosses[ MEMP_NUM_NETCONN ];
+#endif /* lwipsocketsDUAL_STACK */
+/*-----------------------------------------------------------*/
+
+/*
+ * Get the lwIP socket descriptor of a socket handle.
+ */
+static int prvSocketFd( SocketHandle xSocket )
+{
+    #if lwipsocketsDUAL_STACK
+        return xLwipSockets[ ( uint32_t ) xSocket ].lFd;
+    #else
+        return ( int ) ( uint32_t ) xSocket;
+    #endif
+}
+/*-----------------------------------------------------------*/
+
+/*
+ * Link_Losses() when a socket handle connected. lwIP keeps a connection over
+ * a lost link until it times out, so the socket fails once this changed.
+ */
+static uint32_t * prvLinkLosses( SocketHandle xSocket )
+{
+    #if lwipsocketsDUAL_STACK
+        return &( xLwipSockets[ ( uint32_t ) xSocket ].ulLinkLosses );
+    #else
+        return &( ulSocketLinkLosses[ ( uint32_t ) xSocket - LWIP_SOCKET_OFFSET ] );
+    #endif
+}
 /*-----------------------------------------------------------*/
 
 /*
  * Lwip DNS Found callback, compatible with type "dns_found_callback"
  * declared in lwip/dns.h.
  *
- * NOTE: this resolves only ipv4 addresses; calls to dns_gethostbyname_addrtype()
- * must specify dns_addrtype == LWIP_DNS_ADDRTYPE_IPV4.
+ * Runs in the lwIP tcpip thread and wakes up the task waiting in prvResolve().
+ * The callback argument is the request id plus the index of the lookup, the
+ * request id being a multiple of the number of lookups.
  */
 static void lwip_dns_found_callback( const char * ucName,
                                      const ip_addr_t * xIPAddr,
                                      void * pvCallbackArg )
 {
-    uint32_t * ulAddr = ( uint32_t * ) pvCallbackArg;
+    uint32_t ulArg = ( uint32_t ) ( uintptr_t ) pvCallbackArg;
+    DnsLookup_t * pxLookup = &( xDnsLookups[ ulArg % lwipsocketsDNS_LOOKUPS ] );
 
-    if( xIPAddr != NULL )
-    {
-        *ulAddr = *( ( uint32_t * ) xIPAddr ); /* NOTE: IPv4 addresses only */
-    }
-    else
+    ( void ) ucName;
+
+    taskENTER_CRITICAL();
+
+    if( ( ulArg - ( ulArg % lwipsocketsDNS_LOOKUPS ) ) == ulDnsRequestId )
     {
-        *ulAddr = 0;
+        if( xIPAddr != NULL )
+        {
+            ip_addr_copy( pxLookup->xAddress, *xIPAddr );
+            pxLookup->xFound = true;
+        }
+        else
+        {
+            pxLookup->xFound = false;
+        }
+
+        pxLookup->xDone = true;
+        ( void ) xSemaphoreGive( xDnsDoneSemaphore );
     }
+
+    taskEXIT_CRITICAL();
 }
 /*-----------------------------------------------------------*/
 
-uint32_t prvGetHostByName( const char * pcHostName )
+/*
+ * Resolve a host name to an address of each family in ucDnsAddressTypes.
+ *
+ * The lookups are sent together. Once one answers with an address, the others
+ * get lwipsocketsRESOLUTION_DELAY_MS more, so a slow family does not hold up
+ * the connect.
+ *
+ * Returns true if the host name was resolved into at least one of pxAddresses,
+ * pxFound telling which.
+ */
+static bool prvResolve( const char * pcHostName,
+                        ip_addr_t pxAddresses[ lwipsocketsDNS_LOOKUPS ],
+                        bool pxFound[ lwipsocketsDNS_LOOKUPS ] )
 {
-    uint32_t ulAddr = 0;
+    #if lwipsocketsDUAL_STACK
+        static const u8_t ucDnsAddressTypes[ lwipsocketsDNS_LOOKUPS ] = { LWIP_DNS_ADDRTYPE_IPV6, LWIP_DNS_ADDRTYPE_IPV4 };
+        bool xShortened = false;
+    #else
+        static const u8_t ucDnsAddressTypes[ lwipsocketsDNS_LOOKUPS ] = { LWIP_DNS_ADDRTYPE_IPV4 };
+    #endif
+    bool xAnyFound = false;
+    bool xAllDone;
     err_t xLwipError = ERR_OK;
-    ip_addr_t xLwipIpv4Address;
-    uint32_t ulDnsResolutionWaitCycles = 0;
+    uint32_t ulIndex;
+    uint32_t ulRequestId;
+    TimeOut_t xTimeOut;
+    TickType_t xTicksToWait = lwipdnsresolverMAX_WAIT_TICKS;
+
+    taskENTER_CRITICAL();
+
+    if( xDnsRequestMutex == NULL )
+    {
+        xDnsRequestMutex = xSemaphoreCreateMutexStatic( &xDnsRequestMutexStorage );
+        xDnsDoneSemaphore = xSemaphoreCreateBinaryStatic( &xDnsDoneSemaphoreStorage );
+    }
+
+    taskEXIT_CRITICAL();
+
+    for( ulIndex = 0; ulIndex < lwipsocketsDNS_LOOKUPS; ulIndex++ )
+    {
+        pxFound[ ulIndex ] = false;
+    }
 
     if( strlen( pcHostName ) <= ( size_t ) SOCKETS_MAX_HOST_NAME_LENGTH )
     {
-        xLwipError = dns_gethostbyname_addrtype( pcHostName, &xLwipIpv4Address,
-                                                 lwip_dns_found_callback, ( void * ) &ulAddr,
-                                                 LWIP_DNS_ADDRTYPE_IPV4 );
+        ( void ) xSemaphoreTake( xDnsRequestMutex, portMAX_DELAY );
 
-        switch( xLwipError )
+        /* Drop a completion a timed out lookup may have signalled. */
+        ( void ) xSemaphoreTake( xDnsDoneSemaphore, 0 );
+
+        taskENTER_CRITICAL();
+        ulDnsRequestId += lwipsocketsDNS_LOOKUPS;
+        ulRequestId = ulDnsRequestId;
+
+        for( ulIndex = 0; ulIndex < lwipsocketsDNS_LOOKUPS; ulIndex++ )
         {
-            case ERR_OK:
-                ulAddr = *( ( uint32_t * ) &xLwipIpv4Address ); /* NOTE: IPv4 addresses only */
-                break;
+            xDnsLookups[ ulIndex ].xFound = false;
+            xDnsLookups[ ulIndex ].xDone = false;
+        }
 
-            case ERR_INPROGRESS:
+        taskEXIT_CRITICAL();
 
-                /*
-                 * The DNS resolver is working the request.  Wait for it to complete
-                 * or time out; print a timeout error message if configured for debug
-                 * printing.
-                 */
-                do
+        for( ulIndex = 0; ulIndex < lwipsocketsDNS_LOOKUPS; ulIndex++ )
+        {
+            /* lwIP answers from its TTL bounded host table when it can, so
+             * reconnects to the same host do not wait for the network. It
+             * keeps lookups of the same name for different address types
+             * apart, so they run at the same time. */
+            xLwipError = dns_gethostbyname_addrtype( pcHostName, &( pxAddresses[ ulIndex ] ),
+                                                     lwip_dns_found_callback,
+                                                     ( void * ) ( uintptr_t ) ( ulRequestId + ulIndex ),
+                                                     ucDnsAddressTypes[ ulIndex ] );
+
+            if( xLwipError != ERR_INPROGRESS )
+            {
+                if( xLwipError == ERR_OK )
                 {
-                    vTaskDelay( lwipdnsresolverLOOP_DELAY_TICKS );
-                }   while( ( ulDnsResolutionWaitCycles++ < lwipdnsresolverMAX_WAIT_CYCLES ) && ulAddr == 0 );
+                    pxFound[ ulIndex ] = true;
+                }
+                else
+                {
+                    configPRINTF( ( "Unexpected error (%lu) from dns_gethostbyname_addrtype() while resolving (%s)!",
+                                    ( uint32_t ) xLwipError, pcHostName ) );
+                }
+
+                taskENTER_CRITICAL();
+                xDnsLookups[ ulIndex ].xDone = true;
+                taskEXIT_CRITICAL();
+            }
+        }
+
+        vTaskSetTimeOutState( &xTimeOut );
+
+        /* Wait for the callbacks of the lookups the resolver is working on. */
+        for( ; ; )
+        {
+            xAllDone = true;
 
-                if( ulAddr == 0 )
+            taskENTER_CRITICAL();
+
+            for( ulIndex = 0; ulIndex < lwipsocketsDNS_LOOKUPS; ulIndex++ )
+            {
+                if( xDnsLookups[ ulIndex ].xDone == false )
+                {
+                    xAllDone = false;
+                }
+                else if( xDnsLookups[ ulIndex ].xFound == true )
                 {
-                    configPRINTF( ( "Unable to resolve (%s) within (%lu) seconds",
-                                    pcHostName, lwipdnsresolverMAX_WAIT_SECONDS ) );
+                    ip_addr_copy( pxAddresses[ ulIndex ], xDnsLookups[ ulIndex ].xAddress );
+                    pxFound[ ulIndex ] = true;
                 }
+            }
+
+            taskEXIT_CRITICAL();
+
+            for( ulIndex = 0; ulIndex < lwipsocketsDNS_LOOKUPS; ulIndex++ )
+            {
+                xAnyFound = xAnyFound || pxFound[ ulIndex ];
+            }
 
+            if( xAllDone == true )
+            {
                 break;
+            }
 
-            default:
-                configPRINTF( ( "Unexpected error (%lu) from dns_gethostbyname_addrtype() while resolving (%s)!",
-                                ( uint32_t ) xLwipError, pcHostName ) );
+            #if lwipsocketsDUAL_STACK
+                /* The first answer is there, the others only get a little
+                 * longer. */
+                if( ( xAnyFound == true ) && ( xShortened == false ) )
+                {
+                    xShortened = true;
+                    vTaskSetTimeOutState( &xTimeOut );
+                    xTicksToWait = pdMS_TO_TICKS( lwipsocketsRESOLUTION_DELAY_MS );
+                }
+            #endif
+
+            if( xTaskCheckForTimeOut( &xTimeOut, &xTicksToWait ) != pdFALSE )
+            {
                 break;
+            }
+
+            ( void ) xSemaphoreTake( xDnsDoneSemaphore, xTicksToWait );
         }
+
+        /* Make a late callback for these lookups be ignored. */
+        taskENTER_CRITICAL();
+        ulDnsRequestId += lwipsocketsDNS_LOOKUPS;
+        taskEXIT_CRITICAL();
+
+        if( xAnyFound == false )
+        {
+            configPRINTF( ( "Unable to resolve (%s) within (%lu) seconds",
+                            pcHostName, lwipdnsresolverMAX_WAIT_SECONDS ) );
+        }
+
+        ( void ) xSemaphoreGive( xDnsRequestMutex );
     }
     else
     {
-        ulAddr = 0;
         configPRINTF( ( "Host name (%s) too long!", pcHostName ) );
     }
 
-    return ulAddr;
+    return xAnyFound;
 }
 /*-----------------------------------------------------------*/
 
+#if lwipsocketsDUAL_STACK
+
+/*
+ * Fill an IPv6 socket address for a resolved address. IPv4 addresses are
+ * IPv4-mapped, which lwIP dual-stack sockets connect to over IPv4.
+ */
+    static void prvToSockAddr6( const ip_addr_t * pxAddress,
+                                uint16_t usPort,
+                                struct sockaddr_in6 * pxSockAddr )
+    {
+        ip6_addr_t xIp6Address;
+
+        memset( pxSockAddr, 0, sizeof( *pxSockAddr ) );
+        pxSockAddr->sin6_len = ( u8_t ) sizeof( *pxSockAddr );
+        pxSockAddr->sin6_family = AF_INET6;
+        pxSockAddr->sin6_port = lwip_htons( usPort );
+
+        if( IP_IS_V6( pxAddress ) )
+        {
+            ip6_addr_copy( xIp6Address, *ip_2_ip6( pxAddress ) );
+        }
+        else
+        {
+            ip4_2_ipv4_mapped_ipv6( &xIp6Address, ip_2_ip4( pxAddress ) );
+        }
+
+        inet6_addr_from_ip6addr( &( pxSockAddr->sin6_addr ), &xIp6Address );
+    }
+/*-----------------------------------------------------------*/
+
+/*
+ * Start a non-blocking connect on a socket.
+ *
+ * Returns 1 if connected, 0 if in progress and -1 on failure.
+ */
+    static int prvStartConnect( int lFd,
+                                const struct sockaddr_in6 * pxSockAddr )
+    {
+        if( lwip_fcntl( lFd, F_SETFL, O_NONBLOCK ) != 0 )
+        {
+            return -1;
+        }
+
+        if( lwip_connect( lFd, ( const struct sockaddr * ) pxSockAddr, sizeof( *pxSockAddr ) ) == 0 )
+        {
+            return 1;
+        }
+
+        return ( errno == EINPROGRESS ) ? 0 : -1;
+    }
+/*-----------------------------------------------------------*/
+
+/*
+ * Wait for the pending connect attempts to complete.
+ *
+ * Attempts that fail are removed by setting their descriptor to -1. Returns the
+ * index of the first attempt to connect, or -1 if none did within xTimeout.
+ */
+    static int prvWaitConnect( int * plFds,
+                               int lCount,
+                               TickType_t xTimeout )
+    {
+        TickType_t xTimeOnEntering = xTaskGetTickCount();
+        TickType_t xElapsed = 0;
+        fd_set xWriteSet;
+        fd_set xErrorSet;
+        struct timeval xTimeValue;
+        int lMaxFd;
+        int lIndex;
+        int lError;
+        socklen_t xErrorLength;
+
+        while( xElapsed < xTimeout )
+        {
+            FD_ZERO( &xWriteSet );
+            FD_ZERO( &xErrorSet );
+            lMaxFd = -1;
+
+            for( lIndex = 0; lIndex < lCount; lIndex++ )
+            {
+                if( plFds[ lIndex ] >= 0 )
+                {
+                    FD_SET( plFds[ lIndex ], &xWriteSet );
+                    FD_SET( plFds[ lIndex ], &xErrorSet );
+                    lMaxFd = ( plFds[ lIndex ] > lMaxFd ) ? plFds[ lIndex ] : lMaxFd;
+                }
+            }
+
+            if( lMaxFd < 0 )
+            {
+                break;
+            }
+
+            xTimeValue.tv_sec = TICK_TO_S( xTimeout - xElapsed );
+            xTimeValue.tv_usec = TICK_TO_US( ( xTimeout - xElapsed ) % configTICK_RATE_HZ );
+
+            if( lwip_select( lMaxFd + 1, NULL, &xWriteSet, &xErrorSet, &xTimeValue ) < 0 )
+            {
+                break;
+            }
+
+            for( lIndex = 0; lIndex < lCount; lIndex++ )
+            {
+                if( ( plFds[ lIndex ] >= 0 ) &&
+                    ( FD_ISSET( plFds[ lIndex ], &xWriteSet ) || FD_ISSET( plFds[ lIndex ], &xErrorSet ) ) )
+                {
+                    lError = 0;
+                    xErrorLength = sizeof( lError );
+
+                    if( ( lwip_getsockopt( plFds[ lIndex ], SOL_SOCKET, SO_ERROR, &lError, &xErrorLength ) == 0 ) &&
+                        ( lError == 0 ) )
+                    {
+                        return lIndex;
+                    }
+
+                    /* This candidate failed, keep waiting for the others. */
+                    plFds[ lIndex ] = -1;
+                }
+            }
+
+            xElapsed = xTaskGetTickCount() - xTimeOnEntering;
+        }
+
+        return -1;
+    }
+/*-----------------------------------------------------------*/
+
+/*
+ * Give a new descriptor the socket options set on the one it replaces.
+ */
+    static void prvCopySocketOptions( int lFromFd,
+                                      int lToFd )
+    {
+        static const int lIntOptions[][ 2 ] =
+        {
+            { IPPROTO_TCP, TCP_NODELAY  },
+            { SOL_SOCKET,  SO_KEEPALIVE },
+            #if LWIP_TCP_KEEPALIVE
+                { IPPROTO_TCP, TCP_KEEPIDLE  },
+                { IPPROTO_TCP, TCP_KEEPINTVL },
+                { IPPROTO_TCP, TCP_KEEPCNT   },
+            #endif
+            #if LWIP_SO_RCVBUF
+                { SOL_SOCKET,  SO_RCVBUF    },
+            #endif
+        };
+        struct timeval xTimeValue;
+        socklen_t xLength;
+        size_t xIndex;
+        int lValue;
+
+        for( xIndex = 0; xIndex < sizeof( lIntOptions ) / sizeof( lIntOptions[ 0 ] ); xIndex++ )
+        {
+            xLength = sizeof( lValue );
+
+            if( lwip_getsockopt( lFromFd, lIntOptions[ xIndex ][ 0 ], lIntOptions[ xIndex ][ 1 ], &lValue, &xLength ) == 0 )
+            {
+                ( void ) lwip_setsockopt( lToFd, lIntOptions[ xIndex ][ 0 ], lIntOptions[ xIndex ][ 1 ], &lValue, xLength );
+            }
+        }
+
+        xLength = sizeof( xTimeValue );
+
+        if( lwip_getsockopt( lFromFd, SOL_SOCKET, SO_RCVTIMEO, &xTimeValue, &xLength ) == 0 )
+        {
+            ( void ) lwip_setsockopt( lToFd, SOL_SOCKET, SO_RCVTIMEO, &xTimeValue, xLength );
+        }
+
+        xLength = sizeof( xTimeValue );
+
+        if( lwip_getsockopt( lFromFd, SOL_SOCKET, SO_SNDTIMEO, &xTimeValue, &xLength ) == 0 )
+        {
+            ( void ) lwip_setsockopt( lToFd, SOL_SOCKET, SO_SNDTIMEO, &xTimeValue, xLength );
+        }
+    }
+/*-----------------------------------------------------------*/
+
+/*
+ * Connect a socket handle to the first reachable candidate address.
+ *
+ * The IPv6 candidate is tried first; the IPv4 candidate is started once the
+ * IPv6 attempt has failed or had lwipsocketsCONNECTION_ATTEMPT_DELAY_MS to
+ * complete. The first connection to complete is kept.
+ */
+    static BaseType_t prvConnectRace( SocketHandle xSocket,
+                                      const ip_addr_t * pxIpv6Address,
+                                      const ip_addr_t * pxIpv4Address,
+                                      uint16_t usPort )
+    {
+        LwipSocket_t * pxSocket = &( xLwipSockets[ ( uint32_t ) xSocket ] );
+        struct sockaddr_in6 xSockAddr;
+        const ip_addr_t * pxCandidates[ 2 ];
+        int lFds[ 2 ] = { -1, -1 };
+        int lPending[ 2 ] = { -1, -1 };
+        int lCandidateCount = 0;
+        int lWinner = -1;
+        int lIndex;
+        int lStatus;
+        TickType_t xConnectStart = xTaskGetTickCount();
+        TickType_t xTimeout = pdMS_TO_TICKS( lwipsocketsCONNECT_TIMEOUT_MS );
+        TickType_t xElapsed;
+        TickType_t xWait;
+
+        if( pxIpv6Address != NULL )
+        {
+            pxCandidates[ lCandidateCount++ ] = pxIpv6Address;
+        }
+
+        if( pxIpv4Address != NULL )
+        {
+            pxCandidates[ lCandidateCount++ ] = pxIpv4Address;
+        }
+
+        for( lIndex = 0; lIndex < lCandidateCount; lIndex++ )
+        {
+            /* The first attempt uses the descriptor the handle already owns. */
+            lFds[ lIndex ] = ( lIndex == 0 ) ? pxSocket->lFd :
+                             lwip_socket( AF_INET6, SOCK_STREAM, IP_PROTO_TCP );
+
+            if( lFds[ lIndex ] >= 0 )
+            {
+                prvToSockAddr6( pxCandidates[ lIndex ], usPort, &xSockAddr );
+                lStatus = prvStartConnect( lFds[ lIndex ], &xSockAddr );
+
+                if( lStatus > 0 )
+                {
+                    lWinner = lIndex;
+                    break;
+                }
+                else if( lStatus == 0 )
+                {
+                    lPending[ lIndex ] = lFds[ lIndex ];
+                }
+            }
+
+            xElapsed = xTaskGetTickCount() - xConnectStart;
+
+            if( xElapsed >= xTimeout )
+            {
+                break;
+            }
+
+            /* Give this attempt a head start before racing the next one; the
+             * last candidate may use the rest of the connect timeout. An
+             * attempt that already failed gives no head start. */
+            xWait = xTimeout - xElapsed;
+
+            if( ( lIndex + 1 < lCandidateCount ) &&
+                ( xWait > pdMS_TO_TICKS( lwipsocketsCONNECTION_ATTEMPT_DELAY_MS ) ) )
+            {
+                xWait = pdMS_TO_TICKS( lwipsocketsCONNECTION_ATTEMPT_DELAY_MS );
+            }
+
+            lWinner = prvWaitConnect( lPending, lIndex + 1, xWait );
+
+            if( lWinner >= 0 )
+            {
+                break;
+            }
+        }
+
+        for( lIndex = 0; lIndex < lCandidateCount; lIndex++ )
+        {
+            if( ( lIndex != lWinner ) && ( lIndex != 0 ) && ( lFds[ lIndex ] >= 0 ) )
+            {
+                ( void ) lwip_close( lFds[ lIndex ] );
+            }
+        }
+
+        if( lWinner < 0 )
+        {
+            return SOCKETS_SOCKET_ERROR;
+        }
+
+        if( lWinner != 0 )
+        {
+            /* The handle takes over the descriptor that connected. */
+            prvCopySocketOptions( pxSocket->lFd, lFds[ lWinner ] );
+            ( void ) lwip_close( pxSocket->lFd );
+            pxSocket->lFd = lFds[ lWinner ];
+        }
+
+        ( void ) lwip_fcntl( pxSocket->lFd, F_SETFL, 0 );
+
+        return SOCKETS_ERROR_NONE;
+    }
+/*-----------------------------------------------------------*/
+#endif /* lwipsocketsDUAL_STACK */
+
 BaseType_t Sockets_Init()
 {
     return SOCKETS_ERROR_NONE;
@@ -141,17 +679,45 @@ BaseType_t Sockets_DeInit()
 
 SocketHandle Sockets_Open()
 {
-    int32_t ulSocketNumber = lwip_socket( AF_INET, SOCK_STREAM, IP_PROTO_TCP );
-    SocketHandle xSocket;
+    SocketHandle xSocket = ( SocketHandle ) SOCKETS_INVALID_SOCKET;
 
-    if( ulSocketNumber < 0 )
-    {
-        xSocket = ( SocketHandle ) SOCKETS_INVALID_SOCKET;
-    }
-    else
-    {
-        xSocket = ( SocketHandle ) ulSocketNumber;
-    }
+    #if lwipsocketsDUAL_STACK
+        uint32_t ulIndex;
+        int lFd;
+
+        /* Dual-stack sockets connect to both IPv6 and IPv4-mapped addresses. */
+        lFd = lwip_socket( AF_INET6, SOCK_STREAM, IP_PROTO_TCP );
+
+        if( lFd >= 0 )
+        {
+            taskENTER_CRITICAL();
+
+            for( ulIndex = 0; ulIndex < lwipsocketsMAX_SOCKETS; ulIndex++ )
+            {
+                if( xLwipSockets[ ulIndex ].ucInUse == 0U )
+                {
+                    xLwipSockets[ ulIndex ].ucInUse = 1;
+                    xLwipSockets[ ulIndex ].lFd = lFd;
+                    xSocket = ( SocketHandle ) ulIndex;
+                    break;
+                }
+            }
+
+            taskEXIT_CRITICAL();
+
+            if( xSocket == ( SocketHandle ) SOCKETS_INVALID_SOCKET )
+            {
+                ( void ) lwip_close( lFd );
+            }
+        }
+    #else /* lwipsocketsDUAL_STACK */
+        int32_t ulSocketNumber = lwip_socket( AF_INET, SOCK_STREAM, IP_PROTO_TCP );
+
+        if( ulSocketNumber >= 0 )
+        {
+            xSocket = ( SocketHandle ) ulSocketNumber;
+        }
+    #endif /* lwipsocketsDUAL_STACK */
 
     return xSocket;
 }
@@ -159,7 +725,22 @@ SocketHandle Sockets_Open()
 
 BaseType_t Sockets_Close( SocketHandle xSocket )
 {
-    return ( BaseType_t ) lwip_close( ( uint32_t ) xSocket );
+    #if lwipsocketsDUAL_STACK
+        LwipSocket_t * pxSocket = &( xLwipSockets[ ( uint32_t ) xSocket ] );
+        BaseType_t xRetVal = SOCKETS_ERROR_NONE;
+
+        if( pxSocket->lFd >= 0 )
+        {
+            xRetVal = ( BaseType_t ) lwip_close( pxSocket->lFd );
+            pxSocket->lFd = -1;
+        }
+
+        pxSocket->ucInUse = 0;
+
+        return xRetVal;
+    #else
+        return ( BaseType_t ) lwip_close( ( uint32_t ) xSocket );
+    #endif
 }
 /*-----------------------------------------------------------*/
 
@@ -167,34 +748,80 @@ BaseType_t Sockets_Connect( SocketHandle xSocket,
                             const char * pcHostName,
                             uint16_t usPort )
 {
-    uint32_t ulSocketNumber = ( uint32_t ) xSocket;
     int32_t lRetVal = SOCKETS_ERROR_NONE;
-    uint32_t ulIPAddres = 0;
-    struct sockaddr_in xSockAddr = { 0 };
+    TickType_t xResolveStart = xTaskGetTickCount();
 
-    if( ( ulIPAddres = prvGetHostByName( pcHostName ) ) == 0 )
-    {
-        lRetVal = SOCKETS_SOCKET_ERROR;
-    }
-    else
-    {
-        xSockAddr.sin_family = AF_INET;
-        xSockAddr.sin_addr.s_addr = ulIPAddres;
-        xSockAddr.sin_port = lwip_htons( usPort );
+    ip_addr_t xAddresses[ lwipsocketsDNS_LOOKUPS ];
+    bool xFound[ lwipsocketsDNS_LOOKUPS ];
 
-        if( lwip_connect( ulSocketNumber, ( struct sockaddr * ) &xSockAddr, sizeof( xSockAddr ) ) < 0 )
+    #if lwipsocketsDUAL_STACK
+        /* Both lookups are usually answered from the lwIP host table on
+         * reconnect. The IPv6 address comes first. */
+        if( prvResolve( pcHostName, xAddresses, xFound ) == false )
         {
+            xLastResolveTime = xTaskGetTickCount() - xResolveStart;
             lRetVal = SOCKETS_SOCKET_ERROR;
         }
+        else
+        {
+            xLastResolveTime = xTaskGetTickCount() - xResolveStart;
+            lRetVal = prvConnectRace( xSocket,
+                                      xFound[ 0 ] ? &( xAddresses[ 0 ] ) : NULL,
+                                      xFound[ 1 ] ? &( xAddresses[ 1 ] ) : NULL,
+                                      usPort );
+        }
+    #else /* lwipsocketsDUAL_STACK */
+        uint32_t ulSocketNumber = ( uint32_t ) xSocket;
+        struct sockaddr_in xSockAddr = { 0 };
+
+        if( prvResolve( pcHostName, xAddresses, xFound ) == false )
+        {
+            xLastResolveTime = xTaskGetTickCount() - xResolveStart;
+            lRetVal = SOCKETS_SOCKET_ERROR;
+        }
+        else
+        {
+            xLastResolveTime = xTaskGetTickCount() - xResolveStart;
+
+            xSockAddr.sin_family = AF_INET;
+            xSockAddr.sin_addr.s_addr = ip4_addr_get_u32( ip_2_ip4( &( xAddresses[ 0 ] ) ) );
+            xSockAddr.sin_port = lwip_htons( usPort );
+
+            if( lwip_connect( ulSocketNumber, ( struct sockaddr * ) &xSockAddr, sizeof( xSockAddr ) ) < 0 )
+            {
+                lRetVal = SOCKETS_SOCKET_ERROR;
+            }
+        }
+    #endif /* lwipsocketsDUAL_STACK */
+
+    if( lRetVal == SOCKETS_ERROR_NONE )
+    {
+        *prvLinkLosses( xSocket ) = Link_Losses();
     }
 
     return lRetVal;
 }
 /*-----------------------------------------------------------*/
 
+TickType_t Sockets_GetLastResolveTime( void )
+{
+    return xLastResolveTime;
+}
+/*-----------------------------------------------------------*/
+
 void Sockets_Disconnect( SocketHandle xSocket )
 {
-    lwip_close( ( uint32_t ) xSocket );
+    #if lwipsocketsDUAL_STACK
+        LwipSocket_t * pxSocket = &( xLwipSockets[ ( uint32_t ) xSocket ] );
+
+        if( pxSocket->lFd >= 0 )
+        {
+            lwip_close( pxSocket->lFd );
+            pxSocket->lFd = -1;
+        }
+    #else
+        lwip_close( ( uint32_t ) xSocket );
+    #endif
 }
 /*-----------------------------------------------------------*/
 
@@ -202,11 +829,19 @@ BaseType_t Sockets_Recv( SocketHandle xSocket,
                          uint8_t * pucReceiveBuffer,
                          size_t xReceiveBufferLength )
 {
-    uint32_t ulSocketNumber = ( uint32_t ) xSocket;
-    int lRetVal = lwip_recv( ulSocketNumber,
-                             pucReceiveBuffer,
-                             xReceiveBufferLength,
-                             0 );
+    int lRetVal;
+
+    if( *prvLinkLosses( xSocket ) != Link_Losses() )
+    {
+        return SOCKETS_SOCKET_ERROR;
+    }
+
+    sampletraceBEGIN( eSampleTraceSocketRecv, xReceiveBufferLength );
+    lRetVal = lwip_recv( prvSocketFd( xSocket ),
+                         pucReceiveBuffer,
+                         xReceiveBufferLength,
+                         0 );
+    sampletraceEND( eSampleTraceSocketRecv, lRetVal );
 
     if( lRetVal == -1 )
     {
@@ -239,14 +874,68 @@ BaseType_t Sockets_Recv( SocketHandle xSocket,
 }
 /*-----------------------------------------------------------*/
 
+BaseType_t Sockets_WaitReadable( SocketHandle xSocket,
+                                 TickType_t xTimeout )
+{
+    int lFd = prvSocketFd( xSocket );
+    fd_set xReadSet;
+    struct timeval xTimeValue;
+    int lRetVal;
+
+    FD_ZERO( &xReadSet );
+    FD_SET( lFd, &xReadSet );
+
+    xTimeValue.tv_sec = TICK_TO_S( xTimeout );
+    xTimeValue.tv_usec = TICK_TO_US( xTimeout % configTICK_RATE_HZ );
+
+    lRetVal = lwip_select( lFd + 1, &xReadSet, NULL, NULL, &xTimeValue );
+
+    if( lRetVal < 0 )
+    {
+        return SOCKETS_SOCKET_ERROR;
+    }
+
+    return ( lRetVal > 0 ) ? 1 : 0;
+}
+/*-----------------------------------------------------------*/
+
+BaseType_t Sockets_RecvAvailable( SocketHandle xSocket )
+{
+    int lAvailable = 0;
+
+    #if LWIP_SO_RCVBUF || LWIP_FIONREAD_LINKEDLIST
+        if( lwip_ioctl( prvSocketFd( xSocket ), FIONREAD, &lAvailable ) != 0 )
+        {
+            lAvailable = 0;
+        }
+    #else
+        /* FIONREAD is not available in this lwIP configuration. */
+        ( void ) xSocket;
+    #endif /* LWIP_SO_RCVBUF || LWIP_FIONREAD_LINKEDLIST */
+
+    return ( BaseType_t ) lAvailable;
+}
+/*-----------------------------------------------------------*/
+
 BaseType_t Sockets_Send( SocketHandle xSocket,
                          const uint8_t * pucData,
                          size_t xDataLength )
 {
-    return ( BaseType_t ) lwip_send( ( uint32_t ) xSocket,
-                                     pucData,
-                                     xDataLength,
-                                     0 );
+    int lRetVal;
+
+    if( *prvLinkLosses( xSocket ) != Link_Losses() )
+    {
+        return SOCKETS_SOCKET_ERROR;
+    }
+
+    sampletraceBEGIN( eSampleTraceSocketSend, xDataLength );
+    lRetVal = lwip_send( prvSocketFd( xSocket ),
+                         pucData,
+                         xDataLength,
+                         0 );
+    sampletraceEND( eSampleTraceSocketSend, lRetVal );
+
+    return ( BaseType_t ) lRetVal;
 }
 /*-----------------------------------------------------------*/
 
@@ -255,7 +944,7 @@ BaseType_t Sockets_SetSockOpt( SocketHandle xSocket,
                                const void * pvOptionValue,
                                size_t xOptionLength )
 {
-    uint32_t ulSocketNumber = ( uint32_t ) xSocket;
+    int lSocketNumber = prvSocketFd( xSocket );
     BaseType_t xRetVal;
     int ulRet = 0;
 
@@ -272,7 +961,7 @@ BaseType_t Sockets_SetSockOpt( SocketHandle xSocket,
                xTV.tv_sec = TICK_TO_S( xTicks );
                xTV.tv_usec = TICK_TO_US( xTicks % configTICK_RATE_HZ );
 
-               ulRet = lwip_setsockopt( ulSocketNumber,
+               ulRet = lwip_setsockopt( lSocketNumber,
                                         SOL_SOCKET,
                                         lOptionName == SOCKETS_SO_RCVTIMEO ?
                                         SO_RCVTIMEO : SO_SNDTIMEO,
@@ -290,6 +979,67 @@ BaseType_t Sockets_SetSockOpt( SocketHandle xSocket,
            }
            break;
 
+        case SOCKETS_SO_NODELAY:
+           {
+               int lNoDelay = ( *( ( const BaseType_t * ) pvOptionValue ) != pdFALSE ) ? 1 : 0;
+
+               ulRet = lwip_setsockopt( lSocketNumber, IPPROTO_TCP, TCP_NODELAY,
+                                        &lNoDelay, sizeof( lNoDelay ) );
+               xRetVal = ( ulRet != 0 ) ? SOCKETS_EINVAL : SOCKETS_ERROR_NONE;
+           }
+           break;
+
+        case SOCKETS_SO_KEEPALIVE:
+           {
+               const SocketsKeepAlive_t * pxKeepAlive = ( const SocketsKeepAlive_t * ) pvOptionValue;
+               int lValue = ( pxKeepAlive->ulIdleSeconds != 0 ) ? 1 : 0;
+
+               ulRet = lwip_setsockopt( lSocketNumber, SOL_SOCKET, SO_KEEPALIVE,
+                                        &lValue, sizeof( lValue ) );
+
+               #if LWIP_TCP_KEEPALIVE
+                   if( ( ulRet == 0 ) && ( lValue != 0 ) )
+                   {
+                       lValue = ( int ) pxKeepAlive->ulIdleSeconds;
+                       ulRet = lwip_setsockopt( lSocketNumber, IPPROTO_TCP, TCP_KEEPIDLE,
+                                                &lValue, sizeof( lValue ) );
+
+                       if( ( ulRet == 0 ) && ( pxKeepAlive->ulIntervalSeconds != 0 ) )
+                       {
+                           lValue = ( int ) pxKeepAlive->ulIntervalSeconds;
+                           ulRet = lwip_setsockopt( lSocketNumber, IPPROTO_TCP, TCP_KEEPINTVL,
+                                                    &lValue, sizeof( lValue ) );
+                       }
+
+                       if( ( ulRet == 0 ) && ( pxKeepAlive->ulProbeCount != 0 ) )
+                       {
+                           lValue = ( int ) pxKeepAlive->ulProbeCount;
+                           ulRet = lwip_setsockopt( lSocketNumber, IPPROTO_TCP, TCP_KEEPCNT,
+                                                    &lValue, sizeof( lValue ) );
+                       }
+                   }
+               #endif /* LWIP_TCP_KEEPALIVE */
+
+               xRetVal = ( ulRet != 0 ) ? SOCKETS_EINVAL : SOCKETS_ERROR_NONE;
+           }
+           break;
+
+        case SOCKETS_SO_RCVBUF:
+            #if LWIP_SO_RCVBUF
+               {
+                   int lBufferSize = ( int ) *( ( const uint32_t * ) pvOptionValue );
+
+                   ulRet = lwip_setsockopt( lSocketNumber, SOL_SOCKET, SO_RCVBUF,
+                                            &lBufferSize, sizeof( lBufferSize ) );
+                   xRetVal = ( ulRet != 0 ) ? SOCKETS_EINVAL : SOCKETS_ERROR_NONE;
+               }
+            #else
+                xRetVal = SOCKETS_ENOPROTOOPT;
+            #endif /* LWIP_SO_RCVBUF */
+            break;
+
+        /* lwIP sizes the send buffer globally with TCP_SND_BUF. */
+        case SOCKETS_SO_SNDBUF:
         default:
             xRetVal = SOCKETS_ENOPROTOOPT;
             break;
@@ -0,0 +1,561 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @file sockets_wrapper_lwip_netconn.c
+ * @brief LWIP socket wrapper on the netconn API.
+ *
+ * An alternative to sockets_wrapper_lwip.c that skips the BSD socket layer of
+ * lwIP: no socket table, select events or locking of the socket on each call.
+ * A receive keeps the pbufs lwIP hands over, and copies out of them until
+ * they are used up. A send is copied into the segments by tcp_write(). With
+ * LWIP_TCPIP_CORE_LOCKING, the netconn calls run the TCP functions under the
+ * core lock, instead of a mailbox round trip into the tcpip thread.
+ *
+ * A connect goes to the first address the resolver returns, without the race
+ * of the address families of sockets_wrapper_lwip.c.
+ */
+
+/* Implements the unimpaired calls when the network is impaired. */
+#define socketswrapperIMPLEMENTATION
+#include "sockets_wrapper.h"
+
+/* Standard includes. */
+#include <string.h>
+
+/* Lwip includes. */
+#include "lwip/api.h"
+#include "lwip/ip.h"
+#include "lwip/pbuf.h"
+#include "lwip/tcp.h"
+#include "lwip/tcpip.h"
+#include "lwip/priv/tcpip_priv.h"
+
+/* FreeRTOS includes. */
+#include "FreeRTOS.h"
+#include "task.h"
+
+/* Trace points of the samples. */
+#include "azure_sample_trace.h"
+
+/* The link of the board, lost connections failing at once. */
+#include "azure_sample_link.h"
+/*-----------------------------------------------------------*/
+
+#if !LWIP_SO_RCVTIMEO
+    #error "The netconn sockets wrapper needs LWIP_SO_RCVTIMEO for its receive timeouts."
+#endif
+
+/*
+ * Number of sockets that can be open at the same time.
+ */
+#ifndef lwipnetconnMAX_SOCKETS
+    #define lwipnetconnMAX_SOCKETS    ( 4 )
+#endif
+
+/*
+ * Convert from system ticks to the milliseconds of the netconn timeouts.
+ */
+#define lwipnetconnTICKS_TO_MS( xTicks )    ( ( int ) ( ( xTicks ) * portTICK_PERIOD_MS ) )
+
+/*
+ * A netconn behind a socket handle, and the options set on the handle, which
+ * are applied once the netconn exists.
+ */
+typedef struct NetconnSocket
+{
+    struct netconn * pxConn;        /* NULL until connected. */
+    struct pbuf * pxRecvData;       /* Received data not returned yet, NULL if none. */
+    uint16_t usRecvOffset;          /* Bytes of pxRecvData already returned. */
+    uint8_t ucInUse;                /* Whether the handle is allocated. */
+    uint8_t ucNoDelay;              /* Whether Nagle is off. */
+    TickType_t xRecvTimeout;        /* 0 blocks. */
+    TickType_t xSendTimeout;        /* 0 blocks. */
+    SocketsKeepAlive_t xKeepAlive;  /* ulIdleSeconds is 0 for no probes. */
+    uint32_t ulReceiveBufferSize;   /* 0 for the default of lwIP. */
+    uint32_t ulLinkLosses;          /* Link_Losses() when connected. */
+} NetconnSocket_t;
+
+/*
+ * The options to apply to the TCP PCB, in the context of the tcpip thread.
+ */
+typedef struct NetconnOptionsCall
+{
+    struct tcpip_api_call_data xCall; /* First, as lwIP passes a pointer to it. */
+    NetconnSocket_t * pxSocket;
+} NetconnOptionsCall_t;
+
+static NetconnSocket_t xNetconnSockets[ lwipnetconnMAX_SOCKETS ];
+
+/*
+ * Duration of the last host name lookup.
+ */
+static TickType_t xLastResolveTime = 0;
+/*-----------------------------------------------------------*/
+
+/*
+ * Set Nagle and the keep alive probes on the PCB of a socket.
+ *
+ * Runs in the tcpip thread, or with the core lock held.
+ */
+static err_t prvApplyOptionsCall( struct tcpip_api_call_data * pxCall )
+{
+    NetconnSocket_t * pxSocket = ( ( NetconnOptionsCall_t * ) pxCall )->pxSocket;
+    struct tcp_pcb * pxPcb = pxSocket->pxConn->pcb.tcp;
+
+    if( pxPcb == NULL )
+    {
+        return ERR_CONN;
+    }
+
+    if( pxSocket->ucNoDelay != 0U )
+    {
+        tcp_nagle_disable( pxPcb );
+    }
+    else
+    {
+        tcp_nagle_enable( pxPcb );
+    }
+
+    if( pxSocket->xKeepAlive.ulIdleSeconds != 0U )
+    {
+        ip_set_option( pxPcb, SOF_KEEPALIVE );
+
+        #if LWIP_TCP_KEEPALIVE
+            pxPcb->keep_idle = pxSocket->xKeepAlive.ulIdleSeconds * 1000U;
+
+            if( pxSocket->xKeepAlive.ulIntervalSeconds != 0U )
+            {
+                pxPcb->keep_intvl = pxSocket->xKeepAlive.ulIntervalSeconds * 1000U;
+            }
+
+            if( pxSocket->xKeepAlive.ulProbeCount != 0U )
+            {
+                pxPcb->keep_cnt = pxSocket->xKeepAlive.ulProbeCount;
+            }
+        #endif /* LWIP_TCP_KEEPALIVE */
+    }
+    else
+    {
+        ip_reset_option( pxPcb, SOF_KEEPALIVE );
+    }
+
+    return ERR_OK;
+}
+/*-----------------------------------------------------------*/
+
+/*
+ * Apply the options of a socket to its netconn.
+ */
+static err_t prvApplyOptions( NetconnSocket_t * pxSocket )
+{
+    NetconnOptionsCall_t xOptionsCall;
+
+    netconn_set_recvtimeout( pxSocket->pxConn, lwipnetconnTICKS_TO_MS( pxSocket->xRecvTimeout ) );
+
+    #if LWIP_SO_SNDTIMEO
+        netconn_set_sendtimeout( pxSocket->pxConn, lwipnetconnTICKS_TO_MS( pxSocket->xSendTimeout ) );
+    #endif
+
+    #if LWIP_SO_RCVBUF
+        if( pxSocket->ulReceiveBufferSize != 0U )
+        {
+            netconn_set_recvbufsize( pxSocket->pxConn, ( int ) pxSocket->ulReceiveBufferSize );
+        }
+    #endif
+
+    xOptionsCall.pxSocket = pxSocket;
+
+    /* Posted to the tcpip thread, or called with the core lock held. */
+    return tcpip_api_call( prvApplyOptionsCall, &( xOptionsCall.xCall ) );
+}
+/*-----------------------------------------------------------*/
+
+/*
+ * Take the next pbuf of the connection as the received data of the socket.
+ *
+ * Returns 1 if data was taken, 0 if the receive timed out, or nothing is
+ * queued with NETCONN_DONTBLOCK, and a negative error otherwise.
+ */
+static BaseType_t prvFetch( NetconnSocket_t * pxSocket,
+                            u8_t ucFlags )
+{
+    struct pbuf * pxData = NULL;
+    err_t xError;
+
+    xError = netconn_recv_tcp_pbuf_flags( pxSocket->pxConn, &pxData, ucFlags );
+
+    if( xError == ERR_OK )
+    {
+        pxSocket->pxRecvData = pxData;
+        pxSocket->usRecvOffset = 0;
+        return 1;
+    }
+
+    if( ( xError == ERR_TIMEOUT ) || ( xError == ERR_WOULDBLOCK ) )
+    {
+        return 0;
+    }
+
+    return ( xError == ERR_CLSD ) ? SOCKETS_ECLOSED : SOCKETS_SOCKET_ERROR;
+}
+/*-----------------------------------------------------------*/
+
+/*
+ * Mark received data of the socket as used, freeing its pbuf once all of it is.
+ */
+static void prvConsume( NetconnSocket_t * pxSocket,
+                        uint16_t usLength )
+{
+    pxSocket->usRecvOffset += usLength;
+
+    if( pxSocket->usRecvOffset >= pxSocket->pxRecvData->tot_len )
+    {
+        ( void ) pbuf_free( pxSocket->pxRecvData );
+        pxSocket->pxRecvData = NULL;
+        pxSocket->usRecvOffset = 0;
+    }
+}
+/*-----------------------------------------------------------*/
+
+BaseType_t Sockets_Init()
+{
+    return SOCKETS_ERROR_NONE;
+}
+/*-----------------------------------------------------------*/
+
+BaseType_t Sockets_DeInit()
+{
+    return SOCKETS_ERROR_NONE;
+}
+/*-----------------------------------------------------------*/
+
+SocketHandle Sockets_Open()
+{
+    SocketHandle xSocket = ( SocketHandle ) SOCKETS_INVALID_SOCKET;
+    uint32_t ulIndex;
+
+    taskENTER_CRITICAL();
+
+    for( ulIndex = 0; ulIndex < lwipnetconnMAX_SOCKETS; ulIndex++ )
+    {
+        if( xNetconnSockets[ ulIndex ].ucInUse == 0U )
+        {
+            memset( &( xNetconnSockets[ ulIndex ] ), 0, sizeof( xNetconnSockets[ ulIndex ] ) );
+            xNetconnSockets[ ulIndex ].ucInUse = 1;
+            xSocket = ( SocketHandle ) ulIndex;
+            break;
+        }
+    }
+
+    taskEXIT_CRITICAL();
+
+    return xSocket;
+}
+/*-----------------------------------------------------------*/
+
+BaseType_t Sockets_Close( SocketHandle xSocket )
+{
+    NetconnSocket_t * pxSocket = &( xNetconnSockets[ ( uint32_t ) xSocket ] );
+
+    Sockets_Disconnect( xSocket );
+    pxSocket->ucInUse = 0;
+
+    return SOCKETS_ERROR_NONE;
+}
+/*-----------------------------------------------------------*/
+
+BaseType_t Sockets_Connect( SocketHandle xSocket,
+                            const char * pcHostName,
+                            uint16_t usPort )
+{
+    NetconnSocket_t * pxSocket = &( xNetconnSockets[ ( uint32_t ) xSocket ] );
+    TickType_t xResolveStart = xTaskGetTickCount();
+    enum netconn_type xType = NETCONN_TCP;
+    ip_addr_t xAddress;
+    err_t xError;
+
+    if( strlen( pcHostName ) > ( size_t ) SOCKETS_MAX_HOST_NAME_LENGTH )
+    {
+        configPRINTF( ( "Host name (%s) too long!", pcHostName ) );
+        return SOCKETS_EINVAL;
+    }
+
+    /* Thread safe, and answered from the host table of lwIP when it can. */
+    xError = netconn_gethostbyname( pcHostName, &xAddress );
+    xLastResolveTime = xTaskGetTickCount() - xResolveStart;
+
+    if( xError != ERR_OK )
+    {
+        configPRINTF( ( "Unable to resolve (%s), error (%d)", pcHostName, ( int ) xError ) );
+        return SOCKETS_SOCKET_ERROR;
+    }
+
+    #if LWIP_IPV6
+        if( IP_IS_V6( &xAddress ) )
+        {
+            xType = NETCONN_TCP_IPV6;
+        }
+    #endif
+
+    if( ( pxSocket->pxConn = netconn_new( xType ) ) == NULL )
+    {
+        return SOCKETS_ENOMEM;
+    }
+
+    xError = netconn_connect( pxSocket->pxConn, &xAddress, usPort );
+
+    if( xError == ERR_OK )
+    {
+        xError = prvApplyOptions( pxSocket );
+    }
+
+    if( xError != ERR_OK )
+    {
+        ( void ) netconn_delete( pxSocket->pxConn );
+        pxSocket->pxConn = NULL;
+        return SOCKETS_SOCKET_ERROR;
+    }
+
+    pxSocket->ulLinkLosses = Link_Losses();
+
+    return SOCKETS_ERROR_NONE;
+}
+/*-----------------------------------------------------------*/
+
+TickType_t Sockets_GetLastResolveTime( void )
+{
+    return xLastResolveTime;
+}
+/*-----------------------------------------------------------*/
+
+void Sockets_Disconnect( SocketHandle xSocket )
+{
+    NetconnSocket_t * pxSocket = &( xNetconnSockets[ ( uint32_t ) xSocket ] );
+
+    if( pxSocket->pxRecvData != NULL )
+    {
+        ( void ) pbuf_free( pxSocket->pxRecvData );
+        pxSocket->pxRecvData = NULL;
+    }
+
+    if( pxSocket->pxConn != NULL )
+    {
+        ( void ) netconn_delete( pxSocket->pxConn );
+        pxSocket->pxConn = NULL;
+    }
+}
+/*-----------------------------------------------------------*/
+
+BaseType_t Sockets_Recv( SocketHandle xSocket,
+                         uint8_t * pucReceiveBuffer,
+                         size_t xReceiveBufferLength )
+{
+    NetconnSocket_t * pxSocket = &( xNetconnSockets[ ( uint32_t ) xSocket ] );
+    BaseType_t xRetVal = 1;
+    size_t xCopied = 0;
+    uint16_t usLength;
+
+    sampletraceBEGIN( eSampleTraceSocketRecv, xReceiveBufferLength );
+
+    if( pxSocket->pxConn == NULL )
+    {
+        xRetVal = SOCKETS_ENOTCONN;
+    }
+    /* lwIP keeps the connection over a lost link until it times out. */
+    else if( pxSocket->ulLinkLosses != Link_Losses() )
+    {
+        xRetVal = SOCKETS_SOCKET_ERROR;
+    }
+    else if( pxSocket->pxRecvData == NULL )
+    {
+        xRetVal = prvFetch( pxSocket, 0 );
+    }
+
+    /* Like lwip_recv(), the pbufs queued after the first are taken without
+     * waiting, while the buffer has room. */
+    while( ( xRetVal > 0 ) && ( xCopied < xReceiveBufferLength ) )
+    {
+        usLength = pxSocket->pxRecvData->tot_len - pxSocket->usRecvOffset;
+
+        if( ( size_t ) usLength > xReceiveBufferLength - xCopied )
+        {
+            usLength = ( uint16_t ) ( xReceiveBufferLength - xCopied );
+        }
+
+        ( void ) pbuf_copy_partial( pxSocket->pxRecvData, &( pucReceiveBuffer[ xCopied ] ),
+                                    usLength, pxSocket->usRecvOffset );
+        xCopied += usLength;
+        prvConsume( pxSocket, usLength );
+
+        if( ( xCopied < xReceiveBufferLength ) && ( pxSocket->pxRecvData == NULL ) )
+        {
+            xRetVal = prvFetch( pxSocket, NETCONN_DONTBLOCK );
+        }
+    }
+
+    /* An error after some data is reported by the next receive. */
+    if( xCopied > 0U )
+    {
+        xRetVal = ( BaseType_t ) xCopied;
+    }
+
+    sampletraceEND( eSampleTraceSocketRecv, xRetVal );
+
+    return xRetVal;
+}
+/*-----------------------------------------------------------*/
+
+BaseType_t Sockets_WaitReadable( SocketHandle xSocket,
+                                 TickType_t xTimeout )
+{
+    NetconnSocket_t * pxSocket = &( xNetconnSockets[ ( uint32_t ) xSocket ] );
+    BaseType_t xRetVal;
+
+    if( pxSocket->pxConn == NULL )
+    {
+        return SOCKETS_ENOTCONN;
+    }
+
+    if( pxSocket->pxRecvData != NULL )
+    {
+        return 1;
+    }
+
+    if( xTimeout == 0U )
+    {
+        return prvFetch( pxSocket, NETCONN_DONTBLOCK );
+    }
+
+    /* The data waited for is kept for the receive that follows. */
+    netconn_set_recvtimeout( pxSocket->pxConn, lwipnetconnTICKS_TO_MS( xTimeout ) );
+    xRetVal = prvFetch( pxSocket, 0 );
+    netconn_set_recvtimeout( pxSocket->pxConn, lwipnetconnTICKS_TO_MS( pxSocket->xRecvTimeout ) );
+
+    return xRetVal;
+}
+/*-----------------------------------------------------------*/
+
+BaseType_t Sockets_RecvAvailable( SocketHandle xSocket )
+{
+    NetconnSocket_t * pxSocket = &( xNetconnSockets[ ( uint32_t ) xSocket ] );
+    BaseType_t xAvailable = 0;
+
+    if( pxSocket->pxRecvData != NULL )
+    {
+        xAvailable = ( BaseType_t ) ( pxSocket->pxRecvData->tot_len - pxSocket->usRecvOffset );
+    }
+
+    #if LWIP_SO_RCVBUF
+        if( pxSocket->pxConn != NULL )
+        {
+            int lQueued;
+
+            /* The pbufs still in the receive mailbox. */
+            SYS_ARCH_GET( pxSocket->pxConn->recv_avail, lQueued );
+            xAvailable += ( BaseType_t ) lQueued;
+        }
+    #endif /* LWIP_SO_RCVBUF */
+
+    return xAvailable;
+}
+/*-----------------------------------------------------------*/
+
+BaseType_t Sockets_Send( SocketHandle xSocket,
+                         const uint8_t * pucData,
+                         size_t xDataLength )
+{
+    NetconnSocket_t * pxSocket = &( xNetconnSockets[ ( uint32_t ) xSocket ] );
+    BaseType_t xRetVal;
+    size_t xWritten = 0;
+    err_t xError;
+
+    if( pxSocket->pxConn == NULL )
+    {
+        return SOCKETS_ENOTCONN;
+    }
+
+    if( pxSocket->ulLinkLosses != Link_Losses() )
+    {
+        return SOCKETS_SOCKET_ERROR;
+    }
+
+    sampletraceBEGIN( eSampleTraceSocketSend, xDataLength );
+
+    /* The caller reuses its buffer at once, so tcp_write() copies it. */
+    xError = netconn_write_partly( pxSocket->pxConn, pucData, xDataLength,
+                                   NETCONN_COPY, &xWritten );
+
+    if( ( xError == ERR_OK ) || ( xWritten > 0U ) )
+    {
+        xRetVal = ( BaseType_t ) xWritten;
+    }
+    else if( ( xError == ERR_WOULDBLOCK ) || ( xError == ERR_TIMEOUT ) )
+    {
+        xRetVal = 0;
+    }
+    else
+    {
+        xRetVal = SOCKETS_SOCKET_ERROR;
+    }
+
+    sampletraceEND( eSampleTraceSocketSend, xRetVal );
+
+    return xRetVal;
+}
+/*-----------------------------------------------------------*/
+
+BaseType_t Sockets_SetSockOpt( SocketHandle xSocket,
+                               int32_t lOptionName,
+                               const void * pvOptionValue,
+                               size_t xOptionLength )
+{
+    NetconnSocket_t * pxSocket = &( xNetconnSockets[ ( uint32_t ) xSocket ] );
+    BaseType_t xRetVal = SOCKETS_ERROR_NONE;
+
+    ( void ) xOptionLength;
+
+    switch( lOptionName )
+    {
+        case SOCKETS_SO_RCVTIMEO:
+            pxSocket->xRecvTimeout = *( ( const TickType_t * ) pvOptionValue );
+            break;
+
+        case SOCKETS_SO_SNDTIMEO:
+            /* Without LWIP_SO_SNDTIMEO, a send waits until lwIP has taken the data. */
+            pxSocket->xSendTimeout = *( ( const TickType_t * ) pvOptionValue );
+            break;
+
+        case SOCKETS_SO_NODELAY:
+            pxSocket->ucNoDelay = ( *( ( const BaseType_t * ) pvOptionValue ) != pdFALSE ) ? 1U : 0U;
+            break;
+
+        case SOCKETS_SO_KEEPALIVE:
+            pxSocket->xKeepAlive = *( ( const SocketsKeepAlive_t * ) pvOptionValue );
+            break;
+
+        case SOCKETS_SO_RCVBUF:
+            #if LWIP_SO_RCVBUF
+                pxSocket->ulReceiveBufferSize = *( ( const uint32_t * ) pvOptionValue );
+            #else
+                xRetVal = SOCKETS_ENOPROTOOPT;
+            #endif /* LWIP_SO_RCVBUF */
+            break;
+
+        /* lwIP sizes the send buffer globally with TCP_SND_BUF. */
+        case SOCKETS_SO_SNDBUF:
+        default:
+            xRetVal = SOCKETS_ENOPROTOOPT;
+            break;
+    }
+
+    /* Before the connect, the options wait for the netconn. */
+    if( ( xRetVal == SOCKETS_ERROR_NONE ) && ( pxSocket->pxConn != NULL ) &&
+        ( prvApplyOptions( pxSocket ) != ERR_OK ) )
+    {
+        xRetVal = SOCKETS_EINVAL;
+    }
+
+    return xRetVal;
+}
+/*-----------------------------------------------------------*/
@@ -0,0 +1,512 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @file sockets_wrapper_posix.c
+ * @brief Sockets wrapper on the sockets of the host, for the linux port.
+ *
+ * Connects through the network stack of the host instead of FreeRTOS+TCP over
+ * libpcap, so the samples need neither root nor a pcap-capable interface, and
+ * run at the speed of the host.
+ *
+ * Each task of the simulator is a thread, and a thread blocked in a system
+ * call keeps the scheduler from running the other tasks. The sockets are
+ * therefore non-blocking, and a task waiting on one polls it, sleeping for
+ * posixsocketsPOLL_INTERVAL_MS between polls. Only the host name lookup
+ * blocks.
+ */
+
+/* Implements the unimpaired calls when the network is impaired. */
+#define socketswrapperIMPLEMENTATION
+#include "sockets_wrapper.h"
+
+/* Standard includes. */
+#include <errno.h>
+#include <netdb.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+
+/* FreeRTOS includes. */
+#include "FreeRTOS.h"
+#include "task.h"
+
+/* Trace points of the samples. */
+#include "azure_sample_trace.h"
+/*-----------------------------------------------------------*/
+
+/*
+ * Time a task waiting on a socket sleeps between polls.
+ */
+#ifndef posixsocketsPOLL_INTERVAL_MS
+    #define posixsocketsPOLL_INTERVAL_MS    ( 1U )
+#endif
+
+/*
+ * Time allowed for the TCP handshake.
+ */
+#ifndef posixsocketsCONNECT_TIMEOUT_MS
+    #define posixsocketsCONNECT_TIMEOUT_MS    ( 20000U )
+#endif
+
+/*
+ * A socket, with the timeouts the kernel is not asked to apply.
+ */
+typedef struct PosixSocket
+{
+    int lFd;
+    TickType_t xRecvTimeout;
+    TickType_t xSendTimeout;
+} PosixSocket_t;
+
+/* Duration of the last host name lookup. */
+static TickType_t xLastResolveTime = 0;
+/*-----------------------------------------------------------*/
+
+/*
+ * Wait until the socket has one of the events, polling it.
+ *
+ * Errors and hang ups count as events, the next call on the socket then
+ * reports them.
+ *
+ * Returns 1 once an event is there, 0 if the wait timed out.
+ */
+static BaseType_t prvWait( int lFd,
+                           short sEvents,
+                           TickType_t xTimeout )
+{
+    struct pollfd xPollFd;
+    TimeOut_t xTimeOut;
+    TickType_t xPollInterval = pdMS_TO_TICKS( posixsocketsPOLL_INTERVAL_MS );
+    int lResult;
+
+    if( xPollInterval == 0U )
+    {
+        xPollInterval = 1U;
+    }
+
+    vTaskSetTimeOutState( &xTimeOut );
+
+    for( ; ; )
+    {
+        xPollFd.fd = lFd;
+        xPollFd.events = sEvents;
+        xPollFd.revents = 0;
+
+        lResult = poll( &xPollFd, 1, 0 );
+
+        if( lResult > 0 )
+        {
+            return 1;
+        }
+
+        if( ( lResult < 0 ) && ( errno != EINTR ) )
+        {
+            return SOCKETS_SOCKET_ERROR;
+        }
+
+        if( xTaskCheckForTimeOut( &xTimeOut, &xTimeout ) != pdFALSE )
+        {
+            return 0;
+        }
+
+        vTaskDelay( ( xTimeout < xPollInterval ) ? xTimeout : xPollInterval );
+    }
+}
+/*-----------------------------------------------------------*/
+
+/*
+ * Map the errno of a failed call to an error code of the wrapper.
+ */
+static BaseType_t prvError( int lErrno )
+{
+    BaseType_t xRetVal;
+
+    switch( lErrno )
+    {
+        /* EWOULDBLOCK is EAGAIN on Linux. */
+        case EAGAIN:
+            xRetVal = SOCKETS_EWOULDBLOCK;
+            break;
+
+        case ENOMEM:
+        case ENOBUFS:
+            xRetVal = SOCKETS_ENOMEM;
+            break;
+
+        case ENOTCONN:
+            xRetVal = SOCKETS_ENOTCONN;
+            break;
+
+        case EBADF:
+        case EPIPE:
+        case ECONNRESET:
+            xRetVal = SOCKETS_ECLOSED;
+            break;
+
+        default:
+            xRetVal = SOCKETS_SOCKET_ERROR;
+            break;
+    }
+
+    return xRetVal;
+}
+/*-----------------------------------------------------------*/
+
+BaseType_t Sockets_Init()
+{
+    return SOCKETS_ERROR_NONE;
+}
+/*-----------------------------------------------------------*/
+
+BaseType_t Sockets_DeInit()
+{
+    return SOCKETS_ERROR_NONE;
+}
+/*-----------------------------------------------------------*/
+
+SocketHandle Sockets_Open()
+{
+    PosixSocket_t * pxSocket;
+    int lFd;
+
+    lFd = socket( AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_TCP );
+
+    if( lFd < 0 )
+    {
+        return ( SocketHandle ) SOCKETS_INVALID_SOCKET;
+    }
+
+    pxSocket = pvPortMalloc( sizeof( PosixSocket_t ) );
+
+    if( pxSocket == NULL )
+    {
+        ( void ) close( lFd );
+        return ( SocketHandle ) SOCKETS_INVALID_SOCKET;
+    }
+
+    pxSocket->lFd = lFd;
+    pxSocket->xRecvTimeout = portMAX_DELAY;
+    pxSocket->xSendTimeout = portMAX_DELAY;
+
+    return ( SocketHandle ) pxSocket;
+}
+/*-----------------------------------------------------------*/
+
+BaseType_t Sockets_Close( SocketHandle xSocket )
+{
+    PosixSocket_t * pxSocket = ( PosixSocket_t * ) xSocket;
+    BaseType_t xRetVal = SOCKETS_ERROR_NONE;
+
+    if( close( pxSocket->lFd ) != 0 )
+    {
+        xRetVal = prvError( errno );
+    }
+
+    vPortFree( pxSocket );
+
+    return xRetVal;
+}
+/*-----------------------------------------------------------*/
+
+BaseType_t Sockets_Connect( SocketHandle xSocket,
+                            const char * pcHostName,
+                            uint16_t usPort )
+{
+    PosixSocket_t * pxSocket = ( PosixSocket_t * ) xSocket;
+    struct addrinfo xHints = { 0 };
+    struct addrinfo * pxAddresses = NULL;
+    struct sockaddr_in xServerAddress;
+    TickType_t xResolveStart = xTaskGetTickCount();
+    int lError = 0;
+    socklen_t xErrorLength = sizeof( lError );
+    int lResult;
+
+    /* The socket was opened for IPv4. */
+    xHints.ai_family = AF_INET;
+    xHints.ai_socktype = SOCK_STREAM;
+
+    lResult = getaddrinfo( pcHostName, NULL, &xHints, &pxAddresses );
+    xLastResolveTime = xTaskGetTickCount() - xResolveStart;
+
+    if( ( lResult != 0 ) || ( pxAddresses == NULL ) )
+    {
+        return SOCKETS_SOCKET_ERROR;
+    }
+
+    memcpy( &xServerAddress, pxAddresses->ai_addr, sizeof( xServerAddress ) );
+    xServerAddress.sin_port = htons( usPort );
+    freeaddrinfo( pxAddresses );
+
+    if( connect( pxSocket->lFd, ( struct sockaddr * ) &xServerAddress, sizeof( xServerAddress ) ) == 0 )
+    {
+        return SOCKETS_ERROR_NONE;
+    }
+
+    if( errno != EINPROGRESS )
+    {
+        return SOCKETS_SOCKET_ERROR;
+    }
+
+    /* The handshake is done once the socket can be written, its outcome is
+     * in SO_ERROR. */
+    if( ( prvWait( pxSocket->lFd, POLLOUT, pdMS_TO_TICKS( posixsocketsCONNECT_TIMEOUT_MS ) ) != 1 ) ||
+        ( getsockopt( pxSocket->lFd, SOL_SOCKET, SO_ERROR, &lError, &xErrorLength ) != 0 ) ||
+        ( lError != 0 ) )
+    {
+        return SOCKETS_SOCKET_ERROR;
+    }
+
+    return SOCKETS_ERROR_NONE;
+}
+/*-----------------------------------------------------------*/
+
+TickType_t Sockets_GetLastResolveTime( void )
+{
+    return xLastResolveTime;
+}
+/*-----------------------------------------------------------*/
+
+void Sockets_Disconnect( SocketHandle xSocket )
+{
+    PosixSocket_t * pxSocket = ( PosixSocket_t * ) xSocket;
+
+    /* The kernel completes the graceful shutdown after Sockets_Close(), so
+     * there is nothing to wait for. */
+    ( void ) shutdown( pxSocket->lFd, SHUT_RDWR );
+}
+/*-----------------------------------------------------------*/
+
+BaseType_t Sockets_Recv( SocketHandle xSocket,
+                         uint8_t * pucReceiveBuffer,
+                         size_t xReceiveBufferLength )
+{
+    PosixSocket_t * pxSocket = ( PosixSocket_t * ) xSocket;
+    BaseType_t xRetVal;
+    ssize_t xReceived;
+
+    sampletraceBEGIN( eSampleTraceSocketRecv, xReceiveBufferLength );
+
+    xRetVal = prvWait( pxSocket->lFd, POLLIN, pxSocket->xRecvTimeout );
+
+    if( xRetVal == 1 )
+    {
+        xReceived = recv( pxSocket->lFd, pucReceiveBuffer, xReceiveBufferLength, 0 );
+
+        if( xReceived > 0 )
+        {
+            xRetVal = ( BaseType_t ) xReceived;
+        }
+        else if( xReceived == 0 )
+        {
+            /* The peer closed the connection. */
+            xRetVal = SOCKETS_ECLOSED;
+        }
+        else
+        {
+            xRetVal = prvError( errno );
+
+            /* Woken up for nothing, as if the receive timed out. */
+            if( ( xRetVal == SOCKETS_EWOULDBLOCK ) || ( errno == EINTR ) )
+            {
+                xRetVal = 0;
+            }
+        }
+    }
+
+    sampletraceEND( eSampleTraceSocketRecv, xRetVal );
+
+    return xRetVal;
+}
+/*-----------------------------------------------------------*/
+
+BaseType_t Sockets_WaitReadable( SocketHandle xSocket,
+                                 TickType_t xTimeout )
+{
+    return prvWait( ( ( PosixSocket_t * ) xSocket )->lFd, POLLIN, xTimeout );
+}
+/*-----------------------------------------------------------*/
+
+BaseType_t Sockets_RecvAvailable( SocketHandle xSocket )
+{
+    int lAvailable = 0;
+
+    if( ioctl( ( ( PosixSocket_t * ) xSocket )->lFd, FIONREAD, &lAvailable ) != 0 )
+    {
+        lAvailable = 0;
+    }
+
+    return ( BaseType_t ) lAvailable;
+}
+/*-----------------------------------------------------------*/
+
+BaseType_t Sockets_Send( SocketHandle xSocket,
+                         const uint8_t * pucData,
+                         size_t xDataLength )
+{
+    PosixSocket_t * pxSocket = ( PosixSocket_t * ) xSocket;
+    size_t xSent = 0;
+    BaseType_t xRetVal = SOCKETS_ERROR_NONE;
+    BaseType_t xWait;
+    ssize_t xResult;
+    TimeOut_t xTimeOut;
+    TickType_t xTicksLeft = pxSocket->xSendTimeout;
+
+    sampletraceBEGIN( eSampleTraceSocketSend, xDataLength );
+
+    vTaskSetTimeOutState( &xTimeOut );
+
+    /* Like FreeRTOS_send(), queue all of the data unless the send times out. */
+    while( xSent < xDataLength )
+    {
+        /* MSG_NOSIGNAL, a closed connection is an error and no SIGPIPE. */
+        xResult = send( pxSocket->lFd, &pucData[ xSent ], xDataLength - xSent, MSG_NOSIGNAL );
+
+        if( xResult > 0 )
+        {
+            xSent += ( size_t ) xResult;
+            continue;
+        }
+
+        if( ( xResult < 0 ) && ( errno == EINTR ) )
+        {
+            continue;
+        }
+
+        if( ( xResult < 0 ) && ( prvError( errno ) != SOCKETS_EWOULDBLOCK ) )
+        {
+            xRetVal = prvError( errno );
+            break;
+        }
+
+        /* The send buffer is full. */
+        if( xTaskCheckForTimeOut( &xTimeOut, &xTicksLeft ) != pdFALSE )
+        {
+            break;
+        }
+
+        xWait = prvWait( pxSocket->lFd, POLLOUT, xTicksLeft );
+
+        if( xWait < 0 )
+        {
+            xRetVal = xWait;
+            break;
+        }
+    }
+
+    if( xSent > 0U )
+    {
+        xRetVal = ( BaseType_t ) xSent;
+    }
+
+    sampletraceEND( eSampleTraceSocketSend, xRetVal );
+
+    return xRetVal;
+}
+/*-----------------------------------------------------------*/
+
+BaseType_t Sockets_SetSockOpt( SocketHandle xSocket,
+                               int32_t lOptionName,
+                               const void * pvOptionValue,
+                               size_t xOptionLength )
+{
+    PosixSocket_t * pxSocket = ( PosixSocket_t * ) xSocket;
+    BaseType_t xRetVal;
+    int ulRet = 0;
+
+    ( void ) xOptionLength;
+
+    switch( lOptionName )
+    {
+        case SOCKETS_SO_RCVTIMEO:
+        case SOCKETS_SO_SNDTIMEO:
+           {
+               /* Comply with Berkeley standard - a 0 timeout is wait forever.
+                * The timeouts are kept here, as the socket never blocks. */
+               TickType_t xTimeout = *( ( const TickType_t * ) pvOptionValue );
+
+               if( xTimeout == 0U )
+               {
+                   xTimeout = portMAX_DELAY;
+               }
+
+               if( lOptionName == SOCKETS_SO_RCVTIMEO )
+               {
+                   pxSocket->xRecvTimeout = xTimeout;
+               }
+               else
+               {
+                   pxSocket->xSendTimeout = xTimeout;
+               }
+
+               xRetVal = SOCKETS_ERROR_NONE;
+           }
+           break;
+
+        case SOCKETS_SO_NODELAY:
+           {
+               int lNoDelay = ( *( ( const BaseType_t * ) pvOptionValue ) != pdFALSE ) ? 1 : 0;
+
+               ulRet = setsockopt( pxSocket->lFd, IPPROTO_TCP, TCP_NODELAY,
+                                   &lNoDelay, sizeof( lNoDelay ) );
+               xRetVal = ( ulRet != 0 ) ? SOCKETS_EINVAL : SOCKETS_ERROR_NONE;
+           }
+           break;
+
+        case SOCKETS_SO_KEEPALIVE:
+           {
+               const SocketsKeepAlive_t * pxKeepAlive = ( const SocketsKeepAlive_t * ) pvOptionValue;
+               int lValue = ( pxKeepAlive->ulIdleSeconds != 0 ) ? 1 : 0;
+
+               ulRet = setsockopt( pxSocket->lFd, SOL_SOCKET, SO_KEEPALIVE,
+                                   &lValue, sizeof( lValue ) );
+
+               if( ( ulRet == 0 ) && ( lValue != 0 ) )
+               {
+                   lValue = ( int ) pxKeepAlive->ulIdleSeconds;
+                   ulRet = setsockopt( pxSocket->lFd, IPPROTO_TCP, TCP_KEEPIDLE,
+                                       &lValue, sizeof( lValue ) );
+
+                   if( ( ulRet == 0 ) && ( pxKeepAlive->ulIntervalSeconds != 0 ) )
+                   {
+                       lValue = ( int ) pxKeepAlive->ulIntervalSeconds;
+                       ulRet = setsockopt( pxSocket->lFd, IPPROTO_TCP, TCP_KEEPINTVL,
+                                           &lValue, sizeof( lValue ) );
+                   }
+
+                   if( ( ulRet == 0 ) && ( pxKeepAlive->ulProbeCount != 0 ) )
+                   {
+                       lValue = ( int ) pxKeepAlive->ulProbeCount;
+                       ulRet = setsockopt( pxSocket->lFd, IPPROTO_TCP, TCP_KEEPCNT,
+                                           &lValue, sizeof( lValue ) );
+                   }
+               }
+
+               xRetVal = ( ulRet != 0 ) ? SOCKETS_EINVAL : SOCKETS_ERROR_NONE;
+           }
+           break;
+
+        case SOCKETS_SO_SNDBUF:
+        case SOCKETS_SO_RCVBUF:
+           {
+               int lBufferSize = ( int ) *( ( const uint32_t * ) pvOptionValue );
+
+               ulRet = setsockopt( pxSocket->lFd, SOL_SOCKET,
+                                   ( lOptionName == SOCKETS_SO_SNDBUF ) ? SO_SNDBUF : SO_RCVBUF,
+                                   &lBufferSize, sizeof( lBufferSize ) );
+               xRetVal = ( ulRet != 0 ) ? SOCKETS_EINVAL : SOCKETS_ERROR_NONE;
+           }
+           break;
+
+        default:
+            xRetVal = SOCKETS_ENOPROTOOPT;
+            break;
+    }
+
+    return xRetVal;
+}
+/*-----------------------------------------------------------*/
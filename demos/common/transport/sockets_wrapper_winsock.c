@@ -0,0 +1,679 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @file sockets_wrapper_winsock.c
+ * @brief Sockets wrapper on Winsock, for the windows port.
+ *
+ * Connects through the network stack of Windows instead of FreeRTOS+TCP over
+ * WinPCap, so no packet is captured, copied and injected again by the
+ * simulator, and the samples run at the speed of the host.
+ *
+ * Each task of the simulator is a Windows thread that the port suspends and
+ * resumes, and a thread blocked in Winsock keeps the other tasks from running.
+ * The connect, receives and sends are therefore overlapped: a task starts the
+ * operation, then polls its completion, sleeping for
+ * winsocksocketsPOLL_INTERVAL_MS between polls. A receive is kept posted into
+ * a buffer of the socket, which Sockets_Recv() copies out of. Only the host
+ * name lookup blocks.
+ */
+
+/* Winsock2 before the windows.h of the FreeRTOS port. */
+#ifndef WIN32_LEAN_AND_MEAN
+    #define WIN32_LEAN_AND_MEAN
+#endif
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <mswsock.h>
+#include <mstcpip.h>
+
+/* Implements the unimpaired calls when the network is impaired. */
+#define socketswrapperIMPLEMENTATION
+#include "sockets_wrapper.h"
+
+/* Standard includes. */
+#include <string.h>
+
+/* FreeRTOS includes. */
+#include "FreeRTOS.h"
+#include "task.h"
+
+/* Trace points of the samples. */
+#include "azure_sample_trace.h"
+/*-----------------------------------------------------------*/
+
+/*
+ * Time a task waiting on a socket sleeps between polls.
+ */
+#ifndef winsocksocketsPOLL_INTERVAL_MS
+    #define winsocksocketsPOLL_INTERVAL_MS    ( 1U )
+#endif
+
+/*
+ * Time allowed for the TCP handshake.
+ */
+#ifndef winsocksocketsCONNECT_TIMEOUT_MS
+    #define winsocksocketsCONNECT_TIMEOUT_MS    ( 20000U )
+#endif
+
+/*
+ * Size of the buffer the receive of each socket is posted into.
+ */
+#ifndef winsocksocketsRECV_BUFFER_SIZE
+    #define winsocksocketsRECV_BUFFER_SIZE    ( 4096U )
+#endif
+
+/*
+ * A socket, with its overlapped operations and the data received ahead.
+ */
+typedef struct WinsockSocket
+{
+    SOCKET xSocket;
+    TickType_t xRecvTimeout;
+    TickType_t xSendTimeout;
+
+    WSAOVERLAPPED xRecvOverlapped;
+    WSAOVERLAPPED xSendOverlapped;
+    BaseType_t xRecvPending;
+    BaseType_t xRecvError; /* The error of the last receive, reported once its data is consumed. */
+    size_t xRecvStart;
+    size_t xRecvEnd;
+    uint8_t ucRecvBuffer[ winsocksocketsRECV_BUFFER_SIZE ];
+} WinsockSocket_t;
+
+/* Duration of the last host name lookup. */
+static TickType_t xLastResolveTime = 0;
+
+/* Whether WSAStartup() has been called. */
+static BaseType_t xWinsockStarted = pdFALSE;
+
+/* The ConnectEx() of the provider, looked up on the first connect. */
+static LPFN_CONNECTEX pxConnectEx = NULL;
+/*-----------------------------------------------------------*/
+
+/*
+ * Map the error of a failed call to an error code of the wrapper.
+ */
+static BaseType_t prvError( int lError )
+{
+    BaseType_t xRetVal;
+
+    switch( lError )
+    {
+        case WSAEWOULDBLOCK:
+            xRetVal = SOCKETS_EWOULDBLOCK;
+            break;
+
+        case WSAENOBUFS:
+        case WSA_NOT_ENOUGH_MEMORY:
+            xRetVal = SOCKETS_ENOMEM;
+            break;
+
+        case WSAENOTCONN:
+            xRetVal = SOCKETS_ENOTCONN;
+            break;
+
+        case WSAENOTSOCK:
+        case WSAESHUTDOWN:
+        case WSAECONNRESET:
+        case WSAECONNABORTED:
+        case WSAENETRESET:
+            xRetVal = SOCKETS_ECLOSED;
+            break;
+
+        default:
+            xRetVal = SOCKETS_SOCKET_ERROR;
+            break;
+    }
+
+    return xRetVal;
+}
+/*-----------------------------------------------------------*/
+
+static TickType_t prvPollInterval( TickType_t xTicksLeft )
+{
+    TickType_t xPollInterval = pdMS_TO_TICKS( winsocksocketsPOLL_INTERVAL_MS );
+
+    if( xPollInterval == 0U )
+    {
+        xPollInterval = 1U;
+    }
+
+    return ( xTicksLeft < xPollInterval ) ? xTicksLeft : xPollInterval;
+}
+/*-----------------------------------------------------------*/
+
+/*
+ * Wait for an overlapped connect or send to complete, polling it. One that
+ * times out is cancelled, and what it did until then is kept.
+ *
+ * Returns 1 once it completed, 0 if the wait timed out, or an error code.
+ */
+static BaseType_t prvWaitOverlapped( WinsockSocket_t * pxSocket,
+                                     WSAOVERLAPPED * pxOverlapped,
+                                     TickType_t xTimeout,
+                                     DWORD * pulTransferred )
+{
+    TimeOut_t xTimeOut;
+    DWORD ulFlags = 0;
+    int lError;
+
+    vTaskSetTimeOutState( &xTimeOut );
+
+    for( ; ; )
+    {
+        if( WSAGetOverlappedResult( pxSocket->xSocket, pxOverlapped, pulTransferred, FALSE, &ulFlags ) )
+        {
+            return 1;
+        }
+
+        lError = WSAGetLastError();
+
+        if( lError != WSA_IO_INCOMPLETE )
+        {
+            return prvError( lError );
+        }
+
+        if( xTaskCheckForTimeOut( &xTimeOut, &xTimeout ) != pdFALSE )
+        {
+            break;
+        }
+
+        vTaskDelay( prvPollInterval( xTimeout ) );
+    }
+
+    /* The cancellation completes at once, the wait is only for its result. */
+    ( void ) CancelIoEx( ( HANDLE ) pxSocket->xSocket, ( LPOVERLAPPED ) pxOverlapped );
+
+    if( !WSAGetOverlappedResult( pxSocket->xSocket, pxOverlapped, pulTransferred, TRUE, &ulFlags ) )
+    {
+        lError = WSAGetLastError();
+
+        if( lError != WSA_OPERATION_ABORTED )
+        {
+            return prvError( lError );
+        }
+    }
+
+    return 0;
+}
+/*-----------------------------------------------------------*/
+
+/*
+ * Collect the posted receive if it completed, and post the next one once the
+ * data received is consumed.
+ */
+static void prvRecvPoll( WinsockSocket_t * pxSocket )
+{
+    WSABUF xBuffer;
+    DWORD ulReceived = 0;
+    DWORD ulFlags = 0;
+    int lError;
+
+    if( pxSocket->xRecvPending != pdFALSE )
+    {
+        if( WSAGetOverlappedResult( pxSocket->xSocket, &pxSocket->xRecvOverlapped, &ulReceived, FALSE, &ulFlags ) )
+        {
+            pxSocket->xRecvPending = pdFALSE;
+
+            if( ulReceived == 0 )
+            {
+                /* The peer closed the connection. */
+                pxSocket->xRecvError = SOCKETS_ECLOSED;
+            }
+            else
+            {
+                pxSocket->xRecvStart = 0;
+                pxSocket->xRecvEnd = ( size_t ) ulReceived;
+            }
+        }
+        else if( ( lError = WSAGetLastError() ) != WSA_IO_INCOMPLETE )
+        {
+            pxSocket->xRecvPending = pdFALSE;
+            pxSocket->xRecvError = prvError( lError );
+        }
+    }
+
+    if( ( pxSocket->xRecvPending == pdFALSE ) &&
+        ( pxSocket->xRecvStart == pxSocket->xRecvEnd ) &&
+        ( pxSocket->xRecvError == SOCKETS_ERROR_NONE ) )
+    {
+        xBuffer.buf = ( char * ) pxSocket->ucRecvBuffer;
+        xBuffer.len = ( ULONG ) sizeof( pxSocket->ucRecvBuffer );
+        ulFlags = 0;
+        ( void ) WSAResetEvent( pxSocket->xRecvOverlapped.hEvent );
+
+        /* Completed at once or not, the result is collected above. */
+        if( ( WSARecv( pxSocket->xSocket, &xBuffer, 1, NULL, &ulFlags, &pxSocket->xRecvOverlapped, NULL ) == 0 ) ||
+            ( ( lError = WSAGetLastError() ) == WSA_IO_PENDING ) )
+        {
+            pxSocket->xRecvPending = pdTRUE;
+        }
+        else
+        {
+            pxSocket->xRecvError = prvError( lError );
+        }
+    }
+}
+/*-----------------------------------------------------------*/
+
+/*
+ * Wait until received data or an error is there, polling the receive.
+ *
+ * Returns 1 once it is there, 0 if the wait timed out.
+ */
+static BaseType_t prvRecvWait( WinsockSocket_t * pxSocket,
+                               TickType_t xTimeout )
+{
+    TimeOut_t xTimeOut;
+
+    vTaskSetTimeOutState( &xTimeOut );
+
+    for( ; ; )
+    {
+        prvRecvPoll( pxSocket );
+
+        if( ( pxSocket->xRecvStart < pxSocket->xRecvEnd ) ||
+            ( pxSocket->xRecvError != SOCKETS_ERROR_NONE ) )
+        {
+            return 1;
+        }
+
+        if( xTaskCheckForTimeOut( &xTimeOut, &xTimeout ) != pdFALSE )
+        {
+            return 0;
+        }
+
+        vTaskDelay( prvPollInterval( xTimeout ) );
+    }
+}
+/*-----------------------------------------------------------*/
+
+BaseType_t Sockets_Init()
+{
+    WSADATA xWSAData;
+
+    if( xWinsockStarted == pdFALSE )
+    {
+        if( WSAStartup( MAKEWORD( 2, 2 ), &xWSAData ) != 0 )
+        {
+            return SOCKETS_SOCKET_ERROR;
+        }
+
+        xWinsockStarted = pdTRUE;
+    }
+
+    return SOCKETS_ERROR_NONE;
+}
+/*-----------------------------------------------------------*/
+
+BaseType_t Sockets_DeInit()
+{
+    if( xWinsockStarted != pdFALSE )
+    {
+        ( void ) WSACleanup();
+        xWinsockStarted = pdFALSE;
+    }
+
+    return SOCKETS_ERROR_NONE;
+}
+/*-----------------------------------------------------------*/
+
+SocketHandle Sockets_Open()
+{
+    WinsockSocket_t * pxSocket;
+    SOCKET xSocket;
+
+    /* The transports do not call Sockets_Init(). */
+    if( Sockets_Init() != SOCKETS_ERROR_NONE )
+    {
+        return ( SocketHandle ) SOCKETS_INVALID_SOCKET;
+    }
+
+    xSocket = WSASocketW( AF_INET, SOCK_STREAM, IPPROTO_TCP, NULL, 0,
+                          WSA_FLAG_OVERLAPPED | WSA_FLAG_NO_HANDLE_INHERIT );
+
+    if( xSocket == INVALID_SOCKET )
+    {
+        return ( SocketHandle ) SOCKETS_INVALID_SOCKET;
+    }
+
+    pxSocket = pvPortMalloc( sizeof( WinsockSocket_t ) );
+
+    if( pxSocket == NULL )
+    {
+        ( void ) closesocket( xSocket );
+        return ( SocketHandle ) SOCKETS_INVALID_SOCKET;
+    }
+
+    memset( pxSocket, 0, sizeof( WinsockSocket_t ) );
+    pxSocket->xSocket = xSocket;
+    pxSocket->xRecvTimeout = portMAX_DELAY;
+    pxSocket->xSendTimeout = portMAX_DELAY;
+    pxSocket->xRecvOverlapped.hEvent = WSACreateEvent();
+    pxSocket->xSendOverlapped.hEvent = WSACreateEvent();
+
+    if( ( pxSocket->xRecvOverlapped.hEvent == WSA_INVALID_EVENT ) ||
+        ( pxSocket->xSendOverlapped.hEvent == WSA_INVALID_EVENT ) )
+    {
+        ( void ) Sockets_Close( ( SocketHandle ) pxSocket );
+        return ( SocketHandle ) SOCKETS_INVALID_SOCKET;
+    }
+
+    return ( SocketHandle ) pxSocket;
+}
+/*-----------------------------------------------------------*/
+
+BaseType_t Sockets_Close( SocketHandle xSocket )
+{
+    WinsockSocket_t * pxSocket = ( WinsockSocket_t * ) xSocket;
+    BaseType_t xRetVal = SOCKETS_ERROR_NONE;
+    DWORD ulReceived;
+    DWORD ulFlags;
+
+    /* The posted receive writes to the socket until it is cancelled. */
+    if( pxSocket->xRecvPending != pdFALSE )
+    {
+        ( void ) CancelIoEx( ( HANDLE ) pxSocket->xSocket, ( LPOVERLAPPED ) &pxSocket->xRecvOverlapped );
+        ( void ) WSAGetOverlappedResult( pxSocket->xSocket, &pxSocket->xRecvOverlapped, &ulReceived, TRUE, &ulFlags );
+    }
+
+    if( closesocket( pxSocket->xSocket ) != 0 )
+    {
+        xRetVal = prvError( WSAGetLastError() );
+    }
+
+    if( ( pxSocket->xRecvOverlapped.hEvent != NULL ) &&
+        ( pxSocket->xRecvOverlapped.hEvent != WSA_INVALID_EVENT ) )
+    {
+        ( void ) WSACloseEvent( pxSocket->xRecvOverlapped.hEvent );
+    }
+
+    if( ( pxSocket->xSendOverlapped.hEvent != NULL ) &&
+        ( pxSocket->xSendOverlapped.hEvent != WSA_INVALID_EVENT ) )
+    {
+        ( void ) WSACloseEvent( pxSocket->xSendOverlapped.hEvent );
+    }
+
+    vPortFree( pxSocket );
+
+    return xRetVal;
+}
+/*-----------------------------------------------------------*/
+
+BaseType_t Sockets_Connect( SocketHandle xSocket,
+                            const char * pcHostName,
+                            uint16_t usPort )
+{
+    WinsockSocket_t * pxSocket = ( WinsockSocket_t * ) xSocket;
+    struct addrinfo xHints = { 0 };
+    struct addrinfo * pxAddresses = NULL;
+    struct sockaddr_in xServerAddress;
+    struct sockaddr_in xLocalAddress = { 0 };
+    GUID xConnectExGuid = WSAID_CONNECTEX;
+    TickType_t xResolveStart = xTaskGetTickCount();
+    DWORD ulBytes = 0;
+    BaseType_t xRetVal;
+    int lResult;
+
+    /* The socket was opened for IPv4. */
+    xHints.ai_family = AF_INET;
+    xHints.ai_socktype = SOCK_STREAM;
+
+    lResult = getaddrinfo( pcHostName, NULL, &xHints, &pxAddresses );
+    xLastResolveTime = xTaskGetTickCount() - xResolveStart;
+
+    if( ( lResult != 0 ) || ( pxAddresses == NULL ) )
+    {
+        return SOCKETS_SOCKET_ERROR;
+    }
+
+    memcpy( &xServerAddress, pxAddresses->ai_addr, sizeof( xServerAddress ) );
+    xServerAddress.sin_port = htons( usPort );
+    freeaddrinfo( pxAddresses );
+
+    if( ( pxConnectEx == NULL ) &&
+        ( WSAIoctl( pxSocket->xSocket, SIO_GET_EXTENSION_FUNCTION_POINTER,
+                    &xConnectExGuid, sizeof( xConnectExGuid ),
+                    &pxConnectEx, sizeof( pxConnectEx ),
+                    &ulBytes, NULL, NULL ) != 0 ) )
+    {
+        pxConnectEx = NULL;
+        return SOCKETS_SOCKET_ERROR;
+    }
+
+    /* ConnectEx() only takes a bound socket. */
+    xLocalAddress.sin_family = AF_INET;
+    xLocalAddress.sin_addr.s_addr = htonl( INADDR_ANY );
+
+    if( bind( pxSocket->xSocket, ( struct sockaddr * ) &xLocalAddress, sizeof( xLocalAddress ) ) != 0 )
+    {
+        return prvError( WSAGetLastError() );
+    }
+
+    ( void ) WSAResetEvent( pxSocket->xSendOverlapped.hEvent );
+
+    if( !pxConnectEx( pxSocket->xSocket, ( struct sockaddr * ) &xServerAddress, sizeof( xServerAddress ),
+                      NULL, 0, NULL, ( LPOVERLAPPED ) &pxSocket->xSendOverlapped ) &&
+        ( WSAGetLastError() != ERROR_IO_PENDING ) )
+    {
+        return SOCKETS_SOCKET_ERROR;
+    }
+
+    xRetVal = prvWaitOverlapped( pxSocket, &pxSocket->xSendOverlapped,
+                                 pdMS_TO_TICKS( winsocksocketsCONNECT_TIMEOUT_MS ), &ulBytes );
+
+    /* shutdown() and getpeername() need the context of the connect. */
+    if( ( xRetVal != 1 ) ||
+        ( setsockopt( pxSocket->xSocket, SOL_SOCKET, SO_UPDATE_CONNECT_CONTEXT, NULL, 0 ) != 0 ) )
+    {
+        return SOCKETS_SOCKET_ERROR;
+    }
+
+    return SOCKETS_ERROR_NONE;
+}
+/*-----------------------------------------------------------*/
+
+TickType_t Sockets_GetLastResolveTime( void )
+{
+    return xLastResolveTime;
+}
+/*-----------------------------------------------------------*/
+
+void Sockets_Disconnect( SocketHandle xSocket )
+{
+    WinsockSocket_t * pxSocket = ( WinsockSocket_t * ) xSocket;
+
+    /* Windows completes the graceful shutdown after Sockets_Close(), so
+     * there is nothing to wait for. */
+    ( void ) shutdown( pxSocket->xSocket, SD_BOTH );
+}
+/*-----------------------------------------------------------*/
+
+BaseType_t Sockets_Recv( SocketHandle xSocket,
+                         uint8_t * pucReceiveBuffer,
+                         size_t xReceiveBufferLength )
+{
+    WinsockSocket_t * pxSocket = ( WinsockSocket_t * ) xSocket;
+    BaseType_t xRetVal;
+    size_t xLength;
+
+    sampletraceBEGIN( eSampleTraceSocketRecv, xReceiveBufferLength );
+
+    xRetVal = prvRecvWait( pxSocket, pxSocket->xRecvTimeout );
+
+    if( xRetVal == 1 )
+    {
+        xLength = pxSocket->xRecvEnd - pxSocket->xRecvStart;
+
+        if( xLength > 0U )
+        {
+            if( xLength > xReceiveBufferLength )
+            {
+                xLength = xReceiveBufferLength;
+            }
+
+            memcpy( pucReceiveBuffer, &pxSocket->ucRecvBuffer[ pxSocket->xRecvStart ], xLength );
+            pxSocket->xRecvStart += xLength;
+            xRetVal = ( BaseType_t ) xLength;
+
+            /* Post the next receive before the caller comes back for it. */
+            prvRecvPoll( pxSocket );
+        }
+        else
+        {
+            xRetVal = pxSocket->xRecvError;
+        }
+    }
+
+    sampletraceEND( eSampleTraceSocketRecv, xRetVal );
+
+    return xRetVal;
+}
+/*-----------------------------------------------------------*/
+
+BaseType_t Sockets_WaitReadable( SocketHandle xSocket,
+                                 TickType_t xTimeout )
+{
+    return prvRecvWait( ( WinsockSocket_t * ) xSocket, xTimeout );
+}
+/*-----------------------------------------------------------*/
+
+BaseType_t Sockets_RecvAvailable( SocketHandle xSocket )
+{
+    WinsockSocket_t * pxSocket = ( WinsockSocket_t * ) xSocket;
+
+    /* What Windows holds beyond the posted receive is not counted. */
+    prvRecvPoll( pxSocket );
+
+    return ( BaseType_t ) ( pxSocket->xRecvEnd - pxSocket->xRecvStart );
+}
+/*-----------------------------------------------------------*/
+
+BaseType_t Sockets_Send( SocketHandle xSocket,
+                         const uint8_t * pucData,
+                         size_t xDataLength )
+{
+    WinsockSocket_t * pxSocket = ( WinsockSocket_t * ) xSocket;
+    WSABUF xBuffer;
+    DWORD ulSent = 0;
+    BaseType_t xRetVal;
+    int lError;
+
+    sampletraceBEGIN( eSampleTraceSocketSend, xDataLength );
+
+    xBuffer.buf = ( char * ) pucData;
+    xBuffer.len = ( ULONG ) xDataLength;
+    ( void ) WSAResetEvent( pxSocket->xSendOverlapped.hEvent );
+
+    /* Like FreeRTOS_send(), queue all of the data unless the send times out.
+     * An overlapped send only completes once all of it is queued. */
+    if( ( WSASend( pxSocket->xSocket, &xBuffer, 1, NULL, 0, &pxSocket->xSendOverlapped, NULL ) != 0 ) &&
+        ( ( lError = WSAGetLastError() ) != WSA_IO_PENDING ) )
+    {
+        xRetVal = prvError( lError );
+    }
+    else
+    {
+        xRetVal = prvWaitOverlapped( pxSocket, &pxSocket->xSendOverlapped, pxSocket->xSendTimeout, &ulSent );
+
+        if( ( xRetVal >= 0 ) || ( ulSent > 0U ) )
+        {
+            xRetVal = ( BaseType_t ) ulSent;
+        }
+    }
+
+    sampletraceEND( eSampleTraceSocketSend, xRetVal );
+
+    return xRetVal;
+}
+/*-----------------------------------------------------------*/
+
+BaseType_t Sockets_SetSockOpt( SocketHandle xSocket,
+                               int32_t lOptionName,
+                               const void * pvOptionValue,
+                               size_t xOptionLength )
+{
+    WinsockSocket_t * pxSocket = ( WinsockSocket_t * ) xSocket;
+    BaseType_t xRetVal;
+    int ulRet = 0;
+
+    ( void ) xOptionLength;
+
+    switch( lOptionName )
+    {
+        case SOCKETS_SO_RCVTIMEO:
+        case SOCKETS_SO_SNDTIMEO:
+           {
+               /* Comply with Berkeley standard - a 0 timeout is wait forever.
+                * The timeouts are kept here, as the socket never blocks. */
+               TickType_t xTimeout = *( ( const TickType_t * ) pvOptionValue );
+
+               if( xTimeout == 0U )
+               {
+                   xTimeout = portMAX_DELAY;
+               }
+
+               if( lOptionName == SOCKETS_SO_RCVTIMEO )
+               {
+                   pxSocket->xRecvTimeout = xTimeout;
+               }
+               else
+               {
+                   pxSocket->xSendTimeout = xTimeout;
+               }
+
+               xRetVal = SOCKETS_ERROR_NONE;
+           }
+           break;
+
+        case SOCKETS_SO_NODELAY:
+           {
+               BOOL xNoDelay = ( *( ( const BaseType_t * ) pvOptionValue ) != pdFALSE ) ? TRUE : FALSE;
+
+               ulRet = setsockopt( pxSocket->xSocket, IPPROTO_TCP, TCP_NODELAY,
+                                   ( const char * ) &xNoDelay, sizeof( xNoDelay ) );
+               xRetVal = ( ulRet != 0 ) ? SOCKETS_EINVAL : SOCKETS_ERROR_NONE;
+           }
+           break;
+
+        case SOCKETS_SO_KEEPALIVE:
+           {
+               /* Windows sends a fixed number of probes, ulProbeCount is
+                * ignored. */
+               const SocketsKeepAlive_t * pxKeepAlive = ( const SocketsKeepAlive_t * ) pvOptionValue;
+               struct tcp_keepalive xKeepAlive;
+               DWORD ulBytes = 0;
+
+               xKeepAlive.onoff = ( pxKeepAlive->ulIdleSeconds != 0 ) ? 1 : 0;
+               xKeepAlive.keepalivetime = pxKeepAlive->ulIdleSeconds * 1000U;
+               xKeepAlive.keepaliveinterval = ( pxKeepAlive->ulIntervalSeconds != 0 ) ?
+                                              pxKeepAlive->ulIntervalSeconds * 1000U : 1000U;
+
+               ulRet = WSAIoctl( pxSocket->xSocket, SIO_KEEPALIVE_VALS,
+                                 &xKeepAlive, sizeof( xKeepAlive ),
+                                 NULL, 0, &ulBytes, NULL, NULL );
+               xRetVal = ( ulRet != 0 ) ? SOCKETS_EINVAL : SOCKETS_ERROR_NONE;
+           }
+           break;
+
+        case SOCKETS_SO_SNDBUF:
+        case SOCKETS_SO_RCVBUF:
+           {
+               int lBufferSize = ( int ) *( ( const uint32_t * ) pvOptionValue );
+
+               ulRet = setsockopt( pxSocket->xSocket, SOL_SOCKET,
+                                   ( lOptionName == SOCKETS_SO_SNDBUF ) ? SO_SNDBUF : SO_RCVBUF,
+                                   ( const char * ) &lBufferSize, sizeof( lBufferSize ) );
+               xRetVal = ( ulRet != 0 ) ? SOCKETS_EINVAL : SOCKETS_ERROR_NONE;
+           }
+           break;
+
+        default:
+            xRetVal = SOCKETS_ENOPROTOOPT;
+            break;
+    }
+
+    return xRetVal;
+}
+/*-----------------------------------------------------------*/
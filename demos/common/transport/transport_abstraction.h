@@ -9,8 +9,34 @@
 #ifndef TRANSPORT_ABSTRACTION_H
 #define TRANSPORT_ABSTRACTION_H
 
+#include <stddef.h>
+#include <stdint.h>
+
 typedef struct NetworkContext   NetworkContext_t;
 
+/**
+ * @brief Connection statistics collected by a transport.
+ *
+ * Point the pxStats member of the transport parameters at an instance to have
+ * the transport fill it in, or leave it NULL to collect nothing. Timings
+ * describe the last connect; counters accumulate until the application clears
+ * them.
+ */
+typedef struct TransportStats
+{
+    uint32_t ulDnsTimeMs;        /**< @brief Time spent resolving the host name. */
+    uint32_t ulConnectTimeMs;    /**< @brief Time spent establishing the TCP connection, excluding DNS. */
+    uint32_t ulHandshakeTimeMs;  /**< @brief Time spent in the TLS handshake, 0 for plaintext. */
+    uint32_t ulSessionResumed;   /**< @brief 1 if the last TLS handshake resumed a session, 0 for a full handshake. */
+    uint32_t ulBytesSent;        /**< @brief Application bytes sent. */
+    uint32_t ulBytesReceived;    /**< @brief Application bytes received. */
+    uint32_t ulRecordsSent;      /**< @brief TLS records (or socket writes for plaintext) sent. */
+    uint32_t ulRecordsReceived;  /**< @brief TLS records (or socket reads for plaintext) received. */
+    uint32_t ulWantReadRetries;  /**< @brief Reads and handshake steps that had to wait for more data. */
+    uint32_t ulTimeouts;         /**< @brief Sends and receives that timed out and returned 0. */
+    size_t xHandshakePeakHeap;   /**< @brief Largest amount of heap in use by the last TLS handshake. */
+} TransportStats_t;
+
 /* SSL Context Handle */
 typedef void                    * SSLContextHandle;
 
@@ -0,0 +1,473 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+#include "transport_loopback.h"
+
+#include <string.h>
+
+/* Include header that defines log levels. */
+#include "logging_levels.h"
+
+/* Logging configuration for the loopback transport. */
+#ifndef LIBRARY_LOG_NAME
+    #define LIBRARY_LOG_NAME     "LoopbackTransport"
+#endif
+#ifndef LIBRARY_LOG_LEVEL
+    #define LIBRARY_LOG_LEVEL    LOG_ERROR
+#endif
+
+/* Prototype for the function used to print to console on Windows simulator
+ * of FreeRTOS.
+ * The function prints to the console before the network is connected;
+ * then a UDP port after the network has connected. */
+extern void vLoggingPrintf( const char * pcFormatString,
+                            ... );
+
+/* Map the SdkLog macro to the logging function to enable logging
+ * on Windows simulator. */
+#ifndef SdkLog
+    #define SdkLog( message )    vLoggingPrintf message
+#endif
+
+#include "logging_stack.h"
+
+/************ End of logging configuration ****************/
+
+/* MQTT packet types, in the high nibble of the first byte. */
+#define loopbacktransportMQTT_CONNECT        1U
+#define loopbacktransportMQTT_PUBLISH        3U
+#define loopbacktransportMQTT_SUBSCRIBE      8U
+#define loopbacktransportMQTT_UNSUBSCRIBE    10U
+#define loopbacktransportMQTT_PINGREQ        12U
+
+/* States of the packet being received. */
+#define loopbacktransportPACKET_TYPE         0U /* Reading the first byte of the fixed header. */
+#define loopbacktransportPACKET_LENGTH       1U /* Reading the remaining length. */
+#define loopbacktransportPACKET_BODY         2U /* Reading the rest, the first bytes being kept. */
+
+/* Most topic filters answered in one SUBACK. */
+#define loopbacktransportMAX_FILTERS         8U
+
+/* The twin requests of the hub client, and the topics the broker answers them on. */
+#define loopbacktransportTWIN_GET            "$iothub/twin/GET/?$rid="
+#define loopbacktransportTWIN_PATCH          "$iothub/twin/PATCH/properties/reported/?$rid="
+#define loopbacktransportTWIN_GET_RESPONSE   "$iothub/twin/res/200/?$rid="
+#define loopbacktransportTWIN_PATCH_RESPONSE "$iothub/twin/res/204/?$rid="
+#define loopbacktransportTWIN_VERSION        "&$version=2"
+#define loopbacktransportTWIN_DOCUMENT       "{\"desired\":{\"$version\":1},\"reported\":{\"$version\":1}}"
+/*-----------------------------------------------------------*/
+
+/* Each transport defines the same NetworkContext. The user then passes their respective transport */
+/* as pParams for the transport which is defined in the transport header file */
+/* (here it's LoopbackTransportParams_t) */
+struct NetworkContext
+{
+    /* LoopbackTransportParams_t */
+    void * pParams;
+};
+/*-----------------------------------------------------------*/
+
+/* Room for an answer of ulLength bytes at the end of the queue, or NULL. */
+static uint8_t * prvReserve( LoopbackTransportParams_t * pxParams,
+                             uint32_t ulLength )
+{
+    uint8_t * pucAnswer;
+
+    if( ( pxParams->ulRecvEnd + ulLength > sizeof( pxParams->ucRecvBuffer ) ) && ( pxParams->ulRecvStart > 0U ) )
+    {
+        memmove( pxParams->ucRecvBuffer, &pxParams->ucRecvBuffer[ pxParams->ulRecvStart ],
+                 pxParams->ulRecvEnd - pxParams->ulRecvStart );
+        pxParams->ulRecvEnd -= pxParams->ulRecvStart;
+        pxParams->ulRecvStart = 0;
+    }
+
+    if( pxParams->ulRecvEnd + ulLength > sizeof( pxParams->ucRecvBuffer ) )
+    {
+        LogError( ( "No room for an answer of %u bytes, the client is not reading.", ( unsigned ) ulLength ) );
+        return NULL;
+    }
+
+    pucAnswer = &pxParams->ucRecvBuffer[ pxParams->ulRecvEnd ];
+    pxParams->ulRecvEnd += ulLength;
+
+    return pucAnswer;
+}
+/*-----------------------------------------------------------*/
+
+static bool prvQueueAck( LoopbackTransportParams_t * pxParams,
+                         uint8_t ucType,
+                         const uint8_t * pucPacketID )
+{
+    uint8_t * pucAnswer = prvReserve( pxParams, 4U );
+
+    if( pucAnswer == NULL )
+    {
+        return false;
+    }
+
+    pucAnswer[ 0 ] = ucType;
+    pucAnswer[ 1 ] = 2U;
+    pucAnswer[ 2 ] = pucPacketID[ 0 ];
+    pucAnswer[ 3 ] = pucPacketID[ 1 ];
+
+    return true;
+}
+/*-----------------------------------------------------------*/
+
+/* A QoS 0 PUBLISH on the twin topic pcResponse, followed by the request ID
+ * and pcSuffix. */
+static bool prvQueueTwinResponse( LoopbackTransportParams_t * pxParams,
+                                  const char * pcResponse,
+                                  const uint8_t * pucRequestID,
+                                  uint32_t ulRequestIDLength,
+                                  const char * pcSuffix,
+                                  const char * pcPayload )
+{
+    uint32_t ulResponseLength = ( uint32_t ) strlen( pcResponse );
+    uint32_t ulSuffixLength = ( uint32_t ) strlen( pcSuffix );
+    uint32_t ulPayloadLength = ( uint32_t ) strlen( pcPayload );
+    uint32_t ulTopicLength = ulResponseLength + ulRequestIDLength + ulSuffixLength;
+    uint32_t ulRemainingLength = 2U + ulTopicLength + ulPayloadLength;
+    uint32_t ulLengthBytes = ( ulRemainingLength < 128U ) ? 1U : 2U;
+    uint8_t * pucAnswer = prvReserve( pxParams, 1U + ulLengthBytes + ulRemainingLength );
+
+    if( pucAnswer == NULL )
+    {
+        return false;
+    }
+
+    /* Both are below 16384, with the request ID taken from a kept header. */
+    *pucAnswer++ = loopbacktransportMQTT_PUBLISH << 4;
+
+    if( ulLengthBytes == 1U )
+    {
+        *pucAnswer++ = ( uint8_t ) ulRemainingLength;
+    }
+    else
+    {
+        *pucAnswer++ = ( uint8_t ) ( ( ulRemainingLength & 0x7FU ) | 0x80U );
+        *pucAnswer++ = ( uint8_t ) ( ulRemainingLength >> 7 );
+    }
+
+    *pucAnswer++ = ( uint8_t ) ( ulTopicLength >> 8 );
+    *pucAnswer++ = ( uint8_t ) ulTopicLength;
+    memcpy( pucAnswer, pcResponse, ulResponseLength );
+    pucAnswer += ulResponseLength;
+    memcpy( pucAnswer, pucRequestID, ulRequestIDLength );
+    pucAnswer += ulRequestIDLength;
+    memcpy( pucAnswer, pcSuffix, ulSuffixLength );
+    pucAnswer += ulSuffixLength;
+    memcpy( pucAnswer, pcPayload, ulPayloadLength );
+
+    return true;
+}
+/*-----------------------------------------------------------*/
+
+static bool prvTopicStartsWith( const uint8_t * pucTopic,
+                                uint32_t ulTopicLength,
+                                const char * pcPrefix )
+{
+    uint32_t ulPrefixLength = ( uint32_t ) strlen( pcPrefix );
+
+    return ( ulTopicLength >= ulPrefixLength ) && ( memcmp( pucTopic, pcPrefix, ulPrefixLength ) == 0 );
+}
+/*-----------------------------------------------------------*/
+
+static bool prvAnswerPublish( LoopbackTransportParams_t * pxParams )
+{
+    const uint8_t * pucTopic = &pxParams->ucHeader[ 2 ];
+    uint32_t ulTopicLength;
+    uint32_t ulQoS = ( pxParams->ucPacketType >> 1 ) & 0x3U;
+    bool xResult = true;
+
+    pxParams->ulPublishCount++;
+
+    if( pxParams->ulHeaderLength < 2U )
+    {
+        return true;
+    }
+
+    ulTopicLength = ( ( uint32_t ) pxParams->ucHeader[ 0 ] << 8 ) | pxParams->ucHeader[ 1 ];
+
+    if( 2U + ulTopicLength + ( ( ulQoS > 0U ) ? 2U : 0U ) > pxParams->ulHeaderLength )
+    {
+        LogError( ( "Topic of %u bytes not kept, raise loopbacktransportHEADER_SIZE.", ( unsigned ) ulTopicLength ) );
+        return ulQoS == 0U;
+    }
+
+    if( ulQoS == 1U )
+    {
+        xResult = prvQueueAck( pxParams, 0x40U, &pucTopic[ ulTopicLength ] );
+    }
+
+    if( xResult && prvTopicStartsWith( pucTopic, ulTopicLength, loopbacktransportTWIN_GET ) )
+    {
+        xResult = prvQueueTwinResponse( pxParams, loopbacktransportTWIN_GET_RESPONSE,
+                                        &pucTopic[ sizeof( loopbacktransportTWIN_GET ) - 1 ],
+                                        ulTopicLength - ( sizeof( loopbacktransportTWIN_GET ) - 1 ),
+                                        "", loopbacktransportTWIN_DOCUMENT );
+    }
+    else if( xResult && prvTopicStartsWith( pucTopic, ulTopicLength, loopbacktransportTWIN_PATCH ) )
+    {
+        xResult = prvQueueTwinResponse( pxParams, loopbacktransportTWIN_PATCH_RESPONSE,
+                                        &pucTopic[ sizeof( loopbacktransportTWIN_PATCH ) - 1 ],
+                                        ulTopicLength - ( sizeof( loopbacktransportTWIN_PATCH ) - 1 ),
+                                        loopbacktransportTWIN_VERSION, "" );
+    }
+
+    return xResult;
+}
+/*-----------------------------------------------------------*/
+
+/* Grants each filter its QoS, at most 1 as IoT Hub does. */
+static bool prvAnswerSubscribe( LoopbackTransportParams_t * pxParams )
+{
+    uint8_t ucGranted[ loopbacktransportMAX_FILTERS ];
+    uint32_t ulFilters = 0;
+    uint32_t ulOffset = 2;
+    uint32_t ulFilterLength;
+    uint8_t * pucAnswer;
+
+    pxParams->ulSubscribeCount++;
+
+    if( pxParams->ulHeaderLength < 2U )
+    {
+        return true;
+    }
+
+    while( ( ulFilters < loopbacktransportMAX_FILTERS ) && ( ulOffset + 2U <= pxParams->ulHeaderLength ) )
+    {
+        ulFilterLength = ( ( uint32_t ) pxParams->ucHeader[ ulOffset ] << 8 ) | pxParams->ucHeader[ ulOffset + 1U ];
+        ulOffset += 2U + ulFilterLength;
+
+        if( ulOffset >= pxParams->ulHeaderLength )
+        {
+            /* Its options were not kept. */
+            ucGranted[ ulFilters++ ] = 1U;
+            break;
+        }
+
+        ucGranted[ ulFilters++ ] = ( ( pxParams->ucHeader[ ulOffset ] & 0x3U ) > 0U ) ? 1U : 0U;
+        ulOffset++;
+    }
+
+    if( ( pucAnswer = prvReserve( pxParams, 4U + ulFilters ) ) == NULL )
+    {
+        return false;
+    }
+
+    pucAnswer[ 0 ] = 0x90U;
+    pucAnswer[ 1 ] = ( uint8_t ) ( 2U + ulFilters );
+    pucAnswer[ 2 ] = pxParams->ucHeader[ 0 ];
+    pucAnswer[ 3 ] = pxParams->ucHeader[ 1 ];
+    memcpy( &pucAnswer[ 4 ], ucGranted, ulFilters );
+
+    return true;
+}
+/*-----------------------------------------------------------*/
+
+static bool prvAnswer( LoopbackTransportParams_t * pxParams )
+{
+    static const uint8_t ucConnack[] = { 0x20U, 2U, 0U, 0U };
+    uint8_t * pucAnswer;
+
+    switch( pxParams->ucPacketType >> 4 )
+    {
+        case loopbacktransportMQTT_CONNECT:
+
+            if( ( pucAnswer = prvReserve( pxParams, sizeof( ucConnack ) ) ) == NULL )
+            {
+                return false;
+            }
+
+            memcpy( pucAnswer, ucConnack, sizeof( ucConnack ) );
+            return true;
+
+        case loopbacktransportMQTT_PUBLISH:
+            return prvAnswerPublish( pxParams );
+
+        case loopbacktransportMQTT_SUBSCRIBE:
+            return prvAnswerSubscribe( pxParams );
+
+        case loopbacktransportMQTT_UNSUBSCRIBE:
+            return ( pxParams->ulHeaderLength < 2U ) || prvQueueAck( pxParams, 0xB0U, pxParams->ucHeader );
+
+        case loopbacktransportMQTT_PINGREQ:
+            pxParams->ulPingCount++;
+
+            if( ( pucAnswer = prvReserve( pxParams, 2U ) ) == NULL )
+            {
+                return false;
+            }
+
+            pucAnswer[ 0 ] = 0xD0U;
+            pucAnswer[ 1 ] = 0U;
+            return true;
+
+        default:
+            /* DISCONNECT and acknowledgments of the client need no answer. */
+            return true;
+    }
+}
+/*-----------------------------------------------------------*/
+
+void Loopback_Connect( NetworkContext_t * pxNetworkContext )
+{
+    LoopbackTransportParams_t * pxParams = ( LoopbackTransportParams_t * ) pxNetworkContext->pParams;
+
+    pxParams->ulRecvStart = 0;
+    pxParams->ulRecvEnd = 0;
+    pxParams->ucState = loopbacktransportPACKET_TYPE;
+    pxParams->xConnected = true;
+
+    if( pxParams->pxStats != NULL )
+    {
+        pxParams->pxStats->ulDnsTimeMs = 0;
+        pxParams->pxStats->ulConnectTimeMs = 0;
+        pxParams->pxStats->ulHandshakeTimeMs = 0;
+        pxParams->pxStats->ulSessionResumed = 0;
+    }
+}
+/*-----------------------------------------------------------*/
+
+void Loopback_Disconnect( NetworkContext_t * pxNetworkContext )
+{
+    LoopbackTransportParams_t * pxParams = ( LoopbackTransportParams_t * ) pxNetworkContext->pParams;
+
+    pxParams->xConnected = false;
+}
+/*-----------------------------------------------------------*/
+
+int32_t Loopback_Send( NetworkContext_t * pxNetworkContext,
+                       const void * pvBuffer,
+                       size_t xBytesToSend )
+{
+    LoopbackTransportParams_t * pxParams = ( LoopbackTransportParams_t * ) pxNetworkContext->pParams;
+    const uint8_t * pucBytes = ( const uint8_t * ) pvBuffer;
+    uint32_t ulOffset = 0;
+    uint32_t ulLength;
+    uint32_t ulKept;
+    bool xComplete;
+
+    if( !pxParams->xConnected )
+    {
+        return -1;
+    }
+
+    while( ulOffset < xBytesToSend )
+    {
+        xComplete = false;
+
+        if( pxParams->ucState == loopbacktransportPACKET_TYPE )
+        {
+            pxParams->ucPacketType = pucBytes[ ulOffset++ ];
+            pxParams->ulRemainingLength = 0;
+            pxParams->ulLengthShift = 0;
+            pxParams->ucState = loopbacktransportPACKET_LENGTH;
+        }
+        else if( pxParams->ucState == loopbacktransportPACKET_LENGTH )
+        {
+            pxParams->ulRemainingLength |= ( uint32_t ) ( pucBytes[ ulOffset ] & 0x7FU ) << pxParams->ulLengthShift;
+            pxParams->ulLengthShift += 7U;
+
+            if( ( pucBytes[ ulOffset++ ] & 0x80U ) == 0U )
+            {
+                pxParams->ulHeaderLength = 0;
+                pxParams->ulRemainingRead = 0;
+                pxParams->ucState = loopbacktransportPACKET_BODY;
+                xComplete = ( pxParams->ulRemainingLength == 0U );
+            }
+            else if( pxParams->ulLengthShift > 21U )
+            {
+                LogError( ( "Malformed remaining length." ) );
+                return -1;
+            }
+        }
+        else
+        {
+            ulLength = pxParams->ulRemainingLength - pxParams->ulRemainingRead;
+
+            if( ulLength > xBytesToSend - ulOffset )
+            {
+                ulLength = ( uint32_t ) xBytesToSend - ulOffset;
+            }
+
+            ulKept = sizeof( pxParams->ucHeader ) - pxParams->ulHeaderLength;
+
+            if( ulKept > ulLength )
+            {
+                ulKept = ulLength;
+            }
+
+            memcpy( &pxParams->ucHeader[ pxParams->ulHeaderLength ], &pucBytes[ ulOffset ], ulKept );
+            pxParams->ulHeaderLength += ulKept;
+            pxParams->ulRemainingRead += ulLength;
+            ulOffset += ulLength;
+            xComplete = ( pxParams->ulRemainingRead == pxParams->ulRemainingLength );
+        }
+
+        if( xComplete )
+        {
+            pxParams->ucState = loopbacktransportPACKET_TYPE;
+
+            if( !prvAnswer( pxParams ) )
+            {
+                return -1;
+            }
+        }
+    }
+
+    if( pxParams->pxStats != NULL )
+    {
+        pxParams->pxStats->ulBytesSent += ( uint32_t ) xBytesToSend;
+        pxParams->pxStats->ulRecordsSent++;
+    }
+
+    return ( int32_t ) xBytesToSend;
+}
+/*-----------------------------------------------------------*/
+
+int32_t Loopback_Recv( NetworkContext_t * pxNetworkContext,
+                       void * pvBuffer,
+                       size_t xBytesToRecv )
+{
+    LoopbackTransportParams_t * pxParams = ( LoopbackTransportParams_t * ) pxNetworkContext->pParams;
+    uint32_t ulLength;
+
+    if( !pxParams->xConnected )
+    {
+        return -1;
+    }
+
+    ulLength = pxParams->ulRecvEnd - pxParams->ulRecvStart;
+
+    if( ulLength > xBytesToRecv )
+    {
+        ulLength = ( uint32_t ) xBytesToRecv;
+    }
+
+    memcpy( pvBuffer, &pxParams->ucRecvBuffer[ pxParams->ulRecvStart ], ulLength );
+    pxParams->ulRecvStart += ulLength;
+
+    if( pxParams->ulRecvStart == pxParams->ulRecvEnd )
+    {
+        pxParams->ulRecvStart = 0;
+        pxParams->ulRecvEnd = 0;
+    }
+
+    if( pxParams->pxStats != NULL )
+    {
+        if( ulLength > 0U )
+        {
+            pxParams->pxStats->ulBytesReceived += ulLength;
+            pxParams->pxStats->ulRecordsReceived++;
+        }
+        else
+        {
+            pxParams->pxStats->ulTimeouts++;
+        }
+    }
+
+    return ( int32_t ) ulLength;
+}
+/*-----------------------------------------------------------*/
@@ -0,0 +1,110 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @brief In-process transport whose peer is a scripted MQTT broker.
+ *
+ * What the client sends is parsed as MQTT packets, and the broker answers
+ * them the way IoT Hub does: CONNACK, PUBACK for QoS 1 publishes, SUBACK,
+ * UNSUBACK and PINGRESP, and the responses of the twin topics. The answers
+ * are queued, and the client reads them back on its next receive.
+ *
+ * Without a network or TLS, the hub client runs as fast as it can, so the CPU
+ * cost of sending telemetry and of the process loop can be measured on their
+ * own. A broker is used by one task, like a socket.
+ */
+
+#ifndef TRANSPORT_LOOPBACK_H
+#define TRANSPORT_LOOPBACK_H
+
+#include <stdbool.h>
+
+#include "azure_iot_transport_interface.h"
+
+#include "transport_abstraction.h"
+
+/**
+ * @brief Bytes of answers the broker can queue until the client reads them.
+ *
+ * Answers exceeding it fail the send, which then returns -1.
+ */
+#ifndef loopbacktransportRECV_BUFFER_SIZE
+    #define loopbacktransportRECV_BUFFER_SIZE    ( 2048U )
+#endif
+
+/**
+ * @brief Bytes kept of each packet, from its variable header on.
+ *
+ * Enough for the topic and packet ID of a telemetry message with a few
+ * properties, the rest of a packet being skipped.
+ */
+#ifndef loopbacktransportHEADER_SIZE
+    #define loopbacktransportHEADER_SIZE    ( 256U )
+#endif
+
+typedef struct LoopbackTransportParams
+{
+    TransportStats_t * pxStats; /* Optional connection statistics, NULL to disable. */
+
+    /* Packets the broker received, by type. */
+    uint32_t ulPublishCount;
+    uint32_t ulSubscribeCount;
+    uint32_t ulPingCount;
+
+    /* Internal state of the broker. */
+    uint8_t ucRecvBuffer[ loopbacktransportRECV_BUFFER_SIZE ];
+    uint32_t ulRecvStart;
+    uint32_t ulRecvEnd;
+    uint8_t ucHeader[ loopbacktransportHEADER_SIZE ];
+    uint32_t ulHeaderLength;
+    uint32_t ulRemainingLength;
+    uint32_t ulRemainingRead;
+    uint32_t ulLengthShift;
+    uint8_t ucPacketType;
+    uint8_t ucState;
+    bool xConnected;
+} LoopbackTransportParams_t;
+
+/**
+ * @brief Connect to the broker, which forgets what it had queued.
+ *
+ * pxNetworkContext->pParams must point to a #LoopbackTransportParams_t.
+ *
+ * @param[in] pxNetworkContext Pointer to the Network context.
+ */
+void Loopback_Connect( NetworkContext_t * pxNetworkContext );
+
+/**
+ * @brief Disconnect from the broker. Sends and receives then fail.
+ *
+ * @param[in] pxNetworkContext Pointer to the Network context.
+ */
+void Loopback_Disconnect( NetworkContext_t * pxNetworkContext );
+
+/**
+ * @brief Hand bytes to the broker, which answers the packets they complete.
+ *
+ * @param[in] pxNetworkContext Pointer to the Network context.
+ * @param[in] pvBuffer Bytes to send.
+ * @param[in] xBytesToSend Number of bytes to send.
+ * @return Number of bytes sent, or -1 once disconnected or out of room for answers.
+ */
+int32_t Loopback_Send( NetworkContext_t * pxNetworkContext,
+                       const void * pvBuffer,
+                       size_t xBytesToSend );
+
+/**
+ * @brief Read the answers of the broker.
+ *
+ * Does not wait: nothing queued reads as the timeout of a socket.
+ *
+ * @param[in] pxNetworkContext Pointer to the Network context.
+ * @param[out] pvBuffer Buffer to receive into.
+ * @param[in] xBytesToRecv Size of \p pvBuffer.
+ * @return Number of bytes received, 0 when nothing is queued, or -1 once disconnected.
+ */
+int32_t Loopback_Recv( NetworkContext_t * pxNetworkContext,
+                       void * pvBuffer,
+                       size_t xBytesToRecv );
+
+#endif /* TRANSPORT_LOOPBACK_H */
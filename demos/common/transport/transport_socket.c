@@ -31,6 +31,9 @@ extern void vLoggingPrintf( const char * pcFormatString,
 
 /************ End of logging configuration ****************/
 
+#include "FreeRTOS.h"
+#include "task.h"
+
 #include "sockets_wrapper.h"
 
 /* Each transport defines the same NetworkContext. The user then passes their respective transport */
@@ -53,6 +56,8 @@ SocketTransportStatus_t Azure_Socket_Connect( NetworkContext_t * pxNetworkContex
 
     TickType_t xRecvTimeout = pdMS_TO_TICKS( ulReceiveTimeoutMs );
     TickType_t xSendTimeout = pdMS_TO_TICKS( ulSendTimeoutMs );
+    TickType_t xConnectStart = xTaskGetTickCount();
+    TickType_t xResolveTime;
 
     if( ( pxSocketParams->xTCPSocket = Sockets_Open() ) == SOCKETS_INVALID_SOCKET )
     {
@@ -75,6 +80,17 @@ SocketTransportStatus_t Azure_Socket_Connect( NetworkContext_t * pxNetworkContex
         LogError( ( "Failed to set send timeout on socket %d.", xSocketStatus ) );
         xSocketStatus = eSocketTransportInternalError;
     }
+    /* A stack that cannot size the receive buffer keeps its default. */
+    else if( ( pxSocketParams->ulReceiveBufferSize != 0U ) &&
+             ( ( xSocketStatus = Sockets_SetSockOpt( pxSocketParams->xTCPSocket,
+                                                     SOCKETS_SO_RCVBUF,
+                                                     &pxSocketParams->ulReceiveBufferSize,
+                                                     sizeof( pxSocketParams->ulReceiveBufferSize ) ) ) != 0 ) &&
+             ( xSocketStatus != SOCKETS_ENOPROTOOPT ) )
+    {
+        LogError( ( "Failed to set receive buffer size on socket %d.", xSocketStatus ) );
+        xSocketStatus = eSocketTransportInternalError;
+    }
     else if( ( xSocketStatus = Sockets_Connect( pxSocketParams->xTCPSocket,
                                                 pHostName,
                                                 usPort ) ) != 0 )
@@ -87,6 +103,16 @@ SocketTransportStatus_t Azure_Socket_Connect( NetworkContext_t * pxNetworkContex
     else
     {
         xSocketStatus = eSocketTransportSuccess;
+
+        if( pxSocketParams->pxStats != NULL )
+        {
+            xResolveTime = Sockets_GetLastResolveTime();
+            pxSocketParams->pxStats->ulDnsTimeMs = ( uint32_t ) ( xResolveTime * portTICK_PERIOD_MS );
+            pxSocketParams->pxStats->ulConnectTimeMs =
+                ( uint32_t ) ( ( xTaskGetTickCount() - xConnectStart - xResolveTime ) * portTICK_PERIOD_MS );
+            pxSocketParams->pxStats->ulHandshakeTimeMs = 0;
+            pxSocketParams->pxStats->ulSessionResumed = 0;
+        }
     }
 
     return xSocketStatus;
@@ -94,7 +120,14 @@ SocketTransportStatus_t Azure_Socket_Connect( NetworkContext_t * pxNetworkContex
 
 void Azure_Socket_Close( NetworkContext_t * pNetworkContext )
 {
-    ( void ) pNetworkContext;
+    SocketTransportParams_t * pxSocketParams = ( SocketTransportParams_t * ) pNetworkContext->pParams;
+
+    if( pxSocketParams->xTCPSocket != SOCKETS_INVALID_SOCKET )
+    {
+        Sockets_Disconnect( pxSocketParams->xTCPSocket );
+        ( void ) Sockets_Close( pxSocketParams->xTCPSocket );
+        pxSocketParams->xTCPSocket = SOCKETS_INVALID_SOCKET;
+    }
 }
 
 int32_t Azure_Socket_Send( NetworkContext_t * pxNetworkContext,
@@ -102,8 +135,22 @@ int32_t Azure_Socket_Send( NetworkContext_t * pxNetworkContext,
                            size_t xBytesToSend )
 {
     SocketTransportParams_t * pxSocketParams = ( SocketTransportParams_t * ) pxNetworkContext->pParams;
+    int32_t lResult = Sockets_Send( pxSocketParams->xTCPSocket, pvBuffer, xBytesToSend );
+
+    if( pxSocketParams->pxStats != NULL )
+    {
+        if( lResult > 0 )
+        {
+            pxSocketParams->pxStats->ulBytesSent += ( uint32_t ) lResult;
+            pxSocketParams->pxStats->ulRecordsSent++;
+        }
+        else if( lResult == 0 )
+        {
+            pxSocketParams->pxStats->ulTimeouts++;
+        }
+    }
 
-    return Sockets_Send( pxSocketParams->xTCPSocket, pvBuffer, xBytesToSend );
+    return lResult;
 }
 
 int32_t Azure_Socket_Recv( NetworkContext_t * pxNetworkContext,
@@ -111,8 +158,22 @@ int32_t Azure_Socket_Recv( NetworkContext_t * pxNetworkContext,
                            size_t xBytesToRecv )
 {
     SocketTransportParams_t * pxSocketParams = ( SocketTransportParams_t * ) pxNetworkContext->pParams;
+    int32_t lResult = Sockets_Recv( pxSocketParams->xTCPSocket,
+                                    pvBuffer,
+                                    xBytesToRecv );
+
+    if( pxSocketParams->pxStats != NULL )
+    {
+        if( lResult > 0 )
+        {
+            pxSocketParams->pxStats->ulBytesReceived += ( uint32_t ) lResult;
+            pxSocketParams->pxStats->ulRecordsReceived++;
+        }
+        else if( lResult == 0 )
+        {
+            pxSocketParams->pxStats->ulTimeouts++;
+        }
+    }
 
-    return Sockets_Recv( pxSocketParams->xTCPSocket,
-                         pvBuffer,
-                         xBytesToRecv );
+    return lResult;
 }
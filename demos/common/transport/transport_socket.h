@@ -22,6 +22,8 @@ typedef struct SocketTransportParams
 {
     SocketHandle xTCPSocket;
     SocketContextHandle xSocketContext;
+    TransportStats_t * pxStats;   /* Optional connection statistics, NULL to disable. */
+    uint32_t ulReceiveBufferSize; /* Receive buffer/window in bytes, 0 keeps the stack default. */
 } SocketTransportParams_t;
 
 /**
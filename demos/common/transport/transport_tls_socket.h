@@ -14,8 +14,164 @@ typedef struct TlsTransportParams
 {
     SocketHandle xTCPSocket;
     SSLContextHandle xSSLContext;
+    TransportStats_t * pxStats; /* Optional connection statistics, NULL to disable. */
 } TlsTransportParams_t;
 
+/**
+ * @brief Number of statically allocated TLS contexts.
+ *
+ * When non-zero, connections take their SSL context from a fixed pool and
+ * mbedTLS record buffers come from a dedicated static arena instead of the
+ * FreeRTOS heap, unless mbedtlsportRECORD_BUFFER_COUNT sets the arena apart.
+ * The board configs then leave out MBEDTLS_SSL_VARIABLE_BUFFER_LENGTH, so the
+ * record buffers keep their slots instead of being resized on the heap. The
+ * other, short-lived, mbedTLS allocations are served as the allocator of
+ * mbedtls_freertos_port.c is set up. 0 allocates both from the heap on every
+ * connect.
+ */
+#ifndef transporttlsCONTEXT_POOL_SIZE
+    #define transporttlsCONTEXT_POOL_SIZE    ( 0 )
+#endif
+
+/**
+ * @brief Number of statically allocated TLS configurations, with
+ * transporttlsCONTEXT_POOL_SIZE.
+ *
+ * A connection takes one for its own configuration, and a #TlsSharedConfig_t
+ * one for all its connections, so connections sharing their configuration
+ * need fewer than transporttlsCONTEXT_POOL_SIZE.
+ */
+#ifndef transporttlsCONFIG_POOL_SIZE
+    #define transporttlsCONFIG_POOL_SIZE    transporttlsCONTEXT_POOL_SIZE
+#endif
+
+/**
+ * @brief Number of distinct root CA buffers whose parsed chains are kept.
+ *
+ * Each chain is parsed once and shared by the connections trusting the same
+ * buffer, such as the hub, an update download and a gateway each with their
+ * own. A chain is only replaced when no connection uses it, so a connection
+ * to yet another CA fails while all of them are in use.
+ */
+#ifndef transporttlsTRUST_STORE_COUNT
+    #define transporttlsTRUST_STORE_COUNT    ( 3 )
+#endif
+
+/**
+ * @brief Size of the per-connection buffer TLS_Socket_Writev() uses to pack
+ * small fragments into a single TLS record. Fragments larger than this are
+ * passed to the TLS layer directly.
+ */
+#ifndef transporttlsWRITEV_COALESCE_SIZE
+    #define transporttlsWRITEV_COALESCE_SIZE    ( 256 )
+#endif
+
+/**
+ * @brief Size of the per-connection buffer TLS_Socket_Send() uses to combine
+ * consecutive small writes into a single TLS record.
+ *
+ * Writes smaller than this are held back until the buffer fills, the deadline
+ * below expires, or the connection is read from or flushed with
+ * TLS_Socket_Flush(). 0 disables write combining.
+ */
+#ifndef transporttlsWRITE_COMBINE_SIZE
+    #define transporttlsWRITE_COMBINE_SIZE    ( 0 )
+#endif
+
+/**
+ * @brief Longest time, in milliseconds, combined writes are held back before
+ * the next TLS_Socket_Send() flushes them.
+ */
+#ifndef transporttlsWRITE_COMBINE_DEADLINE_MS
+    #define transporttlsWRITE_COMBINE_DEADLINE_MS    ( 20 )
+#endif
+
+/**
+ * @brief Set to 1 to make TLS_Socket_Recv() keep reading until the request is
+ * satisfied or no more data can be read without blocking.
+ *
+ * By default a receive returns after a single TLS record, leaving any further
+ * decrypted or queued data for the next call.
+ */
+#ifndef transporttlsRECV_DRAIN
+    #define transporttlsRECV_DRAIN    ( 0 )
+#endif
+
+/**
+ * @brief Free heap probe used to measure the heap taken by the TLS handshake
+ * in #TransportStats_t.
+ *
+ * Ports whose heap implementation cannot report its free size define this to 0.
+ */
+#ifndef transporttlsFREE_HEAP_SIZE
+    #define transporttlsFREE_HEAP_SIZE()    xPortGetFreeHeapSize()
+#endif
+
+/**
+ * @brief Number of host names a #TlsSessionCache_t can hold sessions for.
+ *
+ * The samples connect to at most two endpoints (DPS and IoT Hub).
+ */
+#ifndef transporttlsSESSION_CACHE_ENTRIES
+    #define transporttlsSESSION_CACHE_ENTRIES    ( 2 )
+#endif
+
+/**
+ * @brief A saved TLS session for a single host.
+ */
+typedef struct TlsSessionCacheEntry
+{
+    char cHostName[ SOCKETS_MAX_HOST_NAME_LENGTH + 1 ]; /**< @brief NULL terminated host name, empty if unused. */
+    void * pvSession;                                   /**< @brief Transport specific session state, NULL if none saved. */
+} TlsSessionCacheEntry_t;
+
+/**
+ * @brief Cache of TLS sessions used to perform abbreviated handshakes on reconnect.
+ *
+ * The cache must outlive the connections using it and must be zero initialized
+ * before first use. Call TLS_Socket_SessionCacheClear() to release the saved sessions.
+ */
+typedef struct TlsSessionCache
+{
+    TlsSessionCacheEntry_t xEntries[ transporttlsSESSION_CACHE_ENTRIES ];
+} TlsSessionCache_t;
+
+/**
+ * @brief TLS configuration shared by every connection made with the same
+ * #NetworkCredentials_t.
+ *
+ * The configuration is set up from the credentials on the first connection,
+ * parsing the client certificate and key once, and the later connections
+ * only reference it, so the credentials must not change meanwhile. Start the
+ * first connection before the others, such as from a single network task.
+ * It must be zero initialized before first use and outlive the connections
+ * using it.
+ * Call TLS_Socket_SharedConfigFree() once none are left to release it.
+ */
+typedef struct TlsSharedConfig
+{
+    void * pvConfig;  /**< @brief Transport specific configuration, NULL until the first connection. */
+    uint32_t ulUsers; /**< @brief Number of connections using the configuration. */
+} TlsSharedConfig_t;
+
+/**
+ * @brief A fragment of data to send with TLS_Socket_Writev().
+ */
+typedef struct TlsTransportOutVector
+{
+    const void * pvBase; /**< @brief Start of the fragment. */
+    size_t xLength;      /**< @brief Length of the fragment in bytes. */
+} TlsTransportOutVector_t;
+
+/**
+ * @brief Cipher suite and curve profile offered in the TLS ClientHello.
+ */
+typedef enum TlsTransportProfile
+{
+    eTLSTransportProfileDefault = 0,   /**< Offer every cipher suite and curve compiled in. */
+    eTLSTransportProfileEcdheAes128Gcm /**< Offer only ECDHE-ECDSA/ECDHE-RSA with AES-128-GCM on secp256r1. */
+} TlsTransportProfile_t;
+
 /**
  * @brief Contains the credentials necessary for TLS connection setup.
  */
@@ -32,12 +188,58 @@ typedef struct NetworkCredentials
      */
     BaseType_t xDisableSni;
 
-    const uint8_t * pucRootCa;     /**< @brief String representing a trusted server root certificate. */
+    /**
+     * @brief Trusted server root certificates, either a PEM string or concatenated
+     * DER certificates. The buffer must stay valid and unchanged for as long as
+     * connections are made, as it is parsed once and the result shared by all of them.
+     */
+    const uint8_t * pucRootCa;
     size_t xRootCaSize;            /**< @brief Size associated with #NetworkCredentials.pRootCa. */
     const uint8_t * pucClientCert; /**< @brief String representing the client certificate. */
     size_t xClientCertSize;        /**< @brief Size associated with #NetworkCredentials.pClientCert. */
     const uint8_t * pucPrivateKey; /**< @brief String representing the client certificate's private key. */
     size_t xPrivateKeySize;        /**< @brief Size associated with #NetworkCredentials.pPrivateKey. */
+
+    /**
+     * @brief Optional client certificate and private key already parsed by the
+     * caller, used instead of #NetworkCredentials.pucClientCert and
+     * #NetworkCredentials.pucPrivateKey so that a connect parses neither.
+     *
+     * With the mbedTLS transport, an mbedtls_x509_crt and an mbedtls_pk_context.
+     * The transport only references them: they must stay valid for as long as
+     * connections are made, and the caller frees them. Both or neither are set.
+     */
+    void * pvParsedClientCert;
+    void * pvParsedPrivateKey;
+
+    /**
+     * @brief Maximum fragment length to negotiate with the server (RFC 6066).
+     * One of 512, 1024, 2048 or 4096 bytes; 0 selects 4096. The record buffers
+     * themselves are sized by MBEDTLS_SSL_IN_CONTENT_LEN / MBEDTLS_SSL_OUT_CONTENT_LEN
+     * in the board mbedtls_config.h.
+     */
+    uint16_t usMaxFragmentLength;
+
+    /**
+     * @brief Cipher suites and curves to offer. Pinning a profile shrinks the
+     * ClientHello and keeps the server from selecting an expensive suite.
+     */
+    TlsTransportProfile_t xProfile;
+
+    /**
+     * @brief Optional session cache. When set, sessions are saved after a successful
+     * handshake and offered to the server on the next connection to the same host.
+     * Set to NULL to always perform a full handshake.
+     */
+    TlsSessionCache_t * pxSessionCache;
+
+    /**
+     * @brief Optional configuration shared by the connections made with these
+     * credentials, such as the ones of the identities behind a gateway, so
+     * that each connection holds only its own session and record buffers.
+     * Set to NULL for each connection to configure its own.
+     */
+    TlsSharedConfig_t * pxSharedConfig;
 } NetworkCredentials_t;
 
 /**
@@ -51,7 +253,8 @@ typedef enum TlsTransportStatus
     eTLSTransportInvalidCredentials, /**< Provided credentials were invalid. */
     eTLSTransportHandshakeFailed,    /**< Performing TLS handshake with server failed. */
     eTLSTransportInternalError,      /**< A call to a system API resulted in an internal error. */
-    eTLSTransportConnectFailure      /**< Initial connection to the server failed. */
+    eTLSTransportConnectFailure,     /**< Initial connection to the server failed. */
+    eTLSTransportInProgress          /**< The TLS handshake has not completed yet. */
 } TlsTransportStatus_t;
 
 /**
@@ -72,6 +275,40 @@ TlsTransportStatus_t TLS_Socket_Connect( NetworkContext_t * pxNetworkContext,
                                          uint32_t ulReceiveTimeoutMs,
                                          uint32_t ulSendTimeoutMs );
 
+/**
+ * @brief Open the TCP connection to a TLS endpoint and prepare the TLS handshake.
+ *
+ * The handshake is then driven by calling TLS_Socket_ConnectStep() until it stops
+ * returning #eTLSTransportInProgress, so the calling task can do other work while the
+ * handshake waits for the server. Each step goes as far as the data on the socket
+ * allows and blocks for at most the socket receive/send timeout.
+ *
+ * @param[in] pxNetworkContext Pointer to the Network context.
+ * @param[in] pcHostName Pointer to NULL terminated hostname.
+ * @param[in] usPort Port to connect to.
+ * @param[in] pxNetworkCredentials Pointer to network credentials.
+ * @param[in] ulReceiveTimeoutMs Receive timeout.
+ * @param[in] ulSendTimeoutMs Send timeout.
+ * @return A #TlsTransportStatus_t with the result of the operation.
+ */
+TlsTransportStatus_t TLS_Socket_ConnectStart( NetworkContext_t * pxNetworkContext,
+                                              const char * pcHostName,
+                                              uint16_t usPort,
+                                              const NetworkCredentials_t * pxNetworkCredentials,
+                                              uint32_t ulReceiveTimeoutMs,
+                                              uint32_t ulSendTimeoutMs );
+
+/**
+ * @brief Advance the TLS handshake started by TLS_Socket_ConnectStart().
+ *
+ * On failure the connection is cleaned up and must be started again.
+ *
+ * @param[in] pxNetworkContext Pointer to the Network context.
+ * @return #eTLSTransportInProgress while the handshake is ongoing, #eTLSTransportSuccess
+ * once the connection is established, or another #TlsTransportStatus_t on failure.
+ */
+TlsTransportStatus_t TLS_Socket_ConnectStep( NetworkContext_t * pxNetworkContext );
+
 /**
  * @brief Disconnect the TLS connection
  *
@@ -79,6 +316,20 @@ TlsTransportStatus_t TLS_Socket_Connect( NetworkContext_t * pxNetworkContext,
  */
 void TLS_Socket_Disconnect( NetworkContext_t * pxNetworkContext );
 
+/**
+ * @brief Release all the sessions saved in a TLS session cache.
+ *
+ * @param[in] pxSessionCache Pointer to the session cache.
+ */
+void TLS_Socket_SessionCacheClear( TlsSessionCache_t * pxSessionCache );
+
+/**
+ * @brief Release a shared TLS configuration, once no connection uses it.
+ *
+ * @param[in] pxSharedConfig Pointer to the shared configuration.
+ */
+void TLS_Socket_SharedConfigFree( TlsSharedConfig_t * pxSharedConfig );
+
 /**
  * @brief Receive data from TLS.
  *
@@ -91,6 +342,29 @@ int32_t TLS_Socket_Recv( NetworkContext_t * pxNetworkContext,
                          void * pvBuffer,
                          size_t xBytesToRecv );
 
+/**
+ * @brief Get the number of bytes TLS_Socket_Recv() can return without reading
+ * from the socket.
+ *
+ * @param pxNetworkContext Pointer to the Network context.
+ * @return The number of decrypted bytes buffered by the TLS layer.
+ */
+size_t TLS_Socket_GetBytesAvailable( NetworkContext_t * pxNetworkContext );
+
+/**
+ * @brief Wait until TLS_Socket_Recv() has data to return.
+ *
+ * Writes held back by the transport are flushed before waiting. Returns at once
+ * if the TLS layer already buffers received data.
+ *
+ * @param pxNetworkContext Pointer to the Network context.
+ * @param ulTimeoutMs Maximum time to wait, in milliseconds.
+ * @return 1 if data can be received, 0 if the wait timed out, or a negative
+ * value on error.
+ */
+int32_t TLS_Socket_WaitReadable( NetworkContext_t * pxNetworkContext,
+                                 uint32_t ulTimeoutMs );
+
 /**
  * @brief Send data using TLS.
  *
@@ -102,3 +376,33 @@ int32_t TLS_Socket_Recv( NetworkContext_t * pxNetworkContext,
 int32_t TLS_Socket_Send( NetworkContext_t * pxNetworkContext,
                          const void * pvBuffer,
                          size_t xBytesToSend );
+
+/**
+ * @brief Write out the data combined by TLS_Socket_Send().
+ *
+ * The transport flushes on its own before reading, so this only needs to be
+ * called when nothing will be received for a while after sending.
+ *
+ * @param pxNetworkContext Pointer to the Network context.
+ * @return 0 once nothing is left buffered, or a negative value on error,
+ * including the socket not taking the data within the send timeout.
+ */
+int32_t TLS_Socket_Flush( NetworkContext_t * pxNetworkContext );
+
+/**
+ * @brief Send several fragments using TLS, as if they were one contiguous buffer.
+ *
+ * Small adjacent fragments (such as a packet header followed by its payload) are
+ * packed into one TLS record, so callers do not need to serialize them into an
+ * intermediate buffer first.
+ *
+ * @param pxNetworkContext Pointer to the Network context.
+ * @param pxIoVec Array of fragments to send, in order.
+ * @param xIoVecCount Number of entries in pxIoVec.
+ * @return An #int32_t number of bytes successfully sent, counted from the start of
+ * the first fragment, or a negative value on error, including the socket not
+ * taking the data within the send timeout.
+ */
+int32_t TLS_Socket_Writev( NetworkContext_t * pxNetworkContext,
+                           const TlsTransportOutVector_t * pxIoVec,
+                           size_t xIoVecCount );
@@ -40,6 +40,8 @@ extern void vLoggingPrintf( const char * pcFormatString,
 
 /* FreeRTOS includes. */
 #include "FreeRTOS.h"
+#include "task.h"
+#include "semphr.h"
 
 /* TLS transport header. */
 #include "transport_tls_socket.h"
@@ -47,13 +49,21 @@ extern void vLoggingPrintf( const char * pcFormatString,
 /* FreeRTOS Socket wrapper include. */
 #include "sockets_wrapper.h"
 
+/* Shared random number generator. */
+#include "azure_sample_crypto.h"
+
+/* Trace points of the samples. */
+#include "azure_sample_trace.h"
+
+/* The peak clock during the handshake. */
+#include "azure_sample_perf_governor.h"
+
 /* mbedTLS util includes. */
-#include "mbedtls/ctr_drbg.h"
-#include "mbedtls/entropy.h"
+#include "mbedtls/asn1.h"
 #include "mbedtls/ssl.h"
-#include "mbedtls/threading.h"
 #include "mbedtls/x509.h"
 #include "mbedtls/error.h"
+#include "mbedtls/platform.h"
 
 /*-----------------------------------------------------------*/
 
@@ -66,21 +76,117 @@ struct NetworkContext
     void * pParams;
 };
 
+/**
+ * @brief A trusted root CA chain, parsed once for all the configurations that
+ * trust the same buffer.
+ *
+ * The configurations referencing the chain are counted, and it is only freed,
+ * to parse another buffer, once none does. xTrustStoreMutex guards the entries.
+ */
+typedef struct TlsTrustStore
+{
+    mbedtls_x509_crt xChain;   /**< @brief Parsed root CA chain. */
+    const uint8_t * pucSource; /**< @brief Buffer the chain was parsed from, NULL if not parsed. */
+    size_t xSourceSize;        /**< @brief Size of the buffer the chain was parsed from. */
+    uint32_t ulUsers;          /**< @brief Configurations using the chain. */
+} TlsTrustStore_t;
+
+/**
+ * @brief Configuration of secured connections, either of a single connection
+ * or of all the connections of a #TlsSharedConfig_t.
+ */
+typedef struct MbedSSLConfig
+{
+    mbedtls_ssl_config config;            /**< @brief SSL connection configuration. */
+    mbedtls_x509_crt_profile certProfile; /**< @brief Certificate security profile. */
+    mbedtls_x509_crt clientCert;          /**< @brief Client certificate context. */
+    mbedtls_pk_context privKey;           /**< @brief Client private key context. */
+    TlsTrustStore_t * pxTrustStore;       /**< @brief Root CA chain referenced, NULL until set. */
+} MbedSSLConfig_t;
+
 /**
  * @brief Secured connection context.
  */
 typedef struct MbedSSLContext
 {
-    mbedtls_ssl_config config;               /**< @brief SSL connection configuration. */
+    MbedSSLConfig_t * pxConfig;              /**< @brief Configuration of the connection, NULL until set up. */
+    TlsSharedConfig_t * pxSharedConfig;      /**< @brief Shared configuration pxConfig belongs to, NULL if its own. */
     mbedtls_ssl_context context;             /**< @brief SSL connection context */
-    mbedtls_x509_crt_profile certProfile;    /**< @brief Certificate security profile for this connection. */
-    mbedtls_x509_crt rootCa;                 /**< @brief Root CA certificate context. */
-    mbedtls_x509_crt clientCert;             /**< @brief Client certificate context. */
-    mbedtls_pk_context privKey;              /**< @brief Client private key context. */
-    mbedtls_entropy_context entropyContext;  /**< @brief Entropy context for random number generation. */
-    mbedtls_ctr_drbg_context ctrDrgbContext; /**< @brief CTR DRBG context for random number generation. */
+    TlsSessionCacheEntry_t * pxCacheEntry;   /**< @brief Session cache entry for the remote host, NULL if not caching. */
+    TransportStats_t * pxStats;              /**< @brief Statistics of the connection, NULL if not collected. */
+    TickType_t xHandshakeStartTick;          /**< @brief Tick at which the handshake started. */
+    size_t xHandshakeHeapBaseline;           /**< @brief Free heap when the handshake started. */
+    size_t xHandshakeHeapLow;                /**< @brief Lowest free heap seen during the handshake. */
+    BaseType_t xFullHandshake;               /**< @brief pdTRUE once the certificate of the server is verified. */
+    BaseType_t xPerfBoosted;                 /**< @brief pdTRUE while the handshake holds the peak clock. */
+    TickType_t xSendTimeout;                 /**< @brief Ticks a write waits for the socket to take a record. */
+    int32_t lWriteError;                     /**< @brief Error of the write that stopped mid-record, 0 if none. */
+    uint8_t ucWritevBuffer[ transporttlsWRITEV_COALESCE_SIZE ]; /**< @brief Staging buffer for coalescing TLS_Socket_Writev() fragments. */
+    #if ( transporttlsWRITE_COMBINE_SIZE > 0 )
+        uint8_t ucCombineBuffer[ transporttlsWRITE_COMBINE_SIZE ]; /**< @brief Small writes held back by TLS_Socket_Send(). */
+        size_t xCombineLength;                                     /**< @brief Number of bytes held in ucCombineBuffer. */
+        TickType_t xCombineStartTick;                              /**< @brief Tick at which the oldest held byte was buffered. */
+    #endif /* transporttlsWRITE_COMBINE_SIZE > 0 */
 } MbedSSLContext_t;
 
+/**
+ * @brief Trusted root CA chains, shared read-only by the SSL contexts, so the
+ * decode and the heap allocations of each happen once.
+ */
+static TlsTrustStore_t xTrustStores[ transporttlsTRUST_STORE_COUNT ];
+
+/**
+ * @brief Guards xTrustStores, created by the first connection.
+ */
+static SemaphoreHandle_t xTrustStoreMutex;
+static StaticSemaphore_t xTrustStoreMutexBuffer;
+
+/**
+ * @brief Cipher suites offered for #eTLSTransportProfileEcdheAes128Gcm.
+ */
+static const int lEcdheAes128GcmCipherSuites[] =
+{
+    MBEDTLS_TLS_ECDHE_ECDSA_WITH_AES_128_GCM_SHA256,
+    MBEDTLS_TLS_ECDHE_RSA_WITH_AES_128_GCM_SHA256,
+    0
+};
+
+/**
+ * @brief Curves offered for #eTLSTransportProfileEcdheAes128Gcm.
+ */
+static const mbedtls_ecp_group_id xEcdheAes128GcmCurves[] =
+{
+    MBEDTLS_ECP_DP_SECP256R1,
+    MBEDTLS_ECP_DP_NONE
+};
+
+#if ( configSUPPORT_DYNAMIC_ALLOCATION == 0 ) && ( transporttlsCONTEXT_POOL_SIZE == 0 )
+    #error "Without a heap, the SSL contexts come from the pool: set transporttlsCONTEXT_POOL_SIZE."
+#endif
+
+#if ( transporttlsCONTEXT_POOL_SIZE > 0 ) && defined( MBEDTLS_SSL_VARIABLE_BUFFER_LENGTH )
+    #error "MBEDTLS_SSL_VARIABLE_BUFFER_LENGTH takes the resized record buffers from the heap: leave it out with the pool."
+#endif
+
+#if ( transporttlsCONTEXT_POOL_SIZE > 0 )
+
+    /**
+     * @brief Statically allocated SSL contexts, used instead of the heap.
+     */
+    static MbedSSLContext_t xSSLContextPool[ transporttlsCONTEXT_POOL_SIZE ];
+    static BaseType_t xSSLContextInUse[ transporttlsCONTEXT_POOL_SIZE ];
+
+    #if ( transporttlsCONFIG_POOL_SIZE < 1 )
+        #error "The SSL configurations come from the pool with the contexts: set transporttlsCONFIG_POOL_SIZE."
+    #endif
+
+    /**
+     * @brief Statically allocated SSL configurations, used instead of the heap.
+     */
+    static MbedSSLConfig_t xSSLConfigPool[ transporttlsCONFIG_POOL_SIZE ];
+    static BaseType_t xSSLConfigInUse[ transporttlsCONFIG_POOL_SIZE ];
+#endif /* transporttlsCONTEXT_POOL_SIZE > 0 */
+
 /*-----------------------------------------------------------*/
 
 /**
@@ -113,6 +219,20 @@ static const char * pcNoLowLevelMbedTlsCodeStr = "<No-Low-Level-Code>";
 
 /*-----------------------------------------------------------*/
 
+/**
+ * @brief Get storage for an SSL context, from the pool if configured or the heap otherwise.
+ *
+ * @return The SSL context, or NULL if none is available.
+ */
+static MbedSSLContext_t * sslContextAlloc( void );
+
+/**
+ * @brief Return the storage of an SSL context obtained from sslContextAlloc().
+ *
+ * @param[in] pxSslContext The SSL context to release.
+ */
+static void sslContextRelease( MbedSSLContext_t * pxSslContext );
+
 /**
  * @brief Initialize the mbed TLS structures in a network connection.
  *
@@ -127,46 +247,93 @@ static void sslContextInit( MbedSSLContext_t * pxSslContext );
  */
 static void sslContextFree( MbedSSLContext_t * pxSslContext );
 
+/**
+ * @brief Get storage for an SSL configuration, from the pool if configured or the heap otherwise.
+ *
+ * @return The SSL configuration, or NULL if none is available.
+ */
+static MbedSSLConfig_t * sslConfigAlloc( void );
+
+/**
+ * @brief Return the storage of an SSL configuration obtained from sslConfigAlloc().
+ *
+ * @param[in] pxSslConfig The SSL configuration to release.
+ */
+static void sslConfigRelease( MbedSSLConfig_t * pxSslConfig );
+
+/**
+ * @brief Initialize the mbed TLS structures of an SSL configuration.
+ *
+ * @param[in] pxSslConfig The SSL configuration to initialize.
+ */
+static void sslConfigInit( MbedSSLConfig_t * pxSslConfig );
+
+/**
+ * @brief Free the mbed TLS structures of an SSL configuration.
+ *
+ * @param[in] pxSslConfig The SSL configuration to free.
+ */
+static void sslConfigFree( MbedSSLConfig_t * pxSslConfig );
+
+/**
+ * @brief End the peak clock of the handshake of a network connection, if held.
+ *
+ * @param[in] pxSslContext The SSL context.
+ */
+static void sslContextPerfRelease( MbedSSLContext_t * pxSslContext );
+
+/**
+ * @brief Parse a chain of concatenated DER-encoded certificates.
+ *
+ * @param[out] pxChain Certificate chain to which the certificates are added.
+ * @param[in] pucDer Concatenated DER-encoded certificates.
+ * @param[in] xDerSize Size of the DER buffer.
+ *
+ * @return 0 on success; otherwise, failure;
+ */
+static int32_t parseDerChain( mbedtls_x509_crt * pxChain,
+                              const uint8_t * pucDer,
+                              size_t xDerSize );
+
 /**
  * @brief Add X509 certificate to the trusted list of root certificates.
  *
- * OpenSSL does not provide a single function for reading and loading certificates
- * from files into stores, so the file API must be called. Start with the
- * root certificate.
+ * The shared trust store is parsed on first use, and re-parsed only if a
+ * different root CA buffer is passed in.
  *
- * @param[out] pxSslContext SSL context to which the trusted server root CA is to be added.
- * @param[in] pucRootCa PEM-encoded string of the trusted server root CA.
+ * @param[out] pxSslConfig SSL configuration to which the trusted server root CA is to be added.
+ * @param[in] pucRootCa PEM-encoded string or concatenated DER certificates of the trusted server root CA.
  * @param[in] xRootCaSize Size of the trusted server root CA.
  *
  * @return 0 on success; otherwise, failure;
  */
-static int32_t setRootCa( MbedSSLContext_t * pxSslContext,
+static int32_t setRootCa( MbedSSLConfig_t * pxSslConfig,
                           const uint8_t * pucRootCa,
                           size_t xRootCaSize );
 
 /**
  * @brief Set X509 certificate as client certificate for the server to authenticate.
  *
- * @param[out] pxSslContext SSL context to which the client certificate is to be set.
+ * @param[out] pxSslConfig SSL configuration to which the client certificate is to be set.
  * @param[in] pucClientCert PEM-encoded string of the client certificate.
  * @param[in] xClientCertSize Size of the client certificate.
  *
  * @return 0 on success; otherwise, failure;
  */
-static int32_t setClientCertificate( MbedSSLContext_t * pxSslContext,
+static int32_t setClientCertificate( MbedSSLConfig_t * pxSslConfig,
                                      const uint8_t * pucClientCert,
                                      size_t xClientCertSize );
 
 /**
  * @brief Set private key for the client's certificate.
  *
- * @param[out] pxSslContext SSL context to which the private key is to be set.
+ * @param[out] pxSslConfig SSL configuration to which the private key is to be set.
  * @param[in] pucPrivateKey PEM-encoded string of the client private key.
  * @param[in] xPrivateKeySize Size of the client private key.
  *
  * @return 0 on success; otherwise, failure;
  */
-static int32_t setPrivateKey( MbedSSLContext_t * pxSslContext,
+static int32_t setPrivateKey( MbedSSLConfig_t * pxSslConfig,
                               const uint8_t * pucPrivateKey,
                               size_t xPrivateKeySize );
 
@@ -177,29 +344,40 @@ static int32_t setPrivateKey( MbedSSLContext_t * pxSslContext,
  * OpenSSL library. If the client certificate or private key is not NULL, mutual
  * authentication is used when performing the TLS handshake.
  *
- * @param[out] pxSslContext SSL context to which the credentials are to be imported.
+ * @param[out] pxSslConfig SSL configuration to which the credentials are to be imported.
  * @param[in] pxNetworkCredentials TLS credentials to be imported.
  *
  * @return 0 on success; otherwise, failure;
  */
-static int32_t setCredentials( MbedSSLContext_t * pxSslContext,
+static int32_t setCredentials( MbedSSLConfig_t * pxSslConfig,
                                const NetworkCredentials_t * pxNetworkCredentials );
 
 /**
- * @brief Set optional configurations for the TLS connection.
+ * @brief Set optional configurations for the TLS connections.
  *
- * This function is used to set SNI and ALPN protocols.
+ * This function is used to set ALPN protocols, the maximum fragment length
+ * and the cipher suite profile.
  *
- * @param[in] pxSslContext SSL context to which the optional configurations are to be set.
- * @param[in] pcHostName Remote host name, used for server name indication.
+ * @param[in] pxSslConfig SSL configuration to which the optional configurations are to be set.
  * @param[in] pxNetworkCredentials TLS setup parameters.
  */
-static void setOptionalConfigurations( MbedSSLContext_t * pxSslContext,
-                                       const char * pcHostName,
+static void setOptionalConfigurations( MbedSSLConfig_t * pxSslConfig,
                                        const NetworkCredentials_t * pxNetworkCredentials );
 
 /**
- * @brief Setup TLS by initializing contexts and setting configurations.
+ * @brief Set up an SSL configuration from the credentials.
+ *
+ * @param[in] pxSslConfig The SSL configuration, initialized.
+ * @param[in] pxNetworkCredentials TLS setup parameters.
+ *
+ * @return #eTLSTransportSuccess, #eTLSTransportInsufficientMemory or #eTLSTransportInvalidCredentials.
+ */
+static TlsTransportStatus_t sslConfigSetup( MbedSSLConfig_t * pxSslConfig,
+                                            const NetworkCredentials_t * pxNetworkCredentials );
+
+/**
+ * @brief Setup TLS by initializing contexts and setting configurations, or
+ * taking the shared configuration of the credentials if they have one.
  *
  * @param[in] pxNetworkContext Network context.
  * @param[in] pcHostName Remote host name, used for server name indication.
@@ -213,184 +391,371 @@ static TlsTransportStatus_t tlsSetup( NetworkContext_t * pxNetworkContext,
                                       const NetworkCredentials_t * pxNetworkCredentials );
 
 /**
- * @brief Perform the TLS handshake on a TCP connection.
+ * @brief Find the session cache entry for a host, claiming a slot if the host is not cached yet.
+ *
+ * @param[in] pxSessionCache The session cache to search.
+ * @param[in] pcHostName Remote host name, used as the cache key.
+ *
+ * @return The cache entry for the host, or NULL if the host name does not fit in an entry.
+ */
+static TlsSessionCacheEntry_t * sessionCacheGetEntry( TlsSessionCache_t * pxSessionCache,
+                                                      const char * pcHostName );
+
+/**
+ * @brief Release the session saved in a cache entry, if any.
+ *
+ * @param[in] pxEntry The cache entry.
+ */
+static void sessionCacheDropSession( TlsSessionCacheEntry_t * pxEntry );
+
+/**
+ * @brief Save the session of an established connection into a cache entry.
+ *
+ * @param[in] pxEntry The cache entry.
+ * @param[in] pxSslContext SSL context of the established connection.
+ */
+static void sessionCacheSaveSession( TlsSessionCacheEntry_t * pxEntry,
+                                     MbedSSLContext_t * pxSslContext );
+
+/**
+ * @brief Prepare the TLS handshake on a TCP connection.
  *
  * @param[in] pxNetworkContext Network context.
+ * @param[in] pcHostName Remote host name, used to look up a cached session.
  * @param[in] pxNetworkCredentials TLS setup parameters.
  *
- * @return #eTLSTransportSuccess, #eTLSTransportHandshakeFailed, or #eTLSTransportInternalError.
+ * @return #eTLSTransportSuccess, or #eTLSTransportInternalError.
+ */
+static TlsTransportStatus_t tlsHandshakeStart( NetworkContext_t * pxNetworkContext,
+                                               const char * pcHostName,
+                                               const NetworkCredentials_t * pxNetworkCredentials );
+
+/**
+ * @brief Certificate verification callback, recording that the handshake is a full one.
+ *
+ * Only a full handshake verifies the certificate of the server. The flags are
+ * left untouched, so the result of the verification is that of mbedTLS.
+ *
+ * @param[in] pvContext SSL context of the connection.
+ * @param[in] pxCertificate Certificate being verified.
+ * @param[in] lDepth Depth of the certificate in the chain.
+ * @param[in] pulFlags Verification flags of the certificate.
+ *
+ * @return 0.
+ */
+static int certificateVerified( void * pvContext,
+                                mbedtls_x509_crt * pxCertificate,
+                                int lDepth,
+                                uint32_t * pulFlags );
+
+/**
+ * @brief Advance the TLS handshake with the data available on the socket.
+ *
+ * @param[in] pxNetworkContext Network context.
+ *
+ * @return #eTLSTransportSuccess once the handshake is complete, #eTLSTransportInProgress
+ * if it waits for the socket, or #eTLSTransportHandshakeFailed.
+ */
+static TlsTransportStatus_t tlsHandshakeStep( NetworkContext_t * pxNetworkContext );
+
+/**
+ * @brief Free the SSL context and close the socket of a failed connection.
+ *
+ * @param[in] pxNetworkContext Network context.
+ */
+static void connectCleanup( NetworkContext_t * pxNetworkContext );
+
+/**
+ * @brief Write a buffer completely.
+ *
+ * A record the socket does not take at once stays in mbedTLS, which must be
+ * given the same data again to send the rest of it, so the write is retried
+ * as it was until the send timeout of the connection. A connection left
+ * mid-record cannot carry other data, so its error is then kept in
+ * pxSSLContext->lWriteError and returned by every later write.
+ *
+ * @param[in] pxSSLContext SSL context of the connection.
+ * @param[in] pucBuffer Data to write.
+ * @param[in] xLength Length of the data.
+ * @param[out] pxWritten Number of bytes mbedTLS confirmed as sent.
+ *
+ * @return 0 if the whole buffer was written, otherwise a negative mbedTLS error.
+ */
+static int32_t writeAll( MbedSSLContext_t * pxSSLContext,
+                         const uint8_t * pucBuffer,
+                         size_t xLength,
+                         size_t * pxWritten );
+
+/**
+ * @brief Write out the bytes held in the write combining buffer.
+ *
+ * Returns the error of an earlier write that stopped mid-record even with
+ * nothing buffered, so the callers that flush first see it.
+ *
+ * @param[in] pxSSLContext SSL context of the connection.
+ *
+ * @return 0 on success or if the write timed out, otherwise a negative mbedTLS error.
+ */
+static int32_t writeCombineFlush( MbedSSLContext_t * pxSSLContext );
+
+#if ( transporttlsRECV_DRAIN == 1 )
+
+    /**
+     * @brief Continue a receive while data can be read without blocking.
+     *
+     * @param[in] pxTlsTransportParams Transport parameters of the connection.
+     * @param[in] pxSSLContext SSL context of the connection.
+     * @param[out] pucBuffer Buffer the receive is filling.
+     * @param[in] xBytesToRecv Size of the buffer.
+     * @param[in] xReceived Number of bytes already received into the buffer.
+     *
+     * @return The total number of bytes received into the buffer.
+     */
+    static int32_t recvDrain( TlsTransportParams_t * pxTlsTransportParams,
+                              MbedSSLContext_t * pxSSLContext,
+                              uint8_t * pucBuffer,
+                              size_t xBytesToRecv,
+                              size_t xReceived );
+#endif /* transporttlsRECV_DRAIN == 1 */
+
+/**
+ * @brief Connect the TCP socket of a TLS connection, timing the connect if
+ * statistics are collected.
+ *
+ * @param[in] pxTlsTransportParams Transport parameters of the connection.
+ * @param[in] pcHostName Remote host name.
+ * @param[in] usPort Remote port.
+ *
+ * @return The result of Sockets_Connect().
+ */
+static BaseType_t tcpConnect( TlsTransportParams_t * pxTlsTransportParams,
+                              const char * pcHostName,
+                              uint16_t usPort );
+
+/**
+ * @brief Account for the result of a TLS write in the connection statistics.
+ *
+ * @param[in] pxSSLContext SSL context of the connection.
+ * @param[in] lMbedtlsError Return value of mbedtls_ssl_write().
+ */
+static void statsCountWrite( MbedSSLContext_t * pxSSLContext,
+                             int32_t lMbedtlsError );
+
+/**
+ * @brief Account for the result of a TLS read in the connection statistics.
+ *
+ * @param[in] pxSSLContext SSL context of the connection.
+ * @param[in] lMbedtlsError Return value of mbedtls_ssl_read().
  */
-static TlsTransportStatus_t tlsHandshake( NetworkContext_t * pxNetworkContext,
-                                          const NetworkCredentials_t * pxNetworkCredentials );
+static void statsCountRead( MbedSSLContext_t * pxSSLContext,
+                            int32_t lMbedtlsError );
 
 /**
  * @brief Initialize mbedTLS.
  *
- * @param[out] entropyContext mbed TLS entropy context for generation of random numbers.
- * @param[out] ctrDrgbContext mbed TLS CTR DRBG context for generation of random numbers.
+ * Threading hooks and the random number generator are process-wide and shared
+ * with the rest of the sample crypto, so this only does work on first use.
  *
  * @return #eTLSTransportSuccess, or #eTLSTransportInternalError.
  */
-static TlsTransportStatus_t initMbedtls( mbedtls_entropy_context * pxEntropyContext,
-                                         mbedtls_ctr_drbg_context * pxCtrDrgbContext );
+static TlsTransportStatus_t initMbedtls( void );
 
 /*-----------------------------------------------------------*/
 
-static void sslContextInit( MbedSSLContext_t * pxSslContext )
+static MbedSSLContext_t * sslContextAlloc( void )
 {
-    configASSERT( pxSslContext != NULL );
+    MbedSSLContext_t * pxSslContext = NULL;
 
-    mbedtls_ssl_config_init( &( pxSslContext->config ) );
-    mbedtls_x509_crt_init( &( pxSslContext->rootCa ) );
-    mbedtls_pk_init( &( pxSslContext->privKey ) );
-    mbedtls_x509_crt_init( &( pxSslContext->clientCert ) );
-    mbedtls_ssl_init( &( pxSslContext->context ) );
+    #if ( transporttlsCONTEXT_POOL_SIZE > 0 )
+        uint32_t ulIndex;
+
+        taskENTER_CRITICAL();
+
+        for( ulIndex = 0; ulIndex < transporttlsCONTEXT_POOL_SIZE; ulIndex++ )
+        {
+            if( xSSLContextInUse[ ulIndex ] == pdFALSE )
+            {
+                xSSLContextInUse[ ulIndex ] = pdTRUE;
+                pxSslContext = &( xSSLContextPool[ ulIndex ] );
+                break;
+            }
+        }
+
+        taskEXIT_CRITICAL();
+    #else /* transporttlsCONTEXT_POOL_SIZE > 0 */
+        pxSslContext = pvPortMalloc( sizeof( MbedSSLContext_t ) );
+    #endif /* transporttlsCONTEXT_POOL_SIZE > 0 */
+
+    return pxSslContext;
 }
 /*-----------------------------------------------------------*/
 
-static void sslContextFree( MbedSSLContext_t * pxSslContext )
+static void sslContextRelease( MbedSSLContext_t * pxSslContext )
+{
+    #if ( transporttlsCONTEXT_POOL_SIZE > 0 )
+        uint32_t ulIndex = ( uint32_t ) ( pxSslContext - xSSLContextPool );
+
+        configASSERT( ulIndex < transporttlsCONTEXT_POOL_SIZE );
+
+        taskENTER_CRITICAL();
+        xSSLContextInUse[ ulIndex ] = pdFALSE;
+        taskEXIT_CRITICAL();
+    #else /* transporttlsCONTEXT_POOL_SIZE > 0 */
+        vPortFree( pxSslContext );
+    #endif /* transporttlsCONTEXT_POOL_SIZE > 0 */
+}
+/*-----------------------------------------------------------*/
+
+static void sslContextInit( MbedSSLContext_t * pxSslContext )
 {
     configASSERT( pxSslContext != NULL );
 
-    mbedtls_ssl_free( &( pxSslContext->context ) );
-    mbedtls_x509_crt_free( &( pxSslContext->rootCa ) );
-    mbedtls_x509_crt_free( &( pxSslContext->clientCert ) );
-    mbedtls_pk_free( &( pxSslContext->privKey ) );
-    mbedtls_entropy_free( &( pxSslContext->entropyContext ) );
-    mbedtls_ctr_drbg_free( &( pxSslContext->ctrDrgbContext ) );
-    mbedtls_ssl_config_free( &( pxSslContext->config ) );
+    mbedtls_ssl_init( &( pxSslContext->context ) );
+    pxSslContext->pxConfig = NULL;
+    pxSslContext->pxSharedConfig = NULL;
+    pxSslContext->pxCacheEntry = NULL;
+    pxSslContext->pxStats = NULL;
+    pxSslContext->xPerfBoosted = pdFALSE;
+    pxSslContext->xSendTimeout = portMAX_DELAY;
+    pxSslContext->lWriteError = 0;
+
+    #if ( transporttlsWRITE_COMBINE_SIZE > 0 )
+        pxSslContext->xCombineLength = 0;
+    #endif /* transporttlsWRITE_COMBINE_SIZE > 0 */
 }
 /*-----------------------------------------------------------*/
 
-static int32_t setRootCa( MbedSSLContext_t * pxSslContext,
-                          const uint8_t * pucRootCa,
-                          size_t xRootCaSize )
+static void sslContextPerfRelease( MbedSSLContext_t * pxSslContext )
 {
-    int32_t lMbedtlsError = -1;
+    if( pxSslContext->xPerfBoosted == pdTRUE )
+    {
+        pxSslContext->xPerfBoosted = pdFALSE;
+        perfgovernorRELEASE();
+    }
+}
+/*-----------------------------------------------------------*/
 
+static void sslContextFree( MbedSSLContext_t * pxSslContext )
+{
     configASSERT( pxSslContext != NULL );
-    configASSERT( pucRootCa != NULL );
 
-    /* Parse the server root CA certificate into the SSL context. */
-    lMbedtlsError = mbedtls_x509_crt_parse( &( pxSslContext->rootCa ),
-                                            pucRootCa,
-                                            xRootCaSize );
+    /* A handshake given up on. */
+    sslContextPerfRelease( pxSslContext );
 
-    if( lMbedtlsError != 0 )
+    mbedtls_ssl_free( &( pxSslContext->context ) );
+
+    if( pxSslContext->pxSharedConfig != NULL )
     {
-        LogError( ( "Failed to parse server root CA certificate: lMbedtlsError[%d]= %s : %s.",
-                    lMbedtlsError, mbedtlsHighLevelCodeOrDefault( lMbedtlsError ),
-                    mbedtlsLowLevelCodeOrDefault( lMbedtlsError ) ) );
+        taskENTER_CRITICAL();
+        pxSslContext->pxSharedConfig->ulUsers--;
+        taskEXIT_CRITICAL();
     }
-    else
+    else if( pxSslContext->pxConfig != NULL )
     {
-        mbedtls_ssl_conf_ca_chain( &( pxSslContext->config ),
-                                   &( pxSslContext->rootCa ),
-                                   NULL );
+        sslConfigFree( pxSslContext->pxConfig );
+        sslConfigRelease( pxSslContext->pxConfig );
     }
 
-    return lMbedtlsError;
+    pxSslContext->pxConfig = NULL;
+    pxSslContext->pxSharedConfig = NULL;
 }
 /*-----------------------------------------------------------*/
 
-static int32_t setClientCertificate( MbedSSLContext_t * pxSslContext,
-                                     const uint8_t * pucClientCert,
-                                     size_t xClientCertSize )
+static MbedSSLConfig_t * sslConfigAlloc( void )
 {
-    int32_t lMbedtlsError = -1;
+    MbedSSLConfig_t * pxSslConfig = NULL;
 
-    configASSERT( pxSslContext != NULL );
-    configASSERT( pucClientCert != NULL );
+    #if ( transporttlsCONTEXT_POOL_SIZE > 0 )
+        uint32_t ulIndex;
 
-    /* Setup the client certificate. */
-    lMbedtlsError = mbedtls_x509_crt_parse( &( pxSslContext->clientCert ),
-                                            pucClientCert,
-                                            xClientCertSize );
+        taskENTER_CRITICAL();
 
-    if( lMbedtlsError != 0 )
-    {
-        LogError( ( "Failed to parse the client certificate: lMbedtlsError[%d]= %s : %s.",
-                    lMbedtlsError, mbedtlsHighLevelCodeOrDefault( lMbedtlsError ),
-                    mbedtlsLowLevelCodeOrDefault( lMbedtlsError ) ) );
-    }
+        for( ulIndex = 0; ulIndex < transporttlsCONFIG_POOL_SIZE; ulIndex++ )
+        {
+            if( xSSLConfigInUse[ ulIndex ] == pdFALSE )
+            {
+                xSSLConfigInUse[ ulIndex ] = pdTRUE;
+                pxSslConfig = &( xSSLConfigPool[ ulIndex ] );
+                break;
+            }
+        }
 
-    return lMbedtlsError;
+        taskEXIT_CRITICAL();
+    #else /* transporttlsCONTEXT_POOL_SIZE > 0 */
+        pxSslConfig = pvPortMalloc( sizeof( MbedSSLConfig_t ) );
+    #endif /* transporttlsCONTEXT_POOL_SIZE > 0 */
+
+    return pxSslConfig;
 }
 /*-----------------------------------------------------------*/
 
-static int32_t setPrivateKey( MbedSSLContext_t * pxSslContext,
-                              const uint8_t * pucPrivateKey,
-                              size_t xPrivateKeySize )
+static void sslConfigRelease( MbedSSLConfig_t * pxSslConfig )
 {
-    int32_t lMbedtlsError = -1;
+    #if ( transporttlsCONTEXT_POOL_SIZE > 0 )
+        uint32_t ulIndex = ( uint32_t ) ( pxSslConfig - xSSLConfigPool );
 
-    configASSERT( pxSslContext != NULL );
-    configASSERT( pucPrivateKey != NULL );
+        configASSERT( ulIndex < transporttlsCONFIG_POOL_SIZE );
 
-    /* Setup the client private key. */
-    lMbedtlsError = mbedtls_pk_parse_key( &( pxSslContext->privKey ),
-                                          pucPrivateKey,
-                                          xPrivateKeySize,
-                                          NULL,
-                                          0 );
+        taskENTER_CRITICAL();
+        xSSLConfigInUse[ ulIndex ] = pdFALSE;
+        taskEXIT_CRITICAL();
+    #else /* transporttlsCONTEXT_POOL_SIZE > 0 */
+        vPortFree( pxSslConfig );
+    #endif /* transporttlsCONTEXT_POOL_SIZE > 0 */
+}
+/*-----------------------------------------------------------*/
 
-    if( lMbedtlsError != 0 )
-    {
-        LogError( ( "Failed to parse the client key: lMbedtlsError[%d]= %s : %s.",
-                    lMbedtlsError, mbedtlsHighLevelCodeOrDefault( lMbedtlsError ),
-                    mbedtlsLowLevelCodeOrDefault( lMbedtlsError ) ) );
-    }
+static void sslConfigInit( MbedSSLConfig_t * pxSslConfig )
+{
+    configASSERT( pxSslConfig != NULL );
 
-    return lMbedtlsError;
+    mbedtls_ssl_config_init( &( pxSslConfig->config ) );
+    mbedtls_pk_init( &( pxSslConfig->privKey ) );
+    mbedtls_x509_crt_init( &( pxSslConfig->clientCert ) );
+    pxSslConfig->pxTrustStore = NULL;
 }
 /*-----------------------------------------------------------*/
 
-static int32_t setCredentials( MbedSSLContext_t * pxSslContext,
-                               const NetworkCredentials_t * pxNetworkCredentials )
+static void sslConfigFree( MbedSSLConfig_t * pxSslConfig )
 {
-    int32_t lMbedtlsError = -1;
-
-    configASSERT( pxSslContext != NULL );
-    configASSERT( pxNetworkCredentials != NULL );
+    configASSERT( pxSslConfig != NULL );
 
-    /* Set up the certificate security profile, starting from the default value. */
-    pxSslContext->certProfile = mbedtls_x509_crt_profile_default;
+    mbedtls_x509_crt_free( &( pxSslConfig->clientCert ) );
+    mbedtls_pk_free( &( pxSslConfig->privKey ) );
+    mbedtls_ssl_config_free( &( pxSslConfig->config ) );
 
-    /* Set SSL authmode and the RNG context. */
-    mbedtls_ssl_conf_authmode( &( pxSslContext->config ),
-                               MBEDTLS_SSL_VERIFY_REQUIRED );
-    mbedtls_ssl_conf_rng( &( pxSslContext->config ),
-                          mbedtls_ctr_drbg_random,
-                          &( pxSslContext->ctrDrgbContext ) );
-    mbedtls_ssl_conf_cert_profile( &( pxSslContext->config ),
-                                   &( pxSslContext->certProfile ) );
+    /* The chain stays parsed for the next connection trusting it. */
+    if( pxSslConfig->pxTrustStore != NULL )
+    {
+        ( void ) xSemaphoreTake( xTrustStoreMutex, portMAX_DELAY );
+        pxSslConfig->pxTrustStore->ulUsers--;
+        ( void ) xSemaphoreGive( xTrustStoreMutex );
+        pxSslConfig->pxTrustStore = NULL;
+    }
+}
+/*-----------------------------------------------------------*/
 
-    lMbedtlsError = setRootCa( pxSslContext,
-                               pxNetworkCredentials->pucRootCa,
-                               pxNetworkCredentials->xRootCaSize );
+static int32_t parseDerChain( mbedtls_x509_crt * pxChain,
+                              const uint8_t * pucDer,
+                              size_t xDerSize )
+{
+    int32_t lMbedtlsError = 0;
+    const uint8_t * pucEnd = pucDer + xDerSize;
+    unsigned char * pucCursor;
+    size_t xLength;
 
-    if( ( pxNetworkCredentials->pucClientCert != NULL ) &&
-        ( pxNetworkCredentials->pucPrivateKey != NULL ) )
+    while( ( lMbedtlsError == 0 ) && ( pucDer < pucEnd ) )
     {
-        if( lMbedtlsError == 0 )
-        {
-            lMbedtlsError = setClientCertificate( pxSslContext,
-                                                  pxNetworkCredentials->pucClientCert,
-                                                  pxNetworkCredentials->xClientCertSize );
-        }
-
-        if( lMbedtlsError == 0 )
-        {
-            lMbedtlsError = setPrivateKey( pxSslContext,
-                                           pxNetworkCredentials->pucPrivateKey,
-                                           pxNetworkCredentials->xPrivateKeySize );
-        }
+        /* Each certificate is an ASN.1 SEQUENCE; its header gives the certificate size. */
+        pucCursor = ( unsigned char * ) pucDer;
+        lMbedtlsError = mbedtls_asn1_get_tag( &pucCursor, pucEnd, &xLength,
+                                              MBEDTLS_ASN1_CONSTRUCTED | MBEDTLS_ASN1_SEQUENCE );
 
         if( lMbedtlsError == 0 )
         {
-            lMbedtlsError = mbedtls_ssl_conf_own_cert( &( pxSslContext->config ),
-                                                       &( pxSslContext->clientCert ),
-                                                       &( pxSslContext->privKey ) );
+            xLength += ( size_t ) ( pucCursor - pucDer );
+            lMbedtlsError = mbedtls_x509_crt_parse_der( pxChain, pucDer, xLength );
+            pucDer += xLength;
         }
     }
 
@@ -398,54 +763,304 @@ static int32_t setCredentials( MbedSSLContext_t * pxSslContext,
 }
 /*-----------------------------------------------------------*/
 
-static void setOptionalConfigurations( MbedSSLContext_t * pxSslContext,
-                                       const char * pcHostName,
-                                       const NetworkCredentials_t * pxNetworkCredentials )
+static int32_t setRootCa( MbedSSLConfig_t * pxSslConfig,
+                          const uint8_t * pucRootCa,
+                          size_t xRootCaSize )
 {
-    int32_t lMbedtlsError = -1;
+    int32_t lMbedtlsError = 0;
+    TlsTrustStore_t * pxTrustStore = NULL;
+    TlsTrustStore_t * pxFree = NULL;
+    uint32_t ulIndex;
 
-    configASSERT( pxSslContext != NULL );
-    configASSERT( pcHostName != NULL );
-    configASSERT( pxNetworkCredentials != NULL );
+    configASSERT( pxSslConfig != NULL );
+    configASSERT( pucRootCa != NULL );
+    configASSERT( pxSslConfig->pxTrustStore == NULL );
 
-    if( pxNetworkCredentials->ppcAlpnProtos != NULL )
+    taskENTER_CRITICAL();
+
+    if( xTrustStoreMutex == NULL )
     {
-        /* Include an application protocol list in the TLS ClientHello
-         * message. */
-        lMbedtlsError = mbedtls_ssl_conf_alpn_protocols( &( pxSslContext->config ),
-                                                         pxNetworkCredentials->ppcAlpnProtos );
+        xTrustStoreMutex = xSemaphoreCreateMutexStatic( &xTrustStoreMutexBuffer );
+    }
 
-        if( lMbedtlsError != 0 )
-        {
-            LogError( ( "Failed to configure ALPN protocol in mbed TLS: lMbedtlsError[%d]= %s : %s.",
+    taskEXIT_CRITICAL();
+
+    /* Held while a chain is parsed, so no other connection frees or parses
+     * the entry meanwhile. */
+    ( void ) xSemaphoreTake( xTrustStoreMutex, portMAX_DELAY );
+
+    for( ulIndex = 0; ulIndex < transporttlsTRUST_STORE_COUNT; ulIndex++ )
+    {
+        if( ( xTrustStores[ ulIndex ].pucSource == pucRootCa ) &&
+            ( xTrustStores[ ulIndex ].xSourceSize == xRootCaSize ) )
+        {
+            pxTrustStore = &( xTrustStores[ ulIndex ] );
+            break;
+        }
+
+        /* An entry never parsed is taken before one the next connection
+         * may need again. */
+        if( ( xTrustStores[ ulIndex ].ulUsers == 0 ) &&
+            ( ( pxFree == NULL ) || ( xTrustStores[ ulIndex ].pucSource == NULL ) ) )
+        {
+            pxFree = &( xTrustStores[ ulIndex ] );
+        }
+    }
+
+    if( ( pxTrustStore == NULL ) && ( pxFree == NULL ) )
+    {
+        LogError( ( "Every trusted root CA chain is in use: set transporttlsTRUST_STORE_COUNT above %d.",
+                    transporttlsTRUST_STORE_COUNT ) );
+        lMbedtlsError = -1;
+    }
+    else if( pxTrustStore == NULL )
+    {
+        pxTrustStore = pxFree;
+
+        if( pxTrustStore->pucSource != NULL )
+        {
+            mbedtls_x509_crt_free( &( pxTrustStore->xChain ) );
+            pxTrustStore->pucSource = NULL;
+        }
+
+        mbedtls_x509_crt_init( &( pxTrustStore->xChain ) );
+
+        /* DER certificates start with an ASN.1 SEQUENCE tag, which skips the PEM decode. */
+        if( ( xRootCaSize > 0 ) &&
+            ( pucRootCa[ 0 ] == ( MBEDTLS_ASN1_CONSTRUCTED | MBEDTLS_ASN1_SEQUENCE ) ) )
+        {
+            lMbedtlsError = parseDerChain( &( pxTrustStore->xChain ),
+                                           pucRootCa,
+                                           xRootCaSize );
+        }
+        else
+        {
+            lMbedtlsError = mbedtls_x509_crt_parse( &( pxTrustStore->xChain ),
+                                                    pucRootCa,
+                                                    xRootCaSize );
+        }
+
+        if( lMbedtlsError != 0 )
+        {
+            LogError( ( "Failed to parse server root CA certificate: lMbedtlsError[%d]= %s : %s.",
                         lMbedtlsError, mbedtlsHighLevelCodeOrDefault( lMbedtlsError ),
                         mbedtlsLowLevelCodeOrDefault( lMbedtlsError ) ) );
+            mbedtls_x509_crt_free( &( pxTrustStore->xChain ) );
+        }
+        else
+        {
+            pxTrustStore->pucSource = pucRootCa;
+            pxTrustStore->xSourceSize = xRootCaSize;
+        }
+    }
+
+    if( lMbedtlsError == 0 )
+    {
+        pxTrustStore->ulUsers++;
+        pxSslConfig->pxTrustStore = pxTrustStore;
+    }
+
+    ( void ) xSemaphoreGive( xTrustStoreMutex );
+
+    if( lMbedtlsError == 0 )
+    {
+        mbedtls_ssl_conf_ca_chain( &( pxSslConfig->config ),
+                                   &( pxTrustStore->xChain ),
+                                   NULL );
+    }
+
+    return lMbedtlsError;
+}
+/*-----------------------------------------------------------*/
+
+static int32_t setClientCertificate( MbedSSLConfig_t * pxSslConfig,
+                                     const uint8_t * pucClientCert,
+                                     size_t xClientCertSize )
+{
+    int32_t lMbedtlsError = -1;
+
+    configASSERT( pxSslConfig != NULL );
+    configASSERT( pucClientCert != NULL );
+
+    /* Setup the client certificate. */
+    lMbedtlsError = mbedtls_x509_crt_parse( &( pxSslConfig->clientCert ),
+                                            pucClientCert,
+                                            xClientCertSize );
+
+    if( lMbedtlsError != 0 )
+    {
+        LogError( ( "Failed to parse the client certificate: lMbedtlsError[%d]= %s : %s.",
+                    lMbedtlsError, mbedtlsHighLevelCodeOrDefault( lMbedtlsError ),
+                    mbedtlsLowLevelCodeOrDefault( lMbedtlsError ) ) );
+    }
+
+    return lMbedtlsError;
+}
+/*-----------------------------------------------------------*/
+
+static int32_t setPrivateKey( MbedSSLConfig_t * pxSslConfig,
+                              const uint8_t * pucPrivateKey,
+                              size_t xPrivateKeySize )
+{
+    int32_t lMbedtlsError = -1;
+
+    configASSERT( pxSslConfig != NULL );
+    configASSERT( pucPrivateKey != NULL );
+
+    /* Setup the client private key. */
+    lMbedtlsError = mbedtls_pk_parse_key( &( pxSslConfig->privKey ),
+                                          pucPrivateKey,
+                                          xPrivateKeySize,
+                                          NULL,
+                                          0 );
+
+    if( lMbedtlsError != 0 )
+    {
+        LogError( ( "Failed to parse the client key: lMbedtlsError[%d]= %s : %s.",
+                    lMbedtlsError, mbedtlsHighLevelCodeOrDefault( lMbedtlsError ),
+                    mbedtlsLowLevelCodeOrDefault( lMbedtlsError ) ) );
+    }
+
+    return lMbedtlsError;
+}
+/*-----------------------------------------------------------*/
+
+static int32_t setCredentials( MbedSSLConfig_t * pxSslConfig,
+                               const NetworkCredentials_t * pxNetworkCredentials )
+{
+    int32_t lMbedtlsError = -1;
+
+    configASSERT( pxSslConfig != NULL );
+    configASSERT( pxNetworkCredentials != NULL );
+
+    /* Set up the certificate security profile, starting from the default value. */
+    pxSslConfig->certProfile = mbedtls_x509_crt_profile_default;
+
+    /* Set SSL authmode and the RNG context. */
+    mbedtls_ssl_conf_authmode( &( pxSslConfig->config ),
+                               MBEDTLS_SSL_VERIFY_REQUIRED );
+    mbedtls_ssl_conf_rng( &( pxSslConfig->config ),
+                          Crypto_Random,
+                          NULL );
+    mbedtls_ssl_conf_cert_profile( &( pxSslConfig->config ),
+                                   &( pxSslConfig->certProfile ) );
+
+    lMbedtlsError = setRootCa( pxSslConfig,
+                               pxNetworkCredentials->pucRootCa,
+                               pxNetworkCredentials->xRootCaSize );
+
+    if( ( pxNetworkCredentials->pvParsedClientCert != NULL ) &&
+        ( pxNetworkCredentials->pvParsedPrivateKey != NULL ) )
+    {
+        /* Parsed by the caller, so neither is parsed nor freed here. */
+        if( lMbedtlsError == 0 )
+        {
+            lMbedtlsError = mbedtls_ssl_conf_own_cert( &( pxSslConfig->config ),
+                                                       ( mbedtls_x509_crt * ) pxNetworkCredentials->pvParsedClientCert,
+                                                       ( mbedtls_pk_context * ) pxNetworkCredentials->pvParsedPrivateKey );
+        }
+    }
+    else if( ( pxNetworkCredentials->pucClientCert != NULL ) &&
+             ( pxNetworkCredentials->pucPrivateKey != NULL ) )
+    {
+        if( lMbedtlsError == 0 )
+        {
+            lMbedtlsError = setClientCertificate( pxSslConfig,
+                                                  pxNetworkCredentials->pucClientCert,
+                                                  pxNetworkCredentials->xClientCertSize );
+        }
+
+        if( lMbedtlsError == 0 )
+        {
+            lMbedtlsError = setPrivateKey( pxSslConfig,
+                                           pxNetworkCredentials->pucPrivateKey,
+                                           pxNetworkCredentials->xPrivateKeySize );
+        }
+
+        if( lMbedtlsError == 0 )
+        {
+            lMbedtlsError = mbedtls_ssl_conf_own_cert( &( pxSslConfig->config ),
+                                                       &( pxSslConfig->clientCert ),
+                                                       &( pxSslConfig->privKey ) );
         }
     }
 
-    /* Enable SNI if requested. */
-    if( pxNetworkCredentials->xDisableSni == pdFALSE )
+    return lMbedtlsError;
+}
+/*-----------------------------------------------------------*/
+
+static void setOptionalConfigurations( MbedSSLConfig_t * pxSslConfig,
+                                       const NetworkCredentials_t * pxNetworkCredentials )
+{
+    int32_t lMbedtlsError = -1;
+
+    #ifdef MBEDTLS_SSL_MAX_FRAGMENT_LENGTH
+        uint8_t ucMaxFragmentLengthCode;
+    #endif
+
+    configASSERT( pxSslConfig != NULL );
+    configASSERT( pxNetworkCredentials != NULL );
+
+    if( pxNetworkCredentials->ppcAlpnProtos != NULL )
     {
-        lMbedtlsError = mbedtls_ssl_set_hostname( &( pxSslContext->context ),
-                                                  pcHostName );
+        /* Include an application protocol list in the TLS ClientHello
+         * message. */
+        lMbedtlsError = mbedtls_ssl_conf_alpn_protocols( &( pxSslConfig->config ),
+                                                         pxNetworkCredentials->ppcAlpnProtos );
 
         if( lMbedtlsError != 0 )
         {
-            LogError( ( "Failed to set server name: lMbedtlsError[%d]= %s : %s.",
+            LogError( ( "Failed to configure ALPN protocol in mbed TLS: lMbedtlsError[%d]= %s : %s.",
                         lMbedtlsError, mbedtlsHighLevelCodeOrDefault( lMbedtlsError ),
                         mbedtlsLowLevelCodeOrDefault( lMbedtlsError ) ) );
         }
     }
 
+    if( pxNetworkCredentials->xProfile == eTLSTransportProfileEcdheAes128Gcm )
+    {
+        mbedtls_ssl_conf_ciphersuites( &( pxSslConfig->config ),
+                                       lEcdheAes128GcmCipherSuites );
+        mbedtls_ssl_conf_curves( &( pxSslConfig->config ),
+                                 xEcdheAes128GcmCurves );
+    }
+
     /* Set Maximum Fragment Length if enabled. */
     #ifdef MBEDTLS_SSL_MAX_FRAGMENT_LENGTH
 
         /* Enable the max fragment extension. 4096 bytes is currently the largest fragment size permitted.
          * See RFC 8449 https://tools.ietf.org/html/rfc8449 for more information.
          *
-         * Smaller values can be found in "mbedtls/include/ssl.h".
+         * With MBEDTLS_SSL_VARIABLE_BUFFER_LENGTH, which the context pool leaves out,
+         * the record buffers are shrunk to the negotiated length once the handshake
+         * completes.
          */
-        lMbedtlsError = mbedtls_ssl_conf_max_frag_len( &( pxSslContext->config ), MBEDTLS_SSL_MAX_FRAG_LEN_4096 );
+        switch( pxNetworkCredentials->usMaxFragmentLength )
+        {
+            case 512:
+                ucMaxFragmentLengthCode = MBEDTLS_SSL_MAX_FRAG_LEN_512;
+                break;
+
+            case 1024:
+                ucMaxFragmentLengthCode = MBEDTLS_SSL_MAX_FRAG_LEN_1024;
+                break;
+
+            case 2048:
+                ucMaxFragmentLengthCode = MBEDTLS_SSL_MAX_FRAG_LEN_2048;
+                break;
+
+            case 0:
+            case 4096:
+                ucMaxFragmentLengthCode = MBEDTLS_SSL_MAX_FRAG_LEN_4096;
+                break;
+
+            default:
+                LogWarn( ( "Unsupported maximum fragment length %u, using 4096.",
+                           pxNetworkCredentials->usMaxFragmentLength ) );
+                ucMaxFragmentLengthCode = MBEDTLS_SSL_MAX_FRAG_LEN_4096;
+                break;
+        }
+
+        lMbedtlsError = mbedtls_ssl_conf_max_frag_len( &( pxSslConfig->config ), ucMaxFragmentLengthCode );
 
         if( lMbedtlsError != 0 )
         {
@@ -457,30 +1072,17 @@ static void setOptionalConfigurations( MbedSSLContext_t * pxSslContext,
 }
 /*-----------------------------------------------------------*/
 
-static TlsTransportStatus_t tlsSetup( NetworkContext_t * pxNetworkContext,
-                                      const char * pcHostName,
-                                      const NetworkCredentials_t * pxNetworkCredentials )
+static TlsTransportStatus_t sslConfigSetup( MbedSSLConfig_t * pxSslConfig,
+                                            const NetworkCredentials_t * pxNetworkCredentials )
 {
-    TlsTransportParams_t * pxTlsTransportParams = NULL;
     TlsTransportStatus_t xRetVal = eTLSTransportSuccess;
     int32_t lMbedtlsError = 0;
-    MbedSSLContext_t * pxSSLContext = NULL;
 
-    configASSERT( pxNetworkContext != NULL );
-    configASSERT( pxNetworkContext->pParams != NULL );
-    configASSERT( pcHostName != NULL );
+    configASSERT( pxSslConfig != NULL );
     configASSERT( pxNetworkCredentials != NULL );
     configASSERT( pxNetworkCredentials->pucRootCa != NULL );
 
-    pxTlsTransportParams = ( TlsTransportParams_t * ) pxNetworkContext->pParams;
-    configASSERT( pxTlsTransportParams->xSSLContext != NULL );
-
-    pxSSLContext = ( MbedSSLContext_t * ) pxTlsTransportParams->xSSLContext;
-
-    /* Initialize the mbed TLS context structures. */
-    sslContextInit( pxSSLContext );
-
-    lMbedtlsError = mbedtls_ssl_config_defaults( &( pxSSLContext->config ),
+    lMbedtlsError = mbedtls_ssl_config_defaults( &( pxSslConfig->config ),
                                                  MBEDTLS_SSL_IS_CLIENT,
                                                  MBEDTLS_SSL_TRANSPORT_STREAM,
                                                  MBEDTLS_SSL_PRESET_DEFAULT );
@@ -497,7 +1099,7 @@ static TlsTransportStatus_t tlsSetup( NetworkContext_t * pxNetworkContext,
 
     if( xRetVal == eTLSTransportSuccess )
     {
-        lMbedtlsError = setCredentials( pxSSLContext,
+        lMbedtlsError = setCredentials( pxSslConfig,
                                         pxNetworkCredentials );
 
         if( lMbedtlsError != 0 )
@@ -506,9 +1108,8 @@ static TlsTransportStatus_t tlsSetup( NetworkContext_t * pxNetworkContext,
         }
         else
         {
-            /* Optionally set SNI and ALPN protocols. */
-            setOptionalConfigurations( pxSSLContext,
-                                       pcHostName,
+            /* Optionally set ALPN protocols. */
+            setOptionalConfigurations( pxSslConfig,
                                        pxNetworkCredentials );
         }
     }
@@ -517,16 +1118,187 @@ static TlsTransportStatus_t tlsSetup( NetworkContext_t * pxNetworkContext,
 }
 /*-----------------------------------------------------------*/
 
-static TlsTransportStatus_t tlsHandshake( NetworkContext_t * pxNetworkContext,
-                                          const NetworkCredentials_t * pxNetworkCredentials )
+static TlsTransportStatus_t tlsSetup( NetworkContext_t * pxNetworkContext,
+                                      const char * pcHostName,
+                                      const NetworkCredentials_t * pxNetworkCredentials )
+{
+    TlsTransportParams_t * pxTlsTransportParams = NULL;
+    TlsTransportStatus_t xRetVal = eTLSTransportSuccess;
+    int32_t lMbedtlsError = 0;
+    MbedSSLContext_t * pxSSLContext = NULL;
+    MbedSSLConfig_t * pxSSLConfig = NULL;
+    TlsSharedConfig_t * pxSharedConfig;
+
+    configASSERT( pxNetworkContext != NULL );
+    configASSERT( pxNetworkContext->pParams != NULL );
+    configASSERT( pcHostName != NULL );
+    configASSERT( pxNetworkCredentials != NULL );
+    configASSERT( pxNetworkCredentials->pucRootCa != NULL );
+
+    pxTlsTransportParams = ( TlsTransportParams_t * ) pxNetworkContext->pParams;
+    configASSERT( pxTlsTransportParams->xSSLContext != NULL );
+
+    pxSSLContext = ( MbedSSLContext_t * ) pxTlsTransportParams->xSSLContext;
+    pxSharedConfig = pxNetworkCredentials->pxSharedConfig;
+
+    if( ( pxSharedConfig != NULL ) && ( pxSharedConfig->pvConfig != NULL ) )
+    {
+        /* Set up by an earlier connection, so nothing is parsed again. */
+        pxSSLConfig = ( MbedSSLConfig_t * ) pxSharedConfig->pvConfig;
+    }
+    else if( ( pxSSLConfig = sslConfigAlloc() ) == NULL )
+    {
+        LogError( ( "Failed to allocate mbed ssl configuration memory." ) );
+        xRetVal = eTLSTransportInsufficientMemory;
+    }
+    else
+    {
+        sslConfigInit( pxSSLConfig );
+        xRetVal = sslConfigSetup( pxSSLConfig, pxNetworkCredentials );
+
+        if( xRetVal != eTLSTransportSuccess )
+        {
+            sslConfigFree( pxSSLConfig );
+            sslConfigRelease( pxSSLConfig );
+        }
+        else if( pxSharedConfig != NULL )
+        {
+            pxSharedConfig->pvConfig = pxSSLConfig;
+        }
+    }
+
+    if( xRetVal == eTLSTransportSuccess )
+    {
+        pxSSLContext->pxConfig = pxSSLConfig;
+
+        if( pxSharedConfig != NULL )
+        {
+            taskENTER_CRITICAL();
+            pxSharedConfig->ulUsers++;
+            taskEXIT_CRITICAL();
+
+            pxSSLContext->pxSharedConfig = pxSharedConfig;
+        }
+
+        /* Enable SNI if requested. The name is set on the connection, so it
+         * can differ between the connections of a shared configuration. */
+        if( pxNetworkCredentials->xDisableSni == pdFALSE )
+        {
+            lMbedtlsError = mbedtls_ssl_set_hostname( &( pxSSLContext->context ),
+                                                      pcHostName );
+
+            if( lMbedtlsError != 0 )
+            {
+                LogError( ( "Failed to set server name: lMbedtlsError[%d]= %s : %s.",
+                            lMbedtlsError, mbedtlsHighLevelCodeOrDefault( lMbedtlsError ),
+                            mbedtlsLowLevelCodeOrDefault( lMbedtlsError ) ) );
+            }
+        }
+    }
+
+    return xRetVal;
+}
+/*-----------------------------------------------------------*/
+
+static TlsSessionCacheEntry_t * sessionCacheGetEntry( TlsSessionCache_t * pxSessionCache,
+                                                      const char * pcHostName )
+{
+    TlsSessionCacheEntry_t * pxEntry = NULL;
+    size_t xHostNameLength = strlen( pcHostName );
+    uint32_t ulIndex;
+
+    if( xHostNameLength >= sizeof( pxSessionCache->xEntries[ 0 ].cHostName ) )
+    {
+        LogWarn( ( "Host name too long to cache TLS session." ) );
+        return NULL;
+    }
+
+    for( ulIndex = 0; ulIndex < transporttlsSESSION_CACHE_ENTRIES; ulIndex++ )
+    {
+        if( strcmp( pxSessionCache->xEntries[ ulIndex ].cHostName, pcHostName ) == 0 )
+        {
+            return &( pxSessionCache->xEntries[ ulIndex ] );
+        }
+
+        if( ( pxEntry == NULL ) && ( pxSessionCache->xEntries[ ulIndex ].cHostName[ 0 ] == '\0' ) )
+        {
+            pxEntry = &( pxSessionCache->xEntries[ ulIndex ] );
+        }
+    }
+
+    /* Host not cached and no free slot, evict the last entry. */
+    if( pxEntry == NULL )
+    {
+        pxEntry = &( pxSessionCache->xEntries[ transporttlsSESSION_CACHE_ENTRIES - 1 ] );
+        sessionCacheDropSession( pxEntry );
+    }
+
+    memcpy( pxEntry->cHostName, pcHostName, xHostNameLength + 1 );
+
+    return pxEntry;
+}
+/*-----------------------------------------------------------*/
+
+static void sessionCacheDropSession( TlsSessionCacheEntry_t * pxEntry )
+{
+    if( pxEntry->pvSession != NULL )
+    {
+        mbedtls_ssl_session_free( ( mbedtls_ssl_session * ) pxEntry->pvSession );
+        mbedtls_free( pxEntry->pvSession );
+        pxEntry->pvSession = NULL;
+    }
+}
+/*-----------------------------------------------------------*/
+
+static void sessionCacheSaveSession( TlsSessionCacheEntry_t * pxEntry,
+                                     MbedSSLContext_t * pxSslContext )
+{
+    int32_t lMbedtlsError;
+
+    if( pxEntry->pvSession == NULL )
+    {
+        /* From the allocator of mbedTLS, which holds the rest of the session. */
+        pxEntry->pvSession = mbedtls_calloc( 1, sizeof( mbedtls_ssl_session ) );
+
+        if( pxEntry->pvSession == NULL )
+        {
+            LogWarn( ( "Failed to allocate memory for TLS session cache entry." ) );
+            return;
+        }
+    }
+    else
+    {
+        mbedtls_ssl_session_free( ( mbedtls_ssl_session * ) pxEntry->pvSession );
+    }
+
+    mbedtls_ssl_session_init( ( mbedtls_ssl_session * ) pxEntry->pvSession );
+
+    lMbedtlsError = mbedtls_ssl_get_session( &( pxSslContext->context ),
+                                             ( mbedtls_ssl_session * ) pxEntry->pvSession );
+
+    if( lMbedtlsError != 0 )
+    {
+        LogWarn( ( "Failed to save TLS session: lMbedtlsError[%d]= %s : %s.",
+                   lMbedtlsError, mbedtlsHighLevelCodeOrDefault( lMbedtlsError ),
+                   mbedtlsLowLevelCodeOrDefault( lMbedtlsError ) ) );
+        sessionCacheDropSession( pxEntry );
+    }
+}
+/*-----------------------------------------------------------*/
+
+static TlsTransportStatus_t tlsHandshakeStart( NetworkContext_t * pxNetworkContext,
+                                               const char * pcHostName,
+                                               const NetworkCredentials_t * pxNetworkCredentials )
 {
     TlsTransportParams_t * pxTlsTransportParams = NULL;
     TlsTransportStatus_t xRetVal = eTLSTransportSuccess;
     int32_t lMbedtlsError = 0;
     MbedSSLContext_t * pxSSLContext = NULL;
+    TlsSessionCacheEntry_t * pxCacheEntry = NULL;
 
     configASSERT( pxNetworkContext != NULL );
     configASSERT( pxNetworkContext->pParams != NULL );
+    configASSERT( pcHostName != NULL );
     configASSERT( pxNetworkCredentials != NULL );
 
     pxTlsTransportParams = ( TlsTransportParams_t * ) pxNetworkContext->pParams;
@@ -536,7 +1308,7 @@ static TlsTransportStatus_t tlsHandshake( NetworkContext_t * pxNetworkContext,
 
     /* Initialize the mbed TLS secured connection context. */
     lMbedtlsError = mbedtls_ssl_setup( &( pxSSLContext->context ),
-                                       &( pxSSLContext->config ) );
+                                       &( pxSSLContext->pxConfig->config ) );
 
     if( lMbedtlsError != 0 )
     {
@@ -560,86 +1332,260 @@ static TlsTransportStatus_t tlsHandshake( NetworkContext_t * pxNetworkContext,
                              mbedtls_platform_send,
                              mbedtls_platform_recv,
                              NULL );
-    }
+        mbedtls_ssl_set_verify( &( pxSSLContext->context ),
+                                certificateVerified,
+                                pxSSLContext );
 
-    if( xRetVal == eTLSTransportSuccess )
-    {
-        /* Perform the TLS handshake. */
-        do
+        if( pxNetworkCredentials->pxSessionCache != NULL )
         {
-            lMbedtlsError = mbedtls_ssl_handshake( &( pxSSLContext->context ) );
-        } while( ( lMbedtlsError == MBEDTLS_ERR_SSL_WANT_READ ) ||
-                 ( lMbedtlsError == MBEDTLS_ERR_SSL_WANT_WRITE ) );
+            pxCacheEntry = sessionCacheGetEntry( pxNetworkCredentials->pxSessionCache, pcHostName );
+        }
 
-        if( lMbedtlsError != 0 )
+        /* Offer the saved session to the server for an abbreviated handshake.
+         * If the server does not accept it, a full handshake is performed. */
+        if( ( pxCacheEntry != NULL ) && ( pxCacheEntry->pvSession != NULL ) )
         {
-            LogError( ( "Failed to perform TLS handshake: lMbedtlsError[%d]= %s : %s.",
-                        lMbedtlsError, mbedtlsHighLevelCodeOrDefault( lMbedtlsError ),
-                        mbedtlsLowLevelCodeOrDefault( lMbedtlsError ) ) );
+            lMbedtlsError = mbedtls_ssl_set_session( &( pxSSLContext->context ),
+                                                     ( const mbedtls_ssl_session * ) pxCacheEntry->pvSession );
 
-            xRetVal = eTLSTransportHandshakeFailed;
-        }
-        else
-        {
-            LogInfo( ( "(Network connection %p) TLS handshake successful.",
-                       pxNetworkContext ) );
+            if( lMbedtlsError != 0 )
+            {
+                LogWarn( ( "Failed to set cached TLS session: lMbedtlsError[%d]= %s : %s.",
+                           lMbedtlsError, mbedtlsHighLevelCodeOrDefault( lMbedtlsError ),
+                           mbedtlsLowLevelCodeOrDefault( lMbedtlsError ) ) );
+                sessionCacheDropSession( pxCacheEntry );
+            }
+            else
+            {
+                LogDebug( ( "Resuming cached TLS session for %s.", pcHostName ) );
+            }
         }
     }
 
+    pxSSLContext->pxCacheEntry = pxCacheEntry;
+    sampletraceBEGIN( eSampleTraceTlsHandshake, 0 );
+    pxSSLContext->xHandshakeStartTick = xTaskGetTickCount();
+    pxSSLContext->xHandshakeHeapBaseline = transporttlsFREE_HEAP_SIZE();
+    pxSSLContext->xHandshakeHeapLow = pxSSLContext->xHandshakeHeapBaseline;
+    pxSSLContext->xFullHandshake = pdFALSE;
+    perfgovernorBOOST();
+    pxSSLContext->xPerfBoosted = pdTRUE;
+
     return xRetVal;
 }
 /*-----------------------------------------------------------*/
 
-static TlsTransportStatus_t initMbedtls( mbedtls_entropy_context * pxEntropyContext,
-                                         mbedtls_ctr_drbg_context * pxCtrDrgbContext )
+static int certificateVerified( void * pvContext,
+                                mbedtls_x509_crt * pxCertificate,
+                                int lDepth,
+                                uint32_t * pulFlags )
 {
+    ( void ) pxCertificate;
+    ( void ) lDepth;
+    ( void ) pulFlags;
+
+    ( ( MbedSSLContext_t * ) pvContext )->xFullHandshake = pdTRUE;
+
+    return 0;
+}
+/*-----------------------------------------------------------*/
+
+static TlsTransportStatus_t tlsHandshakeStep( NetworkContext_t * pxNetworkContext )
+{
+    TlsTransportParams_t * pxTlsTransportParams = NULL;
     TlsTransportStatus_t xRetVal = eTLSTransportSuccess;
     int32_t lMbedtlsError = 0;
+    MbedSSLContext_t * pxSSLContext = NULL;
 
-    /* Set the mutex functions for mbed TLS thread safety. */
-    mbedtls_threading_set_alt( mbedtls_platform_mutex_init,
-                               mbedtls_platform_mutex_free,
-                               mbedtls_platform_mutex_lock,
-                               mbedtls_platform_mutex_unlock );
+    configASSERT( pxNetworkContext != NULL );
+    configASSERT( pxNetworkContext->pParams != NULL );
 
-    /* Initialize contexts for random number generation. */
-    mbedtls_entropy_init( pxEntropyContext );
-    mbedtls_ctr_drbg_init( pxCtrDrgbContext );
+    pxTlsTransportParams = ( TlsTransportParams_t * ) pxNetworkContext->pParams;
+    configASSERT( pxTlsTransportParams->xSSLContext != NULL );
 
-    /* Add a strong entropy source. At least one is required. */
-    lMbedtlsError = mbedtls_entropy_add_source( pxEntropyContext,
-                                                mbedtls_platform_entropy_poll,
-                                                NULL,
-                                                32,
-                                                MBEDTLS_ENTROPY_SOURCE_STRONG );
+    pxSSLContext = ( MbedSSLContext_t * ) pxTlsTransportParams->xSSLContext;
 
-    if( lMbedtlsError != 0 )
+    /* The handshake runs until it needs data the socket does not have yet,
+     * returning 0 only once it is over. */
+    lMbedtlsError = mbedtls_ssl_handshake( &( pxSSLContext->context ) );
+
+    if( pxSSLContext->pxStats != NULL )
+    {
+        if( transporttlsFREE_HEAP_SIZE() < pxSSLContext->xHandshakeHeapLow )
+        {
+            pxSSLContext->xHandshakeHeapLow = transporttlsFREE_HEAP_SIZE();
+        }
+
+        if( lMbedtlsError == MBEDTLS_ERR_SSL_WANT_READ )
+        {
+            pxSSLContext->pxStats->ulWantReadRetries++;
+        }
+    }
+
+    if( ( lMbedtlsError == MBEDTLS_ERR_SSL_WANT_READ ) ||
+        ( lMbedtlsError == MBEDTLS_ERR_SSL_WANT_WRITE ) )
+    {
+        xRetVal = eTLSTransportInProgress;
+    }
+    else if( lMbedtlsError != 0 )
     {
-        LogError( ( "Failed to add entropy source: lMbedtlsError[%d]= %s : %s.",
+        LogError( ( "Failed to perform TLS handshake: lMbedtlsError[%d]= %s : %s.",
                     lMbedtlsError, mbedtlsHighLevelCodeOrDefault( lMbedtlsError ),
                     mbedtlsLowLevelCodeOrDefault( lMbedtlsError ) ) );
-        xRetVal = eTLSTransportInternalError;
+
+        xRetVal = eTLSTransportHandshakeFailed;
+
+        /* Do not offer a session that may be the cause of the failure again. */
+        if( pxSSLContext->pxCacheEntry != NULL )
+        {
+            sessionCacheDropSession( pxSSLContext->pxCacheEntry );
+        }
     }
+    else
+    {
+        LogInfo( ( "(Network connection %p) TLS handshake successful, %s with cipher suite %s.",
+                   pxNetworkContext,
+                   mbedtls_ssl_get_version( &( pxSSLContext->context ) ),
+                   mbedtls_ssl_get_ciphersuite( &( pxSSLContext->context ) ) ) );
 
-    if( xRetVal == eTLSTransportSuccess )
+        if( pxSSLContext->pxCacheEntry != NULL )
+        {
+            sessionCacheSaveSession( pxSSLContext->pxCacheEntry, pxSSLContext );
+        }
+
+        if( pxSSLContext->pxStats != NULL )
+        {
+            pxSSLContext->pxStats->ulHandshakeTimeMs =
+                ( uint32_t ) ( ( xTaskGetTickCount() - pxSSLContext->xHandshakeStartTick ) * portTICK_PERIOD_MS );
+            pxSSLContext->pxStats->ulSessionResumed = ( pxSSLContext->xFullHandshake == pdTRUE ) ? 0U : 1U;
+            pxSSLContext->pxStats->xHandshakePeakHeap =
+                pxSSLContext->xHandshakeHeapBaseline - pxSSLContext->xHandshakeHeapLow;
+        }
+    }
+
+    if( xRetVal != eTLSTransportInProgress )
     {
-        /* Seed the random number generator. */
-        lMbedtlsError = mbedtls_ctr_drbg_seed( pxCtrDrgbContext,
-                                               mbedtls_entropy_func,
-                                               pxEntropyContext,
-                                               NULL,
-                                               0 );
+        sslContextPerfRelease( pxSSLContext );
+    }
 
-        if( lMbedtlsError != 0 )
+    return xRetVal;
+}
+/*-----------------------------------------------------------*/
+
+static BaseType_t tcpConnect( TlsTransportParams_t * pxTlsTransportParams,
+                              const char * pcHostName,
+                              uint16_t usPort )
+{
+    BaseType_t xSocketStatus;
+    TickType_t xConnectStart = xTaskGetTickCount();
+    TickType_t xResolveTime;
+
+    sampletraceBEGIN( eSampleTraceTcpConnect, usPort );
+    xSocketStatus = Sockets_Connect( pxTlsTransportParams->xTCPSocket,
+                                     pcHostName,
+                                     usPort );
+    sampletraceEND( eSampleTraceTcpConnect, xSocketStatus );
+
+    if( ( xSocketStatus == 0 ) && ( pxTlsTransportParams->pxStats != NULL ) )
+    {
+        xResolveTime = Sockets_GetLastResolveTime();
+        pxTlsTransportParams->pxStats->ulDnsTimeMs = ( uint32_t ) ( xResolveTime * portTICK_PERIOD_MS );
+        pxTlsTransportParams->pxStats->ulConnectTimeMs =
+            ( uint32_t ) ( ( xTaskGetTickCount() - xConnectStart - xResolveTime ) * portTICK_PERIOD_MS );
+    }
+
+    return xSocketStatus;
+}
+/*-----------------------------------------------------------*/
+
+static void statsCountWrite( MbedSSLContext_t * pxSSLContext,
+                             int32_t lMbedtlsError )
+{
+    if( pxSSLContext->pxStats == NULL )
+    {
+        return;
+    }
+
+    if( lMbedtlsError > 0 )
+    {
+        /* Each successful write emits a single record. */
+        pxSSLContext->pxStats->ulBytesSent += ( uint32_t ) lMbedtlsError;
+        pxSSLContext->pxStats->ulRecordsSent++;
+    }
+    else if( ( lMbedtlsError == MBEDTLS_ERR_SSL_TIMEOUT ) ||
+             ( lMbedtlsError == MBEDTLS_ERR_SSL_WANT_READ ) ||
+             ( lMbedtlsError == MBEDTLS_ERR_SSL_WANT_WRITE ) )
+    {
+        pxSSLContext->pxStats->ulTimeouts++;
+    }
+}
+/*-----------------------------------------------------------*/
+
+static void statsCountRead( MbedSSLContext_t * pxSSLContext,
+                            int32_t lMbedtlsError )
+{
+    if( pxSSLContext->pxStats == NULL )
+    {
+        return;
+    }
+
+    if( lMbedtlsError > 0 )
+    {
+        /* Each successful read returns data from a single record. */
+        pxSSLContext->pxStats->ulBytesReceived += ( uint32_t ) lMbedtlsError;
+        pxSSLContext->pxStats->ulRecordsReceived++;
+    }
+    else if( ( lMbedtlsError == MBEDTLS_ERR_SSL_TIMEOUT ) ||
+             ( lMbedtlsError == MBEDTLS_ERR_SSL_WANT_READ ) ||
+             ( lMbedtlsError == MBEDTLS_ERR_SSL_WANT_WRITE ) )
+    {
+        if( lMbedtlsError == MBEDTLS_ERR_SSL_WANT_READ )
         {
-            LogError( ( "Failed to seed PRNG: lMbedtlsError[%d]= %s : %s.",
-                        lMbedtlsError, mbedtlsHighLevelCodeOrDefault( lMbedtlsError ),
-                        mbedtlsLowLevelCodeOrDefault( lMbedtlsError ) ) );
-            xRetVal = eTLSTransportInternalError;
+            pxSSLContext->pxStats->ulWantReadRetries++;
         }
+
+        pxSSLContext->pxStats->ulTimeouts++;
     }
+}
+/*-----------------------------------------------------------*/
 
-    if( xRetVal == eTLSTransportSuccess )
+static void connectCleanup( NetworkContext_t * pxNetworkContext )
+{
+    TlsTransportParams_t * pxTlsTransportParams = NULL;
+    MbedSSLContext_t * pxSSLContext = NULL;
+
+    if( ( pxNetworkContext != NULL ) && ( pxNetworkContext->pParams != NULL ) )
+    {
+        pxTlsTransportParams = ( TlsTransportParams_t * ) pxNetworkContext->pParams;
+        pxSSLContext = ( MbedSSLContext_t * ) pxTlsTransportParams->xSSLContext;
+
+        if( pxSSLContext != NULL )
+        {
+            sslContextFree( pxSSLContext );
+            sslContextRelease( pxSSLContext );
+            pxTlsTransportParams->xSSLContext = NULL;
+        }
+
+        if( pxTlsTransportParams->xTCPSocket != SOCKETS_INVALID_SOCKET )
+        {
+            ( void ) Sockets_Disconnect( pxTlsTransportParams->xTCPSocket );
+            ( void ) Sockets_Close( pxTlsTransportParams->xTCPSocket );
+            pxTlsTransportParams->xTCPSocket = SOCKETS_INVALID_SOCKET;
+        }
+    }
+}
+/*-----------------------------------------------------------*/
+
+static TlsTransportStatus_t initMbedtls( void )
+{
+    TlsTransportStatus_t xRetVal = eTLSTransportSuccess;
+
+    if( Crypto_Init() != 0 )
+    {
+        LogError( ( "Failed to initialize the random number generator." ) );
+        xRetVal = eTLSTransportInternalError;
+    }
+    else
     {
         LogDebug( ( "Successfully initialized mbedTLS." ) );
     }
@@ -648,12 +1594,12 @@ static TlsTransportStatus_t initMbedtls( mbedtls_entropy_context * pxEntropyCont
 }
 /*-----------------------------------------------------------*/
 
-TlsTransportStatus_t TLS_Socket_Connect( NetworkContext_t * pxNetworkContext,
-                                         const char * pcHostName,
-                                         uint16_t usPort,
-                                         const NetworkCredentials_t * pxNetworkCredentials,
-                                         uint32_t ulReceiveTimeoutMs,
-                                         uint32_t ulSendTimeoutMs )
+TlsTransportStatus_t TLS_Socket_ConnectStart( NetworkContext_t * pxNetworkContext,
+                                              const char * pcHostName,
+                                              uint16_t usPort,
+                                              const NetworkCredentials_t * pxNetworkCredentials,
+                                              uint32_t ulReceiveTimeoutMs,
+                                              uint32_t ulSendTimeoutMs )
 {
     TlsTransportParams_t * pxTlsTransportParams = NULL;
     TlsTransportStatus_t xRetVal = eTLSTransportSuccess;
@@ -679,7 +1625,7 @@ TlsTransportStatus_t TLS_Socket_Connect( NetworkContext_t * pxNetworkContext,
         LogError( ( "pucRootCa cannot be NULL." ) );
         xRetVal = eTLSTransportInvalidParameter;
     }
-    else if( ( pxSSLContext = pvPortMalloc( sizeof( MbedSSLContext_t ) ) ) == NULL )
+    else if( ( pxSSLContext = sslContextAlloc() ) == NULL )
     {
         LogError( ( "Failed to allocate mbed ssl context memmory ." ) );
         xRetVal = eTLSTransportInsufficientMemory;
@@ -689,6 +1635,12 @@ TlsTransportStatus_t TLS_Socket_Connect( NetworkContext_t * pxNetworkContext,
         pxTlsTransportParams = pxNetworkContext->pParams;
         pxTlsTransportParams->xSSLContext = ( SSLContextHandle ) pxSSLContext;
 
+        /* Initialize the mbed TLS context structures. */
+        sslContextInit( pxSSLContext );
+        pxSSLContext->pxStats = pxTlsTransportParams->pxStats;
+        /* Like the socket, a 0 timeout is wait forever. */
+        pxSSLContext->xSendTimeout = ( xSendTimeout == 0U ) ? portMAX_DELAY : xSendTimeout;
+
         if( ( pxTlsTransportParams->xTCPSocket = Sockets_Open() ) == SOCKETS_INVALID_SOCKET )
         {
             LogError( ( "Failed to open socket." ) );
@@ -710,52 +1662,108 @@ TlsTransportStatus_t TLS_Socket_Connect( NetworkContext_t * pxNetworkContext,
             LogError( ( "Failed to set send timeout on socket %d.", xSocketStatus ) );
             xRetVal = eTLSTransportInternalError;
         }
-        else if( ( xSocketStatus = Sockets_Connect( pxTlsTransportParams->xTCPSocket,
-                                                    pcHostName,
-                                                    usPort ) ) != 0 )
+        else if( ( xSocketStatus = tcpConnect( pxTlsTransportParams,
+                                               pcHostName,
+                                               usPort ) ) != 0 )
         {
             LogError( ( "Failed to connect to %s with error %d.",
                         pcHostName,
                         xSocketStatus ) );
             xRetVal = eTLSTransportConnectFailure;
         }
-        else if( ( xRetVal = initMbedtls( &( pxSSLContext->entropyContext ),
-                                          &( pxSSLContext->ctrDrgbContext ) ) ) != eTLSTransportSuccess )
+        else if( ( xRetVal = initMbedtls() ) != eTLSTransportSuccess )
+        {
+            LogError( ( "Failed to initialize Mbedtls %d.", xRetVal ) );
+        }
+        else if( ( xRetVal = tlsSetup( pxNetworkContext, pcHostName,
+                                       pxNetworkCredentials ) ) != eTLSTransportSuccess )
+        {
+            LogError( ( "Failed to setup Mbedtls %d.", xRetVal ) );
+        }
+        else if( ( xRetVal = tlsHandshakeStart( pxNetworkContext, pcHostName,
+                                                pxNetworkCredentials ) ) != eTLSTransportSuccess )
+        {
+            sampletraceEND( eSampleTraceTlsHandshake, xRetVal );
+            LogError( ( "Failed to start TLS handshake %d.", xRetVal ) );
+        }
+        else
+        {
+            LogDebug( ( "(Network connection %p) TCP connection to %s established.",
+                        pxNetworkContext,
+                        pcHostName ) );
+        }
+
+        /* Clean up on failure. */
+        if( xRetVal != eTLSTransportSuccess )
+        {
+            connectCleanup( pxNetworkContext );
+        }
+    }
+
+    return xRetVal;
+}
+/*-----------------------------------------------------------*/
+
+TlsTransportStatus_t TLS_Socket_ConnectStep( NetworkContext_t * pxNetworkContext )
+{
+    TlsTransportStatus_t xRetVal;
+
+    if( ( pxNetworkContext == NULL ) ||
+        ( pxNetworkContext->pParams == NULL ) ||
+        ( ( ( TlsTransportParams_t * ) pxNetworkContext->pParams )->xSSLContext == NULL ) )
+    {
+        LogError( ( "Invalid input parameter(s): no TLS connection in progress." ) );
+        xRetVal = eTLSTransportInvalidParameter;
+    }
+    else
+    {
+        xRetVal = tlsHandshakeStep( pxNetworkContext );
+
+        if( xRetVal != eTLSTransportInProgress )
         {
-            LogError( ( "Failed to initialize Mbedtls %d.", xRetVal ) );
+            sampletraceEND( eSampleTraceTlsHandshake, xRetVal );
         }
-        else if( ( xRetVal = tlsSetup( pxNetworkContext, pcHostName,
-                                       pxNetworkCredentials ) ) != eTLSTransportSuccess )
+
+        if( xRetVal == eTLSTransportSuccess )
         {
-            LogError( ( "Failed to setup Mbedtls %d.", xRetVal ) );
+            LogInfo( ( "(Network connection %p) Connection established.",
+                       pxNetworkContext ) );
         }
-        else if( ( xRetVal = tlsHandshake( pxNetworkContext, pxNetworkCredentials ) ) != eTLSTransportSuccess )
+        else if( xRetVal != eTLSTransportInProgress )
         {
             LogError( ( "Failed to do TLS handshake %d.", xRetVal ) );
+            connectCleanup( pxNetworkContext );
         }
         else
         {
-            LogInfo( ( "(Network connection %p) Connection to %s established.",
-                       pxNetworkContext,
-                       pcHostName ) );
+            /* Empty else marker. */
         }
+    }
 
-        /* Clean up on failure. */
-        if( xRetVal != eTLSTransportSuccess )
+    return xRetVal;
+}
+/*-----------------------------------------------------------*/
+
+TlsTransportStatus_t TLS_Socket_Connect( NetworkContext_t * pxNetworkContext,
+                                         const char * pcHostName,
+                                         uint16_t usPort,
+                                         const NetworkCredentials_t * pxNetworkCredentials,
+                                         uint32_t ulReceiveTimeoutMs,
+                                         uint32_t ulSendTimeoutMs )
+{
+    TlsTransportStatus_t xRetVal;
+
+    xRetVal = TLS_Socket_ConnectStart( pxNetworkContext, pcHostName, usPort,
+                                       pxNetworkCredentials, ulReceiveTimeoutMs,
+                                       ulSendTimeoutMs );
+
+    if( xRetVal == eTLSTransportSuccess )
+    {
+        /* Drive the handshake to completion. */
+        do
         {
-            if( ( pxNetworkContext != NULL ) && ( pxNetworkContext->pParams != NULL ) )
-            {
-                sslContextFree( pxSSLContext );
-                vPortFree( pxSSLContext );
-                pxTlsTransportParams->xSSLContext = NULL;
-
-                if( pxTlsTransportParams->xTCPSocket != SOCKETS_INVALID_SOCKET )
-                {
-                    ( void ) Sockets_Disconnect( pxTlsTransportParams->xTCPSocket );
-                    ( void ) Sockets_Close( pxTlsTransportParams->xTCPSocket );
-                }
-            }
-        }
+            xRetVal = TLS_Socket_ConnectStep( pxNetworkContext );
+        } while( xRetVal == eTLSTransportInProgress );
     }
 
     return xRetVal;
@@ -792,6 +1800,9 @@ void TLS_Socket_Disconnect( NetworkContext_t * pxNetworkContext )
 
     pxSSLContext = ( MbedSSLContext_t * ) pxTlsTransportParams->xSSLContext;
 
+    /* Give held back writes a chance to go out before the connection closes. */
+    ( void ) writeCombineFlush( pxSSLContext );
+
     /* Attempting to terminate TLS connection. */
     lMbedtlsError = mbedtls_ssl_close_notify( &( pxSSLContext->context ) );
 
@@ -827,10 +1838,43 @@ void TLS_Socket_Disconnect( NetworkContext_t * pxNetworkContext )
 
     /* Free mbed TLS contexts. */
     sslContextFree( pxSSLContext );
-    vPortFree( pxSSLContext );
+    sslContextRelease( pxSSLContext );
+}
+/*-----------------------------------------------------------*/
+
+void TLS_Socket_SessionCacheClear( TlsSessionCache_t * pxSessionCache )
+{
+    uint32_t ulIndex;
+
+    if( pxSessionCache == NULL )
+    {
+        return;
+    }
+
+    for( ulIndex = 0; ulIndex < transporttlsSESSION_CACHE_ENTRIES; ulIndex++ )
+    {
+        sessionCacheDropSession( &( pxSessionCache->xEntries[ ulIndex ] ) );
+        pxSessionCache->xEntries[ ulIndex ].cHostName[ 0 ] = '\0';
+    }
+}
+/*-----------------------------------------------------------*/
+
+void TLS_Socket_SharedConfigFree( TlsSharedConfig_t * pxSharedConfig )
+{
+    MbedSSLConfig_t * pxSslConfig;
+
+    if( ( pxSharedConfig == NULL ) || ( pxSharedConfig->pvConfig == NULL ) )
+    {
+        return;
+    }
 
-    /* Clear the mutex functions for mbed TLS thread safety. */
-    mbedtls_threading_free_alt();
+    /* The connections reference the configuration until they are closed. */
+    configASSERT( pxSharedConfig->ulUsers == 0 );
+
+    pxSslConfig = ( MbedSSLConfig_t * ) pxSharedConfig->pvConfig;
+    sslConfigFree( pxSslConfig );
+    sslConfigRelease( pxSslConfig );
+    pxSharedConfig->pvConfig = NULL;
 }
 /*-----------------------------------------------------------*/
 
@@ -850,9 +1894,22 @@ int32_t TLS_Socket_Recv( NetworkContext_t * pxNetworkContext,
     configASSERT( pxTlsTransportParams->xSSLContext != NULL );
 
     pxSSLContext = ( MbedSSLContext_t * ) pxTlsTransportParams->xSSLContext;
+
+    /* A reply is usually only sent once the held back request has gone out. */
+    lMbedtlsError = writeCombineFlush( pxSSLContext );
+
+    if( lMbedtlsError < 0 )
+    {
+        LogError( ( "Failed to flush combined writes: mbedTLSError[%d]= %s : %s.",
+                    lMbedtlsError, mbedtlsHighLevelCodeOrDefault( lMbedtlsError ),
+                    mbedtlsLowLevelCodeOrDefault( lMbedtlsError ) ) );
+        return lMbedtlsError;
+    }
+
     lMbedtlsError = ( int32_t ) mbedtls_ssl_read( &( pxSSLContext->context ),
                                                   pvBuffer,
                                                   xBytesToRecv );
+    statsCountRead( pxSSLContext, lMbedtlsError );
 
     if( ( lMbedtlsError == MBEDTLS_ERR_SSL_TIMEOUT ) ||
         ( lMbedtlsError == MBEDTLS_ERR_SSL_WANT_READ ) ||
@@ -875,13 +1932,73 @@ int32_t TLS_Socket_Recv( NetworkContext_t * pxNetworkContext,
     }
     else
     {
-        /* Empty else marker. */
+        #if ( transporttlsRECV_DRAIN == 1 )
+            lMbedtlsError = recvDrain( pxTlsTransportParams, pxSSLContext,
+                                       ( uint8_t * ) pvBuffer, xBytesToRecv,
+                                       ( size_t ) lMbedtlsError );
+        #endif /* transporttlsRECV_DRAIN == 1 */
     }
 
     return lMbedtlsError;
 }
 /*-----------------------------------------------------------*/
 
+size_t TLS_Socket_GetBytesAvailable( NetworkContext_t * pxNetworkContext )
+{
+    TlsTransportParams_t * pxTlsTransportParams = NULL;
+
+    configASSERT( ( pxNetworkContext != NULL ) &&
+                  ( pxNetworkContext->pParams != NULL ) );
+
+    pxTlsTransportParams = ( TlsTransportParams_t * ) pxNetworkContext->pParams;
+
+    configASSERT( pxTlsTransportParams->xSSLContext != NULL );
+
+    return mbedtls_ssl_get_bytes_avail( &( ( ( MbedSSLContext_t * ) pxTlsTransportParams->xSSLContext )->context ) );
+}
+/*-----------------------------------------------------------*/
+
+int32_t TLS_Socket_WaitReadable( NetworkContext_t * pxNetworkContext,
+                                 uint32_t ulTimeoutMs )
+{
+    int32_t lRetVal;
+    MbedSSLContext_t * pxSSLContext;
+    TlsTransportParams_t * pxTlsTransportParams = NULL;
+
+    configASSERT( ( pxNetworkContext != NULL ) &&
+                  ( pxNetworkContext->pParams != NULL ) );
+
+    pxTlsTransportParams = ( TlsTransportParams_t * ) pxNetworkContext->pParams;
+
+    configASSERT( pxTlsTransportParams->xSSLContext != NULL );
+
+    pxSSLContext = ( MbedSSLContext_t * ) pxTlsTransportParams->xSSLContext;
+
+    /* The peer may be waiting for data that is still held back. */
+    lRetVal = writeCombineFlush( pxSSLContext );
+
+    if( lRetVal < 0 )
+    {
+        LogError( ( "Failed to flush combined writes: mbedTLSError[%d]= %s : %s.",
+                    lRetVal, mbedtlsHighLevelCodeOrDefault( lRetVal ),
+                    mbedtlsLowLevelCodeOrDefault( lRetVal ) ) );
+    }
+    else if( ( mbedtls_ssl_get_bytes_avail( &( pxSSLContext->context ) ) > 0 ) ||
+             ( mbedtls_ssl_check_pending( &( pxSSLContext->context ) ) != 0 ) )
+    {
+        /* Received data is already buffered, the socket may well be empty. */
+        lRetVal = 1;
+    }
+    else
+    {
+        lRetVal = ( int32_t ) Sockets_WaitReadable( pxTlsTransportParams->xTCPSocket,
+                                                    pdMS_TO_TICKS( ulTimeoutMs ) );
+    }
+
+    return lRetVal;
+}
+/*-----------------------------------------------------------*/
+
 int32_t TLS_Socket_Send( NetworkContext_t * pxNetworkContext,
                          const void * pvBuffer,
                          size_t xBytesToSend )
@@ -898,9 +2015,63 @@ int32_t TLS_Socket_Send( NetworkContext_t * pxNetworkContext,
     configASSERT( pxTlsTransportParams->xSSLContext != NULL );
 
     pxSSLContext = ( MbedSSLContext_t * ) pxTlsTransportParams->xSSLContext;
+
+    #if ( transporttlsWRITE_COMBINE_SIZE > 0 )
+    {
+        if( ( pxSSLContext->xCombineLength > 0 ) &&
+            ( ( xTaskGetTickCount() - pxSSLContext->xCombineStartTick ) >=
+              pdMS_TO_TICKS( transporttlsWRITE_COMBINE_DEADLINE_MS ) ) )
+        {
+            lMbedtlsError = writeCombineFlush( pxSSLContext );
+        }
+
+        /* Make room for the new write, or flush first to keep the byte order
+         * when the write is too large to be held back. */
+        if( ( lMbedtlsError == 0 ) &&
+            ( ( pxSSLContext->xCombineLength + xBytesToSend ) > sizeof( pxSSLContext->ucCombineBuffer ) ) )
+        {
+            lMbedtlsError = writeCombineFlush( pxSSLContext );
+        }
+
+        if( lMbedtlsError < 0 )
+        {
+            LogError( ( "Failed to flush combined writes: mbedTLSError[%d]= %s : %s.",
+                        lMbedtlsError, mbedtlsHighLevelCodeOrDefault( lMbedtlsError ),
+                        mbedtlsLowLevelCodeOrDefault( lMbedtlsError ) ) );
+            return lMbedtlsError;
+        }
+
+        if( ( pxSSLContext->xCombineLength + xBytesToSend ) <= sizeof( pxSSLContext->ucCombineBuffer ) )
+        {
+            if( pxSSLContext->xCombineLength == 0 )
+            {
+                pxSSLContext->xCombineStartTick = xTaskGetTickCount();
+            }
+
+            memcpy( &( pxSSLContext->ucCombineBuffer[ pxSSLContext->xCombineLength ] ),
+                    pvBuffer, xBytesToSend );
+            pxSSLContext->xCombineLength += xBytesToSend;
+
+            if( pxSSLContext->xCombineLength == sizeof( pxSSLContext->ucCombineBuffer ) )
+            {
+                /* The data is already accepted, a failure surfaces on the next call. */
+                ( void ) writeCombineFlush( pxSSLContext );
+            }
+
+            return ( int32_t ) xBytesToSend;
+        }
+    }
+    #endif /* transporttlsWRITE_COMBINE_SIZE > 0 */
+
+    if( pxSSLContext->lWriteError < 0 )
+    {
+        return pxSSLContext->lWriteError;
+    }
+
     lMbedtlsError = ( int32_t ) mbedtls_ssl_write( &( pxSSLContext->context ),
                                                    pvBuffer,
                                                    xBytesToSend );
+    statsCountWrite( pxSSLContext, lMbedtlsError );
 
     if( ( lMbedtlsError == MBEDTLS_ERR_SSL_TIMEOUT ) ||
         ( lMbedtlsError == MBEDTLS_ERR_SSL_WANT_READ ) ||
@@ -929,3 +2100,226 @@ int32_t TLS_Socket_Send( NetworkContext_t * pxNetworkContext,
     return lMbedtlsError;
 }
 /*-----------------------------------------------------------*/
+
+static int32_t writeAll( MbedSSLContext_t * pxSSLContext,
+                         const uint8_t * pucBuffer,
+                         size_t xLength,
+                         size_t * pxWritten )
+{
+    int32_t lMbedtlsError = 0;
+    TickType_t xStallStartTick = xTaskGetTickCount();
+
+    *pxWritten = 0;
+
+    if( pxSSLContext->lWriteError < 0 )
+    {
+        return pxSSLContext->lWriteError;
+    }
+
+    while( *pxWritten < xLength )
+    {
+        lMbedtlsError = ( int32_t ) mbedtls_ssl_write( &( pxSSLContext->context ),
+                                                       pucBuffer + *pxWritten,
+                                                       xLength - *pxWritten );
+        statsCountWrite( pxSSLContext, lMbedtlsError );
+
+        if( lMbedtlsError > 0 )
+        {
+            *pxWritten += ( size_t ) lMbedtlsError;
+            xStallStartTick = xTaskGetTickCount();
+            lMbedtlsError = 0;
+        }
+        else if( ( lMbedtlsError == 0 ) ||
+                 ( lMbedtlsError == MBEDTLS_ERR_SSL_WANT_READ ) ||
+                 ( lMbedtlsError == MBEDTLS_ERR_SSL_WANT_WRITE ) )
+        {
+            /* Each try waits for the socket, up to its own timeout. */
+            if( ( xTaskGetTickCount() - xStallStartTick ) >= pxSSLContext->xSendTimeout )
+            {
+                lMbedtlsError = ( lMbedtlsError == 0 ) ? MBEDTLS_ERR_SSL_WANT_WRITE : lMbedtlsError;
+                pxSSLContext->lWriteError = lMbedtlsError;
+                break;
+            }
+        }
+        else
+        {
+            pxSSLContext->lWriteError = lMbedtlsError;
+            break;
+        }
+    }
+
+    return lMbedtlsError;
+}
+/*-----------------------------------------------------------*/
+
+#if ( transporttlsRECV_DRAIN == 1 )
+    static int32_t recvDrain( TlsTransportParams_t * pxTlsTransportParams,
+                              MbedSSLContext_t * pxSSLContext,
+                              uint8_t * pucBuffer,
+                              size_t xBytesToRecv,
+                              size_t xReceived )
+    {
+        int32_t lMbedtlsError;
+
+        while( xReceived < xBytesToRecv )
+        {
+            /* Stop once another read would have to wait for the network. */
+            if( ( mbedtls_ssl_get_bytes_avail( &( pxSSLContext->context ) ) == 0 ) &&
+                ( mbedtls_ssl_check_pending( &( pxSSLContext->context ) ) == 0 ) &&
+                ( Sockets_RecvAvailable( pxTlsTransportParams->xTCPSocket ) == 0 ) )
+            {
+                break;
+            }
+
+            lMbedtlsError = ( int32_t ) mbedtls_ssl_read( &( pxSSLContext->context ),
+                                                          pucBuffer + xReceived,
+                                                          xBytesToRecv - xReceived );
+            statsCountRead( pxSSLContext, lMbedtlsError );
+
+            /* Errors are reported by the next receive, once the data read so
+             * far has been consumed. */
+            if( lMbedtlsError <= 0 )
+            {
+                break;
+            }
+
+            xReceived += ( size_t ) lMbedtlsError;
+        }
+
+        return ( int32_t ) xReceived;
+    }
+    /*-----------------------------------------------------------*/
+#endif /* transporttlsRECV_DRAIN == 1 */
+
+static int32_t writeCombineFlush( MbedSSLContext_t * pxSSLContext )
+{
+    int32_t lMbedtlsError = pxSSLContext->lWriteError;
+
+    #if ( transporttlsWRITE_COMBINE_SIZE > 0 )
+    {
+        size_t xWritten = 0;
+
+        if( ( lMbedtlsError == 0 ) && ( pxSSLContext->xCombineLength > 0 ) )
+        {
+            /* Written whole or not at all, as the connection fails otherwise. */
+            lMbedtlsError = writeAll( pxSSLContext, pxSSLContext->ucCombineBuffer,
+                                      pxSSLContext->xCombineLength, &xWritten );
+            pxSSLContext->xCombineLength = 0;
+        }
+    }
+    #endif /* transporttlsWRITE_COMBINE_SIZE > 0 */
+
+    return lMbedtlsError;
+}
+/*-----------------------------------------------------------*/
+
+int32_t TLS_Socket_Flush( NetworkContext_t * pxNetworkContext )
+{
+    int32_t lMbedtlsError = 0;
+    MbedSSLContext_t * pxSSLContext;
+    TlsTransportParams_t * pxTlsTransportParams = NULL;
+
+    configASSERT( ( pxNetworkContext != NULL ) &&
+                  ( pxNetworkContext->pParams != NULL ) );
+
+    pxTlsTransportParams = ( TlsTransportParams_t * ) pxNetworkContext->pParams;
+
+    configASSERT( pxTlsTransportParams->xSSLContext != NULL );
+
+    pxSSLContext = ( MbedSSLContext_t * ) pxTlsTransportParams->xSSLContext;
+    lMbedtlsError = writeCombineFlush( pxSSLContext );
+
+    if( lMbedtlsError < 0 )
+    {
+        LogError( ( "Failed to flush combined writes: mbedTLSError[%d]= %s : %s.",
+                    lMbedtlsError, mbedtlsHighLevelCodeOrDefault( lMbedtlsError ),
+                    mbedtlsLowLevelCodeOrDefault( lMbedtlsError ) ) );
+    }
+
+    return lMbedtlsError;
+}
+/*-----------------------------------------------------------*/
+
+int32_t TLS_Socket_Writev( NetworkContext_t * pxNetworkContext,
+                           const TlsTransportOutVector_t * pxIoVec,
+                           size_t xIoVecCount )
+{
+    int32_t lMbedtlsError = 0;
+    MbedSSLContext_t * pxSSLContext;
+    TlsTransportParams_t * pxTlsTransportParams = NULL;
+    size_t xStaged = 0;
+    size_t xWritten = 0;
+    size_t xTotalSent = 0;
+    size_t xIndex;
+
+    configASSERT( ( pxNetworkContext != NULL ) &&
+                  ( pxNetworkContext->pParams != NULL ) );
+    configASSERT( ( pxIoVec != NULL ) || ( xIoVecCount == 0 ) );
+
+    pxTlsTransportParams = ( TlsTransportParams_t * ) pxNetworkContext->pParams;
+
+    configASSERT( pxTlsTransportParams->xSSLContext != NULL );
+
+    pxSSLContext = ( MbedSSLContext_t * ) pxTlsTransportParams->xSSLContext;
+
+    /* Bytes held back by TLS_Socket_Send() go out first to keep the byte order. */
+    lMbedtlsError = writeCombineFlush( pxSSLContext );
+
+    for( xIndex = 0; ( xIndex < xIoVecCount ) && ( lMbedtlsError == 0 ); xIndex++ )
+    {
+        /* Pack the fragment with the previous ones if they fit in one staging buffer. */
+        if( ( xStaged + pxIoVec[ xIndex ].xLength ) <= sizeof( pxSSLContext->ucWritevBuffer ) )
+        {
+            memcpy( &( pxSSLContext->ucWritevBuffer[ xStaged ] ),
+                    pxIoVec[ xIndex ].pvBase,
+                    pxIoVec[ xIndex ].xLength );
+            xStaged += pxIoVec[ xIndex ].xLength;
+            continue;
+        }
+
+        /* Flush what is staged so the byte order is preserved. */
+        if( xStaged > 0 )
+        {
+            lMbedtlsError = writeAll( pxSSLContext, pxSSLContext->ucWritevBuffer, xStaged, &xWritten );
+            xTotalSent += xWritten;
+            xStaged = 0;
+
+            if( lMbedtlsError != 0 )
+            {
+                break;
+            }
+        }
+
+        if( pxIoVec[ xIndex ].xLength <= sizeof( pxSSLContext->ucWritevBuffer ) )
+        {
+            memcpy( pxSSLContext->ucWritevBuffer, pxIoVec[ xIndex ].pvBase, pxIoVec[ xIndex ].xLength );
+            xStaged = pxIoVec[ xIndex ].xLength;
+        }
+        else
+        {
+            /* Large fragments go to the TLS layer without an extra copy. */
+            lMbedtlsError = writeAll( pxSSLContext, pxIoVec[ xIndex ].pvBase, pxIoVec[ xIndex ].xLength, &xWritten );
+            xTotalSent += xWritten;
+        }
+    }
+
+    if( ( lMbedtlsError == 0 ) && ( xStaged > 0 ) )
+    {
+        lMbedtlsError = writeAll( pxSSLContext, pxSSLContext->ucWritevBuffer, xStaged, &xWritten );
+        xTotalSent += xWritten;
+    }
+
+    if( lMbedtlsError < 0 )
+    {
+        LogError( ( "Failed to send data:  mbedTLSError[%d]= %s : %s.",
+                    lMbedtlsError, mbedtlsHighLevelCodeOrDefault( lMbedtlsError ),
+                    mbedtlsLowLevelCodeOrDefault( lMbedtlsError ) ) );
+
+        /* The connection may be left mid-record, so the bytes sent before
+         * the error cannot be followed by the rest. */
+        return lMbedtlsError;
+    }
+
+    return ( int32_t ) xTotalSent;
+}
+/*-----------------------------------------------------------*/
@@ -0,0 +1,125 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+#include "azure_sample_buffer_arena.h"
+
+#include <stddef.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#if ( configSUPPORT_DYNAMIC_ALLOCATION == 0 )
+    static uint64_t ullStaticBlock[ ( democonfigBUFFER_ARENA_STATIC_SIZE + 7U ) / 8U ];
+    static BufferArena_t * pxStaticBlockOwner = NULL;
+#endif /* configSUPPORT_DYNAMIC_ALLOCATION == 0 */
+/*-----------------------------------------------------------*/
+
+static uint8_t * prvTakeBlock( BufferArena_t * pxArena,
+                               uint32_t ulSize )
+{
+    #if ( configSUPPORT_DYNAMIC_ALLOCATION == 0 )
+        uint8_t * pucBlock = NULL;
+
+        taskENTER_CRITICAL();
+
+        if( ( pxStaticBlockOwner == NULL ) && ( ulSize <= sizeof( ullStaticBlock ) ) )
+        {
+            pxStaticBlockOwner = pxArena;
+            pucBlock = ( uint8_t * ) ullStaticBlock;
+        }
+
+        taskEXIT_CRITICAL();
+
+        return pucBlock;
+    #else
+        ( void ) pxArena;
+
+        /* pvPortMalloc() aligns to portBYTE_ALIGNMENT, at least 8 on the boards. */
+        return ( uint8_t * ) pvPortMalloc( ulSize );
+    #endif /* configSUPPORT_DYNAMIC_ALLOCATION == 0 */
+}
+/*-----------------------------------------------------------*/
+
+static void prvGiveBlock( BufferArena_t * pxArena )
+{
+    #if ( configSUPPORT_DYNAMIC_ALLOCATION == 0 )
+        taskENTER_CRITICAL();
+
+        if( pxStaticBlockOwner == pxArena )
+        {
+            pxStaticBlockOwner = NULL;
+        }
+
+        taskEXIT_CRITICAL();
+    #else
+        vPortFree( pxArena->pucBlock );
+    #endif /* configSUPPORT_DYNAMIC_ALLOCATION == 0 */
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t BufferArena_Enter( BufferArena_t * pxArena,
+                                    BufferArenaPhase_t xPhase,
+                                    uint32_t ulSize )
+{
+    if( pxArena == NULL )
+    {
+        return eAzureIoTErrorInvalidArgument;
+    }
+
+    BufferArena_Leave( pxArena );
+
+    if( ulSize > 0 )
+    {
+        pxArena->pucBlock = prvTakeBlock( pxArena, ulSize );
+
+        if( pxArena->pucBlock == NULL )
+        {
+            return eAzureIoTErrorOutOfMemory;
+        }
+    }
+
+    pxArena->ulBlockSize = ulSize;
+    pxArena->xPhase = xPhase;
+
+    return eAzureIoTSuccess;
+}
+/*-----------------------------------------------------------*/
+
+uint8_t * BufferArena_Lend( BufferArena_t * pxArena,
+                            uint32_t ulLength )
+{
+    uint8_t * pucBuffer;
+    uint32_t ulRegionSize = bufferarenaREGION_SIZE( ulLength );
+
+    if( ( pxArena == NULL ) || ( pxArena->pucBlock == NULL ) ||
+        ( ulRegionSize < ulLength ) ||
+        ( ulRegionSize > pxArena->ulBlockSize - pxArena->ulUsed ) )
+    {
+        return NULL;
+    }
+
+    pucBuffer = pxArena->pucBlock + pxArena->ulUsed;
+    pxArena->ulUsed += ulRegionSize;
+
+    return pucBuffer;
+}
+/*-----------------------------------------------------------*/
+
+void BufferArena_Leave( BufferArena_t * pxArena )
+{
+    if( pxArena == NULL )
+    {
+        return;
+    }
+
+    if( pxArena->pucBlock != NULL )
+    {
+        prvGiveBlock( pxArena );
+    }
+
+    pxArena->pucBlock = NULL;
+    pxArena->ulBlockSize = 0;
+    pxArena->ulUsed = 0;
+    pxArena->xPhase = eBufferArenaPhaseNone;
+}
+/*-----------------------------------------------------------*/
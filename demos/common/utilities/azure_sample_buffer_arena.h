@@ -0,0 +1,102 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @file azure_sample_buffer_arena.h
+ *
+ * @brief Buffers that are only held during one phase of a sample.
+ *
+ * A static buffer that is only used while provisioning or downloading an
+ * update still takes its RAM for the whole life of the sample. A sample
+ * enters a phase with BufferArena_Enter(), which takes one block of the size
+ * of the phase from the FreeRTOS heap, and lends the buffers of the phase out
+ * of it with BufferArena_Lend(). Leaving the phase, or entering the next one,
+ * gives the whole block back at once, so the heap, such as the TLS buffers of
+ * the connections, can use that RAM until the phase comes again.
+ *
+ * One block per phase, given back whole, keeps the heap from fragmenting
+ * the way separate allocations of each buffer would. A BufferArena_t is not
+ * thread safe; it is used by the task that runs the phases.
+ *
+ * With configSUPPORT_DYNAMIC_ALLOCATION set to 0 there is no heap to give
+ * the RAM back to, and the block of every phase is one static block of
+ * democonfigBUFFER_ARENA_STATIC_SIZE bytes instead, held by one arena at a
+ * time.
+ */
+
+#ifndef AZURE_SAMPLE_BUFFER_ARENA_H
+#define AZURE_SAMPLE_BUFFER_ARENA_H
+
+#include <stdint.h>
+
+#include "azure_iot_result.h"
+
+/**
+ * @brief Alignment of the buffers lent.
+ */
+#define bufferarenaALIGNMENT                ( 8U )
+
+/**
+ * @brief Room a buffer of ulLength bytes takes in the block of a phase, to
+ * size the phase with.
+ */
+#define bufferarenaREGION_SIZE( ulLength )  ( ( ( ulLength ) + bufferarenaALIGNMENT - 1U ) & ~( bufferarenaALIGNMENT - 1U ) )
+
+/**
+ * @brief Size of the static block of the phases, without a heap. Sized for
+ * the largest phase of the sample.
+ */
+#ifndef democonfigBUFFER_ARENA_STATIC_SIZE
+    #define democonfigBUFFER_ARENA_STATIC_SIZE    ( 0 )
+#endif
+
+typedef enum BufferArenaPhase
+{
+    eBufferArenaPhaseNone = 0,     /* Nothing is lent. */
+    eBufferArenaPhaseProvisioning, /* Registering with the provisioning service. */
+    eBufferArenaPhaseSteadyState,  /* Connected to IoT Hub. */
+    eBufferArenaPhaseDownload      /* Downloading an update image. */
+} BufferArenaPhase_t;
+
+typedef struct BufferArena
+{
+    uint8_t * pucBlock;
+    uint32_t ulBlockSize;
+    uint32_t ulUsed;
+    BufferArenaPhase_t xPhase;
+} BufferArena_t;
+
+/**
+ * @brief Enter a phase, giving back the buffers of the phase before.
+ *
+ * @param[in,out] pxArena The arena, zeroed before its first use.
+ * @param[in] xPhase The phase.
+ * @param[in] ulSize Size of the block of the phase, the sum of the
+ * bufferarenaREGION_SIZE() of its buffers.
+ * @return eAzureIoTErrorOutOfMemory if the heap, or the static block, has
+ * no block of \p ulSize, in which case the arena is left in
+ * eBufferArenaPhaseNone.
+ */
+AzureIoTResult_t BufferArena_Enter( BufferArena_t * pxArena,
+                                    BufferArenaPhase_t xPhase,
+                                    uint32_t ulSize );
+
+/**
+ * @brief Lend a buffer of the current phase.
+ *
+ * @param[in,out] pxArena The arena.
+ * @param[in] ulLength Length of the buffer.
+ * @return The buffer, valid until the phase is left, or NULL if the block of
+ * the phase has no room left.
+ */
+uint8_t * BufferArena_Lend( BufferArena_t * pxArena,
+                            uint32_t ulLength );
+
+/**
+ * @brief Leave the current phase, giving back all its buffers.
+ *
+ * @param[in,out] pxArena The arena.
+ */
+void BufferArena_Leave( BufferArena_t * pxArena );
+
+#endif /* AZURE_SAMPLE_BUFFER_ARENA_H */
@@ -0,0 +1,90 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+#include "azure_sample_c2d_queue.h"
+
+#include <stddef.h>
+#include <string.h>
+
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t CloudMessageQueue_Init( CloudMessageQueue_t * pxQueue )
+{
+    CloudMessage_t * pxSlot;
+    uint32_t ulIndex;
+
+    if( pxQueue == NULL )
+    {
+        return eAzureIoTErrorInvalidArgument;
+    }
+
+    memset( pxQueue, 0, sizeof( *pxQueue ) );
+    pxQueue->xFreeQueue = xQueueCreateStatic( democonfigC2D_QUEUE_COUNT,
+                                              sizeof( CloudMessage_t * ),
+                                              pxQueue->ucFreeQueueBuffer,
+                                              &pxQueue->xFreeQueueStorage );
+    pxQueue->xWorkQueue = xQueueCreateStatic( democonfigC2D_QUEUE_COUNT,
+                                              sizeof( CloudMessage_t * ),
+                                              pxQueue->ucWorkQueueBuffer,
+                                              &pxQueue->xWorkQueueStorage );
+
+    for( ulIndex = 0; ulIndex < democonfigC2D_QUEUE_COUNT; ulIndex++ )
+    {
+        pxSlot = &pxQueue->xSlots[ ulIndex ];
+        ( void ) xQueueSendToBack( pxQueue->xFreeQueue, &pxSlot, 0 );
+    }
+
+    return eAzureIoTSuccess;
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t CloudMessageQueue_Put( CloudMessageQueue_t * pxQueue,
+                                        const AzureIoTHubClientCloudToDeviceMessageRequest_t * pxMessage )
+{
+    CloudMessage_t * pxSlot;
+
+    if( pxMessage->ulPayloadLength > democonfigC2D_QUEUE_PAYLOAD_SIZE )
+    {
+        pxQueue->ulDropped++;
+        return eAzureIoTErrorOutOfMemory;
+    }
+
+    /* Waiting here keeps the process loop from reading, and acknowledging,
+     * anything more until the consumer catches up. */
+    if( xQueueReceive( pxQueue->xFreeQueue, &pxSlot, pdMS_TO_TICKS( democonfigC2D_QUEUE_WAIT_MS ) ) != pdTRUE )
+    {
+        pxQueue->ulDropped++;
+        return eAzureIoTErrorOutOfMemory;
+    }
+
+    memcpy( pxSlot->ucPayload, pxMessage->pvMessagePayload, pxMessage->ulPayloadLength );
+    pxSlot->ulPayloadLength = pxMessage->ulPayloadLength;
+
+    /* The queue has room for every slot, so this does not wait. */
+    ( void ) xQueueSendToBack( pxQueue->xWorkQueue, &pxSlot, 0 );
+
+    return eAzureIoTSuccess;
+}
+/*-----------------------------------------------------------*/
+
+CloudMessage_t * CloudMessageQueue_Take( CloudMessageQueue_t * pxQueue,
+                                         TickType_t xTicksToWait )
+{
+    CloudMessage_t * pxSlot = NULL;
+
+    if( xQueueReceive( pxQueue->xWorkQueue, &pxSlot, xTicksToWait ) != pdTRUE )
+    {
+        return NULL;
+    }
+
+    return pxSlot;
+}
+/*-----------------------------------------------------------*/
+
+void CloudMessageQueue_Release( CloudMessageQueue_t * pxQueue,
+                                CloudMessage_t * pxMessage )
+{
+    /* The queue has room for every slot, so this does not wait. */
+    ( void ) xQueueSendToBack( pxQueue->xFreeQueue, &pxMessage, 0 );
+}
+/*-----------------------------------------------------------*/
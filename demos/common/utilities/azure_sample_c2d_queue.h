@@ -0,0 +1,125 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @file azure_sample_c2d_queue.h
+ *
+ * @brief Cloud-to-device messages handled after their callback returns.
+ *
+ * A cloud-to-device callback runs in AzureIoTHubClient_ProcessLoop(), so a
+ * message whose handling takes a while holds up keep alive, telemetry and the
+ * messages behind it. The callback instead copies the message into a free
+ * slot with CloudMessageQueue_Put() and returns, and a consumer task takes the
+ * slots in order with CloudMessageQueue_Take() and gives them back with
+ * CloudMessageQueue_Release().
+ *
+ * When every slot is taken, CloudMessageQueue_Put() waits for the consumer to
+ * free one, up to democonfigC2D_QUEUE_WAIT_MS. The process loop reads nothing
+ * meanwhile, so the PUBACK of the message is held back and the packets behind
+ * it stay in the TCP window, which throttles IoT Hub instead of the device
+ * dropping work. A message still without a slot at the end of the wait, or
+ * too large for one, is counted in ulDropped and logged by the caller.
+ * All the slots are in the CloudMessageQueue_t; nothing is allocated.
+ */
+
+#ifndef AZURE_SAMPLE_C2D_QUEUE_H
+#define AZURE_SAMPLE_C2D_QUEUE_H
+
+#include <stdint.h>
+
+#include "FreeRTOS.h"
+#include "queue.h"
+
+#include "azure_iot_hub_client.h"
+
+/**
+ * @brief 1 for the samples to handle cloud-to-device messages in a consumer task.
+ */
+#ifndef democonfigC2D_QUEUE
+    #define democonfigC2D_QUEUE    0
+#endif
+
+/**
+ * @brief Messages that can be waiting for, or in, the consumer.
+ */
+#ifndef democonfigC2D_QUEUE_COUNT
+    #define democonfigC2D_QUEUE_COUNT           4
+#endif
+
+/**
+ * @brief Largest message payload.
+ */
+#ifndef democonfigC2D_QUEUE_PAYLOAD_SIZE
+    #define democonfigC2D_QUEUE_PAYLOAD_SIZE    256
+#endif
+
+/**
+ * @brief Longest a full queue holds up the process loop, in milliseconds.
+ * Keep it well under the MQTT keep alive interval.
+ */
+#ifndef democonfigC2D_QUEUE_WAIT_MS
+    #define democonfigC2D_QUEUE_WAIT_MS         5000
+#endif
+
+/**
+ * @brief A message copied out of the MQTT buffer.
+ */
+typedef struct CloudMessage
+{
+    uint8_t ucPayload[ democonfigC2D_QUEUE_PAYLOAD_SIZE ];
+    uint32_t ulPayloadLength;
+} CloudMessage_t;
+
+typedef struct CloudMessageQueue
+{
+    CloudMessage_t xSlots[ democonfigC2D_QUEUE_COUNT ];
+    QueueHandle_t xFreeQueue; /* Slots for the callback. */
+    StaticQueue_t xFreeQueueStorage;
+    uint8_t ucFreeQueueBuffer[ democonfigC2D_QUEUE_COUNT * sizeof( CloudMessage_t * ) ];
+    QueueHandle_t xWorkQueue; /* Slots for the consumer, in the order of arrival. */
+    StaticQueue_t xWorkQueueStorage;
+    uint8_t ucWorkQueueBuffer[ democonfigC2D_QUEUE_COUNT * sizeof( CloudMessage_t * ) ];
+    uint32_t ulDropped; /* Messages that got no slot. */
+} CloudMessageQueue_t;
+
+/**
+ * @brief Initialize the slots, before the consumer starts.
+ *
+ * @param[out] pxQueue The slots to initialize.
+ * @return An #AzureIoTResult_t with the result of the operation.
+ */
+AzureIoTResult_t CloudMessageQueue_Init( CloudMessageQueue_t * pxQueue );
+
+/**
+ * @brief Copy a message into a free slot for the consumer, waiting for one up
+ * to democonfigC2D_QUEUE_WAIT_MS. Call from the cloud-to-device callback.
+ *
+ * @param[in] pxQueue The slots.
+ * @param[in] pxMessage The message.
+ * @return eAzureIoTErrorOutOfMemory if the message got no slot, or does not
+ * fit one.
+ */
+AzureIoTResult_t CloudMessageQueue_Put( CloudMessageQueue_t * pxQueue,
+                                        const AzureIoTHubClientCloudToDeviceMessageRequest_t * pxMessage );
+
+/**
+ * @brief Take the oldest message. Call from the consumer task.
+ *
+ * @param[in] pxQueue The slots.
+ * @param[in] xTicksToWait Longest to wait for a message.
+ * @return The message, to give back with CloudMessageQueue_Release(), or NULL
+ * if none came.
+ */
+CloudMessage_t * CloudMessageQueue_Take( CloudMessageQueue_t * pxQueue,
+                                         TickType_t xTicksToWait );
+
+/**
+ * @brief Give back the slot of a message once it is handled.
+ *
+ * @param[in] pxQueue The slots.
+ * @param[in] pxMessage The message from CloudMessageQueue_Take().
+ */
+void CloudMessageQueue_Release( CloudMessageQueue_t * pxQueue,
+                                CloudMessage_t * pxMessage );
+
+#endif /* AZURE_SAMPLE_C2D_QUEUE_H */
@@ -0,0 +1,249 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+#include "azure_sample_cbor_writer.h"
+
+#include <stddef.h>
+#include <string.h>
+
+/* Major types, in the top three bits of the initial byte. */
+#define cborwriterMAJOR_UNSIGNED        ( 0U << 5 )
+#define cborwriterMAJOR_NEGATIVE        ( 1U << 5 )
+#define cborwriterMAJOR_TEXT            ( 3U << 5 )
+#define cborwriterMAJOR_ARRAY           ( 4U << 5 )
+#define cborwriterMAJOR_MAP             ( 5U << 5 )
+#define cborwriterMAJOR_SIMPLE          ( 7U << 5 )
+
+/* Additional information values of the initial byte. */
+#define cborwriterINFO_UINT8            24U
+#define cborwriterINFO_UINT16           25U
+#define cborwriterINFO_UINT32           26U
+#define cborwriterINFO_FLOAT32          26U
+#define cborwriterINFO_FLOAT64          27U
+#define cborwriterINFO_INDEFINITE       31U
+
+#define cborwriterSIMPLE_FALSE          ( cborwriterMAJOR_SIMPLE | 20U )
+#define cborwriterSIMPLE_TRUE           ( cborwriterMAJOR_SIMPLE | 21U )
+#define cborwriterBREAK                 ( cborwriterMAJOR_SIMPLE | cborwriterINFO_INDEFINITE )
+/*-----------------------------------------------------------*/
+
+static AzureIoTResult_t prvAppendByte( CBORWriter_t * pxWriter,
+                                       uint8_t ucByte )
+{
+    if( pxWriter->ulUsed >= pxWriter->ulBufferSize )
+    {
+        return eAzureIoTErrorOutOfMemory;
+    }
+
+    pxWriter->pucBuffer[ pxWriter->ulUsed++ ] = ucByte;
+
+    return eAzureIoTSuccess;
+}
+/*-----------------------------------------------------------*/
+
+/* Appends an initial byte and a big endian argument of ulSize bytes. */
+static AzureIoTResult_t prvAppendArgument( CBORWriter_t * pxWriter,
+                                           uint8_t ucInitialByte,
+                                           uint64_t ullArgument,
+                                           uint32_t ulSize )
+{
+    if( pxWriter->ulBufferSize - pxWriter->ulUsed < 1 + ulSize )
+    {
+        return eAzureIoTErrorOutOfMemory;
+    }
+
+    pxWriter->pucBuffer[ pxWriter->ulUsed++ ] = ucInitialByte;
+
+    while( ulSize-- > 0 )
+    {
+        pxWriter->pucBuffer[ pxWriter->ulUsed++ ] = ( uint8_t ) ( ullArgument >> ( ulSize * 8 ) );
+    }
+
+    return eAzureIoTSuccess;
+}
+/*-----------------------------------------------------------*/
+
+/* Appends a head with the shortest encoding of ulValue. */
+static AzureIoTResult_t prvAppendHead( CBORWriter_t * pxWriter,
+                                       uint8_t ucMajorType,
+                                       uint32_t ulValue )
+{
+    if( ulValue < cborwriterINFO_UINT8 )
+    {
+        return prvAppendByte( pxWriter, ( uint8_t ) ( ucMajorType | ulValue ) );
+    }
+    else if( ulValue <= UINT8_MAX )
+    {
+        return prvAppendArgument( pxWriter, ( uint8_t ) ( ucMajorType | cborwriterINFO_UINT8 ), ulValue, 1 );
+    }
+    else if( ulValue <= UINT16_MAX )
+    {
+        return prvAppendArgument( pxWriter, ( uint8_t ) ( ucMajorType | cborwriterINFO_UINT16 ), ulValue, 2 );
+    }
+
+    return prvAppendArgument( pxWriter, ( uint8_t ) ( ucMajorType | cborwriterINFO_UINT32 ), ulValue, 4 );
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t CBORWriter_Init( CBORWriter_t * pxWriter,
+                                  uint8_t * pucBuffer,
+                                  uint32_t ulBufferSize )
+{
+    if( ( pxWriter == NULL ) || ( pucBuffer == NULL ) )
+    {
+        return eAzureIoTErrorInvalidArgument;
+    }
+
+    pxWriter->pucBuffer = pucBuffer;
+    pxWriter->ulBufferSize = ulBufferSize;
+    pxWriter->ulUsed = 0;
+
+    return eAzureIoTSuccess;
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t CBORWriter_AppendBeginObject( CBORWriter_t * pxWriter )
+{
+    return prvAppendByte( pxWriter, cborwriterMAJOR_MAP | cborwriterINFO_INDEFINITE );
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t CBORWriter_AppendEndObject( CBORWriter_t * pxWriter )
+{
+    return prvAppendByte( pxWriter, cborwriterBREAK );
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t CBORWriter_AppendBeginArray( CBORWriter_t * pxWriter )
+{
+    return prvAppendByte( pxWriter, cborwriterMAJOR_ARRAY | cborwriterINFO_INDEFINITE );
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t CBORWriter_AppendEndArray( CBORWriter_t * pxWriter )
+{
+    return prvAppendByte( pxWriter, cborwriterBREAK );
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t CBORWriter_AppendPropertyName( CBORWriter_t * pxWriter,
+                                                const uint8_t * pucPropertyName,
+                                                uint32_t ulPropertyNameLength )
+{
+    return CBORWriter_AppendString( pxWriter, pucPropertyName, ulPropertyNameLength );
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t CBORWriter_AppendString( CBORWriter_t * pxWriter,
+                                          const uint8_t * pucValue,
+                                          uint32_t ulValueLength )
+{
+    AzureIoTResult_t xResult;
+
+    if( ( xResult = prvAppendHead( pxWriter, cborwriterMAJOR_TEXT, ulValueLength ) ) != eAzureIoTSuccess )
+    {
+        return xResult;
+    }
+
+    if( pxWriter->ulBufferSize - pxWriter->ulUsed < ulValueLength )
+    {
+        return eAzureIoTErrorOutOfMemory;
+    }
+
+    memcpy( pxWriter->pucBuffer + pxWriter->ulUsed, pucValue, ulValueLength );
+    pxWriter->ulUsed += ulValueLength;
+
+    return eAzureIoTSuccess;
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t CBORWriter_AppendInt32( CBORWriter_t * pxWriter,
+                                         int32_t lValue )
+{
+    if( lValue >= 0 )
+    {
+        return prvAppendHead( pxWriter, cborwriterMAJOR_UNSIGNED, ( uint32_t ) lValue );
+    }
+
+    /* A negative integer n is encoded as -1 - n. */
+    return prvAppendHead( pxWriter, cborwriterMAJOR_NEGATIVE, ( uint32_t ) ( -1 - lValue ) );
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t CBORWriter_AppendDouble( CBORWriter_t * pxWriter,
+                                          double xValue )
+{
+    float xSingle = ( float ) xValue;
+    uint32_t ulBits;
+    uint64_t ullBits;
+
+    /* NaN is not equal to itself, so it is written as a double. */
+    if( ( double ) xSingle == xValue )
+    {
+        memcpy( &ulBits, &xSingle, sizeof( ulBits ) );
+
+        return prvAppendArgument( pxWriter, cborwriterMAJOR_SIMPLE | cborwriterINFO_FLOAT32, ulBits, 4 );
+    }
+
+    memcpy( &ullBits, &xValue, sizeof( ullBits ) );
+
+    return prvAppendArgument( pxWriter, cborwriterMAJOR_SIMPLE | cborwriterINFO_FLOAT64, ullBits, 8 );
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t CBORWriter_AppendBool( CBORWriter_t * pxWriter,
+                                        bool xValue )
+{
+    return prvAppendByte( pxWriter, xValue ? cborwriterSIMPLE_TRUE : cborwriterSIMPLE_FALSE );
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t CBORWriter_AppendPropertyWithInt32Value( CBORWriter_t * pxWriter,
+                                                          const uint8_t * pucPropertyName,
+                                                          uint32_t ulPropertyNameLength,
+                                                          int32_t lValue )
+{
+    AzureIoTResult_t xResult;
+
+    if( ( xResult = CBORWriter_AppendPropertyName( pxWriter, pucPropertyName,
+                                                   ulPropertyNameLength ) ) != eAzureIoTSuccess )
+    {
+        return xResult;
+    }
+
+    return CBORWriter_AppendInt32( pxWriter, lValue );
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t CBORWriter_AppendPropertyWithDoubleValue( CBORWriter_t * pxWriter,
+                                                           const uint8_t * pucPropertyName,
+                                                           uint32_t ulPropertyNameLength,
+                                                           double xValue )
+{
+    AzureIoTResult_t xResult;
+
+    if( ( xResult = CBORWriter_AppendPropertyName( pxWriter, pucPropertyName,
+                                                   ulPropertyNameLength ) ) != eAzureIoTSuccess )
+    {
+        return xResult;
+    }
+
+    return CBORWriter_AppendDouble( pxWriter, xValue );
+}
+/*-----------------------------------------------------------*/
+
+int32_t CBORWriter_GetBytesUsed( const CBORWriter_t * pxWriter )
+{
+    return ( int32_t ) pxWriter->ulUsed;
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t CBORWriter_AppendMessageProperties( AzureIoTMessageProperties_t * pxProperties )
+{
+    return AzureIoTMessage_PropertiesAppend( pxProperties,
+                                             ( const uint8_t * ) cborwriterCONTENT_TYPE_PROPERTY,
+                                             sizeof( cborwriterCONTENT_TYPE_PROPERTY ) - 1,
+                                             ( const uint8_t * ) cborwriterCONTENT_TYPE_VALUE,
+                                             sizeof( cborwriterCONTENT_TYPE_VALUE ) - 1 );
+}
+/*-----------------------------------------------------------*/
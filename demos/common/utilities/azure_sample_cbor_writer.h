@@ -0,0 +1,144 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @file azure_sample_cbor_writer.h
+ *
+ * @brief Writes telemetry as CBOR (RFC 8949) instead of JSON.
+ *
+ * The API follows AzureIoTJSONWriter_t, so a telemetry builder can switch
+ * between the two. Objects and arrays are written with indefinite length, so
+ * nothing has to be counted in advance. Integers take the fewest bytes that
+ * hold them and doubles are written as 32 bit floats when that loses nothing,
+ * which makes a typical sensor payload a half to a third of its JSON size.
+ * Messages carrying CBOR need the properties set by CBORWriter_AppendMessageProperties().
+ */
+
+#ifndef AZURE_SAMPLE_CBOR_WRITER_H
+#define AZURE_SAMPLE_CBOR_WRITER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "azure_iot_hub_client.h"
+
+/**
+ * @brief Send telemetry as CBOR rather than JSON, in the samples that support it.
+ */
+#ifndef democonfigTELEMETRY_CBOR
+    #define democonfigTELEMETRY_CBOR    0
+#endif
+
+/**
+ * @brief Content type message property of CBOR telemetry, URL encoded. The
+ * payload is binary, so it has no content encoding.
+ */
+#define cborwriterCONTENT_TYPE_PROPERTY    "$.ct"
+#define cborwriterCONTENT_TYPE_VALUE       "application%2Fcbor"
+
+typedef struct CBORWriter
+{
+    uint8_t * pucBuffer;
+    uint32_t ulBufferSize;
+    uint32_t ulUsed;
+} CBORWriter_t;
+
+/**
+ * @brief Initialize a CBOR writer.
+ *
+ * @param[out] pxWriter The writer to initialize.
+ * @param[in] pucBuffer Buffer the CBOR is written to.
+ * @param[in] ulBufferSize Size of \p pucBuffer.
+ * @return An #AzureIoTResult_t with the result of the operation.
+ */
+AzureIoTResult_t CBORWriter_Init( CBORWriter_t * pxWriter,
+                                  uint8_t * pucBuffer,
+                                  uint32_t ulBufferSize );
+
+/**
+ * @brief Append the start of a map, the CBOR counterpart of a JSON object.
+ */
+AzureIoTResult_t CBORWriter_AppendBeginObject( CBORWriter_t * pxWriter );
+
+/**
+ * @brief Append the end of a map.
+ */
+AzureIoTResult_t CBORWriter_AppendEndObject( CBORWriter_t * pxWriter );
+
+/**
+ * @brief Append the start of an array.
+ */
+AzureIoTResult_t CBORWriter_AppendBeginArray( CBORWriter_t * pxWriter );
+
+/**
+ * @brief Append the end of an array.
+ */
+AzureIoTResult_t CBORWriter_AppendEndArray( CBORWriter_t * pxWriter );
+
+/**
+ * @brief Append a map key.
+ *
+ * @param[in] pxWriter The writer.
+ * @param[in] pucPropertyName The key.
+ * @param[in] ulPropertyNameLength Length of \p pucPropertyName.
+ * @return An #AzureIoTResult_t with the result of the operation.
+ */
+AzureIoTResult_t CBORWriter_AppendPropertyName( CBORWriter_t * pxWriter,
+                                                const uint8_t * pucPropertyName,
+                                                uint32_t ulPropertyNameLength );
+
+/**
+ * @brief Append a text string.
+ */
+AzureIoTResult_t CBORWriter_AppendString( CBORWriter_t * pxWriter,
+                                          const uint8_t * pucValue,
+                                          uint32_t ulValueLength );
+
+/**
+ * @brief Append an integer.
+ */
+AzureIoTResult_t CBORWriter_AppendInt32( CBORWriter_t * pxWriter,
+                                         int32_t lValue );
+
+/**
+ * @brief Append a double, as a 32 bit float when that is exact.
+ */
+AzureIoTResult_t CBORWriter_AppendDouble( CBORWriter_t * pxWriter,
+                                          double xValue );
+
+/**
+ * @brief Append a boolean.
+ */
+AzureIoTResult_t CBORWriter_AppendBool( CBORWriter_t * pxWriter,
+                                        bool xValue );
+
+/**
+ * @brief Append a map key and an integer value.
+ */
+AzureIoTResult_t CBORWriter_AppendPropertyWithInt32Value( CBORWriter_t * pxWriter,
+                                                          const uint8_t * pucPropertyName,
+                                                          uint32_t ulPropertyNameLength,
+                                                          int32_t lValue );
+
+/**
+ * @brief Append a map key and a double value.
+ */
+AzureIoTResult_t CBORWriter_AppendPropertyWithDoubleValue( CBORWriter_t * pxWriter,
+                                                           const uint8_t * pucPropertyName,
+                                                           uint32_t ulPropertyNameLength,
+                                                           double xValue );
+
+/**
+ * @brief Get the number of bytes written.
+ */
+int32_t CBORWriter_GetBytesUsed( const CBORWriter_t * pxWriter );
+
+/**
+ * @brief Append the content type property of a CBOR message.
+ *
+ * @param[in] pxProperties Properties sent with the message.
+ * @return An #AzureIoTResult_t with the result of the operation.
+ */
+AzureIoTResult_t CBORWriter_AppendMessageProperties( AzureIoTMessageProperties_t * pxProperties );
+
+#endif /* AZURE_SAMPLE_CBOR_WRITER_H */
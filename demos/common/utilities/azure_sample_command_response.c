@@ -0,0 +1,57 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+#include "azure_sample_command_response.h"
+
+#include <stddef.h>
+#include <string.h>
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t CommandResponsePool_Init( CommandResponsePool_t * pxPool )
+{
+    if( pxPool == NULL )
+    {
+        return eAzureIoTErrorInvalidArgument;
+    }
+
+    memset( pxPool, 0, sizeof( *pxPool ) );
+
+    return eAzureIoTSuccess;
+}
+/*-----------------------------------------------------------*/
+
+uint8_t * CommandResponsePool_Acquire( CommandResponsePool_t * pxPool )
+{
+    uint32_t ulIndex;
+
+    for( ulIndex = 0; ulIndex < democonfigCOMMAND_RESPONSE_BUFFER_COUNT; ulIndex++ )
+    {
+        if( !pxPool->xInUse[ ulIndex ] )
+        {
+            pxPool->xInUse[ ulIndex ] = true;
+            return pxPool->ucBuffers[ ulIndex ];
+        }
+    }
+
+    return NULL;
+}
+/*-----------------------------------------------------------*/
+
+void CommandResponsePool_Release( CommandResponsePool_t * pxPool,
+                                  uint8_t * pucBuffer )
+{
+    uint32_t ulIndex;
+
+    if( pucBuffer == NULL )
+    {
+        return;
+    }
+
+    ulIndex = ( uint32_t ) ( pucBuffer - pxPool->ucBuffers[ 0 ] ) / democonfigCOMMAND_RESPONSE_BUFFER_SIZE;
+
+    if( ulIndex < democonfigCOMMAND_RESPONSE_BUFFER_COUNT )
+    {
+        pxPool->xInUse[ ulIndex ] = false;
+    }
+}
+/*-----------------------------------------------------------*/
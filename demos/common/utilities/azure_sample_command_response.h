@@ -0,0 +1,73 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @file azure_sample_command_response.h
+ *
+ * @brief Buffers for command responses, so that commands never share one.
+ *
+ * A command callback takes a buffer with CommandResponsePool_Acquire(), builds
+ * the response in it, sends it with AzureIoTHubClient_SendCommandResponse()
+ * and gives the buffer back with CommandResponsePool_Release(). The samples
+ * give it back before the callback returns, so one buffer is enough for them;
+ * more let a response be held past its callback, to be sent later, without
+ * the next command overwriting it.
+ *
+ * The callbacks run in the task of AzureIoTHubClient_ProcessLoop(), so the
+ * pool takes no lock; it must only be used from that task.
+ */
+
+#ifndef AZURE_SAMPLE_COMMAND_RESPONSE_H
+#define AZURE_SAMPLE_COMMAND_RESPONSE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "azure_iot_result.h"
+
+/**
+ * @brief Responses that can be held at once.
+ */
+#ifndef democonfigCOMMAND_RESPONSE_BUFFER_COUNT
+    #define democonfigCOMMAND_RESPONSE_BUFFER_COUNT    1
+#endif
+
+/**
+ * @brief Size of each response buffer, in bytes.
+ */
+#ifndef democonfigCOMMAND_RESPONSE_BUFFER_SIZE
+    #define democonfigCOMMAND_RESPONSE_BUFFER_SIZE     256
+#endif
+
+typedef struct CommandResponsePool
+{
+    uint8_t ucBuffers[ democonfigCOMMAND_RESPONSE_BUFFER_COUNT ][ democonfigCOMMAND_RESPONSE_BUFFER_SIZE ];
+    bool xInUse[ democonfigCOMMAND_RESPONSE_BUFFER_COUNT ];
+} CommandResponsePool_t;
+
+/**
+ * @brief Initialize a pool of response buffers.
+ *
+ * @param[out] pxPool The pool to initialize.
+ * @return An #AzureIoTResult_t with the result of the operation.
+ */
+AzureIoTResult_t CommandResponsePool_Init( CommandResponsePool_t * pxPool );
+
+/**
+ * @brief Take a free buffer.
+ *
+ * @param[in] pxPool The pool.
+ * @return The buffer, democonfigCOMMAND_RESPONSE_BUFFER_SIZE bytes long, or NULL when all are in use.
+ */
+uint8_t * CommandResponsePool_Acquire( CommandResponsePool_t * pxPool );
+
+/**
+ * @brief Give back a buffer once its response was sent.
+ *
+ * @param[in] pxPool The pool.
+ * @param[in] pucBuffer A buffer from CommandResponsePool_Acquire().
+ */
+void CommandResponsePool_Release( CommandResponsePool_t * pxPool,
+                                  uint8_t * pucBuffer );
+
+#endif /* AZURE_SAMPLE_COMMAND_RESPONSE_H */
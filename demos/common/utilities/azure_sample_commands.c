@@ -0,0 +1,43 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+#include "azure_sample_commands.h"
+
+#include <stddef.h>
+#include <string.h>
+
+#define commandsNOT_FOUND_STATUS    ( 404 )
+#define commandsEMPTY_PAYLOAD       "{}"
+/*-----------------------------------------------------------*/
+
+uint32_t CommandsDispatch_Process( DispatchTable_t * pxHandlers,
+                                   AzureIoTHubClientCommandRequest_t * pxMessage,
+                                   uint32_t * pulResponseStatus,
+                                   uint8_t * pucResponsePayload,
+                                   uint32_t ulResponsePayloadSize )
+{
+    const CommandHandlerEntry_t * pxEntry;
+
+    pxEntry = ( const CommandHandlerEntry_t * ) DispatchTable_Find( pxHandlers,
+                                                                    pxMessage->pucComponentName,
+                                                                    pxMessage->usComponentNameLength,
+                                                                    pxMessage->pucCommandName,
+                                                                    pxMessage->usCommandNameLength );
+
+    if( pxEntry != NULL )
+    {
+        return pxEntry->xHandler( pxMessage, pulResponseStatus, pucResponsePayload, ulResponsePayloadSize );
+    }
+
+    *pulResponseStatus = commandsNOT_FOUND_STATUS;
+
+    if( ulResponsePayloadSize < sizeof( commandsEMPTY_PAYLOAD ) - 1 )
+    {
+        return 0;
+    }
+
+    ( void ) memcpy( pucResponsePayload, commandsEMPTY_PAYLOAD, sizeof( commandsEMPTY_PAYLOAD ) - 1 );
+
+    return sizeof( commandsEMPTY_PAYLOAD ) - 1;
+}
+/*-----------------------------------------------------------*/
@@ -0,0 +1,60 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @file azure_sample_commands.h
+ *
+ * @brief Dispatches a command to its handler, found by name in a table.
+ *
+ * A sample lists its commands in a #DispatchTable_t of #CommandHandlerEntry_t,
+ * per component, and CommandsDispatch_Process() calls the one named by the
+ * request. A command no handler is for is answered with 404 and an empty
+ * object, as the samples did before.
+ */
+
+#ifndef AZURE_SAMPLE_COMMANDS_H
+#define AZURE_SAMPLE_COMMANDS_H
+
+#include <stdint.h>
+
+#include "azure_iot_hub_client.h"
+
+#include "azure_sample_dispatch_table.h"
+
+/**
+ * @brief Handles a command.
+ *
+ * @param[in] pxMessage The command request.
+ * @param[out] pulResponseStatus The status of the response.
+ * @param[out] pucResponsePayload Buffer for the response payload.
+ * @param[in] ulResponsePayloadSize Size of \p pucResponsePayload.
+ * @return Length of the response payload.
+ */
+typedef uint32_t ( * CommandHandler_t )( AzureIoTHubClientCommandRequest_t * pxMessage,
+                                         uint32_t * pulResponseStatus,
+                                         uint8_t * pucResponsePayload,
+                                         uint32_t ulResponsePayloadSize );
+
+typedef struct CommandHandlerEntry
+{
+    DispatchName_t xName;
+    CommandHandler_t xHandler;
+} CommandHandlerEntry_t;
+
+/**
+ * @brief Call the handler of a command.
+ *
+ * @param[in] pxHandlers Table of #CommandHandlerEntry_t.
+ * @param[in] pxMessage The command request.
+ * @param[out] pulResponseStatus The status of the response.
+ * @param[out] pucResponsePayload Buffer for the response payload.
+ * @param[in] ulResponsePayloadSize Size of \p pucResponsePayload.
+ * @return Length of the response payload, which is 0 if it does not fit.
+ */
+uint32_t CommandsDispatch_Process( DispatchTable_t * pxHandlers,
+                                   AzureIoTHubClientCommandRequest_t * pxMessage,
+                                   uint32_t * pulResponseStatus,
+                                   uint8_t * pucResponsePayload,
+                                   uint32_t ulResponsePayloadSize );
+
+#endif /* AZURE_SAMPLE_COMMANDS_H */
@@ -0,0 +1,599 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+#include "azure_sample_connection_manager.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+/* Kernel includes. */
+#include "FreeRTOS.h"
+#include "task.h"
+
+/* Demo Specific configs. */
+#include "demo_config.h"
+
+/* Azure Provisioning includes. */
+#include "azure_iot_provisioning_client.h"
+
+/* Crypto helper header. */
+#include "azure_sample_crypto.h"
+
+/* Startup timing. */
+#include "azure_sample_startup.h"
+
+#ifdef democonfigUSE_DPS_CACHE
+    /* Provisioning assignment kept across reboots. */
+    #include "azure_sample_dps_cache.h"
+#endif
+
+#ifdef democonfigTIME_SYNC
+    /* Unix time from SNTP, synced while the samples connect. */
+    #include "azure_sample_time_sync.h"
+#endif
+
+/**
+ * @brief Seeds the reconnect jitter, so that devices do not retry in step.
+ *
+ * An HSM only gives its registration ID once provisioning starts, so then
+ * configRAND32() alone seeds it.
+ */
+#ifndef democonfigENABLE_DPS_SAMPLE
+    #define connectionmanagerIDENTITY    democonfigDEVICE_ID
+#elif !defined( democonfigUSE_HSM )
+    #define connectionmanagerIDENTITY    democonfigREGISTRATION_ID
+#else
+    #define connectionmanagerIDENTITY    ""
+#endif
+
+/* Returned by prvConnect() once the attempts before a failover failed. */
+#define connectionmanagerFAILOVER_DUE    2U
+
+/* Each compilation unit must define the NetworkContext struct. */
+struct NetworkContext
+{
+    void * pParams;
+};
+
+/**
+ * @brief Unix time.
+ *
+ * @return Time in milliseconds.
+ */
+uint64_t ullGetUnixTime( void );
+
+#ifdef democonfigENABLE_DPS_SAMPLE
+    static AzureIoTProvisioningClient_t xAzureIoTProvisioningClient;
+
+/**
+ * @brief Time between two queries of a pending registration, in
+ * milliseconds, before the jitter. The retry-after of the service is not
+ * exposed by the middleware, which does not query again before it, so a
+ * longer one only makes the next AzureIoTProvisioningClient_Register() wait.
+ */
+    #ifndef connectionmanagerDPS_POLL_INTERVAL_MS
+        #define connectionmanagerDPS_POLL_INTERVAL_MS    ( 3000U )
+    #endif
+#endif /* democonfigENABLE_DPS_SAMPLE */
+/*-----------------------------------------------------------*/
+
+static void prvSetupNetworkCredentials( ConnectionManager_t * pxManager )
+{
+    NetworkCredentials_t * pxNetworkCredentials = &pxManager->xNetworkCredentials;
+
+    pxNetworkCredentials->xDisableSni = pdFALSE;
+    pxNetworkCredentials->pxSessionCache = &pxManager->xTlsSessionCache;
+    /* Set the credentials for establishing a TLS connection. */
+    pxNetworkCredentials->pucRootCa = ( const unsigned char * ) democonfigROOT_CA_PEM;
+    pxNetworkCredentials->xRootCaSize = sizeof( democonfigROOT_CA_PEM );
+    #ifdef democonfigCLIENT_CERTIFICATE_PEM
+        pxNetworkCredentials->pucClientCert = ( const unsigned char * ) democonfigCLIENT_CERTIFICATE_PEM;
+        pxNetworkCredentials->xClientCertSize = sizeof( democonfigCLIENT_CERTIFICATE_PEM );
+        pxNetworkCredentials->pucPrivateKey = ( const unsigned char * ) democonfigCLIENT_PRIVATE_KEY_PEM;
+        pxNetworkCredentials->xPrivateKeySize = sizeof( democonfigCLIENT_PRIVATE_KEY_PEM );
+    #endif
+
+    #ifdef democonfigGATEWAY_HOSTNAME
+        /* The gateway relays the device certificate, if any, to the hub, but
+         * presents a certificate of the site CA. */
+        pxManager->xGatewayCredentials = *pxNetworkCredentials;
+        pxManager->xGatewayCredentials.pucRootCa = ( const unsigned char * ) democonfigGATEWAY_ROOT_CA_PEM;
+        pxManager->xGatewayCredentials.xRootCaSize = sizeof( democonfigGATEWAY_ROOT_CA_PEM );
+    #endif
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t ConnectionManager_Init( ConnectionManager_t * pxManager,
+                                         uint8_t * pucBuffer,
+                                         uint32_t ulBufferLength,
+                                         uint32_t ulTransportTimeoutMs )
+{
+    if( pxManager == NULL )
+    {
+        return eAzureIoTErrorInvalidArgument;
+    }
+
+    memset( pxManager, 0, sizeof( *pxManager ) );
+    pxManager->pucBuffer = pucBuffer;
+    pxManager->ulBufferLength = ulBufferLength;
+    pxManager->ulTransportTimeoutMs = ulTransportTimeoutMs;
+
+    prvSetupNetworkCredentials( pxManager );
+
+    return ReconnectPolicy_Init( &pxManager->xReconnectPolicy,
+                                 ( const uint8_t * ) connectionmanagerIDENTITY,
+                                 sizeof( connectionmanagerIDENTITY ) - 1,
+                                 configRAND32() );
+}
+/*-----------------------------------------------------------*/
+
+void ConnectionManager_WaitInitialDelay( ConnectionManager_t * pxManager )
+{
+    vTaskDelay( pdMS_TO_TICKS( ReconnectPolicy_InitialDelay( &pxManager->xReconnectPolicy ) ) );
+}
+/*-----------------------------------------------------------*/
+
+/* Connects as ConnectionManager_Connect() does, with pxCredentials, or
+ * stops early with connectionmanagerFAILOVER_DUE once ulFailoverAttempts
+ * failed, unless it is 0. */
+static uint32_t prvConnect( ConnectionManager_t * pxManager,
+                            const char * pcHostName,
+                            uint32_t ulPort,
+                            NetworkContext_t * pxNetworkContext,
+                            NetworkCredentials_t * pxCredentials,
+                            uint32_t ulFailoverAttempts )
+{
+    TlsTransportStatus_t xNetworkStatus;
+    AzureIoTResult_t xBackoffResult = eAzureIoTSuccess;
+    uint32_t ulNextRetryBackOff = 0U;
+    uint32_t ulAttempts = 0U;
+
+    ReconnectPolicy_Reset( &pxManager->xReconnectPolicy );
+
+    /* Attempt to connect to the server. If connection fails, retry after a
+     * random part of a backoff that doubles with each attempt, up to
+     * democonfigRECONNECT_MAX_DELAY_MS, until democonfigRECONNECT_MAX_ATTEMPTS
+     * attempts were made, or forever if it is 0.
+     */
+    do
+    {
+        LogInfo( ( "Creating a TLS connection to %s:%u.\r\n", pcHostName, ( unsigned int ) ulPort ) );
+        /* Attempt to create a mutually authenticated TLS connection. */
+        xNetworkStatus = TLS_Socket_Connect( pxNetworkContext,
+                                             pcHostName, ulPort,
+                                             pxCredentials,
+                                             pxManager->ulTransportTimeoutMs,
+                                             pxManager->ulTransportTimeoutMs );
+
+        if( xNetworkStatus != eTLSTransportSuccess )
+        {
+            pxManager->ulFailedAttempts++;
+            pxManager->ulConsecutiveFailures++;
+
+            if( ++ulAttempts == ulFailoverAttempts )
+            {
+                LogWarn( ( "Connection to %s failed [%d] %u times, failing over.",
+                           pcHostName, xNetworkStatus, ( unsigned int ) ulAttempts ) );
+                return connectionmanagerFAILOVER_DUE;
+            }
+
+            /* Calculate the backoff (in milliseconds) for the next connection retry. */
+            xBackoffResult = ReconnectPolicy_NextDelay( &pxManager->xReconnectPolicy, &ulNextRetryBackOff );
+
+            if( xBackoffResult != eAzureIoTSuccess )
+            {
+                LogError( ( "Connection to %s failed, all attempts exhausted.", pcHostName ) );
+            }
+            else
+            {
+                LogWarn( ( "Connection to %s failed [%d]. "
+                           "Retrying connection with backoff and jitter [%u]ms.",
+                           pcHostName, xNetworkStatus, ( unsigned int ) ulNextRetryBackOff ) );
+                vTaskDelay( pdMS_TO_TICKS( ulNextRetryBackOff ) );
+            }
+        }
+    } while( ( xNetworkStatus != eTLSTransportSuccess ) && ( xBackoffResult == eAzureIoTSuccess ) );
+
+    if( xNetworkStatus != eTLSTransportSuccess )
+    {
+        return 1;
+    }
+
+    pxManager->ulConnects++;
+    pxManager->ulConsecutiveFailures = 0;
+    pxManager->xLastConnectTicks = xTaskGetTickCount();
+
+    #if defined( democonfigTIME_SYNC ) && defined( democonfigDEVICE_SYMMETRIC_KEY )
+        /* The SAS token of the CONNECT that follows expires from the time,
+         * which SNTP most often gave during the handshake. */
+        if( TimeSync_WaitValid( pdMS_TO_TICKS( democonfigTIME_SYNC_WAIT_MS ) ) != eAzureIoTSuccess )
+        {
+            LogWarn( ( "No time from SNTP yet, signing with the fallback time." ) );
+        }
+    #endif
+
+    return 0;
+}
+/*-----------------------------------------------------------*/
+
+uint32_t ConnectionManager_Connect( ConnectionManager_t * pxManager,
+                                    const char * pcHostName,
+                                    uint32_t ulPort,
+                                    NetworkContext_t * pxNetworkContext )
+{
+    return prvConnect( pxManager, pcHostName, ulPort, pxNetworkContext,
+                       &pxManager->xNetworkCredentials, 0U );
+}
+/*-----------------------------------------------------------*/
+
+uint32_t ConnectionManager_ConnectHubNoFailover( ConnectionManager_t * pxManager,
+                                                 const char * pcHubHostname,
+                                                 uint32_t ulPort,
+                                                 NetworkContext_t * pxNetworkContext )
+{
+    #ifdef democonfigGATEWAY_HOSTNAME
+        ( void ) pcHubHostname;
+
+        return prvConnect( pxManager, democonfigGATEWAY_HOSTNAME, ulPort, pxNetworkContext,
+                           &pxManager->xGatewayCredentials, 0U );
+    #else
+        return prvConnect( pxManager, pcHubHostname, ulPort, pxNetworkContext,
+                           &pxManager->xNetworkCredentials, 0U );
+    #endif /* democonfigGATEWAY_HOSTNAME */
+}
+/*-----------------------------------------------------------*/
+
+#ifdef democonfigENABLE_DPS_SAMPLE
+
+/* Sleep until the registration can be queried again, instead of spinning
+ * the client with its process loop until then. xPollStart is when the poll
+ * that returned pending started, whose time counts against the wait. */
+    static void prvWaitRegistrationRetry( ConnectionManager_t * pxManager,
+                                          TickType_t xPollStart )
+    {
+        TickType_t xElapsed = xTaskGetTickCount() - xPollStart;
+        TickType_t xWait;
+
+        xWait = pdMS_TO_TICKS( ReconnectPolicy_RetryAfterDelay( &pxManager->xReconnectPolicy,
+                                                                connectionmanagerDPS_POLL_INTERVAL_MS ) );
+
+        LogInfo( ( "Registration pending, querying again in %u ms.\r\n",
+                   ( unsigned int ) ( ( xWait > xElapsed ) ? ( ( xWait - xElapsed ) * portTICK_PERIOD_MS ) : 0U ) ) );
+
+        if( xWait > xElapsed )
+        {
+            vTaskDelay( xWait - xElapsed );
+        }
+    }
+/*-----------------------------------------------------------*/
+
+/* The registration ID of the device, which an HSM allocates. */
+    static uint32_t prvGetRegistrationId( const char ** ppcRegistrationId,
+                                          uint32_t * pulRegistrationIdLength )
+    {
+        #ifdef democonfigUSE_HSM
+            /* The HSM allocates the registration ID it generates. */
+            char * pcHsmRegistrationId = NULL;
+
+            if( getRegistrationId( &pcHsmRegistrationId ) != 0 )
+            {
+                LogError( ( "Failed to get the registration ID from the HSM." ) );
+                return 1;
+            }
+
+            *ppcRegistrationId = pcHsmRegistrationId;
+            *pulRegistrationIdLength = strlen( pcHsmRegistrationId );
+        #else
+            *ppcRegistrationId = democonfigREGISTRATION_ID;
+            *pulRegistrationIdLength = sizeof( democonfigREGISTRATION_ID ) - 1;
+        #endif /* democonfigUSE_HSM */
+
+        return 0;
+    }
+/*-----------------------------------------------------------*/
+
+/* Registers with the provisioning service, with the payload and timeout of
+ * the last ConnectionManager_Provision(), and keeps the assignment in the
+ * manager and the DPS cache. */
+    static uint32_t prvRegister( ConnectionManager_t * pxManager,
+                                 const char * pcRegistrationId,
+                                 uint32_t ulRegistrationIdLength )
+    {
+        NetworkContext_t xNetworkContext = { 0 };
+        TlsTransportParams_t xTlsTransportParams = { 0 };
+        AzureIoTResult_t xResult;
+        AzureIoTTransportInterface_t xTransport;
+        uint32_t ulPolls = 0;
+        uint32_t ulHostnameLength = sizeof( pxManager->ucHubHostname ) - 1;
+        uint32_t ulDeviceIdLength = sizeof( pxManager->ucHubDeviceId ) - 1;
+        TickType_t xPollStart;
+
+        /* Set the pParams member of the network context with desired transport. */
+        xNetworkContext.pParams = &xTlsTransportParams;
+
+        if( ConnectionManager_Connect( pxManager, democonfigENDPOINT, democonfigIOTHUB_PORT,
+                                       &xNetworkContext ) != 0 )
+        {
+            return 1;
+        }
+
+        StartupProfile_Mark( eStartupPhaseDpsConnected );
+
+        /* Fill in Transport Interface send and receive function pointers. */
+        xTransport.pxNetworkContext = &xNetworkContext;
+        xTransport.xSend = TLS_Socket_Send;
+        xTransport.xRecv = TLS_Socket_Recv;
+
+        xResult = AzureIoTProvisioningClient_Init( &xAzureIoTProvisioningClient,
+                                                   ( const uint8_t * ) democonfigENDPOINT,
+                                                   sizeof( democonfigENDPOINT ) - 1,
+                                                   ( const uint8_t * ) democonfigID_SCOPE,
+                                                   sizeof( democonfigID_SCOPE ) - 1,
+                                                   ( const uint8_t * ) pcRegistrationId,
+                                                   ulRegistrationIdLength,
+                                                   NULL, pxManager->pucBuffer, pxManager->ulBufferLength,
+                                                   ullGetUnixTime,
+                                                   &xTransport );
+        configASSERT( xResult == eAzureIoTSuccess );
+
+        #ifdef democonfigDEVICE_SYMMETRIC_KEY
+            xResult = AzureIoTProvisioningClient_SetSymmetricKey( &xAzureIoTProvisioningClient,
+                                                                  ( const uint8_t * ) democonfigDEVICE_SYMMETRIC_KEY,
+                                                                  sizeof( democonfigDEVICE_SYMMETRIC_KEY ) - 1,
+                                                                  Crypto_HMAC );
+            configASSERT( xResult == eAzureIoTSuccess );
+        #endif /* democonfigDEVICE_SYMMETRIC_KEY */
+
+        if( pxManager->pucPayload != NULL )
+        {
+            xResult = AzureIoTProvisioningClient_SetRegistrationPayload( &xAzureIoTProvisioningClient,
+                                                                         pxManager->pucPayload,
+                                                                         pxManager->ulPayloadLength );
+            configASSERT( xResult == eAzureIoTSuccess );
+        }
+
+        for( ; ; )
+        {
+            xPollStart = xTaskGetTickCount();
+            ulPolls++;
+            xResult = AzureIoTProvisioningClient_Register( &xAzureIoTProvisioningClient,
+                                                           pxManager->ulRegistrationTimeoutMs );
+
+            if( xResult != eAzureIoTErrorPending )
+            {
+                break;
+            }
+
+            /* The service answered with an operation to query. The jitter
+             * of the wait spreads the queries of a fleet out. */
+            prvWaitRegistrationRetry( pxManager, xPollStart );
+        }
+
+        pxManager->ulRegistrationPolls = ulPolls;
+
+        if( xResult == eAzureIoTSuccess )
+        {
+            LogInfo( ( "Successfully acquired IoT Hub name and Device ID after %u polls",
+                       ( unsigned int ) ulPolls ) );
+            /* One byte is left for the terminator, as an assignment to a
+             * shorter hostname may replace the one in the buffer. */
+            xResult = AzureIoTProvisioningClient_GetDeviceAndHub( &xAzureIoTProvisioningClient,
+                                                                  pxManager->ucHubHostname, &ulHostnameLength,
+                                                                  pxManager->ucHubDeviceId, &ulDeviceIdLength );
+        }
+        else
+        {
+            LogError( ( "Error getting IoT Hub name and Device ID: 0x%08x", ( uint16_t ) xResult ) );
+        }
+
+        AzureIoTProvisioningClient_Deinit( &xAzureIoTProvisioningClient );
+
+        /* Close the network connection.  */
+        TLS_Socket_Disconnect( &xNetworkContext );
+
+        if( xResult != eAzureIoTSuccess )
+        {
+            return 1;
+        }
+
+        pxManager->ucHubHostname[ ulHostnameLength ] = '\0';
+        pxManager->ulHubHostnameLength = ulHostnameLength;
+        pxManager->ucHubDeviceId[ ulDeviceIdLength ] = '\0';
+        pxManager->ulHubDeviceIdLength = ulDeviceIdLength;
+
+        StartupProfile_Mark( eStartupPhaseDpsRegistered );
+
+        #ifdef democonfigUSE_DPS_CACHE
+            if( DPSCache_Save( ullGetUnixTime(),
+                               ( const uint8_t * ) pcRegistrationId, ulRegistrationIdLength,
+                               pxManager->ucHubHostname, pxManager->ulHubHostnameLength,
+                               pxManager->ucHubDeviceId, pxManager->ulHubDeviceIdLength ) != eAzureIoTSuccess )
+            {
+                LogWarn( ( "Failed to cache the IoT Hub assignment.\r\n" ) );
+            }
+        #endif /* democonfigUSE_DPS_CACHE */
+
+        return 0;
+    }
+/*-----------------------------------------------------------*/
+
+    uint32_t ConnectionManager_Provision( ConnectionManager_t * pxManager,
+                                          const uint8_t * pucPayload,
+                                          uint32_t ulPayloadLength,
+                                          uint32_t ulRegistrationTimeoutMs,
+                                          uint8_t ** ppucHubHostname,
+                                          uint32_t * pulHubHostnameLength,
+                                          uint8_t ** ppucHubDeviceId,
+                                          uint32_t * pulHubDeviceIdLength )
+    {
+        const char * pcRegistrationId;
+        uint32_t ulRegistrationIdLength;
+        bool xAssigned = false;
+
+        if( prvGetRegistrationId( &pcRegistrationId, &ulRegistrationIdLength ) != 0 )
+        {
+            return 1;
+        }
+
+        /* Kept for the registrations of a failover. */
+        pxManager->pucPayload = pucPayload;
+        pxManager->ulPayloadLength = ulPayloadLength;
+        pxManager->ulRegistrationTimeoutMs = ulRegistrationTimeoutMs;
+
+        #ifdef democonfigUSE_DPS_CACHE
+            pxManager->ulHubHostnameLength = sizeof( pxManager->ucHubHostname );
+            pxManager->ulHubDeviceIdLength = sizeof( pxManager->ucHubDeviceId );
+
+            /* A device that registered before skips the provisioning service. */
+            if( DPSCache_Load( ullGetUnixTime(),
+                               ( const uint8_t * ) pcRegistrationId, ulRegistrationIdLength,
+                               pxManager->ucHubHostname, &pxManager->ulHubHostnameLength,
+                               pxManager->ucHubDeviceId, &pxManager->ulHubDeviceIdLength ) == eAzureIoTSuccess )
+            {
+                LogInfo( ( "Using the cached IoT Hub assignment.\r\n" ) );
+                StartupProfile_Mark( eStartupPhaseDpsRegistered );
+                xAssigned = true;
+            }
+        #endif /* democonfigUSE_DPS_CACHE */
+
+        if( !xAssigned && ( prvRegister( pxManager, pcRegistrationId, ulRegistrationIdLength ) != 0 ) )
+        {
+            return 1;
+        }
+
+        *ppucHubHostname = pxManager->ucHubHostname;
+        *pulHubHostnameLength = pxManager->ulHubHostnameLength;
+        *ppucHubDeviceId = pxManager->ucHubDeviceId;
+        *pulHubDeviceIdLength = pxManager->ulHubDeviceIdLength;
+
+        return 0;
+    }
+/*-----------------------------------------------------------*/
+
+    void ConnectionManager_ForgetAssignment( ConnectionManager_t * pxManager )
+    {
+        pxManager->ulHubHostnameLength = 0;
+        pxManager->ulHubDeviceIdLength = 0;
+
+        #ifdef democonfigUSE_DPS_CACHE
+            ( void ) DPSCache_Clear();
+        #endif
+    }
+/*-----------------------------------------------------------*/
+
+    #if ( democonfigHUB_FAILOVER_ATTEMPTS > 0 ) && !defined( democonfigGATEWAY_HOSTNAME )
+
+/* Moves the assignment to another hub: to the secondary assignment of the
+ * DPS cache, the first time in an outage and if there is one, or else to
+ * the hub a new registration allocates. */
+        static uint32_t prvFailover( ConnectionManager_t * pxManager,
+                                     bool * pxSecondaryTried )
+        {
+            const char * pcRegistrationId;
+            uint32_t ulRegistrationIdLength;
+
+            #ifdef democonfigUSE_DPS_CACHE
+                uint32_t ulHostnameLength = sizeof( pxManager->ucHubHostname );
+                uint32_t ulDeviceIdLength = sizeof( pxManager->ucHubDeviceId );
+            #endif
+
+            pxManager->ulFailovers++;
+
+            if( prvGetRegistrationId( &pcRegistrationId, &ulRegistrationIdLength ) != 0 )
+            {
+                return 1;
+            }
+
+            #ifdef democonfigUSE_DPS_CACHE
+                if( !*pxSecondaryTried )
+                {
+                    *pxSecondaryTried = true;
+
+                    /* The buffers are only written when it succeeds. */
+                    if( DPSCache_LoadSecondary( ullGetUnixTime(),
+                                                ( const uint8_t * ) pcRegistrationId, ulRegistrationIdLength,
+                                                pxManager->ucHubHostname, &ulHostnameLength,
+                                                pxManager->ucHubDeviceId, &ulDeviceIdLength ) == eAzureIoTSuccess )
+                    {
+                        pxManager->ulHubHostnameLength = ulHostnameLength;
+                        pxManager->ulHubDeviceIdLength = ulDeviceIdLength;
+
+                        LogWarn( ( "Failing over to the secondary IoT Hub %s.\r\n", pxManager->ucHubHostname ) );
+
+                        /* Swaps the two, so a reboot keeps to the one that works. */
+                        if( DPSCache_Save( ullGetUnixTime(),
+                                           ( const uint8_t * ) pcRegistrationId, ulRegistrationIdLength,
+                                           pxManager->ucHubHostname, pxManager->ulHubHostnameLength,
+                                           pxManager->ucHubDeviceId, pxManager->ulHubDeviceIdLength ) != eAzureIoTSuccess )
+                        {
+                            LogWarn( ( "Failed to cache the IoT Hub assignment.\r\n" ) );
+                        }
+
+                        return 0;
+                    }
+                }
+            #endif /* democonfigUSE_DPS_CACHE */
+
+            LogWarn( ( "Registering with the provisioning service again to fail over.\r\n" ) );
+
+            return prvRegister( pxManager, pcRegistrationId, ulRegistrationIdLength );
+        }
+/*-----------------------------------------------------------*/
+
+    #endif /* democonfigHUB_FAILOVER_ATTEMPTS > 0 && !democonfigGATEWAY_HOSTNAME */
+
+#endif /* democonfigENABLE_DPS_SAMPLE */
+/*-----------------------------------------------------------*/
+
+uint32_t ConnectionManager_ConnectHub( ConnectionManager_t * pxManager,
+                                       uint32_t ulPort,
+                                       NetworkContext_t * pxNetworkContext,
+                                       uint8_t ** ppucHubHostname,
+                                       uint32_t * pulHubHostnameLength,
+                                       uint8_t ** ppucHubDeviceId,
+                                       uint32_t * pulHubDeviceIdLength )
+{
+    #if defined( democonfigENABLE_DPS_SAMPLE ) && ( democonfigHUB_FAILOVER_ATTEMPTS > 0 ) && !defined( democonfigGATEWAY_HOSTNAME )
+        uint32_t ulStatus;
+        uint32_t ulAttempts = 0;
+        bool xSecondaryTried = false;
+
+        for( ; ; )
+        {
+            ulStatus = prvConnect( pxManager, ( const char * ) *ppucHubHostname, ulPort, pxNetworkContext,
+                                   &pxManager->xNetworkCredentials, democonfigHUB_FAILOVER_ATTEMPTS );
+
+            if( ulStatus != connectionmanagerFAILOVER_DUE )
+            {
+                return ulStatus;
+            }
+
+            ulAttempts += democonfigHUB_FAILOVER_ATTEMPTS;
+
+            #if ( democonfigRECONNECT_MAX_ATTEMPTS > 0U )
+                if( ulAttempts >= democonfigRECONNECT_MAX_ATTEMPTS )
+                {
+                    LogError( ( "Connection to IoT Hub failed, all attempts exhausted." ) );
+                    return 1;
+                }
+            #endif /* democonfigRECONNECT_MAX_ATTEMPTS > 0U */
+
+            /* Without a new assignment, the same hub is tried again. */
+            if( prvFailover( pxManager, &xSecondaryTried ) == 0 )
+            {
+                *ppucHubHostname = pxManager->ucHubHostname;
+                *pulHubHostnameLength = pxManager->ulHubHostnameLength;
+                *ppucHubDeviceId = pxManager->ucHubDeviceId;
+                *pulHubDeviceIdLength = pxManager->ulHubDeviceIdLength;
+            }
+        }
+    #else /* democonfigENABLE_DPS_SAMPLE && democonfigHUB_FAILOVER_ATTEMPTS > 0 && !democonfigGATEWAY_HOSTNAME */
+        ( void ) pulHubHostnameLength;
+        ( void ) ppucHubDeviceId;
+        ( void ) pulHubDeviceIdLength;
+
+        return ConnectionManager_ConnectHubNoFailover( pxManager, ( const char * ) *ppucHubHostname,
+                                                       ulPort, pxNetworkContext );
+    #endif /* democonfigENABLE_DPS_SAMPLE && democonfigHUB_FAILOVER_ATTEMPTS > 0 && !democonfigGATEWAY_HOSTNAME */
+}
+/*-----------------------------------------------------------*/
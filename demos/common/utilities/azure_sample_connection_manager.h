@@ -0,0 +1,223 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @file azure_sample_connection_manager.h
+ *
+ * @brief The TLS connections of a sample to the provisioning service and IoT Hub.
+ *
+ * A ConnectionManager_t holds what the samples used to keep each on their
+ * own: the network credentials from demo_config.h, the TLS session cache
+ * that lets a reconnect skip the full handshake, and the reconnect policy,
+ * seeded with the device or registration ID. ConnectionManager_Connect()
+ * retries with the backoff of the policy, and ConnectionManager_Provision()
+ * registers with the provisioning service, or reads the assignment kept by
+ * the DPS cache when the board defines democonfigUSE_DPS_CACHE.
+ *
+ * ConnectionManager_ConnectHub() connects to the assigned IoT Hub, and with
+ * democonfigHUB_FAILOVER_ATTEMPTS set fails over to another hub when it
+ * cannot reach that one: to the secondary assignment of the DPS cache, the
+ * hub an earlier registration allocated, or else to the hub the provisioning
+ * service allocates when the device registers again, which a service linked
+ * to several hubs may move it to in an outage of one. The connections keep
+ * the credentials and root CA of the manager.
+ *
+ * When the board defines democonfigGATEWAY_HOSTNAME, the hub connections go
+ * to that IoT Edge gateway on the site instead, checked against the site CA
+ * democonfigGATEWAY_ROOT_CA_PEM, while the provisioning service is still
+ * reached directly. The hostname and device ID, and so the MQTT identity,
+ * the SAS token and the topics, stay those of the hub the gateway relays to,
+ * which is why a gateway never fails over.
+ *
+ * The manager also counts the connects and failed attempts, which a sample
+ * can report, such as in its diagnostics.
+ *
+ * A ConnectionManager_t is not thread safe; use one per task that connects.
+ */
+
+#ifndef AZURE_SAMPLE_CONNECTION_MANAGER_H
+#define AZURE_SAMPLE_CONNECTION_MANAGER_H
+
+#include <stdint.h>
+
+#include "FreeRTOS.h"
+
+#include "azure_iot_result.h"
+
+#include "azure_sample_reconnect.h"
+
+#include "transport_tls_socket.h"
+
+/**
+ * @brief Size of the hostname and device ID assigned by the provisioning service.
+ */
+#ifndef democonfigCONNECTION_MANAGER_ID_SIZE
+    #define democonfigCONNECTION_MANAGER_ID_SIZE    128
+#endif
+
+/**
+ * @brief Failed attempts to connect to the assigned IoT Hub after which
+ * ConnectionManager_ConnectHub() fails over to another, or 0 to keep to it.
+ * Only used with democonfigENABLE_DPS_SAMPLE.
+ */
+#ifndef democonfigHUB_FAILOVER_ATTEMPTS
+    #define democonfigHUB_FAILOVER_ATTEMPTS    0
+#endif
+
+typedef struct ConnectionManager
+{
+    NetworkCredentials_t xNetworkCredentials;
+    NetworkCredentials_t xGatewayCredentials; /* With democonfigGATEWAY_HOSTNAME. */
+    TlsSessionCache_t xTlsSessionCache;
+    ReconnectPolicy_t xReconnectPolicy;
+    uint32_t ulTransportTimeoutMs;
+
+    /* Lent to the provisioning client. */
+    uint8_t * pucBuffer;
+    uint32_t ulBufferLength;
+
+    /* Of the last ConnectionManager_Provision(), for the registrations of a failover. */
+    const uint8_t * pucPayload;
+    uint32_t ulPayloadLength;
+    uint32_t ulRegistrationTimeoutMs;
+
+    /* The assignment of the provisioning service. */
+    uint8_t ucHubHostname[ democonfigCONNECTION_MANAGER_ID_SIZE ];
+    uint32_t ulHubHostnameLength;
+    uint8_t ucHubDeviceId[ democonfigCONNECTION_MANAGER_ID_SIZE ];
+    uint32_t ulHubDeviceIdLength;
+
+    /* Health of the connections, since boot. */
+    uint32_t ulConnects;
+    uint32_t ulFailedAttempts;
+    uint32_t ulConsecutiveFailures;
+    TickType_t xLastConnectTicks;
+    uint32_t ulRegistrationPolls; /* Of the last registration with the provisioning service. */
+    uint32_t ulFailovers;         /* Moves to another IoT Hub. */
+} ConnectionManager_t;
+
+/**
+ * @brief Initialize a connection manager.
+ *
+ * @param[out] pxManager The manager to initialize.
+ * @param[in] pucBuffer Buffer for the MQTT messages of the provisioning client,
+ * such as the MQTT buffer of the sample, as it is not used while provisioning.
+ * @param[in] ulBufferLength Length of \p pucBuffer.
+ * @param[in] ulTransportTimeoutMs Send and receive timeout of the connections.
+ * @return An #AzureIoTResult_t with the result of the operation.
+ */
+AzureIoTResult_t ConnectionManager_Init( ConnectionManager_t * pxManager,
+                                         uint8_t * pucBuffer,
+                                         uint32_t ulBufferLength,
+                                         uint32_t ulTransportTimeoutMs );
+
+/**
+ * @brief Wait the random delay of the first connect after boot, so that
+ * devices that power up together do not all connect at the same moment.
+ *
+ * @param[in] pxManager The manager.
+ */
+void ConnectionManager_WaitInitialDelay( ConnectionManager_t * pxManager );
+
+/**
+ * @brief Connect to an endpoint, retrying with backoff and jitter.
+ *
+ * @param[in] pxManager The manager.
+ * @param[in] pcHostName Hostname of the endpoint.
+ * @param[in] ulPort Port of the endpoint.
+ * @param[in,out] pxNetworkContext The network context, with its parameters set.
+ * @return 0 once connected, or 1 once democonfigRECONNECT_MAX_ATTEMPTS were made.
+ */
+uint32_t ConnectionManager_Connect( ConnectionManager_t * pxManager,
+                                    const char * pcHostName,
+                                    uint32_t ulPort,
+                                    NetworkContext_t * pxNetworkContext );
+
+/**
+ * @brief Connect to an IoT Hub, or to the gateway in front of it, retrying
+ * with backoff and jitter.
+ *
+ * For the samples whose registration payload does not stay valid, which
+ * ConnectionManager_ConnectHub() would need to fail over.
+ *
+ * @param[in] pxManager The manager.
+ * @param[in] pcHubHostname Hostname of the IoT Hub.
+ * @param[in] ulPort Port of IoT Hub, and of the gateway.
+ * @param[in,out] pxNetworkContext The network context, with its parameters set.
+ * @return 0 once connected, or 1 once democonfigRECONNECT_MAX_ATTEMPTS were made.
+ */
+uint32_t ConnectionManager_ConnectHubNoFailover( ConnectionManager_t * pxManager,
+                                                 const char * pcHubHostname,
+                                                 uint32_t ulPort,
+                                                 NetworkContext_t * pxNetworkContext );
+
+/**
+ * @brief Connect to the assigned IoT Hub, failing over to another hub after
+ * democonfigHUB_FAILOVER_ATTEMPTS failed attempts.
+ *
+ * The first failover of a call moves to the secondary assignment of the DPS
+ * cache when there is one, and the others register with the provisioning
+ * service again, with the payload given to ConnectionManager_Provision(),
+ * which then has to stay valid. A failed registration leaves the hub as it
+ * was. The attempts on all hubs count against democonfigRECONNECT_MAX_ATTEMPTS.
+ *
+ * Without democonfigENABLE_DPS_SAMPLE, with democonfigHUB_FAILOVER_ATTEMPTS
+ * 0, or through a gateway, this is ConnectionManager_ConnectHubNoFailover().
+ *
+ * @param[in] pxManager The manager.
+ * @param[in] ulPort Port of IoT Hub.
+ * @param[in,out] pxNetworkContext The network context, with its parameters set.
+ * @param[in,out] ppucHubHostname The hostname of the IoT Hub, then of the hub connected to.
+ * @param[in,out] pulHubHostnameLength Length of the hostname.
+ * @param[in,out] ppucHubDeviceId The device ID, then the one on the hub connected to.
+ * @param[in,out] pulHubDeviceIdLength Length of the device ID.
+ * @return 0 once connected, or 1 once democonfigRECONNECT_MAX_ATTEMPTS were made.
+ */
+uint32_t ConnectionManager_ConnectHub( ConnectionManager_t * pxManager,
+                                       uint32_t ulPort,
+                                       NetworkContext_t * pxNetworkContext,
+                                       uint8_t ** ppucHubHostname,
+                                       uint32_t * pulHubHostnameLength,
+                                       uint8_t ** ppucHubDeviceId,
+                                       uint32_t * pulHubDeviceIdLength );
+
+/**
+ * @brief Get the IoT Hub and device ID assigned by the provisioning service.
+ *
+ * A cached assignment is used when there is one. Otherwise this connects to
+ * democonfigENDPOINT, registers and blocks until the result, which is then
+ * cached. While the registration is pending, the task sleeps for the
+ * retry-after of the service, with a random part of
+ * democonfigRECONNECT_RETRY_AFTER_JITTER_MS added, before each query. The hostname and device ID stay valid in the manager until the
+ * next call. Only built with democonfigENABLE_DPS_SAMPLE.
+ *
+ * @param[in] pxManager The manager.
+ * @param[in] pucPayload The registration payload, or NULL for none.
+ * @param[in] ulPayloadLength Length of \p pucPayload.
+ * @param[in] ulRegistrationTimeoutMs Longest wait for the response of each
+ * registration poll, in which the retry-after counts.
+ * @param[out] ppucHubHostname The hostname of the IoT Hub.
+ * @param[out] pulHubHostnameLength Length of the hostname.
+ * @param[out] ppucHubDeviceId The device ID.
+ * @param[out] pulHubDeviceIdLength Length of the device ID.
+ * @return 0 on success.
+ */
+uint32_t ConnectionManager_Provision( ConnectionManager_t * pxManager,
+                                      const uint8_t * pucPayload,
+                                      uint32_t ulPayloadLength,
+                                      uint32_t ulRegistrationTimeoutMs,
+                                      uint8_t ** ppucHubHostname,
+                                      uint32_t * pulHubHostnameLength,
+                                      uint8_t ** ppucHubDeviceId,
+                                      uint32_t * pulHubDeviceIdLength );
+
+/**
+ * @brief Forget the assignment, once IoT Hub refuses it, so that the next
+ * ConnectionManager_Provision() registers again. Only built with
+ * democonfigENABLE_DPS_SAMPLE.
+ *
+ * @param[in] pxManager The manager.
+ */
+void ConnectionManager_ForgetAssignment( ConnectionManager_t * pxManager );
+
+#endif /* AZURE_SAMPLE_CONNECTION_MANAGER_H */
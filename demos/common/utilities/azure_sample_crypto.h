@@ -1,18 +1,85 @@
 /* Copyright (c) Microsoft Corporation.
  * Licensed under the MIT License. */
 
+#ifndef AZURE_SAMPLE_CRYPTO_H
+#define AZURE_SAMPLE_CRYPTO_H
+
+#include <stddef.h>
 #include <stdint.h>
 
+/**
+ * @brief Number of random number requests served before the shared DRBG is
+ * reseeded from the platform entropy source.
+ */
+#ifndef cryptoRNG_RESEED_INTERVAL
+    #define cryptoRNG_RESEED_INTERVAL    ( 10000 )
+#endif
+
+/**
+ * @brief Longest HMAC key whose context Crypto_HMAC() keeps for the next call.
+ *
+ * Longer keys are set up again for every HMAC.
+ */
+#ifndef cryptoHMAC_CACHED_KEY_SIZE
+    #define cryptoHMAC_CACHED_KEY_SIZE    ( 64 )
+#endif
+
+/**
+ * @brief RSA public keys whose imported context Crypto_RSAVerify() keeps,
+ * two for the ADU root key and the signing key it vouches for.
+ */
+#ifndef cryptoRSA_CACHED_KEY_COUNT
+    #define cryptoRSA_CACHED_KEY_COUNT       ( 2 )
+#endif
+
+/**
+ * @brief Longest RSA modulus, in bytes, whose context Crypto_RSAVerify() keeps.
+ */
+#ifndef cryptoRSA_CACHED_KEY_SIZE
+    #define cryptoRSA_CACHED_KEY_SIZE        ( 512 )
+#endif
+
+/**
+ * @brief Longest RSA public exponent, in bytes, whose context Crypto_RSAVerify() keeps.
+ *
+ * Keys with a longer modulus or exponent are imported again for every verify.
+ */
+#ifndef cryptoRSA_CACHED_EXPONENT_SIZE
+    #define cryptoRSA_CACHED_EXPONENT_SIZE    ( 8 )
+#endif
+
 /**
  * @brief Initialize crypto
  *
+ * Registers the threading hooks and seeds the process-wide random number
+ * generator. Safe to call more than once, from several tasks at once; only
+ * the first call does the work.
+ *
  * @return An #uint32_t with result of operation.
  */
 uint32_t Crypto_Init();
 
+/**
+ * @brief Generate random bytes from the process-wide DRBG.
+ *
+ * The signature matches the mbedTLS f_rng callback so it can be passed
+ * directly to mbedtls_ssl_conf_rng(). Crypto_Init() must have succeeded.
+ *
+ * @param[in] pvContext Unused.
+ * @param[out] pucOutput Buffer to fill with random bytes.
+ * @param[in] xOutputLength Number of bytes to generate.
+ * @return 0 on success, otherwise an mbedTLS error code.
+ */
+int Crypto_Random( void * pvContext,
+                   unsigned char * pucOutput,
+                   size_t xOutputLength );
+
 /**
  * @brief Compute HMAC SHA256
  *
+ * The HMAC state of the last key is kept, so signing again with the same key,
+ * as every SAS token renewal does, does not set the key up again.
+ *
  * @param[in] pucKey Pointer to key.
  * @param[in] ulKeyLength Length of Key.
  * @param[in] pucData Pointer to data for HMAC
@@ -29,3 +96,46 @@ uint32_t Crypto_HMAC( const uint8_t * pucKey,
                       uint8_t * pucOutput,
                       uint32_t ulOutputLength,
                       uint32_t * pulBytesCopied );
+
+/**
+ * @brief Compute SHA256
+ *
+ * @param[in] pucData Pointer to data to hash.
+ * @param[in] ulDataLength Length of data.
+ * @param[out] pucOutput Buffer to place the 32 bytes of the hash.
+ * @param[in] ulOutputLength Length of output buffer.
+ * @return An #uint32_t with result of operation.
+ */
+uint32_t Crypto_SHA256( const uint8_t * pucData,
+                        uint32_t ulDataLength,
+                        uint8_t * pucOutput,
+                        uint32_t ulOutputLength );
+
+/**
+ * @brief Verify an RS256 signature, RSASSA-PKCS1-v1_5 over a SHA256 hash.
+ *
+ * The imported contexts of the last cryptoRSA_CACHED_KEY_COUNT keys are kept,
+ * with the Montgomery constant of their modulus worked out by the first verify,
+ * so verifying again with the same root key, as every ADU manifest does, does
+ * not import and complete the key again.
+ *
+ * @param[in] pucN Pointer to the big endian modulus of the key.
+ * @param[in] ulNLength Length of the modulus.
+ * @param[in] pucE Pointer to the big endian public exponent of the key.
+ * @param[in] ulELength Length of the exponent.
+ * @param[in] pucHash Pointer to the SHA256 of the signed data.
+ * @param[in] ulHashLength Length of hash, 32.
+ * @param[in] pucSignature Pointer to signature.
+ * @param[in] ulSignatureLength Length of signature, that of the modulus.
+ * @return 0 if the signature is valid, otherwise non zero.
+ */
+uint32_t Crypto_RSAVerify( const uint8_t * pucN,
+                           uint32_t ulNLength,
+                           const uint8_t * pucE,
+                           uint32_t ulELength,
+                           const uint8_t * pucHash,
+                           uint32_t ulHashLength,
+                           const uint8_t * pucSignature,
+                           uint32_t ulSignatureLength );
+
+#endif /* AZURE_SAMPLE_CRYPTO_H */
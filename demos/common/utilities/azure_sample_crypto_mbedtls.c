@@ -3,23 +3,322 @@
 
 #include "azure_sample_crypto.h"
 
+#include <string.h>
+
 #include "threading_alt.h"
 
+/* FreeRTOS includes. */
+#include "FreeRTOS.h"
+#include "semphr.h"
+#include "task.h"
+
 /* mbed TLS includes. */
+#include "mbedtls/ctr_drbg.h"
+#include "mbedtls/entropy.h"
 #include "mbedtls/md.h"
+#include "mbedtls/rsa.h"
 #include "mbedtls/threading.h"
+#include "mbedtls/version.h"
+
+/*-----------------------------------------------------------*/
+
+/* Random number generator shared by every TLS context in the process. */
+static mbedtls_entropy_context xEntropyContext;
+static mbedtls_ctr_drbg_context xCtrDrbgContext;
+static BaseType_t xCryptoInitialized = pdFALSE;
+
+/* Held by the Crypto_Init() call doing the setup, as the transports of
+ * several tasks may connect at once. */
+static SemaphoreHandle_t xInitMutex = NULL;
+static StaticSemaphore_t xInitMutexBuffer;
+
+/* HMAC context of the last key, kept so that signing again with the same
+ * key, as every SAS token renewal does, skips the key setup. mbed TLS keeps
+ * the key XOR ipad and opad blocks in it, and mbedtls_md_hmac_reset() starts
+ * the next HMAC from them. */
+static mbedtls_md_context_t xHMACContext;
+static uint8_t ucHMACKey[ cryptoHMAC_CACHED_KEY_SIZE ];
+static uint32_t ulHMACKeyLength = 0;
+static BaseType_t xHMACKeyValid = pdFALSE;
+static SemaphoreHandle_t xHMACMutex = NULL;
+static StaticSemaphore_t xHMACMutexBuffer;
+
+/* Imported RSA public keys, kept so that verifying again with the same key,
+ * as every ADU manifest does with its root key, skips the import. mbed TLS
+ * works out the Montgomery constant of the modulus, RN, on the first public
+ * operation and keeps it in the context for the next ones. */
+typedef struct CryptoRSAKey
+{
+    mbedtls_rsa_context xContext;
+    uint8_t ucN[ cryptoRSA_CACHED_KEY_SIZE ];
+    uint32_t ulNLength;
+    uint8_t ucE[ cryptoRSA_CACHED_EXPONENT_SIZE ];
+    uint32_t ulELength;
+    uint32_t ulLastUse;
+    BaseType_t xValid;
+} CryptoRSAKey_t;
+
+static CryptoRSAKey_t xRSAKeys[ cryptoRSA_CACHED_KEY_COUNT ];
+static uint32_t ulRSAUseCount = 0;
+static SemaphoreHandle_t xRSAMutex = NULL;
+static StaticSemaphore_t xRSAMutexBuffer;
+
+/*-----------------------------------------------------------*/
+
+static void prvHMACCacheInit( void )
+{
+    mbedtls_md_init( &xHMACContext );
+
+    /* Without a context, every HMAC is computed from scratch. */
+    if( mbedtls_md_setup( &xHMACContext, mbedtls_md_info_from_type( MBEDTLS_MD_SHA256 ), 1 ) == 0 )
+    {
+        xHMACMutex = xSemaphoreCreateMutexStatic( &xHMACMutexBuffer );
+    }
+}
+/*-----------------------------------------------------------*/
+
+static uint32_t prvHMACUncached( const uint8_t * pucKey,
+                                 uint32_t ulKeyLength,
+                                 const uint8_t * pucData,
+                                 uint32_t ulDataLength,
+                                 uint8_t * pucOutput )
+{
+    uint32_t ulRet;
+    mbedtls_md_context_t xCtx;
+    mbedtls_md_type_t xMDType = MBEDTLS_MD_SHA256;
+
+    mbedtls_md_init( &xCtx );
+
+    if( mbedtls_md_setup( &xCtx, mbedtls_md_info_from_type( xMDType ), 1 ) ||
+        mbedtls_md_hmac_starts( &xCtx, pucKey, ulKeyLength ) ||
+        mbedtls_md_hmac_update( &xCtx, pucData, ulDataLength ) ||
+        mbedtls_md_hmac_finish( &xCtx, pucOutput ) )
+    {
+        ulRet = 1;
+    }
+    else
+    {
+        ulRet = 0;
+    }
+
+    mbedtls_md_free( &xCtx );
+
+    return ulRet;
+}
+/*-----------------------------------------------------------*/
+
+static int prvRSAImport( mbedtls_rsa_context * pxContext,
+                         const uint8_t * pucN,
+                         uint32_t ulNLength,
+                         const uint8_t * pucE,
+                         uint32_t ulELength )
+{
+    /* The padding moved out of the init in mbed TLS 3.0. */
+    #if MBEDTLS_VERSION_NUMBER >= 0x03000000
+        mbedtls_rsa_init( pxContext );
+
+        if( mbedtls_rsa_set_padding( pxContext, MBEDTLS_RSA_PKCS_V15, MBEDTLS_MD_NONE ) != 0 )
+        {
+            return 1;
+        }
+    #else
+        mbedtls_rsa_init( pxContext, MBEDTLS_RSA_PKCS_V15, 0 );
+    #endif
+
+    return ( mbedtls_rsa_import_raw( pxContext, pucN, ulNLength, NULL, 0, NULL, 0, NULL, 0, pucE, ulELength ) ||
+             mbedtls_rsa_complete( pxContext ) );
+}
+/*-----------------------------------------------------------*/
+
+static uint32_t prvRSAVerify( mbedtls_rsa_context * pxContext,
+                              const uint8_t * pucHash,
+                              uint32_t ulHashLength,
+                              const uint8_t * pucSignature,
+                              uint32_t ulSignatureLength )
+{
+    int lResult;
+
+    if( mbedtls_rsa_get_len( pxContext ) != ulSignatureLength )
+    {
+        return 1;
+    }
+
+    /* mbed TLS 3.0 dropped the RNG and mode arguments, a verify always being public. */
+    #if MBEDTLS_VERSION_NUMBER >= 0x03000000
+        lResult = mbedtls_rsa_pkcs1_verify( pxContext, MBEDTLS_MD_SHA256,
+                                            ulHashLength, pucHash, pucSignature );
+    #else
+        lResult = mbedtls_rsa_pkcs1_verify( pxContext, NULL, NULL, MBEDTLS_RSA_PUBLIC, MBEDTLS_MD_SHA256,
+                                            ulHashLength, pucHash, pucSignature );
+    #endif
 
+    if( lResult != 0 )
+    {
+        return 1;
+    }
+
+    return 0;
+}
+/*-----------------------------------------------------------*/
+
+/* The key of pucN and pucE, imported into the slot least recently used if it
+ * is not kept already. Called with xRSAMutex taken. */
+static CryptoRSAKey_t * prvRSAKeyGet( const uint8_t * pucN,
+                                      uint32_t ulNLength,
+                                      const uint8_t * pucE,
+                                      uint32_t ulELength )
+{
+    CryptoRSAKey_t * pxKey = &xRSAKeys[ 0 ];
+    uint32_t ulIndex;
+
+    for( ulIndex = 0; ulIndex < cryptoRSA_CACHED_KEY_COUNT; ulIndex++ )
+    {
+        if( ( xRSAKeys[ ulIndex ].xValid == pdTRUE ) &&
+            ( xRSAKeys[ ulIndex ].ulNLength == ulNLength ) &&
+            ( xRSAKeys[ ulIndex ].ulELength == ulELength ) &&
+            ( memcmp( xRSAKeys[ ulIndex ].ucN, pucN, ulNLength ) == 0 ) &&
+            ( memcmp( xRSAKeys[ ulIndex ].ucE, pucE, ulELength ) == 0 ) )
+        {
+            return &xRSAKeys[ ulIndex ];
+        }
+
+        if( ( xRSAKeys[ ulIndex ].xValid != pdTRUE ) ||
+            ( ( pxKey->xValid == pdTRUE ) && ( xRSAKeys[ ulIndex ].ulLastUse < pxKey->ulLastUse ) ) )
+        {
+            pxKey = &xRSAKeys[ ulIndex ];
+        }
+    }
+
+    if( pxKey->xValid == pdTRUE )
+    {
+        mbedtls_rsa_free( &pxKey->xContext );
+        pxKey->xValid = pdFALSE;
+    }
+
+    if( prvRSAImport( &pxKey->xContext, pucN, ulNLength, pucE, ulELength ) )
+    {
+        mbedtls_rsa_free( &pxKey->xContext );
+        return NULL;
+    }
+
+    memcpy( pxKey->ucN, pucN, ulNLength );
+    pxKey->ulNLength = ulNLength;
+    memcpy( pxKey->ucE, pucE, ulELength );
+    pxKey->ulELength = ulELength;
+    pxKey->xValid = pdTRUE;
+
+    return pxKey;
+}
+/*-----------------------------------------------------------*/
+
+static uint32_t prvRSAVerifyUncached( const uint8_t * pucN,
+                                      uint32_t ulNLength,
+                                      const uint8_t * pucE,
+                                      uint32_t ulELength,
+                                      const uint8_t * pucHash,
+                                      uint32_t ulHashLength,
+                                      const uint8_t * pucSignature,
+                                      uint32_t ulSignatureLength )
+{
+    uint32_t ulRet;
+    mbedtls_rsa_context xContext;
+
+    if( prvRSAImport( &xContext, pucN, ulNLength, pucE, ulELength ) )
+    {
+        ulRet = 1;
+    }
+    else
+    {
+        ulRet = prvRSAVerify( &xContext, pucHash, ulHashLength, pucSignature, ulSignatureLength );
+    }
+
+    mbedtls_rsa_free( &xContext );
+
+    return ulRet;
+}
 /*-----------------------------------------------------------*/
 
 uint32_t Crypto_Init()
 {
+    uint32_t ulRet = 0;
+
+    /* Seeding polls the entropy source, too long for a critical section,
+     * which only creates the mutex the setup then runs under. */
+    taskENTER_CRITICAL();
+
+    if( xInitMutex == NULL )
+    {
+        xInitMutex = xSemaphoreCreateMutexStatic( &xInitMutexBuffer );
+    }
+
+    taskEXIT_CRITICAL();
+
+    ( void ) xSemaphoreTake( xInitMutex, portMAX_DELAY );
+
+    if( xCryptoInitialized == pdTRUE )
+    {
+        ( void ) xSemaphoreGive( xInitMutex );
+        return 0;
+    }
+
     /* Set the mutex functions for mbed TLS thread safety. */
     mbedtls_threading_set_alt( mbedtls_platform_mutex_init,
                                mbedtls_platform_mutex_free,
                                mbedtls_platform_mutex_lock,
                                mbedtls_platform_mutex_unlock );
 
-    return 0;
+    #ifdef MBEDTLS_MEMORY_BUFFER_ALLOC_C
+        /* Without a heap, mbedTLS allocates from its arena, which needs the mutexes. */
+        mbedtls_platform_memory_init();
+    #endif /* MBEDTLS_MEMORY_BUFFER_ALLOC_C */
+
+    mbedtls_entropy_init( &xEntropyContext );
+    mbedtls_ctr_drbg_init( &xCtrDrbgContext );
+
+    /* Add a strong entropy source. At least one is required. */
+    if( mbedtls_entropy_add_source( &xEntropyContext,
+                                    mbedtls_platform_entropy_poll,
+                                    NULL,
+                                    32,
+                                    MBEDTLS_ENTROPY_SOURCE_STRONG ) ||
+        mbedtls_ctr_drbg_seed( &xCtrDrbgContext,
+                               mbedtls_entropy_func,
+                               &xEntropyContext,
+                               NULL,
+                               0 ) )
+    {
+        mbedtls_ctr_drbg_free( &xCtrDrbgContext );
+        mbedtls_entropy_free( &xEntropyContext );
+        ulRet = 1;
+    }
+    else
+    {
+        /* The DRBG reseeds itself from the entropy source once the interval is reached. */
+        mbedtls_ctr_drbg_set_reseed_interval( &xCtrDrbgContext, cryptoRNG_RESEED_INTERVAL );
+        prvHMACCacheInit();
+        xRSAMutex = xSemaphoreCreateMutexStatic( &xRSAMutexBuffer );
+        xCryptoInitialized = pdTRUE;
+    }
+
+    ( void ) xSemaphoreGive( xInitMutex );
+
+    return ulRet;
+}
+/*-----------------------------------------------------------*/
+
+int Crypto_Random( void * pvContext,
+                   unsigned char * pucOutput,
+                   size_t xOutputLength )
+{
+    ( void ) pvContext;
+
+    if( xCryptoInitialized != pdTRUE )
+    {
+        return MBEDTLS_ERR_CTR_DRBG_ENTROPY_SOURCE_FAILED;
+    }
+
+    /* mbedtls_ctr_drbg_random takes the context mutex, so concurrent callers are safe. */
+    return mbedtls_ctr_drbg_random( &xCtrDrbgContext, pucOutput, xOutputLength );
 }
 /*-----------------------------------------------------------*/
 
@@ -32,30 +331,117 @@ uint32_t Crypto_HMAC( const uint8_t * pucKey,
                       uint32_t * pulBytesCopied )
 {
     uint32_t ulRet;
-    mbedtls_md_context_t xCtx;
-    mbedtls_md_type_t xMDType = MBEDTLS_MD_SHA256;
 
     if( ulOutputLength < 32 )
     {
         return 1;
     }
 
-    mbedtls_md_init( &xCtx );
+    /* Keys too long to remember, and callers that find another task signing,
+     * do not wait for the cached context. */
+    if( ( ulKeyLength > sizeof( ucHMACKey ) ) || ( xHMACMutex == NULL ) ||
+        ( xSemaphoreTake( xHMACMutex, 0 ) != pdTRUE ) )
+    {
+        ulRet = prvHMACUncached( pucKey, ulKeyLength, pucData, ulDataLength, pucOutput );
+    }
+    else
+    {
+        if( ( xHMACKeyValid == pdTRUE ) && ( ulHMACKeyLength == ulKeyLength ) &&
+            ( memcmp( ucHMACKey, pucKey, ulKeyLength ) == 0 ) )
+        {
+            ulRet = mbedtls_md_hmac_reset( &xHMACContext ) ? 1 : 0;
+        }
+        else
+        {
+            xHMACKeyValid = pdFALSE;
+            ulRet = mbedtls_md_hmac_starts( &xHMACContext, pucKey, ulKeyLength ) ? 1 : 0;
 
-    if( mbedtls_md_setup( &xCtx, mbedtls_md_info_from_type( xMDType ), 1 ) ||
-        mbedtls_md_hmac_starts( &xCtx, pucKey, ulKeyLength ) ||
-        mbedtls_md_hmac_update( &xCtx, pucData, ulDataLength ) ||
-        mbedtls_md_hmac_finish( &xCtx, pucOutput ) )
+            if( ulRet == 0 )
+            {
+                memcpy( ucHMACKey, pucKey, ulKeyLength );
+                ulHMACKeyLength = ulKeyLength;
+                xHMACKeyValid = pdTRUE;
+            }
+        }
+
+        if( ( ulRet == 0 ) &&
+            ( mbedtls_md_hmac_update( &xHMACContext, pucData, ulDataLength ) ||
+              mbedtls_md_hmac_finish( &xHMACContext, pucOutput ) ) )
+        {
+            ulRet = 1;
+        }
+
+        /* A context left part way through is set up again by the next call. */
+        if( ulRet != 0 )
+        {
+            xHMACKeyValid = pdFALSE;
+        }
+
+        ( void ) xSemaphoreGive( xHMACMutex );
+    }
+
+    if( ulRet == 0 )
+    {
+        *pulBytesCopied = 32;
+    }
+
+    return ulRet;
+}
+/*-----------------------------------------------------------*/
+
+uint32_t Crypto_SHA256( const uint8_t * pucData,
+                        uint32_t ulDataLength,
+                        uint8_t * pucOutput,
+                        uint32_t ulOutputLength )
+{
+    if( ulOutputLength < 32 )
+    {
+        return 1;
+    }
+
+    return mbedtls_md( mbedtls_md_info_from_type( MBEDTLS_MD_SHA256 ), pucData, ulDataLength, pucOutput ) ? 1 : 0;
+}
+/*-----------------------------------------------------------*/
+
+uint32_t Crypto_RSAVerify( const uint8_t * pucN,
+                           uint32_t ulNLength,
+                           const uint8_t * pucE,
+                           uint32_t ulELength,
+                           const uint8_t * pucHash,
+                           uint32_t ulHashLength,
+                           const uint8_t * pucSignature,
+                           uint32_t ulSignatureLength )
+{
+    uint32_t ulRet;
+    CryptoRSAKey_t * pxKey;
+
+    if( ( pucN == NULL ) || ( pucE == NULL ) || ( pucHash == NULL ) || ( pucSignature == NULL ) )
+    {
+        return 1;
+    }
+
+    /* Keys too long to remember, and callers that find another task
+     * verifying, do not wait for the kept contexts. */
+    if( ( ulNLength > cryptoRSA_CACHED_KEY_SIZE ) || ( ulELength > cryptoRSA_CACHED_EXPONENT_SIZE ) ||
+        ( xRSAMutex == NULL ) || ( xSemaphoreTake( xRSAMutex, 0 ) != pdTRUE ) )
+    {
+        return prvRSAVerifyUncached( pucN, ulNLength, pucE, ulELength,
+                                     pucHash, ulHashLength, pucSignature, ulSignatureLength );
+    }
+
+    pxKey = prvRSAKeyGet( pucN, ulNLength, pucE, ulELength );
+
+    if( pxKey == NULL )
     {
         ulRet = 1;
     }
     else
     {
-        ulRet = 0;
-        *pulBytesCopied = 32;
+        pxKey->ulLastUse = ++ulRSAUseCount;
+        ulRet = prvRSAVerify( &pxKey->xContext, pucHash, ulHashLength, pucSignature, ulSignatureLength );
     }
 
-    mbedtls_md_free( &xCtx );
+    ( void ) xSemaphoreGive( xRSAMutex );
 
     return ulRet;
 }
@@ -0,0 +1,148 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+#include "azure_sample_decimal.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+static const uint32_t ulPowersOfTen[ decimalMAX_FRACTIONAL_DIGITS + 1 ] =
+{
+    1U, 10U, 100U, 1000U, 10000U, 100000U, 1000000U, 10000000U, 100000000U, 1000000000U
+};
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Write the sign, the integer part and the decimals of a value.
+ */
+static uint32_t prvWriteDecimal( bool xNegative,
+                                 uint64_t ullInteger,
+                                 uint32_t ulFraction,
+                                 uint32_t ulFractionalDigits,
+                                 uint8_t * pucBuffer,
+                                 uint32_t ulBufferSize )
+{
+    uint8_t ucIntegerDigits[ 20 ];
+    uint32_t ulIntegerDigitCount = 0;
+    uint32_t ulLength = 0;
+    uint32_t ulIndex;
+
+    do
+    {
+        ucIntegerDigits[ ulIntegerDigitCount++ ] = ( uint8_t ) ( '0' + ( ullInteger % 10U ) );
+        ullInteger /= 10U;
+    } while( ullInteger > 0 );
+
+    if( ( xNegative ? 1U : 0U ) + ulIntegerDigitCount +
+        ( ( ulFractionalDigits > 0 ) ? ( 1U + ulFractionalDigits ) : 0U ) > ulBufferSize )
+    {
+        return 0;
+    }
+
+    if( xNegative )
+    {
+        pucBuffer[ ulLength++ ] = '-';
+    }
+
+    while( ulIntegerDigitCount > 0 )
+    {
+        pucBuffer[ ulLength++ ] = ucIntegerDigits[ --ulIntegerDigitCount ];
+    }
+
+    if( ulFractionalDigits > 0 )
+    {
+        pucBuffer[ ulLength++ ] = '.';
+
+        for( ulIndex = ulFractionalDigits; ulIndex > 0; ulIndex-- )
+        {
+            pucBuffer[ ulLength + ulIndex - 1 ] = ( uint8_t ) ( '0' + ( ulFraction % 10U ) );
+            ulFraction /= 10U;
+        }
+
+        ulLength += ulFractionalDigits;
+    }
+
+    return ulLength;
+}
+/*-----------------------------------------------------------*/
+
+uint32_t Decimal_Format( double xValue,
+                         uint32_t ulFractionalDigits,
+                         uint8_t * pucBuffer,
+                         uint32_t ulBufferSize )
+{
+    uint32_t ulScale;
+    uint32_t ulFraction;
+    uint64_t ullInteger;
+    double xMagnitude;
+    double xInteger;
+    double xFraction;
+    double xScaled;
+    double xAboveHalf;
+    bool xNegative;
+
+    if( ( pucBuffer == NULL ) || ( ulFractionalDigits > decimalMAX_FRACTIONAL_DIGITS ) || isnan( xValue ) )
+    {
+        return 0;
+    }
+
+    /* printf writes the sign of a negative value that rounds to zero, and of -0. */
+    xNegative = ( signbit( xValue ) != 0 );
+    xMagnitude = fabs( xValue );
+
+    if( !( xMagnitude < decimalMAX_MAGNITUDE ) )
+    {
+        return 0;
+    }
+
+    xFraction = modf( xMagnitude, &xInteger );
+    ullInteger = ( uint64_t ) xInteger;
+    ulScale = ulPowersOfTen[ ulFractionalDigits ];
+
+    /* The product of the fraction and the scale may be rounded, so which way
+     * the decimals round is taken from the exact difference with the halfway
+     * point, which fma() gives with its sign intact. */
+    xScaled = floor( xFraction * ( double ) ulScale );
+    xAboveHalf = fma( xFraction, ( double ) ulScale, -( xScaled + 0.5 ) );
+    ulFraction = ( uint32_t ) xScaled;
+
+    if( ( xAboveHalf > 0.0 ) ||
+        ( ( xAboveHalf == 0.0 ) &&
+          ( ( ( ulFractionalDigits > 0 ) ? ( ulFraction & 1U ) : ( uint32_t ) ( ullInteger & 1U ) ) != 0 ) ) )
+    {
+        ulFraction++;
+    }
+
+    if( ulFraction >= ulScale )
+    {
+        ulFraction -= ulScale;
+        ullInteger++;
+    }
+
+    return prvWriteDecimal( xNegative, ullInteger, ulFraction, ulFractionalDigits,
+                            pucBuffer, ulBufferSize );
+}
+/*-----------------------------------------------------------*/
+
+uint32_t Decimal_FormatScaled( int64_t llValue,
+                               uint32_t ulFractionalDigits,
+                               uint8_t * pucBuffer,
+                               uint32_t ulBufferSize )
+{
+    uint64_t ullMagnitude;
+
+    if( ( pucBuffer == NULL ) || ( ulFractionalDigits > decimalMAX_FRACTIONAL_DIGITS ) )
+    {
+        return 0;
+    }
+
+    /* The magnitude of INT64_MIN does not fit an int64_t, but does a uint64_t. */
+    ullMagnitude = ( llValue < 0 ) ? ( 0U - ( uint64_t ) llValue ) : ( uint64_t ) llValue;
+
+    return prvWriteDecimal( llValue < 0,
+                            ullMagnitude / ulPowersOfTen[ ulFractionalDigits ],
+                            ( uint32_t ) ( ullMagnitude % ulPowersOfTen[ ulFractionalDigits ] ),
+                            ulFractionalDigits, pucBuffer, ulBufferSize );
+}
+/*-----------------------------------------------------------*/
@@ -0,0 +1,77 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @file azure_sample_decimal.h
+ *
+ * @brief Formats a double with a fixed number of decimals, without printf.
+ *
+ * Decimal_Format() writes what snprintf( "%.*f" ) would, using integer
+ * arithmetic on the scaled value. Calling printf with a double instead links
+ * in the float conversion of the C library (-u _printf_float with newlib
+ * nano), which is large and takes several KB of stack.
+ *
+ * The decimals are rounded to nearest, ties to even, on the exact value of
+ * the double, as the C libraries do.
+ *
+ * Decimal_FormatScaled() writes a fixed-point integer, such as a temperature
+ * in hundredths of a degree, with no floating point at all.
+ */
+
+#ifndef AZURE_SAMPLE_DECIMAL_H
+#define AZURE_SAMPLE_DECIMAL_H
+
+#include <stdint.h>
+
+/**
+ * @brief Most decimals Decimal_Format() can write.
+ */
+#define decimalMAX_FRACTIONAL_DIGITS    ( 9U )
+
+/**
+ * @brief Largest magnitude Decimal_Format() can write, 2^63.
+ */
+#define decimalMAX_MAGNITUDE            ( 9223372036854775808.0 )
+
+/**
+ * @brief Buffer size that fits any value with ulFractionalDigits decimals.
+ *
+ * A sign, 19 integer digits, the point and the decimals.
+ */
+#define decimalBUFFER_SIZE( ulFractionalDigits )    ( 21U + ( ulFractionalDigits ) )
+
+/**
+ * @brief Write a double with a fixed number of decimals, as "%.*f" would.
+ *
+ * Nothing is terminated; the text is not followed by a '\0'.
+ *
+ * @param[in] xValue The value. It must be finite, with a magnitude below
+ * #decimalMAX_MAGNITUDE.
+ * @param[in] ulFractionalDigits Decimals to write, up to #decimalMAX_FRACTIONAL_DIGITS.
+ * @param[out] pucBuffer Buffer for the text.
+ * @param[in] ulBufferSize Size of \p pucBuffer.
+ * @return Length of the text, or 0 if the value cannot be written or does not fit.
+ */
+uint32_t Decimal_Format( double xValue,
+                         uint32_t ulFractionalDigits,
+                         uint8_t * pucBuffer,
+                         uint32_t ulBufferSize );
+
+/**
+ * @brief Write a fixed-point value, llValue / 10^ulFractionalDigits, with
+ * its ulFractionalDigits decimals.
+ *
+ * Nothing is terminated; the text is not followed by a '\0'.
+ *
+ * @param[in] llValue The value, in units of the last decimal.
+ * @param[in] ulFractionalDigits Decimals of the value, up to #decimalMAX_FRACTIONAL_DIGITS.
+ * @param[out] pucBuffer Buffer for the text. decimalBUFFER_SIZE( ulFractionalDigits ) fits any value.
+ * @param[in] ulBufferSize Size of \p pucBuffer.
+ * @return Length of the text, or 0 if it does not fit.
+ */
+uint32_t Decimal_FormatScaled( int64_t llValue,
+                               uint32_t ulFractionalDigits,
+                               uint8_t * pucBuffer,
+                               uint32_t ulBufferSize );
+
+#endif /* AZURE_SAMPLE_DECIMAL_H */
@@ -0,0 +1,65 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+#include "azure_sample_deep_sleep.h"
+
+/* Kernel includes. */
+#include "FreeRTOS.h"
+#include "task.h"
+
+/* Demo Specific configs. */
+#include "demo_config.h"
+
+/* Built into the samples whether they sleep or not, so it is empty when the
+ * boards need not implement the platform functions. */
+#if ( democonfigDEEP_SLEEP == 1 )
+
+bool DeepSleep_Subscribed( bool xSessionPresent )
+{
+    DeepSleepState_t * pxState = DeepSleep_PlatformState();
+
+    if( !xSessionPresent || !DeepSleep_PlatformWoke() )
+    {
+        pxState->ulSubscribed = 0;
+        return false;
+    }
+
+    return pxState->ulSubscribed == deepsleepSUBSCRIBED_MAGIC;
+}
+/*-----------------------------------------------------------*/
+
+void DeepSleep_SetSubscribed( void )
+{
+    DeepSleep_PlatformState()->ulSubscribed = deepsleepSUBSCRIBED_MAGIC;
+}
+/*-----------------------------------------------------------*/
+
+void DeepSleep_Enter( void )
+{
+    DeepSleepState_t * pxState = DeepSleep_PlatformState();
+    uint32_t ulIntervalMs = democonfigDEEP_SLEEP_INTERVAL_S * 1000U;
+    uint32_t ulAwakeMs = ( uint32_t ) ( xTaskGetTickCount() * portTICK_PERIOD_MS );
+    uint32_t ulSleepMs = democonfigDEEP_SLEEP_MIN_MS;
+
+    /* The ticks count from the boot, so the wakes keep to the interval. */
+    if( ulAwakeMs + democonfigDEEP_SLEEP_MIN_MS < ulIntervalMs )
+    {
+        ulSleepMs = ulIntervalMs - ulAwakeMs;
+    }
+
+    pxState->ulWakes++;
+
+    LogInfo( ( "Awake for %u ms, sleeping for %u ms, wake %u.\r\n",
+               ( unsigned int ) ulAwakeMs, ( unsigned int ) ulSleepMs,
+               ( unsigned int ) pxState->ulWakes ) );
+
+    DeepSleep_PlatformEnter( ulSleepMs );
+
+    /* The board boots again when it wakes. */
+    for( ; ; )
+    {
+    }
+}
+/*-----------------------------------------------------------*/
+
+#endif /* democonfigDEEP_SLEEP == 1 */
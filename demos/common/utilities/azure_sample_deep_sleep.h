@@ -0,0 +1,123 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @file azure_sample_deep_sleep.h
+ *
+ * @brief A duty cycle of deep sleeps, for boards on batteries: wake, send a
+ * batch of telemetry and sleep again, every democonfigDEEP_SLEEP_INTERVAL_S.
+ *
+ * With democonfigDEEP_SLEEP set to 1, the samples make one pass of their
+ * telemetry loop, disconnect and call DeepSleep_Enter(), which does not
+ * return: the board powers down but for a timer and a few kilobytes of
+ * memory kept through the sleep, and boots again when the timer expires. The
+ * interval is counted from the last boot, so the time awake does not shift
+ * the next wake.
+ *
+ * A wake repeats as little of the first boot as it can. The board keeps the
+ * access point, the TLS session ticket and the DPS assignment in the memory
+ * kept through the sleep, so it joins without a scan, resumes the TLS session
+ * and does not register again, and does not wait for SNTP, as its clock runs
+ * through the sleep. The samples skip the random initial delay, and keep the
+ * MQTT session of IoT Hub: they do not unsubscribe before they disconnect,
+ * and when the hub still has the session after a wake, the SUBSCRIBEs are
+ * answered by the subscribe batch and not sent. DeepSleep_Subscribed() tells
+ * them whether the session holds the subscriptions, which it only does once
+ * they were made in it, in a connection that DeepSleep_SetSubscribed() marked.
+ *
+ * Each board keeps a #DeepSleepState_t through the sleep, and sleeps, by
+ * implementing DeepSleep_PlatformState(), DeepSleep_PlatformWoke() and
+ * DeepSleep_PlatformEnter().
+ */
+
+#ifndef AZURE_SAMPLE_DEEP_SLEEP_H
+#define AZURE_SAMPLE_DEEP_SLEEP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * @brief 1 to sleep between the batches of telemetry, set from the
+ * configuration of the board.
+ */
+#ifndef democonfigDEEP_SLEEP
+    #define democonfigDEEP_SLEEP               0
+#endif
+
+/**
+ * @brief Time from one wake to the next, in seconds.
+ */
+#ifndef democonfigDEEP_SLEEP_INTERVAL_S
+    #define democonfigDEEP_SLEEP_INTERVAL_S    ( 5U * 60U )
+#endif
+
+/**
+ * @brief Shortest sleep, in milliseconds, when a wake took longer than the interval.
+ */
+#ifndef democonfigDEEP_SLEEP_MIN_MS
+    #define democonfigDEEP_SLEEP_MIN_MS        ( 1000U )
+#endif
+
+/**
+ * @brief What the samples keep through the sleep, zero after a cold boot.
+ */
+typedef struct DeepSleepState
+{
+    uint32_t ulWakes;      /* Wakes since the last cold boot. */
+    uint32_t ulSubscribed; /* deepsleepSUBSCRIBED_MAGIC once the MQTT session holds the subscriptions. */
+} DeepSleepState_t;
+
+#define deepsleepSUBSCRIBED_MAGIC    0x53554253UL
+
+#if ( democonfigDEEP_SLEEP == 1 )
+    #define deepsleepWOKE()                          DeepSleep_PlatformWoke()
+    #define deepsleepSUBSCRIBED( xSessionPresent )    DeepSleep_Subscribed( xSessionPresent )
+    #define deepsleepSET_SUBSCRIBED()                DeepSleep_SetSubscribed()
+#else
+    #define deepsleepWOKE()                          ( false )
+    #define deepsleepSUBSCRIBED( xSessionPresent )    ( false )
+    #define deepsleepSET_SUBSCRIBED()                do {} while( 0 )
+#endif /* democonfigDEEP_SLEEP == 1 */
+
+/**
+ * @brief Whether the MQTT session IoT Hub kept holds the subscriptions of the
+ * sample, so they need not be sent again.
+ *
+ * Forgets the subscriptions when the hub did not keep the session.
+ *
+ * @param[in] xSessionPresent The session present flag of the CONNACK.
+ * @return true after a wake, with the session present, once the
+ * subscriptions were made in it.
+ */
+bool DeepSleep_Subscribed( bool xSessionPresent );
+
+/**
+ * @brief Record that the subscriptions were made in the MQTT session.
+ */
+void DeepSleep_SetSubscribed( void );
+
+/**
+ * @brief Sleep until the next wake, once the connection is closed. Does not return.
+ */
+void DeepSleep_Enter( void );
+
+/**
+ * @brief The state kept through the sleep. Implemented by each board.
+ *
+ * @return The state, zero after a cold boot.
+ */
+DeepSleepState_t * DeepSleep_PlatformState( void );
+
+/**
+ * @brief Whether the board booted from its deep sleep. Implemented by each board.
+ */
+bool DeepSleep_PlatformWoke( void );
+
+/**
+ * @brief Power down until the timer wakes the board. Implemented by each board.
+ *
+ * @param[in] ulSleepMs Time to sleep, in milliseconds.
+ */
+void DeepSleep_PlatformEnter( uint32_t ulSleepMs );
+
+#endif /* AZURE_SAMPLE_DEEP_SLEEP_H */
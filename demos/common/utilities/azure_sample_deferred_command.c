@@ -0,0 +1,207 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+#include "azure_sample_deferred_command.h"
+
+#include <stddef.h>
+#include <string.h>
+
+#include "task.h"
+
+#define deferredcommandSTATUS_TIMEOUT    504
+
+static const uint8_t ucEmptyResponse[] = "{}";
+/*-----------------------------------------------------------*/
+
+/* A request for the response, or for the handler, pointing into the slot. */
+static void prvFillRequest( const DeferredCommand_t * pxCommand,
+                            AzureIoTHubClientCommandRequest_t * pxRequest )
+{
+    memset( pxRequest, 0, sizeof( *pxRequest ) );
+    pxRequest->pucRequestID = pxCommand->ucRequestID;
+    pxRequest->usRequestIDLength = pxCommand->usRequestIDLength;
+    pxRequest->pucComponentName = pxCommand->ucComponentName;
+    pxRequest->usComponentNameLength = pxCommand->usComponentNameLength;
+    pxRequest->pucCommandName = pxCommand->ucCommandName;
+    pxRequest->usCommandNameLength = pxCommand->usCommandNameLength;
+    pxRequest->pvMessagePayload = pxCommand->ucPayload;
+    pxRequest->ulPayloadLength = pxCommand->ulPayloadLength;
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t DeferredCommands_Init( DeferredCommands_t * pxCommands )
+{
+    if( pxCommands == NULL )
+    {
+        return eAzureIoTErrorInvalidArgument;
+    }
+
+    memset( pxCommands, 0, sizeof( *pxCommands ) );
+    pxCommands->xMutex = xSemaphoreCreateMutexStatic( &pxCommands->xMutexStorage );
+    pxCommands->xWorkQueue = xQueueCreateStatic( democonfigDEFERRED_COMMAND_COUNT,
+                                                 sizeof( DeferredCommand_t * ),
+                                                 pxCommands->ucWorkQueueBuffer,
+                                                 &pxCommands->xWorkQueueStorage );
+
+    return eAzureIoTSuccess;
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t DeferredCommands_Defer( DeferredCommands_t * pxCommands,
+                                         const AzureIoTHubClientCommandRequest_t * pxMessage )
+{
+    DeferredCommand_t * pxCommand = NULL;
+    uint32_t ulIndex;
+
+    if( ( pxMessage->usRequestIDLength > deferredcommandREQUEST_ID_SIZE ) ||
+        ( pxMessage->usComponentNameLength > deferredcommandNAME_SIZE ) ||
+        ( pxMessage->usCommandNameLength > deferredcommandNAME_SIZE ) ||
+        ( pxMessage->ulPayloadLength > democonfigDEFERRED_COMMAND_PAYLOAD_SIZE ) )
+    {
+        return eAzureIoTErrorOutOfMemory;
+    }
+
+    ( void ) xSemaphoreTake( pxCommands->xMutex, portMAX_DELAY );
+
+    for( ulIndex = 0; ulIndex < democonfigDEFERRED_COMMAND_COUNT; ulIndex++ )
+    {
+        if( pxCommands->xSlots[ ulIndex ].xState == eDeferredCommandFree )
+        {
+            pxCommand = &pxCommands->xSlots[ ulIndex ];
+            pxCommand->xState = eDeferredCommandQueued;
+            pxCommand->xArrived = xTaskGetTickCount();
+            break;
+        }
+    }
+
+    ( void ) xSemaphoreGive( pxCommands->xMutex );
+
+    if( pxCommand == NULL )
+    {
+        return eAzureIoTErrorOutOfMemory;
+    }
+
+    memcpy( pxCommand->ucRequestID, pxMessage->pucRequestID, pxMessage->usRequestIDLength );
+    pxCommand->usRequestIDLength = pxMessage->usRequestIDLength;
+    memcpy( pxCommand->ucComponentName, pxMessage->pucComponentName, pxMessage->usComponentNameLength );
+    pxCommand->usComponentNameLength = pxMessage->usComponentNameLength;
+    memcpy( pxCommand->ucCommandName, pxMessage->pucCommandName, pxMessage->usCommandNameLength );
+    pxCommand->usCommandNameLength = pxMessage->usCommandNameLength;
+    memcpy( pxCommand->ucPayload, pxMessage->pvMessagePayload, pxMessage->ulPayloadLength );
+    pxCommand->ulPayloadLength = pxMessage->ulPayloadLength;
+
+    /* The queue has room for every slot, so this does not wait. */
+    ( void ) xQueueSendToBack( pxCommands->xWorkQueue, &pxCommand, 0 );
+
+    return eAzureIoTSuccess;
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t DeferredCommands_Send( DeferredCommands_t * pxCommands,
+                                        AzureIoTHubClient_t * pxHubClient )
+{
+    AzureIoTHubClientCommandRequest_t xRequest;
+    AzureIoTResult_t xResult = eAzureIoTSuccess;
+    AzureIoTResult_t xSendResult;
+    DeferredCommand_t * pxCommand;
+    DeferredCommandState_t xState;
+    BaseType_t xTimedOut;
+    uint8_t ucRequestID[ deferredcommandREQUEST_ID_SIZE ];
+    TickType_t xNow = xTaskGetTickCount();
+    uint32_t ulIndex;
+
+    for( ulIndex = 0; ulIndex < democonfigDEFERRED_COMMAND_COUNT; ulIndex++ )
+    {
+        pxCommand = &pxCommands->xSlots[ ulIndex ];
+
+        ( void ) xSemaphoreTake( pxCommands->xMutex, portMAX_DELAY );
+        xState = pxCommand->xState;
+        xTimedOut = pdFALSE;
+
+        if( ( xState == eDeferredCommandQueued ) &&
+            ( xNow - pxCommand->xArrived >= pdMS_TO_TICKS( democonfigDEFERRED_COMMAND_TIMEOUT_MS ) ) )
+        {
+            /* The worker frees the slot once its handler returns, which may be
+             * while the 504 goes out, so the request ID is copied first. */
+            pxCommand->xState = eDeferredCommandExpired;
+            xTimedOut = pdTRUE;
+            memcpy( ucRequestID, pxCommand->ucRequestID, pxCommand->usRequestIDLength );
+            memset( &xRequest, 0, sizeof( xRequest ) );
+            xRequest.pucRequestID = ucRequestID;
+            xRequest.usRequestIDLength = pxCommand->usRequestIDLength;
+        }
+
+        ( void ) xSemaphoreGive( pxCommands->xMutex );
+
+        if( xState == eDeferredCommandDone )
+        {
+            /* Only this task uses a slot that is done. */
+            prvFillRequest( pxCommand, &xRequest );
+            xSendResult = AzureIoTHubClient_SendCommandResponse( pxHubClient, &xRequest,
+                                                                 pxCommand->ulResponseStatus,
+                                                                 pxCommand->ucResponse,
+                                                                 pxCommand->ulResponseLength );
+
+            ( void ) xSemaphoreTake( pxCommands->xMutex, portMAX_DELAY );
+            pxCommand->xState = eDeferredCommandFree;
+            ( void ) xSemaphoreGive( pxCommands->xMutex );
+        }
+        else if( xTimedOut == pdTRUE )
+        {
+            xSendResult = AzureIoTHubClient_SendCommandResponse( pxHubClient, &xRequest,
+                                                                 deferredcommandSTATUS_TIMEOUT,
+                                                                 ucEmptyResponse, sizeof( ucEmptyResponse ) - 1 );
+        }
+        else
+        {
+            continue;
+        }
+
+        if( ( xSendResult != eAzureIoTSuccess ) && ( xResult == eAzureIoTSuccess ) )
+        {
+            xResult = xSendResult;
+        }
+    }
+
+    return xResult;
+}
+/*-----------------------------------------------------------*/
+
+void DeferredCommands_RunWorker( DeferredCommands_t * pxCommands,
+                                 CommandHandler_t xHandler )
+{
+    AzureIoTHubClientCommandRequest_t xRequest;
+    DeferredCommand_t * pxCommand;
+    uint32_t ulStatus;
+    uint32_t ulLength;
+
+    for( ; ; )
+    {
+        if( xQueueReceive( pxCommands->xWorkQueue, &pxCommand, portMAX_DELAY ) != pdPASS )
+        {
+            continue;
+        }
+
+        /* The network task only reads the request ID, which does not change. */
+        prvFillRequest( pxCommand, &xRequest );
+        ulStatus = 0;
+        ulLength = xHandler( &xRequest, &ulStatus, pxCommand->ucResponse, sizeof( pxCommand->ucResponse ) );
+
+        ( void ) xSemaphoreTake( pxCommands->xMutex, portMAX_DELAY );
+
+        if( pxCommand->xState == eDeferredCommandExpired )
+        {
+            /* Already answered with 504. */
+            pxCommand->xState = eDeferredCommandFree;
+        }
+        else
+        {
+            pxCommand->ulResponseStatus = ulStatus;
+            pxCommand->ulResponseLength = ulLength;
+            pxCommand->xState = eDeferredCommandDone;
+        }
+
+        ( void ) xSemaphoreGive( pxCommands->xMutex );
+    }
+}
+/*-----------------------------------------------------------*/
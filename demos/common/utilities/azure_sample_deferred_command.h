@@ -0,0 +1,141 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @file azure_sample_deferred_command.h
+ *
+ * @brief Commands answered after their callback returns, for samples that run
+ * the hub client from one task.
+ *
+ * A command callback runs in AzureIoTHubClient_ProcessLoop(), so a command
+ * that drives an actuator for seconds would hold up keep alive and telemetry
+ * if it were answered there. The callback instead copies the command into a
+ * free slot with DeferredCommands_Defer() and returns. A worker task running
+ * DeferredCommands_RunWorker() handles the command from the slot, and the
+ * task of the hub client sends the response with DeferredCommands_Send(),
+ * between process loop calls, as the client is not thread safe.
+ *
+ * A command whose handler has not finished democonfigDEFERRED_COMMAND_TIMEOUT_MS
+ * after it arrived is answered with 504, before the service gives up on it.
+ * All the slots are in the DeferredCommands_t; nothing is allocated.
+ *
+ * The multitask sample gets the same from azure_sample_hub_task.h, whose
+ * network task owns the client.
+ */
+
+#ifndef AZURE_SAMPLE_DEFERRED_COMMAND_H
+#define AZURE_SAMPLE_DEFERRED_COMMAND_H
+
+#include <stdint.h>
+
+#include "FreeRTOS.h"
+#include "queue.h"
+#include "semphr.h"
+
+#include "azure_iot_hub_client.h"
+
+#include "azure_sample_commands.h"
+
+/**
+ * @brief Commands that can be waiting for, or in, the worker.
+ */
+#ifndef democonfigDEFERRED_COMMAND_COUNT
+    #define democonfigDEFERRED_COMMAND_COUNT           2
+#endif
+
+/**
+ * @brief Largest command payload, and largest response payload.
+ */
+#ifndef democonfigDEFERRED_COMMAND_PAYLOAD_SIZE
+    #define democonfigDEFERRED_COMMAND_PAYLOAD_SIZE    128
+#endif
+
+/**
+ * @brief Time a command has to be answered in, in milliseconds. Keep it under
+ * the response timeout of the callers of the commands, 30 seconds by default.
+ */
+#ifndef democonfigDEFERRED_COMMAND_TIMEOUT_MS
+    #define democonfigDEFERRED_COMMAND_TIMEOUT_MS      25000
+#endif
+
+#define deferredcommandREQUEST_ID_SIZE    32
+#define deferredcommandNAME_SIZE          32
+
+typedef enum DeferredCommandState
+{
+    eDeferredCommandFree = 0, /* Nothing in the slot. */
+    eDeferredCommandQueued,   /* Waiting for, or in, the worker. */
+    eDeferredCommandDone,     /* Handled, the response is waiting to be sent. */
+    eDeferredCommandExpired   /* Answered with 504, the worker still has it. */
+} DeferredCommandState_t;
+
+/**
+ * @brief A command copied out of the MQTT buffer, and its response.
+ */
+typedef struct DeferredCommand
+{
+    DeferredCommandState_t xState;
+    TickType_t xArrived; /* Tick count when the command came. */
+    uint8_t ucRequestID[ deferredcommandREQUEST_ID_SIZE ];
+    uint16_t usRequestIDLength;
+    uint8_t ucComponentName[ deferredcommandNAME_SIZE ];
+    uint16_t usComponentNameLength;
+    uint8_t ucCommandName[ deferredcommandNAME_SIZE ];
+    uint16_t usCommandNameLength;
+    uint8_t ucPayload[ democonfigDEFERRED_COMMAND_PAYLOAD_SIZE ];
+    uint32_t ulPayloadLength;
+    uint32_t ulResponseStatus;
+    uint8_t ucResponse[ democonfigDEFERRED_COMMAND_PAYLOAD_SIZE ];
+    uint32_t ulResponseLength;
+} DeferredCommand_t;
+
+typedef struct DeferredCommands
+{
+    DeferredCommand_t xSlots[ democonfigDEFERRED_COMMAND_COUNT ];
+    SemaphoreHandle_t xMutex; /* Held while the state of a slot changes. */
+    StaticSemaphore_t xMutexStorage;
+    QueueHandle_t xWorkQueue; /* Slots for the worker. */
+    StaticQueue_t xWorkQueueStorage;
+    uint8_t ucWorkQueueBuffer[ democonfigDEFERRED_COMMAND_COUNT * sizeof( DeferredCommand_t * ) ];
+} DeferredCommands_t;
+
+/**
+ * @brief Initialize the slots, before the worker starts.
+ *
+ * @param[out] pxCommands The slots to initialize.
+ * @return An #AzureIoTResult_t with the result of the operation.
+ */
+AzureIoTResult_t DeferredCommands_Init( DeferredCommands_t * pxCommands );
+
+/**
+ * @brief Copy a command into a free slot for the worker. Call from the command callback.
+ *
+ * @param[in] pxCommands The slots.
+ * @param[in] pxMessage The command request.
+ * @return eAzureIoTErrorOutOfMemory if no slot is free, or the command does
+ * not fit one, in which case the callback answers it itself.
+ */
+AzureIoTResult_t DeferredCommands_Defer( DeferredCommands_t * pxCommands,
+                                         const AzureIoTHubClientCommandRequest_t * pxMessage );
+
+/**
+ * @brief Send the responses of the commands handled, and 504 for the ones
+ * past their deadline. Call from the task of the hub client only.
+ *
+ * @param[in] pxCommands The slots.
+ * @param[in] pxHubClient The hub client.
+ * @return The error of the first response that could not be sent.
+ */
+AzureIoTResult_t DeferredCommands_Send( DeferredCommands_t * pxCommands,
+                                        AzureIoTHubClient_t * pxHubClient );
+
+/**
+ * @brief Handle deferred commands forever. Call from the worker task.
+ *
+ * @param[in] pxCommands The slots.
+ * @param[in] xHandler Handles each command, with a request that points into its slot.
+ */
+void DeferredCommands_RunWorker( DeferredCommands_t * pxCommands,
+                                 CommandHandler_t xHandler );
+
+#endif /* AZURE_SAMPLE_DEFERRED_COMMAND_H */
@@ -0,0 +1,692 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+#include "azure_sample_deferred_log.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+/* FreeRTOS includes. */
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "azure_sample_task.h"
+
+/* Built into the samples whether the logs are deferred or not, so the ring
+ * takes no RAM when they are not. */
+#if ( democonfigDEFERRED_LOG == 1 )
+
+/* A log in the ring: its length, the format pointer, then the arguments in
+ * the order of the format, each as the bytes of its type. A string is its
+ * length on two bytes followed by its characters. */
+#define deferredlogHEADER_SIZE    ( sizeof( uint16_t ) + sizeof( const char * ) )
+
+/* Length modifiers of a conversion. */
+typedef enum DeferredLogLength
+{
+    eDeferredLogLengthNone = 0,
+    eDeferredLogLengthLong,
+    eDeferredLogLengthLongLong,
+    eDeferredLogLengthSize,
+    eDeferredLogLengthIntMax,
+    eDeferredLogLengthPtrDiff,
+    eDeferredLogLengthLongDouble
+} DeferredLogLength_t;
+
+/* A conversion of the format, from its '%' up to its conversion character. */
+typedef struct DeferredLogSpec
+{
+    size_t xLength;
+    size_t xPrecisionOffset;       /* Of the '.', or where it would be. */
+    int lPrecision;                /* -1 without a precision, or with '*'. */
+    bool xWidthStar;
+    bool xPrecisionStar;
+    DeferredLogLength_t eLength;
+    char cConversion;              /* 0 when the conversion is not supported. */
+} DeferredLogSpec_t;
+
+static uint8_t ucRing[ democonfigDEFERRED_LOG_BUFFER_SIZE ];
+static size_t xRingHead;
+static size_t xRingTail;
+static size_t xRingUsed;
+static uint32_t ulDropped;
+
+static DeferredLogOutput_t xLogOutput;
+static TaskHandle_t xLogTask;
+/*-----------------------------------------------------------*/
+
+/* Same parse on both sides, so the task reads back what the caller wrote. */
+static void prvParseSpec( const char * pcSpec,
+                          DeferredLogSpec_t * pxSpec )
+{
+    size_t xIndex = 1;
+
+    memset( pxSpec, 0, sizeof( *pxSpec ) );
+    pxSpec->lPrecision = -1;
+
+    while( ( pcSpec[ xIndex ] != '\0' ) && ( strchr( "-+ #0", pcSpec[ xIndex ] ) != NULL ) )
+    {
+        xIndex++;
+    }
+
+    if( pcSpec[ xIndex ] == '*' )
+    {
+        pxSpec->xWidthStar = true;
+        xIndex++;
+    }
+
+    while( ( pcSpec[ xIndex ] >= '0' ) && ( pcSpec[ xIndex ] <= '9' ) )
+    {
+        xIndex++;
+    }
+
+    pxSpec->xPrecisionOffset = xIndex;
+
+    if( pcSpec[ xIndex ] == '.' )
+    {
+        xIndex++;
+
+        if( pcSpec[ xIndex ] == '*' )
+        {
+            pxSpec->xPrecisionStar = true;
+            xIndex++;
+        }
+        else
+        {
+            pxSpec->lPrecision = 0;
+        }
+
+        while( ( pcSpec[ xIndex ] >= '0' ) && ( pcSpec[ xIndex ] <= '9' ) )
+        {
+            pxSpec->lPrecision = ( pxSpec->lPrecision * 10 ) + ( pcSpec[ xIndex ] - '0' );
+            xIndex++;
+        }
+    }
+
+    switch( pcSpec[ xIndex ] )
+    {
+        case 'h':
+            /* Promoted to int like no modifier. */
+            xIndex += ( pcSpec[ xIndex + 1 ] == 'h' ) ? 2 : 1;
+            break;
+
+        case 'l':
+
+            if( pcSpec[ xIndex + 1 ] == 'l' )
+            {
+                pxSpec->eLength = eDeferredLogLengthLongLong;
+                xIndex++;
+            }
+            else
+            {
+                pxSpec->eLength = eDeferredLogLengthLong;
+            }
+
+            xIndex++;
+            break;
+
+        case 'z':
+            pxSpec->eLength = eDeferredLogLengthSize;
+            xIndex++;
+            break;
+
+        case 'j':
+            pxSpec->eLength = eDeferredLogLengthIntMax;
+            xIndex++;
+            break;
+
+        case 't':
+            pxSpec->eLength = eDeferredLogLengthPtrDiff;
+            xIndex++;
+            break;
+
+        case 'L':
+            pxSpec->eLength = eDeferredLogLengthLongDouble;
+            xIndex++;
+            break;
+
+        default:
+            break;
+    }
+
+    if( ( pcSpec[ xIndex ] != '\0' ) && ( strchr( "diouxXcpsfFeEgGaA%", pcSpec[ xIndex ] ) != NULL ) )
+    {
+        pxSpec->cConversion = pcSpec[ xIndex ];
+    }
+
+    pxSpec->xLength = xIndex + 1;
+}
+/*-----------------------------------------------------------*/
+
+/* Bytes of the argument of a conversion other than %s. */
+static size_t prvArgumentSize( const DeferredLogSpec_t * pxSpec )
+{
+    switch( pxSpec->cConversion )
+    {
+        case 'p':
+            return sizeof( void * );
+
+        case 'f':
+        case 'F':
+        case 'e':
+        case 'E':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A':
+            return ( pxSpec->eLength == eDeferredLogLengthLongDouble ) ? sizeof( long double ) : sizeof( double );
+
+        default:
+            break;
+    }
+
+    switch( pxSpec->eLength )
+    {
+        case eDeferredLogLengthLong:
+            return sizeof( long );
+
+        case eDeferredLogLengthLongLong:
+            return sizeof( long long );
+
+        case eDeferredLogLengthSize:
+            return sizeof( size_t );
+
+        case eDeferredLogLengthIntMax:
+            return sizeof( intmax_t );
+
+        case eDeferredLogLengthPtrDiff:
+            return sizeof( ptrdiff_t );
+
+        default:
+            return sizeof( int );
+    }
+}
+/*-----------------------------------------------------------*/
+
+static void prvRingCopy( size_t xPosition,
+                         const uint8_t * pucData,
+                         size_t xLength )
+{
+    size_t xFirst = democonfigDEFERRED_LOG_BUFFER_SIZE - xPosition;
+
+    if( xFirst > xLength )
+    {
+        xFirst = xLength;
+    }
+
+    memcpy( &ucRing[ xPosition ], pucData, xFirst );
+    memcpy( ucRing, &pucData[ xFirst ], xLength - xFirst );
+}
+/*-----------------------------------------------------------*/
+
+static void prvRingRead( size_t xPosition,
+                         uint8_t * pucData,
+                         size_t xLength )
+{
+    size_t xFirst = democonfigDEFERRED_LOG_BUFFER_SIZE - xPosition;
+
+    if( xFirst > xLength )
+    {
+        xFirst = xLength;
+    }
+
+    memcpy( pucData, &ucRing[ xPosition ], xFirst );
+    memcpy( &pucData[ xFirst ], ucRing, xLength - xFirst );
+}
+/*-----------------------------------------------------------*/
+
+/* Format one conversion with its arguments, read from the record. Returns
+ * false once the record has no more arguments. */
+static bool prvFormatConversion( const char * pcSpec,
+                                 const DeferredLogSpec_t * pxSpec,
+                                 const uint8_t ** ppucArgument,
+                                 const uint8_t * pucEnd,
+                                 char * pcOutput,
+                                 size_t xRoom,
+                                 int * plWritten )
+{
+    char cFormat[ 24 ];
+    int lStars[ 2 ];
+    int lStarCount = 0;
+    size_t xSize;
+
+    if( pxSpec->xLength >= ( sizeof( cFormat ) - 2U ) )
+    {
+        return false;
+    }
+
+    /* The stars are written for all conversions, the precision of %s being
+     * replaced by the length of the string copied. */
+    if( pxSpec->xWidthStar )
+    {
+        if( ( size_t ) ( pucEnd - *ppucArgument ) < sizeof( int ) )
+        {
+            return false;
+        }
+
+        memcpy( &lStars[ lStarCount++ ], *ppucArgument, sizeof( int ) );
+        *ppucArgument += sizeof( int );
+    }
+
+    if( pxSpec->xPrecisionStar )
+    {
+        if( ( size_t ) ( pucEnd - *ppucArgument ) < sizeof( int ) )
+        {
+            return false;
+        }
+
+        memcpy( &lStars[ lStarCount ], *ppucArgument, sizeof( int ) );
+        *ppucArgument += sizeof( int );
+
+        if( pxSpec->cConversion != 's' )
+        {
+            lStarCount++;
+        }
+    }
+
+    #define deferredlogFORMAT( xValue )                                                                                \
+    ( ( lStarCount == 0 ) ? snprintf( pcOutput, xRoom, cFormat, xValue ) :                                              \
+      ( lStarCount == 1 ) ? snprintf( pcOutput, xRoom, cFormat, lStars[ 0 ], xValue ) :                                 \
+      snprintf( pcOutput, xRoom, cFormat, lStars[ 0 ], lStars[ 1 ], xValue ) )
+
+    #define deferredlogFORMAT_AS( xType )                    \
+    do {                                                     \
+        xType xValue;                                        \
+        memcpy( &xValue, *ppucArgument, sizeof( xValue ) );  \
+        *plWritten = deferredlogFORMAT( xValue );            \
+    } while( 0 )
+
+    if( pxSpec->cConversion == 's' )
+    {
+        uint16_t usLength;
+
+        if( ( size_t ) ( pucEnd - *ppucArgument ) < sizeof( usLength ) )
+        {
+            return false;
+        }
+
+        memcpy( &usLength, *ppucArgument, sizeof( usLength ) );
+        *ppucArgument += sizeof( usLength );
+
+        if( ( size_t ) ( pucEnd - *ppucArgument ) < usLength )
+        {
+            return false;
+        }
+
+        /* The flags and width, and the length copied as precision. */
+        memcpy( cFormat, pcSpec, pxSpec->xPrecisionOffset );
+        memcpy( &cFormat[ pxSpec->xPrecisionOffset ], ".*s", 4 );
+        lStars[ lStarCount++ ] = ( int ) usLength;
+        *plWritten = deferredlogFORMAT( ( const char * ) *ppucArgument );
+        *ppucArgument += usLength;
+
+        return true;
+    }
+
+    xSize = prvArgumentSize( pxSpec );
+
+    if( ( size_t ) ( pucEnd - *ppucArgument ) < xSize )
+    {
+        return false;
+    }
+
+    memcpy( cFormat, pcSpec, pxSpec->xLength );
+    cFormat[ pxSpec->xLength ] = '\0';
+
+    if( pxSpec->cConversion == 'p' )
+    {
+        deferredlogFORMAT_AS( void * );
+    }
+    else if( strchr( "fFeEgGaA", pxSpec->cConversion ) != NULL )
+    {
+        if( pxSpec->eLength == eDeferredLogLengthLongDouble )
+        {
+            deferredlogFORMAT_AS( long double );
+        }
+        else
+        {
+            deferredlogFORMAT_AS( double );
+        }
+    }
+    else
+    {
+        switch( pxSpec->eLength )
+        {
+            case eDeferredLogLengthLong:
+                deferredlogFORMAT_AS( long );
+                break;
+
+            case eDeferredLogLengthLongLong:
+                deferredlogFORMAT_AS( long long );
+                break;
+
+            case eDeferredLogLengthSize:
+                deferredlogFORMAT_AS( size_t );
+                break;
+
+            case eDeferredLogLengthIntMax:
+                deferredlogFORMAT_AS( intmax_t );
+                break;
+
+            case eDeferredLogLengthPtrDiff:
+                deferredlogFORMAT_AS( ptrdiff_t );
+                break;
+
+            default:
+                deferredlogFORMAT_AS( int );
+                break;
+        }
+    }
+
+    #undef deferredlogFORMAT_AS
+    #undef deferredlogFORMAT
+
+    *ppucArgument += xSize;
+
+    return true;
+}
+/*-----------------------------------------------------------*/
+
+/* Format a record into the line, returning the length of the line. */
+static size_t prvFormatRecord( const uint8_t * pucRecord,
+                               size_t xRecordLength,
+                               char * pcLine,
+                               size_t xLineSize )
+{
+    const char * pcFormat;
+    const uint8_t * pucArgument = &pucRecord[ deferredlogHEADER_SIZE ];
+    const uint8_t * pucEnd = &pucRecord[ xRecordLength ];
+    DeferredLogSpec_t xSpec;
+    size_t xLength = 0;
+    size_t xLiteral;
+    int lWritten;
+
+    memcpy( &pcFormat, &pucRecord[ sizeof( uint16_t ) ], sizeof( pcFormat ) );
+
+    while( ( *pcFormat != '\0' ) && ( xLength < ( xLineSize - 1U ) ) )
+    {
+        if( *pcFormat != '%' )
+        {
+            xLiteral = strcspn( pcFormat, "%" );
+
+            if( xLiteral > ( xLineSize - 1U - xLength ) )
+            {
+                xLiteral = xLineSize - 1U - xLength;
+            }
+
+            memcpy( &pcLine[ xLength ], pcFormat, xLiteral );
+            xLength += xLiteral;
+            pcFormat += xLiteral;
+            continue;
+        }
+
+        prvParseSpec( pcFormat, &xSpec );
+
+        if( xSpec.cConversion == '%' )
+        {
+            pcLine[ xLength++ ] = '%';
+        }
+        else if( ( xSpec.cConversion == 0 ) ||
+                 !prvFormatConversion( pcFormat, &xSpec, &pucArgument, pucEnd,
+                                       &pcLine[ xLength ], xLineSize - xLength, &lWritten ) )
+        {
+            /* The rest of the format cannot be read back. */
+            break;
+        }
+        else if( lWritten > 0 )
+        {
+            xLength += ( size_t ) lWritten;
+
+            if( xLength > ( xLineSize - 1U ) )
+            {
+                xLength = xLineSize - 1U;
+            }
+        }
+
+        pcFormat += xSpec.xLength;
+    }
+
+    pcLine[ xLength ] = '\0';
+
+    return xLength;
+}
+/*-----------------------------------------------------------*/
+
+static void prvDeferredLogTask( void * pvParameters )
+{
+    uint8_t ucRecord[ democonfigDEFERRED_LOG_MAX_RECORD ];
+    char cLine[ democonfigDEFERRED_LOG_LINE_LENGTH ];
+    uint16_t usRecordLength;
+    uint32_t ulDroppedWritten = 0;
+    uint32_t ulDroppedNow;
+    size_t xUsed;
+    size_t xLength;
+
+    ( void ) pvParameters;
+
+    for( ; ; )
+    {
+        taskENTER_CRITICAL();
+        {
+            xUsed = xRingUsed;
+            ulDroppedNow = ulDropped;
+        }
+        taskEXIT_CRITICAL();
+
+        if( ulDroppedNow != ulDroppedWritten )
+        {
+            xLength = ( size_t ) snprintf( cLine, sizeof( cLine ), "[%u logs dropped]\r\n",
+                                           ( unsigned int ) ( ulDroppedNow - ulDroppedWritten ) );
+            xLogOutput( cLine, ( xLength < sizeof( cLine ) ) ? xLength : sizeof( cLine ) - 1U );
+            ulDroppedWritten = ulDroppedNow;
+        }
+
+        if( xUsed == 0U )
+        {
+            ( void ) ulTaskNotifyTake( pdTRUE, portMAX_DELAY );
+            continue;
+        }
+
+        /* Only this task takes from the ring, so the record stays while it is
+         * read without the critical section. */
+        prvRingRead( xRingTail, ( uint8_t * ) &usRecordLength, sizeof( usRecordLength ) );
+        prvRingRead( xRingTail, ucRecord, usRecordLength );
+
+        taskENTER_CRITICAL();
+        {
+            xRingTail = ( xRingTail + usRecordLength ) % democonfigDEFERRED_LOG_BUFFER_SIZE;
+            xRingUsed -= usRecordLength;
+        }
+        taskEXIT_CRITICAL();
+
+        xLength = prvFormatRecord( ucRecord, usRecordLength, cLine, sizeof( cLine ) );
+
+        if( xLength > 0U )
+        {
+            xLogOutput( cLine, xLength );
+        }
+    }
+}
+/*-----------------------------------------------------------*/
+
+BaseType_t DeferredLog_Init( DeferredLogOutput_t xOutput )
+{
+    if( ( xOutput == NULL ) || ( xLogTask != NULL ) )
+    {
+        return pdFAIL;
+    }
+
+    xLogOutput = xOutput;
+
+    return sampletaskCREATE( prvDeferredLogTask, "Log", democonfigDEFERRED_LOG_TASK_STACK_SIZE,
+                             NULL, democonfigDEFERRED_LOG_TASK_PRIORITY, &xLogTask, tskNO_AFFINITY );
+}
+/*-----------------------------------------------------------*/
+
+void DeferredLog_VPrintf( const char * pcFormat,
+                          va_list xArgs )
+{
+    uint8_t ucRecord[ democonfigDEFERRED_LOG_MAX_RECORD ];
+    size_t xLength = deferredlogHEADER_SIZE;
+    const char * pcSpec = pcFormat;
+    DeferredLogSpec_t xSpec;
+    uint16_t usRecordLength;
+    bool xQueued = false;
+    va_list xArgsCopy;
+
+    va_copy( xArgsCopy, xArgs );
+
+    /* The arguments are copied as the task will read them back, stopping at
+     * the first that does not fit. */
+    while( ( pcSpec = strchr( pcSpec, '%' ) ) != NULL )
+    {
+        int lPrecision;
+        size_t xSize;
+
+        prvParseSpec( pcSpec, &xSpec );
+        pcSpec += xSpec.xLength;
+        lPrecision = xSpec.lPrecision;
+
+        if( xSpec.cConversion == '%' )
+        {
+            continue;
+        }
+
+        if( xSpec.cConversion == 0 )
+        {
+            break;
+        }
+
+        xSize = ( ( xSpec.xWidthStar ? 1U : 0U ) + ( xSpec.xPrecisionStar ? 1U : 0U ) ) * sizeof( int );
+
+        if( xSize > ( sizeof( ucRecord ) - xLength ) )
+        {
+            break;
+        }
+
+        if( xSpec.xWidthStar )
+        {
+            int lStar = va_arg( xArgsCopy, int );
+
+            memcpy( &ucRecord[ xLength ], &lStar, sizeof( lStar ) );
+            xLength += sizeof( lStar );
+        }
+
+        if( xSpec.xPrecisionStar )
+        {
+            lPrecision = va_arg( xArgsCopy, int );
+
+            memcpy( &ucRecord[ xLength ], &lPrecision, sizeof( lPrecision ) );
+            xLength += sizeof( lPrecision );
+        }
+
+        if( xSpec.cConversion == 's' )
+        {
+            const char * pcString = va_arg( xArgsCopy, const char * );
+            size_t xMaxString;
+            uint16_t usStringLength;
+
+            if( ( sizeof( ucRecord ) - xLength ) < sizeof( usStringLength ) )
+            {
+                break;
+            }
+
+            xMaxString = sizeof( ucRecord ) - xLength - sizeof( usStringLength );
+
+            /* The precision ends strings such as those of "%.*s", which need
+             * not be NUL terminated. */
+            if( ( lPrecision >= 0 ) && ( ( size_t ) lPrecision < xMaxString ) )
+            {
+                xMaxString = ( size_t ) lPrecision;
+            }
+
+            usStringLength = ( pcString == NULL ) ? 0U : ( uint16_t ) strnlen( pcString, xMaxString );
+
+            memcpy( &ucRecord[ xLength ], &usStringLength, sizeof( usStringLength ) );
+            xLength += sizeof( usStringLength );
+            memcpy( &ucRecord[ xLength ], pcString, usStringLength );
+            xLength += usStringLength;
+            continue;
+        }
+
+        xSize = prvArgumentSize( &xSpec );
+
+        if( xSize > ( sizeof( ucRecord ) - xLength ) )
+        {
+            break;
+        }
+
+        if( xSpec.cConversion == 'p' )
+        {
+            void * pvValue = va_arg( xArgsCopy, void * );
+
+            memcpy( &ucRecord[ xLength ], &pvValue, xSize );
+        }
+        else if( strchr( "fFeEgGaA", xSpec.cConversion ) != NULL )
+        {
+            if( xSpec.eLength == eDeferredLogLengthLongDouble )
+            {
+                long double xValue = va_arg( xArgsCopy, long double );
+
+                memcpy( &ucRecord[ xLength ], &xValue, xSize );
+            }
+            else
+            {
+                double xValue = va_arg( xArgsCopy, double );
+
+                memcpy( &ucRecord[ xLength ], &xValue, xSize );
+            }
+        }
+        else if( xSize == sizeof( long long ) )
+        {
+            long long xValue = va_arg( xArgsCopy, long long );
+
+            memcpy( &ucRecord[ xLength ], &xValue, xSize );
+        }
+        else
+        {
+            int lValue = va_arg( xArgsCopy, int );
+
+            memcpy( &ucRecord[ xLength ], &lValue, xSize );
+        }
+
+        xLength += xSize;
+    }
+
+    va_end( xArgsCopy );
+
+    usRecordLength = ( uint16_t ) xLength;
+    memcpy( ucRecord, &usRecordLength, sizeof( usRecordLength ) );
+    memcpy( &ucRecord[ sizeof( uint16_t ) ], &pcFormat, sizeof( pcFormat ) );
+
+    taskENTER_CRITICAL();
+    {
+        if( ( democonfigDEFERRED_LOG_BUFFER_SIZE - xRingUsed ) >= xLength )
+        {
+            prvRingCopy( xRingHead, ucRecord, xLength );
+            xRingHead = ( xRingHead + xLength ) % democonfigDEFERRED_LOG_BUFFER_SIZE;
+            xRingUsed += xLength;
+            xQueued = true;
+        }
+        else
+        {
+            ulDropped++;
+        }
+    }
+    taskEXIT_CRITICAL();
+
+    if( xQueued && ( xLogTask != NULL ) )
+    {
+        ( void ) xTaskNotifyGive( xLogTask );
+    }
+}
+/*-----------------------------------------------------------*/
+
+uint32_t DeferredLog_GetDropped( void )
+{
+    return ulDropped;
+}
+/*-----------------------------------------------------------*/
+
+#endif /* democonfigDEFERRED_LOG == 1 */
@@ -0,0 +1,111 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @file azure_sample_deferred_log.h
+ *
+ * @brief Logs formatted and written by a task of low priority.
+ *
+ * vLoggingPrintf() of a board formats each log and writes it to the UART
+ * before it returns, so a sample logging in a loop runs at the speed of the
+ * UART. With democonfigDEFERRED_LOG set to 1, by the SAMPLE_DEFERRED_LOG CMake
+ * option, vLoggingPrintf() calls DeferredLog_VPrintf() instead. It copies the
+ * format pointer and the arguments into a ring buffer and returns. A task
+ * started by DeferredLog_Init() then formats the logs and writes them out when
+ * the samples have nothing better to do. When the ring is full, logs are
+ * dropped and counted rather than waited for, and the task writes how many
+ * were dropped.
+ *
+ * The formats must stay in memory, as string literals do. The strings of %s
+ * are copied, cut to what fits in democonfigDEFERRED_LOG_MAX_RECORD. %n is not
+ * supported. Can be called from any task, and before the scheduler starts,
+ * not from an interrupt.
+ */
+
+#ifndef AZURE_SAMPLE_DEFERRED_LOG_H
+#define AZURE_SAMPLE_DEFERRED_LOG_H
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "FreeRTOS.h"
+
+/**
+ * @brief 1 to defer the logs of the board, set by the SAMPLE_DEFERRED_LOG
+ * CMake option.
+ */
+#ifndef democonfigDEFERRED_LOG
+    #define democonfigDEFERRED_LOG    0
+#endif
+
+/**
+ * @brief Bytes of the ring buffer holding the logs not yet written.
+ */
+#ifndef democonfigDEFERRED_LOG_BUFFER_SIZE
+    #define democonfigDEFERRED_LOG_BUFFER_SIZE    ( 2048U )
+#endif
+
+/**
+ * @brief Most bytes of one log in the ring, its arguments and strings.
+ *
+ * The log is put together on the stack of the caller.
+ */
+#ifndef democonfigDEFERRED_LOG_MAX_RECORD
+    #define democonfigDEFERRED_LOG_MAX_RECORD    ( 128U )
+#endif
+
+/**
+ * @brief Most characters of one log once formatted.
+ */
+#ifndef democonfigDEFERRED_LOG_LINE_LENGTH
+    #define democonfigDEFERRED_LOG_LINE_LENGTH    ( 256U )
+#endif
+
+/**
+ * @brief Priority of the task writing the logs, that of the samples.
+ */
+#ifndef democonfigDEFERRED_LOG_TASK_PRIORITY
+    #define democonfigDEFERRED_LOG_TASK_PRIORITY    ( tskIDLE_PRIORITY )
+#endif
+
+#ifndef democonfigDEFERRED_LOG_TASK_STACK_SIZE
+    #define democonfigDEFERRED_LOG_TASK_STACK_SIZE    ( configMINIMAL_STACK_SIZE * 8 )
+#endif
+
+/**
+ * @brief Writes formatted logs out, such as to the UART.
+ *
+ * @param[in] pcText The text, not NUL terminated.
+ * @param[in] xLength Its length.
+ */
+typedef void ( * DeferredLogOutput_t )( const char * pcText,
+                                        size_t xLength );
+
+/**
+ * @brief Start the task writing the logs.
+ *
+ * The logs made before are kept, and written once the task runs.
+ *
+ * @param[in] xOutput Writes the logs out.
+ * @return pdPASS, or pdFAIL if the task could not be created.
+ */
+BaseType_t DeferredLog_Init( DeferredLogOutput_t xOutput );
+
+/**
+ * @brief Queue a log.
+ *
+ * @param[in] pcFormat A printf format, which must stay in memory.
+ * @param[in] xArgs Its arguments.
+ */
+void DeferredLog_VPrintf( const char * pcFormat,
+                          va_list xArgs );
+
+/**
+ * @brief Get the number of logs dropped because the ring was full.
+ *
+ * @return The logs dropped since the start.
+ */
+uint32_t DeferredLog_GetDropped( void );
+
+#endif /* AZURE_SAMPLE_DEFERRED_LOG_H */
@@ -0,0 +1,184 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+#include "azure_sample_dhcp_lease.h"
+
+#include <stddef.h>
+
+/* FreeRTOS includes. */
+#include "task.h"
+
+/* lwIP includes. */
+#include "lwip/netif.h"
+#include "lwip/netifapi.h"
+#include "lwip/dhcp.h"
+#include "lwip/prot/dhcp.h"
+
+/* Mixed into the checksum, so that cleared storage does not pass as a lease. */
+#define dhcpleaseMAGIC    0x44484350UL
+
+#if !LWIP_NETIF_STATUS_CALLBACK
+    #error "DHCPLease_WaitBound() needs LWIP_NETIF_STATUS_CALLBACK."
+#endif
+
+/* The address requested by prvRequestLease(), in the tcpip thread. */
+static uint32_t ulLeaseAddress;
+
+/* The task in DHCPLease_WaitBound(), NULL if none. Written in the tcpip thread. */
+static TaskHandle_t xBoundWaiter;
+/*-----------------------------------------------------------*/
+
+static uint32_t prvCrc32( const uint8_t * pucData,
+                          uint32_t ulLength )
+{
+    uint32_t ulCrc = 0xFFFFFFFFU;
+    uint32_t ulBit;
+
+    while( ulLength-- > 0 )
+    {
+        ulCrc ^= *pucData++;
+
+        for( ulBit = 0; ulBit < 8; ulBit++ )
+        {
+            ulCrc = ( ulCrc >> 1 ) ^ ( 0xEDB88320U & ( 0U - ( ulCrc & 1U ) ) );
+        }
+    }
+
+    return ~ulCrc;
+}
+/*-----------------------------------------------------------*/
+
+static uint32_t prvRecordChecksum( const DHCPLeaseRecord_t * pxLeaseRecord )
+{
+    return prvCrc32( ( const uint8_t * ) pxLeaseRecord, offsetof( DHCPLeaseRecord_t, ulChecksum ) ) ^ dhcpleaseMAGIC;
+}
+/*-----------------------------------------------------------*/
+
+/* A client that was bound reboots on a network change, requesting the
+ * address it was offered. */
+static err_t prvRequestLease( struct netif * pxNetif )
+{
+    struct dhcp * pxDHCP = netif_dhcp_data( pxNetif );
+
+    if( pxDHCP == NULL )
+    {
+        return ERR_ARG;
+    }
+
+    ip4_addr_set_u32( &pxDHCP->offered_ip_addr, ulLeaseAddress );
+    pxDHCP->state = DHCP_STATE_REBOOTING;
+    dhcp_network_changed( pxNetif );
+
+    return ERR_OK;
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t DHCPLease_Start( struct netif * pxNetif )
+{
+    DHCPLeaseRecord_t xRecord;
+
+    if( pxNetif == NULL )
+    {
+        return eAzureIoTErrorInvalidArgument;
+    }
+
+    if( ( DHCPLease_PlatformRead( &xRecord ) != eAzureIoTSuccess ) ||
+        ( xRecord.ulChecksum != prvRecordChecksum( &xRecord ) ) ||
+        ( xRecord.ulAddress == 0 ) )
+    {
+        return eAzureIoTErrorFailed;
+    }
+
+    ulLeaseAddress = xRecord.ulAddress;
+
+    return ( netifapi_netif_common( pxNetif, NULL, prvRequestLease ) == ERR_OK ) ?
+           eAzureIoTSuccess : eAzureIoTErrorFailed;
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t DHCPLease_Bound( struct netif * pxNetif )
+{
+    DHCPLeaseRecord_t xStored;
+    DHCPLeaseRecord_t xRecord;
+
+    if( pxNetif == NULL )
+    {
+        return eAzureIoTErrorInvalidArgument;
+    }
+
+    xRecord.ulAddress = ip4_addr_get_u32( netif_ip4_addr( pxNetif ) );
+    xRecord.ulNetmask = ip4_addr_get_u32( netif_ip4_netmask( pxNetif ) );
+    xRecord.ulGateway = ip4_addr_get_u32( netif_ip4_gw( pxNetif ) );
+    xRecord.ulChecksum = prvRecordChecksum( &xRecord );
+
+    /* Most boots get the same lease, which is then not written again. */
+    if( ( DHCPLease_PlatformRead( &xStored ) == eAzureIoTSuccess ) &&
+        ( xStored.ulAddress == xRecord.ulAddress ) &&
+        ( xStored.ulNetmask == xRecord.ulNetmask ) &&
+        ( xStored.ulGateway == xRecord.ulGateway ) &&
+        ( xStored.ulChecksum == xRecord.ulChecksum ) )
+    {
+        return eAzureIoTSuccess;
+    }
+
+    return DHCPLease_PlatformWrite( &xRecord );
+}
+/*-----------------------------------------------------------*/
+
+/* The status callback of the interface, in the tcpip thread. */
+static void prvStatusChanged( struct netif * pxNetif )
+{
+    if( ( xBoundWaiter != NULL ) && dhcp_supplied_address( pxNetif ) )
+    {
+        xTaskNotifyGive( xBoundWaiter );
+        xBoundWaiter = NULL;
+    }
+}
+/*-----------------------------------------------------------*/
+
+static err_t prvWatchBound( struct netif * pxNetif )
+{
+    netif_set_status_callback( pxNetif, prvStatusChanged );
+
+    /* Bound already, before the callback was set. */
+    prvStatusChanged( pxNetif );
+
+    return ERR_OK;
+}
+/*-----------------------------------------------------------*/
+
+static void prvStopWatching( struct netif * pxNetif )
+{
+    ( void ) pxNetif;
+
+    xBoundWaiter = NULL;
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t DHCPLease_WaitBound( struct netif * pxNetif,
+                                      TickType_t xTicksToWait )
+{
+    if( pxNetif == NULL )
+    {
+        return eAzureIoTErrorInvalidArgument;
+    }
+
+    /* Set before the callback can run, and read there only. */
+    ( void ) ulTaskNotifyTake( pdTRUE, 0 );
+    xBoundWaiter = xTaskGetCurrentTaskHandle();
+
+    if( netifapi_netif_common( pxNetif, NULL, prvWatchBound ) != ERR_OK )
+    {
+        xBoundWaiter = NULL;
+        return eAzureIoTErrorFailed;
+    }
+
+    if( ulTaskNotifyTake( pdTRUE, xTicksToWait ) == 0 )
+    {
+        ( void ) netifapi_netif_common( pxNetif, prvStopWatching, NULL );
+        return eAzureIoTErrorFailed;
+    }
+
+    return DHCPLease_Bound( pxNetif );
+}
+/*-----------------------------------------------------------*/
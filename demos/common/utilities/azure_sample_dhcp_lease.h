@@ -0,0 +1,96 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @file azure_sample_dhcp_lease.h
+ *
+ * @brief The last DHCP lease of an lwIP board, asked for again at boot.
+ *
+ * Started the usual way, DHCP discovers a server, waits for its offer and
+ * probes the offered address with ARP before requesting it, which takes
+ * seconds. With the address of the last lease, DHCPLease_Start() instead
+ * moves the client into INIT-REBOOT, requesting that address at once. The
+ * server acknowledges it without an offer or an ARP probe, as the address was
+ * already theirs, or refuses it and the client discovers again. Without an
+ * answer, lwIP discovers after two requests.
+ *
+ * The expiry of the lease is not kept, as the boards have no time at boot to
+ * check it against, and the server knows better anyway. Once bound,
+ * DHCPLease_Bound() stores the address, which is only written when it
+ * changed. DHCPLease_WaitBound() waits for the address without polling, from
+ * the status callback of the interface, and stores it.
+ *
+ * Each board provides storage for one record, by implementing
+ * DHCPLease_PlatformRead() and DHCPLease_PlatformWrite(), kept across resets
+ * such as in backup RAM.
+ */
+
+#ifndef AZURE_SAMPLE_DHCP_LEASE_H
+#define AZURE_SAMPLE_DHCP_LEASE_H
+
+#include <stdint.h>
+
+#include "FreeRTOS.h"
+
+#include "azure_iot_result.h"
+
+struct netif;
+
+typedef struct DHCPLeaseRecord
+{
+    uint32_t ulAddress; /* In network order, as lwIP keeps them. */
+    uint32_t ulNetmask;
+    uint32_t ulGateway;
+    uint32_t ulChecksum; /* CRC32 of everything before it. */
+} DHCPLeaseRecord_t;
+
+/**
+ * @brief Request the address of the last lease. Call right after dhcp_start().
+ *
+ * @param[in] pxNetif The interface DHCP was started on.
+ * @return eAzureIoTErrorFailed if there is no lease, DHCP then going on as started.
+ */
+AzureIoTResult_t DHCPLease_Start( struct netif * pxNetif );
+
+/**
+ * @brief Store the lease of the interface, once DHCP is bound.
+ *
+ * @param[in] pxNetif The interface.
+ * @return An #AzureIoTResult_t with the result of the operation.
+ */
+AzureIoTResult_t DHCPLease_Bound( struct netif * pxNetif );
+
+/**
+ * @brief Wait for DHCP to bind, then store the lease as DHCPLease_Bound() does.
+ *
+ * The interface notifies the calling task from its status callback the moment
+ * it has an address, which the module takes over. Needs
+ * LWIP_NETIF_STATUS_CALLBACK.
+ *
+ * @param[in] pxNetif The interface DHCP was started on.
+ * @param[in] xTicksToWait Longest to wait for the address.
+ * @return eAzureIoTErrorFailed if DHCP did not bind in time.
+ */
+AzureIoTResult_t DHCPLease_WaitBound( struct netif * pxNetif,
+                                      TickType_t xTicksToWait );
+
+/**
+ * @brief Read the stored record. Implemented by each board.
+ *
+ * Storage that was never written may return anything, as the record is
+ * checked before it is used.
+ *
+ * @param[out] pxRecord The record.
+ * @return An #AzureIoTResult_t with the result of the operation.
+ */
+AzureIoTResult_t DHCPLease_PlatformRead( DHCPLeaseRecord_t * pxRecord );
+
+/**
+ * @brief Replace the stored record. Implemented by each board.
+ *
+ * @param[in] pxRecord The record.
+ * @return An #AzureIoTResult_t with the result of the operation.
+ */
+AzureIoTResult_t DHCPLease_PlatformWrite( const DHCPLeaseRecord_t * pxRecord );
+
+#endif /* AZURE_SAMPLE_DHCP_LEASE_H */
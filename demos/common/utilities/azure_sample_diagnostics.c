@@ -0,0 +1,160 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+#include "azure_sample_diagnostics.h"
+
+#include <stddef.h>
+#include <string.h>
+
+/* Built into the samples whether they report diagnostics or not, so it is
+ * empty when the kernel cannot list its tasks. */
+#if ( configUSE_TRACE_FACILITY == 1 )
+
+/* The kernel only defines it in tasks.c. */
+#ifndef configIDLE_TASK_NAME
+    #define configIDLE_TASK_NAME    "IDLE"
+#endif
+/*-----------------------------------------------------------*/
+
+static uint32_t prvCopyName( const char * pcTaskName,
+                             char * pcName )
+{
+    uint32_t ulLength = 0;
+
+    while( ( ulLength < configMAX_TASK_NAME_LEN ) && ( pcTaskName[ ulLength ] != '\0' ) )
+    {
+        pcName[ ulLength ] = pcTaskName[ ulLength ];
+        ulLength++;
+    }
+
+    return ulLength;
+}
+/*-----------------------------------------------------------*/
+
+#if ( configGENERATE_RUN_TIME_STATS == 1 )
+
+/* Run time of a task since the sample before. A task that was not there
+ * then started since, so all of its run time counts. */
+    static uint32_t prvRunTimeSince( const Diagnostics_t * pxDiagnostics,
+                                     const TaskStatus_t * pxStatus )
+    {
+        UBaseType_t uxIndex;
+
+        for( uxIndex = 0; uxIndex < pxDiagnostics->uxPreviousCount; uxIndex++ )
+        {
+            if( pxDiagnostics->pxPrevious[ uxIndex ].uxTaskNumber == pxStatus->xTaskNumber )
+            {
+                /* Unsigned, so it holds across a wrap of the counter. */
+                return pxStatus->ulRunTimeCounter - pxDiagnostics->pxPrevious[ uxIndex ].ulRunTime;
+            }
+        }
+
+        return pxStatus->ulRunTimeCounter;
+    }
+/*-----------------------------------------------------------*/
+
+    static int32_t prvPercent( uint32_t ulRunTime,
+                               uint32_t ulTotalRunTime )
+    {
+        return ( int32_t ) ( ( ( uint64_t ) ulRunTime * 100U ) / ulTotalRunTime );
+    }
+/*-----------------------------------------------------------*/
+#endif /* configGENERATE_RUN_TIME_STATS == 1 */
+
+static void prvSampleFreeBlocks( DiagnosticsSnapshot_t * pxSnapshot )
+{
+    HeapStats_t xHeapStats;
+
+    vPortGetHeapStats( &xHeapStats );
+    pxSnapshot->ulLargestFreeBlock = ( uint32_t ) xHeapStats.xSizeOfLargestFreeBlockInBytes;
+    pxSnapshot->ulFreeBlocks = ( uint32_t ) xHeapStats.xNumberOfFreeBlocks;
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t Diagnostics_Sample( Diagnostics_t * pxDiagnostics,
+                                     DiagnosticsSnapshot_t * pxSnapshot )
+{
+    UBaseType_t uxCount;
+    UBaseType_t uxIndex;
+    uint32_t ulTotalRunTime = 0;
+    uint32_t ulStackFree;
+    const TaskStatus_t * pxStatus;
+
+    #if ( configGENERATE_RUN_TIME_STATS == 1 )
+        uint32_t ulRunTime;
+        uint32_t ulBusiestRunTime = 0;
+        uint32_t ulElapsed;
+    #endif
+
+    if( ( pxDiagnostics == NULL ) || ( pxSnapshot == NULL ) )
+    {
+        return eAzureIoTErrorInvalidArgument;
+    }
+
+    uxCount = uxTaskGetSystemState( pxDiagnostics->pxStatus, pxDiagnostics->uxMaxTasks, &ulTotalRunTime );
+
+    if( uxCount == 0 )
+    {
+        return eAzureIoTErrorOutOfMemory;
+    }
+
+    ( void ) memset( pxSnapshot, 0, sizeof( *pxSnapshot ) );
+    pxSnapshot->ulFreeHeap = ( uint32_t ) xPortGetFreeHeapSize();
+    pxSnapshot->ulMinimumEverFreeHeap = ( uint32_t ) xPortGetMinimumEverFreeHeapSize();
+    prvSampleFreeBlocks( pxSnapshot );
+    pxSnapshot->ulTaskCount = ( uint32_t ) uxCount;
+    pxSnapshot->ulMinimumStackFree = UINT32_MAX;
+    pxSnapshot->lIdleCpu = diagnosticsCPU_UNKNOWN;
+    pxSnapshot->lBusiestCpu = diagnosticsCPU_UNKNOWN;
+
+    #if ( configGENERATE_RUN_TIME_STATS == 1 )
+        ulElapsed = ulTotalRunTime - pxDiagnostics->ulPreviousTotalRunTime;
+    #endif
+
+    for( uxIndex = 0; uxIndex < uxCount; uxIndex++ )
+    {
+        pxStatus = &pxDiagnostics->pxStatus[ uxIndex ];
+        ulStackFree = ( uint32_t ) pxStatus->usStackHighWaterMark * sizeof( StackType_t );
+
+        if( ulStackFree < pxSnapshot->ulMinimumStackFree )
+        {
+            pxSnapshot->ulMinimumStackFree = ulStackFree;
+            pxSnapshot->ulMinimumStackTaskLength = prvCopyName( pxStatus->pcTaskName, pxSnapshot->cMinimumStackTask );
+        }
+
+        #if ( configGENERATE_RUN_TIME_STATS == 1 )
+            if( ( pxDiagnostics->uxPreviousCount == 0 ) || ( ulElapsed == 0 ) )
+            {
+                continue;
+            }
+
+            ulRunTime = prvRunTimeSince( pxDiagnostics, pxStatus );
+
+            if( strncmp( pxStatus->pcTaskName, configIDLE_TASK_NAME, configMAX_TASK_NAME_LEN ) == 0 )
+            {
+                pxSnapshot->lIdleCpu = prvPercent( ulRunTime, ulElapsed );
+            }
+            else if( ( pxSnapshot->lBusiestCpu == diagnosticsCPU_UNKNOWN ) || ( ulRunTime > ulBusiestRunTime ) )
+            {
+                ulBusiestRunTime = ulRunTime;
+                pxSnapshot->lBusiestCpu = prvPercent( ulRunTime, ulElapsed );
+                pxSnapshot->ulBusiestTaskLength = prvCopyName( pxStatus->pcTaskName, pxSnapshot->cBusiestTask );
+            }
+        #endif /* configGENERATE_RUN_TIME_STATS == 1 */
+    }
+
+    /* Kept apart, as the next sample fills the status array again. */
+    for( uxIndex = 0; uxIndex < uxCount; uxIndex++ )
+    {
+        pxDiagnostics->pxPrevious[ uxIndex ].uxTaskNumber = pxDiagnostics->pxStatus[ uxIndex ].xTaskNumber;
+        pxDiagnostics->pxPrevious[ uxIndex ].ulRunTime = ( uint32_t ) pxDiagnostics->pxStatus[ uxIndex ].ulRunTimeCounter;
+    }
+
+    pxDiagnostics->uxPreviousCount = uxCount;
+    pxDiagnostics->ulPreviousTotalRunTime = ulTotalRunTime;
+
+    return eAzureIoTSuccess;
+}
+/*-----------------------------------------------------------*/
+
+#endif /* configUSE_TRACE_FACILITY == 1 */
@@ -0,0 +1,124 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @file azure_sample_diagnostics.h
+ *
+ * @brief Heap, stack and CPU figures of the device, for reporting to the cloud.
+ *
+ * Diagnostics_Sample() lists the tasks with uxTaskGetSystemState() and writes
+ * a snapshot with the free heap, its low-water mark, its largest free block
+ * and the task with the least stack left, so a leak, a heap cut into blocks
+ * too small for a TLS record or a task about to overflow shows in the twin
+ * before it takes the device down.
+ *
+ * When the board measures run time (configGENERATE_RUN_TIME_STATS, set by the
+ * BOARD_RUNTIME_STATS CMake option), the snapshot also has the share of the
+ * CPU the idle task had and the busiest task, both since the sample before.
+ *
+ * It needs configUSE_TRACE_FACILITY, and the heap figures need heap_4 or
+ * heap_5. A Diagnostics_t is not thread safe; it is used by one task.
+ */
+
+#ifndef AZURE_SAMPLE_DIAGNOSTICS_H
+#define AZURE_SAMPLE_DIAGNOSTICS_H
+
+#include <stdint.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "azure_iot_result.h"
+
+/**
+ * @brief Time between two diagnostics reports, in seconds.
+ *
+ * 0 disables the diagnostics, which is the default when the kernel cannot
+ * list its tasks.
+ */
+#ifndef democonfigDIAGNOSTICS_INTERVAL_SECS
+    #if ( configUSE_TRACE_FACILITY == 1 )
+        #define democonfigDIAGNOSTICS_INTERVAL_SECS    ( 60U )
+    #else
+        #define democonfigDIAGNOSTICS_INTERVAL_SECS    0
+    #endif
+#endif
+
+#if ( democonfigDIAGNOSTICS_INTERVAL_SECS > 0 ) && ( configUSE_TRACE_FACILITY != 1 )
+    #error "The diagnostics list the tasks with uxTaskGetSystemState(), set configUSE_TRACE_FACILITY to 1."
+#endif
+
+/**
+ * @brief Most tasks a sample can list.
+ */
+#ifndef democonfigDIAGNOSTICS_MAX_TASKS
+    #define democonfigDIAGNOSTICS_MAX_TASKS    ( 16U )
+#endif
+
+/**
+ * @brief Share of the CPU when it is not known, before the second sample or
+ * without run-time stats.
+ */
+#define diagnosticsCPU_UNKNOWN    ( -1 )
+
+/**
+ * @brief Initializer of a #Diagnostics_t with the arrays pxStatus and
+ * pxPrevious, which have the same length.
+ */
+#define diagnosticsINIT( pxStatus, pxPrevious ) \
+    { ( pxStatus ), ( pxPrevious ), sizeof( pxStatus ) / sizeof( ( pxStatus )[ 0 ] ), 0, 0 }
+
+/**
+ * @brief Run time of a task at the sample before.
+ */
+typedef struct DiagnosticsTask
+{
+    UBaseType_t uxTaskNumber;
+    uint32_t ulRunTime;
+} DiagnosticsTask_t;
+
+typedef struct Diagnostics
+{
+    TaskStatus_t * pxStatus;         /* Filled by uxTaskGetSystemState(). */
+    DiagnosticsTask_t * pxPrevious;  /* Run times at the sample before. */
+    UBaseType_t uxMaxTasks;          /* Length of both arrays. */
+    UBaseType_t uxPreviousCount;     /* 0 before the first sample. */
+    uint32_t ulPreviousTotalRunTime;
+} Diagnostics_t;
+
+/**
+ * @brief Figures of one sample.
+ *
+ * The names are copied, so a snapshot stays valid after the task is deleted.
+ */
+typedef struct DiagnosticsSnapshot
+{
+    uint32_t ulFreeHeap;
+    uint32_t ulMinimumEverFreeHeap;
+    uint32_t ulLargestFreeBlock;
+    uint32_t ulFreeBlocks;                  /* More of them for the same free heap is a heap cut up. */
+    uint32_t ulTaskCount;
+    uint32_t ulMinimumStackFree;            /* In bytes, over all the tasks. */
+    char cMinimumStackTask[ configMAX_TASK_NAME_LEN ];
+    uint32_t ulMinimumStackTaskLength;
+    int32_t lIdleCpu;                       /* Percent, or #diagnosticsCPU_UNKNOWN. */
+    int32_t lBusiestCpu;                    /* Percent, or #diagnosticsCPU_UNKNOWN. */
+    char cBusiestTask[ configMAX_TASK_NAME_LEN ];
+    uint32_t ulBusiestTaskLength;
+} DiagnosticsSnapshot_t;
+
+/**
+ * @brief Take a sample of the heap, the stacks and the run times.
+ *
+ * The shares of the CPU are over the time since the sample before, so they
+ * are #diagnosticsCPU_UNKNOWN the first time. The idle task is not counted
+ * as the busiest.
+ *
+ * @param[in] pxDiagnostics The diagnostics.
+ * @param[out] pxSnapshot The figures.
+ * @return eAzureIoTErrorOutOfMemory if there are more tasks than the arrays hold.
+ */
+AzureIoTResult_t Diagnostics_Sample( Diagnostics_t * pxDiagnostics,
+                                     DiagnosticsSnapshot_t * pxSnapshot );
+
+#endif /* AZURE_SAMPLE_DIAGNOSTICS_H */
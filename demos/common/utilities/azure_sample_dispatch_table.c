@@ -0,0 +1,228 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+#include "azure_sample_dispatch_table.h"
+
+#include <stddef.h>
+#include <string.h>
+
+#define dispatchtableFNV_OFFSET_BASIS    0x811C9DC5UL
+#define dispatchtableFNV_PRIME           0x01000193UL
+
+/* A slot holds the index of its entry plus one, so that 0 is free, and
+ * this bit when it stands for the component of the entry. */
+#define dispatchtableCOMPONENT_SLOT      0x80U
+
+/* Ends the component part of a key, differently for a component alone. */
+#define dispatchtableNAME_SEPARATOR      0x00U
+#define dispatchtableCOMPONENT_END       0x01U
+/*-----------------------------------------------------------*/
+
+static uint32_t prvHashBytes( uint32_t ulHash,
+                              const uint8_t * pucData,
+                              uint32_t ulLength )
+{
+    while( ulLength-- > 0 )
+    {
+        ulHash = ( ulHash ^ *pucData++ ) * dispatchtableFNV_PRIME;
+    }
+
+    return ulHash;
+}
+/*-----------------------------------------------------------*/
+
+static uint32_t prvHashKey( const uint8_t * pucComponentName,
+                            uint32_t ulComponentNameLength,
+                            const uint8_t * pucName,
+                            uint32_t ulNameLength )
+{
+    uint8_t ucEnd = ( pucName == NULL ) ? dispatchtableCOMPONENT_END : dispatchtableNAME_SEPARATOR;
+    uint32_t ulHash = dispatchtableFNV_OFFSET_BASIS;
+
+    if( pucComponentName != NULL )
+    {
+        ulHash = prvHashBytes( ulHash, pucComponentName, ulComponentNameLength );
+    }
+
+    ulHash = prvHashBytes( ulHash, &ucEnd, 1 );
+
+    if( pucName != NULL )
+    {
+        ulHash = prvHashBytes( ulHash, pucName, ulNameLength );
+    }
+
+    return ulHash;
+}
+/*-----------------------------------------------------------*/
+
+static bool prvTextEqual( const uint8_t * pucLeft,
+                          uint32_t ulLeftLength,
+                          const uint8_t * pucRight,
+                          uint32_t ulRightLength )
+{
+    /* NULL and empty both stand for the root component. */
+    if( ( pucLeft == NULL ) || ( pucRight == NULL ) )
+    {
+        return ( ( pucLeft == NULL ) || ( ulLeftLength == 0 ) ) &&
+               ( ( pucRight == NULL ) || ( ulRightLength == 0 ) );
+    }
+
+    return ( ulLeftLength == ulRightLength ) && ( memcmp( pucLeft, pucRight, ulLeftLength ) == 0 );
+}
+/*-----------------------------------------------------------*/
+
+static const DispatchName_t * prvEntryName( const DispatchTable_t * pxTable,
+                                            uint32_t ulIndex )
+{
+    return ( const DispatchName_t * ) ( pxTable->pucEntries + ( ulIndex * pxTable->ulEntrySize ) );
+}
+/*-----------------------------------------------------------*/
+
+static bool prvSlotMatches( const DispatchTable_t * pxTable,
+                            uint8_t ucSlot,
+                            const uint8_t * pucComponentName,
+                            uint32_t ulComponentNameLength,
+                            const uint8_t * pucName,
+                            uint32_t ulNameLength )
+{
+    const DispatchName_t * pxName = prvEntryName( pxTable, ( ucSlot & ~dispatchtableCOMPONENT_SLOT ) - 1U );
+
+    if( ( ( ucSlot & dispatchtableCOMPONENT_SLOT ) != 0 ) != ( pucName == NULL ) )
+    {
+        return false;
+    }
+
+    return prvTextEqual( pxName->pucComponentName, pxName->ulComponentNameLength,
+                         pucComponentName, ulComponentNameLength ) &&
+           ( ( pucName == NULL ) ||
+             prvTextEqual( pxName->pucName, pxName->ulNameLength, pucName, ulNameLength ) );
+}
+/*-----------------------------------------------------------*/
+
+/* Linear probing from the slot of the hash, stopping at the first free slot. */
+static uint32_t prvProbe( const DispatchTable_t * pxTable,
+                          const uint8_t * pucComponentName,
+                          uint32_t ulComponentNameLength,
+                          const uint8_t * pucName,
+                          uint32_t ulNameLength )
+{
+    uint32_t ulSlot = prvHashKey( pucComponentName, ulComponentNameLength, pucName, ulNameLength ) %
+                      pxTable->ulSlotCount;
+
+    while( ( pxTable->pucSlots[ ulSlot ] != 0 ) &&
+           !prvSlotMatches( pxTable, pxTable->pucSlots[ ulSlot ],
+                            pucComponentName, ulComponentNameLength, pucName, ulNameLength ) )
+    {
+        ulSlot = ( ulSlot + 1U ) % pxTable->ulSlotCount;
+    }
+
+    return ulSlot;
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t DispatchTable_Index( DispatchTable_t * pxTable )
+{
+    uint32_t ulIndex;
+    uint32_t ulSlot;
+    uint32_t ulKeys = 0;
+    const DispatchName_t * pxName;
+
+    if( ( pxTable == NULL ) || ( ( pxTable->pucEntries == NULL ) && ( pxTable->ulEntryCount > 0 ) ) ||
+        ( pxTable->pucSlots == NULL ) || ( pxTable->ulEntrySize < sizeof( DispatchName_t ) ) )
+    {
+        return eAzureIoTErrorInvalidArgument;
+    }
+
+    if( pxTable->xIndexed )
+    {
+        return eAzureIoTSuccess;
+    }
+
+    if( ( pxTable->ulEntryCount > dispatchtableMAX_ENTRIES ) ||
+        ( pxTable->ulSlotCount < dispatchtableSLOT_COUNT( pxTable->ulEntryCount ) ) )
+    {
+        return eAzureIoTErrorOutOfMemory;
+    }
+
+    memset( pxTable->pucSlots, 0, pxTable->ulSlotCount );
+
+    for( ulIndex = 0; ulIndex < pxTable->ulEntryCount; ulIndex++ )
+    {
+        pxName = prvEntryName( pxTable, ulIndex );
+
+        ulSlot = prvProbe( pxTable, pxName->pucComponentName, pxName->ulComponentNameLength,
+                           pxName->pucName, pxName->ulNameLength );
+
+        /* A name given twice keeps its first handler, as a linear search would. */
+        if( pxTable->pucSlots[ ulSlot ] == 0 )
+        {
+            pxTable->pucSlots[ ulSlot ] = ( uint8_t ) ( ulIndex + 1U );
+            ulKeys++;
+        }
+
+        if( ( pxName->pucComponentName != NULL ) && ( pxName->ulComponentNameLength > 0 ) )
+        {
+            ulSlot = prvProbe( pxTable, pxName->pucComponentName, pxName->ulComponentNameLength, NULL, 0 );
+
+            if( pxTable->pucSlots[ ulSlot ] == 0 )
+            {
+                pxTable->pucSlots[ ulSlot ] = ( uint8_t ) ( ( ulIndex + 1U ) | dispatchtableCOMPONENT_SLOT );
+                ulKeys++;
+            }
+        }
+    }
+
+    /* Always true with dispatchtableSLOT_COUNT() slots, so the probes end. */
+    if( ulKeys >= pxTable->ulSlotCount )
+    {
+        return eAzureIoTErrorOutOfMemory;
+    }
+
+    pxTable->xIndexed = true;
+
+    return eAzureIoTSuccess;
+}
+/*-----------------------------------------------------------*/
+
+const void * DispatchTable_Find( DispatchTable_t * pxTable,
+                                 const uint8_t * pucComponentName,
+                                 uint32_t ulComponentNameLength,
+                                 const uint8_t * pucName,
+                                 uint32_t ulNameLength )
+{
+    uint8_t ucSlot;
+
+    if( ( pucName == NULL ) || ( DispatchTable_Index( pxTable ) != eAzureIoTSuccess ) )
+    {
+        return NULL;
+    }
+
+    if( ulComponentNameLength == 0 )
+    {
+        pucComponentName = NULL;
+    }
+
+    ucSlot = pxTable->pucSlots[ prvProbe( pxTable, pucComponentName, ulComponentNameLength,
+                                          pucName, ulNameLength ) ];
+
+    return ( ucSlot == 0 ) ? NULL : prvEntryName( pxTable, ucSlot - 1U );
+}
+/*-----------------------------------------------------------*/
+
+const void * DispatchTable_FindComponent( DispatchTable_t * pxTable,
+                                          const uint8_t * pucComponentName,
+                                          uint32_t ulComponentNameLength )
+{
+    uint8_t ucSlot;
+
+    if( ( pucComponentName == NULL ) || ( ulComponentNameLength == 0 ) ||
+        ( DispatchTable_Index( pxTable ) != eAzureIoTSuccess ) )
+    {
+        return NULL;
+    }
+
+    ucSlot = pxTable->pucSlots[ prvProbe( pxTable, pucComponentName, ulComponentNameLength, NULL, 0 ) ];
+
+    return ( ucSlot == 0 ) ? NULL : prvEntryName( pxTable, ( ucSlot & ~dispatchtableCOMPONENT_SLOT ) - 1U );
+}
+/*-----------------------------------------------------------*/
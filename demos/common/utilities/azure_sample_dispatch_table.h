@@ -0,0 +1,111 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @file azure_sample_dispatch_table.h
+ *
+ * @brief Looks up the handler of a property or command by name, in one probe.
+ *
+ * A sample declares its handlers in a constant table, each entry starting
+ * with a DispatchName_t. The first lookup hashes every name of the table
+ * (FNV-1a over the component and the name) into a small open addressed index
+ * at most half full, and later lookups hash the incoming name and usually
+ * compare it with a single entry, however many handlers there are.
+ *
+ * The index is kept in slots the sample provides, one byte each, sized with
+ * dispatchtableSLOT_COUNT(). A table is not thread safe; it is only used by
+ * the task running the process loop.
+ */
+
+#ifndef AZURE_SAMPLE_DISPATCH_TABLE_H
+#define AZURE_SAMPLE_DISPATCH_TABLE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "azure_iot_result.h"
+
+/**
+ * @brief Slots needed for a table of ulEntryCount entries.
+ *
+ * Each entry may add its component as well as its name, and the index is
+ * kept at most half full so that few lookups probe more than one slot.
+ */
+#define dispatchtableSLOT_COUNT( ulEntryCount )    ( 4U * ( ulEntryCount ) + 1U )
+
+/**
+ * @brief Most entries a table may have.
+ */
+#define dispatchtableMAX_ENTRIES                   ( 127U )
+
+/**
+ * @brief Initializer of a #DispatchTable_t for the arrays pxEntries and pucSlots.
+ */
+#define dispatchtableINIT( pxEntries, pucSlots )                            \
+    {                                                                       \
+        ( const uint8_t * ) ( pxEntries ), sizeof( ( pxEntries )[ 0 ] ),    \
+        sizeof( pxEntries ) / sizeof( ( pxEntries )[ 0 ] ),                 \
+        ( pucSlots ), sizeof( pucSlots ), false                             \
+    }
+
+/**
+ * @brief Name of a handler. The first member of each entry of a table.
+ */
+typedef struct DispatchName
+{
+    const uint8_t * pucComponentName; /* NULL for the root component. */
+    uint32_t ulComponentNameLength;
+    const uint8_t * pucName;
+    uint32_t ulNameLength;
+} DispatchName_t;
+
+typedef struct DispatchTable
+{
+    const uint8_t * pucEntries;
+    uint32_t ulEntrySize;
+    uint32_t ulEntryCount;
+    uint8_t * pucSlots;
+    uint32_t ulSlotCount;
+    bool xIndexed;
+} DispatchTable_t;
+
+/**
+ * @brief Build the index of a table, if it was not yet.
+ *
+ * Lookups do this themselves; call it at start up to find a table that is
+ * too large for its slots before the first message arrives.
+ *
+ * @param[in] pxTable The table.
+ * @return eAzureIoTErrorOutOfMemory if the slots cannot index all the entries.
+ */
+AzureIoTResult_t DispatchTable_Index( DispatchTable_t * pxTable );
+
+/**
+ * @brief Find the entry of a name.
+ *
+ * @param[in] pxTable The table.
+ * @param[in] pucComponentName The component, or NULL for the root component.
+ * @param[in] ulComponentNameLength Length of \p pucComponentName.
+ * @param[in] pucName The property or command name.
+ * @param[in] ulNameLength Length of \p pucName.
+ * @return The entry, or NULL if there is none or the table cannot be indexed.
+ */
+const void * DispatchTable_Find( DispatchTable_t * pxTable,
+                                 const uint8_t * pucComponentName,
+                                 uint32_t ulComponentNameLength,
+                                 const uint8_t * pucName,
+                                 uint32_t ulNameLength );
+
+/**
+ * @brief Find the first entry of a component.
+ *
+ * @param[in] pxTable The table.
+ * @param[in] pucComponentName The component.
+ * @param[in] ulComponentNameLength Length of \p pucComponentName.
+ * @return The entry, or NULL if no handler is for that component.
+ */
+const void * DispatchTable_FindComponent( DispatchTable_t * pxTable,
+                                          const uint8_t * pucComponentName,
+                                          uint32_t ulComponentNameLength );
+
+#endif /* AZURE_SAMPLE_DISPATCH_TABLE_H */
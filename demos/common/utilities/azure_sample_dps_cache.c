@@ -0,0 +1,269 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+#include "azure_sample_dps_cache.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+/* Changed with the layout of the record, so an older one is not read. */
+#define dpscacheMAGIC    0x44505344UL
+
+/* Only used by one task at a time, the one connecting to IoT Hub. */
+static DPSCacheRecord_t xRecord;
+/*-----------------------------------------------------------*/
+
+static uint32_t prvCrc32( const uint8_t * pucData,
+                          uint32_t ulLength )
+{
+    uint32_t ulCrc = 0xFFFFFFFFU;
+    uint32_t ulBit;
+
+    while( ulLength-- > 0 )
+    {
+        ulCrc ^= *pucData++;
+
+        for( ulBit = 0; ulBit < 8; ulBit++ )
+        {
+            ulCrc = ( ulCrc >> 1 ) ^ ( 0xEDB88320U & ( 0U - ( ulCrc & 1U ) ) );
+        }
+    }
+
+    return ~ulCrc;
+}
+/*-----------------------------------------------------------*/
+
+static uint32_t prvRecordChecksum( const DPSCacheRecord_t * pxCacheRecord )
+{
+    return prvCrc32( ( const uint8_t * ) pxCacheRecord, offsetof( DPSCacheRecord_t, ulChecksum ) );
+}
+/*-----------------------------------------------------------*/
+
+/* Reads the stored record into xRecord, which is valid when it belongs to
+ * the registration ID, whatever its age. */
+static AzureIoTResult_t prvReadRecord( const uint8_t * pucRegistrationID,
+                                       uint32_t ulRegistrationIDLength )
+{
+    AzureIoTResult_t xResult;
+
+    if( ( xResult = DPSCache_PlatformRead( &xRecord ) ) != eAzureIoTSuccess )
+    {
+        return xResult;
+    }
+
+    /* The lengths are checked as well, so that a record that happens to
+     * match its checksum is still never copied past its buffers. */
+    if( ( xRecord.ulMagic != dpscacheMAGIC ) ||
+        ( xRecord.ulRegistrationIDLength > sizeof( xRecord.ucRegistrationID ) ) ||
+        ( xRecord.ulHostnameLength > sizeof( xRecord.ucHostname ) ) ||
+        ( xRecord.ulDeviceIDLength > sizeof( xRecord.ucDeviceID ) ) ||
+        ( xRecord.ulSecondaryHostnameLength > sizeof( xRecord.ucSecondaryHostname ) ) ||
+        ( xRecord.ulSecondaryDeviceIDLength > sizeof( xRecord.ucSecondaryDeviceID ) ) ||
+        ( xRecord.ulChecksum != prvRecordChecksum( &xRecord ) ) )
+    {
+        return eAzureIoTErrorFailed;
+    }
+
+    if( ( xRecord.ulRegistrationIDLength != ulRegistrationIDLength ) ||
+        ( memcmp( xRecord.ucRegistrationID, pucRegistrationID, ulRegistrationIDLength ) != 0 ) )
+    {
+        return eAzureIoTErrorFailed;
+    }
+
+    return eAzureIoTSuccess;
+}
+/*-----------------------------------------------------------*/
+
+/* Copies an assignment of the record read by prvReadRecord() out, unless
+ * the record is too old. */
+static AzureIoTResult_t prvCopyAssignment( uint64_t ullNow,
+                                           const uint8_t * pucRecordHostname,
+                                           uint32_t ulRecordHostnameLength,
+                                           const uint8_t * pucRecordDeviceID,
+                                           uint32_t ulRecordDeviceIDLength,
+                                           uint8_t * pucHostname,
+                                           uint32_t * pulHostnameLength,
+                                           uint8_t * pucDeviceID,
+                                           uint32_t * pulDeviceIDLength )
+{
+    /* A record from the future is as stale as an old one, as either the
+     * clock or the record is wrong. */
+    if( ( ullNow < xRecord.ullSavedTime ) ||
+        ( ( ullNow - xRecord.ullSavedTime ) > democonfigDPS_CACHE_MAX_AGE_SECONDS ) )
+    {
+        return eAzureIoTErrorFailed;
+    }
+
+    /* Room is left for the terminators, as the hostname is also used as a string. */
+    if( ( ulRecordHostnameLength >= *pulHostnameLength ) ||
+        ( ulRecordDeviceIDLength >= *pulDeviceIDLength ) )
+    {
+        return eAzureIoTErrorOutOfMemory;
+    }
+
+    memcpy( pucHostname, pucRecordHostname, ulRecordHostnameLength );
+    pucHostname[ ulRecordHostnameLength ] = '\0';
+    *pulHostnameLength = ulRecordHostnameLength;
+    memcpy( pucDeviceID, pucRecordDeviceID, ulRecordDeviceIDLength );
+    pucDeviceID[ ulRecordDeviceIDLength ] = '\0';
+    *pulDeviceIDLength = ulRecordDeviceIDLength;
+
+    return eAzureIoTSuccess;
+}
+/*-----------------------------------------------------------*/
+
+/* Sets a field of the record, clearing the rest of it so the unused end is
+ * part of a stable checksum. */
+static void prvSetField( uint8_t * pucField,
+                         uint32_t ulFieldSize,
+                         uint32_t * pulFieldLength,
+                         const uint8_t * pucValue,
+                         uint32_t ulValueLength )
+{
+    memmove( pucField, pucValue, ulValueLength );
+    memset( pucField + ulValueLength, 0, ulFieldSize - ulValueLength );
+    *pulFieldLength = ulValueLength;
+}
+/*-----------------------------------------------------------*/
+
+static bool prvSameHostname( const uint8_t * pucHostname,
+                             uint32_t ulHostnameLength,
+                             const uint8_t * pucOtherHostname,
+                             uint32_t ulOtherHostnameLength )
+{
+    return ( ulHostnameLength == ulOtherHostnameLength ) &&
+           ( memcmp( pucHostname, pucOtherHostname, ulHostnameLength ) == 0 );
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t DPSCache_Load( uint64_t ullNow,
+                                const uint8_t * pucRegistrationID,
+                                uint32_t ulRegistrationIDLength,
+                                uint8_t * pucHostname,
+                                uint32_t * pulHostnameLength,
+                                uint8_t * pucDeviceID,
+                                uint32_t * pulDeviceIDLength )
+{
+    AzureIoTResult_t xResult;
+
+    if( ( pucRegistrationID == NULL ) || ( pucHostname == NULL ) || ( pulHostnameLength == NULL ) ||
+        ( pucDeviceID == NULL ) || ( pulDeviceIDLength == NULL ) )
+    {
+        return eAzureIoTErrorInvalidArgument;
+    }
+
+    if( ( xResult = prvReadRecord( pucRegistrationID, ulRegistrationIDLength ) ) != eAzureIoTSuccess )
+    {
+        return xResult;
+    }
+
+    return prvCopyAssignment( ullNow,
+                              xRecord.ucHostname, xRecord.ulHostnameLength,
+                              xRecord.ucDeviceID, xRecord.ulDeviceIDLength,
+                              pucHostname, pulHostnameLength,
+                              pucDeviceID, pulDeviceIDLength );
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t DPSCache_LoadSecondary( uint64_t ullNow,
+                                         const uint8_t * pucRegistrationID,
+                                         uint32_t ulRegistrationIDLength,
+                                         uint8_t * pucHostname,
+                                         uint32_t * pulHostnameLength,
+                                         uint8_t * pucDeviceID,
+                                         uint32_t * pulDeviceIDLength )
+{
+    AzureIoTResult_t xResult;
+
+    if( ( pucRegistrationID == NULL ) || ( pucHostname == NULL ) || ( pulHostnameLength == NULL ) ||
+        ( pucDeviceID == NULL ) || ( pulDeviceIDLength == NULL ) )
+    {
+        return eAzureIoTErrorInvalidArgument;
+    }
+
+    if( ( xResult = prvReadRecord( pucRegistrationID, ulRegistrationIDLength ) ) != eAzureIoTSuccess )
+    {
+        return xResult;
+    }
+
+    if( xRecord.ulSecondaryHostnameLength == 0 )
+    {
+        return eAzureIoTErrorFailed;
+    }
+
+    return prvCopyAssignment( ullNow,
+                              xRecord.ucSecondaryHostname, xRecord.ulSecondaryHostnameLength,
+                              xRecord.ucSecondaryDeviceID, xRecord.ulSecondaryDeviceIDLength,
+                              pucHostname, pulHostnameLength,
+                              pucDeviceID, pulDeviceIDLength );
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t DPSCache_Save( uint64_t ullNow,
+                                const uint8_t * pucRegistrationID,
+                                uint32_t ulRegistrationIDLength,
+                                const uint8_t * pucHostname,
+                                uint32_t ulHostnameLength,
+                                const uint8_t * pucDeviceID,
+                                uint32_t ulDeviceIDLength )
+{
+    if( ( pucRegistrationID == NULL ) || ( pucHostname == NULL ) || ( pucDeviceID == NULL ) )
+    {
+        return eAzureIoTErrorInvalidArgument;
+    }
+
+    if( ( ulRegistrationIDLength > sizeof( xRecord.ucRegistrationID ) ) ||
+        ( ulHostnameLength > sizeof( xRecord.ucHostname ) ) ||
+        ( ulDeviceIDLength > sizeof( xRecord.ucDeviceID ) ) )
+    {
+        return eAzureIoTErrorOutOfMemory;
+    }
+
+    /* The record kept gives the secondary assignment, which is the hub
+     * replaced when it is another one. */
+    if( prvReadRecord( pucRegistrationID, ulRegistrationIDLength ) != eAzureIoTSuccess )
+    {
+        memset( &xRecord, 0, sizeof( xRecord ) );
+    }
+    else if( !prvSameHostname( xRecord.ucHostname, xRecord.ulHostnameLength,
+                               pucHostname, ulHostnameLength ) )
+    {
+        prvSetField( xRecord.ucSecondaryHostname, sizeof( xRecord.ucSecondaryHostname ),
+                     &xRecord.ulSecondaryHostnameLength,
+                     xRecord.ucHostname, xRecord.ulHostnameLength );
+        prvSetField( xRecord.ucSecondaryDeviceID, sizeof( xRecord.ucSecondaryDeviceID ),
+                     &xRecord.ulSecondaryDeviceIDLength,
+                     xRecord.ucDeviceID, xRecord.ulDeviceIDLength );
+    }
+    else if( prvSameHostname( xRecord.ucSecondaryHostname, xRecord.ulSecondaryHostnameLength,
+                              pucHostname, ulHostnameLength ) )
+    {
+        prvSetField( xRecord.ucSecondaryHostname, sizeof( xRecord.ucSecondaryHostname ),
+                     &xRecord.ulSecondaryHostnameLength, ( const uint8_t * ) "", 0 );
+        prvSetField( xRecord.ucSecondaryDeviceID, sizeof( xRecord.ucSecondaryDeviceID ),
+                     &xRecord.ulSecondaryDeviceIDLength, ( const uint8_t * ) "", 0 );
+    }
+
+    xRecord.ulMagic = dpscacheMAGIC;
+    xRecord.ullSavedTime = ullNow;
+    prvSetField( xRecord.ucRegistrationID, sizeof( xRecord.ucRegistrationID ),
+                 &xRecord.ulRegistrationIDLength, pucRegistrationID, ulRegistrationIDLength );
+    prvSetField( xRecord.ucHostname, sizeof( xRecord.ucHostname ),
+                 &xRecord.ulHostnameLength, pucHostname, ulHostnameLength );
+    prvSetField( xRecord.ucDeviceID, sizeof( xRecord.ucDeviceID ),
+                 &xRecord.ulDeviceIDLength, pucDeviceID, ulDeviceIDLength );
+    xRecord.ulReserved = 0;
+    xRecord.ulChecksum = prvRecordChecksum( &xRecord );
+
+    return DPSCache_PlatformWrite( &xRecord );
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t DPSCache_Clear( void )
+{
+    memset( &xRecord, 0, sizeof( xRecord ) );
+
+    return DPSCache_PlatformWrite( &xRecord );
+}
+/*-----------------------------------------------------------*/
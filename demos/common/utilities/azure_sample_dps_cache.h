@@ -0,0 +1,153 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @file azure_sample_dps_cache.h
+ *
+ * @brief The IoT Hub assignment from the provisioning service, kept across reboots.
+ *
+ * DPSCache_Save() stores the assigned hub and device ID in one record, along
+ * with the registration ID it was assigned to, the time it was saved and a
+ * CRC32 of all of it. DPSCache_Load() only returns a record whose checksum
+ * matches, that belongs to the same registration ID and that is younger than
+ * democonfigDPS_CACHE_MAX_AGE_SECONDS, so a device still registers again
+ * from time to time and after its registration ID changes.
+ *
+ * When a registration assigns another hub than the cached one, as the
+ * allocation policy of a service linked to several hubs may, the one it
+ * replaces is kept in the record as the secondary assignment.
+ * DPSCache_LoadSecondary() returns it, so that a device that cannot reach
+ * its hub can fail over to the other without registering again, and saving
+ * it swaps the two.
+ *
+ * Each board provides the storage, one record in size, by implementing
+ * DPSCache_PlatformRead() and DPSCache_PlatformWrite().
+ */
+
+#ifndef AZURE_SAMPLE_DPS_CACHE_H
+#define AZURE_SAMPLE_DPS_CACHE_H
+
+#include <stdint.h>
+
+#include "azure_iot_result.h"
+
+/**
+ * @brief Largest hostname, device ID and registration ID that can be cached.
+ */
+#ifndef democonfigDPS_CACHE_ID_SIZE
+    #define democonfigDPS_CACHE_ID_SIZE            128
+#endif
+
+/**
+ * @brief Age after which a cached assignment is no longer used, in seconds.
+ */
+#ifndef democonfigDPS_CACHE_MAX_AGE_SECONDS
+    #define democonfigDPS_CACHE_MAX_AGE_SECONDS    ( 7UL * 24UL * 60UL * 60UL )
+#endif
+
+typedef struct DPSCacheRecord
+{
+    uint32_t ulMagic;
+    uint32_t ulRegistrationIDLength;
+    uint32_t ulHostnameLength;
+    uint32_t ulDeviceIDLength;
+    uint32_t ulSecondaryHostnameLength; /* 0 without a secondary assignment. */
+    uint32_t ulSecondaryDeviceIDLength;
+    uint64_t ullSavedTime;
+    uint8_t ucRegistrationID[ democonfigDPS_CACHE_ID_SIZE ];
+    uint8_t ucHostname[ democonfigDPS_CACHE_ID_SIZE ];
+    uint8_t ucDeviceID[ democonfigDPS_CACHE_ID_SIZE ];
+    uint8_t ucSecondaryHostname[ democonfigDPS_CACHE_ID_SIZE ];
+    uint8_t ucSecondaryDeviceID[ democonfigDPS_CACHE_ID_SIZE ];
+    uint32_t ulChecksum; /* CRC32 of everything before it. */
+    uint32_t ulReserved; /* Keeps the size a multiple of 8 for double word programming. */
+} DPSCacheRecord_t;
+
+/**
+ * @brief Read the cached assignment.
+ *
+ * @param[in] ullNow Current unix time, in seconds.
+ * @param[in] pucRegistrationID The registration ID of the device.
+ * @param[in] ulRegistrationIDLength Length of \p pucRegistrationID.
+ * @param[out] pucHostname Buffer for the IoT Hub hostname.
+ * @param[in,out] pulHostnameLength Size of \p pucHostname, then the hostname length.
+ * @param[out] pucDeviceID Buffer for the device ID.
+ * @param[in,out] pulDeviceIDLength Size of \p pucDeviceID, then the device ID length.
+ * @return eAzureIoTErrorFailed if there is no valid assignment for this registration ID.
+ *
+ * Both are null terminated, after the returned length.
+ */
+AzureIoTResult_t DPSCache_Load( uint64_t ullNow,
+                                const uint8_t * pucRegistrationID,
+                                uint32_t ulRegistrationIDLength,
+                                uint8_t * pucHostname,
+                                uint32_t * pulHostnameLength,
+                                uint8_t * pucDeviceID,
+                                uint32_t * pulDeviceIDLength );
+
+/**
+ * @brief Read the secondary assignment, the hub the cached one replaced.
+ *
+ * Same as DPSCache_Load(), for the secondary assignment of the record.
+ *
+ * @return eAzureIoTErrorFailed if there is no valid secondary assignment for this registration ID.
+ */
+AzureIoTResult_t DPSCache_LoadSecondary( uint64_t ullNow,
+                                         const uint8_t * pucRegistrationID,
+                                         uint32_t ulRegistrationIDLength,
+                                         uint8_t * pucHostname,
+                                         uint32_t * pulHostnameLength,
+                                         uint8_t * pucDeviceID,
+                                         uint32_t * pulDeviceIDLength );
+
+/**
+ * @brief Store an assignment, replacing the cached one.
+ *
+ * A cached assignment to another hub, of the same registration ID, becomes
+ * the secondary one. Otherwise the secondary assignment is kept, unless it
+ * is the hub being saved.
+ *
+ * @param[in] ullNow Current unix time, in seconds.
+ * @param[in] pucRegistrationID The registration ID of the device.
+ * @param[in] ulRegistrationIDLength Length of \p pucRegistrationID.
+ * @param[in] pucHostname The assigned IoT Hub hostname.
+ * @param[in] ulHostnameLength Length of \p pucHostname.
+ * @param[in] pucDeviceID The assigned device ID.
+ * @param[in] ulDeviceIDLength Length of \p pucDeviceID.
+ * @return An #AzureIoTResult_t with the result of the operation.
+ */
+AzureIoTResult_t DPSCache_Save( uint64_t ullNow,
+                                const uint8_t * pucRegistrationID,
+                                uint32_t ulRegistrationIDLength,
+                                const uint8_t * pucHostname,
+                                uint32_t ulHostnameLength,
+                                const uint8_t * pucDeviceID,
+                                uint32_t ulDeviceIDLength );
+
+/**
+ * @brief Invalidate the cached assignment, for example once the hub refused it.
+ *
+ * @return An #AzureIoTResult_t with the result of the operation.
+ */
+AzureIoTResult_t DPSCache_Clear( void );
+
+/**
+ * @brief Read the stored record. Implemented by each board.
+ *
+ * Storage that was never written may return anything, as the record is
+ * checked before it is used.
+ *
+ * @param[out] pxRecord The record.
+ * @return An #AzureIoTResult_t with the result of the operation.
+ */
+AzureIoTResult_t DPSCache_PlatformRead( DPSCacheRecord_t * pxRecord );
+
+/**
+ * @brief Replace the stored record. Implemented by each board.
+ *
+ * @param[in] pxRecord The record.
+ * @return An #AzureIoTResult_t with the result of the operation.
+ */
+AzureIoTResult_t DPSCache_PlatformWrite( const DPSCacheRecord_t * pxRecord );
+
+#endif /* AZURE_SAMPLE_DPS_CACHE_H */
@@ -0,0 +1,159 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+#include "azure_sample_entropy_pool.h"
+
+#include <string.h>
+
+/* FreeRTOS includes. */
+#include "FreeRTOS.h"
+#include "task.h"
+#include "semphr.h"
+
+#include "azure_sample_task.h"
+/*-----------------------------------------------------------*/
+
+/* Bytes are added at the end and taken from the end. */
+static uint8_t ucPool[ democonfigENTROPY_POOL_SIZE ];
+static size_t xPoolLength;
+static EntropyPoolSource_t xPoolSource;
+static TaskHandle_t xPoolTask;
+
+/* Drivers of the RNG are not reentrant, so the task and the callers reading
+ * it themselves take turns. */
+static StaticSemaphore_t xSourceMutexBuffer;
+static SemaphoreHandle_t xSourceMutex;
+/*-----------------------------------------------------------*/
+
+static int prvReadSource( uint8_t * pucBuffer,
+                          size_t xLength )
+{
+    int lResult;
+
+    ( void ) xSemaphoreTake( xSourceMutex, portMAX_DELAY );
+    lResult = xPoolSource( pucBuffer, xLength );
+    ( void ) xSemaphoreGive( xSourceMutex );
+
+    return lResult;
+}
+/*-----------------------------------------------------------*/
+
+static void prvEntropyPoolTask( void * pvParameters )
+{
+    uint8_t ucChunk[ entropypoolCHUNK_SIZE ];
+    size_t xRoom;
+
+    ( void ) pvParameters;
+
+    for( ; ; )
+    {
+        taskENTER_CRITICAL();
+        {
+            xRoom = democonfigENTROPY_POOL_SIZE - xPoolLength;
+        }
+        taskEXIT_CRITICAL();
+
+        if( xRoom == 0U )
+        {
+            ( void ) ulTaskNotifyTake( pdTRUE, portMAX_DELAY );
+            continue;
+        }
+
+        if( xRoom > entropypoolCHUNK_SIZE )
+        {
+            xRoom = entropypoolCHUNK_SIZE;
+        }
+
+        /* The RNG is read without holding the pool. */
+        if( prvReadSource( ucChunk, xRoom ) != 0 )
+        {
+            /* Try again when bytes are taken, the callers reading the RNG themselves until then. */
+            ( void ) ulTaskNotifyTake( pdTRUE, portMAX_DELAY );
+            continue;
+        }
+
+        taskENTER_CRITICAL();
+        {
+            /* Only this task adds, so the room is still there. */
+            memcpy( &ucPool[ xPoolLength ], ucChunk, xRoom );
+            xPoolLength += xRoom;
+        }
+        taskEXIT_CRITICAL();
+
+        memset( ucChunk, 0, sizeof( ucChunk ) );
+    }
+}
+/*-----------------------------------------------------------*/
+
+BaseType_t EntropyPool_Init( EntropyPoolSource_t xSource )
+{
+    if( ( xSource == NULL ) || ( xPoolTask != NULL ) )
+    {
+        return pdFAIL;
+    }
+
+    xPoolSource = xSource;
+    xSourceMutex = xSemaphoreCreateMutexStatic( &xSourceMutexBuffer );
+
+    return sampletaskCREATE( prvEntropyPoolTask, "Entropy", democonfigENTROPY_POOL_TASK_STACK_SIZE,
+                             NULL, democonfigENTROPY_POOL_TASK_PRIORITY, &xPoolTask, tskNO_AFFINITY );
+}
+/*-----------------------------------------------------------*/
+
+size_t EntropyPool_Take( uint8_t * pucBuffer,
+                         size_t xLength )
+{
+    size_t xTaken;
+    size_t xLeft;
+
+    taskENTER_CRITICAL();
+    {
+        xTaken = ( xLength < xPoolLength ) ? xLength : xPoolLength;
+        xPoolLength -= xTaken;
+        memcpy( pucBuffer, &ucPool[ xPoolLength ], xTaken );
+        memset( &ucPool[ xPoolLength ], 0, xTaken );
+        xLeft = xPoolLength;
+    }
+    taskEXIT_CRITICAL();
+
+    if( ( xPoolTask != NULL ) && ( xLeft < democonfigENTROPY_POOL_LOW_WATER ) )
+    {
+        ( void ) xTaskNotifyGive( xPoolTask );
+    }
+
+    return xTaken;
+}
+/*-----------------------------------------------------------*/
+
+int EntropyPool_Poll( void * pvData,
+                      unsigned char * pucOutput,
+                      size_t xLength,
+                      size_t * pxOutputLength )
+{
+    size_t xTaken;
+    int lResult = 0;
+
+    ( void ) pvData;
+
+    *pxOutputLength = 0;
+
+    if( xSourceMutex == NULL )
+    {
+        return -1;
+    }
+
+    xTaken = EntropyPool_Take( pucOutput, xLength );
+
+    if( xTaken < xLength )
+    {
+        lResult = prvReadSource( pucOutput + xTaken, xLength - xTaken );
+    }
+
+    if( lResult == 0 )
+    {
+        *pxOutputLength = xLength;
+    }
+
+    return lResult;
+}
+/*-----------------------------------------------------------*/
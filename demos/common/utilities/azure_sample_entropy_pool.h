@@ -0,0 +1,107 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @file azure_sample_entropy_pool.h
+ *
+ * @brief Random bytes from the hardware RNG, read ahead of the TLS handshake.
+ *
+ * Reading the RNG of a board waits for each word to be ready, and a handshake
+ * asks for a few hundred bytes at once. EntropyPool_Init() starts a task of
+ * low priority that reads the RNG of the board into a pool while the device
+ * has nothing better to do, such as during DHCP. EntropyPool_Take() and
+ * EntropyPool_Poll() then copy from the pool without waiting, and wake the
+ * task to top it up once it runs low. Only what the pool cannot give is read
+ * from the RNG while the caller waits, so it is never short of bytes.
+ *
+ * The bytes are handed out once, and wiped from the pool. The functions can
+ * be called from any task, not from an interrupt.
+ */
+
+#ifndef AZURE_SAMPLE_ENTROPY_POOL_H
+#define AZURE_SAMPLE_ENTROPY_POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "FreeRTOS.h"
+
+/**
+ * @brief Bytes the pool holds, a handshake or two.
+ */
+#ifndef democonfigENTROPY_POOL_SIZE
+    #define democonfigENTROPY_POOL_SIZE    ( 512U )
+#endif
+
+/**
+ * @brief Bytes left in the pool under which the task tops it up.
+ */
+#ifndef democonfigENTROPY_POOL_LOW_WATER
+    #define democonfigENTROPY_POOL_LOW_WATER    ( democonfigENTROPY_POOL_SIZE / 2U )
+#endif
+
+/**
+ * @brief Priority of the task filling the pool, under the tasks of the samples.
+ */
+#ifndef democonfigENTROPY_POOL_TASK_PRIORITY
+    #define democonfigENTROPY_POOL_TASK_PRIORITY    ( tskIDLE_PRIORITY + 1 )
+#endif
+
+#ifndef democonfigENTROPY_POOL_TASK_STACK_SIZE
+    #define democonfigENTROPY_POOL_TASK_STACK_SIZE    ( configMINIMAL_STACK_SIZE * 2 )
+#endif
+
+/**
+ * @brief Bytes the task reads from the RNG at a time.
+ */
+#define entropypoolCHUNK_SIZE    ( 32U )
+
+/**
+ * @brief Reads the RNG of the board, waiting for it.
+ *
+ * @param[out] pucBuffer Where to write the bytes.
+ * @param[in] xLength How many bytes, all of which are written on success.
+ * @return 0 on success.
+ */
+typedef int ( * EntropyPoolSource_t )( uint8_t * pucBuffer,
+                                       size_t xLength );
+
+/**
+ * @brief Start the task filling the pool.
+ *
+ * Call it once the RNG is initialized, from a task or before the scheduler
+ * starts.
+ *
+ * @param[in] xSource Reads the RNG of the board.
+ * @return pdPASS, or pdFAIL if the task could not be created, in which case
+ * EntropyPool_Poll() reads the RNG each time.
+ */
+BaseType_t EntropyPool_Init( EntropyPoolSource_t xSource );
+
+/**
+ * @brief Copy bytes from the pool, without waiting.
+ *
+ * @param[out] pucBuffer Where to write the bytes.
+ * @param[in] xLength Most bytes to copy.
+ * @return The bytes copied, fewer than \p xLength when the pool runs short.
+ */
+size_t EntropyPool_Take( uint8_t * pucBuffer,
+                         size_t xLength );
+
+/**
+ * @brief Get bytes from the pool, reading the rest from the RNG.
+ *
+ * Has the signature of mbedtls_platform_entropy_poll().
+ *
+ * @param[in] pvData Not used.
+ * @param[out] pucOutput Where to write the bytes.
+ * @param[in] xLength How many bytes.
+ * @param[out] pxOutputLength \p xLength on success, else 0.
+ * @return 0 on success, else what the source returned.
+ */
+int EntropyPool_Poll( void * pvData,
+                      unsigned char * pucOutput,
+                      size_t xLength,
+                      size_t * pxOutputLength );
+
+#endif /* AZURE_SAMPLE_ENTROPY_POOL_H */
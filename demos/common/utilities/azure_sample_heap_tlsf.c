@@ -0,0 +1,574 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/*
+ * A FreeRTOS heap with a two level segregated fit allocator, see
+ * azure_sample_heap_tlsf.h. Built in place of portable/MemMang/heap_x.c.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Defining MPU_WRAPPERS_INCLUDED_FROM_API_FILE prevents task.h from redefining
+ * all the API functions to use the MPU wrappers. */
+#define MPU_WRAPPERS_INCLUDED_FROM_API_FILE
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#undef MPU_WRAPPERS_INCLUDED_FROM_API_FILE
+
+#include "azure_sample_heap_tlsf.h"
+
+#if ( configSUPPORT_DYNAMIC_ALLOCATION == 0 )
+    #error This file must not be used if configSUPPORT_DYNAMIC_ALLOCATION is 0
+#endif
+
+/* The sizes are multiples of the alignment, which leaves their low bits for
+ * the flags of the block. */
+#if ( portBYTE_ALIGNMENT == 16 )
+    #define heaptlsfALIGNMENT_LOG2    4
+#elif ( portBYTE_ALIGNMENT == 8 )
+    #define heaptlsfALIGNMENT_LOG2    3
+#elif ( portBYTE_ALIGNMENT == 4 )
+    #define heaptlsfALIGNMENT_LOG2    2
+#else
+    #error The TLSF heap needs a portBYTE_ALIGNMENT of 4, 8 or 16
+#endif
+
+/* Each power of two of sizes is split into 2^heaptlsfSL_INDEX_COUNT_LOG2
+ * lists. Below heaptlsfSMALL_BLOCK_SIZE, the lists are one alignment apart. */
+#define heaptlsfSL_INDEX_COUNT_LOG2    4
+#define heaptlsfSL_INDEX_COUNT         ( 1U << heaptlsfSL_INDEX_COUNT_LOG2 )
+#define heaptlsfFL_INDEX_SHIFT         ( heaptlsfSL_INDEX_COUNT_LOG2 + heaptlsfALIGNMENT_LOG2 )
+#define heaptlsfFL_INDEX_COUNT         ( democonfigHEAP_TLSF_FL_INDEX_MAX - heaptlsfFL_INDEX_SHIFT + 1 )
+#define heaptlsfSMALL_BLOCK_SIZE       ( ( size_t ) 1 << heaptlsfFL_INDEX_SHIFT )
+
+#if ( heaptlsfFL_INDEX_COUNT > 32 ) || ( heaptlsfFL_INDEX_COUNT < 1 )
+    #error democonfigHEAP_TLSF_FL_INDEX_MAX does not fit the bitmap of the lists
+#endif
+
+#define heaptlsfBLOCK_FREE         ( ( size_t ) 1 )
+#define heaptlsfBLOCK_PREV_FREE    ( ( size_t ) 2 )
+#define heaptlsfBLOCK_FLAGS        ( heaptlsfBLOCK_FREE | heaptlsfBLOCK_PREV_FREE )
+
+#define heaptlsfALIGN_UP( x )      ( ( ( x ) + ( ( size_t ) portBYTE_ALIGNMENT - 1 ) ) & ~( ( size_t ) portBYTE_ALIGNMENT - 1 ) )
+
+/* The header of a block, before the memory handed out. The previous block
+ * in memory is only needed, to merge with, when it is free. */
+typedef struct HeapBlock
+{
+    struct HeapBlock * pxPrevPhys;
+    size_t xSize; /* Of the memory after the header, with the flags. */
+
+    /* In the memory of a free block only. */
+    struct HeapBlock * pxNextFree;
+    struct HeapBlock * pxPrevFree;
+} HeapBlock_t;
+
+#define heaptlsfHEADER_SIZE        heaptlsfALIGN_UP( offsetof( HeapBlock_t, pxNextFree ) )
+#define heaptlsfMIN_BLOCK_SIZE     heaptlsfALIGN_UP( sizeof( HeapBlock_t ) - heaptlsfHEADER_SIZE )
+#define heaptlsfMAX_BLOCK_SIZE     ( ( ( size_t ) 1 << democonfigHEAP_TLSF_FL_INDEX_MAX ) - ( size_t ) portBYTE_ALIGNMENT )
+
+/*-----------------------------------------------------------*/
+
+/* The free lists, with a bit for each list that has a block, and a bit for
+ * each power of two that has a list with a block. */
+static uint32_t ulFLBitmap = 0;
+static uint32_t ulSLBitmap[ heaptlsfFL_INDEX_COUNT ];
+static HeapBlock_t * pxFreeBlocks[ heaptlsfFL_INDEX_COUNT ][ heaptlsfSL_INDEX_COUNT ];
+
+static size_t xFreeBytesRemaining = 0U;
+static size_t xMinimumEverFreeBytesRemaining = 0U;
+static size_t xNumberOfFreeBlocks = 0U;
+static size_t xNumberOfSuccessfulAllocations = 0U;
+static size_t xNumberOfSuccessfulFrees = 0U;
+
+#if ( democonfigHEAP_TLSF_REGIONS == 0 )
+
+/* Allocate the memory for the heap. */
+    #if ( configAPPLICATION_ALLOCATED_HEAP == 1 )
+        extern uint8_t ucHeap[ configTOTAL_HEAP_SIZE ];
+    #else
+        PRIVILEGED_DATA static uint8_t ucHeap[ configTOTAL_HEAP_SIZE ];
+    #endif /* configAPPLICATION_ALLOCATED_HEAP */
+
+    static BaseType_t xHeapInitialized = pdFALSE;
+
+#endif /* democonfigHEAP_TLSF_REGIONS == 0 */
+
+/*-----------------------------------------------------------*/
+
+/* Index of the highest bit set, of a word that is not 0. */
+static uint32_t prvFLS( size_t x )
+{
+    #if defined( __GNUC__ )
+        #if ( SIZE_MAX > UINT32_MAX )
+            return 63U - ( uint32_t ) __builtin_clzll( ( unsigned long long ) x );
+        #else
+            return 31U - ( uint32_t ) __builtin_clz( ( unsigned int ) x );
+        #endif
+    #else
+        uint32_t ulBit = 0;
+        uint32_t ulShift;
+
+        for( ulShift = ( uint32_t ) ( sizeof( size_t ) * 4U ); ulShift > 0; ulShift >>= 1 )
+        {
+            if( ( x >> ulShift ) != 0 )
+            {
+                x >>= ulShift;
+                ulBit += ulShift;
+            }
+        }
+
+        return ulBit;
+    #endif /* defined( __GNUC__ ) */
+}
+/*-----------------------------------------------------------*/
+
+/* Index of the lowest bit set, of a word that is not 0. */
+static uint32_t prvFFS( uint32_t x )
+{
+    return prvFLS( ( size_t ) ( x & ( ~x + 1U ) ) );
+}
+/*-----------------------------------------------------------*/
+
+static size_t prvBlockSize( const HeapBlock_t * pxBlock )
+{
+    return pxBlock->xSize & ~heaptlsfBLOCK_FLAGS;
+}
+/*-----------------------------------------------------------*/
+
+static HeapBlock_t * prvBlockNext( const HeapBlock_t * pxBlock )
+{
+    return ( HeapBlock_t * ) ( ( uint8_t * ) pxBlock + heaptlsfHEADER_SIZE + prvBlockSize( pxBlock ) );
+}
+/*-----------------------------------------------------------*/
+
+/* The list of the blocks of xSize. */
+static void prvMappingInsert( size_t xSize,
+                              uint32_t * pulFL,
+                              uint32_t * pulSL )
+{
+    uint32_t ulFL;
+
+    if( xSize < heaptlsfSMALL_BLOCK_SIZE )
+    {
+        *pulFL = 0;
+        *pulSL = ( uint32_t ) ( xSize >> heaptlsfALIGNMENT_LOG2 );
+    }
+    else
+    {
+        ulFL = prvFLS( xSize );
+        *pulSL = ( uint32_t ) ( xSize >> ( ulFL - heaptlsfSL_INDEX_COUNT_LOG2 ) ) ^ heaptlsfSL_INDEX_COUNT;
+        *pulFL = ulFL - ( heaptlsfFL_INDEX_SHIFT - 1U );
+    }
+}
+/*-----------------------------------------------------------*/
+
+/* The first list whose blocks all fit xSize. */
+static void prvMappingSearch( size_t xSize,
+                              uint32_t * pulFL,
+                              uint32_t * pulSL )
+{
+    if( xSize >= heaptlsfSMALL_BLOCK_SIZE )
+    {
+        xSize += ( ( size_t ) 1 << ( prvFLS( xSize ) - heaptlsfSL_INDEX_COUNT_LOG2 ) ) - 1U;
+    }
+
+    prvMappingInsert( xSize, pulFL, pulSL );
+}
+/*-----------------------------------------------------------*/
+
+static void prvInsertFreeBlock( HeapBlock_t * pxBlock )
+{
+    uint32_t ulFL;
+    uint32_t ulSL;
+
+    prvMappingInsert( prvBlockSize( pxBlock ), &ulFL, &ulSL );
+
+    pxBlock->pxPrevFree = NULL;
+    pxBlock->pxNextFree = pxFreeBlocks[ ulFL ][ ulSL ];
+
+    if( pxBlock->pxNextFree != NULL )
+    {
+        pxBlock->pxNextFree->pxPrevFree = pxBlock;
+    }
+
+    pxFreeBlocks[ ulFL ][ ulSL ] = pxBlock;
+    ulFLBitmap |= ( 1UL << ulFL );
+    ulSLBitmap[ ulFL ] |= ( 1UL << ulSL );
+
+    xNumberOfFreeBlocks++;
+}
+/*-----------------------------------------------------------*/
+
+static void prvRemoveFreeBlock( HeapBlock_t * pxBlock )
+{
+    uint32_t ulFL;
+    uint32_t ulSL;
+
+    prvMappingInsert( prvBlockSize( pxBlock ), &ulFL, &ulSL );
+
+    if( pxBlock->pxNextFree != NULL )
+    {
+        pxBlock->pxNextFree->pxPrevFree = pxBlock->pxPrevFree;
+    }
+
+    if( pxBlock->pxPrevFree != NULL )
+    {
+        pxBlock->pxPrevFree->pxNextFree = pxBlock->pxNextFree;
+    }
+    else
+    {
+        pxFreeBlocks[ ulFL ][ ulSL ] = pxBlock->pxNextFree;
+
+        if( pxBlock->pxNextFree == NULL )
+        {
+            ulSLBitmap[ ulFL ] &= ~( 1UL << ulSL );
+
+            if( ulSLBitmap[ ulFL ] == 0 )
+            {
+                ulFLBitmap &= ~( 1UL << ulFL );
+            }
+        }
+    }
+
+    xNumberOfFreeBlocks--;
+}
+/*-----------------------------------------------------------*/
+
+/* A free block of at least xSize, out of its list, or NULL. */
+static HeapBlock_t * prvTakeSuitableBlock( size_t xSize )
+{
+    HeapBlock_t * pxBlock;
+    uint32_t ulFL;
+    uint32_t ulSL;
+    uint32_t ulMap;
+
+    prvMappingSearch( xSize, &ulFL, &ulSL );
+
+    if( ulFL >= heaptlsfFL_INDEX_COUNT )
+    {
+        return NULL;
+    }
+
+    ulMap = ulSLBitmap[ ulFL ] & ( ~0UL << ulSL );
+
+    if( ulMap == 0 )
+    {
+        /* The next power of two with a block. */
+        ulMap = ( ulFL + 1U < heaptlsfFL_INDEX_COUNT ) ? ( ulFLBitmap & ( ~0UL << ( ulFL + 1U ) ) ) : 0;
+
+        if( ulMap == 0 )
+        {
+            return NULL;
+        }
+
+        ulFL = prvFFS( ulMap );
+        ulMap = ulSLBitmap[ ulFL ];
+    }
+
+    ulSL = prvFFS( ulMap );
+    pxBlock = pxFreeBlocks[ ulFL ][ ulSL ];
+    prvRemoveFreeBlock( pxBlock );
+
+    return pxBlock;
+}
+/*-----------------------------------------------------------*/
+
+/* Mark the block after pxBlock with whether pxBlock is free. */
+static void prvLinkNext( HeapBlock_t * pxBlock )
+{
+    HeapBlock_t * pxNext = prvBlockNext( pxBlock );
+
+    pxNext->pxPrevPhys = pxBlock;
+
+    if( ( pxBlock->xSize & heaptlsfBLOCK_FREE ) != 0 )
+    {
+        pxNext->xSize |= heaptlsfBLOCK_PREV_FREE;
+    }
+    else
+    {
+        pxNext->xSize &= ~heaptlsfBLOCK_PREV_FREE;
+    }
+}
+/*-----------------------------------------------------------*/
+
+/* Give the end of a block larger than xSize back to the free lists. */
+static void prvTrimBlock( HeapBlock_t * pxBlock,
+                          size_t xSize )
+{
+    HeapBlock_t * pxRemainder;
+    size_t xBlockSize = prvBlockSize( pxBlock );
+
+    if( xBlockSize >= xSize + heaptlsfHEADER_SIZE + heaptlsfMIN_BLOCK_SIZE )
+    {
+        pxRemainder = ( HeapBlock_t * ) ( ( uint8_t * ) pxBlock + heaptlsfHEADER_SIZE + xSize );
+        pxRemainder->xSize = ( xBlockSize - xSize - heaptlsfHEADER_SIZE ) | heaptlsfBLOCK_FREE;
+        pxBlock->xSize = xSize | ( pxBlock->xSize & heaptlsfBLOCK_FLAGS );
+        xFreeBytesRemaining -= heaptlsfHEADER_SIZE;
+
+        /* pxBlock is in use. */
+        pxRemainder->pxPrevPhys = pxBlock;
+        prvLinkNext( pxRemainder );
+        prvInsertFreeBlock( pxRemainder );
+    }
+}
+/*-----------------------------------------------------------*/
+
+/* Add a region of the heap, as blocks of up to heaptlsfMAX_BLOCK_SIZE ended
+ * by a block of size 0 that is never free. */
+static void prvAddRegion( uint8_t * pucStart,
+                          size_t xRegionSize )
+{
+    uint8_t * pucEnd = pucStart + xRegionSize;
+    uint8_t * pucBlock;
+    HeapBlock_t * pxBlock;
+    HeapBlock_t * pxPrevious = NULL;
+    size_t xSize;
+
+    pucBlock = ( uint8_t * ) heaptlsfALIGN_UP( ( size_t ) pucStart );
+
+    while( ( pucBlock < pucEnd ) &&
+           ( ( size_t ) ( pucEnd - pucBlock ) >= 2U * heaptlsfHEADER_SIZE + heaptlsfMIN_BLOCK_SIZE ) )
+    {
+        xSize = ( ( size_t ) ( pucEnd - pucBlock ) - 2U * heaptlsfHEADER_SIZE ) & ~( ( size_t ) portBYTE_ALIGNMENT - 1 );
+
+        if( xSize > heaptlsfMAX_BLOCK_SIZE )
+        {
+            xSize = heaptlsfMAX_BLOCK_SIZE;
+        }
+
+        pxBlock = ( HeapBlock_t * ) pucBlock;
+        pxBlock->pxPrevPhys = pxPrevious;
+        pxBlock->xSize = xSize | heaptlsfBLOCK_FREE;
+        prvInsertFreeBlock( pxBlock );
+        xFreeBytesRemaining += xSize;
+
+        /* The end of the region, or of this block of it. */
+        pxPrevious = prvBlockNext( pxBlock );
+        pxPrevious->pxPrevPhys = pxBlock;
+        pxPrevious->xSize = heaptlsfBLOCK_PREV_FREE;
+        pucBlock = ( uint8_t * ) pxPrevious + heaptlsfHEADER_SIZE;
+    }
+
+    xMinimumEverFreeBytesRemaining = xFreeBytesRemaining;
+}
+/*-----------------------------------------------------------*/
+
+void * pvPortMalloc( size_t xWantedSize )
+{
+    HeapBlock_t * pxBlock = NULL;
+    void * pvReturn = NULL;
+    size_t xSize;
+
+    /* More than the largest block, or than the addition below can take. */
+    if( ( xWantedSize > 0 ) && ( xWantedSize <= heaptlsfMAX_BLOCK_SIZE ) )
+    {
+        xSize = heaptlsfALIGN_UP( xWantedSize );
+
+        if( xSize < heaptlsfMIN_BLOCK_SIZE )
+        {
+            xSize = heaptlsfMIN_BLOCK_SIZE;
+        }
+    }
+    else
+    {
+        xSize = 0;
+    }
+
+    vTaskSuspendAll();
+    {
+        #if ( democonfigHEAP_TLSF_REGIONS == 0 )
+            if( xHeapInitialized == pdFALSE )
+            {
+                prvAddRegion( ucHeap, sizeof( ucHeap ) );
+                xHeapInitialized = pdTRUE;
+            }
+        #else
+            /* vPortDefineHeapRegions() has not been called. */
+            configASSERT( xMinimumEverFreeBytesRemaining > 0 );
+        #endif
+
+        if( xSize > 0 )
+        {
+            pxBlock = prvTakeSuitableBlock( xSize );
+        }
+
+        if( pxBlock != NULL )
+        {
+            pxBlock->xSize &= ~heaptlsfBLOCK_FREE;
+            prvTrimBlock( pxBlock, xSize );
+            prvLinkNext( pxBlock );
+
+            xFreeBytesRemaining -= prvBlockSize( pxBlock );
+
+            if( xFreeBytesRemaining < xMinimumEverFreeBytesRemaining )
+            {
+                xMinimumEverFreeBytesRemaining = xFreeBytesRemaining;
+            }
+
+            xNumberOfSuccessfulAllocations++;
+            pvReturn = ( uint8_t * ) pxBlock + heaptlsfHEADER_SIZE;
+        }
+
+        traceMALLOC( pvReturn, xWantedSize );
+    }
+    ( void ) xTaskResumeAll();
+
+    #if ( configUSE_MALLOC_FAILED_HOOK == 1 )
+    {
+        if( pvReturn == NULL )
+        {
+            extern void vApplicationMallocFailedHook( void );
+            vApplicationMallocFailedHook();
+        }
+    }
+    #endif /* if ( configUSE_MALLOC_FAILED_HOOK == 1 ) */
+
+    configASSERT( ( ( ( size_t ) pvReturn ) & ( ( size_t ) portBYTE_ALIGNMENT - 1 ) ) == 0 );
+
+    return pvReturn;
+}
+/*-----------------------------------------------------------*/
+
+void vPortFree( void * pv )
+{
+    HeapBlock_t * pxBlock;
+    HeapBlock_t * pxNeighbour;
+
+    if( pv == NULL )
+    {
+        return;
+    }
+
+    pxBlock = ( HeapBlock_t * ) ( ( uint8_t * ) pv - heaptlsfHEADER_SIZE );
+
+    /* Freed twice, or not from pvPortMalloc(). */
+    configASSERT( ( pxBlock->xSize & heaptlsfBLOCK_FREE ) == 0 );
+
+    vTaskSuspendAll();
+    {
+        traceFREE( pv, prvBlockSize( pxBlock ) );
+
+        xFreeBytesRemaining += prvBlockSize( pxBlock );
+        xNumberOfSuccessfulFrees++;
+        pxBlock->xSize |= heaptlsfBLOCK_FREE;
+
+        /* Merge with the free blocks around it, whose headers its memory
+         * takes, so that fragments do not build up. */
+        if( ( pxBlock->xSize & heaptlsfBLOCK_PREV_FREE ) != 0 )
+        {
+            pxNeighbour = pxBlock->pxPrevPhys;
+            prvRemoveFreeBlock( pxNeighbour );
+            pxNeighbour->xSize += prvBlockSize( pxBlock ) + heaptlsfHEADER_SIZE;
+            xFreeBytesRemaining += heaptlsfHEADER_SIZE;
+            pxBlock = pxNeighbour;
+        }
+
+        pxNeighbour = prvBlockNext( pxBlock );
+
+        if( ( pxNeighbour->xSize & heaptlsfBLOCK_FREE ) != 0 )
+        {
+            prvRemoveFreeBlock( pxNeighbour );
+            pxBlock->xSize += prvBlockSize( pxNeighbour ) + heaptlsfHEADER_SIZE;
+            xFreeBytesRemaining += heaptlsfHEADER_SIZE;
+        }
+
+        prvLinkNext( pxBlock );
+        prvInsertFreeBlock( pxBlock );
+    }
+    ( void ) xTaskResumeAll();
+}
+/*-----------------------------------------------------------*/
+
+#if ( democonfigHEAP_TLSF_REGIONS == 1 )
+
+    void vPortDefineHeapRegions( const HeapRegion_t * const pxHeapRegions )
+    {
+        const HeapRegion_t * pxRegion;
+
+        /* Can only call once! */
+        configASSERT( xMinimumEverFreeBytesRemaining == 0 );
+
+        for( pxRegion = pxHeapRegions; pxRegion->xSizeInBytes > 0; pxRegion++ )
+        {
+            prvAddRegion( pxRegion->pucStartAddress, pxRegion->xSizeInBytes );
+        }
+
+        /* Check something was actually defined before it is accessed. */
+        configASSERT( xFreeBytesRemaining > 0 );
+    }
+
+#endif /* democonfigHEAP_TLSF_REGIONS == 1 */
+/*-----------------------------------------------------------*/
+
+size_t xPortGetFreeHeapSize( void )
+{
+    return xFreeBytesRemaining;
+}
+/*-----------------------------------------------------------*/
+
+size_t xPortGetMinimumEverFreeHeapSize( void )
+{
+    return xMinimumEverFreeBytesRemaining;
+}
+/*-----------------------------------------------------------*/
+
+void vPortInitialiseBlocks( void )
+{
+    /* This just exists to keep the linker quiet. */
+}
+/*-----------------------------------------------------------*/
+
+void vPortGetHeapStats( HeapStats_t * pxHeapStats )
+{
+    HeapBlock_t * pxBlock;
+    size_t xMaxSize = 0;
+    size_t xMinSize = 0;
+    uint32_t ulFL;
+    uint32_t ulSL;
+
+    vTaskSuspendAll();
+    {
+        /* The largest block is in the highest list with a block, the
+         * smallest in the lowest one, so only those two are walked. */
+        if( ulFLBitmap != 0 )
+        {
+            ulFL = prvFLS( ulFLBitmap );
+            ulSL = prvFLS( ulSLBitmap[ ulFL ] );
+
+            for( pxBlock = pxFreeBlocks[ ulFL ][ ulSL ]; pxBlock != NULL; pxBlock = pxBlock->pxNextFree )
+            {
+                if( prvBlockSize( pxBlock ) > xMaxSize )
+                {
+                    xMaxSize = prvBlockSize( pxBlock );
+                }
+            }
+
+            ulFL = prvFFS( ulFLBitmap );
+            ulSL = prvFFS( ulSLBitmap[ ulFL ] );
+            xMinSize = SIZE_MAX;
+
+            for( pxBlock = pxFreeBlocks[ ulFL ][ ulSL ]; pxBlock != NULL; pxBlock = pxBlock->pxNextFree )
+            {
+                if( prvBlockSize( pxBlock ) < xMinSize )
+                {
+                    xMinSize = prvBlockSize( pxBlock );
+                }
+            }
+        }
+
+        pxHeapStats->xSizeOfLargestFreeBlockInBytes = xMaxSize;
+        pxHeapStats->xSizeOfSmallestFreeBlockInBytes = xMinSize;
+        pxHeapStats->xNumberOfFreeBlocks = xNumberOfFreeBlocks;
+        pxHeapStats->xAvailableHeapSpaceInBytes = xFreeBytesRemaining;
+        pxHeapStats->xNumberOfSuccessfulAllocations = xNumberOfSuccessfulAllocations;
+        pxHeapStats->xNumberOfSuccessfulFrees = xNumberOfSuccessfulFrees;
+        pxHeapStats->xMinimumEverFreeBytesRemaining = xMinimumEverFreeBytesRemaining;
+    }
+    ( void ) xTaskResumeAll();
+}
+/*-----------------------------------------------------------*/
@@ -0,0 +1,51 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @file azure_sample_heap_tlsf.h
+ *
+ * @brief A FreeRTOS heap whose allocations and frees take constant time.
+ *
+ * heap_4 and heap_5 walk their list of free blocks for the first that fits,
+ * so an allocation takes longer the more the heap is cut up, as it is after
+ * many TLS handshakes. heap_3 takes the lock of the C library around malloc().
+ * azure_sample_heap_tlsf.c implements pvPortMalloc() and vPortFree() with a
+ * two level segregated fit (TLSF) allocator instead: the free blocks are kept
+ * in lists by size class, found from two bitmaps with a count of leading zeros,
+ * so an allocation or a free does a fixed number of steps whatever the state
+ * of the heap, and the time the scheduler is kept suspended is bounded.
+ *
+ * The SAMPLE_HEAP_TLSF CMake option links it in place of the FreeRTOS heap of
+ * every board. It keeps the interface of the heap it replaces:
+ * xPortGetFreeHeapSize(), xPortGetMinimumEverFreeHeapSize(), vPortGetHeapStats(),
+ * the traceMALLOC and traceFREE hooks of azure_sample_heap_trace.h, the malloc
+ * failed hook, and vPortDefineHeapRegions() in place of heap_5.
+ *
+ * A block may be up to a size class larger than asked for, which is the price
+ * of the constant time; each allocation takes two words of header, as with
+ * heap_4.
+ */
+
+#ifndef AZURE_SAMPLE_HEAP_TLSF_H
+#define AZURE_SAMPLE_HEAP_TLSF_H
+
+/**
+ * @brief 1 for the heap to be given by vPortDefineHeapRegions(), as heap_5,
+ * set by the SAMPLE_HEAP_TLSF CMake option on the boards with heap_5. 0 for a
+ * static array of configTOTAL_HEAP_SIZE bytes, as heap_4, which the
+ * application defines as ucHeap with configAPPLICATION_ALLOCATED_HEAP.
+ */
+#ifndef democonfigHEAP_TLSF_REGIONS
+    #define democonfigHEAP_TLSF_REGIONS    0
+#endif
+
+/**
+ * @brief Log2 of the size of the largest block, a region larger than it is
+ * added as several blocks. The lists take 64 bytes of RAM, of pointers, for
+ * each power of two above 128 bytes.
+ */
+#ifndef democonfigHEAP_TLSF_FL_INDEX_MAX
+    #define democonfigHEAP_TLSF_FL_INDEX_MAX    ( 24 )
+#endif
+
+#endif /* AZURE_SAMPLE_HEAP_TLSF_H */
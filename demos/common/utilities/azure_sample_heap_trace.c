@@ -0,0 +1,230 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+#include "azure_sample_heap_trace.h"
+
+/* FreeRTOS includes. */
+#include "FreeRTOS.h"
+#include "task.h"
+
+/* Built into the samples whether the heap is traced or not, so it is empty
+ * when the hooks are not set. */
+#if ( democonfigHEAP_TRACE == 1 )
+
+/* An allocation alive, and the site it is counted for. */
+typedef struct HeapTraceLive
+{
+    void * pvAddress;
+    uint32_t ulSize;
+    uint32_t ulSite;
+} HeapTraceLive_t;
+
+/* The last site counts those beyond the table. */
+static HeapTraceSite_t xSites[ democonfigHEAP_TRACE_MAX_SITES + 1U ];
+static HeapTraceLive_t xLive[ democonfigHEAP_TRACE_MAX_LIVE ];
+static HeapTraceStats_t xStats;
+static HeapTraceSample_t xHistory[ democonfigHEAP_TRACE_HISTORY_LENGTH ];
+static uint32_t ulHistoryNext;
+static uint32_t ulHistoryCount;
+/*-----------------------------------------------------------*/
+
+static uint32_t prvBucket( size_t xSize )
+{
+    uint32_t ulBucket = 0;
+    size_t xBound = heaptraceSMALLEST_BUCKET;
+
+    while( ( xSize > xBound ) && ( ulBucket < ( heaptraceBUCKET_COUNT - 1U ) ) )
+    {
+        xBound <<= 1;
+        ulBucket++;
+    }
+
+    return ulBucket;
+}
+/*-----------------------------------------------------------*/
+
+static uint32_t prvSite( const void * pvCaller )
+{
+    uint32_t ulSite;
+
+    for( ulSite = 0; ulSite < democonfigHEAP_TRACE_MAX_SITES; ulSite++ )
+    {
+        if( xSites[ ulSite ].pvCaller == pvCaller )
+        {
+            return ulSite;
+        }
+
+        if( xSites[ ulSite ].pvCaller == NULL )
+        {
+            xSites[ ulSite ].pvCaller = pvCaller;
+            return ulSite;
+        }
+    }
+
+    return democonfigHEAP_TRACE_MAX_SITES;
+}
+/*-----------------------------------------------------------*/
+
+static uint32_t prvLargestFreeBlock( void )
+{
+    HeapStats_t xHeapStats;
+
+    vPortGetHeapStats( &xHeapStats );
+
+    return ( uint32_t ) xHeapStats.xSizeOfLargestFreeBlockInBytes;
+}
+/*-----------------------------------------------------------*/
+
+void HeapTrace_Malloc( void * pvAddress,
+                       size_t xSize,
+                       const void * pvCaller )
+{
+    HeapTraceSite_t * pxSite = &xSites[ prvSite( pvCaller ) ];
+    uint32_t ulIndex;
+
+    if( pvAddress == NULL )
+    {
+        /* Nothing is allocated for 0 bytes, that is no failure. */
+        if( xSize == 0U )
+        {
+            return;
+        }
+
+        pxSite->ulFailures++;
+        xStats.ulFailures++;
+        xStats.ulLastFailureSize = ( uint32_t ) xSize;
+        xStats.ulLastFailureLargestBlock = prvLargestFreeBlock();
+        return;
+    }
+
+    pxSite->ulAllocations++;
+    xStats.ulAllocations++;
+    xStats.ulBuckets[ prvBucket( xSize ) ]++;
+
+    for( ulIndex = 0; ulIndex < democonfigHEAP_TRACE_MAX_LIVE; ulIndex++ )
+    {
+        if( xLive[ ulIndex ].pvAddress == NULL )
+        {
+            xLive[ ulIndex ].pvAddress = pvAddress;
+            xLive[ ulIndex ].ulSize = ( uint32_t ) xSize;
+            xLive[ ulIndex ].ulSite = ( uint32_t ) ( pxSite - xSites );
+
+            pxSite->ulLiveBytes += ( uint32_t ) xSize;
+
+            if( pxSite->ulLiveBytes > pxSite->ulPeakLiveBytes )
+            {
+                pxSite->ulPeakLiveBytes = pxSite->ulLiveBytes;
+            }
+
+            return;
+        }
+    }
+
+    xStats.ulUntracked++;
+}
+/*-----------------------------------------------------------*/
+
+void HeapTrace_Free( void * pvAddress,
+                     size_t xSize )
+{
+    uint32_t ulIndex;
+
+    ( void ) xSize;
+
+    xStats.ulFrees++;
+
+    for( ulIndex = 0; ulIndex < democonfigHEAP_TRACE_MAX_LIVE; ulIndex++ )
+    {
+        if( xLive[ ulIndex ].pvAddress == pvAddress )
+        {
+            xSites[ xLive[ ulIndex ].ulSite ].ulLiveBytes -= xLive[ ulIndex ].ulSize;
+            xLive[ ulIndex ].pvAddress = NULL;
+            break;
+        }
+    }
+}
+/*-----------------------------------------------------------*/
+
+void HeapTrace_Sample( HeapTraceSample_t * pxSample )
+{
+    HeapStats_t xHeapStats;
+    HeapTraceSample_t xSample;
+
+    vPortGetHeapStats( &xHeapStats );
+
+    xSample.ulUptimeSeconds = ( uint32_t ) ( xTaskGetTickCount() / configTICK_RATE_HZ );
+    xSample.ulFreeBytes = ( uint32_t ) xHeapStats.xAvailableHeapSpaceInBytes;
+    xSample.ulLargestFreeBlock = ( uint32_t ) xHeapStats.xSizeOfLargestFreeBlockInBytes;
+    xSample.ulFreeBlocks = ( uint32_t ) xHeapStats.xNumberOfFreeBlocks;
+
+    vTaskSuspendAll();
+    {
+        xHistory[ ulHistoryNext ] = xSample;
+        ulHistoryNext = ( ulHistoryNext + 1U ) % democonfigHEAP_TRACE_HISTORY_LENGTH;
+
+        if( ulHistoryCount < democonfigHEAP_TRACE_HISTORY_LENGTH )
+        {
+            ulHistoryCount++;
+        }
+    }
+    ( void ) xTaskResumeAll();
+
+    if( pxSample != NULL )
+    {
+        *pxSample = xSample;
+    }
+}
+/*-----------------------------------------------------------*/
+
+bool HeapTrace_GetHistory( uint32_t ulAge,
+                           HeapTraceSample_t * pxSample )
+{
+    bool xFound = false;
+
+    vTaskSuspendAll();
+    {
+        if( ulAge < ulHistoryCount )
+        {
+            *pxSample = xHistory[ ( ulHistoryNext + democonfigHEAP_TRACE_HISTORY_LENGTH - 1U - ulAge ) %
+                                  democonfigHEAP_TRACE_HISTORY_LENGTH ];
+            xFound = true;
+        }
+    }
+    ( void ) xTaskResumeAll();
+
+    return xFound;
+}
+/*-----------------------------------------------------------*/
+
+void HeapTrace_GetStats( HeapTraceStats_t * pxStats )
+{
+    vTaskSuspendAll();
+    {
+        *pxStats = xStats;
+    }
+    ( void ) xTaskResumeAll();
+}
+/*-----------------------------------------------------------*/
+
+bool HeapTrace_GetSite( uint32_t ulIndex,
+                        HeapTraceSite_t * pxSite )
+{
+    bool xFound = false;
+
+    if( ulIndex > democonfigHEAP_TRACE_MAX_SITES )
+    {
+        return false;
+    }
+
+    vTaskSuspendAll();
+    {
+        *pxSite = xSites[ ulIndex ];
+        xFound = ( pxSite->ulAllocations > 0U ) || ( pxSite->ulFailures > 0U );
+    }
+    ( void ) xTaskResumeAll();
+
+    return xFound;
+}
+/*-----------------------------------------------------------*/
+
+#endif /* democonfigHEAP_TRACE == 1 */
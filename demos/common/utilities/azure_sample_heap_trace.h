@@ -0,0 +1,168 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @file azure_sample_heap_trace.h
+ *
+ * @brief Allocation sizes, call sites and free blocks of the heap, over time.
+ *
+ * A device can have enough free heap and still fail an allocation after days
+ * of reconnects, once the free heap is cut into blocks smaller than a TLS
+ * record buffer. With democonfigHEAP_TRACE set to 1, by the SAMPLE_HEAP_TRACE
+ * CMake option, the traceMALLOC and traceFREE hooks of the board call
+ * HeapTrace_Malloc() and HeapTrace_Free(), which count the allocations by
+ * size and by the function that called pvPortMalloc(), and the failures with
+ * the largest free block when they happened. HeapTrace_Sample(), called with
+ * the diagnostics, keeps a history of the free heap, its largest block and
+ * the number of free blocks, so a slow split of the heap shows as the largest
+ * block going down while the free heap stays.
+ *
+ * Allocations made through a wrapper, such as mbedtls_platform_calloc(), are
+ * counted for the wrapper.
+ *
+ * The hooks run with the scheduler suspended, from pvPortMalloc() and
+ * vPortFree(), and only update tables; the functions that read them suspend
+ * the scheduler as well. The figures of the free blocks need heap_4 or heap_5.
+ */
+
+#ifndef AZURE_SAMPLE_HEAP_TRACE_H
+#define AZURE_SAMPLE_HEAP_TRACE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief 1 to trace the allocations of the heap, set by the SAMPLE_HEAP_TRACE
+ * CMake option.
+ */
+#ifndef democonfigHEAP_TRACE
+    #define democonfigHEAP_TRACE    0
+#endif
+
+/**
+ * @brief Most call sites of pvPortMalloc() counted apart, the others are
+ * counted together.
+ */
+#ifndef democonfigHEAP_TRACE_MAX_SITES
+    #define democonfigHEAP_TRACE_MAX_SITES    ( 24U )
+#endif
+
+/**
+ * @brief Most allocations alive at once whose call site is known when they
+ * are freed.
+ */
+#ifndef democonfigHEAP_TRACE_MAX_LIVE
+    #define democonfigHEAP_TRACE_MAX_LIVE    ( 96U )
+#endif
+
+/**
+ * @brief Samples of HeapTrace_Sample() kept.
+ */
+#ifndef democonfigHEAP_TRACE_HISTORY_LENGTH
+    #define democonfigHEAP_TRACE_HISTORY_LENGTH    ( 32U )
+#endif
+
+/**
+ * @brief Buckets of the size histogram. Bucket 0 counts the allocations up
+ * to 16 bytes, each next one those up to twice as large, and the last one
+ * all those larger.
+ */
+#define heaptraceBUCKET_COUNT         ( 12U )
+#define heaptraceSMALLEST_BUCKET      ( 16U )
+
+/**
+ * @brief Allocations from one call site of pvPortMalloc().
+ */
+typedef struct HeapTraceSite
+{
+    const void * pvCaller;       /* NULL for the sites beyond the table. */
+    uint32_t ulAllocations;
+    uint32_t ulFailures;
+    uint32_t ulLiveBytes;        /* Of the allocations whose free is traced. */
+    uint32_t ulPeakLiveBytes;
+} HeapTraceSite_t;
+
+/**
+ * @brief Counts over all the allocations.
+ */
+typedef struct HeapTraceStats
+{
+    uint32_t ulAllocations;
+    uint32_t ulFrees;
+    uint32_t ulBuckets[ heaptraceBUCKET_COUNT ];
+    uint32_t ulFailures;
+    uint32_t ulLastFailureSize;          /* Bytes asked, with the block header. */
+    uint32_t ulLastFailureLargestBlock;  /* Largest free block then. */
+    uint32_t ulUntracked;                /* Allocations the live table could not hold. */
+} HeapTraceStats_t;
+
+/**
+ * @brief The heap at one HeapTrace_Sample().
+ */
+typedef struct HeapTraceSample
+{
+    uint32_t ulUptimeSeconds;
+    uint32_t ulFreeBytes;
+    uint32_t ulLargestFreeBlock;
+    uint32_t ulFreeBlocks;
+} HeapTraceSample_t;
+
+/**
+ * @brief The traceMALLOC hook.
+ *
+ * @param[in] pvAddress The block, NULL when the allocation failed.
+ * @param[in] xSize The size asked, with the block header.
+ * @param[in] pvCaller Return address in the function that called pvPortMalloc().
+ */
+void HeapTrace_Malloc( void * pvAddress,
+                       size_t xSize,
+                       const void * pvCaller );
+
+/**
+ * @brief The traceFREE hook.
+ *
+ * @param[in] pvAddress The block.
+ * @param[in] xSize Its size, with the block header.
+ */
+void HeapTrace_Free( void * pvAddress,
+                     size_t xSize );
+
+/**
+ * @brief Sample the free blocks of the heap, into the history.
+ *
+ * @param[out] pxSample The sample, may be NULL.
+ */
+void HeapTrace_Sample( HeapTraceSample_t * pxSample );
+
+/**
+ * @brief Get a sample of the history.
+ *
+ * @param[in] ulAge 0 for the last sample, 1 for the one before, and so on.
+ * @param[out] pxSample The sample.
+ * @return false when there are not that many samples.
+ */
+bool HeapTrace_GetHistory( uint32_t ulAge,
+                           HeapTraceSample_t * pxSample );
+
+/**
+ * @brief Get the counts over all the allocations.
+ *
+ * @param[out] pxStats The counts.
+ */
+void HeapTrace_GetStats( HeapTraceStats_t * pxStats );
+
+/**
+ * @brief Get a call site, the sites beyond the table being counted at
+ * democonfigHEAP_TRACE_MAX_SITES.
+ *
+ * The sites are in the order they first allocated.
+ *
+ * @param[in] ulIndex 0 up to democonfigHEAP_TRACE_MAX_SITES.
+ * @param[out] pxSite The site.
+ * @return false when the site did not allocate.
+ */
+bool HeapTrace_GetSite( uint32_t ulIndex,
+                        HeapTraceSite_t * pxSite );
+
+#endif /* AZURE_SAMPLE_HEAP_TRACE_H */
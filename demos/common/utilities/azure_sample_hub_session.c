@@ -0,0 +1,65 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+#include "azure_sample_hub_session.h"
+
+/* Demo Specific configs. */
+#include "demo_config.h"
+/*-----------------------------------------------------------*/
+
+bool HubSession_Resume( HubSession_t * pxSession,
+                        bool xSessionPresent )
+{
+    if( !xSessionPresent )
+    {
+        pxSession->xSubscribed = false;
+        pxSession->ulDesiredVersion = 0;
+    }
+
+    return pxSession->xSubscribed;
+}
+/*-----------------------------------------------------------*/
+
+void HubSession_SetSubscribed( HubSession_t * pxSession )
+{
+    pxSession->xSubscribed = true;
+}
+/*-----------------------------------------------------------*/
+
+bool HubSession_NeedsProperties( const HubSession_t * pxSession )
+{
+    return pxSession->ulDesiredVersion == 0;
+}
+/*-----------------------------------------------------------*/
+
+bool HubSession_PropertiesReceived( HubSession_t * pxSession,
+                                    const AzureIoTHubClientPropertiesResponse_t * pxMessage,
+                                    uint32_t ulVersion )
+{
+    if( pxMessage->xMessageType == eAzureIoTHubPropertiesRequestedMessage )
+    {
+        pxSession->ulDesiredVersion = ulVersion;
+        return false;
+    }
+
+    /* While the version is 0 a document was requested, and is newer than
+     * the patches that arrive before it. */
+    if( ( pxSession->ulDesiredVersion == 0 ) ||
+        ( pxMessage->xMessageType != eAzureIoTHubPropertiesWritablePropertyMessage ) )
+    {
+        return false;
+    }
+
+    if( ulVersion == pxSession->ulDesiredVersion + 1U )
+    {
+        pxSession->ulDesiredVersion = ulVersion;
+        return false;
+    }
+
+    LogWarn( ( "Desired properties version %u after %u, requesting the document.\r\n",
+               ( unsigned int ) ulVersion, ( unsigned int ) pxSession->ulDesiredVersion ) );
+    pxSession->ulDesiredVersion = 0;
+
+    return true;
+}
+/*-----------------------------------------------------------*/
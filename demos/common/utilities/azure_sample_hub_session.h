@@ -0,0 +1,81 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @file azure_sample_hub_session.h
+ *
+ * @brief What the MQTT session IoT Hub keeps for the device holds, so that a
+ * reconnect does not resynchronise what it still has.
+ *
+ * The samples connect without a clean session, so over a reconnect the hub
+ * keeps their subscriptions and the desired property patches it queued.
+ * HubSession_Resume() tells them, from the session present flag of the
+ * CONNACK, whether the subscriptions were made in the session they got back,
+ * so the SUBSCRIBEs can be answered by the subscribe batch instead of being
+ * sent. HubSession_NeedsProperties() tells them whether to request the
+ * property document, which they only need when the session is new or no
+ * document was handled yet.
+ *
+ * The $version of the desired properties counts the patches, so a patch that
+ * is not the one after the last handled shows that one was missed, and
+ * HubSession_PropertiesReceived() then asks for the whole document.
+ *
+ * A HubSession_t lives as long as the sample task, over its connections, and
+ * is only used from that task.
+ */
+
+#ifndef AZURE_SAMPLE_HUB_SESSION_H
+#define AZURE_SAMPLE_HUB_SESSION_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "azure_iot_hub_client.h"
+
+typedef struct HubSession
+{
+    bool xSubscribed;          /* The session holds the subscriptions of the sample. */
+    uint32_t ulDesiredVersion; /* $version of the desired properties last handled, 0 while a document is awaited. */
+} HubSession_t;
+
+/**
+ * @brief Whether the session the hub resumed holds the subscriptions.
+ *
+ * Forgets the subscriptions and the version when the hub did not keep the
+ * session, as the patches it had queued are gone with it.
+ *
+ * @param[in] pxSession The session.
+ * @param[in] xSessionPresent The session present flag of the CONNACK.
+ * @return true when the subscriptions were made in the session.
+ */
+bool HubSession_Resume( HubSession_t * pxSession,
+                        bool xSessionPresent );
+
+/**
+ * @brief Record that the subscriptions were made in the session.
+ *
+ * @param[in] pxSession The session.
+ */
+void HubSession_SetSubscribed( HubSession_t * pxSession );
+
+/**
+ * @brief Whether the property document is to be requested after the connect.
+ *
+ * @param[in] pxSession The session.
+ * @return true until a document was handled in the session.
+ */
+bool HubSession_NeedsProperties( const HubSession_t * pxSession );
+
+/**
+ * @brief Record the version of a property document or patch once it was handled.
+ *
+ * @param[in] pxSession The session.
+ * @param[in] pxMessage The document, or the patch of writable properties.
+ * @param[in] ulVersion The $version of its desired properties, 0 if it could not be read.
+ * @return true when a patch was missed, so the document is to be requested.
+ */
+bool HubSession_PropertiesReceived( HubSession_t * pxSession,
+                                    const AzureIoTHubClientPropertiesResponse_t * pxMessage,
+                                    uint32_t ulVersion );
+
+#endif /* AZURE_SAMPLE_HUB_SESSION_H */
@@ -0,0 +1,370 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+#include "azure_sample_hub_task.h"
+
+#include <string.h>
+
+#include "task.h"
+
+/* Demo Specific configs. */
+#include "demo_config.h"
+
+/* Trace points of the samples. */
+#include "azure_sample_trace.h"
+
+#define hubtaskSTATUS_PAYLOAD_TOO_LARGE    413
+#define hubtaskSTATUS_BUSY                 503
+#define hubtaskSTATUS_NOT_FOUND            404
+
+static const uint8_t ucEmptyResponse[] = "{}";
+/*-----------------------------------------------------------*/
+
+static void prvRingCopy( HubTask_t * pxHubTask,
+                         uint32_t ulPosition,
+                         const uint8_t * pucData,
+                         uint32_t ulLength )
+{
+    uint32_t ulFirst = democonfigHUB_TASK_TELEMETRY_RING_SIZE - ulPosition;
+
+    if( ulFirst > ulLength )
+    {
+        ulFirst = ulLength;
+    }
+
+    memcpy( &pxHubTask->ucTelemetryRing[ ulPosition ], pucData, ulFirst );
+    memcpy( pxHubTask->ucTelemetryRing, &pucData[ ulFirst ], ulLength - ulFirst );
+}
+/*-----------------------------------------------------------*/
+
+static void prvRingRead( const HubTask_t * pxHubTask,
+                         uint32_t ulPosition,
+                         uint8_t * pucData,
+                         uint32_t ulLength )
+{
+    uint32_t ulFirst = democonfigHUB_TASK_TELEMETRY_RING_SIZE - ulPosition;
+
+    if( ulFirst > ulLength )
+    {
+        ulFirst = ulLength;
+    }
+
+    memcpy( pucData, &pxHubTask->ucTelemetryRing[ ulPosition ], ulFirst );
+    memcpy( &pucData[ ulFirst ], pxHubTask->ucTelemetryRing, ulLength - ulFirst );
+}
+/*-----------------------------------------------------------*/
+
+/* Take the oldest message of the ring into the scratch item. The producers
+ * only write the free part, so the message is read outside the critical
+ * section, and its room given back once it is copied. */
+static void prvTelemetryTake( HubTask_t * pxHubTask )
+{
+    uint16_t usLength;
+    uint32_t ulPosition;
+
+    prvRingRead( pxHubTask, pxHubTask->ulTelemetryTail, ( uint8_t * ) &usLength, sizeof( usLength ) );
+    ulPosition = ( pxHubTask->ulTelemetryTail + hubtaskTELEMETRY_RECORD_HEADER_SIZE ) %
+                 democonfigHUB_TASK_TELEMETRY_RING_SIZE;
+    prvRingRead( pxHubTask, ulPosition, pxHubTask->xTelemetry.ucPayload, usLength );
+    pxHubTask->xTelemetry.ulLength = usLength;
+
+    taskENTER_CRITICAL();
+    {
+        pxHubTask->ulTelemetryTail = ( ulPosition + usLength ) % democonfigHUB_TASK_TELEMETRY_RING_SIZE;
+        pxHubTask->ulTelemetryUsed -= hubtaskTELEMETRY_RECORD_HEADER_SIZE + usLength;
+        pxHubTask->ulTelemetryCount--;
+    }
+    taskEXIT_CRITICAL();
+}
+/*-----------------------------------------------------------*/
+
+/* Log the messages dropped since the last log, at most once a report period. */
+static void prvReportDropped( HubTask_t * pxHubTask )
+{
+    HubTaskTelemetryStats_t xStats;
+    TickType_t xNow = xTaskGetTickCount();
+
+    if( ( pxHubTask->xTelemetryStats.ulDropped == pxHubTask->ulDroppedReported ) ||
+        ( ( pxHubTask->ulDroppedReported != 0 ) &&
+          ( ( xNow - pxHubTask->xDropReportTick ) < pdMS_TO_TICKS( democonfigHUB_TASK_DROP_REPORT_PERIOD_MS ) ) ) )
+    {
+        return;
+    }
+
+    HubTask_GetTelemetryStats( pxHubTask, &xStats );
+    LogWarn( ( "%u telemetry messages dropped, %u of %u since the start. The ring peaked at %u of %u bytes, %u messages.\r\n",
+               ( unsigned int ) ( xStats.ulDropped - pxHubTask->ulDroppedReported ),
+               ( unsigned int ) xStats.ulDropped, ( unsigned int ) ( xStats.ulQueued + xStats.ulDropped ),
+               ( unsigned int ) xStats.ulHighWaterBytes, ( unsigned int ) democonfigHUB_TASK_TELEMETRY_RING_SIZE,
+               ( unsigned int ) xStats.ulHighWaterCount ) );
+    pxHubTask->ulDroppedReported = xStats.ulDropped;
+    pxHubTask->xDropReportTick = xNow;
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t HubTask_Init( HubTask_t * pxHubTask,
+                               AzureIoTHubClient_t * pxHubClient,
+                               HubTaskCommandHandler_t xCommandHandler,
+                               void * pvContext )
+{
+    if( ( pxHubTask == NULL ) || ( pxHubClient == NULL ) )
+    {
+        return eAzureIoTErrorInvalidArgument;
+    }
+
+    memset( pxHubTask, 0, sizeof( *pxHubTask ) );
+    pxHubTask->pxHubClient = pxHubClient;
+    pxHubTask->xCommandHandler = xCommandHandler;
+    pxHubTask->pvContext = pvContext;
+    pxHubTask->xCommandQueue = xQueueCreateStatic( democonfigHUB_TASK_COMMAND_QUEUE_LENGTH,
+                                                   sizeof( HubTaskCommand_t ),
+                                                   pxHubTask->ucCommandQueueBuffer,
+                                                   &pxHubTask->xCommandQueueStorage );
+    pxHubTask->xResponseQueue = xQueueCreateStatic( democonfigHUB_TASK_COMMAND_QUEUE_LENGTH,
+                                                    sizeof( HubTaskResponse_t ),
+                                                    pxHubTask->ucResponseQueueBuffer,
+                                                    &pxHubTask->xResponseQueueStorage );
+
+    return eAzureIoTSuccess;
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t HubTask_SendTelemetry( HubTask_t * pxHubTask,
+                                        const uint8_t * pucPayload,
+                                        uint32_t ulPayloadLength )
+{
+    uint16_t usLength = ( uint16_t ) ulPayloadLength;
+    uint32_t ulRecordLength = hubtaskTELEMETRY_RECORD_HEADER_SIZE + ulPayloadLength;
+    AzureIoTResult_t xResult = eAzureIoTErrorOutOfMemory;
+
+    if( ( pxHubTask == NULL ) || ( pucPayload == NULL ) )
+    {
+        return eAzureIoTErrorInvalidArgument;
+    }
+
+    /* The copy is all that is done in the critical section, so a producer
+     * waits at most for that of a message of the largest size. */
+    taskENTER_CRITICAL();
+    {
+        if( ( ulPayloadLength <= democonfigHUB_TASK_TELEMETRY_SIZE ) &&
+            ( ( democonfigHUB_TASK_TELEMETRY_RING_SIZE - pxHubTask->ulTelemetryUsed ) >= ulRecordLength ) )
+        {
+            prvRingCopy( pxHubTask, pxHubTask->ulTelemetryHead, ( const uint8_t * ) &usLength, sizeof( usLength ) );
+            prvRingCopy( pxHubTask, ( pxHubTask->ulTelemetryHead + hubtaskTELEMETRY_RECORD_HEADER_SIZE ) %
+                         democonfigHUB_TASK_TELEMETRY_RING_SIZE, pucPayload, ulPayloadLength );
+            pxHubTask->ulTelemetryHead = ( pxHubTask->ulTelemetryHead + ulRecordLength ) %
+                                         democonfigHUB_TASK_TELEMETRY_RING_SIZE;
+            pxHubTask->ulTelemetryUsed += ulRecordLength;
+            pxHubTask->ulTelemetryCount++;
+            pxHubTask->xTelemetryStats.ulQueued++;
+
+            if( pxHubTask->ulTelemetryUsed > pxHubTask->xTelemetryStats.ulHighWaterBytes )
+            {
+                pxHubTask->xTelemetryStats.ulHighWaterBytes = pxHubTask->ulTelemetryUsed;
+            }
+
+            if( pxHubTask->ulTelemetryCount > pxHubTask->xTelemetryStats.ulHighWaterCount )
+            {
+                pxHubTask->xTelemetryStats.ulHighWaterCount = pxHubTask->ulTelemetryCount;
+            }
+
+            xResult = eAzureIoTSuccess;
+        }
+        else
+        {
+            pxHubTask->xTelemetryStats.ulDropped++;
+        }
+    }
+    taskEXIT_CRITICAL();
+
+    return xResult;
+}
+/*-----------------------------------------------------------*/
+
+void HubTask_GetTelemetryStats( HubTask_t * pxHubTask,
+                                HubTaskTelemetryStats_t * pxStats )
+{
+    taskENTER_CRITICAL();
+    {
+        *pxStats = pxHubTask->xTelemetryStats;
+    }
+    taskEXIT_CRITICAL();
+}
+/*-----------------------------------------------------------*/
+
+void HubTask_CommandCallback( AzureIoTHubClientCommandRequest_t * pxMessage,
+                              void * pvContext )
+{
+    HubTask_t * pxHubTask = ( HubTask_t * ) pvContext;
+    HubTaskCommand_t * pxCommand = &pxHubTask->xCommand;
+    uint32_t ulStatus = hubtaskSTATUS_BUSY;
+
+    if( ( pxMessage->usRequestIDLength > sizeof( pxCommand->ucRequestID ) ) ||
+        ( pxMessage->usComponentNameLength > sizeof( pxCommand->ucComponentName ) ) ||
+        ( pxMessage->usCommandNameLength > sizeof( pxCommand->ucCommandName ) ) ||
+        ( pxMessage->ulPayloadLength > sizeof( pxCommand->ucPayload ) ) )
+    {
+        ulStatus = hubtaskSTATUS_PAYLOAD_TOO_LARGE;
+    }
+    else if( uxQueueSpacesAvailable( pxHubTask->xCommandQueue ) > 0 )
+    {
+        memcpy( pxCommand->ucRequestID, pxMessage->pucRequestID, pxMessage->usRequestIDLength );
+        pxCommand->usRequestIDLength = pxMessage->usRequestIDLength;
+        memcpy( pxCommand->ucComponentName, pxMessage->pucComponentName, pxMessage->usComponentNameLength );
+        pxCommand->usComponentNameLength = pxMessage->usComponentNameLength;
+        memcpy( pxCommand->ucCommandName, pxMessage->pucCommandName, pxMessage->usCommandNameLength );
+        pxCommand->usCommandNameLength = pxMessage->usCommandNameLength;
+        memcpy( pxCommand->ucPayload, pxMessage->pvMessagePayload, pxMessage->ulPayloadLength );
+        pxCommand->ulPayloadLength = pxMessage->ulPayloadLength;
+
+        if( xQueueSendToBack( pxHubTask->xCommandQueue, pxCommand, 0 ) == pdPASS )
+        {
+            return;
+        }
+    }
+
+    /* Answered here, in the network task, so the service is not left waiting. */
+    ( void ) AzureIoTHubClient_SendCommandResponse( pxHubTask->pxHubClient, pxMessage, ulStatus,
+                                                    ucEmptyResponse, sizeof( ucEmptyResponse ) - 1 );
+}
+/*-----------------------------------------------------------*/
+
+/* Send what was queued, then run one process loop. */
+static AzureIoTResult_t prvServeOnce( HubTask_t * pxHubTask )
+{
+    AzureIoTHubClientCommandRequest_t xRequest;
+    AzureIoTResult_t xResult;
+    uint16_t usPacketID = 0;
+    uint32_t ulCount;
+
+    taskENTER_CRITICAL();
+    {
+        ulCount = pxHubTask->ulTelemetryCount;
+    }
+    taskEXIT_CRITICAL();
+
+    /* Everything that queued up during the last process loop goes out
+     * before the next one. What is queued while it goes out waits for the
+     * next round, so busy producers do not hold off the process loop. */
+    for( ; ulCount > 0; ulCount-- )
+    {
+        prvTelemetryTake( pxHubTask );
+
+        sampletraceBEGIN( eSampleTraceTelemetrySend, pxHubTask->xTelemetry.ulLength );
+        xResult = AzureIoTHubClient_SendTelemetry( pxHubTask->pxHubClient,
+                                                   pxHubTask->xTelemetry.ucPayload,
+                                                   pxHubTask->xTelemetry.ulLength,
+                                                   NULL, eAzureIoTHubMessageQoS1, &usPacketID );
+        sampletraceEND( eSampleTraceTelemetrySend, ( xResult == eAzureIoTSuccess ) ? usPacketID : 0 );
+
+        if( xResult != eAzureIoTSuccess )
+        {
+            return xResult;
+        }
+    }
+
+    prvReportDropped( pxHubTask );
+
+    while( xQueueReceive( pxHubTask->xResponseQueue, &pxHubTask->xResponse, 0 ) == pdPASS )
+    {
+        /* A response only needs the request ID of its command. */
+        memset( &xRequest, 0, sizeof( xRequest ) );
+        xRequest.pucRequestID = pxHubTask->xResponse.ucRequestID;
+        xRequest.usRequestIDLength = pxHubTask->xResponse.usRequestIDLength;
+
+        xResult = AzureIoTHubClient_SendCommandResponse( pxHubTask->pxHubClient, &xRequest,
+                                                         pxHubTask->xResponse.ulStatus,
+                                                         pxHubTask->xResponse.ucPayload,
+                                                         pxHubTask->xResponse.ulPayloadLength );
+
+        if( xResult != eAzureIoTSuccess )
+        {
+            return xResult;
+        }
+    }
+
+    return AzureIoTHubClient_ProcessLoop( pxHubTask->pxHubClient,
+                                          democonfigHUB_TASK_PROCESS_LOOP_TIMEOUT_MS );
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t HubTask_Run( HubTask_t * pxHubTask )
+{
+    AzureIoTResult_t xResult;
+
+    if( pxHubTask == NULL )
+    {
+        return eAzureIoTErrorInvalidArgument;
+    }
+
+    do
+    {
+        xResult = prvServeOnce( pxHubTask );
+    } while( xResult == eAzureIoTSuccess );
+
+    return xResult;
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t HubTask_RunFor( HubTask_t * pxHubTask,
+                                 TickType_t xTicksToRun )
+{
+    AzureIoTResult_t xResult;
+    TimeOut_t xTimeOut;
+
+    if( pxHubTask == NULL )
+    {
+        return eAzureIoTErrorInvalidArgument;
+    }
+
+    vTaskSetTimeOutState( &xTimeOut );
+
+    do
+    {
+        xResult = prvServeOnce( pxHubTask );
+    } while( ( xResult == eAzureIoTSuccess ) &&
+             ( xTaskCheckForTimeOut( &xTimeOut, &xTicksToRun ) == pdFALSE ) );
+
+    return xResult;
+}
+/*-----------------------------------------------------------*/
+
+void HubTask_RunCommandWorker( HubTask_t * pxHubTask )
+{
+    HubTaskCommand_t xCommand;
+    HubTaskResponse_t xResponse;
+
+    for( ; ; )
+    {
+        if( xQueueReceive( pxHubTask->xCommandQueue, &xCommand, portMAX_DELAY ) != pdPASS )
+        {
+            continue;
+        }
+
+        memcpy( xResponse.ucRequestID, xCommand.ucRequestID, xCommand.usRequestIDLength );
+        xResponse.usRequestIDLength = xCommand.usRequestIDLength;
+        xResponse.ulPayloadLength = 0;
+
+        if( pxHubTask->xCommandHandler != NULL )
+        {
+            xResponse.ulStatus = pxHubTask->xCommandHandler( &xCommand, xResponse.ucPayload,
+                                                             sizeof( xResponse.ucPayload ),
+                                                             &xResponse.ulPayloadLength,
+                                                             pxHubTask->pvContext );
+        }
+        else
+        {
+            xResponse.ulStatus = hubtaskSTATUS_NOT_FOUND;
+        }
+
+        /* The service needs a JSON payload, even for an empty response. */
+        if( ( xResponse.ulPayloadLength == 0 ) || ( xResponse.ulPayloadLength > sizeof( xResponse.ucPayload ) ) )
+        {
+            memcpy( xResponse.ucPayload, ucEmptyResponse, sizeof( ucEmptyResponse ) - 1 );
+            xResponse.ulPayloadLength = sizeof( ucEmptyResponse ) - 1;
+        }
+
+        ( void ) xQueueSendToBack( pxHubTask->xResponseQueue, &xResponse, portMAX_DELAY );
+    }
+}
+/*-----------------------------------------------------------*/
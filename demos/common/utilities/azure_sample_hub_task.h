@@ -0,0 +1,249 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @file azure_sample_hub_task.h
+ *
+ * @brief A hub client owned by one network task and used by others through queues.
+ *
+ * The AzureIoTHubClient_* API is not thread safe, so only the network task
+ * calls it, from HubTask_Run(). Other tasks reach the client through queues:
+ * - Producer tasks call HubTask_SendTelemetry(), which copies the serialized
+ *   payload into a ring and returns without waiting, for the network or for
+ *   room in the ring.
+ * - HubTask_CommandCallback() copies each command into a queue for worker
+ *   tasks running HubTask_RunCommandWorker(), and their responses come back
+ *   through another queue, so a slow command handler holds up neither the
+ *   process loop nor telemetry.
+ *
+ * Queued telemetry and responses are sent between process loop calls, so
+ * they wait at most democonfigHUB_TASK_PROCESS_LOOP_TIMEOUT_MS. All queues are
+ * statically allocated in the HubTask_t.
+ *
+ * The telemetry ring holds each message in as many bytes as it has, so it
+ * takes many short readings or a few long ones. A producer copies its message
+ * in within a critical section, which is the longest it is held up, however
+ * stalled the network is. A message that finds the ring full is dropped and
+ * counted. The network task logs the drops, with the high-water marks of the
+ * ring, and HubTask_GetTelemetryStats() gives them to any task.
+ */
+
+#ifndef AZURE_SAMPLE_HUB_TASK_H
+#define AZURE_SAMPLE_HUB_TASK_H
+
+#include <stdint.h>
+
+#include "FreeRTOS.h"
+#include "queue.h"
+
+#include "azure_iot_hub_client.h"
+
+/**
+ * @brief Bytes of the ring of the telemetry waiting for the network task,
+ * hubtaskTELEMETRY_RECORD_HEADER_SIZE more than its payload for each message.
+ */
+#ifndef democonfigHUB_TASK_TELEMETRY_RING_SIZE
+    #define democonfigHUB_TASK_TELEMETRY_RING_SIZE       1024
+#endif
+
+/**
+ * @brief Largest telemetry payload that can be queued.
+ */
+#ifndef democonfigHUB_TASK_TELEMETRY_SIZE
+    #define democonfigHUB_TASK_TELEMETRY_SIZE            128
+#endif
+
+/**
+ * @brief Commands that can wait for a worker task, and responses for the network task.
+ */
+#ifndef democonfigHUB_TASK_COMMAND_QUEUE_LENGTH
+    #define democonfigHUB_TASK_COMMAND_QUEUE_LENGTH      2
+#endif
+
+/**
+ * @brief Largest command payload, and largest command response payload.
+ */
+#ifndef democonfigHUB_TASK_COMMAND_PAYLOAD_SIZE
+    #define democonfigHUB_TASK_COMMAND_PAYLOAD_SIZE      128
+#endif
+
+/**
+ * @brief Process loop timeout of the network task, in milliseconds.
+ */
+#ifndef democonfigHUB_TASK_PROCESS_LOOP_TIMEOUT_MS
+    #define democonfigHUB_TASK_PROCESS_LOOP_TIMEOUT_MS    100
+#endif
+
+/**
+ * @brief Shortest time between two logs of dropped telemetry, in milliseconds.
+ */
+#ifndef democonfigHUB_TASK_DROP_REPORT_PERIOD_MS
+    #define democonfigHUB_TASK_DROP_REPORT_PERIOD_MS      10000
+#endif
+
+#define hubtaskREQUEST_ID_SIZE                 32
+#define hubtaskNAME_SIZE                       32
+#define hubtaskTELEMETRY_RECORD_HEADER_SIZE    sizeof( uint16_t )
+
+typedef struct HubTaskTelemetry
+{
+    uint32_t ulLength;
+    uint8_t ucPayload[ democonfigHUB_TASK_TELEMETRY_SIZE ];
+} HubTaskTelemetry_t;
+
+/**
+ * @brief What went through the telemetry ring since HubTask_Init().
+ */
+typedef struct HubTaskTelemetryStats
+{
+    uint32_t ulQueued;         /* Messages queued. */
+    uint32_t ulDropped;        /* Messages that found the ring full, or were too large. */
+    uint32_t ulHighWaterBytes; /* Most bytes of the ring in use at once. */
+    uint32_t ulHighWaterCount; /* Most messages in the ring at once. */
+} HubTaskTelemetryStats_t;
+
+/**
+ * @brief A command copied out of the MQTT buffer for a worker task.
+ */
+typedef struct HubTaskCommand
+{
+    uint8_t ucRequestID[ hubtaskREQUEST_ID_SIZE ];
+    uint16_t usRequestIDLength;
+    uint8_t ucComponentName[ hubtaskNAME_SIZE ];
+    uint16_t usComponentNameLength;
+    uint8_t ucCommandName[ hubtaskNAME_SIZE ];
+    uint16_t usCommandNameLength;
+    uint8_t ucPayload[ democonfigHUB_TASK_COMMAND_PAYLOAD_SIZE ];
+    uint32_t ulPayloadLength;
+} HubTaskCommand_t;
+
+typedef struct HubTaskResponse
+{
+    uint8_t ucRequestID[ hubtaskREQUEST_ID_SIZE ];
+    uint16_t usRequestIDLength;
+    uint32_t ulStatus;
+    uint8_t ucPayload[ democonfigHUB_TASK_COMMAND_PAYLOAD_SIZE ];
+    uint32_t ulPayloadLength;
+} HubTaskResponse_t;
+
+/**
+ * @brief Handles a command in a worker task.
+ *
+ * @param[in] pxCommand The command.
+ * @param[out] pucResponse Buffer for the response payload, which must be JSON.
+ * @param[in] ulResponseSize Size of \p pucResponse.
+ * @param[out] pulResponseLength Length of the response payload.
+ * @param[in] pvContext Context passed to HubTask_Init().
+ * @return The status code of the response.
+ */
+typedef uint32_t ( * HubTaskCommandHandler_t )( const HubTaskCommand_t * pxCommand,
+                                                uint8_t * pucResponse,
+                                                uint32_t ulResponseSize,
+                                                uint32_t * pulResponseLength,
+                                                void * pvContext );
+
+typedef struct HubTask
+{
+    AzureIoTHubClient_t * pxHubClient;
+    HubTaskCommandHandler_t xCommandHandler;
+    void * pvContext;
+    /* Ring of the telemetry, each message its length on
+     * hubtaskTELEMETRY_RECORD_HEADER_SIZE bytes then its payload. The
+     * producers move the head, and the network task the tail, in a
+     * critical section. */
+    uint8_t ucTelemetryRing[ democonfigHUB_TASK_TELEMETRY_RING_SIZE ];
+    uint32_t ulTelemetryHead;
+    uint32_t ulTelemetryTail;
+    uint32_t ulTelemetryUsed;
+    uint32_t ulTelemetryCount;
+    HubTaskTelemetryStats_t xTelemetryStats;
+    QueueHandle_t xCommandQueue;
+    QueueHandle_t xResponseQueue;
+    StaticQueue_t xCommandQueueStorage;
+    StaticQueue_t xResponseQueueStorage;
+    uint8_t ucCommandQueueBuffer[ democonfigHUB_TASK_COMMAND_QUEUE_LENGTH * sizeof( HubTaskCommand_t ) ];
+    uint8_t ucResponseQueueBuffer[ democonfigHUB_TASK_COMMAND_QUEUE_LENGTH * sizeof( HubTaskResponse_t ) ];
+    /* Scratch items, used by the network task only. */
+    HubTaskTelemetry_t xTelemetry;
+    HubTaskCommand_t xCommand;
+    HubTaskResponse_t xResponse;
+    uint32_t ulDroppedReported; /* Drops the network task logged. */
+    TickType_t xDropReportTick; /* When it last logged some. */
+} HubTask_t;
+
+/**
+ * @brief Initialize a hub task, before any of the tasks using it start.
+ *
+ * @param[out] pxHubTask The hub task to initialize.
+ * @param[in] pxHubClient Client owned by the network task.
+ * @param[in] xCommandHandler Called by the command workers for each command, or NULL.
+ * @param[in] pvContext Passed to \p xCommandHandler.
+ * @return An #AzureIoTResult_t with the result of the operation.
+ */
+AzureIoTResult_t HubTask_Init( HubTask_t * pxHubTask,
+                               AzureIoTHubClient_t * pxHubClient,
+                               HubTaskCommandHandler_t xCommandHandler,
+                               void * pvContext );
+
+/**
+ * @brief Queue a telemetry message, from any task but not an interrupt.
+ *
+ * Never blocks. The message is dropped and counted if the ring is full.
+ *
+ * @param[in] pxHubTask The hub task.
+ * @param[in] pucPayload The serialized payload, copied into the ring.
+ * @param[in] ulPayloadLength Length of \p pucPayload, at most
+ * democonfigHUB_TASK_TELEMETRY_SIZE.
+ * @return eAzureIoTErrorOutOfMemory if the message was dropped.
+ */
+AzureIoTResult_t HubTask_SendTelemetry( HubTask_t * pxHubTask,
+                                        const uint8_t * pucPayload,
+                                        uint32_t ulPayloadLength );
+
+/**
+ * @brief Get what went through the telemetry ring, from any task.
+ *
+ * @param[in] pxHubTask The hub task.
+ * @param[out] pxStats The counts and high-water marks since HubTask_Init().
+ */
+void HubTask_GetTelemetryStats( HubTask_t * pxHubTask,
+                                HubTaskTelemetryStats_t * pxStats );
+
+/**
+ * @brief Command callback to subscribe with, with the HubTask_t as context.
+ *
+ * Commands that do not fit a HubTaskCommand_t, or that find the queue full,
+ * are answered straight away with status 413 or 503.
+ */
+void HubTask_CommandCallback( AzureIoTHubClientCommandRequest_t * pxMessage,
+                              void * pvContext );
+
+/**
+ * @brief Serve the connected client until it fails. Call from the network task only.
+ *
+ * @param[in] pxHubTask The hub task.
+ * @return The error that stopped the loop.
+ */
+AzureIoTResult_t HubTask_Run( HubTask_t * pxHubTask );
+
+/**
+ * @brief Serve the connected client for a while. Call from the network task only.
+ *
+ * Lets the network task do other work between calls, such as renewing the
+ * connection, while telemetry keeps going out.
+ *
+ * @param[in] pxHubTask The hub task.
+ * @param[in] xTicksToRun How long to serve the client, at least one process loop.
+ * @return eAzureIoTSuccess once the time is up, else the error that stopped the loop.
+ */
+AzureIoTResult_t HubTask_RunFor( HubTask_t * pxHubTask,
+                                 TickType_t xTicksToRun );
+
+/**
+ * @brief Handle commands forever. Call from each command worker task.
+ *
+ * @param[in] pxHubTask The hub task.
+ */
+void HubTask_RunCommandWorker( HubTask_t * pxHubTask );
+
+#endif /* AZURE_SAMPLE_HUB_TASK_H */
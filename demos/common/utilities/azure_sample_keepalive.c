@@ -0,0 +1,221 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+#include "azure_sample_keepalive.h"
+
+#include <stddef.h>
+#include <string.h>
+
+/* Built into the samples whether the keepalive is learnt or not. */
+#if ( democonfigADAPTIVE_KEEPALIVE == 1 )
+
+#define keepaliveMAGIC    0x4B414C56UL
+
+/* Only used by one task at a time, the one connecting to IoT Hub. */
+static KeepAliveRecord_t xRecord;
+static bool xRecordLoaded;
+static KeepAliveNetwork_t * pxSelected;
+static uint16_t usSelectedSeconds = democonfigKEEPALIVE_START_SECONDS;
+/*-----------------------------------------------------------*/
+
+static uint32_t prvCrc32( const uint8_t * pucData,
+                          uint32_t ulLength )
+{
+    uint32_t ulCrc = 0xFFFFFFFFU;
+    uint32_t ulBit;
+
+    while( ulLength-- > 0 )
+    {
+        ulCrc ^= *pucData++;
+
+        for( ulBit = 0; ulBit < 8; ulBit++ )
+        {
+            ulCrc = ( ulCrc >> 1 ) ^ ( 0xEDB88320U & ( 0U - ( ulCrc & 1U ) ) );
+        }
+    }
+
+    return ~ulCrc;
+}
+/*-----------------------------------------------------------*/
+
+static uint32_t prvRecordChecksum( const KeepAliveRecord_t * pxKeepAliveRecord )
+{
+    return prvCrc32( ( const uint8_t * ) pxKeepAliveRecord, offsetof( KeepAliveRecord_t, ulChecksum ) );
+}
+/*-----------------------------------------------------------*/
+
+static void prvLoadRecord( void )
+{
+    if( ( KeepAlive_PlatformRead( &xRecord ) != eAzureIoTSuccess ) ||
+        ( xRecord.ulMagic != keepaliveMAGIC ) ||
+        ( xRecord.ulChecksum != prvRecordChecksum( &xRecord ) ) )
+    {
+        memset( &xRecord, 0, sizeof( xRecord ) );
+        xRecord.ulMagic = keepaliveMAGIC;
+    }
+
+    xRecordLoaded = true;
+}
+/*-----------------------------------------------------------*/
+
+static KeepAliveNetwork_t * prvFindNetwork( uint32_t ulNetworkID )
+{
+    KeepAliveNetwork_t * pxOldest = &xRecord.xNetworks[ 0 ];
+    uint32_t ulIndex;
+
+    for( ulIndex = 0; ulIndex < democonfigKEEPALIVE_NETWORKS; ulIndex++ )
+    {
+        if( xRecord.xNetworks[ ulIndex ].ulNetworkID == ulNetworkID )
+        {
+            return &xRecord.xNetworks[ ulIndex ];
+        }
+
+        /* Unused entries are the oldest, as they were never used. */
+        if( xRecord.xNetworks[ ulIndex ].ulLastUsed < pxOldest->ulLastUsed )
+        {
+            pxOldest = &xRecord.xNetworks[ ulIndex ];
+        }
+    }
+
+    memset( pxOldest, 0, sizeof( *pxOldest ) );
+    pxOldest->ulNetworkID = ulNetworkID;
+
+    return pxOldest;
+}
+/*-----------------------------------------------------------*/
+
+/* Half as much again as the keepalive that survived, but below the one that
+ * failed, halving the gap between them until it is within an eighth. */
+static uint16_t prvNextSeconds( const KeepAliveNetwork_t * pxNetwork )
+{
+    uint32_t ulSurvived = pxNetwork->usSurvivedSeconds;
+    uint32_t ulFailed = pxNetwork->usFailedSeconds;
+    uint32_t ulNext;
+
+    if( ulSurvived == 0 )
+    {
+        ulNext = democonfigKEEPALIVE_START_SECONDS;
+    }
+    else
+    {
+        ulNext = ulSurvived + ( ulSurvived / 2U );
+    }
+
+    if( ulNext > democonfigKEEPALIVE_MAX_SECONDS )
+    {
+        ulNext = democonfigKEEPALIVE_MAX_SECONDS;
+    }
+
+    if( ( ulFailed != 0 ) && ( ulNext >= ulFailed ) )
+    {
+        if( ulSurvived == 0 )
+        {
+            ulNext = ulFailed - ( ulFailed / 3U );
+        }
+        else if( ( ( ulFailed - ulSurvived ) / 2U ) > ( ulSurvived / 8U ) )
+        {
+            ulNext = ulSurvived + ( ( ulFailed - ulSurvived ) / 2U );
+        }
+        else
+        {
+            ulNext = ulSurvived;
+        }
+    }
+
+    if( ulNext < democonfigKEEPALIVE_MIN_SECONDS )
+    {
+        ulNext = democonfigKEEPALIVE_MIN_SECONDS;
+    }
+
+    return ( uint16_t ) ulNext;
+}
+/*-----------------------------------------------------------*/
+
+void KeepAlive_Select( void )
+{
+    uint8_t ucNetworkID[ democonfigKEEPALIVE_NETWORK_ID_SIZE ];
+    uint32_t ulNetworkIDLength = sizeof( ucNetworkID );
+    uint32_t ulNetworkID;
+
+    if( !xRecordLoaded )
+    {
+        prvLoadRecord();
+    }
+
+    if( KeepAlive_PlatformNetworkID( ucNetworkID, &ulNetworkIDLength ) != eAzureIoTSuccess )
+    {
+        /* Nothing is learnt about a network that cannot be told apart. */
+        pxSelected = NULL;
+        usSelectedSeconds = democonfigKEEPALIVE_START_SECONDS;
+
+        return;
+    }
+
+    /* 0 marks an unused entry. */
+    ulNetworkID = prvCrc32( ucNetworkID, ulNetworkIDLength );
+
+    if( ulNetworkID == 0 )
+    {
+        ulNetworkID = 1;
+    }
+
+    pxSelected = prvFindNetwork( ulNetworkID );
+    pxSelected->ulLastUsed = ++xRecord.ulLastUsed;
+    usSelectedSeconds = prvNextSeconds( pxSelected );
+}
+/*-----------------------------------------------------------*/
+
+uint16_t KeepAlive_Seconds( void )
+{
+    return usSelectedSeconds;
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t KeepAlive_Report( uint32_t ulUpSeconds,
+                                   bool xLost )
+{
+    uint32_t ulSeconds = usSelectedSeconds;
+
+    if( pxSelected == NULL )
+    {
+        return eAzureIoTSuccess;
+    }
+
+    if( ulUpSeconds >= ( democonfigKEEPALIVE_CONFIRM_PERIODS * ulSeconds ) )
+    {
+        if( ulSeconds <= pxSelected->usSurvivedSeconds )
+        {
+            return eAzureIoTSuccess;
+        }
+
+        pxSelected->usSurvivedSeconds = ( uint16_t ) ulSeconds;
+
+        /* The network changed behind the same ID. */
+        if( pxSelected->usFailedSeconds <= ulSeconds )
+        {
+            pxSelected->usFailedSeconds = 0;
+        }
+    }
+    else if( xLost && ( ulUpSeconds >= ulSeconds ) )
+    {
+        /* A connection lost within its first keepalive went idle for less
+         * than it, so it is not the keepalive that lost it. */
+        pxSelected->usFailedSeconds = ( uint16_t ) ulSeconds;
+
+        if( pxSelected->usSurvivedSeconds >= ulSeconds )
+        {
+            pxSelected->usSurvivedSeconds = 0;
+        }
+    }
+    else
+    {
+        return eAzureIoTSuccess;
+    }
+
+    xRecord.ulChecksum = prvRecordChecksum( &xRecord );
+
+    return KeepAlive_PlatformWrite( &xRecord );
+}
+/*-----------------------------------------------------------*/
+
+#endif /* democonfigADAPTIVE_KEEPALIVE == 1 */
@@ -0,0 +1,159 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @file azure_sample_keepalive.h
+ *
+ * @brief The MQTT keepalive learnt per network, kept across reboots.
+ *
+ * With democonfigADAPTIVE_KEEPALIVE set to 1, by the SAMPLE_ADAPTIVE_KEEPALIVE
+ * CMake option, the config of the board takes the keepalive of the hub client
+ * from KeepAlive_Seconds(). A NAT drops the mapping of a connection idle for
+ * longer than its timeout, which may be as short as a minute on some networks
+ * and half an hour on others, so no fixed keepalive suits all of them.
+ *
+ * Before each connect, KeepAlive_Select() picks the keepalive of the current
+ * network: the largest that a connection already survived on it or, until
+ * one failed, half as much again to probe the next. Once a connection has
+ * been up for democonfigKEEPALIVE_CONFIRM_PERIODS keepalives,
+ * KeepAlive_Report() takes it as survived, and a connection lost sooner as
+ * too long, which then backs off. Each board stores the record, the networks
+ * least recently used being replaced, by implementing KeepAlive_PlatformRead()
+ * and KeepAlive_PlatformWrite(), and tells the networks apart by implementing
+ * KeepAlive_PlatformNetworkID().
+ *
+ * coreMQTT only pings after a keepalive without any packet sent, so telemetry
+ * sent more often already keeps the mapping and no ping goes out.
+ */
+
+#ifndef AZURE_SAMPLE_KEEPALIVE_H
+#define AZURE_SAMPLE_KEEPALIVE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "azure_iot_result.h"
+
+/**
+ * @brief 1 to learn the keepalive, set by the SAMPLE_ADAPTIVE_KEEPALIVE
+ * CMake option.
+ */
+#ifndef democonfigADAPTIVE_KEEPALIVE
+    #define democonfigADAPTIVE_KEEPALIVE    0
+#endif
+
+/**
+ * @brief Keepalive of a network not seen before, in seconds.
+ */
+#ifndef democonfigKEEPALIVE_START_SECONDS
+    #define democonfigKEEPALIVE_START_SECONDS    ( 4U * 60U )
+#endif
+
+/**
+ * @brief Shortest keepalive, in seconds, that a network backs off to.
+ */
+#ifndef democonfigKEEPALIVE_MIN_SECONDS
+    #define democonfigKEEPALIVE_MIN_SECONDS    ( 30U )
+#endif
+
+/**
+ * @brief Longest keepalive, in seconds, below the 1767 seconds of IoT Hub.
+ */
+#ifndef democonfigKEEPALIVE_MAX_SECONDS
+    #define democonfigKEEPALIVE_MAX_SECONDS    ( 28U * 60U )
+#endif
+
+/**
+ * @brief Keepalives a connection is up for before its keepalive is taken as survived.
+ */
+#ifndef democonfigKEEPALIVE_CONFIRM_PERIODS
+    #define democonfigKEEPALIVE_CONFIRM_PERIODS    ( 3U )
+#endif
+
+/**
+ * @brief Networks remembered.
+ */
+#ifndef democonfigKEEPALIVE_NETWORKS
+    #define democonfigKEEPALIVE_NETWORKS    ( 4U )
+#endif
+
+/**
+ * @brief Largest network ID from KeepAlive_PlatformNetworkID().
+ */
+#ifndef democonfigKEEPALIVE_NETWORK_ID_SIZE
+    #define democonfigKEEPALIVE_NETWORK_ID_SIZE    ( 64U )
+#endif
+
+typedef struct KeepAliveNetwork
+{
+    uint32_t ulNetworkID;       /* CRC32 of the network ID, 0 for an unused entry. */
+    uint32_t ulLastUsed;        /* Order of the selections, to replace the least recent. */
+    uint16_t usSurvivedSeconds; /* Largest keepalive a connection survived. */
+    uint16_t usFailedSeconds;   /* Smallest keepalive a connection was lost with, 0 for none. */
+} KeepAliveNetwork_t;
+
+typedef struct KeepAliveRecord
+{
+    uint32_t ulMagic;
+    uint32_t ulLastUsed;
+    KeepAliveNetwork_t xNetworks[ democonfigKEEPALIVE_NETWORKS ];
+    uint32_t ulChecksum; /* CRC32 of everything before it. */
+    uint32_t ulReserved; /* Keeps the size a multiple of 8 for double word programming. */
+} KeepAliveRecord_t;
+
+/**
+ * @brief Pick the keepalive of the current network, for the next connect.
+ *
+ * A record that cannot be read starts over with the keepalive of a new network.
+ */
+void KeepAlive_Select( void );
+
+/**
+ * @brief Keepalive of the connection, in seconds, used by the config of the board.
+ *
+ * @return The keepalive picked by KeepAlive_Select(), or democonfigKEEPALIVE_START_SECONDS.
+ */
+uint16_t KeepAlive_Seconds( void );
+
+/**
+ * @brief Learn from how long a connection with the picked keepalive lasted.
+ *
+ * @param[in] ulUpSeconds Time the connection was up, in seconds.
+ * @param[in] xLost true if it was lost, false if closed by the device.
+ * @return An #AzureIoTResult_t with the result of storing what was learnt.
+ */
+AzureIoTResult_t KeepAlive_Report( uint32_t ulUpSeconds,
+                                   bool xLost );
+
+/**
+ * @brief Get the ID of the current network. Implemented by each board.
+ *
+ * Such as the SSID and BSSID of the access point, or the address of the gateway.
+ *
+ * @param[out] pucNetworkID Buffer for the ID.
+ * @param[in,out] pulNetworkIDLength Size of \p pucNetworkID, then the ID length.
+ * @return An #AzureIoTResult_t with the result of the operation.
+ */
+AzureIoTResult_t KeepAlive_PlatformNetworkID( uint8_t * pucNetworkID,
+                                              uint32_t * pulNetworkIDLength );
+
+/**
+ * @brief Read the stored record. Implemented by each board.
+ *
+ * Storage that was never written may return anything, as the record is
+ * checked before it is used.
+ *
+ * @param[out] pxRecord The record.
+ * @return An #AzureIoTResult_t with the result of the operation.
+ */
+AzureIoTResult_t KeepAlive_PlatformRead( KeepAliveRecord_t * pxRecord );
+
+/**
+ * @brief Replace the stored record. Implemented by each board.
+ *
+ * @param[in] pxRecord The record.
+ * @return An #AzureIoTResult_t with the result of the operation.
+ */
+AzureIoTResult_t KeepAlive_PlatformWrite( const KeepAliveRecord_t * pxRecord );
+
+#endif /* AZURE_SAMPLE_KEEPALIVE_H */
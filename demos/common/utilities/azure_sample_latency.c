@@ -0,0 +1,63 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+#include "azure_sample_latency.h"
+
+#include <string.h>
+/*-----------------------------------------------------------*/
+
+void LatencyHistogram_Reset( LatencyHistogram_t * pxHistogram )
+{
+    ( void ) memset( pxHistogram, 0, sizeof( *pxHistogram ) );
+}
+/*-----------------------------------------------------------*/
+
+void LatencyHistogram_Add( LatencyHistogram_t * pxHistogram,
+                           TickType_t xLatency )
+{
+    uint32_t ulLatencyMs = ( uint32_t ) ( ( uint64_t ) xLatency * 1000U / configTICK_RATE_HZ );
+    uint32_t ulBucket = ulLatencyMs / democonfigLATENCY_BUCKET_MS;
+
+    if( ulBucket >= democonfigLATENCY_BUCKETS )
+    {
+        ulBucket = democonfigLATENCY_BUCKETS - 1U;
+    }
+
+    pxHistogram->ulBuckets[ ulBucket ]++;
+    pxHistogram->ulCount++;
+
+    if( ulLatencyMs > pxHistogram->ulMaxMs )
+    {
+        pxHistogram->ulMaxMs = ulLatencyMs;
+    }
+}
+/*-----------------------------------------------------------*/
+
+uint32_t LatencyHistogram_Percentile( const LatencyHistogram_t * pxHistogram,
+                                      uint32_t ulPercentile )
+{
+    uint64_t ullRank;
+    uint64_t ullSeen = 0;
+    uint32_t ulBucket;
+
+    if( pxHistogram->ulCount == 0U )
+    {
+        return 0U;
+    }
+
+    /* Rank of the sample at the percentile, rounded up. */
+    ullRank = ( ( uint64_t ) pxHistogram->ulCount * ulPercentile + 99U ) / 100U;
+
+    for( ulBucket = 0; ulBucket < democonfigLATENCY_BUCKETS - 1U; ulBucket++ )
+    {
+        ullSeen += pxHistogram->ulBuckets[ ulBucket ];
+
+        if( ullSeen >= ullRank )
+        {
+            return ( ulBucket + 1U ) * democonfigLATENCY_BUCKET_MS;
+        }
+    }
+
+    return pxHistogram->ulMaxMs;
+}
+/*-----------------------------------------------------------*/
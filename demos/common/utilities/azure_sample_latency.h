@@ -0,0 +1,90 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @file azure_sample_latency.h
+ *
+ * @brief Histogram of publish to PUBACK latencies, for percentile summaries.
+ *
+ * With democonfigLATENCY_MEASUREMENT set, a sample sends each telemetry
+ * message on its own with a sequence number and the device uptime in its
+ * properties, and adds the round trip of each PUBACK to a histogram. The
+ * summary it logs then gives the device side of the latency, and the
+ * properties let the cloud side be matched against it message by message.
+ *
+ * A LatencyHistogram_t is not thread safe; it is used by one task.
+ */
+
+#ifndef AZURE_SAMPLE_LATENCY_H
+#define AZURE_SAMPLE_LATENCY_H
+
+#include <stdint.h>
+
+#include "FreeRTOS.h"
+
+/**
+ * @brief 1 to stamp the telemetry and report its latency percentiles.
+ *
+ * Messages are then not batched, so each has its own latency.
+ */
+#ifndef democonfigLATENCY_MEASUREMENT
+    #define democonfigLATENCY_MEASUREMENT    0
+#endif
+
+/**
+ * @brief Time between two latency summaries, in milliseconds.
+ */
+#ifndef democonfigLATENCY_REPORT_INTERVAL_MS
+    #define democonfigLATENCY_REPORT_INTERVAL_MS    ( 60 * 1000U )
+#endif
+
+/**
+ * @brief Width of a bucket of the histogram, in milliseconds.
+ */
+#ifndef democonfigLATENCY_BUCKET_MS
+    #define democonfigLATENCY_BUCKET_MS    ( 10U )
+#endif
+
+/**
+ * @brief Buckets of the histogram. Latencies past the last one count in it.
+ */
+#ifndef democonfigLATENCY_BUCKETS
+    #define democonfigLATENCY_BUCKETS    ( 256U )
+#endif
+
+typedef struct LatencyHistogram
+{
+    uint32_t ulBuckets[ democonfigLATENCY_BUCKETS ];
+    uint32_t ulCount;
+    uint32_t ulMaxMs;
+} LatencyHistogram_t;
+
+/**
+ * @brief Empty a histogram, such as after a summary.
+ *
+ * @param[out] pxHistogram The histogram.
+ */
+void LatencyHistogram_Reset( LatencyHistogram_t * pxHistogram );
+
+/**
+ * @brief Add a latency measured in ticks.
+ *
+ * @param[in] pxHistogram The histogram.
+ * @param[in] xLatency The latency, in ticks.
+ */
+void LatencyHistogram_Add( LatencyHistogram_t * pxHistogram,
+                           TickType_t xLatency );
+
+/**
+ * @brief Get a percentile, as the upper edge of the bucket it falls in.
+ *
+ * A percentile in the last bucket is the largest latency added.
+ *
+ * @param[in] pxHistogram The histogram.
+ * @param[in] ulPercentile The percentile, from 1 to 100.
+ * @return The latency in milliseconds, or 0 when the histogram is empty.
+ */
+uint32_t LatencyHistogram_Percentile( const LatencyHistogram_t * pxHistogram,
+                                      uint32_t ulPercentile );
+
+#endif /* AZURE_SAMPLE_LATENCY_H */
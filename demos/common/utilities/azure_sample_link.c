@@ -0,0 +1,38 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+#include "azure_sample_link.h"
+
+/* Written by the task of the link events only, and read by any task. A
+ * 32 bit read is atomic on the boards. */
+static volatile bool xLinkUp = true;
+static volatile uint32_t ulLinkLosses;
+/*-----------------------------------------------------------*/
+
+void Link_Report( bool xUp )
+{
+    if( xUp == xLinkUp )
+    {
+        return;
+    }
+
+    if( !xUp )
+    {
+        ulLinkLosses++;
+    }
+
+    xLinkUp = xUp;
+}
+/*-----------------------------------------------------------*/
+
+bool Link_IsUp( void )
+{
+    return xLinkUp;
+}
+/*-----------------------------------------------------------*/
+
+uint32_t Link_Losses( void )
+{
+    return ulLinkLosses;
+}
+/*-----------------------------------------------------------*/
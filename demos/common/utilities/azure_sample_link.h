@@ -0,0 +1,53 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @file azure_sample_link.h
+ *
+ * @brief The state of the network link of the board, so that the connections
+ * made over a link that was lost fail at once.
+ *
+ * A TCP connection does not notice that the access point went away: reads
+ * just time out, and the sample only reconnects once its TLS receive or the
+ * MQTT keepalive times out. The board reports its link events to
+ * Link_Report(), and a transport keeps Link_Losses() when it connects. Once
+ * the count changed, the transport fails its sends and receives, so that the
+ * process loop of the sample returns an error and its reconnect starts right
+ * away.
+ *
+ * The link of a board that reports nothing is up, and never lost.
+ */
+
+#ifndef AZURE_SAMPLE_LINK_H
+#define AZURE_SAMPLE_LINK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * @brief Report the link going up or down. Called by the board, such as from
+ * its Wi-Fi events.
+ *
+ * Reporting the same state again does nothing.
+ *
+ * @param[in] xUp true once the link is up with an address, false once it is lost.
+ */
+void Link_Report( bool xUp );
+
+/**
+ * @brief Whether the link is up.
+ *
+ * @return true if the link is up.
+ */
+bool Link_IsUp( void );
+
+/**
+ * @brief Number of times the link was lost since boot.
+ *
+ * A connection made while this was N is over the lost link once it is not N.
+ *
+ * @return The number of losses.
+ */
+uint32_t Link_Losses( void );
+
+#endif /* AZURE_SAMPLE_LINK_H */
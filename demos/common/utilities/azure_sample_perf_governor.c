@@ -0,0 +1,68 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+#include "azure_sample_perf_governor.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* FreeRTOS includes. */
+#include "FreeRTOS.h"
+#include "semphr.h"
+
+static PerfGovernorSetLevel_t xGovernorSetLevel;
+static uint32_t ulBoosts; /* Crypto phases running. */
+
+/* Held while the count changes and the clock follows it, so that the clock
+ * of the board always matches the count. */
+static StaticSemaphore_t xGovernorMutexBuffer;
+static SemaphoreHandle_t xGovernorMutex;
+/*-----------------------------------------------------------*/
+
+void PerfGovernor_Init( PerfGovernorSetLevel_t xSetLevel )
+{
+    xGovernorMutex = xSemaphoreCreateMutexStatic( &xGovernorMutexBuffer );
+    ulBoosts = 0;
+    xGovernorSetLevel = xSetLevel;
+
+    xGovernorSetLevel( ePerfLevelLow );
+}
+/*-----------------------------------------------------------*/
+
+void PerfGovernor_Boost( void )
+{
+    if( xGovernorSetLevel == NULL )
+    {
+        return;
+    }
+
+    ( void ) xSemaphoreTake( xGovernorMutex, portMAX_DELAY );
+
+    if( ulBoosts++ == 0U )
+    {
+        xGovernorSetLevel( ePerfLevelHigh );
+    }
+
+    ( void ) xSemaphoreGive( xGovernorMutex );
+}
+/*-----------------------------------------------------------*/
+
+void PerfGovernor_Release( void )
+{
+    if( xGovernorSetLevel == NULL )
+    {
+        return;
+    }
+
+    ( void ) xSemaphoreTake( xGovernorMutex, portMAX_DELAY );
+
+    configASSERT( ulBoosts > 0U );
+
+    if( ( ulBoosts > 0U ) && ( --ulBoosts == 0U ) )
+    {
+        xGovernorSetLevel( ePerfLevelLow );
+    }
+
+    ( void ) xSemaphoreGive( xGovernorMutex );
+}
+/*-----------------------------------------------------------*/
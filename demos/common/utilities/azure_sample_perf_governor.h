@@ -0,0 +1,73 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @file azure_sample_perf_governor.h
+ *
+ * @brief The CPU clock at its peak only while the crypto of the samples runs.
+ *
+ * Most of the time a sample waits for the next telemetry, when a low clock
+ * costs it nothing. The TLS handshake, the JWS check of an update manifest
+ * and the hash of an update image are the few phases that keep the CPU busy.
+ * They are marked with perfgovernorBOOST() and perfgovernorRELEASE(), and the
+ * board raises the clock while at least one of them runs, through the
+ * PerfGovernorSetLevel_t given to PerfGovernor_Init().
+ *
+ * By default the macros compile to nothing. A board that can change its
+ * clock sets democonfigPERF_GOVERNOR to 1, and calls PerfGovernor_Init()
+ * before the samples start. The functions can be called from any task, not
+ * from an interrupt.
+ */
+
+#ifndef AZURE_SAMPLE_PERF_GOVERNOR_H
+#define AZURE_SAMPLE_PERF_GOVERNOR_H
+
+/**
+ * @brief Set to 1 by the boards that scale their clock.
+ */
+#ifndef democonfigPERF_GOVERNOR
+    #define democonfigPERF_GOVERNOR    0
+#endif
+
+typedef enum PerfLevel
+{
+    ePerfLevelLow = 0, /* Nothing busy, the clock of the idle telemetry wait. */
+    ePerfLevelHigh     /* A crypto phase runs, the peak clock. */
+} PerfLevel_t;
+
+/**
+ * @brief Sets the clock of the board, waiting until it runs at the level.
+ *
+ * @param[in] xLevel The level.
+ */
+typedef void ( * PerfGovernorSetLevel_t )( PerfLevel_t xLevel );
+
+#if ( democonfigPERF_GOVERNOR == 1 )
+    #define perfgovernorBOOST()      PerfGovernor_Boost()
+    #define perfgovernorRELEASE()    PerfGovernor_Release()
+#else
+    #define perfgovernorBOOST()      do {} while( 0 )
+    #define perfgovernorRELEASE()    do {} while( 0 )
+#endif /* democonfigPERF_GOVERNOR == 1 */
+
+/**
+ * @brief Start governing the clock, from the low level.
+ *
+ * @param[in] xSetLevel Sets the clock of the board.
+ */
+void PerfGovernor_Init( PerfGovernorSetLevel_t xSetLevel );
+
+/**
+ * @brief Begin a crypto phase, raising the clock if it is the only one.
+ *
+ * Does nothing before PerfGovernor_Init().
+ */
+void PerfGovernor_Boost( void );
+
+/**
+ * @brief End a crypto phase begun with PerfGovernor_Boost(), dropping the
+ * clock if it was the last one.
+ */
+void PerfGovernor_Release( void );
+
+#endif /* AZURE_SAMPLE_PERF_GOVERNOR_H */
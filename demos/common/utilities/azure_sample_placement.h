@@ -0,0 +1,29 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @file azure_sample_placement.h
+ *
+ * @brief Where the large buffers of the samples are placed in memory.
+ *
+ * The buffers that are large and off the network path, such as those of the
+ * telemetry store and of the update decoder, are declared with
+ * democonfigLARGE_BUFFER_ATTR. A board with external RAM defines it in its
+ * demo_config.h, as a section attribute that moves them there, leaving the
+ * internal RAM to the MQTT buffer, the stacks and TLS. The buffers are zero
+ * initialized, so the section is one that is not loaded.
+ *
+ * Include this file after demo_config.h.
+ */
+
+#ifndef AZURE_SAMPLE_PLACEMENT_H
+#define AZURE_SAMPLE_PLACEMENT_H
+
+/**
+ * @brief Attribute of the large buffers, none placing them with the others.
+ */
+#ifndef democonfigLARGE_BUFFER_ATTR
+    #define democonfigLARGE_BUFFER_ATTR
+#endif
+
+#endif /* AZURE_SAMPLE_PLACEMENT_H */
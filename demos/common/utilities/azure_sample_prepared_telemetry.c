@@ -0,0 +1,154 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+#include "azure_sample_prepared_telemetry.h"
+
+#include <stddef.h>
+
+#if ( democonfigPREPARED_TELEMETRY_DIRECT == 1 )
+    #include "azure_iot_mqtt.h"
+
+    #include "azure/iot/az_iot_hub_client.h"
+#endif /* democonfigPREPARED_TELEMETRY_DIRECT == 1 */
+
+/* Trace points of the samples. */
+#include "azure_sample_trace.h"
+
+/*-----------------------------------------------------------*/
+
+#if ( democonfigPREPARED_TELEMETRY_DIRECT == 1 )
+
+    AzureIoTResult_t PreparedTelemetry_Init( PreparedTelemetry_t * pxPrepared,
+                                             AzureIoTHubClient_t * pxHubClient,
+                                             AzureIoTMessageProperties_t * pxProperties )
+    {
+        size_t xTopicLength;
+        az_result xCoreResult;
+
+        if( ( pxPrepared == NULL ) || ( pxHubClient == NULL ) )
+        {
+            return eAzureIoTErrorInvalidArgument;
+        }
+
+        xCoreResult = az_iot_hub_client_telemetry_get_publish_topic( &pxHubClient->_internal.xAzureIoTHubClientCore,
+                                                                     ( pxProperties != NULL ) ?
+                                                                     &pxProperties->_internal.xProperties : NULL,
+                                                                     ( char * ) pxPrepared->ucTopic,
+                                                                     sizeof( pxPrepared->ucTopic ),
+                                                                     &xTopicLength );
+
+        if( xCoreResult == AZ_ERROR_NOT_ENOUGH_SPACE )
+        {
+            return eAzureIoTErrorOutOfMemory;
+        }
+        else if( az_result_failed( xCoreResult ) )
+        {
+            return eAzureIoTErrorFailed;
+        }
+
+        pxPrepared->pxHubClient = pxHubClient;
+        pxPrepared->usTopicLength = ( uint16_t ) xTopicLength;
+
+        return eAzureIoTSuccess;
+    }
+/*-----------------------------------------------------------*/
+
+    AzureIoTResult_t PreparedTelemetry_Send( PreparedTelemetry_t * pxPrepared,
+                                             const uint8_t * pucTelemetryData,
+                                             uint32_t ulTelemetryDataLength,
+                                             AzureIoTHubMessageQoS_t xQOS,
+                                             uint16_t * pusTelemetryPacketID )
+    {
+        AzureIoTMQTTPublishInfo_t xMQTTPublishInfo = { 0 };
+        uint16_t usPublishPacketIdentifier = 0;
+
+        if( ( pxPrepared == NULL ) || ( pxPrepared->pxHubClient == NULL ) ||
+            ( ( pucTelemetryData == NULL ) && ( ulTelemetryDataLength > 0 ) ) )
+        {
+            return eAzureIoTErrorInvalidArgument;
+        }
+
+        xMQTTPublishInfo.xQOS = ( xQOS == eAzureIoTHubMessageQoS1 ) ? eAzureIoTMQTTQoS1 : eAzureIoTMQTTQoS0;
+        xMQTTPublishInfo.pcTopicName = pxPrepared->ucTopic;
+        xMQTTPublishInfo.usTopicNameLength = pxPrepared->usTopicLength;
+        xMQTTPublishInfo.pvPayload = ( const void * ) pucTelemetryData;
+        xMQTTPublishInfo.xPayloadLength = ulTelemetryDataLength;
+
+        /* A packet ID is only used with QoS 1. */
+        if( xQOS == eAzureIoTHubMessageQoS1 )
+        {
+            usPublishPacketIdentifier = AzureIoTMQTT_GetPacketId( &pxPrepared->pxHubClient->_internal.xMQTTContext );
+        }
+
+        sampletraceBEGIN( eSampleTraceTelemetrySend, ulTelemetryDataLength );
+
+        if( AzureIoTMQTT_Publish( &pxPrepared->pxHubClient->_internal.xMQTTContext,
+                                  &xMQTTPublishInfo, usPublishPacketIdentifier ) != eAzureIoTMQTTSuccess )
+        {
+            sampletraceEND( eSampleTraceTelemetrySend, 0 );
+            return eAzureIoTErrorPublishFailed;
+        }
+
+        sampletraceEND( eSampleTraceTelemetrySend, usPublishPacketIdentifier );
+
+        if( ( xQOS == eAzureIoTHubMessageQoS1 ) && ( pusTelemetryPacketID != NULL ) )
+        {
+            *pusTelemetryPacketID = usPublishPacketIdentifier;
+        }
+
+        return eAzureIoTSuccess;
+    }
+/*-----------------------------------------------------------*/
+
+#else /* democonfigPREPARED_TELEMETRY_DIRECT == 1 */
+
+    AzureIoTResult_t PreparedTelemetry_Init( PreparedTelemetry_t * pxPrepared,
+                                             AzureIoTHubClient_t * pxHubClient,
+                                             AzureIoTMessageProperties_t * pxProperties )
+    {
+        if( ( pxPrepared == NULL ) || ( pxHubClient == NULL ) )
+        {
+            return eAzureIoTErrorInvalidArgument;
+        }
+
+        pxPrepared->pxHubClient = pxHubClient;
+        pxPrepared->pxProperties = pxProperties;
+
+        return eAzureIoTSuccess;
+    }
+/*-----------------------------------------------------------*/
+
+    AzureIoTResult_t PreparedTelemetry_Send( PreparedTelemetry_t * pxPrepared,
+                                             const uint8_t * pucTelemetryData,
+                                             uint32_t ulTelemetryDataLength,
+                                             AzureIoTHubMessageQoS_t xQOS,
+                                             uint16_t * pusTelemetryPacketID )
+    {
+        AzureIoTResult_t xResult;
+        uint16_t usPacketID = 0;
+
+        if( ( pxPrepared == NULL ) || ( pxPrepared->pxHubClient == NULL ) ||
+            ( ( pucTelemetryData == NULL ) && ( ulTelemetryDataLength > 0 ) ) )
+        {
+            return eAzureIoTErrorInvalidArgument;
+        }
+
+        sampletraceBEGIN( eSampleTraceTelemetrySend, ulTelemetryDataLength );
+
+        xResult = AzureIoTHubClient_SendTelemetry( pxPrepared->pxHubClient,
+                                                   pucTelemetryData, ulTelemetryDataLength,
+                                                   pxPrepared->pxProperties, xQOS, &usPacketID );
+
+        sampletraceEND( eSampleTraceTelemetrySend, ( xResult == eAzureIoTSuccess ) ? usPacketID : 0 );
+
+        if( ( xResult == eAzureIoTSuccess ) && ( xQOS == eAzureIoTHubMessageQoS1 ) &&
+            ( pusTelemetryPacketID != NULL ) )
+        {
+            *pusTelemetryPacketID = usPacketID;
+        }
+
+        return xResult;
+    }
+/*-----------------------------------------------------------*/
+
+#endif /* democonfigPREPARED_TELEMETRY_DIRECT == 1 */
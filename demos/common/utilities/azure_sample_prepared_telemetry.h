@@ -0,0 +1,89 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @file azure_sample_prepared_telemetry.h
+ *
+ * @brief Telemetry sends with the topic rendered once.
+ *
+ * AzureIoTHubClient_SendTelemetry() formats the telemetry topic, and with it
+ * the message properties, for every message it sends. A PreparedTelemetry_t
+ * ties a client to one set of properties, which must outlive it, and by
+ * default each PreparedTelemetry_Send() is an AzureIoTHubClient_SendTelemetry()
+ * of them.
+ *
+ * With democonfigPREPARED_TELEMETRY_DIRECT set to 1, the topic is formatted
+ * once when the prepared telemetry is initialized, and each send only
+ * publishes the payload on it. The middleware has no function for that, so it
+ * is done on the hub client and MQTT context of the client, which are not part
+ * of its public interface and can change with any version of it. Later changes
+ * to the properties are then not seen, so prepare them again after any.
+ *
+ * PUBACKs of prepared sends reach the telemetry callback of the client like
+ * those of AzureIoTHubClient_SendTelemetry().
+ */
+
+#ifndef AZURE_SAMPLE_PREPARED_TELEMETRY_H
+#define AZURE_SAMPLE_PREPARED_TELEMETRY_H
+
+#include <stdint.h>
+
+#include "azure_iot_hub_client.h"
+
+/**
+ * @brief 1 to format the topic once and publish on it directly, through the
+ * internals of the middleware, 0 to send with AzureIoTHubClient_SendTelemetry().
+ */
+#ifndef democonfigPREPARED_TELEMETRY_DIRECT
+    #define democonfigPREPARED_TELEMETRY_DIRECT    0
+#endif
+
+/**
+ * @brief Size of the buffer a prepared telemetry topic is rendered in.
+ */
+#ifndef democonfigPREPARED_TELEMETRY_TOPIC_SIZE
+    #define democonfigPREPARED_TELEMETRY_TOPIC_SIZE    256
+#endif
+
+typedef struct PreparedTelemetry
+{
+    AzureIoTHubClient_t * pxHubClient;
+    #if ( democonfigPREPARED_TELEMETRY_DIRECT == 1 )
+        uint8_t ucTopic[ democonfigPREPARED_TELEMETRY_TOPIC_SIZE ];
+        uint16_t usTopicLength;
+    #else
+        AzureIoTMessageProperties_t * pxProperties;
+    #endif /* democonfigPREPARED_TELEMETRY_DIRECT == 1 */
+} PreparedTelemetry_t;
+
+/**
+ * @brief Prepare the telemetry of a client and a set of properties.
+ *
+ * The client must be initialized, as the topic holds its device ID.
+ *
+ * @param[out] pxPrepared The prepared telemetry to initialize.
+ * @param[in] pxHubClient Client the telemetry is sent with.
+ * @param[in] pxProperties Properties sent with each message, or NULL.
+ * @return An #AzureIoTResult_t with the result of the operation.
+ */
+AzureIoTResult_t PreparedTelemetry_Init( PreparedTelemetry_t * pxPrepared,
+                                         AzureIoTHubClient_t * pxHubClient,
+                                         AzureIoTMessageProperties_t * pxProperties );
+
+/**
+ * @brief Send a telemetry message on the prepared topic.
+ *
+ * @param[in] pxPrepared The prepared telemetry.
+ * @param[in] pucTelemetryData The payload.
+ * @param[in] ulTelemetryDataLength Length of \p pucTelemetryData.
+ * @param[in] xQOS QoS the message is published with.
+ * @param[out] pusTelemetryPacketID Packet ID of a QoS 1 message, or NULL.
+ * @return An #AzureIoTResult_t with the result of the operation.
+ */
+AzureIoTResult_t PreparedTelemetry_Send( PreparedTelemetry_t * pxPrepared,
+                                         const uint8_t * pucTelemetryData,
+                                         uint32_t ulTelemetryDataLength,
+                                         AzureIoTHubMessageQoS_t xQOS,
+                                         uint16_t * pusTelemetryPacketID );
+
+#endif /* AZURE_SAMPLE_PREPARED_TELEMETRY_H */
@@ -0,0 +1,275 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+#include "azure_sample_properties.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#define propertiesVERSION     "$version"
+#define propertiesDESIRED     "desired"
+#define propertiesREPORTED    "reported"
+
+/* Longest name looked up in the table, longer ones being compared with each
+ * entry instead. */
+#define propertiesNAME_SIZE    64
+
+typedef struct PropertiesDispatch
+{
+    DispatchTable_t * pxHandlers;
+    void * pvContext;
+    uint32_t * pulVersion;
+    bool xVersionFound;
+} PropertiesDispatch_t;
+/*-----------------------------------------------------------*/
+
+static bool prvNameIs( AzureIoTJSONReader_t * pxReader,
+                       const uint8_t * pucName,
+                       uint32_t ulNameLength )
+{
+    return AzureIoTJSONReader_TokenIsTextEqual( pxReader, pucName, ulNameLength );
+}
+/*-----------------------------------------------------------*/
+
+/* prvFind() of a name longer than propertiesNAME_SIZE, compared with each
+ * entry by the reader. */
+static const DispatchName_t * prvFindLong( PropertiesDispatch_t * pxDispatch,
+                                           AzureIoTJSONReader_t * pxReader,
+                                           const uint8_t * pucComponentName,
+                                           uint32_t ulComponentNameLength,
+                                           bool xComponent )
+{
+    uint32_t ulIndex;
+    const PropertyHandlerEntry_t * pxEntry;
+
+    for( ulIndex = 0; ulIndex < pxDispatch->pxHandlers->ulEntryCount; ulIndex++ )
+    {
+        pxEntry = &( ( const PropertyHandlerEntry_t * ) pxDispatch->pxHandlers->pucEntries )[ ulIndex ];
+
+        if( xComponent )
+        {
+            if( ( pxEntry->xName.ulComponentNameLength > 0 ) &&
+                prvNameIs( pxReader, pxEntry->xName.pucComponentName, pxEntry->xName.ulComponentNameLength ) )
+            {
+                return &pxEntry->xName;
+            }
+        }
+        else if( ( pxEntry->xName.ulComponentNameLength == ulComponentNameLength ) &&
+                 ( ( ulComponentNameLength == 0 ) ||
+                   ( memcmp( pxEntry->xName.pucComponentName, pucComponentName, ulComponentNameLength ) == 0 ) ) &&
+                 prvNameIs( pxReader, pxEntry->xName.pucName, pxEntry->xName.ulNameLength ) )
+        {
+            return &pxEntry->xName;
+        }
+    }
+
+    return NULL;
+}
+/*-----------------------------------------------------------*/
+
+/* The handlers of a component that has any, when xComponent, otherwise the
+ * handler of a property of the component given. */
+static const DispatchName_t * prvFind( PropertiesDispatch_t * pxDispatch,
+                                       AzureIoTJSONReader_t * pxReader,
+                                       const uint8_t * pucComponentName,
+                                       uint32_t ulComponentNameLength,
+                                       bool xComponent )
+{
+    uint8_t ucName[ propertiesNAME_SIZE ];
+    uint32_t ulNameLength;
+
+    /* The name comes unescaped, so it is the one of the table. */
+    if( AzureIoTJSONReader_GetTokenString( pxReader, ucName, sizeof( ucName ), &ulNameLength ) != eAzureIoTSuccess )
+    {
+        return prvFindLong( pxDispatch, pxReader, pucComponentName, ulComponentNameLength, xComponent );
+    }
+
+    if( xComponent )
+    {
+        return DispatchTable_FindComponent( pxDispatch->pxHandlers, ucName, ulNameLength );
+    }
+
+    return DispatchTable_Find( pxDispatch->pxHandlers, pucComponentName, ulComponentNameLength,
+                               ucName, ulNameLength );
+}
+/*-----------------------------------------------------------*/
+
+/* Walks the members of the object the reader is on, leaving it on its end. */
+static AzureIoTResult_t prvProcessObject( PropertiesDispatch_t * pxDispatch,
+                                          AzureIoTJSONReader_t * pxReader,
+                                          const uint8_t * pucComponentName,
+                                          uint32_t ulComponentNameLength,
+                                          bool xDispatchProperties,
+                                          bool xReadVersion )
+{
+    AzureIoTResult_t xResult;
+    AzureIoTJSONTokenType_t xTokenType;
+    const DispatchName_t * pxComponent;
+    const DispatchName_t * pxProperty;
+
+    if( ( AzureIoTJSONReader_TokenType( pxReader, &xTokenType ) != eAzureIoTSuccess ) ||
+        ( xTokenType != eAzureIoTJSONTokenBEGIN_OBJECT ) )
+    {
+        return eAzureIoTErrorFailed;
+    }
+
+    for( ; ; )
+    {
+        if( ( AzureIoTJSONReader_NextToken( pxReader ) != eAzureIoTSuccess ) ||
+            ( AzureIoTJSONReader_TokenType( pxReader, &xTokenType ) != eAzureIoTSuccess ) )
+        {
+            return eAzureIoTErrorFailed;
+        }
+
+        if( xTokenType == eAzureIoTJSONTokenEND_OBJECT )
+        {
+            return eAzureIoTSuccess;
+        }
+
+        if( xReadVersion &&
+            prvNameIs( pxReader, ( const uint8_t * ) propertiesVERSION, sizeof( propertiesVERSION ) - 1 ) )
+        {
+            if( ( AzureIoTJSONReader_NextToken( pxReader ) != eAzureIoTSuccess ) ||
+                ( AzureIoTJSONReader_GetTokenUInt32( pxReader, pxDispatch->pulVersion ) != eAzureIoTSuccess ) )
+            {
+                return eAzureIoTErrorFailed;
+            }
+
+            pxDispatch->xVersionFound = true;
+            continue;
+        }
+
+        pxComponent = NULL;
+        pxProperty = NULL;
+
+        if( xDispatchProperties )
+        {
+            if( pucComponentName == NULL )
+            {
+                pxComponent = prvFind( pxDispatch, pxReader, NULL, 0, true );
+            }
+
+            if( pxComponent == NULL )
+            {
+                pxProperty = prvFind( pxDispatch, pxReader, pucComponentName, ulComponentNameLength, false );
+            }
+        }
+
+        if( AzureIoTJSONReader_NextToken( pxReader ) != eAzureIoTSuccess )
+        {
+            return eAzureIoTErrorFailed;
+        }
+
+        if( pxComponent != NULL )
+        {
+            /* Its "__t" marker has no handler, so it is skipped like any other. */
+            xResult = prvProcessObject( pxDispatch, pxReader, pxComponent->pucComponentName,
+                                        pxComponent->ulComponentNameLength, true, false );
+        }
+        else if( pxProperty != NULL )
+        {
+            xResult = ( ( const PropertyHandlerEntry_t * ) pxProperty )->xHandler( pxReader, pxDispatch->pvContext );
+        }
+        else
+        {
+            xResult = AzureIoTJSONReader_SkipChildren( pxReader );
+        }
+
+        if( xResult != eAzureIoTSuccess )
+        {
+            return xResult;
+        }
+    }
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t PropertiesDispatch_Process( AzureIoTHubClientPropertiesResponse_t * pxMessage,
+                                             AzureIoTHubClientPropertyType_t xPropertyType,
+                                             DispatchTable_t * pxHandlers,
+                                             void * pvContext,
+                                             uint32_t * pulVersion )
+{
+    AzureIoTResult_t xResult;
+    AzureIoTJSONReader_t xReader;
+    AzureIoTJSONTokenType_t xTokenType;
+    PropertiesDispatch_t xDispatch;
+    bool xWritable = ( xPropertyType == eAzureIoTHubClientPropertyWritable );
+
+    if( ( pxMessage == NULL ) || ( pulVersion == NULL ) || ( pxHandlers == NULL ) ||
+        ( ( pxMessage->xMessageType != eAzureIoTHubPropertiesWritablePropertyMessage ) &&
+          ( pxMessage->xMessageType != eAzureIoTHubPropertiesRequestedMessage ) ) )
+    {
+        return eAzureIoTErrorInvalidArgument;
+    }
+
+    if( ( xResult = DispatchTable_Index( pxHandlers ) ) != eAzureIoTSuccess )
+    {
+        return xResult;
+    }
+
+    xDispatch.pxHandlers = pxHandlers;
+    xDispatch.pvContext = pvContext;
+    xDispatch.pulVersion = pulVersion;
+    xDispatch.xVersionFound = false;
+
+    if( ( AzureIoTJSONReader_Init( &xReader, pxMessage->pvMessagePayload, pxMessage->ulPayloadLength ) != eAzureIoTSuccess ) ||
+        ( AzureIoTJSONReader_NextToken( &xReader ) != eAzureIoTSuccess ) )
+    {
+        return eAzureIoTErrorFailed;
+    }
+
+    if( pxMessage->xMessageType == eAzureIoTHubPropertiesWritablePropertyMessage )
+    {
+        /* An update only holds writable properties, with the version among them. */
+        xResult = prvProcessObject( &xDispatch, &xReader, NULL, 0, xWritable, true );
+    }
+    else
+    {
+        /* A requested document holds them under "desired", and the reported
+         * ones under "reported". Only the first has the version wanted. */
+        if( ( AzureIoTJSONReader_TokenType( &xReader, &xTokenType ) != eAzureIoTSuccess ) ||
+            ( xTokenType != eAzureIoTJSONTokenBEGIN_OBJECT ) )
+        {
+            return eAzureIoTErrorFailed;
+        }
+
+        for( xResult = eAzureIoTSuccess; xResult == eAzureIoTSuccess; )
+        {
+            if( ( AzureIoTJSONReader_NextToken( &xReader ) != eAzureIoTSuccess ) ||
+                ( AzureIoTJSONReader_TokenType( &xReader, &xTokenType ) != eAzureIoTSuccess ) )
+            {
+                return eAzureIoTErrorFailed;
+            }
+
+            if( xTokenType == eAzureIoTJSONTokenEND_OBJECT )
+            {
+                break;
+            }
+
+            if( prvNameIs( &xReader, ( const uint8_t * ) propertiesDESIRED, sizeof( propertiesDESIRED ) - 1 ) )
+            {
+                xResult = ( AzureIoTJSONReader_NextToken( &xReader ) != eAzureIoTSuccess ) ? eAzureIoTErrorFailed :
+                          prvProcessObject( &xDispatch, &xReader, NULL, 0, xWritable, true );
+            }
+            else if( prvNameIs( &xReader, ( const uint8_t * ) propertiesREPORTED, sizeof( propertiesREPORTED ) - 1 ) )
+            {
+                xResult = ( AzureIoTJSONReader_NextToken( &xReader ) != eAzureIoTSuccess ) ? eAzureIoTErrorFailed :
+                          prvProcessObject( &xDispatch, &xReader, NULL, 0, !xWritable, false );
+            }
+            else
+            {
+                xResult = ( AzureIoTJSONReader_NextToken( &xReader ) != eAzureIoTSuccess ) ? eAzureIoTErrorFailed :
+                          AzureIoTJSONReader_SkipChildren( &xReader );
+            }
+        }
+    }
+
+    if( ( xResult == eAzureIoTSuccess ) && !xDispatch.xVersionFound )
+    {
+        xResult = eAzureIoTErrorFailed;
+    }
+
+    return xResult;
+}
+/*-----------------------------------------------------------*/
@@ -0,0 +1,74 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @file azure_sample_properties.h
+ *
+ * @brief Dispatches the properties of a document to handlers in one pass.
+ *
+ * AzureIoTHubClientProperties_GetPropertiesVersion() reads the whole document
+ * to find "$version", which usually comes last, and then
+ * AzureIoTHubClientProperties_GetNextComponentProperty() reads it again. With
+ * a full property document of several KB that doubles the parsing time.
+ * PropertiesDispatch_Process() reads it once, calling the handler of each
+ * property it knows and skipping the rest, and returns "$version" at the end.
+ *
+ * As handlers may run before "$version" was read, they should only take the
+ * value, and leave the acknowledgements to the caller, once
+ * PropertiesDispatch_Process() returned the version.
+ *
+ * The handlers are looked up by name in a #DispatchTable_t of
+ * #PropertyHandlerEntry_t, so a document costs one hash per member whatever
+ * the number of handlers.
+ */
+
+#ifndef AZURE_SAMPLE_PROPERTIES_H
+#define AZURE_SAMPLE_PROPERTIES_H
+
+#include <stdint.h>
+
+#include "azure_iot_hub_client.h"
+#include "azure_iot_hub_client_properties.h"
+#include "azure_iot_json_reader.h"
+
+#include "azure_sample_dispatch_table.h"
+
+/**
+ * @brief Handles the value of a property.
+ *
+ * @param[in] pxReader Reader on the first token of the value. It must be left
+ * on the last token of the value, for example with AzureIoTJSONReader_SkipChildren().
+ * @param[in] pvContext Context passed to PropertiesDispatch_Process().
+ * @return An #AzureIoTResult_t, which stops the dispatch when not eAzureIoTSuccess.
+ */
+typedef AzureIoTResult_t ( * PropertyHandler_t )( AzureIoTJSONReader_t * pxReader,
+                                                  void * pvContext );
+
+typedef struct PropertyHandlerEntry
+{
+    DispatchName_t xName;
+    PropertyHandler_t xHandler;
+} PropertyHandlerEntry_t;
+
+/**
+ * @brief Call the handlers of the properties of a document, and get its version.
+ *
+ * The properties of a component are only looked at when one of the handlers
+ * is for that component; others are skipped as a whole.
+ *
+ * @param[in] pxMessage A writable property update, or the response to a property document request.
+ * @param[in] xPropertyType Writable properties, or, in a requested document, the reported ones.
+ * @param[in] pxHandlers Table of #PropertyHandlerEntry_t.
+ * @param[in] pvContext Passed to the handlers.
+ * @param[out] pulVersion The version of the writable properties.
+ * @return eAzureIoTErrorFailed if the document has no version or is not valid JSON,
+ * eAzureIoTErrorOutOfMemory if \p pxHandlers has too few slots,
+ * otherwise the result of the first handler that failed.
+ */
+AzureIoTResult_t PropertiesDispatch_Process( AzureIoTHubClientPropertiesResponse_t * pxMessage,
+                                             AzureIoTHubClientPropertyType_t xPropertyType,
+                                             DispatchTable_t * pxHandlers,
+                                             void * pvContext,
+                                             uint32_t * pulVersion );
+
+#endif /* AZURE_SAMPLE_PROPERTIES_H */
@@ -0,0 +1,833 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+#include "azure_sample_properties_stream.h"
+
+#include <string.h>
+
+#include "azure_iot_json_reader.h"
+
+#define propertiesstreamTWIN_TOPIC          "$iothub/twin/"
+#define propertiesstreamTWIN_PATCH_TOPIC    "$iothub/twin/PATCH/"
+#define propertiesstreamVERSION             "$version"
+#define propertiesstreamDESIRED             "desired"
+#define propertiesstreamREPORTED            "reported"
+
+#define propertiesstreamMQTT_PUBLISH        0x30U
+
+/* Bytes read from the transport at a time while streaming a payload. */
+#define propertiesstreamCHUNK_SIZE          64U
+
+/* States of the packet being received. */
+#define propertiesstreamPACKET_HEADER       0U /* Reading the fixed header. */
+#define propertiesstreamPACKET_TOPIC        1U /* Reading the topic of a large PUBLISH. */
+#define propertiesstreamPACKET_PAYLOAD      2U /* Parsing its payload. */
+#define propertiesstreamPACKET_DELIVER      3U /* Handing on the header read. */
+#define propertiesstreamPACKET_PASS         4U /* Handing on the rest of the packet as it is. */
+
+/* States of the document being parsed. */
+#define propertiesstreamPARSE_BEGIN         0U
+#define propertiesstreamPARSE_MEMBER        1U /* Before a name, or the end of an object. */
+#define propertiesstreamPARSE_NAME          2U
+#define propertiesstreamPARSE_COLON         3U
+#define propertiesstreamPARSE_VALUE         4U /* Before a value. */
+#define propertiesstreamPARSE_SCAN          5U /* In a value. */
+#define propertiesstreamPARSE_AFTER         6U /* After a value. */
+#define propertiesstreamPARSE_END           7U
+#define propertiesstreamPARSE_ERROR         8U
+
+/* What is done with the value of a member. */
+#define propertiesstreamACTION_SKIP         0U
+#define propertiesstreamACTION_KEEP         1U /* Kept for its handler. */
+#define propertiesstreamACTION_VERSION      2U
+#define propertiesstreamACTION_ENTER        3U /* An object whose members are looked at. */
+
+/* Objects the parser looks into. */
+#define propertiesstreamROLE_DOCUMENT       0U /* A requested document. */
+#define propertiesstreamROLE_UPDATE         1U /* A writable property update. */
+#define propertiesstreamROLE_DESIRED        2U
+#define propertiesstreamROLE_REPORTED       3U
+#define propertiesstreamROLE_COMPONENT      4U
+/*-----------------------------------------------------------*/
+
+static bool prvIsSpace( uint8_t ucByte )
+{
+    return ( ucByte == ' ' ) || ( ucByte == '\t' ) || ( ucByte == '\n' ) || ( ucByte == '\r' );
+}
+/*-----------------------------------------------------------*/
+
+static bool prvNameIs( PropertiesStream_t * pxStream,
+                       const char * pcName,
+                       uint32_t ulNameLength )
+{
+    return pxStream->xNameMatchable && ( pxStream->ulNameLength == ulNameLength ) &&
+           ( memcmp( pxStream->ucName, pcName, ulNameLength ) == 0 );
+}
+/*-----------------------------------------------------------*/
+
+static void prvParseBegin( PropertiesStream_t * pxStream,
+                           bool xUpdate )
+{
+    pxStream->ucParseState = propertiesstreamPARSE_BEGIN;
+    pxStream->ucDepth = 0;
+    pxStream->ucRoles[ 0 ] = xUpdate ? propertiesstreamROLE_UPDATE : propertiesstreamROLE_DOCUMENT;
+    pxStream->pxComponent = NULL;
+    pxStream->ulValuesLength = 0;
+    pxStream->xVersionFound = false;
+    pxStream->xOutOfMemory = false;
+    pxStream->xPending = false;
+}
+/*-----------------------------------------------------------*/
+
+/* The action for a handler of the member just named, if there is one. */
+static uint8_t prvKeepIfHandled( PropertiesStream_t * pxStream,
+                                 const void * pvEntry )
+{
+    if( pvEntry == NULL )
+    {
+        return propertiesstreamACTION_SKIP;
+    }
+
+    pxStream->ucEntry = ( uint8_t ) ( ( ( const uint8_t * ) pvEntry - pxStream->pxHandlers->pucEntries ) /
+                                      pxStream->pxHandlers->ulEntrySize );
+
+    return propertiesstreamACTION_KEEP;
+}
+/*-----------------------------------------------------------*/
+
+/* Sets what is done with the value of the member just named, and the role of
+ * the object it may be. Mirrors PropertiesDispatch_Process(). */
+static uint8_t prvDecide( PropertiesStream_t * pxStream,
+                          uint8_t * pucRole )
+{
+    uint8_t ucRole = pxStream->ucRoles[ pxStream->ucDepth - 1 ];
+    bool xWritable = ( pxStream->xPropertyType == eAzureIoTHubClientPropertyWritable );
+    bool xDispatch;
+    const DispatchName_t * pxName;
+
+    if( !pxStream->xNameMatchable )
+    {
+        return propertiesstreamACTION_SKIP;
+    }
+
+    if( ucRole == propertiesstreamROLE_DOCUMENT )
+    {
+        if( prvNameIs( pxStream, propertiesstreamDESIRED, sizeof( propertiesstreamDESIRED ) - 1 ) )
+        {
+            *pucRole = propertiesstreamROLE_DESIRED;
+            return propertiesstreamACTION_ENTER;
+        }
+
+        if( prvNameIs( pxStream, propertiesstreamREPORTED, sizeof( propertiesstreamREPORTED ) - 1 ) )
+        {
+            *pucRole = propertiesstreamROLE_REPORTED;
+            return propertiesstreamACTION_ENTER;
+        }
+
+        return propertiesstreamACTION_SKIP;
+    }
+
+    if( ucRole == propertiesstreamROLE_COMPONENT )
+    {
+        return prvKeepIfHandled( pxStream,
+                                 DispatchTable_Find( pxStream->pxHandlers,
+                                                     pxStream->pxComponent->pucComponentName,
+                                                     pxStream->pxComponent->ulComponentNameLength,
+                                                     pxStream->ucName, pxStream->ulNameLength ) );
+    }
+
+    /* Only the desired properties have the version wanted. */
+    if( ( ucRole != propertiesstreamROLE_REPORTED ) &&
+        prvNameIs( pxStream, propertiesstreamVERSION, sizeof( propertiesstreamVERSION ) - 1 ) )
+    {
+        return propertiesstreamACTION_VERSION;
+    }
+
+    xDispatch = ( ucRole == propertiesstreamROLE_REPORTED ) ? !xWritable : xWritable;
+
+    if( !xDispatch )
+    {
+        return propertiesstreamACTION_SKIP;
+    }
+
+    pxName = DispatchTable_FindComponent( pxStream->pxHandlers, pxStream->ucName, pxStream->ulNameLength );
+
+    if( pxName != NULL )
+    {
+        pxStream->pxComponent = pxName;
+        *pucRole = propertiesstreamROLE_COMPONENT;
+        return propertiesstreamACTION_ENTER;
+    }
+
+    return prvKeepIfHandled( pxStream,
+                             DispatchTable_Find( pxStream->pxHandlers, NULL, 0,
+                                                 pxStream->ucName, pxStream->ulNameLength ) );
+}
+/*-----------------------------------------------------------*/
+
+/* Starts a kept value with the index of its handler and room for its length. */
+static void prvKeepBegin( PropertiesStream_t * pxStream )
+{
+    if( pxStream->ulValuesSize - pxStream->ulValuesLength < propertiesstreamVALUE_OVERHEAD )
+    {
+        pxStream->xOutOfMemory = true;
+        pxStream->ucAction = propertiesstreamACTION_SKIP;
+        return;
+    }
+
+    pxStream->ulValueStart = pxStream->ulValuesLength;
+    pxStream->pucValues[ pxStream->ulValuesLength ] = pxStream->ucEntry;
+    pxStream->ulValuesLength += propertiesstreamVALUE_OVERHEAD;
+}
+/*-----------------------------------------------------------*/
+
+static void prvKeep( PropertiesStream_t * pxStream,
+                     uint8_t ucByte )
+{
+    if( pxStream->ucAction == propertiesstreamACTION_VERSION )
+    {
+        /* Digits only; anything else leaves the document without a version. */
+        if( ( ucByte < '0' ) || ( ucByte > '9' ) ||
+            ( pxStream->ulVersion > ( UINT32_MAX - ( uint32_t ) ( ucByte - '0' ) ) / 10U ) )
+        {
+            pxStream->xVersionFound = false;
+            pxStream->ucAction = propertiesstreamACTION_SKIP;
+            return;
+        }
+
+        pxStream->ulVersion = ( pxStream->ulVersion * 10U ) + ( uint32_t ) ( ucByte - '0' );
+        pxStream->ulNameLength++;
+    }
+    else if( pxStream->ucAction == propertiesstreamACTION_KEEP )
+    {
+        if( ( pxStream->ulValuesLength >= pxStream->ulValuesSize ) ||
+            ( pxStream->ulValuesLength - pxStream->ulValueStart - propertiesstreamVALUE_OVERHEAD >= UINT16_MAX ) )
+        {
+            /* Drops the value, so that the others may still fit. */
+            pxStream->ulValuesLength = pxStream->ulValueStart;
+            pxStream->xOutOfMemory = true;
+            pxStream->ucAction = propertiesstreamACTION_SKIP;
+            return;
+        }
+
+        pxStream->pucValues[ pxStream->ulValuesLength++ ] = ucByte;
+    }
+}
+/*-----------------------------------------------------------*/
+
+static void prvValueEnd( PropertiesStream_t * pxStream )
+{
+    uint32_t ulLength;
+
+    if( pxStream->ucAction == propertiesstreamACTION_VERSION )
+    {
+        pxStream->xVersionFound = ( pxStream->ulNameLength > 0 );
+    }
+    else if( pxStream->ucAction == propertiesstreamACTION_KEEP )
+    {
+        ulLength = pxStream->ulValuesLength - pxStream->ulValueStart - propertiesstreamVALUE_OVERHEAD;
+        pxStream->pucValues[ pxStream->ulValueStart + 1 ] = ( uint8_t ) ( ulLength & 0xFFU );
+        pxStream->pucValues[ pxStream->ulValueStart + 2 ] = ( uint8_t ) ( ulLength >> 8 );
+    }
+
+    pxStream->ucParseState = propertiesstreamPARSE_AFTER;
+}
+/*-----------------------------------------------------------*/
+
+static void prvObjectEnd( PropertiesStream_t * pxStream )
+{
+    if( pxStream->ucRoles[ --pxStream->ucDepth ] == propertiesstreamROLE_COMPONENT )
+    {
+        pxStream->pxComponent = NULL;
+    }
+
+    pxStream->ucParseState = ( pxStream->ucDepth == 0 ) ? propertiesstreamPARSE_END : propertiesstreamPARSE_AFTER;
+}
+/*-----------------------------------------------------------*/
+
+/* Scans a value byte by byte, keeping track of strings and nesting only, and
+ * returns false when the byte is not part of the value. */
+static bool prvScan( PropertiesStream_t * pxStream,
+                     uint8_t ucByte )
+{
+    if( pxStream->xInString )
+    {
+        prvKeep( pxStream, ucByte );
+
+        if( pxStream->xEscaped )
+        {
+            pxStream->xEscaped = false;
+        }
+        else if( ucByte == '\\' )
+        {
+            pxStream->xEscaped = true;
+        }
+        else if( ucByte == '"' )
+        {
+            pxStream->xInString = false;
+
+            if( pxStream->ulNesting == 0 )
+            {
+                prvValueEnd( pxStream );
+            }
+        }
+
+        return true;
+    }
+
+    if( ( pxStream->ulNesting == 0 ) &&
+        ( ( ucByte == ',' ) || ( ucByte == '}' ) || ( ucByte == ']' ) || prvIsSpace( ucByte ) ) )
+    {
+        /* The end of a number or literal. */
+        prvValueEnd( pxStream );
+        return false;
+    }
+
+    prvKeep( pxStream, ucByte );
+
+    if( ucByte == '"' )
+    {
+        pxStream->xInString = true;
+    }
+    else if( ( ucByte == '{' ) || ( ucByte == '[' ) )
+    {
+        pxStream->ulNesting++;
+    }
+    else if( ( ucByte == '}' ) || ( ucByte == ']' ) )
+    {
+        if( --pxStream->ulNesting == 0 )
+        {
+            prvValueEnd( pxStream );
+        }
+    }
+
+    return true;
+}
+/*-----------------------------------------------------------*/
+
+static void prvParseByte( PropertiesStream_t * pxStream,
+                          uint8_t ucByte )
+{
+    uint8_t ucRole = propertiesstreamROLE_DOCUMENT;
+
+    switch( pxStream->ucParseState )
+    {
+        case propertiesstreamPARSE_BEGIN:
+        case propertiesstreamPARSE_END:
+
+            if( prvIsSpace( ucByte ) )
+            {
+                break;
+            }
+
+            if( ( pxStream->ucParseState == propertiesstreamPARSE_BEGIN ) && ( ucByte == '{' ) )
+            {
+                pxStream->ucDepth = 1;
+                pxStream->ucParseState = propertiesstreamPARSE_MEMBER;
+            }
+            else
+            {
+                pxStream->ucParseState = propertiesstreamPARSE_ERROR;
+            }
+
+            break;
+
+        case propertiesstreamPARSE_MEMBER:
+        case propertiesstreamPARSE_AFTER:
+
+            if( prvIsSpace( ucByte ) )
+            {
+                break;
+            }
+
+            if( ucByte == '}' )
+            {
+                prvObjectEnd( pxStream );
+            }
+            else if( ucByte == ',' )
+            {
+                pxStream->ucParseState = propertiesstreamPARSE_MEMBER;
+            }
+            else if( ( ucByte == '"' ) && ( pxStream->ucParseState == propertiesstreamPARSE_MEMBER ) )
+            {
+                pxStream->ulNameLength = 0;
+                pxStream->xNameMatchable = true;
+                pxStream->xEscaped = false;
+                pxStream->ucParseState = propertiesstreamPARSE_NAME;
+            }
+            else
+            {
+                pxStream->ucParseState = propertiesstreamPARSE_ERROR;
+            }
+
+            break;
+
+        case propertiesstreamPARSE_NAME:
+
+            if( pxStream->xEscaped )
+            {
+                pxStream->xEscaped = false;
+            }
+            else if( ucByte == '\\' )
+            {
+                pxStream->xEscaped = true;
+                pxStream->xNameMatchable = false;
+            }
+            else if( ucByte == '"' )
+            {
+                pxStream->ucParseState = propertiesstreamPARSE_COLON;
+                break;
+            }
+
+            if( pxStream->ulNameLength < sizeof( pxStream->ucName ) )
+            {
+                pxStream->ucName[ pxStream->ulNameLength++ ] = ucByte;
+            }
+            else
+            {
+                pxStream->xNameMatchable = false;
+            }
+
+            break;
+
+        case propertiesstreamPARSE_COLON:
+
+            if( ucByte == ':' )
+            {
+                pxStream->ucAction = prvDecide( pxStream, &ucRole );
+
+                /* Components are the deepest objects entered, so there is room. */
+                if( pxStream->ucAction == propertiesstreamACTION_ENTER )
+                {
+                    pxStream->ucRoles[ pxStream->ucDepth ] = ucRole;
+                }
+
+                pxStream->ucParseState = propertiesstreamPARSE_VALUE;
+            }
+            else if( !prvIsSpace( ucByte ) )
+            {
+                pxStream->ucParseState = propertiesstreamPARSE_ERROR;
+            }
+
+            break;
+
+        case propertiesstreamPARSE_VALUE:
+
+            if( prvIsSpace( ucByte ) )
+            {
+                break;
+            }
+
+            if( pxStream->ucAction == propertiesstreamACTION_ENTER )
+            {
+                if( ucByte == '{' )
+                {
+                    pxStream->ucDepth++;
+                    pxStream->ucParseState = propertiesstreamPARSE_MEMBER;
+                    break;
+                }
+
+                /* Not an object after all, so there is nothing to look at. */
+                pxStream->pxComponent = NULL;
+                pxStream->ucAction = propertiesstreamACTION_SKIP;
+            }
+
+            if( ( ucByte == ',' ) || ( ucByte == '}' ) || ( ucByte == ']' ) || ( ucByte == ':' ) )
+            {
+                pxStream->ucParseState = propertiesstreamPARSE_ERROR;
+                break;
+            }
+
+            if( pxStream->ucAction == propertiesstreamACTION_KEEP )
+            {
+                prvKeepBegin( pxStream );
+            }
+            else if( pxStream->ucAction == propertiesstreamACTION_VERSION )
+            {
+                pxStream->ulVersion = 0;
+                pxStream->ulNameLength = 0;
+            }
+
+            pxStream->ulNesting = 0;
+            pxStream->xInString = false;
+            pxStream->xEscaped = false;
+            pxStream->ucParseState = propertiesstreamPARSE_SCAN;
+            ( void ) prvScan( pxStream, ucByte );
+            break;
+
+        case propertiesstreamPARSE_SCAN:
+
+            if( !prvScan( pxStream, ucByte ) )
+            {
+                /* The byte that ended a number or literal comes after it. */
+                prvParseByte( pxStream, ucByte );
+            }
+
+            break;
+
+        default:
+            break;
+    }
+}
+/*-----------------------------------------------------------*/
+
+static void prvParseEnd( PropertiesStream_t * pxStream )
+{
+    /* A document that is only a number would still be in it. */
+    if( pxStream->ucParseState == propertiesstreamPARSE_SCAN )
+    {
+        prvParseByte( pxStream, ' ' );
+    }
+
+    pxStream->xPending = true;
+}
+/*-----------------------------------------------------------*/
+
+/* Reads into the header until it holds ulLength bytes. */
+static int32_t prvReadHeader( PropertiesStream_t * pxStream,
+                              uint32_t ulLength )
+{
+    int32_t lResult;
+
+    while( pxStream->ulHeaderLength < ulLength )
+    {
+        lResult = pxStream->xRecv( pxStream->pxNetworkContext,
+                                   &pxStream->ucHeader[ pxStream->ulHeaderLength ],
+                                   ulLength - pxStream->ulHeaderLength );
+
+        if( lResult <= 0 )
+        {
+            return lResult;
+        }
+
+        pxStream->ulHeaderLength += ( uint32_t ) lResult;
+    }
+
+    return 1;
+}
+/*-----------------------------------------------------------*/
+
+/* Hands on the header read, then the rest of the packet. */
+static void prvDeliver( PropertiesStream_t * pxStream,
+                        uint32_t ulRemaining )
+{
+    pxStream->ulHeaderSent = 0;
+    pxStream->ulRemaining = ulRemaining;
+    pxStream->ucPacketState = propertiesstreamPACKET_DELIVER;
+}
+/*-----------------------------------------------------------*/
+
+static int32_t prvReadFixedHeader( PropertiesStream_t * pxStream )
+{
+    int32_t lResult;
+    uint32_t ulIndex;
+    uint32_t ulRemaining = 0;
+
+    /* The packet type, then the remaining length a byte at a time, as its
+     * length is only known from its last byte. */
+    do
+    {
+        if( ( lResult = prvReadHeader( pxStream, pxStream->ulHeaderLength + 1 ) ) <= 0 )
+        {
+            return lResult;
+        }
+    } while( ( pxStream->ulHeaderLength < 2 ) ||
+             ( ( ( pxStream->ucHeader[ pxStream->ulHeaderLength - 1 ] & 0x80U ) != 0 ) &&
+               ( pxStream->ulHeaderLength < 5 ) ) );
+
+    for( ulIndex = pxStream->ulHeaderLength - 1; ulIndex > 0; ulIndex-- )
+    {
+        ulRemaining = ( ulRemaining << 7 ) | ( pxStream->ucHeader[ ulIndex ] & 0x7FU );
+    }
+
+    pxStream->ulFixedHeaderLength = pxStream->ulHeaderLength;
+
+    if( ( ( pxStream->ucHeader[ 0 ] & 0xF0U ) == propertiesstreamMQTT_PUBLISH ) &&
+        ( pxStream->ulFixedHeaderLength + ulRemaining > pxStream->ulMaxPacketSize ) )
+    {
+        pxStream->ulRemaining = ulRemaining;
+        pxStream->ucPacketState = propertiesstreamPACKET_TOPIC;
+    }
+    else
+    {
+        prvDeliver( pxStream, ulRemaining );
+    }
+
+    return 1;
+}
+/*-----------------------------------------------------------*/
+
+static int32_t prvReadTopic( PropertiesStream_t * pxStream )
+{
+    int32_t lResult;
+    uint32_t ulTopicStart = pxStream->ulFixedHeaderLength + 2;
+    uint32_t ulVariableHeaderLength;
+
+    if( ( lResult = prvReadHeader( pxStream, ulTopicStart ) ) <= 0 )
+    {
+        return lResult;
+    }
+
+    pxStream->ulTopicLength = ( ( uint32_t ) pxStream->ucHeader[ ulTopicStart - 2 ] << 8 ) |
+                              pxStream->ucHeader[ ulTopicStart - 1 ];
+
+    /* The packet identifier of QoS 1 and 2. */
+    ulVariableHeaderLength = 2 + pxStream->ulTopicLength +
+                             ( ( ( pxStream->ucHeader[ 0 ] & 0x06U ) != 0 ) ? 2U : 0U );
+
+    if( ( pxStream->ulTopicLength > propertiesstreamMAX_TOPIC_SIZE ) ||
+        ( ulVariableHeaderLength > pxStream->ulRemaining ) )
+    {
+        prvDeliver( pxStream, pxStream->ulRemaining - 2 );
+        return 1;
+    }
+
+    if( ( lResult = prvReadHeader( pxStream, pxStream->ulFixedHeaderLength + ulVariableHeaderLength ) ) <= 0 )
+    {
+        return lResult;
+    }
+
+    if( ( pxStream->ulTopicLength < sizeof( propertiesstreamTWIN_TOPIC ) - 1 ) ||
+        ( memcmp( &pxStream->ucHeader[ ulTopicStart ], propertiesstreamTWIN_TOPIC,
+                  sizeof( propertiesstreamTWIN_TOPIC ) - 1 ) != 0 ) )
+    {
+        prvDeliver( pxStream, pxStream->ulRemaining - ulVariableHeaderLength );
+        return 1;
+    }
+
+    prvParseBegin( pxStream,
+                   ( pxStream->ulTopicLength >= sizeof( propertiesstreamTWIN_PATCH_TOPIC ) - 1 ) &&
+                   ( memcmp( &pxStream->ucHeader[ ulTopicStart ], propertiesstreamTWIN_PATCH_TOPIC,
+                             sizeof( propertiesstreamTWIN_PATCH_TOPIC ) - 1 ) == 0 ) );
+    pxStream->ulRemaining -= ulVariableHeaderLength;
+    pxStream->ucPacketState = propertiesstreamPACKET_PAYLOAD;
+
+    return 1;
+}
+/*-----------------------------------------------------------*/
+
+static int32_t prvReadPayload( PropertiesStream_t * pxStream )
+{
+    uint8_t ucChunk[ propertiesstreamCHUNK_SIZE ];
+    int32_t lResult;
+    int32_t lIndex;
+    uint32_t ulVariableHeaderLength;
+    uint32_t ulFixedHeaderLength;
+
+    while( pxStream->ulRemaining > 0 )
+    {
+        lResult = pxStream->xRecv( pxStream->pxNetworkContext, ucChunk,
+                                   ( pxStream->ulRemaining < sizeof( ucChunk ) ) ?
+                                   pxStream->ulRemaining : sizeof( ucChunk ) );
+
+        if( lResult <= 0 )
+        {
+            return lResult;
+        }
+
+        for( lIndex = 0; lIndex < lResult; lIndex++ )
+        {
+            prvParseByte( pxStream, ucChunk[ lIndex ] );
+        }
+
+        pxStream->ulRemaining -= ( uint32_t ) lResult;
+    }
+
+    prvParseEnd( pxStream );
+
+    /* The packet goes on with the same topic and no payload. Its remaining
+     * length takes a single byte now. */
+    ulVariableHeaderLength = pxStream->ulHeaderLength - pxStream->ulFixedHeaderLength;
+    ulFixedHeaderLength = ( ulVariableHeaderLength < 0x80U ) ? 2U : 3U;
+    ( void ) memmove( &pxStream->ucHeader[ ulFixedHeaderLength ],
+                      &pxStream->ucHeader[ pxStream->ulFixedHeaderLength ], ulVariableHeaderLength );
+
+    if( ulFixedHeaderLength == 2U )
+    {
+        pxStream->ucHeader[ 1 ] = ( uint8_t ) ulVariableHeaderLength;
+    }
+    else
+    {
+        pxStream->ucHeader[ 1 ] = ( uint8_t ) ( ( ulVariableHeaderLength & 0x7FU ) | 0x80U );
+        pxStream->ucHeader[ 2 ] = ( uint8_t ) ( ulVariableHeaderLength >> 7 );
+    }
+
+    pxStream->ulHeaderLength = ulFixedHeaderLength + ulVariableHeaderLength;
+    prvDeliver( pxStream, 0 );
+
+    return 1;
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t PropertiesStream_Init( PropertiesStream_t * pxStream,
+                                        AzureIoTTransportInterface_t * pxTransport,
+                                        uint32_t ulMaxPacketSize,
+                                        AzureIoTHubClientPropertyType_t xPropertyType,
+                                        DispatchTable_t * pxHandlers,
+                                        uint8_t * pucValueBuffer,
+                                        uint32_t ulValueBufferSize )
+{
+    AzureIoTResult_t xResult;
+
+    if( ( pxStream == NULL ) || ( pxTransport == NULL ) || ( pxTransport->xRecv == NULL ) ||
+        ( pxHandlers == NULL ) || ( pucValueBuffer == NULL ) ||
+        ( ulValueBufferSize < propertiesstreamVALUE_OVERHEAD ) ||
+        ( ulMaxPacketSize < propertiesstreamHEADER_SIZE ) )
+    {
+        return eAzureIoTErrorInvalidArgument;
+    }
+
+    /* The kept values are found by the index of their handler, in a byte. */
+    if( ( xResult = DispatchTable_Index( pxHandlers ) ) != eAzureIoTSuccess )
+    {
+        return xResult;
+    }
+
+    ( void ) memset( pxStream, 0, sizeof( *pxStream ) );
+    pxStream->xContext.pParams = pxStream;
+    pxStream->pxNetworkContext = pxTransport->pxNetworkContext;
+    pxStream->xRecv = pxTransport->xRecv;
+    pxStream->ulMaxPacketSize = ulMaxPacketSize;
+    pxStream->xPropertyType = xPropertyType;
+    pxStream->pxHandlers = pxHandlers;
+    pxStream->pucValues = pucValueBuffer;
+    pxStream->ulValuesSize = ulValueBufferSize;
+    pxStream->ucPacketState = propertiesstreamPACKET_HEADER;
+
+    pxTransport->pxNetworkContext = ( NetworkContext_t * ) &pxStream->xContext;
+    pxTransport->xRecv = PropertiesStream_Recv;
+
+    return eAzureIoTSuccess;
+}
+/*-----------------------------------------------------------*/
+
+int32_t PropertiesStream_Recv( NetworkContext_t * pxNetworkContext,
+                               void * pvBuffer,
+                               size_t xBytesToRecv )
+{
+    PropertiesStream_t * pxStream = ( PropertiesStream_t * ) ( ( PropertiesStreamContext_t * ) pxNetworkContext )->pParams;
+    int32_t lResult = 1;
+    uint32_t ulLength;
+
+    while( xBytesToRecv > 0 )
+    {
+        switch( pxStream->ucPacketState )
+        {
+            case propertiesstreamPACKET_HEADER:
+                lResult = prvReadFixedHeader( pxStream );
+                break;
+
+            case propertiesstreamPACKET_TOPIC:
+                lResult = prvReadTopic( pxStream );
+                break;
+
+            case propertiesstreamPACKET_PAYLOAD:
+                lResult = prvReadPayload( pxStream );
+                break;
+
+            case propertiesstreamPACKET_DELIVER:
+                ulLength = pxStream->ulHeaderLength - pxStream->ulHeaderSent;
+                ulLength = ( xBytesToRecv < ulLength ) ? ( uint32_t ) xBytesToRecv : ulLength;
+                ( void ) memcpy( pvBuffer, &pxStream->ucHeader[ pxStream->ulHeaderSent ], ulLength );
+                pxStream->ulHeaderSent += ulLength;
+
+                if( pxStream->ulHeaderSent == pxStream->ulHeaderLength )
+                {
+                    pxStream->ulHeaderLength = 0;
+                    pxStream->ucPacketState = ( pxStream->ulRemaining > 0 ) ?
+                                              propertiesstreamPACKET_PASS : propertiesstreamPACKET_HEADER;
+                }
+
+                return ( int32_t ) ulLength;
+
+            default:
+                lResult = pxStream->xRecv( pxStream->pxNetworkContext, pvBuffer,
+                                           ( xBytesToRecv < pxStream->ulRemaining ) ?
+                                           xBytesToRecv : pxStream->ulRemaining );
+
+                if( lResult > 0 )
+                {
+                    pxStream->ulRemaining -= ( uint32_t ) lResult;
+
+                    if( pxStream->ulRemaining == 0 )
+                    {
+                        pxStream->ucPacketState = propertiesstreamPACKET_HEADER;
+                    }
+                }
+
+                return lResult;
+        }
+
+        /* Nothing handed on yet: no data, or a transport error. */
+        if( lResult <= 0 )
+        {
+            return lResult;
+        }
+    }
+
+    return 0;
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t PropertiesStream_Process( PropertiesStream_t * pxStream,
+                                           AzureIoTHubClientPropertiesResponse_t * pxMessage,
+                                           void * pvContext,
+                                           uint32_t * pulVersion )
+{
+    AzureIoTResult_t xResult = eAzureIoTSuccess;
+    AzureIoTJSONReader_t xReader;
+    const PropertyHandlerEntry_t * pxEntry;
+    uint32_t ulOffset;
+    uint32_t ulLength;
+
+    if( ( pxStream == NULL ) || ( pxMessage == NULL ) || ( pulVersion == NULL ) )
+    {
+        return eAzureIoTErrorInvalidArgument;
+    }
+
+    if( !pxStream->xPending || ( pxMessage->ulPayloadLength > 0 ) ||
+        ( ( pxMessage->xMessageType != eAzureIoTHubPropertiesWritablePropertyMessage ) &&
+          ( pxMessage->xMessageType != eAzureIoTHubPropertiesRequestedMessage ) ) )
+    {
+        return PropertiesDispatch_Process( pxMessage, pxStream->xPropertyType, pxStream->pxHandlers,
+                                           pvContext, pulVersion );
+    }
+
+    pxStream->xPending = false;
+
+    if( ( pxStream->ucParseState != propertiesstreamPARSE_END ) || !pxStream->xVersionFound )
+    {
+        return eAzureIoTErrorFailed;
+    }
+
+    for( ulOffset = 0; ( ulOffset < pxStream->ulValuesLength ) && ( xResult == eAzureIoTSuccess ); ulOffset += ulLength )
+    {
+        pxEntry = ( const PropertyHandlerEntry_t * ) ( pxStream->pxHandlers->pucEntries +
+                                                       ( pxStream->pucValues[ ulOffset ] * pxStream->pxHandlers->ulEntrySize ) );
+        ulLength = ( uint32_t ) pxStream->pucValues[ ulOffset + 1 ] | ( ( uint32_t ) pxStream->pucValues[ ulOffset + 2 ] << 8 );
+        ulOffset += propertiesstreamVALUE_OVERHEAD;
+
+        if( ( AzureIoTJSONReader_Init( &xReader, &pxStream->pucValues[ ulOffset ], ulLength ) != eAzureIoTSuccess ) ||
+            ( AzureIoTJSONReader_NextToken( &xReader ) != eAzureIoTSuccess ) )
+        {
+            xResult = eAzureIoTErrorFailed;
+        }
+        else
+        {
+            xResult = pxEntry->xHandler( &xReader, pvContext );
+        }
+    }
+
+    if( xResult == eAzureIoTSuccess )
+    {
+        *pulVersion = pxStream->ulVersion;
+
+        if( pxStream->xOutOfMemory )
+        {
+            xResult = eAzureIoTErrorOutOfMemory;
+        }
+    }
+
+    return xResult;
+}
+/*-----------------------------------------------------------*/
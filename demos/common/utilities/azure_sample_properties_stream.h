@@ -0,0 +1,159 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @file azure_sample_properties_stream.h
+ *
+ * @brief Reads property documents larger than the MQTT buffer as they arrive.
+ *
+ * The MQTT client only hands on a PUBLISH once the whole packet is in its
+ * buffer, so that buffer bounds the largest property document a device can
+ * take. PropertiesStream_Init() puts a receive function in front of the
+ * transport, which passes every packet on as it is, except a twin PUBLISH
+ * ("$iothub/twin/...") that would not fit the buffer. The payload of that one
+ * is read from the transport in small pieces and parsed as it comes, keeping
+ * only the values of the properties that have a handler, and the MQTT client
+ * gets the packet without its payload.
+ *
+ * The property callback calls PropertiesStream_Process() in place of
+ * PropertiesDispatch_Process(). For a document that was streamed it calls the
+ * handlers with the values kept, otherwise it parses the payload as usual, so
+ * the handlers see the same values either way. Names with escaped characters
+ * match no handler in a streamed document.
+ *
+ * A PropertiesStream_t is for one connection, and is not thread safe; it is
+ * used by the task running the process loop.
+ */
+
+#ifndef AZURE_SAMPLE_PROPERTIES_STREAM_H
+#define AZURE_SAMPLE_PROPERTIES_STREAM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "azure_iot_hub_client.h"
+#include "azure_iot_transport_interface.h"
+
+#include "azure_sample_dispatch_table.h"
+#include "azure_sample_properties.h"
+
+/**
+ * @brief Longest topic of a PUBLISH that can be streamed. Longer ones are passed on.
+ */
+#define propertiesstreamMAX_TOPIC_SIZE    ( 128U )
+
+/**
+ * @brief Longest property or component name that can match a handler.
+ */
+#define propertiesstreamMAX_NAME_SIZE     ( 64U )
+
+/**
+ * @brief Space a value takes in the value buffer, besides its JSON text.
+ */
+#define propertiesstreamVALUE_OVERHEAD    ( 3U )
+
+/* Fixed header, topic length, topic and packet identifier of a PUBLISH. */
+#define propertiesstreamHEADER_SIZE       ( 5U + 2U + propertiesstreamMAX_TOPIC_SIZE + 2U )
+
+/* Objects of a document the parser looks into: the document, the properties
+ * and a component. */
+#define propertiesstreamMAX_DEPTH         ( 3U )
+
+/**
+ * @brief Context the receive function is given, laid out as the
+ * NetworkContext of the samples.
+ */
+typedef struct PropertiesStreamContext
+{
+    void * pParams;
+} PropertiesStreamContext_t;
+
+typedef struct PropertiesStream
+{
+    PropertiesStreamContext_t xContext;
+    NetworkContext_t * pxNetworkContext;
+    AzureIoTTransportRecv_t xRecv;
+    uint32_t ulMaxPacketSize;
+    DispatchTable_t * pxHandlers;
+    AzureIoTHubClientPropertyType_t xPropertyType;
+    uint8_t * pucValues;
+    uint32_t ulValuesSize;
+
+    /* The packet being received. */
+    uint8_t ucPacketState;
+    uint8_t ucHeader[ propertiesstreamHEADER_SIZE ];
+    uint32_t ulHeaderLength;
+    uint32_t ulHeaderSent;
+    uint32_t ulFixedHeaderLength;
+    uint32_t ulRemaining;
+    uint32_t ulTopicLength;
+
+    /* The document being parsed. */
+    uint8_t ucParseState;
+    uint8_t ucAction;
+    uint8_t ucEntry;
+    uint8_t ucDepth;
+    uint8_t ucRoles[ propertiesstreamMAX_DEPTH ];
+    const DispatchName_t * pxComponent;
+    uint8_t ucName[ propertiesstreamMAX_NAME_SIZE ];
+    uint32_t ulNameLength;
+    bool xNameMatchable;
+    bool xInString;
+    bool xEscaped;
+    uint32_t ulNesting;
+    uint32_t ulValueStart;
+    uint32_t ulValuesLength;
+    uint32_t ulVersion;
+    bool xVersionFound;
+    bool xOutOfMemory;
+    bool xPending;
+} PropertiesStream_t;
+
+/**
+ * @brief Put the stream in front of the receive function of a transport.
+ *
+ * Call it for each connection, once the transport is filled in and before it
+ * is given to AzureIoTHubClient_Init().
+ *
+ * @param[out] pxStream The stream.
+ * @param[in,out] pxTransport The transport, which then receives through the stream.
+ * @param[in] ulMaxPacketSize Size of the MQTT buffer. Larger twin packets are streamed.
+ * @param[in] xPropertyType The properties handled, as given to PropertiesDispatch_Process().
+ * @param[in] pxHandlers Table of #PropertyHandlerEntry_t.
+ * @param[in] pucValueBuffer Buffer for the values kept from a streamed document.
+ * @param[in] ulValueBufferSize Size of \p pucValueBuffer. Each value takes
+ * #propertiesstreamVALUE_OVERHEAD bytes besides its text.
+ * @return An #AzureIoTResult_t with the result of the operation.
+ */
+AzureIoTResult_t PropertiesStream_Init( PropertiesStream_t * pxStream,
+                                        AzureIoTTransportInterface_t * pxTransport,
+                                        uint32_t ulMaxPacketSize,
+                                        AzureIoTHubClientPropertyType_t xPropertyType,
+                                        DispatchTable_t * pxHandlers,
+                                        uint8_t * pucValueBuffer,
+                                        uint32_t ulValueBufferSize );
+
+/**
+ * @brief The receive function the transport is given by PropertiesStream_Init().
+ */
+int32_t PropertiesStream_Recv( NetworkContext_t * pxNetworkContext,
+                               void * pvBuffer,
+                               size_t xBytesToRecv );
+
+/**
+ * @brief Call the handlers of the properties of a message, and get its version.
+ *
+ * @param[in] pxStream The stream.
+ * @param[in] pxMessage A writable property update, or the response to a property document request.
+ * @param[in] pvContext Passed to the handlers.
+ * @param[out] pulVersion The version of the writable properties.
+ * @return As PropertiesDispatch_Process(), and eAzureIoTErrorOutOfMemory if
+ * the values of a streamed document did not fit the value buffer.
+ */
+AzureIoTResult_t PropertiesStream_Process( PropertiesStream_t * pxStream,
+                                           AzureIoTHubClientPropertiesResponse_t * pxMessage,
+                                           void * pvContext,
+                                           uint32_t * pulVersion );
+
+#endif /* AZURE_SAMPLE_PROPERTIES_STREAM_H */
@@ -0,0 +1,275 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+#include "azure_sample_publish_window.h"
+
+#include <stddef.h>
+#include <string.h>
+
+/* FreeRTOS includes. */
+#include "FreeRTOS.h"
+#include "task.h"
+
+/* Trace points of the samples. */
+#include "azure_sample_trace.h"
+
+/*-----------------------------------------------------------*/
+
+/* Sends a message in a free slot; the caller has checked there is one. */
+static AzureIoTResult_t prvSendInSlot( PublishWindow_t * pxWindow,
+                                       const uint8_t * pucMessage,
+                                       uint32_t ulMessageLength,
+                                       PreparedTelemetry_t * pxPrepared )
+{
+    PublishWindowSlot_t * pxSlot = NULL;
+    AzureIoTResult_t xResult;
+    uint32_t ulIndex;
+
+    for( ulIndex = 0; ulIndex < democonfigPUBLISH_WINDOW_SIZE; ulIndex++ )
+    {
+        if( pxWindow->xSlots[ ulIndex ].usPacketID == 0 )
+        {
+            pxSlot = &pxWindow->xSlots[ ulIndex ];
+            break;
+        }
+    }
+
+    pxSlot->xSendTime = xTaskGetTickCount();
+
+    if( ( xResult = PreparedTelemetry_Send( pxPrepared, pucMessage, ulMessageLength,
+                                            eAzureIoTHubMessageQoS1,
+                                            &pxSlot->usPacketID ) ) != eAzureIoTSuccess )
+    {
+        pxSlot->usPacketID = 0;
+        return xResult;
+    }
+
+    pxWindow->ulInFlight++;
+
+    return eAzureIoTSuccess;
+}
+/*-----------------------------------------------------------*/
+
+/* Sends the urgent message raised while waiting, if any. */
+static AzureIoTResult_t prvProcessUrgent( PublishWindow_t * pxWindow )
+{
+    #if ( democonfigTELEMETRY_URGENT == 1 )
+        return PublishWindow_ProcessUrgent( pxWindow );
+    #else
+        ( void ) pxWindow;
+        return eAzureIoTSuccess;
+    #endif /* democonfigTELEMETRY_URGENT == 1 */
+}
+/*-----------------------------------------------------------*/
+
+/* Runs the process loop until at most ulMaxInFlight messages are in flight. */
+static AzureIoTResult_t prvWaitForInFlight( PublishWindow_t * pxWindow,
+                                            uint32_t ulMaxInFlight,
+                                            TickType_t xTimeout )
+{
+    TickType_t xStart = xTaskGetTickCount();
+    AzureIoTResult_t xResult;
+
+    while( pxWindow->ulInFlight > ulMaxInFlight )
+    {
+        if( ( xTaskGetTickCount() - xStart ) >= xTimeout )
+        {
+            return eAzureIoTErrorFailed;
+        }
+
+        if( ( ( xResult = AzureIoTHubClient_ProcessLoop( pxWindow->pxHubClient,
+                                                         pxWindow->ulProcessLoopTimeoutMs ) ) != eAzureIoTSuccess ) ||
+            ( ( xResult = prvProcessUrgent( pxWindow ) ) != eAzureIoTSuccess ) )
+        {
+            return xResult;
+        }
+    }
+
+    return eAzureIoTSuccess;
+}
+/*-----------------------------------------------------------*/
+
+/* Runs the process loop until the rate limiter has the tokens of a message,
+ * and takes them. */
+static AzureIoTResult_t prvWaitForTokens( PublishWindow_t * pxWindow,
+                                          uint32_t ulMessageLength,
+                                          TickType_t xTimeout )
+{
+    TickType_t xStart = xTaskGetTickCount();
+    TickType_t xWait;
+    AzureIoTResult_t xResult;
+
+    while( RateLimiter_TryTake( pxWindow->pxRateLimiter, ulMessageLength, &xWait ) != pdTRUE )
+    {
+        if( ( xTaskGetTickCount() - xStart ) >= xTimeout )
+        {
+            return eAzureIoTErrorFailed;
+        }
+
+        if( ( ( xResult = AzureIoTHubClient_ProcessLoop( pxWindow->pxHubClient,
+                                                         pxWindow->ulProcessLoopTimeoutMs ) ) != eAzureIoTSuccess ) ||
+            ( ( xResult = prvProcessUrgent( pxWindow ) ) != eAzureIoTSuccess ) )
+        {
+            return xResult;
+        }
+    }
+
+    return eAzureIoTSuccess;
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t PublishWindow_Init( PublishWindow_t * pxWindow,
+                                     AzureIoTHubClient_t * pxHubClient,
+                                     uint32_t ulProcessLoopTimeoutMs,
+                                     PublishWindowAckCallback_t xAckCallback,
+                                     void * pvCallbackContext )
+{
+    if( ( pxWindow == NULL ) || ( pxHubClient == NULL ) )
+    {
+        return eAzureIoTErrorInvalidArgument;
+    }
+
+    memset( pxWindow, 0, sizeof( *pxWindow ) );
+    pxWindow->pxHubClient = pxHubClient;
+    pxWindow->ulProcessLoopTimeoutMs = ulProcessLoopTimeoutMs;
+    pxWindow->xAckCallback = xAckCallback;
+    pxWindow->pvCallbackContext = pvCallbackContext;
+
+    return eAzureIoTSuccess;
+}
+/*-----------------------------------------------------------*/
+
+void PublishWindow_SetRateLimiter( PublishWindow_t * pxWindow,
+                                   RateLimiter_t * pxRateLimiter )
+{
+    pxWindow->pxRateLimiter = pxRateLimiter;
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t PublishWindow_Send( PublishWindow_t * pxWindow,
+                                     const uint8_t * pucMessage,
+                                     uint32_t ulMessageLength,
+                                     PreparedTelemetry_t * pxPrepared,
+                                     TickType_t xTimeout )
+{
+    AzureIoTResult_t xResult;
+
+    /* The tokens are waited for first, so no urgent message sent meanwhile
+     * can take the slot found next. */
+    if( ( pxWindow->pxRateLimiter != NULL ) &&
+        ( ( xResult = prvWaitForTokens( pxWindow, ulMessageLength, xTimeout ) ) != eAzureIoTSuccess ) )
+    {
+        return xResult;
+    }
+
+    if( ( xResult = prvWaitForInFlight( pxWindow, democonfigPUBLISH_WINDOW_SIZE - publishwindowURGENT_SLOTS - 1,
+                                        xTimeout ) ) != eAzureIoTSuccess )
+    {
+        return xResult;
+    }
+
+    return prvSendInSlot( pxWindow, pucMessage, ulMessageLength, pxPrepared );
+}
+/*-----------------------------------------------------------*/
+
+#if ( democonfigTELEMETRY_URGENT == 1 )
+    AzureIoTResult_t PublishWindow_RaiseUrgent( PublishWindow_t * pxWindow,
+                                                const uint8_t * pucMessage,
+                                                uint32_t ulMessageLength,
+                                                PreparedTelemetry_t * pxPrepared )
+    {
+        AzureIoTResult_t xResult = eAzureIoTSuccess;
+
+        if( ( ulMessageLength == 0 ) || ( ulMessageLength > sizeof( pxWindow->ucUrgent ) ) )
+        {
+            return eAzureIoTErrorOutOfMemory;
+        }
+
+        taskENTER_CRITICAL();
+        {
+            if( pxWindow->ulUrgentLength != 0 )
+            {
+                xResult = eAzureIoTErrorOutOfMemory;
+            }
+            else
+            {
+                memcpy( pxWindow->ucUrgent, pucMessage, ulMessageLength );
+                pxWindow->pxUrgentPrepared = pxPrepared;
+                pxWindow->ulUrgentLength = ulMessageLength;
+            }
+        }
+        taskEXIT_CRITICAL();
+
+        return xResult;
+    }
+/*-----------------------------------------------------------*/
+
+    AzureIoTResult_t PublishWindow_ProcessUrgent( PublishWindow_t * pxWindow )
+    {
+        AzureIoTResult_t xResult;
+
+        if( ( pxWindow->ulUrgentLength == 0 ) ||
+            ( pxWindow->ulInFlight >= democonfigPUBLISH_WINDOW_SIZE ) )
+        {
+            return eAzureIoTSuccess;
+        }
+
+        /* Urgent messages take tokens when there are some, so routine ones
+         * make up for them, but never wait for them. */
+        if( pxWindow->pxRateLimiter != NULL )
+        {
+            ( void ) RateLimiter_TryTake( pxWindow->pxRateLimiter, pxWindow->ulUrgentLength, NULL );
+        }
+
+        xResult = prvSendInSlot( pxWindow, pxWindow->ucUrgent, pxWindow->ulUrgentLength,
+                                 pxWindow->pxUrgentPrepared );
+
+        /* Like a routine reading, an urgent message that fails to send is dropped. */
+        taskENTER_CRITICAL();
+        {
+            pxWindow->ulUrgentLength = 0;
+        }
+        taskEXIT_CRITICAL();
+
+        return xResult;
+    }
+#endif /* democonfigTELEMETRY_URGENT == 1 */
+/*-----------------------------------------------------------*/
+
+void PublishWindow_Acknowledge( PublishWindow_t * pxWindow,
+                                uint16_t usPacketID )
+{
+    uint32_t ulIndex;
+    TickType_t xRoundTrip;
+
+    for( ulIndex = 0; ulIndex < democonfigPUBLISH_WINDOW_SIZE; ulIndex++ )
+    {
+        if( ( usPacketID != 0 ) && ( pxWindow->xSlots[ ulIndex ].usPacketID == usPacketID ) )
+        {
+            sampletraceMARK( eSampleTracePuback, usPacketID );
+            pxWindow->xSlots[ ulIndex ].usPacketID = 0;
+            pxWindow->ulInFlight--;
+            xRoundTrip = xTaskGetTickCount() - pxWindow->xSlots[ ulIndex ].xSendTime;
+
+            if( pxWindow->pxRateLimiter != NULL )
+            {
+                RateLimiter_ReportRoundTrip( pxWindow->pxRateLimiter, xRoundTrip );
+            }
+
+            if( pxWindow->xAckCallback != NULL )
+            {
+                pxWindow->xAckCallback( pxWindow->pvCallbackContext, usPacketID, xRoundTrip );
+            }
+
+            break;
+        }
+    }
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t PublishWindow_WaitForAll( PublishWindow_t * pxWindow,
+                                           TickType_t xTimeout )
+{
+    return prvWaitForInFlight( pxWindow, 0, xTimeout );
+}
+/*-----------------------------------------------------------*/
@@ -0,0 +1,212 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @file azure_sample_publish_window.h
+ *
+ * @brief Window of QoS 1 telemetry messages waiting for PUBACK.
+ *
+ * Messages are sent without waiting for the PUBACK of the previous one, so
+ * up to democonfigPUBLISH_WINDOW_SIZE messages are in flight at once. When the
+ * window is full PublishWindow_Send() runs the process loop until a PUBACK
+ * frees a slot, rather than letting the MQTT client run out of state slots.
+ * Call PublishWindow_Acknowledge() from the telemetry PUBACK callback set in
+ * AzureIoTHubClientOptions_t.
+ *
+ * With a RateLimiter_t set by PublishWindow_SetRateLimiter(), sending also
+ * runs the process loop until the bucket has the tokens of the message, and
+ * each PUBACK round trip is reported to it.
+ *
+ * With democonfigTELEMETRY_URGENT set, one slot is kept for urgent messages,
+ * such as an alarm, raised with PublishWindow_RaiseUrgent(). An urgent message
+ * is sent by the next PublishWindow_ProcessUrgent(), which the waits of
+ * PublishWindow_Send() run after each process loop as well, so it never waits
+ * behind routine messages or their rate limit: it only waits for the PUBACK
+ * of the urgent message before it, one round trip at most.
+ */
+
+#ifndef AZURE_SAMPLE_PUBLISH_WINDOW_H
+#define AZURE_SAMPLE_PUBLISH_WINDOW_H
+
+#include <stdint.h>
+
+#include "FreeRTOS.h"
+
+#include "azure_iot_hub_client.h"
+
+#include "azure_sample_prepared_telemetry.h"
+#include "azure_sample_rate_limit.h"
+
+/**
+ * @brief Telemetry messages that can wait for PUBACK at once.
+ *
+ * Keep this below MQTT_STATE_ARRAY_MAX_COUNT in core_mqtt_config.h, which also
+ * has to hold reported property publishes and incoming QoS 1 messages.
+ */
+#ifndef democonfigPUBLISH_WINDOW_SIZE
+    #define democonfigPUBLISH_WINDOW_SIZE          8
+#endif
+
+/**
+ * @brief 1 to keep a slot of the window for urgent messages.
+ */
+#ifndef democonfigTELEMETRY_URGENT
+    #define democonfigTELEMETRY_URGENT         0
+#endif
+
+/**
+ * @brief Largest urgent message.
+ */
+#ifndef democonfigTELEMETRY_URGENT_SIZE
+    #define democonfigTELEMETRY_URGENT_SIZE    128
+#endif
+
+/**
+ * @brief Slots of the window routine messages cannot take.
+ */
+#if ( democonfigTELEMETRY_URGENT == 1 )
+    #define publishwindowURGENT_SLOTS    1
+#else
+    #define publishwindowURGENT_SLOTS    0
+#endif /* democonfigTELEMETRY_URGENT == 1 */
+
+#if ( democonfigPUBLISH_WINDOW_SIZE <= publishwindowURGENT_SLOTS )
+    #error "democonfigPUBLISH_WINDOW_SIZE must leave a slot for routine messages."
+#endif
+
+/**
+ * @brief Longest PublishWindow_Send() waits for a free slot before failing.
+ */
+#ifndef democonfigPUBLISH_WINDOW_TIMEOUT_MS
+    #define democonfigPUBLISH_WINDOW_TIMEOUT_MS    ( 10 * 1000U )
+#endif
+
+/**
+ * @brief Called when a message of the window is acknowledged.
+ *
+ * @param[in] pvContext Context passed to PublishWindow_Init().
+ * @param[in] usPacketID Packet ID of the acknowledged message.
+ * @param[in] xRoundTrip Ticks from sending the message to its PUBACK.
+ */
+typedef void ( * PublishWindowAckCallback_t )( void * pvContext,
+                                               uint16_t usPacketID,
+                                               TickType_t xRoundTrip );
+
+typedef struct PublishWindowSlot
+{
+    uint16_t usPacketID;  /* 0 when the slot is free. */
+    TickType_t xSendTime; /* Tick count when the message was sent. */
+} PublishWindowSlot_t;
+
+typedef struct PublishWindow
+{
+    AzureIoTHubClient_t * pxHubClient;
+    uint32_t ulProcessLoopTimeoutMs;
+    PublishWindowAckCallback_t xAckCallback;
+    void * pvCallbackContext;
+    PublishWindowSlot_t xSlots[ democonfigPUBLISH_WINDOW_SIZE ];
+    uint32_t ulInFlight;
+    RateLimiter_t * pxRateLimiter; /* NULL when sending is not rate limited. */
+    #if ( democonfigTELEMETRY_URGENT == 1 )
+        uint8_t ucUrgent[ democonfigTELEMETRY_URGENT_SIZE ];
+        uint32_t ulUrgentLength;                /* 0 when no urgent message is raised. */
+        PreparedTelemetry_t * pxUrgentPrepared; /* Topic of the raised urgent message. */
+    #endif /* democonfigTELEMETRY_URGENT == 1 */
+} PublishWindow_t;
+
+/**
+ * @brief Initialize a publish window.
+ *
+ * @param[out] pxWindow The window to initialize.
+ * @param[in] pxHubClient Client the messages are sent with.
+ * @param[in] ulProcessLoopTimeoutMs Process loop timeout used while waiting for a free slot.
+ * @param[in] xAckCallback Called for each acknowledged message, or NULL.
+ * @param[in] pvCallbackContext Passed to \p xAckCallback.
+ * @return An #AzureIoTResult_t with the result of the operation.
+ */
+AzureIoTResult_t PublishWindow_Init( PublishWindow_t * pxWindow,
+                                     AzureIoTHubClient_t * pxHubClient,
+                                     uint32_t ulProcessLoopTimeoutMs,
+                                     PublishWindowAckCallback_t xAckCallback,
+                                     void * pvCallbackContext );
+
+/**
+ * @brief Rate limit the messages of a window.
+ *
+ * @param[in] pxWindow The window.
+ * @param[in] pxRateLimiter The bucket, which outlives the window, or NULL for none.
+ */
+void PublishWindow_SetRateLimiter( PublishWindow_t * pxWindow,
+                                   RateLimiter_t * pxRateLimiter );
+
+/**
+ * @brief Send a telemetry message with QoS 1, waiting for a free slot if the window is full,
+ * and for the tokens of the message if it is rate limited.
+ *
+ * Waiting runs the process loop, so other callbacks of the client may be called.
+ *
+ * @param[in] pxWindow The window.
+ * @param[in] pucMessage The message.
+ * @param[in] ulMessageLength Length of \p pucMessage.
+ * @param[in] pxPrepared Prepared topic the message is sent on.
+ * @param[in] xTimeout Longest wait for a free slot, and again for the tokens, in ticks.
+ * @return An #AzureIoTResult_t with the result of the operation.
+ */
+AzureIoTResult_t PublishWindow_Send( PublishWindow_t * pxWindow,
+                                     const uint8_t * pucMessage,
+                                     uint32_t ulMessageLength,
+                                     PreparedTelemetry_t * pxPrepared,
+                                     TickType_t xTimeout );
+
+#if ( democonfigTELEMETRY_URGENT == 1 )
+
+/**
+ * @brief Raise an urgent message, to be sent by the next PublishWindow_ProcessUrgent().
+ *
+ * The message is copied. It can be raised from any task, or from a callback
+ * of the client.
+ *
+ * @param[in] pxWindow The window.
+ * @param[in] pucMessage The message.
+ * @param[in] ulMessageLength Length of \p pucMessage, at most democonfigTELEMETRY_URGENT_SIZE.
+ * @param[in] pxPrepared Prepared topic the message is sent on.
+ * @return eAzureIoTErrorOutOfMemory if the message is too large, or the one
+ * raised before is not sent yet.
+ */
+    AzureIoTResult_t PublishWindow_RaiseUrgent( PublishWindow_t * pxWindow,
+                                                const uint8_t * pucMessage,
+                                                uint32_t ulMessageLength,
+                                                PreparedTelemetry_t * pxPrepared );
+
+/**
+ * @brief Send the raised urgent message, if any, with QoS 1 in the slot kept for it.
+ *
+ * It does not wait: a message whose slot is still taken by the urgent
+ * message before it stays raised for the next call.
+ *
+ * @param[in] pxWindow The window.
+ * @return An #AzureIoTResult_t with the result of the operation.
+ */
+    AzureIoTResult_t PublishWindow_ProcessUrgent( PublishWindow_t * pxWindow );
+#endif /* democonfigTELEMETRY_URGENT == 1 */
+
+/**
+ * @brief Free the slot of an acknowledged message. Call from the telemetry PUBACK callback.
+ *
+ * @param[in] pxWindow The window.
+ * @param[in] usPacketID Packet ID of the acknowledged message.
+ */
+void PublishWindow_Acknowledge( PublishWindow_t * pxWindow,
+                                uint16_t usPacketID );
+
+/**
+ * @brief Run the process loop until every message in the window is acknowledged.
+ *
+ * @param[in] pxWindow The window.
+ * @param[in] xTimeout Longest wait, in ticks.
+ * @return An #AzureIoTResult_t with the result of the operation.
+ */
+AzureIoTResult_t PublishWindow_WaitForAll( PublishWindow_t * pxWindow,
+                                           TickType_t xTimeout );
+
+#endif /* AZURE_SAMPLE_PUBLISH_WINDOW_H */
@@ -0,0 +1,133 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+#include "azure_sample_rate_limit.h"
+
+#include <stddef.h>
+
+/* FreeRTOS includes. */
+#include "FreeRTOS.h"
+#include "task.h"
+
+/*-----------------------------------------------------------*/
+
+static void prvRefill( RateLimiter_t * pxLimiter )
+{
+    TickType_t xNow = xTaskGetTickCount();
+    uint64_t ullElapsedMs = ( uint64_t ) ( xNow - pxLimiter->xLastRefill ) * portTICK_PERIOD_MS;
+    uint64_t ullAdded = ( ullElapsedMs * pxLimiter->ulRate ) / 60U;
+    uint64_t ullFull = ( uint64_t ) pxLimiter->ulBurst * 1000U;
+
+    /* The refill tick only moves when something is added, so slow rates
+     * still accumulate over short calls. */
+    if( ullAdded == 0 )
+    {
+        return;
+    }
+
+    pxLimiter->xLastRefill = xNow;
+    pxLimiter->ulMilliTokens = ( uint32_t ) ( ( pxLimiter->ulMilliTokens + ullAdded < ullFull ) ?
+                                              pxLimiter->ulMilliTokens + ullAdded : ullFull );
+}
+/*-----------------------------------------------------------*/
+
+static void prvHalveRate( RateLimiter_t * pxLimiter )
+{
+    uint32_t ulMinRate = ( pxLimiter->ulMaxRate / 16U > 0 ) ? pxLimiter->ulMaxRate / 16U : 1U;
+
+    prvRefill( pxLimiter );
+
+    pxLimiter->ulRate = ( pxLimiter->ulRate / 2U > ulMinRate ) ? pxLimiter->ulRate / 2U : ulMinRate;
+    pxLimiter->xLastThrottle = xTaskGetTickCount();
+    pxLimiter->ulThrottled++;
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t RateLimiter_Init( RateLimiter_t * pxLimiter,
+                                   uint32_t ulRatePerMinute,
+                                   uint32_t ulBurst )
+{
+    if( ( pxLimiter == NULL ) || ( ulRatePerMinute == 0 ) || ( ulBurst == 0 ) )
+    {
+        return eAzureIoTErrorInvalidArgument;
+    }
+
+    pxLimiter->ulMaxRate = ulRatePerMinute;
+    pxLimiter->ulRate = ulRatePerMinute;
+    pxLimiter->ulBurst = ulBurst;
+    pxLimiter->ulMilliTokens = ulBurst * 1000U;
+    pxLimiter->xLastRefill = xTaskGetTickCount();
+    pxLimiter->xLastThrottle = pxLimiter->xLastRefill - pdMS_TO_TICKS( democonfigRATE_LIMIT_THROTTLE_MS );
+    pxLimiter->ulThrottled = 0;
+
+    return eAzureIoTSuccess;
+}
+/*-----------------------------------------------------------*/
+
+BaseType_t RateLimiter_TryTake( RateLimiter_t * pxLimiter,
+                                uint32_t ulMessageLength,
+                                TickType_t * pxWait )
+{
+    uint32_t ulCount = ratelimitMETERED_COUNT( ulMessageLength );
+    uint32_t ulNeeded;
+    uint64_t ullWaitMs;
+
+    if( ulCount == 0 )
+    {
+        ulCount = 1;
+    }
+    else if( ulCount > pxLimiter->ulBurst )
+    {
+        ulCount = pxLimiter->ulBurst;
+    }
+
+    ulNeeded = ulCount * 1000U;
+
+    prvRefill( pxLimiter );
+
+    if( pxLimiter->ulMilliTokens >= ulNeeded )
+    {
+        pxLimiter->ulMilliTokens -= ulNeeded;
+        return pdTRUE;
+    }
+
+    if( pxWait != NULL )
+    {
+        ullWaitMs = ( ( uint64_t ) ( ulNeeded - pxLimiter->ulMilliTokens ) * 60U +
+                      pxLimiter->ulRate - 1U ) / pxLimiter->ulRate;
+        *pxWait = pdMS_TO_TICKS( ( uint32_t ) ullWaitMs ) + 1;
+    }
+
+    return pdFALSE;
+}
+/*-----------------------------------------------------------*/
+
+void RateLimiter_ReportRoundTrip( RateLimiter_t * pxLimiter,
+                                  TickType_t xRoundTrip )
+{
+    uint32_t ulStep = ( pxLimiter->ulMaxRate / 32U > 0 ) ? pxLimiter->ulMaxRate / 32U : 1U;
+
+    if( xRoundTrip >= pdMS_TO_TICKS( democonfigRATE_LIMIT_THROTTLE_MS ) )
+    {
+        /* The messages sent before the rate was halved are slow as well, so
+         * they do not halve it again. */
+        if( ( xTaskGetTickCount() - pxLimiter->xLastThrottle ) >= pdMS_TO_TICKS( democonfigRATE_LIMIT_THROTTLE_MS ) )
+        {
+            prvHalveRate( pxLimiter );
+        }
+    }
+    else if( pxLimiter->ulRate < pxLimiter->ulMaxRate )
+    {
+        prvRefill( pxLimiter );
+
+        pxLimiter->ulRate = ( pxLimiter->ulRate + ulStep < pxLimiter->ulMaxRate ) ?
+                            pxLimiter->ulRate + ulStep : pxLimiter->ulMaxRate;
+    }
+}
+/*-----------------------------------------------------------*/
+
+void RateLimiter_ReportThrottled( RateLimiter_t * pxLimiter )
+{
+    prvHalveRate( pxLimiter );
+}
+/*-----------------------------------------------------------*/
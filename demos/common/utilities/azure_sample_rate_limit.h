@@ -0,0 +1,125 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @file azure_sample_rate_limit.h
+ *
+ * @brief Token bucket keeping telemetry within the quota of the IoT hub.
+ *
+ * IoT Hub meters device-to-cloud messages in blocks of ratelimitMETER_SIZE
+ * bytes, so a message takes one token for each block it starts. The bucket
+ * holds up to ulBurst tokens and refills at the current rate, in messages a
+ * minute; RateLimiter_TryTake() takes the tokens of a message or tells how
+ * long until they are there.
+ *
+ * Over MQTT a throttled hub holds back PUBACKs rather than rejecting
+ * messages, so RateLimiter_ReportRoundTrip() halves the rate, down to a
+ * sixteenth of the configured one, when a PUBACK takes longer than
+ * democonfigRATE_LIMIT_THROTTLE_MS, at most once in that time. Each prompt
+ * PUBACK then adds a thirty-second of the configured rate back, up to it.
+ * RateLimiter_ReportThrottled() halves the rate as well, for a disconnect
+ * under load.
+ */
+
+#ifndef AZURE_SAMPLE_RATE_LIMIT_H
+#define AZURE_SAMPLE_RATE_LIMIT_H
+
+#include <stdint.h>
+
+#include "FreeRTOS.h"
+
+#include "azure_iot_result.h"
+
+/**
+ * @brief 1 for the samples to rate limit their telemetry.
+ */
+#ifndef democonfigRATE_LIMIT
+    #define democonfigRATE_LIMIT                0
+#endif
+
+/**
+ * @brief Messages a minute, of ratelimitMETER_SIZE bytes each, the device may send.
+ * Set it to its share of the daily quota of the hub units.
+ */
+#ifndef democonfigRATE_LIMIT_PER_MINUTE
+    #define democonfigRATE_LIMIT_PER_MINUTE     60
+#endif
+
+/**
+ * @brief Messages sent back to back after the device has been quiet.
+ */
+#ifndef democonfigRATE_LIMIT_BURST
+    #define democonfigRATE_LIMIT_BURST          10
+#endif
+
+/**
+ * @brief PUBACK round trip, in milliseconds, taken as the hub throttling.
+ */
+#ifndef democonfigRATE_LIMIT_THROTTLE_MS
+    #define democonfigRATE_LIMIT_THROTTLE_MS    5000
+#endif
+
+/**
+ * @brief Bytes IoT Hub meters as one message.
+ */
+#define ratelimitMETER_SIZE                     4096U
+
+/**
+ * @brief Metered messages a message of \p ulLength bytes counts as.
+ */
+#define ratelimitMETERED_COUNT( ulLength )    ( ( ( ulLength ) + ratelimitMETER_SIZE - 1U ) / ratelimitMETER_SIZE )
+
+typedef struct RateLimiter
+{
+    uint32_t ulMaxRate;       /* Configured messages a minute. */
+    uint32_t ulRate;          /* Current messages a minute. */
+    uint32_t ulBurst;         /* Size of the bucket, in messages. */
+    uint32_t ulMilliTokens;   /* Tokens in the bucket, in thousandths. */
+    TickType_t xLastRefill;   /* Tick count the bucket was last refilled at. */
+    TickType_t xLastThrottle; /* Tick count the rate was last halved at. */
+    uint32_t ulThrottled;     /* Times the rate was halved. */
+} RateLimiter_t;
+
+/**
+ * @brief Initialize a full bucket.
+ *
+ * @param[out] pxLimiter The bucket to initialize.
+ * @param[in] ulRatePerMinute Messages a minute.
+ * @param[in] ulBurst Size of the bucket, in messages.
+ * @return An #AzureIoTResult_t with the result of the operation.
+ */
+AzureIoTResult_t RateLimiter_Init( RateLimiter_t * pxLimiter,
+                                   uint32_t ulRatePerMinute,
+                                   uint32_t ulBurst );
+
+/**
+ * @brief Take the tokens of a message, if they are in the bucket.
+ *
+ * A message larger than the bucket waits for a full bucket and empties it.
+ *
+ * @param[in] pxLimiter The bucket.
+ * @param[in] ulMessageLength Length of the message, in bytes.
+ * @param[out] pxWait Ticks until the tokens are there, when they are not.
+ * @return pdTRUE if the tokens were taken.
+ */
+BaseType_t RateLimiter_TryTake( RateLimiter_t * pxLimiter,
+                                uint32_t ulMessageLength,
+                                TickType_t * pxWait );
+
+/**
+ * @brief Adjust the rate to the PUBACK round trip of a message.
+ *
+ * @param[in] pxLimiter The bucket.
+ * @param[in] xRoundTrip Ticks from sending the message to its PUBACK.
+ */
+void RateLimiter_ReportRoundTrip( RateLimiter_t * pxLimiter,
+                                  TickType_t xRoundTrip );
+
+/**
+ * @brief Halve the rate.
+ *
+ * @param[in] pxLimiter The bucket.
+ */
+void RateLimiter_ReportThrottled( RateLimiter_t * pxLimiter );
+
+#endif /* AZURE_SAMPLE_RATE_LIMIT_H */
@@ -0,0 +1,135 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+#include "azure_sample_reconnect.h"
+
+#include <stddef.h>
+
+#define reconnectFNV_OFFSET_BASIS    0x811C9DC5UL
+#define reconnectFNV_PRIME           0x01000193UL
+/*-----------------------------------------------------------*/
+
+/* xorshift32, which must not be left in the all zero state. */
+static uint32_t prvNextRandom( ReconnectPolicy_t * pxPolicy )
+{
+    uint32_t ulState = pxPolicy->ulRandomState;
+
+    ulState ^= ulState << 13;
+    ulState ^= ulState >> 17;
+    ulState ^= ulState << 5;
+    pxPolicy->ulRandomState = ulState;
+
+    return ulState;
+}
+/*-----------------------------------------------------------*/
+
+/* A random number from 0 to ulMax, both included. */
+static uint32_t prvRandomUpTo( ReconnectPolicy_t * pxPolicy,
+                               uint32_t ulMax )
+{
+    if( ulMax == UINT32_MAX )
+    {
+        return prvNextRandom( pxPolicy );
+    }
+
+    return prvNextRandom( pxPolicy ) % ( ulMax + 1U );
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t ReconnectPolicy_Init( ReconnectPolicy_t * pxPolicy,
+                                       const uint8_t * pucIdentity,
+                                       uint32_t ulIdentityLength,
+                                       uint32_t ulRandom )
+{
+    uint32_t ulHash = reconnectFNV_OFFSET_BASIS;
+    uint32_t ulIndex;
+
+    if( ( pxPolicy == NULL ) || ( ( pucIdentity == NULL ) && ( ulIdentityLength > 0 ) ) )
+    {
+        return eAzureIoTErrorInvalidArgument;
+    }
+
+    for( ulIndex = 0; ulIndex < ulIdentityLength; ulIndex++ )
+    {
+        ulHash = ( ulHash ^ pucIdentity[ ulIndex ] ) * reconnectFNV_PRIME;
+    }
+
+    pxPolicy->ulRandomState = ulHash ^ ulRandom;
+
+    if( pxPolicy->ulRandomState == 0 )
+    {
+        pxPolicy->ulRandomState = reconnectFNV_OFFSET_BASIS;
+    }
+
+    pxPolicy->ulAttempts = 0;
+
+    return eAzureIoTSuccess;
+}
+/*-----------------------------------------------------------*/
+
+void ReconnectPolicy_Reset( ReconnectPolicy_t * pxPolicy )
+{
+    pxPolicy->ulAttempts = 0;
+}
+/*-----------------------------------------------------------*/
+
+uint32_t ReconnectPolicy_InitialDelay( ReconnectPolicy_t * pxPolicy )
+{
+    return prvRandomUpTo( pxPolicy, democonfigRECONNECT_INITIAL_DELAY_MS );
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t ReconnectPolicy_NextDelay( ReconnectPolicy_t * pxPolicy,
+                                            uint32_t * pulDelayMs )
+{
+    uint32_t ulBackoff = democonfigRECONNECT_BASE_MS;
+    uint32_t ulDoubling;
+
+    #if ( democonfigRECONNECT_MAX_ATTEMPTS > 0U )
+        if( pxPolicy->ulAttempts >= democonfigRECONNECT_MAX_ATTEMPTS )
+        {
+            return eAzureIoTErrorFailed;
+        }
+    #endif /* democonfigRECONNECT_MAX_ATTEMPTS > 0U */
+
+    /* Doubled once per earlier retry, stopping at the cap so it cannot overflow. */
+    for( ulDoubling = 0; ( ulDoubling < pxPolicy->ulAttempts ) &&
+         ( ulBackoff < democonfigRECONNECT_MAX_DELAY_MS ); ulDoubling++ )
+    {
+        ulBackoff = ( ulBackoff > ( democonfigRECONNECT_MAX_DELAY_MS / 2U ) ) ?
+                    democonfigRECONNECT_MAX_DELAY_MS : ( ulBackoff * 2U );
+    }
+
+    if( ulBackoff > democonfigRECONNECT_MAX_DELAY_MS )
+    {
+        ulBackoff = democonfigRECONNECT_MAX_DELAY_MS;
+    }
+
+    pxPolicy->ulAttempts++;
+    *pulDelayMs = prvRandomUpTo( pxPolicy, ulBackoff );
+
+    return eAzureIoTSuccess;
+}
+/*-----------------------------------------------------------*/
+
+uint32_t ReconnectPolicy_RetryAfterDelay( ReconnectPolicy_t * pxPolicy,
+                                          uint32_t ulRetryAfterMs )
+{
+    uint32_t ulDelay = prvRandomUpTo( pxPolicy, democonfigRECONNECT_RETRY_AFTER_JITTER_MS );
+
+    /* A jitter configured above the longest delay would wrap the bound below. */
+    if( ulDelay > democonfigRECONNECT_MAX_DELAY_MS )
+    {
+        ulDelay = democonfigRECONNECT_MAX_DELAY_MS;
+    }
+
+    /* The jitter only ever lengthens the wait, as polling before the time
+     * asked for is what gets a fleet throttled. */
+    if( ulRetryAfterMs > ( democonfigRECONNECT_MAX_DELAY_MS - ulDelay ) )
+    {
+        return democonfigRECONNECT_MAX_DELAY_MS;
+    }
+
+    return ulRetryAfterMs + ulDelay;
+}
+/*-----------------------------------------------------------*/
@@ -0,0 +1,121 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @file azure_sample_reconnect.h
+ *
+ * @brief Reconnect delays that spread a fleet out instead of keeping it in step.
+ *
+ * When power comes back to a whole site, every device starts at the same
+ * moment, and plain exponential backoff keeps them retrying together. Each
+ * delay is drawn from the full range between zero and the exponential
+ * backoff ("full jitter"), and the first connect after boot waits a random
+ * part of democonfigRECONNECT_INITIAL_DELAY_MS. The random numbers come from
+ * a generator seeded with the device identity as well as configRAND32(), so
+ * devices differ even where the random number generator is not seeded.
+ *
+ * A ReconnectPolicy_t holds no FreeRTOS objects and is not thread safe; use
+ * one per task that connects.
+ */
+
+#ifndef AZURE_SAMPLE_RECONNECT_H
+#define AZURE_SAMPLE_RECONNECT_H
+
+#include <stdint.h>
+
+#include "azure_iot_result.h"
+
+/**
+ * @brief Backoff of the first retry, in milliseconds. It doubles with each retry.
+ */
+#ifndef democonfigRECONNECT_BASE_MS
+    #define democonfigRECONNECT_BASE_MS             ( 500U )
+#endif
+
+/**
+ * @brief Longest backoff, in milliseconds.
+ */
+#ifndef democonfigRECONNECT_MAX_DELAY_MS
+    #define democonfigRECONNECT_MAX_DELAY_MS        ( 120U * 1000U )
+#endif
+
+/**
+ * @brief Attempts before a connect gives up, or 0 to retry forever.
+ */
+#ifndef democonfigRECONNECT_MAX_ATTEMPTS
+    #define democonfigRECONNECT_MAX_ATTEMPTS        ( 0U )
+#endif
+
+/**
+ * @brief Longest random wait before the first connect after boot, in milliseconds.
+ */
+#ifndef democonfigRECONNECT_INITIAL_DELAY_MS
+    #define democonfigRECONNECT_INITIAL_DELAY_MS    ( 5U * 1000U )
+#endif
+
+/**
+ * @brief Longest random wait added to a retry-after of the provisioning
+ * service, in milliseconds.
+ */
+#ifndef democonfigRECONNECT_RETRY_AFTER_JITTER_MS
+    #define democonfigRECONNECT_RETRY_AFTER_JITTER_MS    ( 2U * 1000U )
+#endif
+
+typedef struct ReconnectPolicy
+{
+    uint32_t ulRandomState;
+    uint32_t ulAttempts;
+} ReconnectPolicy_t;
+
+/**
+ * @brief Initialize a reconnect policy.
+ *
+ * @param[out] pxPolicy The policy to initialize.
+ * @param[in] pucIdentity Something unique to the device, such as its registration or device ID.
+ * @param[in] ulIdentityLength Length of \p pucIdentity.
+ * @param[in] ulRandom A random number, such as configRAND32().
+ * @return An #AzureIoTResult_t with the result of the operation.
+ */
+AzureIoTResult_t ReconnectPolicy_Init( ReconnectPolicy_t * pxPolicy,
+                                       const uint8_t * pucIdentity,
+                                       uint32_t ulIdentityLength,
+                                       uint32_t ulRandom );
+
+/**
+ * @brief Start counting attempts again, before each connect.
+ *
+ * @param[in] pxPolicy The policy.
+ */
+void ReconnectPolicy_Reset( ReconnectPolicy_t * pxPolicy );
+
+/**
+ * @brief Get the wait before the first connect after boot.
+ *
+ * @param[in] pxPolicy The policy.
+ * @return The wait in milliseconds, up to democonfigRECONNECT_INITIAL_DELAY_MS.
+ */
+uint32_t ReconnectPolicy_InitialDelay( ReconnectPolicy_t * pxPolicy );
+
+/**
+ * @brief Get the wait before the next attempt, after a failed one.
+ *
+ * @param[in] pxPolicy The policy.
+ * @param[out] pulDelayMs The wait in milliseconds.
+ * @return eAzureIoTErrorFailed once democonfigRECONNECT_MAX_ATTEMPTS were made.
+ */
+AzureIoTResult_t ReconnectPolicy_NextDelay( ReconnectPolicy_t * pxPolicy,
+                                            uint32_t * pulDelayMs );
+
+/**
+ * @brief Get the wait before polling a service that asked to be polled again
+ * after a time, the time with a random part of
+ * democonfigRECONNECT_RETRY_AFTER_JITTER_MS added.
+ *
+ * @param[in] pxPolicy The policy.
+ * @param[in] ulRetryAfterMs The time the service asked for, in milliseconds.
+ * @return The wait in milliseconds, up to democonfigRECONNECT_MAX_DELAY_MS.
+ */
+uint32_t ReconnectPolicy_RetryAfterDelay( ReconnectPolicy_t * pxPolicy,
+                                          uint32_t ulRetryAfterMs );
+
+#endif /* AZURE_SAMPLE_RECONNECT_H */
@@ -0,0 +1,402 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+#include "azure_sample_reported_properties.h"
+
+#include <stddef.h>
+#include <string.h>
+
+/* FreeRTOS includes. */
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "azure_iot_hub_client_properties.h"
+#include "azure_iot_json_writer.h"
+/*-----------------------------------------------------------*/
+
+static bool prvIsRoot( const ReportedProperty_t * pxProperty )
+{
+    return ( pxProperty->xName.pucComponentName == NULL ) || ( pxProperty->xName.ulComponentNameLength == 0 );
+}
+/*-----------------------------------------------------------*/
+
+static bool prvSameComponent( const ReportedProperty_t * pxLeft,
+                              const ReportedProperty_t * pxRight )
+{
+    return ( pxLeft->xName.ulComponentNameLength == pxRight->xName.ulComponentNameLength ) &&
+           ( memcmp( pxLeft->xName.pucComponentName, pxRight->xName.pucComponentName,
+                     pxLeft->xName.ulComponentNameLength ) == 0 );
+}
+/*-----------------------------------------------------------*/
+
+static void prvMark( ReportedProperties_t * pxStore,
+                     uint32_t ulIndex )
+{
+    /* The first change opens the window the following ones join. */
+    if( pxStore->ulChanged == 0 )
+    {
+        pxStore->xFirstChangeTime = xTaskGetTickCount();
+    }
+
+    pxStore->ulChanged |= ( 1UL << ulIndex );
+}
+/*-----------------------------------------------------------*/
+
+static ReportedProperty_t * prvProperty( ReportedProperties_t * pxStore,
+                                         uint32_t ulIndex,
+                                         ReportedPropertyType_t xType )
+{
+    if( ( pxStore == NULL ) || ( ulIndex >= pxStore->ulCount ) ||
+        ( ulIndex >= reportedpropertiesMAX_COUNT ) || ( pxStore->pxProperties[ ulIndex ].xType != xType ) )
+    {
+        return NULL;
+    }
+
+    return &pxStore->pxProperties[ ulIndex ];
+}
+/*-----------------------------------------------------------*/
+
+/* Marks the update in flight again once its response is overdue. */
+static void prvCheckInFlight( ReportedProperties_t * pxStore )
+{
+    if( ( pxStore->ulInFlight != 0 ) &&
+        ( ( xTaskGetTickCount() - pxStore->xSentTime ) >= pdMS_TO_TICKS( democonfigREPORTED_PROPERTIES_ACK_TIMEOUT_MS ) ) )
+    {
+        pxStore->ulChanged |= pxStore->ulInFlight;
+        pxStore->ulInFlight = 0;
+        pxStore->xSendNow = true;
+    }
+}
+/*-----------------------------------------------------------*/
+
+static AzureIoTResult_t prvAppendValue( AzureIoTJSONWriter_t * pxWriter,
+                                        const ReportedProperty_t * pxProperty )
+{
+    AzureIoTResult_t xResult;
+
+    if( ( xResult = AzureIoTJSONWriter_AppendPropertyName( pxWriter, pxProperty->xName.pucName,
+                                                           pxProperty->xName.ulNameLength ) ) != eAzureIoTSuccess )
+    {
+        return xResult;
+    }
+
+    return ReportedProperties_AppendValue( pxWriter, pxProperty );
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t ReportedProperties_AppendValue( AzureIoTJSONWriter_t * pxWriter,
+                                                 const ReportedProperty_t * pxProperty )
+{
+    switch( pxProperty->xType )
+    {
+        case eReportedPropertyBool:
+            return AzureIoTJSONWriter_AppendBool( pxWriter, pxProperty->xValue.xBool );
+
+        case eReportedPropertyInt32:
+            return AzureIoTJSONWriter_AppendInt32( pxWriter, pxProperty->xValue.lInt32 );
+
+        case eReportedPropertyDouble:
+            return AzureIoTJSONWriter_AppendDouble( pxWriter, pxProperty->xValue.xDouble,
+                                                    pxProperty->usFractionalDigits );
+
+        case eReportedPropertyString:
+            return AzureIoTJSONWriter_AppendString( pxWriter, pxProperty->xValue.xString.pucValue,
+                                                    pxProperty->xValue.xString.ulLength );
+
+        default:
+            return eAzureIoTErrorInvalidArgument;
+    }
+}
+/*-----------------------------------------------------------*/
+
+/* Writes the marked properties of the root component, then those of each
+ * component, in the order of the array. */
+static AzureIoTResult_t prvWriteUpdate( ReportedProperties_t * pxStore,
+                                        AzureIoTHubClient_t * pxHubClient,
+                                        AzureIoTJSONWriter_t * pxWriter )
+{
+    AzureIoTResult_t xResult;
+    uint32_t ulLeft = pxStore->ulChanged;
+    uint32_t ulIndex;
+    uint32_t ulNext;
+    const ReportedProperty_t * pxProperty;
+
+    if( ( xResult = AzureIoTJSONWriter_AppendBeginObject( pxWriter ) ) != eAzureIoTSuccess )
+    {
+        return xResult;
+    }
+
+    for( ulIndex = 0; ulIndex < pxStore->ulCount; ulIndex++ )
+    {
+        pxProperty = &pxStore->pxProperties[ ulIndex ];
+
+        if( ( ( ulLeft & ( 1UL << ulIndex ) ) != 0 ) && prvIsRoot( pxProperty ) )
+        {
+            if( ( xResult = prvAppendValue( pxWriter, pxProperty ) ) != eAzureIoTSuccess )
+            {
+                return xResult;
+            }
+
+            ulLeft &= ~( 1UL << ulIndex );
+        }
+    }
+
+    for( ulIndex = 0; ( ulIndex < pxStore->ulCount ) && ( ulLeft != 0 ); ulIndex++ )
+    {
+        pxProperty = &pxStore->pxProperties[ ulIndex ];
+
+        if( ( ulLeft & ( 1UL << ulIndex ) ) == 0 )
+        {
+            continue;
+        }
+
+        if( ( xResult = AzureIoTHubClientProperties_BuilderBeginComponent( pxHubClient, pxWriter,
+                                                                           pxProperty->xName.pucComponentName,
+                                                                           pxProperty->xName.ulComponentNameLength ) ) != eAzureIoTSuccess )
+        {
+            return xResult;
+        }
+
+        for( ulNext = ulIndex; ulNext < pxStore->ulCount; ulNext++ )
+        {
+            if( ( ( ulLeft & ( 1UL << ulNext ) ) != 0 ) &&
+                prvSameComponent( pxProperty, &pxStore->pxProperties[ ulNext ] ) )
+            {
+                if( ( xResult = prvAppendValue( pxWriter, &pxStore->pxProperties[ ulNext ] ) ) != eAzureIoTSuccess )
+                {
+                    return xResult;
+                }
+
+                ulLeft &= ~( 1UL << ulNext );
+            }
+        }
+
+        if( ( xResult = AzureIoTHubClientProperties_BuilderEndComponent( pxHubClient, pxWriter ) ) != eAzureIoTSuccess )
+        {
+            return xResult;
+        }
+    }
+
+    return AzureIoTJSONWriter_AppendEndObject( pxWriter );
+}
+/*-----------------------------------------------------------*/
+
+void ReportedProperties_SetBool( ReportedProperties_t * pxStore,
+                                 uint32_t ulIndex,
+                                 bool xValue )
+{
+    ReportedProperty_t * pxProperty = prvProperty( pxStore, ulIndex, eReportedPropertyBool );
+
+    if( ( pxProperty != NULL ) && ( pxProperty->xValue.xBool != xValue ) )
+    {
+        pxProperty->xValue.xBool = xValue;
+        prvMark( pxStore, ulIndex );
+    }
+}
+/*-----------------------------------------------------------*/
+
+void ReportedProperties_SetInt32( ReportedProperties_t * pxStore,
+                                  uint32_t ulIndex,
+                                  int32_t lValue )
+{
+    ReportedProperty_t * pxProperty = prvProperty( pxStore, ulIndex, eReportedPropertyInt32 );
+
+    if( ( pxProperty != NULL ) && ( pxProperty->xValue.lInt32 != lValue ) )
+    {
+        pxProperty->xValue.lInt32 = lValue;
+        prvMark( pxStore, ulIndex );
+    }
+}
+/*-----------------------------------------------------------*/
+
+void ReportedProperties_SetDouble( ReportedProperties_t * pxStore,
+                                   uint32_t ulIndex,
+                                   double xValue )
+{
+    ReportedProperty_t * pxProperty = prvProperty( pxStore, ulIndex, eReportedPropertyDouble );
+
+    if( ( pxProperty != NULL ) && ( pxProperty->xValue.xDouble != xValue ) )
+    {
+        pxProperty->xValue.xDouble = xValue;
+        prvMark( pxStore, ulIndex );
+    }
+}
+/*-----------------------------------------------------------*/
+
+void ReportedProperties_SetString( ReportedProperties_t * pxStore,
+                                   uint32_t ulIndex,
+                                   const uint8_t * pucValue,
+                                   uint32_t ulLength )
+{
+    ReportedProperty_t * pxProperty = prvProperty( pxStore, ulIndex, eReportedPropertyString );
+
+    if( ( pxProperty == NULL ) || ( ( pucValue == NULL ) && ( ulLength > 0 ) ) )
+    {
+        return;
+    }
+
+    if( ( pxProperty->xValue.xString.ulLength != ulLength ) ||
+        ( ( ulLength > 0 ) &&
+          ( memcmp( pxProperty->xValue.xString.pucValue, pucValue, ulLength ) != 0 ) ) )
+    {
+        prvMark( pxStore, ulIndex );
+    }
+
+    /* Kept even when equal, as the earlier buffer may not live as long. */
+    pxProperty->xValue.xString.pucValue = pucValue;
+    pxProperty->xValue.xString.ulLength = ulLength;
+}
+/*-----------------------------------------------------------*/
+
+void ReportedProperties_Flush( ReportedProperties_t * pxStore )
+{
+    pxStore->xSendNow = true;
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t ReportedProperties_Build( ReportedProperties_t * pxStore,
+                                           AzureIoTHubClient_t * pxHubClient,
+                                           uint8_t * pucBuffer,
+                                           uint32_t ulBufferSize,
+                                           uint32_t * pulLength )
+{
+    AzureIoTResult_t xResult;
+    AzureIoTJSONWriter_t xWriter;
+    int32_t lBytesWritten;
+
+    if( ( pxStore == NULL ) || ( pxHubClient == NULL ) || ( pucBuffer == NULL ) || ( pulLength == NULL ) ||
+        ( pxStore->ulCount > reportedpropertiesMAX_COUNT ) )
+    {
+        return eAzureIoTErrorInvalidArgument;
+    }
+
+    *pulLength = 0;
+
+    prvCheckInFlight( pxStore );
+
+    if( ( pxStore->ulInFlight != 0 ) || ( ReportedProperties_TimeUntilDue( pxStore ) != 0 ) )
+    {
+        return eAzureIoTSuccess;
+    }
+
+    if( ( ( xResult = AzureIoTJSONWriter_Init( &xWriter, pucBuffer, ulBufferSize ) ) != eAzureIoTSuccess ) ||
+        ( ( xResult = prvWriteUpdate( pxStore, pxHubClient, &xWriter ) ) != eAzureIoTSuccess ) )
+    {
+        return ( xResult == eAzureIoTErrorInvalidArgument ) ? xResult : eAzureIoTErrorOutOfMemory;
+    }
+
+    if( ( lBytesWritten = AzureIoTJSONWriter_GetBytesUsed( &xWriter ) ) <= 0 )
+    {
+        return eAzureIoTErrorFailed;
+    }
+
+    /* In flight from here, so an update that is never sent is retried as well. */
+    pxStore->ulInFlight = pxStore->ulChanged;
+    pxStore->ulChanged = 0;
+    pxStore->xSendNow = false;
+    pxStore->xSentTime = xTaskGetTickCount();
+    *pulLength = ( uint32_t ) lBytesWritten;
+
+    return eAzureIoTSuccess;
+}
+/*-----------------------------------------------------------*/
+
+void ReportedProperties_Sent( ReportedProperties_t * pxStore,
+                              uint32_t ulRequestId,
+                              AzureIoTResult_t xSendResult )
+{
+    if( xSendResult != eAzureIoTSuccess )
+    {
+        if( ( pxStore->ulChanged == 0 ) && ( pxStore->ulInFlight != 0 ) )
+        {
+            pxStore->xFirstChangeTime = xTaskGetTickCount();
+        }
+
+        pxStore->ulChanged |= pxStore->ulInFlight;
+        pxStore->ulInFlight = 0;
+        return;
+    }
+
+    pxStore->ulRequestId = ulRequestId;
+    pxStore->xSentTime = xTaskGetTickCount();
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t ReportedProperties_Send( ReportedProperties_t * pxStore,
+                                          AzureIoTHubClient_t * pxHubClient,
+                                          uint8_t * pucBuffer,
+                                          uint32_t ulBufferSize )
+{
+    AzureIoTResult_t xResult;
+    uint32_t ulLength;
+    uint32_t ulRequestId = 0;
+
+    if( ( ( xResult = ReportedProperties_Build( pxStore, pxHubClient, pucBuffer,
+                                                ulBufferSize, &ulLength ) ) != eAzureIoTSuccess ) ||
+        ( ulLength == 0 ) )
+    {
+        return xResult;
+    }
+
+    xResult = AzureIoTHubClient_SendPropertiesReported( pxHubClient, pucBuffer, ulLength, &ulRequestId );
+    ReportedProperties_Sent( pxStore, ulRequestId, xResult );
+
+    return xResult;
+}
+/*-----------------------------------------------------------*/
+
+void ReportedProperties_HandleResponse( ReportedProperties_t * pxStore,
+                                        const AzureIoTHubClientPropertiesResponse_t * pxMessage )
+{
+    uint32_t ulStatus;
+
+    if( ( pxStore == NULL ) || ( pxMessage == NULL ) || ( pxStore->ulInFlight == 0 ) ||
+        ( pxMessage->xMessageType != eAzureIoTHubPropertiesReportedResponseMessage ) ||
+        ( pxMessage->ulRequestID != pxStore->ulRequestId ) )
+    {
+        return;
+    }
+
+    ulStatus = ( uint32_t ) pxMessage->xMessageStatus;
+
+    if( ( ulStatus < 200 ) || ( ulStatus >= 300 ) )
+    {
+        if( pxStore->ulChanged == 0 )
+        {
+            pxStore->xFirstChangeTime = xTaskGetTickCount();
+        }
+
+        pxStore->ulChanged |= pxStore->ulInFlight;
+    }
+
+    pxStore->ulInFlight = 0;
+}
+/*-----------------------------------------------------------*/
+
+TickType_t ReportedProperties_TimeUntilDue( const ReportedProperties_t * pxStore )
+{
+    TickType_t xElapsed;
+    TickType_t xWait;
+
+    if( pxStore->ulInFlight != 0 )
+    {
+        xElapsed = xTaskGetTickCount() - pxStore->xSentTime;
+        xWait = pdMS_TO_TICKS( democonfigREPORTED_PROPERTIES_ACK_TIMEOUT_MS );
+    }
+    else if( pxStore->ulChanged == 0 )
+    {
+        return portMAX_DELAY;
+    }
+    else if( pxStore->xSendNow )
+    {
+        return 0;
+    }
+    else
+    {
+        xElapsed = xTaskGetTickCount() - pxStore->xFirstChangeTime;
+        xWait = pdMS_TO_TICKS( democonfigREPORTED_PROPERTIES_WINDOW_MS );
+    }
+
+    return ( xElapsed >= xWait ) ? 0 : ( xWait - xElapsed );
+}
+/*-----------------------------------------------------------*/
@@ -0,0 +1,237 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @file azure_sample_reported_properties.h
+ *
+ * @brief Reported properties that are only sent when they change.
+ *
+ * A sample lists its reported properties in an array of ReportedProperty_t
+ * and sets their values whenever it likes. Only values that changed are
+ * marked, and ReportedProperties_Build() writes just the marked properties,
+ * grouped by component, in one update. The first change opens a window of
+ * democonfigREPORTED_PROPERTIES_WINDOW_MS, and changes made within it go out
+ * together when it closes, so the twin traffic follows how often values
+ * change rather than how many properties there are.
+ *
+ * Only one update is in flight at a time. It is cleared once IoT Hub accepts
+ * it, and its properties are marked again when it is refused, when it could
+ * not be sent or when no response came within
+ * democonfigREPORTED_PROPERTIES_ACK_TIMEOUT_MS, such as after a disconnect.
+ *
+ * All the properties are marked at first, so the first update reports them
+ * all, without waiting for the window. A ReportedProperties_t is not thread
+ * safe; it is used by the task running the process loop.
+ */
+
+#ifndef AZURE_SAMPLE_REPORTED_PROPERTIES_H
+#define AZURE_SAMPLE_REPORTED_PROPERTIES_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "FreeRTOS.h"
+
+#include "azure_iot_hub_client.h"
+#include "azure_iot_json_writer.h"
+
+#include "azure_sample_dispatch_table.h"
+
+/**
+ * @brief Time changes are gathered for before they are reported, in milliseconds.
+ */
+#ifndef democonfigREPORTED_PROPERTIES_WINDOW_MS
+    #define democonfigREPORTED_PROPERTIES_WINDOW_MS        ( 2 * 1000U )
+#endif
+
+/**
+ * @brief Longest an update waits for its response before it is reported again, in milliseconds.
+ */
+#ifndef democonfigREPORTED_PROPERTIES_ACK_TIMEOUT_MS
+    #define democonfigREPORTED_PROPERTIES_ACK_TIMEOUT_MS    ( 30 * 1000U )
+#endif
+
+/**
+ * @brief Most properties in one ReportedProperties_t.
+ */
+#define reportedpropertiesMAX_COUNT                         ( 32U )
+
+/**
+ * @brief Initializer of a #ReportedProperties_t for the array pxProperties,
+ * which marks all the properties.
+ */
+#define reportedpropertiesINIT( pxProperties )                                                      \
+    {                                                                                               \
+        ( pxProperties ), sizeof( pxProperties ) / sizeof( ( pxProperties )[ 0 ] ),                 \
+        ( uint32_t ) ( ( ( uint64_t ) 1U << ( sizeof( pxProperties ) / sizeof( ( pxProperties )[ 0 ] ) ) ) - 1U ), \
+        0, 0, 0, 0, true                                                                            \
+    }
+
+typedef enum ReportedPropertyType
+{
+    eReportedPropertyBool = 0,
+    eReportedPropertyInt32,
+    eReportedPropertyDouble,
+    eReportedPropertyString
+} ReportedPropertyType_t;
+
+typedef struct ReportedProperty
+{
+    DispatchName_t xName;
+    ReportedPropertyType_t xType;
+    uint16_t usFractionalDigits; /* Of a double. */
+    union
+    {
+        bool xBool;
+        int32_t lInt32;
+        double xDouble;
+        struct
+        {
+            const uint8_t * pucValue; /* Must stay valid until it is replaced. */
+            uint32_t ulLength;
+        } xString;
+    } xValue;
+} ReportedProperty_t;
+
+typedef struct ReportedProperties
+{
+    ReportedProperty_t * pxProperties;
+    uint32_t ulCount;
+    uint32_t ulChanged;
+    uint32_t ulInFlight;
+    uint32_t ulRequestId;
+    TickType_t xFirstChangeTime;
+    TickType_t xSentTime;
+    bool xSendNow;
+} ReportedProperties_t;
+
+/**
+ * @brief Set a boolean property, marking it if the value changed.
+ *
+ * @param[in] pxStore The properties.
+ * @param[in] ulIndex Index of the property in the array.
+ * @param[in] xValue The value.
+ */
+void ReportedProperties_SetBool( ReportedProperties_t * pxStore,
+                                 uint32_t ulIndex,
+                                 bool xValue );
+
+/**
+ * @brief Set an integer property, marking it if the value changed.
+ *
+ * @param[in] pxStore The properties.
+ * @param[in] ulIndex Index of the property in the array.
+ * @param[in] lValue The value.
+ */
+void ReportedProperties_SetInt32( ReportedProperties_t * pxStore,
+                                  uint32_t ulIndex,
+                                  int32_t lValue );
+
+/**
+ * @brief Set a double property, marking it if the value changed.
+ *
+ * @param[in] pxStore The properties.
+ * @param[in] ulIndex Index of the property in the array.
+ * @param[in] xValue The value.
+ */
+void ReportedProperties_SetDouble( ReportedProperties_t * pxStore,
+                                   uint32_t ulIndex,
+                                   double xValue );
+
+/**
+ * @brief Set a string property, marking it if the value changed.
+ *
+ * The string is not copied, and must stay valid until it is replaced.
+ *
+ * @param[in] pxStore The properties.
+ * @param[in] ulIndex Index of the property in the array.
+ * @param[in] pucValue The value, not quoted.
+ * @param[in] ulLength Length of \p pucValue.
+ */
+void ReportedProperties_SetString( ReportedProperties_t * pxStore,
+                                   uint32_t ulIndex,
+                                   const uint8_t * pucValue,
+                                   uint32_t ulLength );
+
+/**
+ * @brief Report the marked properties with the next update, without waiting for the window.
+ *
+ * @param[in] pxStore The properties.
+ */
+void ReportedProperties_Flush( ReportedProperties_t * pxStore );
+
+/**
+ * @brief Write the update of the marked properties, if one is due.
+ *
+ * Send the update, then pass its request ID and the result to
+ * ReportedProperties_Sent().
+ *
+ * @param[in] pxStore The properties.
+ * @param[in] pxHubClient The client, for the component format.
+ * @param[out] pucBuffer Buffer for the update.
+ * @param[in] ulBufferSize Size of \p pucBuffer.
+ * @param[out] pulLength Length of the update, 0 when none is due.
+ * @return eAzureIoTErrorOutOfMemory if the update does not fit \p pucBuffer.
+ */
+AzureIoTResult_t ReportedProperties_Build( ReportedProperties_t * pxStore,
+                                           AzureIoTHubClient_t * pxHubClient,
+                                           uint8_t * pucBuffer,
+                                           uint32_t ulBufferSize,
+                                           uint32_t * pulLength );
+
+/**
+ * @brief Record that the update written by ReportedProperties_Build() was sent.
+ *
+ * @param[in] pxStore The properties.
+ * @param[in] ulRequestId Request ID from AzureIoTHubClient_SendPropertiesReported().
+ * @param[in] xSendResult Result of AzureIoTHubClient_SendPropertiesReported().
+ */
+void ReportedProperties_Sent( ReportedProperties_t * pxStore,
+                              uint32_t ulRequestId,
+                              AzureIoTResult_t xSendResult );
+
+/**
+ * @brief Build and send the update of the marked properties, if one is due.
+ *
+ * @param[in] pxStore The properties.
+ * @param[in] pxHubClient The client to send it with.
+ * @param[in] pucBuffer Buffer for the update.
+ * @param[in] ulBufferSize Size of \p pucBuffer.
+ * @return An #AzureIoTResult_t with the result of the operation.
+ */
+AzureIoTResult_t ReportedProperties_Send( ReportedProperties_t * pxStore,
+                                          AzureIoTHubClient_t * pxHubClient,
+                                          uint8_t * pucBuffer,
+                                          uint32_t ulBufferSize );
+
+/**
+ * @brief Handle the response to a reported properties update.
+ *
+ * Responses to updates sent otherwise are ignored.
+ *
+ * @param[in] pxStore The properties.
+ * @param[in] pxMessage A message of type eAzureIoTHubPropertiesReportedResponseMessage.
+ */
+void ReportedProperties_HandleResponse( ReportedProperties_t * pxStore,
+                                        const AzureIoTHubClientPropertiesResponse_t * pxMessage );
+
+/**
+ * @brief Append the value of a property, without its name, such as in the
+ * response status of a writable property.
+ *
+ * @param[in] pxWriter The writer.
+ * @param[in] pxProperty The property.
+ * @return An #AzureIoTResult_t with the result of the operation.
+ */
+AzureIoTResult_t ReportedProperties_AppendValue( AzureIoTJSONWriter_t * pxWriter,
+                                                 const ReportedProperty_t * pxProperty );
+
+/**
+ * @brief Time until the next update is due, for a process loop timeout.
+ *
+ * @param[in] pxStore The properties.
+ * @return The time in ticks, or portMAX_DELAY when nothing is marked.
+ */
+TickType_t ReportedProperties_TimeUntilDue( const ReportedProperties_t * pxStore );
+
+#endif /* AZURE_SAMPLE_REPORTED_PROPERTIES_H */
@@ -0,0 +1,184 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+#include "azure_sample_soak.h"
+
+#include <stdbool.h>
+
+/* Kernel includes. */
+#include "FreeRTOS.h"
+#include "task.h"
+
+/* Demo Specific configs. */
+#include "demo_config.h"
+
+/* Built into the samples whether they soak or not, so it is empty when the
+ * hooks are not set. */
+#if ( democonfigSOAK == 1 )
+
+/* Millisecond clock the connects are timed with, which demo_config.h may
+ * give from the host. */
+#ifndef democonfigSOAK_TIME_MS
+    #define democonfigSOAK_TIME_MS()    ( ( uint32_t ) ( xTaskGetTickCount() * portTICK_PERIOD_MS ) )
+#endif
+
+/* Called when the run ends, with 0 when it passed and 1 when it failed. */
+#ifndef democonfigSOAK_DONE
+    #define democonfigSOAK_DONE( lStatus )    vTaskSuspend( NULL )
+#endif
+
+/* The connect time is averaged over about this many cycles, as a single
+ * connect may wait on a retransmission. */
+#define soakLATENCY_AVERAGE_SHIFT    3U
+
+/* Added to the connect time allowed, so that a baseline of a few
+ * milliseconds, to a local broker, does not fail on the jitter of the tick. */
+#define soakLATENCY_SLACK_MS         20U
+
+/* The measures of a cycle, and of the baseline. */
+typedef struct SoakMeasures
+{
+    uint32_t ulFreeHeap;
+    uint32_t ulSockets;
+    uint32_t ulTasks;
+    uint32_t ulLatencyMs;
+} SoakMeasures_t;
+
+static uint32_t ulCycle;
+static uint32_t ulConnectStartMs;
+static uint32_t ulLatencyMs;
+static uint32_t ulAverageLatencyMs;
+static uint32_t ulWarmupLatencySumMs;
+static SoakMeasures_t xBaseline;
+
+/* Cycles in a row each check failed. */
+static uint32_t ulHeapFailures;
+static uint32_t ulSocketFailures;
+static uint32_t ulTaskFailures;
+static uint32_t ulLatencyFailures;
+/*-----------------------------------------------------------*/
+
+static bool prvCheck( bool xFailed,
+                      uint32_t * pulFailures,
+                      const char * pcName )
+{
+    if( !xFailed )
+    {
+        *pulFailures = 0;
+        return false;
+    }
+
+    ( *pulFailures )++;
+
+    if( *pulFailures < democonfigSOAK_DRIFT_CYCLES )
+    {
+        return false;
+    }
+
+    LogError( ( "Soak failed at cycle %u: %s drifted for %u cycles.\r\n",
+                ( unsigned int ) ulCycle, pcName, ( unsigned int ) *pulFailures ) );
+
+    return true;
+}
+/*-----------------------------------------------------------*/
+
+void Soak_ConnectBegin( void )
+{
+    ulConnectStartMs = democonfigSOAK_TIME_MS();
+}
+/*-----------------------------------------------------------*/
+
+void Soak_Connected( void )
+{
+    ulLatencyMs = democonfigSOAK_TIME_MS() - ulConnectStartMs;
+}
+/*-----------------------------------------------------------*/
+
+SoakDisconnect_t Soak_Disconnect( void )
+{
+    static const char cScript[] = democonfigSOAK_SCRIPT;
+
+    switch( cScript[ ulCycle % ( sizeof( cScript ) - 1U ) ] )
+    {
+        case 'a':
+            return eSoakDisconnectAbrupt;
+
+        case 'p':
+            return eSoakDisconnectReprovision;
+
+        default:
+            return eSoakDisconnectClean;
+    }
+}
+/*-----------------------------------------------------------*/
+
+void Soak_CycleEnd( void )
+{
+    SoakMeasures_t xMeasures;
+    bool xFailed = false;
+
+    xMeasures.ulFreeHeap = ( uint32_t ) xPortGetFreeHeapSize();
+    xMeasures.ulSockets = Soak_PlatformOpenSockets();
+    xMeasures.ulTasks = ( uint32_t ) uxTaskGetNumberOfTasks();
+    xMeasures.ulLatencyMs = ulLatencyMs;
+
+    ulCycle++;
+
+    if( ulCycle <= democonfigSOAK_WARMUP_CYCLES )
+    {
+        /* The baseline is that of the last warmup cycle, but for the connect
+         * time, which is averaged over all of them. */
+        ulWarmupLatencySumMs += ulLatencyMs;
+        xBaseline = xMeasures;
+        xBaseline.ulLatencyMs = ulWarmupLatencySumMs / ulCycle;
+        ulAverageLatencyMs = xBaseline.ulLatencyMs;
+
+        LogInfo( ( "Soak warmup %u: heap %u, sockets %u, tasks %u, connect %u ms.\r\n",
+                   ( unsigned int ) ulCycle, ( unsigned int ) xMeasures.ulFreeHeap,
+                   ( unsigned int ) xMeasures.ulSockets, ( unsigned int ) xMeasures.ulTasks,
+                   ( unsigned int ) xMeasures.ulLatencyMs ) );
+        return;
+    }
+
+    /* ulAverageLatencyMs += ( ulLatencyMs - ulAverageLatencyMs ) / 8, in unsigned. */
+    ulAverageLatencyMs = ulAverageLatencyMs - ( ulAverageLatencyMs >> soakLATENCY_AVERAGE_SHIFT ) +
+                         ( ulLatencyMs >> soakLATENCY_AVERAGE_SHIFT );
+
+    LogInfo( ( "Soak cycle %u: heap %u (%d), sockets %u (%d), tasks %u (%d), connect %u ms, average %u ms (%u).\r\n",
+               ( unsigned int ) ulCycle,
+               ( unsigned int ) xMeasures.ulFreeHeap,
+               ( int ) ( xMeasures.ulFreeHeap - xBaseline.ulFreeHeap ),
+               ( unsigned int ) xMeasures.ulSockets,
+               ( int ) ( xMeasures.ulSockets - xBaseline.ulSockets ),
+               ( unsigned int ) xMeasures.ulTasks,
+               ( int ) ( xMeasures.ulTasks - xBaseline.ulTasks ),
+               ( unsigned int ) xMeasures.ulLatencyMs,
+               ( unsigned int ) ulAverageLatencyMs,
+               ( unsigned int ) xBaseline.ulLatencyMs ) );
+
+    /* Every check is run, so each keeps its count of cycles in a row. */
+    xFailed |= prvCheck( ( xMeasures.ulFreeHeap + democonfigSOAK_HEAP_DRIFT_BYTES ) < xBaseline.ulFreeHeap,
+                         &ulHeapFailures, "free heap" );
+    xFailed |= prvCheck( xMeasures.ulSockets > xBaseline.ulSockets, &ulSocketFailures, "open sockets" );
+    xFailed |= prvCheck( xMeasures.ulTasks > xBaseline.ulTasks, &ulTaskFailures, "tasks" );
+    xFailed |= prvCheck( ( uint64_t ) ulAverageLatencyMs >
+                         ( uint64_t ) xBaseline.ulLatencyMs * ( 100U + democonfigSOAK_LATENCY_DRIFT_PERCENT ) / 100U +
+                         soakLATENCY_SLACK_MS,
+                         &ulLatencyFailures, "connect time" );
+
+    if( xFailed )
+    {
+        democonfigSOAK_DONE( 1 );
+    }
+
+    #if ( democonfigSOAK_CYCLES != 0U )
+        else if( ulCycle >= democonfigSOAK_CYCLES )
+        {
+            LogInfo( ( "Soak passed %u cycles.\r\n", ( unsigned int ) ulCycle ) );
+            democonfigSOAK_DONE( 0 );
+        }
+    #endif
+}
+/*-----------------------------------------------------------*/
+
+#endif /* democonfigSOAK == 1 */
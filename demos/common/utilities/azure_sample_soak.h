@@ -0,0 +1,145 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @file azure_sample_soak.h
+ *
+ * @brief Checks that the connect, telemetry and disconnect cycles of a sample
+ * leave nothing behind, for soak runs of thousands of cycles.
+ *
+ * With democonfigSOAK set to 1, as the -soak executable of the Linux port
+ * does, the hub sample runs its cycles back to back. democonfigSOAK_SCRIPT
+ * picks how each cycle disconnects: cleanly, abruptly, without the MQTT
+ * DISCONNECT or the unsubscribes, as a lost network does, or cleanly and then
+ * registering with DPS again. At the end of each cycle, once the connection
+ * is closed, Soak_CycleEnd() reads the free heap, the sockets open, the
+ * number of tasks and the time the connect to IoT Hub took, and logs them
+ * against the baseline taken after democonfigSOAK_WARMUP_CYCLES.
+ *
+ * The run fails, with democonfigSOAK_DONE( 1 ), once for
+ * democonfigSOAK_DRIFT_CYCLES cycles in a row the free heap is
+ * democonfigSOAK_HEAP_DRIFT_BYTES below the baseline, there are more sockets
+ * or tasks than in the baseline, or the average connect time is
+ * democonfigSOAK_LATENCY_DRIFT_PERCENT above it. Taking a few cycles in a
+ * row lets a socket that is still closing, or a slow connect, pass. It
+ * passes, with democonfigSOAK_DONE( 0 ), after democonfigSOAK_CYCLES.
+ *
+ * The free heap is that of xPortGetFreeHeapSize(), so the heap must be one
+ * that counts it, heap_4 or heap_5. Each board gives the sockets it has open
+ * with Soak_PlatformOpenSockets().
+ */
+
+#ifndef AZURE_SAMPLE_SOAK_H
+#define AZURE_SAMPLE_SOAK_H
+
+#include <stdint.h>
+
+/**
+ * @brief 1 to run the soak checks, set by the -soak executable of the Linux port.
+ */
+#ifndef democonfigSOAK
+    #define democonfigSOAK    0
+#endif
+
+/**
+ * @brief Cycles to run before passing, 0 to run until a check fails.
+ */
+#ifndef democonfigSOAK_CYCLES
+    #define democonfigSOAK_CYCLES    ( 0U )
+#endif
+
+/**
+ * @brief Cycles run before the baseline is taken, for the caches, the TLS
+ * session and the heap to settle.
+ */
+#ifndef democonfigSOAK_WARMUP_CYCLES
+    #define democonfigSOAK_WARMUP_CYCLES    ( 5U )
+#endif
+
+/**
+ * @brief How the cycles disconnect, one letter each, the script repeating:
+ * 'c' cleanly, 'a' abruptly, 'p' cleanly then provisioning again.
+ */
+#ifndef democonfigSOAK_SCRIPT
+    #define democonfigSOAK_SCRIPT    "ccacap"
+#endif
+
+/**
+ * @brief Free heap lost since the baseline, in bytes, that counts as a leak.
+ */
+#ifndef democonfigSOAK_HEAP_DRIFT_BYTES
+    #define democonfigSOAK_HEAP_DRIFT_BYTES    ( 2048U )
+#endif
+
+/**
+ * @brief Rise of the average connect time over the baseline, in percent,
+ * that counts as a slowdown.
+ */
+#ifndef democonfigSOAK_LATENCY_DRIFT_PERCENT
+    #define democonfigSOAK_LATENCY_DRIFT_PERCENT    ( 200U )
+#endif
+
+/**
+ * @brief Cycles in a row a check must fail for the run to fail.
+ */
+#ifndef democonfigSOAK_DRIFT_CYCLES
+    #define democonfigSOAK_DRIFT_CYCLES    ( 3U )
+#endif
+
+/**
+ * @brief Wait between two cycles, in milliseconds.
+ */
+#ifndef democonfigSOAK_CYCLE_DELAY_MS
+    #define democonfigSOAK_CYCLE_DELAY_MS    ( 1000U )
+#endif
+
+/**
+ * @brief How a cycle disconnects.
+ */
+typedef enum SoakDisconnect
+{
+    eSoakDisconnectClean = 0,  /* Unsubscribe, MQTT DISCONNECT and close. */
+    eSoakDisconnectAbrupt,     /* Close the connection only. */
+    eSoakDisconnectReprovision /* Clean, then register with DPS again. */
+} SoakDisconnect_t;
+
+#if ( democonfigSOAK == 1 )
+    #define soakCONNECT_BEGIN()    Soak_ConnectBegin()
+    #define soakCONNECTED()        Soak_Connected()
+    #define soakDISCONNECT()       Soak_Disconnect()
+    #define soakCYCLE_END()        Soak_CycleEnd()
+#else
+    #define soakCONNECT_BEGIN()    do {} while( 0 )
+    #define soakCONNECTED()        do {} while( 0 )
+    #define soakDISCONNECT()       ( eSoakDisconnectClean )
+    #define soakCYCLE_END()        do {} while( 0 )
+#endif /* democonfigSOAK == 1 */
+
+/**
+ * @brief Record that the connection to IoT Hub starts, before the TLS connect.
+ */
+void Soak_ConnectBegin( void );
+
+/**
+ * @brief Record that the CONNACK arrived.
+ */
+void Soak_Connected( void );
+
+/**
+ * @brief How the cycle is to disconnect, from democonfigSOAK_SCRIPT.
+ */
+SoakDisconnect_t Soak_Disconnect( void );
+
+/**
+ * @brief Check the cycle against the baseline, once its connection is closed.
+ *
+ * Calls democonfigSOAK_DONE() when the run passed or failed.
+ */
+void Soak_CycleEnd( void );
+
+/**
+ * @brief Sockets open in the network stack. Implemented by each board.
+ */
+uint32_t Soak_PlatformOpenSockets( void );
+
+#endif /* AZURE_SAMPLE_SOAK_H */
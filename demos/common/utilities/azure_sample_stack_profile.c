@@ -0,0 +1,337 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+#include "azure_sample_stack_profile.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/* FreeRTOS includes. */
+#include "FreeRTOS.h"
+#include "task.h"
+#include "timers.h"
+
+/* sampletaskCREATE_TASK(), the creation without the profile. */
+#include "azure_sample_task.h"
+
+/* Built into the samples whether the stacks are profiled or not, so it is
+ * empty when sampletaskCREATE() does not call it. */
+#if ( democonfigSTACK_PROFILE == 1 )
+
+/* Round the recommended depths up to a multiple of this. */
+#define stackprofileROUNDING    ( 32U )
+
+#define stackprofileNO_PEAK     ( UINT32_MAX )
+
+/* A task, with the least free stack it ever had. */
+typedef struct StackProfileTask
+{
+    TaskHandle_t xTask;
+    char cName[ configMAX_TASK_NAME_LEN ];
+    uint32_t ulDepth; /* 0 when the task was not created by sampletaskCREATE(). */
+    uint32_t ulMinimumFree;
+    StackPhase_t ePeakPhase;
+} StackProfileTask_t;
+
+static const char * const pcPhaseNames[ eStackPhaseCount ] =
+{
+    "network",
+    "dps",
+    "hub-tls",
+    "connect",
+    "properties",
+    "telemetry",
+    "adu"
+};
+
+static StackProfileTask_t xTasks[ democonfigSTACK_PROFILE_MAX_TASKS ];
+static uint32_t ulTaskCount = 0;
+static bool xKernelTasksAdded = false;
+static bool xPeakChanged = false;
+
+#if ( configUSE_TRACE_FACILITY == 1 )
+    /* The tasks alive, a task deleted since is not in it. */
+    static TaskStatus_t xStatus[ democonfigSTACK_PROFILE_MAX_TASKS ];
+#endif
+/*-----------------------------------------------------------*/
+
+/* The entry of a task, added if it has none and there is room. Called with
+ * the scheduler suspended. */
+static StackProfileTask_t * prvGetTask( TaskHandle_t xTask,
+                                        const char * pcName )
+{
+    StackProfileTask_t * pxTask;
+    uint32_t ulIndex;
+
+    for( ulIndex = 0; ulIndex < ulTaskCount; ulIndex++ )
+    {
+        if( xTasks[ ulIndex ].xTask == xTask )
+        {
+            return &xTasks[ ulIndex ];
+        }
+    }
+
+    if( ulTaskCount == democonfigSTACK_PROFILE_MAX_TASKS )
+    {
+        return NULL;
+    }
+
+    pxTask = &xTasks[ ulTaskCount++ ];
+    pxTask->xTask = xTask;
+    ( void ) strncpy( pxTask->cName, pcName, sizeof( pxTask->cName ) - 1U );
+    pxTask->cName[ sizeof( pxTask->cName ) - 1U ] = '\0';
+    pxTask->ulDepth = 0;
+    pxTask->ulMinimumFree = stackprofileNO_PEAK;
+    pxTask->ePeakPhase = eStackPhaseNetwork;
+
+    return pxTask;
+}
+/*-----------------------------------------------------------*/
+
+static void prvUpdateTask( StackProfileTask_t * pxTask,
+                           uint32_t ulFree,
+                           StackPhase_t ePhase )
+{
+    if( ulFree < pxTask->ulMinimumFree )
+    {
+        pxTask->ulMinimumFree = ulFree;
+        pxTask->ePeakPhase = ePhase;
+        xPeakChanged = true;
+    }
+}
+/*-----------------------------------------------------------*/
+
+/* The tasks of the kernel, whose depths the configuration gives. Called with
+ * the scheduler suspended. */
+static void prvAddKernelTasks( void )
+{
+    StackProfileTask_t * pxTask;
+
+    ( void ) pxTask;
+
+    #if ( INCLUDE_xTaskGetIdleTaskHandle == 1 )
+        pxTask = prvGetTask( xTaskGetIdleTaskHandle(), configIDLE_TASK_NAME );
+
+        if( pxTask != NULL )
+        {
+            pxTask->ulDepth = configMINIMAL_STACK_SIZE;
+        }
+    #endif
+
+    #if ( configUSE_TIMERS == 1 ) && ( INCLUDE_xTimerGetTimerDaemonTaskHandle == 1 )
+        pxTask = prvGetTask( xTimerGetTimerDaemonTaskHandle(), "Tmr Svc" );
+
+        if( pxTask != NULL )
+        {
+            pxTask->ulDepth = configTIMER_TASK_STACK_DEPTH;
+        }
+    #endif
+}
+/*-----------------------------------------------------------*/
+
+void StackProfile_Register( TaskHandle_t xTask,
+                            const char * pcName,
+                            uint32_t ulStackDepth )
+{
+    StackProfileTask_t * pxTask;
+
+    if( xTask == NULL )
+    {
+        return;
+    }
+
+    vTaskSuspendAll();
+    {
+        pxTask = prvGetTask( xTask, pcName );
+
+        if( pxTask != NULL )
+        {
+            pxTask->ulDepth = ulStackDepth;
+        }
+    }
+    ( void ) xTaskResumeAll();
+}
+/*-----------------------------------------------------------*/
+
+bool StackProfile_Mark( StackPhase_t ePhase )
+{
+    StackProfileTask_t * pxTask;
+    bool xChanged;
+    UBaseType_t uxIndex;
+    UBaseType_t uxCount;
+
+    if( ePhase >= eStackPhaseCount )
+    {
+        return false;
+    }
+
+    /* The kernel creates the idle and timer tasks when the scheduler starts,
+     * after the samples create theirs, so they are only looked up here. */
+    if( !xKernelTasksAdded && ( xTaskGetSchedulerState() != taskSCHEDULER_NOT_STARTED ) )
+    {
+        vTaskSuspendAll();
+        {
+            prvAddKernelTasks();
+            xKernelTasksAdded = true;
+        }
+        ( void ) xTaskResumeAll();
+    }
+
+    #if ( configUSE_TRACE_FACILITY == 1 )
+        vTaskSuspendAll();
+        {
+            /* Reads the high water mark of every task, 0 tasks when there are
+             * more than entries. */
+            uxCount = uxTaskGetSystemState( xStatus, democonfigSTACK_PROFILE_MAX_TASKS, NULL );
+
+            for( uxIndex = 0; uxIndex < uxCount; uxIndex++ )
+            {
+                pxTask = prvGetTask( xStatus[ uxIndex ].xHandle, xStatus[ uxIndex ].pcTaskName );
+
+                if( pxTask != NULL )
+                {
+                    prvUpdateTask( pxTask, ( uint32_t ) xStatus[ uxIndex ].usStackHighWaterMark, ePhase );
+                }
+            }
+
+            xChanged = xPeakChanged;
+        }
+        ( void ) xTaskResumeAll();
+    #else
+        /* Without the list of the tasks, only the ones registered are read,
+         * and they must not have been deleted. */
+        vTaskSuspendAll();
+        {
+            uxCount = ( UBaseType_t ) ulTaskCount;
+
+            for( uxIndex = 0; uxIndex < uxCount; uxIndex++ )
+            {
+                pxTask = &xTasks[ uxIndex ];
+                prvUpdateTask( pxTask, ( uint32_t ) uxTaskGetStackHighWaterMark( pxTask->xTask ), ePhase );
+            }
+
+            xChanged = xPeakChanged;
+        }
+        ( void ) xTaskResumeAll();
+    #endif /* configUSE_TRACE_FACILITY == 1 */
+
+    return xChanged;
+}
+/*-----------------------------------------------------------*/
+
+bool StackProfile_Changed( void )
+{
+    return xPeakChanged;
+}
+/*-----------------------------------------------------------*/
+
+size_t StackProfile_Format( char * pcBuffer,
+                            size_t xBufferLength )
+{
+    StackProfileTask_t xTask;
+    size_t xLength = 0;
+    uint32_t ulIndex;
+    uint32_t ulCount;
+    uint32_t ulUsed;
+    uint32_t ulRecommended;
+    int lWritten;
+
+    if( ( pcBuffer == NULL ) || ( xBufferLength == 0 ) )
+    {
+        return 0;
+    }
+
+    pcBuffer[ 0 ] = '\0';
+
+    vTaskSuspendAll();
+    {
+        ulCount = ulTaskCount;
+        xPeakChanged = false;
+    }
+    ( void ) xTaskResumeAll();
+
+    for( ulIndex = 0; ( ulIndex < ulCount ) && ( xLength < xBufferLength - 1U ); ulIndex++ )
+    {
+        vTaskSuspendAll();
+        {
+            xTask = xTasks[ ulIndex ];
+        }
+        ( void ) xTaskResumeAll();
+
+        if( xTask.ulMinimumFree == stackprofileNO_PEAK )
+        {
+            continue;
+        }
+
+        if( ( xTask.ulDepth == 0 ) || ( xTask.ulMinimumFree > xTask.ulDepth ) )
+        {
+            /* Not created by the samples, only its free stack is known. */
+            lWritten = snprintf( &pcBuffer[ xLength ], xBufferLength - xLength, "%s%s free %u %s",
+                                 ( xLength > 0 ) ? ", " : "",
+                                 xTask.cName,
+                                 ( unsigned int ) xTask.ulMinimumFree,
+                                 pcPhaseNames[ xTask.ePeakPhase ] );
+        }
+        else
+        {
+            ulUsed = xTask.ulDepth - xTask.ulMinimumFree;
+            ulRecommended = ulUsed + ( ulUsed * democonfigSTACK_PROFILE_MARGIN_PERCENT + 99U ) / 100U;
+            ulRecommended = ( ( ulRecommended + stackprofileROUNDING - 1U ) / stackprofileROUNDING ) * stackprofileROUNDING;
+
+            lWritten = snprintf( &pcBuffer[ xLength ], xBufferLength - xLength, "%s%s %u/%u %s -> %u",
+                                 ( xLength > 0 ) ? ", " : "",
+                                 xTask.cName,
+                                 ( unsigned int ) ulUsed,
+                                 ( unsigned int ) xTask.ulDepth,
+                                 pcPhaseNames[ xTask.ePeakPhase ],
+                                 ( unsigned int ) ulRecommended );
+        }
+
+        if( lWritten < 0 )
+        {
+            break;
+        }
+
+        xLength += ( size_t ) lWritten;
+    }
+
+    if( xLength >= xBufferLength )
+    {
+        xLength = xBufferLength - 1U;
+    }
+
+    return xLength;
+}
+/*-----------------------------------------------------------*/
+
+BaseType_t StackProfile_TaskCreate( TaskFunction_t pxTaskCode,
+                                    const char * pcName,
+                                    configSTACK_DEPTH_TYPE usStackDepth,
+                                    void * pvParameters,
+                                    UBaseType_t uxPriority,
+                                    TaskHandle_t * pxCreatedTask,
+                                    BaseType_t xCoreID )
+{
+    TaskHandle_t xTask = NULL;
+    BaseType_t xResult;
+
+    ( void ) xCoreID;
+
+    xResult = sampletaskCREATE_TASK( pxTaskCode, pcName, usStackDepth, pvParameters,
+                                     uxPriority, &xTask, xCoreID );
+
+    if( xResult == pdPASS )
+    {
+        StackProfile_Register( xTask, pcName, ( uint32_t ) usStackDepth );
+    }
+
+    if( pxCreatedTask != NULL )
+    {
+        *pxCreatedTask = xTask;
+    }
+
+    return xResult;
+}
+/*-----------------------------------------------------------*/
+
+#endif /* democonfigSTACK_PROFILE == 1 */
@@ -0,0 +1,138 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @file azure_sample_stack_profile.h
+ *
+ * @brief Peak stack of each task through the phases of a sample, and the
+ * stack size it needs.
+ *
+ * The stacks of the tasks are sized by guesswork, and usually by kilobytes
+ * more than they use. With democonfigSTACK_PROFILE set to 1, by the
+ * SAMPLE_STACK_PROFILE CMake option, sampletaskCREATE() records the stack
+ * depth of each task it creates, and the idle and timer tasks are added when
+ * their handles can be had. stackprofileMARK() then reads the high water mark
+ * of every task, which FreeRTOS finds from the fill byte it paints new stacks
+ * with, at the end of the network, DPS, TLS, MQTT connect, property, telemetry
+ * and ADU phases, so the peak of each task comes with the phase that reached
+ * it. StackProfile_Format() gives for each task its peak, its depth, and a
+ * depth to set with democonfigSTACK_PROFILE_MARGIN_PERCENT of margin; the
+ * samples log it when a peak grew.
+ *
+ * With configUSE_TRACE_FACILITY, every task is read, those of the network
+ * stack with their free stack only. Without it, only the tasks added are read,
+ * and they must not be deleted.
+ *
+ * The depths are in the unit of xTaskCreate(), words, bytes on ESP-IDF. A peak
+ * only covers the code paths that ran, so the profile is worth running through
+ * reconnects and an update before the sizes are cut. The host ports run the
+ * tasks on the stacks of threads, so only a profile made on the board counts.
+ */
+
+#ifndef AZURE_SAMPLE_STACK_PROFILE_H
+#define AZURE_SAMPLE_STACK_PROFILE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+/**
+ * @brief 1 to profile the stacks of the tasks, set by the
+ * SAMPLE_STACK_PROFILE CMake option.
+ */
+#ifndef democonfigSTACK_PROFILE
+    #define democonfigSTACK_PROFILE    0
+#endif
+
+/**
+ * @brief Most tasks profiled, the ones created after are left out.
+ */
+#ifndef democonfigSTACK_PROFILE_MAX_TASKS
+    #define democonfigSTACK_PROFILE_MAX_TASKS    ( 10U )
+#endif
+
+/**
+ * @brief Margin added to the peak of a task for the depth recommended, in
+ * percent, the depth then being rounded up to 32.
+ */
+#ifndef democonfigSTACK_PROFILE_MARGIN_PERCENT
+    #define democonfigSTACK_PROFILE_MARGIN_PERCENT    ( 25U )
+#endif
+
+/**
+ * @brief Phases whose end the peaks are read at.
+ */
+typedef enum StackPhase
+{
+    eStackPhaseNetwork = 0,  /* The network is up and the time set. */
+    eStackPhaseDps,          /* Connected and registered with DPS. */
+    eStackPhaseHubTls,       /* The TLS handshake with IoT Hub. */
+    eStackPhaseMqttConnect,  /* The CONNACK and subscriptions. */
+    eStackPhaseProperties,   /* A property document or update handled. */
+    eStackPhaseTelemetry,    /* Telemetry acknowledged. */
+    eStackPhaseAdu,          /* An update downloaded and verified. */
+    eStackPhaseCount
+} StackPhase_t;
+
+#if ( democonfigSTACK_PROFILE == 1 )
+    #define stackprofileMARK( ePhase )    StackProfile_Mark( ePhase )
+#else
+    #define stackprofileMARK( ePhase )    do {} while( 0 )
+#endif /* democonfigSTACK_PROFILE == 1 */
+
+/**
+ * @brief Add a task to the profile, sampletaskCREATE() doing it for the tasks
+ * it creates.
+ *
+ * @param[in] xTask The task.
+ * @param[in] pcName Name to report it under.
+ * @param[in] ulStackDepth The depth it was created with.
+ */
+void StackProfile_Register( TaskHandle_t xTask,
+                            const char * pcName,
+                            uint32_t ulStackDepth );
+
+/**
+ * @brief Read the high water mark of every task at the end of a phase.
+ *
+ * Can be called from any task, not from an interrupt.
+ *
+ * @param[in] ePhase The phase that ended.
+ * @return true when the peak of a task grew since the last
+ * StackProfile_Format().
+ */
+bool StackProfile_Mark( StackPhase_t ePhase );
+
+/**
+ * @brief Whether the peak of a task grew since the last StackProfile_Format().
+ */
+bool StackProfile_Changed( void );
+
+/**
+ * @brief Write the peak, depth and recommended depth of each task, on one line.
+ *
+ * Such as "AzureDemoTask 1210/2048 hub-tls -> 1536, CloudMessages ...".
+ *
+ * @param[out] pcBuffer Buffer for the text, NUL terminated.
+ * @param[in] xBufferLength Size of \p pcBuffer, the text being cut to it.
+ * @return The length of the text, without the NUL.
+ */
+size_t StackProfile_Format( char * pcBuffer,
+                            size_t xBufferLength );
+
+/**
+ * @brief Create a task and add it to the profile, what sampletaskCREATE()
+ * does with democonfigSTACK_PROFILE set to 1.
+ */
+BaseType_t StackProfile_TaskCreate( TaskFunction_t pxTaskCode,
+                                    const char * pcName,
+                                    configSTACK_DEPTH_TYPE usStackDepth,
+                                    void * pvParameters,
+                                    UBaseType_t uxPriority,
+                                    TaskHandle_t * pxCreatedTask,
+                                    BaseType_t xCoreID );
+
+#endif /* AZURE_SAMPLE_STACK_PROFILE_H */
@@ -0,0 +1,163 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+#include "azure_sample_startup.h"
+
+#include <stdio.h>
+
+/* FreeRTOS includes. */
+#include "FreeRTOS.h"
+#include "task.h"
+
+/* The stacks are read at the end of each phase, with democonfigSTACK_PROFILE. */
+#include "azure_sample_stack_profile.h"
+/*-----------------------------------------------------------*/
+
+static const char * const pcPhaseNames[ eStartupPhaseCount ] =
+{
+    "network",
+    "time",
+    "dps-tls",
+    "dps-register",
+    "hub-tls",
+    "connack",
+    "suback",
+    "properties",
+    "puback"
+};
+
+#if ( democonfigSTACK_PROFILE == 1 )
+    static const StackPhase_t xStackPhases[ eStartupPhaseCount ] =
+    {
+        eStackPhaseNetwork,
+        eStackPhaseNetwork,
+        eStackPhaseDps,
+        eStackPhaseDps,
+        eStackPhaseHubTls,
+        eStackPhaseMqttConnect,
+        eStackPhaseMqttConnect,
+        eStackPhaseProperties,
+        eStackPhaseTelemetry
+    };
+#endif
+
+static TickType_t xPhaseTicks[ eStartupPhaseCount ];
+static bool xPhaseMarked[ eStartupPhaseCount ];
+/*-----------------------------------------------------------*/
+
+void StartupProfile_Mark( StartupPhase_t ePhase )
+{
+    TickType_t xNow = xTaskGetTickCount();
+
+    if( ePhase >= eStartupPhaseCount )
+    {
+        return;
+    }
+
+    vTaskSuspendAll();
+    {
+        if( !xPhaseMarked[ ePhase ] )
+        {
+            xPhaseTicks[ ePhase ] = xNow;
+            xPhaseMarked[ ePhase ] = true;
+        }
+    }
+    ( void ) xTaskResumeAll();
+
+    /* Every time, as a reconnect can go deeper than the first connect. */
+    #if ( democonfigSTACK_PROFILE == 1 )
+        ( void ) StackProfile_Mark( xStackPhases[ ePhase ] );
+    #endif
+}
+/*-----------------------------------------------------------*/
+
+bool StartupProfile_Get( StartupPhase_t ePhase,
+                         uint32_t * pulMs )
+{
+    bool xMarked = false;
+    TickType_t xTicks = 0;
+
+    if( ePhase >= eStartupPhaseCount )
+    {
+        return false;
+    }
+
+    vTaskSuspendAll();
+    {
+        xMarked = xPhaseMarked[ ePhase ];
+        xTicks = xPhaseTicks[ ePhase ];
+    }
+    ( void ) xTaskResumeAll();
+
+    if( xMarked )
+    {
+        *pulMs = ( uint32_t ) ( ( uint64_t ) xTicks * 1000U / configTICK_RATE_HZ );
+    }
+
+    return xMarked;
+}
+/*-----------------------------------------------------------*/
+
+size_t StartupProfile_Format( char * pcBuffer,
+                              size_t xBufferLength )
+{
+    size_t xLength = 0;
+    uint32_t ulPreviousMs = 0;
+    uint32_t ulMs[ eStartupPhaseCount ];
+    bool xPending[ eStartupPhaseCount ];
+    uint32_t ulPhase;
+    uint32_t ulNext;
+    int lWritten;
+
+    if( xBufferLength == 0 )
+    {
+        return 0;
+    }
+
+    pcBuffer[ 0 ] = '\0';
+
+    for( ulPhase = 0; ulPhase < eStartupPhaseCount; ulPhase++ )
+    {
+        xPending[ ulPhase ] = StartupProfile_Get( ( StartupPhase_t ) ulPhase, &ulMs[ ulPhase ] );
+    }
+
+    /* In the order they ended, as the property document can come after the
+     * first PUBACK. */
+    for( ; ; )
+    {
+        ulNext = eStartupPhaseCount;
+
+        for( ulPhase = 0; ulPhase < eStartupPhaseCount; ulPhase++ )
+        {
+            if( xPending[ ulPhase ] &&
+                ( ( ulNext == eStartupPhaseCount ) || ( ulMs[ ulPhase ] < ulMs[ ulNext ] ) ) )
+            {
+                ulNext = ulPhase;
+            }
+        }
+
+        if( ulNext == eStartupPhaseCount )
+        {
+            break;
+        }
+
+        xPending[ ulNext ] = false;
+        ulPhase = ulNext;
+
+        lWritten = snprintf( pcBuffer + xLength, xBufferLength - xLength, "%s%s %u ms (+%u)",
+                             ( xLength > 0 ) ? ", " : "", pcPhaseNames[ ulPhase ],
+                             ( unsigned int ) ulMs[ ulPhase ], ( unsigned int ) ( ulMs[ ulPhase ] - ulPreviousMs ) );
+
+        if( ( lWritten < 0 ) || ( ( size_t ) lWritten >= xBufferLength - xLength ) )
+        {
+            /* Cut at the end of the buffer. */
+            return xBufferLength - 1;
+        }
+
+        xLength += ( size_t ) lWritten;
+        ulPreviousMs = ulMs[ ulPhase ];
+    }
+
+    return xLength;
+}
+/*-----------------------------------------------------------*/
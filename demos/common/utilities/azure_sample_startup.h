@@ -0,0 +1,77 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @file azure_sample_startup.h
+ *
+ * @brief Time each phase from boot to the first acknowledged telemetry.
+ *
+ * The ports mark when the network is up and the time is set, and the samples
+ * mark the TLS connections to DPS and IoT Hub, the registration, the CONNACK,
+ * the subscriptions, the property document and the first PUBACK. Only the
+ * first mark of a phase counts, so reconnects do not move it. Once the first
+ * PUBACK arrives, the sample logs StartupProfile_Format(), which gives each
+ * phase the time since the scheduler started and since the phase before, to
+ * show where a cold start spends its time.
+ *
+ * The times are in ticks from the start of the scheduler, so what main() does
+ * before is not counted. Phases a build does not go through, such as DPS or
+ * the time sync on the PC ports, are left out of the breakdown.
+ */
+
+#ifndef AZURE_SAMPLE_STARTUP_H
+#define AZURE_SAMPLE_STARTUP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Phases of the startup, in the order a sample goes through them.
+ */
+typedef enum StartupPhase
+{
+    eStartupPhaseNetworkUp = 0,       /* The port has an IP address. */
+    eStartupPhaseTimeSynced,          /* The port has set the time, with SNTP. */
+    eStartupPhaseDpsConnected,        /* TLS is up with the provisioning service. */
+    eStartupPhaseDpsRegistered,       /* The hub of the device is known. */
+    eStartupPhaseHubConnected,        /* TLS is up with IoT Hub. */
+    eStartupPhaseMqttConnected,       /* The CONNACK arrived. */
+    eStartupPhaseSubscribed,          /* The subscriptions are made, or sent when batched. */
+    eStartupPhasePropertiesReceived,  /* The property document GET was answered. */
+    eStartupPhaseFirstPuback,         /* The first telemetry was acknowledged. */
+    eStartupPhaseCount
+} StartupPhase_t;
+
+/**
+ * @brief Record that a phase ended, unless it did before.
+ *
+ * Can be called from any task, not from an interrupt.
+ *
+ * @param[in] ePhase The phase.
+ */
+void StartupProfile_Mark( StartupPhase_t ePhase );
+
+/**
+ * @brief Get when a phase ended.
+ *
+ * @param[in] ePhase The phase.
+ * @param[out] pulMs Milliseconds from the start of the scheduler.
+ * @return true when the phase was marked.
+ */
+bool StartupProfile_Get( StartupPhase_t ePhase,
+                         uint32_t * pulMs );
+
+/**
+ * @brief Write the breakdown of the phases marked, on one line.
+ *
+ * Such as "network 812 ms (+812), hub-tls 2311 ms (+1499), ...".
+ *
+ * @param[out] pcBuffer Buffer for the text, NUL terminated.
+ * @param[in] xBufferLength Size of \p pcBuffer, the text being cut to it.
+ * @return The length of the text, without the NUL.
+ */
+size_t StartupProfile_Format( char * pcBuffer,
+                              size_t xBufferLength );
+
+#endif /* AZURE_SAMPLE_STARTUP_H */
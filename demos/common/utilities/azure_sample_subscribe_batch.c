@@ -0,0 +1,446 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+#include "azure_sample_subscribe_batch.h"
+
+#include <string.h>
+
+#define subscribebatchMQTT_SUBSCRIBE    0x82U
+#define subscribebatchMQTT_SUBACK       0x90U
+
+/* Longest encoding of the remaining length of an MQTT packet. */
+#define subscribebatchMAX_LENGTH_BYTES  4U
+
+/* States of the packet being received from the transport. */
+#define subscribebatchRECV_BOUNDARY     0U /* Between two packets. */
+#define subscribebatchRECV_LENGTH       1U /* Reading the remaining length. */
+#define subscribebatchRECV_BODY         2U /* Passing the rest of the packet. */
+/*-----------------------------------------------------------*/
+
+/* Get the lengths of the packet at pucPacket, false until its fixed header is complete. */
+static bool prvPacketLength( const uint8_t * pucPacket,
+                             uint32_t ulAvailable,
+                             uint32_t * pulHeaderLength,
+                             uint32_t * pulRemainingLength )
+{
+    uint32_t ulRemaining = 0;
+    uint32_t ulIndex = 1;
+    uint8_t ucByte;
+
+    do
+    {
+        if( ( ulIndex >= ulAvailable ) || ( ulIndex > subscribebatchMAX_LENGTH_BYTES ) )
+        {
+            return false;
+        }
+
+        ucByte = pucPacket[ ulIndex ];
+        ulRemaining |= ( uint32_t ) ( ucByte & 0x7FU ) << ( 7U * ( ulIndex - 1U ) );
+        ulIndex++;
+    } while( ( ucByte & 0x80U ) != 0U );
+
+    *pulHeaderLength = ulIndex;
+    *pulRemainingLength = ulRemaining;
+
+    return true;
+}
+/*-----------------------------------------------------------*/
+
+static uint32_t prvWriteLength( uint8_t * pucBuffer,
+                                uint32_t ulLength )
+{
+    uint32_t ulIndex = 0;
+
+    do
+    {
+        pucBuffer[ ulIndex ] = ( uint8_t ) ( ulLength & 0x7FU );
+        ulLength >>= 7;
+
+        if( ulLength > 0U )
+        {
+            pucBuffer[ ulIndex ] |= 0x80U;
+        }
+
+        ulIndex++;
+    } while( ulLength > 0U );
+
+    return ulIndex;
+}
+/*-----------------------------------------------------------*/
+
+/* Queue the answer to a SUBSCRIBE, granting each filter the QoS it asked for. */
+static bool prvQueueSuback( SubscribeBatch_t * pxBatch,
+                            const uint8_t * pucPayload,
+                            uint32_t ulPayloadLength,
+                            uint8_t ucPacketIdHigh,
+                            uint8_t ucPacketIdLow )
+{
+    uint8_t * pucSuback = &pxBatch->ucSuback[ pxBatch->ulSubackEnd ];
+    uint32_t ulRoom = subscribebatchSUBACK_BUFFER_SIZE - pxBatch->ulSubackEnd;
+    uint32_t ulLength = 4;
+    uint32_t ulOffset = 0;
+    uint32_t ulFilterLength;
+
+    while( ulOffset < ulPayloadLength )
+    {
+        if( ulOffset + 2U > ulPayloadLength )
+        {
+            return false;
+        }
+
+        ulFilterLength = ( ( uint32_t ) pucPayload[ ulOffset ] << 8 ) | pucPayload[ ulOffset + 1U ];
+        ulOffset += 2U + ulFilterLength;
+
+        if( ( ulOffset >= ulPayloadLength ) || ( ulLength >= ulRoom ) || ( ulLength >= 0x7FU ) )
+        {
+            return false;
+        }
+
+        pucSuback[ ulLength++ ] = pucPayload[ ulOffset++ ] & 0x03U;
+    }
+
+    if( ulLength == 4U )
+    {
+        return false;
+    }
+
+    pucSuback[ 0 ] = subscribebatchMQTT_SUBACK;
+    pucSuback[ 1 ] = ( uint8_t ) ( ulLength - 2U );
+    pucSuback[ 2 ] = ucPacketIdHigh;
+    pucSuback[ 3 ] = ucPacketIdLow;
+    pxBatch->ulSubackEnd += ulLength;
+
+    return true;
+}
+/*-----------------------------------------------------------*/
+
+static AzureIoTResult_t prvWrite( SubscribeBatch_t * pxBatch,
+                                  const uint8_t * pucData,
+                                  uint32_t ulLength )
+{
+    uint32_t ulOffset = 0;
+    int32_t lSent;
+
+    while( ulOffset < ulLength )
+    {
+        lSent = pxBatch->xSend( pxBatch->pxNetworkContext, &pucData[ ulOffset ], ulLength - ulOffset );
+
+        if( lSent <= 0 )
+        {
+            return eAzureIoTErrorFailed;
+        }
+
+        ulOffset += ( uint32_t ) lSent;
+    }
+
+    return eAzureIoTSuccess;
+}
+/*-----------------------------------------------------------*/
+
+/* Write what is held as it is, and stop holding. */
+static AzureIoTResult_t prvFlush( SubscribeBatch_t * pxBatch )
+{
+    uint32_t ulLength = pxBatch->ulHeldLength;
+
+    pxBatch->xHolding = false;
+    pxBatch->ulHeldLength = 0;
+    pxBatch->ulCompleteLength = 0;
+
+    return prvWrite( pxBatch, pxBatch->ucHeld, ulLength );
+}
+/*-----------------------------------------------------------*/
+
+/* Write the packets held into ucMerged, the SUBSCRIBEs as one in place of the
+ * first, or none of them when the session is resumed. */
+static uint32_t prvMerge( SubscribeBatch_t * pxBatch )
+{
+    const uint8_t * pucHeld = pxBatch->ucHeld;
+    uint8_t * pucMerged = pxBatch->ucMerged;
+    uint32_t ulSubscribeCount = 0;
+    uint32_t ulPayloadLength = 0;
+    uint32_t ulFirst = 0;
+    uint32_t ulOffset;
+    uint32_t ulLength;
+    uint32_t ulHeaderLength;
+    uint32_t ulRemainingLength;
+
+    for( ulOffset = 0; ulOffset < pxBatch->ulCompleteLength; ulOffset += ulHeaderLength + ulRemainingLength )
+    {
+        ( void ) prvPacketLength( &pucHeld[ ulOffset ], pxBatch->ulCompleteLength - ulOffset,
+                                  &ulHeaderLength, &ulRemainingLength );
+
+        if( pucHeld[ ulOffset ] == subscribebatchMQTT_SUBSCRIBE )
+        {
+            if( ulSubscribeCount++ == 0U )
+            {
+                ulFirst = ulOffset;
+            }
+
+            ulPayloadLength += ulRemainingLength - 2U;
+        }
+    }
+
+    /* Merging saves at least the fixed header and packet identifier of each
+     * SUBSCRIBE after the first, more than the length can grow. */
+    if( ( ulSubscribeCount == 0U ) || ( ( ulSubscribeCount == 1U ) && !pxBatch->xResumed ) )
+    {
+        ( void ) memcpy( pucMerged, pucHeld, pxBatch->ulHeldLength );
+        return pxBatch->ulHeldLength;
+    }
+
+    ( void ) memcpy( pucMerged, pucHeld, ulFirst );
+    ulLength = ulFirst;
+
+    /* A resumed session already has the subscriptions, which IoT Hub would
+     * only acknowledge again. */
+    if( !pxBatch->xResumed )
+    {
+        pucMerged[ ulLength++ ] = subscribebatchMQTT_SUBSCRIBE;
+        ulLength += prvWriteLength( &pucMerged[ ulLength ], ulPayloadLength + 2U );
+
+        /* The packet identifier of the first, which IoT Hub acknowledges. */
+        ( void ) prvPacketLength( &pucHeld[ ulFirst ], pxBatch->ulCompleteLength - ulFirst,
+                                  &ulHeaderLength, &ulRemainingLength );
+        pucMerged[ ulLength++ ] = pucHeld[ ulFirst + ulHeaderLength ];
+        pucMerged[ ulLength++ ] = pucHeld[ ulFirst + ulHeaderLength + 1U ];
+
+        for( ulOffset = ulFirst; ulOffset < pxBatch->ulCompleteLength; ulOffset += ulHeaderLength + ulRemainingLength )
+        {
+            ( void ) prvPacketLength( &pucHeld[ ulOffset ], pxBatch->ulCompleteLength - ulOffset,
+                                      &ulHeaderLength, &ulRemainingLength );
+
+            if( pucHeld[ ulOffset ] == subscribebatchMQTT_SUBSCRIBE )
+            {
+                ( void ) memcpy( &pucMerged[ ulLength ], &pucHeld[ ulOffset + ulHeaderLength + 2U ], ulRemainingLength - 2U );
+                ulLength += ulRemainingLength - 2U;
+            }
+        }
+    }
+
+    /* The other packets follow, in the order they were sent. */
+    for( ulOffset = ulFirst; ulOffset < pxBatch->ulCompleteLength; ulOffset += ulHeaderLength + ulRemainingLength )
+    {
+        ( void ) prvPacketLength( &pucHeld[ ulOffset ], pxBatch->ulCompleteLength - ulOffset,
+                                  &ulHeaderLength, &ulRemainingLength );
+
+        if( pucHeld[ ulOffset ] != subscribebatchMQTT_SUBSCRIBE )
+        {
+            ( void ) memcpy( &pucMerged[ ulLength ], &pucHeld[ ulOffset ], ulHeaderLength + ulRemainingLength );
+            ulLength += ulHeaderLength + ulRemainingLength;
+        }
+    }
+
+    /* A packet not complete yet goes out as it is, and the rest follows. */
+    ( void ) memcpy( &pucMerged[ ulLength ], &pucHeld[ pxBatch->ulCompleteLength ],
+                     pxBatch->ulHeldLength - pxBatch->ulCompleteLength );
+    ulLength += pxBatch->ulHeldLength - pxBatch->ulCompleteLength;
+
+    return ulLength;
+}
+/*-----------------------------------------------------------*/
+
+/* Follow the packets the transport hands to the client, to answer between two. */
+static void prvTrackReceived( SubscribeBatch_t * pxBatch,
+                              const uint8_t * pucData,
+                              uint32_t ulLength )
+{
+    uint32_t ulOffset = 0;
+    uint32_t ulSkip;
+
+    while( ulOffset < ulLength )
+    {
+        switch( pxBatch->ucRecvState )
+        {
+            case subscribebatchRECV_BOUNDARY:
+                pxBatch->ulRecvRemaining = 0;
+                pxBatch->ucRecvLengthBytes = 0;
+                pxBatch->ucRecvState = subscribebatchRECV_LENGTH;
+                ulOffset++;
+                break;
+
+            case subscribebatchRECV_LENGTH:
+                if( pxBatch->ucRecvLengthBytes < subscribebatchMAX_LENGTH_BYTES )
+                {
+                    pxBatch->ulRecvRemaining |= ( uint32_t ) ( pucData[ ulOffset ] & 0x7FU ) << ( 7U * pxBatch->ucRecvLengthBytes );
+                    pxBatch->ucRecvLengthBytes++;
+                }
+
+                if( ( pucData[ ulOffset++ ] & 0x80U ) == 0U )
+                {
+                    pxBatch->ucRecvState = ( pxBatch->ulRecvRemaining > 0U ) ?
+                                           subscribebatchRECV_BODY : subscribebatchRECV_BOUNDARY;
+                }
+
+                break;
+
+            default:
+                ulSkip = ulLength - ulOffset;
+                ulSkip = ( ulSkip < pxBatch->ulRecvRemaining ) ? ulSkip : pxBatch->ulRecvRemaining;
+                pxBatch->ulRecvRemaining -= ulSkip;
+                ulOffset += ulSkip;
+
+                if( pxBatch->ulRecvRemaining == 0U )
+                {
+                    pxBatch->ucRecvState = subscribebatchRECV_BOUNDARY;
+                }
+
+                break;
+        }
+    }
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t SubscribeBatch_Init( SubscribeBatch_t * pxBatch,
+                                      AzureIoTTransportInterface_t * pxTransport )
+{
+    if( ( pxBatch == NULL ) || ( pxTransport == NULL ) ||
+        ( pxTransport->xSend == NULL ) || ( pxTransport->xRecv == NULL ) )
+    {
+        return eAzureIoTErrorInvalidArgument;
+    }
+
+    ( void ) memset( pxBatch, 0, sizeof( *pxBatch ) );
+    pxBatch->xContext.pParams = pxBatch;
+    pxBatch->pxNetworkContext = pxTransport->pxNetworkContext;
+    pxBatch->xSend = pxTransport->xSend;
+    pxBatch->xRecv = pxTransport->xRecv;
+    pxBatch->ucRecvState = subscribebatchRECV_BOUNDARY;
+
+    pxTransport->pxNetworkContext = ( NetworkContext_t * ) &pxBatch->xContext;
+    pxTransport->xSend = SubscribeBatch_Send;
+    pxTransport->xRecv = SubscribeBatch_Recv;
+
+    return eAzureIoTSuccess;
+}
+/*-----------------------------------------------------------*/
+
+void SubscribeBatch_Begin( SubscribeBatch_t * pxBatch )
+{
+    pxBatch->xHolding = true;
+    pxBatch->xResumed = false;
+    pxBatch->ulHeldLength = 0;
+    pxBatch->ulCompleteLength = 0;
+}
+/*-----------------------------------------------------------*/
+
+void SubscribeBatch_BeginResumed( SubscribeBatch_t * pxBatch )
+{
+    SubscribeBatch_Begin( pxBatch );
+    pxBatch->xResumed = true;
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t SubscribeBatch_End( SubscribeBatch_t * pxBatch )
+{
+    uint32_t ulLength;
+
+    if( !pxBatch->xHolding )
+    {
+        return eAzureIoTSuccess;
+    }
+
+    pxBatch->xHolding = false;
+    ulLength = prvMerge( pxBatch );
+    pxBatch->ulHeldLength = 0;
+    pxBatch->ulCompleteLength = 0;
+
+    return prvWrite( pxBatch, pxBatch->ucMerged, ulLength );
+}
+/*-----------------------------------------------------------*/
+
+int32_t SubscribeBatch_Send( NetworkContext_t * pxNetworkContext,
+                             const void * pvBuffer,
+                             size_t xBytesToSend )
+{
+    SubscribeBatch_t * pxBatch = ( SubscribeBatch_t * ) ( ( SubscribeBatchContext_t * ) pxNetworkContext )->pParams;
+    const uint8_t * pucHeld = pxBatch->ucHeld;
+    uint32_t ulHeaderLength;
+    uint32_t ulRemainingLength;
+    uint32_t ulAvailable;
+
+    if( !pxBatch->xHolding )
+    {
+        return pxBatch->xSend( pxBatch->pxNetworkContext, pvBuffer, xBytesToSend );
+    }
+
+    if( xBytesToSend > sizeof( pxBatch->ucHeld ) - pxBatch->ulHeldLength )
+    {
+        /* Out of room, the batch ends unmerged. */
+        if( prvFlush( pxBatch ) != eAzureIoTSuccess )
+        {
+            return -1;
+        }
+
+        return pxBatch->xSend( pxBatch->pxNetworkContext, pvBuffer, xBytesToSend );
+    }
+
+    ( void ) memcpy( &pxBatch->ucHeld[ pxBatch->ulHeldLength ], pvBuffer, xBytesToSend );
+    pxBatch->ulHeldLength += ( uint32_t ) xBytesToSend;
+
+    /* Answer the SUBSCRIBEs this completes. */
+    for( ; ; )
+    {
+        ulAvailable = pxBatch->ulHeldLength - pxBatch->ulCompleteLength;
+
+        if( !prvPacketLength( &pucHeld[ pxBatch->ulCompleteLength ], ulAvailable, &ulHeaderLength, &ulRemainingLength ) ||
+            ( ulHeaderLength + ulRemainingLength > ulAvailable ) )
+        {
+            break;
+        }
+
+        if( ( pucHeld[ pxBatch->ulCompleteLength ] == subscribebatchMQTT_SUBSCRIBE ) &&
+            ( ( ulRemainingLength < 2U ) ||
+              !prvQueueSuback( pxBatch, &pucHeld[ pxBatch->ulCompleteLength + ulHeaderLength + 2U ], ulRemainingLength - 2U,
+                               pucHeld[ pxBatch->ulCompleteLength + ulHeaderLength ],
+                               pucHeld[ pxBatch->ulCompleteLength + ulHeaderLength + 1U ] ) ) )
+        {
+            /* Left for IoT Hub to answer. */
+            if( prvFlush( pxBatch ) != eAzureIoTSuccess )
+            {
+                return -1;
+            }
+
+            break;
+        }
+
+        pxBatch->ulCompleteLength += ulHeaderLength + ulRemainingLength;
+    }
+
+    return ( int32_t ) xBytesToSend;
+}
+/*-----------------------------------------------------------*/
+
+int32_t SubscribeBatch_Recv( NetworkContext_t * pxNetworkContext,
+                             void * pvBuffer,
+                             size_t xBytesToRecv )
+{
+    SubscribeBatch_t * pxBatch = ( SubscribeBatch_t * ) ( ( SubscribeBatchContext_t * ) pxNetworkContext )->pParams;
+    uint32_t ulLength = pxBatch->ulSubackEnd - pxBatch->ulSubackStart;
+    int32_t lResult;
+
+    /* The SUBACKs go between two packets of IoT Hub. */
+    if( ( ulLength > 0U ) && ( pxBatch->ucRecvState == subscribebatchRECV_BOUNDARY ) )
+    {
+        ulLength = ( xBytesToRecv < ulLength ) ? ( uint32_t ) xBytesToRecv : ulLength;
+        ( void ) memcpy( pvBuffer, &pxBatch->ucSuback[ pxBatch->ulSubackStart ], ulLength );
+        pxBatch->ulSubackStart += ulLength;
+
+        if( pxBatch->ulSubackStart == pxBatch->ulSubackEnd )
+        {
+            pxBatch->ulSubackStart = 0;
+            pxBatch->ulSubackEnd = 0;
+        }
+
+        return ( int32_t ) ulLength;
+    }
+
+    lResult = pxBatch->xRecv( pxBatch->pxNetworkContext, pvBuffer, xBytesToRecv );
+
+    if( lResult > 0 )
+    {
+        prvTrackReceived( pxBatch, ( const uint8_t * ) pvBuffer, ( uint32_t ) lResult );
+    }
+
+    return lResult;
+}
+/*-----------------------------------------------------------*/
@@ -0,0 +1,156 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @file azure_sample_subscribe_batch.h
+ *
+ * @brief Sends the subscriptions made after a connect in one SUBSCRIBE.
+ *
+ * The hub client subscribes to each feature on its own and waits for each
+ * SUBACK, a round trip per feature on every connect. SubscribeBatch_Init()
+ * puts send and receive functions in front of the transport. Between
+ * SubscribeBatch_Begin() and SubscribeBatch_End() they hold what the client
+ * sends and answer each SUBSCRIBE at once, so the subscribe calls do not wait.
+ * SubscribeBatch_End() then writes the topic filters of all of them in one
+ * SUBSCRIBE, followed by what else was held, such as the property document
+ * GET, so the whole exchange takes one round trip.
+ *
+ * The client takes any SUBACK as success, since IoT Hub disconnects a client
+ * whose subscription it refuses, so answering early only changes when the
+ * calls return. The SUBACK of IoT Hub then reaches the client as an extra
+ * one, which it ignores. Packets that do not fit the buffers end the batch:
+ * what was held is written unmerged, and later subscriptions go out and are
+ * acknowledged as usual.
+ *
+ * After a connect that resumed an MQTT session which already holds the
+ * subscriptions, such as after a deep sleep, SubscribeBatch_BeginResumed()
+ * answers the SUBSCRIBEs the same way but drops them, so that only the rest,
+ * such as the property GET, is written at the end of the batch.
+ *
+ * A SubscribeBatch_t is for one connection, and is not thread safe; it is
+ * used by the task running the process loop.
+ */
+
+#ifndef AZURE_SAMPLE_SUBSCRIBE_BATCH_H
+#define AZURE_SAMPLE_SUBSCRIBE_BATCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "azure_iot_result.h"
+#include "azure_iot_transport_interface.h"
+
+/**
+ * @brief 1 for the samples to send their subscriptions in one SUBSCRIBE.
+ */
+#ifndef democonfigSUBSCRIBE_BATCH
+    #define democonfigSUBSCRIBE_BATCH    1
+#endif
+
+/**
+ * @brief Bytes of packets held between the begin and the end of a batch.
+ *
+ * Enough for the subscriptions of the hub client and the property GET.
+ */
+#ifndef democonfigSUBSCRIBE_BATCH_BUFFER_SIZE
+    #define democonfigSUBSCRIBE_BATCH_BUFFER_SIZE    ( 256U )
+#endif
+
+/**
+ * @brief Bytes of the SUBACKs a batch holds for the client.
+ */
+#define subscribebatchSUBACK_BUFFER_SIZE    ( 32U )
+
+/**
+ * @brief Context the send and receive functions are given, laid out as the
+ * NetworkContext of the samples.
+ */
+typedef struct SubscribeBatchContext
+{
+    void * pParams;
+} SubscribeBatchContext_t;
+
+typedef struct SubscribeBatch
+{
+    SubscribeBatchContext_t xContext;
+    NetworkContext_t * pxNetworkContext;
+    AzureIoTTransportSend_t xSend;
+    AzureIoTTransportRecv_t xRecv;
+    bool xHolding;
+    bool xResumed; /* The session holds the subscriptions, so the SUBSCRIBEs are dropped. */
+
+    /* The packets held, and the length of those complete. */
+    uint8_t ucHeld[ democonfigSUBSCRIBE_BATCH_BUFFER_SIZE ];
+    uint32_t ulHeldLength;
+    uint32_t ulCompleteLength;
+
+    /* The SUBACKs for the client. */
+    uint8_t ucSuback[ subscribebatchSUBACK_BUFFER_SIZE ];
+    uint32_t ulSubackStart;
+    uint32_t ulSubackEnd;
+
+    /* The packet being received from the transport. */
+    uint8_t ucRecvState;
+    uint8_t ucRecvLengthBytes;
+    uint32_t ulRecvRemaining;
+
+    /* Where the merged packets are written. */
+    uint8_t ucMerged[ democonfigSUBSCRIBE_BATCH_BUFFER_SIZE ];
+} SubscribeBatch_t;
+
+/**
+ * @brief Put the batch in front of the send and receive functions of a transport.
+ *
+ * Call it for each connection, once the transport is filled in and before it
+ * is given to AzureIoTHubClient_Init().
+ *
+ * @param[out] pxBatch The batch.
+ * @param[in,out] pxTransport The transport, which then sends and receives through the batch.
+ * @return An #AzureIoTResult_t with the result of the operation.
+ */
+AzureIoTResult_t SubscribeBatch_Init( SubscribeBatch_t * pxBatch,
+                                      AzureIoTTransportInterface_t * pxTransport );
+
+/**
+ * @brief Start holding what the client sends, once it is connected.
+ *
+ * @param[in] pxBatch The batch.
+ */
+void SubscribeBatch_Begin( SubscribeBatch_t * pxBatch );
+
+/**
+ * @brief Start holding what the client sends, once it is connected to a
+ * session that holds its subscriptions.
+ *
+ * The subscribe calls return as after SubscribeBatch_Begin(), and no
+ * SUBSCRIBE is written. Only use it when the CONNACK had the session present
+ * and the subscriptions were made in that session.
+ *
+ * @param[in] pxBatch The batch.
+ */
+void SubscribeBatch_BeginResumed( SubscribeBatch_t * pxBatch );
+
+/**
+ * @brief Write what was held, the subscriptions merged into one SUBSCRIBE.
+ *
+ * @param[in] pxBatch The batch.
+ * @return eAzureIoTSuccess, or eAzureIoTErrorFailed if the transport failed.
+ */
+AzureIoTResult_t SubscribeBatch_End( SubscribeBatch_t * pxBatch );
+
+/**
+ * @brief The send function the transport is given by SubscribeBatch_Init().
+ */
+int32_t SubscribeBatch_Send( NetworkContext_t * pxNetworkContext,
+                             const void * pvBuffer,
+                             size_t xBytesToSend );
+
+/**
+ * @brief The receive function the transport is given by SubscribeBatch_Init().
+ */
+int32_t SubscribeBatch_Recv( NetworkContext_t * pxNetworkContext,
+                             void * pvBuffer,
+                             size_t xBytesToRecv );
+
+#endif /* AZURE_SAMPLE_SUBSCRIBE_BATCH_H */
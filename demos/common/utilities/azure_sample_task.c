@@ -0,0 +1,66 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+#include "azure_sample_task.h"
+
+#include "demo_config.h"
+
+/* Built into the boards whether the tasks are static or not, so it is empty
+ * when they come from the heap. */
+#if ( configSUPPORT_DYNAMIC_ALLOCATION == 0 )
+
+/* Pool of the tasks, handed out in order. */
+static StaticTask_t xTaskBuffers[ democonfigSTATIC_TASK_COUNT ];
+static StackType_t uxTaskStacks[ democonfigSTATIC_TASK_STACK_SIZE ];
+static uint32_t ulTasksCreated;
+static uint32_t ulStackUsed;
+/*-----------------------------------------------------------*/
+
+BaseType_t SampleTask_CreateStatic( TaskFunction_t pxTaskCode,
+                                    const char * pcName,
+                                    configSTACK_DEPTH_TYPE usStackDepth,
+                                    void * pvParameters,
+                                    UBaseType_t uxPriority,
+                                    TaskHandle_t * pxCreatedTask,
+                                    BaseType_t xCoreID )
+{
+    TaskHandle_t xTask;
+    StaticTask_t * pxTaskBuffer = NULL;
+    StackType_t * puxStack = NULL;
+
+    taskENTER_CRITICAL();
+
+    if( ( ulTasksCreated < democonfigSTATIC_TASK_COUNT ) &&
+        ( usStackDepth <= democonfigSTATIC_TASK_STACK_SIZE - ulStackUsed ) )
+    {
+        pxTaskBuffer = &xTaskBuffers[ ulTasksCreated ];
+        puxStack = &uxTaskStacks[ ulStackUsed ];
+        ulTasksCreated++;
+        ulStackUsed += usStackDepth;
+    }
+
+    taskEXIT_CRITICAL();
+
+    if( pxTaskBuffer == NULL )
+    {
+        return errCOULD_NOT_ALLOCATE_REQUIRED_MEMORY;
+    }
+
+    #ifdef democonfigPIN_TASKS_TO_CORE
+        xTask = xTaskCreateStaticPinnedToCore( pxTaskCode, pcName, usStackDepth, pvParameters,
+                                               uxPriority, puxStack, pxTaskBuffer, xCoreID );
+    #else
+        ( void ) xCoreID;
+        xTask = xTaskCreateStatic( pxTaskCode, pcName, usStackDepth, pvParameters,
+                                   uxPriority, puxStack, pxTaskBuffer );
+    #endif /* democonfigPIN_TASKS_TO_CORE */
+
+    if( pxCreatedTask != NULL )
+    {
+        *pxCreatedTask = xTask;
+    }
+
+    return pdPASS;
+}
+/*-----------------------------------------------------------*/
+#endif /* configSUPPORT_DYNAMIC_ALLOCATION == 0 */
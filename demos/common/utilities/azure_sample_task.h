@@ -0,0 +1,91 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @file azure_sample_task.h
+ *
+ * @brief Task creation with optional core affinity.
+ *
+ * On SMP ports that provide xTaskCreatePinnedToCore(), such as ESP-IDF,
+ * defining democonfigPIN_TASKS_TO_CORE makes sampletaskCREATE() pin each
+ * task to the core it is given, for example to keep TLS and application
+ * work off the core of the WiFi stack. Otherwise it is xTaskCreate() and
+ * the core is ignored.
+ *
+ * With configSUPPORT_DYNAMIC_ALLOCATION set to 0, sampletaskCREATE() takes
+ * the stack and TCB of the task from a static pool instead, sized by
+ * democonfigSTATIC_TASK_COUNT and democonfigSTATIC_TASK_STACK_SIZE, so the
+ * stacks of the tasks show in the link map. The tasks of the samples run
+ * until reset, so the pool is never given back.
+ *
+ * With democonfigSTACK_PROFILE set to 1, the tasks created are added to the
+ * profile of azure_sample_stack_profile.h.
+ */
+
+#ifndef AZURE_SAMPLE_TASK_H
+#define AZURE_SAMPLE_TASK_H
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+/* Records the depth of the tasks created, with democonfigSTACK_PROFILE. */
+#include "azure_sample_stack_profile.h"
+
+/**
+ * @brief Number of tasks the static pool can create.
+ */
+#ifndef democonfigSTATIC_TASK_COUNT
+    #define democonfigSTATIC_TASK_COUNT    4
+#endif
+
+/**
+ * @brief Words of stack shared by the tasks of the static pool, enough by
+ * default for the demo task and the small log and entropy tasks.
+ */
+#ifndef democonfigSTATIC_TASK_STACK_SIZE
+    #define democonfigSTATIC_TASK_STACK_SIZE    ( democonfigDEMO_STACKSIZE + ( 16 * configMINIMAL_STACK_SIZE ) )
+#endif
+
+/**
+ * @brief Create a task with its stack and TCB taken from the static pool,
+ * only built with configSUPPORT_DYNAMIC_ALLOCATION set to 0.
+ *
+ * @return pdPASS, or errCOULD_NOT_ALLOCATE_REQUIRED_MEMORY once the pool
+ * has no TCB or stack of \p usStackDepth words left, as xTaskCreate() would.
+ */
+BaseType_t SampleTask_CreateStatic( TaskFunction_t pxTaskCode,
+                                    const char * pcName,
+                                    configSTACK_DEPTH_TYPE usStackDepth,
+                                    void * pvParameters,
+                                    UBaseType_t uxPriority,
+                                    TaskHandle_t * pxCreatedTask,
+                                    BaseType_t xCoreID );
+
+#if ( configSUPPORT_DYNAMIC_ALLOCATION == 0 ) && defined( democonfigPIN_TASKS_TO_CORE )
+    #define sampletaskCREATE_TASK( pxTaskCode, pcName, usStackDepth, pvParameters, uxPriority, pxCreatedTask, xCoreID ) \
+    SampleTask_CreateStatic( ( pxTaskCode ), ( pcName ), ( usStackDepth ), ( pvParameters ),                            \
+                             ( uxPriority ), ( pxCreatedTask ), ( xCoreID ) )
+#elif ( configSUPPORT_DYNAMIC_ALLOCATION == 0 )
+    #define sampletaskCREATE_TASK( pxTaskCode, pcName, usStackDepth, pvParameters, uxPriority, pxCreatedTask, xCoreID ) \
+    SampleTask_CreateStatic( ( pxTaskCode ), ( pcName ), ( usStackDepth ), ( pvParameters ),                            \
+                             ( uxPriority ), ( pxCreatedTask ), 0 )
+#elif defined( democonfigPIN_TASKS_TO_CORE )
+    #define sampletaskCREATE_TASK( pxTaskCode, pcName, usStackDepth, pvParameters, uxPriority, pxCreatedTask, xCoreID ) \
+    xTaskCreatePinnedToCore( ( pxTaskCode ), ( pcName ), ( usStackDepth ), ( pvParameters ),                            \
+                             ( uxPriority ), ( pxCreatedTask ), ( xCoreID ) )
+#else
+    #define sampletaskCREATE_TASK( pxTaskCode, pcName, usStackDepth, pvParameters, uxPriority, pxCreatedTask, xCoreID ) \
+    xTaskCreate( ( pxTaskCode ), ( pcName ), ( usStackDepth ), ( pvParameters ), ( uxPriority ), ( pxCreatedTask ) )
+#endif /* configSUPPORT_DYNAMIC_ALLOCATION == 0 */
+
+#if ( democonfigSTACK_PROFILE == 1 )
+    #define sampletaskCREATE( pxTaskCode, pcName, usStackDepth, pvParameters, uxPriority, pxCreatedTask, xCoreID ) \
+    StackProfile_TaskCreate( ( pxTaskCode ), ( pcName ), ( usStackDepth ), ( pvParameters ),                       \
+                             ( uxPriority ), ( pxCreatedTask ), ( xCoreID ) )
+#else
+    #define sampletaskCREATE( pxTaskCode, pcName, usStackDepth, pvParameters, uxPriority, pxCreatedTask, xCoreID ) \
+    sampletaskCREATE_TASK( ( pxTaskCode ), ( pcName ), ( usStackDepth ), ( pvParameters ),                         \
+                           ( uxPriority ), ( pxCreatedTask ), ( xCoreID ) )
+#endif /* democonfigSTACK_PROFILE == 1 */
+
+#endif /* AZURE_SAMPLE_TASK_H */
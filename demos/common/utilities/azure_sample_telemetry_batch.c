@@ -0,0 +1,248 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+#include "azure_sample_telemetry_batch.h"
+
+#include <stddef.h>
+
+/* FreeRTOS includes. */
+#include "FreeRTOS.h"
+#include "task.h"
+
+/*-----------------------------------------------------------*/
+
+static bool prvIsCompressed( const TelemetryBatch_t * pxBatch )
+{
+    #if ( democonfigTELEMETRY_COMPRESSION == 1 )
+        return pxBatch->xCompress;
+    #else
+        ( void ) pxBatch;
+        return false;
+    #endif /* democonfigTELEMETRY_COMPRESSION == 1 */
+}
+/*-----------------------------------------------------------*/
+
+static AzureIoTResult_t prvSend( TelemetryBatch_t * pxBatch,
+                                 const uint8_t * pucMessage,
+                                 uint32_t ulMessageLength,
+                                 PreparedTelemetry_t * pxTelemetry )
+{
+    if( pxBatch->pxWindow != NULL )
+    {
+        return PublishWindow_Send( pxBatch->pxWindow, pucMessage, ulMessageLength,
+                                   pxTelemetry,
+                                   pdMS_TO_TICKS( democonfigPUBLISH_WINDOW_TIMEOUT_MS ) );
+    }
+
+    return PreparedTelemetry_Send( pxTelemetry, pucMessage, ulMessageLength,
+                                   eAzureIoTHubMessageQoS1, NULL );
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t TelemetryBatch_Init( TelemetryBatch_t * pxBatch,
+                                      AzureIoTHubClient_t * pxHubClient,
+                                      AzureIoTMessageProperties_t * pxProperties,
+                                      PublishWindow_t * pxWindow,
+                                      uint8_t * pucBuffer,
+                                      uint32_t ulBufferSize,
+                                      uint32_t ulMaxCount,
+                                      TickType_t xMaxAge )
+{
+    AzureIoTResult_t xResult;
+
+    if( ( pxBatch == NULL ) || ( pxHubClient == NULL ) ||
+        ( ( ulMaxCount > 1 ) && ( pucBuffer == NULL ) ) )
+    {
+        return eAzureIoTErrorInvalidArgument;
+    }
+
+    if( ( xResult = PreparedTelemetry_Init( &pxBatch->xTelemetry, pxHubClient,
+                                            pxProperties ) ) != eAzureIoTSuccess )
+    {
+        return xResult;
+    }
+
+    pxBatch->pxWindow = pxWindow;
+    pxBatch->pucBuffer = pucBuffer;
+    pxBatch->ulBufferSize = ( ulMaxCount > 1 ) ? ulBufferSize : 0;
+    pxBatch->ulMaxCount = ulMaxCount;
+    pxBatch->xMaxAge = xMaxAge;
+    pxBatch->ulCount = 0;
+    pxBatch->xFirstReadingTime = 0;
+    #if ( democonfigTELEMETRY_COMPRESSION == 1 )
+        pxBatch->xCompress = false;
+    #endif /* democonfigTELEMETRY_COMPRESSION == 1 */
+
+    return eAzureIoTSuccess;
+}
+/*-----------------------------------------------------------*/
+
+#if ( democonfigTELEMETRY_COMPRESSION == 1 )
+    AzureIoTResult_t TelemetryBatch_EnableCompression( TelemetryBatch_t * pxBatch,
+                                                       AzureIoTMessageProperties_t * pxCompressedProperties )
+    {
+        AzureIoTResult_t xResult;
+
+        if( ( pxBatch == NULL ) || ( pxCompressedProperties == NULL ) )
+        {
+            return eAzureIoTErrorInvalidArgument;
+        }
+
+        if( ( xResult = PreparedTelemetry_Init( &pxBatch->xCompressedTelemetry, pxBatch->xTelemetry.pxHubClient,
+                                                pxCompressedProperties ) ) != eAzureIoTSuccess )
+        {
+            return xResult;
+        }
+
+        pxBatch->xCompress = true;
+
+        return eAzureIoTSuccess;
+    }
+#endif /* democonfigTELEMETRY_COMPRESSION == 1 */
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t TelemetryBatch_Add( TelemetryBatch_t * pxBatch,
+                                     const uint8_t * pucReading,
+                                     uint32_t ulReadingLength )
+{
+    AzureIoTResult_t xResult;
+    uint32_t ulUsed;
+
+    /* Room for the reading with the '[' or ',' before it and the closing ']'. */
+    if( ulReadingLength + 2 > pxBatch->ulBufferSize )
+    {
+        if( ( xResult = TelemetryBatch_Flush( pxBatch ) ) != eAzureIoTSuccess )
+        {
+            return xResult;
+        }
+
+        return prvSend( pxBatch, pucReading, ulReadingLength, &pxBatch->xTelemetry );
+    }
+
+    ulUsed = ( pxBatch->ulCount > 0 ) ? ( uint32_t ) AzureIoTJSONWriter_GetBytesUsed( &pxBatch->xWriter ) : 0;
+
+    /* A batch that would spill into one more metered message is sent first,
+     * so the messages it is billed as are full. Compressed batches are
+     * metered once compressed, so their size here says little. */
+    if( ( ulUsed + ulReadingLength + 2 > pxBatch->ulBufferSize ) ||
+        ( ( ulUsed > 0 ) && !prvIsCompressed( pxBatch ) &&
+          ( ratelimitMETERED_COUNT( ulUsed + ulReadingLength + 2 ) > ratelimitMETERED_COUNT( ulUsed + 1 ) ) ) )
+    {
+        if( ( xResult = TelemetryBatch_Flush( pxBatch ) ) != eAzureIoTSuccess )
+        {
+            return xResult;
+        }
+    }
+
+    if( pxBatch->ulCount == 0 )
+    {
+        if( ( ( xResult = AzureIoTJSONWriter_Init( &pxBatch->xWriter, pxBatch->pucBuffer,
+                                                    pxBatch->ulBufferSize ) ) != eAzureIoTSuccess ) ||
+            ( ( xResult = AzureIoTJSONWriter_AppendBeginArray( &pxBatch->xWriter ) ) != eAzureIoTSuccess ) )
+        {
+            return xResult;
+        }
+
+        pxBatch->xFirstReadingTime = xTaskGetTickCount();
+    }
+
+    if( ( xResult = AzureIoTJSONWriter_AppendJSONText( &pxBatch->xWriter, pucReading,
+                                                       ( int32_t ) ulReadingLength ) ) != eAzureIoTSuccess )
+    {
+        return xResult;
+    }
+
+    pxBatch->ulCount++;
+
+    if( pxBatch->ulCount >= pxBatch->ulMaxCount )
+    {
+        return TelemetryBatch_Flush( pxBatch );
+    }
+
+    return eAzureIoTSuccess;
+}
+/*-----------------------------------------------------------*/
+
+#if ( democonfigTELEMETRY_URGENT == 1 )
+    AzureIoTResult_t TelemetryBatch_RaiseUrgent( TelemetryBatch_t * pxBatch,
+                                                 const uint8_t * pucReading,
+                                                 uint32_t ulReadingLength )
+    {
+        if( pxBatch->pxWindow == NULL )
+        {
+            return eAzureIoTErrorInvalidArgument;
+        }
+
+        return PublishWindow_RaiseUrgent( pxBatch->pxWindow, pucReading, ulReadingLength,
+                                          &pxBatch->xTelemetry );
+    }
+#endif /* democonfigTELEMETRY_URGENT == 1 */
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t TelemetryBatch_Process( TelemetryBatch_t * pxBatch )
+{
+    #if ( democonfigTELEMETRY_URGENT == 1 )
+        AzureIoTResult_t xResult;
+
+        if( ( pxBatch->pxWindow != NULL ) &&
+            ( ( xResult = PublishWindow_ProcessUrgent( pxBatch->pxWindow ) ) != eAzureIoTSuccess ) )
+        {
+            return xResult;
+        }
+    #endif /* democonfigTELEMETRY_URGENT == 1 */
+
+    if( ( pxBatch->ulCount > 0 ) &&
+        ( ( xTaskGetTickCount() - pxBatch->xFirstReadingTime ) >= pxBatch->xMaxAge ) )
+    {
+        return TelemetryBatch_Flush( pxBatch );
+    }
+
+    return eAzureIoTSuccess;
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t TelemetryBatch_Flush( TelemetryBatch_t * pxBatch )
+{
+    AzureIoTResult_t xResult;
+    uint32_t ulLength;
+
+    #if ( democonfigTELEMETRY_COMPRESSION == 1 )
+        uint32_t ulCompressedLength;
+        uint32_t ulCompressedSize;
+    #endif /* democonfigTELEMETRY_COMPRESSION == 1 */
+
+    if( pxBatch->ulCount == 0 )
+    {
+        return eAzureIoTSuccess;
+    }
+
+    /* The batch is dropped whether or not it is sent, like a failed single reading. */
+    pxBatch->ulCount = 0;
+
+    if( ( xResult = AzureIoTJSONWriter_AppendEndArray( &pxBatch->xWriter ) ) != eAzureIoTSuccess )
+    {
+        return xResult;
+    }
+
+    ulLength = ( uint32_t ) AzureIoTJSONWriter_GetBytesUsed( &pxBatch->xWriter );
+
+    #if ( democonfigTELEMETRY_COMPRESSION == 1 )
+
+        /* Output that is not smaller than the batch does not fit, so the
+         * batch is then sent as it is. */
+        ulCompressedSize = ( ulLength < sizeof( pxBatch->ucCompressed ) ) ?
+                           ulLength - 1 : sizeof( pxBatch->ucCompressed );
+
+        if( pxBatch->xCompress &&
+            ( TelemetryCompress_Gzip( &pxBatch->xCompressor, pxBatch->pucBuffer, ulLength,
+                                      pxBatch->ucCompressed, ulCompressedSize,
+                                      &ulCompressedLength ) == eAzureIoTSuccess ) )
+        {
+            return prvSend( pxBatch, pxBatch->ucCompressed, ulCompressedLength,
+                            &pxBatch->xCompressedTelemetry );
+        }
+    #endif /* democonfigTELEMETRY_COMPRESSION == 1 */
+
+    return prvSend( pxBatch, pxBatch->pucBuffer, ulLength, &pxBatch->xTelemetry );
+}
+/*-----------------------------------------------------------*/
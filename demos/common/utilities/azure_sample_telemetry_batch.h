@@ -0,0 +1,179 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @file azure_sample_telemetry_batch.h
+ *
+ * @brief Gathers telemetry readings into one message.
+ *
+ * Each reading is a JSON value. Readings are appended to a JSON array, which
+ * is published as a single telemetry message once it holds ulMaxCount
+ * readings, once the next reading would not fit the buffer, or once the
+ * oldest reading is xMaxAge ticks old. With ulMaxCount of 1 every reading is
+ * published on its own, as it is, and no buffer is needed.
+ *
+ * The telemetry is prepared once, at TelemetryBatch_Init(), so the properties
+ * must outlive the batch and cannot change afterwards.
+ *
+ * Messages are sent through a PublishWindow_t when one is given, so they are
+ * tracked until acknowledged and sending waits when too many are in flight.
+ *
+ * IoT Hub meters messages in blocks of ratelimitMETER_SIZE bytes, so a batch
+ * is also published once the next reading would make it start one more
+ * block; with a buffer of up to that size a batch is then one metered message.
+ *
+ * With democonfigTELEMETRY_URGENT set, TelemetryBatch_RaiseUrgent() sends a
+ * reading, such as an alarm, on its own and ahead of the batch, through the
+ * slot the window keeps for it, by the next TelemetryBatch_Process().
+ *
+ * With democonfigTELEMETRY_COMPRESSION set, batches of more than one reading
+ * are sent gzip compressed, with the properties given to
+ * TelemetryBatch_EnableCompression(), whenever that makes them smaller.
+ */
+
+#ifndef AZURE_SAMPLE_TELEMETRY_BATCH_H
+#define AZURE_SAMPLE_TELEMETRY_BATCH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "FreeRTOS.h"
+
+#include "azure_iot_hub_client.h"
+#include "azure_iot_json_writer.h"
+
+#include "azure_sample_publish_window.h"
+#include "azure_sample_rate_limit.h"
+#include "azure_sample_telemetry_compress.h"
+
+/**
+ * @brief Readings published together. 1 publishes each reading on its own.
+ */
+#ifndef democonfigTELEMETRY_BATCH_COUNT
+    #define democonfigTELEMETRY_BATCH_COUNT          1
+#endif
+
+/**
+ * @brief Size of the buffer the batch is built in, used when democonfigTELEMETRY_BATCH_COUNT > 1.
+ */
+#ifndef democonfigTELEMETRY_BATCH_BUFFER_SIZE
+    #define democonfigTELEMETRY_BATCH_BUFFER_SIZE    1024
+#endif
+
+/**
+ * @brief Longest a reading waits in the batch before it is published.
+ */
+#ifndef democonfigTELEMETRY_BATCH_MAX_AGE_MS
+    #define democonfigTELEMETRY_BATCH_MAX_AGE_MS     ( 60 * 1000U )
+#endif
+
+typedef struct TelemetryBatch
+{
+    PreparedTelemetry_t xTelemetry;
+    PublishWindow_t * pxWindow;
+    uint8_t * pucBuffer;
+    uint32_t ulBufferSize;
+    uint32_t ulMaxCount;
+    TickType_t xMaxAge;
+    AzureIoTJSONWriter_t xWriter;
+    uint32_t ulCount;
+    TickType_t xFirstReadingTime;
+    #if ( democonfigTELEMETRY_COMPRESSION == 1 )
+        bool xCompress;
+        PreparedTelemetry_t xCompressedTelemetry;
+        TelemetryCompressor_t xCompressor;
+        uint8_t ucCompressed[ democonfigTELEMETRY_BATCH_BUFFER_SIZE ];
+    #endif /* democonfigTELEMETRY_COMPRESSION == 1 */
+} TelemetryBatch_t;
+
+/**
+ * @brief Initialize a telemetry batch.
+ *
+ * @param[out] pxBatch The batch to initialize.
+ * @param[in] pxHubClient Client the batch is published with, already initialized.
+ * @param[in] pxProperties Properties sent with each message, or NULL.
+ * @param[in] pxWindow Window the messages are sent through, or NULL to send them untracked.
+ * @param[in] pucBuffer Buffer the batch is built in. May be NULL when \p ulMaxCount is 1.
+ * @param[in] ulBufferSize Size of \p pucBuffer.
+ * @param[in] ulMaxCount Readings published together.
+ * @param[in] xMaxAge Longest a reading waits before it is published, in ticks.
+ * @return An #AzureIoTResult_t with the result of the operation.
+ */
+AzureIoTResult_t TelemetryBatch_Init( TelemetryBatch_t * pxBatch,
+                                      AzureIoTHubClient_t * pxHubClient,
+                                      AzureIoTMessageProperties_t * pxProperties,
+                                      PublishWindow_t * pxWindow,
+                                      uint8_t * pucBuffer,
+                                      uint32_t ulBufferSize,
+                                      uint32_t ulMaxCount,
+                                      TickType_t xMaxAge );
+
+#if ( democonfigTELEMETRY_COMPRESSION == 1 )
+
+/**
+ * @brief Send batches gzip compressed from now on.
+ *
+ * @param[in] pxBatch The batch.
+ * @param[in] pxCompressedProperties Properties sent with compressed messages,
+ * which must include those set by TelemetryCompress_AppendMessageProperties().
+ * @return An #AzureIoTResult_t with the result of the operation.
+ */
+    AzureIoTResult_t TelemetryBatch_EnableCompression( TelemetryBatch_t * pxBatch,
+                                                       AzureIoTMessageProperties_t * pxCompressedProperties );
+#endif /* democonfigTELEMETRY_COMPRESSION == 1 */
+
+/**
+ * @brief Add a reading to the batch, publishing the batch if it is full.
+ *
+ * The reading is copied, so its buffer can be reused straight away. A reading
+ * too large for the batch buffer is published on its own.
+ *
+ * @param[in] pxBatch The batch.
+ * @param[in] pucReading The reading, a JSON value.
+ * @param[in] ulReadingLength Length of \p pucReading.
+ * @return An #AzureIoTResult_t with the result of the operation.
+ */
+AzureIoTResult_t TelemetryBatch_Add( TelemetryBatch_t * pxBatch,
+                                     const uint8_t * pucReading,
+                                     uint32_t ulReadingLength );
+
+#if ( democonfigTELEMETRY_URGENT == 1 )
+
+/**
+ * @brief Raise a reading to be published on its own, ahead of the batch.
+ *
+ * The reading is copied, and published by the next TelemetryBatch_Process()
+ * or by the window while it waits. It can be raised from any task, or from a
+ * callback of the client. The batch needs a window.
+ *
+ * @param[in] pxBatch The batch.
+ * @param[in] pucReading The reading, a JSON value.
+ * @param[in] ulReadingLength Length of \p pucReading, at most democonfigTELEMETRY_URGENT_SIZE.
+ * @return eAzureIoTErrorOutOfMemory if the reading is too large, or the one
+ * raised before is not published yet.
+ */
+    AzureIoTResult_t TelemetryBatch_RaiseUrgent( TelemetryBatch_t * pxBatch,
+                                                 const uint8_t * pucReading,
+                                                 uint32_t ulReadingLength );
+#endif /* democonfigTELEMETRY_URGENT == 1 */
+
+/**
+ * @brief Publish a raised urgent reading, and the batch if its oldest reading
+ * has waited long enough.
+ *
+ * Call this regularly, for example after each AzureIoTHubClient_ProcessLoop().
+ *
+ * @param[in] pxBatch The batch.
+ * @return An #AzureIoTResult_t with the result of the operation.
+ */
+AzureIoTResult_t TelemetryBatch_Process( TelemetryBatch_t * pxBatch );
+
+/**
+ * @brief Publish any readings in the batch now, such as before disconnecting.
+ *
+ * @param[in] pxBatch The batch.
+ * @return An #AzureIoTResult_t with the result of the operation.
+ */
+AzureIoTResult_t TelemetryBatch_Flush( TelemetryBatch_t * pxBatch );
+
+#endif /* AZURE_SAMPLE_TELEMETRY_BATCH_H */
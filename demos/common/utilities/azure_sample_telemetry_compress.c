@@ -0,0 +1,299 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+#include "azure_sample_telemetry_compress.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#define telemetrycompressMIN_MATCH    3U
+#define telemetrycompressMAX_MATCH    258U
+
+#if ( telemetrycompressWINDOW_SIZE > 32768 )
+    #error "telemetrycompressWINDOW_SIZE must be at most 32768."
+#endif
+
+typedef struct BitWriter
+{
+    uint8_t * pucBuffer;
+    uint32_t ulBufferSize;
+    uint32_t ulUsed;
+    uint32_t ulBits;
+    uint32_t ulBitCount;
+    bool xOverflow;
+} BitWriter_t;
+
+/* Length and distance code bases and extra bits, RFC 1951 section 3.2.5. */
+static const uint16_t usLengthBase[] =
+{
+    3,  4,  5,  6,  7,  8,  9,  10, 11, 13,  15,  17,  19,  23,  27,
+    31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const uint8_t ucLengthExtra[] =
+{
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2,
+    2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const uint16_t usDistanceBase[] =
+{
+    1,    2,    3,    4,    5,    7,     9,     13,    17,    25,
+    33,   49,   65,   97,   129,  193,   257,   385,   513,   769,
+    1025, 1537, 2049, 3073, 4097, 6145,  8193,  12289, 16385, 24577
+};
+static const uint8_t ucDistanceExtra[] =
+{
+    0, 0, 0, 0, 1, 1, 2,  2,  3,  3,
+    4, 4, 5, 5, 6, 6, 7,  7,  8,  8,
+    9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+/*-----------------------------------------------------------*/
+
+static void prvPutByte( BitWriter_t * pxWriter,
+                        uint8_t ucByte )
+{
+    if( pxWriter->ulUsed < pxWriter->ulBufferSize )
+    {
+        pxWriter->pucBuffer[ pxWriter->ulUsed++ ] = ucByte;
+    }
+    else
+    {
+        pxWriter->xOverflow = true;
+    }
+}
+/*-----------------------------------------------------------*/
+
+/* Deflate packs values least significant bit first. */
+static void prvPutBits( BitWriter_t * pxWriter,
+                        uint32_t ulValue,
+                        uint32_t ulCount )
+{
+    pxWriter->ulBits |= ulValue << pxWriter->ulBitCount;
+    pxWriter->ulBitCount += ulCount;
+
+    while( pxWriter->ulBitCount >= 8 )
+    {
+        prvPutByte( pxWriter, ( uint8_t ) pxWriter->ulBits );
+        pxWriter->ulBits >>= 8;
+        pxWriter->ulBitCount -= 8;
+    }
+}
+/*-----------------------------------------------------------*/
+
+/* Huffman codes are packed most significant bit first. */
+static void prvPutCode( BitWriter_t * pxWriter,
+                        uint32_t ulCode,
+                        uint32_t ulLength )
+{
+    uint32_t ulReversed = 0;
+    uint32_t ulIndex;
+
+    for( ulIndex = 0; ulIndex < ulLength; ulIndex++ )
+    {
+        ulReversed = ( ulReversed << 1 ) | ( ( ulCode >> ulIndex ) & 1U );
+    }
+
+    prvPutBits( pxWriter, ulReversed, ulLength );
+}
+/*-----------------------------------------------------------*/
+
+/* Writes a literal/length symbol with the fixed Huffman code. */
+static void prvPutSymbol( BitWriter_t * pxWriter,
+                          uint32_t ulSymbol )
+{
+    if( ulSymbol < 144 )
+    {
+        prvPutCode( pxWriter, 0x30U + ulSymbol, 8 );
+    }
+    else if( ulSymbol < 256 )
+    {
+        prvPutCode( pxWriter, 0x190U + ulSymbol - 144U, 9 );
+    }
+    else if( ulSymbol < 280 )
+    {
+        prvPutCode( pxWriter, ulSymbol - 256U, 7 );
+    }
+    else
+    {
+        prvPutCode( pxWriter, 0xC0U + ulSymbol - 280U, 8 );
+    }
+}
+/*-----------------------------------------------------------*/
+
+static void prvPutMatch( BitWriter_t * pxWriter,
+                         uint32_t ulLength,
+                         uint32_t ulDistance )
+{
+    uint32_t ulIndex = sizeof( usLengthBase ) / sizeof( usLengthBase[ 0 ] ) - 1;
+
+    while( usLengthBase[ ulIndex ] > ulLength )
+    {
+        ulIndex--;
+    }
+
+    prvPutSymbol( pxWriter, 257U + ulIndex );
+    prvPutBits( pxWriter, ulLength - usLengthBase[ ulIndex ], ucLengthExtra[ ulIndex ] );
+
+    ulIndex = sizeof( usDistanceBase ) / sizeof( usDistanceBase[ 0 ] ) - 1;
+
+    while( usDistanceBase[ ulIndex ] > ulDistance )
+    {
+        ulIndex--;
+    }
+
+    prvPutCode( pxWriter, ulIndex, 5 );
+    prvPutBits( pxWriter, ulDistance - usDistanceBase[ ulIndex ], ucDistanceExtra[ ulIndex ] );
+}
+/*-----------------------------------------------------------*/
+
+static uint32_t prvHash( const uint8_t * pucData )
+{
+    uint32_t ulValue = ( ( uint32_t ) pucData[ 0 ] << 16 ) | ( ( uint32_t ) pucData[ 1 ] << 8 ) | pucData[ 2 ];
+
+    return ( ulValue * 2654435761U ) >> ( 32 - telemetrycompressHASH_BITS );
+}
+/*-----------------------------------------------------------*/
+
+static void prvInsert( TelemetryCompressor_t * pxCompressor,
+                       const uint8_t * pucInput,
+                       uint32_t ulInputLength,
+                       uint32_t ulPosition )
+{
+    if( ulPosition + telemetrycompressMIN_MATCH <= ulInputLength )
+    {
+        pxCompressor->usHashHead[ prvHash( &pucInput[ ulPosition ] ) ] = ( uint16_t ) ( ulPosition + 1 );
+    }
+}
+/*-----------------------------------------------------------*/
+
+static uint32_t prvCrc32( const uint8_t * pucData,
+                          uint32_t ulLength )
+{
+    uint32_t ulCrc = 0xFFFFFFFFU;
+    uint32_t ulBit;
+
+    while( ulLength-- > 0 )
+    {
+        ulCrc ^= *pucData++;
+
+        for( ulBit = 0; ulBit < 8; ulBit++ )
+        {
+            ulCrc = ( ulCrc >> 1 ) ^ ( 0xEDB88320U & ( 0U - ( ulCrc & 1U ) ) );
+        }
+    }
+
+    return ~ulCrc;
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t TelemetryCompress_Gzip( TelemetryCompressor_t * pxCompressor,
+                                         const uint8_t * pucInput,
+                                         uint32_t ulInputLength,
+                                         uint8_t * pucOutput,
+                                         uint32_t ulOutputSize,
+                                         uint32_t * pulOutputLength )
+{
+    static const uint8_t ucGzipHeader[] = { 0x1F, 0x8B, 0x08, 0, 0, 0, 0, 0, 0, 0xFF };
+    BitWriter_t xWriter = { 0 };
+    uint32_t ulPosition = 0;
+    uint32_t ulCandidate;
+    uint32_t ulMatch;
+    uint32_t ulMaxMatch;
+    uint32_t ulCrc;
+    uint32_t ulIndex;
+
+    if( ( pxCompressor == NULL ) || ( pucInput == NULL ) || ( pucOutput == NULL ) ||
+        ( pulOutputLength == NULL ) || ( ulInputLength > UINT16_MAX ) )
+    {
+        return eAzureIoTErrorInvalidArgument;
+    }
+
+    xWriter.pucBuffer = pucOutput;
+    xWriter.ulBufferSize = ulOutputSize;
+    memset( pxCompressor->usHashHead, 0, sizeof( pxCompressor->usHashHead ) );
+
+    for( ulIndex = 0; ulIndex < sizeof( ucGzipHeader ); ulIndex++ )
+    {
+        prvPutByte( &xWriter, ucGzipHeader[ ulIndex ] );
+    }
+
+    /* One final block with the fixed Huffman codes. */
+    prvPutBits( &xWriter, 1, 1 );
+    prvPutBits( &xWriter, 1, 2 );
+
+    while( ( ulPosition < ulInputLength ) && !xWriter.xOverflow )
+    {
+        ulMatch = 0;
+
+        if( ulPosition + telemetrycompressMIN_MATCH <= ulInputLength )
+        {
+            ulCandidate = pxCompressor->usHashHead[ prvHash( &pucInput[ ulPosition ] ) ];
+
+            if( ( ulCandidate != 0 ) && ( ulPosition - ( ulCandidate - 1 ) <= telemetrycompressWINDOW_SIZE ) )
+            {
+                ulCandidate--;
+                ulMaxMatch = ulInputLength - ulPosition;
+                ulMaxMatch = ( ulMaxMatch < telemetrycompressMAX_MATCH ) ? ulMaxMatch : telemetrycompressMAX_MATCH;
+
+                while( ( ulMatch < ulMaxMatch ) && ( pucInput[ ulCandidate + ulMatch ] == pucInput[ ulPosition + ulMatch ] ) )
+                {
+                    ulMatch++;
+                }
+            }
+        }
+
+        if( ulMatch >= telemetrycompressMIN_MATCH )
+        {
+            prvPutMatch( &xWriter, ulMatch, ulPosition - ulCandidate );
+
+            for( ulIndex = 0; ulIndex < ulMatch; ulIndex++ )
+            {
+                prvInsert( pxCompressor, pucInput, ulInputLength, ulPosition + ulIndex );
+            }
+
+            ulPosition += ulMatch;
+        }
+        else
+        {
+            prvPutSymbol( &xWriter, pucInput[ ulPosition ] );
+            prvInsert( pxCompressor, pucInput, ulInputLength, ulPosition );
+            ulPosition++;
+        }
+    }
+
+    /* End of block, then flush the last partial byte. */
+    prvPutSymbol( &xWriter, 256 );
+    prvPutBits( &xWriter, 0, 7 );
+
+    ulCrc = prvCrc32( pucInput, ulInputLength );
+
+    for( ulIndex = 0; ulIndex < 32; ulIndex += 8 )
+    {
+        prvPutByte( &xWriter, ( uint8_t ) ( ulCrc >> ulIndex ) );
+    }
+
+    for( ulIndex = 0; ulIndex < 32; ulIndex += 8 )
+    {
+        prvPutByte( &xWriter, ( uint8_t ) ( ulInputLength >> ulIndex ) );
+    }
+
+    if( xWriter.xOverflow )
+    {
+        return eAzureIoTErrorOutOfMemory;
+    }
+
+    *pulOutputLength = xWriter.ulUsed;
+
+    return eAzureIoTSuccess;
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t TelemetryCompress_AppendMessageProperties( AzureIoTMessageProperties_t * pxProperties )
+{
+    return AzureIoTMessage_PropertiesAppend( pxProperties,
+                                             ( const uint8_t * ) telemetrycompressCONTENT_ENCODING_PROPERTY,
+                                             sizeof( telemetrycompressCONTENT_ENCODING_PROPERTY ) - 1,
+                                             ( const uint8_t * ) telemetrycompressCONTENT_ENCODING_VALUE,
+                                             sizeof( telemetrycompressCONTENT_ENCODING_VALUE ) - 1 );
+}
+/*-----------------------------------------------------------*/
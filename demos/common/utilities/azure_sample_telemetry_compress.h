@@ -0,0 +1,88 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @file azure_sample_telemetry_compress.h
+ *
+ * @brief Gzip compression of telemetry payloads in fixed RAM.
+ *
+ * Matches are found through a single hash table of the latest position of
+ * each three byte sequence, with no chains, and coded with the fixed deflate
+ * Huffman tables. That compresses little next to zlib, but batches of JSON
+ * readings repeat the same property names and shrink a lot, and the only RAM
+ * needed is the TelemetryCompressor_t. Messages carrying the output need the
+ * properties set by TelemetryCompress_AppendMessageProperties().
+ */
+
+#ifndef AZURE_SAMPLE_TELEMETRY_COMPRESS_H
+#define AZURE_SAMPLE_TELEMETRY_COMPRESS_H
+
+#include <stdint.h>
+
+#include "azure_iot_hub_client.h"
+
+/**
+ * @brief Compress batches of telemetry, in the samples that support it.
+ */
+#ifndef democonfigTELEMETRY_COMPRESSION
+    #define democonfigTELEMETRY_COMPRESSION    0
+#endif
+
+/**
+ * @brief Farthest back a match can be, in bytes. At most 32768.
+ */
+#ifndef telemetrycompressWINDOW_SIZE
+    #define telemetrycompressWINDOW_SIZE    4096
+#endif
+
+/**
+ * @brief Bits of the match hash. The table takes 2 << telemetrycompressHASH_BITS bytes.
+ */
+#ifndef telemetrycompressHASH_BITS
+    #define telemetrycompressHASH_BITS    10
+#endif
+
+/**
+ * @brief Bytes the gzip header and trailer add to the compressed data.
+ */
+#define telemetrycompressGZIP_OVERHEAD    18
+
+/**
+ * @brief Content encoding message property of compressed telemetry.
+ */
+#define telemetrycompressCONTENT_ENCODING_PROPERTY    "$.ce"
+#define telemetrycompressCONTENT_ENCODING_VALUE       "gzip"
+
+typedef struct TelemetryCompressor
+{
+    uint16_t usHashHead[ 1 << telemetrycompressHASH_BITS ]; /* Position + 1 of the latest sequence, 0 for none. */
+} TelemetryCompressor_t;
+
+/**
+ * @brief Compress a payload to gzip format.
+ *
+ * @param[in] pxCompressor Working memory of the compressor.
+ * @param[in] pucInput The payload, at most 65535 bytes.
+ * @param[in] ulInputLength Length of \p pucInput.
+ * @param[out] pucOutput Buffer the gzip data is written to.
+ * @param[in] ulOutputSize Size of \p pucOutput.
+ * @param[out] pulOutputLength Length of the gzip data.
+ * @return eAzureIoTErrorOutOfMemory if the output does not fit, which means
+ * the payload is better sent as it is.
+ */
+AzureIoTResult_t TelemetryCompress_Gzip( TelemetryCompressor_t * pxCompressor,
+                                         const uint8_t * pucInput,
+                                         uint32_t ulInputLength,
+                                         uint8_t * pucOutput,
+                                         uint32_t ulOutputSize,
+                                         uint32_t * pulOutputLength );
+
+/**
+ * @brief Append the content encoding property of a gzip message.
+ *
+ * @param[in] pxProperties Properties sent with the message.
+ * @return An #AzureIoTResult_t with the result of the operation.
+ */
+AzureIoTResult_t TelemetryCompress_AppendMessageProperties( AzureIoTMessageProperties_t * pxProperties );
+
+#endif /* AZURE_SAMPLE_TELEMETRY_COMPRESS_H */
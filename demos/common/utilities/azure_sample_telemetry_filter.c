@@ -0,0 +1,212 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+#include "azure_sample_telemetry_filter.h"
+
+#include <math.h>
+#include <stddef.h>
+
+/* FreeRTOS includes. */
+#include "FreeRTOS.h"
+#include "task.h"
+/*-----------------------------------------------------------*/
+
+/* Reads the deadbands of an object, setting them only when xApply is true,
+ * so the object can be checked as a whole before any of them changes. */
+static AzureIoTResult_t prvReadDeadbands( TelemetryFilter_t * pxFilter,
+                                          AzureIoTJSONReader_t * pxReader,
+                                          bool xApply )
+{
+    AzureIoTResult_t xResult;
+    AzureIoTJSONTokenType_t xTokenType;
+    uint32_t ulIndex;
+    double xDeadband;
+
+    if( ( ( xResult = AzureIoTJSONReader_TokenType( pxReader, &xTokenType ) ) != eAzureIoTSuccess ) ||
+        ( xTokenType != eAzureIoTJSONTokenBEGIN_OBJECT ) )
+    {
+        return ( xResult != eAzureIoTSuccess ) ? xResult : eAzureIoTErrorFailed;
+    }
+
+    for( ; ; )
+    {
+        if( ( ( xResult = AzureIoTJSONReader_NextToken( pxReader ) ) != eAzureIoTSuccess ) ||
+            ( ( xResult = AzureIoTJSONReader_TokenType( pxReader, &xTokenType ) ) != eAzureIoTSuccess ) )
+        {
+            return xResult;
+        }
+
+        if( xTokenType == eAzureIoTJSONTokenEND_OBJECT )
+        {
+            return eAzureIoTSuccess;
+        }
+
+        for( ulIndex = 0; ulIndex < pxFilter->ulCount; ulIndex++ )
+        {
+            if( AzureIoTJSONReader_TokenIsTextEqual( pxReader, pxFilter->pxFields[ ulIndex ].pucName,
+                                                     pxFilter->pxFields[ ulIndex ].ulNameLength ) )
+            {
+                break;
+            }
+        }
+
+        if( ( xResult = AzureIoTJSONReader_NextToken( pxReader ) ) != eAzureIoTSuccess )
+        {
+            return xResult;
+        }
+
+        if( ulIndex == pxFilter->ulCount )
+        {
+            if( ( xResult = AzureIoTJSONReader_SkipChildren( pxReader ) ) != eAzureIoTSuccess )
+            {
+                return xResult;
+            }
+
+            continue;
+        }
+
+        if( ( xResult = AzureIoTJSONReader_GetTokenDouble( pxReader, &xDeadband ) ) != eAzureIoTSuccess )
+        {
+            return xResult;
+        }
+
+        if( !( xDeadband >= 0.0 ) )
+        {
+            return eAzureIoTErrorInvalidArgument;
+        }
+
+        if( xApply )
+        {
+            pxFilter->pxFields[ ulIndex ].xDeadband = xDeadband;
+        }
+    }
+}
+/*-----------------------------------------------------------*/
+
+void TelemetryFilter_Begin( TelemetryFilter_t * pxFilter )
+{
+    configASSERT( pxFilter->ulCount <= telemetryfilterMAX_COUNT );
+
+    pxFilter->ulPending = 0;
+    pxFilter->xNow = xTaskGetTickCount();
+}
+/*-----------------------------------------------------------*/
+
+bool TelemetryFilter_Check( TelemetryFilter_t * pxFilter,
+                            uint32_t ulIndex,
+                            double xValue )
+{
+    TelemetryFilterField_t * pxField = &pxFilter->pxFields[ ulIndex ];
+    uint32_t ulBit = ( uint32_t ) 1U << ulIndex;
+
+    configASSERT( ulIndex < pxFilter->ulCount );
+
+    if( ( ( pxFilter->ulWritten & ulBit ) != 0 ) &&
+        !( fabs( xValue - pxField->xLastValue ) > pxField->xDeadband ) &&
+        ( ( pxFilter->xHeartbeatTicks == 0 ) ||
+          ( ( pxFilter->xNow - pxField->xLastTime ) < pxFilter->xHeartbeatTicks ) ) )
+    {
+        return false;
+    }
+
+    /* Kept as the value to compare with once the message is built. */
+    pxField->xLastValue = xValue;
+    pxField->xLastTime = pxFilter->xNow;
+    pxFilter->ulPending |= ulBit;
+
+    return true;
+}
+/*-----------------------------------------------------------*/
+
+uint32_t TelemetryFilter_End( TelemetryFilter_t * pxFilter )
+{
+    uint32_t ulPending = pxFilter->ulPending;
+    uint32_t ulCount = 0;
+
+    pxFilter->ulWritten |= ulPending;
+    pxFilter->ulPending = 0;
+
+    for( ; ulPending != 0; ulPending &= ulPending - 1U )
+    {
+        ulCount++;
+    }
+
+    return ulCount;
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t TelemetryFilter_SetHeartbeat( TelemetryFilter_t * pxFilter,
+                                               int32_t lHeartbeatSecs )
+{
+    if( ( pxFilter == NULL ) || ( lHeartbeatSecs < 0 ) ||
+        ( ( uint32_t ) lHeartbeatSecs > telemetryfilterMAX_HEARTBEAT_SECS ) )
+    {
+        return eAzureIoTErrorInvalidArgument;
+    }
+
+    pxFilter->xHeartbeatTicks = ( TickType_t ) ( ( uint32_t ) lHeartbeatSecs * configTICK_RATE_HZ );
+
+    return eAzureIoTSuccess;
+}
+/*-----------------------------------------------------------*/
+
+int32_t TelemetryFilter_GetHeartbeat( const TelemetryFilter_t * pxFilter )
+{
+    return ( int32_t ) ( pxFilter->xHeartbeatTicks / configTICK_RATE_HZ );
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t TelemetryFilter_ParseDeadbands( TelemetryFilter_t * pxFilter,
+                                                 AzureIoTJSONReader_t * pxReader )
+{
+    AzureIoTResult_t xResult;
+    AzureIoTJSONReader_t xCheckReader;
+
+    if( ( pxFilter == NULL ) || ( pxReader == NULL ) )
+    {
+        return eAzureIoTErrorInvalidArgument;
+    }
+
+    /* A copy of the reader checks the object, the reader then sets it. */
+    xCheckReader = *pxReader;
+
+    if( ( xResult = prvReadDeadbands( pxFilter, &xCheckReader, false ) ) != eAzureIoTSuccess )
+    {
+        return xResult;
+    }
+
+    return prvReadDeadbands( pxFilter, pxReader, true );
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t TelemetryFilter_AppendDeadbands( const TelemetryFilter_t * pxFilter,
+                                                  AzureIoTJSONWriter_t * pxWriter,
+                                                  int32_t lFractionalDigits )
+{
+    AzureIoTResult_t xResult;
+    uint32_t ulIndex;
+
+    if( ( pxFilter == NULL ) || ( pxWriter == NULL ) )
+    {
+        return eAzureIoTErrorInvalidArgument;
+    }
+
+    if( ( xResult = AzureIoTJSONWriter_AppendBeginObject( pxWriter ) ) != eAzureIoTSuccess )
+    {
+        return xResult;
+    }
+
+    for( ulIndex = 0; ulIndex < pxFilter->ulCount; ulIndex++ )
+    {
+        if( ( ( xResult = AzureIoTJSONWriter_AppendPropertyName( pxWriter, pxFilter->pxFields[ ulIndex ].pucName,
+                                                                 pxFilter->pxFields[ ulIndex ].ulNameLength ) ) != eAzureIoTSuccess ) ||
+            ( ( xResult = AzureIoTJSONWriter_AppendDouble( pxWriter, pxFilter->pxFields[ ulIndex ].xDeadband,
+                                                           lFractionalDigits ) ) != eAzureIoTSuccess ) )
+        {
+            return xResult;
+        }
+    }
+
+    return AzureIoTJSONWriter_AppendEndObject( pxWriter );
+}
+/*-----------------------------------------------------------*/
@@ -0,0 +1,164 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @file azure_sample_telemetry_filter.h
+ *
+ * @brief Report-by-exception filter for telemetry fields.
+ *
+ * A sample lists the fields of its telemetry in an array of
+ * TelemetryFilterField_t, each with a deadband, and asks the filter about
+ * every field it is about to write. A field is written when it moved by more
+ * than its deadband since the value last written, so a reading that sits
+ * still for hours is sent once. A deadband of 0 writes any change.
+ *
+ * A field is also written when it was not for a heartbeat interval, whether
+ * it changed or not, so the cloud can tell a quiet device from a dead one and
+ * a value lost on the way is not stale for longer than that. A message in
+ * which no field was written is dropped.
+ *
+ * The deadbands and the heartbeat can be set through writable properties:
+ * TelemetryFilter_ParseDeadbands() reads an object of field names and
+ * deadbands, and TelemetryFilter_AppendDeadbands() writes it back for the
+ * acknowledgement. A TelemetryFilter_t is not thread safe; it is used by the
+ * task building the telemetry.
+ */
+
+#ifndef AZURE_SAMPLE_TELEMETRY_FILTER_H
+#define AZURE_SAMPLE_TELEMETRY_FILTER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "FreeRTOS.h"
+
+#include "azure_iot_json_reader.h"
+#include "azure_iot_json_writer.h"
+
+/**
+ * @brief Longest a field goes unwritten, in seconds, whether it changed or not.
+ *
+ * 0 disables the heartbeat, so only changes are written.
+ */
+#ifndef democonfigTELEMETRY_HEARTBEAT_SECS
+    #define democonfigTELEMETRY_HEARTBEAT_SECS    ( 15 * 60U )
+#endif
+
+/**
+ * @brief Most fields in one TelemetryFilter_t.
+ */
+#define telemetryfilterMAX_COUNT                  ( 32U )
+
+/**
+ * @brief Longest heartbeat interval, in seconds, so that it fits in ticks.
+ */
+#define telemetryfilterMAX_HEARTBEAT_SECS         ( ( uint32_t ) ( portMAX_DELAY / 2U / configTICK_RATE_HZ ) )
+
+/**
+ * @brief Initializer of a #TelemetryFilterField_t.
+ */
+#define telemetryfilterFIELD( pcName, xDeadband ) \
+    { ( const uint8_t * ) ( pcName ), sizeof( pcName ) - 1, ( xDeadband ), 0.0, 0 }
+
+/**
+ * @brief Initializer of a #TelemetryFilter_t for the array pxFields, which
+ * writes all the fields the first time.
+ */
+#define telemetryfilterINIT( pxFields, ulHeartbeatSecs )                      \
+    {                                                                         \
+        ( pxFields ), sizeof( pxFields ) / sizeof( ( pxFields )[ 0 ] ), 0, 0, \
+        ( TickType_t ) ( ( ulHeartbeatSecs ) * configTICK_RATE_HZ ), 0        \
+    }
+
+typedef struct TelemetryFilterField
+{
+    const uint8_t * pucName;
+    uint32_t ulNameLength;
+    double xDeadband;   /* Change from the value last written that is written again. */
+    double xLastValue;  /* Value last written. */
+    TickType_t xLastTime; /* Tick count when it was written. */
+} TelemetryFilterField_t;
+
+typedef struct TelemetryFilter
+{
+    TelemetryFilterField_t * pxFields;
+    uint32_t ulCount;
+    uint32_t ulWritten; /* Fields that have a value last written. */
+    uint32_t ulPending; /* Fields written in the message being built. */
+    TickType_t xHeartbeatTicks;
+    TickType_t xNow;    /* Tick count when the message being built was started. */
+} TelemetryFilter_t;
+
+/**
+ * @brief Start a message.
+ *
+ * @param[in] pxFilter The filter.
+ */
+void TelemetryFilter_Begin( TelemetryFilter_t * pxFilter );
+
+/**
+ * @brief Tell whether a field is to be written in the message being built.
+ *
+ * @param[in] pxFilter The filter.
+ * @param[in] ulIndex Index of the field in the array.
+ * @param[in] xValue The reading.
+ * @return true if the field is written, as it changed by more than its
+ * deadband or its heartbeat is due.
+ */
+bool TelemetryFilter_Check( TelemetryFilter_t * pxFilter,
+                            uint32_t ulIndex,
+                            double xValue );
+
+/**
+ * @brief End a message, recording the values of the fields written.
+ *
+ * @param[in] pxFilter The filter.
+ * @return Number of fields written. The message is dropped when it is 0.
+ */
+uint32_t TelemetryFilter_End( TelemetryFilter_t * pxFilter );
+
+/**
+ * @brief Set the heartbeat interval, from the next message on.
+ *
+ * @param[in] pxFilter The filter.
+ * @param[in] lHeartbeatSecs Interval in seconds, up to
+ * #telemetryfilterMAX_HEARTBEAT_SECS, or 0 to disable the heartbeat.
+ * @return eAzureIoTErrorInvalidArgument if the interval is out of range.
+ */
+AzureIoTResult_t TelemetryFilter_SetHeartbeat( TelemetryFilter_t * pxFilter,
+                                               int32_t lHeartbeatSecs );
+
+/**
+ * @brief Interval of the heartbeat, in seconds.
+ *
+ * @param[in] pxFilter The filter.
+ * @return The interval, 0 when the heartbeat is disabled.
+ */
+int32_t TelemetryFilter_GetHeartbeat( const TelemetryFilter_t * pxFilter );
+
+/**
+ * @brief Set deadbands from an object of field names and deadbands.
+ *
+ * Names that match no field are skipped. Nothing is set if a deadband is
+ * negative or not a number, and the reader is then left where it was.
+ *
+ * @param[in] pxFilter The filter.
+ * @param[in] pxReader Reader on the '{' of the object. It is left on its '}'.
+ * @return An #AzureIoTResult_t with the result of the operation.
+ */
+AzureIoTResult_t TelemetryFilter_ParseDeadbands( TelemetryFilter_t * pxFilter,
+                                                 AzureIoTJSONReader_t * pxReader );
+
+/**
+ * @brief Write the deadbands of all the fields as an object.
+ *
+ * @param[in] pxFilter The filter.
+ * @param[in] pxWriter Writer the object is appended to.
+ * @param[in] lFractionalDigits Decimals of the deadbands.
+ * @return An #AzureIoTResult_t with the result of the operation.
+ */
+AzureIoTResult_t TelemetryFilter_AppendDeadbands( const TelemetryFilter_t * pxFilter,
+                                                  AzureIoTJSONWriter_t * pxWriter,
+                                                  int32_t lFractionalDigits );
+
+#endif /* AZURE_SAMPLE_TELEMETRY_FILTER_H */
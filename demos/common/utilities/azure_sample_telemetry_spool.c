@@ -0,0 +1,616 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+#include "azure_sample_telemetry_spool.h"
+
+#include <stddef.h>
+#include <string.h>
+
+/* Built into the samples whether the spool is used or not, so it is empty
+ * when the boards need not implement the platform functions. */
+#if ( democonfigTELEMETRY_SPOOL == 1 )
+
+#define telemetryspoolMAGIC          0x5453504CUL
+
+/* Frame types, which the erased 0xFF is neither of. */
+#define telemetryspoolTYPE_RECORD    0x52U
+#define telemetryspoolTYPE_CURSOR    0x43U
+
+#define telemetryspoolERASED_LENGTH  0xFFFFU
+
+/* The data of a cursor frame, the sequence number and offset of the read cursor. */
+#define telemetryspoolCURSOR_SIZE    8U
+
+#define telemetryspoolALIGN( ulSize, ulProgramSize ) \
+    ( ( ( ulSize ) + ( ulProgramSize ) - 1U ) & ~( ( ulProgramSize ) - 1U ) )
+
+typedef struct TelemetrySpoolSectorHeader
+{
+    uint32_t ulMagic;
+    uint32_t ulSequence;
+    uint32_t ulCursorSequence; /* The read cursor when the sector was opened. */
+    uint32_t ulCursorOffset;
+    uint32_t ulReserved;
+    uint32_t ulChecksum; /* CRC32 of everything before it. */
+} TelemetrySpoolSectorHeader_t;
+/*-----------------------------------------------------------*/
+
+static uint32_t prvCrc32( uint32_t ulCrc,
+                          const uint8_t * pucData,
+                          uint32_t ulLength )
+{
+    uint32_t ulBit;
+
+    ulCrc = ~ulCrc;
+
+    while( ulLength-- > 0 )
+    {
+        ulCrc ^= *pucData++;
+
+        for( ulBit = 0; ulBit < 8; ulBit++ )
+        {
+            ulCrc = ( ulCrc >> 1 ) ^ ( 0xEDB88320U & ( 0U - ( ulCrc & 1U ) ) );
+        }
+    }
+
+    return ~ulCrc;
+}
+/*-----------------------------------------------------------*/
+
+static void prvPutUint32( uint8_t * pucData,
+                          uint32_t ulValue )
+{
+    pucData[ 0 ] = ( uint8_t ) ulValue;
+    pucData[ 1 ] = ( uint8_t ) ( ulValue >> 8 );
+    pucData[ 2 ] = ( uint8_t ) ( ulValue >> 16 );
+    pucData[ 3 ] = ( uint8_t ) ( ulValue >> 24 );
+}
+/*-----------------------------------------------------------*/
+
+static uint32_t prvGetUint32( const uint8_t * pucData )
+{
+    return ( uint32_t ) pucData[ 0 ] | ( ( uint32_t ) pucData[ 1 ] << 8 ) |
+           ( ( uint32_t ) pucData[ 2 ] << 16 ) | ( ( uint32_t ) pucData[ 3 ] << 24 );
+}
+/*-----------------------------------------------------------*/
+
+/* The sectors are written in turn, so the one of a sequence number follows
+ * from the newest. */
+static uint32_t prvSectorOf( const TelemetrySpool_t * pxSpool,
+                             uint32_t ulSequence )
+{
+    return ( pxSpool->ulWriteSector + pxSpool->ulSectorCount -
+             ( pxSpool->xWrite.ulSequence - ulSequence ) % pxSpool->ulSectorCount ) % pxSpool->ulSectorCount;
+}
+/*-----------------------------------------------------------*/
+
+static uint32_t prvAddress( const TelemetrySpool_t * pxSpool,
+                            const TelemetrySpoolPosition_t * pxPosition )
+{
+    return prvSectorOf( pxSpool, pxPosition->ulSequence ) * pxSpool->ulSectorSize + pxPosition->ulOffset;
+}
+/*-----------------------------------------------------------*/
+
+static uint32_t prvHeaderChecksum( const TelemetrySpoolSectorHeader_t * pxHeader )
+{
+    return prvCrc32( 0, ( const uint8_t * ) pxHeader, offsetof( TelemetrySpoolSectorHeader_t, ulChecksum ) );
+}
+/*-----------------------------------------------------------*/
+
+static bool prvReadSectorHeader( const TelemetrySpool_t * pxSpool,
+                                 uint32_t ulSector,
+                                 TelemetrySpoolSectorHeader_t * pxHeader )
+{
+    return ( TelemetrySpool_PlatformRead( ulSector * pxSpool->ulSectorSize,
+                                          ( uint8_t * ) pxHeader, sizeof( *pxHeader ) ) == eAzureIoTSuccess ) &&
+           ( pxHeader->ulMagic == telemetryspoolMAGIC ) &&
+           ( pxHeader->ulChecksum == prvHeaderChecksum( pxHeader ) );
+}
+/*-----------------------------------------------------------*/
+
+/* The CRC of a frame covers its place in the log, so a frame left from an
+ * earlier pass or another sector never passes for one of this one. */
+static uint32_t prvFrameChecksum( const TelemetrySpoolPosition_t * pxPosition,
+                                  const uint8_t * pucFrame,
+                                  uint32_t ulLength )
+{
+    uint8_t ucPosition[ 8 ];
+    uint32_t ulCrc;
+
+    prvPutUint32( ucPosition, pxPosition->ulSequence );
+    prvPutUint32( &ucPosition[ 4 ], pxPosition->ulOffset );
+
+    ulCrc = prvCrc32( 0, ucPosition, sizeof( ucPosition ) );
+    ulCrc = prvCrc32( ulCrc, pucFrame, 4 );
+
+    return prvCrc32( ulCrc, &pucFrame[ telemetryspoolFRAME_HEADER_SIZE ], ulLength );
+}
+/*-----------------------------------------------------------*/
+
+/* Reads the frame at a position into ucFrame, false when there is no valid
+ * frame there. */
+static bool prvReadFrame( TelemetrySpool_t * pxSpool,
+                          const TelemetrySpoolPosition_t * pxPosition,
+                          uint32_t * pulLength,
+                          uint32_t * pulFrameSize,
+                          uint8_t * pucType )
+{
+    uint8_t * pucFrame = pxSpool->ucFrame;
+    uint32_t ulAddress = prvAddress( pxSpool, pxPosition );
+    uint32_t ulLength;
+    uint32_t ulFrameSize;
+
+    if( ( pxPosition->ulOffset + telemetryspoolFRAME_HEADER_SIZE > pxSpool->ulSectorSize ) ||
+        ( TelemetrySpool_PlatformRead( ulAddress, pucFrame, telemetryspoolFRAME_HEADER_SIZE ) != eAzureIoTSuccess ) )
+    {
+        return false;
+    }
+
+    ulLength = ( uint32_t ) pucFrame[ 0 ] | ( ( uint32_t ) pucFrame[ 1 ] << 8 );
+    ulFrameSize = telemetryspoolALIGN( telemetryspoolFRAME_HEADER_SIZE + ulLength, pxSpool->ulProgramSize );
+
+    if( ( ulLength == telemetryspoolERASED_LENGTH ) || ( ulLength > democonfigTELEMETRY_SPOOL_RECORD_SIZE ) ||
+        ( ( pucFrame[ 2 ] != telemetryspoolTYPE_RECORD ) && ( pucFrame[ 2 ] != telemetryspoolTYPE_CURSOR ) ) ||
+        ( ( pucFrame[ 2 ] ^ pucFrame[ 3 ] ) != 0xFFU ) ||
+        ( pxPosition->ulOffset + ulFrameSize > pxSpool->ulSectorSize ) )
+    {
+        return false;
+    }
+
+    if( ( ulLength > 0 ) &&
+        ( TelemetrySpool_PlatformRead( ulAddress + telemetryspoolFRAME_HEADER_SIZE,
+                                       &pucFrame[ telemetryspoolFRAME_HEADER_SIZE ], ulLength ) != eAzureIoTSuccess ) )
+    {
+        return false;
+    }
+
+    if( prvGetUint32( &pucFrame[ 4 ] ) != prvFrameChecksum( pxPosition, pucFrame, ulLength ) )
+    {
+        return false;
+    }
+
+    *pulLength = ulLength;
+    *pulFrameSize = ulFrameSize;
+    *pucType = pucFrame[ 2 ];
+
+    return true;
+}
+/*-----------------------------------------------------------*/
+
+/* Moves a position to the next record of the log, read into ucFrame, false
+ * when it reached the end of the log. A frame that does not read back ends
+ * its sector. */
+static bool prvNextRecord( TelemetrySpool_t * pxSpool,
+                           TelemetrySpoolPosition_t * pxPosition,
+                           uint32_t * pulLength,
+                           uint32_t * pulFrameSize )
+{
+    uint8_t ucType;
+
+    for( ; ; )
+    {
+        if( pxPosition->ulSequence < pxSpool->ulOldestSequence )
+        {
+            pxPosition->ulSequence = pxSpool->ulOldestSequence;
+            pxPosition->ulOffset = pxSpool->ulHeaderSize;
+        }
+
+        if( ( pxPosition->ulSequence > pxSpool->xWrite.ulSequence ) ||
+            ( ( pxPosition->ulSequence == pxSpool->xWrite.ulSequence ) &&
+              ( pxPosition->ulOffset >= pxSpool->xWrite.ulOffset ) ) )
+        {
+            return false;
+        }
+
+        if( prvReadFrame( pxSpool, pxPosition, pulLength, pulFrameSize, &ucType ) )
+        {
+            if( ucType == telemetryspoolTYPE_RECORD )
+            {
+                return true;
+            }
+
+            pxPosition->ulOffset += *pulFrameSize;
+        }
+        else if( pxPosition->ulSequence == pxSpool->xWrite.ulSequence )
+        {
+            return false;
+        }
+        else
+        {
+            pxPosition->ulSequence++;
+            pxPosition->ulOffset = pxSpool->ulHeaderSize;
+        }
+    }
+}
+/*-----------------------------------------------------------*/
+
+/* Records from a position to the end of its sector. */
+static uint32_t prvCountRecords( TelemetrySpool_t * pxSpool,
+                                 TelemetrySpoolPosition_t xPosition )
+{
+    uint32_t ulSequence = xPosition.ulSequence;
+    uint32_t ulCount = 0;
+    uint32_t ulLength;
+    uint32_t ulFrameSize;
+
+    while( prvNextRecord( pxSpool, &xPosition, &ulLength, &ulFrameSize ) &&
+           ( xPosition.ulSequence == ulSequence ) )
+    {
+        xPosition.ulOffset += ulFrameSize;
+        ulCount++;
+    }
+
+    return ulCount;
+}
+/*-----------------------------------------------------------*/
+
+/* Gives up the oldest sector, to be erased. The records in it the store
+ * holds are skipped when it acknowledges them, the others are dropped. */
+static void prvDropOldest( TelemetrySpool_t * pxSpool )
+{
+    uint32_t ulSequence = pxSpool->ulOldestSequence;
+    uint32_t ulRecords;
+    uint32_t ulLoaded;
+
+    if( pxSpool->xRead.ulSequence <= ulSequence )
+    {
+        ulRecords = prvCountRecords( pxSpool, pxSpool->xRead );
+        ulLoaded = ( pxSpool->xLoad.ulSequence > ulSequence ) ? ulRecords : pxSpool->ulLoaded;
+        ulLoaded = ( ulLoaded < pxSpool->ulLoaded ) ? ulLoaded : pxSpool->ulLoaded;
+        ulLoaded = ( ulLoaded < ulRecords ) ? ulLoaded : ulRecords;
+
+        pxSpool->ulLoaded -= ulLoaded;
+        pxSpool->ulSkip += ulLoaded;
+        pxSpool->ulDropped += ulRecords - ulLoaded;
+
+        pxSpool->xRead.ulSequence = ulSequence + 1;
+        pxSpool->xRead.ulOffset = pxSpool->ulHeaderSize;
+
+        if( pxSpool->xLoad.ulSequence <= ulSequence )
+        {
+            pxSpool->xLoad = pxSpool->xRead;
+        }
+    }
+
+    pxSpool->ulOldestSequence++;
+}
+/*-----------------------------------------------------------*/
+
+/* Erases the sector after the newest and starts it with a header holding
+ * the read cursor. */
+static AzureIoTResult_t prvOpenSector( TelemetrySpool_t * pxSpool )
+{
+    TelemetrySpoolSectorHeader_t xHeader;
+    uint8_t ucHeader[ telemetryspoolMAX_PROGRAM_SIZE ];
+    uint32_t ulSequence = pxSpool->xWrite.ulSequence + 1;
+    uint32_t ulSector = ( pxSpool->ulWriteSector + 1 ) % pxSpool->ulSectorCount;
+
+    while( ulSequence - pxSpool->ulOldestSequence >= pxSpool->ulSectorCount )
+    {
+        prvDropOldest( pxSpool );
+    }
+
+    if( TelemetrySpool_PlatformErase( ulSector ) != eAzureIoTSuccess )
+    {
+        return eAzureIoTErrorFailed;
+    }
+
+    xHeader.ulMagic = telemetryspoolMAGIC;
+    xHeader.ulSequence = ulSequence;
+    xHeader.ulCursorSequence = pxSpool->xRead.ulSequence;
+    xHeader.ulCursorOffset = pxSpool->xRead.ulOffset;
+    xHeader.ulReserved = UINT32_MAX;
+    xHeader.ulChecksum = prvHeaderChecksum( &xHeader );
+
+    memset( ucHeader, 0xFF, sizeof( ucHeader ) );
+    memcpy( ucHeader, &xHeader, sizeof( xHeader ) );
+
+    pxSpool->ulWriteSector = ulSector;
+    pxSpool->xWrite.ulSequence = ulSequence;
+    pxSpool->xWrite.ulOffset = pxSpool->ulHeaderSize;
+    pxSpool->ulUnsaved = 0;
+
+    if( TelemetrySpool_PlatformWrite( ulSector * pxSpool->ulSectorSize, ucHeader,
+                                      pxSpool->ulHeaderSize ) != eAzureIoTSuccess )
+    {
+        /* Nothing is written after a header that may not read back. */
+        pxSpool->xWrite.ulOffset = pxSpool->ulSectorSize;
+        return eAzureIoTErrorFailed;
+    }
+
+    return eAzureIoTSuccess;
+}
+/*-----------------------------------------------------------*/
+
+static AzureIoTResult_t prvWriteFrame( TelemetrySpool_t * pxSpool,
+                                       uint8_t ucType,
+                                       const uint8_t * pucData,
+                                       uint32_t ulLength )
+{
+    uint8_t * pucFrame = pxSpool->ucFrame;
+    uint32_t ulFrameSize = telemetryspoolALIGN( telemetryspoolFRAME_HEADER_SIZE + ulLength, pxSpool->ulProgramSize );
+    AzureIoTResult_t xResult;
+
+    if( ( pxSpool->xWrite.ulOffset + ulFrameSize > pxSpool->ulSectorSize ) &&
+        ( ( xResult = prvOpenSector( pxSpool ) ) != eAzureIoTSuccess ) )
+    {
+        return xResult;
+    }
+
+    pucFrame[ 0 ] = ( uint8_t ) ulLength;
+    pucFrame[ 1 ] = ( uint8_t ) ( ulLength >> 8 );
+    pucFrame[ 2 ] = ucType;
+    pucFrame[ 3 ] = ( uint8_t ) ~ucType;
+    memcpy( &pucFrame[ telemetryspoolFRAME_HEADER_SIZE ], pucData, ulLength );
+    memset( &pucFrame[ telemetryspoolFRAME_HEADER_SIZE + ulLength ], 0xFF,
+            ulFrameSize - telemetryspoolFRAME_HEADER_SIZE - ulLength );
+    prvPutUint32( &pucFrame[ 4 ], prvFrameChecksum( &pxSpool->xWrite, pucFrame, ulLength ) );
+
+    if( TelemetrySpool_PlatformWrite( prvAddress( pxSpool, &pxSpool->xWrite ),
+                                      pucFrame, ulFrameSize ) != eAzureIoTSuccess )
+    {
+        /* The frame may be half written, so the sector is closed. */
+        pxSpool->xWrite.ulOffset = pxSpool->ulSectorSize;
+        return eAzureIoTErrorFailed;
+    }
+
+    pxSpool->xWrite.ulOffset += ulFrameSize;
+
+    return eAzureIoTSuccess;
+}
+/*-----------------------------------------------------------*/
+
+/* Appends the read cursor. When the newest sector has no room, the next one
+ * is opened, its header holding it, unless that erases records not yet
+ * acknowledged: the next record appended opens it then. */
+static void prvSaveCursor( TelemetrySpool_t * pxSpool )
+{
+    uint8_t ucCursor[ telemetryspoolCURSOR_SIZE ];
+    uint32_t ulFrameSize = telemetryspoolALIGN( telemetryspoolFRAME_HEADER_SIZE + telemetryspoolCURSOR_SIZE,
+                                                pxSpool->ulProgramSize );
+
+    if( pxSpool->xWrite.ulOffset + ulFrameSize > pxSpool->ulSectorSize )
+    {
+        if( ( pxSpool->xWrite.ulSequence + 1U - pxSpool->ulOldestSequence < pxSpool->ulSectorCount ) ||
+            ( pxSpool->xRead.ulSequence > pxSpool->ulOldestSequence ) )
+        {
+            ( void ) prvOpenSector( pxSpool );
+        }
+
+        return;
+    }
+
+    prvPutUint32( ucCursor, pxSpool->xRead.ulSequence );
+    prvPutUint32( &ucCursor[ 4 ], pxSpool->xRead.ulOffset );
+
+    if( prvWriteFrame( pxSpool, telemetryspoolTYPE_CURSOR, ucCursor, sizeof( ucCursor ) ) == eAzureIoTSuccess )
+    {
+        pxSpool->ulUnsaved = 0;
+    }
+}
+/*-----------------------------------------------------------*/
+
+static AzureIoTResult_t prvBackingAppend( void * pvContext,
+                                          const uint8_t * pucRecord,
+                                          uint32_t ulLength )
+{
+    TelemetrySpool_t * pxSpool = ( TelemetrySpool_t * ) pvContext;
+
+    if( ( ulLength == 0 ) || ( ulLength > democonfigTELEMETRY_SPOOL_RECORD_SIZE ) )
+    {
+        return eAzureIoTErrorInvalidArgument;
+    }
+
+    return prvWriteFrame( pxSpool, telemetryspoolTYPE_RECORD, pucRecord, ulLength );
+}
+/*-----------------------------------------------------------*/
+
+static void prvBackingRemoveOldest( void * pvContext,
+                                    uint32_t ulCount )
+{
+    TelemetrySpool_t * pxSpool = ( TelemetrySpool_t * ) pvContext;
+    uint32_t ulSkipped = ( ulCount < pxSpool->ulSkip ) ? ulCount : pxSpool->ulSkip;
+    uint32_t ulLength;
+    uint32_t ulFrameSize;
+
+    /* The records of an erased sector are already behind the cursor. */
+    pxSpool->ulSkip -= ulSkipped;
+    ulCount -= ulSkipped;
+
+    while( ( ulCount > 0 ) && ( pxSpool->ulLoaded > 0 ) &&
+           prvNextRecord( pxSpool, &pxSpool->xRead, &ulLength, &ulFrameSize ) )
+    {
+        pxSpool->xRead.ulOffset += ulFrameSize;
+        pxSpool->ulLoaded--;
+        pxSpool->ulUnsaved++;
+        ulCount--;
+    }
+
+    if( pxSpool->ulUnsaved >= democonfigTELEMETRY_SPOOL_CURSOR_INTERVAL )
+    {
+        prvSaveCursor( pxSpool );
+    }
+}
+/*-----------------------------------------------------------*/
+
+static AzureIoTResult_t prvBackingLoadNext( void * pvContext,
+                                            uint8_t * pucRecord,
+                                            uint32_t ulSize,
+                                            uint32_t * pulLength )
+{
+    TelemetrySpool_t * pxSpool = ( TelemetrySpool_t * ) pvContext;
+    uint32_t ulLength;
+    uint32_t ulFrameSize;
+
+    if( !prvNextRecord( pxSpool, &pxSpool->xLoad, &ulLength, &ulFrameSize ) )
+    {
+        return eAzureIoTErrorFailed;
+    }
+
+    if( ulLength > ulSize )
+    {
+        return eAzureIoTErrorOutOfMemory;
+    }
+
+    memcpy( pucRecord, &pxSpool->ucFrame[ telemetryspoolFRAME_HEADER_SIZE ], ulLength );
+    *pulLength = ulLength;
+    pxSpool->xLoad.ulOffset += ulFrameSize;
+    pxSpool->ulLoaded++;
+
+    return eAzureIoTSuccess;
+}
+/*-----------------------------------------------------------*/
+
+static bool prvIsErased( TelemetrySpool_t * pxSpool,
+                         const TelemetrySpoolPosition_t * pxPosition )
+{
+    uint32_t ulIndex;
+
+    if( ( pxPosition->ulOffset + telemetryspoolFRAME_HEADER_SIZE > pxSpool->ulSectorSize ) ||
+        ( TelemetrySpool_PlatformRead( prvAddress( pxSpool, pxPosition ), pxSpool->ucFrame,
+                                       telemetryspoolFRAME_HEADER_SIZE ) != eAzureIoTSuccess ) )
+    {
+        return false;
+    }
+
+    for( ulIndex = 0; ulIndex < telemetryspoolFRAME_HEADER_SIZE; ulIndex++ )
+    {
+        if( pxSpool->ucFrame[ ulIndex ] != 0xFFU )
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t TelemetrySpool_Init( TelemetrySpool_t * pxSpool )
+{
+    TelemetrySpoolSectorHeader_t xHeader;
+    TelemetrySpoolPosition_t xPosition;
+    TelemetrySpoolPosition_t xCursor = { 0 };
+    uint32_t ulSector;
+    uint32_t ulAge;
+    uint32_t ulNewest = 0;
+    uint32_t ulLength;
+    uint32_t ulFrameSize;
+    uint8_t ucType;
+    bool xFound = false;
+    AzureIoTResult_t xResult;
+
+    if( pxSpool == NULL )
+    {
+        return eAzureIoTErrorInvalidArgument;
+    }
+
+    memset( pxSpool, 0, sizeof( *pxSpool ) );
+
+    if( ( xResult = TelemetrySpool_PlatformInit( &pxSpool->ulSectorSize, &pxSpool->ulSectorCount,
+                                                 &pxSpool->ulProgramSize ) ) != eAzureIoTSuccess )
+    {
+        return xResult;
+    }
+
+    if( ( pxSpool->ulSectorSize < 256U ) || ( pxSpool->ulSectorCount < 2U ) ||
+        ( pxSpool->ulProgramSize == 0 ) || ( pxSpool->ulProgramSize > telemetryspoolMAX_PROGRAM_SIZE ) ||
+        ( ( pxSpool->ulProgramSize & ( pxSpool->ulProgramSize - 1U ) ) != 0 ) ||
+        ( ( pxSpool->ulSectorSize % pxSpool->ulProgramSize ) != 0 ) )
+    {
+        return eAzureIoTErrorInvalidArgument;
+    }
+
+    pxSpool->ulHeaderSize = telemetryspoolALIGN( sizeof( TelemetrySpoolSectorHeader_t ), pxSpool->ulProgramSize );
+
+    pxSpool->xBacking.pvContext = pxSpool;
+    pxSpool->xBacking.xAppend = prvBackingAppend;
+    pxSpool->xBacking.xRemoveOldest = prvBackingRemoveOldest;
+    pxSpool->xBacking.xRestore = NULL;
+    pxSpool->xBacking.xLoadNext = prvBackingLoadNext;
+
+    /* The newest sector is the one with the highest sequence number. */
+    for( ulSector = 0; ulSector < pxSpool->ulSectorCount; ulSector++ )
+    {
+        if( prvReadSectorHeader( pxSpool, ulSector, &xHeader ) &&
+            ( !xFound || ( xHeader.ulSequence > pxSpool->xWrite.ulSequence ) ) )
+        {
+            xFound = true;
+            ulNewest = ulSector;
+            pxSpool->xWrite.ulSequence = xHeader.ulSequence;
+            xCursor.ulSequence = xHeader.ulCursorSequence;
+            xCursor.ulOffset = xHeader.ulCursorOffset;
+        }
+    }
+
+    if( !xFound )
+    {
+        /* An empty log, as if a full sector 0 came before the first. */
+        pxSpool->ulWriteSector = pxSpool->ulSectorCount - 1U;
+        pxSpool->xWrite.ulSequence = 0;
+        pxSpool->xWrite.ulOffset = pxSpool->ulSectorSize;
+        pxSpool->ulOldestSequence = 1;
+        pxSpool->xRead.ulSequence = 1;
+        pxSpool->xRead.ulOffset = pxSpool->ulHeaderSize;
+        pxSpool->xLoad = pxSpool->xRead;
+
+        return eAzureIoTSuccess;
+    }
+
+    pxSpool->ulWriteSector = ulNewest;
+    pxSpool->ulOldestSequence = pxSpool->xWrite.ulSequence;
+
+    /* The oldest is the furthest sector before it that holds the sequence
+     * number it should. A sector whose erase was cut by a reset holds none. */
+    for( ulAge = pxSpool->ulSectorCount - 1U; ulAge > 0; ulAge-- )
+    {
+        ulSector = ( ulNewest + pxSpool->ulSectorCount - ulAge ) % pxSpool->ulSectorCount;
+
+        if( ( ulAge < pxSpool->xWrite.ulSequence ) &&
+            prvReadSectorHeader( pxSpool, ulSector, &xHeader ) &&
+            ( xHeader.ulSequence == pxSpool->xWrite.ulSequence - ulAge ) )
+        {
+            pxSpool->ulOldestSequence = xHeader.ulSequence;
+            break;
+        }
+    }
+
+    /* Walk the newest sector for the end of the log and the last cursor. */
+    xPosition.ulSequence = pxSpool->xWrite.ulSequence;
+    xPosition.ulOffset = pxSpool->ulHeaderSize;
+
+    while( prvReadFrame( pxSpool, &xPosition, &ulLength, &ulFrameSize, &ucType ) )
+    {
+        if( ucType == telemetryspoolTYPE_CURSOR )
+        {
+            xCursor.ulSequence = prvGetUint32( &pxSpool->ucFrame[ telemetryspoolFRAME_HEADER_SIZE ] );
+            xCursor.ulOffset = prvGetUint32( &pxSpool->ucFrame[ telemetryspoolFRAME_HEADER_SIZE + 4 ] );
+        }
+
+        xPosition.ulOffset += ulFrameSize;
+    }
+
+    /* The log ends where the flash is still erased. Anything else is a frame
+     * cut by a reset, and the sector is not written after it. */
+    pxSpool->xWrite.ulOffset = prvIsErased( pxSpool, &xPosition ) ? xPosition.ulOffset : pxSpool->ulSectorSize;
+
+    if( ( xCursor.ulSequence < pxSpool->ulOldestSequence ) || ( xCursor.ulOffset < pxSpool->ulHeaderSize ) )
+    {
+        xCursor.ulSequence = ( xCursor.ulSequence < pxSpool->ulOldestSequence ) ?
+                             pxSpool->ulOldestSequence : xCursor.ulSequence;
+        xCursor.ulOffset = pxSpool->ulHeaderSize;
+    }
+
+    if( ( xCursor.ulSequence > pxSpool->xWrite.ulSequence ) ||
+        ( ( xCursor.ulSequence == pxSpool->xWrite.ulSequence ) && ( xCursor.ulOffset > pxSpool->xWrite.ulOffset ) ) )
+    {
+        xCursor = pxSpool->xWrite;
+    }
+
+    pxSpool->xRead = xCursor;
+    pxSpool->xLoad = xCursor;
+
+    return eAzureIoTSuccess;
+}
+/*-----------------------------------------------------------*/
+
+#endif /* democonfigTELEMETRY_SPOOL == 1 */
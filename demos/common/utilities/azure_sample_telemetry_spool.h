@@ -0,0 +1,174 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @file azure_sample_telemetry_spool.h
+ *
+ * @brief A log of telemetry in flash, kept across resets and outages longer
+ * than the RAM of the telemetry store holds.
+ *
+ * The spool is a TelemetryStoreBacking_t that streams: every reading is
+ * appended to the log, and the store holds only the oldest readings not yet
+ * acknowledged, loading the next ones from the log as IoT Hub acknowledges
+ * them. A backlog of days is then sent at the rate the in flight window
+ * allows once the device reconnects.
+ *
+ * The log is a ring of flash sectors written in turn. Each sector starts with
+ * a header holding its sequence number and the read cursor at the time it was
+ * opened, then records, each framed with its length and a CRC32 of it and of
+ * its place in the log. The read cursor, the oldest reading not acknowledged,
+ * is also appended as a small frame every democonfigTELEMETRY_SPOOL_CURSOR_INTERVAL
+ * readings acknowledged, so after a reset at most that many readings are sent
+ * again, as delivery is at least once anyway. At start the sector headers
+ * give the oldest and newest sectors, and only the newest is walked for the
+ * end of the log and the last cursor. A record cut by a reset fails its CRC,
+ * and the rest of its sector is left unused.
+ *
+ * Records are never moved, so flash is only written once per reading: its
+ * length and 8 bytes of frame, rounded up to the program size, plus the
+ * cursor frames and one header per sector. Each sector is then erased once
+ * per pass of the log and the wear is level. At one reading a second of 56
+ * bytes, 64 bytes framed, the log writes 5.5 MB a day, so each sector of a
+ * log of L MB is erased 365 * 5.5 / L times a year: 250 times for the 8 MB
+ * QSPI flash of the B-L475E-IOT01A, 2 500 in ten years against the 100 000 it
+ * is rated for. Internal flash rated for 10 000 cycles needs 2 MB for ten
+ * years. When the log is full, its oldest sector is erased and the readings
+ * in it are dropped.
+ *
+ * Each board provides the flash, in whole sectors, by implementing
+ * TelemetrySpool_PlatformInit(), TelemetrySpool_PlatformRead(),
+ * TelemetrySpool_PlatformWrite() and TelemetrySpool_PlatformErase(). The
+ * spool is used by one task at a time, as the store is.
+ */
+
+#ifndef AZURE_SAMPLE_TELEMETRY_SPOOL_H
+#define AZURE_SAMPLE_TELEMETRY_SPOOL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "azure_iot_result.h"
+
+#include "azure_sample_telemetry_store.h"
+
+/**
+ * @brief 1 to keep the telemetry store of the samples in a spool in flash,
+ * on the boards that implement the platform functions.
+ */
+#ifndef democonfigTELEMETRY_SPOOL
+    #define democonfigTELEMETRY_SPOOL                    0
+#endif
+
+/**
+ * @brief Largest reading the spool takes.
+ */
+#ifndef democonfigTELEMETRY_SPOOL_RECORD_SIZE
+    #define democonfigTELEMETRY_SPOOL_RECORD_SIZE        democonfigTELEMETRY_STORE_MESSAGE_SIZE
+#endif
+
+/**
+ * @brief Readings acknowledged between two writes of the read cursor, the
+ * most readings sent again after a reset.
+ */
+#ifndef democonfigTELEMETRY_SPOOL_CURSOR_INTERVAL
+    #define democonfigTELEMETRY_SPOOL_CURSOR_INTERVAL    16
+#endif
+
+/**
+ * @brief Largest program size of the flash, 32 bytes for the flash words of the STM32H7.
+ */
+#define telemetryspoolMAX_PROGRAM_SIZE    32U
+
+/* The frame before each record. */
+#define telemetryspoolFRAME_HEADER_SIZE    8U
+
+/**
+ * @brief A place in the log, a sector by its sequence number and an offset in it.
+ */
+typedef struct TelemetrySpoolPosition
+{
+    uint32_t ulSequence;
+    uint32_t ulOffset;
+} TelemetrySpoolPosition_t;
+
+typedef struct TelemetrySpool
+{
+    uint32_t ulSectorSize;
+    uint32_t ulSectorCount;
+    uint32_t ulProgramSize;
+    uint32_t ulHeaderSize;     /* The sector header, rounded up to the program size. */
+
+    uint32_t ulWriteSector;    /* Index of the newest sector of the log. */
+    uint32_t ulOldestSequence; /* Sequence number of the oldest sector of the log. */
+    TelemetrySpoolPosition_t xWrite; /* End of the log, in the newest sector. */
+    TelemetrySpoolPosition_t xRead;  /* Oldest record not acknowledged. */
+    TelemetrySpoolPosition_t xLoad;  /* Next record to give to the store. */
+    uint32_t ulLoaded;         /* Records from xRead to xLoad, which the store holds. */
+    uint32_t ulSkip;           /* Records the store holds whose sector was erased. */
+    uint32_t ulUnsaved;        /* Records acknowledged since the cursor was written. */
+    uint32_t ulDropped;        /* Records erased before the store loaded them. */
+
+    TelemetryStoreBacking_t xBacking; /* Pass to TelemetryStore_Init(). */
+
+    uint8_t ucFrame[ telemetryspoolFRAME_HEADER_SIZE + democonfigTELEMETRY_SPOOL_RECORD_SIZE +
+                     telemetryspoolMAX_PROGRAM_SIZE ];
+} TelemetrySpool_t;
+
+/**
+ * @brief Open the log, finding its end and its read cursor, an empty log if
+ * the flash holds none.
+ *
+ * Call before TelemetryStore_Init() with &pxSpool->xBacking, which loads the
+ * readings not yet acknowledged.
+ *
+ * @param[out] pxSpool The spool.
+ * @return An #AzureIoTResult_t with the result of the operation.
+ */
+AzureIoTResult_t TelemetrySpool_Init( TelemetrySpool_t * pxSpool );
+
+/**
+ * @brief Prepare the flash and give its geometry. Implemented by each board.
+ *
+ * @param[out] pulSectorSize Size of an erase sector, at least 256 bytes.
+ * @param[out] pulSectorCount Sectors given to the spool, at least 2.
+ * @param[out] pulProgramSize Size and alignment of a write, a power of two
+ * up to #telemetryspoolMAX_PROGRAM_SIZE, 1 for NOR flash.
+ * @return An #AzureIoTResult_t with the result of the operation.
+ */
+AzureIoTResult_t TelemetrySpool_PlatformInit( uint32_t * pulSectorSize,
+                                              uint32_t * pulSectorCount,
+                                              uint32_t * pulProgramSize );
+
+/**
+ * @brief Read from the flash of the spool. Implemented by each board.
+ *
+ * @param[in] ulOffset Offset in the flash of the spool.
+ * @param[out] pucData Buffer for the data.
+ * @param[in] ulLength Bytes to read.
+ * @return An #AzureIoTResult_t with the result of the operation.
+ */
+AzureIoTResult_t TelemetrySpool_PlatformRead( uint32_t ulOffset,
+                                              uint8_t * pucData,
+                                              uint32_t ulLength );
+
+/**
+ * @brief Program erased flash of the spool. Implemented by each board.
+ *
+ * @param[in] ulOffset Offset in the flash of the spool, a multiple of the program size.
+ * @param[in] pucData The data.
+ * @param[in] ulLength Bytes to write, a multiple of the program size.
+ * @return An #AzureIoTResult_t with the result of the operation.
+ */
+AzureIoTResult_t TelemetrySpool_PlatformWrite( uint32_t ulOffset,
+                                               const uint8_t * pucData,
+                                               uint32_t ulLength );
+
+/**
+ * @brief Erase a sector of the spool to 0xFF. Implemented by each board.
+ *
+ * @param[in] ulSector Index of the sector.
+ * @return An #AzureIoTResult_t with the result of the operation.
+ */
+AzureIoTResult_t TelemetrySpool_PlatformErase( uint32_t ulSector );
+
+#endif /* AZURE_SAMPLE_TELEMETRY_SPOOL_H */
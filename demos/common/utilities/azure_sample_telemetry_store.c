@@ -0,0 +1,366 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+#include "azure_sample_telemetry_store.h"
+
+#include <stddef.h>
+#include <string.h>
+
+/* FreeRTOS includes. */
+#include "FreeRTOS.h"
+
+/* Trace points of the samples. */
+#include "azure_sample_trace.h"
+
+/* Records are kept as a 16 bit length followed by the record bytes. */
+#define telemetrystoreLENGTH_PREFIX_SIZE    2U
+/*-----------------------------------------------------------*/
+
+static void prvRingWrite( TelemetryStore_t * pxStore,
+                          uint32_t ulOffset,
+                          const uint8_t * pucData,
+                          uint32_t ulLength )
+{
+    uint32_t ulFirst;
+
+    ulOffset %= pxStore->ulBufferSize;
+    ulFirst = pxStore->ulBufferSize - ulOffset;
+    ulFirst = ( ulFirst < ulLength ) ? ulFirst : ulLength;
+
+    memcpy( pxStore->pucBuffer + ulOffset, pucData, ulFirst );
+    memcpy( pxStore->pucBuffer, pucData + ulFirst, ulLength - ulFirst );
+}
+/*-----------------------------------------------------------*/
+
+static void prvRingRead( const TelemetryStore_t * pxStore,
+                         uint32_t ulOffset,
+                         uint8_t * pucData,
+                         uint32_t ulLength )
+{
+    uint32_t ulFirst;
+
+    ulOffset %= pxStore->ulBufferSize;
+    ulFirst = pxStore->ulBufferSize - ulOffset;
+    ulFirst = ( ulFirst < ulLength ) ? ulFirst : ulLength;
+
+    memcpy( pucData, pxStore->pucBuffer + ulOffset, ulFirst );
+    memcpy( pucData + ulFirst, pxStore->pucBuffer, ulLength - ulFirst );
+}
+/*-----------------------------------------------------------*/
+
+static uint32_t prvRecordLength( const TelemetryStore_t * pxStore,
+                                 uint32_t ulOffset )
+{
+    uint8_t ucPrefix[ telemetrystoreLENGTH_PREFIX_SIZE ];
+
+    prvRingRead( pxStore, ulOffset, ucPrefix, sizeof( ucPrefix ) );
+
+    return ( uint32_t ) ucPrefix[ 0 ] | ( ( uint32_t ) ucPrefix[ 1 ] << 8 );
+}
+/*-----------------------------------------------------------*/
+
+/* Removes the oldest record, which must not be waiting for PUBACK. */
+static void prvRemoveOldest( TelemetryStore_t * pxStore )
+{
+    uint32_t ulSize = telemetrystoreLENGTH_PREFIX_SIZE + prvRecordLength( pxStore, pxStore->ulHead );
+
+    pxStore->ulHead = ( pxStore->ulHead + ulSize ) % pxStore->ulBufferSize;
+    pxStore->ulUsed -= ulSize;
+    pxStore->ulCount--;
+}
+/*-----------------------------------------------------------*/
+
+static AzureIoTResult_t prvStore( TelemetryStore_t * pxStore,
+                                  const uint8_t * pucRecord,
+                                  uint32_t ulLength,
+                                  bool xPersist )
+{
+    uint32_t ulSize = telemetrystoreLENGTH_PREFIX_SIZE + ulLength;
+    uint32_t ulDropped = 0;
+    uint8_t ucPrefix[ telemetrystoreLENGTH_PREFIX_SIZE ];
+    AzureIoTResult_t xResult;
+
+    /* Leave room for the '[' and ']' around a message of several records. */
+    if( ( pxStore == NULL ) || ( pucRecord == NULL ) || ( ulLength == 0 ) ||
+        ( ulLength > UINT16_MAX ) || ( ulSize > pxStore->ulBufferSize ) ||
+        ( ulLength + 2 > pxStore->ulMessageSize ) )
+    {
+        return eAzureIoTErrorInvalidArgument;
+    }
+
+    if( pxStore->ulUsed + ulSize > pxStore->ulBufferSize )
+    {
+        /* A PUBACK for a dropped record must not remove a newer one, so stop
+         * tracking what is in flight. Whatever is left will be sent again. */
+        TelemetryStore_Resend( pxStore );
+
+        while( pxStore->ulUsed + ulSize > pxStore->ulBufferSize )
+        {
+            prvRemoveOldest( pxStore );
+            ulDropped++;
+        }
+
+        pxStore->ulDropped += ulDropped;
+
+        if( xPersist && ( pxStore->pxBacking != NULL ) )
+        {
+            pxStore->pxBacking->xRemoveOldest( pxStore->pxBacking->pvContext, ulDropped );
+        }
+    }
+
+    if( xPersist && ( pxStore->pxBacking != NULL ) &&
+        ( ( xResult = pxStore->pxBacking->xAppend( pxStore->pxBacking->pvContext,
+                                                   pucRecord, ulLength ) ) != eAzureIoTSuccess ) )
+    {
+        return xResult;
+    }
+
+    ucPrefix[ 0 ] = ( uint8_t ) ulLength;
+    ucPrefix[ 1 ] = ( uint8_t ) ( ulLength >> 8 );
+    prvRingWrite( pxStore, pxStore->ulHead + pxStore->ulUsed, ucPrefix, sizeof( ucPrefix ) );
+    prvRingWrite( pxStore, pxStore->ulHead + pxStore->ulUsed + telemetrystoreLENGTH_PREFIX_SIZE,
+                  pucRecord, ulLength );
+    pxStore->ulUsed += ulSize;
+    pxStore->ulCount++;
+
+    return eAzureIoTSuccess;
+}
+/*-----------------------------------------------------------*/
+
+/* With a backing that loads its records, fills the ring with the oldest
+ * records not yet in it, as many as fit. The message buffer is free between
+ * drains, so a record is read back through it. */
+static void prvLoad( TelemetryStore_t * pxStore )
+{
+    const TelemetryStoreBacking_t * pxBacking = pxStore->pxBacking;
+    uint32_t ulSize;
+    uint32_t ulLength;
+
+    if( ( pxBacking == NULL ) || ( pxBacking->xLoadNext == NULL ) )
+    {
+        return;
+    }
+
+    while( pxStore->ulUsed + telemetrystoreLENGTH_PREFIX_SIZE < pxStore->ulBufferSize )
+    {
+        ulSize = pxStore->ulBufferSize - pxStore->ulUsed - telemetrystoreLENGTH_PREFIX_SIZE;
+        ulSize = ( ulSize < pxStore->ulMessageSize - 2 ) ? ulSize : pxStore->ulMessageSize - 2;
+
+        if( ( pxBacking->xLoadNext( pxBacking->pvContext, pxStore->pucMessage,
+                                    ulSize, &ulLength ) != eAzureIoTSuccess ) ||
+            ( prvStore( pxStore, pxStore->pucMessage, ulLength, false ) != eAzureIoTSuccess ) )
+        {
+            break;
+        }
+    }
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t TelemetryStore_Init( TelemetryStore_t * pxStore,
+                                      uint8_t * pucBuffer,
+                                      uint32_t ulBufferSize,
+                                      uint8_t * pucMessage,
+                                      uint32_t ulMessageSize,
+                                      uint32_t ulRecordsPerMessage,
+                                      const TelemetryStoreBacking_t * pxBacking )
+{
+    if( ( pxStore == NULL ) || ( pucBuffer == NULL ) ||
+        ( ulBufferSize <= telemetrystoreLENGTH_PREFIX_SIZE ) ||
+        ( pucMessage == NULL ) || ( ulMessageSize <= 2 ) )
+    {
+        return eAzureIoTErrorInvalidArgument;
+    }
+
+    memset( pxStore, 0, sizeof( *pxStore ) );
+    pxStore->pucBuffer = pucBuffer;
+    pxStore->ulBufferSize = ulBufferSize;
+    pxStore->pucMessage = pucMessage;
+    pxStore->ulMessageSize = ulMessageSize;
+    pxStore->ulRecordsPerMessage = ( ulRecordsPerMessage > 0 ) ? ulRecordsPerMessage : 1;
+    pxStore->pxBacking = pxBacking;
+
+    if( ( pxBacking != NULL ) && ( pxBacking->xLoadNext != NULL ) )
+    {
+        prvLoad( pxStore );
+    }
+    else if( ( pxBacking != NULL ) && ( pxBacking->xRestore != NULL ) )
+    {
+        pxBacking->xRestore( pxBacking->pvContext, pxStore );
+    }
+
+    return eAzureIoTSuccess;
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t TelemetryStore_Add( TelemetryStore_t * pxStore,
+                                     const uint8_t * pucRecord,
+                                     uint32_t ulLength )
+{
+    AzureIoTResult_t xResult;
+
+    if( ( pxStore == NULL ) || ( pxStore->pxBacking == NULL ) || ( pxStore->pxBacking->xLoadNext == NULL ) )
+    {
+        return prvStore( pxStore, pucRecord, ulLength, true );
+    }
+
+    /* The ring is loaded from the backing in order, so a reading only goes
+     * into it from there. */
+    if( ( pucRecord == NULL ) || ( ulLength == 0 ) || ( ulLength + 2 > pxStore->ulMessageSize ) )
+    {
+        return eAzureIoTErrorInvalidArgument;
+    }
+
+    if( ( xResult = pxStore->pxBacking->xAppend( pxStore->pxBacking->pvContext,
+                                                 pucRecord, ulLength ) ) != eAzureIoTSuccess )
+    {
+        return xResult;
+    }
+
+    prvLoad( pxStore );
+
+    return eAzureIoTSuccess;
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t TelemetryStore_Restore( TelemetryStore_t * pxStore,
+                                         const uint8_t * pucRecord,
+                                         uint32_t ulLength )
+{
+    return prvStore( pxStore, pucRecord, ulLength, false );
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t TelemetryStore_Drain( TelemetryStore_t * pxStore,
+                                       AzureIoTHubClient_t * pxHubClient,
+                                       AzureIoTMessageProperties_t * pxProperties,
+                                       uint32_t ulMaxMessages )
+{
+    AzureIoTResult_t xResult;
+    TelemetryStoreInFlight_t * pxInFlight;
+    uint32_t ulMessages = 0;
+    uint32_t ulOffset;
+    uint32_t ulRecords;
+    uint32_t ulBytes;
+    uint32_t ulLength;
+    uint32_t ulRecordLength;
+
+    while( ( ulMessages < ulMaxMessages ) &&
+           ( pxStore->ulInFlightCount < telemetrystoreMAX_IN_FLIGHT ) &&
+           ( pxStore->ulSentCount < pxStore->ulCount ) )
+    {
+        ulOffset = pxStore->ulHead + pxStore->ulSentBytes;
+        ulRecords = 0;
+        ulBytes = 0;
+
+        if( pxStore->ulRecordsPerMessage == 1 )
+        {
+            ulLength = prvRecordLength( pxStore, ulOffset );
+            prvRingRead( pxStore, ulOffset + telemetrystoreLENGTH_PREFIX_SIZE,
+                         pxStore->pucMessage, ulLength );
+            ulRecords = 1;
+            ulBytes = telemetrystoreLENGTH_PREFIX_SIZE + ulLength;
+        }
+        else
+        {
+            /* Gather the records into a JSON array, as many as fit. Each record
+             * was checked to fit with its brackets when it was stored. */
+            ulLength = 1;
+
+            while( ( ulRecords < pxStore->ulRecordsPerMessage ) &&
+                   ( pxStore->ulSentCount + ulRecords < pxStore->ulCount ) )
+            {
+                ulRecordLength = prvRecordLength( pxStore, ulOffset + ulBytes );
+
+                if( ulLength + ulRecordLength + 1 > pxStore->ulMessageSize )
+                {
+                    break;
+                }
+
+                pxStore->pucMessage[ ulLength - 1 ] = ( ulRecords == 0 ) ? '[' : ',';
+                prvRingRead( pxStore, ulOffset + ulBytes + telemetrystoreLENGTH_PREFIX_SIZE,
+                             pxStore->pucMessage + ulLength, ulRecordLength );
+                ulLength += ulRecordLength + 1;
+                ulBytes += telemetrystoreLENGTH_PREFIX_SIZE + ulRecordLength;
+                ulRecords++;
+            }
+
+            pxStore->pucMessage[ ulLength - 1 ] = ']';
+        }
+
+        pxInFlight = &pxStore->xInFlight[ pxStore->ulInFlightCount ];
+
+        sampletraceBEGIN( eSampleTraceTelemetrySend, ulLength );
+
+        if( ( xResult = AzureIoTHubClient_SendTelemetry( pxHubClient,
+                                                         pxStore->pucMessage, ulLength,
+                                                         pxProperties, eAzureIoTHubMessageQoS1,
+                                                         &pxInFlight->usPacketID ) ) != eAzureIoTSuccess )
+        {
+            sampletraceEND( eSampleTraceTelemetrySend, 0 );
+            return xResult;
+        }
+
+        sampletraceEND( eSampleTraceTelemetrySend, pxInFlight->usPacketID );
+
+        pxInFlight->usRecords = ( uint16_t ) ulRecords;
+        pxInFlight->xAcknowledged = false;
+        pxStore->ulInFlightCount++;
+        pxStore->ulSentCount += ulRecords;
+        pxStore->ulSentBytes += ulBytes;
+        ulMessages++;
+    }
+
+    return eAzureIoTSuccess;
+}
+/*-----------------------------------------------------------*/
+
+void TelemetryStore_Acknowledge( TelemetryStore_t * pxStore,
+                                 uint16_t usPacketID )
+{
+    uint32_t ulIndex;
+    uint32_t ulRemoved = 0;
+    uint32_t ulRecords;
+
+    for( ulIndex = 0; ulIndex < pxStore->ulInFlightCount; ulIndex++ )
+    {
+        if( pxStore->xInFlight[ ulIndex ].usPacketID == usPacketID )
+        {
+            sampletraceMARK( eSampleTracePuback, usPacketID );
+            pxStore->xInFlight[ ulIndex ].xAcknowledged = true;
+            break;
+        }
+    }
+
+    /* Records are only removed from the front of the ring, so a message
+     * acknowledged out of order is held until those before it are. */
+    while( ( pxStore->ulInFlightCount > 0 ) && pxStore->xInFlight[ 0 ].xAcknowledged )
+    {
+        for( ulRecords = pxStore->xInFlight[ 0 ].usRecords; ulRecords > 0; ulRecords-- )
+        {
+            pxStore->ulSentBytes -= telemetrystoreLENGTH_PREFIX_SIZE +
+                                    prvRecordLength( pxStore, pxStore->ulHead );
+            pxStore->ulSentCount--;
+            prvRemoveOldest( pxStore );
+            ulRemoved++;
+        }
+
+        pxStore->ulInFlightCount--;
+        memmove( &pxStore->xInFlight[ 0 ], &pxStore->xInFlight[ 1 ],
+                 pxStore->ulInFlightCount * sizeof( pxStore->xInFlight[ 0 ] ) );
+    }
+
+    if( ( ulRemoved > 0 ) && ( pxStore->pxBacking != NULL ) )
+    {
+        pxStore->pxBacking->xRemoveOldest( pxStore->pxBacking->pvContext, ulRemoved );
+        prvLoad( pxStore );
+    }
+}
+/*-----------------------------------------------------------*/
+
+void TelemetryStore_Resend( TelemetryStore_t * pxStore )
+{
+    pxStore->ulSentCount = 0;
+    pxStore->ulSentBytes = 0;
+    pxStore->ulInFlightCount = 0;
+}
+/*-----------------------------------------------------------*/
@@ -0,0 +1,206 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @file azure_sample_telemetry_store.h
+ *
+ * @brief Store and forward queue for telemetry.
+ *
+ * Readings are kept in a bounded ring buffer until IoT Hub acknowledges
+ * them, so readings taken while the device is offline are sent once it
+ * reconnects. TelemetryStore_Drain() publishes the oldest readings with QoS 1,
+ * a few messages per call, optionally gathering several readings into one
+ * JSON array per message. A reading is removed only when the PUBACK for its
+ * message arrives. After a reconnect, TelemetryStore_Resend() queues the
+ * readings that were sent but not acknowledged again, so delivery is at least
+ * once. When the buffer is full the oldest readings are dropped.
+ *
+ * The ring buffer lives in RAM. A TelemetryStoreBacking_t can keep a copy in
+ * flash, so readings also survive a reset. A backing that loads its records
+ * back one by one, such as the spool of azure_sample_telemetry_spool.h, holds
+ * more than the ring: every reading then goes to the backing, and the ring
+ * only holds the oldest ones, loaded again from the backing as room is made.
+ */
+
+#ifndef AZURE_SAMPLE_TELEMETRY_STORE_H
+#define AZURE_SAMPLE_TELEMETRY_STORE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "azure_iot_hub_client.h"
+
+/**
+ * @brief Size of the ring buffer readings are kept in. 0 disables the store in the samples.
+ */
+#ifndef democonfigTELEMETRY_STORE_SIZE
+    #define democonfigTELEMETRY_STORE_SIZE                    0
+#endif
+
+/**
+ * @brief Size of the buffer each drained message is built in, which bounds the size of a reading.
+ */
+#ifndef democonfigTELEMETRY_STORE_MESSAGE_SIZE
+    #define democonfigTELEMETRY_STORE_MESSAGE_SIZE            512
+#endif
+
+/**
+ * @brief Readings sent together in one message. 1 sends each reading as it is.
+ */
+#ifndef democonfigTELEMETRY_STORE_RECORDS_PER_MESSAGE
+    #define democonfigTELEMETRY_STORE_RECORDS_PER_MESSAGE     8
+#endif
+
+/**
+ * @brief Messages sent per TelemetryStore_Drain() call, which limits the rate a backlog is sent at.
+ */
+#ifndef democonfigTELEMETRY_STORE_MESSAGES_PER_DRAIN
+    #define democonfigTELEMETRY_STORE_MESSAGES_PER_DRAIN      2
+#endif
+
+/**
+ * @brief Messages that can be waiting for PUBACK at once.
+ */
+#ifndef telemetrystoreMAX_IN_FLIGHT
+    #define telemetrystoreMAX_IN_FLIGHT    4
+#endif
+
+struct TelemetryStore;
+
+/**
+ * @brief Optional persistent copy of the store, such as a log in a flash partition.
+ *
+ * Records are appended in order and removed oldest first, so an append only
+ * log with a read pointer is enough.
+ */
+typedef struct TelemetryStoreBacking
+{
+    void * pvContext;
+
+    /* Append a record. */
+    AzureIoTResult_t ( * xAppend )( void * pvContext,
+                                    const uint8_t * pucRecord,
+                                    uint32_t ulLength );
+
+    /* Remove the ulCount oldest records. */
+    void ( * xRemoveOldest )( void * pvContext,
+                              uint32_t ulCount );
+
+    /* Pass each persisted record, oldest first, to TelemetryStore_Restore(). */
+    void ( * xRestore )( void * pvContext,
+                         struct TelemetryStore * pxStore );
+
+    /* Copy the oldest record not yet loaded into pucRecord, or NULL for a
+     * backing that only keeps a copy of the ring. Returns eAzureIoTErrorOutOfMemory,
+     * without moving on, when it is longer than ulSize, and eAzureIoTErrorFailed
+     * when there is none. */
+    AzureIoTResult_t ( * xLoadNext )( void * pvContext,
+                                      uint8_t * pucRecord,
+                                      uint32_t ulSize,
+                                      uint32_t * pulLength );
+} TelemetryStoreBacking_t;
+
+typedef struct TelemetryStoreInFlight
+{
+    uint16_t usPacketID;
+    uint16_t usRecords;
+    bool xAcknowledged;
+} TelemetryStoreInFlight_t;
+
+typedef struct TelemetryStore
+{
+    uint8_t * pucBuffer;
+    uint32_t ulBufferSize;
+    uint8_t * pucMessage;
+    uint32_t ulMessageSize;
+    uint32_t ulRecordsPerMessage;
+    const TelemetryStoreBacking_t * pxBacking;
+
+    uint32_t ulHead;      /* Offset of the oldest record. */
+    uint32_t ulUsed;      /* Bytes used by records, with their length prefixes. */
+    uint32_t ulCount;     /* Records stored. */
+    uint32_t ulSentCount; /* Oldest records sent and waiting for PUBACK. */
+    uint32_t ulSentBytes; /* Bytes used by those records. */
+    uint32_t ulDropped;   /* Records dropped because the store was full. */
+
+    TelemetryStoreInFlight_t xInFlight[ telemetrystoreMAX_IN_FLIGHT ];
+    uint32_t ulInFlightCount;
+} TelemetryStore_t;
+
+/**
+ * @brief Initialize a telemetry store, restoring persisted records if there is a backing,
+ * or loading the oldest if the backing loads them.
+ *
+ * @param[out] pxStore The store to initialize.
+ * @param[in] pucBuffer Ring buffer the records are kept in.
+ * @param[in] ulBufferSize Size of \p pucBuffer.
+ * @param[in] pucMessage Buffer drained messages are built in.
+ * @param[in] ulMessageSize Size of \p pucMessage.
+ * @param[in] ulRecordsPerMessage Records sent together in one message.
+ * @param[in] pxBacking Persistent copy of the store, or NULL.
+ * @return An #AzureIoTResult_t with the result of the operation.
+ */
+AzureIoTResult_t TelemetryStore_Init( TelemetryStore_t * pxStore,
+                                      uint8_t * pucBuffer,
+                                      uint32_t ulBufferSize,
+                                      uint8_t * pucMessage,
+                                      uint32_t ulMessageSize,
+                                      uint32_t ulRecordsPerMessage,
+                                      const TelemetryStoreBacking_t * pxBacking );
+
+/**
+ * @brief Store a reading, dropping the oldest ones if there is no room, or
+ * leaving it in the backing until there is if the backing loads them.
+ *
+ * @param[in] pxStore The store.
+ * @param[in] pucRecord The reading, a JSON value if readings are sent together.
+ * @param[in] ulLength Length of \p pucRecord.
+ * @return An #AzureIoTResult_t with the result of the operation.
+ */
+AzureIoTResult_t TelemetryStore_Add( TelemetryStore_t * pxStore,
+                                     const uint8_t * pucRecord,
+                                     uint32_t ulLength );
+
+/**
+ * @brief Store a record read back from the backing, without appending it to the backing again.
+ *
+ * @param[in] pxStore The store.
+ * @param[in] pucRecord The record.
+ * @param[in] ulLength Length of \p pucRecord.
+ * @return An #AzureIoTResult_t with the result of the operation.
+ */
+AzureIoTResult_t TelemetryStore_Restore( TelemetryStore_t * pxStore,
+                                         const uint8_t * pucRecord,
+                                         uint32_t ulLength );
+
+/**
+ * @brief Send up to \p ulMaxMessages messages of the oldest unsent readings.
+ *
+ * @param[in] pxStore The store.
+ * @param[in] pxHubClient Connected client to send with.
+ * @param[in] pxProperties Properties sent with each message, or NULL.
+ * @param[in] ulMaxMessages Most messages to send in this call.
+ * @return An #AzureIoTResult_t with the result of the operation.
+ */
+AzureIoTResult_t TelemetryStore_Drain( TelemetryStore_t * pxStore,
+                                       AzureIoTHubClient_t * pxHubClient,
+                                       AzureIoTMessageProperties_t * pxProperties,
+                                       uint32_t ulMaxMessages );
+
+/**
+ * @brief Remove the readings of an acknowledged message. Call from the telemetry PUBACK callback.
+ *
+ * @param[in] pxStore The store.
+ * @param[in] usPacketID Packet ID of the acknowledged message.
+ */
+void TelemetryStore_Acknowledge( TelemetryStore_t * pxStore,
+                                 uint16_t usPacketID );
+
+/**
+ * @brief Queue the readings that were sent but not acknowledged again. Call after a reconnect.
+ *
+ * @param[in] pxStore The store.
+ */
+void TelemetryStore_Resend( TelemetryStore_t * pxStore );
+
+#endif /* AZURE_SAMPLE_TELEMETRY_STORE_H */
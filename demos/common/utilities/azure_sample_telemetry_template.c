@@ -0,0 +1,211 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+#include "azure_sample_telemetry_template.h"
+
+#include <stddef.h>
+#include <string.h>
+
+#include "azure_sample_decimal.h"
+
+/* A sign and the 10 digits of 2^31. */
+#define telemetrytemplateINT32_SIZE    ( 11U )
+/*-----------------------------------------------------------*/
+
+/* Copies the key of a field, without its comma if it is the first of the message. */
+static AzureIoTResult_t prvAppendKey( TelemetryTemplateWriter_t * pxWriter,
+                                      uint32_t ulIndex,
+                                      uint32_t ulValueSize )
+{
+    const TelemetryTemplate_t * pxTemplate = pxWriter->pxTemplate;
+    uint32_t ulStart;
+    uint32_t ulKeyLength;
+
+    if( ulIndex >= pxTemplate->ulCount )
+    {
+        return eAzureIoTErrorInvalidArgument;
+    }
+
+    ulStart = pxTemplate->usKeyOffsets[ ulIndex ] + ( pxWriter->xHasField ? 0U : 1U );
+    ulKeyLength = pxTemplate->usKeyOffsets[ ulIndex + 1 ] - ulStart;
+
+    /* The '}' of the end is kept room for. */
+    if( pxWriter->ulBufferSize - pxWriter->ulLength < ulKeyLength + ulValueSize + 1U )
+    {
+        return eAzureIoTErrorOutOfMemory;
+    }
+
+    ( void ) memcpy( pxWriter->pucBuffer + pxWriter->ulLength, pxTemplate->pucSkeleton + ulStart, ulKeyLength );
+    pxWriter->ulLength += ulKeyLength;
+    pxWriter->xHasField = true;
+
+    return eAzureIoTSuccess;
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t TelemetryTemplate_Init( TelemetryTemplate_t * pxTemplate,
+                                         const TelemetryTemplateField_t * pxFields,
+                                         uint32_t ulCount,
+                                         uint8_t * pucSkeleton,
+                                         uint32_t ulSkeletonSize )
+{
+    uint32_t ulOffset = 0;
+    uint32_t ulIndex;
+    uint32_t ulCharacter;
+    uint8_t ucCharacter;
+
+    if( ( pxTemplate == NULL ) || ( pxFields == NULL ) || ( pucSkeleton == NULL ) ||
+        ( ulCount > telemetrytemplateMAX_COUNT ) || ( ulSkeletonSize > UINT16_MAX ) )
+    {
+        return eAzureIoTErrorInvalidArgument;
+    }
+
+    for( ulIndex = 0; ulIndex < ulCount; ulIndex++ )
+    {
+        for( ulCharacter = 0; ulCharacter < pxFields[ ulIndex ].ulNameLength; ulCharacter++ )
+        {
+            ucCharacter = pxFields[ ulIndex ].pucName[ ulCharacter ];
+
+            if( ( ucCharacter < 0x20U ) || ( ucCharacter == ( uint8_t ) '"' ) || ( ucCharacter == ( uint8_t ) '\\' ) )
+            {
+                return eAzureIoTErrorInvalidArgument;
+            }
+        }
+
+        if( ulSkeletonSize - ulOffset < telemetrytemplateKEY_SIZE( pxFields[ ulIndex ].ulNameLength ) )
+        {
+            return eAzureIoTErrorOutOfMemory;
+        }
+
+        pxTemplate->usKeyOffsets[ ulIndex ] = ( uint16_t ) ulOffset;
+        pucSkeleton[ ulOffset++ ] = ',';
+        pucSkeleton[ ulOffset++ ] = '"';
+        ( void ) memcpy( pucSkeleton + ulOffset, pxFields[ ulIndex ].pucName, pxFields[ ulIndex ].ulNameLength );
+        ulOffset += pxFields[ ulIndex ].ulNameLength;
+        pucSkeleton[ ulOffset++ ] = '"';
+        pucSkeleton[ ulOffset++ ] = ':';
+    }
+
+    pxTemplate->usKeyOffsets[ ulCount ] = ( uint16_t ) ulOffset;
+    pxTemplate->pxFields = pxFields;
+    pxTemplate->ulCount = ulCount;
+    pxTemplate->pucSkeleton = pucSkeleton;
+
+    return eAzureIoTSuccess;
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t TelemetryTemplate_Begin( TelemetryTemplateWriter_t * pxWriter,
+                                          const TelemetryTemplate_t * pxTemplate,
+                                          uint8_t * pucBuffer,
+                                          uint32_t ulBufferSize )
+{
+    if( ( pxWriter == NULL ) || ( pxTemplate == NULL ) || ( pucBuffer == NULL ) )
+    {
+        return eAzureIoTErrorInvalidArgument;
+    }
+
+    pxWriter->pxTemplate = pxTemplate;
+    pxWriter->pucBuffer = pucBuffer;
+    pxWriter->ulBufferSize = ulBufferSize;
+    pxWriter->ulLength = 0;
+    pxWriter->xHasField = false;
+
+    /* Room for the '}' too. */
+    if( ulBufferSize < 2U )
+    {
+        return eAzureIoTErrorOutOfMemory;
+    }
+
+    pucBuffer[ pxWriter->ulLength++ ] = '{';
+
+    return eAzureIoTSuccess;
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t TelemetryTemplate_AppendDouble( TelemetryTemplateWriter_t * pxWriter,
+                                                 uint32_t ulIndex,
+                                                 double xValue )
+{
+    AzureIoTResult_t xResult;
+    uint8_t ucValue[ decimalBUFFER_SIZE( decimalMAX_FRACTIONAL_DIGITS ) ];
+    uint32_t ulValueLength;
+
+    if( ulIndex >= pxWriter->pxTemplate->ulCount )
+    {
+        return eAzureIoTErrorInvalidArgument;
+    }
+
+    ulValueLength = Decimal_Format( xValue, pxWriter->pxTemplate->pxFields[ ulIndex ].ulFractionalDigits,
+                                    ucValue, sizeof( ucValue ) );
+
+    if( ulValueLength == 0 )
+    {
+        return eAzureIoTErrorInvalidArgument;
+    }
+
+    if( ( xResult = prvAppendKey( pxWriter, ulIndex, ulValueLength ) ) != eAzureIoTSuccess )
+    {
+        return xResult;
+    }
+
+    ( void ) memcpy( pxWriter->pucBuffer + pxWriter->ulLength, ucValue, ulValueLength );
+    pxWriter->ulLength += ulValueLength;
+
+    return eAzureIoTSuccess;
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t TelemetryTemplate_AppendInt32( TelemetryTemplateWriter_t * pxWriter,
+                                                uint32_t ulIndex,
+                                                int32_t lValue )
+{
+    AzureIoTResult_t xResult;
+    uint8_t ucValue[ telemetrytemplateINT32_SIZE ];
+    uint32_t ulStart = sizeof( ucValue );
+    uint32_t ulMagnitude;
+
+    /* Through unsigned, so that INT32_MIN does not overflow. */
+    ulMagnitude = ( lValue < 0 ) ? ( 0U - ( uint32_t ) lValue ) : ( uint32_t ) lValue;
+
+    do
+    {
+        ucValue[ --ulStart ] = ( uint8_t ) ( '0' + ( ulMagnitude % 10U ) );
+        ulMagnitude /= 10U;
+    } while( ulMagnitude != 0U );
+
+    if( lValue < 0 )
+    {
+        ucValue[ --ulStart ] = '-';
+    }
+
+    if( ( xResult = prvAppendKey( pxWriter, ulIndex, sizeof( ucValue ) - ulStart ) ) != eAzureIoTSuccess )
+    {
+        return xResult;
+    }
+
+    ( void ) memcpy( pxWriter->pucBuffer + pxWriter->ulLength, ucValue + ulStart, sizeof( ucValue ) - ulStart );
+    pxWriter->ulLength += sizeof( ucValue ) - ulStart;
+
+    return eAzureIoTSuccess;
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t TelemetryTemplate_End( TelemetryTemplateWriter_t * pxWriter )
+{
+    if( pxWriter->ulLength >= pxWriter->ulBufferSize )
+    {
+        return eAzureIoTErrorOutOfMemory;
+    }
+
+    pxWriter->pucBuffer[ pxWriter->ulLength++ ] = '}';
+
+    return eAzureIoTSuccess;
+}
+/*-----------------------------------------------------------*/
+
+int32_t TelemetryTemplate_GetBytesUsed( const TelemetryTemplateWriter_t * pxWriter )
+{
+    return ( int32_t ) pxWriter->ulLength;
+}
+/*-----------------------------------------------------------*/
@@ -0,0 +1,147 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @file azure_sample_telemetry_template.h
+ *
+ * @brief JSON telemetry written from keys rendered once.
+ *
+ * The JSON writer escapes and quotes every name, and checks every token, for
+ * each message, although the names of a telemetry message never change. A
+ * TelemetryTemplate_t renders the key of each field, its name quoted with the
+ * separators around it, into a skeleton buffer when it is initialized. A
+ * message is then the keys of the fields it has, copied, each followed by its
+ * value, which is formatted with integer arithmetic: Decimal_Format() for a
+ * double, with the decimals of the field, and a plain conversion for an
+ * integer.
+ *
+ * The fields a message leaves out, such as the ones the telemetry filter
+ * drops, are skipped, so the keys are copied rather than the whole skeleton
+ * patched. The names must not need escaping.
+ */
+
+#ifndef AZURE_SAMPLE_TELEMETRY_TEMPLATE_H
+#define AZURE_SAMPLE_TELEMETRY_TEMPLATE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "azure_iot_result.h"
+
+/**
+ * @brief Most fields in one TelemetryTemplate_t.
+ */
+#define telemetrytemplateMAX_COUNT    ( 32U )
+
+/**
+ * @brief Size the key of a name of ulNameLength takes in the skeleton.
+ *
+ * A comma, the quoted name and a colon.
+ */
+#define telemetrytemplateKEY_SIZE( ulNameLength )    ( ( ulNameLength ) + 4U )
+
+/**
+ * @brief Initializer of a #TelemetryTemplateField_t.
+ */
+#define telemetrytemplateFIELD( pcName, ulFractionalDigits ) \
+    { ( const uint8_t * ) ( pcName ), sizeof( pcName ) - 1, ( ulFractionalDigits ) }
+
+typedef struct TelemetryTemplateField
+{
+    const uint8_t * pucName;
+    uint32_t ulNameLength;
+    uint32_t ulFractionalDigits; /* Of a double. */
+} TelemetryTemplateField_t;
+
+typedef struct TelemetryTemplate
+{
+    const TelemetryTemplateField_t * pxFields;
+    uint32_t ulCount;
+    const uint8_t * pucSkeleton;
+    uint16_t usKeyOffsets[ telemetrytemplateMAX_COUNT + 1 ]; /* Field i is from [ i ] to [ i + 1 ]. */
+} TelemetryTemplate_t;
+
+typedef struct TelemetryTemplateWriter
+{
+    const TelemetryTemplate_t * pxTemplate;
+    uint8_t * pucBuffer;
+    uint32_t ulBufferSize;
+    uint32_t ulLength;
+    bool xHasField; /* The keys after the first keep their comma. */
+} TelemetryTemplateWriter_t;
+
+/**
+ * @brief Render the keys of the fields into a skeleton buffer.
+ *
+ * @param[out] pxTemplate The template to initialize.
+ * @param[in] pxFields The fields, which must stay valid.
+ * @param[in] ulCount Number of fields, up to #telemetrytemplateMAX_COUNT.
+ * @param[out] pucSkeleton Buffer the keys are rendered in, which must stay
+ * valid. The sum of #telemetrytemplateKEY_SIZE of the names is enough.
+ * @param[in] ulSkeletonSize Size of \p pucSkeleton.
+ * @return eAzureIoTErrorOutOfMemory if the keys do not fit,
+ * eAzureIoTErrorInvalidArgument if a name needs escaping.
+ */
+AzureIoTResult_t TelemetryTemplate_Init( TelemetryTemplate_t * pxTemplate,
+                                         const TelemetryTemplateField_t * pxFields,
+                                         uint32_t ulCount,
+                                         uint8_t * pucSkeleton,
+                                         uint32_t ulSkeletonSize );
+
+/**
+ * @brief Start a message, writing its '{'.
+ *
+ * @param[out] pxWriter The writer to initialize.
+ * @param[in] pxTemplate The template.
+ * @param[out] pucBuffer Buffer for the message.
+ * @param[in] ulBufferSize Size of \p pucBuffer.
+ * @return eAzureIoTErrorOutOfMemory if the buffer is empty.
+ */
+AzureIoTResult_t TelemetryTemplate_Begin( TelemetryTemplateWriter_t * pxWriter,
+                                          const TelemetryTemplate_t * pxTemplate,
+                                          uint8_t * pucBuffer,
+                                          uint32_t ulBufferSize );
+
+/**
+ * @brief Write a field with a double value, with the decimals of the field.
+ *
+ * @param[in] pxWriter The writer.
+ * @param[in] ulIndex Index of the field in the template.
+ * @param[in] xValue The value, finite and below #decimalMAX_MAGNITUDE.
+ * @return eAzureIoTErrorOutOfMemory if the field does not fit, in which case
+ * nothing of it is written.
+ */
+AzureIoTResult_t TelemetryTemplate_AppendDouble( TelemetryTemplateWriter_t * pxWriter,
+                                                 uint32_t ulIndex,
+                                                 double xValue );
+
+/**
+ * @brief Write a field with an integer value.
+ *
+ * @param[in] pxWriter The writer.
+ * @param[in] ulIndex Index of the field in the template.
+ * @param[in] lValue The value.
+ * @return eAzureIoTErrorOutOfMemory if the field does not fit, in which case
+ * nothing of it is written.
+ */
+AzureIoTResult_t TelemetryTemplate_AppendInt32( TelemetryTemplateWriter_t * pxWriter,
+                                                uint32_t ulIndex,
+                                                int32_t lValue );
+
+/**
+ * @brief End the message, writing its '}'.
+ *
+ * @param[in] pxWriter The writer.
+ * @return eAzureIoTErrorOutOfMemory if the '}' does not fit.
+ */
+AzureIoTResult_t TelemetryTemplate_End( TelemetryTemplateWriter_t * pxWriter );
+
+/**
+ * @brief Length of the message written so far.
+ *
+ * @param[in] pxWriter The writer.
+ * @return The length in bytes.
+ */
+int32_t TelemetryTemplate_GetBytesUsed( const TelemetryTemplateWriter_t * pxWriter );
+
+#endif /* AZURE_SAMPLE_TELEMETRY_TEMPLATE_H */
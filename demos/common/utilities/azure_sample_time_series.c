@@ -0,0 +1,238 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+#include "azure_sample_time_series.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+/* A sign and the 19 digits of an int64_t, or the 20 of a uint64_t. */
+#define timeseriesINT64_SIZE    ( 20U )
+
+/* {"t0": ,"dt": ,"n": and the closing brace around the numbers. */
+#define timeseriesHEADER_SIZE   ( 18U )
+
+/*-----------------------------------------------------------*/
+
+/* Writes a magnitude, with a '-' if it is negative, at the end of a
+ * timeseriesINT64_SIZE buffer; returns where it starts. */
+static uint32_t prvFormat( uint64_t ullMagnitude,
+                           bool xNegative,
+                           uint8_t * pucText )
+{
+    uint32_t ulStart = timeseriesINT64_SIZE;
+
+    do
+    {
+        pucText[ --ulStart ] = ( uint8_t ) ( '0' + ( ullMagnitude % 10U ) );
+        ullMagnitude /= 10U;
+    } while( ullMagnitude != 0U );
+
+    if( xNegative )
+    {
+        pucText[ --ulStart ] = '-';
+    }
+
+    return ulStart;
+}
+/*-----------------------------------------------------------*/
+
+static uint32_t prvDigits( uint64_t ullValue )
+{
+    uint32_t ulDigits = 1;
+
+    while( ullValue >= 10U )
+    {
+        ullValue /= 10U;
+        ulDigits++;
+    }
+
+    return ulDigits;
+}
+/*-----------------------------------------------------------*/
+
+/* The element i of a channel: the first value, or the difference from the value before. */
+static int64_t prvElement( const int32_t * plColumn,
+                           uint32_t ulIndex )
+{
+    return ( ulIndex == 0 ) ? ( int64_t ) plColumn[ 0 ] :
+           ( int64_t ) plColumn[ ulIndex ] - ( int64_t ) plColumn[ ulIndex - 1 ];
+}
+/*-----------------------------------------------------------*/
+
+static uint32_t prvElementLength( int64_t llElement )
+{
+    return ( llElement < 0 ) ? prvDigits( ( uint64_t ) -llElement ) + 1U : prvDigits( ( uint64_t ) llElement );
+}
+/*-----------------------------------------------------------*/
+
+static uint8_t * prvAppendNumber( uint8_t * pucOut,
+                                  int64_t llValue )
+{
+    uint8_t ucText[ timeseriesINT64_SIZE ];
+    uint32_t ulStart = prvFormat( ( llValue < 0 ) ? ( uint64_t ) -llValue : ( uint64_t ) llValue,
+                                  llValue < 0, ucText );
+
+    ( void ) memcpy( pucOut, ucText + ulStart, timeseriesINT64_SIZE - ulStart );
+
+    return pucOut + ( timeseriesINT64_SIZE - ulStart );
+}
+/*-----------------------------------------------------------*/
+
+static uint8_t * prvAppendText( uint8_t * pucOut,
+                                const char * pcText,
+                                uint32_t ulLength )
+{
+    ( void ) memcpy( pucOut, pcText, ulLength );
+
+    return pucOut + ulLength;
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t TimeSeries_Init( TimeSeries_t * pxSeries,
+                                  const TimeSeriesChannel_t * pxChannels,
+                                  uint32_t ulChannelCount,
+                                  int32_t * plSamples,
+                                  uint32_t ulMaxSamples,
+                                  uint32_t ulPeriodMs )
+{
+    if( ( pxSeries == NULL ) || ( pxChannels == NULL ) || ( ulChannelCount == 0 ) ||
+        ( plSamples == NULL ) || ( ulMaxSamples == 0 ) )
+    {
+        return eAzureIoTErrorInvalidArgument;
+    }
+
+    pxSeries->pxChannels = pxChannels;
+    pxSeries->ulChannelCount = ulChannelCount;
+    pxSeries->plSamples = plSamples;
+    pxSeries->ulMaxSamples = ulMaxSamples;
+    pxSeries->ulPeriodMs = ulPeriodMs;
+    pxSeries->ullFirstTimeMs = 0;
+    pxSeries->ulCount = 0;
+
+    return eAzureIoTSuccess;
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t TimeSeries_Append( TimeSeries_t * pxSeries,
+                                    uint64_t ullTimeMs,
+                                    const int32_t * plValues )
+{
+    uint32_t ulChannel;
+
+    if( pxSeries->ulCount >= pxSeries->ulMaxSamples )
+    {
+        return eAzureIoTErrorOutOfMemory;
+    }
+
+    if( pxSeries->ulCount == 0 )
+    {
+        pxSeries->ullFirstTimeMs = ullTimeMs;
+    }
+
+    for( ulChannel = 0; ulChannel < pxSeries->ulChannelCount; ulChannel++ )
+    {
+        pxSeries->plSamples[ ulChannel * pxSeries->ulMaxSamples + pxSeries->ulCount ] = plValues[ ulChannel ];
+    }
+
+    pxSeries->ulCount++;
+
+    return eAzureIoTSuccess;
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t TimeSeries_Encode( TimeSeries_t * pxSeries,
+                                    uint8_t * pucBuffer,
+                                    uint32_t ulBufferSize,
+                                    uint32_t * pulLength )
+{
+    uint32_t ulLength;
+    uint32_t ulSampleLength;
+    uint32_t ulSamples;
+    uint32_t ulChannel;
+    uint32_t ulIndex;
+    int32_t * plColumn;
+    uint8_t * pucOut = pucBuffer;
+
+    if( pxSeries->ulCount == 0 )
+    {
+        return eAzureIoTErrorInvalidArgument;
+    }
+
+    /* The header, with room for a count of every sample kept, and the key
+     * and brackets of each channel. */
+    ulLength = timeseriesHEADER_SIZE + prvDigits( pxSeries->ullFirstTimeMs ) +
+               prvDigits( pxSeries->ulPeriodMs ) + prvDigits( pxSeries->ulCount );
+
+    for( ulChannel = 0; ulChannel < pxSeries->ulChannelCount; ulChannel++ )
+    {
+        ulLength += pxSeries->pxChannels[ ulChannel ].ulNameLength + 6U;
+    }
+
+    /* Whole samples only, so every channel has the same count. */
+    for( ulSamples = 0; ulSamples < pxSeries->ulCount; ulSamples++ )
+    {
+        ulSampleLength = 0;
+
+        for( ulChannel = 0; ulChannel < pxSeries->ulChannelCount; ulChannel++ )
+        {
+            plColumn = &pxSeries->plSamples[ ulChannel * pxSeries->ulMaxSamples ];
+            ulSampleLength += prvElementLength( prvElement( plColumn, ulSamples ) ) + ( ( ulSamples > 0 ) ? 1U : 0U );
+        }
+
+        if( ulLength + ulSampleLength > ulBufferSize )
+        {
+            break;
+        }
+
+        ulLength += ulSampleLength;
+    }
+
+    if( ulSamples == 0 )
+    {
+        return eAzureIoTErrorOutOfMemory;
+    }
+
+    pucOut = prvAppendText( pucOut, "{\"t0\":", 6 );
+    pucOut = prvAppendNumber( pucOut, ( int64_t ) pxSeries->ullFirstTimeMs );
+    pucOut = prvAppendText( pucOut, ",\"dt\":", 6 );
+    pucOut = prvAppendNumber( pucOut, pxSeries->ulPeriodMs );
+    pucOut = prvAppendText( pucOut, ",\"n\":", 5 );
+    pucOut = prvAppendNumber( pucOut, ulSamples );
+
+    for( ulChannel = 0; ulChannel < pxSeries->ulChannelCount; ulChannel++ )
+    {
+        plColumn = &pxSeries->plSamples[ ulChannel * pxSeries->ulMaxSamples ];
+
+        pucOut = prvAppendText( pucOut, ",\"", 2 );
+        pucOut = prvAppendText( pucOut, ( const char * ) pxSeries->pxChannels[ ulChannel ].pucName,
+                                pxSeries->pxChannels[ ulChannel ].ulNameLength );
+        pucOut = prvAppendText( pucOut, "\":[", 3 );
+
+        for( ulIndex = 0; ulIndex < ulSamples; ulIndex++ )
+        {
+            if( ulIndex > 0 )
+            {
+                *pucOut++ = ',';
+            }
+
+            pucOut = prvAppendNumber( pucOut, prvElement( plColumn, ulIndex ) );
+        }
+
+        *pucOut++ = ']';
+
+        /* The samples left start the next message. */
+        ( void ) memmove( plColumn, plColumn + ulSamples,
+                          ( pxSeries->ulCount - ulSamples ) * sizeof( plColumn[ 0 ] ) );
+    }
+
+    *pucOut++ = '}';
+
+    pxSeries->ulCount -= ulSamples;
+    pxSeries->ullFirstTimeMs += ( uint64_t ) ulSamples * pxSeries->ulPeriodMs;
+    *pulLength = ( uint32_t ) ( pucOut - pucBuffer );
+
+    return eAzureIoTSuccess;
+}
+/*-----------------------------------------------------------*/
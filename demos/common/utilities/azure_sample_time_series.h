@@ -0,0 +1,106 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @file azure_sample_time_series.h
+ *
+ * @brief Samples taken at a fixed period, sent as delta encoded columns.
+ *
+ * Sending each sample as its own JSON object repeats every key and a
+ * timestamp per sample. A TimeSeries_t keeps integer samples of a few
+ * channels instead, and TimeSeries_Encode() writes them as one object
+ * holding the time of the first sample, the sample period and, for each
+ * channel, an array of its first value followed by the difference of each
+ * value from the one before:
+ *
+ *     {"t0":1700000000000,"dt":5,"n":4,"ax":[9806,3,-1,0],"ay":[-12,0,2,-1]}
+ *
+ * - "t0" is the time of the first sample, in milliseconds since the epoch.
+ * - "dt" is the sample period, in milliseconds.
+ * - "n" is the number of samples, the length of every array.
+ * - Every other member is a channel. Its value i, from 0, is the sum of the
+ *   elements 0 to i of its array, and was sampled at t0 + i * dt.
+ *
+ * Slowly changing values then take a digit or two per sample. A message
+ * decoder, such as a function behind a message route, expands a message by
+ * running the sums; the channels and their units are those the device
+ * documents.
+ *
+ * The samples are kept until they are encoded. A message that cannot hold
+ * them all gets as many as fit, and the rest start the next one.
+ */
+
+#ifndef AZURE_SAMPLE_TIME_SERIES_H
+#define AZURE_SAMPLE_TIME_SERIES_H
+
+#include <stdint.h>
+
+#include "azure_iot_result.h"
+
+/**
+ * @brief Initializer of a #TimeSeriesChannel_t.
+ */
+#define timeseriesCHANNEL( pcName )    { ( const uint8_t * ) ( pcName ), sizeof( pcName ) - 1 }
+
+typedef struct TimeSeriesChannel
+{
+    const uint8_t * pucName; /* Must not need escaping. */
+    uint32_t ulNameLength;
+} TimeSeriesChannel_t;
+
+typedef struct TimeSeries
+{
+    const TimeSeriesChannel_t * pxChannels;
+    uint32_t ulChannelCount;
+    int32_t * plSamples;     /* ulMaxSamples values of each channel, one channel after the other. */
+    uint32_t ulMaxSamples;
+    uint32_t ulPeriodMs;
+    uint64_t ullFirstTimeMs; /* Time of the first sample kept. */
+    uint32_t ulCount;        /* Samples kept. */
+} TimeSeries_t;
+
+/**
+ * @brief Initialize an empty series.
+ *
+ * @param[out] pxSeries The series to initialize.
+ * @param[in] pxChannels The channels, which must stay valid.
+ * @param[in] ulChannelCount Number of \p pxChannels.
+ * @param[in] plSamples Buffer for ulChannelCount * ulMaxSamples values, which must stay valid.
+ * @param[in] ulMaxSamples Samples the series keeps.
+ * @param[in] ulPeriodMs Sample period, in milliseconds.
+ * @return An #AzureIoTResult_t with the result of the operation.
+ */
+AzureIoTResult_t TimeSeries_Init( TimeSeries_t * pxSeries,
+                                  const TimeSeriesChannel_t * pxChannels,
+                                  uint32_t ulChannelCount,
+                                  int32_t * plSamples,
+                                  uint32_t ulMaxSamples,
+                                  uint32_t ulPeriodMs );
+
+/**
+ * @brief Add a sample, one value per channel, taken one period after the one before.
+ *
+ * @param[in] pxSeries The series.
+ * @param[in] ullTimeMs Time of the sample, used only when the series is empty.
+ * @param[in] plValues The value of each channel.
+ * @return eAzureIoTErrorOutOfMemory if the series is full.
+ */
+AzureIoTResult_t TimeSeries_Append( TimeSeries_t * pxSeries,
+                                    uint64_t ullTimeMs,
+                                    const int32_t * plValues );
+
+/**
+ * @brief Write the oldest samples, as many as fit, as a message and remove them.
+ *
+ * @param[in] pxSeries The series, which must have a sample.
+ * @param[out] pucBuffer Buffer for the message.
+ * @param[in] ulBufferSize Size of \p pucBuffer.
+ * @param[out] pulLength Length of the message.
+ * @return eAzureIoTErrorOutOfMemory if not even one sample fits.
+ */
+AzureIoTResult_t TimeSeries_Encode( TimeSeries_t * pxSeries,
+                                    uint8_t * pucBuffer,
+                                    uint32_t ulBufferSize,
+                                    uint32_t * pulLength );
+
+#endif /* AZURE_SAMPLE_TIME_SERIES_H */
@@ -0,0 +1,260 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+#include "azure_sample_time_sync.h"
+
+#include <string.h>
+
+/* Kernel includes. */
+#include "FreeRTOS.h"
+#include "task.h"
+#include "semphr.h"
+
+/* Demo Specific configs. */
+#include "demo_config.h"
+
+/* Seconds from the NTP epoch, 1900, to the unix one, 1970. */
+#define timesyncNTP_UNIX_OFFSET    2208988800ULL
+
+#define timesyncSNTP_CLIENT        0x23U /* No leap warning, version 4, client. */
+#define timesyncSNTP_MODE_SERVER   4U
+#define timesyncSNTP_LI_ALARM      3U    /* The server is not synchronised. */
+
+/* Offsets in the packet, of the big endian originate and transmit timestamps. */
+#define timesyncSNTP_ORIGINATE     24U
+#define timesyncSNTP_TRANSMIT      40U
+
+/* The clock: the time at xBaseTicks, and the correction still to slew in. */
+static uint64_t ullBaseMs;
+static TickType_t xBaseTicks;
+static int64_t llSlewMs;
+static bool xValid;
+
+static StaticSemaphore_t xValidSemaphoreBuffer;
+static SemaphoreHandle_t xValidSemaphore;
+/*-----------------------------------------------------------*/
+
+static uint64_t prvTicksToMs( TickType_t xTicks )
+{
+    return ( ( uint64_t ) xTicks * 1000U ) / configTICK_RATE_HZ;
+}
+/*-----------------------------------------------------------*/
+
+/* The time of the clock at xNow, with pllApplied the part of the slew
+ * corrected by then. Called in a critical section. */
+static uint64_t prvClockAt( TickType_t xNow,
+                            int64_t * pllApplied )
+{
+    uint64_t ullElapsedMs = prvTicksToMs( xNow - xBaseTicks );
+    int64_t llLimit = ( int64_t ) ( ( ullElapsedMs * democonfigTIME_SYNC_SLEW_PPM ) / 1000000U );
+    int64_t llApplied = llSlewMs;
+
+    if( llApplied > llLimit )
+    {
+        llApplied = llLimit;
+    }
+    else if( llApplied < -llLimit )
+    {
+        llApplied = -llLimit;
+    }
+
+    *pllApplied = llApplied;
+
+    return ( uint64_t ) ( ( int64_t ) ( ullBaseMs + ullElapsedMs ) + llApplied );
+}
+/*-----------------------------------------------------------*/
+
+/* Moves the base of the clock to xNow, keeping its time. Called in a
+ * critical section. */
+static void prvRebase( TickType_t xNow )
+{
+    int64_t llApplied;
+
+    ullBaseMs = prvClockAt( xNow, &llApplied );
+    llSlewMs -= llApplied;
+    xBaseTicks = xNow;
+}
+/*-----------------------------------------------------------*/
+
+void TimeSync_Init( void )
+{
+    ullBaseMs = democonfigTIME_SYNC_FALLBACK_TIME * 1000U;
+    xBaseTicks = xTaskGetTickCount();
+    llSlewMs = 0;
+    xValid = false;
+
+    xValidSemaphore = xSemaphoreCreateBinaryStatic( &xValidSemaphoreBuffer );
+}
+/*-----------------------------------------------------------*/
+
+void TimeSync_Report( uint64_t ullUnixTimeMs,
+                      TickType_t xAtTicks )
+{
+    TickType_t xNow;
+    int64_t llError;
+    bool xFirst;
+    bool xStepped = false;
+
+    taskENTER_CRITICAL();
+    {
+        xNow = xTaskGetTickCount();
+        ullUnixTimeMs += prvTicksToMs( xNow - xAtTicks );
+        prvRebase( xNow );
+        llError = ( int64_t ) ( ullUnixTimeMs - ullBaseMs );
+        xFirst = !xValid;
+
+        /* The slew left from the last report is replaced, as the error is
+         * measured with the part of it already corrected. */
+        if( xFirst || ( llError > ( int64_t ) democonfigTIME_SYNC_STEP_MS ) ||
+            ( llError < -( int64_t ) democonfigTIME_SYNC_STEP_MS ) )
+        {
+            ullBaseMs = ullUnixTimeMs;
+            llSlewMs = 0;
+            xStepped = true;
+        }
+        else
+        {
+            llSlewMs = llError;
+        }
+
+        xValid = true;
+    }
+    taskEXIT_CRITICAL();
+
+    if( xFirst )
+    {
+        LogInfo( ( "Time set to %u, %d s from the fallback.\r\n",
+                   ( unsigned int ) ( ullUnixTimeMs / 1000U ), ( int ) ( llError / 1000 ) ) );
+
+        /* Given once and never taken for good, so it wakes each waiter. */
+        ( void ) xSemaphoreGive( xValidSemaphore );
+    }
+    else if( xStepped )
+    {
+        LogWarn( ( "Time stepped by %d ms.\r\n", ( int ) llError ) );
+    }
+    else
+    {
+        LogInfo( ( "Time slewing by %d ms.\r\n", ( int ) llError ) );
+    }
+}
+/*-----------------------------------------------------------*/
+
+bool TimeSync_IsValid( void )
+{
+    return xValid;
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t TimeSync_WaitValid( TickType_t xTicksToWait )
+{
+    if( xValid )
+    {
+        return eAzureIoTSuccess;
+    }
+
+    if( xSemaphoreTake( xValidSemaphore, xTicksToWait ) != pdTRUE )
+    {
+        return eAzureIoTErrorFailed;
+    }
+
+    ( void ) xSemaphoreGive( xValidSemaphore );
+
+    return eAzureIoTSuccess;
+}
+/*-----------------------------------------------------------*/
+
+uint64_t TimeSync_GetUnixTimeMs( void )
+{
+    TickType_t xNow;
+    uint64_t ullTime;
+    int64_t llApplied;
+
+    taskENTER_CRITICAL();
+    {
+        xNow = xTaskGetTickCount();
+
+        /* Keeps the ticks since the base from wrapping, without the sync. */
+        if( ( TickType_t ) ( xNow - xBaseTicks ) > ( portMAX_DELAY / 2U ) )
+        {
+            prvRebase( xNow );
+        }
+
+        ullTime = prvClockAt( xNow, &llApplied );
+    }
+    taskEXIT_CRITICAL();
+
+    return ullTime;
+}
+/*-----------------------------------------------------------*/
+
+static uint32_t prvReadBigEndian32( const uint8_t * pucData )
+{
+    return ( ( uint32_t ) pucData[ 0 ] << 24 ) | ( ( uint32_t ) pucData[ 1 ] << 16 ) |
+           ( ( uint32_t ) pucData[ 2 ] << 8 ) | ( uint32_t ) pucData[ 3 ];
+}
+/*-----------------------------------------------------------*/
+
+void TimeSync_SntpRequest( uint8_t * pucPacket,
+                           uint32_t ulNonce )
+{
+    memset( pucPacket, 0, timesyncSNTP_PACKET_SIZE );
+    pucPacket[ 0 ] = timesyncSNTP_CLIENT;
+
+    /* In the fraction of the transmit timestamp, the seconds being 0. */
+    pucPacket[ timesyncSNTP_TRANSMIT + 4U ] = ( uint8_t ) ( ulNonce >> 24 );
+    pucPacket[ timesyncSNTP_TRANSMIT + 5U ] = ( uint8_t ) ( ulNonce >> 16 );
+    pucPacket[ timesyncSNTP_TRANSMIT + 6U ] = ( uint8_t ) ( ulNonce >> 8 );
+    pucPacket[ timesyncSNTP_TRANSMIT + 7U ] = ( uint8_t ) ulNonce;
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t TimeSync_SntpResponse( const uint8_t * pucPacket,
+                                        size_t xLength,
+                                        uint32_t ulNonce,
+                                        uint64_t * pullUnixTimeMs )
+{
+    uint64_t ullSeconds;
+    uint32_t ulFraction;
+
+    if( ( pucPacket == NULL ) || ( pullUnixTimeMs == NULL ) || ( xLength < timesyncSNTP_PACKET_SIZE ) )
+    {
+        return eAzureIoTErrorInvalidArgument;
+    }
+
+    /* A stratum of 0 is a kiss-o'-death, asking the client to go away. */
+    if( ( ( pucPacket[ 0 ] & 0x07U ) != timesyncSNTP_MODE_SERVER ) ||
+        ( ( pucPacket[ 0 ] >> 6 ) == timesyncSNTP_LI_ALARM ) ||
+        ( pucPacket[ 1 ] == 0U ) || ( pucPacket[ 1 ] > 15U ) )
+    {
+        return eAzureIoTErrorFailed;
+    }
+
+    /* The server echoes the transmit timestamp of the request, which tells a
+     * late answer to an earlier request, or a forged one, apart. */
+    if( ( prvReadBigEndian32( &pucPacket[ timesyncSNTP_ORIGINATE ] ) != 0U ) ||
+        ( prvReadBigEndian32( &pucPacket[ timesyncSNTP_ORIGINATE + 4U ] ) != ulNonce ) )
+    {
+        return eAzureIoTErrorFailed;
+    }
+
+    ullSeconds = prvReadBigEndian32( &pucPacket[ timesyncSNTP_TRANSMIT ] );
+    ulFraction = prvReadBigEndian32( &pucPacket[ timesyncSNTP_TRANSMIT + 4U ] );
+
+    if( ullSeconds == 0U )
+    {
+        return eAzureIoTErrorFailed;
+    }
+
+    /* Without the top bit the seconds are of the era that starts in 2036. */
+    if( ( ullSeconds & 0x80000000ULL ) == 0U )
+    {
+        ullSeconds += 0x100000000ULL;
+    }
+
+    *pullUnixTimeMs = ( ullSeconds - timesyncNTP_UNIX_OFFSET ) * 1000U +
+                      ( ( ( uint64_t ) ulFraction * 1000U ) >> 32 );
+
+    return eAzureIoTSuccess;
+}
+/*-----------------------------------------------------------*/
@@ -0,0 +1,152 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @file azure_sample_time_sync.h
+ *
+ * @brief The unix time of a board without a clock, from SNTP.
+ *
+ * The clock counts from the tick count, from democonfigTIME_SYNC_FALLBACK_TIME
+ * at boot until the first time comes from the network. Each board gets that
+ * time its own way, in the background while the samples provision and
+ * connect, and hands it to TimeSync_Report(): the lwIP boards from the SNTP
+ * client of lwIP, the others with TimeSync_SntpRequest() and
+ * TimeSync_SntpResponse() over a socket of their own.
+ *
+ * The first report sets the clock. The later ones slew it, correcting the
+ * error by at most democonfigTIME_SYNC_SLEW_PPM of the time that passes, so
+ * that the clock never jumps, nor runs backwards, under the tokens and
+ * timestamps of the samples. Only an error beyond democonfigTIME_SYNC_STEP_MS
+ * steps it again.
+ *
+ * Until the first report the time is not valid. Only what needs a valid time,
+ * such as generating a SAS token, waits for it with TimeSync_WaitValid(), so
+ * the boot, the DNS lookups and the TLS handshakes go on meanwhile. The boards
+ * that sync their time define democonfigTIME_SYNC in their demo_config.h.
+ */
+
+#ifndef AZURE_SAMPLE_TIME_SYNC_H
+#define AZURE_SAMPLE_TIME_SYNC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "FreeRTOS.h"
+
+#include "azure_iot_result.h"
+
+/**
+ * @brief Unix time of the clock at boot, until the network gave one, in seconds.
+ */
+#ifndef democonfigTIME_SYNC_FALLBACK_TIME
+    #define democonfigTIME_SYNC_FALLBACK_TIME    1673769600ULL
+#endif
+
+/**
+ * @brief Largest rate at which an error of the clock is corrected, in parts per million.
+ */
+#ifndef democonfigTIME_SYNC_SLEW_PPM
+    #define democonfigTIME_SYNC_SLEW_PPM         500U
+#endif
+
+/**
+ * @brief Error of the clock beyond which it is set instead of slewed, in milliseconds.
+ */
+#ifndef democonfigTIME_SYNC_STEP_MS
+    #define democonfigTIME_SYNC_STEP_MS          ( 10U * 1000U )
+#endif
+
+/**
+ * @brief Interval of the SNTP queries once the time is valid, in milliseconds.
+ */
+#ifndef democonfigTIME_SYNC_INTERVAL_MS
+    #define democonfigTIME_SYNC_INTERVAL_MS      ( 60U * 60U * 1000U )
+#endif
+
+/**
+ * @brief The SNTP server.
+ */
+#ifndef democonfigTIME_SYNC_SERVER
+    #define democonfigTIME_SYNC_SERVER           "pool.ntp.org"
+#endif
+
+/**
+ * @brief Longest wait of TimeSync_WaitValid() in the samples, in milliseconds.
+ */
+#ifndef democonfigTIME_SYNC_WAIT_MS
+    #define democonfigTIME_SYNC_WAIT_MS          ( 30U * 1000U )
+#endif
+
+/**
+ * @brief Size of an SNTP packet, without the optional fields.
+ */
+#define timesyncSNTP_PACKET_SIZE                 48U
+
+/**
+ * @brief The UDP port of SNTP.
+ */
+#define timesyncSNTP_PORT                        123U
+
+/**
+ * @brief Initialize the clock. Call before the scheduler starts.
+ */
+void TimeSync_Init( void );
+
+/**
+ * @brief Hand a time from the network to the clock.
+ *
+ * @param[in] ullUnixTimeMs The unix time, in milliseconds.
+ * @param[in] xAtTicks The tick count when it was the time.
+ */
+void TimeSync_Report( uint64_t ullUnixTimeMs,
+                      TickType_t xAtTicks );
+
+/**
+ * @brief Whether the network gave a time since boot.
+ *
+ * @return true once the clock was set.
+ */
+bool TimeSync_IsValid( void );
+
+/**
+ * @brief Wait until the network gave a time.
+ *
+ * @param[in] xTicksToWait Longest wait.
+ * @return eAzureIoTErrorFailed if the time is still not valid, the clock
+ * then keeping the fallback time.
+ */
+AzureIoTResult_t TimeSync_WaitValid( TickType_t xTicksToWait );
+
+/**
+ * @brief The unix time of the clock, in milliseconds.
+ *
+ * @return The time, which never runs backwards unless the clock was stepped.
+ */
+uint64_t TimeSync_GetUnixTimeMs( void );
+
+/**
+ * @brief Write an SNTP client request.
+ *
+ * @param[out] pucPacket Buffer of #timesyncSNTP_PACKET_SIZE bytes.
+ * @param[in] ulNonce Sent as the transmit timestamp, which the server echoes.
+ */
+void TimeSync_SntpRequest( uint8_t * pucPacket,
+                           uint32_t ulNonce );
+
+/**
+ * @brief Read the time of the response of an SNTP server.
+ *
+ * @param[in] pucPacket The response.
+ * @param[in] xLength Length of \p pucPacket.
+ * @param[in] ulNonce The nonce of the request.
+ * @param[out] pullUnixTimeMs The transmit time of the server, in unix milliseconds.
+ * @return eAzureIoTErrorFailed if it does not answer the request, or the
+ * server is not synchronised or asks to be queried no more.
+ */
+AzureIoTResult_t TimeSync_SntpResponse( const uint8_t * pucPacket,
+                                        size_t xLength,
+                                        uint32_t ulNonce,
+                                        uint64_t * pullUnixTimeMs );
+
+#endif /* AZURE_SAMPLE_TIME_SYNC_H */
@@ -0,0 +1,141 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+#include "azure_sample_token_log.h"
+
+#include <stdarg.h>
+#include <string.h>
+
+/* FreeRTOS includes. */
+#include "FreeRTOS.h"
+#include "task.h"
+
+/* Built into the samples whether the logs are tokenised or not. */
+#if ( democonfigTOKEN_LOG == 1 )
+
+/* The start byte and the length of the frame. */
+#define tokenlogFRAME_HEADER_SIZE    ( 2U )
+
+static TokenLogOutput_t xTokenOutput;
+/*-----------------------------------------------------------*/
+
+static size_t prvPutLittleEndian( uint8_t * pucFrame,
+                                  size_t xOffset,
+                                  uint64_t ullValue,
+                                  size_t xSize )
+{
+    size_t xIndex;
+
+    if( ( xOffset + xSize ) > democonfigTOKEN_LOG_MAX_FRAME )
+    {
+        return xOffset;
+    }
+
+    for( xIndex = 0; xIndex < xSize; xIndex++ )
+    {
+        pucFrame[ xOffset + xIndex ] = ( uint8_t ) ( ullValue >> ( 8U * xIndex ) );
+    }
+
+    return xOffset + xSize;
+}
+/*-----------------------------------------------------------*/
+
+static size_t prvPutString( uint8_t * pucFrame,
+                            size_t xOffset,
+                            const char * pcString )
+{
+    size_t xLength;
+
+    if( pcString == NULL )
+    {
+        pcString = "(null)";
+    }
+
+    xLength = strnlen( pcString, democonfigTOKEN_LOG_MAX_STRING );
+
+    if( ( xOffset + 1U ) >= democonfigTOKEN_LOG_MAX_FRAME )
+    {
+        return xOffset;
+    }
+
+    /* Cut to what is left of the frame. */
+    if( ( xOffset + 1U + xLength ) > democonfigTOKEN_LOG_MAX_FRAME )
+    {
+        xLength = democonfigTOKEN_LOG_MAX_FRAME - xOffset - 1U;
+    }
+
+    pucFrame[ xOffset ] = ( uint8_t ) xLength;
+    ( void ) memcpy( &pucFrame[ xOffset + 1U ], pcString, xLength );
+
+    return xOffset + 1U + xLength;
+}
+/*-----------------------------------------------------------*/
+
+void TokenLog_Init( TokenLogOutput_t xOutput )
+{
+    xTokenOutput = xOutput;
+}
+/*-----------------------------------------------------------*/
+
+void TokenLog_Write( uint32_t ulToken,
+                     uint32_t ulTypes,
+                     ... )
+{
+    uint8_t ucFrame[ democonfigTOKEN_LOG_MAX_FRAME ];
+    size_t xOffset = tokenlogFRAME_HEADER_SIZE;
+    uint32_t ulCount = ulTypes & 0xFU;
+    uint32_t ulIndex;
+    va_list xArgs;
+
+    if( xTokenOutput == NULL )
+    {
+        return;
+    }
+
+    xOffset = prvPutLittleEndian( ucFrame, xOffset, ulToken, sizeof( uint32_t ) );
+
+    va_start( xArgs, ulTypes );
+
+    for( ulIndex = 0; ulIndex < ulCount; ulIndex++ )
+    {
+        switch( ( ulTypes >> ( 4U + ( 2U * ulIndex ) ) ) & 0x3U )
+        {
+            case tokenlogARG_64:
+                xOffset = prvPutLittleEndian( ucFrame, xOffset,
+                                              va_arg( xArgs, unsigned long long ), sizeof( uint64_t ) );
+                break;
+
+            case tokenlogARG_DOUBLE:
+               {
+                   double xValue = va_arg( xArgs, double );
+                   uint64_t ullBits;
+
+                   ( void ) memcpy( &ullBits, &xValue, sizeof( ullBits ) );
+                   xOffset = prvPutLittleEndian( ucFrame, xOffset, ullBits, sizeof( uint64_t ) );
+               }
+               break;
+
+            case tokenlogARG_STRING:
+                xOffset = prvPutString( ucFrame, xOffset, va_arg( xArgs, const char * ) );
+                break;
+
+            default:
+                xOffset = prvPutLittleEndian( ucFrame, xOffset,
+                                              va_arg( xArgs, uint32_t ), sizeof( uint32_t ) );
+                break;
+        }
+    }
+
+    va_end( xArgs );
+
+    ucFrame[ 0 ] = ( uint8_t ) tokenlogFRAME_START;
+    ucFrame[ 1 ] = ( uint8_t ) ( xOffset - tokenlogFRAME_HEADER_SIZE );
+
+    /* Written whole, so the frames of two tasks do not interleave. */
+    vTaskSuspendAll();
+    xTokenOutput( ( const char * ) ucFrame, xOffset );
+    ( void ) xTaskResumeAll();
+}
+/*-----------------------------------------------------------*/
+
+#endif /* democonfigTOKEN_LOG == 1 */
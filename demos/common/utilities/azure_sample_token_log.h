@@ -0,0 +1,167 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @file azure_sample_token_log.h
+ *
+ * @brief Logs written as a token and the raw arguments, not as text.
+ *
+ * With democonfigTOKEN_LOG set to 1, by the SAMPLE_TOKEN_LOG CMake option, the
+ * config headers of a board map SdkLog() to tokenlogLOG(). It keeps the
+ * format, with the file and line of the log, in the .tokenlog section, which
+ * the linker script of the board places at address 0 and does not load. The
+ * format is then neither in flash nor formatted on the device. The address of
+ * the format in that section is the token of the log, and TokenLog_Write()
+ * writes only the token and the arguments:
+ *
+ * - 0xA5, then the length of the rest of the frame on one byte;
+ * - the token, on 4 bytes;
+ * - each argument, in the order of the format: integers of up to 32 bits on
+ *   4 bytes, 64-bit integers and doubles on 8 bytes, and strings as their
+ *   length on one byte followed by their characters.
+ *
+ * All numbers are little endian. A decoder reads the formats from the ELF,
+ * dumped with `objcopy -O binary --only-section=.tokenlog`, in which the
+ * token is the offset of the format, followed by a NUL and "file:line". Text
+ * still written by vLoggingPrintf() carries no 0xA5 byte, so the two can share
+ * the UART.
+ *
+ * The formats must be string literals and take at most 8 arguments. The type
+ * of each argument is taken from the argument itself, so pointers other than
+ * strings are written as 32-bit integers, as they are on the boards. The logs
+ * are written by the caller, democonfigDEFERRED_LOG then only applying to
+ * those still written as text.
+ */
+
+#ifndef AZURE_SAMPLE_TOKEN_LOG_H
+#define AZURE_SAMPLE_TOKEN_LOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief 1 to tokenise the logs of the board, set by the SAMPLE_TOKEN_LOG
+ * CMake option.
+ */
+#ifndef democonfigTOKEN_LOG
+    #define democonfigTOKEN_LOG    0
+#endif
+
+/**
+ * @brief Most bytes of one frame, the arguments that do not fit being left out.
+ */
+#ifndef democonfigTOKEN_LOG_MAX_FRAME
+    #define democonfigTOKEN_LOG_MAX_FRAME    ( 96U )
+#endif
+
+/**
+ * @brief Most characters written of a string argument.
+ */
+#ifndef democonfigTOKEN_LOG_MAX_STRING
+    #define democonfigTOKEN_LOG_MAX_STRING    ( 48U )
+#endif
+
+#define tokenlogFRAME_START    ( 0xA5U )
+
+/**
+ * @brief Types of the arguments, on 2 bits each.
+ */
+#define tokenlogARG_32          ( 0U )
+#define tokenlogARG_64          ( 1U )
+#define tokenlogARG_DOUBLE      ( 2U )
+#define tokenlogARG_STRING      ( 3U )
+
+/**
+ * @brief Writes frames out, such as to the UART.
+ *
+ * @param[in] pcFrame The frame.
+ * @param[in] xLength Its length.
+ */
+typedef void ( * TokenLogOutput_t )( const char * pcFrame,
+                                     size_t xLength );
+
+#if ( democonfigTOKEN_LOG == 1 )
+
+    #define tokenlogSTRING_( x )    # x
+    #define tokenlogSTRING( x )     tokenlogSTRING_( x )
+    #define tokenlogJOIN_( a, b )   a ## b
+    #define tokenlogJOIN( a, b )    tokenlogJOIN_( a, b )
+
+    #define tokenlogTYPE( xArg )                   \
+    ( ( uint32_t ) _Generic( ( xArg ),             \
+                             char *: tokenlogARG_STRING,              \
+                             const char *: tokenlogARG_STRING,        \
+                             float: tokenlogARG_DOUBLE,               \
+                             double: tokenlogARG_DOUBLE,              \
+                             long long: tokenlogARG_64,               \
+                             unsigned long long: tokenlogARG_64,      \
+                             default: tokenlogARG_32 ) )
+
+/* The number of arguments on the low 4 bits, then the type of each. */
+    #define tokenlogCOUNT_( x, a1, a2, a3, a4, a5, a6, a7, a8, xCount, ... )    xCount
+    #define tokenlogCOUNT( ... )                                                tokenlogCOUNT_( x, ## __VA_ARGS__, 8, 7, 6, 5, 4, 3, 2, 1, 0 )
+    #define tokenlogTYPES( ... )                                                tokenlogJOIN( tokenlogTYPES_, tokenlogCOUNT( __VA_ARGS__ ) )( __VA_ARGS__ )
+
+    #define tokenlogTYPES_0()                            ( 0U )
+    #define tokenlogTYPES_1( a )                         ( 1U | ( tokenlogTYPE( a ) << 4 ) )
+    #define tokenlogTYPES_2( a, b )                      ( 2U | ( tokenlogTYPES_1( a ) & ~0xFU ) | ( tokenlogTYPE( b ) << 6 ) )
+    #define tokenlogTYPES_3( a, b, c )                   ( 3U | ( tokenlogTYPES_2( a, b ) & ~0xFU ) | ( tokenlogTYPE( c ) << 8 ) )
+    #define tokenlogTYPES_4( a, b, c, d )                ( 4U | ( tokenlogTYPES_3( a, b, c ) & ~0xFU ) | ( tokenlogTYPE( d ) << 10 ) )
+    #define tokenlogTYPES_5( a, b, c, d, e )             ( 5U | ( tokenlogTYPES_4( a, b, c, d ) & ~0xFU ) | ( tokenlogTYPE( e ) << 12 ) )
+    #define tokenlogTYPES_6( a, b, c, d, e, f )          ( 6U | ( tokenlogTYPES_5( a, b, c, d, e ) & ~0xFU ) | ( tokenlogTYPE( f ) << 14 ) )
+    #define tokenlogTYPES_7( a, b, c, d, e, f, g )       ( 7U | ( tokenlogTYPES_6( a, b, c, d, e, f ) & ~0xFU ) | ( tokenlogTYPE( g ) << 16 ) )
+    #define tokenlogTYPES_8( a, b, c, d, e, f, g, h )    ( 8U | ( tokenlogTYPES_7( a, b, c, d, e, f, g ) & ~0xFU ) | ( tokenlogTYPE( h ) << 18 ) )
+
+/**
+ * @brief Write a log as its token and arguments.
+ *
+ * @param[in] pcFormat A printf format, which must be a string literal.
+ */
+    #define tokenlogLOG( pcFormat, ... )                                                                       \
+    do {                                                                                                       \
+        static const char cTokenLogEntry[] __attribute__( ( section( ".tokenlog" ), used ) ) =                 \
+            pcFormat "\0" __FILE__ ":" tokenlogSTRING( __LINE__ );                                             \
+        TokenLog_Write( ( uint32_t ) ( uintptr_t ) cTokenLogEntry, tokenlogTYPES( __VA_ARGS__ ), ## __VA_ARGS__ ); \
+    } while( 0 )
+
+/* The log with its line end, as one token. */
+    #define tokenlogLOG_LINE( pcFormat, ... )    tokenlogLOG( pcFormat "\r\n", ## __VA_ARGS__ )
+
+    #define tokenlogSDK_LOG( ... )               tokenlogLOG( __VA_ARGS__ )
+
+    #undef SdkLog
+    #define SdkLog( message )        tokenlogSDK_LOG message
+
+    #undef SdkLogLine
+    #define SdkLogLine( message )    tokenlogLOG_LINE message
+
+/* The metadata of logging_stack.h without the file name, which the token
+ * already gives. */
+    #ifndef LOG_METADATA_FORMAT
+        #define LOG_METADATA_FORMAT    "[%d] "
+    #endif
+
+    #ifndef LOG_METADATA_ARGS
+        #define LOG_METADATA_ARGS    __LINE__
+    #endif
+
+/**
+ * @brief Set where the frames are written, until then they are dropped.
+ *
+ * @param[in] xOutput Writes the frames out.
+ */
+    void TokenLog_Init( TokenLogOutput_t xOutput );
+
+/**
+ * @brief Write a frame, called by tokenlogLOG().
+ *
+ * @param[in] ulToken Token of the log.
+ * @param[in] ulTypes Number and types of the arguments, from tokenlogTYPES().
+ */
+    void TokenLog_Write( uint32_t ulToken,
+                         uint32_t ulTypes,
+                         ... );
+
+#endif /* democonfigTOKEN_LOG == 1 */
+
+#endif /* AZURE_SAMPLE_TOKEN_LOG_H */
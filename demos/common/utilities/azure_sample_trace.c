@@ -0,0 +1,153 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+#include "azure_sample_trace.h"
+
+#include <stddef.h>
+
+/* FreeRTOS includes. */
+#include "FreeRTOS.h"
+#include "task.h"
+
+#if ( democonfigTRACE_BACKEND == sampletraceBACKEND_TRACEALYZER )
+    #include "trcRecorder.h"
+#endif
+
+/* Indexed by event. */
+static const char * const pcEventNames[ eSampleTraceEventCount ] =
+{
+    "unknown",
+    "tcpConnect",
+    "tlsHandshake",
+    "socketSend",
+    "socketRecv",
+    "subscribe",
+    "telemetrySend",
+    "puback",
+    "aduChunkFetch",
+    "flashWrite",
+    "flashVerify"
+};
+
+#if ( democonfigTRACE_BACKEND == sampletraceBACKEND_RING )
+    static SampleTraceRecord_t xRing[ democonfigTRACE_RING_LENGTH ];
+    static uint32_t ulRingNext;  /* Index of the next record. */
+    static uint32_t ulRingCount; /* Records held, up to the length of the ring. */
+#elif ( democonfigTRACE_BACKEND == sampletraceBACKEND_TRACEALYZER )
+    static traceString xChannels[ eSampleTraceEventCount ];
+#endif
+/*-----------------------------------------------------------*/
+
+void SampleTrace_Init( void )
+{
+    uint32_t ulEvent;
+
+    for( ulEvent = 1; ulEvent < eSampleTraceEventCount; ulEvent++ )
+    {
+        #if ( democonfigTRACE_BACKEND == sampletraceBACKEND_SYSTEMVIEW )
+            SEGGER_SYSVIEW_NameMarker( ( unsigned ) ulEvent, pcEventNames[ ulEvent ] );
+        #elif ( democonfigTRACE_BACKEND == sampletraceBACKEND_TRACEALYZER )
+            xChannels[ ulEvent ] = xTraceRegisterString( pcEventNames[ ulEvent ] );
+        #endif
+    }
+}
+/*-----------------------------------------------------------*/
+
+void SampleTrace_Record( SampleTraceEvent_t xEvent,
+                         SampleTracePhase_t xPhase,
+                         uint32_t ulValue )
+{
+    #if ( democonfigTRACE_BACKEND == sampletraceBACKEND_RING )
+        SampleTraceRecord_t * pxRecord;
+
+        taskENTER_CRITICAL();
+        {
+            pxRecord = &xRing[ ulRingNext ];
+            ulRingNext = ( ulRingNext + 1U ) % democonfigTRACE_RING_LENGTH;
+
+            if( ulRingCount < democonfigTRACE_RING_LENGTH )
+            {
+                ulRingCount++;
+            }
+
+            #if ( configGENERATE_RUN_TIME_STATS == 1 )
+                pxRecord->ulTime = ( uint32_t ) portGET_RUN_TIME_COUNTER_VALUE();
+            #else
+                pxRecord->ulTime = ( uint32_t ) xTaskGetTickCount();
+            #endif
+            pxRecord->ulValue = ulValue;
+            pxRecord->ucEvent = ( uint8_t ) xEvent;
+            pxRecord->ucPhase = ( uint8_t ) xPhase;
+        }
+        taskEXIT_CRITICAL();
+    #elif ( democonfigTRACE_BACKEND == sampletraceBACKEND_TRACEALYZER )
+        /* Not named yet if SampleTrace_Init() was not called. */
+        if( ( ( uint32_t ) xEvent >= eSampleTraceEventCount ) || ( xChannels[ xEvent ] == 0 ) )
+        {
+            return;
+        }
+
+        if( xPhase == eSampleTraceBegin )
+        {
+            vTracePrintF( xChannels[ xEvent ], "begin %u", ulValue );
+        }
+        else if( xPhase == eSampleTraceEnd )
+        {
+            vTracePrintF( xChannels[ xEvent ], "end %u", ulValue );
+        }
+        else
+        {
+            vTracePrintF( xChannels[ xEvent ], "%u", ulValue );
+        }
+    #else
+        ( void ) xEvent;
+        ( void ) xPhase;
+        ( void ) ulValue;
+    #endif /* democonfigTRACE_BACKEND */
+}
+/*-----------------------------------------------------------*/
+
+uint32_t SampleTrace_Read( SampleTraceRecord_t * pxRecords,
+                           uint32_t ulMaxRecords )
+{
+    uint32_t ulCount = 0;
+
+    #if ( democonfigTRACE_BACKEND == sampletraceBACKEND_RING )
+        uint32_t ulIndex;
+        uint32_t ulFirst;
+
+        if( pxRecords == NULL )
+        {
+            return 0;
+        }
+
+        taskENTER_CRITICAL();
+        {
+            ulCount = ( ulRingCount < ulMaxRecords ) ? ulRingCount : ulMaxRecords;
+            ulFirst = ( ulRingNext + democonfigTRACE_RING_LENGTH - ulCount ) % democonfigTRACE_RING_LENGTH;
+
+            for( ulIndex = 0; ulIndex < ulCount; ulIndex++ )
+            {
+                pxRecords[ ulIndex ] = xRing[ ( ulFirst + ulIndex ) % democonfigTRACE_RING_LENGTH ];
+            }
+        }
+        taskEXIT_CRITICAL();
+    #else
+        ( void ) pxRecords;
+        ( void ) ulMaxRecords;
+    #endif /* democonfigTRACE_BACKEND == sampletraceBACKEND_RING */
+
+    return ulCount;
+}
+/*-----------------------------------------------------------*/
+
+const char * SampleTrace_EventName( SampleTraceEvent_t xEvent )
+{
+    if( ( uint32_t ) xEvent >= eSampleTraceEventCount )
+    {
+        xEvent = ( SampleTraceEvent_t ) 0;
+    }
+
+    return pcEventNames[ xEvent ];
+}
+/*-----------------------------------------------------------*/
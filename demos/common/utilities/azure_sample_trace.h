@@ -0,0 +1,139 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @file azure_sample_trace.h
+ *
+ * @brief Trace points on the path from connect to PUBACK, and of ADU.
+ *
+ * The transport, the sockets wrappers, the telemetry utilities and the ADU
+ * sample mark where the phases of a connection, a publish or an update begin
+ * and end, so their latency can be measured on the device. By default the
+ * macros compile to nothing. democonfigTRACE_BACKEND sends them to:
+ *
+ * - sampletraceBACKEND_RING: a RAM ring of the latest records, read with
+ *   SampleTrace_Read() or from the debugger, for boards without a probe.
+ * - sampletraceBACKEND_SYSTEMVIEW: SEGGER SystemView markers, an event being
+ *   the marker ID. The probe build provides SEGGER_SYSVIEW.h.
+ * - sampletraceBACKEND_TRACEALYZER: Percepio Tracealyzer user events, on one
+ *   channel per event. The build provides trcRecorder.h.
+ *
+ * Call SampleTrace_Init() once the recorder runs, to name the events.
+ */
+
+#ifndef AZURE_SAMPLE_TRACE_H
+#define AZURE_SAMPLE_TRACE_H
+
+#include <stdint.h>
+
+#define sampletraceBACKEND_NONE           0
+#define sampletraceBACKEND_RING           1
+#define sampletraceBACKEND_SYSTEMVIEW     2
+#define sampletraceBACKEND_TRACEALYZER    3
+
+/**
+ * @brief Where the trace points go, one of the sampletraceBACKEND_ values.
+ *
+ * Set by the SAMPLE_TRACE_BACKEND CMake option, so that every file agrees.
+ */
+#ifndef democonfigTRACE_BACKEND
+    #define democonfigTRACE_BACKEND    sampletraceBACKEND_NONE
+#endif
+
+/**
+ * @brief Records the RAM ring holds, the oldest being overwritten.
+ */
+#ifndef democonfigTRACE_RING_LENGTH
+    #define democonfigTRACE_RING_LENGTH    ( 128U )
+#endif
+
+/**
+ * @brief Events traced. Their values are the SystemView marker IDs.
+ */
+typedef enum SampleTraceEvent
+{
+    eSampleTraceTcpConnect = 1,   /* Value: the port. */
+    eSampleTraceTlsHandshake,     /* Value: the TLS transport status at the end. */
+    eSampleTraceSocketSend,       /* Value: bytes to send, then bytes sent or the error. */
+    eSampleTraceSocketRecv,       /* Value: bytes wanted, then bytes received or the error. */
+    eSampleTraceSubscribe,        /* Value: the result at the end. */
+    eSampleTraceTelemetrySend,    /* Value: the length, then the packet ID. */
+    eSampleTracePuback,           /* Value: the packet ID. */
+    eSampleTraceAduChunkFetch,    /* Value: the offset, then the length received. */
+    eSampleTraceFlashWrite,       /* Value: the offset, then the result. */
+    eSampleTraceFlashVerify,      /* Value: the result at the end. */
+    eSampleTraceEventCount
+} SampleTraceEvent_t;
+
+typedef enum SampleTracePhase
+{
+    eSampleTraceBegin = 0,
+    eSampleTraceEnd,
+    eSampleTraceMark
+} SampleTracePhase_t;
+
+/**
+ * @brief A record of the RAM ring.
+ */
+typedef struct SampleTraceRecord
+{
+    uint32_t ulTime;  /* Run-time stats counter, or ticks without run-time stats. */
+    uint32_t ulValue;
+    uint8_t ucEvent;  /* A #SampleTraceEvent_t. */
+    uint8_t ucPhase;  /* A #SampleTracePhase_t. */
+} SampleTraceRecord_t;
+
+#if ( democonfigTRACE_BACKEND == sampletraceBACKEND_NONE )
+    #define sampletraceBEGIN( xEvent, ulValue )    do {} while( 0 )
+    #define sampletraceEND( xEvent, ulValue )      do {} while( 0 )
+    #define sampletraceMARK( xEvent, ulValue )     do {} while( 0 )
+#elif ( democonfigTRACE_BACKEND == sampletraceBACKEND_SYSTEMVIEW )
+    #include "SEGGER_SYSVIEW.h"
+
+/* Markers carry no value, so the values are left out. */
+    #define sampletraceBEGIN( xEvent, ulValue )    SEGGER_SYSVIEW_MarkStart( ( unsigned ) ( xEvent ) )
+    #define sampletraceEND( xEvent, ulValue )      SEGGER_SYSVIEW_MarkStop( ( unsigned ) ( xEvent ) )
+    #define sampletraceMARK( xEvent, ulValue )     SEGGER_SYSVIEW_Mark( ( unsigned ) ( xEvent ) )
+#else
+    #define sampletraceBEGIN( xEvent, ulValue )    SampleTrace_Record( ( xEvent ), eSampleTraceBegin, ( uint32_t ) ( ulValue ) )
+    #define sampletraceEND( xEvent, ulValue )      SampleTrace_Record( ( xEvent ), eSampleTraceEnd, ( uint32_t ) ( ulValue ) )
+    #define sampletraceMARK( xEvent, ulValue )     SampleTrace_Record( ( xEvent ), eSampleTraceMark, ( uint32_t ) ( ulValue ) )
+#endif /* democonfigTRACE_BACKEND */
+
+/**
+ * @brief Name the events in the recorder. Nothing to do for the RAM ring.
+ */
+void SampleTrace_Init( void );
+
+/**
+ * @brief Record a trace point, in the RAM ring or as a Tracealyzer user event.
+ *
+ * Called through the sampletrace macros, from tasks.
+ *
+ * @param[in] xEvent The event.
+ * @param[in] xPhase Whether it begins, ends or is an instant.
+ * @param[in] ulValue Value of the event.
+ */
+void SampleTrace_Record( SampleTraceEvent_t xEvent,
+                         SampleTracePhase_t xPhase,
+                         uint32_t ulValue );
+
+/**
+ * @brief Copy the records of the RAM ring, the oldest first.
+ *
+ * @param[out] pxRecords Buffer for the records.
+ * @param[in] ulMaxRecords Records \p pxRecords holds.
+ * @return Number of records copied, the latest ones if they do not all fit.
+ */
+uint32_t SampleTrace_Read( SampleTraceRecord_t * pxRecords,
+                           uint32_t ulMaxRecords );
+
+/**
+ * @brief Name of an event.
+ *
+ * @param[in] xEvent The event.
+ * @return Its name, or "unknown".
+ */
+const char * SampleTrace_EventName( SampleTraceEvent_t xEvent );
+
+#endif /* AZURE_SAMPLE_TRACE_H */
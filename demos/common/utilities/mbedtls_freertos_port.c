@@ -11,58 +11,466 @@
 
 /* FreeRTOS includes. */
 #include "FreeRTOS.h"
+#include "task.h"
 
 #include "sockets_wrapper.h"
 
+/* For transporttlsCONTEXT_POOL_SIZE. */
+#include "transport_tls_socket.h"
+
 /* mbed TLS includes. */
 #include "mbedtls_config.h"
 #include "threading_alt.h"
 #include "mbedtls/entropy.h"
+#include "mbedtls/ssl_internal.h"
+
+#ifdef MBEDTLS_MEMORY_BUFFER_ALLOC_C
+    #include "mbedtls/memory_buffer_alloc.h"
+#endif /* MBEDTLS_MEMORY_BUFFER_ALLOC_C */
+
+/*-----------------------------------------------------------*/
+
+#ifdef MBEDTLS_MEMORY_BUFFER_ALLOC_C
+
+    /**
+     * @brief RAM of each pooled TLS context, beyond its record buffers, for the
+     * certificates, keys and bignums of the handshake.
+     */
+    #ifndef mbedtlsportMEMORY_BUFFER_CONNECTION_OVERHEAD
+        #define mbedtlsportMEMORY_BUFFER_CONNECTION_OVERHEAD    ( 12 * 1024 )
+    #endif
+
+    /**
+     * @brief Size of the arena every mbedTLS allocation is served from, with
+     * MBEDTLS_MEMORY_BUFFER_ALLOC_C, as the boards without a heap use it.
+     *
+     * The arena is one static array, so the worst case of the connections shows
+     * in the link map. Defaults to the record buffers and handshake of each
+     * pooled TLS context; mbedtls_memory_buffer_alloc_status() reports the peak
+     * to size it with.
+     */
+    #ifndef mbedtlsportMEMORY_BUFFER_SIZE
+        #define mbedtlsportMEMORY_BUFFER_SIZE                                      \
+    ( transporttlsCONTEXT_POOL_SIZE * ( MBEDTLS_SSL_IN_BUFFER_LEN + MBEDTLS_SSL_OUT_BUFFER_LEN + \
+                                        mbedtlsportMEMORY_BUFFER_CONNECTION_OVERHEAD ) )
+    #endif
+
+    /* Word aligned storage of the arena. */
+    static uint32_t ulMemoryBufferArena[ ( mbedtlsportMEMORY_BUFFER_SIZE + 3 ) / 4 ];
 
+    /**
+     * @brief Give the arena to the allocator of mbedTLS. Called once, after the
+     * threading functions are set, as the allocator takes a mutex.
+     */
+    void mbedtls_platform_memory_init( void )
+    {
+        mbedtls_memory_buffer_alloc_init( ( unsigned char * ) ulMemoryBufferArena,
+                                          sizeof( ulMemoryBufferArena ) );
+    }
+#endif /* MBEDTLS_MEMORY_BUFFER_ALLOC_C */
 /*-----------------------------------------------------------*/
 
 /**
- * @brief Allocates memory for an array of members.
+ * @brief Number of mbedTLS record buffers served from a static arena.
  *
- * @param[in] nmemb Number of members that need to be allocated.
- * @param[in] size Size of each member.
- *
- * @return Pointer to the beginning of newly allocated memory.
+ * The record buffers are the largest allocations of the samples and live as
+ * long as a connection. Taken from the heap, each reconnect can leave them
+ * in a different place, and over days the free heap is cut into blocks too
+ * small for the next pair. Given their own region, the heap only serves the
+ * short-lived allocations and merges back when they are freed. Defaults to
+ * one incoming and one outgoing buffer per pooled TLS context; record
+ * buffers beyond the arena come from the heap. With
+ * MBEDTLS_MEMORY_BUFFER_ALLOC_C, mbedTLS does not call this port to allocate,
+ * and the record buffers are in its arena.
  */
-void * mbedtls_platform_calloc( size_t nmemb,
-                                size_t size )
-{
-    size_t totalSize = nmemb * size;
-    void * pBuffer = NULL;
+#ifndef mbedtlsportRECORD_BUFFER_COUNT
+    #ifdef MBEDTLS_MEMORY_BUFFER_ALLOC_C
+        #define mbedtlsportRECORD_BUFFER_COUNT    ( 0 )
+    #else
+        #define mbedtlsportRECORD_BUFFER_COUNT    ( 2 * transporttlsCONTEXT_POOL_SIZE )
+    #endif
+#endif
 
-    /* Check that neither nmemb nor size were 0. */
-    if( totalSize > 0 )
+#if ( mbedtlsportRECORD_BUFFER_COUNT > 0 )
+
+    /**
+     * @brief Size of a record buffer slot, large enough for either direction.
+     */
+    #define mbedtlsportRECORD_BUFFER_SIZE                             \
+    ( ( MBEDTLS_SSL_IN_BUFFER_LEN > MBEDTLS_SSL_OUT_BUFFER_LEN ) ? \
+      MBEDTLS_SSL_IN_BUFFER_LEN : MBEDTLS_SSL_OUT_BUFFER_LEN )
+
+    /* Word aligned storage for the record buffers. */
+    static uint32_t ulRecordBufferArena[ mbedtlsportRECORD_BUFFER_COUNT ][ ( mbedtlsportRECORD_BUFFER_SIZE + 3 ) / 4 ];
+    static BaseType_t xRecordBufferInUse[ mbedtlsportRECORD_BUFFER_COUNT ];
+
+    /**
+     * @brief Take a record buffer from the static arena.
+     *
+     * @param[in] totalSize Requested allocation size.
+     *
+     * @return Pointer to the buffer, or NULL if the request is not for a record
+     * buffer or the arena is exhausted.
+     */
+    static void * prvRecordBufferAlloc( size_t totalSize )
     {
-        /* Overflow check. */
-        if( ( totalSize / size ) == nmemb )
+        void * pBuffer = NULL;
+        uint32_t ulIndex;
+
+        /* mbedTLS allocates the record buffers with exactly these sizes. */
+        if( ( totalSize == MBEDTLS_SSL_IN_BUFFER_LEN ) ||
+            ( totalSize == MBEDTLS_SSL_OUT_BUFFER_LEN ) )
         {
-            pBuffer = pvPortMalloc( totalSize );
+            taskENTER_CRITICAL();
 
-            if( pBuffer != NULL )
+            for( ulIndex = 0; ulIndex < mbedtlsportRECORD_BUFFER_COUNT; ulIndex++ )
             {
-                ( void ) memset( pBuffer, 0x00, totalSize );
+                if( xRecordBufferInUse[ ulIndex ] == pdFALSE )
+                {
+                    xRecordBufferInUse[ ulIndex ] = pdTRUE;
+                    pBuffer = ulRecordBufferArena[ ulIndex ];
+                    break;
+                }
             }
+
+            taskEXIT_CRITICAL();
         }
+
+        return pBuffer;
     }
 
-    return pBuffer;
-}
+    /**
+     * @brief Return a buffer to the static arena.
+     *
+     * @param[in] ptr Buffer to release.
+     *
+     * @return pdTRUE if the buffer belonged to the arena, pdFALSE otherwise.
+     */
+    static BaseType_t prvRecordBufferFree( void * ptr )
+    {
+        uint8_t * pucArenaStart = ( uint8_t * ) ulRecordBufferArena;
+        uint8_t * pucArenaEnd = pucArenaStart + sizeof( ulRecordBufferArena );
+        uint32_t ulIndex;
+
+        if( ( ( uint8_t * ) ptr < pucArenaStart ) || ( ( uint8_t * ) ptr >= pucArenaEnd ) )
+        {
+            return pdFALSE;
+        }
+
+        ulIndex = ( uint32_t ) ( ( ( uint8_t * ) ptr - pucArenaStart ) / sizeof( ulRecordBufferArena[ 0 ] ) );
+
+        taskENTER_CRITICAL();
+        xRecordBufferInUse[ ulIndex ] = pdFALSE;
+        taskEXIT_CRITICAL();
+
+        return pdTRUE;
+    }
+#endif /* mbedtlsportRECORD_BUFFER_COUNT > 0 */
 /*-----------------------------------------------------------*/
 
 /**
- * @brief Frees the space previously allocated by calloc.
+ * @brief Enable the size-class slab allocator for small mbedTLS allocations.
  *
- * @param[in] ptr Pointer to the memory to be freed.
+ * The handshake makes hundreds of short-lived bignum and ECP allocations. With
+ * the slab enabled, allocations up to mbedtlsportSLAB_MAX_BLOCK_SIZE bytes are
+ * served from fixed-size blocks in static memory, and only fall back to the
+ * FreeRTOS heap when the matching class is exhausted.
  */
-void mbedtls_platform_free( void * ptr )
-{
-    vPortFree( ptr );
-}
+#ifndef mbedtlsportSLAB_ENABLED
+    #define mbedtlsportSLAB_ENABLED    0
+#endif
+
+#if defined( MBEDTLS_MEMORY_BUFFER_ALLOC_C ) && \
+    ( ( mbedtlsportRECORD_BUFFER_COUNT > 0 ) || ( mbedtlsportSLAB_ENABLED == 1 ) )
+    #error "The record buffers and slab serve mbedtls_platform_calloc(), unused with MBEDTLS_MEMORY_BUFFER_ALLOC_C."
+#endif
+
+#if ( mbedtlsportSLAB_ENABLED == 1 )
+
+    /* Number of blocks in each size class. Use mbedtls_platform_slab_get_stats()
+     * after a few connections to size these. */
+    #ifndef mbedtlsportSLAB_32_COUNT
+        #define mbedtlsportSLAB_32_COUNT     ( 48 )
+    #endif
+    #ifndef mbedtlsportSLAB_64_COUNT
+        #define mbedtlsportSLAB_64_COUNT     ( 32 )
+    #endif
+    #ifndef mbedtlsportSLAB_128_COUNT
+        #define mbedtlsportSLAB_128_COUNT    ( 16 )
+    #endif
+    #ifndef mbedtlsportSLAB_256_COUNT
+        #define mbedtlsportSLAB_256_COUNT    ( 16 )
+    #endif
+
+    #define mbedtlsportSLAB_CLASS_COUNT      ( 4 )
+    #define mbedtlsportSLAB_MAX_BLOCK_SIZE   ( 256 )
+
+    typedef struct SlabClass
+    {
+        size_t xBlockSize;       /* Size of each block in bytes. */
+        uint16_t usBlockCount;   /* Number of blocks in the class. */
+        uint16_t usFreeCount;    /* Number of entries in pusFreeList. */
+        uint16_t usMinFreeCount; /* Lowest usFreeCount seen. */
+        uint16_t * pusFreeList;  /* Stack of free block indexes. */
+        uint8_t * pucStorage;    /* Block storage. */
+    } SlabClass_t;
+
+    static uint32_t ulSlab32[ mbedtlsportSLAB_32_COUNT ][ 32 / 4 ];
+    static uint32_t ulSlab64[ mbedtlsportSLAB_64_COUNT ][ 64 / 4 ];
+    static uint32_t ulSlab128[ mbedtlsportSLAB_128_COUNT ][ 128 / 4 ];
+    static uint32_t ulSlab256[ mbedtlsportSLAB_256_COUNT ][ 256 / 4 ];
+    static uint16_t usSlab32FreeList[ mbedtlsportSLAB_32_COUNT ];
+    static uint16_t usSlab64FreeList[ mbedtlsportSLAB_64_COUNT ];
+    static uint16_t usSlab128FreeList[ mbedtlsportSLAB_128_COUNT ];
+    static uint16_t usSlab256FreeList[ mbedtlsportSLAB_256_COUNT ];
+
+    static SlabClass_t xSlabClasses[ mbedtlsportSLAB_CLASS_COUNT ] =
+    {
+        { 32,  mbedtlsportSLAB_32_COUNT,  0, 0, usSlab32FreeList,  ( uint8_t * ) ulSlab32  },
+        { 64,  mbedtlsportSLAB_64_COUNT,  0, 0, usSlab64FreeList,  ( uint8_t * ) ulSlab64  },
+        { 128, mbedtlsportSLAB_128_COUNT, 0, 0, usSlab128FreeList, ( uint8_t * ) ulSlab128 },
+        { 256, mbedtlsportSLAB_256_COUNT, 0, 0, usSlab256FreeList, ( uint8_t * ) ulSlab256 }
+    };
+
+    static BaseType_t xSlabInitialized = pdFALSE;
+    static size_t xSlabBytesInUse = 0;
+    static size_t xSlabPeakBytesInUse = 0;
+    static uint32_t ulSlabHeapFallbacks = 0;
+
+    /**
+     * @brief Fill the free lists. Must be called inside a critical section.
+     */
+    static void prvSlabInit( void )
+    {
+        uint32_t ulClass;
+        uint16_t usIndex;
+
+        for( ulClass = 0; ulClass < mbedtlsportSLAB_CLASS_COUNT; ulClass++ )
+        {
+            for( usIndex = 0; usIndex < xSlabClasses[ ulClass ].usBlockCount; usIndex++ )
+            {
+                xSlabClasses[ ulClass ].pusFreeList[ usIndex ] = usIndex;
+            }
+
+            xSlabClasses[ ulClass ].usFreeCount = xSlabClasses[ ulClass ].usBlockCount;
+            xSlabClasses[ ulClass ].usMinFreeCount = xSlabClasses[ ulClass ].usBlockCount;
+        }
+
+        xSlabInitialized = pdTRUE;
+    }
+
+    /**
+     * @brief Take a block from the smallest class that fits the request.
+     *
+     * @param[in] totalSize Requested allocation size.
+     *
+     * @return Pointer to the block, or NULL if the request is too large or the class is exhausted.
+     */
+    static void * prvSlabAlloc( size_t totalSize )
+    {
+        void * pBuffer = NULL;
+        SlabClass_t * pxClass;
+        uint32_t ulClass;
+
+        if( totalSize > mbedtlsportSLAB_MAX_BLOCK_SIZE )
+        {
+            return NULL;
+        }
+
+        taskENTER_CRITICAL();
+
+        if( xSlabInitialized == pdFALSE )
+        {
+            prvSlabInit();
+        }
+
+        for( ulClass = 0; ulClass < mbedtlsportSLAB_CLASS_COUNT; ulClass++ )
+        {
+            pxClass = &( xSlabClasses[ ulClass ] );
+
+            if( totalSize <= pxClass->xBlockSize )
+            {
+                if( pxClass->usFreeCount > 0 )
+                {
+                    pxClass->usFreeCount--;
+                    pBuffer = pxClass->pucStorage +
+                              ( pxClass->pusFreeList[ pxClass->usFreeCount ] * pxClass->xBlockSize );
+
+                    if( pxClass->usFreeCount < pxClass->usMinFreeCount )
+                    {
+                        pxClass->usMinFreeCount = pxClass->usFreeCount;
+                    }
+
+                    xSlabBytesInUse += pxClass->xBlockSize;
+
+                    if( xSlabBytesInUse > xSlabPeakBytesInUse )
+                    {
+                        xSlabPeakBytesInUse = xSlabBytesInUse;
+                    }
+                }
+                else
+                {
+                    ulSlabHeapFallbacks++;
+                }
+
+                break;
+            }
+        }
+
+        taskEXIT_CRITICAL();
+
+        return pBuffer;
+    }
+
+    /**
+     * @brief Return a block to its class.
+     *
+     * @param[in] ptr Block to release.
+     *
+     * @return pdTRUE if the block belonged to the slab, pdFALSE otherwise.
+     */
+    static BaseType_t prvSlabFree( void * ptr )
+    {
+        BaseType_t xFound = pdFALSE;
+        SlabClass_t * pxClass;
+        uint32_t ulClass;
+        uint8_t * pucBlock = ( uint8_t * ) ptr;
+
+        for( ulClass = 0; ulClass < mbedtlsportSLAB_CLASS_COUNT; ulClass++ )
+        {
+            pxClass = &( xSlabClasses[ ulClass ] );
+
+            if( ( pucBlock >= pxClass->pucStorage ) &&
+                ( pucBlock < pxClass->pucStorage + ( pxClass->xBlockSize * pxClass->usBlockCount ) ) )
+            {
+                taskENTER_CRITICAL();
+                pxClass->pusFreeList[ pxClass->usFreeCount ] =
+                    ( uint16_t ) ( ( size_t ) ( pucBlock - pxClass->pucStorage ) / pxClass->xBlockSize );
+                pxClass->usFreeCount++;
+                xSlabBytesInUse -= pxClass->xBlockSize;
+                taskEXIT_CRITICAL();
+
+                xFound = pdTRUE;
+                break;
+            }
+        }
+
+        return xFound;
+    }
+
+    /**
+     * @brief Report slab usage, to size the slab classes.
+     *
+     * @param[out] pxPeakBytesInUse Highest number of slab bytes in use at once.
+     * @param[out] pusMinFreeBlocks Array of mbedtlsportSLAB_CLASS_COUNT entries receiving the
+     * lowest number of free blocks seen for each class, from smallest to largest. Can be NULL.
+     * @param[out] pulHeapFallbacks Number of allocations that went to the heap because their class was exhausted.
+     */
+    void mbedtls_platform_slab_get_stats( size_t * pxPeakBytesInUse,
+                                          uint16_t * pusMinFreeBlocks,
+                                          uint32_t * pulHeapFallbacks )
+    {
+        uint32_t ulClass;
+
+        taskENTER_CRITICAL();
+
+        if( pxPeakBytesInUse != NULL )
+        {
+            *pxPeakBytesInUse = xSlabPeakBytesInUse;
+        }
+
+        if( pusMinFreeBlocks != NULL )
+        {
+            for( ulClass = 0; ulClass < mbedtlsportSLAB_CLASS_COUNT; ulClass++ )
+            {
+                pusMinFreeBlocks[ ulClass ] = ( xSlabInitialized == pdTRUE ) ?
+                                              xSlabClasses[ ulClass ].usMinFreeCount :
+                                              xSlabClasses[ ulClass ].usBlockCount;
+            }
+        }
+
+        if( pulHeapFallbacks != NULL )
+        {
+            *pulHeapFallbacks = ulSlabHeapFallbacks;
+        }
+
+        taskEXIT_CRITICAL();
+    }
+#endif /* mbedtlsportSLAB_ENABLED == 1 */
+/*-----------------------------------------------------------*/
+
+#ifndef MBEDTLS_MEMORY_BUFFER_ALLOC_C
+
+    /**
+     * @brief Allocates memory for an array of members.
+     *
+     * @param[in] nmemb Number of members that need to be allocated.
+     * @param[in] size Size of each member.
+     *
+     * @return Pointer to the beginning of newly allocated memory.
+     */
+    void * mbedtls_platform_calloc( size_t nmemb,
+                                    size_t size )
+    {
+        size_t totalSize = nmemb * size;
+        void * pBuffer = NULL;
+
+        /* Check that neither nmemb nor size were 0. */
+        if( totalSize > 0 )
+        {
+            /* Overflow check. */
+            if( ( totalSize / size ) == nmemb )
+            {
+                #if ( mbedtlsportRECORD_BUFFER_COUNT > 0 )
+                    pBuffer = prvRecordBufferAlloc( totalSize );
+                #endif /* mbedtlsportRECORD_BUFFER_COUNT > 0 */
+
+                #if ( mbedtlsportSLAB_ENABLED == 1 )
+                    if( pBuffer == NULL )
+                    {
+                        pBuffer = prvSlabAlloc( totalSize );
+                    }
+                #endif /* mbedtlsportSLAB_ENABLED == 1 */
+
+                if( pBuffer == NULL )
+                {
+                    pBuffer = pvPortMalloc( totalSize );
+                }
+
+                if( pBuffer != NULL )
+                {
+                    ( void ) memset( pBuffer, 0x00, totalSize );
+                }
+            }
+        }
+
+        return pBuffer;
+    }
+
+    /**
+     * @brief Frees the space previously allocated by calloc.
+     *
+     * @param[in] ptr Pointer to the memory to be freed.
+     */
+    void mbedtls_platform_free( void * ptr )
+    {
+        #if ( mbedtlsportRECORD_BUFFER_COUNT > 0 )
+            if( prvRecordBufferFree( ptr ) == pdTRUE )
+            {
+                return;
+            }
+        #endif /* mbedtlsportRECORD_BUFFER_COUNT > 0 */
+
+        #if ( mbedtlsportSLAB_ENABLED == 1 )
+            if( prvSlabFree( ptr ) == pdTRUE )
+            {
+                return;
+            }
+        #endif /* mbedtlsportSLAB_ENABLED == 1 */
+
+        vPortFree( ptr );
+    }
+#endif /* MBEDTLS_MEMORY_BUFFER_ALLOC_C */
 /*-----------------------------------------------------------*/
 
 /**
@@ -3,12 +3,236 @@
 
 #include "azure_sample_crypto.h"
 
+#include <string.h>
+
+/* FreeRTOS includes. */
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
 /* mbed TLS includes. */
 #include "mbedtls/md.h"
+#include "mbedtls/rsa.h"
 #include "mbedtls/threading.h"
 
 /*-----------------------------------------------------------*/
 
+/* HMAC context of the last key, kept so that signing again with the same
+ * key, as every SAS token renewal does, skips the key setup. With
+ * CONFIG_MBEDTLS_HARDWARE_SHA, the SHA-256 under it runs on the SHA
+ * accelerator. */
+static mbedtls_md_context_t xHMACContext;
+static uint8_t ucHMACKey[ cryptoHMAC_CACHED_KEY_SIZE ];
+static uint32_t ulHMACKeyLength = 0;
+static BaseType_t xHMACKeyValid = pdFALSE;
+static SemaphoreHandle_t xHMACMutex = NULL;
+static StaticSemaphore_t xHMACMutexBuffer;
+static BaseType_t xHMACCacheInitialized = pdFALSE;
+static portMUX_TYPE xHMACInitLock = portMUX_INITIALIZER_UNLOCKED;
+
+/* Imported RSA public keys, kept so that verifying again with the same key,
+ * as every ADU manifest does with its root key, skips the import. mbed TLS
+ * works out the Montgomery constant of the modulus, RN, on the first public
+ * operation and keeps it in the context for the next ones. With
+ * CONFIG_MBEDTLS_HARDWARE_MPI, the modular exponentiation runs on the RSA
+ * accelerator, and with CONFIG_MBEDTLS_HARDWARE_SHA, Crypto_SHA256() on the
+ * SHA accelerator. */
+typedef struct CryptoRSAKey
+{
+    mbedtls_rsa_context xContext;
+    uint8_t ucN[ cryptoRSA_CACHED_KEY_SIZE ];
+    uint32_t ulNLength;
+    uint8_t ucE[ cryptoRSA_CACHED_EXPONENT_SIZE ];
+    uint32_t ulELength;
+    uint32_t ulLastUse;
+    BaseType_t xValid;
+} CryptoRSAKey_t;
+
+static CryptoRSAKey_t xRSAKeys[ cryptoRSA_CACHED_KEY_COUNT ];
+static uint32_t ulRSAUseCount = 0;
+static SemaphoreHandle_t xRSAMutex = NULL;
+static StaticSemaphore_t xRSAMutexBuffer;
+static BaseType_t xRSACacheInitialized = pdFALSE;
+static portMUX_TYPE xRSAInitLock = portMUX_INITIALIZER_UNLOCKED;
+
+/*-----------------------------------------------------------*/
+
+/* Nothing calls Crypto_Init() on this port, so the first HMAC sets up the cache. */
+static void prvHMACCacheInit( void )
+{
+    BaseType_t xFirst;
+
+    portENTER_CRITICAL( &xHMACInitLock );
+    xFirst = ( xHMACCacheInitialized == pdFALSE ) ? pdTRUE : pdFALSE;
+    xHMACCacheInitialized = pdTRUE;
+    portEXIT_CRITICAL( &xHMACInitLock );
+
+    if( xFirst != pdTRUE )
+    {
+        return;
+    }
+
+    mbedtls_md_init( &xHMACContext );
+
+    /* Without a context, every HMAC is computed from scratch. */
+    if( mbedtls_md_setup( &xHMACContext, mbedtls_md_info_from_type( MBEDTLS_MD_SHA256 ), 1 ) == 0 )
+    {
+        xHMACMutex = xSemaphoreCreateMutexStatic( &xHMACMutexBuffer );
+    }
+}
+/*-----------------------------------------------------------*/
+
+static uint32_t prvHMACUncached( const uint8_t * pucKey, uint32_t ulKeyLength,
+                                 const uint8_t * pucData, uint32_t ulDataLength,
+                                 uint8_t * pucOutput )
+{
+    uint32_t ulRet;
+    mbedtls_md_context_t xCtx;
+    mbedtls_md_type_t xMDType = MBEDTLS_MD_SHA256;
+
+    mbedtls_md_init( &xCtx );
+
+    if( mbedtls_md_setup( &xCtx, mbedtls_md_info_from_type( xMDType ), 1 ) ||
+        mbedtls_md_hmac_starts( &xCtx, pucKey, ulKeyLength ) ||
+        mbedtls_md_hmac_update( &xCtx, pucData, ulDataLength ) ||
+        mbedtls_md_hmac_finish( &xCtx, pucOutput ) )
+    {
+        ulRet = 1;
+    }
+    else
+    {
+        ulRet = 0;
+    }
+
+    mbedtls_md_free( &xCtx );
+
+    return ulRet;
+}
+/*-----------------------------------------------------------*/
+
+/* As for the HMAC, the first verify sets up the kept keys. */
+static void prvRSACacheInit( void )
+{
+    BaseType_t xFirst;
+
+    portENTER_CRITICAL( &xRSAInitLock );
+    xFirst = ( xRSACacheInitialized == pdFALSE ) ? pdTRUE : pdFALSE;
+    xRSACacheInitialized = pdTRUE;
+    portEXIT_CRITICAL( &xRSAInitLock );
+
+    if( xFirst == pdTRUE )
+    {
+        xRSAMutex = xSemaphoreCreateMutexStatic( &xRSAMutexBuffer );
+    }
+}
+/*-----------------------------------------------------------*/
+
+static int prvRSAImport( mbedtls_rsa_context * pxContext,
+                         const uint8_t * pucN,
+                         uint32_t ulNLength,
+                         const uint8_t * pucE,
+                         uint32_t ulELength )
+{
+    mbedtls_rsa_init( pxContext, MBEDTLS_RSA_PKCS_V15, 0 );
+
+    return ( mbedtls_rsa_import_raw( pxContext, pucN, ulNLength, NULL, 0, NULL, 0, NULL, 0, pucE, ulELength ) ||
+             mbedtls_rsa_complete( pxContext ) );
+}
+/*-----------------------------------------------------------*/
+
+static uint32_t prvRSAVerify( mbedtls_rsa_context * pxContext,
+                              const uint8_t * pucHash,
+                              uint32_t ulHashLength,
+                              const uint8_t * pucSignature,
+                              uint32_t ulSignatureLength )
+{
+    if( ( mbedtls_rsa_get_len( pxContext ) != ulSignatureLength ) ||
+        mbedtls_rsa_pkcs1_verify( pxContext, NULL, NULL, MBEDTLS_RSA_PUBLIC, MBEDTLS_MD_SHA256,
+                                  ulHashLength, pucHash, pucSignature ) )
+    {
+        return 1;
+    }
+
+    return 0;
+}
+/*-----------------------------------------------------------*/
+
+/* The key of pucN and pucE, imported into the slot least recently used if it
+ * is not kept already. Called with xRSAMutex taken. */
+static CryptoRSAKey_t * prvRSAKeyGet( const uint8_t * pucN,
+                                      uint32_t ulNLength,
+                                      const uint8_t * pucE,
+                                      uint32_t ulELength )
+{
+    CryptoRSAKey_t * pxKey = &xRSAKeys[ 0 ];
+    uint32_t ulIndex;
+
+    for( ulIndex = 0; ulIndex < cryptoRSA_CACHED_KEY_COUNT; ulIndex++ )
+    {
+        if( ( xRSAKeys[ ulIndex ].xValid == pdTRUE ) &&
+            ( xRSAKeys[ ulIndex ].ulNLength == ulNLength ) &&
+            ( xRSAKeys[ ulIndex ].ulELength == ulELength ) &&
+            ( memcmp( xRSAKeys[ ulIndex ].ucN, pucN, ulNLength ) == 0 ) &&
+            ( memcmp( xRSAKeys[ ulIndex ].ucE, pucE, ulELength ) == 0 ) )
+        {
+            return &xRSAKeys[ ulIndex ];
+        }
+
+        if( ( xRSAKeys[ ulIndex ].xValid != pdTRUE ) ||
+            ( ( pxKey->xValid == pdTRUE ) && ( xRSAKeys[ ulIndex ].ulLastUse < pxKey->ulLastUse ) ) )
+        {
+            pxKey = &xRSAKeys[ ulIndex ];
+        }
+    }
+
+    if( pxKey->xValid == pdTRUE )
+    {
+        mbedtls_rsa_free( &pxKey->xContext );
+        pxKey->xValid = pdFALSE;
+    }
+
+    if( prvRSAImport( &pxKey->xContext, pucN, ulNLength, pucE, ulELength ) )
+    {
+        mbedtls_rsa_free( &pxKey->xContext );
+        return NULL;
+    }
+
+    memcpy( pxKey->ucN, pucN, ulNLength );
+    pxKey->ulNLength = ulNLength;
+    memcpy( pxKey->ucE, pucE, ulELength );
+    pxKey->ulELength = ulELength;
+    pxKey->xValid = pdTRUE;
+
+    return pxKey;
+}
+/*-----------------------------------------------------------*/
+
+static uint32_t prvRSAVerifyUncached( const uint8_t * pucN,
+                                      uint32_t ulNLength,
+                                      const uint8_t * pucE,
+                                      uint32_t ulELength,
+                                      const uint8_t * pucHash,
+                                      uint32_t ulHashLength,
+                                      const uint8_t * pucSignature,
+                                      uint32_t ulSignatureLength )
+{
+    uint32_t ulRet;
+    mbedtls_rsa_context xContext;
+
+    if( prvRSAImport( &xContext, pucN, ulNLength, pucE, ulELength ) )
+    {
+        ulRet = 1;
+    }
+    else
+    {
+        ulRet = prvRSAVerify( &xContext, pucHash, ulHashLength, pucSignature, ulSignatureLength );
+    }
+
+    mbedtls_rsa_free( &xContext );
+
+    return ulRet;
+}
+/*-----------------------------------------------------------*/
+
 uint32_t Crypto_Init()
 {
     return 0;
@@ -21,30 +245,121 @@ uint32_t Crypto_HMAC( const uint8_t * pucKey, uint32_t ulKeyLength,
                       uint32_t * pulBytesCopied )
 {
     uint32_t ulRet;
-    mbedtls_md_context_t xCtx;
-    mbedtls_md_type_t xMDType = MBEDTLS_MD_SHA256;
 
     if( ulOutputLength < 32 )
     {
         return 1;
     }
 
-    mbedtls_md_init( &xCtx );
+    prvHMACCacheInit();
 
-    if( mbedtls_md_setup( &xCtx, mbedtls_md_info_from_type( xMDType ), 1 ) ||
-        mbedtls_md_hmac_starts( &xCtx, pucKey, ulKeyLength ) ||
-        mbedtls_md_hmac_update( &xCtx, pucData, ulDataLength ) ||
-        mbedtls_md_hmac_finish( &xCtx, pucOutput ) )
+    /* Keys too long to remember, and callers that find another task signing,
+     * do not wait for the cached context. */
+    if( ( ulKeyLength > sizeof( ucHMACKey ) ) || ( xHMACMutex == NULL ) ||
+        ( xSemaphoreTake( xHMACMutex, 0 ) != pdTRUE ) )
     {
-        ulRet = 1;
+        ulRet = prvHMACUncached( pucKey, ulKeyLength, pucData, ulDataLength, pucOutput );
     }
     else
     {
-        ulRet = 0;
+        if( ( xHMACKeyValid == pdTRUE ) && ( ulHMACKeyLength == ulKeyLength ) &&
+            ( memcmp( ucHMACKey, pucKey, ulKeyLength ) == 0 ) )
+        {
+            ulRet = mbedtls_md_hmac_reset( &xHMACContext ) ? 1 : 0;
+        }
+        else
+        {
+            xHMACKeyValid = pdFALSE;
+            ulRet = mbedtls_md_hmac_starts( &xHMACContext, pucKey, ulKeyLength ) ? 1 : 0;
+
+            if( ulRet == 0 )
+            {
+                memcpy( ucHMACKey, pucKey, ulKeyLength );
+                ulHMACKeyLength = ulKeyLength;
+                xHMACKeyValid = pdTRUE;
+            }
+        }
+
+        if( ( ulRet == 0 ) &&
+            ( mbedtls_md_hmac_update( &xHMACContext, pucData, ulDataLength ) ||
+              mbedtls_md_hmac_finish( &xHMACContext, pucOutput ) ) )
+        {
+            ulRet = 1;
+        }
+
+        /* A context left part way through is set up again by the next call. */
+        if( ulRet != 0 )
+        {
+            xHMACKeyValid = pdFALSE;
+        }
+
+        ( void ) xSemaphoreGive( xHMACMutex );
+    }
+
+    if( ulRet == 0 )
+    {
         *pulBytesCopied = 32;
     }
 
-    mbedtls_md_free( &xCtx );
+    return ulRet;
+}
+/*-----------------------------------------------------------*/
+
+uint32_t Crypto_SHA256( const uint8_t * pucData,
+                        uint32_t ulDataLength,
+                        uint8_t * pucOutput,
+                        uint32_t ulOutputLength )
+{
+    if( ulOutputLength < 32 )
+    {
+        return 1;
+    }
+
+    return mbedtls_md( mbedtls_md_info_from_type( MBEDTLS_MD_SHA256 ), pucData, ulDataLength, pucOutput ) ? 1 : 0;
+}
+/*-----------------------------------------------------------*/
+
+uint32_t Crypto_RSAVerify( const uint8_t * pucN,
+                           uint32_t ulNLength,
+                           const uint8_t * pucE,
+                           uint32_t ulELength,
+                           const uint8_t * pucHash,
+                           uint32_t ulHashLength,
+                           const uint8_t * pucSignature,
+                           uint32_t ulSignatureLength )
+{
+    uint32_t ulRet;
+    CryptoRSAKey_t * pxKey;
+
+    if( ( pucN == NULL ) || ( pucE == NULL ) || ( pucHash == NULL ) || ( pucSignature == NULL ) )
+    {
+        return 1;
+    }
+
+    prvRSACacheInit();
+
+    /* Keys too long to remember, and callers that find another task
+     * verifying, do not wait for the kept contexts. */
+    if( ( ulNLength > cryptoRSA_CACHED_KEY_SIZE ) || ( ulELength > cryptoRSA_CACHED_EXPONENT_SIZE ) ||
+        ( xRSAMutex == NULL ) || ( xSemaphoreTake( xRSAMutex, 0 ) != pdTRUE ) )
+    {
+        return prvRSAVerifyUncached( pucN, ulNLength, pucE, ulELength,
+                                     pucHash, ulHashLength, pucSignature, ulSignatureLength );
+    }
+
+    pxKey = prvRSAKeyGet( pucN, ulNLength, pucE, ulELength );
+
+    if( pxKey == NULL )
+    {
+        ulRet = 1;
+    }
+    else
+    {
+        pxKey->ulLastUse = ++ulRSAUseCount;
+        ulRet = prvRSAVerify( &pxKey->xContext, pucHash, ulHashLength, pucSignature, ulSignatureLength );
+    }
+
+    ( void ) xSemaphoreGive( xRSAMutex );
 
     return ulRet;
 }
@@ -26,6 +26,7 @@
 
 /* Standard includes. */
 #include <errno.h>
+#include <stdint.h>
 
 /* FreeRTOS includes. */
 #include "freertos/FreeRTOS.h"
@@ -38,14 +39,18 @@
 /* Socket includes. */
 #include "esp_transport.h"
 #include "esp_transport_tcp.h"
+#include "lwip/sockets.h"
 
-// We will malloc this and put it in SocketTransportParams_t.xSocketContext
+/* Allocated by the first connect and kept in SocketTransportParams_t.xSocketContext
+ * from then on, so that the reconnects of the image download reuse the transport
+ * and its list instead of building them again. */
 typedef struct EspSocketTransportParams
 {
     esp_transport_handle_t xTransport;
     esp_transport_list_handle_t xTransportList;
     uint32_t ulReceiveTimeoutMs;
     uint32_t ulSendTimeoutMs;
+    BaseType_t xConnected;
 } EspSocketTransportParams_t;
 
 /* Each transport defines the same NetworkContext. The user then passes their respective transport */
@@ -60,6 +65,74 @@ struct NetworkContext
 static const char *TAG = "esp_sockets";
 /*-----------------------------------------------------------*/
 
+static EspSocketTransportParams_t * prvCreateTransport( void )
+{
+    EspSocketTransportParams_t * pxEspSocketTransport = (EspSocketTransportParams_t*) pvPortMalloc(sizeof(EspSocketTransportParams_t));
+
+    if(pxEspSocketTransport == NULL)
+    {
+        return NULL;
+    }
+
+    pxEspSocketTransport->xTransport = esp_transport_tcp_init( );
+    pxEspSocketTransport->xTransportList = esp_transport_list_init();
+    pxEspSocketTransport->xConnected = pdFALSE;
+
+    if( ( pxEspSocketTransport->xTransport == NULL ) ||
+        ( pxEspSocketTransport->xTransportList == NULL ) )
+    {
+        if( pxEspSocketTransport->xTransportList != NULL )
+        {
+            esp_transport_list_destroy(pxEspSocketTransport->xTransportList);
+        }
+        else if( pxEspSocketTransport->xTransport != NULL )
+        {
+            esp_transport_destroy(pxEspSocketTransport->xTransport);
+        }
+
+        vPortFree(pxEspSocketTransport);
+        return NULL;
+    }
+
+    /* The list owns the transport, and destroys it with itself. */
+    esp_transport_list_add(pxEspSocketTransport->xTransportList, pxEspSocketTransport->xTransport, "_tcp");
+
+    return pxEspSocketTransport;
+}
+/*-----------------------------------------------------------*/
+
+/* Expose the socket of a new connection in xTCPSocket, and tune it for the
+ * range requests of the image download: each is a short request waiting for a
+ * long response, so Nagle only delays the request, and the receive buffer is
+ * sized by ulReceiveBufferSize. */
+static void prvTuneSocket( SocketTransportParams_t * pxSocketTransport,
+                           EspSocketTransportParams_t * pxEspSocketTransport )
+{
+    int lSocket = esp_transport_get_socket( pxEspSocketTransport->xTransport );
+    int lNoDelay = 1;
+    int lReceiveBufferSize = ( int ) pxSocketTransport->ulReceiveBufferSize;
+
+    if( lSocket < 0 )
+    {
+        return;
+    }
+
+    pxSocketTransport->xTCPSocket = ( SocketHandle ) ( intptr_t ) lSocket;
+
+    if( setsockopt( lSocket, IPPROTO_TCP, TCP_NODELAY, &lNoDelay, sizeof( lNoDelay ) ) != 0 )
+    {
+        ESP_LOGW( TAG, "Failed to set TCP_NODELAY, errno= %d", errno );
+    }
+
+    /* Needs CONFIG_LWIP_SO_RCVBUF, the default buffer is kept otherwise. */
+    if( ( lReceiveBufferSize > 0 ) &&
+        ( setsockopt( lSocket, SOL_SOCKET, SO_RCVBUF, &lReceiveBufferSize, sizeof( lReceiveBufferSize ) ) != 0 ) )
+    {
+        ESP_LOGW( TAG, "Failed to set SO_RCVBUF, errno= %d", errno );
+    }
+}
+/*-----------------------------------------------------------*/
+
 SocketTransportStatus_t Azure_Socket_Connect( NetworkContext_t * pNetworkContext,
                                          const char * pHostName,
                                          uint16_t usPort,
@@ -86,43 +159,44 @@ SocketTransportStatus_t Azure_Socket_Connect( NetworkContext_t * pNetworkContext
         return eSocketTransportInvalidParameter;
     }
 
-    EspSocketTransportParams_t * pxEspSocketTransport = (EspSocketTransportParams_t*) pvPortMalloc(sizeof(EspSocketTransportParams_t));
-    if(pxEspSocketTransport == NULL)
+    EspSocketTransportParams_t * pxEspSocketTransport = (EspSocketTransportParams_t*)pxSocketTransport->xSocketContext;
+
+    if( pxEspSocketTransport == NULL )
     {
-      return eSocketTransportInsufficientMemory;
+        pxEspSocketTransport = prvCreateTransport();
+
+        if( pxEspSocketTransport == NULL )
+        {
+            return eSocketTransportInsufficientMemory;
+        }
+
+        pxSocketTransport->xSocketContext = (void*)pxEspSocketTransport;
+    }
+    else if( pxEspSocketTransport->xConnected )
+    {
+        /* A connect replaces the connection, keeping the transport. */
+        esp_transport_close( pxEspSocketTransport->xTransport );
+        pxEspSocketTransport->xConnected = pdFALSE;
     }
 
-    pxEspSocketTransport->xTransport = esp_transport_tcp_init( );
-    pxEspSocketTransport->xTransportList = esp_transport_list_init();
     pxEspSocketTransport->ulReceiveTimeoutMs = ulReceiveTimeoutMs;
     pxEspSocketTransport->ulSendTimeoutMs = ulSendTimeoutMs;
-
-    esp_transport_list_add(pxEspSocketTransport->xTransportList, pxEspSocketTransport->xTransport, "_tcp");
-
-    pxSocketTransport->xSocketContext = (void*)pxEspSocketTransport;
+    pxSocketTransport->xTCPSocket = SOCKETS_INVALID_SOCKET;
 
     if ( esp_transport_connect( pxEspSocketTransport->xTransport, pHostName, usPort, ulReceiveTimeoutMs ) < 0 )
     {
         ESP_LOGE( TAG, "Failed establishing socket connection (esp_transport_connect failed)" );
         xReturnStatus = eSocketTransportConnectFailure;
+
+        /* The transport is kept for the next attempt. */
+        esp_transport_close( pxEspSocketTransport->xTransport );
     }
     else
     {
         xReturnStatus = eSocketTransportSuccess;
-    }
+        pxEspSocketTransport->xConnected = pdTRUE;
+        prvTuneSocket( pxSocketTransport, pxEspSocketTransport );
 
-    /* Clean up on failure. */
-    if( xReturnStatus != eSocketTransportSuccess )
-    {
-        if( pNetworkContext != NULL )
-        {
-            esp_transport_close( pxEspSocketTransport->xTransport );
-            esp_transport_list_destroy(pxEspSocketTransport->xTransportList);
-            vPortFree(pxEspSocketTransport);
-        }
-    }
-    else
-    {
         ESP_LOGI( TAG, "(Network connection %p) Connection to %s established.",
                    pNetworkContext,
                    pHostName );
@@ -150,12 +224,16 @@ void Azure_Socket_Close( NetworkContext_t * pNetworkContext )
 
     EspSocketTransportParams_t * pxEspSocketTransport = (EspSocketTransportParams_t*)pxSocketTransport->xSocketContext;
 
-    /* Attempting to terminate socket connection. */
-    esp_transport_close( pxEspSocketTransport->xTransport );
+    if( ( pxEspSocketTransport == NULL ) || !pxEspSocketTransport->xConnected )
+    {
+        return;
+    }
 
-    /* Destroy list of transports */
-    esp_transport_list_destroy(pxEspSocketTransport->xTransportList);
-    vPortFree( pxEspSocketTransport );
+    /* Attempting to terminate socket connection. The transport and its list are
+     * kept for the next connect. */
+    esp_transport_close( pxEspSocketTransport->xTransport );
+    pxEspSocketTransport->xConnected = pdFALSE;
+    pxSocketTransport->xTCPSocket = SOCKETS_INVALID_SOCKET;
 }
 /*-----------------------------------------------------------*/
 
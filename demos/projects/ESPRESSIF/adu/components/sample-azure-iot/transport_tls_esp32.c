@@ -36,6 +36,9 @@
 
 #include "esp_log.h"
 
+/* The peak clock during the handshake. */
+#include "azure_sample_perf_governor.h"
+
 /* TLS includes. */
 #include "esp_transport_ssl.h"
 
@@ -69,6 +72,7 @@ TlsTransportStatus_t TLS_Socket_Connect( NetworkContext_t * pNetworkContext,
                                          uint32_t ulSendTimeoutMs )
 {
     TlsTransportStatus_t xReturnStatus = eTLSTransportSuccess;
+    int lConnected;
 
     if( ( pNetworkContext == NULL ) ||
         ( pHostName == NULL ) ||
@@ -134,7 +138,11 @@ TlsTransportStatus_t TLS_Socket_Connect( NetworkContext_t * pNetworkContext,
         esp_transport_ssl_set_client_key_data_der( pxEspTlsTransport->xTransport, (const char *) pNetworkCredentials->pucPrivateKey, pNetworkCredentials->xPrivateKeySize );
     }
 
-    if ( esp_transport_connect( pxEspTlsTransport->xTransport, pHostName, usPort, ulReceiveTimeoutMs ) < 0 )
+    perfgovernorBOOST();
+    lConnected = esp_transport_connect( pxEspTlsTransport->xTransport, pHostName, usPort, ulReceiveTimeoutMs );
+    perfgovernorRELEASE();
+
+    if ( lConnected < 0 )
     {
         ESP_LOGE( TAG, "Failed establishing TLS connection (esp_transport_connect failed)" );
         xReturnStatus = eTLSTransportConnectFailure;
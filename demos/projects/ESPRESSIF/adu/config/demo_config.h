@@ -209,9 +209,35 @@
 #define democonfigDEMO_STACKSIZE         CONFIG_AZURE_TASK_STACKSIZE
 
 /**
- * @brief Size of the network buffer for MQTT packets.
+ * @brief Set the core the demo task is pinned to.
+ *
+ */
+#ifdef CONFIG_AZURE_TASK_PIN_TO_CORE
+    #define democonfigPIN_TASKS_TO_CORE
+    #define democonfigDEMO_TASK_CORE    CONFIG_AZURE_TASK_CORE
+    #define democonfigADU_TASK_CORE     CONFIG_AZURE_ADU_TASK_CORE
+#endif /* CONFIG_AZURE_TASK_PIN_TO_CORE */
+
+/**
+ * @brief Size of the part of the hub client buffer the MQTT packets are
+ * received in, which must hold the largest one the hub sends, such as a
+ * property document or an ADU manifest.
+ */
+#define democonfigNETWORK_RX_BUFFER_SIZE    CONFIG_NETWORK_BUFFER_SIZE
+
+/**
+ * @brief Size of the part of the hub client buffer the middleware writes the
+ * topic, user name and password of the packets it sends in. The payloads are
+ * sent from the buffers of the samples, so this does not grow with them.
+ */
+#define democonfigNETWORK_TX_BUFFER_SIZE    ( azureiotconfigUSERNAME_MAX + azureiotconfigPASSWORD_MAX )
+
+/**
+ * @brief Size of the buffer given to the hub and provisioning clients, which
+ * use its first democonfigNETWORK_TX_BUFFER_SIZE bytes for what they send and
+ * receive in the rest.
  */
-#define democonfigNETWORK_BUFFER_SIZE    CONFIG_NETWORK_BUFFER_SIZE
+#define democonfigNETWORK_BUFFER_SIZE       ( democonfigNETWORK_TX_BUFFER_SIZE + democonfigNETWORK_RX_BUFFER_SIZE )
 
 /**
  * @brief IoTHub endpoint port.
@@ -220,11 +246,34 @@
 
 /**
  * @brief Defines configRAND32, used by the common sample modules.
+ *
+ * esp_random() uses the hardware RNG, where rand() would be the same
+ * unseeded sequence on every device.
  */
-#define configRAND32()    ( rand() / RAND_MAX )
+#include "esp_system.h"
+#define configRAND32()    esp_random()
 
 #define democonfigCHUNK_DOWNLOAD_SIZE        4096
 
+/* Keep the download progress in an NVS journal, so an interrupted download
+ * picks up where it stopped. */
+#define democonfigADU_RESUMABLE_DOWNLOAD     1
+
+/**
+ * @brief Clock for the flash write benchmark (CONFIG_SAMPLE_IOT_FLASH_BENCHMARK).
+ */
+#include "esp_timer.h"
+#define democonfigFLASH_BENCH_TIME_US()      ( ( uint64_t ) esp_timer_get_time() )
+
+/**
+ * @brief Places the large buffers of the update in PSRAM
+ * (CONFIG_SAMPLE_IOT_PSRAM_BUFFERS).
+ */
+#ifdef CONFIG_SAMPLE_IOT_PSRAM_BUFFERS
+    #include "esp_attr.h"
+    #define democonfigLARGE_BUFFER_ATTR    EXT_RAM_BSS_ATTR
+#endif
+
 #define democonfigADU_DEVICE_MANUFACTURER    "ESPRESSIF"
 #define democonfigADU_DEVICE_MODEL           "ESP32-Azure-IoT-Kit"
 #define democonfigADU_UPDATE_PROVIDER        "Contoso"
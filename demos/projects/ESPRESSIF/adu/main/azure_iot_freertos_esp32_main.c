@@ -12,6 +12,7 @@
 #include "esp_wifi_default.h"
 #include "esp_err.h"
 #include "esp_netif.h"
+#include "esp_pm.h"
 #include "esp_sntp.h"
 #include "esp_log.h"
 #include "freertos/FreeRTOS.h"
@@ -25,12 +26,25 @@
 
 #include "sample_azure_iot_pnp_data_if.h"
 
+/* Startup timing. */
+#include "azure_sample_startup.h"
+
+/* The peak clock during the crypto of the sample. */
+#include "azure_sample_perf_governor.h"
+
 /* Azure Device Update */
 #include <azure/iot/az_iot_adu_client.h>
 /*-----------------------------------------------------------*/
 
 #define NR_OF_IP_ADDRESSES_TO_WAIT_FOR     1
 
+/* Clock of the CPU while idle, the crystal of most ESP32 modules. */
+#if defined( CONFIG_ESP32_XTAL_FREQ ) && ( CONFIG_ESP32_XTAL_FREQ > 0 )
+    #define SAMPLE_IOT_PM_MIN_FREQ_MHZ     CONFIG_ESP32_XTAL_FREQ
+#else
+    #define SAMPLE_IOT_PM_MIN_FREQ_MHZ     40
+#endif
+
 #if CONFIG_SAMPLE_IOT_WIFI_SCAN_METHOD_FAST
     #define SAMPLE_IOT_WIFI_SCAN_METHOD    WIFI_FAST_SCAN
 #elif CONFIG_SAMPLE_IOT_WIFI_SCAN_METHOD_ALL_CHANNEL
@@ -312,9 +326,46 @@ uint64_t ullGetUnixTime( void )
 }
 /*-----------------------------------------------------------*/
 
+#if CONFIG_SAMPLE_IOT_PERF_GOVERNOR
+
+static esp_pm_lock_handle_t xPerfLock;
+
+/* The CPU stays at max_freq_mhz while the sample runs its crypto. */
+static void prvSetPerfLevel( PerfLevel_t xLevel )
+{
+    if( xLevel == ePerfLevelHigh )
+    {
+        ( void ) esp_pm_lock_acquire( xPerfLock );
+    }
+    else
+    {
+        ( void ) esp_pm_lock_release( xPerfLock );
+    }
+}
+
+/* The CPU clocks down while idle, and up for the crypto of the sample. */
+static void prvInitializePerfGovernor( void )
+{
+    esp_pm_config_esp32_t xPmConfig =
+    {
+        .max_freq_mhz = CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ,
+        .min_freq_mhz = SAMPLE_IOT_PM_MIN_FREQ_MHZ,
+    };
+
+    ESP_ERROR_CHECK( esp_pm_configure( &xPmConfig ) );
+    ESP_ERROR_CHECK( esp_pm_lock_create( ESP_PM_CPU_FREQ_MAX, 0, "crypto", &xPerfLock ) );
+    PerfGovernor_Init( prvSetPerfLevel );
+}
+
+#endif /* CONFIG_SAMPLE_IOT_PERF_GOVERNOR */
+/*-----------------------------------------------------------*/
+
 void app_main( void )
 {
     ESP_ERROR_CHECK( nvs_flash_init() );
+    #if CONFIG_SAMPLE_IOT_PERF_GOVERNOR
+        prvInitializePerfGovernor();
+    #endif
     ESP_ERROR_CHECK( esp_netif_init() );
     ESP_ERROR_CHECK( esp_event_loop_create_default() );
 
@@ -322,8 +373,10 @@ void app_main( void )
     vTaskDelay( pdMS_TO_TICKS( 100 ) );
 
     ( void ) prvConnectNetwork();
+    StartupProfile_Mark( eStartupPhaseNetworkUp );
 
     prvInitializeTime();
+    StartupProfile_Mark( eStartupPhaseTimeSynced );
 
     vStartDemoTask();
 }
@@ -1,6 +1,7 @@
 /* Copyright (c) Microsoft Corporation.
  * Licensed under the MIT License. */
 
+#include <stdbool.h>
 #include <string.h>
 
 #include "azure_iot_flash_platform.h"
@@ -13,14 +14,93 @@
 
 #include "esp_ota_ops.h"
 #include "esp_system.h"
+#include "esp_timer.h"
+#include "nvs.h"
 #include "mbedtls/md.h"
 
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
 #define azureiotflashSHA_256_SIZE    32
 
-static uint8_t ucPartitionReadBuffer[ 32 ];
+/* Set to 0 to hash the image by reading it back in AzureIoTPlatform_VerifyImage()
+ * instead of finishing the hash of the written blocks. */
+#ifndef azureiotflashSTREAMING_HASH
+    #define azureiotflashSTREAMING_HASH    1
+#endif
+
+/* Set to 1 to also read the image back when the streamed hash matches. */
+#ifndef azureiotflashREAD_BACK_CHECK
+    #define azureiotflashREAD_BACK_CHECK    0
+#endif
+
+/* Span of the partition mapped at a time when the whole image cannot be
+ * mapped at once. A multiple of the MMU page size. */
+#ifndef azureiotflashMMAP_WINDOW_SIZE
+    #define azureiotflashMMAP_WINDOW_SIZE    ( 4 * SPI_FLASH_MMU_PAGE_SIZE )
+#endif
+
+/* ulHashedLength value once a block was written out of order. */
+#define azureiotflashHASH_INVALID    0xffffffffUL
+
+/* Set to 0 to erase the whole update partition in AzureIoTPlatform_Init()
+ * instead of erasing each sector just before it is first written. */
+#ifndef azureiotflashLAZY_ERASE
+    #define azureiotflashLAZY_ERASE    1
+#endif
+
+/* Called between the slices of an erase or a hash, so the image can be
+ * written with the task watchdog watching the task. Define it to feed the
+ * watchdog, such as esp_task_wdt_reset() for a task subscribed to it. */
+#ifndef azureiotflashWATCHDOG_KICK
+    #define azureiotflashWATCHDOG_KICK()    do {} while( 0 )
+#endif
+
+/* Bytes erased or hashed between two yields. 64 KB, a block the flash
+ * erases in one command, of some hundred milliseconds. */
+#ifndef azureiotflashSLICE_SIZE
+    #define azureiotflashSLICE_SIZE    ( 16 * SPI_FLASH_SEC_SIZE )
+#endif
+
+/* The download progress journal is an NVS blob, NVS being initialized by
+ * app_main(). NVS replaces a blob atomically, so it holds one record, the
+ * latest, and a record cut short by power loss leaves the previous one. */
+#define azureiotflashJOURNAL_NVS_NAMESPACE    "azure_adu"
+#define azureiotflashJOURNAL_NVS_KEY          "journal"
+
+/* Bytes downloaded between two journal records. A multiple of the sector
+ * size, so a download resumes at a sector that is erased again before it is
+ * written. Each record is an NVS write, so they are further apart than the
+ * sectors. */
+#ifndef azureiotflashJOURNAL_INTERVAL
+    #define azureiotflashJOURNAL_INTERVAL    ( 16 * SPI_FLASH_SEC_SIZE )
+#endif
+
+typedef struct AzureADUJournalRecord
+{
+    uint32_t ulImageFileSize;
+    uint32_t ulOffset;
+    uint8_t ucManifestHash[ azureiotflashSHA_256_SIZE ]; /* Identifies the image being downloaded. */
+    uint8_t ucWrittenHash[ azureiotflashSHA_256_SIZE ];  /* SHA256 of the first ulOffset bytes. */
+} AzureADUJournalRecord_t;
+
+/* Used to read the image back when it cannot be memory mapped. */
+static uint8_t ucPartitionReadBuffer[ 1024 ];
 static uint8_t ucDecodedManifestHash[ azureiotflashSHA_256_SIZE ];
 static uint8_t ucCalculatedHash[ azureiotflashSHA_256_SIZE ];
 
+/* Running hash of the bytes passed to AzureIoTPlatform_WriteBlock(). */
+static mbedtls_md_context_t xWrittenHashContext;
+static uint32_t ulHashedLength;
+
+/* Everything below this offset in the update partition has been erased. */
+static uint32_t ulErasedLength;
+
+static uint8_t ucJournalManifestHash[ azureiotflashSHA_256_SIZE ];
+
+/* Offset of the latest journal record of the download. */
+static uint32_t ulJournalOffset;
+
 static AzureIoTResult_t prvBase64Decode( uint8_t * base64Encoded,
                                          size_t ulBase64EncodedLength,
                                          uint8_t * pucOutputBuffer,
@@ -44,9 +124,239 @@ static AzureIoTResult_t prvBase64Decode( uint8_t * base64Encoded,
     return eAzureIoTSuccess;
 }
 
+static void prvStartWrittenHash( void )
+{
+    mbedtls_md_free( &xWrittenHashContext );
+    mbedtls_md_init( &xWrittenHashContext );
+    mbedtls_md_setup( &xWrittenHashContext, mbedtls_md_info_from_type( MBEDTLS_MD_SHA256 ), 0 );
+    mbedtls_md_starts( &xWrittenHashContext );
+    ulHashedLength = 0;
+}
+
+/* Between two slices: the other tasks, the network stack and whatever calls
+ * AzureIoTHubClient_ProcessLoop() in the pipelined download, get to run and
+ * the watchdog is fed. */
+static void prvYield( void )
+{
+    azureiotflashWATCHDOG_KICK();
+    vTaskDelay( 1 );
+}
+
+/* Hash a mapped span of the partition in slices. */
+static void prvHashMapped( mbedtls_md_context_t * pxContext,
+                           const uint8_t * pucMapped,
+                           uint32_t ulSize )
+{
+    uint32_t ulOffset;
+    uint32_t ulHashSize;
+
+    for( ulOffset = 0; ulOffset < ulSize; ulOffset += ulHashSize )
+    {
+        ulHashSize = ulSize - ulOffset < azureiotflashSLICE_SIZE ? ulSize - ulOffset : azureiotflashSLICE_SIZE;
+        mbedtls_md_update( pxContext, ( const unsigned char * ) pucMapped + ulOffset, ulHashSize );
+        prvYield();
+    }
+}
+
+/* Erase the partition up to ulEraseEnd a slice at a time, yielding after
+ * each. ulErasedLength is moved on with every slice, so an erase cut short by
+ * an error is picked up by the next block. */
+static AzureIoTResult_t prvErase( AzureADUImage_t * const pxAduImage,
+                                  uint32_t ulEraseEnd )
+{
+    uint32_t ulEraseSize;
+
+    while( ulErasedLength < ulEraseEnd )
+    {
+        /* Up to the next slice boundary, so the slices line up with the
+         * 64 KB blocks of the flash. */
+        ulEraseSize = azureiotflashSLICE_SIZE - ( ulErasedLength % azureiotflashSLICE_SIZE );
+        ulEraseSize = ulEraseEnd - ulErasedLength < ulEraseSize ? ulEraseEnd - ulErasedLength : ulEraseSize;
+
+        if( esp_partition_erase_range( pxAduImage->xUpdatePartition, ulErasedLength, ulEraseSize ) != ESP_OK )
+        {
+            AZLogError( ( "esp_partition_erase_range failed" ) );
+            return eAzureIoTErrorFailed;
+        }
+
+        ulErasedLength += ulEraseSize;
+        prvYield();
+    }
+
+    return eAzureIoTSuccess;
+}
+
+/* Hash the first ulLength bytes of the partition into pxContext. */
+static AzureIoTResult_t prvHashRange( AzureADUImage_t * const pxAduImage,
+                                      mbedtls_md_context_t * pxContext,
+                                      uint32_t ulLength )
+{
+    const void * pvMappedImage;
+    spi_flash_mmap_handle_t xMapHandle;
+    uint32_t ulReadSize;
+    uint32_t ulOffset = 0;
+    AzureIoTResult_t xResult = eAzureIoTSuccess;
+
+    /* Hash through the flash cache in one go if there are enough free MMU pages. */
+    if( ( ulLength > 0 ) &&
+        ( esp_partition_mmap( pxAduImage->xUpdatePartition, 0, ulLength,
+                              SPI_FLASH_MMAP_DATA, &pvMappedImage, &xMapHandle ) == ESP_OK ) )
+    {
+        prvHashMapped( pxContext, ( const uint8_t * ) pvMappedImage, ulLength );
+        spi_flash_munmap( xMapHandle );
+        ulOffset = ulLength;
+    }
+
+    /* Otherwise a few pages at a time. */
+    while( ulOffset < ulLength )
+    {
+        ulReadSize = ulLength - ulOffset < azureiotflashMMAP_WINDOW_SIZE ? ulLength - ulOffset : azureiotflashMMAP_WINDOW_SIZE;
+
+        if( esp_partition_mmap( pxAduImage->xUpdatePartition, ulOffset, ulReadSize,
+                                SPI_FLASH_MMAP_DATA, &pvMappedImage, &xMapHandle ) != ESP_OK )
+        {
+            break;
+        }
+
+        prvHashMapped( pxContext, ( const uint8_t * ) pvMappedImage, ulReadSize );
+        spi_flash_munmap( xMapHandle );
+        ulOffset += ulReadSize;
+    }
+
+    /* And read into RAM if even that could not be mapped. */
+    while( ulOffset < ulLength )
+    {
+        ulReadSize = ulLength - ulOffset < sizeof( ucPartitionReadBuffer ) ? ulLength - ulOffset : sizeof( ucPartitionReadBuffer );
+
+        if( esp_partition_read_raw( pxAduImage->xUpdatePartition,
+                                    ulOffset,
+                                    ucPartitionReadBuffer,
+                                    ulReadSize ) != ESP_OK )
+        {
+            AZLogError( ( "esp_partition_read_raw failed" ) );
+            xResult = eAzureIoTErrorFailed;
+            break;
+        }
+
+        mbedtls_md_update( pxContext, ( const unsigned char * ) ucPartitionReadBuffer, ulReadSize );
+        ulOffset += ulReadSize;
+
+        if( ( ulOffset % azureiotflashSLICE_SIZE ) == 0 )
+        {
+            prvYield();
+        }
+    }
+
+    return xResult;
+}
+
+static AzureIoTResult_t prvHashPartition( AzureADUImage_t * const pxAduImage,
+                                          uint8_t * pucHash )
+{
+    mbedtls_md_context_t ctx;
+    AzureIoTResult_t xResult;
+
+    /* With CONFIG_MBEDTLS_HARDWARE_SHA, mbedTLS feeds these spans to the SHA
+     * accelerator, so the cost is mostly reading flash through the cache. */
+    mbedtls_md_init( &ctx );
+    mbedtls_md_setup( &ctx, mbedtls_md_info_from_type( MBEDTLS_MD_SHA256 ), 0 );
+    mbedtls_md_starts( &ctx );
+
+    xResult = prvHashRange( pxAduImage, &ctx, pxAduImage->ulImageFileSize );
+
+    mbedtls_md_finish( &ctx, pucHash );
+    mbedtls_md_free( &ctx );
+
+    return xResult;
+}
+
+/* Finish a copy of the running hash, so it can keep absorbing later blocks. */
+static void prvGetWrittenHash( uint8_t * pucHash )
+{
+    mbedtls_md_context_t xCopy;
+
+    mbedtls_md_init( &xCopy );
+    mbedtls_md_setup( &xCopy, mbedtls_md_info_from_type( MBEDTLS_MD_SHA256 ), 0 );
+    mbedtls_md_clone( &xCopy, &xWrittenHashContext );
+    mbedtls_md_finish( &xCopy, pucHash );
+    mbedtls_md_free( &xCopy );
+}
+
+/* The journal record, if it is one of this image at a sector it can resume at. */
+static bool prvReadJournalRecord( AzureADUImage_t * const pxAduImage,
+                                  AzureADUJournalRecord_t * pxRecord )
+{
+    nvs_handle_t xHandle;
+    size_t xLength = sizeof( *pxRecord );
+    esp_err_t xError;
+
+    if( nvs_open( azureiotflashJOURNAL_NVS_NAMESPACE, NVS_READONLY, &xHandle ) != ESP_OK )
+    {
+        return false;
+    }
+
+    xError = nvs_get_blob( xHandle, azureiotflashJOURNAL_NVS_KEY, pxRecord, &xLength );
+    nvs_close( xHandle );
+
+    return ( xError == ESP_OK ) && ( xLength == sizeof( *pxRecord ) ) &&
+           ( pxRecord->ulImageFileSize == pxAduImage->ulImageFileSize ) &&
+           ( pxRecord->ulOffset <= pxAduImage->ulImageFileSize ) &&
+           ( ( pxRecord->ulOffset % SPI_FLASH_SEC_SIZE ) == 0 ) &&
+           ( memcmp( pxRecord->ucManifestHash, ucJournalManifestHash, azureiotflashSHA_256_SIZE ) == 0 );
+}
+
+static void prvStartRegion( AzureADUImage_t * const pxAduImage,
+                            const esp_partition_t * pxPartition )
+{
+    pxAduImage->pucBufferToWrite = NULL;
+    pxAduImage->ulBytesToWriteLength = 0;
+    pxAduImage->ulCurrentOffset = 0;
+    pxAduImage->ulImageFileSize = 0;
+    pxAduImage->xUpdatePartition = pxPartition;
+    prvStartWrittenHash();
+
+    ulErasedLength = 0;
+    ulJournalOffset = 0;
+
+    #if ( azureiotflashLAZY_ERASE == 0 )
+        /* In slices rather than in one call, which would hold the task for
+         * seconds. What is left after an error is erased with the blocks. */
+        ( void ) prvErase( pxAduImage, pxAduImage->xUpdatePartition->size );
+    #endif
+}
+
+/* The image goes to the next OTA partition, any other file of the update to
+ * the data partition labelled with its name. */
+static const esp_partition_t * prvFindFileRegion( uint32_t ulFileIndex,
+                                                  const uint8_t * pucFileName,
+                                                  uint32_t ulFileNameLength )
+{
+    char cLabel[ sizeof( ( ( esp_partition_t * ) 0 )->label ) ];
+    const esp_partition_t * pxCurrentPartition;
+
+    if( ulFileIndex == 0 )
+    {
+        pxCurrentPartition = esp_ota_get_running_partition();
+
+        return ( pxCurrentPartition != NULL ) ? esp_ota_get_next_update_partition( pxCurrentPartition ) : NULL;
+    }
+
+    if( ulFileNameLength >= sizeof( cLabel ) )
+    {
+        AZLogError( ( "File name %.*s is too long for a partition label", ( int16_t ) ulFileNameLength, pucFileName ) );
+        return NULL;
+    }
+
+    ( void ) memcpy( cLabel, pucFileName, ulFileNameLength );
+    cLabel[ ulFileNameLength ] = '\0';
+
+    return esp_partition_find_first( ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, cLabel );
+}
+
 AzureIoTResult_t AzureIoTPlatform_Init( AzureADUImage_t * const pxAduImage )
 {
     const esp_partition_t * pxCurrentPartition = esp_ota_get_running_partition();
+    const esp_partition_t * pxNextPartition;
 
     if( pxCurrentPartition == NULL )
     {
@@ -54,23 +364,162 @@ AzureIoTResult_t AzureIoTPlatform_Init( AzureADUImage_t * const pxAduImage )
         return eAzureIoTErrorFailed;
     }
 
+    pxNextPartition = esp_ota_get_next_update_partition( pxCurrentPartition );
+
+    if( pxNextPartition == NULL )
+    {
+        AZLogError( ( "esp_ota_get_next_update_partition failed" ) );
+        return eAzureIoTErrorFailed;
+    }
+
+    prvStartRegion( pxAduImage, pxNextPartition );
+
+    return eAzureIoTSuccess;
+}
+
+AzureIoTResult_t AzureIoTPlatform_InitFileRegion( AzureADUImage_t * const pxAduImage,
+                                                  uint32_t ulFileIndex,
+                                                  const uint8_t * pucFileName,
+                                                  uint32_t ulFileNameLength )
+{
+    const esp_partition_t * pxPartition = prvFindFileRegion( ulFileIndex, pucFileName, ulFileNameLength );
+
+    if( pxPartition == NULL )
+    {
+        AZLogError( ( "No partition for file %.*s", ( int16_t ) ulFileNameLength, pucFileName ) );
+        return eAzureIoTErrorFailed;
+    }
+
+    prvStartRegion( pxAduImage, pxPartition );
+
+    return eAzureIoTSuccess;
+}
+
+AzureIoTResult_t AzureIoTPlatform_ResumeInit( AzureADUImage_t * const pxAduImage,
+                                              uint8_t * pucSHA256Hash,
+                                              uint32_t ulSHA256HashLength )
+{
+    const esp_partition_t * pxPartition = prvFindFileRegion( 0, NULL, 0 );
+    AzureADUJournalRecord_t xRecord;
+    uint32_t ulOutputSize;
+
+    if( pxPartition == NULL )
+    {
+        AZLogError( ( "esp_ota_get_next_update_partition failed" ) );
+        return eAzureIoTErrorFailed;
+    }
+
+    if( pxAduImage->ulImageFileSize > pxPartition->size )
+    {
+        AZLogError( ( "Image does not fit in the update partition\r\n" ) );
+        return eAzureIoTErrorFailed;
+    }
+
+    if( prvBase64Decode( pucSHA256Hash, ulSHA256HashLength, ucJournalManifestHash,
+                         azureiotflashSHA_256_SIZE, ( size_t * ) &ulOutputSize ) != eAzureIoTSuccess )
+    {
+        AZLogError( ( "Unable to decode base64 SHA256\r\n" ) );
+        return eAzureIoTErrorFailed;
+    }
+
+    pxAduImage->xUpdatePartition = pxPartition;
     pxAduImage->pucBufferToWrite = NULL;
     pxAduImage->ulBytesToWriteLength = 0;
     pxAduImage->ulCurrentOffset = 0;
-    pxAduImage->ulImageFileSize = 0;
-    pxAduImage->xUpdatePartition = esp_ota_get_next_update_partition( pxCurrentPartition );
+    prvStartWrittenHash();
 
-    if( pxAduImage->xUpdatePartition == NULL )
+    if( prvReadJournalRecord( pxAduImage, &xRecord ) )
+    {
+        /* Only trust what is in flash, not just what the journal says was written. */
+        if( prvHashRange( pxAduImage, &xWrittenHashContext, xRecord.ulOffset ) == eAzureIoTSuccess )
+        {
+            ulHashedLength = xRecord.ulOffset;
+            prvGetWrittenHash( ucCalculatedHash );
+        }
+
+        if( ( ulHashedLength == xRecord.ulOffset ) &&
+            ( memcmp( ucCalculatedHash, xRecord.ucWrittenHash, azureiotflashSHA_256_SIZE ) == 0 ) )
+        {
+            pxAduImage->ulCurrentOffset = xRecord.ulOffset;
+        }
+        else
+        {
+            AZLogWarn( ( "Image in flash does not match the download journal\r\n" ) );
+            prvStartWrittenHash();
+        }
+    }
+
+    AZLogInfo( ( "Download starting at %u of %u bytes\r\n", pxAduImage->ulCurrentOffset, pxAduImage->ulImageFileSize ) );
+
+    /* Blocks written after the latest record may be in the sectors from the
+     * resume point on, so those are erased again before they are written. */
+    ulErasedLength = pxAduImage->ulCurrentOffset;
+    ulJournalOffset = pxAduImage->ulCurrentOffset;
+
+    #if ( azureiotflashLAZY_ERASE == 0 )
+        ( void ) prvErase( pxAduImage, pxAduImage->xUpdatePartition->size );
+    #endif
+
+    return eAzureIoTSuccess;
+}
+
+AzureIoTResult_t AzureIoTPlatform_SaveProgress( AzureADUImage_t * const pxAduImage )
+{
+    AzureADUJournalRecord_t xRecord;
+    nvs_handle_t xHandle;
+    esp_err_t xError;
+
+    if( ( pxAduImage->ulCurrentOffset != pxAduImage->ulImageFileSize ) &&
+        ( ( ( pxAduImage->ulCurrentOffset % SPI_FLASH_SEC_SIZE ) != 0 ) ||
+          ( pxAduImage->ulCurrentOffset < ulJournalOffset + azureiotflashJOURNAL_INTERVAL ) ) )
+    {
+        return eAzureIoTSuccess;
+    }
+
+    if( ulHashedLength != pxAduImage->ulCurrentOffset )
+    {
+        AZLogError( ( "Blocks were not written in order, progress not recorded\r\n" ) );
+        return eAzureIoTErrorFailed;
+    }
+
+    xRecord.ulImageFileSize = pxAduImage->ulImageFileSize;
+    xRecord.ulOffset = pxAduImage->ulCurrentOffset;
+    memcpy( xRecord.ucManifestHash, ucJournalManifestHash, azureiotflashSHA_256_SIZE );
+    prvGetWrittenHash( xRecord.ucWrittenHash );
+
+    if( nvs_open( azureiotflashJOURNAL_NVS_NAMESPACE, NVS_READWRITE, &xHandle ) != ESP_OK )
     {
-        AZLogError( ( "esp_ota_get_next_update_partition failed" ) );
         return eAzureIoTErrorFailed;
     }
 
-    esp_partition_erase_range( pxAduImage->xUpdatePartition, 0, pxAduImage->xUpdatePartition->size );
+    xError = nvs_set_blob( xHandle, azureiotflashJOURNAL_NVS_KEY, &xRecord, sizeof( xRecord ) );
+
+    if( xError == ESP_OK )
+    {
+        xError = nvs_commit( xHandle );
+    }
+
+    nvs_close( xHandle );
+
+    if( xError != ESP_OK )
+    {
+        return eAzureIoTErrorFailed;
+    }
+
+    ulJournalOffset = pxAduImage->ulCurrentOffset;
 
     return eAzureIoTSuccess;
 }
 
+int64_t AzureIoTPlatform_GetFileRegionSize( uint32_t ulFileIndex,
+                                            const uint8_t * pucFileName,
+                                            uint32_t ulFileNameLength )
+{
+    const esp_partition_t * pxPartition = prvFindFileRegion( ulFileIndex, pucFileName, ulFileNameLength );
+
+    return ( pxPartition != NULL ) ? ( int64_t ) pxPartition->size : -1;
+}
+
 int64_t AzureIoTPlatform_GetSingleFlashBootBankSize()
 {
     const esp_partition_t * pxCurrentPartition = esp_ota_get_running_partition();
@@ -99,6 +548,34 @@ AzureIoTResult_t AzureIoTPlatform_WriteBlock( AzureADUImage_t * const pxAduImage
                                               uint32_t ulBlockSize )
 {
     int ret;
+    uint32_t ulEraseEnd;
+
+    /* Blocks arrive in order, so only the sectors past the erased ones need erasing. */
+    if( ulOffset + ulBlockSize > ulErasedLength )
+    {
+        ulEraseEnd = ( ulOffset + ulBlockSize + SPI_FLASH_SEC_SIZE - 1 ) & ~( SPI_FLASH_SEC_SIZE - 1 );
+
+        if( ulEraseEnd > pxAduImage->xUpdatePartition->size )
+        {
+            AZLogError( ( "Block does not fit in the update partition" ) );
+            return eAzureIoTErrorFailed;
+        }
+
+        if( prvErase( pxAduImage, ulEraseEnd ) != eAzureIoTSuccess )
+        {
+            return eAzureIoTErrorFailed;
+        }
+    }
+
+    if( ulOffset == ulHashedLength )
+    {
+        mbedtls_md_update( &xWrittenHashContext, ( const unsigned char * ) pData, ulBlockSize );
+        ulHashedLength += ulBlockSize;
+    }
+    else
+    {
+        ulHashedLength = azureiotflashHASH_INVALID;
+    }
 
     ret = esp_partition_write( pxAduImage->xUpdatePartition, ulOffset, pData, ulBlockSize );
 
@@ -110,15 +587,42 @@ AzureIoTResult_t AzureIoTPlatform_WriteBlock( AzureADUImage_t * const pxAduImage
     return eAzureIoTSuccess;
 }
 
+static AzureIoTResult_t prvCompareHash( void )
+{
+    if( memcmp( ucDecodedManifestHash, ucCalculatedHash, azureiotflashSHA_256_SIZE ) == 0 )
+    {
+        AZLogInfo( ( "SHAs match\r\n" ) );
+        return eAzureIoTSuccess;
+    }
+
+    AZLogError( ( "SHAs do not match\r\n" ) );
+    AZLogInfo( ( "Wanted: " ) );
+
+    for( int i = 0; i < azureiotflashSHA_256_SIZE; ++i )
+    {
+        AZLogInfo( ( "%x", ucDecodedManifestHash[ i ] ) );
+    }
+
+    AZLogInfo( ( "\r\n" ) );
+    AZLogInfo( ( "Calculated: " ) );
+
+    for( int i = 0; i < azureiotflashSHA_256_SIZE; ++i )
+    {
+        AZLogInfo( ( "%x", ucCalculatedHash[ i ] ) );
+    }
+
+    AZLogInfo( ( "\r\n" ) );
+
+    return eAzureIoTErrorFailed;
+}
+
 AzureIoTResult_t AzureIoTPlatform_VerifyImage( AzureADUImage_t * const pxAduImage,
                                                uint8_t * pucSHA256Hash,
                                                uint32_t ulSHA256HashLength )
 {
     int xResult;
-    esp_err_t espErr;
-
     uint32_t ulOutputSize;
-    uint32_t ulReadSize;
+    int xReadBack = 1;
 
     AZLogInfo( ( "Base64 Encoded Hash from ADU: %.*s", ( int16_t ) ulSHA256HashLength, pucSHA256Hash ) );
     xResult = prvBase64Decode( pucSHA256Hash, ulSHA256HashLength, ucDecodedManifestHash, azureiotflashSHA_256_SIZE, ( size_t * ) &ulOutputSize );
@@ -129,59 +633,35 @@ AzureIoTResult_t AzureIoTPlatform_VerifyImage( AzureADUImage_t * const pxAduImag
         return eAzureIoTErrorFailed;
     }
 
-    mbedtls_md_context_t ctx;
-    mbedtls_md_type_t md_type = MBEDTLS_MD_SHA256;
-
-    mbedtls_md_init( &ctx );
-    mbedtls_md_setup( &ctx, mbedtls_md_info_from_type( md_type ), 0 );
-    mbedtls_md_starts( &ctx );
-
-    AZLogInfo( ( "Starting the mbedtls calculation: image size %u\r\n", ( uint16_t ) pxAduImage->ulImageFileSize ) );
+    #if ( azureiotflashSTREAMING_HASH == 1 )
+        if( ulHashedLength == pxAduImage->ulImageFileSize )
+        {
+            mbedtls_md_finish( &xWrittenHashContext, ucCalculatedHash );
+            /* The context is finished, so a second call has to read the image back. */
+            ulHashedLength = azureiotflashHASH_INVALID;
+            xResult = prvCompareHash();
+            xReadBack = ( xResult == eAzureIoTSuccess ) && ( azureiotflashREAD_BACK_CHECK == 1 );
+        }
+        else
+        {
+            AZLogWarn( ( "Blocks were not written in order, reading the image back\r\n" ) );
+        }
+    #endif /* azureiotflashSTREAMING_HASH == 1 */
 
-    for( size_t ulOffset = 0; ulOffset < pxAduImage->ulImageFileSize; ulOffset += sizeof( ucPartitionReadBuffer ) )
+    if( xReadBack )
     {
-        ulReadSize = pxAduImage->ulImageFileSize - ulOffset < sizeof( ucPartitionReadBuffer ) ? pxAduImage->ulImageFileSize - ulOffset : sizeof( ucPartitionReadBuffer );
+        int64_t llStart = esp_timer_get_time();
 
-        espErr = esp_partition_read_raw( pxAduImage->xUpdatePartition,
-                                         ulOffset,
-                                         ucPartitionReadBuffer,
-                                         ulReadSize );
-        ( void ) espErr;
+        AZLogInfo( ( "Starting the mbedtls calculation: image size %u\r\n", ( unsigned int ) pxAduImage->ulImageFileSize ) );
 
-        mbedtls_md_update( &ctx, ( const unsigned char * ) ucPartitionReadBuffer, ulReadSize );
-    }
+        xResult = prvHashPartition( pxAduImage, ucCalculatedHash );
 
-    AZLogInfo( ( "mbedtls calculation completed\r\n" ) );
+        AZLogInfo( ( "mbedtls calculation completed in %u ms\r\n", ( unsigned int ) ( ( esp_timer_get_time() - llStart ) / 1000 ) ) );
 
-    mbedtls_md_finish( &ctx, ucCalculatedHash );
-    mbedtls_md_free( &ctx );
-
-    if( memcmp( ucDecodedManifestHash, ucCalculatedHash, azureiotflashSHA_256_SIZE ) == 0 )
-    {
-        AZLogInfo( ( "SHAs match\r\n" ) );
-        xResult = eAzureIoTSuccess;
-    }
-    else
-    {
-        AZLogInfo( ( "SHAs do not match\r\n" ) );
-        AZLogInfo( ( "Wanted: " ) );
-
-        for( int i = 0; i < azureiotflashSHA_256_SIZE; ++i )
+        if( xResult == eAzureIoTSuccess )
         {
-            AZLogInfo( ( "%x", ucDecodedManifestHash[ i ] ) );
+            xResult = prvCompareHash();
         }
-
-        AZLogInfo( ( "\r\n" ) );
-        AZLogInfo( ( "Calculated: " ) );
-
-        for( int i = 0; i < azureiotflashSHA_256_SIZE; ++i )
-        {
-            AZLogInfo( ( "%x", ucCalculatedHash[ i ] ) );
-        }
-
-        AZLogInfo( ( "\r\n" ) );
-
-        xResult = eAzureIoTErrorFailed;
     }
 
     return xResult;
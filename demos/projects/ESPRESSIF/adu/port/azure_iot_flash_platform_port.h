@@ -25,4 +25,62 @@ typedef struct AzureADUImageContext
 
 typedef AzureADUImageContext_t AzureADUImage_t;
 
+/**
+ * @brief Size of the flash region a file of a multi-file update is downloaded
+ *        to, or -1 if the file has none.
+ *
+ * @param[in] ulFileIndex Index of the file in the update manifest, 0 for the image.
+ * @param[in] pucFileName Name of the file in the update manifest.
+ * @param[in] ulFileNameLength The length of \p pucFileName.
+ */
+int64_t AzureIoTPlatform_GetFileRegionSize( uint32_t ulFileIndex,
+                                            const uint8_t * pucFileName,
+                                            uint32_t ulFileNameLength );
+
+/**
+ * @brief Prepare the flash region of a file of a multi-file update, which the
+ *        blocks of the file are then written to.
+ *
+ * Used instead of AzureIoTPlatform_Init() when democonfigADU_MAX_FILES is
+ * above 1. The image goes to the next OTA partition,
+ * as with AzureIoTPlatform_Init(), and any other file to the data partition
+ * labelled with its name.
+ *
+ * @param[in] pxAduImage The image context.
+ * @param[in] ulFileIndex Index of the file in the update manifest, 0 for the image.
+ * @param[in] pucFileName Name of the file in the update manifest.
+ * @param[in] ulFileNameLength The length of \p pucFileName.
+ */
+AzureIoTResult_t AzureIoTPlatform_InitFileRegion( AzureADUImage_t * const pxAduImage,
+                                                  uint32_t ulFileIndex,
+                                                  const uint8_t * pucFileName,
+                                                  uint32_t ulFileNameLength );
+
+/**
+ * @brief Prepare the update partition for a download that may continue an earlier one.
+ *
+ * Used instead of AzureIoTPlatform_Init(). pxAduImage->ulImageFileSize must be set.
+ * If the progress journal in NVS records the same image and the partition
+ * contents up to the recorded offset still hash to the journaled value,
+ * ulCurrentOffset is set to that offset and only the sectors after it are erased.
+ * Otherwise the download starts from zero. NVS must be initialized.
+ *
+ * @param[in] pxAduImage The image context.
+ * @param[in] pucSHA256Hash The base64 encoded SHA256 of the image from the update manifest.
+ * @param[in] ulSHA256HashLength The length of \p pucSHA256Hash.
+ */
+AzureIoTResult_t AzureIoTPlatform_ResumeInit( AzureADUImage_t * const pxAduImage,
+                                              uint8_t * pucSHA256Hash,
+                                              uint32_t ulSHA256HashLength );
+
+/**
+ * @brief Record pxAduImage->ulCurrentOffset and the hash of the bytes written so far.
+ *
+ * Only sector aligned offsets a journal interval apart and the end of the image
+ * are recorded, so a resumed download never has to rewrite a written sector.
+ *
+ * @param[in] pxAduImage The image context.
+ */
+AzureIoTResult_t AzureIoTPlatform_SaveProgress( AzureADUImage_t * const pxAduImage );
+
 #endif /* AZURE_IOT_FLASH_PLATFORM_PORT_H */
@@ -4,9 +4,14 @@
 #include "sensor_manager.h"
 
 #include <stdio.h>
+#include <string.h>
 #include <math.h>
 
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
 #include "driver/i2c.h"
+#include "driver/gpio.h"
 #include "sensors/hts221.h"
 #include "sensors/bh1750.h"
 #include "sensors/mpu6050.h"
@@ -16,6 +21,14 @@
 #include "sensors/oled.h"
 #include "sensors/led.h"
 
+#ifdef CONFIG_AZURE_IOT_ULP_SENSORS
+#include "esp_sleep.h"
+#include "driver/rtc_io.h"
+#include "soc/rtc_cntl_reg.h"
+#include "esp32/ulp.h"
+#include "ulp_sensors.h"
+#endif
+
 #define I2C_MASTER_SCL_IO 26        /*!< gpio number for I2C master clock */
 #define I2C_MASTER_SDA_IO 25        /*!< gpio number for I2C master data  */
 #define I2C_MASTER_FREQ_HZ 100000   /*!< I2C master clock frequency */
@@ -25,6 +38,73 @@
 
 #define SHAKE_THRESHOLD 2
 
+#define SAMPLING_TASK_STACK_SIZE   3072
+#define SAMPLING_TASK_PRIORITY     (tskIDLE_PRIORITY + 1)
+#define SAMPLING_TASK_PERIOD_MS    100   /*!< the shortest of the periods below */
+
+#ifdef CONFIG_AZURE_IOT_HTS221_PERIOD_MS
+#define HUMITURE_PERIOD_MS         CONFIG_AZURE_IOT_HTS221_PERIOD_MS
+#else
+#define HUMITURE_PERIOD_MS         1000
+#endif
+#define AMBIENT_LIGHT_PERIOD_MS    500
+#define BAROMETER_PERIOD_MS        1000
+#define MAGNETOMETER_PERIOD_MS     200
+#define MOTION_PERIOD_MS           100
+
+#define SAMPLING_GROUP_COUNT       5     /*!< sensors read on their own schedule */
+#define HUMITURE_GROUP             0
+#define MAGNETOMETER_GROUP         3
+#define MOTION_GROUP               4
+
+/* The data-ready pins, when the board wires them to GPIOs; the sensors are
+ * polled otherwise. */
+#if defined(CONFIG_AZURE_IOT_MPU6050_INT_GPIO) && CONFIG_AZURE_IOT_MPU6050_INT_GPIO >= 0
+#define MOTION_INT_IO              CONFIG_AZURE_IOT_MPU6050_INT_GPIO
+#endif
+#if defined(CONFIG_AZURE_IOT_MAG3110_INT_GPIO) && CONFIG_AZURE_IOT_MAG3110_INT_GPIO >= 0
+#define MAGNETOMETER_INT_IO        CONFIG_AZURE_IOT_MAG3110_INT_GPIO
+#endif
+#if defined(CONFIG_AZURE_IOT_HTS221_DRDY_GPIO) && CONFIG_AZURE_IOT_HTS221_DRDY_GPIO >= 0
+#define HUMITURE_INT_IO            CONFIG_AZURE_IOT_HTS221_DRDY_GPIO
+#endif
+
+/* One-shot by default: the HTS221 converts once per sample and idles in
+ * between, rather than converting continuously at 1 Hz. */
+#ifdef CONFIG_AZURE_IOT_HTS221_ODR
+#define HUMITURE_ODR               ((hts221_odr_t)CONFIG_AZURE_IOT_HTS221_ODR)
+#else
+#define HUMITURE_ODR               HTS221_ODR_ONE_SHOT
+#endif
+#ifdef CONFIG_AZURE_IOT_HTS221_AVG_H
+#define HUMITURE_AVG_H             ((hts221_avgh_t)CONFIG_AZURE_IOT_HTS221_AVG_H)
+#else
+#define HUMITURE_AVG_H             HTS221_AVGH_32
+#endif
+#ifdef CONFIG_AZURE_IOT_HTS221_AVG_T
+#define HUMITURE_AVG_T             ((hts221_avgt_t)(CONFIG_AZURE_IOT_HTS221_AVG_T << HTS221_AVGT_BIT))
+#else
+#define HUMITURE_AVG_T             HTS221_AVGT_16
+#endif
+#define HUMITURE_ONESHOT_WAIT_MS   200   /*!< longer than a conversion with the most averaging */
+#define HUMITURE_ONESHOT_POLL_MS   10
+
+#define MOTION_NOTIFY_BIT          (1U << 0)
+#define MAGNETOMETER_NOTIFY_BIT    (1U << 1)
+#define HUMITURE_NOTIFY_BIT        (1U << 2)
+#define MOTION_NOTIFY_SAMPLES      (MOTION_PERIOD_MS / MOTION_SAMPLE_PERIOD_MS) /*!< FIFO bursts of 100 ms */
+#define MAGNETOMETER_DR_OS         MAG3110_DR_OS_5_128   /*!< 5 Hz, MAGNETOMETER_PERIOD_MS */
+
+#define MOTION_FIFO_RATE_DIV       4     /*!< accelerometer at 1 kHz / (1 + 4) = 200 Hz */
+#define MOTION_FIFO_BURST_SAMPLES  32    /*!< samples drained from the FIFO at a time */
+#define MOTION_FIFO_MAX_SAMPLES    170   /*!< what the FIFO holds */
+#define STANDARD_GRAVITY_UM_S2     9806650
+
+#define ULP_MAX_SAMPLES            64    /*!< MAX_SAMPLES of ulp/sensors.S */
+#define ULP_WORDS_PER_SAMPLE       3     /*!< humidity, temperature and light */
+#define ULP_STOP_WAIT_MS           10    /*!< longer than a run of the ULP program */
+#define BH1750_COUNTS_PER_LUX      1.2f  /*!< in the 1 lx resolution modes */
+
 static i2c_bus_handle_t i2c_bus = NULL;
 static hts221_handle_t hts221 = NULL;
 static bh1750_handle_t bh1750 = NULL;
@@ -34,6 +114,86 @@ static mpu6050_handle_t mpu6050 = NULL;
 static ssd1306_handle_t oled = NULL;
 static float range_per_digit = 0;
 
+/* Read once, so a sample is the one burst read of its output registers. */
+static hts221_calibration_t humiture_calibration;
+static bool humiture_calibrated = false;
+
+/* Set between the one-shot trigger and the read of its conversion, which a
+ * later pass of the sampling task, or the data-ready interrupt, does. */
+static bool humiture_converting = false;
+
+/* Set while the FBM320 converts, for the next passes of the sampling task to
+ * collect, so the other sensors are read meanwhile. */
+static bool barometer_converting = false;
+
+/* The sampling task fills the back snapshot in without a lock, then publishes
+ * it by swapping front and back. Readers copy the front one, holding the lock
+ * for no longer than the copy. */
+static sensor_snapshot_t snapshots[2];
+static volatile uint32_t front_snapshot = 0;
+static portMUX_TYPE snapshot_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/* Accelerometer samples from the FIFO, in raw counts, accumulated by the
+ * sampling task since take_motion_statistics() was last called. Guarded by
+ * snapshot_lock. */
+typedef struct motion_window
+{
+    uint32_t samples;
+    uint32_t overruns;
+    int16_t min[3];
+    int16_t max[3];
+    int64_t sum[3];
+    uint64_t sum_squares[3];
+} motion_window_t;
+
+static TaskHandle_t sampling_task = NULL;
+
+/* Bits of the sampling groups read when their data-ready interrupt notifies
+ * the sampling task, rather than on their schedule. */
+static volatile uint32_t interrupt_groups = 0;
+#ifdef MOTION_INT_IO
+static uint32_t motion_interrupt_samples = 0;
+static bool motion_interrupt_enabled = false;
+#endif
+#ifdef MAGNETOMETER_INT_IO
+static bool magnetometer_interrupt_enabled = false;
+#endif
+#ifdef HUMITURE_INT_IO
+static bool humiture_interrupt_enabled = false;
+static bool humiture_interrupt_started = false;
+#endif
+
+static bool motion_fifo_enabled = false;
+static int32_t accel_lsb_per_g = 16384;
+static motion_window_t motion_window;
+
+#ifdef CONFIG_AZURE_IOT_TELEMETRY_TIME_SERIES
+#define MOTION_RING_SAMPLES        400   /*!< two seconds of samples at 200 Hz */
+
+/* The samples themselves, oldest first from ring_first, for
+ * take_motion_samples(). Contiguous: when samples are lost the ring is
+ * emptied and ring_restarted set. Guarded by snapshot_lock. */
+static mpu6050_acceleration_t motion_ring[MOTION_RING_SAMPLES];
+static uint32_t ring_first = 0;
+static uint32_t ring_count = 0;
+static TickType_t ring_newest_tick = 0;
+static bool ring_restarted = false;
+#endif
+
+#ifdef CONFIG_AZURE_IOT_ULP_SENSORS
+extern const uint8_t ulp_sensors_bin_start[] asm("_binary_ulp_sensors_bin_start");
+extern const uint8_t ulp_sensors_bin_end[] asm("_binary_ulp_sensors_bin_end");
+
+/* Set when the ULP program is started, kept through the deep sleep, so a
+ * wake can tell its samples in RTC slow memory from those of a cold boot. */
+static RTC_DATA_ATTR bool ulp_sampling = false;
+
+/* The sampling task stops reading the bus once sampling_stopping is set, and
+ * notifies sampling_stopper. */
+static TaskHandle_t sampling_stopper = NULL;
+static volatile bool sampling_stopping = false;
+#endif
+
 /**
  * @brief i2c master initialization
  */
@@ -57,22 +217,36 @@ static void init_humiture_sensor()
     hts221 = iot_hts221_create(i2c_bus, HTS221_I2C_ADDRESS);
 
     hts221_config_t hts221_config;
-    hts221_config.avg_h = HTS221_AVGH_32;
-    hts221_config.avg_t = HTS221_AVGT_16;
-    hts221_config.odr = HTS221_ODR_1HZ;
-    hts221_config.bdu_status = HTS221_DISABLE;
+    hts221_config.avg_h = HUMITURE_AVG_H;
+    hts221_config.avg_t = HUMITURE_AVG_T;
+    hts221_config.odr = HUMITURE_ODR;
+    /* The burst read gets the humidity and temperature of one conversion. */
+    hts221_config.bdu_status = HTS221_ENABLE;
     hts221_config.heater_status = HTS221_DISABLE;
+    hts221_config.irq_level = HTS221_HIGH_LVL;
+    hts221_config.irq_output_type = HTS221_PUSHPULL;
+#ifdef HUMITURE_INT_IO
+    hts221_config.irq_enable = HTS221_ENABLE;
+#else
+    hts221_config.irq_enable = HTS221_DISABLE;
+#endif
+    humiture_converting = false;
+#ifdef HUMITURE_INT_IO
+    humiture_interrupt_enabled = iot_hts221_set_config(hts221, &hts221_config) == ESP_OK;
+#else
     iot_hts221_set_config(hts221, &hts221_config);
-    
+#endif
+
     iot_hts221_set_activate(hts221);
+    humiture_calibrated = iot_hts221_get_calibration(hts221, &humiture_calibration) == ESP_OK;
 }
 
 static void init_ambient_light_sensor()
 {
     bh1750 = iot_bh1750_create(i2c_bus, BH1750_I2C_ADDRESS);
-    bh1750_cmd_measure_t cmd_measure = BH1750_CONTINUE_4LX_RES;
-    iot_bh1750_power_on(bh1750);
-    iot_bh1750_set_measure_mode(bh1750, cmd_measure);
+    /* Converting every 120 ms on its own, faster than AMBIENT_LIGHT_PERIOD_MS,
+     * so a read is the latest conversion and never waits for one. */
+    iot_bh1750_start_continuous(bh1750, BH1750_CONTINUE_1LX_RES);
 }
 
 static void init_motion_sensor()
@@ -101,6 +275,12 @@ static void init_motion_sensor()
         range_per_digit = .000061f;
         break;
     }
+
+    accel_lsb_per_g = 16384 >> (range <= 3 ? range : 0);
+    motion_fifo_enabled = (mpu6050_start_accel_fifo(mpu6050, MOTION_FIFO_RATE_DIV) == ESP_OK);
+#ifdef MOTION_INT_IO
+    motion_interrupt_enabled = motion_fifo_enabled && mpu6050_enable_data_ready_interrupt(mpu6050) == ESP_OK;
+#endif
 }
 
 static void init_barometer_sensor()
@@ -113,6 +293,9 @@ static void init_magnetometer_sensor()
 {
     mag3110 = iot_mag3110_create(i2c_bus, MAG3110_I2C_ADDRESS);
     mag3110_start(mag3110);
+#ifdef MAGNETOMETER_INT_IO
+    magnetometer_interrupt_enabled = mag3110_set_DR_OS(mag3110, MAGNETOMETER_DR_OS) == ESP_OK;
+#endif
 }
 
 static void init_oled()
@@ -121,8 +304,28 @@ static void init_oled()
     oled_init(oled);
 }
 
+#ifdef CONFIG_AZURE_IOT_ULP_SENSORS
+/* The ULP timer runs through a wake on the timer, so it is stopped and the
+ * bus taken back from the ULP program before the I2C driver drives it. */
+static void stop_ulp_sampling()
+{
+    if (!ulp_sampling)
+    {
+        return;
+    }
+
+    CLEAR_PERI_REG_MASK(RTC_CNTL_STATE0_REG, RTC_CNTL_ULP_CP_SLP_TIMER_EN);
+    vTaskDelay(pdMS_TO_TICKS(ULP_STOP_WAIT_MS));
+    rtc_gpio_deinit(I2C_MASTER_SDA_IO);
+    rtc_gpio_deinit(I2C_MASTER_SCL_IO);
+}
+#endif
+
 void initialize_sensors()
 {
+#ifdef CONFIG_AZURE_IOT_ULP_SENSORS
+    stop_ulp_sampling();
+#endif
     i2c_master_init();
     init_humiture_sensor();
     init_ambient_light_sensor();
@@ -168,6 +371,80 @@ float get_humidity()
     return (float)humidity / 10;
 }
 
+/* Reads the last conversion of the HTS221, humidity and temperature in one burst. */
+static bool read_humiture(float *temperature, float *humidity)
+{
+    int16_t raw_humidity, raw_temperature;
+
+    if (hts221 == NULL || !humiture_calibrated ||
+        iot_hts221_get_raw_humidity_temperature(hts221, &raw_humidity, &raw_temperature) != ESP_OK)
+    {
+        return false;
+    }
+
+    *temperature = (float)iot_hts221_calibrate_temperature(&humiture_calibration, raw_temperature) / 10;
+    *humidity = (float)iot_hts221_calibrate_humidity(&humiture_calibration, raw_humidity) / 10;
+
+    return true;
+}
+
+void get_temperature_humidity(float *temperature, float *humidity)
+{
+    bool ready = false;
+
+    if (HUMITURE_ODR == HTS221_ODR_ONE_SHOT && hts221 != NULL &&
+        iot_hts221_start_oneshot(hts221) == ESP_OK)
+    {
+        for (uint32_t waited = 0; !ready && waited < HUMITURE_ONESHOT_WAIT_MS; waited += HUMITURE_ONESHOT_POLL_MS)
+        {
+            vTaskDelay(pdMS_TO_TICKS(HUMITURE_ONESHOT_POLL_MS));
+            if (iot_hts221_data_ready(hts221, &ready) != ESP_OK)
+            {
+                break;
+            }
+        }
+    }
+
+    if (!read_humiture(temperature, humidity))
+    {
+        *temperature = 0;
+        *humidity = 0;
+    }
+}
+
+/* Reads the one-shot conversion once the HTS221 has finished it, unless the
+ * data-ready interrupt does. */
+static bool collect_humiture(sensor_snapshot_t *snapshot)
+{
+    bool ready = false;
+
+    if (!humiture_converting)
+    {
+        return false;
+    }
+
+#ifdef HUMITURE_INT_IO
+    if (humiture_interrupt_started)
+    {
+        return false;
+    }
+#endif
+
+    if (iot_hts221_data_ready(hts221, &ready) != ESP_OK)
+    {
+        humiture_converting = false;
+        return false;
+    }
+
+    if (ready)
+    {
+        humiture_converting = false;
+        read_humiture(&snapshot->temperature, &snapshot->humidity);
+    }
+
+    return ready;
+}
+
 float get_ambientLight()
 {
 
@@ -178,7 +455,12 @@ float get_ambientLight()
         return 0;
     }
 
-    ret = iot_bh1750_get_data(bh1750, &bh1750_data);
+    ret = iot_bh1750_read_continuous(bh1750, &bh1750_data);
+    if (ret == ESP_ERR_INVALID_STATE)
+    {
+        /* The first conversion is not done yet. */
+        return 0;
+    }
     if (ret != ESP_OK)
     {
         printf("No ack, sensor not connected...\n");
@@ -187,15 +469,13 @@ float get_ambientLight()
     return bh1750_data;
 }
 
-void get_pitch_roll_accel(int *pitch, int *roll, int *accelX, int *accelY, int *accelZ)
+static void accel_to_pitch_roll(const mpu6050_acceleration_t *raw, int *pitch, int *roll, int *accelX, int *accelY, int *accelZ)
 {
-    mpu6050_acceleration_t result;
+    mpu6050_acceleration_t result = *raw;
     int16_t norm_accel_x;
     int16_t norm_accel_y;
     int16_t norm_accel_z;
 
-    mpu6050_get_acceleration(mpu6050, &result);
-
     norm_accel_x = result.accel_x * range_per_digit * 9.80665f;
     norm_accel_y = result.accel_y * range_per_digit * 9.80665f;
     norm_accel_z = result.accel_z * range_per_digit * 9.80665f;
@@ -208,11 +488,18 @@ void get_pitch_roll_accel(int *pitch, int *roll, int *accelX, int *accelY, int *
     *roll = (atan2(norm_accel_y, norm_accel_z) * 180.0) / 3.1415;
 }
 
-void get_pressure_altitude(float *pressure, float *altitude)
+void get_pitch_roll_accel(int *pitch, int *roll, int *accelX, int *accelY, int *accelZ)
+{
+    mpu6050_acceleration_t result;
+
+    mpu6050_get_acceleration(mpu6050, &result);
+    accel_to_pitch_roll(&result, pitch, roll, accelX, accelY, accelZ);
+}
+
+static void read_pressure_altitude(float *pressure, float *altitude)
 {
     int32_t real_p, real_t, abs_alt;
 
-    fbm320_update_data(fbm320);
     fbm320_read_data(fbm320, &real_p, &real_t);
 
     *pressure = real_p / 1000.0; // convert pa to Kpa
@@ -220,6 +507,52 @@ void get_pressure_altitude(float *pressure, float *altitude)
     *altitude = abs_alt / 1000.0;
 }
 
+void get_pressure_altitude(float *pressure, float *altitude)
+{
+    fbm320_update_data(fbm320);
+    read_pressure_altitude(pressure, altitude);
+}
+
+static bool collect_pressure_altitude(sensor_snapshot_t *snapshot)
+{
+    bool done = false;
+
+    if (!barometer_converting)
+    {
+        return false;
+    }
+
+    if (fbm320_collect(fbm320, &done) != ESP_OK)
+    {
+        barometer_converting = false;
+        return false;
+    }
+
+    if (done)
+    {
+        barometer_converting = false;
+        read_pressure_altitude(&snapshot->pressure, &snapshot->altitude);
+    }
+
+    return done;
+}
+
+#ifdef MAGNETOMETER_INT_IO
+/* Reads the magnetometer without checking DR_STATUS, once the data-ready
+ * interrupt told it has a sample. */
+static void read_magnetometer(sensor_snapshot_t *snapshot)
+{
+    uint16_t x = 0, y = 0, z = 0;
+
+    if (mag3110_read_mag(mag3110, &x, &y, &z) == ESP_OK)
+    {
+        snapshot->magnetometer_x = x;
+        snapshot->magnetometer_y = y;
+        snapshot->magnetometer_z = z;
+    }
+}
+#endif
+
 void get_magnetometer(int *magnetometerX, int *magnetometerY, int *magnetometerZ)
 {
     uint16_t x = 0, y = 0, z = 0;
@@ -244,3 +577,654 @@ void led2_set_state(uint32_t ulLedState)
 {
     toggle_wifi_led(ulLedState);
 }
+
+static void publish_snapshot(const sensor_snapshot_t *snapshot)
+{
+    uint32_t back = front_snapshot ^ 1;
+
+    snapshots[back] = *snapshot;
+
+    portENTER_CRITICAL(&snapshot_lock);
+    front_snapshot = back;
+    portEXIT_CRITICAL(&snapshot_lock);
+}
+
+static void reset_motion_window(motion_window_t *window)
+{
+    memset(window, 0, sizeof(*window));
+    for (uint32_t axis = 0; axis < 3; axis++)
+    {
+        window->min[axis] = INT16_MAX;
+        window->max[axis] = INT16_MIN;
+    }
+}
+
+static void accumulate_motion(motion_window_t *window, const mpu6050_acceleration_t *samples, uint16_t count)
+{
+    for (uint16_t i = 0; i < count; i++)
+    {
+        const int16_t value[3] = { samples[i].accel_x, samples[i].accel_y, samples[i].accel_z };
+
+        for (uint32_t axis = 0; axis < 3; axis++)
+        {
+            window->min[axis] = value[axis] < window->min[axis] ? value[axis] : window->min[axis];
+            window->max[axis] = value[axis] > window->max[axis] ? value[axis] : window->max[axis];
+            window->sum[axis] += value[axis];
+            window->sum_squares[axis] += (uint64_t)((int32_t)value[axis] * value[axis]);
+        }
+    }
+    window->samples += count;
+}
+
+static void merge_motion_window(motion_window_t *into, const motion_window_t *from)
+{
+    for (uint32_t axis = 0; axis < 3; axis++)
+    {
+        into->min[axis] = from->min[axis] < into->min[axis] ? from->min[axis] : into->min[axis];
+        into->max[axis] = from->max[axis] > into->max[axis] ? from->max[axis] : into->max[axis];
+        into->sum[axis] += from->sum[axis];
+        into->sum_squares[axis] += from->sum_squares[axis];
+    }
+    into->samples += from->samples;
+    into->overruns += from->overruns;
+}
+
+#ifdef CONFIG_AZURE_IOT_TELEMETRY_TIME_SERIES
+/* Keeps a burst of samples for take_motion_samples(). Called under snapshot_lock. */
+static void keep_motion_samples(const mpu6050_acceleration_t *samples, uint16_t count, bool lost)
+{
+    if (lost || ring_count + count > MOTION_RING_SAMPLES)
+    {
+        ring_first = 0;
+        ring_count = 0;
+        ring_restarted = true;
+    }
+
+    for (uint16_t i = 0; i < count; i++)
+    {
+        motion_ring[(ring_first + ring_count) % MOTION_RING_SAMPLES] = samples[i];
+        ring_count++;
+    }
+
+    ring_newest_tick = xTaskGetTickCount();
+}
+#endif
+
+/* Drains the accelerometer FIFO. The samples are accumulated outside the
+ * lock and merged into the window under it; the snapshot gets the last one. */
+static void sample_motion_fifo(sensor_snapshot_t *snapshot)
+{
+    mpu6050_acceleration_t samples[MOTION_FIFO_BURST_SAMPLES];
+    motion_window_t drained;
+    uint16_t total = 0;
+    uint16_t count;
+    esp_err_t ret;
+
+    reset_motion_window(&drained);
+
+    do
+    {
+        ret = mpu6050_read_accel_fifo(mpu6050, samples, MOTION_FIFO_BURST_SAMPLES, &count);
+        if (ret == ESP_ERR_INVALID_STATE)
+        {
+            drained.overruns++;
+        }
+        accumulate_motion(&drained, samples, count);
+#ifdef CONFIG_AZURE_IOT_TELEMETRY_TIME_SERIES
+        if (count > 0 || ret == ESP_ERR_INVALID_STATE)
+        {
+            portENTER_CRITICAL(&snapshot_lock);
+            keep_motion_samples(samples, count, ret == ESP_ERR_INVALID_STATE);
+            portEXIT_CRITICAL(&snapshot_lock);
+        }
+#endif
+        total += count;
+    } while (ret == ESP_OK && count == MOTION_FIFO_BURST_SAMPLES && total < MOTION_FIFO_MAX_SAMPLES);
+
+    if (drained.samples > 0 || drained.overruns > 0)
+    {
+        portENTER_CRITICAL(&snapshot_lock);
+        merge_motion_window(&motion_window, &drained);
+        portEXIT_CRITICAL(&snapshot_lock);
+    }
+
+    if (count > 0)
+    {
+        accel_to_pitch_roll(&samples[count - 1], &snapshot->pitch, &snapshot->roll,
+                            &snapshot->accel_x, &snapshot->accel_y, &snapshot->accel_z);
+    }
+}
+
+static void sample_due_sensors(sensor_snapshot_t *snapshot, TickType_t now, TickType_t *next_due, bool all)
+{
+    static const TickType_t periods[SAMPLING_GROUP_COUNT] =
+    {
+        pdMS_TO_TICKS(HUMITURE_PERIOD_MS),
+        pdMS_TO_TICKS(AMBIENT_LIGHT_PERIOD_MS),
+        pdMS_TO_TICKS(BAROMETER_PERIOD_MS),
+        pdMS_TO_TICKS(MAGNETOMETER_PERIOD_MS),
+        pdMS_TO_TICKS(MOTION_PERIOD_MS)
+    };
+    bool updated = false;
+
+    for (uint32_t i = 0; i < SAMPLING_GROUP_COUNT; i++)
+    {
+        if (!all && ((int32_t)(now - next_due[i]) < 0 || (interrupt_groups & (1U << i)) != 0))
+        {
+            continue;
+        }
+
+        switch (i)
+        {
+        case HUMITURE_GROUP:
+            if (all || HUMITURE_ODR != HTS221_ODR_ONE_SHOT)
+            {
+                get_temperature_humidity(&snapshot->temperature, &snapshot->humidity);
+            }
+            else
+            {
+                /* Read by collect_humiture(), or on the data-ready interrupt. */
+                humiture_converting = iot_hts221_start_oneshot(hts221) == ESP_OK;
+            }
+            break;
+        case 1:
+            snapshot->ambient_light = get_ambientLight();
+            break;
+        case 2:
+            if (all)
+            {
+                get_pressure_altitude(&snapshot->pressure, &snapshot->altitude);
+            }
+            else
+            {
+                /* Collected below, or on a later pass. */
+                barometer_converting = fbm320_start_conversion(fbm320) == ESP_OK;
+            }
+            break;
+        case 3:
+            get_magnetometer(&snapshot->magnetometer_x, &snapshot->magnetometer_y, &snapshot->magnetometer_z);
+            break;
+        default:
+            if (motion_fifo_enabled)
+            {
+                sample_motion_fifo(snapshot);
+            }
+            else
+            {
+                get_pitch_roll_accel(&snapshot->pitch, &snapshot->roll,
+                                     &snapshot->accel_x, &snapshot->accel_y, &snapshot->accel_z);
+            }
+            break;
+        }
+
+        next_due[i] = now + periods[i];
+        updated = true;
+    }
+
+    if (collect_pressure_altitude(snapshot))
+    {
+        updated = true;
+    }
+
+    if (collect_humiture(snapshot))
+    {
+        updated = true;
+    }
+
+    if (updated)
+    {
+        snapshot->sequence++;
+        publish_snapshot(snapshot);
+    }
+}
+
+/* Reads the sensors whose data-ready interrupts notified the sampling task. */
+static void sample_notified_sensors(sensor_snapshot_t *snapshot, uint32_t notified)
+{
+    if ((notified & MOTION_NOTIFY_BIT) != 0)
+    {
+        sample_motion_fifo(snapshot);
+    }
+
+#ifdef MAGNETOMETER_INT_IO
+    if ((notified & MAGNETOMETER_NOTIFY_BIT) != 0)
+    {
+        /* Reading the sample lowers the pin, so its interrupt is enabled again after. */
+        read_magnetometer(snapshot);
+        gpio_intr_enable(MAGNETOMETER_INT_IO);
+    }
+#endif
+
+#ifdef HUMITURE_INT_IO
+    if ((notified & HUMITURE_NOTIFY_BIT) != 0)
+    {
+        /* As the MAG3110's, the pin stays high until the output is read. */
+        humiture_converting = false;
+        read_humiture(&snapshot->temperature, &snapshot->humidity);
+        gpio_intr_enable(HUMITURE_INT_IO);
+    }
+#endif
+
+    snapshot->sequence++;
+    publish_snapshot(snapshot);
+}
+
+static void sensor_sampling_task(void *parameters)
+{
+    sensor_snapshot_t *snapshot = (sensor_snapshot_t *)parameters;
+    TickType_t next_due[SAMPLING_GROUP_COUNT];
+    TickType_t next_pass = xTaskGetTickCount();
+    uint32_t notified;
+
+    for (uint32_t i = 0; i < SAMPLING_GROUP_COUNT; i++)
+    {
+        next_due[i] = next_pass;
+    }
+
+    for (;;)
+    {
+        TickType_t now = xTaskGetTickCount();
+
+        /* Woken by the data-ready interrupts, at the output rate of their
+         * sensors, and on the schedule of the others. */
+        notified = 0;
+        if ((int32_t)(next_pass - now) > 0)
+        {
+            xTaskNotifyWait(0, UINT32_MAX, &notified, next_pass - now);
+        }
+#ifdef CONFIG_AZURE_IOT_ULP_SENSORS
+        if (sampling_stopping)
+        {
+            xTaskNotifyGive(sampling_stopper);
+            vTaskSuspend(NULL);
+        }
+#endif
+        if (notified != 0)
+        {
+            sample_notified_sensors(snapshot, notified);
+        }
+
+        now = xTaskGetTickCount();
+        if ((int32_t)(now - next_pass) >= 0)
+        {
+            next_pass += pdMS_TO_TICKS(SAMPLING_TASK_PERIOD_MS);
+            sample_due_sensors(snapshot, now, next_due, false);
+        }
+    }
+}
+
+#ifdef MOTION_INT_IO
+/* Counts the 50 us pulses of the MPU6050, one a sample, and has the sampling
+ * task drain the FIFO once a burst of them is in it. */
+static void motion_data_ready_isr(void *arg)
+{
+    BaseType_t woken = pdFALSE;
+
+    (void)arg;
+
+    if (++motion_interrupt_samples >= MOTION_NOTIFY_SAMPLES)
+    {
+        motion_interrupt_samples = 0;
+        xTaskNotifyFromISR(sampling_task, MOTION_NOTIFY_BIT, eSetBits, &woken);
+    }
+
+    if (woken == pdTRUE)
+    {
+        portYIELD_FROM_ISR();
+    }
+}
+#endif
+
+#ifdef MAGNETOMETER_INT_IO
+/* The MAG3110 holds its pin high until the sample is read, so the interrupt
+ * is level triggered, and disabled until the sampling task reads it. */
+static void magnetometer_data_ready_isr(void *arg)
+{
+    BaseType_t woken = pdFALSE;
+
+    gpio_intr_disable((gpio_num_t)(uintptr_t)arg);
+    xTaskNotifyFromISR(sampling_task, MAGNETOMETER_NOTIFY_BIT, eSetBits, &woken);
+
+    if (woken == pdTRUE)
+    {
+        portYIELD_FROM_ISR();
+    }
+}
+#endif
+
+#ifdef HUMITURE_INT_IO
+/* DRDY is level triggered too, high until the output registers are read. */
+static void humiture_data_ready_isr(void *arg)
+{
+    BaseType_t woken = pdFALSE;
+
+    gpio_intr_disable((gpio_num_t)(uintptr_t)arg);
+    xTaskNotifyFromISR(sampling_task, HUMITURE_NOTIFY_BIT, eSetBits, &woken);
+
+    if (woken == pdTRUE)
+    {
+        portYIELD_FROM_ISR();
+    }
+}
+#endif
+
+#if defined(MOTION_INT_IO) || defined(MAGNETOMETER_INT_IO) || defined(HUMITURE_INT_IO)
+static bool enable_data_ready_interrupt(gpio_num_t pin, gpio_int_type_t type, gpio_isr_t isr)
+{
+    /* The sensors drive the pin push-pull. */
+    gpio_config_t conf =
+    {
+        .pin_bit_mask = 1ULL << pin,
+        .mode = GPIO_MODE_INPUT,
+        .pull_up_en = GPIO_PULLUP_DISABLE,
+        .pull_down_en = GPIO_PULLDOWN_DISABLE,
+        .intr_type = type
+    };
+    esp_err_t ret;
+
+    if (gpio_config(&conf) != ESP_OK)
+    {
+        return false;
+    }
+
+    /* Other components may have installed the service already. */
+    ret = gpio_install_isr_service(0);
+    if (ret != ESP_OK && ret != ESP_ERR_INVALID_STATE)
+    {
+        return false;
+    }
+
+    return gpio_isr_handler_add(pin, isr, (void *)(uintptr_t)pin) == ESP_OK;
+}
+#endif
+
+/* Called once the sampling task runs, which the interrupts notify. Until
+ * then, and for the sensors whose pins are not wired, it polls them. */
+static void start_data_ready_interrupts()
+{
+#ifdef MOTION_INT_IO
+    if (motion_interrupt_enabled &&
+        enable_data_ready_interrupt(MOTION_INT_IO, GPIO_INTR_POSEDGE, motion_data_ready_isr))
+    {
+        interrupt_groups |= 1U << MOTION_GROUP;
+    }
+#endif
+
+#ifdef MAGNETOMETER_INT_IO
+    if (magnetometer_interrupt_enabled &&
+        enable_data_ready_interrupt(MAGNETOMETER_INT_IO, GPIO_INTR_HIGH_LEVEL, magnetometer_data_ready_isr))
+    {
+        interrupt_groups |= 1U << MAGNETOMETER_GROUP;
+    }
+#endif
+
+#ifdef HUMITURE_INT_IO
+    /* A one-shot conversion is still triggered on the schedule, and read on
+     * the interrupt; a continuous one is only read on the interrupt. */
+    if (humiture_interrupt_enabled &&
+        enable_data_ready_interrupt(HUMITURE_INT_IO, GPIO_INTR_HIGH_LEVEL, humiture_data_ready_isr))
+    {
+        humiture_interrupt_started = true;
+        if (HUMITURE_ODR != HTS221_ODR_ONE_SHOT)
+        {
+            interrupt_groups |= 1U << HUMITURE_GROUP;
+        }
+    }
+#endif
+}
+
+bool start_sensor_sampling()
+{
+    reset_motion_window(&motion_window);
+
+    /* The task's own copy of the readings, which it updates and publishes. */
+    static sensor_snapshot_t working_snapshot;
+    TickType_t next_due[SAMPLING_GROUP_COUNT];
+
+    memset(&working_snapshot, 0, sizeof(working_snapshot));
+    sample_due_sensors(&working_snapshot, xTaskGetTickCount(), next_due, true);
+
+    if (xTaskCreate(sensor_sampling_task, "sensor_sampling", SAMPLING_TASK_STACK_SIZE,
+                    &working_snapshot, SAMPLING_TASK_PRIORITY, &sampling_task) != pdPASS)
+    {
+        return false;
+    }
+
+    start_data_ready_interrupts();
+
+    return true;
+}
+
+void get_sensor_snapshot(sensor_snapshot_t *snapshot)
+{
+    portENTER_CRITICAL(&snapshot_lock);
+    *snapshot = snapshots[front_snapshot];
+    portEXIT_CRITICAL(&snapshot_lock);
+}
+
+/* Fixed point: counts / divisor to micrometres per second squared, rounded. */
+static int32_t counts_to_um_s2(int64_t counts, int64_t divisor)
+{
+    int64_t scaled = counts * STANDARD_GRAVITY_UM_S2;
+    int64_t denominator = accel_lsb_per_g * divisor;
+    int64_t half = denominator / 2;
+
+    return (int32_t)((scaled >= 0 ? scaled + half : scaled - half) / denominator);
+}
+
+static uint32_t isqrt64(uint64_t value)
+{
+    uint64_t root = 0;
+    uint64_t bit = (uint64_t)1 << 62;
+
+    while (bit > value)
+    {
+        bit >>= 2;
+    }
+
+    while (bit != 0)
+    {
+        if (value >= root + bit)
+        {
+            value -= root + bit;
+            root = (root >> 1) + bit;
+        }
+        else
+        {
+            root >>= 1;
+        }
+        bit >>= 2;
+    }
+
+    return (uint32_t)root;
+}
+
+bool take_motion_statistics(motion_statistics_t *statistics)
+{
+    motion_window_t window;
+
+    portENTER_CRITICAL(&snapshot_lock);
+    window = motion_window;
+    reset_motion_window(&motion_window);
+    portEXIT_CRITICAL(&snapshot_lock);
+
+    memset(statistics, 0, sizeof(*statistics));
+    statistics->samples = window.samples;
+    statistics->overruns = window.overruns;
+
+    if (window.samples == 0)
+    {
+        return false;
+    }
+
+    for (uint32_t axis = 0; axis < 3; axis++)
+    {
+        /* The root is taken in 1/16 of a count: x 256 under it. */
+        uint32_t rms_x16 = isqrt64((window.sum_squares[axis] << 8) / window.samples);
+
+        statistics->min[axis] = counts_to_um_s2(window.min[axis], 1);
+        statistics->max[axis] = counts_to_um_s2(window.max[axis], 1);
+        statistics->mean[axis] = counts_to_um_s2(window.sum[axis], window.samples);
+        statistics->rms[axis] = counts_to_um_s2(rms_x16, 16);
+    }
+
+    return true;
+}
+
+uint32_t take_motion_samples(int32_t (*samples)[3], uint32_t max_samples, uint32_t *first_age_ms, bool *restarted)
+{
+    uint32_t count = 0;
+
+    *first_age_ms = 0;
+    *restarted = false;
+
+#ifdef CONFIG_AZURE_IOT_TELEMETRY_TIME_SERIES
+    static mpu6050_acceleration_t taken[MOTION_RING_SAMPLES];
+
+    portENTER_CRITICAL(&snapshot_lock);
+    count = ring_count < max_samples ? ring_count : max_samples;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        taken[i] = motion_ring[(ring_first + i) % MOTION_RING_SAMPLES];
+    }
+    if (count > 0)
+    {
+        /* The newest sample was taken when the ring was last filled. */
+        *first_age_ms = (uint32_t)((xTaskGetTickCount() - ring_newest_tick) * portTICK_PERIOD_MS) +
+                        (ring_count - 1) * MOTION_SAMPLE_PERIOD_MS;
+        *restarted = ring_restarted;
+        ring_restarted = false;
+    }
+    ring_first = (ring_first + count) % MOTION_RING_SAMPLES;
+    ring_count -= count;
+    portEXIT_CRITICAL(&snapshot_lock);
+
+    /* Converted outside the lock. */
+    for (uint32_t i = 0; i < count; i++)
+    {
+        samples[i][0] = counts_to_um_s2(taken[i].accel_x, 1000);
+        samples[i][1] = counts_to_um_s2(taken[i].accel_y, 1000);
+        samples[i][2] = counts_to_um_s2(taken[i].accel_z, 1000);
+    }
+#else
+    (void)samples;
+    (void)max_samples;
+#endif
+
+    return count;
+}
+
+#ifdef CONFIG_AZURE_IOT_ULP_SENSORS
+static void init_ulp_pin(gpio_num_t pin)
+{
+    /* The output is held low, and driven by enabling it. */
+    rtc_gpio_init(pin);
+    rtc_gpio_set_direction(pin, RTC_GPIO_MODE_INPUT_ONLY);
+    rtc_gpio_set_level(pin, 0);
+    rtc_gpio_pullup_en(pin);
+    rtc_gpio_pulldown_dis(pin);
+}
+
+bool start_ulp_sampling(uint32_t period_ms, uint32_t batch_samples, float light_threshold_lux)
+{
+    sensor_snapshot_t snapshot;
+
+    if (batch_samples == 0 || batch_samples > ULP_MAX_SAMPLES)
+    {
+        return false;
+    }
+
+    if (sampling_task != NULL)
+    {
+        sampling_stopper = xTaskGetCurrentTaskHandle();
+        sampling_stopping = true;
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(SAMPLING_TASK_PERIOD_MS * 10));
+    }
+
+    get_sensor_snapshot(&snapshot);
+
+    /* Only the HTS221 and the BH1750 are read by the ULP program; the others
+     * are powered down, and the two it reads convert on demand. */
+    mpu6050_set_sleep_enabled(mpu6050, true);
+    mag3110_enter_standby(mag3110);
+    iot_hts221_set_odr(hts221, HTS221_ODR_ONE_SHOT);
+    iot_hts221_start_oneshot(hts221);
+    iot_bh1750_set_measure_mode(bh1750, BH1750_ONETIME_1LX_RES);
+
+    if (ulp_load_binary(0, ulp_sensors_bin_start,
+                        (ulp_sensors_bin_end - ulp_sensors_bin_start) / sizeof(uint32_t)) != ESP_OK)
+    {
+        return false;
+    }
+
+    ulp_sample_max = batch_samples;
+    ulp_light_threshold = (uint32_t)(light_threshold_lux * BH1750_COUNTS_PER_LUX);
+    ulp_light_sent = (uint32_t)(snapshot.ambient_light * BH1750_COUNTS_PER_LUX);
+
+    init_ulp_pin(I2C_MASTER_SDA_IO);
+    init_ulp_pin(I2C_MASTER_SCL_IO);
+    esp_sleep_pd_config(ESP_PD_DOMAIN_RTC_PERIPH, ESP_PD_OPTION_ON);
+
+    if (ulp_set_wakeup_period(0, period_ms * 1000) != ESP_OK ||
+        ulp_run(&ulp_entry - RTC_SLOW_MEM) != ESP_OK ||
+        esp_sleep_enable_ulp_wakeup() != ESP_OK)
+    {
+        return false;
+    }
+
+    ulp_sampling = true;
+
+    return true;
+}
+
+uint32_t take_ulp_samples(ulp_sample_t *samples, uint32_t max_samples, uint32_t *bus_errors)
+{
+    hts221_calibration_t calibration;
+    const volatile uint32_t *taken = &ulp_samples;
+    uint32_t count;
+
+    *bus_errors = 0;
+
+    if (!ulp_sampling || iot_hts221_get_calibration(hts221, &calibration) != ESP_OK)
+    {
+        return 0;
+    }
+
+    ulp_sampling = false;
+
+    /* The ULP program keeps its values in the lower half of each word. */
+    count = ulp_sample_count & UINT16_MAX;
+    count = count < ULP_MAX_SAMPLES ? count : ULP_MAX_SAMPLES;
+    count = count < max_samples ? count : max_samples;
+    *bus_errors = ulp_bus_errors & UINT16_MAX;
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        const volatile uint32_t *words = &taken[i * ULP_WORDS_PER_SAMPLE];
+
+        samples[i].humidity = iot_hts221_calibrate_humidity(&calibration, (int16_t)(words[0] & UINT16_MAX));
+        samples[i].temperature = iot_hts221_calibrate_temperature(&calibration, (int16_t)(words[1] & UINT16_MAX));
+        samples[i].ambient_light = (uint16_t)((words[2] & UINT16_MAX) / BH1750_COUNTS_PER_LUX);
+    }
+
+    return count;
+}
+#else
+bool start_ulp_sampling(uint32_t period_ms, uint32_t batch_samples, float light_threshold_lux)
+{
+    (void)period_ms;
+    (void)batch_samples;
+    (void)light_threshold_lux;
+
+    return false;
+}
+
+uint32_t take_ulp_samples(ulp_sample_t *samples, uint32_t max_samples, uint32_t *bus_errors)
+{
+    (void)samples;
+    (void)max_samples;
+    *bus_errors = 0;
+
+    return 0;
+}
+#endif
@@ -5,17 +5,66 @@
 #define SENSOR_MANAGER_H
 
 #include <inttypes.h>
+#include <stdbool.h>
 
 #define LED_STATE_ON  1
 #define LED_STATE_OFF 0
 
 #define OLED_DISPLAY_MAX_STRING_LENGTH 48
 
+#define MOTION_SAMPLE_PERIOD_MS 5   /* the accelerometer FIFO runs at 200 Hz */
+
 #ifdef __cplusplus
 extern "C"
 {
 #endif
 
+    /**
+     * @brief The latest readings of all the sensors, as taken by the sampling task.
+     */
+    typedef struct sensor_snapshot
+    {
+        float temperature;
+        float humidity;
+        float ambient_light;
+        float pressure;
+        float altitude;
+        int magnetometer_x;
+        int magnetometer_y;
+        int magnetometer_z;
+        int pitch;
+        int roll;
+        int accel_x;
+        int accel_y;
+        int accel_z;
+        uint32_t sequence;   /* Incremented each time a reading is updated. */
+    } sensor_snapshot_t;
+
+    /**
+     * @brief Statistics of the accelerometer samples captured since they were last taken.
+     *
+     * Values are per axis (X, Y, Z), in micrometres per second squared.
+     */
+    typedef struct motion_statistics
+    {
+        uint32_t samples;    /* Samples in the window; 0 when the FIFO capture is not running. */
+        uint32_t overruns;   /* Times the FIFO overflowed and samples were lost. */
+        int32_t min[3];
+        int32_t max[3];
+        int32_t mean[3];
+        int32_t rms[3];
+    } motion_statistics_t;
+
+    /**
+     * @brief A reading the ULP coprocessor took during the deep sleep.
+     */
+    typedef struct ulp_sample
+    {
+        int16_t temperature;     /* In tenths of Celsius. */
+        int16_t humidity;        /* In tenths of percentage points. */
+        uint16_t ambient_light;  /* In lux. */
+    } ulp_sample_t;
+
     /**
      * API for interacting with sensors and other peripherals of the Espressif ESP32 Azure IoT Kit board.
      * For more details about the device, please refer to the original documenation at
@@ -27,6 +76,83 @@ extern "C"
      */
     void initialize_sensors();
 
+    /**
+     * @brief Starts a task that reads the sensors, each one on its own schedule, into a snapshot.
+     *
+     * All the sensors are read once before it returns, so the first snapshot is complete.
+     * The MPU6050 and the MAG3110 are read when their data-ready interrupts fire, at their output rates,
+     * when CONFIG_AZURE_IOT_MPU6050_INT_GPIO and CONFIG_AZURE_IOT_MAG3110_INT_GPIO give the GPIOs their INT
+     * pins are wired to, and polled otherwise. Call it once, after initialize_sensors().
+     *
+     * @return true if the task was started.
+     */
+    bool start_sensor_sampling();
+
+    /**
+     * @brief Copies the latest readings taken by the sampling task.
+     *
+     * It does not wait on the I2C bus, so it can be called from the network task.
+     *
+     * @param[out] snapshot  The readings.
+     */
+    void get_sensor_snapshot(sensor_snapshot_t *snapshot);
+
+    /**
+     * @brief Takes the statistics of the accelerometer samples captured since the last call, and starts a new window.
+     *
+     * The sampling task drains the MPU6050 FIFO, filled at 200 Hz, so the statistics cover every sample
+     * and not only those taken when telemetry is sent.
+     *
+     * @param[out] statistics  The statistics of the window.
+     * @return true if the window has samples.
+     */
+    bool take_motion_statistics(motion_statistics_t *statistics);
+
+    /**
+     * @brief Takes the oldest accelerometer samples the sampling task kept from the FIFO.
+     *
+     * The samples are MOTION_SAMPLE_PERIOD_MS apart, oldest first, per axis (X, Y, Z), in millimetres per
+     * second squared. They are kept only when CONFIG_AZURE_IOT_TELEMETRY_TIME_SERIES is set; up to about
+     * two seconds of them, after which they are dropped, as they are when the FIFO overflows.
+     *
+     * @param[out] samples           Buffer for the samples.
+     * @param[in]  max_samples       Samples \p samples holds.
+     * @param[out] first_age_ms      How long ago the first sample was taken.
+     * @param[out] restarted         true when samples were dropped before the first one.
+     * @return The number of samples taken.
+     */
+    uint32_t take_motion_samples(int32_t (*samples)[3], uint32_t max_samples, uint32_t *first_age_ms, bool *restarted);
+
+    /**
+     * @brief Hands the HTS221 and the BH1750 to the ULP coprocessor, which reads them every \p period_ms through
+     * the deep sleep that should follow.
+     *
+     * The sampling task is stopped and the other sensors are powered down. The ULP program keeps the readings in
+     * RTC slow memory, and wakes the main cores once it has \p batch_samples of them, or once the light is
+     * \p light_threshold_lux or more from that of the latest snapshot. Only when
+     * CONFIG_AZURE_IOT_ULP_SENSORS is set.
+     *
+     * @param[in] period_ms            Time between the readings.
+     * @param[in] batch_samples        Readings to keep before waking, up to 64.
+     * @param[in] light_threshold_lux  Change of the light to wake on; 0 not to.
+     * @return true if the ULP program was started, and wakes the main cores.
+     */
+    bool start_ulp_sampling(uint32_t period_ms, uint32_t batch_samples, float light_threshold_lux);
+
+    /**
+     * @brief Takes the readings the ULP coprocessor kept during the deep sleep, oldest first.
+     *
+     * Call it once after a wake, after initialize_sensors(), which reads the HTS221 calibration the readings are
+     * converted with. The last reading was taken just before the wake, and each one start_ulp_sampling()'s
+     * period after the one before.
+     *
+     * @param[out] samples      Buffer for the readings.
+     * @param[in]  max_samples  Readings \p samples holds.
+     * @param[out] bus_errors   Runs of the ULP program a sensor did not answer in, so did not keep a reading.
+     * @return The number of readings taken; 0 after a cold boot.
+     */
+    uint32_t take_ulp_samples(ulp_sample_t *samples, uint32_t max_samples, uint32_t *bus_errors);
+
     /**
      * @brief Reads the temperature currently measured by the built-in ST HTS221 sensor.
      * 
@@ -41,6 +167,16 @@ extern "C"
      */
     float get_humidity();
 
+    /**
+     * @brief Reads the temperature and relative humidity of one conversion of the built-in ST HTS221 sensor.
+     *
+     * In the one-shot mode, CONFIG_AZURE_IOT_HTS221_ODR 0, starts the conversion and waits for it.
+     *
+     * @param[out] temperature Temperature in Celsius.
+     * @param[out] humidity    Relative humidity in percentage points.
+     */
+    void get_temperature_humidity(float *temperature, float *humidity);
+
     /**
      * @brief Reads the ambient iluminance currently measured by the built-in ROHM BH1750FVI sensor.
      * 
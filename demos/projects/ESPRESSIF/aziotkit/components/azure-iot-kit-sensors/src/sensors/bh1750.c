@@ -28,9 +28,15 @@
 #define BH1750_POWER_ON          0x01    /*!< Command to set Power On*/
 #define BH1750_DATA_REG_RESET    0x07    /*!< Command to reset data register, not acceptable in power down mode*/
 
+#define BH1750_L_RES_MAX_TIME_MS    24   /*!< longest L-resolution conversion */
+#define BH1750_H_RES_MAX_TIME_MS    180  /*!< longest H-resolution conversion */
+
 typedef struct {
     i2c_bus_handle_t bus;
     uint16_t dev_addr;
+    bool continuous;                      /*!< measuring continuously since iot_bh1750_start_continuous() */
+    bh1750_cmd_measure_t continuous_mode;
+    TickType_t first_conversion_tick;     /*!< when the first continuous conversion is done */
 } bh1750_dev_t;
 
 bh1750_handle_t iot_bh1750_create(i2c_bus_handle_t bus, uint16_t dev_addr)
@@ -55,6 +61,7 @@ esp_err_t iot_bh1750_delete(bh1750_handle_t sensor, bool del_bus)
 esp_err_t iot_bh1750_power_down(bh1750_handle_t sensor)
 {    
     bh1750_dev_t* sens = (bh1750_dev_t*) sensor;
+    sens->continuous = false;
     i2c_cmd_handle_t cmd = i2c_cmd_link_create();
     i2c_master_start(cmd);
     i2c_master_write_byte(cmd, (sens->dev_addr << 1) | WRITE_BIT, ACK_CHECK_EN);
@@ -127,9 +134,9 @@ esp_err_t iot_bh1750_set_measure_mode(bh1750_handle_t sensor, bh1750_cmd_measure
     return ret;
 }
 
-esp_err_t iot_bh1750_get_data(bh1750_handle_t sensor, float* data)
+/* Reads the data register: the 2 bytes of the last conversion. */
+static esp_err_t bh1750_read_data_register(bh1750_dev_t* sens, uint16_t* raw)
 {
-    bh1750_dev_t* sens = (bh1750_dev_t*) sensor;
     uint8_t bh1750_data_h, bh1750_data_l;
     i2c_cmd_handle_t cmd = i2c_cmd_link_create();
     i2c_master_start(cmd);
@@ -139,10 +146,64 @@ esp_err_t iot_bh1750_get_data(bh1750_handle_t sensor, float* data)
     i2c_master_stop(cmd);
     int ret = iot_i2c_bus_cmd_begin(sens->bus, cmd, 1000 / portTICK_RATE_MS);
     i2c_cmd_link_delete(cmd);
-    if (ret == ESP_FAIL) {
-        return ESP_FAIL;
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    *raw = (uint16_t)(bh1750_data_h << 8 | bh1750_data_l);
+    return ESP_OK;
+}
+
+esp_err_t iot_bh1750_get_data(bh1750_handle_t sensor, float* data)
+{
+    bh1750_dev_t* sens = (bh1750_dev_t*) sensor;
+    uint16_t raw;
+    int ret = bh1750_read_data_register(sens, &raw);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    *data = (raw / BH_1750_MEASUREMENT_ACCURACY);
+    return ESP_OK;
+}
+
+esp_err_t iot_bh1750_start_continuous(bh1750_handle_t sensor, bh1750_cmd_measure_t cmd_measure)
+{
+    bh1750_dev_t* sens = (bh1750_dev_t*) sensor;
+    if ((cmd_measure != BH1750_CONTINUE_1LX_RES) && (cmd_measure != BH1750_CONTINUE_HALFLX_RES) &&
+        (cmd_measure != BH1750_CONTINUE_4LX_RES)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    sens->continuous = false;
+    int ret = iot_bh1750_power_on(sensor);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    ret = iot_bh1750_set_measure_mode(sensor, cmd_measure);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    sens->continuous = true;
+    sens->continuous_mode = cmd_measure;
+    sens->first_conversion_tick = xTaskGetTickCount() +
+        pdMS_TO_TICKS(cmd_measure == BH1750_CONTINUE_4LX_RES ? BH1750_L_RES_MAX_TIME_MS : BH1750_H_RES_MAX_TIME_MS);
+    return ESP_OK;
+}
+
+esp_err_t iot_bh1750_read_continuous(bh1750_handle_t sensor, float* data)
+{
+    bh1750_dev_t* sens = (bh1750_dev_t*) sensor;
+    uint16_t raw;
+    if (!sens->continuous || (int32_t)(xTaskGetTickCount() - sens->first_conversion_tick) < 0) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    int ret = bh1750_read_data_register(sens, &raw);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    /* H-resolution mode2 counts half lux. */
+    *data = (raw / BH_1750_MEASUREMENT_ACCURACY);
+    if (sens->continuous_mode == BH1750_CONTINUE_HALFLX_RES) {
+        *data /= 2;
     }
-    *data = (( bh1750_data_h << 8 | bh1750_data_l ) / BH_1750_MEASUREMENT_ACCURACY);
     return ESP_OK;
 }
 
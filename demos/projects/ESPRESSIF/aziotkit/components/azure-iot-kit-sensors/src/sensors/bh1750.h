@@ -108,6 +108,35 @@ esp_err_t iot_bh1750_get_data(bh1750_handle_t sensor, float* data);
  */
 esp_err_t iot_bh1750_get_light_intensity(bh1750_handle_t sensor, bh1750_cmd_measure_t cmd_measure, float* data);
 
+/**
+ * @brief Start continuous measurement, for iot_bh1750_read_continuous()
+ *
+ * @param sensor object handle of bh1750
+ * @param cmd_measure one of the continuous measurement modes
+ *
+ * @return
+ *     - ESP_OK Success
+ *     - ESP_ERR_INVALID_ARG cmd_measure is a onetime mode
+ *     - ESP_FAIL Fail
+ * @note
+ *        The sensor is powered on and then converts on its own, every 16 ms in L-resolution mode and
+ *        every 120 ms in the H-resolution modes, so reads need not wait for a conversion.
+ */
+esp_err_t iot_bh1750_start_continuous(bh1750_handle_t sensor, bh1750_cmd_measure_t cmd_measure);
+
+/**
+ * @brief Get the latest conversion of continuous measurement, with a single read and no delay
+ *
+ * @param sensor object handle of bh1750
+ * @param data light intensity value got from bh1750, in lux
+ *
+ * @return
+ *     - ESP_OK Success
+ *     - ESP_ERR_INVALID_STATE iot_bh1750_start_continuous() was not called, or the first conversion is not done yet
+ *     - ESP_FAIL Fail
+ */
+esp_err_t iot_bh1750_read_continuous(bh1750_handle_t sensor, float* data);
+
 /**
  * @brief Change measurement time
  *
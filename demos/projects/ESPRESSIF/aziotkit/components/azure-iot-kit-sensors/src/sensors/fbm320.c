@@ -269,27 +269,102 @@ exit:
 
 /**
  * @brief      { API for triggering measurement procedure and updating
- *               the temperature and pressure data in fbm320_data structure. }
+ *               the temperature and pressure data in fbm320_data structure.
+ *               It waits only the conversion times of the oversampling rate. }
  */
 esp_err_t fbm320_update_data(fbm320_handle_t sensor)
 {
 	esp_err_t ret;
+	bool done = false;
+
+	ret = fbm320_start_conversion(sensor);
+	while (ret == ESP_OK && !done)
+	{
+		vTaskDelay(fbm320_conversion_ticks_left(sensor));
+		ret = fbm320_collect(sensor, &done);
+	}
+	return ret;
+}
+
+/**
+ * @brief      { Tick the conversion measured from now is done by. A tick may
+ *               already be partly over, so one more is counted. }
+ */
+static TickType_t fbm320_ready_tick(uint32_t cnvTime_us)
+{
+	const uint32_t tick_us = portTICK_PERIOD_MS * 1000;
+	return xTaskGetTickCount() + (cnvTime_us + tick_us - 1) / tick_us + 1;
+}
+
+esp_err_t fbm320_start_conversion(fbm320_handle_t sensor)
+{
+	esp_err_t ret;
+
+	barom->conversion_state = fbm320_idle;
 	ret = fbm320_startMeasure_temp(sensor);
-	if (ret < 0)
-		goto exit;
-	vTaskDelay(10 / portTICK_RATE_MS);
-	ret = fbm320_get_raw_temperature(sensor);
-	if (ret < 0)
-		goto exit;
-	ret = fbm320_startMeasure_press(sensor);
-	if (ret < 0)
-		goto exit;
-	vTaskDelay(30 / portTICK_RATE_MS);
+	if (ret != ESP_OK)
+	{
+		return ret;
+	}
+	barom->conversion_ready_tick = fbm320_ready_tick(barom->cnvTime_temp);
+	barom->conversion_state = fbm320_converting_temp;
+
+	return ESP_OK;
+}
+
+TickType_t fbm320_conversion_ticks_left(fbm320_handle_t sensor)
+{
+	int32_t left = (int32_t)(barom->conversion_ready_tick - xTaskGetTickCount());
+
+	if (barom->conversion_state == fbm320_idle || left < 0)
+	{
+		return 0;
+	}
+	return (TickType_t)left;
+}
+
+esp_err_t fbm320_collect(fbm320_handle_t sensor, bool *done)
+{
+	esp_err_t ret;
+
+	*done = false;
+	if (barom->conversion_state == fbm320_idle)
+	{
+		return ESP_ERR_INVALID_STATE;
+	}
+	if (fbm320_conversion_ticks_left(sensor) > 0)
+	{
+		return ESP_OK;
+	}
+
+	/* A failed step leaves the sensor idle, to be started again. */
+	if (barom->conversion_state == fbm320_converting_temp)
+	{
+		barom->conversion_state = fbm320_idle;
+		ret = fbm320_get_raw_temperature(sensor);
+		if (ret != ESP_OK)
+		{
+			return ret;
+		}
+		ret = fbm320_startMeasure_press(sensor);
+		if (ret != ESP_OK)
+		{
+			return ret;
+		}
+		barom->conversion_ready_tick = fbm320_ready_tick(barom->cnvTime_press);
+		barom->conversion_state = fbm320_converting_press;
+		return ESP_OK;
+	}
+
+	barom->conversion_state = fbm320_idle;
 	ret = fbm320_get_raw_pressure(sensor);
-	if (ret < 0)
-		goto exit;
-exit:
-	return ret;
+	if (ret != ESP_OK)
+	{
+		return ret;
+	}
+	*done = true;
+
+	return ESP_OK;
 }
 
 /**
@@ -61,6 +61,12 @@ enum fbm320_osr {
 	osr_16384 = 0x4
 };
 
+enum fbm320_conversion_state {
+	fbm320_idle = 0,
+	fbm320_converting_temp,
+	fbm320_converting_press
+};
+
 enum fbm320_hw_version {
 	hw_ver_b1 = 0x0,
 	hw_ver_b2 = 0x1,
@@ -80,6 +86,8 @@ struct fbm320_data {
 	uint32_t raw_pressure;
 	int32_t real_temperature; //unit:0.01 degree Celsisu
 	int32_t real_pressure; //unit: Pa
+	enum fbm320_conversion_state conversion_state;
+	TickType_t conversion_ready_tick;
 };
 
 /**
@@ -165,6 +173,46 @@ esp_err_t fbm320_read_pressure(fbm320_handle_t sensor, float* real_pressure);
  */
 esp_err_t fbm320_update_data(fbm320_handle_t sensor);
 
+/**
+ * @brief Start a temperature then pressure conversion, without waiting for it
+ *
+ * Call fbm320_collect() until it is done, then fbm320_read_data(). Starting
+ * again abandons a conversion that is not collected yet.
+ *
+ * @param sensor object handle of fbm320
+ *
+ * @return
+ *     - ESP_OK Success
+ *     - ESP_FAIL Fail
+ */
+esp_err_t fbm320_start_conversion(fbm320_handle_t sensor);
+
+/**
+ * @brief Move a started conversion on, without waiting
+ *
+ * Reads the temperature once its conversion time for the oversampling rate has
+ * passed and starts the pressure conversion, then reads the pressure once that
+ * one has too. Returns ESP_OK with done false while a conversion is running.
+ *
+ * @param sensor object handle of fbm320
+ * @param done true once the raw temperature and pressure are both read
+ *
+ * @return
+ *     - ESP_OK Success
+ *     - ESP_ERR_INVALID_STATE No conversion is started
+ *     - ESP_FAIL Fail
+ */
+esp_err_t fbm320_collect(fbm320_handle_t sensor, bool *done);
+
+/**
+ * @brief Ticks until the running conversion step is due
+ *
+ * @param sensor object handle of fbm320
+ *
+ * @return 0 if it is due, or no conversion is running
+ */
+TickType_t fbm320_conversion_ticks_left(fbm320_handle_t sensor);
+
 /**
  * @brief Converting pressure value to altitude
  *
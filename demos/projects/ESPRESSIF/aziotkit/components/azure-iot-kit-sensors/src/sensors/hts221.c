@@ -21,6 +21,7 @@
 #define ACK_CHECK_DIS  0x0               /*!< I2C master will not check ack from slave */
 #define ACK_VAL        0x0               /*!< I2C ack value */
 #define NACK_VAL       0x1               /*!< I2C nack value */
+#define AUTO_INCREMENT 0x80              /*!< Register address bit for multi-byte reads */
 
 typedef struct {
     i2c_bus_handle_t bus;
@@ -83,16 +84,12 @@ esp_err_t iot_hts221_read_byte(hts221_handle_t sensor, uint8_t reg, uint8_t *dat
 
 esp_err_t iot_hts221_read(hts221_handle_t sensor, uint8_t reg_start_addr, uint8_t reg_num, uint8_t *data_buf)
 {
-    uint32_t i = 0;
-    uint8_t data_t = 0;
-    if (data_buf != NULL) {
-        for(i=0; i<reg_num; i++){
-            iot_hts221_read_byte(sensor, reg_start_addr+i, &data_t);
-            data_buf[i] = data_t;
-        }
-        return ESP_OK;
-    } 
-    return ESP_FAIL;  
+    hts221_dev_t* sens = (hts221_dev_t*) sensor;
+    i2c_bus_read_block_t block = { reg_start_addr, reg_num, data_buf };
+    if (data_buf == NULL || reg_num == 0) {
+        return ESP_FAIL;
+    }
+    return iot_i2c_bus_read_blocks(sens->bus, sens->dev_addr, &block, 1, AUTO_INCREMENT, 1000 / portTICK_RATE_MS);
 }
 
 esp_err_t iot_hts221_get_deviceid(hts221_handle_t sensor, uint8_t* deviceid)
@@ -319,23 +316,27 @@ esp_err_t iot_hts221_get_raw_humidity(hts221_handle_t sensor, int16_t *humidity)
 
 esp_err_t iot_hts221_get_humidity(hts221_handle_t sensor, int16_t *humidity)
 {
+    hts221_dev_t* sens = (hts221_dev_t*) sensor;
     int16_t h0_t0_out, h1_t0_out, h_t_out;
     int16_t h0_rh, h1_rh;
-    uint8_t buffer[2];
+    uint8_t rh_x2[2], h0_out[2], h1_out[2], h_out[2];
     int32_t tmp_32;
-    
-    iot_hts221_read(sensor, HTS221_H0_RH_X2, 2, buffer);
-    h0_rh = buffer[0] >> 1;
-    h1_rh = buffer[1] >> 1;
-    
-    iot_hts221_read(sensor, HTS221_H0_T0_OUT_L, 2, buffer);
-    h0_t0_out = (int16_t)(((uint16_t)buffer[1]) << 8) | (uint16_t)buffer[0];
-
-    iot_hts221_read(sensor, HTS221_H1_T0_OUT_L, 2, buffer);
-    h1_t0_out = (int16_t)(((uint16_t)buffer[1]) << 8) | (uint16_t)buffer[0];
-    
-    iot_hts221_read(sensor, HTS221_HR_OUT_L_REG, 2, buffer);
-    h_t_out = (int16_t)(((uint16_t)buffer[1]) << 8) | (uint16_t)buffer[0];
+    const i2c_bus_read_block_t blocks[] = {
+        { HTS221_H0_RH_X2, 2, rh_x2 },
+        { HTS221_H0_T0_OUT_L, 2, h0_out },
+        { HTS221_H1_T0_OUT_L, 2, h1_out },
+        { HTS221_HR_OUT_L_REG, 2, h_out },
+    };
+
+    if (iot_i2c_bus_read_blocks(sens->bus, sens->dev_addr, blocks, sizeof(blocks) / sizeof(blocks[0]),
+                                AUTO_INCREMENT, 1000 / portTICK_RATE_MS) != ESP_OK) {
+        return ESP_FAIL;
+    }
+    h0_rh = rh_x2[0] >> 1;
+    h1_rh = rh_x2[1] >> 1;
+    h0_t0_out = (int16_t)(((uint16_t)h0_out[1]) << 8) | (uint16_t)h0_out[0];
+    h1_t0_out = (int16_t)(((uint16_t)h1_out[1]) << 8) | (uint16_t)h1_out[0];
+    h_t_out = (int16_t)(((uint16_t)h_out[1]) << 8) | (uint16_t)h_out[0];
     
     tmp_32 = ((int32_t)(h_t_out - h0_t0_out)) * ((int32_t)(h1_rh - h0_rh) * 10);
     if (h1_t0_out - h0_t0_out == 0) {
@@ -359,23 +360,31 @@ esp_err_t iot_hts221_get_raw_temperature(hts221_handle_t sensor, int16_t *temper
 
 esp_err_t iot_hts221_get_temperature(hts221_handle_t sensor, int16_t *temperature)
 {
+    hts221_dev_t* sens = (hts221_dev_t*) sensor;
     int16_t t0_out, t1_out, t_out, t0_degc_x8_u16, t1_degc_x8_u16;
     int16_t t0_degc, t1_degc;
-    uint8_t buffer[4], tmp_8;
+    uint8_t degc_x8[2], tmp_8, t01_out[4], t_raw[2];
     uint32_t tmp_32;
-    iot_hts221_read(sensor, HTS221_T0_DEGC_X8, 2, buffer);
-    iot_hts221_read(sensor, HTS221_T0_T1_DEGC_H2, 1, &tmp_8);
-    t0_degc_x8_u16 = (((uint16_t)(tmp_8 & 0x03)) << 8) | ((uint16_t)buffer[0]);  
-    t1_degc_x8_u16 = (((uint16_t)(tmp_8 & 0x0C)) << 6) | ((uint16_t)buffer[1]);
+    const i2c_bus_read_block_t blocks[] = {
+        { HTS221_T0_DEGC_X8, 2, degc_x8 },
+        { HTS221_T0_T1_DEGC_H2, 1, &tmp_8 },
+        { HTS221_T0_OUT_L, 4, t01_out },
+        { HTS221_TEMP_OUT_L_REG, 2, t_raw },
+    };
+
+    if (iot_i2c_bus_read_blocks(sens->bus, sens->dev_addr, blocks, sizeof(blocks) / sizeof(blocks[0]),
+                                AUTO_INCREMENT, 1000 / portTICK_RATE_MS) != ESP_OK) {
+        return ESP_FAIL;
+    }
+    t0_degc_x8_u16 = (((uint16_t)(tmp_8 & 0x03)) << 8) | ((uint16_t)degc_x8[0]);  
+    t1_degc_x8_u16 = (((uint16_t)(tmp_8 & 0x0C)) << 6) | ((uint16_t)degc_x8[1]);
     t0_degc = t0_degc_x8_u16 >> 3;
     t1_degc = t1_degc_x8_u16 >> 3;
 
-    iot_hts221_read(sensor, HTS221_T0_OUT_L, 4, buffer);
-    t0_out = (((uint16_t)buffer[1]) << 8) | (uint16_t)buffer[0];  
-    t1_out = (((uint16_t)buffer[3]) << 8) | (uint16_t)buffer[2];
+    t0_out = (((uint16_t)t01_out[1]) << 8) | (uint16_t)t01_out[0];  
+    t1_out = (((uint16_t)t01_out[3]) << 8) | (uint16_t)t01_out[2];
 
-    iot_hts221_read(sensor, HTS221_TEMP_OUT_L_REG, 2, buffer);
-    t_out = (((uint16_t)buffer[1]) << 8) | (uint16_t)buffer[0]; 
+    t_out = (((uint16_t)t_raw[1]) << 8) | (uint16_t)t_raw[0]; 
 
     tmp_32 = ((uint32_t)(t_out - t0_out)) * ((uint32_t)(t1_degc - t0_degc) * 10);
     if ((t1_out - t0_out) == 0) {
@@ -385,6 +394,77 @@ esp_err_t iot_hts221_get_temperature(hts221_handle_t sensor, int16_t *temperatur
     return ESP_OK;
 }
 
+esp_err_t iot_hts221_get_raw_humidity_temperature(hts221_handle_t sensor, int16_t *humidity, int16_t *temperature)
+{
+    uint8_t buffer[4];
+    if (iot_hts221_read(sensor, HTS221_HR_OUT_L_REG, 4, buffer) != ESP_OK) {
+        return ESP_FAIL;
+    }
+    *humidity = (int16_t)((((uint16_t)buffer[1]) << 8) | (uint16_t)buffer[0]);
+    *temperature = (int16_t)((((uint16_t)buffer[3]) << 8) | (uint16_t)buffer[2]);
+    return ESP_OK;
+}
+
+esp_err_t iot_hts221_data_ready(hts221_handle_t sensor, bool *ready)
+{
+    uint8_t status;
+    if (iot_hts221_read_byte(sensor, HTS221_STATUS_REG, &status) != ESP_OK) {
+        return ESP_FAIL;
+    }
+    *ready = (status & (HTS221_HDA_MASK | HTS221_TDA_MASK)) == (HTS221_HDA_MASK | HTS221_TDA_MASK);
+    return ESP_OK;
+}
+
+esp_err_t iot_hts221_get_calibration(hts221_handle_t sensor, hts221_calibration_t *calibration)
+{
+    hts221_dev_t* sens = (hts221_dev_t*) sensor;
+    uint8_t rh_x2[2], h0_out[2], h1_out[2], degc_x8[2], tmp_8, t01_out[4];
+    const i2c_bus_read_block_t blocks[] = {
+        { HTS221_H0_RH_X2, 2, rh_x2 },
+        { HTS221_H0_T0_OUT_L, 2, h0_out },
+        { HTS221_H1_T0_OUT_L, 2, h1_out },
+        { HTS221_T0_DEGC_X8, 2, degc_x8 },
+        { HTS221_T0_T1_DEGC_H2, 1, &tmp_8 },
+        { HTS221_T0_OUT_L, 4, t01_out },
+    };
+
+    if (iot_i2c_bus_read_blocks(sens->bus, sens->dev_addr, blocks, sizeof(blocks) / sizeof(blocks[0]),
+                                AUTO_INCREMENT, 1000 / portTICK_RATE_MS) != ESP_OK) {
+        return ESP_FAIL;
+    }
+    calibration->h0_rh_x10 = (rh_x2[0] >> 1) * 10;
+    calibration->h1_rh_x10 = (rh_x2[1] >> 1) * 10;
+    calibration->h0_t0_out = (int16_t)((((uint16_t)h0_out[1]) << 8) | (uint16_t)h0_out[0]);
+    calibration->h1_t0_out = (int16_t)((((uint16_t)h1_out[1]) << 8) | (uint16_t)h1_out[0]);
+    calibration->t0_degc_x10 = (int16_t)(((((uint16_t)(tmp_8 & 0x03)) << 8) | ((uint16_t)degc_x8[0])) >> 3) * 10;
+    calibration->t1_degc_x10 = (int16_t)(((((uint16_t)(tmp_8 & 0x0C)) << 6) | ((uint16_t)degc_x8[1])) >> 3) * 10;
+    calibration->t0_out = (int16_t)((((uint16_t)t01_out[1]) << 8) | (uint16_t)t01_out[0]);
+    calibration->t1_out = (int16_t)((((uint16_t)t01_out[3]) << 8) | (uint16_t)t01_out[2]);
+    if (calibration->h1_t0_out == calibration->h0_t0_out || calibration->t1_out == calibration->t0_out) {
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+int16_t iot_hts221_calibrate_humidity(const hts221_calibration_t *calibration, int16_t raw)
+{
+    int32_t humidity = (int32_t)(raw - calibration->h0_t0_out) * (calibration->h1_rh_x10 - calibration->h0_rh_x10) /
+                       (calibration->h1_t0_out - calibration->h0_t0_out) + calibration->h0_rh_x10;
+    if (humidity > 1000) {
+        humidity = 1000;
+    }
+    if (humidity < 0) {
+        humidity = 0;
+    }
+    return (int16_t)humidity;
+}
+
+int16_t iot_hts221_calibrate_temperature(const hts221_calibration_t *calibration, int16_t raw)
+{
+    return (int16_t)((int32_t)(raw - calibration->t0_out) * (calibration->t1_degc_x10 - calibration->t0_degc_x10) /
+                     (calibration->t1_out - calibration->t0_out) + calibration->t0_degc_x10);
+}
+
 hts221_handle_t iot_hts221_create(i2c_bus_handle_t bus, uint16_t dev_addr)
 {
     hts221_dev_t* sensor = (hts221_dev_t*) calloc(1, sizeof(hts221_dev_t));
@@ -599,6 +599,77 @@ esp_err_t iot_hts221_get_raw_temperature(hts221_handle_t sensor, int16_t *temper
  */
 esp_err_t iot_hts221_get_temperature(hts221_handle_t sensor, int16_t *temperature);
 
+/**
+ * @brief Read the humidity and temperature output registers in one burst, so both are of the same conversion
+ *
+ * @param sensor object handle of hts221
+ * @param humidity pointer to the returned humidity raw value
+ * @param temperature pointer to the returned temperature raw value
+ *
+ * @return
+ *     - ESP_OK Success
+ *     - ESP_FAIL Fail
+ */
+esp_err_t iot_hts221_get_raw_humidity_temperature(hts221_handle_t sensor, int16_t *humidity, int16_t *temperature);
+
+/**
+ * @brief Whether a new humidity and a new temperature are in the output registers
+ *
+ * @param sensor object handle of hts221
+ * @param ready pointer to the returned status, true once both are
+ *
+ * @return
+ *     - ESP_OK Success
+ *     - ESP_FAIL Fail
+ */
+esp_err_t iot_hts221_data_ready(hts221_handle_t sensor, bool *ready);
+
+/**
+ * @brief Calibration of the HTS221, for output values read without the driver
+ */
+typedef struct {
+    int16_t h0_rh_x10;      /*!< Humidity of the first calibration point, in tenths of % */
+    int16_t h1_rh_x10;      /*!< Humidity of the second calibration point, in tenths of % */
+    int16_t h0_t0_out;      /*!< Humidity output at the first calibration point */
+    int16_t h1_t0_out;      /*!< Humidity output at the second calibration point */
+    int16_t t0_degc_x10;    /*!< Temperature of the first calibration point, in tenths of 'C */
+    int16_t t1_degc_x10;    /*!< Temperature of the second calibration point, in tenths of 'C */
+    int16_t t0_out;         /*!< Temperature output at the first calibration point */
+    int16_t t1_out;         /*!< Temperature output at the second calibration point */
+} hts221_calibration_t;
+
+/**
+ * @brief Read the calibration of HTS221
+ *
+ * @param sensor object handle of hts221
+ * @param calibration pointer to the returned calibration
+ *
+ * @return
+ *     - ESP_OK Success
+ *     - ESP_FAIL Fail
+ */
+esp_err_t iot_hts221_get_calibration(hts221_handle_t sensor, hts221_calibration_t *calibration);
+
+/**
+ * @brief Calculate the humidity of a raw output value, as iot_hts221_get_humidity() does
+ *
+ * @param calibration calibration read by iot_hts221_get_calibration()
+ * @param raw humidity output value
+ *
+ * @return humidity, in tenths of %
+ */
+int16_t iot_hts221_calibrate_humidity(const hts221_calibration_t *calibration, int16_t raw);
+
+/**
+ * @brief Calculate the temperature of a raw output value, as iot_hts221_get_temperature() does
+ *
+ * @param calibration calibration read by iot_hts221_get_calibration()
+ * @param raw temperature output value
+ *
+ * @return temperature, in tenths of 'C
+ */
+int16_t iot_hts221_calibrate_temperature(const hts221_calibration_t *calibration, int16_t raw);
+
 /**
  * @brief Create and init sensor object and return a sensor handle
  *
@@ -12,13 +12,21 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 #include <stdio.h>
+#include <stdbool.h>
 #include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
 #include "driver/i2c.h"
 #include "iot_i2c_bus.h"
 
 typedef struct {
     i2c_config_t i2c_conf;   /*!<I2C bus parameters*/
     i2c_port_t i2c_port;     /*!<I2C port number */
+    SemaphoreHandle_t lock;  /*!<Held for the length of a transaction */
+    SemaphoreHandle_t high_idle;  /*!<Given when no high priority transaction is waiting */
+    portMUX_TYPE waiting_lock;    /*!<Guards high_waiting */
+    uint32_t high_waiting;   /*!<High priority transactions waiting for the lock */
 } i2c_bus_t;
 
 static const char* I2C_BUS_TAG = "i2c_bus";
@@ -34,8 +42,15 @@ i2c_bus_handle_t iot_i2c_bus_create(i2c_port_t port, i2c_config_t* conf)
     I2C_BUS_CHECK(port < I2C_NUM_MAX, "I2C port error", NULL);
     I2C_BUS_CHECK(conf != NULL, "Pointer error", NULL);
     i2c_bus_t* bus = (i2c_bus_t*) calloc(1, sizeof(i2c_bus_t));
+    I2C_BUS_CHECK(bus != NULL, "Memory error", NULL);
     bus->i2c_conf = *conf;
     bus->i2c_port = port;
+    bus->waiting_lock = (portMUX_TYPE) portMUX_INITIALIZER_UNLOCKED;
+    bus->lock = xSemaphoreCreateMutex();
+    bus->high_idle = xSemaphoreCreateBinary();
+    if(bus->lock == NULL || bus->high_idle == NULL) {
+        goto error;
+    }
     esp_err_t ret = i2c_param_config(bus->i2c_port, &bus->i2c_conf);
     if(ret != ESP_OK) {
         goto error;
@@ -48,6 +63,12 @@ i2c_bus_handle_t iot_i2c_bus_create(i2c_port_t port, i2c_config_t* conf)
 
     error:
     if(bus) {
+        if(bus->lock) {
+            vSemaphoreDelete(bus->lock);
+        }
+        if(bus->high_idle) {
+            vSemaphoreDelete(bus->high_idle);
+        }
         free(bus);
     }
     return NULL;
@@ -58,14 +79,100 @@ esp_err_t iot_i2c_bus_delete(i2c_bus_handle_t bus)
     I2C_BUS_CHECK(bus != NULL, "Handle error", ESP_FAIL);
     i2c_bus_t* i2c_bus = (i2c_bus_t*) bus;
     i2c_driver_delete(i2c_bus->i2c_port);
+    vSemaphoreDelete(i2c_bus->lock);
+    vSemaphoreDelete(i2c_bus->high_idle);
     free(bus);
     return ESP_OK;
 }
 
-esp_err_t iot_i2c_bus_cmd_begin(i2c_bus_handle_t bus, i2c_cmd_handle_t cmd, portBASE_TYPE ticks_to_wait)
+/* Takes the bus for one transaction. A low priority transaction that gets
+ * the lock while a high priority one is waiting for it hands it over, and
+ * waits for the high priority ones to be done before trying again. */
+static esp_err_t i2c_bus_lock(i2c_bus_t* i2c_bus, i2c_bus_priority_t priority, TickType_t ticks_to_wait)
+{
+    TimeOut_t timeout;
+    TickType_t wait = ticks_to_wait;
+    BaseType_t taken;
+    bool last;
+
+    if (priority == I2C_BUS_PRIORITY_HIGH) {
+        portENTER_CRITICAL(&i2c_bus->waiting_lock);
+        i2c_bus->high_waiting++;
+        portEXIT_CRITICAL(&i2c_bus->waiting_lock);
+        taken = xSemaphoreTake(i2c_bus->lock, wait);
+        portENTER_CRITICAL(&i2c_bus->waiting_lock);
+        last = (--i2c_bus->high_waiting == 0);
+        portEXIT_CRITICAL(&i2c_bus->waiting_lock);
+        if (last) {
+            xSemaphoreGive(i2c_bus->high_idle);
+        }
+        return (taken == pdTRUE) ? ESP_OK : ESP_ERR_TIMEOUT;
+    }
+
+    vTaskSetTimeOutState(&timeout);
+    for (;;) {
+        if (xSemaphoreTake(i2c_bus->lock, wait) != pdTRUE) {
+            return ESP_ERR_TIMEOUT;
+        }
+        portENTER_CRITICAL(&i2c_bus->waiting_lock);
+        last = (i2c_bus->high_waiting == 0);
+        portEXIT_CRITICAL(&i2c_bus->waiting_lock);
+        if (last) {
+            return ESP_OK;
+        }
+        xSemaphoreGive(i2c_bus->lock);
+        if (xTaskCheckForTimeOut(&timeout, &wait) != pdFALSE) {
+            return ESP_ERR_TIMEOUT;
+        }
+        // Also wakes up for a give left over from earlier, the loop checks again
+        xSemaphoreTake(i2c_bus->high_idle, wait);
+        if (xTaskCheckForTimeOut(&timeout, &wait) != pdFALSE) {
+            return ESP_ERR_TIMEOUT;
+        }
+    }
+}
+
+esp_err_t iot_i2c_bus_cmd_begin_with_priority(i2c_bus_handle_t bus, i2c_cmd_handle_t cmd,
+                                              i2c_bus_priority_t priority, portBASE_TYPE ticks_to_wait)
 {
     I2C_BUS_CHECK(bus != NULL, "Handle error", ESP_FAIL);
     I2C_BUS_CHECK(cmd != NULL, "I2C cmd error", ESP_FAIL);
     i2c_bus_t* i2c_bus = (i2c_bus_t*) bus;
-    return i2c_master_cmd_begin(i2c_bus->i2c_port, cmd, ticks_to_wait);
-}
\ No newline at end of file
+    esp_err_t ret = i2c_bus_lock(i2c_bus, priority, ticks_to_wait);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    ret = i2c_master_cmd_begin(i2c_bus->i2c_port, cmd, ticks_to_wait);
+    xSemaphoreGive(i2c_bus->lock);
+    return ret;
+}
+
+esp_err_t iot_i2c_bus_cmd_begin(i2c_bus_handle_t bus, i2c_cmd_handle_t cmd, portBASE_TYPE ticks_to_wait)
+{
+    return iot_i2c_bus_cmd_begin_with_priority(bus, cmd, I2C_BUS_PRIORITY_HIGH, ticks_to_wait);
+}
+
+esp_err_t iot_i2c_bus_read_blocks(i2c_bus_handle_t bus, uint16_t dev_addr,
+                                  const i2c_bus_read_block_t* blocks, size_t block_num,
+                                  uint8_t reg_addr_flags, portBASE_TYPE ticks_to_wait)
+{
+    I2C_BUS_CHECK(bus != NULL, "Handle error", ESP_ERR_INVALID_ARG);
+    I2C_BUS_CHECK(blocks != NULL && block_num > 0, "Blocks error", ESP_ERR_INVALID_ARG);
+    for (size_t i = 0; i < block_num; i++) {
+        I2C_BUS_CHECK(blocks[i].len > 0 && blocks[i].data != NULL, "Block error", ESP_ERR_INVALID_ARG);
+    }
+    i2c_cmd_handle_t cmd = i2c_cmd_link_create();
+    I2C_BUS_CHECK(cmd != NULL, "I2C cmd error", ESP_ERR_NO_MEM);
+    for (size_t i = 0; i < block_num; i++) {
+        i2c_master_start(cmd);
+        i2c_master_write_byte(cmd, (dev_addr << 1) | I2C_MASTER_WRITE, true);
+        i2c_master_write_byte(cmd, blocks[i].reg_addr | reg_addr_flags, true);
+        i2c_master_start(cmd);
+        i2c_master_write_byte(cmd, (dev_addr << 1) | I2C_MASTER_READ, true);
+        i2c_master_read(cmd, blocks[i].data, blocks[i].len, I2C_MASTER_LAST_NACK);
+    }
+    i2c_master_stop(cmd);
+    esp_err_t ret = iot_i2c_bus_cmd_begin(bus, cmd, ticks_to_wait);
+    i2c_cmd_link_delete(cmd);
+    return ret;
+}
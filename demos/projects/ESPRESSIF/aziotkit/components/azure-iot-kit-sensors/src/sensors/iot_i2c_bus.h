@@ -22,6 +22,28 @@ extern "C"
 
 typedef void* i2c_bus_handle_t;
 
+/**
+ * @brief Priority of a transaction on a shared bus
+ *
+ * Transactions run one at a time. One that is low priority does not start
+ * while a high priority one is waiting for the bus, so a client with a lot of
+ * traffic, such as a display, sends it as low priority transactions and
+ * sensor reads only ever wait for the one on the bus.
+ */
+typedef enum {
+    I2C_BUS_PRIORITY_LOW = 0,    /*!< Bulk traffic that can be held back */
+    I2C_BUS_PRIORITY_HIGH,       /*!< Time-critical reads, the default */
+} i2c_bus_priority_t;
+
+/**
+ * @brief A block of consecutive registers read by iot_i2c_bus_read_blocks
+ */
+typedef struct {
+    uint8_t reg_addr;    /*!< Address of the first register */
+    uint8_t len;         /*!< Number of registers, at least 1 */
+    uint8_t* data;       /*!< Buffer for the values read */
+} i2c_bus_read_block_t;
+
 /**
  * @brief Create and init I2C bus and return a I2C bus handle
  *
@@ -45,7 +67,7 @@ i2c_bus_handle_t iot_i2c_bus_create(i2c_port_t port, i2c_config_t* conf);
 esp_err_t iot_i2c_bus_delete(i2c_bus_handle_t bus);
 
 /**
- * @brief I2C start sending buffered commands
+ * @brief I2C start sending buffered commands, as a high priority transaction
  *
  * @param bus I2C bus handle
  * @param cmd I2C cmd handle
@@ -57,6 +79,47 @@ esp_err_t iot_i2c_bus_delete(i2c_bus_handle_t bus);
  */
 esp_err_t iot_i2c_bus_cmd_begin(i2c_bus_handle_t bus, i2c_cmd_handle_t cmd,
 portBASE_TYPE ticks_to_wait);
+
+/**
+ * @brief I2C start sending buffered commands, with a priority
+ *
+ * @param bus I2C bus handle
+ * @param cmd I2C cmd handle
+ * @param priority Priority of the transaction
+ * @param ticks_to_wait Maximum blocking time, for the bus and then for the transfer
+ *
+ * @return
+ *     - ESP_OK Success
+ *     - ESP_FAIL Fail
+ *     - ESP_ERR_TIMEOUT The bus was not free in time
+ */
+esp_err_t iot_i2c_bus_cmd_begin_with_priority(i2c_bus_handle_t bus, i2c_cmd_handle_t cmd,
+                                              i2c_bus_priority_t priority, portBASE_TYPE ticks_to_wait);
+
+/**
+ * @brief Read several blocks of registers of a device in a single transfer
+ *
+ * All the blocks are chained in one command link, each one addressed with a
+ * repeated start, so the bus is taken once for all of them.
+ *
+ * @param bus I2C bus handle
+ * @param dev_addr 7-bit address of the device
+ * @param blocks Blocks to read
+ * @param block_num Number of blocks
+ * @param reg_addr_flags Bits set in each register address, such as the
+ *        auto-increment bit of devices that need one for multi-byte reads
+ * @param ticks_to_wait Maximum blocking time
+ *
+ * @return
+ *     - ESP_OK Success
+ *     - ESP_ERR_INVALID_ARG Parameter error
+ *     - ESP_ERR_NO_MEM Command link could not be created
+ *     - ESP_FAIL The device did not ACK the transfer
+ *     - ESP_ERR_TIMEOUT Operation timeout because the bus is busy
+ */
+esp_err_t iot_i2c_bus_read_blocks(i2c_bus_handle_t bus, uint16_t dev_addr,
+                                  const i2c_bus_read_block_t* blocks, size_t block_num,
+                                  uint8_t reg_addr_flags, portBASE_TYPE ticks_to_wait);
 #ifdef __cplusplus
 }
 #endif
@@ -174,18 +174,17 @@ esp_err_t mag3110_read_axis(mag3110_handle_t sensor, uint8_t axis, uint16_t *val
 
 esp_err_t mag3110_read_mag(mag3110_handle_t sensor, uint16_t *x, uint16_t *y, uint16_t *z)
 {
-	//Read each axis
-	esp_err_t ret;
-	ret = mag3110_read_axis(sensor, MAG3110_OUT_X_MSB, x);
-	if (ret == ESP_FAIL)
-		goto exit;
-	ret = mag3110_read_axis(sensor, MAG3110_OUT_Y_MSB, y);
-	if (ret == ESP_FAIL)
-		goto exit;
-	ret = mag3110_read_axis(sensor, MAG3110_OUT_Z_MSB, z);
-	if (ret == ESP_FAIL)
-		goto exit;
-exit:
+	//Read all axes in one burst; the address auto-increments from OUT_X_MSB to OUT_Z_LSB
+	mag3110_dev_t *sens = (mag3110_dev_t *)sensor;
+	uint8_t data[6];
+	i2c_bus_read_block_t block = { MAG3110_OUT_X_MSB, sizeof(data), data };
+	esp_err_t ret = iot_i2c_bus_read_blocks(sens->bus, sens->dev_addr, &block, 1, 0, 1000 / portTICK_PERIOD_MS);
+	if (ret != ESP_OK)
+		return ret;
+
+	*x = (data[1] | (data[0] << 8));
+	*y = (data[3] | (data[2] << 8));
+	*z = (data[5] | (data[4] << 8));
 	return ret;
 }
 
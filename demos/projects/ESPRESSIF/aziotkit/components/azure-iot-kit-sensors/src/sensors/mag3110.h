@@ -166,6 +166,17 @@ esp_err_t mag3110_data_ready(mag3110_handle_t sensor, bool* ready);
  */
 esp_err_t mag3110_read_mag(mag3110_handle_t sensor, uint16_t *x, uint16_t *y, uint16_t *z);
 
+/**
+ * @brief Stop mag3110 measuring, in its low power standby mode
+ *
+ * @param sensor object handle of mag3110
+ *
+ * @return
+ *     - ESP_OK Success
+ *     - ESP_FAIL Fail
+ */
+esp_err_t mag3110_enter_standby(mag3110_handle_t sensor);
+
 #ifdef __cplusplus
 }
 #endif
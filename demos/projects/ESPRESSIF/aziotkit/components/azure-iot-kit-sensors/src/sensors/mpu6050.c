@@ -4,7 +4,6 @@
 #include "iot_i2c_bus.h"
 #include "mpu6050.h"
 
-void select_register (mpu6050_handle_t sensor, uint8_t register_address);
 int8_t mpu6050_i2c_read_bytes (mpu6050_handle_t sensor, uint8_t register_address, uint8_t size, uint8_t* data);
 int8_t mpu6050_i2c_read_byte (mpu6050_handle_t sensor, uint8_t register_address, uint8_t* data);
 int8_t mpu6050_i2c_read_bits (mpu6050_handle_t sensor, uint8_t register_address, uint8_t bit_start, uint8_t size, uint8_t* data);
@@ -14,6 +13,10 @@ bool mpu6050_i2c_write_byte (mpu6050_handle_t sensor, uint8_t register_address,
 bool mpu6050_i2c_write_bits (mpu6050_handle_t sensor, uint8_t register_address, uint8_t bit_start, uint8_t size, uint8_t data);
 bool mpu6050_i2c_write_bit (mpu6050_handle_t sensor, uint8_t register_address, uint8_t bit_number, uint8_t data);
 
+#define MPU6050_FIFO_SIZE           1024
+#define MPU6050_FIFO_SAMPLE_SIZE    6     /* ACCEL_XOUT_H to ACCEL_ZOUT_L */
+#define MPU6050_FIFO_BURST_SAMPLES  42    /* samples per read, within the 255 bytes of a block */
+
 typedef struct
 {
 	i2c_bus_handle_t bus;
@@ -268,6 +271,90 @@ esp_err_t mpu6050_set_clock_source (mpu6050_handle_t sensor, uint8_t source)
     MPU6050_PWR1_CLKSEL_BIT, MPU6050_PWR1_CLKSEL_LENGTH, source);
 }
 
+esp_err_t mpu6050_start_accel_fifo(mpu6050_handle_t sensor, uint8_t rate_div)
+{
+    if (mpu6050_i2c_write_byte(sensor, MPU6050_REGISTER_SMPLRT_DIV, rate_div) == false ||
+        mpu6050_i2c_write_bits(sensor, MPU6050_REGISTER_CONFIG, MPU6050_CFG_DLPF_CFG_BIT,
+                               MPU6050_CFG_DLPF_CFG_LENGTH, MPU6050_DLPF_BW_98) == false ||
+        mpu6050_i2c_write_byte(sensor, MPU6050_REGISTER_FIFO_EN, 1 << MPU6050_ACCEL_FIFO_EN_BIT) == false ||
+        mpu6050_i2c_write_bit(sensor, MPU6050_REGISTER_USER_CTRL, MPU6050_USERCTRL_FIFO_RESET_BIT, 1) == false ||
+        mpu6050_i2c_write_bit(sensor, MPU6050_REGISTER_USER_CTRL, MPU6050_USERCTRL_FIFO_EN_BIT, 1) == false)
+    {
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+esp_err_t mpu6050_enable_data_ready_interrupt(mpu6050_handle_t sensor)
+{
+    // INT_LEVEL, INT_OPEN and LATCH_INT_EN cleared
+    if (mpu6050_i2c_write_bits(sensor, MPU6050_REGISTER_INT_PIN_CFG, MPU6050_INTCFG_INT_LEVEL_BIT, 3, 0) == false ||
+        mpu6050_i2c_write_byte(sensor, MPU6050_REGISTER_INT_ENABLE, 1 << MPU6050_INTERRUPT_DATA_RDY_BIT) == false)
+    {
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+esp_err_t mpu6050_read_accel_fifo(mpu6050_handle_t sensor, mpu6050_acceleration_t* samples,
+                                  uint16_t max_samples, uint16_t* count)
+{
+    mpu6050_dev_t *sens = (mpu6050_dev_t *)sensor;
+    uint8_t temp[MPU6050_FIFO_BURST_SAMPLES * MPU6050_FIFO_SAMPLE_SIZE];
+    i2c_bus_read_block_t block = { MPU6050_REGISTER_FIFO_COUNTH, 2, temp };
+    uint16_t available;
+    uint16_t read = 0;
+
+    *count = 0;
+    esp_err_t ret = iot_i2c_bus_read_blocks(sens->bus, sens->dev_addr, &block, 1, 0, 1000 / portTICK_PERIOD_MS);
+    if (ret != ESP_OK)
+    {
+        return ret;
+    }
+
+    available = (((uint16_t)temp[0]) << 8) | temp[1];
+    if (available >= MPU6050_FIFO_SIZE)
+    {
+        mpu6050_i2c_write_bit(sensor, MPU6050_REGISTER_USER_CTRL, MPU6050_USERCTRL_FIFO_RESET_BIT, 1);
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    available /= MPU6050_FIFO_SAMPLE_SIZE;
+    if (available > max_samples)
+    {
+        available = max_samples;
+    }
+
+    // The FIFO_R_W address does not increment, each byte read pops the FIFO
+    while (read < available)
+    {
+        uint16_t burst = available - read;
+        if (burst > MPU6050_FIFO_BURST_SAMPLES)
+        {
+            burst = MPU6050_FIFO_BURST_SAMPLES;
+        }
+        block.reg_addr = MPU6050_REGISTER_FIFO_R_W;
+        block.len = burst * MPU6050_FIFO_SAMPLE_SIZE;
+        ret = iot_i2c_bus_read_blocks(sens->bus, sens->dev_addr, &block, 1, 0, 1000 / portTICK_PERIOD_MS);
+        if (ret != ESP_OK)
+        {
+            break;
+        }
+
+        for (uint16_t i = 0; i < burst; i++)
+        {
+            const uint8_t *sample = &temp[i * MPU6050_FIFO_SAMPLE_SIZE];
+            samples[read + i].accel_x = (((int16_t)sample[0]) << 8) | sample[1];
+            samples[read + i].accel_y = (((int16_t)sample[2]) << 8) | sample[3];
+            samples[read + i].accel_z = (((int16_t)sample[4]) << 8) | sample[5];
+        }
+        read += burst;
+    }
+
+    *count = read;
+    return ret;
+}
+
 mpu6050_handle_t iot_mpu6050_create(i2c_bus_handle_t bus, uint16_t dev_addr)
 {
 	mpu6050_dev_t *sensor = (mpu6050_dev_t *)calloc(1, sizeof(mpu6050_dev_t));
@@ -288,35 +375,14 @@ esp_err_t iot_mpu6050_delete(mpu6050_handle_t sensor, bool del_bus)
 	return ESP_OK;
 }
 
-void select_register(mpu6050_handle_t sensor, uint8_t register_address)
-{
-    mpu6050_dev_t *sens = (mpu6050_dev_t *)sensor;
-    i2c_cmd_handle_t cmd = i2c_cmd_link_create();
-    i2c_master_start(cmd);
-    i2c_master_write_byte(cmd, (sens->dev_addr << 1) | I2C_MASTER_WRITE, 1);
-    i2c_master_write_byte(cmd, register_address, 1);
-    i2c_master_stop(cmd);
-    iot_i2c_bus_cmd_begin(sens->bus, cmd, 1000 / portTICK_PERIOD_MS);
-    i2c_cmd_link_delete(cmd);
-}
-
 int8_t mpu6050_i2c_read_bytes(mpu6050_handle_t sensor, uint8_t register_address,
                             uint8_t size, uint8_t *data)
 {
     mpu6050_dev_t *sens = (mpu6050_dev_t *)sensor;
-    select_register(sensor, register_address);
-    i2c_cmd_handle_t cmd = i2c_cmd_link_create();
-    i2c_master_start(cmd);
-    i2c_master_write_byte(cmd, (sens->dev_addr << 1) | I2C_MASTER_READ, 1);
+    i2c_bus_read_block_t block = { register_address, size, data };
 
-    if (size > 1)
-    {
-        i2c_master_read(cmd, data, size - 1, 0);
-    }
-    i2c_master_read_byte(cmd, data + size - 1, 1);
-    i2c_master_stop(cmd);
-    iot_i2c_bus_cmd_begin(sens->bus, cmd, 1000 / portTICK_PERIOD_MS);
-    i2c_cmd_link_delete(cmd);
+    // The register is selected with a repeated start, in the same transfer as the read
+    iot_i2c_bus_read_blocks(sens->bus, sens->dev_addr, &block, 1, 0, 1000 / portTICK_PERIOD_MS);
 
     return size;
 }
@@ -735,6 +735,51 @@ esp_err_t mpu6050_set_sleep_enabled(mpu6050_handle_t sensor, bool enabled);
  */
 esp_err_t mpu6050_set_clock_source (mpu6050_handle_t sensor, uint8_t source);
 
+/*
+ * @brief Start capturing acceleration samples into the FIFO of the device.
+ * The accelerometer is sampled at 1 kHz / (1 + rate_div), with the digital
+ * low pass filter set to 98 Hz, and the FIFO (1024 bytes) holds 170 samples.
+ *
+ * @param sensor object handle of mpu6050
+ * @param rate_div: sample rate divider.
+ * 
+ * @return
+ *     - ESP_OK Success
+ *     - ESP_FAIL Fail
+ */
+esp_err_t mpu6050_start_accel_fifo(mpu6050_handle_t sensor, uint8_t rate_div);
+
+/*
+ * @brief Read the acceleration samples captured in the FIFO, oldest first.
+ * If the FIFO overflowed its content is discarded, since the samples are no
+ * longer aligned, and capture restarts.
+ *
+ * @param sensor object handle of mpu6050
+ * @param samples: buffer for the samples.
+ * @param max_samples: number of samples the buffer holds.
+ * @param count: number of samples read.
+ * 
+ * @return
+ *     - ESP_OK Success
+ *     - ESP_ERR_INVALID_STATE The FIFO overflowed and was reset
+ *     - ESP_FAIL Fail
+ */
+esp_err_t mpu6050_read_accel_fifo(mpu6050_handle_t sensor, mpu6050_acceleration_t* samples,
+                                  uint16_t max_samples, uint16_t* count);
+
+/*
+ * @brief Pulse the INT pin for each sample, at the sample rate.
+ * The pin is active high and push-pull, and each pulse lasts 50 us, so
+ * nothing has to be read to clear it.
+ *
+ * @param sensor object handle of mpu6050
+ * 
+ * @return
+ *     - ESP_OK Success
+ *     - ESP_FAIL Fail
+ */
+esp_err_t mpu6050_enable_data_ready_interrupt(mpu6050_handle_t sensor);
+
 #ifdef __cplusplus
 }
 #endif
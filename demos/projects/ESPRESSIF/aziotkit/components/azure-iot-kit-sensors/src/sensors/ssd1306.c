@@ -18,12 +18,123 @@
 #include <time.h>
 #include <sys/time.h>
 
+#define SSD1306_PAGES          8
+#define SSD1306_CLEAN_PAGE     0xFF    /* dirty_first of a page with nothing to refresh */
+#define SSD1306_SLICE_COLUMNS  32      /* Columns sent per transaction, about 3 ms at 100 kHz */
+
 typedef struct {
     i2c_bus_handle_t bus;
     uint16_t dev_addr;
     uint8_t s_chDisplayBuffer[128][8];
+    /* Columns of each page changed since the last refresh, first to last. */
+    uint8_t dirty_first[SSD1306_PAGES];
+    uint8_t dirty_last[SSD1306_PAGES];
 } ssd1306_dev_t;
 
+static void mark_dirty(ssd1306_dev_t* device, uint8_t page, uint8_t first, uint8_t last)
+{
+    if (device->dirty_first[page] == SSD1306_CLEAN_PAGE) {
+        device->dirty_first[page] = first;
+        device->dirty_last[page] = last;
+        return;
+    }
+    if (first < device->dirty_first[page]) {
+        device->dirty_first[page] = first;
+    }
+    if (last > device->dirty_last[page]) {
+        device->dirty_last[page] = last;
+    }
+}
+
+static void set_buffer_byte(ssd1306_dev_t* device, uint8_t x, uint8_t page, uint8_t mask, uint8_t value)
+{
+    uint8_t chNew = (device->s_chDisplayBuffer[x][page] & ~mask) | (value & mask);
+
+    if (chNew != device->s_chDisplayBuffer[x][page]) {
+        device->s_chDisplayBuffer[x][page] = chNew;
+        mark_dirty(device, page, x, x);
+    }
+}
+
+/* Writes a column of up to 32 pixels, top pixel in the most significant of
+ * chHeight bits, a page byte at a time instead of pixel by pixel. */
+static void blit_column(ssd1306_dev_t* device, uint8_t chXpos, uint8_t chYpos,
+        uint32_t bits, uint8_t chHeight)
+{
+    uint16_t row = chYpos;
+    uint16_t end = chYpos + chHeight;
+
+    if (chXpos >= SSD1306_WIDTH) {
+        return;
+    }
+    if (end > SSD1306_HEIGHT) {
+        end = SSD1306_HEIGHT;
+    }
+
+    while (row < end) {
+        uint16_t page = row / 8;
+        uint16_t last = (page * 8 + 7 < end - 1) ? page * 8 + 7 : end - 1;
+        /* Row r is bit (chHeight - 1 - (r - chYpos)) of bits and bit (7 - r % 8)
+         * of its byte: the same shift for every row of the page. */
+        int shift = 8 * page + 8 - chHeight - chYpos;
+        uint64_t shifted = shift >= 0 ? (uint64_t)bits << shift : (uint64_t)bits >> -shift;
+        uint8_t mask = (uint8_t)((0xFF >> (row % 8)) & (0xFF << (7 - last % 8)));
+
+        /* The buffer holds the pages bottom up, as fill_point does. */
+        set_buffer_byte(device, chXpos, 7 - page, mask, (uint8_t)shifted);
+        row = last + 1;
+    }
+}
+
+/* Draws a glyph stored column by column, each column in (height + 7) / 8
+ * bytes, most significant bit on top. */
+static void blit_glyph(ssd1306_dev_t* device, uint8_t chXpos, uint8_t chYpos,
+        const uint8_t *glyph, uint8_t chWidth, uint8_t chHeight, uint8_t chMode)
+{
+    uint8_t bytesPerColumn = (chHeight + 7) / 8;
+    uint8_t i, j;
+
+    for (i = 0; i < chWidth; i++) {
+        uint32_t bits = 0;
+        for (j = 0; j < bytesPerColumn; j++) {
+            bits = (bits << 8) | (chMode ? glyph[j] : (uint8_t)~glyph[j]);
+        }
+        bits >>= bytesPerColumn * 8 - chHeight;
+        blit_column(device, chXpos + i, chYpos, bits, chHeight);
+        glyph += bytesPerColumn;
+    }
+}
+
+/* Sends a run of one page in a single transfer: page and column address
+ * commands, then the data. */
+static esp_err_t write_page_run(ssd1306_dev_t* device, uint8_t page, uint8_t first, uint8_t last)
+{
+    uint8_t data[SSD1306_WIDTH];
+    uint8_t column = first + SSD1306_SET_LOWER_ADDRESS;
+    uint8_t i;
+    esp_err_t ret;
+
+    for (i = first; i <= last; i++) {
+        data[i - first] = device->s_chDisplayBuffer[i][page];
+    }
+
+    i2c_cmd_handle_t cmd = i2c_cmd_link_create();
+    i2c_master_start(cmd);
+    i2c_master_write_byte(cmd, (device->dev_addr << 1) | WRITE_BIT, ACK_CHECK_EN);
+    i2c_master_write_byte(cmd, SSD1306_WRITE_CMD, ACK_CHECK_EN);
+    i2c_master_write_byte(cmd, SSD1306_SET_PAGE_ADDR + page, ACK_CHECK_EN);
+    i2c_master_write_byte(cmd, column & 0x0F, ACK_CHECK_EN);
+    i2c_master_write_byte(cmd, SSD1306_SET_HIGHER_ADDRESS | (column >> 4), ACK_CHECK_EN);
+    i2c_master_start(cmd);
+    i2c_master_write_byte(cmd, (device->dev_addr << 1) | WRITE_BIT, ACK_CHECK_EN);
+    i2c_master_write_byte(cmd, SSD1306_WRITE_DAT, ACK_CHECK_EN);
+    i2c_master_write(cmd, data, last - first + 1, ACK_CHECK_EN);
+    i2c_master_stop(cmd);
+    ret = iot_i2c_bus_cmd_begin_with_priority(device->bus, cmd, I2C_BUS_PRIORITY_LOW, 1000 / portTICK_RATE_MS);
+    i2c_cmd_link_delete(cmd);
+    return ret;
+}
+
 static uint32_t _pow(uint8_t m, uint8_t n)
 {
     uint32_t result = 1;
@@ -60,7 +171,7 @@ esp_err_t iot_ssd1306_write_byte(ssd1306_handle_t dev, uint8_t chData,
     }
     i2c_master_write_byte(cmd, chData, ACK_CHECK_EN);
     i2c_master_stop(cmd);
-    ret = i2c_master_cmd_begin(OLED_IIC_NUM, cmd, 1000 / portTICK_RATE_MS);
+    ret = iot_i2c_bus_cmd_begin_with_priority(device->bus, cmd, I2C_BUS_PRIORITY_LOW, 1000 / portTICK_RATE_MS);
     i2c_cmd_link_delete(cmd);
 #endif
     return ret;
@@ -104,41 +215,15 @@ void iot_ssd1306_draw_num(ssd1306_handle_t dev, uint8_t chXpos, uint8_t chYpos,
 void iot_ssd1306_draw_char(ssd1306_handle_t dev, uint8_t chXpos, uint8_t chYpos,
         uint8_t chChr, uint8_t chSize, uint8_t chMode)
 {
-    uint8_t i, j;
-    uint8_t chTemp, chYpos0 = chYpos;
+    const uint8_t *glyph;
 
     chChr = chChr - ' ';
-    for (i = 0; i < chSize; i++) {
-        if (chSize == 12) {
-            if (chMode) {
-                chTemp = c_chFont1206[chChr][i];
-            } else {
-                chTemp = ~c_chFont1206[chChr][i];
-            }
-        } else {
-            if (chMode) {
-                chTemp = c_chFont1608[chChr][i];
-            } else {
-                chTemp = ~c_chFont1608[chChr][i];
-            }
-        }
-
-        for (j = 0; j < 8; j++) {
-            if (chTemp & 0x80) {
-                iot_ssd1306_fill_point(dev, chXpos, chYpos, 1);
-            } else {
-                iot_ssd1306_fill_point(dev, chXpos, chYpos, 0);
-            }
-            chTemp <<= 1;
-            chYpos++;
-
-            if ((chYpos - chYpos0) == chSize) {
-                chYpos = chYpos0;
-                chXpos++;
-                break;
-            }
-        }
+    if (chSize == 12) {
+        glyph = c_chFont1206[chChr];
+    } else {
+        glyph = c_chFont1608[chChr];
     }
+    blit_glyph((ssd1306_dev_t*) dev, chXpos, chYpos, glyph, chSize / 2, chSize, chMode);
 }
 
 esp_err_t iot_ssd1306_draw_string(ssd1306_handle_t dev, uint8_t chXpos,
@@ -179,55 +264,19 @@ void iot_ssd1306_fill_point(ssd1306_handle_t dev, uint8_t chXpos, uint8_t chYpos
     chBx = chYpos % 8;
     chTemp = 1 << (7 - chBx);
 
-    if (chPoint) {
-        device->s_chDisplayBuffer[chXpos][chPos] |= chTemp;
-    } else {
-        device->s_chDisplayBuffer[chXpos][chPos] &= ~chTemp;
-    }
+    set_buffer_byte(device, chXpos, chPos, chTemp, chPoint ? 0xFF : 0x00);
 }
 
 void iot_ssd1306_draw_1616char(ssd1306_handle_t dev, uint8_t chXpos, uint8_t chYpos,
         uint8_t chChar)
 {
-    uint8_t i, j;
-    uint8_t chTemp = 0, chYpos0 = chYpos, chMode = 0;
-
-    for (i = 0; i < 32; i++) {
-        chTemp = c_chFont1612[chChar - 0x30][i];
-        for (j = 0; j < 8; j++) {
-            chMode = chTemp & 0x80 ? 1 : 0;
-            iot_ssd1306_fill_point(dev, chXpos, chYpos, chMode);
-            chTemp <<= 1;
-            chYpos++;
-            if ((chYpos - chYpos0) == 16) {
-                chYpos = chYpos0;
-                chXpos++;
-                break;
-            }
-        }
-    }
+    blit_glyph((ssd1306_dev_t*) dev, chXpos, chYpos, c_chFont1612[chChar - 0x30], 16, 16, 1);
 }
 
 void iot_ssd1306_draw_3216char(ssd1306_handle_t dev, uint8_t chXpos, uint8_t chYpos,
         uint8_t chChar)
 {
-    uint8_t i, j;
-    uint8_t chTemp = 0, chYpos0 = chYpos, chMode = 0;
-
-    for (i = 0; i < 64; i++) {
-        chTemp = c_chFont3216[chChar - 0x30][i];
-        for (j = 0; j < 8; j++) {
-            chMode = chTemp & 0x80 ? 1 : 0;
-            iot_ssd1306_fill_point(dev, chXpos, chYpos, chMode);
-            chTemp <<= 1;
-            chYpos++;
-            if ((chYpos - chYpos0) == 32) {
-                chYpos = chYpos0;
-                chXpos++;
-                break;
-            }
-        }
-    }
+    blit_glyph((ssd1306_dev_t*) dev, chXpos, chYpos, c_chFont3216[chChar - 0x30], 16, 32, 1);
 }
 
 void iot_ssd1306_draw_bitmap(ssd1306_handle_t dev, uint8_t chXpos, uint8_t chYpos,
@@ -288,6 +337,12 @@ esp_err_t iot_ssd1306_init(ssd1306_handle_t dev)
     iot_ssd1306_write_byte(dev, 0xA6, SSD1306_CMD); // Disable Inverse Display On (0xa6/a7)
     iot_ssd1306_write_byte(dev, 0xAF, SSD1306_CMD); //--turn on oled panel
 
+    // The GRAM content is unknown at power up, the first refresh sends all of it
+    for (uint8_t i = 0; i < SSD1306_PAGES; i++) {
+        ((ssd1306_dev_t*) dev)->dirty_first[i] = 0;
+        ((ssd1306_dev_t*) dev)->dirty_last[i] = SSD1306_WIDTH - 1;
+    }
+
     ret = iot_ssd1306_clear_screen(dev, 0x00);
     return ret;
 }
@@ -319,21 +374,22 @@ esp_err_t iot_ssd1306_delete(ssd1306_handle_t dev, bool del_bus)
 esp_err_t iot_ssd1306_refresh_gram(ssd1306_handle_t dev)
 {
     ssd1306_dev_t* device = (ssd1306_dev_t*) dev;
-    uint8_t i, j;
-    esp_err_t ret;
+    uint8_t i, last;
+    esp_err_t ret = ESP_OK;
 
-    for (i = 0; i < 8; i++) {
-        ret = iot_ssd1306_write_byte(dev, SSD1306_SET_PAGE_ADDR + i, SSD1306_CMD);
-        if (ret == ESP_FAIL) {
-            return ret;
-        }
-        iot_set_column_address(dev);
-        for (j = 0; j < 128; j++) {
-            ret = iot_ssd1306_write_byte(dev, device->s_chDisplayBuffer[j][i],
-            SSD1306_DAT);
-            if (ret == ESP_FAIL) {
+    // Only the columns changed since the last refresh are sent. They go in
+    // low priority slices, so sensor reads on the bus get in between them.
+    for (i = 0; i < SSD1306_PAGES; i++) {
+        while (device->dirty_first[i] != SSD1306_CLEAN_PAGE) {
+            last = device->dirty_last[i];
+            if (last - device->dirty_first[i] >= SSD1306_SLICE_COLUMNS) {
+                last = device->dirty_first[i] + SSD1306_SLICE_COLUMNS - 1;
+            }
+            ret = write_page_run(device, i, device->dirty_first[i], last);
+            if (ret != ESP_OK) {
                 return ret;
             }
+            device->dirty_first[i] = (last == device->dirty_last[i]) ? SSD1306_CLEAN_PAGE : last + 1;
         }
     }
     return ret;
@@ -343,15 +399,10 @@ esp_err_t iot_ssd1306_clear_screen(ssd1306_handle_t dev, uint8_t chFill)
 {
     ssd1306_dev_t* device = (ssd1306_dev_t*) dev;
     uint8_t i, j;
-    esp_err_t ret;
+    // Only the buffer is cleared, the screen is on the next refresh
     for (i = 0; i < 8; i++) {
-        ret = iot_ssd1306_write_byte(dev, SSD1306_SET_PAGE_ADDR + i, SSD1306_CMD);
-        if (ret == ESP_FAIL) {
-            return ret;
-        }
-        iot_set_column_address(dev);
         for (j = 0; j < 128; j++)
-            device->s_chDisplayBuffer[j][i] = chFill;
+            set_buffer_byte(device, j, i, 0xFF, chFill);
     }
     return ESP_OK;
 }
@@ -223,18 +223,71 @@
 #define democonfigDEMO_STACKSIZE         CONFIG_AZURE_TASK_STACKSIZE
 
 /**
- * @brief Size of the network buffer for MQTT packets.
+ * @brief Set the core the demo task is pinned to.
+ *
+ */
+#ifdef CONFIG_AZURE_TASK_PIN_TO_CORE
+    #define democonfigPIN_TASKS_TO_CORE
+    #define democonfigDEMO_TASK_CORE    CONFIG_AZURE_TASK_CORE
+#endif /* CONFIG_AZURE_TASK_PIN_TO_CORE */
+
+/**
+ * @brief Size of the part of the hub client buffer the MQTT packets are
+ * received in, which must hold the largest one the hub sends, such as a
+ * property document or an ADU manifest.
+ */
+#define democonfigNETWORK_RX_BUFFER_SIZE    CONFIG_NETWORK_BUFFER_SIZE
+
+/**
+ * @brief Size of the part of the hub client buffer the middleware writes the
+ * topic, user name and password of the packets it sends in. The payloads are
+ * sent from the buffers of the samples, so this does not grow with them.
+ */
+#define democonfigNETWORK_TX_BUFFER_SIZE    ( azureiotconfigUSERNAME_MAX + azureiotconfigPASSWORD_MAX )
+
+/**
+ * @brief Size of the buffer given to the hub and provisioning clients, which
+ * use its first democonfigNETWORK_TX_BUFFER_SIZE bytes for what they send and
+ * receive in the rest.
  */
-#define democonfigNETWORK_BUFFER_SIZE    CONFIG_NETWORK_BUFFER_SIZE
+#define democonfigNETWORK_BUFFER_SIZE       ( democonfigNETWORK_TX_BUFFER_SIZE + democonfigNETWORK_RX_BUFFER_SIZE )
 
 /**
  * @brief IoTHub endpoint port.
  */
 #define democonfigIOTHUB_PORT            8883
 
+/**
+ * @brief Send telemetry as CBOR instead of JSON.
+ */
+#ifdef CONFIG_AZURE_IOT_TELEMETRY_CBOR
+    #define democonfigTELEMETRY_CBOR    1
+#endif
+
+/**
+ * @brief Send the accelerometer samples as a time series, in messages of up
+ * to democonfigTELEMETRY_MESSAGE_SIZE bytes, one IoT Hub metered message.
+ */
+#ifdef CONFIG_AZURE_IOT_TELEMETRY_TIME_SERIES
+    #define democonfigTELEMETRY_TIME_SERIES    1
+    #define democonfigTELEMETRY_MESSAGE_SIZE   4096
+#endif
+
+/**
+ * @brief Send the readings the ULP coprocessor took during the deep sleep as
+ * a time series, in one message.
+ */
+#if defined( CONFIG_AZURE_IOT_ULP_SENSORS ) && !defined( democonfigTELEMETRY_MESSAGE_SIZE )
+    #define democonfigTELEMETRY_MESSAGE_SIZE   4096
+#endif
+
 /**
  * @brief Defines configRAND32, used by the common sample modules.
+ *
+ * esp_random() uses the hardware RNG, where rand() would be the same
+ * unseeded sequence on every device.
  */
-#define configRAND32()    ( rand() / RAND_MAX )
+#include "esp_system.h"
+#define configRAND32()    esp_random()
 
 #endif /* DEMO_CONFIG_H */
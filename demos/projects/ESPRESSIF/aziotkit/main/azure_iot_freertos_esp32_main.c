@@ -19,14 +19,25 @@
 #include "freertos/semphr.h"
 #include "nvs_flash.h"
 
+#ifdef CONFIG_AZURE_IOT_ULP_SENSORS
+    #include "esp_attr.h"
+    #include "esp_sleep.h"
+#endif
+
 /* Azure Provisioning/IoT Hub library includes */
 #include "azure_iot_hub_client.h"
 #include "azure_iot_hub_client_properties.h"
 
 #include "sample_azure_iot_pnp_data_if.h"
+
+/* Startup timing. */
+#include "azure_sample_startup.h"
 #include "led.h"
 #include "sensor_manager.h"
 #include "azure_iot_freertos_esp32_sensors_data.h"
+
+/* The sleeps while the ULP coprocessor reads the sensors. */
+#include "azure_sample_deep_sleep.h"
 /*-----------------------------------------------------------*/
 
 #define NR_OF_IP_ADDRESSES_TO_WAIT_FOR     1
@@ -75,6 +86,11 @@ static const char * TAG = "sample_azureiotkit";
 
 static bool xTimeInitialized = false;
 
+#ifdef CONFIG_AZURE_IOT_ULP_SENSORS
+    /* RTC_DATA_ATTR is zeroed at a cold boot and kept through the deep sleep. */
+    static RTC_DATA_ATTR DeepSleepState_t xDeepSleepState;
+#endif
+
 static xSemaphoreHandle xSemphGetIpAddrs;
 static esp_ip4_addr_t xIpAddress;
 /*-----------------------------------------------------------*/
@@ -291,6 +307,15 @@ static void prvInitializeTime()
     sntp_set_time_sync_notification_cb( prvTimeSyncNotificationCallback );
     sntp_init();
 
+    #ifdef CONFIG_AZURE_IOT_ULP_SENSORS
+        /* The RTC kept the time through the sleep, so SNTP only corrects its
+         * drift, in the background. */
+        if( DeepSleep_PlatformWoke() )
+        {
+            return;
+        }
+    #endif
+
     ESP_LOGI( TAG, "Waiting for time synchronization with SNTP server" );
 
     while( !xTimeInitialized )
@@ -310,6 +335,19 @@ uint32_t ulCreateReportedPropertiesUpdate( uint8_t * pucPropertiesData,
 }
 /*-----------------------------------------------------------*/
 
+void vReportedPropertiesUpdateSent( uint32_t ulRequestId,
+                                    AzureIoTResult_t xResult )
+{
+    vSampleReportedPropertiesUpdateSent( ulRequestId, xResult );
+}
+/*-----------------------------------------------------------*/
+
+void vHandleReportedPropertiesResponse( AzureIoTHubClientPropertiesResponse_t * pxMessage )
+{
+    vSampleHandleReportedPropertiesResponse( pxMessage );
+}
+/*-----------------------------------------------------------*/
+
 uint32_t ulHandleCommand( AzureIoTHubClientCommandRequest_t * pxMessage,
                           uint32_t * pulResponseStatus,
                           uint8_t * pucCommandResponsePayloadBuffer,
@@ -352,13 +390,56 @@ void app_main( void )
     vTaskDelay( pdMS_TO_TICKS( 100 ) );
 
     initialize_sensors();
+
+    if( !start_sensor_sampling() )
+    {
+        ESP_LOGE( TAG, "Failed starting the sensor sampling task.\r\n" );
+    }
+
     oled_clean_screen();
     oled_show_message( ( uint8_t * ) OLED_SPLASH_MESSAGE, sizeof( OLED_SPLASH_MESSAGE ) - 1 );
 
     ( void ) prvConnectNetwork();
+    StartupProfile_Mark( eStartupPhaseNetworkUp );
 
     prvInitializeTime();
+    StartupProfile_Mark( eStartupPhaseTimeSynced );
 
     vStartDemoTask();
 }
 /*-----------------------------------------------------------*/
+
+#ifdef CONFIG_AZURE_IOT_ULP_SENSORS
+
+DeepSleepState_t * DeepSleep_PlatformState( void )
+{
+    return &xDeepSleepState;
+}
+/*-----------------------------------------------------------*/
+
+bool DeepSleep_PlatformWoke( void )
+{
+    esp_sleep_wakeup_cause_t xCause = esp_sleep_get_wakeup_cause();
+
+    return ( xCause == ESP_SLEEP_WAKEUP_ULP ) || ( xCause == ESP_SLEEP_WAKEUP_TIMER );
+}
+/*-----------------------------------------------------------*/
+
+/* The ULP coprocessor wakes the board once it has a batch of readings, and
+ * the timer after the longest sleep, should it not. */
+void DeepSleep_PlatformEnter( uint32_t ulSleepMs )
+{
+    prvWifiStop();
+
+    if( !start_ulp_sampling( CONFIG_AZURE_IOT_ULP_SENSORS_PERIOD_MS,
+                             CONFIG_AZURE_IOT_ULP_SENSORS_BATCH,
+                             ( float ) CONFIG_AZURE_IOT_ULP_SENSORS_LIGHT_THRESHOLD_LUX ) )
+    {
+        ESP_LOGE( TAG, "Failed starting the ULP sampling, sleeping on the timer.\r\n" );
+    }
+
+    ESP_ERROR_CHECK( esp_sleep_enable_timer_wakeup( ( uint64_t ) ulSleepMs * 1000ULL ) );
+    esp_deep_sleep_start();
+}
+
+#endif /* CONFIG_AZURE_IOT_ULP_SENSORS */
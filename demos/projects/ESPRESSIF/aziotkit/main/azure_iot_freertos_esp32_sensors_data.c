@@ -5,14 +5,40 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
 #include <time.h>
 
+/* FreeRTOS */
+#include "FreeRTOS.h"
+#include "task.h"
+
 /* Azure Provisioning/IoT Hub library includes */
 #include "azure_iot_hub_client.h"
 #include "azure_iot_hub_client_properties.h"
 
+/* Single pass property dispatch, and command dispatch by name. */
+#include "azure_sample_properties.h"
+#include "azure_sample_commands.h"
+#include "azure_sample_reported_properties.h" /* For democonfigREPORTED_PROPERTIES_ACK_TIMEOUT_MS. */
+
 #include "sample_azure_iot_pnp_data_if.h"
 #include "sensor_manager.h"
+
+/* Demo Specific configs. */
+#include "demo_config.h"
+
+/* CBOR telemetry encoding. */
+#include "azure_sample_cbor_writer.h"
+
+/* Report-by-exception of the telemetry fields. */
+#include "azure_sample_telemetry_filter.h"
+
+/* JSON telemetry from keys rendered once. */
+#include "azure_sample_telemetry_template.h"
+
+/* Delta encoded columns of the accelerometer samples. */
+#include "azure_sample_time_series.h"
 /*-----------------------------------------------------------*/
 
 #define INDEFINITE_TIME    ( ( time_t ) -1 )
@@ -29,26 +55,48 @@ static const char * TAG = "sample_azureiotkit";
 /**
  * @brief Device Info Values
  */
-#define sampleazureiotkitDEVICE_INFORMATION_NAME                  ( "deviceInformation" )
-#define sampleazureiotkitMANUFACTURER_PROPERTY_NAME               ( "manufacturer" )
-#define sampleazureiotkitMODEL_PROPERTY_NAME                      ( "model" )
-#define sampleazureiotkitSOFTWARE_VERSION_PROPERTY_NAME           ( "swVersion" )
-#define sampleazureiotkitOS_NAME_PROPERTY_NAME                    ( "osName" )
-#define sampleazureiotkitPROCESSOR_ARCHITECTURE_PROPERTY_NAME     ( "processorArchitecture" )
-#define sampleazureiotkitPROCESSOR_MANUFACTURER_PROPERTY_NAME     ( "processorManufacturer" )
-#define sampleazureiotkitTOTAL_STORAGE_PROPERTY_NAME              ( "totalStorage" )
-#define sampleazureiotkitTOTAL_MEMORY_PROPERTY_NAME               ( "totalMemory" )
-
-#define sampleazureiotkitMANUFACTURER_PROPERTY_VALUE              ( "ESPRESSIF" )
-#define sampleazureiotkitMODEL_PROPERTY_VALUE                     ( "ESP32 Azure IoT Kit" )
-#define sampleazureiotkitVERSION_PROPERTY_VALUE                   ( "1.0.0" )
-#define sampleazureiotkitOS_NAME_PROPERTY_VALUE                   ( "FreeRTOS" )
-#define sampleazureiotkitARCHITECTURE_PROPERTY_VALUE              ( "ESP32 WROVER-B" )
-#define sampleazureiotkitPROCESSOR_MANUFACTURER_PROPERTY_VALUE    ( "ESPRESSIF" )
+#define sampleazureiotkitDEVICE_INFORMATION_NAME                  "deviceInformation"
+#define sampleazureiotkitMANUFACTURER_PROPERTY_NAME               "manufacturer"
+#define sampleazureiotkitMODEL_PROPERTY_NAME                      "model"
+#define sampleazureiotkitSOFTWARE_VERSION_PROPERTY_NAME           "swVersion"
+#define sampleazureiotkitOS_NAME_PROPERTY_NAME                    "osName"
+#define sampleazureiotkitPROCESSOR_ARCHITECTURE_PROPERTY_NAME     "processorArchitecture"
+#define sampleazureiotkitPROCESSOR_MANUFACTURER_PROPERTY_NAME     "processorManufacturer"
+#define sampleazureiotkitTOTAL_STORAGE_PROPERTY_NAME              "totalStorage"
+#define sampleazureiotkitTOTAL_MEMORY_PROPERTY_NAME               "totalMemory"
+
+#define sampleazureiotkitMANUFACTURER_PROPERTY_VALUE              "ESPRESSIF"
+#define sampleazureiotkitMODEL_PROPERTY_VALUE                     "ESP32 Azure IoT Kit"
+#define sampleazureiotkitVERSION_PROPERTY_VALUE                   "1.0.0"
+#define sampleazureiotkitOS_NAME_PROPERTY_VALUE                   "FreeRTOS"
+#define sampleazureiotkitARCHITECTURE_PROPERTY_VALUE              "ESP32 WROVER-B"
+#define sampleazureiotkitPROCESSOR_MANUFACTURER_PROPERTY_VALUE    "ESPRESSIF"
 /* The next couple properties are in KiloBytes. */
 #define sampleazureiotkitTOTAL_STORAGE_PROPERTY_VALUE             4096
 #define sampleazureiotkitTOTAL_MEMORY_PROPERTY_VALUE              8192
 
+#define sampleazureiotkitSTRINGIFY_( x )                          # x
+#define sampleazureiotkitSTRINGIFY( x )                           sampleazureiotkitSTRINGIFY_( x )
+#define sampleazureiotkitJSON_STRING_PROPERTY( pcName, pcValue )  "\"" pcName "\":\"" pcValue "\""
+#define sampleazureiotkitJSON_NUMBER_PROPERTY( pcName, xValue )   "\"" pcName "\":" sampleazureiotkitSTRINGIFY( xValue )
+
+/**
+ * @brief The device information, all constants, written by the compiler as
+ * the reported properties document the JSON writer would build. "__t":"c"
+ * marks the component.
+ */
+static const char cDeviceInfoPayload[] =
+    "{\"" sampleazureiotkitDEVICE_INFORMATION_NAME "\":{\"__t\":\"c\","
+    sampleazureiotkitJSON_STRING_PROPERTY( sampleazureiotkitMANUFACTURER_PROPERTY_NAME, sampleazureiotkitMANUFACTURER_PROPERTY_VALUE ) ","
+    sampleazureiotkitJSON_STRING_PROPERTY( sampleazureiotkitMODEL_PROPERTY_NAME, sampleazureiotkitMODEL_PROPERTY_VALUE ) ","
+    sampleazureiotkitJSON_STRING_PROPERTY( sampleazureiotkitSOFTWARE_VERSION_PROPERTY_NAME, sampleazureiotkitVERSION_PROPERTY_VALUE ) ","
+    sampleazureiotkitJSON_STRING_PROPERTY( sampleazureiotkitOS_NAME_PROPERTY_NAME, sampleazureiotkitOS_NAME_PROPERTY_VALUE ) ","
+    sampleazureiotkitJSON_STRING_PROPERTY( sampleazureiotkitPROCESSOR_ARCHITECTURE_PROPERTY_NAME, sampleazureiotkitARCHITECTURE_PROPERTY_VALUE ) ","
+    sampleazureiotkitJSON_STRING_PROPERTY( sampleazureiotkitPROCESSOR_MANUFACTURER_PROPERTY_NAME, sampleazureiotkitPROCESSOR_MANUFACTURER_PROPERTY_VALUE ) ","
+    sampleazureiotkitJSON_NUMBER_PROPERTY( sampleazureiotkitTOTAL_STORAGE_PROPERTY_NAME, sampleazureiotkitTOTAL_STORAGE_PROPERTY_VALUE ) ","
+    sampleazureiotkitJSON_NUMBER_PROPERTY( sampleazureiotkitTOTAL_MEMORY_PROPERTY_NAME, sampleazureiotkitTOTAL_MEMORY_PROPERTY_VALUE )
+    "}}";
+
 /**
  * @brief Telemetry Values
  */
@@ -65,9 +113,139 @@ static const char * TAG = "sample_azureiotkit";
 #define sampleazureiotTELEMETRY_ACCELEROMETERX                    ( "accelerometerX" )
 #define sampleazureiotTELEMETRY_ACCELEROMETERY                    ( "accelerometerY" )
 #define sampleazureiotTELEMETRY_ACCELEROMETERZ                    ( "accelerometerZ" )
+#define sampleazureiotTELEMETRY_DECIMALS                          ( 2 )
+
+/* The fields of the telemetry with their default deadbands, in the units
+ * sent, in the order of the indexes below. Readings within the deadband of
+ * the value last sent are left out, until the heartbeat sends them all. */
+static TelemetryFilterField_t xTelemetryFields[] =
+{
+    telemetryfilterFIELD( sampleazureiotTELEMETRY_TEMPERATURE, 0.2 ),
+    telemetryfilterFIELD( sampleazureiotTELEMETRY_HUMIDITY, 1.0 ),
+    telemetryfilterFIELD( sampleazureiotTELEMETRY_LIGHT, 5.0 ),
+    telemetryfilterFIELD( sampleazureiotTELEMETRY_PRESSURE, 0.5 ),
+    telemetryfilterFIELD( sampleazureiotTELEMETRY_ALTITUDE, 2.0 ),
+    telemetryfilterFIELD( sampleazureiotTELEMETRY_MAGNETOMETERX, 5.0 ),
+    telemetryfilterFIELD( sampleazureiotTELEMETRY_MAGNETOMETERY, 5.0 ),
+    telemetryfilterFIELD( sampleazureiotTELEMETRY_MAGNETOMETERZ, 5.0 ),
+    telemetryfilterFIELD( sampleazureiotTELEMETRY_PITCH, 2.0 ),
+    telemetryfilterFIELD( sampleazureiotTELEMETRY_ROLL, 2.0 ),
+    telemetryfilterFIELD( sampleazureiotTELEMETRY_ACCELEROMETERX, 0.0 ),
+    telemetryfilterFIELD( sampleazureiotTELEMETRY_ACCELEROMETERY, 0.0 ),
+    telemetryfilterFIELD( sampleazureiotTELEMETRY_ACCELEROMETERZ, 0.0 )
+};
+
+#define sampleazureiotFIELD_TEMPERATURE       0
+#define sampleazureiotFIELD_HUMIDITY          1
+#define sampleazureiotFIELD_LIGHT             2
+#define sampleazureiotFIELD_PRESSURE          3
+#define sampleazureiotFIELD_ALTITUDE          4
+#define sampleazureiotFIELD_MAGNETOMETERX     5
+#define sampleazureiotFIELD_MAGNETOMETERY     6
+#define sampleazureiotFIELD_MAGNETOMETERZ     7
+#define sampleazureiotFIELD_PITCH             8
+#define sampleazureiotFIELD_ROLL              9
+#define sampleazureiotFIELD_ACCELEROMETERX    10
+#define sampleazureiotFIELD_ACCELEROMETERY    11
+#define sampleazureiotFIELD_ACCELEROMETERZ    12
+
+static TelemetryFilter_t xTelemetryFilter = telemetryfilterINIT( xTelemetryFields, democonfigTELEMETRY_HEARTBEAT_SECS );
+
+#define sampleazureiotMOTION_STATISTIC_DECIMALS                   ( 2 )
+
+/* Every field the telemetry can have, the ones of the filter first, at their
+ * indexes, then the statistics of the accelerometer over the telemetry
+ * period, in m/s^2, per axis: minimum, maximum and RMS. The mean is sent as
+ * accelerometerX/Y/Z. */
+static const TelemetryTemplateField_t xTelemetryTemplateFields[] =
+{
+    telemetrytemplateFIELD( sampleazureiotTELEMETRY_TEMPERATURE, sampleazureiotTELEMETRY_DECIMALS ),
+    telemetrytemplateFIELD( sampleazureiotTELEMETRY_HUMIDITY, sampleazureiotTELEMETRY_DECIMALS ),
+    telemetrytemplateFIELD( sampleazureiotTELEMETRY_LIGHT, sampleazureiotTELEMETRY_DECIMALS ),
+    telemetrytemplateFIELD( sampleazureiotTELEMETRY_PRESSURE, sampleazureiotTELEMETRY_DECIMALS ),
+    telemetrytemplateFIELD( sampleazureiotTELEMETRY_ALTITUDE, sampleazureiotTELEMETRY_DECIMALS ),
+    telemetrytemplateFIELD( sampleazureiotTELEMETRY_MAGNETOMETERX, 0 ),
+    telemetrytemplateFIELD( sampleazureiotTELEMETRY_MAGNETOMETERY, 0 ),
+    telemetrytemplateFIELD( sampleazureiotTELEMETRY_MAGNETOMETERZ, 0 ),
+    telemetrytemplateFIELD( sampleazureiotTELEMETRY_PITCH, 0 ),
+    telemetrytemplateFIELD( sampleazureiotTELEMETRY_ROLL, 0 ),
+    telemetrytemplateFIELD( sampleazureiotTELEMETRY_ACCELEROMETERX, 0 ),
+    telemetrytemplateFIELD( sampleazureiotTELEMETRY_ACCELEROMETERY, 0 ),
+    telemetrytemplateFIELD( sampleazureiotTELEMETRY_ACCELEROMETERZ, 0 ),
+    telemetrytemplateFIELD( "accelXMin", sampleazureiotMOTION_STATISTIC_DECIMALS ),
+    telemetrytemplateFIELD( "accelXMax", sampleazureiotMOTION_STATISTIC_DECIMALS ),
+    telemetrytemplateFIELD( "accelXRms", sampleazureiotMOTION_STATISTIC_DECIMALS ),
+    telemetrytemplateFIELD( "accelYMin", sampleazureiotMOTION_STATISTIC_DECIMALS ),
+    telemetrytemplateFIELD( "accelYMax", sampleazureiotMOTION_STATISTIC_DECIMALS ),
+    telemetrytemplateFIELD( "accelYRms", sampleazureiotMOTION_STATISTIC_DECIMALS ),
+    telemetrytemplateFIELD( "accelZMin", sampleazureiotMOTION_STATISTIC_DECIMALS ),
+    telemetrytemplateFIELD( "accelZMax", sampleazureiotMOTION_STATISTIC_DECIMALS ),
+    telemetrytemplateFIELD( "accelZRms", sampleazureiotMOTION_STATISTIC_DECIMALS )
+};
+
+/* Index of the minimum of the X axis; each axis then has its minimum, maximum and RMS. */
+#define sampleazureiotFIELD_MOTION_STATISTICS    13
+
+#if ( democonfigTELEMETRY_CBOR == 0 )
+    /* The keys of xTelemetryTemplateFields, rendered by the first message. */
+    static TelemetryTemplate_t xTelemetryTemplate;
+    static uint8_t ucTelemetrySkeleton[ 320 ];
+    static bool xTelemetryTemplateReady = false;
+#endif /* democonfigTELEMETRY_CBOR == 0 */
 
 static time_t xLastTelemetrySendTime = INDEFINITE_TIME;
 
+#if ( democonfigTELEMETRY_TIME_SERIES == 1 )
+    #if ( democonfigTELEMETRY_CBOR == 1 )
+        #error "The time series is JSON, it cannot be sent with CBOR telemetry."
+    #endif
+
+/* Samples in a series of the accelerometer: two seconds, encoded into as few
+ * messages as the message size allows. */
+    #define sampleazureiotMOTION_SERIES_SAMPLES    400
+
+/* Samples taken from the sampling task at a time. */
+    #define sampleazureiotMOTION_TAKEN_SAMPLES     64
+
+/* The axes of the accelerometer, in mm/s^2. */
+    static const TimeSeriesChannel_t xMotionChannels[] =
+    {
+        timeseriesCHANNEL( sampleazureiotTELEMETRY_ACCELEROMETERX ),
+        timeseriesCHANNEL( sampleazureiotTELEMETRY_ACCELEROMETERY ),
+        timeseriesCHANNEL( sampleazureiotTELEMETRY_ACCELEROMETERZ )
+    };
+
+    static TimeSeries_t xMotionSeries;
+    static int32_t lMotionSeriesValues[ 3 * sampleazureiotMOTION_SERIES_SAMPLES ];
+    static bool xMotionSeriesReady = false;
+
+/* Samples taken but not in the series yet, with the time of the first. */
+    static int32_t lMotionTaken[ sampleazureiotMOTION_TAKEN_SAMPLES ][ 3 ];
+    static uint32_t ulMotionTakenCount = 0;
+    static uint32_t ulMotionTakenNext = 0;
+    static uint64_t ullMotionTakenTimeMs;
+    static bool xMotionTakenAfterGap = false;
+#endif /* democonfigTELEMETRY_TIME_SERIES == 1 */
+
+#ifdef CONFIG_AZURE_IOT_ULP_SENSORS
+    #if ( democonfigTELEMETRY_CBOR == 1 )
+        #error "The time series is JSON, it cannot be sent with CBOR telemetry."
+    #endif
+
+/* The readings of the ULP coprocessor, in tenths of Celsius, tenths of
+ * percentage points and lux. */
+    static const TimeSeriesChannel_t xSleepChannels[] =
+    {
+        timeseriesCHANNEL( sampleazureiotTELEMETRY_TEMPERATURE ),
+        timeseriesCHANNEL( sampleazureiotTELEMETRY_HUMIDITY ),
+        timeseriesCHANNEL( sampleazureiotTELEMETRY_LIGHT )
+    };
+
+    static TimeSeries_t xSleepSeries;
+    static int32_t lSleepSeriesValues[ 3 * CONFIG_AZURE_IOT_ULP_SENSORS_BATCH ];
+    static bool xSleepSamplesTaken = false;
+#endif /* CONFIG_AZURE_IOT_ULP_SENSORS */
+
 /**
  * @brief Command Values
  */
@@ -86,75 +264,103 @@ static bool xLed2State = false;
 #define sampleazureiotPROPERTY_STATUS_SUCCESS         200
 #define sampleazureiotPROPERTY_SUCCESS                "success"
 #define sampleazureiotPROPERTY_TELEMETRY_FREQUENCY    ( "telemetryFrequencySecs" )
+#define sampleazureiotPROPERTY_TELEMETRY_HEARTBEAT    ( "telemetryHeartbeatSecs" )
+#define sampleazureiotPROPERTY_TELEMETRY_DEADBANDS    ( "telemetryDeadbands" )
+
+/* Writable properties received in a document. */
+#define sampleazureiotRECEIVED_FREQUENCY              ( 1U << 0 )
+#define sampleazureiotRECEIVED_HEARTBEAT              ( 1U << 1 )
+#define sampleazureiotRECEIVED_DEADBANDS              ( 1U << 2 )
 
 static int lTelemetryFrequencySecs = 2;
 /*-----------------------------------------------------------*/
 
-int32_t lGenerateDeviceInfo( uint8_t * pucPropertiesData,
-                             uint32_t ulPropertiesDataSize )
+typedef enum DeviceInfoState
 {
-    AzureIoTResult_t xAzIoTResult;
-    AzureIoTJSONWriter_t xWriter;
-    int32_t lBytesWritten;
-
-    /* Update reported property */
-    xAzIoTResult = AzureIoTJSONWriter_Init( &xWriter, pucPropertiesData, ulPropertiesDataSize );
-    configASSERT( xAzIoTResult == eAzureIoTSuccess );
-
-    xAzIoTResult = AzureIoTJSONWriter_AppendBeginObject( &xWriter );
-    configASSERT( xAzIoTResult == eAzureIoTSuccess );
-
-    xAzIoTResult = AzureIoTHubClientProperties_BuilderBeginComponent( &xAzureIoTHubClient, &xWriter, ( const uint8_t * ) sampleazureiotkitDEVICE_INFORMATION_NAME, strlen( sampleazureiotkitDEVICE_INFORMATION_NAME ) );
-    configASSERT( xAzIoTResult == eAzureIoTSuccess );
+    eDeviceInfoPending = 0, /* To be sent. */
+    eDeviceInfoInFlight,    /* Sent, waiting for IoT Hub to accept it. */
+    eDeviceInfoReported     /* Accepted, not sent again. */
+} DeviceInfoState_t;
+
+/* Reports the device information once, and again only if IoT Hub did not accept it. */
+static DeviceInfoState_t xDeviceInfoState = eDeviceInfoPending;
+static uint32_t ulDeviceInfoRequestId;
+static TickType_t xDeviceInfoSentTime;
+/*-----------------------------------------------------------*/
 
-    xAzIoTResult = AzureIoTJSONWriter_AppendPropertyWithStringValue( &xWriter, ( uint8_t * ) sampleazureiotkitMANUFACTURER_PROPERTY_NAME, lengthof( sampleazureiotkitMANUFACTURER_PROPERTY_NAME ),
-                                                                     ( uint8_t * ) sampleazureiotkitMANUFACTURER_PROPERTY_VALUE, lengthof( sampleazureiotkitMANUFACTURER_PROPERTY_VALUE ) );
-    configASSERT( xAzIoTResult == eAzureIoTSuccess );
+static uint32_t prvEmptyResponse( uint32_t * pulResponseStatus,
+                                  uint8_t * pucCommandResponsePayloadBuffer,
+                                  uint32_t ulCommandResponsePayloadBufferSize )
+{
+    *pulResponseStatus = AZ_IOT_STATUS_OK;
+    configASSERT( ulCommandResponsePayloadBufferSize >= lengthof( sampleazureiotCOMMAND_EMPTY_PAYLOAD ) );
+    ( void ) memcpy( pucCommandResponsePayloadBuffer, sampleazureiotCOMMAND_EMPTY_PAYLOAD, lengthof( sampleazureiotCOMMAND_EMPTY_PAYLOAD ) );
 
-    xAzIoTResult = AzureIoTJSONWriter_AppendPropertyWithStringValue( &xWriter, ( uint8_t * ) sampleazureiotkitMODEL_PROPERTY_NAME, lengthof( sampleazureiotkitMODEL_PROPERTY_NAME ),
-                                                                     ( uint8_t * ) sampleazureiotkitMODEL_PROPERTY_VALUE, lengthof( sampleazureiotkitMODEL_PROPERTY_VALUE ) );
-    configASSERT( xAzIoTResult == eAzureIoTSuccess );
+    return lengthof( sampleazureiotCOMMAND_EMPTY_PAYLOAD );
+}
+/*-----------------------------------------------------------*/
 
-    xAzIoTResult = AzureIoTJSONWriter_AppendPropertyWithStringValue( &xWriter, ( uint8_t * ) sampleazureiotkitSOFTWARE_VERSION_PROPERTY_NAME, lengthof( sampleazureiotkitSOFTWARE_VERSION_PROPERTY_NAME ),
-                                                                     ( uint8_t * ) sampleazureiotkitVERSION_PROPERTY_VALUE, lengthof( sampleazureiotkitVERSION_PROPERTY_VALUE ) );
-    configASSERT( xAzIoTResult == eAzureIoTSuccess );
+static uint32_t prvHandleToggleLed1( AzureIoTHubClientCommandRequest_t * pxMessage,
+                                     uint32_t * pulResponseStatus,
+                                     uint8_t * pucCommandResponsePayloadBuffer,
+                                     uint32_t ulCommandResponsePayloadBufferSize )
+{
+    ( void ) pxMessage;
 
-    xAzIoTResult = AzureIoTJSONWriter_AppendPropertyWithStringValue( &xWriter, ( uint8_t * ) sampleazureiotkitOS_NAME_PROPERTY_NAME, lengthof( sampleazureiotkitOS_NAME_PROPERTY_NAME ),
-                                                                     ( uint8_t * ) sampleazureiotkitOS_NAME_PROPERTY_VALUE, lengthof( sampleazureiotkitOS_NAME_PROPERTY_VALUE ) );
-    configASSERT( xAzIoTResult == eAzureIoTSuccess );
+    xLed1State = !xLed1State;
+    led1_set_state( xLed1State ? LED_STATE_ON : LED_STATE_OFF );
 
-    xAzIoTResult = AzureIoTJSONWriter_AppendPropertyWithStringValue( &xWriter, ( uint8_t * ) sampleazureiotkitPROCESSOR_ARCHITECTURE_PROPERTY_NAME, lengthof( sampleazureiotkitPROCESSOR_ARCHITECTURE_PROPERTY_NAME ),
-                                                                     ( uint8_t * ) sampleazureiotkitARCHITECTURE_PROPERTY_VALUE, lengthof( sampleazureiotkitARCHITECTURE_PROPERTY_VALUE ) );
-    configASSERT( xAzIoTResult == eAzureIoTSuccess );
+    return prvEmptyResponse( pulResponseStatus, pucCommandResponsePayloadBuffer, ulCommandResponsePayloadBufferSize );
+}
+/*-----------------------------------------------------------*/
 
-    xAzIoTResult = AzureIoTJSONWriter_AppendPropertyWithStringValue( &xWriter, ( uint8_t * ) sampleazureiotkitPROCESSOR_MANUFACTURER_PROPERTY_NAME, lengthof( sampleazureiotkitPROCESSOR_MANUFACTURER_PROPERTY_NAME ),
-                                                                     ( uint8_t * ) sampleazureiotkitPROCESSOR_MANUFACTURER_PROPERTY_VALUE, lengthof( sampleazureiotkitPROCESSOR_MANUFACTURER_PROPERTY_VALUE ) );
-    configASSERT( xAzIoTResult == eAzureIoTSuccess );
+static uint32_t prvHandleToggleLed2( AzureIoTHubClientCommandRequest_t * pxMessage,
+                                     uint32_t * pulResponseStatus,
+                                     uint8_t * pucCommandResponsePayloadBuffer,
+                                     uint32_t ulCommandResponsePayloadBufferSize )
+{
+    ( void ) pxMessage;
 
-    xAzIoTResult = AzureIoTJSONWriter_AppendPropertyWithDoubleValue( &xWriter, ( uint8_t * ) sampleazureiotkitTOTAL_STORAGE_PROPERTY_NAME, lengthof( sampleazureiotkitTOTAL_STORAGE_PROPERTY_NAME ),
-                                                                     sampleazureiotkitTOTAL_STORAGE_PROPERTY_VALUE, 0 );
-    configASSERT( xAzIoTResult == eAzureIoTSuccess );
+    xLed2State = !xLed2State;
+    led2_set_state( xLed2State ? LED_STATE_ON : LED_STATE_OFF );
 
-    xAzIoTResult = AzureIoTJSONWriter_AppendPropertyWithDoubleValue( &xWriter, ( uint8_t * ) sampleazureiotkitTOTAL_MEMORY_PROPERTY_NAME, lengthof( sampleazureiotkitTOTAL_MEMORY_PROPERTY_NAME ),
-                                                                     sampleazureiotkitTOTAL_MEMORY_PROPERTY_VALUE, 0 );
-    configASSERT( xAzIoTResult == eAzureIoTSuccess );
+    return prvEmptyResponse( pulResponseStatus, pucCommandResponsePayloadBuffer, ulCommandResponsePayloadBufferSize );
+}
+/*-----------------------------------------------------------*/
 
-    xAzIoTResult = AzureIoTHubClientProperties_BuilderEndComponent( &xAzureIoTHubClient, &xWriter );
-    configASSERT( xAzIoTResult == eAzureIoTSuccess );
+static uint32_t prvHandleDisplayText( AzureIoTHubClientCommandRequest_t * pxMessage,
+                                      uint32_t * pulResponseStatus,
+                                      uint8_t * pucCommandResponsePayloadBuffer,
+                                      uint32_t ulCommandResponsePayloadBufferSize )
+{
+    uint32_t ulStringLength = UNQUOTED_STRING_LENGTH( pxMessage->ulPayloadLength );
 
-    xAzIoTResult = AzureIoTJSONWriter_AppendEndObject( &xWriter );
-    configASSERT( xAzIoTResult == eAzureIoTSuccess );
+    oled_clean_screen();
+    oled_show_message( ( const uint8_t * ) UNQUOTE_STRING( pxMessage->pvMessagePayload ),
+                       ulStringLength <= OLED_DISPLAY_MAX_STRING_LENGTH ? ulStringLength : OLED_DISPLAY_MAX_STRING_LENGTH );
 
-    lBytesWritten = AzureIoTJSONWriter_GetBytesUsed( &xWriter );
+    return prvEmptyResponse( pulResponseStatus, pucCommandResponsePayloadBuffer, ulCommandResponsePayloadBufferSize );
+}
+/*-----------------------------------------------------------*/
 
-    if( lBytesWritten < 0 )
+static const CommandHandlerEntry_t xCommandHandlers[] =
+{
     {
-        LogError( ( "Error getting the bytes written for the device properties JSON" ) );
-        lBytesWritten = 0;
+        { NULL, 0, ( const uint8_t * ) sampleazureiotCOMMAND_TOGGLE_LED1, lengthof( sampleazureiotCOMMAND_TOGGLE_LED1 ) },
+        prvHandleToggleLed1
+    },
+    {
+        { NULL, 0, ( const uint8_t * ) sampleazureiotCOMMAND_TOGGLE_LED2, lengthof( sampleazureiotCOMMAND_TOGGLE_LED2 ) },
+        prvHandleToggleLed2
+    },
+    {
+        { NULL, 0, ( const uint8_t * ) sampleazureiotCOMMAND_DISPLAY_TEXT, lengthof( sampleazureiotCOMMAND_DISPLAY_TEXT ) },
+        prvHandleDisplayText
     }
+};
 
-    return lBytesWritten;
-}
+static uint8_t ucCommandSlots[ dispatchtableSLOT_COUNT( sizeof( xCommandHandlers ) / sizeof( xCommandHandlers[ 0 ] ) ) ];
+static DispatchTable_t xCommandTable = dispatchtableINIT( xCommandHandlers, ucCommandSlots );
 /*-----------------------------------------------------------*/
 
 /**
@@ -165,55 +371,224 @@ uint32_t ulSampleHandleCommand( AzureIoTHubClientCommandRequest_t * pxMessage,
                                 uint8_t * pucCommandResponsePayloadBuffer,
                                 uint32_t ulCommandResponsePayloadBufferSize )
 {
-    uint32_t ulCommandResponsePayloadLength;
-
     ESP_LOGI( TAG, "Command payload : %.*s \r\n",
               ( int16_t ) pxMessage->ulPayloadLength,
               ( const char * ) pxMessage->pvMessagePayload );
 
-    if( strncmp( ( const char * ) pxMessage->pucCommandName, sampleazureiotCOMMAND_TOGGLE_LED1, pxMessage->usCommandNameLength ) == 0 )
+    return CommandsDispatch_Process( &xCommandTable, pxMessage, pulResponseStatus,
+                                     pucCommandResponsePayloadBuffer, ulCommandResponsePayloadBufferSize );
+}
+/*-----------------------------------------------------------*/
+
+#if ( democonfigTELEMETRY_CBOR == 1 )
+    typedef CBORWriter_t TelemetryWriter_t;
+#else
+    typedef TelemetryTemplateWriter_t TelemetryWriter_t;
+#endif
+
+/* Writes a field if the filter lets it through, returning whether it did. */
+static bool prvAppendDoubleField( TelemetryWriter_t * pxWriter,
+                                  uint32_t ulIndex,
+                                  double xValue )
+{
+    AzureIoTResult_t xAzIoTResult;
+    if( !TelemetryFilter_Check( &xTelemetryFilter, ulIndex, xValue ) )
     {
-        xLed1State = !xLed1State;
-        led1_set_state( xLed1State ? LED_STATE_ON : LED_STATE_OFF );
+        return false;
+    }
 
-        *pulResponseStatus = AZ_IOT_STATUS_OK;
-        ulCommandResponsePayloadLength = lengthof( sampleazureiotCOMMAND_EMPTY_PAYLOAD );
-        ( void ) memcpy( pucCommandResponsePayloadBuffer, sampleazureiotCOMMAND_EMPTY_PAYLOAD, ulCommandResponsePayloadLength );
+    #if ( democonfigTELEMETRY_CBOR == 1 )
+        xAzIoTResult = CBORWriter_AppendPropertyWithDoubleValue( pxWriter, xTelemetryTemplateFields[ ulIndex ].pucName,
+                                                                 xTelemetryTemplateFields[ ulIndex ].ulNameLength, xValue );
+    #else
+        xAzIoTResult = TelemetryTemplate_AppendDouble( pxWriter, ulIndex, xValue );
+    #endif
+    configASSERT( xAzIoTResult == eAzureIoTSuccess );
+
+    return true;
+}
+/*-----------------------------------------------------------*/
+
+static bool prvAppendInt32Field( TelemetryWriter_t * pxWriter,
+                                 uint32_t ulIndex,
+                                 int32_t lValue )
+{
+    AzureIoTResult_t xAzIoTResult;
+    if( !TelemetryFilter_Check( &xTelemetryFilter, ulIndex, ( double ) lValue ) )
+    {
+        return false;
     }
-    else if( strncmp( ( const char * ) pxMessage->pucCommandName, sampleazureiotCOMMAND_TOGGLE_LED2, pxMessage->usCommandNameLength ) == 0 )
+
+    #if ( democonfigTELEMETRY_CBOR == 1 )
+        xAzIoTResult = CBORWriter_AppendPropertyWithInt32Value( pxWriter, xTelemetryTemplateFields[ ulIndex ].pucName,
+                                                                xTelemetryTemplateFields[ ulIndex ].ulNameLength, lValue );
+    #else
+        xAzIoTResult = TelemetryTemplate_AppendInt32( pxWriter, ulIndex, lValue );
+    #endif
+    configASSERT( xAzIoTResult == eAzureIoTSuccess );
+
+    return true;
+}
+/*-----------------------------------------------------------*/
+
+static void prvAppendMotionStatistics( TelemetryWriter_t * pxWriter,
+                                       const motion_statistics_t * pxStatistics )
+{
+    AzureIoTResult_t xAzIoTResult;
+    uint32_t ulAxis;
+
+    for( ulAxis = 0; ulAxis < 3; ulAxis++ )
     {
-        xLed2State = !xLed2State;
-        led2_set_state( xLed2State ? LED_STATE_ON : LED_STATE_OFF );
+        const int32_t lValues[ 3 ] =
+        {
+            pxStatistics->min[ ulAxis ], pxStatistics->max[ ulAxis ], pxStatistics->rms[ ulAxis ]
+        };
+        uint32_t ulStatistic;
 
-        *pulResponseStatus = AZ_IOT_STATUS_OK;
-        ulCommandResponsePayloadLength = lengthof( sampleazureiotCOMMAND_EMPTY_PAYLOAD );
-        configASSERT( ulCommandResponsePayloadBufferSize >= ulCommandResponsePayloadLength );
-        ( void ) memcpy( pucCommandResponsePayloadBuffer, sampleazureiotCOMMAND_EMPTY_PAYLOAD, ulCommandResponsePayloadLength );
+        for( ulStatistic = 0; ulStatistic < 3; ulStatistic++ )
+        {
+            uint32_t ulIndex = sampleazureiotFIELD_MOTION_STATISTICS + ulAxis * 3 + ulStatistic;
+            double xValue = ( double ) lValues[ ulStatistic ] / 1000000.0;
+
+            #if ( democonfigTELEMETRY_CBOR == 1 )
+                xAzIoTResult = CBORWriter_AppendPropertyWithDoubleValue( pxWriter, xTelemetryTemplateFields[ ulIndex ].pucName,
+                                                                         xTelemetryTemplateFields[ ulIndex ].ulNameLength, xValue );
+            #else
+                xAzIoTResult = TelemetryTemplate_AppendDouble( pxWriter, ulIndex, xValue );
+            #endif
+            configASSERT( xAzIoTResult == eAzureIoTSuccess );
+        }
     }
-    else if( strncmp( ( const char * ) pxMessage->pucCommandName, sampleazureiotCOMMAND_DISPLAY_TEXT, pxMessage->usCommandNameLength ) == 0 )
+}
+/*-----------------------------------------------------------*/
+
+#if ( democonfigTELEMETRY_TIME_SERIES == 1 )
+
+/* Moves the accelerometer samples into the series, and writes a message of
+ * the series once it is full, or once a gap in the samples ends it. Returns
+ * the length of the message, 0 when there is none. */
+    static uint32_t prvCreateMotionSeries( uint8_t * pucTelemetryData,
+                                           uint32_t ulTelemetryDataLength )
     {
-        oled_clean_screen();
-        uint32_t ulStringLength = UNQUOTED_STRING_LENGTH( pxMessage->ulPayloadLength );
+        AzureIoTResult_t xAzIoTResult;
+        struct timeval xTimeOfDay;
+        uint32_t ulFirstAgeMs;
+        uint32_t ulLength = 0;
+
+        if( !xMotionSeriesReady )
+        {
+            xAzIoTResult = TimeSeries_Init( &xMotionSeries, xMotionChannels,
+                                            sizeof( xMotionChannels ) / sizeof( xMotionChannels[ 0 ] ),
+                                            lMotionSeriesValues, sampleazureiotMOTION_SERIES_SAMPLES,
+                                            MOTION_SAMPLE_PERIOD_MS );
+            configASSERT( xAzIoTResult == eAzureIoTSuccess );
+            xMotionSeriesReady = true;
+        }
 
-        oled_show_message( ( const uint8_t * ) UNQUOTE_STRING( pxMessage->pvMessagePayload ),
-                           ulStringLength <= OLED_DISPLAY_MAX_STRING_LENGTH ? ulStringLength : OLED_DISPLAY_MAX_STRING_LENGTH );
+        if( ulMotionTakenNext >= ulMotionTakenCount )
+        {
+            ulMotionTakenCount = take_motion_samples( lMotionTaken, sampleazureiotMOTION_TAKEN_SAMPLES,
+                                                      &ulFirstAgeMs, &xMotionTakenAfterGap );
+            ulMotionTakenNext = 0;
+
+            ( void ) gettimeofday( &xTimeOfDay, NULL );
+            ullMotionTakenTimeMs = ( uint64_t ) xTimeOfDay.tv_sec * 1000U +
+                                   ( uint64_t ) ( xTimeOfDay.tv_usec / 1000 ) - ulFirstAgeMs;
+        }
 
-        *pulResponseStatus = AZ_IOT_STATUS_OK;
-        ulCommandResponsePayloadLength = lengthof( sampleazureiotCOMMAND_EMPTY_PAYLOAD );
-        configASSERT( ulCommandResponsePayloadBufferSize >= ulCommandResponsePayloadLength );
-        ( void ) memcpy( pucCommandResponsePayloadBuffer, sampleazureiotCOMMAND_EMPTY_PAYLOAD, ulCommandResponsePayloadLength );
+        /* Samples after a gap are not one period after those of the series,
+         * so they start the next series, once this one is sent. */
+        if( !xMotionTakenAfterGap || ( xMotionSeries.ulCount == 0 ) )
+        {
+            xMotionTakenAfterGap = false;
+
+            while( ( ulMotionTakenNext < ulMotionTakenCount ) &&
+                   ( TimeSeries_Append( &xMotionSeries,
+                                        ullMotionTakenTimeMs + ( uint64_t ) ulMotionTakenNext * MOTION_SAMPLE_PERIOD_MS,
+                                        lMotionTaken[ ulMotionTakenNext ] ) == eAzureIoTSuccess ) )
+            {
+                ulMotionTakenNext++;
+            }
+        }
+
+        if( ( xMotionSeries.ulCount == sampleazureiotMOTION_SERIES_SAMPLES ) ||
+            ( xMotionTakenAfterGap && ( xMotionSeries.ulCount > 0 ) ) )
+        {
+            xAzIoTResult = TimeSeries_Encode( &xMotionSeries, pucTelemetryData, ulTelemetryDataLength, &ulLength );
+            configASSERT( xAzIoTResult == eAzureIoTSuccess );
+        }
+
+        return ulLength;
     }
-    else
+/*-----------------------------------------------------------*/
+#endif /* democonfigTELEMETRY_TIME_SERIES == 1 */
+
+#ifdef CONFIG_AZURE_IOT_ULP_SENSORS
+
+/* Takes the readings of the ULP coprocessor once after a wake, and writes
+ * the series of them, as many as fit in a message. Returns the length of the
+ * message, 0 when there is none. */
+    static uint32_t prvCreateSleepSeries( uint8_t * pucTelemetryData,
+                                          uint32_t ulTelemetryDataLength )
     {
-        *pulResponseStatus = AZ_IOT_STATUS_NOT_FOUND;
-        ulCommandResponsePayloadLength = lengthof( sampleazureiotCOMMAND_EMPTY_PAYLOAD );
-        configASSERT( ulCommandResponsePayloadBufferSize >= ulCommandResponsePayloadLength );
-        ( void ) memcpy( pucCommandResponsePayloadBuffer, sampleazureiotCOMMAND_EMPTY_PAYLOAD, ulCommandResponsePayloadLength );
-    }
+        ulp_sample_t xSamples[ CONFIG_AZURE_IOT_ULP_SENSORS_BATCH ];
+        AzureIoTResult_t xAzIoTResult;
+        struct timeval xTimeOfDay;
+        uint64_t ullFirstTimeMs;
+        uint32_t ulBusErrors;
+        uint32_t ulCount;
+        uint32_t ulIndex;
+        uint32_t ulLength = 0;
+
+        if( !xSleepSamplesTaken )
+        {
+            xSleepSamplesTaken = true;
 
-    return ulCommandResponsePayloadLength;
-}
+            xAzIoTResult = TimeSeries_Init( &xSleepSeries, xSleepChannels,
+                                            sizeof( xSleepChannels ) / sizeof( xSleepChannels[ 0 ] ),
+                                            lSleepSeriesValues, CONFIG_AZURE_IOT_ULP_SENSORS_BATCH,
+                                            CONFIG_AZURE_IOT_ULP_SENSORS_PERIOD_MS );
+            configASSERT( xAzIoTResult == eAzureIoTSuccess );
+
+            ulCount = take_ulp_samples( xSamples, CONFIG_AZURE_IOT_ULP_SENSORS_BATCH, &ulBusErrors );
+
+            if( ulBusErrors > 0 )
+            {
+                ESP_LOGW( TAG, "The ULP coprocessor missed %u readings.\r\n", ( unsigned int ) ulBusErrors );
+            }
+
+            /* The last reading was taken just before the wake. */
+            ( void ) gettimeofday( &xTimeOfDay, NULL );
+            ullFirstTimeMs = ( uint64_t ) xTimeOfDay.tv_sec * 1000U + ( uint64_t ) ( xTimeOfDay.tv_usec / 1000 ) -
+                             ( uint64_t ) xTaskGetTickCount() * portTICK_PERIOD_MS;
+
+            if( ulCount > 0 )
+            {
+                ullFirstTimeMs -= ( uint64_t ) ( ulCount - 1 ) * CONFIG_AZURE_IOT_ULP_SENSORS_PERIOD_MS;
+            }
+
+            for( ulIndex = 0; ulIndex < ulCount; ulIndex++ )
+            {
+                const int32_t lValues[ 3 ] =
+                {
+                    xSamples[ ulIndex ].temperature, xSamples[ ulIndex ].humidity, xSamples[ ulIndex ].ambient_light
+                };
+
+                xAzIoTResult = TimeSeries_Append( &xSleepSeries, ullFirstTimeMs, lValues );
+                configASSERT( xAzIoTResult == eAzureIoTSuccess );
+            }
+        }
+
+        if( xSleepSeries.ulCount > 0 )
+        {
+            xAzIoTResult = TimeSeries_Encode( &xSleepSeries, pucTelemetryData, ulTelemetryDataLength, &ulLength );
+            configASSERT( xAzIoTResult == eAzureIoTSuccess );
+        }
+
+        return ulLength;
+    }
 /*-----------------------------------------------------------*/
+#endif /* CONFIG_AZURE_IOT_ULP_SENSORS */
 
 uint32_t ulSampleCreateTelemetry( uint8_t * pucTelemetryData,
                                   uint32_t ulTelemetryDataLength )
@@ -221,6 +596,28 @@ uint32_t ulSampleCreateTelemetry( uint8_t * pucTelemetryData,
     int32_t lBytesWritten = 0;
     time_t xNow = time( NULL );
 
+    #ifdef CONFIG_AZURE_IOT_ULP_SENSORS
+        /* The readings of the sleep are the telemetry of a wake; the readings
+         * of the snapshot go out after a cold boot, which has none. */
+        lBytesWritten = ( int32_t ) prvCreateSleepSeries( pucTelemetryData, ulTelemetryDataLength );
+
+        if( lBytesWritten > 0 )
+        {
+            return ( uint32_t ) lBytesWritten;
+        }
+    #endif /* CONFIG_AZURE_IOT_ULP_SENSORS */
+
+    #if ( democonfigTELEMETRY_TIME_SERIES == 1 )
+        /* A message of the series goes out on its own, the other telemetry
+         * on the next call. */
+        lBytesWritten = ( int32_t ) prvCreateMotionSeries( pucTelemetryData, ulTelemetryDataLength );
+
+        if( lBytesWritten > 0 )
+        {
+            return ( uint32_t ) lBytesWritten;
+        }
+    #endif /* democonfigTELEMETRY_TIME_SERIES == 1 */
+
     if( xNow == INDEFINITE_TIME )
     {
         ESP_LOGE( TAG, "Failed obtaining current time.\r\n" );
@@ -230,84 +627,99 @@ uint32_t ulSampleCreateTelemetry( uint8_t * pucTelemetryData,
         ( difftime( xNow, xLastTelemetrySendTime ) > lTelemetryFrequencySecs ) )
     {
         AzureIoTResult_t xAzIoTResult;
-        AzureIoTJSONWriter_t xWriter;
-
-        float xPressure;
-        float xAltitude;
-        int lMagnetometerX;
-        int lMagnetometerY;
-        int lMagnetometerZ;
-        int lPitch;
-        int lRoll;
-        int lAccelerometerX;
-        int lAccelerometerY;
-        int lAccelerometerZ;
-
-        /* Collect sensor data */
-        float xTemperature = get_temperature();
-        float xHumidity = get_humidity();
-        float xLight = get_ambientLight();
-        get_pressure_altitude( &xPressure, &xAltitude );
-        get_magnetometer( &lMagnetometerX, &lMagnetometerY, &lMagnetometerZ );
-        get_pitch_roll_accel( &lPitch, &lRoll, &lAccelerometerX, &lAccelerometerY, &lAccelerometerZ );
-
-        /* Initialize Json Writer */
-        xAzIoTResult = AzureIoTJSONWriter_Init( &xWriter, pucTelemetryData, ulTelemetryDataLength );
-        configASSERT( xAzIoTResult == eAzureIoTSuccess );
+        TelemetryWriter_t xWriter;
+        sensor_snapshot_t xSnapshot;
+        motion_statistics_t xMotion;
+        bool xHasMotion;
+        bool xAccelerometerWritten;
 
-        xAzIoTResult = AzureIoTJSONWriter_AppendBeginObject( &xWriter );
-        configASSERT( xAzIoTResult == eAzureIoTSuccess );
+        /* Latest readings of the sampling task; nothing waits on the I2C bus here. */
+        get_sensor_snapshot( &xSnapshot );
+        xHasMotion = take_motion_statistics( &xMotion );
 
-        /* Temperature, Humidity, Light Intensity */
-        xAzIoTResult = AzureIoTJSONWriter_AppendPropertyWithDoubleValue( &xWriter, ( uint8_t * ) sampleazureiotTELEMETRY_TEMPERATURE, lengthof( sampleazureiotTELEMETRY_TEMPERATURE ), xTemperature, 2 );
-        configASSERT( xAzIoTResult == eAzureIoTSuccess );
+        int lAccelerometerX = xSnapshot.accel_x;
+        int lAccelerometerY = xSnapshot.accel_y;
+        int lAccelerometerZ = xSnapshot.accel_z;
 
-        xAzIoTResult = AzureIoTJSONWriter_AppendPropertyWithDoubleValue( &xWriter, ( uint8_t * ) sampleazureiotTELEMETRY_HUMIDITY, lengthof( sampleazureiotTELEMETRY_HUMIDITY ), xHumidity, 2 );
-        configASSERT( xAzIoTResult == eAzureIoTSuccess );
+        if( xHasMotion )
+        {
+            /* Mean over the period, truncated to m/s^2 as the single readings were. */
+            lAccelerometerX = xMotion.mean[ 0 ] / 1000000;
+            lAccelerometerY = xMotion.mean[ 1 ] / 1000000;
+            lAccelerometerZ = xMotion.mean[ 2 ] / 1000000;
+        }
 
-        xAzIoTResult = AzureIoTJSONWriter_AppendPropertyWithDoubleValue( &xWriter, ( uint8_t * ) sampleazureiotTELEMETRY_LIGHT, lengthof( sampleazureiotTELEMETRY_LIGHT ), xLight, 2 );
-        configASSERT( xAzIoTResult == eAzureIoTSuccess );
+        #if ( democonfigTELEMETRY_CBOR == 1 )
+            xAzIoTResult = CBORWriter_Init( &xWriter, pucTelemetryData, ulTelemetryDataLength );
+            configASSERT( xAzIoTResult == eAzureIoTSuccess );
 
-        /* Pressure, Altitude */
-        xAzIoTResult = AzureIoTJSONWriter_AppendPropertyWithDoubleValue( &xWriter, ( uint8_t * ) sampleazureiotTELEMETRY_PRESSURE, lengthof( sampleazureiotTELEMETRY_PRESSURE ), xPressure, 2 );
+            xAzIoTResult = CBORWriter_AppendBeginObject( &xWriter );
+        #else
+            if( !xTelemetryTemplateReady )
+            {
+                xAzIoTResult = TelemetryTemplate_Init( &xTelemetryTemplate, xTelemetryTemplateFields,
+                                                       sizeof( xTelemetryTemplateFields ) / sizeof( xTelemetryTemplateFields[ 0 ] ),
+                                                       ucTelemetrySkeleton, sizeof( ucTelemetrySkeleton ) );
+                configASSERT( xAzIoTResult == eAzureIoTSuccess );
+                xTelemetryTemplateReady = true;
+            }
+
+            xAzIoTResult = TelemetryTemplate_Begin( &xWriter, &xTelemetryTemplate, pucTelemetryData, ulTelemetryDataLength );
+        #endif
         configASSERT( xAzIoTResult == eAzureIoTSuccess );
 
-        xAzIoTResult = AzureIoTJSONWriter_AppendPropertyWithDoubleValue( &xWriter, ( uint8_t * ) sampleazureiotTELEMETRY_ALTITUDE, lengthof( sampleazureiotTELEMETRY_ALTITUDE ), xAltitude, 2 );
-        configASSERT( xAzIoTResult == eAzureIoTSuccess );
+        /* Only the fields that moved past their deadband are written, and all
+         * of them when a heartbeat is due. */
+        TelemetryFilter_Begin( &xTelemetryFilter );
 
-        /* Magnetometer */
-        xAzIoTResult = AzureIoTJSONWriter_AppendPropertyWithInt32Value( &xWriter, ( uint8_t * ) sampleazureiotTELEMETRY_MAGNETOMETERX, lengthof( sampleazureiotTELEMETRY_MAGNETOMETERX ), lMagnetometerX );
-        configASSERT( xAzIoTResult == eAzureIoTSuccess );
+        /* Temperature, Humidity, Light Intensity */
+        prvAppendDoubleField( &xWriter, sampleazureiotFIELD_TEMPERATURE, xSnapshot.temperature );
+        prvAppendDoubleField( &xWriter, sampleazureiotFIELD_HUMIDITY, xSnapshot.humidity );
+        prvAppendDoubleField( &xWriter, sampleazureiotFIELD_LIGHT, xSnapshot.ambient_light );
 
-        xAzIoTResult = AzureIoTJSONWriter_AppendPropertyWithInt32Value( &xWriter, ( uint8_t * ) sampleazureiotTELEMETRY_MAGNETOMETERY, lengthof( sampleazureiotTELEMETRY_MAGNETOMETERY ), lMagnetometerY );
-        configASSERT( xAzIoTResult == eAzureIoTSuccess );
+        /* Pressure, Altitude */
+        prvAppendDoubleField( &xWriter, sampleazureiotFIELD_PRESSURE, xSnapshot.pressure );
+        prvAppendDoubleField( &xWriter, sampleazureiotFIELD_ALTITUDE, xSnapshot.altitude );
 
-        xAzIoTResult = AzureIoTJSONWriter_AppendPropertyWithInt32Value( &xWriter, ( uint8_t * ) sampleazureiotTELEMETRY_MAGNETOMETERZ, lengthof( sampleazureiotTELEMETRY_MAGNETOMETERZ ), lMagnetometerZ );
-        configASSERT( xAzIoTResult == eAzureIoTSuccess );
+        /* Magnetometer */
+        prvAppendInt32Field( &xWriter, sampleazureiotFIELD_MAGNETOMETERX, xSnapshot.magnetometer_x );
+        prvAppendInt32Field( &xWriter, sampleazureiotFIELD_MAGNETOMETERY, xSnapshot.magnetometer_y );
+        prvAppendInt32Field( &xWriter, sampleazureiotFIELD_MAGNETOMETERZ, xSnapshot.magnetometer_z );
 
         /* Pitch, Roll, Accelleration */
-        xAzIoTResult = AzureIoTJSONWriter_AppendPropertyWithInt32Value( &xWriter, ( uint8_t * ) sampleazureiotTELEMETRY_PITCH, lengthof( sampleazureiotTELEMETRY_PITCH ), lPitch );
-        configASSERT( xAzIoTResult == eAzureIoTSuccess );
+        prvAppendInt32Field( &xWriter, sampleazureiotFIELD_PITCH, xSnapshot.pitch );
+        prvAppendInt32Field( &xWriter, sampleazureiotFIELD_ROLL, xSnapshot.roll );
 
-        xAzIoTResult = AzureIoTJSONWriter_AppendPropertyWithInt32Value( &xWriter, ( uint8_t * ) sampleazureiotTELEMETRY_ROLL, lengthof( sampleazureiotTELEMETRY_ROLL ), lRoll );
-        configASSERT( xAzIoTResult == eAzureIoTSuccess );
+        /* Not short-circuited, each axis is checked. */
+        xAccelerometerWritten = prvAppendInt32Field( &xWriter, sampleazureiotFIELD_ACCELEROMETERX, lAccelerometerX );
+        xAccelerometerWritten = prvAppendInt32Field( &xWriter, sampleazureiotFIELD_ACCELEROMETERY, lAccelerometerY ) || xAccelerometerWritten;
+        xAccelerometerWritten = prvAppendInt32Field( &xWriter, sampleazureiotFIELD_ACCELEROMETERZ, lAccelerometerZ ) || xAccelerometerWritten;
 
-        xAzIoTResult = AzureIoTJSONWriter_AppendPropertyWithInt32Value( &xWriter, ( uint8_t * ) sampleazureiotTELEMETRY_ACCELEROMETERX, lengthof( sampleazureiotTELEMETRY_ACCELEROMETERX ), lAccelerometerX );
-        configASSERT( xAzIoTResult == eAzureIoTSuccess );
-
-        xAzIoTResult = AzureIoTJSONWriter_AppendPropertyWithInt32Value( &xWriter, ( uint8_t * ) sampleazureiotTELEMETRY_ACCELEROMETERY, lengthof( sampleazureiotTELEMETRY_ACCELEROMETERY ), lAccelerometerY );
-        configASSERT( xAzIoTResult == eAzureIoTSuccess );
+        /* The statistics describe the same window as the mean, so they go with it. */
+        if( xHasMotion && xAccelerometerWritten )
+        {
+            prvAppendMotionStatistics( &xWriter, &xMotion );
+        }
 
-        xAzIoTResult = AzureIoTJSONWriter_AppendPropertyWithInt32Value( &xWriter, ( uint8_t * ) sampleazureiotTELEMETRY_ACCELEROMETERZ, lengthof( sampleazureiotTELEMETRY_ACCELEROMETERZ ), lAccelerometerZ );
-        configASSERT( xAzIoTResult == eAzureIoTSuccess );
+        #if ( democonfigTELEMETRY_CBOR == 1 )
+            xAzIoTResult = CBORWriter_AppendEndObject( &xWriter );
+            configASSERT( xAzIoTResult == eAzureIoTSuccess );
 
-        /* Complete Json Content */
-        xAzIoTResult = AzureIoTJSONWriter_AppendEndObject( &xWriter );
-        configASSERT( xAzIoTResult == eAzureIoTSuccess );
+            lBytesWritten = CBORWriter_GetBytesUsed( &xWriter );
+        #else
+            xAzIoTResult = TelemetryTemplate_End( &xWriter );
+            configASSERT( xAzIoTResult == eAzureIoTSuccess );
 
-        lBytesWritten = AzureIoTJSONWriter_GetBytesUsed( &xWriter );
+            lBytesWritten = TelemetryTemplate_GetBytesUsed( &xWriter );
+        #endif /* democonfigTELEMETRY_CBOR == 1 */
         configASSERT( lBytesWritten > 0 );
 
+        if( TelemetryFilter_End( &xTelemetryFilter ) == 0 )
+        {
+            /* Nothing changed, no message. */
+            lBytesWritten = 0;
+        }
+
         xLastTelemetrySendTime = xNow;
     }
 
@@ -316,12 +728,33 @@ uint32_t ulSampleCreateTelemetry( uint8_t * pucTelemetryData,
 /*-----------------------------------------------------------*/
 
 
+/* Writes the start of the acknowledgement of a writable property, its value follows. */
+static void prvBeginAck( AzureIoTJSONWriter_t * pxWriter,
+                         const char * pcName,
+                         uint32_t ulNameLength,
+                         uint32_t ulVersion )
+{
+    AzureIoTResult_t xAzIoTResult;
+
+    xAzIoTResult = AzureIoTHubClientProperties_BuilderBeginResponseStatus( &xAzureIoTHubClient,
+                                                                           pxWriter,
+                                                                           ( const uint8_t * ) pcName,
+                                                                           ulNameLength,
+                                                                           sampleazureiotPROPERTY_STATUS_SUCCESS,
+                                                                           ulVersion,
+                                                                           ( const uint8_t * ) sampleazureiotPROPERTY_SUCCESS,
+                                                                           lengthof( sampleazureiotPROPERTY_SUCCESS ) );
+    configASSERT( xAzIoTResult == eAzureIoTSuccess );
+}
+/*-----------------------------------------------------------*/
+
 /**
- * @brief Acknowledges the update of Telemetry Frequency property.
+ * @brief Acknowledges the writable properties received, sampleazureiotRECEIVED_* bits.
  */
-static uint32_t prvGenerateAckForTelemetryFrequencyPropertyUpdate( uint8_t * pucPropertiesData,
-                                                                   uint32_t ulPropertiesDataSize,
-                                                                   uint32_t ulVersion )
+static uint32_t prvGenerateAckForWritableProperties( uint8_t * pucPropertiesData,
+                                                     uint32_t ulPropertiesDataSize,
+                                                     uint32_t ulVersion,
+                                                     uint32_t ulReceived )
 {
     AzureIoTResult_t xAzIoTResult;
     AzureIoTJSONWriter_t xWriter;
@@ -333,21 +766,41 @@ static uint32_t prvGenerateAckForTelemetryFrequencyPropertyUpdate( uint8_t * puc
     xAzIoTResult = AzureIoTJSONWriter_AppendBeginObject( &xWriter );
     configASSERT( xAzIoTResult == eAzureIoTSuccess );
 
-    xAzIoTResult = AzureIoTHubClientProperties_BuilderBeginResponseStatus( &xAzureIoTHubClient,
-                                                                           &xWriter,
-                                                                           ( const uint8_t * ) sampleazureiotPROPERTY_TELEMETRY_FREQUENCY,
-                                                                           lengthof( sampleazureiotPROPERTY_TELEMETRY_FREQUENCY ),
-                                                                           sampleazureiotPROPERTY_STATUS_SUCCESS,
-                                                                           ulVersion,
-                                                                           ( const uint8_t * ) sampleazureiotPROPERTY_SUCCESS,
-                                                                           lengthof( sampleazureiotPROPERTY_SUCCESS ) );
-    configASSERT( xAzIoTResult == eAzureIoTSuccess );
+    if( ( ulReceived & sampleazureiotRECEIVED_FREQUENCY ) != 0 )
+    {
+        prvBeginAck( &xWriter, sampleazureiotPROPERTY_TELEMETRY_FREQUENCY,
+                     lengthof( sampleazureiotPROPERTY_TELEMETRY_FREQUENCY ), ulVersion );
 
-    xAzIoTResult = AzureIoTJSONWriter_AppendInt32( &xWriter, lTelemetryFrequencySecs );
-    configASSERT( xAzIoTResult == eAzureIoTSuccess );
+        xAzIoTResult = AzureIoTJSONWriter_AppendInt32( &xWriter, lTelemetryFrequencySecs );
+        configASSERT( xAzIoTResult == eAzureIoTSuccess );
 
-    xAzIoTResult = AzureIoTHubClientProperties_BuilderEndResponseStatus( &xAzureIoTHubClient, &xWriter );
-    configASSERT( xAzIoTResult == eAzureIoTSuccess );
+        xAzIoTResult = AzureIoTHubClientProperties_BuilderEndResponseStatus( &xAzureIoTHubClient, &xWriter );
+        configASSERT( xAzIoTResult == eAzureIoTSuccess );
+    }
+
+    if( ( ulReceived & sampleazureiotRECEIVED_HEARTBEAT ) != 0 )
+    {
+        prvBeginAck( &xWriter, sampleazureiotPROPERTY_TELEMETRY_HEARTBEAT,
+                     lengthof( sampleazureiotPROPERTY_TELEMETRY_HEARTBEAT ), ulVersion );
+
+        xAzIoTResult = AzureIoTJSONWriter_AppendInt32( &xWriter, TelemetryFilter_GetHeartbeat( &xTelemetryFilter ) );
+        configASSERT( xAzIoTResult == eAzureIoTSuccess );
+
+        xAzIoTResult = AzureIoTHubClientProperties_BuilderEndResponseStatus( &xAzureIoTHubClient, &xWriter );
+        configASSERT( xAzIoTResult == eAzureIoTSuccess );
+    }
+
+    if( ( ulReceived & sampleazureiotRECEIVED_DEADBANDS ) != 0 )
+    {
+        prvBeginAck( &xWriter, sampleazureiotPROPERTY_TELEMETRY_DEADBANDS,
+                     lengthof( sampleazureiotPROPERTY_TELEMETRY_DEADBANDS ), ulVersion );
+
+        xAzIoTResult = TelemetryFilter_AppendDeadbands( &xTelemetryFilter, &xWriter, sampleazureiotTELEMETRY_DECIMALS );
+        configASSERT( xAzIoTResult == eAzureIoTSuccess );
+
+        xAzIoTResult = AzureIoTHubClientProperties_BuilderEndResponseStatus( &xAzureIoTHubClient, &xWriter );
+        configASSERT( xAzIoTResult == eAzureIoTSuccess );
+    }
 
     xAzIoTResult = AzureIoTJSONWriter_AppendEndObject( &xWriter );
     configASSERT( xAzIoTResult == eAzureIoTSuccess );
@@ -359,104 +812,195 @@ static uint32_t prvGenerateAckForTelemetryFrequencyPropertyUpdate( uint8_t * puc
 }
 /*-----------------------------------------------------------*/
 
-static void prvSkipPropertyAndValue( AzureIoTJSONReader_t * pxReader )
+static AzureIoTResult_t prvHandleTelemetryFrequency( AzureIoTJSONReader_t * pxReader,
+                                                     void * pvContext )
+{
+    AzureIoTResult_t xAzIoTResult;
+
+    xAzIoTResult = AzureIoTJSONReader_GetTokenInt32( pxReader, ( int32_t * ) &lTelemetryFrequencySecs );
+
+    if( xAzIoTResult == eAzureIoTSuccess )
+    {
+        /* Acknowledged once the version is known, as it usually comes last. */
+        *( uint32_t * ) pvContext |= sampleazureiotRECEIVED_FREQUENCY;
+    }
+
+    return xAzIoTResult;
+}
+/*-----------------------------------------------------------*/
+
+static AzureIoTResult_t prvHandleTelemetryHeartbeat( AzureIoTJSONReader_t * pxReader,
+                                                     void * pvContext )
 {
-    AzureIoTResult_t xResult;
+    int32_t lHeartbeatSecs;
+
+    if( ( AzureIoTJSONReader_GetTokenInt32( pxReader, &lHeartbeatSecs ) != eAzureIoTSuccess ) ||
+        ( TelemetryFilter_SetHeartbeat( &xTelemetryFilter, lHeartbeatSecs ) != eAzureIoTSuccess ) )
+    {
+        /* Left unacknowledged, the other properties are still applied. */
+        ESP_LOGE( TAG, "Invalid %s value.\r\n", sampleazureiotPROPERTY_TELEMETRY_HEARTBEAT );
+        return AzureIoTJSONReader_SkipChildren( pxReader );
+    }
+
+    *( uint32_t * ) pvContext |= sampleazureiotRECEIVED_HEARTBEAT;
+
+    return eAzureIoTSuccess;
+}
+/*-----------------------------------------------------------*/
 
-    xResult = AzureIoTJSONReader_NextToken( pxReader );
-    configASSERT( xResult == eAzureIoTSuccess );
+static AzureIoTResult_t prvHandleTelemetryDeadbands( AzureIoTJSONReader_t * pxReader,
+                                                     void * pvContext )
+{
+    if( TelemetryFilter_ParseDeadbands( &xTelemetryFilter, pxReader ) != eAzureIoTSuccess )
+    {
+        /* The reader was left on the value, which is skipped as a whole. */
+        ESP_LOGE( TAG, "Invalid %s value.\r\n", sampleazureiotPROPERTY_TELEMETRY_DEADBANDS );
+        return AzureIoTJSONReader_SkipChildren( pxReader );
+    }
 
-    xResult = AzureIoTJSONReader_SkipChildren( pxReader );
-    configASSERT( xResult == eAzureIoTSuccess );
+    *( uint32_t * ) pvContext |= sampleazureiotRECEIVED_DEADBANDS;
 
-    xResult = AzureIoTJSONReader_NextToken( pxReader );
-    configASSERT( xResult == eAzureIoTSuccess );
+    return eAzureIoTSuccess;
 }
 /*-----------------------------------------------------------*/
 
+static const PropertyHandlerEntry_t xPropertyHandlers[] =
+{
+    {
+        {
+            NULL, 0,
+            ( const uint8_t * ) sampleazureiotPROPERTY_TELEMETRY_FREQUENCY,
+            lengthof( sampleazureiotPROPERTY_TELEMETRY_FREQUENCY )
+        },
+        prvHandleTelemetryFrequency
+    },
+    {
+        {
+            NULL, 0,
+            ( const uint8_t * ) sampleazureiotPROPERTY_TELEMETRY_HEARTBEAT,
+            lengthof( sampleazureiotPROPERTY_TELEMETRY_HEARTBEAT )
+        },
+        prvHandleTelemetryHeartbeat
+    },
+    {
+        {
+            NULL, 0,
+            ( const uint8_t * ) sampleazureiotPROPERTY_TELEMETRY_DEADBANDS,
+            lengthof( sampleazureiotPROPERTY_TELEMETRY_DEADBANDS )
+        },
+        prvHandleTelemetryDeadbands
+    }
+};
+
+static uint8_t ucPropertySlots[ dispatchtableSLOT_COUNT( sizeof( xPropertyHandlers ) / sizeof( xPropertyHandlers[ 0 ] ) ) ];
+static DispatchTable_t xPropertyTable = dispatchtableINIT( xPropertyHandlers, ucPropertySlots );
+/*-----------------------------------------------------------*/
+
 /**
  * @brief Handler for writable properties updates.
  */
-void vHandleWritableProperties( AzureIoTHubClientPropertiesResponse_t * pxMessage,
-                                uint8_t * pucWritablePropertyResponseBuffer,
-                                uint32_t ulWritablePropertyResponseBufferSize,
-                                uint32_t * pulWritablePropertyResponseBufferLength )
+uint32_t ulHandleWritableProperties( AzureIoTHubClientPropertiesResponse_t * pxMessage,
+                                     uint8_t * pucWritablePropertyResponseBuffer,
+                                     uint32_t ulWritablePropertyResponseBufferSize,
+                                     uint32_t * pulWritablePropertyResponseBufferLength )
 {
     AzureIoTResult_t xAzIoTResult;
-    AzureIoTJSONReader_t xJsonReader;
-    const uint8_t * pucComponentName = NULL;
-    uint32_t ulComponentNameLength = 0;
     uint32_t ulPropertyVersion;
+    uint32_t ulReceived = 0;
 
-    xAzIoTResult = AzureIoTJSONReader_Init( &xJsonReader, pxMessage->pvMessagePayload, pxMessage->ulPayloadLength );
-    configASSERT( xAzIoTResult == eAzureIoTSuccess );
-
-    xAzIoTResult = AzureIoTHubClientProperties_GetPropertiesVersion( &xAzureIoTHubClient, &xJsonReader, pxMessage->xMessageType, &ulPropertyVersion );
-    configASSERT( xAzIoTResult == eAzureIoTSuccess );
-
-    /* Reset JSON reader to the beginning */
-    xAzIoTResult = AzureIoTJSONReader_Init( &xJsonReader, pxMessage->pvMessagePayload, pxMessage->ulPayloadLength );
-    configASSERT( xAzIoTResult == eAzureIoTSuccess );
+    /* The version and the properties are read in the same pass. */
+    xAzIoTResult = PropertiesDispatch_Process( pxMessage, eAzureIoTHubClientPropertyWritable, &xPropertyTable,
+                                               &ulReceived, &ulPropertyVersion );
 
-    while( ( xAzIoTResult = AzureIoTHubClientProperties_GetNextComponentProperty( &xAzureIoTHubClient, &xJsonReader,
-                                                                                  pxMessage->xMessageType, eAzureIoTHubClientPropertyWritable,
-                                                                                  &pucComponentName, &ulComponentNameLength ) ) == eAzureIoTSuccess )
+    if( xAzIoTResult != eAzureIoTSuccess )
     {
-        if( AzureIoTJSONReader_TokenIsTextEqual( &xJsonReader,
-                                                 ( const uint8_t * ) sampleazureiotPROPERTY_TELEMETRY_FREQUENCY,
-                                                 lengthof( sampleazureiotPROPERTY_TELEMETRY_FREQUENCY ) ) )
-        {
-            xAzIoTResult = AzureIoTJSONReader_NextToken( &xJsonReader );
-            configASSERT( xAzIoTResult == eAzureIoTSuccess );
-
-            xAzIoTResult = AzureIoTJSONReader_GetTokenInt32( &xJsonReader, ( int32_t * ) &lTelemetryFrequencySecs );
-            configASSERT( xAzIoTResult == eAzureIoTSuccess );
+        LogError( ( "There was an error parsing the properties: result 0x%08x", xAzIoTResult ) );
+        return 0;
+    }
+    else
+    {
+        LogInfo( ( "Successfully parsed properties" ) );
 
-            *pulWritablePropertyResponseBufferLength = prvGenerateAckForTelemetryFrequencyPropertyUpdate(
+        if( ulReceived != 0 )
+        {
+            *pulWritablePropertyResponseBufferLength = prvGenerateAckForWritableProperties(
                 pucWritablePropertyResponseBuffer,
                 ulWritablePropertyResponseBufferSize,
-                ulPropertyVersion );
+                ulPropertyVersion,
+                ulReceived );
+        }
 
+        if( ( ulReceived & sampleazureiotRECEIVED_FREQUENCY ) != 0 )
+        {
             ESP_LOGI( TAG, "Telemetry frequency set to once every %d seconds.\r\n", lTelemetryFrequencySecs );
-
-            xAzIoTResult = AzureIoTJSONReader_NextToken( &xJsonReader );
-            configASSERT( xAzIoTResult == eAzureIoTSuccess );
         }
-        else
-        {
-            LogInfo( ( "Unknown property arrived: skipping over it." ) );
 
-            /* Unknown property arrived. We have to skip over the property and value to continue iterating. */
-            prvSkipPropertyAndValue( &xJsonReader );
+        if( ( ulReceived & sampleazureiotRECEIVED_HEARTBEAT ) != 0 )
+        {
+            ESP_LOGI( TAG, "Telemetry heartbeat set to once every %d seconds.\r\n",
+                      TelemetryFilter_GetHeartbeat( &xTelemetryFilter ) );
         }
     }
 
-    if( xAzIoTResult != eAzureIoTErrorEndOfProperties )
+    return ulPropertyVersion;
+}
+/*-----------------------------------------------------------*/
+
+uint32_t ulSampleCreateReportedPropertiesUpdate( uint8_t * pucPropertiesData,
+                                                 uint32_t ulPropertiesDataSize )
+{
+    /* A document sent without an answer, such as before a disconnect, is sent again. */
+    if( ( xDeviceInfoState == eDeviceInfoInFlight ) &&
+        ( xTaskGetTickCount() - xDeviceInfoSentTime >= pdMS_TO_TICKS( democonfigREPORTED_PROPERTIES_ACK_TIMEOUT_MS ) ) )
     {
-        LogError( ( "There was an error parsing the properties: result 0x%08x", xAzIoTResult ) );
+        xDeviceInfoState = eDeviceInfoPending;
     }
-    else
+
+    /* No reported properties to send if length is zero. */
+    if( xDeviceInfoState != eDeviceInfoPending )
     {
-        LogInfo( ( "Successfully parsed properties" ) );
+        return 0;
     }
+
+    configASSERT( ulPropertiesDataSize >= lengthof( cDeviceInfoPayload ) );
+    ( void ) memcpy( pucPropertiesData, cDeviceInfoPayload, lengthof( cDeviceInfoPayload ) );
+    xDeviceInfoState = eDeviceInfoInFlight;
+
+    return lengthof( cDeviceInfoPayload );
 }
 /*-----------------------------------------------------------*/
 
-static bool xUpdateDeviceProperties = true;
+void vSampleReportedPropertiesUpdateSent( uint32_t ulRequestId,
+                                          AzureIoTResult_t xResult )
+{
+    if( xDeviceInfoState != eDeviceInfoInFlight )
+    {
+        return;
+    }
 
-uint32_t ulSampleCreateReportedPropertiesUpdate( uint8_t * pucPropertiesData,
-                                                 uint32_t ulPropertiesDataSize )
+    if( xResult != eAzureIoTSuccess )
+    {
+        xDeviceInfoState = eDeviceInfoPending;
+        return;
+    }
+
+    ulDeviceInfoRequestId = ulRequestId;
+    xDeviceInfoSentTime = xTaskGetTickCount();
+}
+/*-----------------------------------------------------------*/
+
+void vSampleHandleReportedPropertiesResponse( AzureIoTHubClientPropertiesResponse_t * pxMessage )
 {
-    /* No reported properties to send if length is zero. */
-    uint32_t lBytesWritten = 0;
+    uint32_t ulStatus;
 
-    if( xUpdateDeviceProperties )
+    if( ( xDeviceInfoState != eDeviceInfoInFlight ) ||
+        ( pxMessage->xMessageType != eAzureIoTHubPropertiesReportedResponseMessage ) ||
+        ( pxMessage->ulRequestID != ulDeviceInfoRequestId ) )
     {
-        lBytesWritten = lGenerateDeviceInfo( pucPropertiesData, ulPropertiesDataSize );
-        configASSERT( lBytesWritten > 0 );
-        xUpdateDeviceProperties = false;
+        return;
     }
 
-    return lBytesWritten;
+    ulStatus = ( uint32_t ) pxMessage->xMessageStatus;
+    xDeviceInfoState = ( ( ulStatus >= 200 ) && ( ulStatus < 300 ) ) ? eDeviceInfoReported : eDeviceInfoPending;
 }
 /*-----------------------------------------------------------*/
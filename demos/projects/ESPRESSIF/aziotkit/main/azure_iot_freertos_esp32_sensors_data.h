@@ -8,17 +8,6 @@
 #include "azure_iot_hub_client.h"
 #include "azure_iot_hub_client_properties.h"
 
-/**
- * @brief Generates a json with the device key information.
- *
- * @param[out] pucPropertiesData       Buffer to write the data on.
- * @param[in]  ulPropertiesDataSize    Size of the buffer.
- *
- * @return int32_t Number of bytes written in the buffer.
- */
-int32_t lGenerateDeviceInfo( uint8_t * pucPropertiesData,
-                             uint32_t ulPropertiesDataSize );
-
 /**
  * @brief Command message callback handler
  *
@@ -69,4 +58,20 @@ void vSampleHandleWritablePropertiesUpdate( AzureIoTHubClientPropertiesResponse_
 uint32_t ulSampleCreateReportedPropertiesUpdate( uint8_t * pucPropertiesData,
                                                  uint32_t ulPropertiesDataSize );
 
+/**
+ * @brief Records that the reported properties update was sent.
+ *
+ * @param[in] ulRequestId Request ID of the update.
+ * @param[in] xResult     Result of sending the update.
+ */
+void vSampleReportedPropertiesUpdateSent( uint32_t ulRequestId,
+                                          AzureIoTResult_t xResult );
+
+/**
+ * @brief Handles the response to a reported properties update.
+ *
+ * @param pxMessage The reported properties response.
+ */
+void vSampleHandleReportedPropertiesResponse( AzureIoTHubClientPropertiesResponse_t * pxMessage );
+
 #endif /* AZURE_IOT_FREERTOS_ESP32_SENSORS_H */
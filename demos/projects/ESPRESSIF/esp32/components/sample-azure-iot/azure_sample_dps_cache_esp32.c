@@ -0,0 +1,101 @@
+/* Copyright (c) Microsoft Corporation.
+   Licensed under the MIT License. */
+
+#include "azure_sample_dps_cache.h"
+
+#include <string.h>
+
+/* NVS includes, initialized by app_main(). */
+#include "nvs.h"
+
+#include "sdkconfig.h"
+
+#ifdef CONFIG_SAMPLE_IOT_DEEP_SLEEP
+    #include "esp_attr.h"
+
+    /* The boards that sleep between their batches of telemetry. */
+    #include "azure_sample_deep_sleep.h"
+#endif
+
+#define dpscacheNVS_NAMESPACE    "azure_dps"
+#define dpscacheNVS_KEY          "assignment"
+
+#ifdef CONFIG_SAMPLE_IOT_DEEP_SLEEP
+    /* A copy of the record kept through the deep sleep, so a wake does not
+     * read NVS, valid once read or written since the cold boot. */
+    static RTC_DATA_ATTR DPSCacheRecord_t xRetainedRecord;
+    static RTC_DATA_ATTR bool xRetainedValid;
+#endif
+
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t DPSCache_PlatformRead( DPSCacheRecord_t * pxRecord )
+{
+    nvs_handle_t xHandle;
+    size_t xLength = sizeof( *pxRecord );
+    esp_err_t xError;
+
+    #ifdef CONFIG_SAMPLE_IOT_DEEP_SLEEP
+        if( xRetainedValid && DeepSleep_PlatformWoke() )
+        {
+            ( void ) memcpy( pxRecord, &xRetainedRecord, sizeof( *pxRecord ) );
+            return eAzureIoTSuccess;
+        }
+    #endif
+
+    if( nvs_open( dpscacheNVS_NAMESPACE, NVS_READONLY, &xHandle ) != ESP_OK )
+    {
+        return eAzureIoTErrorFailed;
+    }
+
+    xError = nvs_get_blob( xHandle, dpscacheNVS_KEY, pxRecord, &xLength );
+    nvs_close( xHandle );
+
+    if( ( xError != ESP_OK ) || ( xLength != sizeof( *pxRecord ) ) )
+    {
+        return eAzureIoTErrorFailed;
+    }
+
+    #ifdef CONFIG_SAMPLE_IOT_DEEP_SLEEP
+        ( void ) memcpy( &xRetainedRecord, pxRecord, sizeof( xRetainedRecord ) );
+        xRetainedValid = true;
+    #endif
+
+    return eAzureIoTSuccess;
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t DPSCache_PlatformWrite( const DPSCacheRecord_t * pxRecord )
+{
+    nvs_handle_t xHandle;
+    esp_err_t xError;
+
+    if( nvs_open( dpscacheNVS_NAMESPACE, NVS_READWRITE, &xHandle ) != ESP_OK )
+    {
+        return eAzureIoTErrorFailed;
+    }
+
+    /* NVS appends the new blob and wear levels, so a rewrite does not erase
+     * a sector each time. */
+    xError = nvs_set_blob( xHandle, dpscacheNVS_KEY, pxRecord, sizeof( *pxRecord ) );
+
+    if( xError == ESP_OK )
+    {
+        xError = nvs_commit( xHandle );
+    }
+
+    nvs_close( xHandle );
+
+    #ifdef CONFIG_SAMPLE_IOT_DEEP_SLEEP
+        /* Kept as written in NVS, so the copy never holds what NVS does not. */
+        xRetainedValid = ( xError == ESP_OK );
+
+        if( xRetainedValid )
+        {
+            ( void ) memcpy( &xRetainedRecord, pxRecord, sizeof( xRetainedRecord ) );
+        }
+    #endif
+
+    return ( xError == ESP_OK ) ? eAzureIoTSuccess : eAzureIoTErrorFailed;
+}
+/*-----------------------------------------------------------*/
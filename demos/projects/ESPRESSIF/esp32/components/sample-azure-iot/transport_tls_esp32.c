@@ -22,11 +22,12 @@
 /**
  * @file transport_tls_esp32.c
  * @brief TLS transport interface implementations. This implementation uses
- * mbedTLS.
+ * esp-tls, on top of mbedTLS.
  */
 
 /* Standard includes. */
 #include "errno.h"
+#include <string.h>
 
 /* FreeRTOS includes. */
 #include "freertos/FreeRTOS.h"
@@ -36,14 +37,53 @@
 
 #include "esp_log.h"
 
+/* The peak clock during the handshake. */
+#include "azure_sample_perf_governor.h"
+
 /* TLS includes. */
-#include "esp_transport_ssl.h"
+#include "esp_tls.h"
+#include "lwip/sockets.h"
 
 #include "demo_config.h"
 
+/* Link losses, which fail the connections made over the lost link. */
+#include "azure_sample_link.h"
+
+#if defined( CONFIG_SAMPLE_IOT_DEEP_SLEEP ) && defined( CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS )
+    #include "esp_attr.h"
+    #include "mbedtls/ssl.h"
+
+    /* The ticket kept through the deep sleep, serialized by mbedTLS. */
+    #define tlsesp32RETAINED_SESSION_SIZE    768
+
+    /* esp-tls only wraps the session of mbedTLS in its opaque type, which
+     * holds nothing else, as esp_tls_mbedtls.c defines it. */
+    struct esp_tls_client_session
+    {
+        mbedtls_ssl_session saved_session;
+    };
+
+    /* The ticket of the last connection, in the memory kept through the deep
+     * sleep, so that a wake resumes the session. Zero after a cold boot. */
+    typedef struct TlsRetainedSession
+    {
+        char cHostName[ sizeof( ( ( TlsSessionCacheEntry_t * ) NULL )->cHostName ) ];
+        size_t xLength;
+        unsigned char ucSession[ tlsesp32RETAINED_SESSION_SIZE ];
+    } TlsRetainedSession_t;
+
+    static RTC_DATA_ATTR TlsRetainedSession_t xRetainedSession;
+#endif
+
 /* For using the ATECC608 secure element if support is configured */
 #ifdef democonfigUSE_HSM
     #include "cryptoauthlib.h"
+    #include "esp_task_wdt.h"
+
+    #if defined(CONFIG_ATECC608A_TNG)
+        #include "tng_atcacert_client.h"
+        #include "mbedtls/pem.h"
+    #endif
 #endif
 
 static const char *TAG = "tls_freertos";
@@ -53,6 +93,30 @@ static const char *TAG = "tls_freertos";
 #define tlsesp32SERIAL_NUMBER_SIZE 9
 #define tlsesp32REGISTRATION_ID_SIZE 21
 
+/* Longest the handshake waits for the socket before the task looks at the
+ * deadline and its watchdog again. */
+#define tlsesp32HANDSHAKE_SLICE_MS 100
+
+/* Registration ID made the first time it is asked for, so the serial
+ * number is read from the ATECC608 once per boot. */
+static char cRegistrationId[ tlsesp32REGISTRATION_ID_SIZE ] = { 0 };
+
+#if defined(CONFIG_ATECC608A_TNG)
+
+/* Most bytes of a certificate of the Trust&GO chip, in DER. */
+#define tlsesp32MAX_DER_CERT_SIZE 1024
+
+/* Most bytes of the device and signer certificates, in PEM. */
+#define tlsesp32CERT_CHAIN_SIZE 2048
+
+/* Device and signer certificates of the Trust&GO chip, read and decoded
+ * the first time a connection needs them instead of by esp-tls on each
+ * connect. Kept in PEM, as DER holds a single certificate. */
+static char cCertChain[ tlsesp32CERT_CHAIN_SIZE ];
+static size_t xCertChainLength = 0;
+
+#endif
+
 #if defined(CONFIG_ATECC608A_TNG)
 /**
  * @brief [Trust&GO] Dynamically generate and write the registration ID as a
@@ -178,6 +242,16 @@ uint32_t getRegistrationId( char **ppcRegistrationId ) {
         if(*ppcRegistrationId != NULL) {
             return 1;
         }
+
+        if(cRegistrationId[0] != '\0') {
+            *ppcRegistrationId = malloc(strlen(cRegistrationId) + 1);
+            if(*ppcRegistrationId == NULL) {
+                return 3;
+            }
+            strcpy(*ppcRegistrationId, cRegistrationId);
+            return 0;
+        }
+
         uint32_t ret = 0;
         uint8_t sernum[tlsesp32SERIAL_NUMBER_SIZE];
         ATCA_STATUS s;
@@ -210,22 +284,89 @@ uint32_t getRegistrationId( char **ppcRegistrationId ) {
  
         #endif
 
+        strncpy(cRegistrationId, *ppcRegistrationId, sizeof(cRegistrationId) - 1);
+
         ESP_LOGI( TAG, "Registration ID is %s", *ppcRegistrationId );  
         return 0;
     }
 
+#if defined(CONFIG_ATECC608A_TNG)
+/**
+ * @brief [Trust&GO] Read the device and signer certificates from the
+ *  ATECC608 into cCertChain, the first time only
+ *
+ * @return  0   if the certificates are in cCertChain
+ */
+static uint32_t prvReadCertChain( void ) {
+
+        uint8_t *pucDerCert;
+        size_t xDerCertSize;
+        size_t xPemLength;
+        int ret = ATCA_SUCCESS;
+
+        if(xCertChainLength != 0) {
+            return 0;
+        }
+
+        /* The signer certificate is read first, the device certificate
+            being rebuilt against it, then each is written after the other. */
+        pucDerCert = pvPortMalloc(2 * tlsesp32MAX_DER_CERT_SIZE);
+        if(pucDerCert == NULL) {
+            return 3;
+        }
+
+        xDerCertSize = tlsesp32MAX_DER_CERT_SIZE;
+        ret = tng_atcacert_read_signer_cert(pucDerCert + tlsesp32MAX_DER_CERT_SIZE, &xDerCertSize);
+
+        if(ret == ATCA_SUCCESS) {
+            size_t xSignerCertSize = xDerCertSize;
+
+            xDerCertSize = tlsesp32MAX_DER_CERT_SIZE;
+            ret = tng_atcacert_read_device_cert(pucDerCert, &xDerCertSize, pucDerCert + tlsesp32MAX_DER_CERT_SIZE);
+
+            if(ret == ATCA_SUCCESS) {
+                ret = mbedtls_pem_write_buffer("-----BEGIN CERTIFICATE-----\n", "-----END CERTIFICATE-----\n",
+                                               pucDerCert, xDerCertSize,
+                                               (unsigned char *)cCertChain, sizeof(cCertChain), &xPemLength);
+            }
+
+            if(ret == 0) {
+                /* The signer certificate overwrites the NUL of the device one. */
+                xCertChainLength = xPemLength - 1;
+                ret = mbedtls_pem_write_buffer("-----BEGIN CERTIFICATE-----\n", "-----END CERTIFICATE-----\n",
+                                               pucDerCert + tlsesp32MAX_DER_CERT_SIZE, xSignerCertSize,
+                                               (unsigned char *)cCertChain + xCertChainLength,
+                                               sizeof(cCertChain) - xCertChainLength, &xPemLength);
+            }
+        }
+
+        vPortFree(pucDerCert);
+
+        if(ret != 0) {
+            ESP_LOGE( TAG, "Failed to read the certificates from ATECC608, ret= %d", ret );
+            xCertChainLength = 0;
+            return 2;
+        }
+
+        /* With its NUL, which mbedTLS wants to parse PEM. */
+        xCertChainLength += xPemLength;
+        return 0;
+}
+#endif
+
 #endif /* democonfigUSE_HSM */
 
 
 /**
  * @brief Definition of the network context for the transport interface
- * implementation that uses mbedTLS and FreeRTOS+TLS sockets.
+ * implementation that uses esp-tls.
  */
 typedef struct EspTlsTransportParams
 {
-    esp_transport_handle_t xTransport;
+    esp_tls_t * pxTls;
     uint32_t ulReceiveTimeoutMs;
     uint32_t ulSendTimeoutMs;
+    uint32_t ulLinkLosses; /* Link_Losses() when connected. */
 } EspTlsTransportParams_t;
 
 /* Each transport defines the same NetworkContext. The user then passes their respective transport */
@@ -237,6 +378,215 @@ struct NetworkContext
     void * pParams;
 };
 
+/* Root CA in the global CA store of esp-tls. It is parsed the first time
+ * it is given, and shared by all the connections after that. */
+static const uint8_t * pucGlobalCaStore = NULL;
+static size_t xGlobalCaStoreSize = 0;
+
+/*-----------------------------------------------------------*/
+
+static esp_err_t prvSetGlobalCaStore( const NetworkCredentials_t * pNetworkCredentials )
+{
+    esp_err_t xResult = ESP_OK;
+
+    if( ( pNetworkCredentials->pucRootCa != NULL ) &&
+        ( ( pNetworkCredentials->pucRootCa != pucGlobalCaStore ) ||
+          ( pNetworkCredentials->xRootCaSize != xGlobalCaStoreSize ) ) )
+    {
+        xResult = esp_tls_set_global_ca_store( ( const unsigned char * ) pNetworkCredentials->pucRootCa,
+                                               pNetworkCredentials->xRootCaSize );
+
+        if( xResult == ESP_OK )
+        {
+            pucGlobalCaStore = pNetworkCredentials->pucRootCa;
+            xGlobalCaStoreSize = pNetworkCredentials->xRootCaSize;
+        }
+        else
+        {
+            pucGlobalCaStore = NULL;
+            xGlobalCaStoreSize = 0;
+        }
+    }
+
+    return xResult;
+}
+/*-----------------------------------------------------------*/
+
+#ifdef CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+
+static TlsSessionCacheEntry_t * prvSessionCacheGetEntry( TlsSessionCache_t * pxSessionCache,
+                                                         const char * pcHostName )
+{
+    TlsSessionCacheEntry_t * pxEntry = NULL;
+    size_t xHostNameLength = strlen( pcHostName );
+    uint32_t ulIndex;
+
+    if( xHostNameLength >= sizeof( pxSessionCache->xEntries[ 0 ].cHostName ) )
+    {
+        ESP_LOGW( TAG, "Host name too long to cache TLS session." );
+        return NULL;
+    }
+
+    for( ulIndex = 0; ulIndex < transporttlsSESSION_CACHE_ENTRIES; ulIndex++ )
+    {
+        if( strcmp( pxSessionCache->xEntries[ ulIndex ].cHostName, pcHostName ) == 0 )
+        {
+            return &( pxSessionCache->xEntries[ ulIndex ] );
+        }
+
+        if( ( pxEntry == NULL ) && ( pxSessionCache->xEntries[ ulIndex ].cHostName[ 0 ] == '\0' ) )
+        {
+            pxEntry = &( pxSessionCache->xEntries[ ulIndex ] );
+        }
+    }
+
+    /* Host not cached and no free slot, evict the last entry. */
+    if( pxEntry == NULL )
+    {
+        pxEntry = &( pxSessionCache->xEntries[ transporttlsSESSION_CACHE_ENTRIES - 1 ] );
+
+        if( pxEntry->pvSession != NULL )
+        {
+            esp_tls_free_client_session( ( esp_tls_client_session_t * ) pxEntry->pvSession );
+            pxEntry->pvSession = NULL;
+        }
+    }
+
+    memcpy( pxEntry->cHostName, pcHostName, xHostNameLength + 1 );
+
+    return pxEntry;
+}
+
+#endif /* CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS */
+/*-----------------------------------------------------------*/
+
+#if defined( CONFIG_SAMPLE_IOT_DEEP_SLEEP ) && defined( CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS )
+
+/* The ticket kept through the sleep for the host, when the cache, in the
+ * heap, lost it with the sleep. */
+static esp_tls_client_session_t * prvRetainedSessionLoad( const char * pcHostName )
+{
+    esp_tls_client_session_t * pxSession;
+
+    if( ( xRetainedSession.xLength == 0 ) ||
+        ( strcmp( xRetainedSession.cHostName, pcHostName ) != 0 ) )
+    {
+        return NULL;
+    }
+
+    pxSession = calloc( 1, sizeof( *pxSession ) );
+
+    if( pxSession == NULL )
+    {
+        return NULL;
+    }
+
+    mbedtls_ssl_session_init( &pxSession->saved_session );
+
+    if( mbedtls_ssl_session_load( &pxSession->saved_session, xRetainedSession.ucSession,
+                                  xRetainedSession.xLength ) != 0 )
+    {
+        ESP_LOGW( TAG, "Failed to load the retained TLS session." );
+        esp_tls_free_client_session( pxSession );
+        xRetainedSession.xLength = 0;
+        return NULL;
+    }
+
+    return pxSession;
+}
+/*-----------------------------------------------------------*/
+
+static void prvRetainedSessionSave( const char * pcHostName,
+                                    esp_tls_client_session_t * pxSession )
+{
+    size_t xLength = 0;
+
+    if( mbedtls_ssl_session_save( &pxSession->saved_session, xRetainedSession.ucSession,
+                                  sizeof( xRetainedSession.ucSession ), &xLength ) != 0 )
+    {
+        ESP_LOGW( TAG, "TLS session too large to retain through the deep sleep." );
+        xLength = 0;
+    }
+
+    /* The host name fits, as the cache entry holds it too. */
+    ( void ) strcpy( xRetainedSession.cHostName, pcHostName );
+    xRetainedSession.xLength = xLength;
+}
+/*-----------------------------------------------------------*/
+
+#endif /* CONFIG_SAMPLE_IOT_DEEP_SLEEP && CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS */
+
+/* Wait until the socket of the connection can be read, or written to. */
+static int32_t prvWaitSocket( esp_tls_t * pxTls,
+                              BaseType_t xRead,
+                              uint32_t ulTimeoutMs )
+{
+    int lSocket = -1;
+    fd_set xSocketSet;
+    struct timeval xTimeout;
+
+    if( ( esp_tls_get_conn_sockfd( pxTls, &lSocket ) != ESP_OK ) || ( lSocket < 0 ) )
+    {
+        return -1;
+    }
+
+    FD_ZERO( &xSocketSet );
+    FD_SET( lSocket, &xSocketSet );
+    xTimeout.tv_sec = ulTimeoutMs / 1000;
+    xTimeout.tv_usec = ( ulTimeoutMs % 1000 ) * 1000;
+
+    return select( lSocket + 1,
+                   xRead ? &xSocketSet : NULL,
+                   xRead ? NULL : &xSocketSet,
+                   NULL,
+                   &xTimeout );
+}
+/*-----------------------------------------------------------*/
+
+#ifdef democonfigUSE_HSM
+
+/* Connect and do the handshake in steps, rather than in esp_tls_conn_new_sync().
+ * Between the steps the task waits on the socket for the server, and feeds its
+ * task watchdog if it has one, instead of sitting in one call for the whole
+ * handshake. The ECDSA signature of the client key is one of the steps: while
+ * the ATECC608 computes it, cryptoauthlib polls for the result with delays
+ * that block the task, leaving the CPU and the I2C bus to others. */
+static int prvConnect( const char * pHostName,
+                       uint16_t usPort,
+                       esp_tls_cfg_t * pxTlsConfig,
+                       esp_tls_t * pxTls,
+                       uint32_t ulTimeoutMs )
+{
+    TickType_t xStart = xTaskGetTickCount();
+    BaseType_t xWatched = ( esp_task_wdt_status( NULL ) == ESP_OK ) ? pdTRUE : pdFALSE;
+    int lConnected;
+
+    pxTlsConfig->non_block = true;
+    pxTlsConfig->timeout_ms = tlsesp32HANDSHAKE_SLICE_MS;
+
+    while( ( lConnected = esp_tls_conn_new_async( pHostName, strlen( pHostName ), usPort,
+                                                  pxTlsConfig, pxTls ) ) == 0 )
+    {
+        if( ( xTaskGetTickCount() - xStart ) >= pdMS_TO_TICKS( ulTimeoutMs ) )
+        {
+            ESP_LOGE( TAG, "TLS handshake timed out" );
+            return -1;
+        }
+
+        if( xWatched == pdTRUE )
+        {
+            ( void ) esp_task_wdt_reset();
+        }
+
+        /* Until the TCP connection is made there is no socket to wait on,
+         * but esp-tls waits for the connection itself, up to the slice. */
+        ( void ) prvWaitSocket( pxTls, pdTRUE, tlsesp32HANDSHAKE_SLICE_MS );
+    }
+
+    return lConnected;
+}
+
+#endif /* democonfigUSE_HSM */
 /*-----------------------------------------------------------*/
 
 TlsTransportStatus_t TLS_Socket_Connect( NetworkContext_t * pNetworkContext,
@@ -247,6 +597,9 @@ TlsTransportStatus_t TLS_Socket_Connect( NetworkContext_t * pNetworkContext,
                                          uint32_t ulSendTimeoutMs )
 {
     TlsTransportStatus_t xReturnStatus = eTLSTransportSuccess;
+    esp_tls_cfg_t xTlsConfig = { 0 };
+    TlsSessionCacheEntry_t * pxCacheEntry = NULL;
+    int lConnected;
 
     if( ( pNetworkContext == NULL ) ||
         ( pHostName == NULL ) ||
@@ -268,6 +621,19 @@ TlsTransportStatus_t TLS_Socket_Connect( NetworkContext_t * pNetworkContext,
         return eTLSTransportInvalidParameter;
     }
 
+    /* Without a link, the lookup of the host would only time out. */
+    if ( !Link_IsUp() )
+    {
+        ESP_LOGE( TAG, "Failed establishing TLS connection, the link is down" );
+        return eTLSTransportConnectFailure;
+    }
+
+    if ( prvSetGlobalCaStore( pNetworkCredentials ) != ESP_OK )
+    {
+        ESP_LOGE( TAG, "Failed to set the global CA store" );
+        return eTLSTransportInvalidCredentials;
+    }
+
     EspTlsTransportParams_t * pxEspTlsTransport = (EspTlsTransportParams_t*) pvPortMalloc(sizeof(EspTlsTransportParams_t));
 
     if(pxEspTlsTransport == NULL)
@@ -275,31 +641,27 @@ TlsTransportStatus_t TLS_Socket_Connect( NetworkContext_t * pNetworkContext,
       return eTLSTransportInsufficientMemory;
     }
 
-    pxEspTlsTransport->xTransport = esp_transport_ssl_init( );
+    pxEspTlsTransport->pxTls = esp_tls_init( );
     pxEspTlsTransport->ulReceiveTimeoutMs = ulReceiveTimeoutMs;
     pxEspTlsTransport->ulSendTimeoutMs = ulSendTimeoutMs;
+    pxEspTlsTransport->ulLinkLosses = Link_Losses();
 
-    esp_transport_ssl_enable_global_ca_store(pxEspTlsTransport->xTransport);
-
-    pxTlsParams->xSSLContext = (void*)pxEspTlsTransport;
-
-    if ( pNetworkCredentials->ppcAlpnProtos )
+    if( pxEspTlsTransport->pxTls == NULL )
     {
-        esp_transport_ssl_set_alpn_protocol( pxEspTlsTransport->xTransport, pNetworkCredentials->ppcAlpnProtos );
+        vPortFree(pxEspTlsTransport);
+        return eTLSTransportInsufficientMemory;
     }
 
-    if ( pNetworkCredentials->xDisableSni )
-    {
-        esp_transport_ssl_skip_common_name_check( pxEspTlsTransport->xTransport );
-    }
+    pxTlsParams->xSSLContext = (void*)pxEspTlsTransport;
+
+    xTlsConfig.alpn_protos = pNetworkCredentials->ppcAlpnProtos;
+    xTlsConfig.use_global_ca_store = true;
+    xTlsConfig.skip_common_name = ( pNetworkCredentials->xDisableSni != pdFALSE );
+    xTlsConfig.timeout_ms = ( int ) ulReceiveTimeoutMs;
 
-    if ( pNetworkCredentials->pucRootCa )
-    {
-        esp_tls_set_global_ca_store( ( const unsigned char * ) pNetworkCredentials->pucRootCa, pNetworkCredentials->xRootCaSize );
-    }
 #ifdef democonfigUSE_HSM
 
-    esp_transport_ssl_use_secure_element( pxEspTlsTransport->xTransport );
+    xTlsConfig.use_secure_element = true;
 
     #if defined(CONFIG_ATECC608A_TCUSTOM) || defined(CONFIG_ATECC608A_TFLEX)
         /*  This is TrustCUSTOM or TrustFLEX chip - the private key will be used from the ATECC608 device slot 0.
@@ -307,14 +669,21 @@ TlsTransportStatus_t TLS_Socket_Connect( NetworkContext_t * pNetworkContext,
         */
         if ( pNetworkCredentials->pucClientCert )
         {
-            esp_transport_ssl_set_client_cert_data_der( pxEspTlsTransport->xTransport, ( const char *) pNetworkCredentials->pucClientCert, pNetworkCredentials->xClientCertSize );
+            xTlsConfig.clientcert_buf = ( const unsigned char * ) pNetworkCredentials->pucClientCert;
+            xTlsConfig.clientcert_bytes = pNetworkCredentials->xClientCertSize;
         }
 
-       
+
     #else
         /*  This is the Trust&GO chip - the private key will be used from ATECC608 device slot 0.
-            We don't need to add certs to the network context as the esp-tls does that for us using cryptoauthlib API.
+            The certs are read from the chip once and kept, else esp-tls reads them on each connect
+            using cryptoauthlib API.
         */
+        if ( prvReadCertChain() == 0 )
+        {
+            xTlsConfig.clientcert_buf = ( const unsigned char * ) cCertChain;
+            xTlsConfig.clientcert_bytes = xCertChainLength;
+        }
 
     #endif
 
@@ -322,19 +691,52 @@ TlsTransportStatus_t TLS_Socket_Connect( NetworkContext_t * pNetworkContext,
 
     if ( pNetworkCredentials->pucClientCert )
     {
-        esp_transport_ssl_set_client_cert_data_der( pxEspTlsTransport->xTransport, ( const char *) pNetworkCredentials->pucClientCert, pNetworkCredentials->xClientCertSize );
+        xTlsConfig.clientcert_buf = ( const unsigned char * ) pNetworkCredentials->pucClientCert;
+        xTlsConfig.clientcert_bytes = pNetworkCredentials->xClientCertSize;
     }
 
     if ( pNetworkCredentials->pucPrivateKey )
     {
-        esp_transport_ssl_set_client_key_data_der( pxEspTlsTransport->xTransport, (const char *) pNetworkCredentials->pucPrivateKey, pNetworkCredentials->xPrivateKeySize );
+        xTlsConfig.clientkey_buf = ( const unsigned char * ) pNetworkCredentials->pucPrivateKey;
+        xTlsConfig.clientkey_bytes = pNetworkCredentials->xPrivateKeySize;
+    }
+
+#endif
+
+#ifdef CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+
+    /* Offer the ticket of the last connection to this host, for an
+     * abbreviated handshake. */
+    if ( pNetworkCredentials->pxSessionCache != NULL )
+    {
+        pxCacheEntry = prvSessionCacheGetEntry( pNetworkCredentials->pxSessionCache, pHostName );
+
+        if ( pxCacheEntry != NULL )
+        {
+#ifdef CONFIG_SAMPLE_IOT_DEEP_SLEEP
+            if ( pxCacheEntry->pvSession == NULL )
+            {
+                pxCacheEntry->pvSession = prvRetainedSessionLoad( pHostName );
+            }
+#endif
+
+            xTlsConfig.client_session = ( esp_tls_client_session_t * ) pxCacheEntry->pvSession;
+        }
     }
 
 #endif
 
-    if ( esp_transport_connect( pxEspTlsTransport->xTransport, pHostName, usPort, ulReceiveTimeoutMs ) < 0 )
+    perfgovernorBOOST();
+#ifdef democonfigUSE_HSM
+    lConnected = prvConnect( pHostName, usPort, &xTlsConfig, pxEspTlsTransport->pxTls, ulReceiveTimeoutMs );
+#else
+    lConnected = esp_tls_conn_new_sync( pHostName, strlen( pHostName ), usPort, &xTlsConfig, pxEspTlsTransport->pxTls );
+#endif
+    perfgovernorRELEASE();
+
+    if ( lConnected != 1 )
     {
-        ESP_LOGE( TAG, "Failed establishing TLS connection (esp_transport_connect failed)" );
+        ESP_LOGE( TAG, "Failed establishing TLS connection" );
         xReturnStatus = eTLSTransportConnectFailure;
     }
     else
@@ -345,20 +747,43 @@ TlsTransportStatus_t TLS_Socket_Connect( NetworkContext_t * pNetworkContext,
     /* Clean up on failure. */
     if( xReturnStatus != eTLSTransportSuccess )
     {
-        if( pxEspTlsTransport != NULL )
-        {
-            esp_transport_close( pxEspTlsTransport->xTransport );
-            esp_transport_destroy( pxEspTlsTransport->xTransport );
-            vPortFree(pxEspTlsTransport);
-        }
+        esp_tls_conn_destroy( pxEspTlsTransport->pxTls );
+        vPortFree(pxEspTlsTransport);
+        pxTlsParams->xSSLContext = NULL;
     }
     else
     {
+#ifdef CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+
+        /* Keep the ticket of this connection for the next one. */
+        if ( pxCacheEntry != NULL )
+        {
+            esp_tls_client_session_t * pxSession = esp_tls_get_client_session( pxEspTlsTransport->pxTls );
+
+            if ( pxSession != NULL )
+            {
+                if ( pxCacheEntry->pvSession != NULL )
+                {
+                    esp_tls_free_client_session( ( esp_tls_client_session_t * ) pxCacheEntry->pvSession );
+                }
+
+                pxCacheEntry->pvSession = pxSession;
+
+#ifdef CONFIG_SAMPLE_IOT_DEEP_SLEEP
+                prvRetainedSessionSave( pHostName, pxSession );
+#endif
+            }
+        }
+
+#endif
+
         ESP_LOGI( TAG, "(Network connection %p) Connection to %s established.",
                    pNetworkContext,
                    pHostName );
     }
 
+    ( void ) pxCacheEntry;
+
     return xReturnStatus;
 }
 /*-----------------------------------------------------------*/
@@ -381,12 +806,51 @@ void TLS_Socket_Disconnect( NetworkContext_t * pNetworkContext )
 
     EspTlsTransportParams_t * pxEspTlsTransport = (EspTlsTransportParams_t *)pxTlsParams->xSSLContext;
 
-    /* Attempting to terminate TLS connection. */
-    esp_transport_close( pxEspTlsTransport->xTransport );
+    if((pxEspTlsTransport == NULL))
+    {
+        ESP_LOGE( TAG, "Invalid input parameter(s): Arguments cannot be NULL. pxTlsParams->xSSLContext=%p.", pxEspTlsTransport );
+        return;
+    }
 
-    /* Free TLS contexts. */
-    esp_transport_destroy( pxEspTlsTransport->xTransport );
+    /* Terminate the TLS connection and free its context. */
+    esp_tls_conn_destroy( pxEspTlsTransport->pxTls );
     vPortFree(pxEspTlsTransport);
+    pxTlsParams->xSSLContext = NULL;
+}
+/*-----------------------------------------------------------*/
+
+void TLS_Socket_SessionCacheClear( TlsSessionCache_t * pxSessionCache )
+{
+    uint32_t ulIndex;
+
+    if( pxSessionCache == NULL )
+    {
+        return;
+    }
+
+    for( ulIndex = 0; ulIndex < transporttlsSESSION_CACHE_ENTRIES; ulIndex++ )
+    {
+#ifdef CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+        if( pxSessionCache->xEntries[ ulIndex ].pvSession != NULL )
+        {
+            esp_tls_free_client_session( ( esp_tls_client_session_t * ) pxSessionCache->xEntries[ ulIndex ].pvSession );
+        }
+#endif
+
+        pxSessionCache->xEntries[ ulIndex ].pvSession = NULL;
+        pxSessionCache->xEntries[ ulIndex ].cHostName[ 0 ] = '\0';
+    }
+}
+/*-----------------------------------------------------------*/
+
+void TLS_Socket_SharedConfigFree( TlsSharedConfig_t * pxSharedConfig )
+{
+    /* esp-tls sets up the configuration of each connection itself, so
+     * nothing is shared. */
+    if( pxSharedConfig != NULL )
+    {
+        pxSharedConfig->pvConfig = NULL;
+    }
 }
 /*-----------------------------------------------------------*/
 
@@ -415,8 +879,30 @@ int32_t TLS_Socket_Recv( NetworkContext_t * pNetworkContext,
 
     EspTlsTransportParams_t * pxEspTlsTransport = (EspTlsTransportParams_t *)pxTlsParams->xSSLContext;
 
-    tlsStatus = esp_transport_read( pxEspTlsTransport->xTransport, pBuffer, xBytesToRecv, pxEspTlsTransport->ulReceiveTimeoutMs );
-    if ( tlsStatus < 0 )
+    /* The connection went with the link, even if the socket has not noticed. */
+    if ( Link_Losses() != pxEspTlsTransport->ulLinkLosses )
+    {
+        ESP_LOGE( TAG, "Reading failed, the link was lost" );
+        return ESP_FAIL;
+    }
+
+    /* Wait for the socket only when esp-tls has nothing decrypted left. */
+    if ( esp_tls_get_bytes_avail( pxEspTlsTransport->pxTls ) <= 0 )
+    {
+        tlsStatus = prvWaitSocket( pxEspTlsTransport->pxTls, pdTRUE, pxEspTlsTransport->ulReceiveTimeoutMs );
+
+        if ( tlsStatus <= 0 )
+        {
+            return ( tlsStatus == 0 ) ? 0 : ESP_FAIL;
+        }
+    }
+
+    tlsStatus = esp_tls_conn_read( pxEspTlsTransport->pxTls, pBuffer, xBytesToRecv );
+    if ( ( tlsStatus == ESP_TLS_ERR_SSL_WANT_READ ) || ( tlsStatus == ESP_TLS_ERR_SSL_WANT_WRITE ) )
+    {
+        return 0;
+    }
+    else if ( tlsStatus <= 0 )
     {
         ESP_LOGE( TAG, "Reading failed, errno= %d", errno );
         return ESP_FAIL;
@@ -451,8 +937,26 @@ int32_t TLS_Socket_Send( NetworkContext_t * pNetworkContext,
 
     EspTlsTransportParams_t * pxEspTlsTransport = (EspTlsTransportParams_t *)pxTlsParams->xSSLContext;
 
-    tlsStatus = esp_transport_write( pxEspTlsTransport->xTransport, pBuffer, xBytesToSend, pxEspTlsTransport->ulSendTimeoutMs );
-    if ( tlsStatus < 0 )
+    if ( Link_Losses() != pxEspTlsTransport->ulLinkLosses )
+    {
+        ESP_LOGE( TAG, "Writing failed, the link was lost" );
+        return ESP_FAIL;
+    }
+
+    tlsStatus = prvWaitSocket( pxEspTlsTransport->pxTls, pdFALSE, pxEspTlsTransport->ulSendTimeoutMs );
+
+    if ( tlsStatus <= 0 )
+    {
+        ESP_LOGE( TAG, "Writing timed out or failed, errno= %d", errno );
+        return ( tlsStatus == 0 ) ? 0 : ESP_FAIL;
+    }
+
+    tlsStatus = esp_tls_conn_write( pxEspTlsTransport->pxTls, pBuffer, xBytesToSend );
+    if ( ( tlsStatus == ESP_TLS_ERR_SSL_WANT_READ ) || ( tlsStatus == ESP_TLS_ERR_SSL_WANT_WRITE ) )
+    {
+        return 0;
+    }
+    else if ( tlsStatus < 0 )
     {
         ESP_LOGE( TAG, "Writing failed, errno= %d", errno );
         return ESP_FAIL;
@@ -83,6 +83,12 @@
  */
     #define democonfigREGISTRATION_ID    CONFIG_AZURE_DPS_REGISTRATION_ID
 
+/**
+ * @brief Keep the IoT Hub assignment across reboots, in NVS.
+ */
+    #ifdef CONFIG_AZURE_DPS_CACHE
+        #define democonfigUSE_DPS_CACHE
+    #endif
 
 #endif /* democonfigENABLE_DPS_SAMPLE */
 
@@ -225,19 +231,57 @@
 #define democonfigDEMO_STACKSIZE         CONFIG_AZURE_TASK_STACKSIZE
 
 /**
- * @brief Size of the network buffer for MQTT packets.
+ * @brief Set the core the demo task is pinned to.
+ *
+ */
+#ifdef CONFIG_AZURE_TASK_PIN_TO_CORE
+    #define democonfigPIN_TASKS_TO_CORE
+    #define democonfigDEMO_TASK_CORE    CONFIG_AZURE_TASK_CORE
+#endif /* CONFIG_AZURE_TASK_PIN_TO_CORE */
+
+/**
+ * @brief Size of the part of the hub client buffer the MQTT packets are
+ * received in, which must hold the largest one the hub sends, such as a
+ * property document or an ADU manifest.
+ */
+#define democonfigNETWORK_RX_BUFFER_SIZE    CONFIG_NETWORK_BUFFER_SIZE
+
+/**
+ * @brief Size of the part of the hub client buffer the middleware writes the
+ * topic, user name and password of the packets it sends in. The payloads are
+ * sent from the buffers of the samples, so this does not grow with them.
  */
-#define democonfigNETWORK_BUFFER_SIZE    CONFIG_NETWORK_BUFFER_SIZE
+#define democonfigNETWORK_TX_BUFFER_SIZE    ( azureiotconfigUSERNAME_MAX + azureiotconfigPASSWORD_MAX )
+
+/**
+ * @brief Size of the buffer given to the hub and provisioning clients, which
+ * use its first democonfigNETWORK_TX_BUFFER_SIZE bytes for what they send and
+ * receive in the rest.
+ */
+#define democonfigNETWORK_BUFFER_SIZE       ( democonfigNETWORK_TX_BUFFER_SIZE + democonfigNETWORK_RX_BUFFER_SIZE )
 
 /**
  * @brief IoTHub endpoint port.
  */
 #define democonfigIOTHUB_PORT            8883
 
+/**
+ * @brief Places the large buffers of the telemetry store in PSRAM
+ * (CONFIG_SAMPLE_IOT_PSRAM_BUFFERS).
+ */
+#ifdef CONFIG_SAMPLE_IOT_PSRAM_BUFFERS
+    #include "esp_attr.h"
+    #define democonfigLARGE_BUFFER_ATTR    EXT_RAM_BSS_ATTR
+#endif
+
 /**
  * @brief Defines configRAND32, used by the common sample modules.
+ *
+ * esp_random() uses the hardware RNG, where rand() would be the same
+ * unseeded sequence on every device.
  */
-#define configRAND32()    ( rand() / RAND_MAX )
+#include "esp_system.h"
+#define configRAND32()    esp_random()
 
 /**
  * @brief Defines the macro for HSM usage depending on whether
@@ -12,12 +12,31 @@
 #include "esp_wifi_default.h"
 #include "esp_err.h"
 #include "esp_netif.h"
+#include "esp_pm.h"
 #include "esp_sntp.h"
 #include "esp_log.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/semphr.h"
 #include "nvs_flash.h"
+#include "nvs.h"
+
+#if CONFIG_SAMPLE_IOT_DEEP_SLEEP
+    #include "esp_attr.h"
+    #include "esp_sleep.h"
+#endif
+
+/* Startup timing. */
+#include "azure_sample_startup.h"
+
+/* Link events for the transport. */
+#include "azure_sample_link.h"
+
+/* The peak clock during the crypto of the sample. */
+#include "azure_sample_perf_governor.h"
+
+/* The sleeps between the batches of telemetry. */
+#include "azure_sample_deep_sleep.h"
 /*-----------------------------------------------------------*/
 
 #define NR_OF_IP_ADDRESSES_TO_WAIT_FOR     1
@@ -54,7 +73,46 @@
     #define SAMPLE_IOT_WIFI_SCAN_AUTH_MODE_THRESHOLD    WIFI_AUTH_WAPI_PSK
 #endif /* if CONFIG_SAMPLE_IOT_WIFI_AUTH_OPEN */
 
+#if CONFIG_SAMPLE_IOT_WIFI_POWER_SAVE_NONE
+    #define SAMPLE_IOT_WIFI_POWER_SAVE                  WIFI_PS_NONE
+#elif CONFIG_SAMPLE_IOT_WIFI_POWER_SAVE_MAX_MODEM
+    #define SAMPLE_IOT_WIFI_POWER_SAVE                  WIFI_PS_MAX_MODEM
+#else
+    #define SAMPLE_IOT_WIFI_POWER_SAVE                  WIFI_PS_MIN_MODEM
+#endif
+
+/* 0 keeps the listen interval of the driver. */
+#ifndef CONFIG_SAMPLE_IOT_WIFI_LISTEN_INTERVAL
+    #define CONFIG_SAMPLE_IOT_WIFI_LISTEN_INTERVAL      0
+#endif
+
+/* Clock of the CPU while idle, the crystal of most ESP32 modules. */
+#if defined( CONFIG_ESP32_XTAL_FREQ ) && ( CONFIG_ESP32_XTAL_FREQ > 0 )
+    #define SAMPLE_IOT_PM_MIN_FREQ_MHZ                  CONFIG_ESP32_XTAL_FREQ
+#else
+    #define SAMPLE_IOT_PM_MIN_FREQ_MHZ                  40
+#endif
+
 #define SNTP_SERVER_FQDN                                "pool.ntp.org"
+
+#if CONFIG_SAMPLE_IOT_WIFI_FAST_RECONNECT
+    #define SAMPLE_IOT_WIFI_NVS_NAMESPACE               "azure_wifi"
+    #define SAMPLE_IOT_WIFI_NVS_KEY                     "last_ap"
+#endif
+/*-----------------------------------------------------------*/
+
+#if CONFIG_SAMPLE_IOT_WIFI_FAST_RECONNECT
+
+/* The access point last joined, kept in NVS. */
+typedef struct wifi_last_ap
+{
+    uint8_t ssid[ 32 ];
+    uint8_t bssid[ 6 ];
+    uint8_t channel;
+    uint8_t authmode;
+} wifi_last_ap_t;
+
+#endif /* CONFIG_SAMPLE_IOT_WIFI_FAST_RECONNECT */
 /*-----------------------------------------------------------*/
 
 static const char * TAG = "sample_azureiot";
@@ -63,6 +121,22 @@ static bool g_timeInitialized = false;
 
 static xSemaphoreHandle s_semph_get_ip_addrs;
 static esp_ip4_addr_t s_ip_addr;
+
+#if CONFIG_SAMPLE_IOT_WIFI_FAST_RECONNECT
+    #if CONFIG_SAMPLE_IOT_DEEP_SLEEP
+        /* Kept through the deep sleep, so a wake does not read NVS. */
+        static RTC_DATA_ATTR wifi_last_ap_t s_last_ap;
+    #else
+        static wifi_last_ap_t s_last_ap;
+    #endif
+    static bool s_direct_join = false;
+    static bool s_associated = false;
+#endif
+
+#if CONFIG_SAMPLE_IOT_DEEP_SLEEP
+    /* RTC_DATA_ATTR is zeroed at a cold boot and kept through the deep sleep. */
+    static RTC_DATA_ATTR DeepSleepState_t s_deep_sleep_state;
+#endif
 /*-----------------------------------------------------------*/
 
 extern void vStartDemoTask( void );
@@ -97,15 +171,131 @@ static void on_got_ip( void * arg,
     ESP_LOGI( TAG, "Got IPv4 event: Interface \"%s\" address: " IPSTR,
               esp_netif_get_desc( event->esp_netif ), IP2STR( &event->ip_info.ip ) );
     memcpy( &s_ip_addr, &event->ip_info.ip, sizeof( s_ip_addr ) );
+    Link_Report( true );
     xSemaphoreGive( s_semph_get_ip_addrs );
 }
 /*-----------------------------------------------------------*/
 
+#if CONFIG_SAMPLE_IOT_WIFI_FAST_RECONNECT
+
+static bool wifi_last_ap_read( wifi_last_ap_t * last_ap )
+{
+    nvs_handle_t handle;
+    size_t length = sizeof( *last_ap );
+    esp_err_t err;
+
+    #if CONFIG_SAMPLE_IOT_DEEP_SLEEP
+        /* s_last_ap still holds the access point joined before the sleep. */
+        if( DeepSleep_PlatformWoke() && ( last_ap->ssid[ 0 ] != '\0' ) )
+        {
+            return true;
+        }
+    #endif
+
+    if( nvs_open( SAMPLE_IOT_WIFI_NVS_NAMESPACE, NVS_READONLY, &handle ) != ESP_OK )
+    {
+        return false;
+    }
+
+    err = nvs_get_blob( handle, SAMPLE_IOT_WIFI_NVS_KEY, last_ap, &length );
+    nvs_close( handle );
+
+    return ( err == ESP_OK ) && ( length == sizeof( *last_ap ) );
+}
+/*-----------------------------------------------------------*/
+
+static void wifi_last_ap_write( const wifi_last_ap_t * last_ap )
+{
+    nvs_handle_t handle;
+    esp_err_t err;
+
+    if( nvs_open( SAMPLE_IOT_WIFI_NVS_NAMESPACE, NVS_READWRITE, &handle ) != ESP_OK )
+    {
+        return;
+    }
+
+    err = nvs_set_blob( handle, SAMPLE_IOT_WIFI_NVS_KEY, last_ap, sizeof( *last_ap ) );
+
+    if( err == ESP_OK )
+    {
+        err = nvs_commit( handle );
+    }
+
+    nvs_close( handle );
+
+    if( err != ESP_OK )
+    {
+        ESP_LOGW( TAG, "Failed to keep the access point joined: %s", esp_err_to_name( err ) );
+    }
+}
+/*-----------------------------------------------------------*/
+
+static void on_wifi_connected( void * arg,
+                               esp_event_base_t event_base,
+                               int32_t event_id,
+                               void * event_data )
+{
+    wifi_event_sta_connected_t * event = ( wifi_event_sta_connected_t * ) event_data;
+    wifi_last_ap_t last_ap = { 0 };
+
+    s_associated = true;
+
+    memcpy( last_ap.ssid, event->ssid, ( event->ssid_len < sizeof( last_ap.ssid ) ) ?
+            event->ssid_len : sizeof( last_ap.ssid ) );
+    memcpy( last_ap.bssid, event->bssid, sizeof( last_ap.bssid ) );
+    last_ap.channel = event->channel;
+    last_ap.authmode = ( uint8_t ) event->authmode;
+
+    /* Most joins are to the same access point, which is then not written again. */
+    if( memcmp( &last_ap, &s_last_ap, sizeof( last_ap ) ) != 0 )
+    {
+        wifi_last_ap_write( &last_ap );
+        s_last_ap = last_ap;
+    }
+}
+/*-----------------------------------------------------------*/
+
+/* The last access point moved to another channel, changed its security or is
+ * gone, so scan for the SSID with the configured threshold. */
+static void wifi_scan_instead( void )
+{
+    wifi_config_t wifi_config;
+
+    ESP_LOGI( TAG, "Failed to join the last access point, scanning for %s", CONFIG_SAMPLE_IOT_WIFI_SSID );
+
+    if( esp_wifi_get_config( WIFI_IF_STA, &wifi_config ) == ESP_OK )
+    {
+        wifi_config.sta.bssid_set = false;
+        wifi_config.sta.channel = 0;
+        wifi_config.sta.threshold.authmode = SAMPLE_IOT_WIFI_SCAN_AUTH_MODE_THRESHOLD;
+        ( void ) esp_wifi_set_config( WIFI_IF_STA, &wifi_config );
+    }
+
+    s_direct_join = false;
+}
+
+#endif /* CONFIG_SAMPLE_IOT_WIFI_FAST_RECONNECT */
+/*-----------------------------------------------------------*/
+
 static void on_wifi_disconnect( void * arg,
                                 esp_event_base_t event_base,
                                 int32_t event_id,
                                 void * event_data )
 {
+    /* Fail the connections over the link now, rather than at their timeout. */
+    Link_Report( false );
+
+    #if CONFIG_SAMPLE_IOT_WIFI_FAST_RECONNECT
+        /* A link that was up is joined directly once more, but a direct join
+         * that failed is not tried again. */
+        if( s_direct_join && !s_associated )
+        {
+            wifi_scan_instead();
+        }
+
+        s_associated = false;
+    #endif
+
     ESP_LOGI( TAG, "Wi-Fi disconnected, trying to reconnect..." );
     esp_err_t err = esp_wifi_connect();
 
@@ -160,6 +350,10 @@ static esp_netif_t * wifi_start( void )
                                                  WIFI_EVENT_STA_DISCONNECTED, &on_wifi_disconnect, NULL ) );
     ESP_ERROR_CHECK( esp_event_handler_register( IP_EVENT,
                                                  IP_EVENT_STA_GOT_IP, &on_got_ip, NULL ) );
+    #if CONFIG_SAMPLE_IOT_WIFI_FAST_RECONNECT
+        ESP_ERROR_CHECK( esp_event_handler_register( WIFI_EVENT,
+                                                     WIFI_EVENT_STA_CONNECTED, &on_wifi_connected, NULL ) );
+    #endif
     #ifdef CONFIG_EXAMPLE_CONNECT_IPV6
         ESP_ERROR_CHECK( esp_event_handler_register( WIFI_EVENT,
                                                      WIFI_EVENT_STA_CONNECTED, &on_wifi_connect, netif ) );
@@ -178,12 +372,30 @@ static esp_netif_t * wifi_start( void )
             .sort_method        = SAMPLE_IOT_WIFI_CONNECT_AP_SORT_METHOD,
             .threshold.rssi     = CONFIG_SAMPLE_IOT_WIFI_SCAN_RSSI_THRESHOLD,
             .threshold.authmode = SAMPLE_IOT_WIFI_SCAN_AUTH_MODE_THRESHOLD,
+            .listen_interval    = CONFIG_SAMPLE_IOT_WIFI_LISTEN_INTERVAL,
         },
     };
+
+    #if CONFIG_SAMPLE_IOT_WIFI_FAST_RECONNECT
+        /* Join the last access point on its channel, without a scan of all
+         * the channels, if it is still the configured SSID. */
+        if( wifi_last_ap_read( &s_last_ap ) &&
+            ( strncmp( ( const char * ) s_last_ap.ssid, CONFIG_SAMPLE_IOT_WIFI_SSID, sizeof( s_last_ap.ssid ) ) == 0 ) )
+        {
+            wifi_config.sta.bssid_set = true;
+            memcpy( wifi_config.sta.bssid, s_last_ap.bssid, sizeof( wifi_config.sta.bssid ) );
+            wifi_config.sta.channel = s_last_ap.channel;
+            wifi_config.sta.threshold.authmode = ( wifi_auth_mode_t ) s_last_ap.authmode;
+            s_direct_join = true;
+            ESP_LOGI( TAG, "Joining the last access point directly, on channel %u", s_last_ap.channel );
+        }
+    #endif
+
     ESP_LOGI( TAG, "Connecting to %s...", wifi_config.sta.ssid );
     ESP_ERROR_CHECK( esp_wifi_set_mode( WIFI_MODE_STA ) );
     ESP_ERROR_CHECK( esp_wifi_set_config( WIFI_IF_STA, &wifi_config ) );
     ESP_ERROR_CHECK( esp_wifi_start() );
+    ESP_ERROR_CHECK( esp_wifi_set_ps( SAMPLE_IOT_WIFI_POWER_SAVE ) );
     esp_wifi_connect();
     return netif;
 }
@@ -197,6 +409,10 @@ static void wifi_stop( void )
                                                    WIFI_EVENT_STA_DISCONNECTED, &on_wifi_disconnect ) );
     ESP_ERROR_CHECK( esp_event_handler_unregister( IP_EVENT,
                                                    IP_EVENT_STA_GOT_IP, &on_got_ip ) );
+    #if CONFIG_SAMPLE_IOT_WIFI_FAST_RECONNECT
+        ESP_ERROR_CHECK( esp_event_handler_unregister( WIFI_EVENT,
+                                                       WIFI_EVENT_STA_CONNECTED, &on_wifi_connected ) );
+    #endif
     #ifdef CONFIG_EXAMPLE_CONNECT_IPV6
         ESP_ERROR_CHECK( esp_event_handler_unregister( IP_EVENT,
                                                        IP_EVENT_GOT_IP6, &on_got_ipv6 ) );
@@ -279,6 +495,15 @@ static void initialize_time()
     sntp_set_time_sync_notification_cb( time_sync_notification_cb );
     sntp_init();
 
+    #if CONFIG_SAMPLE_IOT_DEEP_SLEEP
+        /* The RTC kept the time through the sleep, so SNTP only corrects its
+         * drift, in the background. */
+        if( DeepSleep_PlatformWoke() )
+        {
+            return;
+        }
+    #endif
+
     ESP_LOGI( TAG, "Waiting for time synchronization with SNTP server" );
 
     while( !g_timeInitialized )
@@ -288,17 +513,95 @@ static void initialize_time()
 }
 /*-----------------------------------------------------------*/
 
+#if CONFIG_PM_ENABLE
+
+/* The CPU clocks down while idle and, with tickless idle, sleeps lightly
+ * until the next timeout of a task, such as the next telemetry, or until the
+ * radio wakes it for a beacon with data buffered for the station. */
+static void initialize_power_management( void )
+{
+    esp_pm_config_esp32_t pm_config =
+    {
+        .max_freq_mhz       = CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ,
+        .min_freq_mhz       = SAMPLE_IOT_PM_MIN_FREQ_MHZ,
+        #if CONFIG_FREERTOS_USE_TICKLESS_IDLE
+            .light_sleep_enable = true,
+        #endif
+    };
+
+    ESP_ERROR_CHECK( esp_pm_configure( &pm_config ) );
+}
+
+#endif /* CONFIG_PM_ENABLE */
+/*-----------------------------------------------------------*/
+
+#if CONFIG_SAMPLE_IOT_PERF_GOVERNOR
+
+static esp_pm_lock_handle_t xPerfLock;
+
+/* The CPU stays at max_freq_mhz while the sample runs its crypto. */
+static void prvSetPerfLevel( PerfLevel_t xLevel )
+{
+    if( xLevel == ePerfLevelHigh )
+    {
+        ( void ) esp_pm_lock_acquire( xPerfLock );
+    }
+    else
+    {
+        ( void ) esp_pm_lock_release( xPerfLock );
+    }
+}
+
+#endif /* CONFIG_SAMPLE_IOT_PERF_GOVERNOR */
+/*-----------------------------------------------------------*/
+
+#if CONFIG_SAMPLE_IOT_DEEP_SLEEP
+
+DeepSleepState_t * DeepSleep_PlatformState( void )
+{
+    return &s_deep_sleep_state;
+}
+/*-----------------------------------------------------------*/
+
+bool DeepSleep_PlatformWoke( void )
+{
+    return esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_TIMER;
+}
+/*-----------------------------------------------------------*/
+
+void DeepSleep_PlatformEnter( uint32_t ulSleepMs )
+{
+    /* Leave the access point, rather than have it buffer frames for a
+     * station that is gone, and power the radio down. */
+    wifi_stop();
+
+    ESP_ERROR_CHECK( esp_sleep_enable_timer_wakeup( ( uint64_t ) ulSleepMs * 1000ULL ) );
+    esp_deep_sleep_start();
+}
+
+#endif /* CONFIG_SAMPLE_IOT_DEEP_SLEEP */
+/*-----------------------------------------------------------*/
+
 void app_main( void )
 {
     ESP_ERROR_CHECK( nvs_flash_init() );
+    #if CONFIG_PM_ENABLE
+        initialize_power_management();
+    #endif
+    #if CONFIG_SAMPLE_IOT_PERF_GOVERNOR
+        ESP_ERROR_CHECK( esp_pm_lock_create( ESP_PM_CPU_FREQ_MAX, 0, "crypto", &xPerfLock ) );
+        PerfGovernor_Init( prvSetPerfLevel );
+    #endif
     ESP_ERROR_CHECK( esp_netif_init() );
     ESP_ERROR_CHECK( esp_event_loop_create_default() );
     /*Allow other core to finish initialization */
     vTaskDelay( pdMS_TO_TICKS( 100 ) );
 
     ( void ) example_connect();
+    StartupProfile_Mark( eStartupPhaseNetworkUp );
 
     initialize_time();
+    StartupProfile_Mark( eStartupPhaseTimeSynced );
 
     vStartDemoTask();
 }
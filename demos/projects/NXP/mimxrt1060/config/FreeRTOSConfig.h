@@ -17,12 +17,18 @@
 *----------------------------------------------------------*/
 
 #define configUSE_PREEMPTION                       1
-#define configUSE_TICKLESS_IDLE                    0
+
+/* Defined as 1 by the BOARD_LOW_POWER CMake option. */
+#ifndef configUSE_TICKLESS_IDLE
+    #define configUSE_TICKLESS_IDLE    0
+#endif
+
 #define configCPU_CLOCK_HZ                         ( SystemCoreClock )
 #define configTICK_RATE_HZ                         ( ( TickType_t ) 1000 )
 #define configMAX_PRIORITIES                       10
 #define configMINIMAL_STACK_SIZE                   ( ( unsigned short ) 90 )
-#define configTOTAL_HEAP_SIZE                      ( ( size_t ) ( 130U * 1024U ) )
+/* Without the 33 KB of TLS record buffers, see mbedtls_config.h. */
+#define configTOTAL_HEAP_SIZE                      ( ( size_t ) ( 97U * 1024U ) )
 #define configMAX_TASK_NAME_LEN                    10
 #define configUSE_16_BIT_TICKS                     0
 #define configIDLE_SHOULD_YIELD                    1
@@ -57,8 +63,11 @@
 #define configUSE_MALLOC_FAILED_HOOK            1
 #define configUSE_DAEMON_TASK_STARTUP_HOOK      1
 
-/* Run time and task stats gathering related definitions. */
-#define configGENERATE_RUN_TIME_STATS           0
+/* Run time and task stats gathering related definitions. Run-time stats
+ * are defined as 1 by the BOARD_RUNTIME_STATS CMake option. */
+#ifndef configGENERATE_RUN_TIME_STATS
+    #define configGENERATE_RUN_TIME_STATS    0
+#endif
 #define configUSE_TRACE_FACILITY                1
 #define configUSE_STATS_FORMATTING_FUNCTIONS    1
 
@@ -142,4 +151,26 @@ extern void vLoggingPrintf( const char * pcFormatString,
 extern int uxRand( void );
 #define configRAND32()       uxRand()
 
+/* Run-time stats. GPT2, a 32-bit timer, counts at 100 kHz the time each task
+ * runs, for the diagnostics of the samples. */
+#if ( configGENERATE_RUN_TIME_STATS == 1 )
+    extern void vMainConfigureTimerForRunTimeStats( void );
+    extern uint32_t ulMainGetRunTimeCounterValue( void );
+    #define portCONFIGURE_TIMER_FOR_RUN_TIME_STATS()    vMainConfigureTimerForRunTimeStats()
+    #define portGET_RUN_TIME_COUNTER_VALUE()            ulMainGetRunTimeCounterValue()
+#endif
+
+/* Heap trace of the samples, set by the SAMPLE_HEAP_TRACE CMake option. The
+ * hooks are expanded in pvPortMalloc(), so the return address is in the
+ * function that called it. */
+#if ( democonfigHEAP_TRACE == 1 )
+    extern void HeapTrace_Malloc( void * pvAddress,
+                                  size_t xSize,
+                                  const void * pvCaller );
+    extern void HeapTrace_Free( void * pvAddress,
+                                size_t xSize );
+    #define traceMALLOC( pvAddress, uiSize )    HeapTrace_Malloc( ( pvAddress ), ( uiSize ), __builtin_return_address( 0 ) )
+    #define traceFREE( pvAddress, uiSize )      HeapTrace_Free( ( pvAddress ), ( uiSize ) )
+#endif
+
 #endif /* FREERTOS_CONFIG_H */
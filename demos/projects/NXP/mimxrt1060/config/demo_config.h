@@ -43,6 +43,11 @@
 extern void vLoggingPrintf( const char * pcFormatString,
                             ... );
 
+/* Writes the logs as tokens, see azure_sample_token_log.h. */
+#if ( democonfigTOKEN_LOG == 1 )
+    #include "azure_sample_token_log.h"
+#endif
+
 /* Map the SdkLog macro to the logging function to enable logging */
 #ifndef SdkLog
     #define SdkLog( message )    vLoggingPrintf message
@@ -87,6 +92,14 @@ extern void vLoggingPrintf( const char * pcFormatString,
  */
     #define democonfigREGISTRATION_ID    "<YOUR REGISTRATION ID HERE>"
 
+/**
+ * @brief Keep the IoT Hub assignment across reboots, in the last flash sector of the first bank.
+ *
+ * @note To register with Device Provisioning on every boot undef this macro
+ *
+ */
+    #define democonfigUSE_DPS_CACHE
+
 #endif /* democonfigENABLE_DPS_SAMPLE */
 
 /**
@@ -222,15 +235,36 @@ extern void vLoggingPrintf( const char * pcFormatString,
 #define democonfigDEMO_STACKSIZE             ( 2 * 1024U )
 
 /**
- * @brief Size of the network buffer for MQTT packets.
+ * @brief Size of the part of the hub client buffer the MQTT packets are
+ * received in, which must hold the largest one the hub sends, such as a
+ * property document or an ADU manifest.
+ */
+#define democonfigNETWORK_RX_BUFFER_SIZE     ( 5 * 1024U )
+
+/**
+ * @brief Size of the part of the hub client buffer the middleware writes the
+ * topic, user name and password of the packets it sends in. The payloads are
+ * sent from the buffers of the samples, so this does not grow with them.
+ */
+#define democonfigNETWORK_TX_BUFFER_SIZE     ( azureiotconfigUSERNAME_MAX + azureiotconfigPASSWORD_MAX )
+
+/**
+ * @brief Size of the buffer given to the hub and provisioning clients, which
+ * use its first democonfigNETWORK_TX_BUFFER_SIZE bytes for what they send and
+ * receive in the rest.
  */
-#define democonfigNETWORK_BUFFER_SIZE        ( 5 * 1024U )
+#define democonfigNETWORK_BUFFER_SIZE        ( democonfigNETWORK_TX_BUFFER_SIZE + democonfigNETWORK_RX_BUFFER_SIZE )
 
 /**
  * @brief IoTHub endpoint port.
  */
 #define democonfigIOTHUB_PORT                ( 8883 )
 
+/**
+ * @brief Sync the time with SNTP, see azure_sample_time_sync.h.
+ */
+#define democonfigTIME_SYNC
+
 
 #define democonfigCHUNK_DOWNLOAD_SIZE        4096
 
@@ -55,7 +55,13 @@
 
 /* ---------- Core locking ---------- */
 
-#define LWIP_TCPIP_CORE_LOCKING    0
+/*
+ * LWIP_TCPIP_CORE_LOCKING==1: the netconn calls run the stack under a lock
+ * instead of posting to the tcpip thread; set by BOARD_LWIP_NETCONN.
+ */
+#ifndef LWIP_TCPIP_CORE_LOCKING
+    #define LWIP_TCPIP_CORE_LOCKING    0
+#endif
 
 void sys_lock_tcpip_core( void );
 #define LOCK_TCPIP_CORE()      sys_lock_tcpip_core()
@@ -69,6 +75,29 @@ void sys_check_core_locking( void );
 void sys_mark_tcpip_thread( void );
 /*#define LWIP_MARK_TCPIP_THREAD() sys_mark_tcpip_thread() */
 
+/* ---------- Bulk transfer profile ---------- */
+
+/*
+ * lwipconfigBULK_PROFILE==1: size TCP for large downloads such as ADU
+ * images on boards with spare RAM. It raises the receive window to 12
+ * segments, queues out-of-order segments, and adds the RX descriptors and
+ * pbufs that hold that much data in flight (about 40 KB more RAM).
+ * The ENET driver wraps RX descriptors in pbufs without copying, so
+ * ENET_RXBD_NUM must cover the window.
+ */
+#ifndef lwipconfigBULK_PROFILE
+    #define lwipconfigBULK_PROFILE    0
+#endif
+
+#if ( lwipconfigBULK_PROFILE == 1 )
+    #define TCP_WND                   ( 12 * TCP_MSS )
+    #define TCP_QUEUE_OOSEQ           1
+    #define TCP_OOSEQ_MAX_PBUFS       6
+    #define ENET_RXBD_NUM             ( 16 )
+    #define PBUF_POOL_SIZE            24
+    #define MEMP_NUM_TCP_SEG          32
+#endif
+
 /* ---------- Memory options ---------- */
 
 /**
@@ -183,6 +212,16 @@ void sys_mark_tcpip_thread( void );
     #define LWIP_NETIF_API    1
 #endif
 
+/* Link changes reported to the sample, see prvLinkChanged() in main.c. */
+#ifndef LWIP_NETIF_LINK_CALLBACK
+    #define LWIP_NETIF_LINK_CALLBACK    1
+#endif
+
+/* The address notified to the boot, see DHCPLease_WaitBound(). */
+#ifndef LWIP_NETIF_STATUS_CALLBACK
+    #define LWIP_NETIF_STATUS_CALLBACK    1
+#endif
+
 /* ---------- ICMP options ---------- */
 #ifndef LWIP_ICMP
     #define LWIP_ICMP    1
@@ -221,8 +260,13 @@ void sys_mark_tcpip_thread( void );
 
 /*
  * Some MCU allow computing and verifying the IP, UDP, TCP and ICMP checksums by hardware:
- * - To use this feature let the following define uncommented.
+ * - To use this feature let the following define uncommented, or pass
+ *   -DCHECKSUM_BY_HARDWARE to the build.
  * - To disable it and process by CPU comment the  the checksum.
+ *
+ * On the RT1060 this turns on the ENET TX/RX accelerators: the MAC inserts
+ * IPv4 header and TCP/UDP/ICMP checksums and drops received frames whose
+ * checksums are wrong.
  */
 /*#define CHECKSUM_BY_HARDWARE */
 
@@ -239,6 +283,10 @@ void sys_mark_tcpip_thread( void );
     #define CHECKSUM_CHECK_UDP    0
 /* CHECKSUM_CHECK_TCP==0: Check checksums by hardware for incoming TCP packets.*/
     #define CHECKSUM_CHECK_TCP    0
+/* CHECKSUM_GEN_ICMP==0: Generate checksums by hardware for outgoing ICMP packets.*/
+    #define CHECKSUM_GEN_ICMP     0
+/* CHECKSUM_CHECK_ICMP==0: Check checksums by hardware for incoming ICMP packets.*/
+    #define CHECKSUM_CHECK_ICMP   0
 #else /* ifdef CHECKSUM_BY_HARDWARE */
 /* CHECKSUM_GEN_IP==1: Generate checksums in software for outgoing IP packets.*/
     #define CHECKSUM_GEN_IP       1
@@ -331,6 +379,17 @@ void sys_mark_tcpip_thread( void );
 #define LWIP_SO_RCVTIMEO             1
 #define LWIP_SO_SNDTIMEO             1
 
+/* SNTP: the time goes to the clock of azure_sample_time_sync.c, from main.c,
+ * queried each hour as democonfigTIME_SYNC_INTERVAL_MS. */
+#include <stdint.h>
+void vMainSntpSetTime( uint32_t ulSeconds,
+                       uint32_t ulMicroseconds );
+#define SNTP_SERVER_DNS                           1
+#define SNTP_CHECK_RESPONSE                       1
+#define SNTP_STARTUP_DELAY                        0
+#define SNTP_UPDATE_DELAY                         ( 60 * 60 * 1000 )
+#define SNTP_SET_SYSTEM_TIME_US( sec, us )        vMainSntpSetTime( ( sec ), ( us ) )
+
 #if ( LWIP_DNS || LWIP_IGMP || LWIP_IPV6 ) && !defined( LWIP_RAND )
 /* When using IGMP or IPv6, LWIP_RAND() needs to be defined to a random-function returning an u32_t random value*/
     #include "lwip/arch.h"
@@ -15,6 +15,10 @@
 /* Place AES tables in ROM. */
 #define MBEDTLS_AES_ROM_TABLES
 
+/* Offload SHA-256 to the DCP, see port/mbedtls_sha256_alt_dcp.c.
+ * Comment out to use the software implementation. */
+#define MBEDTLS_SHA256_ALT
+
 /* Enable the following cipher modes. */
 #define MBEDTLS_CIPHER_MODE_CBC
 #define MBEDTLS_CIPHER_MODE_CFB
@@ -30,6 +34,10 @@
 #define MBEDTLS_REMOVE_ARC4_CIPHERSUITES
 #define MBEDTLS_ECP_DP_SECP256R1_ENABLED
 #define MBEDTLS_ECP_NIST_OPTIM
+
+/* MBEDTLS_ECP_WINDOW_SIZE and MBEDTLS_ECP_FIXED_POINT_OPTIM stay at their
+ * defaults, the fastest for secp256r1: its generator uses the comb tables
+ * built into mbedTLS, and no larger window is used for a 256 bit curve. */
 #define MBEDTLS_KEY_EXCHANGE_ECDHE_RSA_ENABLED
 #define MBEDTLS_KEY_EXCHANGE_ECDHE_ECDSA_ENABLED
 
@@ -43,6 +51,25 @@
 #define MBEDTLS_SSL_PROTO_TLS1_2
 #define MBEDTLS_SSL_ALPN
 #define MBEDTLS_SSL_SERVER_NAME_INDICATION
+#define MBEDTLS_SSL_SESSION_TICKETS
+
+/* Record buffers shrunk to the negotiated fragment length after the handshake.
+ * The pooled TLS contexts keep theirs at full size, in their static slots, as
+ * the shrunk buffers would come from the heap. */
+#if !defined( transporttlsCONTEXT_POOL_SIZE ) || ( transporttlsCONTEXT_POOL_SIZE == 0 )
+    #define MBEDTLS_SSL_VARIABLE_BUFFER_LENGTH
+#endif
+
+/* Size of the incoming and outgoing record buffers. The incoming buffer must hold
+ * the largest record the server sends, so only shrink it below 16 KB when the
+ * server honors the maximum fragment length extension. The outgoing buffer must
+ * hold the largest handshake message sent, such as the client certificate. */
+#ifndef MBEDTLS_SSL_IN_CONTENT_LEN
+    #define MBEDTLS_SSL_IN_CONTENT_LEN     16384
+#endif
+#ifndef MBEDTLS_SSL_OUT_CONTENT_LEN
+    #define MBEDTLS_SSL_OUT_CONTENT_LEN    16384
+#endif
 
 /* Check certificate key usage. */
 #define MBEDTLS_X509_CHECK_KEY_USAGE
@@ -91,6 +118,18 @@ void mbedtls_platform_free( void * ptr );
 #define MBEDTLS_PLATFORM_CALLOC_MACRO    mbedtls_platform_calloc
 #define MBEDTLS_PLATFORM_FREE_MACRO      mbedtls_platform_free
 
+/* The record buffers of one connection at a time have their own region, out
+ * of the heap, so reconnects do not cut up the heap around them. The heap in
+ * FreeRTOSConfig.h is smaller by as much. */
+#ifndef mbedtlsportRECORD_BUFFER_COUNT
+    #define mbedtlsportRECORD_BUFFER_COUNT    ( 2 )
+#endif
+
+/* Slab allocator statistics, available when mbedtlsportSLAB_ENABLED is 1. */
+void mbedtls_platform_slab_get_stats( size_t * pxPeakBytesInUse,
+                                      uint16_t * pusMinFreeBlocks,
+                                      uint32_t * pulHeapFallbacks );
+
 /* The network send and receive functions on FreeRTOS. */
 int mbedtls_platform_send( void * ctx,
                            const unsigned char * buf,
@@ -7,6 +7,7 @@
 
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 #include <stdarg.h>
 
 #include "board.h"
@@ -23,6 +24,7 @@
 #include "lwip/dhcp.h"
 #include "lwip/dns.h"
 #include "lwip/prot/dhcp.h"
+#include "lwip/apps/sntp.h"
 #include "netif/ethernet.h"
 #include "enet_ethernetif.h"
 #include "fsl_phy.h"
@@ -35,9 +37,44 @@
 #include "fsl_phyksz8081.h"
 #include "fsl_enet_mdio.h"
 
+#if ( configGENERATE_RUN_TIME_STATS == 1 )
+    #include "fsl_gpt.h"
+#endif
+
 
 #include "fsl_common.h"
 
+/* Startup timing. */
+#include "azure_sample_startup.h"
+
+/* Random bytes read ahead of the handshakes. */
+#include "azure_sample_entropy_pool.h"
+
+/* Logs written by a task of low priority. */
+#include "azure_sample_deferred_log.h"
+
+/* Logs written as tokens. */
+#include "azure_sample_token_log.h"
+
+/* DHCP lease asked for again at boot. */
+#include "azure_sample_dhcp_lease.h"
+
+/* The peak clock during the crypto of the samples. */
+#include "azure_sample_perf_governor.h"
+
+/* The link of the board, for the sockets to fail once it is lost. */
+#include "azure_sample_link.h"
+
+/* Unix time from the SNTP client of lwIP. */
+#include "azure_sample_time_sync.h"
+
+/* Demo Specific configs. */
+#include "demo_config.h"
+
+#if ( democonfigPERF_GOVERNOR == 1 ) && ( configUSE_TICKLESS_IDLE == 1 )
+    #error "BOARD_PERF_GOVERNOR reloads the SysTick at each clock change, which tickless idle does not allow"
+#endif
+
 #if defined( FSL_FEATURE_SOC_LTC_COUNT ) && ( FSL_FEATURE_SOC_LTC_COUNT > 0 )
     #include "fsl_ltc.h"
 #endif
@@ -100,7 +137,6 @@ static ethernetif_config_t xEnetConfig =
     .phyHandle  = &xPhyHandle,
     .macAddress = mainConfigMAC_ADDR,
 };
-static uint64_t ulGlobalEntryTime = 1673769600;
 
 /*
  * Prototypes for the demos that can be started from this project.
@@ -109,10 +145,44 @@ extern void vStartDemoTask( void );
 
 static void prvNetworkUp( void );
 
+#ifdef democonfigTIME_SYNC
+    static void prvStartSntp( void * pvArgument );
+#endif
+
+static void prvLinkChanged( struct netif * pxNetif );
+
+/* Reads the TRNG for the entropy pool, waiting for it. */
+static int prvReadTrng( uint8_t * output,
+                        size_t len );
+
+/* Writes a log to the console, waiting for it. */
+static void prvWriteConsole( const char * pcText,
+                             size_t xLength );
+
 /*******************************************************************************
  * Code
  ******************************************************************************/
 
+#ifdef BOARD_TCM
+
+    /* Set by tcm/tcm_sections.ld. */
+    extern uint32_t __itcm_start__[], __itcm_end__[], __itcm_load__[];
+    extern uint32_t __dtcm_data_start__[], __dtcm_data_end__[], __dtcm_data_load__[];
+
+    static void prvTcmInit( void )
+    {
+        memcpy( __itcm_start__, __itcm_load__,
+                ( size_t ) ( ( uint8_t * ) __itcm_end__ - ( uint8_t * ) __itcm_start__ ) );
+        memcpy( __dtcm_data_start__, __dtcm_data_load__,
+                ( size_t ) ( ( uint8_t * ) __dtcm_data_end__ - ( uint8_t * ) __dtcm_data_start__ ) );
+
+        /* The copied code is fetched only after this. */
+        __DSB();
+        __ISB();
+    }
+/*-----------------------------------------------------------*/
+#endif /* BOARD_TCM */
+
 static void prvInitializeHeap( void )
 {
     static uint8_t ucHeap1[ configTOTAL_HEAP_SIZE ];
@@ -146,13 +216,26 @@ void delay( void )
 }
 /*-----------------------------------------------------------*/
 
+static void prvWriteConsole( const char * pcText,
+                             size_t xLength )
+{
+    ( void ) fwrite( pcText, 1, xLength, stdout );
+}
+/*-----------------------------------------------------------*/
+
 void vLoggingPrintf( const char * pcFormat,
                      ... )
 {
     va_list vargs;
 
     va_start( vargs, pcFormat );
-    vprintf( pcFormat, vargs );
+
+    #if ( democonfigDEFERRED_LOG == 1 )
+        DeferredLog_VPrintf( pcFormat, vargs );
+    #else
+        vprintf( pcFormat, vargs );
+    #endif
+
     va_end( vargs );
 }
 /*-----------------------------------------------------------*/
@@ -209,6 +292,11 @@ int main( void )
 {
     gpio_pin_config_t gpio_config = { kGPIO_DigitalOutput, 0, kGPIO_NoIntmode };
 
+    #ifdef BOARD_TCM
+        /* Before anything calls into mbedTLS. */
+        prvTcmInit();
+    #endif
+
     BOARD_ConfigMPU();
     BOARD_InitBootPins();
     BOARD_InitBootClocks();
@@ -230,6 +318,25 @@ int main( void )
     prvInitializeHeap();
     CRYPTO_InitHardware();
 
+    /* The TRNG is read into the pool while DHCP runs. */
+    ( void ) EntropyPool_Init( prvReadTrng );
+
+    /* The fallback time until SNTP answers. */
+    TimeSync_Init();
+
+    #if ( democonfigPERF_GOVERNOR == 1 )
+        PerfGovernor_Init( prvSetPerfLevel );
+    #endif
+
+    #if ( democonfigDEFERRED_LOG == 1 )
+        /* The logs made until the scheduler starts are written then. */
+        ( void ) DeferredLog_Init( prvWriteConsole );
+    #endif
+
+    #if ( democonfigTOKEN_LOG == 1 )
+        TokenLog_Init( prvWriteConsole );
+    #endif
+
     xMdioHandle.resource.csrClock_Hz = mainCLOCK_FREQ;
 
     vTaskStartScheduler();
@@ -247,6 +354,14 @@ int uxRand( void )
 {
     static UBaseType_t uxlNextRand; /*_RB_ Not seeded. */
     const uint32_t ulMultiplier = 0x015a4e35UL, ulIncrement = 1UL;
+    uint32_t ulRandom;
+
+    /* lwIP takes its DNS IDs and ports from here, so they come from the TRNG
+     * while the pool has bytes, never waiting for it. */
+    if( EntropyPool_Take( ( uint8_t * ) &ulRandom, sizeof( ulRandom ) ) == sizeof( ulRandom ) )
+    {
+        return ( int ) ( ulRandom & 0x7fffffffUL );
+    }
 
     /* Utility function to generate a pseudo random number. */
 
@@ -259,6 +374,7 @@ int uxRand( void )
 void vApplicationDaemonTaskStartupHook( void )
 {
     prvNetworkUp();
+    StartupProfile_Mark( eStartupPhaseNetworkUp );
 
     /* Demos that use the network are created after the network is
      * up. */
@@ -295,6 +411,65 @@ void vApplicationIdleHook( void )
 }
 /*-----------------------------------------------------------*/
 
+#if ( configGENERATE_RUN_TIME_STATS == 1 )
+
+/* Rate of the run-time stats counter. The counter of a task wraps after
+ * about 12 hours, and the diagnostics only take differences. */
+    #define mainRUN_TIME_STATS_HZ    ( 100000U )
+
+/* Called by the kernel as the scheduler starts. GPT2 runs free from the
+ * peripheral clock, without an interrupt. */
+    void vMainConfigureTimerForRunTimeStats( void )
+    {
+        gpt_config_t xGptConfig;
+
+        GPT_GetDefaultConfig( &xGptConfig );
+        xGptConfig.clockSource = kGPT_ClockSource_Periph;
+        xGptConfig.divider = CLOCK_GetFreq( kCLOCK_PerClk ) / mainRUN_TIME_STATS_HZ;
+        xGptConfig.enableFreeRun = true;
+
+        GPT_Init( GPT2, &xGptConfig );
+        GPT_StartTimer( GPT2 );
+    }
+/*-----------------------------------------------------------*/
+
+    uint32_t ulMainGetRunTimeCounterValue( void )
+    {
+        return GPT_GetCurrentTimerCount( GPT2 );
+    }
+/*-----------------------------------------------------------*/
+#endif /* configGENERATE_RUN_TIME_STATS == 1 */
+
+#if ( democonfigPERF_GOVERNOR == 1 )
+
+/* ARM_PODF of each level, dividing the 1200 MHz of the ARM PLL by 2 for
+ * 600 MHz, or by 4 for 300 MHz. The AHB and IPG clocks follow it, while the
+ * SEMC, FlexSPI, LPUART and ENET clocks have their own sources. */
+    #define mainPERF_ARM_PODF_HIGH    ( 1U )
+    #define mainPERF_ARM_PODF_LOW     ( 3U )
+
+    static void prvSetPerfLevel( PerfLevel_t xLevel )
+    {
+        taskENTER_CRITICAL();
+        {
+            /* Glitch free, and waits for the divider to be taken. */
+            CLOCK_SetDiv( kCLOCK_ArmDiv, ( xLevel == ePerfLevelHigh ) ? mainPERF_ARM_PODF_HIGH : mainPERF_ARM_PODF_LOW );
+            SystemCoreClockUpdate();
+
+            /* The tick, which counts the core clock, keeps its length. */
+            SysTick->LOAD = ( SystemCoreClock / configTICK_RATE_HZ ) - 1UL;
+            SysTick->VAL = 0UL;
+
+            #if ( configGENERATE_RUN_TIME_STATS == 1 )
+                /* As does the run-time stats counter, from the IPG clock. */
+                GPT_SetClockDivider( GPT2, CLOCK_GetFreq( kCLOCK_PerClk ) / mainRUN_TIME_STATS_HZ );
+            #endif
+        }
+        taskEXIT_CRITICAL();
+    }
+/*-----------------------------------------------------------*/
+#endif /* democonfigPERF_GOVERNOR == 1 */
+
 /* configUSE_STATIC_ALLOCATION is set to 1, so the application must provide an
  * implementation of vApplicationGetIdleTaskMemory() to provide the memory that is
  * used by the Idle task. */
@@ -369,10 +544,8 @@ void vApplicationMallocFailedHook()
 }
 /*-----------------------------------------------------------*/
 
-int mbedtls_platform_entropy_poll( void * data,
-                                   unsigned char * output,
-                                   size_t len,
-                                   size_t * olen )
+static int prvReadTrng( uint8_t * output,
+                        size_t len )
 {
     status_t result = kStatus_Success;
 
@@ -419,45 +592,51 @@ int mbedtls_platform_entropy_poll( void * data,
         result = kStatus_Success;
     #endif /* if defined( FSL_FEATURE_SOC_TRNG_COUNT ) && ( FSL_FEATURE_SOC_TRNG_COUNT > 0 ) */
 
-    if( result == kStatus_Success )
-    {
-        *olen = len;
-        return 0;
-    }
-    else
-    {
-        return result;
-    }
+    return ( result == kStatus_Success ) ? 0 : -1;
+}
+/*-----------------------------------------------------------*/
+
+int mbedtls_platform_entropy_poll( void * data,
+                                   unsigned char * output,
+                                   size_t len,
+                                   size_t * olen )
+{
+    return EntropyPool_Poll( data, output, len, olen );
+}
+/*-----------------------------------------------------------*/
+
+/* Called in the tcpip thread by the link poll of the ethernetif. */
+static void prvLinkChanged( struct netif * pxNetif )
+{
+    Link_Report( netif_is_link_up( pxNetif ) );
 }
 /*-----------------------------------------------------------*/
 
 static void prvNetworkUp( void )
 {
-    struct dhcp * pxDHCP;
-    TickType_t xTimeoutTick;
     const ip_addr_t * pxIP;
 
     tcpip_init( NULL, NULL );
 
+    /* Adding the netif does not wait for the autonegotiation: its link goes
+     * up later, and DHCP starts then. */
     netifapi_netif_add( &xNetif, NULL, NULL, NULL, &xEnetConfig, mainNETIF_INIT_FN, tcpip_input );
+    netif_set_link_callback( &xNetif, prvLinkChanged );
     netifapi_netif_set_default( &xNetif );
     netifapi_netif_set_up( &xNetif );
 
     configPRINTF( ( "Getting IP address from DHCP ...\r\n" ) );
     netifapi_dhcp_start( &xNetif );
-    pxDHCP = netif_dhcp_data( &xNetif );
-
-    xTimeoutTick = xTaskGetTickCount() + mainDHCP_TIMEOUT * configTICK_RATE_HZ;
 
-    while( pxDHCP->state != DHCP_STATE_BOUND &&
-           xTimeoutTick > xTaskGetTickCount() )
+    if( DHCPLease_Start( &xNetif ) == eAzureIoTSuccess )
     {
-        vTaskDelay( 100 );
+        configPRINTF( ( "Requesting the last lease ...\r\n" ) );
     }
 
-    if( pxDHCP->state != DHCP_STATE_BOUND )
+    /* Goes on the moment the address is bound. */
+    if( DHCPLease_WaitBound( &xNetif, mainDHCP_TIMEOUT * configTICK_RATE_HZ ) != eAzureIoTSuccess )
     {
-        configPRINTF( ( "DHCP failed \r\n" ) );
+        configPRINTF( ( "DHCP failed, in state %u \r\n", ( unsigned ) netif_dhcp_data( &xNetif )->state ) );
         configASSERT( false );
     }
 
@@ -473,6 +652,33 @@ static void prvNetworkUp( void )
     }
 
     configPRINTF( ( "\r\n" ) );
+
+    #ifdef democonfigTIME_SYNC
+        /* Queries the time while the demo provisions and connects, rather
+         * than before it. */
+        ( void ) tcpip_callback( prvStartSntp, NULL );
+    #endif
+}
+/*-----------------------------------------------------------*/
+
+#ifdef democonfigTIME_SYNC
+    /* Called in the tcpip thread, as the SNTP client is. */
+    static void prvStartSntp( void * pvArgument )
+    {
+        ( void ) pvArgument;
+
+        sntp_setoperatingmode( SNTP_OPMODE_POLL );
+        sntp_setservername( 0, democonfigTIME_SYNC_SERVER );
+        sntp_init();
+    }
+#endif /* democonfigTIME_SYNC */
+/*-----------------------------------------------------------*/
+
+/* Called in the tcpip thread by the SNTP client, see lwipopts.h. */
+void vMainSntpSetTime( uint32_t ulSeconds,
+                       uint32_t ulMicroseconds )
+{
+    TimeSync_Report( ( ( uint64_t ) ulSeconds * 1000U ) + ( ulMicroseconds / 1000U ), xTaskGetTickCount() );
 }
 /*-----------------------------------------------------------*/
 
@@ -494,20 +700,7 @@ void * pvPortCalloc( size_t xNum,
 
 uint64_t ullGetUnixTime( void )
 {
-    TickType_t xTickCount = 0;
-    uint64_t ulTime = 0UL;
-
-    /* Get the current tick count. */
-    xTickCount = xTaskGetTickCount();
-
-    /* Convert the ticks to milliseconds. */
-    ulTime = ( uint64_t ) xTickCount / configTICK_RATE_HZ;
-
-    /* Reduce ulGlobalEntryTimeMs from obtained time so as to always return the
-     * elapsed time in the application. */
-    ulTime = ( uint64_t ) ( ulTime + ulGlobalEntryTime );
-
-    return ulTime;
+    return TimeSync_GetUnixTimeMs() / 1000U;
 }
 /*-----------------------------------------------------------*/
 
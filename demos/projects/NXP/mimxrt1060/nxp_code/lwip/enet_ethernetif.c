@@ -49,6 +49,7 @@
 #include "netif/ppp/pppoe.h"
 #include "lwip/igmp.h"
 #include "lwip/mld6.h"
+#include "lwip/timeouts.h"
 
 #if USE_RTOS && defined(FSL_RTOS_FREE_RTOS)
 #include "FreeRTOS.h"
@@ -73,10 +74,10 @@ void ethernetif_phy_init(struct ethernetif *ethernetif,
                          const ethernetif_config_t *ethernetifConfig,
                          enet_config_t *config)
 {
+    ethernetif_phy_t *phy = ethernetif_phy_ptr(ethernetif);
     phy_config_t phyConfig;
     status_t status;
     bool link = false;
-    uint32_t count = 0;
     phy_speed_t speed;
     phy_duplex_t duplex;
 
@@ -84,44 +85,71 @@ void ethernetif_phy_init(struct ethernetif *ethernetif,
     phyConfig.autoNeg = true;
 
     ethernetifConfig->phyHandle->mdioHandle->resource.base = *ethernetif_enet_ptr(ethernetif);
+    phy->handle = ethernetifConfig->phyHandle;
 
     LWIP_PLATFORM_DIAG(("Initializing PHY..."));
 
-    while ((count < ENET_ATONEGOTIATION_TIMEOUT) && (!link))
-    {
-        status = PHY_Init(ethernetifConfig->phyHandle, &phyConfig);
-
-        if (kStatus_Success == status)
-        {
-            PHY_GetLinkStatus(ethernetifConfig->phyHandle, &link);
-        }
-        // else if (kStatus_PHY_AutoNegotiateFail == status)
-        // {
-        //     LWIP_PLATFORM_DIAG(("PHY Auto-negotiation failed. Please check the ENET cable connection and link partner setting."));
-        // }
-        else
-        {
-            LWIP_ASSERT("\r\nCannot initialize PHY.\r\n", 0);
-        }
+    /* This starts the autonegotiation, without waiting for it. The link poll
+     * brings the link up once it is done, at the speed and duplex agreed. */
+    status = PHY_Init(phy->handle, &phyConfig);
+    phy->ready = (kStatus_Success == status);
 
-        count++;
+    if (!phy->ready)
+    {
+        LWIP_PLATFORM_DIAG(("PHY initialization failed, retrying from the link poll."));
     }
-
-    if (link)
+    else if ((kStatus_Success == PHY_GetLinkStatus(phy->handle, &link)) && link)
     {
         /* Get the actual PHY link speed. */
-        PHY_GetLinkSpeedDuplex(ethernetifConfig->phyHandle, &speed, &duplex);
+        PHY_GetLinkSpeedDuplex(phy->handle, &speed, &duplex);
         /* Change the MII speed and duplex for actual link status. */
         config->miiSpeed = (enet_mii_speed_t)speed;
         config->miiDuplex = (enet_mii_duplex_t)duplex;
     }
-#if 0 /* Disable assert. If initial auto-negation is timeout, \ \
-         the ENET is set to default (100Mbs and full-duplex). */
-    else
+    /* Otherwise the ENET starts at its default, 100Mbs and full-duplex. */
+}
+
+/**
+ * Polls the link of the PHY over MDIO, from the lwIP timeouts, and brings the
+ * netif link up or down with it.
+ *
+ * @param arg the lwip network interface structure for this ethernetif
+ */
+static void ethernetif_phy_poll(void *arg)
+{
+    struct netif *netif = (struct netif *)arg;
+    struct ethernetif *ethernetif = (struct ethernetif *)netif->state;
+    ethernetif_phy_t *phy = ethernetif_phy_ptr(ethernetif);
+    phy_config_t phyConfig;
+    bool link = false;
+    phy_speed_t speed;
+    phy_duplex_t duplex;
+
+    if (!phy->ready)
     {
-        LWIP_ASSERT("\r\nGiving up PHY initialization. Please check the ENET cable connection and link partner setting and reset the board.\r\n", 0);
+        phyConfig.phyAddr = phy->handle->phyAddr;
+        phyConfig.autoNeg = true;
+        phy->ready = (kStatus_Success == PHY_Init(phy->handle, &phyConfig));
     }
-#endif
+
+    if (phy->ready && (kStatus_Success == PHY_GetLinkStatus(phy->handle, &link)))
+    {
+        if (link && !netif_is_link_up(netif))
+        {
+            /* The MAC follows what the PHY agreed with its link partner. */
+            PHY_GetLinkSpeedDuplex(phy->handle, &speed, &duplex);
+            ENET_SetMII(*ethernetif_enet_ptr(ethernetif), (enet_mii_speed_t)speed, (enet_mii_duplex_t)duplex);
+            LWIP_PLATFORM_DIAG(("Ethernet link up."));
+            netif_set_link_up(netif);
+        }
+        else if (!link && netif_is_link_up(netif))
+        {
+            LWIP_PLATFORM_DIAG(("Ethernet link down."));
+            netif_set_link_down(netif);
+        }
+    }
+
+    sys_timeout(ENET_LINK_POLL_INTERVAL_MS, ethernetif_phy_poll, netif);
 }
 
 /**
@@ -231,7 +259,8 @@ err_t ethernetif_init(struct netif *netif, struct ethernetif *ethernetif,
 
     /* device capabilities */
     /* don't set NETIF_FLAG_ETHARP if this device is not an ethernet one */
-    netif->flags |= NETIF_FLAG_BROADCAST | NETIF_FLAG_ETHARP | NETIF_FLAG_LINK_UP;
+    /* The link is up once the PHY reports it, see ethernetif_phy_poll(). */
+    netif->flags |= NETIF_FLAG_BROADCAST | NETIF_FLAG_ETHARP;
 
     /* ENET driver initialization.*/
     ethernetif_enet_init(netif, ethernetif, ethernetifConfig);
@@ -250,5 +279,7 @@ err_t ethernetif_init(struct netif *netif, struct ethernetif *ethernetif,
     }
 #endif /* LWIP_IPV6 && LWIP_IPV6_MLD */
 
+    sys_timeout(ENET_LINK_POLL_INTERVAL_MS, ethernetif_phy_poll, netif);
+
     return ERR_OK;
 }
@@ -73,6 +73,14 @@
 
 #define ENET_TIMEOUT        (0xFFFU)
 
+/* Set to 1 to hand pbuf payloads straight to the TX descriptors instead of
+ * copying every frame into the driver's TX buffers. Frames whose pbuf chain
+ * needs more than ENET_TXBD_NUM descriptors still go through the copy path.
+ * Requires FreeRTOS. */
+#ifndef ENET_TX_ZERO_COPY
+    #define ENET_TX_ZERO_COPY   (1)
+#endif
+
 /* ENET IRQ priority. Used in FreeRTOS. */
 /* Interrupt priorities. */
 #ifdef __CA7_REV
@@ -91,10 +99,12 @@
 #endif
 #endif
 
-/*  Defines Ethernet Autonegotiation Timeout during initialization. 
- *  Set it to 0 to disable the waiting. */ 
-#ifndef ENET_ATONEGOTIATION_TIMEOUT
-    #define ENET_ATONEGOTIATION_TIMEOUT     (0xFFFU)
+/*  Defines how often the link of the PHY is polled, in milliseconds. The
+ *  initialization does not wait for the autonegotiation: the netif link goes
+ *  up at the first poll that finds it done, and down at the first that finds
+ *  it lost. */
+#ifndef ENET_LINK_POLL_INTERVAL_MS
+    #define ENET_LINK_POLL_INTERVAL_MS      (250U)
 #endif
 
 /* Define those to better describe your network interface. */
@@ -70,6 +70,16 @@
 #error "ETH_PAD_SIZE != 0"
 #endif /* ETH_PAD_SIZE != 0 */
 
+#if ENET_TX_ZERO_COPY && USE_RTOS && defined(FSL_RTOS_FREE_RTOS)
+#define ENET_TX_ZERO_COPY_ENABLED 1
+#else
+#define ENET_TX_ZERO_COPY_ENABLED 0
+#endif
+
+/* Each frame in flight holds one slot, so one spare slot keeps the ring of
+ * transmitted pbufs from ever looking empty when full. */
+#define ENET_TX_DONE_NUM (ENET_TXBD_NUM + 1)
+
 /*******************************************************************************
  * Definitions
  ******************************************************************************/
@@ -92,6 +102,7 @@ typedef struct rx_pbuf_wrapper
 struct ethernetif
 {
     ENET_Type *base;
+    ethernetif_phy_t phy;
 #if (defined(FSL_FEATURE_SOC_ENET_COUNT) && (FSL_FEATURE_SOC_ENET_COUNT > 0)) || \
     (USE_RTOS && defined(FSL_RTOS_FREE_RTOS))
     enet_handle_t handle;
@@ -105,6 +116,14 @@ struct ethernetif
     rx_buffer_t *RxDataBuff;
     tx_buffer_t *TxDataBuff;
     rx_pbuf_wrapper_t RxPbufs[ENET_RXBD_NUM];
+#if ENET_TX_ZERO_COPY_ENABLED
+    enet_frame_info_t *TxFrameInfo;
+    /* pbufs whose frames have been sent, queued by the TX interrupt and
+     * freed from the tcpip thread. */
+    struct pbuf *TxDone[ENET_TX_DONE_NUM];
+    volatile uint8_t txDoneHead;
+    volatile uint8_t txDoneTail;
+#endif
 };
 
 /*******************************************************************************
@@ -140,6 +159,18 @@ static void ethernet_callback(ENET_Type *base,
         {
             portBASE_TYPE taskToWake = pdFALSE;
 
+#if ENET_TX_ZERO_COPY_ENABLED
+            /* With TX reclaim enabled the callback comes once per frame sent,
+             * with the context given to ENET_StartTxFrame(), NULL for the
+             * copied frames. pbuf_free() is not interrupt safe, so the pbuf of
+             * a zero-copy frame is queued for the next transmit to release. */
+            if ((frameInfo != NULL) && (frameInfo->context != NULL))
+            {
+                ethernetif->TxDone[ethernetif->txDoneHead] = (struct pbuf *)frameInfo->context;
+                ethernetif->txDoneHead = (ethernetif->txDoneHead + 1U) % ENET_TX_DONE_NUM;
+            }
+#endif
+
 #ifdef __CA7_REV
             if (SystemGetIRQNestingLevel())
 #else
@@ -264,7 +295,13 @@ void ethernetif_enet_init(struct netif *netif, struct ethernetif *ethernetif,
     buffCfg[0].txBdStartAddrAlign = &(ethernetif->TxBuffDescrip[0]); /* Aligned transmit buffer descriptor start address. */
     buffCfg[0].rxBufferAlign = &(ethernetif->RxDataBuff[0][0]); /* Receive data buffer start address. */
     buffCfg[0].txBufferAlign = &(ethernetif->TxDataBuff[0][0]); /* Transmit data buffer start address. */
+#if ENET_TX_ZERO_COPY_ENABLED
+    buffCfg[0].txFrameInfo = ethernetif->TxFrameInfo;           /* Transmit frame information start address. Set only if using zero-copy transmit. */
+    ethernetif->txDoneHead = 0U;
+    ethernetif->txDoneTail = 0U;
+#else
     buffCfg[0].txFrameInfo = NULL;                              /* Transmit frame information start address. Set only if using zero-copy transmit. */
+#endif
     buffCfg[0].rxMaintainEnable = true;                         /*!< Receive buffer cache maintain. */
     buffCfg[0].txMaintainEnable = true;                         /*!< Transmit buffer cache maintain. */
 
@@ -273,6 +310,14 @@ void ethernetif_enet_init(struct netif *netif, struct ethernetif *ethernetif,
     ENET_GetDefaultConfig(&config);
     config.ringNum = ENET_RING_NUM;
 
+#ifdef CHECKSUM_BY_HARDWARE
+    /* lwIP leaves the checksum fields zero; the MAC fills them in. Frames
+     * received with a bad checksum are discarded by the MAC. Both need the
+     * default store-and-forward FIFO mode. */
+    config.txAccelerConfig = (uint8_t)(kENET_TxAccelIpCheckEnabled | kENET_TxAccelProtoCheckEnabled);
+    config.rxAccelerConfig = (uint8_t)(kENET_RxAccelIpCheckEnabled | kENET_RxAccelProtoCheckEnabled);
+#endif
+
     ethernetif_phy_init(ethernetif, ethernetifConfig, &config);
 
 #if USE_RTOS && defined(FSL_RTOS_FREE_RTOS)
@@ -330,6 +375,12 @@ void ethernetif_enet_init(struct netif *netif, struct ethernetif *ethernetif,
     ENET_SetCallback(&ethernetif->handle, ethernet_callback, netif);
 #endif
 
+#if ENET_TX_ZERO_COPY_ENABLED
+    /* Without reclaim the driver calls back with no frame information, and
+     * the pbufs of the zero-copy frames would never be released. */
+    ENET_SetTxReclaim(&ethernetif->handle, true, 0);
+#endif
+
     ENET_ActiveRead(ethernetif->base);
 }
 
@@ -338,6 +389,11 @@ ENET_Type **ethernetif_enet_ptr(struct ethernetif *ethernetif)
     return &(ethernetif->base);
 }
 
+ethernetif_phy_t *ethernetif_phy_ptr(struct ethernetif *ethernetif)
+{
+    return &(ethernetif->phy);
+}
+
 /**
  * Returns next buffer for TX.
  * Can wait if no buffer available.
@@ -387,6 +443,79 @@ static err_t enet_send_frame(struct ethernetif *ethernetif, unsigned char *data,
 #endif
 }
 
+#if ENET_TX_ZERO_COPY_ENABLED
+/**
+ * Frees the pbufs of zero-copy frames the hardware has finished sending.
+ */
+static void enet_tx_reclaim(struct ethernetif *ethernetif)
+{
+    while (ethernetif->txDoneTail != ethernetif->txDoneHead)
+    {
+        pbuf_free(ethernetif->TxDone[ethernetif->txDoneTail]);
+        ethernetif->txDoneTail = (ethernetif->txDoneTail + 1U) % ENET_TX_DONE_NUM;
+    }
+}
+
+/**
+ * Sends a pbuf chain via ENET without copying, one TX descriptor per pbuf.
+ * The chain is referenced until the TX interrupt reports the frame sent.
+ * Returns ERR_BUF if the chain needs more descriptors than the ring has, so
+ * the caller can fall back to copying.
+ */
+static err_t enet_send_pbuf(struct ethernetif *ethernetif, struct pbuf *p)
+{
+    enet_buffer_struct_t txBuffers[ENET_TXBD_NUM];
+    enet_tx_frame_struct_t txFrame;
+    struct pbuf *q;
+    uint32_t count = 0U;
+    status_t result;
+
+    for (q = p; q != NULL; q = q->next)
+    {
+        if (q->len == 0U)
+        {
+            continue;
+        }
+
+        if (count == ENET_TXBD_NUM)
+        {
+            return ERR_BUF;
+        }
+
+        txBuffers[count].buffer = q->payload;
+        txBuffers[count].length = q->len;
+        count++;
+    }
+
+    memset(&txFrame, 0, sizeof(txFrame));
+    txFrame.txBuffArray = &txBuffers[0];
+    txFrame.txBuffNum = count;
+    txFrame.context = p;
+
+    pbuf_ref(p);
+
+    do
+    {
+        result = ENET_StartTxFrame(ethernetif->base, &ethernetif->handle, &txFrame, 0);
+
+        if (result == kStatus_ENET_TxFrameBusy)
+        {
+            xEventGroupWaitBits(ethernetif->enetTransmitAccessEvent, ethernetif->txFlag, pdTRUE, (BaseType_t) false,
+                                portMAX_DELAY);
+            enet_tx_reclaim(ethernetif);
+        }
+    } while (result == kStatus_ENET_TxFrameBusy);
+
+    if (result != kStatus_Success)
+    {
+        pbuf_free(p);
+        return ERR_BUF;
+    }
+
+    return ERR_OK;
+}
+#endif /* ENET_TX_ZERO_COPY_ENABLED */
+
 /**
  * Reclaims RX buffer held by the p after p is no longer used
  * by the application / lwIP.
@@ -537,11 +666,9 @@ err_t ethernetif_linkoutput(struct netif *netif, struct pbuf *p)
 
     LWIP_ASSERT("Output packet buffer empty", p);
 
-    pucBuffer = enet_get_tx_buffer(ethernetif);
-    if (pucBuffer == NULL)
-    {
-        return ERR_BUF;
-    }
+#if ENET_TX_ZERO_COPY_ENABLED
+    enet_tx_reclaim(ethernetif);
+#endif
 
 /* Initiate transfer. */
 
@@ -549,15 +676,26 @@ err_t ethernetif_linkoutput(struct netif *netif, struct pbuf *p)
     pbuf_header(p, -ETH_PAD_SIZE); /* drop the padding word */
 #endif
 
+#if ENET_TX_ZERO_COPY_ENABLED
+    if (enet_send_pbuf(ethernetif, p) == ERR_OK)
+    {
+        /* Sent straight from the pbufs. */
+        result = ERR_OK;
+    }
+    else
+#endif
     if (p->len == p->tot_len)
     {
         /* No pbuf chain, don't have to copy -> faster. */
         pucBuffer = (unsigned char *)p->payload;
+        result = enet_send_frame(ethernetif, pucBuffer, p->tot_len);
     }
     else
     {
-        /* pbuf chain, copy into contiguous ucBuffer. */
-        if (p->tot_len > ENET_FRAME_MAX_FRAMELEN)
+        /* pbuf chain, copy into contiguous ucBuffer. The buffer is only
+         * taken here, where the frame is copied. */
+        pucBuffer = enet_get_tx_buffer(ethernetif);
+        if ((pucBuffer == NULL) || (p->tot_len > ENET_FRAME_MAX_FRAMELEN))
         {
             return ERR_BUF;
         }
@@ -575,10 +713,10 @@ err_t ethernetif_linkoutput(struct netif *netif, struct pbuf *p)
                 pucChar += q->len;
             }
         }
-    }
 
-    /* Send frame. */
-    result = enet_send_frame(ethernetif, pucBuffer, p->tot_len);
+        /* Send frame. */
+        result = enet_send_frame(ethernetif, pucBuffer, p->tot_len);
+    }
 
     MIB2_STATS_NETIF_ADD(netif, ifoutoctets, p->tot_len);
     if (((u8_t *)p->payload)[0] & 1)
@@ -621,6 +759,11 @@ err_t ethernetif0_init(struct netif *netif)
     AT_NONCACHEABLE_SECTION_ALIGN(static enet_tx_bd_struct_t txBuffDescrip_0[ENET_TXBD_NUM], FSL_ENET_BUFF_ALIGNMENT);
     SDK_ALIGN(static rx_buffer_t rxDataBuff_0[ENET_RXBD_NUM], FSL_ENET_BUFF_ALIGNMENT);
     SDK_ALIGN(static tx_buffer_t txDataBuff_0[ENET_TXBD_NUM], FSL_ENET_BUFF_ALIGNMENT);
+#if ENET_TX_ZERO_COPY_ENABLED
+    static enet_frame_info_t txFrameInfo_0[ENET_TXBD_NUM];
+
+    ethernetif_0.TxFrameInfo = &(txFrameInfo_0[0]);
+#endif
 
     ethernetif_0.RxBuffDescrip = &(rxBuffDescrip_0[0]);
     ethernetif_0.TxBuffDescrip = &(txBuffDescrip_0[0]);
@@ -650,6 +793,11 @@ err_t ethernetif1_init(struct netif *netif)
     AT_NONCACHEABLE_SECTION_ALIGN(static enet_tx_bd_struct_t txBuffDescrip_1[ENET_TXBD_NUM], FSL_ENET_BUFF_ALIGNMENT);
     SDK_ALIGN(static rx_buffer_t rxDataBuff_1[ENET_RXBD_NUM], FSL_ENET_BUFF_ALIGNMENT);
     SDK_ALIGN(static tx_buffer_t txDataBuff_1[ENET_TXBD_NUM], FSL_ENET_BUFF_ALIGNMENT);
+#if ENET_TX_ZERO_COPY_ENABLED
+    static enet_frame_info_t txFrameInfo_1[ENET_TXBD_NUM];
+
+    ethernetif_1.TxFrameInfo = &(txFrameInfo_1[0]);
+#endif
 
     ethernetif_1.RxBuffDescrip = &(rxBuffDescrip_1[0]);
     ethernetif_1.TxBuffDescrip = &(txBuffDescrip_1[0]);
@@ -12,6 +12,15 @@
 
 struct ethernetif;
 
+/**
+ * The PHY of an ethernetif, for the link poll.
+ */
+typedef struct ethernetif_phy
+{
+    phy_handle_t *handle;
+    bool ready; /* PHY_Init() succeeded, and the autonegotiation started. */
+} ethernetif_phy_t;
+
 #if defined(__cplusplus)
 extern "C" {
 #endif /* __cplusplus */
@@ -29,6 +38,8 @@ void ethernetif_phy_init(struct ethernetif *ethernetif,
 
 ENET_Type **ethernetif_enet_ptr(struct ethernetif *ethernetif);
 
+ethernetif_phy_t *ethernetif_phy_ptr(struct ethernetif *ethernetif);
+
 #if LWIP_IPV4 && LWIP_IGMP
 err_t ethernetif_igmp_mac_filter(struct netif *netif, const ip4_addr_t *group,
                                  enum netif_mac_filter_action action);
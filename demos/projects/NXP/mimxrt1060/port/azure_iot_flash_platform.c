@@ -11,14 +11,53 @@
 
 #include "azure/core/az_base64.h"
 
+#include "fsl_common.h"
+#include "fsl_romapi.h"
+
 #include "mbedtls/md.h"
 
-#define azureiotflashSHA_256_SIZE    32
+#define azureiotflashSHA_256_SIZE           32
+
+/* The EVK's 8 MB QSPI NOR is split into two 4 MB banks. The application
+ * runs from the first (see MIMXRT1062xxxxx_sdram.ld) and updates are
+ * written to the second. */
+#define azureiotflashNXP_FLEXSPI_INSTANCE    0
+#define azureiotflashNXP_BANK_SIZE           0x400000UL
+#define azureiotflashNXP_UPDATE_BANK         azureiotflashNXP_BANK_SIZE
+#define azureiotflashNXP_PAGE_SIZE           256
+#define azureiotflashNXP_SECTOR_SIZE         0x1000UL
+
+/* ROM configuration option for QuadSPI NOR at 133 MHz. */
+#define azureiotflashNXP_NOR_OPTION          0xc0000007UL
+
+/* The last sector of the update bank holds the record that marks a staged
+ * image for the bootloader, so the image itself can use everything before it. */
+#define azureiotflashNXP_TRAILER_OFFSET      ( azureiotflashNXP_BANK_SIZE - azureiotflashNXP_SECTOR_SIZE )
+#define azureiotflashNXP_TRAILER_MAGIC       0x41445550UL
+
+/* ulHashedLength value once a block was written out of order. */
+#define azureiotflashHASH_INVALID            0xffffffffUL
 
-static uint8_t ucPartitionReadBuffer[ 32 ];
 static uint8_t ucDecodedManifestHash[ azureiotflashSHA_256_SIZE ];
 static uint8_t ucCalculatedHash[ azureiotflashSHA_256_SIZE ];
 
+static flexspi_nor_config_t xNorConfig;
+static bool xNorReady = false;
+
+/* Running hash of the bytes passed to AzureIoTPlatform_WriteBlock(). */
+static mbedtls_md_context_t xWrittenHashContext;
+static uint32_t ulHashedLength;
+
+/* Everything below this offset in the update bank has been erased. */
+static uint32_t ulErasedLength;
+
+/* Bytes of the page at ulPageOffset that have not been programmed yet. The
+ * ROM programs whole pages from a word-aligned source, so blocks are staged
+ * here and a partial page is carried over to the next call. */
+static uint32_t ulPageBuffer[ azureiotflashNXP_PAGE_SIZE / sizeof( uint32_t ) ];
+static uint32_t ulPageOffset;
+static uint32_t ulPageLength;
+
 static AzureIoTResult_t prvBase64Decode( uint8_t * base64Encoded,
                                          size_t ulBase64EncodedLength,
                                          uint8_t * pucOutputBuffer,
@@ -42,24 +81,144 @@ static AzureIoTResult_t prvBase64Decode( uint8_t * base64Encoded,
     return eAzureIoTSuccess;
 }
 
-AzureIoTResult_t AzureIoTPlatform_Init( AzureADUImage_t * const pxAduImage )
+/*
+ * The application executes in place from the same FlexSPI device, so no code
+ * may be fetched from flash while the ROM erases or programs it. These run
+ * from RAM with interrupts masked, and clear the FlexSPI and CPU caches
+ * before execution goes back to flash.
+ */
+AT_QUICKACCESS_SECTION_CODE( static status_t prvNorErase( uint32_t ulOffset,
+                                                          uint32_t ulLength ) )
 {
-    ( void ) pxAduImage;
+    status_t xStatus;
+    uint32_t ulPrimask = DisableGlobalIRQ();
 
-    /* TODO: Fill in initialization for NXP flash writing capability. */
+    xStatus = ROM_FLEXSPI_NorFlash_Erase( azureiotflashNXP_FLEXSPI_INSTANCE, &xNorConfig, ulOffset, ulLength );
+    ROM_FLEXSPI_NorFlash_ClearCache( azureiotflashNXP_FLEXSPI_INSTANCE );
+    SCB_InvalidateDCache_by_Addr( ( void * ) ( FlexSPI_AMBA_BASE + ulOffset ), ( int32_t ) ulLength );
 
-    LogInfo( ( "AzureIoTPlatform_Init()\r\n" ) );
+    EnableGlobalIRQ( ulPrimask );
 
-    return eAzureIoTSuccess;
+    return xStatus;
 }
 
-int64_t AzureIoTPlatform_GetSingleFlashBootBankSize()
+AT_QUICKACCESS_SECTION_CODE( static status_t prvNorProgramPage( uint32_t ulOffset,
+                                                                const uint32_t * pulData ) )
+{
+    status_t xStatus;
+    uint32_t ulPrimask = DisableGlobalIRQ();
+
+    xStatus = ROM_FLEXSPI_NorFlash_ProgramPage( azureiotflashNXP_FLEXSPI_INSTANCE, &xNorConfig, ulOffset, pulData );
+    ROM_FLEXSPI_NorFlash_ClearCache( azureiotflashNXP_FLEXSPI_INSTANCE );
+    SCB_InvalidateDCache_by_Addr( ( void * ) ( FlexSPI_AMBA_BASE + ulOffset ), azureiotflashNXP_PAGE_SIZE );
+
+    EnableGlobalIRQ( ulPrimask );
+
+    return xStatus;
+}
+
+AT_QUICKACCESS_SECTION_CODE( static status_t prvNorInit( void ) )
+{
+    serial_nor_config_option_t xOption;
+    status_t xStatus;
+    uint32_t ulPrimask = DisableGlobalIRQ();
+
+    xOption.option0.U = azureiotflashNXP_NOR_OPTION;
+    xOption.option1.U = 0;
+
+    xStatus = ROM_FLEXSPI_NorFlash_GetConfig( azureiotflashNXP_FLEXSPI_INSTANCE, &xNorConfig, &xOption );
+
+    if( xStatus == kStatus_Success )
+    {
+        xStatus = ROM_FLEXSPI_NorFlash_Init( azureiotflashNXP_FLEXSPI_INSTANCE, &xNorConfig );
+    }
+
+    ROM_FLEXSPI_NorFlash_ClearCache( azureiotflashNXP_FLEXSPI_INSTANCE );
+
+    EnableGlobalIRQ( ulPrimask );
+
+    return xStatus;
+}
+
+/* Program the staged page, padding a partial one with the erased value. */
+static AzureIoTResult_t prvFlushPage( void )
 {
-    /* TODO: Fill in returning of flash bank size (to make sure we don't install an image larger than that) */
+    AzureIoTResult_t xResult = eAzureIoTSuccess;
+
+    if( ulPageLength == 0 )
+    {
+        return eAzureIoTSuccess;
+    }
+
+    memset( ( uint8_t * ) ulPageBuffer + ulPageLength, 0xFF, azureiotflashNXP_PAGE_SIZE - ulPageLength );
 
-    LogInfo( ( "AzureIoTPlatform_GetSingleFlashBootBankSize()\r\n" ) );
+    if( prvNorProgramPage( azureiotflashNXP_UPDATE_BANK + ulPageOffset, ulPageBuffer ) != kStatus_Success )
+    {
+        AZLogError( ( "Error programming flash page at 0x%08x\r\n", ulPageOffset ) );
+        xResult = eAzureIoTErrorFailed;
+    }
+
+    ulPageOffset += azureiotflashNXP_PAGE_SIZE;
+    ulPageLength = 0;
+
+    return xResult;
+}
+
+static void prvStartWrittenHash( void )
+{
+    mbedtls_md_free( &xWrittenHashContext );
+    mbedtls_md_init( &xWrittenHashContext );
+    mbedtls_md_setup( &xWrittenHashContext, mbedtls_md_info_from_type( MBEDTLS_MD_SHA256 ), 0 );
+    mbedtls_md_starts( &xWrittenHashContext );
+    ulHashedLength = 0;
+}
+
+AzureIoTResult_t AzureIoTPlatform_Init( AzureADUImage_t * const pxAduImage )
+{
+    pxAduImage->xUpdatePartition = ( uint8_t * ) ( FlexSPI_AMBA_BASE + azureiotflashNXP_UPDATE_BANK );
+    pxAduImage->pucBufferToWrite = NULL;
+    pxAduImage->ulBytesToWriteLength = 0;
+    pxAduImage->ulCurrentOffset = 0;
+    pxAduImage->ulImageFileSize = 0;
+
+    prvStartWrittenHash();
+    ulErasedLength = 0;
+    ulPageOffset = 0;
+    ulPageLength = 0;
+
+    if( !xNorReady )
+    {
+        if( prvNorInit() != kStatus_Success )
+        {
+            AZLogError( ( "FlexSPI NOR init failed\r\n" ) );
+            return eAzureIoTErrorFailed;
+        }
+
+        if( ( xNorConfig.pageSize != azureiotflashNXP_PAGE_SIZE ) ||
+            ( xNorConfig.sectorSize != azureiotflashNXP_SECTOR_SIZE ) )
+        {
+            AZLogError( ( "Unexpected NOR geometry: page %u, sector %u\r\n", xNorConfig.pageSize, xNorConfig.sectorSize ) );
+            return eAzureIoTErrorFailed;
+        }
+
+        xNorReady = true;
+    }
+
+    /* Drop any image staged by an earlier download. The image sectors
+     * themselves are erased as they are first written. */
+    if( prvNorErase( azureiotflashNXP_UPDATE_BANK + azureiotflashNXP_TRAILER_OFFSET,
+                     azureiotflashNXP_SECTOR_SIZE ) != kStatus_Success )
+    {
+        AZLogError( ( "Error erasing the update trailer\r\n" ) );
+        return eAzureIoTErrorFailed;
+    }
+
+    return eAzureIoTSuccess;
+}
 
-    return INT64_MAX;
+int64_t AzureIoTPlatform_GetSingleFlashBootBankSize()
+{
+    return azureiotflashNXP_TRAILER_OFFSET;
 }
 
 AzureIoTResult_t AzureIoTPlatform_WriteBlock( AzureADUImage_t * const pxAduImage,
@@ -67,40 +226,174 @@ AzureIoTResult_t AzureIoTPlatform_WriteBlock( AzureADUImage_t * const pxAduImage
                                               uint8_t * const pData,
                                               uint32_t ulBlockSize )
 {
+    uint8_t * pucNextReadAddr = pData;
+    uint32_t ulRemaining = ulBlockSize;
+    uint32_t ulCopySize;
+    uint32_t ulEraseEnd;
+
     ( void ) pxAduImage;
-    ( void ) ulOffset;
-    ( void ) pData;
-    ( void ) ulBlockSize;
 
-    /* TODO: Fill in to write pData of size ulBlockSize to ulOffset in memory. */
+    if( ulOffset != ulPageOffset + ulPageLength )
+    {
+        /* The block does not continue the staged page, so finish that page
+         * and start a new one, which has to be aligned. */
+        if( prvFlushPage() != eAzureIoTSuccess )
+        {
+            return eAzureIoTErrorFailed;
+        }
+
+        if( ( ulOffset % azureiotflashNXP_PAGE_SIZE ) != 0 )
+        {
+            AZLogError( ( "Block does not start on a flash page\r\n" ) );
+            return eAzureIoTErrorFailed;
+        }
+
+        ulPageOffset = ulOffset;
+    }
+
+    /* Blocks arrive in order, so only the sectors past the erased ones need erasing. */
+    if( ulOffset + ulBlockSize > ulErasedLength )
+    {
+        ulEraseEnd = ( ulOffset + ulBlockSize + azureiotflashNXP_SECTOR_SIZE - 1 ) & ~( azureiotflashNXP_SECTOR_SIZE - 1 );
+
+        if( ulEraseEnd > azureiotflashNXP_TRAILER_OFFSET )
+        {
+            AZLogError( ( "Block does not fit in the update bank\r\n" ) );
+            return eAzureIoTErrorFailed;
+        }
+
+        if( prvNorErase( azureiotflashNXP_UPDATE_BANK + ulErasedLength, ulEraseEnd - ulErasedLength ) != kStatus_Success )
+        {
+            AZLogError( ( "Error erasing flash at 0x%08x\r\n", ulErasedLength ) );
+            return eAzureIoTErrorFailed;
+        }
 
-    LogInfo( ( "AzureIoTPlatform_WriteBlock(): offset %i\r\n", ulOffset ) );
+        ulErasedLength = ulEraseEnd;
+    }
+
+    if( ulOffset == ulHashedLength )
+    {
+        mbedtls_md_update( &xWrittenHashContext, ( const unsigned char * ) pData, ulBlockSize );
+        ulHashedLength += ulBlockSize;
+    }
+    else
+    {
+        ulHashedLength = azureiotflashHASH_INVALID;
+    }
+
+    while( ulRemaining > 0 )
+    {
+        ulCopySize = azureiotflashNXP_PAGE_SIZE - ulPageLength;
+        ulCopySize = ulRemaining < ulCopySize ? ulRemaining : ulCopySize;
+
+        memcpy( ( uint8_t * ) ulPageBuffer + ulPageLength, pucNextReadAddr, ulCopySize );
+        ulPageLength += ulCopySize;
+        pucNextReadAddr += ulCopySize;
+        ulRemaining -= ulCopySize;
+
+        if( ( ulPageLength == azureiotflashNXP_PAGE_SIZE ) &&
+            ( prvFlushPage() != eAzureIoTSuccess ) )
+        {
+            return eAzureIoTErrorFailed;
+        }
+    }
 
     return eAzureIoTSuccess;
 }
 
+static AzureIoTResult_t prvCompareHash( void )
+{
+    if( memcmp( ucDecodedManifestHash, ucCalculatedHash, azureiotflashSHA_256_SIZE ) == 0 )
+    {
+        AZLogInfo( ( "SHAs match\r\n" ) );
+        return eAzureIoTSuccess;
+    }
+
+    AZLogError( ( "SHAs do not match\r\n" ) );
+    AZLogInfo( ( "Wanted: " ) );
+
+    for( int i = 0; i < azureiotflashSHA_256_SIZE; ++i )
+    {
+        AZLogInfo( ( "%x", ucDecodedManifestHash[ i ] ) );
+    }
+
+    AZLogInfo( ( "\r\n" ) );
+    AZLogInfo( ( "Calculated: " ) );
+
+    for( int i = 0; i < azureiotflashSHA_256_SIZE; ++i )
+    {
+        AZLogInfo( ( "%x", ucCalculatedHash[ i ] ) );
+    }
+
+    AZLogInfo( ( "\r\n" ) );
+
+    return eAzureIoTErrorFailed;
+}
+
 AzureIoTResult_t AzureIoTPlatform_VerifyImage( AzureADUImage_t * const pxAduImage,
                                                uint8_t * pucSHA256Hash,
                                                uint32_t ulSHA256HashLength )
 {
-    ( void ) pxAduImage;
-    ( void ) pucSHA256Hash;
-    ( void ) ulSHA256HashLength;
+    int xResult;
+    uint32_t ulOutputSize;
+    mbedtls_md_context_t ctx;
 
-    /* TODO: Fill in to verify bytes written to flash bank match the SHA256 given by pucSHA256Hash. */
+    AZLogInfo( ( "Base64 Encoded Hash from ADU: %.*s", ulSHA256HashLength, pucSHA256Hash ) );
+    xResult = prvBase64Decode( pucSHA256Hash, ulSHA256HashLength, ucDecodedManifestHash, azureiotflashSHA_256_SIZE, ( size_t * ) &ulOutputSize );
 
-    LogInfo( ( "AzureIoTPlatform_VerifyImage()\r\n" ) );
+    if( xResult != eAzureIoTSuccess )
+    {
+        AZLogError( ( "Unable to decode base64 SHA256\r\n" ) );
+        return eAzureIoTErrorFailed;
+    }
 
-    return eAzureIoTSuccess;
+    /* The download is over, so program the tail of the image. */
+    if( prvFlushPage() != eAzureIoTSuccess )
+    {
+        return eAzureIoTErrorFailed;
+    }
+
+    if( ulHashedLength == pxAduImage->ulImageFileSize )
+    {
+        mbedtls_md_finish( &xWrittenHashContext, ucCalculatedHash );
+        /* The context is finished, so a second call has to read the image back. */
+        ulHashedLength = azureiotflashHASH_INVALID;
+
+        if( prvCompareHash() != eAzureIoTSuccess )
+        {
+            return eAzureIoTErrorFailed;
+        }
+    }
+
+    /* Always check what actually landed in flash. The bank is memory mapped,
+     * so it is hashed through the FlexSPI window without a copy. */
+    AZLogInfo( ( "Starting the mbedtls calculation: image size %u\r\n", pxAduImage->ulImageFileSize ) );
+
+    mbedtls_md_init( &ctx );
+    mbedtls_md_setup( &ctx, mbedtls_md_info_from_type( MBEDTLS_MD_SHA256 ), 0 );
+    mbedtls_md_starts( &ctx );
+    mbedtls_md_update( &ctx, ( const unsigned char * ) pxAduImage->xUpdatePartition, pxAduImage->ulImageFileSize );
+    mbedtls_md_finish( &ctx, ucCalculatedHash );
+    mbedtls_md_free( &ctx );
+
+    AZLogInfo( ( "mbedtls calculation completed\r\n" ) );
+
+    return prvCompareHash();
 }
 
 AzureIoTResult_t AzureIoTPlatform_EnableImage( AzureADUImage_t * const pxAduImage )
 {
-    ( void ) pxAduImage;
-
-    /* TODO: Fill in to program board to decide which memory bank to use on reboot. */
+    /* The RT1060 has no bank swap, so the image is marked for a second stage
+     * bootloader to install: magic, image size, then the erased value. */
+    memset( ulPageBuffer, 0xFF, sizeof( ulPageBuffer ) );
+    ulPageBuffer[ 0 ] = azureiotflashNXP_TRAILER_MAGIC;
+    ulPageBuffer[ 1 ] = pxAduImage->ulImageFileSize;
 
-    LogInfo( ( "AzureIoTPlatform_EnableImage()\r\n" ) );
+    if( prvNorProgramPage( azureiotflashNXP_UPDATE_BANK + azureiotflashNXP_TRAILER_OFFSET, ulPageBuffer ) != kStatus_Success )
+    {
+        AZLogError( ( "Error writing the update trailer\r\n" ) );
+        return eAzureIoTErrorFailed;
+    }
 
     return eAzureIoTSuccess;
 }
@@ -109,9 +402,7 @@ AzureIoTResult_t AzureIoTPlatform_ResetDevice( AzureADUImage_t * const pxAduImag
 {
     ( void ) pxAduImage;
 
-    /* TODO: Fill in to reboot the device. */
-
-    LogInfo( ( "AzureIoTPlatform_ResetDevice()\r\n" ) );
+    NVIC_SystemReset();
 
     return eAzureIoTSuccess;
 }
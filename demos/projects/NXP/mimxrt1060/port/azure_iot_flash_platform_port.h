@@ -13,7 +13,7 @@
 
 typedef struct AzureADUImageContext
 {
-    void * xUpdatePartition;       /**< TODO: Fill in for NXP partition. */
+    uint8_t * xUpdatePartition;    /**< Memory mapped address of the update bank. */
     uint8_t * pucBufferToWrite;    /**< The buffer containing the bytes to write to the flash. */
     uint32_t ulBytesToWriteLength; /**< The length of the buffer from which to write the bytes. */
     uint32_t ulCurrentOffset;      /**< The offset for the partition to write the bytes. */
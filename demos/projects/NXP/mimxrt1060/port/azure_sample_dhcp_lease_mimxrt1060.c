@@ -0,0 +1,47 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+#include "azure_sample_dhcp_lease.h"
+
+#include "fsl_common.h"
+#include "fsl_clock.h"
+
+/* The record takes the four general purpose registers of the SNVS low power
+ * domain, which keep it across resets and brownouts, and across power loss
+ * with a coin cell on VSNVS. That saves flash a write each time the lease
+ * changes. */
+#define dhcpleaseNXP_WORDS    ( sizeof( DHCPLeaseRecord_t ) / sizeof( uint32_t ) )
+
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t DHCPLease_PlatformRead( DHCPLeaseRecord_t * pxRecord )
+{
+    uint32_t * pulRecord = ( uint32_t * ) pxRecord;
+    uint32_t ulIndex;
+
+    CLOCK_EnableClock( kCLOCK_SnvsLp );
+
+    for( ulIndex = 0; ulIndex < dhcpleaseNXP_WORDS; ulIndex++ )
+    {
+        pulRecord[ ulIndex ] = SNVS->LPGPR[ ulIndex ];
+    }
+
+    return eAzureIoTSuccess;
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t DHCPLease_PlatformWrite( const DHCPLeaseRecord_t * pxRecord )
+{
+    const uint32_t * pulRecord = ( const uint32_t * ) pxRecord;
+    uint32_t ulIndex;
+
+    CLOCK_EnableClock( kCLOCK_SnvsLp );
+
+    for( ulIndex = 0; ulIndex < dhcpleaseNXP_WORDS; ulIndex++ )
+    {
+        SNVS->LPGPR[ ulIndex ] = pulRecord[ ulIndex ];
+    }
+
+    return eAzureIoTSuccess;
+}
+/*-----------------------------------------------------------*/
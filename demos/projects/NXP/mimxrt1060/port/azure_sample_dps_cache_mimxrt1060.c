@@ -0,0 +1,143 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "azure_sample_dps_cache.h"
+
+#include "fsl_common.h"
+#include "fsl_romapi.h"
+
+/* MIMXRT1062xxxxx_sdram.ld ends the application one sector before the end
+ * of the first bank, and that sector holds the record. */
+#define dpscacheNXP_FLEXSPI_INSTANCE    0
+#define dpscacheNXP_SECTOR_OFFSET       0x3FF000UL
+#define dpscacheNXP_SECTOR_SIZE         0x1000UL
+#define dpscacheNXP_PAGE_SIZE           256
+
+/* ROM configuration option for QuadSPI NOR at 133 MHz. */
+#define dpscacheNXP_NOR_OPTION          0xc0000007UL
+
+#define dpscacheNXP_RECORD_PAGES        ( ( sizeof( DPSCacheRecord_t ) + dpscacheNXP_PAGE_SIZE - 1 ) / dpscacheNXP_PAGE_SIZE )
+
+static flexspi_nor_config_t xNorConfig;
+static bool xNorReady = false;
+
+/* The ROM programs whole pages from a word-aligned source. */
+static uint32_t ulPageBuffer[ dpscacheNXP_PAGE_SIZE / sizeof( uint32_t ) ];
+
+/*-----------------------------------------------------------*/
+
+/*
+ * The application executes in place from the same FlexSPI device, so no code
+ * may be fetched from flash while the ROM erases or programs it. As in the ADU
+ * flash port, these run from RAM with interrupts masked.
+ */
+AT_QUICKACCESS_SECTION_CODE( static status_t prvNorErase( uint32_t ulOffset,
+                                                          uint32_t ulLength ) )
+{
+    status_t xStatus;
+    uint32_t ulPrimask = DisableGlobalIRQ();
+
+    xStatus = ROM_FLEXSPI_NorFlash_Erase( dpscacheNXP_FLEXSPI_INSTANCE, &xNorConfig, ulOffset, ulLength );
+    ROM_FLEXSPI_NorFlash_ClearCache( dpscacheNXP_FLEXSPI_INSTANCE );
+    SCB_InvalidateDCache_by_Addr( ( void * ) ( FlexSPI_AMBA_BASE + ulOffset ), ( int32_t ) ulLength );
+
+    EnableGlobalIRQ( ulPrimask );
+
+    return xStatus;
+}
+
+AT_QUICKACCESS_SECTION_CODE( static status_t prvNorProgramPage( uint32_t ulOffset,
+                                                                const uint32_t * pulData ) )
+{
+    status_t xStatus;
+    uint32_t ulPrimask = DisableGlobalIRQ();
+
+    xStatus = ROM_FLEXSPI_NorFlash_ProgramPage( dpscacheNXP_FLEXSPI_INSTANCE, &xNorConfig, ulOffset, pulData );
+    ROM_FLEXSPI_NorFlash_ClearCache( dpscacheNXP_FLEXSPI_INSTANCE );
+    SCB_InvalidateDCache_by_Addr( ( void * ) ( FlexSPI_AMBA_BASE + ulOffset ), dpscacheNXP_PAGE_SIZE );
+
+    EnableGlobalIRQ( ulPrimask );
+
+    return xStatus;
+}
+
+AT_QUICKACCESS_SECTION_CODE( static status_t prvNorInit( void ) )
+{
+    serial_nor_config_option_t xOption;
+    status_t xStatus;
+    uint32_t ulPrimask = DisableGlobalIRQ();
+
+    xOption.option0.U = dpscacheNXP_NOR_OPTION;
+    xOption.option1.U = 0;
+
+    xStatus = ROM_FLEXSPI_NorFlash_GetConfig( dpscacheNXP_FLEXSPI_INSTANCE, &xNorConfig, &xOption );
+
+    if( xStatus == kStatus_Success )
+    {
+        xStatus = ROM_FLEXSPI_NorFlash_Init( dpscacheNXP_FLEXSPI_INSTANCE, &xNorConfig );
+    }
+
+    ROM_FLEXSPI_NorFlash_ClearCache( dpscacheNXP_FLEXSPI_INSTANCE );
+
+    EnableGlobalIRQ( ulPrimask );
+
+    return xStatus;
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t DPSCache_PlatformRead( DPSCacheRecord_t * pxRecord )
+{
+    /* The NOR is memory mapped, so the record is read in place. */
+    memcpy( pxRecord, ( const void * ) ( FlexSPI_AMBA_BASE + dpscacheNXP_SECTOR_OFFSET ), sizeof( *pxRecord ) );
+
+    return eAzureIoTSuccess;
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t DPSCache_PlatformWrite( const DPSCacheRecord_t * pxRecord )
+{
+    uint32_t ulPage;
+    uint32_t ulOffset;
+    uint32_t ulLength;
+
+    if( !xNorReady )
+    {
+        if( prvNorInit() != kStatus_Success )
+        {
+            return eAzureIoTErrorFailed;
+        }
+
+        xNorReady = true;
+    }
+
+    if( prvNorErase( dpscacheNXP_SECTOR_OFFSET, dpscacheNXP_SECTOR_SIZE ) != kStatus_Success )
+    {
+        return eAzureIoTErrorFailed;
+    }
+
+    for( ulPage = 0; ulPage < dpscacheNXP_RECORD_PAGES; ulPage++ )
+    {
+        ulOffset = ulPage * dpscacheNXP_PAGE_SIZE;
+        ulLength = sizeof( *pxRecord ) - ulOffset;
+
+        if( ulLength > dpscacheNXP_PAGE_SIZE )
+        {
+            ulLength = dpscacheNXP_PAGE_SIZE;
+        }
+
+        /* A partial last page is padded with the erased value. */
+        memset( ulPageBuffer, 0xFF, sizeof( ulPageBuffer ) );
+        memcpy( ulPageBuffer, ( const uint8_t * ) pxRecord + ulOffset, ulLength );
+
+        if( prvNorProgramPage( dpscacheNXP_SECTOR_OFFSET + ulOffset, ulPageBuffer ) != kStatus_Success )
+        {
+            return eAzureIoTErrorFailed;
+        }
+    }
+
+    return eAzureIoTSuccess;
+}
+/*-----------------------------------------------------------*/
@@ -0,0 +1,181 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @file mbedtls_sha256_alt_dcp.c
+ * @brief mbedTLS SHA-256 implementation offloaded to the i.MX RT DCP.
+ *
+ * Used when MBEDTLS_SHA256_ALT is defined in mbedtls_config.h. The DCP is
+ * initialized in main.c before the scheduler starts. All contexts share DCP
+ * channel 0, and a mutex serializes access between tasks.
+ *
+ * The DCP cannot read the DTCM, where BOARD_TCM places the TLS record buffers,
+ * so input from there is hashed through a bounce buffer in the OCRAM.
+ */
+
+#include <string.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "semphr.h"
+
+#include "mbedtls/sha256.h"
+
+#if defined( MBEDTLS_SHA256_ALT )
+
+static dcp_handle_t xDcpHashHandle =
+{
+    .channel    = kDCP_Channel0,
+    .keySlot    = kDCP_KeySlot0,
+    .swapConfig = kDCP_NoSwap,
+};
+
+static SemaphoreHandle_t xDcpMutex = NULL;
+static StaticSemaphore_t xDcpMutexStorage;
+
+#ifdef BOARD_TCM
+    #define sha256altDTCM_START          ( 0x20000000UL )
+    #define sha256altDTCM_END            ( 0x20080000UL )
+    #define sha256altBOUNCE_BUFFER_SIZE  ( 256U )
+
+    /* Used under the DCP mutex. */
+    static uint8_t ucBounceBuffer[ sha256altBOUNCE_BUFFER_SIZE ];
+#endif /* BOARD_TCM */
+
+/*-----------------------------------------------------------*/
+
+static void prvDcpLock( void )
+{
+    if( xDcpMutex == NULL )
+    {
+        taskENTER_CRITICAL();
+
+        if( xDcpMutex == NULL )
+        {
+            xDcpMutex = xSemaphoreCreateMutexStatic( &xDcpMutexStorage );
+        }
+
+        taskEXIT_CRITICAL();
+    }
+
+    ( void ) xSemaphoreTake( xDcpMutex, portMAX_DELAY );
+}
+/*-----------------------------------------------------------*/
+
+static void prvDcpUnlock( void )
+{
+    ( void ) xSemaphoreGive( xDcpMutex );
+}
+/*-----------------------------------------------------------*/
+
+void mbedtls_sha256_init( mbedtls_sha256_context * ctx )
+{
+    memset( ctx, 0, sizeof( mbedtls_sha256_context ) );
+}
+/*-----------------------------------------------------------*/
+
+void mbedtls_sha256_free( mbedtls_sha256_context * ctx )
+{
+    if( ctx != NULL )
+    {
+        memset( ctx, 0, sizeof( mbedtls_sha256_context ) );
+    }
+}
+/*-----------------------------------------------------------*/
+
+void mbedtls_sha256_clone( mbedtls_sha256_context * dst,
+                           const mbedtls_sha256_context * src )
+{
+    /* The DCP context only holds a pointer to the shared handle, so a copy is a valid clone. */
+    *dst = *src;
+}
+/*-----------------------------------------------------------*/
+
+int mbedtls_sha256_starts_ret( mbedtls_sha256_context * ctx,
+                               int is224 )
+{
+    status_t xStatus;
+
+    ctx->is224 = is224;
+
+    if( is224 != 0 )
+    {
+        return MBEDTLS_ERR_SHA256_HW_ACCEL_FAILED;
+    }
+
+    prvDcpLock();
+    xStatus = DCP_HASH_Init( DCP, &xDcpHashHandle, &ctx->xDcpContext, kDCP_Sha256 );
+    prvDcpUnlock();
+
+    return ( xStatus == kStatus_Success ) ? 0 : MBEDTLS_ERR_SHA256_HW_ACCEL_FAILED;
+}
+/*-----------------------------------------------------------*/
+
+int mbedtls_sha256_update_ret( mbedtls_sha256_context * ctx,
+                               const unsigned char * input,
+                               size_t ilen )
+{
+    status_t xStatus;
+
+    if( ctx->is224 != 0 )
+    {
+        return MBEDTLS_ERR_SHA256_HW_ACCEL_FAILED;
+    }
+
+    prvDcpLock();
+
+    #ifdef BOARD_TCM
+        if( ( ( uintptr_t ) input >= sha256altDTCM_START ) && ( ( uintptr_t ) input < sha256altDTCM_END ) )
+        {
+            size_t xChunk;
+
+            xStatus = kStatus_Success;
+
+            while( ( ilen > 0 ) && ( xStatus == kStatus_Success ) )
+            {
+                xChunk = ( ilen < sizeof( ucBounceBuffer ) ) ? ilen : sizeof( ucBounceBuffer );
+                memcpy( ucBounceBuffer, input, xChunk );
+                xStatus = DCP_HASH_Update( DCP, &ctx->xDcpContext, ucBounceBuffer, xChunk );
+                input += xChunk;
+                ilen -= xChunk;
+            }
+        }
+        else
+    #endif /* BOARD_TCM */
+    {
+        xStatus = DCP_HASH_Update( DCP, &ctx->xDcpContext, input, ilen );
+    }
+
+    prvDcpUnlock();
+
+    return ( xStatus == kStatus_Success ) ? 0 : MBEDTLS_ERR_SHA256_HW_ACCEL_FAILED;
+}
+/*-----------------------------------------------------------*/
+
+int mbedtls_sha256_finish_ret( mbedtls_sha256_context * ctx,
+                               unsigned char output[ 32 ] )
+{
+    status_t xStatus;
+    size_t xOutputSize = 32;
+
+    if( ctx->is224 != 0 )
+    {
+        return MBEDTLS_ERR_SHA256_HW_ACCEL_FAILED;
+    }
+
+    prvDcpLock();
+    xStatus = DCP_HASH_Finish( DCP, &ctx->xDcpContext, output, &xOutputSize );
+    prvDcpUnlock();
+
+    return ( xStatus == kStatus_Success ) ? 0 : MBEDTLS_ERR_SHA256_HW_ACCEL_FAILED;
+}
+/*-----------------------------------------------------------*/
+
+int mbedtls_internal_sha256_process( mbedtls_sha256_context * ctx,
+                                     const unsigned char data[ 64 ] )
+{
+    return mbedtls_sha256_update_ret( ctx, data, 64 );
+}
+/*-----------------------------------------------------------*/
+
+#endif /* MBEDTLS_SHA256_ALT */
@@ -0,0 +1,22 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @file sha256_alt.h
+ *
+ * @brief SHA-256 context for the mbedTLS SHA-256 implementation using the DCP.
+ *
+ */
+
+#ifndef SHA256_ALT_H
+#define SHA256_ALT_H
+
+#include "fsl_dcp.h"
+
+typedef struct mbedtls_sha256_context
+{
+    dcp_hash_ctx_t xDcpContext; /**< DCP hashing state. */
+    int is224;                  /**< Set for SHA-224, which the DCP does not support. */
+} mbedtls_sha256_context;
+
+#endif /* SHA256_ALT_H */
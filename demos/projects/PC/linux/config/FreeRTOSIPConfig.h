@@ -18,6 +18,13 @@
 extern void vLoggingPrintf( const char * pcFormatString,
                             ... );
 
+/* Set to 1 by the FREERTOS_TCP_STATIC_BUFFERS CMake option, which builds
+ * BufferAllocation_1 instead of BufferAllocation_2. Network buffers are then
+ * statically sized and allocated once, instead of one malloc() per packet. */
+#ifndef democonfigSTATIC_NETWORK_BUFFERS
+    #define democonfigSTATIC_NETWORK_BUFFERS    0
+#endif
+
 /* Set to 1 to print out debug messages.  If ipconfigHAS_DEBUG_PRINTF is set to
  * 1 then FreeRTOS_debug_printf should be defined to the function used to print
  * out the debugging messages. */
@@ -173,7 +180,13 @@ extern UBaseType_t uxRand();
  * are available to the IP stack.  The total number of network buffers is limited
  * to ensure the total amount of RAM that can be consumed by the IP stack is capped
  * to a pre-determinable value. */
-#define ipconfigNUM_NETWORK_BUFFER_DESCRIPTORS         60
+#if ( democonfigSTATIC_NETWORK_BUFFERS == 1 )
+    /* BufferAllocation_1 allocates all the buffers once at start up, so there
+     * are enough of them for a sustained high packet rate. */
+    #define ipconfigNUM_NETWORK_BUFFER_DESCRIPTORS     120
+#else
+    #define ipconfigNUM_NETWORK_BUFFER_DESCRIPTORS     60
+#endif
 
 /* A FreeRTOS queue is used to send events from application tasks to the IP
  * stack.  ipconfigEVENT_QUEUE_LENGTH sets the maximum number of events that can
@@ -210,7 +223,13 @@ extern UBaseType_t uxRand();
  * lower value can save RAM, depending on the buffer management scheme used.  If
  * ipconfigCAN_FRAGMENT_OUTGOING_PACKETS is 1 then (ipconfigNETWORK_MTU - 28) must
  * be divisible by 8. */
-#define ipconfigNETWORK_MTU                            1200U
+#if ( democonfigSTATIC_NETWORK_BUFFERS == 1 )
+    /* BufferAllocation_1 buffers have a fixed size and must hold any frame
+     * the host interface delivers. */
+    #define ipconfigNETWORK_MTU                        1500U
+#else
+    #define ipconfigNETWORK_MTU                        1200U
+#endif
 
 /* Set ipconfigUSE_DNS to 1 to include a basic DNS client/resolver.  DNS is used
  * through the FreeRTOS_gethostbyname() API function. */
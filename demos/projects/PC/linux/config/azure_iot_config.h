@@ -49,4 +49,14 @@ extern void vLoggingPrintf( const char * pcFormatString,
 #include "logging_stack.h"
 /************ End of logging configuration ****************/
 
+/* Keepalive of the hub client, learnt per network by azure_sample_keepalive.c
+ * when built with the SAMPLE_ADAPTIVE_KEEPALIVE CMake option. */
+#if defined( democonfigADAPTIVE_KEEPALIVE ) && ( democonfigADAPTIVE_KEEPALIVE == 1 )
+    #include <stdint.h>
+
+    extern uint16_t KeepAlive_Seconds( void );
+
+    #define azureiotconfigKEEP_ALIVE_TIMEOUT_SECONDS    KeepAlive_Seconds()
+#endif
+
 #endif /* AZURE_IOT_CONFIG_H */
@@ -4,6 +4,8 @@
 #ifndef DEMO_CONFIG_H
 #define DEMO_CONFIG_H
 
+#include <stdint.h>
+
 /* FreeRTOS config include. */
 #include "FreeRTOSConfig.h"
 
@@ -87,6 +89,15 @@ extern void vLoggingPrintf( const char * pcFormatString,
  */
     #define democonfigREGISTRATION_ID    "<YOUR REGISTRATION ID HERE>"
 
+/**
+ * @brief Keep the IoT Hub assignment across restarts, in democonfigDPS_CACHE_FILE.
+ *
+ * @note To register with Device Provisioning on every start undef this macro
+ *
+ */
+    #define democonfigUSE_DPS_CACHE
+    #define democonfigDPS_CACHE_FILE     "dps_cache.bin"
+
 #endif /* democonfigENABLE_DPS_SAMPLE */
 
 /**
@@ -223,18 +234,73 @@ extern void vLoggingPrintf( const char * pcFormatString,
 #define democonfigDEMO_STACKSIZE             ( 2 * 1024U )
 
 /**
- * @brief Size of the network buffer for MQTT packets.
+ * @brief Size of the part of the hub client buffer the MQTT packets are
+ * received in, which must hold the largest one the hub sends, such as a
+ * property document or an ADU manifest.
  */
-#define democonfigNETWORK_BUFFER_SIZE        ( 5 * 1024U )
+#define democonfigNETWORK_RX_BUFFER_SIZE     ( 5 * 1024U )
+
+/**
+ * @brief Size of the part of the hub client buffer the middleware writes the
+ * topic, user name and password of the packets it sends in. The payloads are
+ * sent from the buffers of the samples, so this does not grow with them.
+ */
+#define democonfigNETWORK_TX_BUFFER_SIZE     ( azureiotconfigUSERNAME_MAX + azureiotconfigPASSWORD_MAX )
+
+/**
+ * @brief Size of the buffer given to the hub and provisioning clients, which
+ * use its first democonfigNETWORK_TX_BUFFER_SIZE bytes for what they send and
+ * receive in the rest.
+ */
+#define democonfigNETWORK_BUFFER_SIZE        ( democonfigNETWORK_TX_BUFFER_SIZE + democonfigNETWORK_RX_BUFFER_SIZE )
 
 /**
  * @brief IoTHub endpoint port.
  */
 #define democonfigIOTHUB_PORT                ( 8883 )
 
+/* Uncomment to connect to IoT Hub through an IoT Edge gateway on the site,
+ * whose server certificate is signed by democonfigGATEWAY_ROOT_CA_PEM. The
+ * provisioning service is still reached directly. */
+/* #define democonfigGATEWAY_HOSTNAME       "edgegateway.local" */
+/* #define democonfigGATEWAY_ROOT_CA_PEM    "-----BEGIN CERTIFICATE-----\n...\n-----END CERTIFICATE-----\n" */
+
+/**
+ * @brief Key the load generator derives its device keys from. This is the
+ * primary key of a DPS group enrollment, or, without DPS, the key the hub
+ * devices were created with derived keys from.
+ *
+ * @note The device count, telemetry rate and payload size of the load
+ * generator are set with democonfigLOAD_DEVICE_COUNT,
+ * democonfigLOAD_TELEMETRY_INTERVAL_MS and democonfigLOAD_PAYLOAD_SIZE.
+ */
+#define democonfigLOAD_GROUP_SYMMETRIC_KEY    "<YOUR GROUP ENROLLMENT KEY HERE>"
+
+/**
+ * @brief Key the gateway sample derives the keys of its leaf devices from,
+ * the hub devices being created with keys derived from it.
+ *
+ * @note The number of leaf devices and their telemetry rate are set with
+ * democonfigGATEWAY_IDENTITY_COUNT and democonfigGATEWAY_TELEMETRY_INTERVAL_MS.
+ */
+#define democonfigGATEWAY_GROUP_SYMMETRIC_KEY    "<YOUR GROUP ENROLLMENT KEY HERE>"
+
 /* 2^16 */
 #define democonfigCHUNK_DOWNLOAD_SIZE        65536
 
+/* Write each chunk to flash while the next one downloads. */
+#define democonfigADU_PIPELINED_DOWNLOAD     ( 1 )
+
+/* Grow the range requests up to democonfigCHUNK_DOWNLOAD_SIZE while the link keeps up. */
+#define democonfigADU_ADAPTIVE_CHUNK_SIZE    ( 1 )
+
+/* Download from a separate task, so telemetry keeps flowing during an update. */
+#define democonfigADU_DOWNLOAD_TASK          ( 1 )
+
+/* Receive buffer for the ADU download socket; FreeRTOS+TCP sizes the
+ * receive window to half of it. */
+#define democonfigADU_DOWNLOAD_RECEIVE_BUFFER_SIZE    ( 32768U )
+
 #define democonfigADU_DEVICE_MANUFACTURER    "PC"
 #define democonfigADU_DEVICE_MODEL           "Linux"
 #define democonfigADU_UPDATE_PROVIDER        "Contoso"
@@ -242,4 +308,27 @@ extern void vLoggingPrintf( const char * pcFormatString,
 #define democonfigADU_UPDATE_VERSION         "1.0"
 #define democonfigADU_UPDATE_NEW_VERSION     "1.1"
 
+/* The benchmarks time with the host clock, as runs are shorter than a tick,
+ * and exit once they have printed their results. */
+extern uint64_t ullGetMonotonicTimeUs( void );
+#define democonfigBENCH_TIME_US()    ullGetMonotonicTimeUs()
+#define democonfigBENCH_DONE()       exit( 0 )
+
+/* The flash benchmark writes to the emulated update bank, which takes the
+ * time of the flash of democonfigFLASH_EMULATOR_PROFILE: 1 for the STM32L475,
+ * 2 for the STM32H745, 3 for the SPI flash of the ESP32, 0 for no latency. */
+#define democonfigFLASH_EMULATOR_PROFILE    ( 1 )
+#define democonfigFLASH_BENCH_TIME_US()     ullGetMonotonicTimeUs()
+#define democonfigFLASH_BENCH_DONE()        exit( 0 )
+
+/* The soak times the connects with the host clock too, and exits with the
+ * result of the run, so a script can loop it. */
+#define democonfigSOAK_TIME_MS()           ( ( uint32_t ) ( ullGetMonotonicTimeUs() / 1000U ) )
+#define democonfigSOAK_DONE( lStatus )    exit( lStatus )
+
+/* Uncomment to benchmark handshakes and throughput against a local TLS echo
+ * server, whose certificate is signed by democonfigBENCH_TLS_ROOT_CA_PEM. */
+/* #define democonfigBENCH_TLS_HOSTNAME       "192.168.1.10" */
+/* #define democonfigBENCH_TLS_ROOT_CA_PEM    "-----BEGIN CERTIFICATE-----\n...\n-----END CERTIFICATE-----\n" */
+
 #endif /* DEMO_CONFIG_H */
@@ -1,15 +1,259 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/* The update bank is emulated on a file mapped into memory, which keeps what
+ * was written across runs, as flash would. It is written as a NOR part is:
+ * blocks are programmed in whole write units at aligned offsets, only over
+ * erased bytes, and the sectors are erased as the writes first reach them.
+ * Each program and erase takes the time it takes on the part of
+ * democonfigFLASH_EMULATOR_PROFILE, so an ADU download runs through the same
+ * write and verify path, at about the same pace, as on the boards. */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
 #include "azure_iot_flash_platform.h"
+#include "azure_iot_flash_platform_port.h"
+
+/* Logging */
+#include "azure_iot.h"
+#include "azure/core/az_base64.h"
+#include "mbedtls/md.h"
+
+/* Demo Specific configs. */
+#include "demo_config.h"
+
+#define azureiotflashEMULATOR_PROFILE_NONE     0 /* No latency, byte writes. */
+#define azureiotflashEMULATOR_PROFILE_L475     1 /* STM32L475 internal flash. */
+#define azureiotflashEMULATOR_PROFILE_H745     2 /* STM32H745 internal flash. */
+#define azureiotflashEMULATOR_PROFILE_ESP32    3 /* SPI NOR flash of the ESP32 modules. */
+
+/* Part whose erase sector, write unit and timings are emulated. */
+#ifndef democonfigFLASH_EMULATOR_PROFILE
+    #define democonfigFLASH_EMULATOR_PROFILE    azureiotflashEMULATOR_PROFILE_L475
+#endif
+
+/* File that holds the update bank. */
+#ifndef democonfigFLASH_EMULATOR_FILE
+    #define democonfigFLASH_EMULATOR_FILE    "adu_flash.bin"
+#endif
+
+/* Size of the update bank, a multiple of the sector size. */
+#ifndef democonfigFLASH_EMULATOR_BANK_SIZE
+    #define democonfigFLASH_EMULATOR_BANK_SIZE    ( 8 * 1024 * 1024 )
+#endif
+
+/* Typical figures of the datasheets: the time to program a write unit, and
+ * to erase a sector. Each can be set on its own to model another part. */
+#if ( democonfigFLASH_EMULATOR_PROFILE == azureiotflashEMULATOR_PROFILE_L475 )
+    #define azureiotflashPROFILE_SECTOR_SIZE    ( 2 * 1024 )   /* Page. */
+    #define azureiotflashPROFILE_WRITE_SIZE     8              /* Double word. */
+    #define azureiotflashPROFILE_PROGRAM_NS     81690
+    #define azureiotflashPROFILE_ERASE_US       22020
+#elif ( democonfigFLASH_EMULATOR_PROFILE == azureiotflashEMULATOR_PROFILE_H745 )
+    #define azureiotflashPROFILE_SECTOR_SIZE    ( 128 * 1024 ) /* Sector. */
+    #define azureiotflashPROFILE_WRITE_SIZE     32             /* Flash word. */
+    #define azureiotflashPROFILE_PROGRAM_NS     16000
+    #define azureiotflashPROFILE_ERASE_US       1000000
+#elif ( democonfigFLASH_EMULATOR_PROFILE == azureiotflashEMULATOR_PROFILE_ESP32 )
+    #define azureiotflashPROFILE_SECTOR_SIZE    ( 4 * 1024 )   /* Sector. */
+    #define azureiotflashPROFILE_WRITE_SIZE     4              /* Word, 0.7 ms for a 256 byte page. */
+    #define azureiotflashPROFILE_PROGRAM_NS     10940
+    #define azureiotflashPROFILE_ERASE_US       45000
+#else
+    #define azureiotflashPROFILE_SECTOR_SIZE    ( 4 * 1024 )
+    #define azureiotflashPROFILE_WRITE_SIZE     1
+    #define azureiotflashPROFILE_PROGRAM_NS     0
+    #define azureiotflashPROFILE_ERASE_US       0
+#endif /* democonfigFLASH_EMULATOR_PROFILE */
+
+#ifndef democonfigFLASH_EMULATOR_SECTOR_SIZE
+    #define democonfigFLASH_EMULATOR_SECTOR_SIZE    azureiotflashPROFILE_SECTOR_SIZE
+#endif
+
+#ifndef democonfigFLASH_EMULATOR_WRITE_SIZE
+    #define democonfigFLASH_EMULATOR_WRITE_SIZE    azureiotflashPROFILE_WRITE_SIZE
+#endif
+
+#ifndef democonfigFLASH_EMULATOR_PROGRAM_NS
+    #define democonfigFLASH_EMULATOR_PROGRAM_NS    azureiotflashPROFILE_PROGRAM_NS
+#endif
+
+#ifndef democonfigFLASH_EMULATOR_ERASE_US
+    #define democonfigFLASH_EMULATOR_ERASE_US    azureiotflashPROFILE_ERASE_US
+#endif
+
+#if ( ( democonfigFLASH_EMULATOR_BANK_SIZE % democonfigFLASH_EMULATOR_SECTOR_SIZE ) != 0 ) || \
+    ( ( democonfigFLASH_EMULATOR_SECTOR_SIZE % democonfigFLASH_EMULATOR_WRITE_SIZE ) != 0 )
+    #error "The bank must be whole sectors, and the sectors whole write units."
+#endif
+
+#define azureiotflashSHA_256_SIZE    32
+#define azureiotflashERASED          0xFF
+
+static uint8_t * pucBank = NULL;
+
+/* Everything below it was erased since AzureIoTPlatform_Init(). */
+static uint32_t ulErasedEnd;
+
+/* For the throughput logged once the image is verified. */
+static uint64_t ullInitNs;
+static uint64_t ullFlashBusyNs;
+static uint64_t ullBytesWritten;
+
+static uint8_t ucDecodedManifestHash[ azureiotflashSHA_256_SIZE ];
+static uint8_t ucCalculatedHash[ azureiotflashSHA_256_SIZE ];
+
+static uint64_t prvNowNs( void )
+{
+    struct timespec xNow;
+
+    clock_gettime( CLOCK_MONOTONIC, &xNow );
+
+    return ( uint64_t ) xNow.tv_sec * 1000000000ULL + ( uint64_t ) xNow.tv_nsec;
+}
+
+/* The flash stalls the writer for as long as the part would, so the
+ * download is slowed as on the board. */
+static void prvFlashBusy( uint64_t ullNs )
+{
+    struct timespec xDelay;
+
+    ullFlashBusyNs += ullNs;
+
+    xDelay.tv_sec = ( time_t ) ( ullNs / 1000000000ULL );
+    xDelay.tv_nsec = ( long ) ( ullNs % 1000000000ULL );
+
+    while( ( ( xDelay.tv_sec != 0 ) || ( xDelay.tv_nsec != 0 ) ) &&
+           ( nanosleep( &xDelay, &xDelay ) != 0 ) && ( errno == EINTR ) )
+    {
+    }
+}
+
+static AzureIoTResult_t prvMapBank( void )
+{
+    int lFile;
+
+    if( pucBank != NULL )
+    {
+        return eAzureIoTSuccess;
+    }
+
+    lFile = open( democonfigFLASH_EMULATOR_FILE, O_RDWR | O_CREAT, 0644 );
+
+    if( lFile < 0 )
+    {
+        AZLogError( ( "Unable to open %s: errno %d\r\n", democonfigFLASH_EMULATOR_FILE, errno ) );
+        return eAzureIoTErrorFailed;
+    }
+
+    /* A new file reads as zeros, so it is erased before it is written, as a bank holding an image is. */
+    if( ftruncate( lFile, democonfigFLASH_EMULATOR_BANK_SIZE ) != 0 )
+    {
+        AZLogError( ( "Unable to size %s: errno %d\r\n", democonfigFLASH_EMULATOR_FILE, errno ) );
+        close( lFile );
+        return eAzureIoTErrorFailed;
+    }
+
+    pucBank = mmap( NULL, democonfigFLASH_EMULATOR_BANK_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, lFile, 0 );
+    close( lFile );
+
+    if( pucBank == MAP_FAILED )
+    {
+        AZLogError( ( "Unable to map %s: errno %d\r\n", democonfigFLASH_EMULATOR_FILE, errno ) );
+        pucBank = NULL;
+        return eAzureIoTErrorFailed;
+    }
+
+    AZLogInfo( ( "Emulating a %u byte update bank in %s: %u byte sectors, %u byte writes\r\n",
+                 ( unsigned int ) democonfigFLASH_EMULATOR_BANK_SIZE, democonfigFLASH_EMULATOR_FILE,
+                 ( unsigned int ) democonfigFLASH_EMULATOR_SECTOR_SIZE,
+                 ( unsigned int ) democonfigFLASH_EMULATOR_WRITE_SIZE ) );
+
+    return eAzureIoTSuccess;
+}
+
+/* Erases the sectors from ulErasedEnd up to the one holding ulEnd - 1. */
+static void prvEraseTo( uint32_t ulEnd )
+{
+    while( ulErasedEnd < ulEnd )
+    {
+        memset( pucBank + ulErasedEnd, azureiotflashERASED, democonfigFLASH_EMULATOR_SECTOR_SIZE );
+        prvFlashBusy( ( uint64_t ) democonfigFLASH_EMULATOR_ERASE_US * 1000ULL );
+        ulErasedEnd += democonfigFLASH_EMULATOR_SECTOR_SIZE;
+    }
+}
+
+static AzureIoTResult_t prvBase64Decode( uint8_t * base64Encoded,
+                                         size_t ulBase64EncodedLength,
+                                         uint8_t * pucOutputBuffer,
+                                         size_t bufferLen,
+                                         size_t * outputSize )
+{
+    az_result xCoreResult;
+
+    az_span encodedSpan = az_span_create( base64Encoded, ulBase64EncodedLength );
+
+    az_span outputSpan = az_span_create( pucOutputBuffer, bufferLen );
+
+    if( az_result_failed( xCoreResult = az_base64_decode( outputSpan, encodedSpan, ( int32_t * ) outputSize ) ) )
+    {
+        AZLogError( ( "az_base64_decode failed: core error=0x%08x", xCoreResult ) );
+        return eAzureIoTErrorFailed;
+    }
+
+    return eAzureIoTSuccess;
+}
 
 AzureIoTResult_t AzureIoTPlatform_Init( AzureADUImage_t * const pxAduImage )
 {
-    ( void ) pxAduImage;
+    if( prvMapBank() != eAzureIoTSuccess )
+    {
+        return eAzureIoTErrorFailed;
+    }
+
+    pxAduImage->ulCurrentOffset = 0;
+
+    /* What the last update left in the bank stays until the writes erase it. */
+    ulErasedEnd = 0;
+    ullFlashBusyNs = 0;
+    ullBytesWritten = 0;
+    ullInitNs = prvNowNs();
 
     return eAzureIoTSuccess;
 }
 
 int64_t AzureIoTPlatform_GetSingleFlashBootBankSize()
 {
-    return INT64_MAX;
+    return democonfigFLASH_EMULATOR_BANK_SIZE;
+}
+
+int64_t AzureIoTPlatform_GetFileRegionSize( uint32_t ulFileIndex,
+                                            const uint8_t * pucFileName,
+                                            uint32_t ulFileNameLength )
+{
+    ( void ) ulFileIndex;
+    ( void ) pucFileName;
+    ( void ) ulFileNameLength;
+
+    return democonfigFLASH_EMULATOR_BANK_SIZE;
+}
+
+AzureIoTResult_t AzureIoTPlatform_InitFileRegion( AzureADUImage_t * const pxAduImage,
+                                                  uint32_t ulFileIndex,
+                                                  const uint8_t * pucFileName,
+                                                  uint32_t ulFileNameLength )
+{
+    ( void ) ulFileIndex;
+    ( void ) pucFileName;
+    ( void ) ulFileNameLength;
+
+    return AzureIoTPlatform_Init( pxAduImage );
 }
 
 AzureIoTResult_t AzureIoTPlatform_WriteBlock( AzureADUImage_t * const pxFileContext,
@@ -17,29 +261,119 @@ AzureIoTResult_t AzureIoTPlatform_WriteBlock( AzureADUImage_t * const pxFileCont
                                               uint8_t * const pData,
                                               uint32_t ulBlockSize )
 {
+    uint32_t ulEnd = ulOffset + ulBlockSize;
+    uint32_t ulProgrammedEnd;
+    uint32_t ulIndex;
+
     ( void ) pxFileContext;
-    ( void ) ulOffset;
-    ( void ) pData;
-    ( void ) ulBlockSize;
+
+    if( pucBank == NULL )
+    {
+        AZLogError( ( "Update bank written before AzureIoTPlatform_Init()\r\n" ) );
+        return eAzureIoTErrorFailed;
+    }
+
+    /* A block ending inside a write unit has it padded with erased bytes,
+     * so only the last block of the image can. */
+    if( ( ulOffset % democonfigFLASH_EMULATOR_WRITE_SIZE ) != 0 )
+    {
+        AZLogError( ( "Block at %u of %u bytes is not aligned to the %u byte writes\r\n",
+                      ( unsigned int ) ulOffset, ( unsigned int ) ulBlockSize,
+                      ( unsigned int ) democonfigFLASH_EMULATOR_WRITE_SIZE ) );
+        return eAzureIoTErrorFailed;
+    }
+
+    ulProgrammedEnd = ( ulEnd + democonfigFLASH_EMULATOR_WRITE_SIZE - 1 ) /
+                      democonfigFLASH_EMULATOR_WRITE_SIZE * democonfigFLASH_EMULATOR_WRITE_SIZE;
+
+    if( ( ulEnd < ulOffset ) || ( ulProgrammedEnd > democonfigFLASH_EMULATOR_BANK_SIZE ) )
+    {
+        AZLogError( ( "Block at %u of %u bytes is past the update bank\r\n",
+                      ( unsigned int ) ulOffset, ( unsigned int ) ulBlockSize ) );
+        return eAzureIoTErrorFailed;
+    }
+
+    prvEraseTo( ulProgrammedEnd );
+
+    for( ulIndex = ulOffset; ulIndex < ulProgrammedEnd; ulIndex++ )
+    {
+        if( pucBank[ ulIndex ] != azureiotflashERASED )
+        {
+            AZLogError( ( "Programming over bytes not erased at %u\r\n", ( unsigned int ) ulIndex ) );
+            return eAzureIoTErrorFailed;
+        }
+    }
+
+    memcpy( pucBank + ulOffset, pData, ulBlockSize );
+    prvFlashBusy( ( uint64_t ) ( ( ulProgrammedEnd - ulOffset ) / democonfigFLASH_EMULATOR_WRITE_SIZE ) *
+                  democonfigFLASH_EMULATOR_PROGRAM_NS );
+    ullBytesWritten += ulBlockSize;
 
     return eAzureIoTSuccess;
 }
 
+static AzureIoTResult_t prvCompareHash( void )
+{
+    if( memcmp( ucDecodedManifestHash, ucCalculatedHash, azureiotflashSHA_256_SIZE ) == 0 )
+    {
+        AZLogInfo( ( "SHAs match\r\n" ) );
+        return eAzureIoTSuccess;
+    }
+
+    AZLogError( ( "SHAs do not match\r\n" ) );
+
+    return eAzureIoTErrorFailed;
+}
+
 AzureIoTResult_t AzureIoTPlatform_VerifyImage( AzureADUImage_t * const pxAduImage,
                                                uint8_t * pucSHA256Hash,
                                                uint32_t ulSHA256HashLength )
 {
-    ( void ) pxAduImage;
-    ( void ) pucSHA256Hash;
-    ( void ) ulSHA256HashLength;
+    mbedtls_md_context_t xContext;
+    size_t xOutputSize;
+    uint64_t ullElapsedNs = prvNowNs() - ullInitNs;
 
-    return eAzureIoTSuccess;
+    if( ( pucBank == NULL ) || ( pxAduImage->ulImageFileSize < 0 ) ||
+        ( pxAduImage->ulImageFileSize > democonfigFLASH_EMULATOR_BANK_SIZE ) )
+    {
+        return eAzureIoTErrorFailed;
+    }
+
+    /* From AzureIoTPlatform_Init(), so it counts the download too. */
+    AZLogInfo( ( "Wrote %u bytes in %u ms, %u.%03u MB/s, the flash busy for %u ms\r\n",
+                 ( unsigned int ) ullBytesWritten, ( unsigned int ) ( ullElapsedNs / 1000000ULL ),
+                 ( unsigned int ) ( ullElapsedNs == 0 ? 0 : ullBytesWritten * 1000ULL / ullElapsedNs ),
+                 ( unsigned int ) ( ullElapsedNs == 0 ? 0 : ullBytesWritten * 1000000ULL / ullElapsedNs % 1000ULL ),
+                 ( unsigned int ) ( ullFlashBusyNs / 1000000ULL ) ) );
+
+    if( prvBase64Decode( pucSHA256Hash, ulSHA256HashLength, ucDecodedManifestHash,
+                         azureiotflashSHA_256_SIZE, &xOutputSize ) != eAzureIoTSuccess )
+    {
+        AZLogError( ( "Unable to decode base64 SHA256\r\n" ) );
+        return eAzureIoTErrorFailed;
+    }
+
+    /* Read back, as a board does, so what the writes left is what is checked. */
+    mbedtls_md_init( &xContext );
+    mbedtls_md_setup( &xContext, mbedtls_md_info_from_type( MBEDTLS_MD_SHA256 ), 0 );
+    mbedtls_md_starts( &xContext );
+    mbedtls_md_update( &xContext, pucBank, ( size_t ) pxAduImage->ulImageFileSize );
+    mbedtls_md_finish( &xContext, ucCalculatedHash );
+    mbedtls_md_free( &xContext );
+
+    return prvCompareHash();
 }
 
 AzureIoTResult_t AzureIoTPlatform_EnableImage( AzureADUImage_t * const pxAduImage )
 {
     ( void ) pxAduImage;
 
+    if( ( pucBank == NULL ) || ( msync( pucBank, democonfigFLASH_EMULATOR_BANK_SIZE, MS_SYNC ) != 0 ) )
+    {
+        AZLogError( ( "Unable to write the update bank back to %s\r\n", democonfigFLASH_EMULATOR_FILE ) );
+        return eAzureIoTErrorFailed;
+    }
+
     return eAzureIoTSuccess;
 }
 
@@ -47,5 +381,8 @@ AzureIoTResult_t AzureIoTPlatform_ResetDevice( AzureADUImage_t * const pxAduImag
 {
     ( void ) pxAduImage;
 
+    /* The simulator keeps running the image it was built with. */
+    AZLogInfo( ( "Image in %s enabled, not rebooting into it\r\n", democonfigFLASH_EMULATOR_FILE ) );
+
     return eAzureIoTSuccess;
 }
@@ -4,13 +4,18 @@
 /**
  * @file azure_iot_flash_platform_port.h
  *
- * @brief Port file for the linux flash abstraction.
+ * @brief Port file for the linux flash abstraction, which emulates the update
+ * bank of a board in a file, democonfigFLASH_EMULATOR_FILE.
  *
  */
 
 #ifndef AZURE_IOT_FLASH_PLATFORM_PORT_H
 #define AZURE_IOT_FLASH_PLATFORM_PORT_H
 
+#include <stdint.h>
+
+#include "azure_iot_result.h"
+
 typedef struct AzureADUImageContext
 {
     uint8_t * pucBufferToWrite;   /**< The buffer containing the bytes to write to the flash. */
@@ -21,4 +26,34 @@ typedef struct AzureADUImageContext
 
 typedef AzureADUImageContext_t AzureADUImage_t;
 
+/**
+ * @brief Size of the flash region a file of a multi-file update is downloaded
+ *        to, or -1 if the file has none.
+ *
+ * @param[in] ulFileIndex Index of the file in the update manifest, 0 for the image.
+ * @param[in] pucFileName Name of the file in the update manifest.
+ * @param[in] ulFileNameLength The length of \p pucFileName.
+ */
+int64_t AzureIoTPlatform_GetFileRegionSize( uint32_t ulFileIndex,
+                                            const uint8_t * pucFileName,
+                                            uint32_t ulFileNameLength );
+
+/**
+ * @brief Prepare the flash region of a file of a multi-file update, which the
+ *        blocks of the file are then written to.
+ *
+ * Used instead of AzureIoTPlatform_Init() when democonfigADU_MAX_FILES is
+ * above 1. The emulated bank holds one file, so each file is written over
+ * the one before it.
+ *
+ * @param[in] pxAduImage The image context.
+ * @param[in] ulFileIndex Index of the file in the update manifest, 0 for the image.
+ * @param[in] pucFileName Name of the file in the update manifest.
+ * @param[in] ulFileNameLength The length of \p pucFileName.
+ */
+AzureIoTResult_t AzureIoTPlatform_InitFileRegion( AzureADUImage_t * const pxAduImage,
+                                                  uint32_t ulFileIndex,
+                                                  const uint8_t * pucFileName,
+                                                  uint32_t ulFileNameLength );
+
 #endif /* AZURE_IOT_FLASH_PLATFORM_PORT_H */
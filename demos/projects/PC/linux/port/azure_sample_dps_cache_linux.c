@@ -0,0 +1,52 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+#include <stdio.h>
+
+#include "demo_config.h"
+
+#include "azure_sample_dps_cache.h"
+
+/* The record is kept in a file in the working directory. */
+#ifndef democonfigDPS_CACHE_FILE
+    #define democonfigDPS_CACHE_FILE    "dps_cache.bin"
+#endif
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t DPSCache_PlatformRead( DPSCacheRecord_t * pxRecord )
+{
+    FILE * pxFile = fopen( democonfigDPS_CACHE_FILE, "rb" );
+    size_t xRead;
+
+    if( pxFile == NULL )
+    {
+        return eAzureIoTErrorFailed;
+    }
+
+    xRead = fread( pxRecord, sizeof( *pxRecord ), 1, pxFile );
+    ( void ) fclose( pxFile );
+
+    return ( xRead == 1 ) ? eAzureIoTSuccess : eAzureIoTErrorFailed;
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t DPSCache_PlatformWrite( const DPSCacheRecord_t * pxRecord )
+{
+    FILE * pxFile = fopen( democonfigDPS_CACHE_FILE, "wb" );
+    size_t xWritten;
+
+    if( pxFile == NULL )
+    {
+        return eAzureIoTErrorFailed;
+    }
+
+    xWritten = fwrite( pxRecord, sizeof( *pxRecord ), 1, pxFile );
+
+    if( fclose( pxFile ) != 0 )
+    {
+        xWritten = 0;
+    }
+
+    return ( xWritten == 1 ) ? eAzureIoTSuccess : eAzureIoTErrorFailed;
+}
+/*-----------------------------------------------------------*/
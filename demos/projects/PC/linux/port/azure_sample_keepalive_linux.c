@@ -0,0 +1,94 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "demo_config.h"
+
+#include "azure_sample_keepalive.h"
+
+/* The record is kept in a file in the working directory. */
+#ifndef democonfigKEEPALIVE_FILE
+    #define democonfigKEEPALIVE_FILE    "keepalive.bin"
+#endif
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t KeepAlive_PlatformNetworkID( uint8_t * pucNetworkID,
+                                              uint32_t * pulNetworkIDLength )
+{
+    FILE * pxFile = fopen( "/proc/net/route", "r" );
+    char cLine[ 256 ];
+    char cInterface[ 32 ];
+    unsigned long ulDestination;
+    unsigned long ulGateway;
+    int lLength = -1;
+
+    if( pxFile == NULL )
+    {
+        return eAzureIoTErrorFailed;
+    }
+
+    /* The network of the host is told apart by the interface and gateway of
+     * its default route. */
+    while( fgets( cLine, sizeof( cLine ), pxFile ) != NULL )
+    {
+        if( ( sscanf( cLine, "%31s %lx %lx", cInterface, &ulDestination, &ulGateway ) == 3 ) &&
+            ( ulDestination == 0 ) )
+        {
+            lLength = snprintf( ( char * ) pucNetworkID, *pulNetworkIDLength, "%s/%08lx",
+                                cInterface, ulGateway );
+            break;
+        }
+    }
+
+    ( void ) fclose( pxFile );
+
+    if( ( lLength < 0 ) || ( ( uint32_t ) lLength >= *pulNetworkIDLength ) )
+    {
+        return eAzureIoTErrorFailed;
+    }
+
+    *pulNetworkIDLength = ( uint32_t ) lLength;
+
+    return eAzureIoTSuccess;
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t KeepAlive_PlatformRead( KeepAliveRecord_t * pxRecord )
+{
+    FILE * pxFile = fopen( democonfigKEEPALIVE_FILE, "rb" );
+    size_t xRead;
+
+    if( pxFile == NULL )
+    {
+        return eAzureIoTErrorFailed;
+    }
+
+    xRead = fread( pxRecord, sizeof( *pxRecord ), 1, pxFile );
+    ( void ) fclose( pxFile );
+
+    return ( xRead == 1 ) ? eAzureIoTSuccess : eAzureIoTErrorFailed;
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t KeepAlive_PlatformWrite( const KeepAliveRecord_t * pxRecord )
+{
+    FILE * pxFile = fopen( democonfigKEEPALIVE_FILE, "wb" );
+    size_t xWritten;
+
+    if( pxFile == NULL )
+    {
+        return eAzureIoTErrorFailed;
+    }
+
+    xWritten = fwrite( pxRecord, sizeof( *pxRecord ), 1, pxFile );
+
+    if( fclose( pxFile ) != 0 )
+    {
+        xWritten = 0;
+    }
+
+    return ( xWritten == 1 ) ? eAzureIoTSuccess : eAzureIoTErrorFailed;
+}
+/*-----------------------------------------------------------*/
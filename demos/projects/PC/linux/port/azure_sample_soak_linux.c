@@ -0,0 +1,87 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+#include "demo_config.h"
+
+#include "azure_sample_soak.h"
+
+/* 1 when the samples use the sockets of the host, set by the
+ * SAMPLE_POSIX_SOCKETS CMake option. */
+#ifndef democonfigPOSIX_SOCKETS
+    #define democonfigPOSIX_SOCKETS    0
+#endif
+
+#if ( democonfigPOSIX_SOCKETS == 1 )
+    #include <dirent.h>
+    #include <fcntl.h>
+    #include <string.h>
+    #include <unistd.h>
+#else
+    /* Kernel includes. */
+    #include "FreeRTOS.h"
+    #include "task.h"
+
+    /* TCP/IP stack includes, with the lists of the bound sockets. */
+    #include "FreeRTOS_IP.h"
+    #include "FreeRTOS_Sockets.h"
+    #include "FreeRTOS_IP_Private.h"
+#endif
+/*-----------------------------------------------------------*/
+
+#if ( democonfigPOSIX_SOCKETS == 1 )
+
+/* The sockets of the host are the descriptors of the process that link to
+ * "socket:[inode]". */
+uint32_t Soak_PlatformOpenSockets( void )
+{
+    DIR * pxDirectory = opendir( "/proc/self/fd" );
+    struct dirent * pxEntry;
+    char cLink[ 16 ];
+    ssize_t lLength;
+    uint32_t ulSockets = 0;
+
+    if( pxDirectory == NULL )
+    {
+        return 0;
+    }
+
+    while( ( pxEntry = readdir( pxDirectory ) ) != NULL )
+    {
+        lLength = readlinkat( dirfd( pxDirectory ), pxEntry->d_name, cLink, sizeof( cLink ) );
+
+        if( ( lLength >= 7 ) && ( strncmp( cLink, "socket:", 7 ) == 0 ) )
+        {
+            ulSockets++;
+        }
+    }
+
+    ( void ) closedir( pxDirectory );
+
+    return ulSockets;
+}
+/*-----------------------------------------------------------*/
+
+#else /* democonfigPOSIX_SOCKETS == 1 */
+
+/* FreeRTOS+TCP keeps every bound socket in a list, TCP and UDP, so those
+ * a connection leaves before they are closed are counted too. The lists are
+ * only changed by the IP task, which is held off while they are read. */
+uint32_t Soak_PlatformOpenSockets( void )
+{
+    uint32_t ulSockets;
+
+    vTaskSuspendAll();
+    {
+        ulSockets = ( uint32_t ) listCURRENT_LIST_LENGTH( &xBoundUDPSocketsList );
+
+        #if ( ipconfigUSE_TCP == 1 )
+            ulSockets += ( uint32_t ) listCURRENT_LIST_LENGTH( &xBoundTCPSocketsList );
+        #endif
+    }
+    ( void ) xTaskResumeAll();
+
+    return ulSockets;
+}
+/*-----------------------------------------------------------*/
+
+#endif /* democonfigPOSIX_SOCKETS == 1 */
@@ -0,0 +1,132 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "demo_config.h"
+
+#include "azure_sample_telemetry_spool.h"
+
+/* The flash is a file in the working directory, erased to 0xFF. */
+#ifndef democonfigTELEMETRY_SPOOL_FILE
+    #define democonfigTELEMETRY_SPOOL_FILE            "telemetry_spool.bin"
+#endif
+
+#ifndef democonfigTELEMETRY_SPOOL_SECTOR_COUNT
+    #define democonfigTELEMETRY_SPOOL_SECTOR_COUNT    64U
+#endif
+
+#define telemetryspoolLINUX_SECTOR_SIZE     4096U
+
+/* Double words, as the internal flash of the STM32L4, so the alignment of
+ * the frames is exercised. */
+#define telemetryspoolLINUX_PROGRAM_SIZE    8U
+
+static FILE * pxSpoolFile = NULL;
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t TelemetrySpool_PlatformInit( uint32_t * pulSectorSize,
+                                              uint32_t * pulSectorCount,
+                                              uint32_t * pulProgramSize )
+{
+    uint8_t ucErased[ 256 ];
+    long lSize;
+
+    if( pxSpoolFile == NULL )
+    {
+        pxSpoolFile = fopen( democonfigTELEMETRY_SPOOL_FILE, "r+b" );
+
+        if( pxSpoolFile == NULL )
+        {
+            pxSpoolFile = fopen( democonfigTELEMETRY_SPOOL_FILE, "w+b" );
+        }
+
+        if( pxSpoolFile == NULL )
+        {
+            return eAzureIoTErrorFailed;
+        }
+    }
+
+    /* A new or short file is extended with erased flash. */
+    memset( ucErased, 0xFF, sizeof( ucErased ) );
+
+    if( ( fseek( pxSpoolFile, 0, SEEK_END ) != 0 ) || ( ( lSize = ftell( pxSpoolFile ) ) < 0 ) )
+    {
+        return eAzureIoTErrorFailed;
+    }
+
+    while( ( unsigned long ) lSize < telemetryspoolLINUX_SECTOR_SIZE * democonfigTELEMETRY_SPOOL_SECTOR_COUNT )
+    {
+        if( fwrite( ucErased, sizeof( ucErased ), 1, pxSpoolFile ) != 1 )
+        {
+            return eAzureIoTErrorFailed;
+        }
+
+        lSize += ( long ) sizeof( ucErased );
+    }
+
+    if( fflush( pxSpoolFile ) != 0 )
+    {
+        return eAzureIoTErrorFailed;
+    }
+
+    *pulSectorSize = telemetryspoolLINUX_SECTOR_SIZE;
+    *pulSectorCount = democonfigTELEMETRY_SPOOL_SECTOR_COUNT;
+    *pulProgramSize = telemetryspoolLINUX_PROGRAM_SIZE;
+
+    return eAzureIoTSuccess;
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t TelemetrySpool_PlatformRead( uint32_t ulOffset,
+                                              uint8_t * pucData,
+                                              uint32_t ulLength )
+{
+    if( ( pxSpoolFile == NULL ) ||
+        ( fseek( pxSpoolFile, ( long ) ulOffset, SEEK_SET ) != 0 ) ||
+        ( fread( pucData, 1, ulLength, pxSpoolFile ) != ulLength ) )
+    {
+        return eAzureIoTErrorFailed;
+    }
+
+    return eAzureIoTSuccess;
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t TelemetrySpool_PlatformWrite( uint32_t ulOffset,
+                                               const uint8_t * pucData,
+                                               uint32_t ulLength )
+{
+    /* Flushed every time, so a record is in the file when the process is killed. */
+    if( ( pxSpoolFile == NULL ) ||
+        ( fseek( pxSpoolFile, ( long ) ulOffset, SEEK_SET ) != 0 ) ||
+        ( fwrite( pucData, 1, ulLength, pxSpoolFile ) != ulLength ) ||
+        ( fflush( pxSpoolFile ) != 0 ) )
+    {
+        return eAzureIoTErrorFailed;
+    }
+
+    return eAzureIoTSuccess;
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t TelemetrySpool_PlatformErase( uint32_t ulSector )
+{
+    uint8_t ucErased[ 256 ];
+    uint32_t ulOffset;
+
+    memset( ucErased, 0xFF, sizeof( ucErased ) );
+
+    for( ulOffset = 0; ulOffset < telemetryspoolLINUX_SECTOR_SIZE; ulOffset += sizeof( ucErased ) )
+    {
+        if( TelemetrySpool_PlatformWrite( ulSector * telemetryspoolLINUX_SECTOR_SIZE + ulOffset,
+                                          ucErased, sizeof( ucErased ) ) != eAzureIoTSuccess )
+        {
+            return eAzureIoTErrorFailed;
+        }
+    }
+
+    return eAzureIoTSuccess;
+}
+/*-----------------------------------------------------------*/
@@ -4,6 +4,8 @@
 #ifndef DEMO_CONFIG_H
 #define DEMO_CONFIG_H
 
+#include <stdint.h>
+
 /* FreeRTOS config include. */
 #include "FreeRTOSConfig.h"
 
@@ -222,13 +224,41 @@ extern void vLoggingPrintf( const char * pcFormatString,
 #define democonfigDEMO_STACKSIZE         ( 2 * 1024U )
 
 /**
- * @brief Size of the network buffer for MQTT packets.
+ * @brief Size of the part of the hub client buffer the MQTT packets are
+ * received in, which must hold the largest one the hub sends, such as a
+ * property document or an ADU manifest.
  */
-#define democonfigNETWORK_BUFFER_SIZE    ( 5 * 1024U )
+#define democonfigNETWORK_RX_BUFFER_SIZE    ( 5 * 1024U )
+
+/**
+ * @brief Size of the part of the hub client buffer the middleware writes the
+ * topic, user name and password of the packets it sends in. The payloads are
+ * sent from the buffers of the samples, so this does not grow with them.
+ */
+#define democonfigNETWORK_TX_BUFFER_SIZE    ( azureiotconfigUSERNAME_MAX + azureiotconfigPASSWORD_MAX )
+
+/**
+ * @brief Size of the buffer given to the hub and provisioning clients, which
+ * use its first democonfigNETWORK_TX_BUFFER_SIZE bytes for what they send and
+ * receive in the rest.
+ */
+#define democonfigNETWORK_BUFFER_SIZE       ( democonfigNETWORK_TX_BUFFER_SIZE + democonfigNETWORK_RX_BUFFER_SIZE )
 
 /**
  * @brief IoTHub endpoint port.
  */
 #define democonfigIOTHUB_PORT            ( 8883 )
 
+/* Uncomment to connect to IoT Hub through an IoT Edge gateway on the site,
+ * whose server certificate is signed by democonfigGATEWAY_ROOT_CA_PEM. The
+ * provisioning service is still reached directly. */
+/* #define democonfigGATEWAY_HOSTNAME       "edgegateway.local" */
+/* #define democonfigGATEWAY_ROOT_CA_PEM    "-----BEGIN CERTIFICATE-----\n...\n-----END CERTIFICATE-----\n" */
+
+/* The benchmarks time with the host clock, as runs are shorter than a tick,
+ * and exit once they have printed their results. */
+extern uint64_t ullGetMonotonicTimeUs( void );
+#define democonfigBENCH_TIME_US()    ullGetMonotonicTimeUs()
+#define democonfigBENCH_DONE()       exit( 0 )
+
 #endif /* DEMO_CONFIG_H */
@@ -5,6 +5,7 @@
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <string.h>
 #include <time.h>
 #include <assert.h>
 
@@ -12,9 +13,17 @@
 #include <FreeRTOS.h>
 #include "task.h"
 
-/* TCP/IP stack includes. */
-#include "FreeRTOS_IP.h"
-#include "FreeRTOS_Sockets.h"
+/* 1 when the samples use the sockets of the host, set by the
+ * SAMPLE_WINSOCK_SOCKETS CMake option. */
+#ifndef democonfigWINSOCK_SOCKETS
+    #define democonfigWINSOCK_SOCKETS    0
+#endif
+
+#if ( democonfigWINSOCK_SOCKETS == 0 )
+    /* TCP/IP stack includes. */
+    #include "FreeRTOS_IP.h"
+    #include "FreeRTOS_Sockets.h"
+#endif
 
 #include "mbedtls/entropy.h"
 
@@ -24,14 +33,21 @@
 /* Demo Specific configs. */
 #include "demo_config.h"
 
+/* Startup timing. */
+#include "azure_sample_startup.h"
+
 #define mainHOST_NAME           "RTOSDemo"
 #define mainDEVICE_NICK_NAME    "windows_demo"
 
+/* Bytes of entropy each thread takes from the system RNG at a time. */
+#define mainENTROPY_POOL_SIZE   ( 256U )
+
 /*
  * Prototypes for the demos that can be started from this project.  Note the
  * MQTT demo is not actually started until the network is already, which is
  * indicated by vApplicationIPNetworkEventHook() executing - hence
  * vStartDemoTask() is called from inside vApplicationIPNetworkEventHook().
+ * With the sockets of the host, the network is up from the start.
  */
 extern void vStartDemoTask( void );
 
@@ -54,10 +70,12 @@ static void prvMiscInitialisation( void );
  * defined here will be used if ipconfigUSE_DHCP is 0, or if ipconfigUSE_DHCP is
  * 1 but a DHCP server could not be contacted.  See the online documentation for
  * more information. */
-static const uint8_t ucIPAddress[ 4 ] = { configIP_ADDR0, configIP_ADDR1, configIP_ADDR2, configIP_ADDR3 };
-static const uint8_t ucNetMask[ 4 ] = { configNET_MASK0, configNET_MASK1, configNET_MASK2, configNET_MASK3 };
-static const uint8_t ucGatewayAddress[ 4 ] = { configGATEWAY_ADDR0, configGATEWAY_ADDR1, configGATEWAY_ADDR2, configGATEWAY_ADDR3 };
-static const uint8_t ucDNSServerAddress[ 4 ] = { configDNS_SERVER_ADDR0, configDNS_SERVER_ADDR1, configDNS_SERVER_ADDR2, configDNS_SERVER_ADDR3 };
+#if ( democonfigWINSOCK_SOCKETS == 0 )
+    static const uint8_t ucIPAddress[ 4 ] = { configIP_ADDR0, configIP_ADDR1, configIP_ADDR2, configIP_ADDR3 };
+    static const uint8_t ucNetMask[ 4 ] = { configNET_MASK0, configNET_MASK1, configNET_MASK2, configNET_MASK3 };
+    static const uint8_t ucGatewayAddress[ 4 ] = { configGATEWAY_ADDR0, configGATEWAY_ADDR1, configGATEWAY_ADDR2, configGATEWAY_ADDR3 };
+    static const uint8_t ucDNSServerAddress[ 4 ] = { configDNS_SERVER_ADDR0, configDNS_SERVER_ADDR1, configDNS_SERVER_ADDR2, configDNS_SERVER_ADDR3 };
+#endif /* democonfigWINSOCK_SOCKETS == 0 */
 
 /* Set the following constant to pdTRUE to log using the method indicated by the
  * name of the constant, or pdFALSE to not log using the method indicated by the
@@ -73,10 +91,17 @@ const BaseType_t xLogToStdout = pdTRUE, xLogToFile = pdFALSE, xLogToUDP = pdFALS
  * to and from a real network connection on the host PC.  See the
  * configNETWORK_INTERFACE_TO_USE definition for information on how to configure
  * the real network connection to use. */
-const uint8_t ucMACAddress[ 6 ] = { configMAC_ADDR0, configMAC_ADDR1, configMAC_ADDR2, configMAC_ADDR3, configMAC_ADDR4, configMAC_ADDR5 };
+#if ( democonfigWINSOCK_SOCKETS == 0 )
+    const uint8_t ucMACAddress[ 6 ] = { configMAC_ADDR0, configMAC_ADDR1, configMAC_ADDR2, configMAC_ADDR3, configMAC_ADDR4, configMAC_ADDR5 };
+#endif
 
 /* Use by the pseudo random number generator. */
 static UBaseType_t ulNextRand;
+
+/* Each task of the simulator runs on its own thread, so a pool per thread
+ * needs no lock. Bytes are wiped once handed out. */
+static __declspec( thread ) unsigned char ucEntropyPool[ mainENTROPY_POOL_SIZE ];
+static __declspec( thread ) size_t xEntropyPoolLeft;
 /*-----------------------------------------------------------*/
 
 void vLoggingInit( BaseType_t xLogToStdout,
@@ -117,14 +142,22 @@ int main( void )
      * the random number generator. */
     prvMiscInitialisation();
 
-    /* Initialize the network interface.
-     *
-     ***NOTE*** Tasks that use the network are created in the network event hook
-     * when the network is connected and ready for use (see the implementation of
-     * vApplicationIPNetworkEventHook() below).  The address values passed in here
-     * are used if ipconfigUSE_DHCP is set to 0, or if ipconfigUSE_DHCP is set to 1
-     * but a DHCP server cannot be contacted. */
-    FreeRTOS_IPInit( ucIPAddress, ucNetMask, ucGatewayAddress, ucDNSServerAddress, ucMACAddress );
+    #if ( democonfigWINSOCK_SOCKETS == 1 )
+        /* The network of the host is up already. */
+        StartupProfile_Mark( eStartupPhaseNetworkUp );
+        LogInfo( ( "---------STARTING DEMO---------\r\n" ) );
+        vStartDemoTask();
+    #else
+
+        /* Initialize the network interface.
+         *
+         ***NOTE*** Tasks that use the network are created in the network event hook
+         * when the network is connected and ready for use (see the implementation of
+         * vApplicationIPNetworkEventHook() below).  The address values passed in here
+         * are used if ipconfigUSE_DHCP is set to 0, or if ipconfigUSE_DHCP is set to 1
+         * but a DHCP server cannot be contacted. */
+        FreeRTOS_IPInit( ucIPAddress, ucNetMask, ucGatewayAddress, ucDNSServerAddress, ucMACAddress );
+    #endif /* democonfigWINSOCK_SOCKETS == 1 */
 
     /* Start the RTOS scheduler. */
     vTaskStartScheduler();
@@ -142,44 +175,50 @@ int main( void )
 }
 /*-----------------------------------------------------------*/
 
-/* Called by FreeRTOS+TCP when the network connects or disconnects.  Disconnect
- * events are only received if implemented in the MAC driver. */
-void vApplicationIPNetworkEventHook( eIPCallbackEvent_t eNetworkEvent )
-{
-    uint32_t ulIPAddress, ulNetMask, ulGatewayAddress, ulDNSServerAddress;
-    char cBuffer[ 16 ];
-    static BaseType_t xTasksAlreadyCreated = pdFALSE;
+#if ( democonfigWINSOCK_SOCKETS == 0 )
 
-    /* If the network has just come up...*/
-    if( eNetworkEvent == eNetworkUp )
+    /* Called by FreeRTOS+TCP when the network connects or disconnects.  Disconnect
+     * events are only received if implemented in the MAC driver. */
+    void vApplicationIPNetworkEventHook( eIPCallbackEvent_t eNetworkEvent )
     {
-        /* Create the tasks that use the IP stack if they have not already been
-         * created. */
-        if( xTasksAlreadyCreated == pdFALSE )
+        uint32_t ulIPAddress, ulNetMask, ulGatewayAddress, ulDNSServerAddress;
+        char cBuffer[ 16 ];
+        static BaseType_t xTasksAlreadyCreated = pdFALSE;
+
+        /* If the network has just come up...*/
+        if( eNetworkEvent == eNetworkUp )
         {
-            /* Demos that use the network are created after the network is
-             * up. */
-            LogInfo( ( "---------STARTING DEMO---------\r\n" ) );
-            vStartDemoTask();
-            xTasksAlreadyCreated = pdTRUE;
+            StartupProfile_Mark( eStartupPhaseNetworkUp );
+
+            /* Create the tasks that use the IP stack if they have not already been
+             * created. */
+            if( xTasksAlreadyCreated == pdFALSE )
+            {
+                /* Demos that use the network are created after the network is
+                 * up. */
+                LogInfo( ( "---------STARTING DEMO---------\r\n" ) );
+                vStartDemoTask();
+                xTasksAlreadyCreated = pdTRUE;
+            }
+
+            /* Print out the network configuration, which may have come from a DHCP
+             * server. */
+            FreeRTOS_GetAddressConfiguration( &ulIPAddress, &ulNetMask, &ulGatewayAddress, &ulDNSServerAddress );
+            FreeRTOS_inet_ntoa( ulIPAddress, cBuffer );
+            LogInfo( ( "\r\n\r\nIP Address: %s\r\n", cBuffer ) );
+
+            FreeRTOS_inet_ntoa( ulNetMask, cBuffer );
+            LogInfo( ( "Subnet Mask: %s\r\n", cBuffer ) );
+
+            FreeRTOS_inet_ntoa( ulGatewayAddress, cBuffer );
+            LogInfo( ( "Gateway Address: %s\r\n", cBuffer ) );
+
+            FreeRTOS_inet_ntoa( ulDNSServerAddress, cBuffer );
+            LogInfo( ( "DNS Server Address: %s\r\n\r\n\r\n", cBuffer ) );
         }
-
-        /* Print out the network configuration, which may have come from a DHCP
-         * server. */
-        FreeRTOS_GetAddressConfiguration( &ulIPAddress, &ulNetMask, &ulGatewayAddress, &ulDNSServerAddress );
-        FreeRTOS_inet_ntoa( ulIPAddress, cBuffer );
-        LogInfo( ( "\r\n\r\nIP Address: %s\r\n", cBuffer ) );
-
-        FreeRTOS_inet_ntoa( ulNetMask, cBuffer );
-        LogInfo( ( "Subnet Mask: %s\r\n", cBuffer ) );
-
-        FreeRTOS_inet_ntoa( ulGatewayAddress, cBuffer );
-        LogInfo( ( "Gateway Address: %s\r\n", cBuffer ) );
-
-        FreeRTOS_inet_ntoa( ulDNSServerAddress, cBuffer );
-        LogInfo( ( "DNS Server Address: %s\r\n\r\n\r\n", cBuffer ) );
     }
-}
+
+#endif /* democonfigWINSOCK_SOCKETS == 0 */
 /*-----------------------------------------------------------*/
 
 void vAssertCalled( const char * pcFile,
@@ -217,9 +256,12 @@ static void prvSRand( UBaseType_t ulSeed )
 static void prvMiscInitialisation( void )
 {
     time_t xTimeNow;
-    uint32_t ulLoggingIPAddress;
+    uint32_t ulLoggingIPAddress = 0;
+
+    #if ( democonfigWINSOCK_SOCKETS == 0 )
+        ulLoggingIPAddress = FreeRTOS_inet_addr_quick( configUDP_LOGGING_ADDR0, configUDP_LOGGING_ADDR1, configUDP_LOGGING_ADDR2, configUDP_LOGGING_ADDR3 );
+    #endif
 
-    ulLoggingIPAddress = FreeRTOS_inet_addr_quick( configUDP_LOGGING_ADDR0, configUDP_LOGGING_ADDR1, configUDP_LOGGING_ADDR2, configUDP_LOGGING_ADDR3 );
     vLoggingInit( xLogToStdout, xLogToFile, xLogToUDP, ulLoggingIPAddress, configPRINT_PORT );
 
     /*
@@ -232,7 +274,7 @@ static void prvMiscInitialisation( void )
     time( &xTimeNow );
     LogDebug( ( "Seed for randomizer: %lu\n", xTimeNow ) );
     prvSRand( ( uint32_t ) xTimeNow );
-    LogDebug( ( "Random numbers: %08X %08X %08X %08X\n", ipconfigRAND32(), ipconfigRAND32(), ipconfigRAND32(), ipconfigRAND32() ) );
+    LogDebug( ( "Random numbers: %08X %08X %08X %08X\n", configRAND32(), configRAND32(), configRAND32(), configRAND32() ) );
 }
 /*-----------------------------------------------------------*/
 
@@ -372,6 +414,19 @@ uint64_t ullGetUnixTime( void )
 }
 /*-----------------------------------------------------------*/
 
+uint64_t ullGetMonotonicTimeUs( void )
+{
+    LARGE_INTEGER xFrequency;
+    LARGE_INTEGER xNow;
+
+    ( void ) QueryPerformanceFrequency( &xFrequency );
+    ( void ) QueryPerformanceCounter( &xNow );
+
+    return ( uint64_t ) ( xNow.QuadPart / xFrequency.QuadPart ) * 1000000ULL +
+           ( uint64_t ) ( xNow.QuadPart % xFrequency.QuadPart ) * 1000000ULL / ( uint64_t ) xFrequency.QuadPart;
+}
+/*-----------------------------------------------------------*/
+
 /**
  * @brief Function to generate a random number.
  *
@@ -390,6 +445,7 @@ int mbedtls_platform_entropy_poll( void * data,
 {
     int status = 0;
     NTSTATUS rngStatus = 0;
+    unsigned char * pucPoolData;
 
     configASSERT( output != NULL );
     configASSERT( olen != NULL );
@@ -397,23 +453,41 @@ int mbedtls_platform_entropy_poll( void * data,
     /* Context is not used by this function. */
     ( void ) data;
 
-    /* TLS requires a secure random number generator; use the RNG provided
-     * by Windows. This function MUST be re-implemented for other platforms. */
-    rngStatus =
-        BCryptGenRandom( NULL, output, len, BCRYPT_USE_SYSTEM_PREFERRED_RNG );
+    *olen = 0;
 
-    if( rngStatus == 0 )
+    /* TLS requires a secure random number generator; use the RNG provided
+     * by Windows. This function MUST be re-implemented for other platforms.
+     * Small polls are served from the pool of the thread, so the RNG is
+     * called once for several of them. */
+    if( len >= mainENTROPY_POOL_SIZE )
+    {
+        rngStatus =
+            BCryptGenRandom( NULL, output, ( ULONG ) len, BCRYPT_USE_SYSTEM_PREFERRED_RNG );
+    }
+    else if( xEntropyPoolLeft < len )
     {
-        /* All random bytes generated. */
-        *olen = len;
+        rngStatus =
+            BCryptGenRandom( NULL, ucEntropyPool, mainENTROPY_POOL_SIZE, BCRYPT_USE_SYSTEM_PREFERRED_RNG );
+        xEntropyPoolLeft = ( rngStatus == 0 ) ? mainENTROPY_POOL_SIZE : 0;
     }
-    else
+
+    if( rngStatus != 0 )
     {
         /* RNG failure. */
-        *olen = 0;
-        status = MBEDTLS_ERR_ENTROPY_SOURCE_FAILED;
+        return MBEDTLS_ERR_ENTROPY_SOURCE_FAILED;
     }
 
+    if( len < mainENTROPY_POOL_SIZE )
+    {
+        pucPoolData = ucEntropyPool + ( mainENTROPY_POOL_SIZE - xEntropyPoolLeft );
+        memcpy( output, pucPoolData, len );
+        memset( pucPoolData, 0, len );
+        xEntropyPoolLeft -= len;
+    }
+
+    /* All random bytes generated. */
+    *olen = len;
+
     return status;
 }
 /*-----------------------------------------------------------*/
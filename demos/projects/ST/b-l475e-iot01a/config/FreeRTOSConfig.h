@@ -24,10 +24,20 @@
 
 #define configSUPPORT_STATIC_ALLOCATION              1
 
+/* Defined as 0 by the BOARD_STATIC_ALLOCATION CMake option. */
+#ifndef configSUPPORT_DYNAMIC_ALLOCATION
+    #define configSUPPORT_DYNAMIC_ALLOCATION    1
+#endif
+
 #define configUSE_PREEMPTION                         1
 #define configUSE_IDLE_HOOK                          1
 #define configUSE_TICK_HOOK                          0
-#define configUSE_TICKLESS_IDLE                      0
+
+/* Defined as 1 by the BOARD_LOW_POWER CMake option. */
+#ifndef configUSE_TICKLESS_IDLE
+    #define configUSE_TICKLESS_IDLE    0
+#endif
+
 #define configUSE_DAEMON_TASK_STARTUP_HOOK           1
 #define configCPU_CLOCK_HZ                           ( SystemCoreClock )
 #define configTICK_RATE_HZ                           ( ( TickType_t ) 1000 )
@@ -45,7 +55,12 @@
 #define configUSE_MALLOC_FAILED_HOOK                 1
 #define configUSE_APPLICATION_TASK_TAG               1
 #define configUSE_COUNTING_SEMAPHORES                1
-#define configGENERATE_RUN_TIME_STATS                0
+
+/* Defined as 1 by the BOARD_RUNTIME_STATS CMake option. */
+#ifndef configGENERATE_RUN_TIME_STATS
+    #define configGENERATE_RUN_TIME_STATS    0
+#endif
+
 #define configOVERRIDE_DEFAULT_TICK_CONFIGURATION    1
 #define configRECORD_STACK_HIGH_ADDRESS              1
 #define configUSE_STATS_FORMATTING_FUNCTIONS         1
@@ -70,6 +85,8 @@
 #define INCLUDE_vTaskDelayUntil                      1
 #define INCLUDE_vTaskDelay                           1
 #define INCLUDE_uxTaskGetStackHighWaterMark          1
+#define INCLUDE_xTaskGetIdleTaskHandle               1
+#define INCLUDE_xTimerGetTimerDaemonTaskHandle       1
 #define INCLUDE_xTaskGetSchedulerState               1
 
 /* Cortex-M specific definitions. */
@@ -154,4 +171,37 @@ extern int iMainRand32( void );
  *            to prevent overwriting SysTick_Handler defined within STM32Cube HAL. */
 /* #define xPortSysTickHandler SysTick_Handler */
 
+/* Low-power profile. With tickless idle the port stops SysTick while every
+ * task is blocked and sleeps the core until the next timeout or interrupt.
+ * TIM6 drives the HAL time base, so it is stopped around the sleep as well,
+ * or it would wake the core every millisecond. */
+#if ( configUSE_TICKLESS_IDLE == 1 )
+    extern void vMainPreSleepProcessing( uint32_t ulExpectedIdleTime );
+    extern void vMainPostSleepProcessing( uint32_t ulExpectedIdleTime );
+    #define configPRE_SLEEP_PROCESSING( x )     vMainPreSleepProcessing( x )
+    #define configPOST_SLEEP_PROCESSING( x )    vMainPostSleepProcessing( x )
+#endif
+
+/* Run-time stats. TIM2, a 32-bit timer apart from the TIM6 time base, counts
+ * at 100 kHz the time each task runs, for the diagnostics of the samples. */
+#if ( configGENERATE_RUN_TIME_STATS == 1 )
+    extern void vMainConfigureTimerForRunTimeStats( void );
+    extern uint32_t ulMainGetRunTimeCounterValue( void );
+    #define portCONFIGURE_TIMER_FOR_RUN_TIME_STATS()    vMainConfigureTimerForRunTimeStats()
+    #define portGET_RUN_TIME_COUNTER_VALUE()            ulMainGetRunTimeCounterValue()
+#endif
+
+/* Heap trace of the samples, set by the SAMPLE_HEAP_TRACE CMake option. The
+ * hooks are expanded in pvPortMalloc(), so the return address is in the
+ * function that called it. */
+#if ( democonfigHEAP_TRACE == 1 )
+    extern void HeapTrace_Malloc( void * pvAddress,
+                                  size_t xSize,
+                                  const void * pvCaller );
+    extern void HeapTrace_Free( void * pvAddress,
+                                size_t xSize );
+    #define traceMALLOC( pvAddress, uiSize )    HeapTrace_Malloc( ( pvAddress ), ( uiSize ), __builtin_return_address( 0 ) )
+    #define traceFREE( pvAddress, uiSize )      HeapTrace_Free( ( pvAddress ), ( uiSize ) )
+#endif
+
 #endif /* FREERTOS_CONFIG_H */
@@ -34,27 +34,37 @@
 extern void vLoggingPrintf( const char * pcFormatString,
                             ... );
 
+/* Writes the logs as tokens, see azure_sample_token_log.h. */
+#if ( democonfigTOKEN_LOG == 1 )
+    #include "azure_sample_token_log.h"
+#endif
+
 /* Map the SdkLog macro to the logging function to enable logging
  * on Windows simulator. */
 #ifndef SdkLog
     #define SdkLog( message )    vLoggingPrintf message
 #endif
 
+/* A log and its line end. */
+#ifndef SdkLogLine
+    #define SdkLogLine( message )    SdkLog( message ); SdkLog( ( "\r\n" ) )
+#endif
+
 /* Middleware logging */
 #if LIBRARY_LOG_LEVEL >= LOG_ERROR
-    #define AZLogError( message )    SdkLog( message ); SdkLog( ( "\r\n" ) )
+    #define AZLogError( message )    SdkLogLine( message )
 #endif
 
-#if LIBRARY_LOG_LEVEL >= LOG_INFO
-    #define AZLogWarn( message )    SdkLog( message ); SdkLog( ( "\r\n" ) )
+#if LIBRARY_LOG_LEVEL >= LOG_WARN
+    #define AZLogWarn( message )    SdkLogLine( message )
 #endif
 
-#if LIBRARY_LOG_LEVEL >= LOG_INF
-    #define AZLogInfo( message )    SdkLog( message ); SdkLog( ( "\r\n" ) )
+#if LIBRARY_LOG_LEVEL >= LOG_INFO
+    #define AZLogInfo( message )    SdkLogLine( message )
 #endif
 
 #if LIBRARY_LOG_LEVEL >= LOG_DEBUG
-    #define AZLogDebug( message )    SdkLog( message ); SdkLog( ( "\r\n" ) )
+    #define AZLogDebug( message )    SdkLogLine( message )
 #endif
 
 #include "logging_stack.h"
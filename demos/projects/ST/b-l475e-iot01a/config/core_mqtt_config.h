@@ -33,6 +33,11 @@
 extern void vLoggingPrintf( const char * pcFormatString,
                             ... );
 
+/* Writes the logs as tokens, see azure_sample_token_log.h. */
+#if ( democonfigTOKEN_LOG == 1 )
+    #include "azure_sample_token_log.h"
+#endif
+
 /* Map the SdkLog macro to the logging function to enable logging
  * on Windows simulator. */
 #ifndef SdkLog
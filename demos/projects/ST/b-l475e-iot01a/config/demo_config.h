@@ -43,6 +43,11 @@
 extern void vLoggingPrintf( const char * pcFormatString,
                             ... );
 
+/* Writes the logs as tokens, see azure_sample_token_log.h. */
+#if ( democonfigTOKEN_LOG == 1 )
+    #include "azure_sample_token_log.h"
+#endif
+
 /* Map the SdkLog macro to the logging function to enable logging */
 #ifndef SdkLog
     #define SdkLog( message )    vLoggingPrintf message
@@ -87,6 +92,14 @@ extern void vLoggingPrintf( const char * pcFormatString,
  */
     #define democonfigREGISTRATION_ID    "<YOUR REGISTRATION ID HERE>"
 
+/**
+ * @brief Keep the IoT Hub assignment across reboots, in a flash page ADU updates leave alone.
+ *
+ * @note To register with Device Provisioning on every boot undef this macro
+ *
+ */
+    #define democonfigUSE_DPS_CACHE
+
 #endif /* democonfigENABLE_DPS_SAMPLE */
 
 /**
@@ -222,15 +235,36 @@ extern void vLoggingPrintf( const char * pcFormatString,
 #define democonfigDEMO_STACKSIZE             ( 2 * 1024U )
 
 /**
- * @brief Size of the network buffer for MQTT packets.
+ * @brief Size of the part of the hub client buffer the MQTT packets are
+ * received in, which must hold the largest one the hub sends, such as a
+ * property document or an ADU manifest.
+ */
+#define democonfigNETWORK_RX_BUFFER_SIZE     ( 5 * 1024U )
+
+/**
+ * @brief Size of the part of the hub client buffer the middleware writes the
+ * topic, user name and password of the packets it sends in. The payloads are
+ * sent from the buffers of the samples, so this does not grow with them.
  */
-#define democonfigNETWORK_BUFFER_SIZE        ( 5 * 1024U )
+#define democonfigNETWORK_TX_BUFFER_SIZE     ( azureiotconfigUSERNAME_MAX + azureiotconfigPASSWORD_MAX )
+
+/**
+ * @brief Size of the buffer given to the hub and provisioning clients, which
+ * use its first democonfigNETWORK_TX_BUFFER_SIZE bytes for what they send and
+ * receive in the rest.
+ */
+#define democonfigNETWORK_BUFFER_SIZE        ( democonfigNETWORK_TX_BUFFER_SIZE + democonfigNETWORK_RX_BUFFER_SIZE )
 
 /**
  * @brief IoTHub endpoint port.
  */
 #define democonfigIOTHUB_PORT                ( 8883 )
 
+/**
+ * @brief Sync the time with SNTP, see azure_sample_time_sync.h.
+ */
+#define democonfigTIME_SYNC
+
 /**
  * @brief Wifi SSID
  *
@@ -256,6 +290,18 @@ extern void vLoggingPrintf( const char * pcFormatString,
 
 #define democonfigCHUNK_DOWNLOAD_SIZE        2048
 
+/* Keep the download progress in the update bank's journal page, so an
+ * interrupted download picks up where it stopped. */
+#define democonfigADU_RESUMABLE_DOWNLOAD     1
+
+/* Stage the verified image and keep the device online until idle, or until
+ * the swapAt time of the Device Update component, before swapping banks. */
+#define democonfigADU_SCHEDULED_SWAP         1
+
+/* Verify the update manifest in place rather than through the large JWS
+ * scratch buffer, leaving that RAM to TLS. */
+#define democonfigADU_STREAMING_JWS          1
+
 #define democonfigADU_DEVICE_MANUFACTURER    "STMicroelectronics"
 #define democonfigADU_DEVICE_MODEL           "STM32L475"
 #define democonfigADU_UPDATE_PROVIDER        "Contoso"
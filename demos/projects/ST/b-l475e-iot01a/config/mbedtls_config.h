@@ -30,6 +30,10 @@
 #define MBEDTLS_REMOVE_ARC4_CIPHERSUITES
 #define MBEDTLS_ECP_DP_SECP256R1_ENABLED
 #define MBEDTLS_ECP_NIST_OPTIM
+
+/* MBEDTLS_ECP_WINDOW_SIZE and MBEDTLS_ECP_FIXED_POINT_OPTIM stay at their
+ * defaults, the fastest for secp256r1: its generator uses the comb tables
+ * built into mbedTLS, and no larger window is used for a 256 bit curve. */
 #define MBEDTLS_KEY_EXCHANGE_ECDHE_RSA_ENABLED
 #define MBEDTLS_KEY_EXCHANGE_ECDHE_ECDSA_ENABLED
 
@@ -43,6 +47,26 @@
 #define MBEDTLS_SSL_PROTO_TLS1_2
 #define MBEDTLS_SSL_ALPN
 #define MBEDTLS_SSL_SERVER_NAME_INDICATION
+#define MBEDTLS_SSL_SESSION_TICKETS
+
+/* Record buffers shrunk to the negotiated fragment length after the handshake.
+ * The pooled TLS contexts keep theirs at full size, in their static slots, as
+ * the shrunk buffers would come from the heap. */
+#if !defined( transporttlsCONTEXT_POOL_SIZE ) || ( transporttlsCONTEXT_POOL_SIZE == 0 )
+    #define MBEDTLS_SSL_VARIABLE_BUFFER_LENGTH
+#endif
+
+/* Size of the incoming and outgoing record buffers. The incoming buffer must hold
+ * the largest record the server sends, so only shrink it below 16 KB when the
+ * server honors the maximum fragment length extension. The outgoing buffer must
+ * hold the largest handshake message sent, such as the client certificate.
+ * A telemetry-only device using symmetric key auth can run with 4096 in / 1024 out. */
+#ifndef MBEDTLS_SSL_IN_CONTENT_LEN
+    #define MBEDTLS_SSL_IN_CONTENT_LEN     16384
+#endif
+#ifndef MBEDTLS_SSL_OUT_CONTENT_LEN
+    #define MBEDTLS_SSL_OUT_CONTENT_LEN    16384
+#endif
 
 /* Check certificate key usage. */
 #define MBEDTLS_X509_CHECK_KEY_USAGE
@@ -83,13 +107,26 @@
 #define MBEDTLS_X509_USE_C
 #define MBEDTLS_X509_CRT_PARSE_C
 
-/* Set the memory allocation functions on FreeRTOS. */
+/* Set the memory allocation functions on FreeRTOS. Without a heap, set by
+ * the BOARD_STATIC_ALLOCATION CMake option, mbedTLS allocates from a static
+ * arena of mbedtls_freertos_port.c instead. */
+#define MBEDTLS_PLATFORM_MEMORY
+
+#if ( configSUPPORT_DYNAMIC_ALLOCATION == 0 )
+    #define MBEDTLS_MEMORY_BUFFER_ALLOC_C
+void mbedtls_platform_memory_init( void );
+#else
 void * mbedtls_platform_calloc( size_t nmemb,
                                 size_t size );
 void mbedtls_platform_free( void * ptr );
-#define MBEDTLS_PLATFORM_MEMORY
-#define MBEDTLS_PLATFORM_CALLOC_MACRO    mbedtls_platform_calloc
-#define MBEDTLS_PLATFORM_FREE_MACRO      mbedtls_platform_free
+    #define MBEDTLS_PLATFORM_CALLOC_MACRO    mbedtls_platform_calloc
+    #define MBEDTLS_PLATFORM_FREE_MACRO      mbedtls_platform_free
+#endif
+
+/* Slab allocator statistics, available when mbedtlsportSLAB_ENABLED is 1. */
+void mbedtls_platform_slab_get_stats( size_t * pxPeakBytesInUse,
+                                      uint16_t * pusMinFreeBlocks,
+                                      uint32_t * pulHeapFallbacks );
 
 /* The network send and receive functions on FreeRTOS. */
 int mbedtls_platform_send( void * ctx,
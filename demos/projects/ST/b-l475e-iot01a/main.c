@@ -22,6 +22,23 @@
 /* Demo includes */
 #include "demo_config.h"
 
+/* Startup timing. */
+#include "azure_sample_startup.h"
+
+/* Random bytes read ahead of the handshakes. */
+#include "azure_sample_entropy_pool.h"
+
+/* Logs written by a task of low priority. */
+#include "azure_sample_deferred_log.h"
+
+/* Logs written as tokens. */
+#include "azure_sample_token_log.h"
+
+/* Unix time from SNTP. */
+#include "azure_sample_time_sync.h"
+#include "azure_sample_task.h"
+#include "sockets_wrapper_stm32l475.h"
+
 /* WiFi driver includes. */
 #include "es_wifi.h"
 #include "wifi.h"
@@ -41,6 +58,12 @@
     #error "Symbol WIFI_SECURITY_TYPE must be defined."
 #endif /* WIFI_SECURITY_TYPE  */
 
+/* The SNTP task, and its wait for an answer and after a failed query. */
+#define mainTIME_SYNC_TASK_STACK_SIZE    ( configMINIMAL_STACK_SIZE * 2 )
+#define mainTIME_SYNC_TASK_PRIORITY      ( tskIDLE_PRIORITY + 1 )
+#define mainTIME_SYNC_TIMEOUT_MS         ( 3000U )
+#define mainTIME_SYNC_RETRY_MS           ( 2000U )
+
 uint8_t MAC_Addr[ 6 ];
 uint8_t IP_Addr[ 4 ];
 uint8_t Gateway_Addr[ 4 ];
@@ -67,7 +90,6 @@ xSemaphoreHandle xWifiSemaphoreHandle;
 static UART_HandleTypeDef xConsoleUart;
 /* Use by the pseudo random number generator. */
 static UBaseType_t ulNextRand;
-static uint64_t ulGlobalEntryTime = 1673769600;
 
 /* Private function prototypes -----------------------------------------------*/
 static void Init_MEM1_Sensors( void );
@@ -92,25 +114,61 @@ uint64_t ullGetUnixTime( void );
  */
 static void prvMiscInitialization( void );
 
+#if ( configSUPPORT_DYNAMIC_ALLOCATION == 1 )
+
 /**
  * @brief Initializes the FreeRTOS heap.
  *
  * Heap_5 is being used because the RAM is not contiguous, therefore the heap
  * needs to be initialized.  See http://www.freertos.org/a00111.html
  */
-static void prvInitializeHeap( void );
+    static void prvInitializeHeap( void );
+#endif /* configSUPPORT_DYNAMIC_ALLOCATION == 1 */
+
+/**
+ * @brief Reads the RNG for the entropy pool, waiting for each word.
+ */
+static int prvReadRng( uint8_t * pucBuffer,
+                       size_t xLength );
+
+/**
+ * @brief Writes a log to the console, waiting for it.
+ */
+static void prvWriteConsole( const char * pcText,
+                             size_t xLength );
+
+#ifdef democonfigTIME_SYNC
+
+/**
+ * @brief Queries the SNTP server over a UDP socket of the WiFi module.
+ */
+    static void prvTimeSyncTask( void * pvParameters );
+#endif /* democonfigTIME_SYNC */
 /*-----------------------------------------------------------*/
 
 static BaseType_t prvInitializeWifi( void );
 /*-----------------------------------------------------------*/
 
+static void prvWriteConsole( const char * pcText,
+                             size_t xLength )
+{
+    ( void ) fwrite( pcText, 1, xLength, stdout );
+}
+/*-----------------------------------------------------------*/
+
 void vLoggingPrintf( const char * pcFormat,
                      ... )
 {
     va_list vargs;
 
     va_start( vargs, pcFormat );
-    vprintf( pcFormat, vargs );
+
+    #if ( democonfigDEFERRED_LOG == 1 )
+        DeferredLog_VPrintf( pcFormat, vargs );
+    #else
+        vprintf( pcFormat, vargs );
+    #endif
+
     va_end( vargs );
 }
 
@@ -123,6 +181,22 @@ int main( void )
      * running.  */
     prvMiscInitialization();
 
+    /* The RNG is read into the pool once the scheduler starts, ahead of the
+     * first handshake. */
+    ( void ) EntropyPool_Init( prvReadRng );
+
+    /* The fallback time until SNTP answers. */
+    TimeSync_Init();
+
+    #if ( democonfigDEFERRED_LOG == 1 )
+        /* The logs made until the scheduler starts are written then. */
+        ( void ) DeferredLog_Init( prvWriteConsole );
+    #endif
+
+    #if ( democonfigTOKEN_LOG == 1 )
+        TokenLog_Init( prvWriteConsole );
+    #endif
+
     /* Start the scheduler.  Initialization that requires the OS to be running,
      * including the WiFi initialization, is performed in the RTOS daemon task
      * startup hook. */
@@ -157,6 +231,16 @@ void vApplicationDaemonTaskStartupHook( void )
     /* Initialize semaphore. */
     xSemaphoreGive( xWifiSemaphoreHandle );
 
+    /* The WiFi connected before the scheduler started. */
+    StartupProfile_Mark( eStartupPhaseNetworkUp );
+
+    #ifdef democonfigTIME_SYNC
+        /* Queries the time while the demo provisions and connects, rather
+         * than before it. */
+        ( void ) sampletaskCREATE( prvTimeSyncTask, "TimeSync", mainTIME_SYNC_TASK_STACK_SIZE,
+                                   NULL, mainTIME_SYNC_TASK_PRIORITY, NULL, tskNO_AFFINITY );
+    #endif
+
     /* Demos that use the network are created after the network is
      * up. */
     configPRINTF( ( "---------STARTING DEMO---------\r\n" ) );
@@ -210,6 +294,15 @@ static BaseType_t prvInitializeWifi( void )
 
             configPRINTF( ( "ES-WIFI Connected.\r\n" ) );
 
+            #if ( configUSE_TICKLESS_IDLE == 1 )
+                /* The radio sleeps between beacons too, the access point
+                 * buffering what comes for it, so the sockets stay open. */
+                if( WIFI_SetPowerSave( 1 ) != WIFI_STATUS_OK )
+                {
+                    configPRINTF( ( "ES-WIFI power save not supported by the module firmware.\r\n" ) );
+                }
+            #endif /* configUSE_TICKLESS_IDLE == 1 */
+
             if( WIFI_GetIP_Address( IP_Addr ) == WIFI_STATUS_OK )
             {
                 configPRINTF( ( "> ES-WIFI IP Address: %d.%d.%d.%d\r\n",
@@ -340,9 +433,11 @@ static void prvMiscInitialization( void )
     /* Configure the system clock. */
     SystemClock_Config();
 
-    /* Heap_5 is being used because the RAM is not contiguous in memory, so the
-     * heap must be initialized. */
-    prvInitializeHeap();
+    #if ( configSUPPORT_DYNAMIC_ALLOCATION == 1 )
+        /* Heap_5 is being used because the RAM is not contiguous in memory, so the
+         * heap must be initialized. */
+        prvInitializeHeap();
+    #endif /* configSUPPORT_DYNAMIC_ALLOCATION == 1 */
 
     BSP_LED_Init( LED_GREEN );
     BSP_PB_Init( BUTTON_USER, BUTTON_MODE_EXTI );
@@ -608,6 +703,58 @@ void vApplicationIdleHook( void )
 }
 /*-----------------------------------------------------------*/
 
+#if ( configUSE_TICKLESS_IDLE == 1 )
+
+/* Called by the port with interrupts masked, just before it sleeps with the
+ * tick stopped. */
+    void vMainPreSleepProcessing( uint32_t ulExpectedIdleTime )
+    {
+        ( void ) ulExpectedIdleTime;
+
+        HAL_SuspendTick();
+    }
+/*-----------------------------------------------------------*/
+
+    void vMainPostSleepProcessing( uint32_t ulExpectedIdleTime )
+    {
+        ( void ) ulExpectedIdleTime;
+
+        HAL_ResumeTick();
+    }
+/*-----------------------------------------------------------*/
+#endif /* configUSE_TICKLESS_IDLE == 1 */
+
+#if ( configGENERATE_RUN_TIME_STATS == 1 )
+
+/* Rate of the run-time stats counter. The counter of a task wraps after
+ * about 12 hours, and the diagnostics only take differences. */
+    #define mainRUN_TIME_STATS_HZ    ( 100000U )
+
+/* Called by the kernel as the scheduler starts. TIM2 runs free, without an
+ * interrupt, so it keeps counting through the sleeps of tickless idle. */
+    void vMainConfigureTimerForRunTimeStats( void )
+    {
+        /* APB1 is not divided, so the timers run at PCLK1, as in HAL_InitTick(). */
+        uint32_t ulTimerClock = HAL_RCC_GetPCLK1Freq();
+
+        __HAL_RCC_TIM2_CLK_ENABLE();
+
+        TIM2->CR1 = 0;
+        TIM2->PSC = ( ulTimerClock / mainRUN_TIME_STATS_HZ ) - 1U;
+        TIM2->ARR = UINT32_MAX;
+        TIM2->CNT = 0;
+        TIM2->EGR = TIM_EGR_UG; /* Loads the prescaler. */
+        TIM2->CR1 = TIM_CR1_CEN;
+    }
+/*-----------------------------------------------------------*/
+
+    uint32_t ulMainGetRunTimeCounterValue( void )
+    {
+        return TIM2->CNT;
+    }
+/*-----------------------------------------------------------*/
+#endif /* configGENERATE_RUN_TIME_STATS == 1 */
+
 void prvGetRegistersFromStack( uint32_t * pulFaultStackAddress )
 {
 /* These are volatile to try and prevent the compiler/linker optimising them
@@ -666,20 +813,29 @@ int iMainRand32( void )
 }
 /*-----------------------------------------------------------*/
 
-static void prvInitializeHeap( void )
-{
-    static uint8_t ucHeap1[ configTOTAL_HEAP_SIZE ];
-    static uint8_t ucHeap2[ 25 * 1024 ] __attribute__( ( section( ".freertos_heap2" ) ) );
+#if ( configSUPPORT_DYNAMIC_ALLOCATION == 1 )
 
-    HeapRegion_t xHeapRegions[] =
+/* The heap region in the .freertos_heap2 section of the linker script, which
+ * is the SRAM2 of the L475 and the SRAM3 of the L4S5. */
+    #ifndef configTOTAL_HEAP2_SIZE
+        #define configTOTAL_HEAP2_SIZE    ( 25 * 1024 )
+    #endif
+
+    static void prvInitializeHeap( void )
     {
-        { ( unsigned char * ) ucHeap2, sizeof( ucHeap2 ) },
-        { ( unsigned char * ) ucHeap1, sizeof( ucHeap1 ) },
-        { NULL,                        0                 }
-    };
+        static uint8_t ucHeap1[ configTOTAL_HEAP_SIZE ];
+        static uint8_t ucHeap2[ configTOTAL_HEAP2_SIZE ] __attribute__( ( section( ".freertos_heap2" ) ) );
 
-    vPortDefineHeapRegions( xHeapRegions );
-}
+        HeapRegion_t xHeapRegions[] =
+        {
+            { ( unsigned char * ) ucHeap2, sizeof( ucHeap2 ) },
+            { ( unsigned char * ) ucHeap1, sizeof( ucHeap1 ) },
+            { NULL,                        0                 }
+        };
+
+        vPortDefineHeapRegions( xHeapRegions );
+    }
+#endif /* configSUPPORT_DYNAMIC_ALLOCATION == 1 */
 
 /*-----------------------------------------------------------*/
 
@@ -716,6 +872,18 @@ void SPI3_IRQHandler( void )
 }
 /*-----------------------------------------------------------*/
 
+#if ( ES_WIFI_USE_SPI_DMA == 1 )
+
+/**
+ * @brief SPI3 transmit DMA Interrupt Handler.
+ */
+    void DMA2_Channel2_IRQHandler( void )
+    {
+        HAL_DMA_IRQHandler( hspi.hdmatx );
+    }
+/*-----------------------------------------------------------*/
+#endif /* ES_WIFI_USE_SPI_DMA == 1 */
+
 /**
  * @brief Period elapsed callback in non blocking mode
  *
@@ -735,45 +903,88 @@ void HAL_TIM_PeriodElapsedCallback( TIM_HandleTypeDef * htim )
 }
 /*-----------------------------------------------------------*/
 
-int mbedtls_platform_entropy_poll( void * data,
-                                   unsigned char * output,
-                                   size_t len,
-                                   size_t * olen )
+static int prvReadRng( uint8_t * pucBuffer,
+                       size_t xLength )
 {
-    HAL_StatusTypeDef status = HAL_OK;
     uint32_t random_number = 0;
+    size_t xCopy;
 
-    status = HAL_RNG_GenerateRandomNumber( &xHrng, &random_number );
-    ( ( void ) data );
-    *olen = 0;
-
-    if( ( len < sizeof( uint32_t ) ) || ( HAL_OK != status ) )
+    while( xLength > 0 )
     {
-        return 0;
-    }
+        if( HAL_RNG_GenerateRandomNumber( &xHrng, &random_number ) != HAL_OK )
+        {
+            return -1;
+        }
 
-    memcpy( output, &random_number, sizeof( uint32_t ) );
-    *olen = sizeof( uint32_t );
+        xCopy = ( xLength < sizeof( random_number ) ) ? xLength : sizeof( random_number );
+        memcpy( pucBuffer, &random_number, xCopy );
+        pucBuffer += xCopy;
+        xLength -= xCopy;
+    }
 
     return 0;
 }
 /*-----------------------------------------------------------*/
 
+int mbedtls_platform_entropy_poll( void * data,
+                                   unsigned char * output,
+                                   size_t len,
+                                   size_t * olen )
+{
+    return EntropyPool_Poll( data, output, len, olen );
+}
+/*-----------------------------------------------------------*/
+
 uint64_t ullGetUnixTime( void )
 {
-    TickType_t xTickCount = 0;
-    uint64_t ulTime = 0UL;
+    return TimeSync_GetUnixTimeMs() / 1000U;
+}
+/*-----------------------------------------------------------*/
+
+#ifdef democonfigTIME_SYNC
+    static void prvTimeSyncTask( void * pvParameters )
+    {
+        uint8_t ucPacket[ timesyncSNTP_PACKET_SIZE ];
+        uint32_t ulRetryMs = mainTIME_SYNC_RETRY_MS;
+        uint32_t ulNonce;
+        uint64_t ullTimeMs;
+        size_t xLength;
+        TickType_t xSent;
+        TickType_t xReceived;
 
-    /* Get the current tick count. */
-    xTickCount = xTaskGetTickCount();
+        ( void ) pvParameters;
 
-    /* Convert the ticks to milliseconds. */
-    ulTime = ( uint64_t ) xTickCount / configTICK_RATE_HZ;
+        for( ; ; )
+        {
+            ulNonce = ( uint32_t ) configRAND32();
+            TimeSync_SntpRequest( ucPacket, ulNonce );
 
-    /* Reduce ulGlobalEntryTimeMs from obtained time so as to always return the
-     * elapsed time in the application. */
-    ulTime = ( uint64_t ) ( ulTime + ulGlobalEntryTime );
+            xSent = xTaskGetTickCount();
 
-    return ulTime;
-}
+            if( ( Sockets_UdpExchange( democonfigTIME_SYNC_SERVER, timesyncSNTP_PORT,
+                                       ucPacket, sizeof( ucPacket ), ucPacket, sizeof( ucPacket ),
+                                       &xLength, mainTIME_SYNC_TIMEOUT_MS ) == SOCKETS_ERROR_NONE ) &&
+                ( TimeSync_SntpResponse( ucPacket, xLength, ulNonce, &ullTimeMs ) == eAzureIoTSuccess ) )
+            {
+                xReceived = xTaskGetTickCount();
+
+                /* The server answered about halfway through the exchange. */
+                TimeSync_Report( ullTimeMs, xSent + ( ( xReceived - xSent ) / 2U ) );
+
+                ulRetryMs = mainTIME_SYNC_RETRY_MS;
+                vTaskDelay( pdMS_TO_TICKS( democonfigTIME_SYNC_INTERVAL_MS ) );
+            }
+            else
+            {
+                LogWarn( ( "SNTP query failed, retrying in %u ms.\r\n", ( unsigned int ) ulRetryMs ) );
+                vTaskDelay( pdMS_TO_TICKS( ulRetryMs ) );
+
+                if( ulRetryMs < ( democonfigTIME_SYNC_INTERVAL_MS / 2U ) )
+                {
+                    ulRetryMs *= 2U;
+                }
+            }
+        }
+    }
+#endif /* democonfigTIME_SYNC */
 /*-----------------------------------------------------------*/
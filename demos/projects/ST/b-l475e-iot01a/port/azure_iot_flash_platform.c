@@ -1,6 +1,7 @@
 /* Copyright (c) Microsoft Corporation.
  * Licensed under the MIT License. */
 
+#include <stdbool.h>
 #include <string.h>
 #include "azure_iot_flash_platform.h"
 #include "azure_iot_flash_platform_port.h"
@@ -13,10 +14,100 @@
 #define azureiotflashL475_DOUBLE_WORD_SIZE    2 * sizeof( long )
 #define azureiotflashSHA_256_SIZE             32
 
-static uint8_t ucPartitionReadBuffer[ 32 ];
+/* Fast programming writes a row in one operation, 32 double words, or the 64
+ * of the L4+ devices, whose HAL gives the count. */
+#ifdef FLASH_NB_DOUBLE_WORDS_IN_ROW
+    #define azureiotflashL475_ROW_SIZE        ( FLASH_NB_DOUBLE_WORDS_IN_ROW * azureiotflashL475_DOUBLE_WORD_SIZE )
+#else
+    #define azureiotflashL475_ROW_SIZE        ( 32 * azureiotflashL475_DOUBLE_WORD_SIZE )
+#endif
+
+/* Set to 0 to program the image a double word at a time. */
+#ifndef azureiotflashROW_PROGRAMMING
+    #define azureiotflashROW_PROGRAMMING    1
+#endif
+
+/* Set to 0 to hash the image by reading it back in AzureIoTPlatform_VerifyImage()
+ * instead of finishing the hash of the written blocks. */
+#ifndef azureiotflashSTREAMING_HASH
+    #define azureiotflashSTREAMING_HASH    1
+#endif
+
+/* Set to 1 to also read the image back when the streamed hash matches. */
+#ifndef azureiotflashREAD_BACK_CHECK
+    #define azureiotflashREAD_BACK_CHECK    0
+#endif
+
+/* ulHashedLength value once a block was written out of order. */
+#define azureiotflashHASH_INVALID             0xffffffffUL
+
+/* The last page of the update bank holds the download progress journal, so
+ * the image itself can use everything before it. */
+#define azureiotflashJOURNAL_OFFSET           ( FLASH_BANK_SIZE - FLASH_PAGE_SIZE )
+#define azureiotflashJOURNAL_MAGIC            0x4144554aUL
+#define azureiotflashJOURNAL_ERASED           0xffffffffUL
+
+/* Records are appended until the page is full. The magic is in the last
+ * double word, so a record whose programming was cut short is never valid. */
+typedef struct AzureADUJournalRecord
+{
+    uint32_t ulImageFileSize;
+    uint32_t ulOffset;
+    uint8_t ucManifestHash[ azureiotflashSHA_256_SIZE ]; /* Identifies the image being downloaded. */
+    uint8_t ucWrittenHash[ azureiotflashSHA_256_SIZE ];  /* SHA256 of the first ulOffset bytes. */
+    uint32_t ulReserved;
+    uint32_t ulMagic;
+} AzureADUJournalRecord_t;
+
+#define azureiotflashJOURNAL_RECORD_COUNT     ( FLASH_PAGE_SIZE / sizeof( AzureADUJournalRecord_t ) )
+
+/* The page before the journal holds the swap records of the image in its
+ * bank, and the one before that the DPS cache record, so an image is limited
+ * to the pages before those. The bank booted from is mapped at FLASH_BASE,
+ * the other one after it. */
+#define azureiotflashSWAP_OFFSET              ( FLASH_BANK_SIZE - 2 * FLASH_PAGE_SIZE )
+#define azureiotflashIMAGE_LIMIT              azureiotflashDPS_CACHE_OFFSET
+#define azureiotflashSWAP_MAGIC               0x41445553UL
+
+/* States of the image of a bank, the latest record giving it. */
+#define azureiotflashSWAP_DOWNLOADING         0x444c4e44UL /* Being written, not bootable. */
+#define azureiotflashSWAP_STAGED              0x53544744UL /* Verified, waiting for its swap. */
+#define azureiotflashSWAP_SWAPPED             0x53575044UL /* The next boot is from it. */
+#define azureiotflashSWAP_TRIAL               0x5452594cUL /* Booted once, not confirmed. */
+#define azureiotflashSWAP_CONFIRMED           0x434e464dUL /* Confirmed by the image itself. */
+#define azureiotflashSWAP_REJECTED            0x524a4354UL /* Rolled back from. */
+#define azureiotflashSWAP_NONE                0UL          /* No record, such as an image flashed by hand. */
+
+/* Records are appended as the journal's are, the magic last. */
+typedef struct AzureADUSwapRecord
+{
+    uint32_t ulState;
+    uint32_t ulImageFileSize;
+    uint64_t ullSwapAt;
+    uint8_t ucImageHash[ azureiotflashSHA_256_SIZE ];
+    uint32_t ulReserved;
+    uint32_t ulMagic;
+} AzureADUSwapRecord_t;
+
+#define azureiotflashSWAP_RECORD_COUNT        ( FLASH_PAGE_SIZE / sizeof( AzureADUSwapRecord_t ) )
+
 static uint8_t ucDecodedManifestHash[ azureiotflashSHA_256_SIZE ];
 static uint8_t ucCalculatedHash[ azureiotflashSHA_256_SIZE ];
 
+/* Running hash of the bytes passed to AzureIoTPlatform_WriteBlock(). */
+static mbedtls_md_context_t xWrittenHashContext;
+static uint32_t ulHashedLength;
+static uint8_t ucJournalManifestHash[ azureiotflashSHA_256_SIZE ];
+static uint32_t ulJournalNextRecord;
+static AzureADUJournalRecord_t xJournalRecord;
+
+/* Fast programming is only done on a bank that was mass erased, so not after
+ * a resume, which erases pages. */
+static bool xBankMassErased = false;
+
+/* Rows are copied here, as the data of a block need not be word aligned. */
+static uint64_t ullRowStaging[ azureiotflashL475_ROW_SIZE / sizeof( uint64_t ) ];
+
 static AzureIoTResult_t prvBase64Decode( uint8_t * base64Encoded,
                                          size_t ulBase64EncodedLength,
                                          uint8_t * pucOutputBuffer,
@@ -40,36 +131,56 @@ static AzureIoTResult_t prvBase64Decode( uint8_t * base64Encoded,
     return eAzureIoTSuccess;
 }
 
-AzureIoTResult_t AzureIoTPlatform_Init( AzureADUImage_t * const pxAduImage )
+/* The bank mapped at FLASH_BASE, which is the one booted from. */
+static uint32_t prvGetRunningBank( void )
 {
-    pxAduImage->xUpdatePartition = ( uint8_t * ) ( FLASH_BASE + FLASH_BANK_SIZE );
-    pxAduImage->ulCurrentOffset = 0;
-    pxAduImage->ulImageFileSize = 0;
+    FLASH_OBProgramInitTypeDef xOptionBytes;
 
-    static FLASH_EraseInitTypeDef xEraseInitStruct;
-    uint32_t ulPageError;
+    HAL_FLASHEx_OBGetConfig( &xOptionBytes );
+
+    return ( ( xOptionBytes.USERConfig & OB_BFB2_ENABLE ) == OB_BFB2_ENABLE )
+           ? FLASH_BANK_2
+           : FLASH_BANK_1;
+}
+
+static uint32_t prvGetUpdateBank( void )
+{
     FLASH_OBProgramInitTypeDef xOptionBytes;
-    AzureIoTResult_t xResult = eAzureIoTSuccess;
 
     /* Clear OPTVERR bit set on virgin samples. */
     __HAL_FLASH_CLEAR_FLAG( FLASH_FLAG_OPTVERR );
     /* Get current optionbytes configuration */
     HAL_FLASHEx_OBGetConfig( &xOptionBytes );
 
-    /* If BFB2 (Boot From Bank 2) is set, erase bank 1, otherwise erase bank 2 */
-    xEraseInitStruct.Banks =
-        ( ( xOptionBytes.USERConfig & OB_BFB2_ENABLE ) == OB_BFB2_ENABLE )
-        ? FLASH_BANK_1
-        : FLASH_BANK_2;
-    xEraseInitStruct.TypeErase = FLASH_TYPEERASE_MASSERASE;
+    /* If BFB2 (Boot From Bank 2) is set, update bank 1, otherwise update bank 2 */
+    return ( ( xOptionBytes.USERConfig & OB_BFB2_ENABLE ) == OB_BFB2_ENABLE )
+           ? FLASH_BANK_1
+           : FLASH_BANK_2;
+}
+
+static AzureIoTResult_t prvEraseBankPages( uint32_t ulBank,
+                                           uint32_t ulFirstPage,
+                                           uint32_t ulPageCount )
+{
+    static FLASH_EraseInitTypeDef xEraseInitStruct;
+    uint32_t ulPageError;
+    AzureIoTResult_t xResult = eAzureIoTSuccess;
+
+    if( ulPageCount == 0 )
+    {
+        return eAzureIoTSuccess;
+    }
+
+    xEraseInitStruct.Banks = ulBank;
+    xEraseInitStruct.TypeErase = FLASH_TYPEERASE_PAGES;
+    xEraseInitStruct.Page = ulFirstPage;
+    xEraseInitStruct.NbPages = ulPageCount;
 
     HAL_FLASH_Unlock();
 
-    /* Erase non-boot bank */
     if( HAL_FLASHEx_Erase( &xEraseInitStruct, &ulPageError ) != HAL_OK )
     {
-        /* Error occurred during page erase. */
-        AZLogError( ( "Error erasing flash bank\r\n" ) );
+        AZLogError( ( "Error erasing flash page %u\r\n", ulPageError ) );
         xResult = eAzureIoTErrorFailed;
     }
 
@@ -78,25 +189,64 @@ AzureIoTResult_t AzureIoTPlatform_Init( AzureADUImage_t * const pxAduImage )
     return xResult;
 }
 
-int64_t AzureIoTPlatform_GetSingleFlashBootBankSize()
+static AzureIoTResult_t prvErasePages( uint32_t ulFirstPage,
+                                       uint32_t ulPageCount )
 {
-    return FLASH_BANK_SIZE;
+    return prvEraseBankPages( prvGetUpdateBank(), ulFirstPage, ulPageCount );
 }
 
-AzureIoTResult_t AzureIoTPlatform_WriteBlock( AzureADUImage_t * const pxAduImage,
-                                              uint32_t ulOffset,
-                                              uint8_t * const pData,
-                                              uint32_t ulBlockSize )
+/* Full rows from pucNextWriteAddr to pucEnd, or 0 when fast programming is not
+ * possible there. */
+static uint32_t prvFullRows( const uint8_t * pucNextWriteAddr,
+                             const uint8_t * pucEnd )
 {
-    uint8_t * pucNextWriteAddr = pxAduImage->xUpdatePartition + ulOffset;
-    uint8_t * pucNextReadAddr = pData;
+    if( !xBankMassErased ||
+        ( ( ( uint32_t ) pucNextWriteAddr % azureiotflashL475_ROW_SIZE ) != 0 ) )
+    {
+        return 0;
+    }
+
+    return ( uint32_t ) ( pucEnd - pucNextWriteAddr ) / azureiotflashL475_ROW_SIZE;
+}
+
+static AzureIoTResult_t prvProgram( uint8_t * pucAddress,
+                                    const uint8_t * pucData,
+                                    uint32_t ulLength )
+{
+    uint8_t * pucNextWriteAddr = pucAddress;
+    const uint8_t * pucNextReadAddr = pucData;
     AzureIoTResult_t xResult = eAzureIoTSuccess;
-    uint32_t ulEndOfBlock = pxAduImage->xUpdatePartition + ulOffset + ulBlockSize;
+    uint32_t ulRows;
 
     HAL_FLASH_Unlock();
 
-    while( pucNextWriteAddr < ulEndOfBlock )
+    while( pucNextWriteAddr < pucAddress + ulLength )
     {
+        #if ( azureiotflashROW_PROGRAMMING == 1 )
+            ulRows = prvFullRows( pucNextWriteAddr, pucAddress + ulLength );
+
+            if( ulRows > 0 )
+            {
+                memcpy( ullRowStaging, pucNextReadAddr, azureiotflashL475_ROW_SIZE );
+
+                /* The last row of a run ends the fast programming. */
+                if( HAL_FLASH_Program( ( ulRows == 1 ) ? FLASH_TYPEPROGRAM_FAST_AND_LAST : FLASH_TYPEPROGRAM_FAST,
+                                       ( uint32_t ) pucNextWriteAddr, ( uint64_t ) ( uint32_t ) ullRowStaging ) != HAL_OK )
+                {
+                    xResult = eAzureIoTErrorFailed;
+                    break;
+                }
+
+                pucNextWriteAddr += azureiotflashL475_ROW_SIZE;
+                pucNextReadAddr += azureiotflashL475_ROW_SIZE;
+                continue;
+            }
+        #else
+            ( void ) ulRows;
+        #endif /* azureiotflashROW_PROGRAMMING == 1 */
+
+        /* The rows are done, or the start is not row aligned: double words
+         * up to the next row or the end. */
         if( HAL_FLASH_Program( FLASH_TYPEPROGRAM_DOUBLEWORD, ( uint32_t ) pucNextWriteAddr, ( uint64_t ) *( uint32_t * ) pucNextReadAddr | ( ( uint64_t ) *( uint32_t * ) ( pucNextReadAddr + 4 ) ) << 32 ) != HAL_OK )
         {
             /* Error occurred while writing data in Flash memory */
@@ -113,72 +263,465 @@ AzureIoTResult_t AzureIoTPlatform_WriteBlock( AzureADUImage_t * const pxAduImage
     return xResult;
 }
 
-AzureIoTResult_t AzureIoTPlatform_VerifyImage( AzureADUImage_t * const pxAduImage,
-                                               uint8_t * pucSHA256Hash,
-                                               uint32_t ulSHA256HashLength )
+static void prvStartWrittenHash( void )
 {
-    int xResult;
+    mbedtls_md_free( &xWrittenHashContext );
+    mbedtls_md_init( &xWrittenHashContext );
+    mbedtls_md_setup( &xWrittenHashContext, mbedtls_md_info_from_type( MBEDTLS_MD_SHA256 ), 0 );
+    mbedtls_md_starts( &xWrittenHashContext );
+    ulHashedLength = 0;
+}
+
+/* The partition is memory mapped, so it is hashed in place rather than copied out. */
+static void prvHashPartition( AzureADUImage_t * const pxAduImage,
+                              uint32_t ulLength,
+                              uint8_t * pucHash )
+{
+    mbedtls_md_context_t ctx;
+
+    mbedtls_md_init( &ctx );
+    mbedtls_md_setup( &ctx, mbedtls_md_info_from_type( MBEDTLS_MD_SHA256 ), 0 );
+    mbedtls_md_starts( &ctx );
+    mbedtls_md_update( &ctx, ( const unsigned char * ) pxAduImage->xUpdatePartition, ulLength );
+    mbedtls_md_finish( &ctx, pucHash );
+    mbedtls_md_free( &ctx );
+}
+
+/* Finish a copy of the running hash, so it can keep absorbing later blocks. */
+static void prvGetWrittenHash( uint8_t * pucHash )
+{
+    mbedtls_md_context_t xCopy;
+
+    mbedtls_md_init( &xCopy );
+    mbedtls_md_setup( &xCopy, mbedtls_md_info_from_type( MBEDTLS_MD_SHA256 ), 0 );
+    mbedtls_md_clone( &xCopy, &xWrittenHashContext );
+    mbedtls_md_finish( &xCopy, pucHash );
+    mbedtls_md_free( &xCopy );
+}
+
+/* Returns the latest complete record for this image, or NULL. Also sets
+ * ulJournalNextRecord to the first free slot in the journal page. */
+static const AzureADUJournalRecord_t * prvFindJournalRecord( AzureADUImage_t * const pxAduImage )
+{
+    const AzureADUJournalRecord_t * pxRecords =
+        ( const AzureADUJournalRecord_t * ) ( pxAduImage->xUpdatePartition + azureiotflashJOURNAL_OFFSET );
+    const AzureADUJournalRecord_t * pxLatest = NULL;
+    uint32_t ulIndex;
+
+    for( ulIndex = 0; ulIndex < azureiotflashJOURNAL_RECORD_COUNT; ulIndex++ )
+    {
+        if( ( pxRecords[ ulIndex ].ulImageFileSize == azureiotflashJOURNAL_ERASED ) &&
+            ( pxRecords[ ulIndex ].ulMagic == azureiotflashJOURNAL_ERASED ) )
+        {
+            break;
+        }
+
+        if( pxRecords[ ulIndex ].ulMagic == azureiotflashJOURNAL_MAGIC )
+        {
+            pxLatest = &pxRecords[ ulIndex ];
+        }
+    }
+
+    ulJournalNextRecord = ulIndex;
+
+    if( ( pxLatest != NULL ) &&
+        ( ( pxLatest->ulImageFileSize != pxAduImage->ulImageFileSize ) ||
+          ( pxLatest->ulOffset > pxAduImage->ulImageFileSize ) ||
+          ( memcmp( pxLatest->ucManifestHash, ucJournalManifestHash, azureiotflashSHA_256_SIZE ) != 0 ) ) )
+    {
+        pxLatest = NULL;
+    }
+
+    return pxLatest;
+}
+
+/* The latest swap record of the bank mapped at pucBank, or NULL. Also sets
+ * *pulNextRecord to the first free slot in its page. */
+static const AzureADUSwapRecord_t * prvFindSwapRecord( const uint8_t * pucBank,
+                                                       uint32_t * pulNextRecord )
+{
+    const AzureADUSwapRecord_t * pxRecords = ( const AzureADUSwapRecord_t * ) ( pucBank + azureiotflashSWAP_OFFSET );
+    const AzureADUSwapRecord_t * pxLatest = NULL;
+    uint32_t ulIndex;
+
+    for( ulIndex = 0; ulIndex < azureiotflashSWAP_RECORD_COUNT; ulIndex++ )
+    {
+        if( ( pxRecords[ ulIndex ].ulState == azureiotflashJOURNAL_ERASED ) &&
+            ( pxRecords[ ulIndex ].ulMagic == azureiotflashJOURNAL_ERASED ) )
+        {
+            break;
+        }
+
+        if( pxRecords[ ulIndex ].ulMagic == azureiotflashSWAP_MAGIC )
+        {
+            pxLatest = &pxRecords[ ulIndex ];
+        }
+    }
+
+    if( pulNextRecord != NULL )
+    {
+        *pulNextRecord = ulIndex;
+    }
+
+    return pxLatest;
+}
+
+static uint32_t prvGetSwapState( const uint8_t * pucBank )
+{
+    const AzureADUSwapRecord_t * pxRecord = prvFindSwapRecord( pucBank, NULL );
+
+    return ( pxRecord != NULL ) ? pxRecord->ulState : azureiotflashSWAP_NONE;
+}
+
+/* Append a record in ulState to the swap page of the bank mapped at pucBank,
+ * which is ulBank, with the image of pxFrom, or of the latest record. */
+static AzureIoTResult_t prvAppendSwapRecord( uint8_t * pucBank,
+                                             uint32_t ulBank,
+                                             uint32_t ulState,
+                                             const AzureADUSwapRecord_t * pxFrom )
+{
+    static AzureADUSwapRecord_t xRecord;
+    uint32_t ulNextRecord;
+    const AzureADUSwapRecord_t * pxLatest = prvFindSwapRecord( pucBank, &ulNextRecord );
+
+    if( pxFrom == NULL )
+    {
+        pxFrom = pxLatest;
+    }
+
+    /* Copied before the page can be erased under it. */
+    if( pxFrom != NULL )
+    {
+        memcpy( &xRecord, pxFrom, sizeof( xRecord ) );
+    }
+    else
+    {
+        memset( &xRecord, 0, sizeof( xRecord ) );
+    }
+
+    if( ulNextRecord >= azureiotflashSWAP_RECORD_COUNT )
+    {
+        /* Power loss before the new record lands loses the state, which is
+         * then that of an image without records. */
+        if( prvEraseBankPages( ulBank, azureiotflashSWAP_OFFSET / FLASH_PAGE_SIZE, 1 ) != eAzureIoTSuccess )
+        {
+            return eAzureIoTErrorFailed;
+        }
+
+        ulNextRecord = 0;
+    }
+
+    xRecord.ulState = ulState;
+    xRecord.ulReserved = 0;
+    xRecord.ulMagic = azureiotflashSWAP_MAGIC;
+
+    return prvProgram( pucBank + azureiotflashSWAP_OFFSET + ulNextRecord * sizeof( AzureADUSwapRecord_t ),
+                       ( const uint8_t * ) &xRecord, sizeof( xRecord ) );
+}
+
+/* The L4+ devices can join their banks into one, which cannot be swapped and
+ * whose pages are not those the update is laid out in. */
+static bool prvDualBank( void )
+{
+    #ifdef FLASH_OPTR_DBANK
+        if( READ_BIT( FLASH->OPTR, FLASH_OPTR_DBANK ) == 0U )
+        {
+            AZLogError( ( "Flash is in single bank mode, set the DBANK option bit\r\n" ) );
+            return false;
+        }
+    #endif
+
+    return true;
+}
+
+/* Boot from the other bank, as the option bytes are reloaded by a reset. */
+static void prvBootOtherBank( AzureADUImage_t * const pxAduImage )
+{
+    if( AzureIoTPlatform_EnableImage( pxAduImage ) == eAzureIoTSuccess )
+    {
+        ( void ) AzureIoTPlatform_ResetDevice( pxAduImage );
+    }
+}
+
+AzureIoTResult_t AzureIoTPlatform_Init( AzureADUImage_t * const pxAduImage )
+{
+    if( !prvDualBank() )
+    {
+        return eAzureIoTErrorFailed;
+    }
+
+    pxAduImage->xUpdatePartition = ( uint8_t * ) ( FLASH_BASE + FLASH_BANK_SIZE );
+    pxAduImage->ulCurrentOffset = 0;
+    pxAduImage->ulImageFileSize = 0;
+
+    prvStartWrittenHash();
+    /* The mass erase below takes the journal with it. */
+    memset( ucJournalManifestHash, 0, sizeof( ucJournalManifestHash ) );
+    ulJournalNextRecord = 0;
+
+    static FLASH_EraseInitTypeDef xEraseInitStruct;
+    uint32_t ulPageError;
+    FLASH_OBProgramInitTypeDef xOptionBytes;
+    AzureIoTResult_t xResult = eAzureIoTSuccess;
+
+    /* Clear OPTVERR bit set on virgin samples. */
+    __HAL_FLASH_CLEAR_FLAG( FLASH_FLAG_OPTVERR );
+    /* Get current optionbytes configuration */
+    HAL_FLASHEx_OBGetConfig( &xOptionBytes );
+
+    /* If BFB2 (Boot From Bank 2) is set, erase bank 1, otherwise erase bank 2 */
+    xEraseInitStruct.Banks =
+        ( ( xOptionBytes.USERConfig & OB_BFB2_ENABLE ) == OB_BFB2_ENABLE )
+        ? FLASH_BANK_1
+        : FLASH_BANK_2;
+    xEraseInitStruct.TypeErase = FLASH_TYPEERASE_MASSERASE;
+
+    HAL_FLASH_Unlock();
+
+    /* Erase non-boot bank */
+    if( HAL_FLASHEx_Erase( &xEraseInitStruct, &ulPageError ) != HAL_OK )
+    {
+        /* Error occurred during page erase. */
+        AZLogError( ( "Error erasing flash bank\r\n" ) );
+        xResult = eAzureIoTErrorFailed;
+    }
+
+    xBankMassErased = ( xResult == eAzureIoTSuccess );
+
+    HAL_FLASH_Lock();
+
+    /* So that the bank is not taken for a previous image to roll back to. */
+    if( xResult == eAzureIoTSuccess )
+    {
+        xResult = prvAppendSwapRecord( pxAduImage->xUpdatePartition, xEraseInitStruct.Banks,
+                                       azureiotflashSWAP_DOWNLOADING, NULL );
+    }
+
+    return xResult;
+}
+
+AzureIoTResult_t AzureIoTPlatform_ResumeInit( AzureADUImage_t * const pxAduImage,
+                                              uint8_t * pucSHA256Hash,
+                                              uint32_t ulSHA256HashLength )
+{
+    const AzureADUJournalRecord_t * pxRecord;
     uint32_t ulOutputSize;
-    uint32_t ulReadSize;
+    uint32_t ulFirstPage;
+    uint32_t ulImagePages;
 
-    AZLogInfo( ( "Base64 Encoded Hash from ADU: %.*s", ulSHA256HashLength, pucSHA256Hash ) );
-    xResult = prvBase64Decode( pucSHA256Hash, ulSHA256HashLength, ucDecodedManifestHash, azureiotflashSHA_256_SIZE, ( size_t * ) &ulOutputSize );
+    if( !prvDualBank() )
+    {
+        return eAzureIoTErrorFailed;
+    }
 
-    if( xResult != eAzureIoTSuccess )
+    pxAduImage->xUpdatePartition = ( uint8_t * ) ( FLASH_BASE + FLASH_BANK_SIZE );
+    pxAduImage->ulCurrentOffset = 0;
+    xBankMassErased = false;
+
+    if( pxAduImage->ulImageFileSize > azureiotflashIMAGE_LIMIT )
+    {
+        AZLogError( ( "Image does not fit in the update bank\r\n" ) );
+        return eAzureIoTErrorFailed;
+    }
+
+    if( prvBase64Decode( pucSHA256Hash, ulSHA256HashLength, ucJournalManifestHash,
+                         azureiotflashSHA_256_SIZE, ( size_t * ) &ulOutputSize ) != eAzureIoTSuccess )
     {
         AZLogError( ( "Unable to decode base64 SHA256\r\n" ) );
         return eAzureIoTErrorFailed;
     }
 
-    mbedtls_md_context_t ctx;
-    mbedtls_md_type_t md_type = MBEDTLS_MD_SHA256;
+    prvStartWrittenHash();
+    pxRecord = prvFindJournalRecord( pxAduImage );
 
-    mbedtls_md_init( &ctx );
-    mbedtls_md_setup( &ctx, mbedtls_md_info_from_type( md_type ), 0 );
-    mbedtls_md_starts( &ctx );
+    if( pxRecord != NULL )
+    {
+        /* Only trust what is in flash, not just what the journal says was written. */
+        mbedtls_md_update( &xWrittenHashContext, ( const unsigned char * ) pxAduImage->xUpdatePartition, pxRecord->ulOffset );
+        ulHashedLength = pxRecord->ulOffset;
+
+        prvGetWrittenHash( ucCalculatedHash );
+
+        if( memcmp( ucCalculatedHash, pxRecord->ucWrittenHash, azureiotflashSHA_256_SIZE ) == 0 )
+        {
+            pxAduImage->ulCurrentOffset = pxRecord->ulOffset;
+        }
+        else
+        {
+            AZLogWarn( ( "Image in flash does not match the download journal\r\n" ) );
+            prvStartWrittenHash();
+        }
+    }
 
-    AZLogInfo( ( "Starting the mbedtls calculation: image size %d\r\n", pxAduImage->ulImageFileSize ) );
+    AZLogInfo( ( "Download starting at %u of %u bytes\r\n", pxAduImage->ulCurrentOffset, pxAduImage->ulImageFileSize ) );
 
-    for( size_t ulOffset = 0; ulOffset < pxAduImage->ulImageFileSize; ulOffset += sizeof( ucPartitionReadBuffer ) )
+    /* Recorded offsets are page aligned, so the pages before the resume point are complete. */
+    ulFirstPage = pxAduImage->ulCurrentOffset / FLASH_PAGE_SIZE;
+    ulImagePages = ( pxAduImage->ulImageFileSize + FLASH_PAGE_SIZE - 1 ) / FLASH_PAGE_SIZE;
+
+    if( ( ulImagePages > ulFirstPage ) &&
+        ( prvErasePages( ulFirstPage, ulImagePages - ulFirstPage ) != eAzureIoTSuccess ) )
     {
-        ulReadSize = pxAduImage->ulImageFileSize - ulOffset < sizeof( ucPartitionReadBuffer ) ? pxAduImage->ulImageFileSize - ulOffset : sizeof( ucPartitionReadBuffer );
+        return eAzureIoTErrorFailed;
+    }
 
-        memcpy( ucPartitionReadBuffer, ( pxAduImage->xUpdatePartition + ulOffset ), ulReadSize );
+    /* Whatever was staged in the bank is being written over. */
+    if( ( prvErasePages( azureiotflashSWAP_OFFSET / FLASH_PAGE_SIZE, 1 ) != eAzureIoTSuccess ) ||
+        ( prvAppendSwapRecord( pxAduImage->xUpdatePartition, prvGetUpdateBank(),
+                               azureiotflashSWAP_DOWNLOADING, NULL ) != eAzureIoTSuccess ) )
+    {
+        return eAzureIoTErrorFailed;
+    }
 
-        mbedtls_md_update( &ctx, ( const unsigned char * ) ucPartitionReadBuffer, ulReadSize );
+    /* Start a new journal for a different image; otherwise keep appending. */
+    if( pxAduImage->ulCurrentOffset == 0 )
+    {
+        if( prvErasePages( azureiotflashJOURNAL_OFFSET / FLASH_PAGE_SIZE, 1 ) != eAzureIoTSuccess )
+        {
+            return eAzureIoTErrorFailed;
+        }
+
+        ulJournalNextRecord = 0;
     }
 
-    AZLogInfo( ( "mbedtls calculation completed\r\n" ) );
+    return eAzureIoTSuccess;
+}
 
-    mbedtls_md_finish( &ctx, ucCalculatedHash );
-    mbedtls_md_free( &ctx );
+AzureIoTResult_t AzureIoTPlatform_SaveProgress( AzureADUImage_t * const pxAduImage )
+{
+    AzureIoTResult_t xResult;
 
-    if( memcmp( ucDecodedManifestHash, ucCalculatedHash, azureiotflashSHA_256_SIZE ) == 0 )
+    if( ( ( pxAduImage->ulCurrentOffset % FLASH_PAGE_SIZE ) != 0 ) &&
+        ( pxAduImage->ulCurrentOffset != pxAduImage->ulImageFileSize ) )
     {
-        AZLogInfo( ( "SHAs match\r\n" ) );
-        xResult = eAzureIoTSuccess;
+        return eAzureIoTSuccess;
     }
-    else
+
+    if( ulHashedLength != pxAduImage->ulCurrentOffset )
     {
-        AZLogError( ( "SHAs do not match\r\n" ) );
-        AZLogInfo( ( "Wanted: " ) );
+        AZLogError( ( "Blocks were not written in order, progress not recorded\r\n" ) );
+        return eAzureIoTErrorFailed;
+    }
 
-        for( int i = 0; i < azureiotflashSHA_256_SIZE; ++i )
+    if( ulJournalNextRecord >= azureiotflashJOURNAL_RECORD_COUNT )
+    {
+        /* Power loss before the new record lands only costs the progress so far. */
+        if( prvErasePages( azureiotflashJOURNAL_OFFSET / FLASH_PAGE_SIZE, 1 ) != eAzureIoTSuccess )
         {
-            AZLogInfo( ( "%x", ucDecodedManifestHash[ i ] ) );
+            return eAzureIoTErrorFailed;
         }
 
-        AZLogInfo( ( "\r\n" ) );
-        AZLogInfo( ( "Calculated: " ) );
+        ulJournalNextRecord = 0;
+    }
+
+    xJournalRecord.ulMagic = azureiotflashJOURNAL_MAGIC;
+    xJournalRecord.ulImageFileSize = pxAduImage->ulImageFileSize;
+    xJournalRecord.ulOffset = pxAduImage->ulCurrentOffset;
+    xJournalRecord.ulReserved = 0;
+    memcpy( xJournalRecord.ucManifestHash, ucJournalManifestHash, azureiotflashSHA_256_SIZE );
+    prvGetWrittenHash( xJournalRecord.ucWrittenHash );
+
+    xResult = prvProgram( pxAduImage->xUpdatePartition + azureiotflashJOURNAL_OFFSET +
+                          ulJournalNextRecord * sizeof( AzureADUJournalRecord_t ),
+                          ( const uint8_t * ) &xJournalRecord, sizeof( xJournalRecord ) );
+
+    /* A failed record is skipped, not rewritten. */
+    ulJournalNextRecord++;
+
+    return xResult;
+}
+
+int64_t AzureIoTPlatform_GetSingleFlashBootBankSize()
+{
+    return azureiotflashIMAGE_LIMIT;
+}
+
+AzureIoTResult_t AzureIoTPlatform_WriteBlock( AzureADUImage_t * const pxAduImage,
+                                              uint32_t ulOffset,
+                                              uint8_t * const pData,
+                                              uint32_t ulBlockSize )
+{
+    if( ulOffset == ulHashedLength )
+    {
+        mbedtls_md_update( &xWrittenHashContext, ( const unsigned char * ) pData, ulBlockSize );
+        ulHashedLength += ulBlockSize;
+    }
+    else
+    {
+        ulHashedLength = azureiotflashHASH_INVALID;
+    }
+
+    return prvProgram( pxAduImage->xUpdatePartition + ulOffset, pData, ulBlockSize );
+}
+
+static AzureIoTResult_t prvCompareHash( void )
+{
+    if( memcmp( ucDecodedManifestHash, ucCalculatedHash, azureiotflashSHA_256_SIZE ) == 0 )
+    {
+        AZLogInfo( ( "SHAs match\r\n" ) );
+        return eAzureIoTSuccess;
+    }
+
+    AZLogError( ( "SHAs do not match\r\n" ) );
+    AZLogInfo( ( "Wanted: " ) );
+
+    for( int i = 0; i < azureiotflashSHA_256_SIZE; ++i )
+    {
+        AZLogInfo( ( "%x", ucDecodedManifestHash[ i ] ) );
+    }
+
+    AZLogInfo( ( "\r\n" ) );
+    AZLogInfo( ( "Calculated: " ) );
+
+    for( int i = 0; i < azureiotflashSHA_256_SIZE; ++i )
+    {
+        AZLogInfo( ( "%x", ucCalculatedHash[ i ] ) );
+    }
+
+    AZLogInfo( ( "\r\n" ) );
+
+    return eAzureIoTErrorFailed;
+}
+
+AzureIoTResult_t AzureIoTPlatform_VerifyImage( AzureADUImage_t * const pxAduImage,
+                                               uint8_t * pucSHA256Hash,
+                                               uint32_t ulSHA256HashLength )
+{
+    int xResult;
+    uint32_t ulOutputSize;
+    int xReadBack = 1;
+
+    AZLogInfo( ( "Base64 Encoded Hash from ADU: %.*s", ulSHA256HashLength, pucSHA256Hash ) );
+    xResult = prvBase64Decode( pucSHA256Hash, ulSHA256HashLength, ucDecodedManifestHash, azureiotflashSHA_256_SIZE, ( size_t * ) &ulOutputSize );
 
-        for( int i = 0; i < azureiotflashSHA_256_SIZE; ++i )
+    if( xResult != eAzureIoTSuccess )
+    {
+        AZLogError( ( "Unable to decode base64 SHA256\r\n" ) );
+        return eAzureIoTErrorFailed;
+    }
+
+    #if ( azureiotflashSTREAMING_HASH == 1 )
+        if( ulHashedLength == pxAduImage->ulImageFileSize )
+        {
+            prvGetWrittenHash( ucCalculatedHash );
+            xResult = prvCompareHash();
+            xReadBack = ( xResult == eAzureIoTSuccess ) && ( azureiotflashREAD_BACK_CHECK == 1 );
+        }
+        else
         {
-            AZLogInfo( ( "%x", ucCalculatedHash[ i ] ) );
+            AZLogWarn( ( "Blocks were not written in order, reading the image back\r\n" ) );
         }
+    #endif /* azureiotflashSTREAMING_HASH == 1 */
 
-        AZLogInfo( ( "\r\n" ) );
+    if( xReadBack )
+    {
+        AZLogInfo( ( "Starting the mbedtls calculation: image size %d\r\n", pxAduImage->ulImageFileSize ) );
 
-        xResult = eAzureIoTErrorFailed;
+        prvHashPartition( pxAduImage, pxAduImage->ulImageFileSize, ucCalculatedHash );
+
+        AZLogInfo( ( "mbedtls calculation completed\r\n" ) );
+
+        xResult = prvCompareHash();
     }
 
     return xResult;
@@ -226,3 +769,147 @@ AzureIoTResult_t AzureIoTPlatform_ResetDevice( AzureADUImage_t * const pxAduImag
 
     return eAzureIoTSuccess;
 }
+
+AzureIoTResult_t AzureIoTPlatform_StageImage( AzureADUImage_t * const pxAduImage,
+                                              uint64_t ullSwapAt )
+{
+    AzureADUSwapRecord_t xRecord = { 0 };
+
+    /* AzureIoTPlatform_VerifyImage() matched it to the image. */
+    xRecord.ulImageFileSize = pxAduImage->ulImageFileSize;
+    xRecord.ullSwapAt = ullSwapAt;
+    memcpy( xRecord.ucImageHash, ucDecodedManifestHash, azureiotflashSHA_256_SIZE );
+
+    return prvAppendSwapRecord( pxAduImage->xUpdatePartition, prvGetUpdateBank(),
+                                azureiotflashSWAP_STAGED, &xRecord );
+}
+
+bool AzureIoTPlatform_GetStagedImage( AzureADUImage_t * const pxAduImage,
+                                      uint64_t * pullSwapAt )
+{
+    const AzureADUSwapRecord_t * pxRecord;
+
+    pxAduImage->xUpdatePartition = ( uint8_t * ) ( FLASH_BASE + FLASH_BANK_SIZE );
+    pxRecord = prvFindSwapRecord( pxAduImage->xUpdatePartition, NULL );
+
+    if( ( pxRecord == NULL ) || ( pxRecord->ulState != azureiotflashSWAP_STAGED ) ||
+        ( pxRecord->ulImageFileSize > azureiotflashIMAGE_LIMIT ) )
+    {
+        return false;
+    }
+
+    pxAduImage->ulImageFileSize = pxRecord->ulImageFileSize;
+    pxAduImage->ulCurrentOffset = pxRecord->ulImageFileSize;
+
+    if( pullSwapAt != NULL )
+    {
+        *pullSwapAt = pxRecord->ullSwapAt;
+    }
+
+    return true;
+}
+
+AzureIoTResult_t AzureIoTPlatform_SwapImage( AzureADUImage_t * const pxAduImage )
+{
+    const AzureADUSwapRecord_t * pxRecord;
+
+    pxAduImage->xUpdatePartition = ( uint8_t * ) ( FLASH_BASE + FLASH_BANK_SIZE );
+    pxRecord = prvFindSwapRecord( pxAduImage->xUpdatePartition, NULL );
+
+    if( ( pxRecord == NULL ) || ( pxRecord->ulState != azureiotflashSWAP_STAGED ) ||
+        ( pxRecord->ulImageFileSize > azureiotflashIMAGE_LIMIT ) )
+    {
+        AZLogError( ( "No image is staged\r\n" ) );
+        return eAzureIoTErrorFailed;
+    }
+
+    /* The staged image may have waited long, or across a reboot. */
+    prvHashPartition( pxAduImage, pxRecord->ulImageFileSize, ucCalculatedHash );
+
+    if( memcmp( ucCalculatedHash, pxRecord->ucImageHash, azureiotflashSHA_256_SIZE ) != 0 )
+    {
+        AZLogError( ( "Staged image no longer matches its hash\r\n" ) );
+        return eAzureIoTErrorFailed;
+    }
+
+    if( prvAppendSwapRecord( pxAduImage->xUpdatePartition, prvGetUpdateBank(),
+                             azureiotflashSWAP_SWAPPED, NULL ) != eAzureIoTSuccess )
+    {
+        return eAzureIoTErrorFailed;
+    }
+
+    return AzureIoTPlatform_EnableImage( pxAduImage );
+}
+
+AzureIoTResult_t AzureIoTPlatform_BootCheck( void )
+{
+    AzureADUImage_t xRunning;
+    uint32_t ulState = prvGetSwapState( ( const uint8_t * ) FLASH_BASE );
+
+    xRunning.xUpdatePartition = ( uint8_t * ) FLASH_BASE;
+
+    if( ulState == azureiotflashSWAP_SWAPPED )
+    {
+        /* First boot of the image, which it has to confirm before the next. */
+        AZLogInfo( ( "Booted a new image, on trial until confirmed\r\n" ) );
+
+        return prvAppendSwapRecord( xRunning.xUpdatePartition, prvGetRunningBank(),
+                                    azureiotflashSWAP_TRIAL, NULL );
+    }
+
+    if( ulState == azureiotflashSWAP_TRIAL )
+    {
+        AZLogError( ( "The new image restarted before confirming itself, rolling back\r\n" ) );
+
+        return AzureIoTPlatform_RollbackImage();
+    }
+
+    return eAzureIoTSuccess;
+}
+
+bool AzureIoTPlatform_IsImageOnTrial( void )
+{
+    return prvGetSwapState( ( const uint8_t * ) FLASH_BASE ) == azureiotflashSWAP_TRIAL;
+}
+
+AzureIoTResult_t AzureIoTPlatform_ConfirmImage( void )
+{
+    if( !AzureIoTPlatform_IsImageOnTrial() )
+    {
+        return eAzureIoTSuccess;
+    }
+
+    return prvAppendSwapRecord( ( uint8_t * ) FLASH_BASE, prvGetRunningBank(),
+                                azureiotflashSWAP_CONFIRMED, NULL );
+}
+
+AzureIoTResult_t AzureIoTPlatform_RollbackImage( void )
+{
+    AzureADUImage_t xOther;
+    uint32_t ulState;
+    const uint32_t * pulVectors;
+
+    xOther.xUpdatePartition = ( uint8_t * ) ( FLASH_BASE + FLASH_BANK_SIZE );
+    ulState = prvGetSwapState( xOther.xUpdatePartition );
+    pulVectors = ( const uint32_t * ) xOther.xUpdatePartition;
+
+    /* The other bank holds the image booted before, unless a download
+     * started over it. A bank flashed by hand has no records, but its
+     * vector table then starts with a stack pointer in SRAM1. */
+    if( ( ( ulState != azureiotflashSWAP_CONFIRMED ) && ( ulState != azureiotflashSWAP_NONE ) ) ||
+        ( ( pulVectors[ 0 ] & 0xfffe0000UL ) != SRAM1_BASE ) )
+    {
+        AZLogError( ( "No previous image to roll back to\r\n" ) );
+        return eAzureIoTErrorFailed;
+    }
+
+    if( prvAppendSwapRecord( ( uint8_t * ) FLASH_BASE, prvGetRunningBank(),
+                             azureiotflashSWAP_REJECTED, NULL ) != eAzureIoTSuccess )
+    {
+        return eAzureIoTErrorFailed;
+    }
+
+    prvBootOtherBank( &xOther );
+
+    return eAzureIoTErrorFailed;
+}
@@ -11,6 +11,11 @@
 #ifndef AZURE_IOT_FLASH_PLATFORM_PORT_H
 #define AZURE_IOT_FLASH_PLATFORM_PORT_H
 
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "azure_iot_result.h"
+
 typedef struct AzureADUImageContext
 {
     uint8_t * xUpdatePartition; /**< Partition address for ST */
@@ -20,4 +25,98 @@ typedef struct AzureADUImageContext
 
 typedef AzureADUImageContext_t AzureADUImage_t;
 
+/**
+ * @brief Offset in each bank of the page holding the DPS cache record.
+ *
+ * It comes before the pages of the swap records and of the download journal,
+ * which end the bank, and images end before it.
+ */
+#define azureiotflashDPS_CACHE_OFFSET    ( FLASH_BANK_SIZE - 3 * FLASH_PAGE_SIZE )
+
+/**
+ * @brief Prepare the update partition for a download that may continue an earlier one.
+ *
+ * Used instead of AzureIoTPlatform_Init(). pxAduImage->ulImageFileSize must be set.
+ * If the progress journal in the update bank records the same image and the
+ * flash contents up to the recorded offset still hash to the journaled value,
+ * ulCurrentOffset is set to that offset and only the pages after it are erased.
+ * Otherwise the download starts from zero.
+ *
+ * @param[in] pxAduImage The image context.
+ * @param[in] pucSHA256Hash The base64 encoded SHA256 of the image from the update manifest.
+ * @param[in] ulSHA256HashLength The length of \p pucSHA256Hash.
+ */
+AzureIoTResult_t AzureIoTPlatform_ResumeInit( AzureADUImage_t * const pxAduImage,
+                                              uint8_t * pucSHA256Hash,
+                                              uint32_t ulSHA256HashLength );
+
+/**
+ * @brief Record pxAduImage->ulCurrentOffset and the hash of the bytes written so far.
+ *
+ * Only page aligned offsets and the end of the image are recorded, so a resumed
+ * download never has to rewrite a partially programmed page.
+ *
+ * @param[in] pxAduImage The image context.
+ */
+AzureIoTResult_t AzureIoTPlatform_SaveProgress( AzureADUImage_t * const pxAduImage );
+
+/**
+ * @brief Mark the verified image of the update bank as waiting for its swap,
+ * instead of enabling it at once.
+ *
+ * The record is kept in the page before the journal, with the hash of the
+ * image, so the staged image survives a reboot and is checked again before
+ * the swap. Used after AzureIoTPlatform_VerifyImage() succeeded.
+ *
+ * @param[in] pxAduImage The image context.
+ * @param[in] ullSwapAt Unix time to swap at, kept for the application, or 0.
+ */
+AzureIoTResult_t AzureIoTPlatform_StageImage( AzureADUImage_t * const pxAduImage,
+                                              uint64_t ullSwapAt );
+
+/**
+ * @brief Whether the update bank holds a staged image, such as one staged
+ * before a reboot.
+ *
+ * @param[out] pxAduImage The image context, set to the staged image.
+ * @param[out] pullSwapAt The time given to AzureIoTPlatform_StageImage(), or NULL.
+ */
+bool AzureIoTPlatform_GetStagedImage( AzureADUImage_t * const pxAduImage,
+                                      uint64_t * pullSwapAt );
+
+/**
+ * @brief Check the staged image against its hash and enable it, in place of
+ * AzureIoTPlatform_EnableImage(). AzureIoTPlatform_ResetDevice() then boots it.
+ *
+ * @param[in] pxAduImage The image context.
+ */
+AzureIoTResult_t AzureIoTPlatform_SwapImage( AzureADUImage_t * const pxAduImage );
+
+/**
+ * @brief Called once at boot, before the image relies on the network.
+ *
+ * The first boot of a swapped image puts it on trial. If it boots again while
+ * on trial, it did not reach AzureIoTPlatform_ConfirmImage(), so this rolls
+ * back to the image of the other bank, and does not return.
+ */
+AzureIoTResult_t AzureIoTPlatform_BootCheck( void );
+
+/**
+ * @brief Whether the image runs its first boot after a swap, not yet confirmed.
+ */
+bool AzureIoTPlatform_IsImageOnTrial( void );
+
+/**
+ * @brief Confirm the image on trial, once it showed it works, such as by
+ * connecting to IoT Hub. The previous image stays in the other bank until a
+ * download starts over it.
+ */
+AzureIoTResult_t AzureIoTPlatform_ConfirmImage( void );
+
+/**
+ * @brief Boot the previous image, kept in the other bank, without downloading
+ * it again. Does not return unless there is no previous image.
+ */
+AzureIoTResult_t AzureIoTPlatform_RollbackImage( void );
+
 #endif /* AZURE_IOT_FLASH_PLATFORM_PORT_H */
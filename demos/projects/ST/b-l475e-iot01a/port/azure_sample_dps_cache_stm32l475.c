@@ -0,0 +1,88 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+#include <string.h>
+
+#include "azure_sample_dps_cache.h"
+
+#include "stm32l4xx_hal.h"
+
+/* For the page ADU leaves to the record in each bank. */
+#include "azure_iot_flash_platform_port.h"
+
+/* The record is written to the page of the bank the application runs from.
+ * Starting a download erases the other bank, so after a bank swap the page of
+ * the running bank is erased and the record is still in the other one. */
+#define dpscacheL475_PAGE_ADDRESS          ( FLASH_BASE + azureiotflashDPS_CACHE_OFFSET )
+#define dpscacheL475_OTHER_PAGE_ADDRESS    ( FLASH_BASE + FLASH_BANK_SIZE + azureiotflashDPS_CACHE_OFFSET )
+#define dpscacheL475_PAGE                  ( azureiotflashDPS_CACHE_OFFSET / FLASH_PAGE_SIZE )
+#define dpscacheL475_ERASED                0xffffffffUL
+
+/*-----------------------------------------------------------*/
+
+/* The bank mapped at FLASH_BASE, which is the one booted from. */
+static uint32_t prvGetRunningBank( void )
+{
+    FLASH_OBProgramInitTypeDef xOptionBytes;
+
+    HAL_FLASHEx_OBGetConfig( &xOptionBytes );
+
+    return ( ( xOptionBytes.USERConfig & OB_BFB2_ENABLE ) == OB_BFB2_ENABLE )
+           ? FLASH_BANK_2
+           : FLASH_BANK_1;
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t DPSCache_PlatformRead( DPSCacheRecord_t * pxRecord )
+{
+    memcpy( pxRecord, ( const void * ) dpscacheL475_PAGE_ADDRESS, sizeof( *pxRecord ) );
+
+    /* Move a record a bank swap left behind to the running bank, before the
+     * next download erases the other one. */
+    if( ( pxRecord->ulMagic == dpscacheL475_ERASED ) &&
+        ( *( const uint32_t * ) dpscacheL475_OTHER_PAGE_ADDRESS != dpscacheL475_ERASED ) )
+    {
+        memcpy( pxRecord, ( const void * ) dpscacheL475_OTHER_PAGE_ADDRESS, sizeof( *pxRecord ) );
+        ( void ) DPSCache_PlatformWrite( pxRecord );
+    }
+
+    return eAzureIoTSuccess;
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t DPSCache_PlatformWrite( const DPSCacheRecord_t * pxRecord )
+{
+    FLASH_EraseInitTypeDef xEraseInitStruct;
+    uint32_t ulPageError;
+    const uint64_t * pullDoubleWords = ( const uint64_t * ) pxRecord;
+    uint32_t ulIndex;
+    AzureIoTResult_t xResult = eAzureIoTSuccess;
+
+    xEraseInitStruct.Banks = prvGetRunningBank();
+    xEraseInitStruct.TypeErase = FLASH_TYPEERASE_PAGES;
+    xEraseInitStruct.Page = dpscacheL475_PAGE;
+    xEraseInitStruct.NbPages = 1;
+
+    HAL_FLASH_Unlock();
+
+    if( HAL_FLASHEx_Erase( &xEraseInitStruct, &ulPageError ) != HAL_OK )
+    {
+        xResult = eAzureIoTErrorFailed;
+    }
+
+    /* The record holds a uint64_t, so it is double word aligned, and its
+     * size is a multiple of a double word. */
+    for( ulIndex = 0; ( xResult == eAzureIoTSuccess ) && ( ulIndex < sizeof( *pxRecord ) / sizeof( uint64_t ) ); ulIndex++ )
+    {
+        if( HAL_FLASH_Program( FLASH_TYPEPROGRAM_DOUBLEWORD, dpscacheL475_PAGE_ADDRESS + ulIndex * sizeof( uint64_t ),
+                               pullDoubleWords[ ulIndex ] ) != HAL_OK )
+        {
+            xResult = eAzureIoTErrorFailed;
+        }
+    }
+
+    HAL_FLASH_Lock();
+
+    return xResult;
+}
+/*-----------------------------------------------------------*/
@@ -0,0 +1,69 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+#include "demo_config.h"
+
+#include "azure_sample_telemetry_spool.h"
+
+#include "stm32l475e_iot01_qspi.h"
+
+/* The spool takes the 8 MB MX25R6435F QSPI flash of the board, which nothing
+ * else uses, from democonfigTELEMETRY_SPOOL_QSPI_OFFSET on. The internal flash
+ * left after the two banks of the image is too small to last. */
+#ifndef democonfigTELEMETRY_SPOOL_QSPI_OFFSET
+    #define democonfigTELEMETRY_SPOOL_QSPI_OFFSET    0U
+#endif
+
+#define telemetryspoolL475_SECTOR_COUNT \
+    ( ( MX25R6435F_FLASH_SIZE - democonfigTELEMETRY_SPOOL_QSPI_OFFSET ) / MX25R6435F_SECTOR_SIZE )
+
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t TelemetrySpool_PlatformInit( uint32_t * pulSectorSize,
+                                              uint32_t * pulSectorCount,
+                                              uint32_t * pulProgramSize )
+{
+    if( BSP_QSPI_Init() != QSPI_OK )
+    {
+        return eAzureIoTErrorFailed;
+    }
+
+    /* NOR flash, programmed a byte at a time. */
+    *pulSectorSize = MX25R6435F_SECTOR_SIZE;
+    *pulSectorCount = telemetryspoolL475_SECTOR_COUNT;
+    *pulProgramSize = 1;
+
+    return eAzureIoTSuccess;
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t TelemetrySpool_PlatformRead( uint32_t ulOffset,
+                                              uint8_t * pucData,
+                                              uint32_t ulLength )
+{
+    return ( BSP_QSPI_Read( pucData, democonfigTELEMETRY_SPOOL_QSPI_OFFSET + ulOffset, ulLength ) == QSPI_OK )
+           ? eAzureIoTSuccess
+           : eAzureIoTErrorFailed;
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t TelemetrySpool_PlatformWrite( uint32_t ulOffset,
+                                               const uint8_t * pucData,
+                                               uint32_t ulLength )
+{
+    /* BSP_QSPI_Write() splits the data at the 256 byte pages and waits for
+     * each to be programmed. It does not write through the pointer. */
+    return ( BSP_QSPI_Write( ( uint8_t * ) pucData, democonfigTELEMETRY_SPOOL_QSPI_OFFSET + ulOffset,
+                             ulLength ) == QSPI_OK )
+           ? eAzureIoTSuccess
+           : eAzureIoTErrorFailed;
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t TelemetrySpool_PlatformErase( uint32_t ulSector )
+{
+    return ( BSP_QSPI_Erase_Sector( democonfigTELEMETRY_SPOOL_QSPI_OFFSET / MX25R6435F_SECTOR_SIZE + ulSector ) == QSPI_OK )
+           ? eAzureIoTSuccess
+           : eAzureIoTErrorFailed;
+}
+/*-----------------------------------------------------------*/
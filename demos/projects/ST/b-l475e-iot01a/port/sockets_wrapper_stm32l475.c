@@ -6,7 +6,10 @@
  * @brief ST socket wrapper.
  */
 
+/* Implements the unimpaired calls when the network is impaired. */
+#define socketswrapperIMPLEMENTATION
 #include "sockets_wrapper.h"
+#include "sockets_wrapper_stm32l475.h"
 
 /* Standard includes. */
 #include <string.h>
@@ -19,6 +22,9 @@
 #include "es_wifi.h"
 #include "wifi.h"
 
+/* Link losses, which fail the sockets connected over the lost link. */
+#include "azure_sample_link.h"
+
 /*-----------------------------------------------------------*/
 
 /**
@@ -63,6 +69,24 @@
  */
 #define stsecuresocketsFIVE_MILLISECONDS           ( pdMS_TO_TICKS( 5 ) )
 
+/**
+ * @brief Longest sleep between read attempts on an idle socket.
+ *
+ * The module has no unsolicited data notification over SPI, so idle sockets
+ * are polled. The sleep starts at one tick and doubles up to this value while
+ * nothing arrives, so a busy socket is served quickly and idle ones leave the
+ * module to the others. With tickless idle, each poll wakes the core and the
+ * SPI of the module, so an idle socket is polled far less often, data then
+ * waiting in the module for up to this long.
+ */
+#ifndef stsecuresocketsMAX_POLL_DELAY
+    #if ( configUSE_TICKLESS_IDLE == 1 )
+        #define stsecuresocketsMAX_POLL_DELAY      ( pdMS_TO_TICKS( 250 ) )
+    #else
+        #define stsecuresocketsMAX_POLL_DELAY      ( pdMS_TO_TICKS( 20 ) )
+    #endif
+#endif
+
 /**
  * @brief The timeout supplied to the Inventek module in receive operation.
  *
@@ -72,6 +96,29 @@
  */
 #define stsecuresocketsONE_MILLISECOND             ( 1 )
 
+/**
+ * @brief Set to 1 to let one receive call read several module chunks.
+ *
+ * The module returns at most ES_WIFI_PAYLOAD_SIZE bytes per read command.
+ * When a read fills a whole chunk, more data is usually queued, so the
+ * wrapper issues the next read straight away, until the caller's buffer is
+ * full or the module has nothing more.
+ */
+#ifndef stsecuresocketsSTREAMING_RECV
+    #define stsecuresocketsSTREAMING_RECV          ( 1 )
+#endif
+
+/**
+ * @brief Shortest time between two checks of the link, in milliseconds.
+ *
+ * The module tells nothing when it leaves the access point, and its sockets
+ * then just receive nothing. A receive that timed out asks the module whether
+ * it is still joined, at most this often, and reports it to Link_Report().
+ */
+#ifndef stsecuresocketsLINK_CHECK_PERIOD_MS
+    #define stsecuresocketsLINK_CHECK_PERIOD_MS    ( 5000 )
+#endif
+
 /**
  * @brief Maximum number of sockets that can be created simultaneously.
  */
@@ -97,12 +144,31 @@ typedef struct STSecureSocket
     uint32_t ulFlags;           /**< Various properties of the socket (secured etc.). */
     uint32_t ulSendTimeout;     /**< Send timeout. */
     uint32_t ulReceiveTimeout;  /**< Receive timeout. */
+    uint8_t ucPeekedByte;       /**< Byte read by Sockets_WaitReadable() and not yet returned. */
+    uint8_t ucHasPeekedByte;    /**< Whether ucPeekedByte holds a byte. */
+    uint32_t ulLinkLosses;      /**< Link_Losses() when connected. */
 } STSecureSocket_t;
 
 static STSecureSocket_t xSockets[ wificonfigMAX_SOCKETS ];
 static const TickType_t xSemaphoreWaitTicks = pdMS_TO_TICKS( 60000 );
 extern xSemaphoreHandle xWifiSemaphoreHandle;
 
+/**
+ * @brief Duration of the last host name lookup.
+ */
+static TickType_t xLastResolveTime = 0;
+
+/**
+ * @brief Time of the last check of the link.
+ */
+static TickType_t xLastLinkCheck = 0;
+
+/**
+ * @brief Root CA last written to the module, NULL if none.
+ */
+static const uint8_t * pucModuleRootCa = NULL;
+static size_t xModuleRootCaSize = 0;
+
 /*-----------------------------------------------------------*/
 
 /**
@@ -202,6 +268,203 @@ static BaseType_t prvIsValidSocket( uint32_t ulSocketNumber )
 }
 /*-----------------------------------------------------------*/
 
+/**
+ * @brief Take the module for one operation.
+ *
+ * @param[in] xTicksToWait Maximum time to wait for the module.
+ * @return pdTRUE if the module was taken, otherwise pdFALSE.
+ */
+static BaseType_t prvTakeModule( TickType_t xTicksToWait )
+{
+    return xSemaphoreTake( xWifiSemaphoreHandle, xTicksToWait );
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Return the module after one operation.
+ *
+ * Each socket holds the module for a single command only. Yielding after the
+ * give hands it to a task of equal priority waiting on another socket, instead
+ * of letting the current task take it again before the next tick, so
+ * operations on different sockets interleave.
+ */
+static void prvGiveModule( void )
+{
+    ( void ) xSemaphoreGive( xWifiSemaphoreHandle );
+    taskYIELD();
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Ask the module whether it is still joined, unless it was asked lately.
+ *
+ * The module is not waited for, as a module busy with another socket is
+ * asked on a later timeout.
+ */
+static void prvCheckLink( void )
+{
+    uint8_t ucAddress[ 4 ];
+    TickType_t xNow = xTaskGetTickCount();
+
+    if( ( xNow - xLastLinkCheck ) < pdMS_TO_TICKS( stsecuresocketsLINK_CHECK_PERIOD_MS ) )
+    {
+        return;
+    }
+
+    if( prvTakeModule( 0 ) == pdTRUE )
+    {
+        xLastLinkCheck = xNow;
+        Link_Report( WIFI_GetIP_Address( ucAddress ) == WIFI_STATUS_OK );
+        prvGiveModule();
+    }
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Sleep before polling an idle socket again.
+ *
+ * @param[in,out] pxPollDelay Current sleep, doubled for the next call.
+ */
+static void prvPollDelay( TickType_t * pxPollDelay )
+{
+    vTaskDelay( *pxPollDelay );
+
+    if( *pxPollDelay < stsecuresocketsMAX_POLL_DELAY )
+    {
+        *pxPollDelay *= 2U;
+
+        if( *pxPollDelay > stsecuresocketsMAX_POLL_DELAY )
+        {
+            *pxPollDelay = stsecuresocketsMAX_POLL_DELAY;
+        }
+    }
+}
+/*-----------------------------------------------------------*/
+
+#if ( stsecuresocketsSTREAMING_RECV == 1 )
+
+/**
+ * @brief Read the chunks that follow a full one without waiting for more.
+ *
+ * Stops at the first short read, when the module is busy with another
+ * socket, or on any error; an error is left for the next receive to report
+ * so the bytes already read are not lost.
+ *
+ * @param[in] ulSocketNumber Socket to read from.
+ * @param[out] pucBuffer Where to store the data.
+ * @param[in] xLength Space left in @p pucBuffer.
+ * @param[in] xChunkLength Largest read the module accepts.
+ * @return Number of bytes read.
+ */
+    static BaseType_t prvRecvFollowOn( uint32_t ulSocketNumber,
+                                       uint8_t * pucBuffer,
+                                       size_t xLength,
+                                       size_t xChunkLength )
+    {
+        BaseType_t xTotal = 0;
+        uint16_t usReceivedBytes = 0;
+        size_t xRequest;
+        WIFI_Status_t xWiFiResult;
+
+        while( ( size_t ) xTotal < xLength )
+        {
+            xRequest = xLength - ( size_t ) xTotal;
+
+            if( xRequest > xChunkLength )
+            {
+                xRequest = xChunkLength;
+            }
+
+            if( prvTakeModule( stsecuresocketsFIVE_MILLISECONDS ) != pdTRUE )
+            {
+                break;
+            }
+
+            xWiFiResult = WIFI_ReceiveData( ( uint8_t ) ulSocketNumber,
+                                            &( pucBuffer[ xTotal ] ),
+                                            ( uint16_t ) xRequest,
+                                            &( usReceivedBytes ),
+                                            stsecuresocketsONE_MILLISECOND );
+
+            prvGiveModule();
+
+            if( xWiFiResult != WIFI_STATUS_OK )
+            {
+                break;
+            }
+
+            xTotal += ( BaseType_t ) usReceivedBytes;
+
+            if( ( size_t ) usReceivedBytes < xRequest )
+            {
+                break;
+            }
+        }
+
+        return xTotal;
+    }
+/*-----------------------------------------------------------*/
+#endif /* stsecuresocketsSTREAMING_RECV == 1 */
+
+/**
+ * @brief Write the root CA the module checks TLS servers against, unless it
+ * already has it.
+ *
+ * @param[in] pucRootCa The root CA in PEM, with or without its terminator.
+ * @param[in] xRootCaSize Size of @p pucRootCa.
+ * @return SOCKETS_ERROR_NONE if the module has the CA, otherwise an error.
+ */
+static int32_t prvStoreRootCa( const uint8_t * pucRootCa,
+                               size_t xRootCaSize )
+{
+    int32_t lRetVal = SOCKETS_ERROR_NONE;
+    size_t xLength = xRootCaSize;
+
+    if( ( pucRootCa == pucModuleRootCa ) && ( xRootCaSize == xModuleRootCaSize ) )
+    {
+        return SOCKETS_ERROR_NONE;
+    }
+
+    if( ( pucRootCa == NULL ) || ( xRootCaSize == 0 ) )
+    {
+        return SOCKETS_EINVAL;
+    }
+
+    /* The module takes the PEM without its terminator. */
+    if( pucRootCa[ xLength - 1 ] == '\0' )
+    {
+        xLength--;
+    }
+
+    if( xLength > stsecuresocketsMAX_ROOT_CA_SIZE )
+    {
+        return SOCKETS_EINVAL;
+    }
+
+    if( prvTakeModule( xSemaphoreWaitTicks ) != pdTRUE )
+    {
+        return SOCKETS_SOCKET_ERROR;
+    }
+
+    if( WIFI_StoreCA( ( uint8_t * ) pucRootCa, /*lint !e9005 STM function does not use const. */
+                      ( uint16_t ) xLength ) == WIFI_STATUS_OK )
+    {
+        pucModuleRootCa = pucRootCa;
+        xModuleRootCaSize = xRootCaSize;
+    }
+    else
+    {
+        pucModuleRootCa = NULL;
+        xModuleRootCaSize = 0;
+        lRetVal = SOCKETS_SOCKET_ERROR;
+    }
+
+    prvGiveModule();
+
+    return lRetVal;
+}
+/*-----------------------------------------------------------*/
+
 /**
  * @brief Resolve hostname.
  *
@@ -213,7 +476,7 @@ static uint32_t prvGetHostByName( const char * pcHostName )
     uint32_t ulIPAddres = 0;
 
     /* Try to acquire the semaphore. */
-    if( xSemaphoreTake( xWifiSemaphoreHandle, xSemaphoreWaitTicks ) == pdTRUE )
+    if( prvTakeModule( xSemaphoreWaitTicks ) == pdTRUE )
     {
         /* Do a DNS Lookup. */
         if( WIFI_GetHostAddress( pcHostName, ( uint8_t * ) &( ulIPAddres ) ) != WIFI_STATUS_OK )
@@ -223,7 +486,7 @@ static uint32_t prvGetHostByName( const char * pcHostName )
         }
 
         /* Return the semaphore. */
-        ( void ) xSemaphoreGive( xWifiSemaphoreHandle );
+        prvGiveModule();
     }
 
     return ulIPAddres;
@@ -262,9 +525,10 @@ SocketHandle Sockets_Open()
     if( prvIsValidSocket( ulSocketNumber ) )
     {
         pxSecureSocket = &( xSockets[ ulSocketNumber ] );
-        pxSecureSocket->ulFlags = stsecuresocketsSOCKET_SECURE_FLAG;
+        pxSecureSocket->ulFlags = 0;
         pxSecureSocket->ulSendTimeout = socketsconfigDEFAULT_SEND_TIMEOUT;
         pxSecureSocket->ulReceiveTimeout = socketsconfigDEFAULT_RECV_TIMEOUT;
+        pxSecureSocket->ucHasPeekedByte = 0;
     }
 
     return ( SocketHandle ) ulSocketNumber;
@@ -292,6 +556,7 @@ BaseType_t Sockets_Connect( SocketHandle xSocket,
     STSecureSocket_t * pxSecureSocket;
     int32_t lRetVal = SOCKETS_ERROR_NONE;
     uint32_t ulIPAddres = 0;
+    TickType_t xResolveStart;
 
     if( prvIsValidSocket( ulSocketNumber ) == pdFALSE )
     {
@@ -301,18 +566,24 @@ BaseType_t Sockets_Connect( SocketHandle xSocket,
     {
         pxSecureSocket = &( xSockets[ ulSocketNumber ] );
 
-        if( ( ulIPAddres = prvGetHostByName( pcHostName ) ) == 0 )
+        xResolveStart = xTaskGetTickCount();
+        ulIPAddres = prvGetHostByName( pcHostName );
+        xLastResolveTime = xTaskGetTickCount() - xResolveStart;
+
+        if( ulIPAddres == 0 )
         {
             lRetVal = SOCKETS_SOCKET_ERROR;
         }
-        else if( xSemaphoreTake( xWifiSemaphoreHandle, xSemaphoreWaitTicks ) != pdTRUE )
+        else if( prvTakeModule( xSemaphoreWaitTicks ) != pdTRUE )
         {
             lRetVal = SOCKETS_SOCKET_ERROR;
         }
         else
         {
-            /* Start the client connection. */
-            if( WIFI_OpenClientConnection( ulSocketNumber, WIFI_TCP_PROTOCOL,
+            /* Start the client connection, the module running the TLS of a secure socket. */
+            if( WIFI_OpenClientConnection( ulSocketNumber,
+                                           ( ( pxSecureSocket->ulFlags & stsecuresocketsSOCKET_SECURE_FLAG ) != 0UL ) ?
+                                           WIFI_TCP_SSL_PROTOCOL : WIFI_TCP_PROTOCOL,
                                            NULL, ( uint8_t * ) &ulIPAddres, usPort, 0 ) == WIFI_STATUS_OK )
             {
                 /* Successful connection is established. */
@@ -320,6 +591,7 @@ BaseType_t Sockets_Connect( SocketHandle xSocket,
 
                 /* Mark that the socket is connected. */
                 pxSecureSocket->ulFlags |= stsecuresocketsSOCKET_IS_CONNECTED_FLAG;
+                pxSecureSocket->ulLinkLosses = Link_Losses();
             }
             else
             {
@@ -328,7 +600,7 @@ BaseType_t Sockets_Connect( SocketHandle xSocket,
             }
 
             /* Return the semaphore. */
-            ( void ) xSemaphoreGive( xWifiSemaphoreHandle );
+            prvGiveModule();
         }
     }
 
@@ -336,6 +608,12 @@ BaseType_t Sockets_Connect( SocketHandle xSocket,
 }
 /*-----------------------------------------------------------*/
 
+TickType_t Sockets_GetLastResolveTime( void )
+{
+    return xLastResolveTime;
+}
+/*-----------------------------------------------------------*/
+
 void Sockets_Disconnect( SocketHandle xSocket )
 {
     uint32_t ulSocketNumber = ( uint32_t ) xSocket;
@@ -352,13 +630,13 @@ void Sockets_Disconnect( SocketHandle xSocket )
         pxSecureSocket->ulFlags |= stsecuresocketsSOCKET_WRITE_CLOSED_FLAG;
 
         /* Try to acquire the semaphore. */
-        if( xSemaphoreTake( xWifiSemaphoreHandle, xSemaphoreWaitTicks ) == pdTRUE )
+        if( prvTakeModule( xSemaphoreWaitTicks ) == pdTRUE )
         {
             /* Stop the client connection. */
             WIFI_CloseClientConnection( ulSocketNumber );
 
             /* Return the semaphore. */
-            ( void ) xSemaphoreGive( xWifiSemaphoreHandle );
+            prvGiveModule();
         }
 
         /* Return the socket back to the free socket pool. */
@@ -377,10 +655,27 @@ BaseType_t Sockets_Recv( SocketHandle xSocket,
     BaseType_t xRetVal;
     WIFI_Status_t xWiFiResult = WIFI_STATUS_OK;
     TickType_t xTimeOnEntering = xTaskGetTickCount(), xSemaphoreWait;
+    TickType_t xPollDelay = 1U;
+    size_t xRequestedLength = xReceiveBufferLength;
 
     /* Shortcut for easy access. */
     pxSecureSocket = &( xSockets[ ulSocketNumber ] );
 
+    /* The connection went with the link, even if the module kept the socket. */
+    if( pxSecureSocket->ulLinkLosses != Link_Losses() )
+    {
+        return SOCKETS_SOCKET_ERROR;
+    }
+
+    /* Hand out the byte read while waiting first, so the caller sees data in
+     * order. The caller asks again for the rest. */
+    if( ( pxSecureSocket->ucHasPeekedByte != 0U ) && ( xReceiveBufferLength > 0 ) )
+    {
+        pucReceiveBuffer[ 0 ] = pxSecureSocket->ucPeekedByte;
+        pxSecureSocket->ucHasPeekedByte = 0;
+        return 1;
+    }
+
     /* WiFi module does not support receiving more than ES_WIFI_PAYLOAD_SIZE
      * bytes at a time. */
     if( xReceiveBufferLength > ( uint32_t ) ES_WIFI_PAYLOAD_SIZE )
@@ -393,7 +688,7 @@ BaseType_t Sockets_Recv( SocketHandle xSocket,
     for( ; ; )
     {
         /* Try to acquire the semaphore. */
-        if( xSemaphoreTake( xWifiSemaphoreHandle, xSemaphoreWait ) == pdTRUE )
+        if( prvTakeModule( xSemaphoreWait ) == pdTRUE )
         {
             /* Receive the data. */
             xWiFiResult = WIFI_ReceiveData( ( uint8_t ) ulSocketNumber,
@@ -403,7 +698,7 @@ BaseType_t Sockets_Recv( SocketHandle xSocket,
                                             stsecuresocketsONE_MILLISECOND );
 
             /* Return the semaphore. */
-            ( void ) xSemaphoreGive( xWifiSemaphoreHandle );
+            prvGiveModule();
 
             if( ( xWiFiResult == WIFI_STATUS_OK ) && ( usReceivedBytes != 0 ) )
             {
@@ -421,7 +716,7 @@ BaseType_t Sockets_Recv( SocketHandle xSocket,
                      * with the board is polling, which would block other tasks, so
                      * block for a short while to allow other tasks to run before
                      * trying again. */
-                    vTaskDelay( stsecuresocketsFIVE_MILLISECONDS );
+                    prvPollDelay( &xPollDelay );
                 }
                 else
                 {
@@ -449,6 +744,29 @@ BaseType_t Sockets_Recv( SocketHandle xSocket,
         }
     }
 
+    /* Nothing came, which is also how a lost link looks. */
+    if( xRetVal == 0 )
+    {
+        prvCheckLink();
+
+        if( pxSecureSocket->ulLinkLosses != Link_Losses() )
+        {
+            xRetVal = SOCKETS_SOCKET_ERROR;
+        }
+    }
+
+    #if ( stsecuresocketsSTREAMING_RECV == 1 )
+        if( ( xRetVal > 0 ) && ( ( size_t ) usReceivedBytes == xReceiveBufferLength ) )
+        {
+            xRetVal += prvRecvFollowOn( ulSocketNumber,
+                                        &( pucReceiveBuffer[ xRetVal ] ),
+                                        xRequestedLength - ( size_t ) xRetVal,
+                                        xReceiveBufferLength );
+        }
+    #else
+        ( void ) xRequestedLength;
+    #endif /* stsecuresocketsSTREAMING_RECV == 1 */
+
     /* The following code attempts to revive the Inventek WiFi module
      * from its unusable state.*/
     if( xWiFiResult == WIFI_STATUS_ERROR )
@@ -459,14 +777,14 @@ BaseType_t Sockets_Recv( SocketHandle xSocket,
         if( WIFI_ResetModule() == WIFI_STATUS_OK )
         {
             /* Try to acquire the semaphore. */
-            if( xSemaphoreTake( xWifiSemaphoreHandle, portMAX_DELAY ) == pdTRUE )
+            if( prvTakeModule( portMAX_DELAY ) == pdTRUE )
             {
                 /* Reinitialize the socket structures which
                  * marks all sockets as closed and free. */
                 Sockets_Init();
 
                 /* Return the semaphore. */
-                ( void ) xSemaphoreGive( xWifiSemaphoreHandle );
+                prvGiveModule();
             }
 
             /* Set the error code to indicate that
@@ -479,6 +797,76 @@ BaseType_t Sockets_Recv( SocketHandle xSocket,
 }
 /*-----------------------------------------------------------*/
 
+BaseType_t Sockets_WaitReadable( SocketHandle xSocket,
+                                 TickType_t xTimeout )
+{
+    uint32_t ulSocketNumber = ( uint32_t ) xSocket;
+    STSecureSocket_t * pxSecureSocket;
+    uint16_t usReceivedBytes = 0;
+    BaseType_t xRetVal = 0;
+    WIFI_Status_t xWiFiResult;
+    TickType_t xTimeOnEntering = xTaskGetTickCount();
+    TickType_t xPollDelay = 1U;
+
+    /* Shortcut for easy access. */
+    pxSecureSocket = &( xSockets[ ulSocketNumber ] );
+
+    /* The module cannot report pending data without reading it, so a single
+     * byte is read and kept for the next Sockets_Recv(). */
+    while( pxSecureSocket->ucHasPeekedByte == 0U )
+    {
+        if( prvTakeModule( xTimeout + stsecuresocketsFIVE_MILLISECONDS ) != pdTRUE )
+        {
+            break;
+        }
+
+        xWiFiResult = WIFI_ReceiveData( ( uint8_t ) ulSocketNumber,
+                                        &( pxSecureSocket->ucPeekedByte ),
+                                        1,
+                                        &( usReceivedBytes ),
+                                        stsecuresocketsONE_MILLISECOND );
+
+        prvGiveModule();
+
+        if( ( xWiFiResult == WIFI_STATUS_OK ) && ( usReceivedBytes != 0 ) )
+        {
+            pxSecureSocket->ucHasPeekedByte = 1;
+        }
+        else if( ( xWiFiResult != WIFI_STATUS_TIMEOUT ) && ( xWiFiResult != WIFI_STATUS_OK ) )
+        {
+            xRetVal = SOCKETS_SOCKET_ERROR;
+            break;
+        }
+        else if( ( xTaskGetTickCount() - xTimeOnEntering ) < xTimeout )
+        {
+            /* Let other tasks run between polls of the module. */
+            prvPollDelay( &xPollDelay );
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    if( pxSecureSocket->ucHasPeekedByte != 0U )
+    {
+        xRetVal = 1;
+    }
+
+    return xRetVal;
+}
+/*-----------------------------------------------------------*/
+
+BaseType_t Sockets_RecvAvailable( SocketHandle xSocket )
+{
+    uint32_t ulSocketNumber = ( uint32_t ) xSocket;
+
+    /* The ES-WiFi module cannot be queried for pending data without
+     * reading it; only a byte kept by Sockets_WaitReadable() is known. */
+    return ( BaseType_t ) xSockets[ ulSocketNumber ].ucHasPeekedByte;
+}
+/*-----------------------------------------------------------*/
+
 BaseType_t Sockets_Send( SocketHandle xSocket,
                          const uint8_t * pucData,
                          size_t xDataLength )
@@ -492,8 +880,14 @@ BaseType_t Sockets_Send( SocketHandle xSocket,
     /* Shortcut for easy access. */
     pxSecureSocket = &( xSockets[ ulSocketNumber ] );
 
-    /* Try to acquire the semaphore. */
-    if( xSemaphoreTake( xWifiSemaphoreHandle, xSemaphoreWaitTicks ) == pdTRUE )
+    if( pxSecureSocket->ulLinkLosses != Link_Losses() )
+    {
+        return SOCKETS_SOCKET_ERROR;
+    }
+
+    /* Wait no longer for the module than the send itself may take, so a
+     * stalled socket cannot hold up this one for the full module timeout. */
+    if( prvTakeModule( pxSecureSocket->ulSendTimeout + stsecuresocketsFIVE_MILLISECONDS ) == pdTRUE )
     {
         /* Send the data. */
         xWiFiResult = WIFI_SendData( ( uint8_t ) ulSocketNumber,
@@ -510,7 +904,14 @@ BaseType_t Sockets_Send( SocketHandle xSocket,
         }
 
         /* Return the semaphore. */
-        ( void ) xSemaphoreGive( xWifiSemaphoreHandle );
+        prvGiveModule();
+    }
+    else
+    {
+        /* Another socket holds the module, which may take seconds while it
+         * joins the network or resolves a name. Like a send that timed out,
+         * nothing was sent and the caller may try again. */
+        xRetVal = 0;
     }
 
     /* The following code attempts to revive the Inventek WiFi module
@@ -523,14 +924,14 @@ BaseType_t Sockets_Send( SocketHandle xSocket,
         if( WIFI_ResetModule() == WIFI_STATUS_OK )
         {
             /* Try to acquire the semaphore. */
-            if( xSemaphoreTake( xWifiSemaphoreHandle, portMAX_DELAY ) == pdTRUE )
+            if( prvTakeModule( portMAX_DELAY ) == pdTRUE )
             {
                 /* Reinitialize the socket structures which
                  * marks all sockets as closed and free. */
                 Sockets_Init();
 
                 /* Return the semaphore. */
-                ( void ) xSemaphoreGive( xWifiSemaphoreHandle );
+                prvGiveModule();
             }
 
             /* Set the error code to indicate that
@@ -539,13 +940,6 @@ BaseType_t Sockets_Send( SocketHandle xSocket,
         }
     }
 
-    /* To allow other tasks of equal priority that are using this API to run as
-     * a switch to an equal priority task that is waiting for the mutex will
-     * only otherwise occur in the tick interrupt - at which point the mutex
-     * might have been taken again by the currently running task.
-     */
-    taskYIELD();
-
     return xRetVal;
 }
 /*-----------------------------------------------------------*/
@@ -579,6 +973,24 @@ int32_t Sockets_SetSockOpt( SocketHandle xSocket,
                 xRetVal = SOCKETS_ERROR_NONE;
                 break;
 
+            case stsecuresocketsSO_REQUIRE_TLS:
+                pxSecureSocket->ulFlags |= stsecuresocketsSOCKET_SECURE_FLAG;
+                xRetVal = SOCKETS_ERROR_NONE;
+                break;
+
+            case stsecuresocketsSO_TRUSTED_SERVER_CERTIFICATE:
+                xRetVal = prvStoreRootCa( ( const uint8_t * ) pvOptionValue, xOptionLength );
+                break;
+
+            case SOCKETS_SO_NODELAY:
+            case SOCKETS_SO_KEEPALIVE:
+            case SOCKETS_SO_SNDBUF:
+            case SOCKETS_SO_RCVBUF:
+                /* The TCP stack runs on the Inventek module, whose driver
+                 * exposes none of these options. */
+                xRetVal = SOCKETS_ENOPROTOOPT;
+                break;
+
             default:
                 xRetVal = SOCKETS_ENOPROTOOPT;
                 break;
@@ -588,3 +1000,95 @@ int32_t Sockets_SetSockOpt( SocketHandle xSocket,
     return xRetVal;
 }
 /*-----------------------------------------------------------*/
+
+BaseType_t Sockets_UdpExchange( const char * pcHostName,
+                                uint16_t usPort,
+                                const uint8_t * pucRequest,
+                                size_t xRequestLength,
+                                uint8_t * pucResponse,
+                                size_t xResponseSize,
+                                size_t * pxResponseLength,
+                                uint32_t ulTimeoutMs )
+{
+    uint32_t ulSocketNumber;
+    uint32_t ulIPAddres;
+    uint16_t usSentBytes = 0;
+    uint16_t usReceivedBytes = 0;
+    WIFI_Status_t xWiFiResult;
+    TickType_t xStart;
+    TickType_t xPollDelay = 1U;
+    BaseType_t xOpened = pdFALSE;
+    BaseType_t xWaiting = pdFALSE;
+    BaseType_t xRetVal = SOCKETS_SOCKET_ERROR;
+
+    if( ( xRequestLength > ( size_t ) ES_WIFI_PAYLOAD_SIZE ) || ( xResponseSize > ( size_t ) ES_WIFI_PAYLOAD_SIZE ) )
+    {
+        return SOCKETS_EINVAL;
+    }
+
+    /* Taken from the pool, so the module socket is not one of a TCP socket. */
+    ulSocketNumber = prvGetFreeSocket();
+
+    if( prvIsValidSocket( ulSocketNumber ) == pdFALSE )
+    {
+        return SOCKETS_ENOMEM;
+    }
+
+    ulIPAddres = prvGetHostByName( pcHostName );
+
+    if( ( ulIPAddres != 0 ) && ( prvTakeModule( xSemaphoreWaitTicks ) == pdTRUE ) )
+    {
+        xOpened = ( WIFI_OpenClientConnection( ulSocketNumber, WIFI_UDP_PROTOCOL, NULL,
+                                               ( uint8_t * ) &ulIPAddres, usPort, 0 ) == WIFI_STATUS_OK ) ? pdTRUE : pdFALSE;
+
+        if( ( xOpened == pdTRUE ) &&
+            ( WIFI_SendData( ( uint8_t ) ulSocketNumber, ( uint8_t * ) pucRequest, ( uint16_t ) xRequestLength,
+                             &usSentBytes, stsecuresocketsMAX_TIMEOUT ) == WIFI_STATUS_OK ) &&
+            ( usSentBytes == xRequestLength ) )
+        {
+            xWaiting = pdTRUE;
+        }
+
+        prvGiveModule();
+    }
+
+    /* The module is polled for the datagram as Sockets_Recv() does, so the
+     * sockets of the samples keep it in between. */
+    xStart = xTaskGetTickCount();
+
+    while( ( xWaiting == pdTRUE ) && ( ( xTaskGetTickCount() - xStart ) < pdMS_TO_TICKS( ulTimeoutMs ) ) )
+    {
+        if( prvTakeModule( xSemaphoreWaitTicks ) == pdTRUE )
+        {
+            xWiFiResult = WIFI_ReceiveData( ( uint8_t ) ulSocketNumber, pucResponse, ( uint16_t ) xResponseSize,
+                                            &usReceivedBytes, stsecuresocketsONE_MILLISECOND );
+            prvGiveModule();
+
+            if( ( xWiFiResult == WIFI_STATUS_OK ) && ( usReceivedBytes != 0 ) )
+            {
+                *pxResponseLength = usReceivedBytes;
+                xRetVal = SOCKETS_ERROR_NONE;
+                xWaiting = pdFALSE;
+            }
+            else if( ( xWiFiResult != WIFI_STATUS_OK ) && ( xWiFiResult != WIFI_STATUS_TIMEOUT ) )
+            {
+                xWaiting = pdFALSE;
+            }
+            else
+            {
+                prvPollDelay( &xPollDelay );
+            }
+        }
+    }
+
+    if( ( xOpened == pdTRUE ) && ( prvTakeModule( xSemaphoreWaitTicks ) == pdTRUE ) )
+    {
+        WIFI_CloseClientConnection( ulSocketNumber );
+        prvGiveModule();
+    }
+
+    prvReturnSocket( ulSocketNumber );
+
+    return xRetVal;
+}
+/*-----------------------------------------------------------*/
@@ -0,0 +1,65 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @file sockets_wrapper_stm32l475.h
+ *
+ * @brief Options of the sockets of the Inventek module, beyond the ones of
+ * sockets_wrapper.h.
+ *
+ * The module can run TLS itself, checking the server against a root CA it
+ * keeps, so the sockets then carry the plaintext of the connection.
+ */
+
+#ifndef SOCKETS_WRAPPER_STM32L475_H
+#define SOCKETS_WRAPPER_STM32L475_H
+
+#include "sockets_wrapper.h"
+
+/**
+ * @brief Connect with the TLS of the module. Set before connecting, no value.
+ */
+#define stsecuresocketsSO_REQUIRE_TLS                   ( 100 )
+
+/**
+ * @brief Root CA the module checks TLS servers against, in PEM, the length of
+ * the option being its size.
+ *
+ * The module keeps the CA for all the sockets. It is written to the module
+ * the first time it is given, and again only when another one is, so the
+ * buffer must stay valid and unchanged.
+ */
+#define stsecuresocketsSO_TRUSTED_SERVER_CERTIFICATE    ( 101 )
+
+/**
+ * @brief Largest root CA the module takes, its length being sent in 4 digits.
+ */
+#define stsecuresocketsMAX_ROOT_CA_SIZE                 ( 9999U )
+
+/**
+ * @brief Send one UDP datagram to a server and wait for its answer, on a
+ * socket of the module taken from the pool of the TCP sockets.
+ *
+ * The sockets of the wrapper are streams only, which is enough for the
+ * samples, and a datagram exchange such as an SNTP query needs no more.
+ *
+ * @param[in] pcHostName The server, resolved by the module.
+ * @param[in] usPort Its UDP port.
+ * @param[in] pucRequest The datagram.
+ * @param[in] xRequestLength Length of \p pucRequest, up to ES_WIFI_PAYLOAD_SIZE.
+ * @param[out] pucResponse Buffer for the answer.
+ * @param[in] xResponseSize Size of \p pucResponse, up to ES_WIFI_PAYLOAD_SIZE.
+ * @param[out] pxResponseLength Length of the answer.
+ * @param[in] ulTimeoutMs Longest wait for the answer.
+ * @return SOCKETS_ERROR_NONE on success, or a negative error code.
+ */
+BaseType_t Sockets_UdpExchange( const char * pcHostName,
+                                uint16_t usPort,
+                                const uint8_t * pucRequest,
+                                size_t xRequestLength,
+                                uint8_t * pucResponse,
+                                size_t xResponseSize,
+                                size_t * pxResponseLength,
+                                uint32_t ulTimeoutMs );
+
+#endif /* SOCKETS_WRAPPER_STM32L475_H */
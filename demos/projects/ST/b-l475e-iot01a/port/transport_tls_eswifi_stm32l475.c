@@ -0,0 +1,302 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @file transport_tls_eswifi_stm32l475.c
+ * @brief TLS transport interface implementations. This implementation runs
+ * TLS on the Inventek ES-WiFi module.
+ *
+ * The module does the handshake and the records itself, checking the server
+ * against the root CA written to it once, so no TLS stack runs on the MCU and
+ * the receives and sends are those of its sockets. The module authenticates
+ * the server only: client certificates, ALPN and session resumption are not
+ * offered, and the server name it sends, if any, is up to its firmware.
+ */
+
+/* Include header that defines log levels. */
+#include "logging_levels.h"
+
+/* Logging configuration for the Sockets. */
+#ifndef LIBRARY_LOG_NAME
+    #define LIBRARY_LOG_NAME     "TlsTransport"
+#endif
+#ifndef LIBRARY_LOG_LEVEL
+    #define LIBRARY_LOG_LEVEL    LOG_ERROR
+#endif
+
+/* Prototype for the function used to print to console on Windows simulator
+ * of FreeRTOS.
+ * The function prints to the console before the network is connected;
+ * then a UDP port after the network has connected. */
+extern void vLoggingPrintf( const char * pcFormatString,
+                            ... );
+
+/* Map the SdkLog macro to the logging function to enable logging
+ * on Windows simulator. */
+#ifndef SdkLog
+    #define SdkLog( message )    vLoggingPrintf message
+#endif
+
+#include "logging_stack.h"
+
+/************ End of logging configuration ****************/
+
+/* FreeRTOS includes. */
+#include "FreeRTOS.h"
+#include "task.h"
+
+/* TLS transport header. */
+#include "transport_tls_socket.h"
+
+/* Sockets of the module, and their TLS options. */
+#include "sockets_wrapper.h"
+#include "sockets_wrapper_stm32l475.h"
+
+/*-----------------------------------------------------------*/
+
+/* Each transport defines the same NetworkContext. The user then passes their respective transport */
+/* as pParams for the transport which is defined in the transport header file */
+/* (here it's TlsTransportParams_t) */
+struct NetworkContext
+{
+    /* TlsTransportParams_t */
+    void * pParams;
+};
+
+/*-----------------------------------------------------------*/
+
+TlsTransportStatus_t TLS_Socket_Connect( NetworkContext_t * pxNetworkContext,
+                                         const char * pcHostName,
+                                         uint16_t usPort,
+                                         const NetworkCredentials_t * pxNetworkCredentials,
+                                         uint32_t ulReceiveTimeoutMs,
+                                         uint32_t ulSendTimeoutMs )
+{
+    TlsTransportParams_t * pxTlsTransportParams = NULL;
+    TlsTransportStatus_t xRetVal = eTLSTransportSuccess;
+    BaseType_t xSocketStatus = 0;
+    TickType_t xRecvTimeout = pdMS_TO_TICKS( ulReceiveTimeoutMs );
+    TickType_t xSendTimeout = pdMS_TO_TICKS( ulSendTimeoutMs );
+    TickType_t xConnectStart = xTaskGetTickCount();
+    TickType_t xResolveTime;
+
+    if( ( pxNetworkContext == NULL ) ||
+        ( pxNetworkContext->pParams == NULL ) ||
+        ( pcHostName == NULL ) ||
+        ( pxNetworkCredentials == NULL ) )
+    {
+        LogError( ( "Invalid input parameter(s): Arguments cannot be NULL. pxNetworkContext=%p, "
+                    "pcHostName=%p, pxNetworkCredentials=%p.",
+                    pxNetworkContext,
+                    pcHostName,
+                    pxNetworkCredentials ) );
+        return eTLSTransportInvalidParameter;
+    }
+
+    if( pxNetworkCredentials->pucRootCa == NULL )
+    {
+        LogError( ( "pucRootCa cannot be NULL." ) );
+        return eTLSTransportInvalidParameter;
+    }
+
+    if( ( pxNetworkCredentials->pucClientCert != NULL ) ||
+        ( pxNetworkCredentials->pvParsedClientCert != NULL ) )
+    {
+        LogError( ( "The TLS of the module does not authenticate with a client certificate." ) );
+        return eTLSTransportInvalidCredentials;
+    }
+
+    pxTlsTransportParams = ( TlsTransportParams_t * ) pxNetworkContext->pParams;
+    pxTlsTransportParams->xSSLContext = NULL;
+
+    if( ( pxTlsTransportParams->xTCPSocket = Sockets_Open() ) == SOCKETS_INVALID_SOCKET )
+    {
+        LogError( ( "Failed to open socket." ) );
+        return eTLSTransportConnectFailure;
+    }
+
+    if( ( xSocketStatus = Sockets_SetSockOpt( pxTlsTransportParams->xTCPSocket,
+                                              SOCKETS_SO_RCVTIMEO,
+                                              &xRecvTimeout,
+                                              sizeof( xRecvTimeout ) ) ) != 0 )
+    {
+        LogError( ( "Failed to set receive timeout on socket %d.", xSocketStatus ) );
+        xRetVal = eTLSTransportInternalError;
+    }
+    else if( ( xSocketStatus = Sockets_SetSockOpt( pxTlsTransportParams->xTCPSocket,
+                                                   SOCKETS_SO_SNDTIMEO,
+                                                   &xSendTimeout,
+                                                   sizeof( xSendTimeout ) ) ) != 0 )
+    {
+        LogError( ( "Failed to set send timeout on socket %d.", xSocketStatus ) );
+        xRetVal = eTLSTransportInternalError;
+    }
+    else if( ( xSocketStatus = Sockets_SetSockOpt( pxTlsTransportParams->xTCPSocket,
+                                                   stsecuresocketsSO_TRUSTED_SERVER_CERTIFICATE,
+                                                   pxNetworkCredentials->pucRootCa,
+                                                   pxNetworkCredentials->xRootCaSize ) ) != 0 )
+    {
+        LogError( ( "Failed to write the root CA to the module %d.", xSocketStatus ) );
+        xRetVal = eTLSTransportInvalidCredentials;
+    }
+    else if( ( xSocketStatus = Sockets_SetSockOpt( pxTlsTransportParams->xTCPSocket,
+                                                   stsecuresocketsSO_REQUIRE_TLS,
+                                                   NULL, 0 ) ) != 0 )
+    {
+        LogError( ( "Failed to require TLS on socket %d.", xSocketStatus ) );
+        xRetVal = eTLSTransportInternalError;
+    }
+    /* The module connects and completes the handshake in one command, so a
+     * server it does not trust fails the connect. */
+    else if( ( xSocketStatus = Sockets_Connect( pxTlsTransportParams->xTCPSocket,
+                                                pcHostName,
+                                                usPort ) ) != 0 )
+    {
+        LogError( ( "Failed to connect to %s with error %d.",
+                    pcHostName,
+                    xSocketStatus ) );
+        xRetVal = eTLSTransportConnectFailure;
+    }
+    else if( pxTlsTransportParams->pxStats != NULL )
+    {
+        /* The handshake is in the connect, and takes no heap of the MCU. */
+        xResolveTime = Sockets_GetLastResolveTime();
+        pxTlsTransportParams->pxStats->ulDnsTimeMs = ( uint32_t ) ( xResolveTime * portTICK_PERIOD_MS );
+        pxTlsTransportParams->pxStats->ulConnectTimeMs =
+            ( uint32_t ) ( ( xTaskGetTickCount() - xConnectStart - xResolveTime ) * portTICK_PERIOD_MS );
+        pxTlsTransportParams->pxStats->ulHandshakeTimeMs = 0;
+        pxTlsTransportParams->pxStats->ulSessionResumed = 0;
+        pxTlsTransportParams->pxStats->xHandshakePeakHeap = 0;
+    }
+
+    if( xRetVal != eTLSTransportSuccess )
+    {
+        Sockets_Disconnect( pxTlsTransportParams->xTCPSocket );
+        ( void ) Sockets_Close( pxTlsTransportParams->xTCPSocket );
+        pxTlsTransportParams->xTCPSocket = SOCKETS_INVALID_SOCKET;
+    }
+    else
+    {
+        LogInfo( ( "(Network connection %p) Connection to %s established with the TLS of the module.",
+                   pxNetworkContext,
+                   pcHostName ) );
+    }
+
+    return xRetVal;
+}
+/*-----------------------------------------------------------*/
+
+void TLS_Socket_Disconnect( NetworkContext_t * pxNetworkContext )
+{
+    TlsTransportParams_t * pxTlsTransportParams;
+
+    if( ( pxNetworkContext == NULL ) || ( pxNetworkContext->pParams == NULL ) )
+    {
+        return;
+    }
+
+    pxTlsTransportParams = ( TlsTransportParams_t * ) pxNetworkContext->pParams;
+
+    /* Closing the socket of the module ends its TLS session as well. */
+    if( pxTlsTransportParams->xTCPSocket != SOCKETS_INVALID_SOCKET )
+    {
+        Sockets_Disconnect( pxTlsTransportParams->xTCPSocket );
+        ( void ) Sockets_Close( pxTlsTransportParams->xTCPSocket );
+        pxTlsTransportParams->xTCPSocket = SOCKETS_INVALID_SOCKET;
+    }
+}
+/*-----------------------------------------------------------*/
+
+void TLS_Socket_SessionCacheClear( TlsSessionCache_t * pxSessionCache )
+{
+    uint32_t ulIndex;
+
+    if( pxSessionCache == NULL )
+    {
+        return;
+    }
+
+    /* No session is saved, the module always doing a full handshake. */
+    for( ulIndex = 0; ulIndex < transporttlsSESSION_CACHE_ENTRIES; ulIndex++ )
+    {
+        pxSessionCache->xEntries[ ulIndex ].pvSession = NULL;
+        pxSessionCache->xEntries[ ulIndex ].cHostName[ 0 ] = '\0';
+    }
+}
+/*-----------------------------------------------------------*/
+
+void TLS_Socket_SharedConfigFree( TlsSharedConfig_t * pxSharedConfig )
+{
+    /* The module keeps the configuration, so nothing is set up to share. */
+    if( pxSharedConfig != NULL )
+    {
+        pxSharedConfig->pvConfig = NULL;
+    }
+}
+/*-----------------------------------------------------------*/
+
+int32_t TLS_Socket_Recv( NetworkContext_t * pxNetworkContext,
+                         void * pvBuffer,
+                         size_t xBytesToRecv )
+{
+    TlsTransportParams_t * pxTlsTransportParams = NULL;
+    int32_t lResult;
+
+    configASSERT( ( pxNetworkContext != NULL ) &&
+                  ( pxNetworkContext->pParams != NULL ) );
+
+    pxTlsTransportParams = ( TlsTransportParams_t * ) pxNetworkContext->pParams;
+
+    lResult = ( int32_t ) Sockets_Recv( pxTlsTransportParams->xTCPSocket,
+                                        pvBuffer,
+                                        xBytesToRecv );
+
+    if( pxTlsTransportParams->pxStats != NULL )
+    {
+        if( lResult > 0 )
+        {
+            pxTlsTransportParams->pxStats->ulBytesReceived += ( uint32_t ) lResult;
+            pxTlsTransportParams->pxStats->ulRecordsReceived++;
+        }
+        else if( lResult == 0 )
+        {
+            pxTlsTransportParams->pxStats->ulTimeouts++;
+        }
+    }
+
+    return lResult;
+}
+/*-----------------------------------------------------------*/
+
+int32_t TLS_Socket_Send( NetworkContext_t * pxNetworkContext,
+                         const void * pvBuffer,
+                         size_t xBytesToSend )
+{
+    TlsTransportParams_t * pxTlsTransportParams = NULL;
+    int32_t lResult;
+
+    configASSERT( ( pxNetworkContext != NULL ) &&
+                  ( pxNetworkContext->pParams != NULL ) );
+
+    pxTlsTransportParams = ( TlsTransportParams_t * ) pxNetworkContext->pParams;
+
+    lResult = ( int32_t ) Sockets_Send( pxTlsTransportParams->xTCPSocket,
+                                        pvBuffer,
+                                        xBytesToSend );
+
+    if( pxTlsTransportParams->pxStats != NULL )
+    {
+        if( lResult > 0 )
+        {
+            pxTlsTransportParams->pxStats->ulBytesSent += ( uint32_t ) lResult;
+            pxTlsTransportParams->pxStats->ulRecordsSent++;
+        }
+        else if( lResult == 0 )
+        {
+            pxTlsTransportParams->pxStats->ulTimeouts++;
+        }
+    }
+
+    return lResult;
+}
+/*-----------------------------------------------------------*/
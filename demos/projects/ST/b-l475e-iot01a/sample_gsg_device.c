@@ -23,6 +23,9 @@
 /* Azure JSON includes */
 #include "azure_iot_json_writer.h"
 
+/* Report-by-exception of the telemetry fields. */
+#include "azure_sample_telemetry_filter.h"
+
 #define samplegsgdeviceTELEMETRY_HUMIDITY          ( "humidity" )
 #define samplegsgdeviceTELEMETRY_TEMPERATURE       ( "temperature" )
 #define samplegsgdeviceTELEMETRY_PRESSURE          ( "pressure" )
@@ -57,77 +60,105 @@ typedef enum TelemetryStateType_t
 } TelemetryStateType_t;
 
 static TelemetryStateType_t xTelemetryState = eTelemetryStateTypeDefault;
+
+/* The fields of the telemetry with their default deadbands, in the units
+ * sent, in the order of the indexes below. The magnetometer is in mgauss,
+ * the accelerometer in mg and the gyroscope in mdps. */
+static TelemetryFilterField_t xTelemetryFields[] =
+{
+    telemetryfilterFIELD( samplegsgdeviceTELEMETRY_TEMPERATURE, 0.2 ),
+    telemetryfilterFIELD( samplegsgdeviceTELEMETRY_HUMIDITY, 1.0 ),
+    telemetryfilterFIELD( samplegsgdeviceTELEMETRY_PRESSURE, 0.5 ),
+    telemetryfilterFIELD( samplegsgdeviceTELEMETRY_MAGNETOMETERX, 20.0 ),
+    telemetryfilterFIELD( samplegsgdeviceTELEMETRY_MAGNETOMETERY, 20.0 ),
+    telemetryfilterFIELD( samplegsgdeviceTELEMETRY_MAGNETOMETERZ, 20.0 ),
+    telemetryfilterFIELD( samplegsgdeviceTELEMETRY_ACCELEROMETERX, 50.0 ),
+    telemetryfilterFIELD( samplegsgdeviceTELEMETRY_ACCELEROMETERY, 50.0 ),
+    telemetryfilterFIELD( samplegsgdeviceTELEMETRY_ACCELEROMETERZ, 50.0 ),
+    telemetryfilterFIELD( samplegsgdeviceTELEMETRY_GYROSCOPEX, 1000.0 ),
+    telemetryfilterFIELD( samplegsgdeviceTELEMETRY_GYROSCOPEY, 1000.0 ),
+    telemetryfilterFIELD( samplegsgdeviceTELEMETRY_GYROSCOPEZ, 1000.0 )
+};
+
+#define samplegsgdeviceFIELD_TEMPERATURE       0
+#define samplegsgdeviceFIELD_HUMIDITY          1
+#define samplegsgdeviceFIELD_PRESSURE          2
+#define samplegsgdeviceFIELD_MAGNETOMETERX     3
+#define samplegsgdeviceFIELD_MAGNETOMETERY     4
+#define samplegsgdeviceFIELD_MAGNETOMETERZ     5
+#define samplegsgdeviceFIELD_ACCELEROMETERX    6
+#define samplegsgdeviceFIELD_ACCELEROMETERY    7
+#define samplegsgdeviceFIELD_ACCELEROMETERZ    8
+#define samplegsgdeviceFIELD_GYROSCOPEX        9
+#define samplegsgdeviceFIELD_GYROSCOPEY        10
+#define samplegsgdeviceFIELD_GYROSCOPEZ        11
+
+TelemetryFilter_t xTelemetryFilter = telemetryfilterINIT( xTelemetryFields, democonfigTELEMETRY_HEARTBEAT_SECS );
 /*-----------------------------------------------------------*/
 
-static void prvCreateTelemetryDevice( AzureIoTJSONWriter_t * xWriter )
+/* Writes a field if the filter lets it through. */
+static void prvAppendField( AzureIoTJSONWriter_t * xWriter,
+                            uint32_t ulIndex,
+                            double xValue,
+                            uint16_t usFractionalDigits )
 {
     AzureIoTResult_t xResult;
+
+    if( TelemetryFilter_Check( &xTelemetryFilter, ulIndex, xValue ) )
+    {
+        xResult = AzureIoTJSONWriter_AppendPropertyWithDoubleValue( xWriter, xTelemetryFields[ ulIndex ].pucName,
+                                                                    xTelemetryFields[ ulIndex ].ulNameLength,
+                                                                    xValue, usFractionalDigits );
+        configASSERT( xResult == eAzureIoTSuccess );
+    }
+}
+/*-----------------------------------------------------------*/
+
+static void prvCreateTelemetryDevice( AzureIoTJSONWriter_t * xWriter )
+{
     float xTemperature = BSP_TSENSOR_ReadTemp();
     float xHumidity = BSP_HSENSOR_ReadHumidity();
     float xPressure = BSP_PSENSOR_ReadPressure();
 
-    xResult = AzureIoTJSONWriter_AppendPropertyWithDoubleValue( xWriter, ( uint8_t * ) samplegsgdeviceTELEMETRY_TEMPERATURE, sizeof( samplegsgdeviceTELEMETRY_TEMPERATURE ) - 1, xTemperature, 2 );
-    configASSERT( xResult == eAzureIoTSuccess );
-
-    xResult = AzureIoTJSONWriter_AppendPropertyWithDoubleValue( xWriter, ( uint8_t * ) samplegsgdeviceTELEMETRY_HUMIDITY, sizeof( samplegsgdeviceTELEMETRY_HUMIDITY ) - 1, xHumidity, 2 );
-    configASSERT( xResult == eAzureIoTSuccess );
-
-    xResult = AzureIoTJSONWriter_AppendPropertyWithDoubleValue( xWriter, ( uint8_t * ) samplegsgdeviceTELEMETRY_PRESSURE, sizeof( samplegsgdeviceTELEMETRY_PRESSURE ) - 1, xPressure, 2 );
-    configASSERT( xResult == eAzureIoTSuccess );
+    prvAppendField( xWriter, samplegsgdeviceFIELD_TEMPERATURE, xTemperature, 2 );
+    prvAppendField( xWriter, samplegsgdeviceFIELD_HUMIDITY, xHumidity, 2 );
+    prvAppendField( xWriter, samplegsgdeviceFIELD_PRESSURE, xPressure, 2 );
 }
 /*-----------------------------------------------------------*/
 
 static void prvCreateTelemetryMagnetometer( AzureIoTJSONWriter_t * xWriter )
 {
-    AzureIoTResult_t xResult;
     int16_t usMagnetometer[ 3 ];
 
     BSP_MAGNETO_GetXYZ( usMagnetometer );
 
-    xResult = AzureIoTJSONWriter_AppendPropertyWithDoubleValue( xWriter, ( uint8_t * ) samplegsgdeviceTELEMETRY_MAGNETOMETERX, sizeof( samplegsgdeviceTELEMETRY_MAGNETOMETERX ) - 1, usMagnetometer[ 0 ], 0 );
-    configASSERT( xResult == eAzureIoTSuccess );
-
-    xResult = AzureIoTJSONWriter_AppendPropertyWithDoubleValue( xWriter, ( uint8_t * ) samplegsgdeviceTELEMETRY_MAGNETOMETERY, sizeof( samplegsgdeviceTELEMETRY_MAGNETOMETERY ) - 1, usMagnetometer[ 1 ], 0 );
-    configASSERT( xResult == eAzureIoTSuccess );
-
-    xResult = AzureIoTJSONWriter_AppendPropertyWithDoubleValue( xWriter, ( uint8_t * ) samplegsgdeviceTELEMETRY_MAGNETOMETERZ, sizeof( samplegsgdeviceTELEMETRY_MAGNETOMETERZ ) - 1, usMagnetometer[ 2 ], 0 );
-    configASSERT( xResult == eAzureIoTSuccess );
+    prvAppendField( xWriter, samplegsgdeviceFIELD_MAGNETOMETERX, usMagnetometer[ 0 ], 0 );
+    prvAppendField( xWriter, samplegsgdeviceFIELD_MAGNETOMETERY, usMagnetometer[ 1 ], 0 );
+    prvAppendField( xWriter, samplegsgdeviceFIELD_MAGNETOMETERZ, usMagnetometer[ 2 ], 0 );
 }
 /*-----------------------------------------------------------*/
 
 static void prvCreateTelemetryAccelerometer( AzureIoTJSONWriter_t * xWriter )
 {
-    AzureIoTResult_t xResult;
     int16_t usAccelerometer[ 3 ];
 
     BSP_ACCELERO_AccGetXYZ( usAccelerometer );
 
-    xResult = AzureIoTJSONWriter_AppendPropertyWithDoubleValue( xWriter, ( uint8_t * ) samplegsgdeviceTELEMETRY_ACCELEROMETERX, sizeof( samplegsgdeviceTELEMETRY_ACCELEROMETERX ) - 1, usAccelerometer[ 0 ], 0 );
-    configASSERT( xResult == eAzureIoTSuccess );
-
-    xResult = AzureIoTJSONWriter_AppendPropertyWithDoubleValue( xWriter, ( uint8_t * ) samplegsgdeviceTELEMETRY_ACCELEROMETERY, sizeof( samplegsgdeviceTELEMETRY_ACCELEROMETERY ) - 1, usAccelerometer[ 1 ], 0 );
-    configASSERT( xResult == eAzureIoTSuccess );
-
-    xResult = AzureIoTJSONWriter_AppendPropertyWithDoubleValue( xWriter, ( uint8_t * ) samplegsgdeviceTELEMETRY_ACCELEROMETERZ, sizeof( samplegsgdeviceTELEMETRY_ACCELEROMETERZ ) - 1, usAccelerometer[ 2 ], 0 );
-    configASSERT( xResult == eAzureIoTSuccess );
+    prvAppendField( xWriter, samplegsgdeviceFIELD_ACCELEROMETERX, usAccelerometer[ 0 ], 0 );
+    prvAppendField( xWriter, samplegsgdeviceFIELD_ACCELEROMETERY, usAccelerometer[ 1 ], 0 );
+    prvAppendField( xWriter, samplegsgdeviceFIELD_ACCELEROMETERZ, usAccelerometer[ 2 ], 0 );
 }
 /*-----------------------------------------------------------*/
 
 static void prvCreateTelemetryGyroscope( AzureIoTJSONWriter_t * xWriter )
 {
-    AzureIoTResult_t xResult;
     float xGyroscope[ 3 ];
 
     BSP_GYRO_GetXYZ( xGyroscope );
 
-    xResult = AzureIoTJSONWriter_AppendPropertyWithDoubleValue( xWriter, ( uint8_t * ) samplegsgdeviceTELEMETRY_GYROSCOPEX, sizeof( samplegsgdeviceTELEMETRY_GYROSCOPEX ) - 1, xGyroscope[ 0 ], 2 );
-    configASSERT( xResult == eAzureIoTSuccess );
-
-    xResult = AzureIoTJSONWriter_AppendPropertyWithDoubleValue( xWriter, ( uint8_t * ) samplegsgdeviceTELEMETRY_GYROSCOPEY, sizeof( samplegsgdeviceTELEMETRY_GYROSCOPEY ) - 1, xGyroscope[ 1 ], 2 );
-    configASSERT( xResult == eAzureIoTSuccess );
-
-    xResult = AzureIoTJSONWriter_AppendPropertyWithDoubleValue( xWriter, ( uint8_t * ) samplegsgdeviceTELEMETRY_GYROSCOPEZ, sizeof( samplegsgdeviceTELEMETRY_GYROSCOPEZ ) - 1, xGyroscope[ 2 ], 2 );
-    configASSERT( xResult == eAzureIoTSuccess );
+    prvAppendField( xWriter, samplegsgdeviceFIELD_GYROSCOPEX, xGyroscope[ 0 ], 2 );
+    prvAppendField( xWriter, samplegsgdeviceFIELD_GYROSCOPEY, xGyroscope[ 1 ], 2 );
+    prvAppendField( xWriter, samplegsgdeviceFIELD_GYROSCOPEZ, xGyroscope[ 2 ], 2 );
 }
 /*-----------------------------------------------------------*/
 
@@ -159,6 +190,8 @@ uint32_t ulCreateTelemetry( uint8_t * pucTelemetryData,
     xResult = AzureIoTJSONWriter_AppendBeginObject( &xWriter );
     configASSERT( xResult == eAzureIoTSuccess );
 
+    TelemetryFilter_Begin( &xTelemetryFilter );
+
     switch( xTelemetryState )
     {
         case eTelemetryStateTypeDefault:
@@ -188,6 +221,12 @@ uint32_t ulCreateTelemetry( uint8_t * pucTelemetryData,
 
     lBytesWritten = AzureIoTJSONWriter_GetBytesUsed( &xWriter );
 
+    if( TelemetryFilter_End( &xTelemetryFilter ) == 0 )
+    {
+        /* No reading of this group changed past its deadband. */
+        return 0;
+    }
+
     if( lBytesWritten < 0 )
     {
         LogError( ( "Error getting the bytes written for the telemetry JSON" ) );
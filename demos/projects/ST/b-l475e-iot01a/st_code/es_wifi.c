@@ -1401,6 +1401,24 @@ ES_WIFI_Status_t ES_WIFI_ResetToFactoryDefault(ES_WIFIObject_t *Obj)
   return ret;
 }
 
+/**
+  * @brief  Enable or disable the 802.11 power save of the station.
+  * @note   The radio sleeps between beacons of the access point, which buffers
+  *         the frames for it meanwhile, so the connections stay open.
+  * @param  Obj: pointer to module handle
+  * @param  enable: 1 to sleep between beacons, 0 to keep the radio on.
+  * @retval Operation Status.
+  */
+ES_WIFI_Status_t ES_WIFI_SetPowerSaveMode(ES_WIFIObject_t *Obj, uint8_t enable)
+{
+  ES_WIFI_Status_t ret ;
+  LOCK_WIFI();
+  sprintf((char*)Obj->CmdData,"ZP=%d\r", (enable != 0) ? 1 : 0);
+  ret = AT_ExecuteCommand(Obj, Obj->CmdData, Obj->CmdData);
+  UNLOCK_WIFI();
+  return ret;
+}
+
 /**
   * @brief  Reset the module.
   * @param  Obj: pointer to module handle
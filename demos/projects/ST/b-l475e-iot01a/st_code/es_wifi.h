@@ -296,6 +296,7 @@ ES_WIFI_Status_t  ES_WIFI_GetStackRev(ES_WIFIObject_t *Obj, uint8_t *StackRev);
 
 ES_WIFI_Status_t  ES_WIFI_SetMACAddress(ES_WIFIObject_t *Obj, uint8_t *mac);
 ES_WIFI_Status_t  ES_WIFI_ResetToFactoryDefault(ES_WIFIObject_t *Obj);
+ES_WIFI_Status_t  ES_WIFI_SetPowerSaveMode(ES_WIFIObject_t *Obj, uint8_t enable);
 ES_WIFI_Status_t  ES_WIFI_ResetModule(ES_WIFIObject_t *Obj);
 ES_WIFI_Status_t ES_WIFI_HardResetModule(ES_WIFIObject_t *Obj);
 ES_WIFI_Status_t  ES_WIFI_SetProductName(ES_WIFIObject_t *Obj, uint8_t *ProductName);
@@ -68,6 +68,18 @@ extern osMutexId es_wifi_mutex;
 #define ES_WIFI_USE_WPS                             0
                                                     
 #define ES_WIFI_USE_SPI                             1  
+
+/* SPI3 clock prescaler: 80/8 = 10MHz. The Inventek module supports up to
+   20MHz (SPI_BAUDRATEPRESCALER_4). */
+#ifndef ES_WIFI_SPI_BAUDRATEPRESCALER
+#define ES_WIFI_SPI_BAUDRATEPRESCALER               SPI_BAUDRATEPRESCALER_8
+#endif
+
+/* Set to 1 to send payloads with DMA (DMA2 channel 2) and read them back with
+   polled transfers, instead of one interrupt per 16-bit word. */
+#ifndef ES_WIFI_USE_SPI_DMA
+#define ES_WIFI_USE_SPI_DMA                         0
+#endif
 #define ES_WIFI_USE_UART                            (!ES_WIFI_USE_SPI)
    
 
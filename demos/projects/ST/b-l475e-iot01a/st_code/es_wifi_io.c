@@ -32,6 +32,9 @@
 /* Private macro -------------------------------------------------------------*/
 /* Private variables ---------------------------------------------------------*/
 SPI_HandleTypeDef hspi;
+#if (ES_WIFI_USE_SPI_DMA == 1)
+static DMA_HandleTypeDef hdma_tx;
+#endif
 static  int volatile spi_rx_event = 0;
 static  int volatile spi_tx_event = 0;
 static  int volatile cmddata_rdy_rising_event = 0;
@@ -135,6 +138,29 @@ void SPI_WIFI_MspInit(SPI_HandleTypeDef* hspi)
   GPIO_Init.Speed     = GPIO_SPEED_FREQ_MEDIUM;
   GPIO_Init.Alternate = GPIO_AF6_SPI3;
   HAL_GPIO_Init( GPIOC,&GPIO_Init );
+
+#if (ES_WIFI_USE_SPI_DMA == 1)
+  /* configure SPI3 TX DMA */
+  __HAL_RCC_DMA2_CLK_ENABLE();
+  hdma_tx.Instance                 = DMA2_Channel2;
+#if defined(DMAMUX1)
+  hdma_tx.Init.Request             = DMA_REQUEST_SPI3_TX;
+#else
+  hdma_tx.Init.Request             = DMA_REQUEST_3;
+#endif
+  hdma_tx.Init.Direction           = DMA_MEMORY_TO_PERIPH;
+  hdma_tx.Init.PeriphInc           = DMA_PINC_DISABLE;
+  hdma_tx.Init.MemInc              = DMA_MINC_ENABLE;
+  hdma_tx.Init.PeriphDataAlignment = DMA_PDATAALIGN_HALFWORD;
+  hdma_tx.Init.MemDataAlignment    = DMA_MDATAALIGN_HALFWORD;
+  hdma_tx.Init.Mode                = DMA_NORMAL;
+  hdma_tx.Init.Priority            = DMA_PRIORITY_HIGH;
+  HAL_DMA_Init(&hdma_tx);
+  __HAL_LINKDMA(hspi, hdmatx, hdma_tx);
+
+  HAL_NVIC_SetPriority(DMA2_Channel2_IRQn, SPI_INTERFACE_PRIO, 0);
+  HAL_NVIC_EnableIRQ(DMA2_Channel2_IRQn);
+#endif
 }
 
 /**
@@ -157,7 +183,7 @@ int8_t SPI_WIFI_Init(uint16_t mode)
     hspi.Init.CLKPolarity       = SPI_POLARITY_LOW;
     hspi.Init.CLKPhase          = SPI_PHASE_1EDGE;
     hspi.Init.NSS               = SPI_NSS_SOFT;
-    hspi.Init.BaudRatePrescaler = SPI_BAUDRATEPRESCALER_8; /* 80/8= 10MHz (Inventek WIFI module supports up to 20MHz)*/
+    hspi.Init.BaudRatePrescaler = ES_WIFI_SPI_BAUDRATEPRESCALER; /* 80/8= 10MHz by default (Inventek WIFI module supports up to 20MHz)*/
     hspi.Init.FirstBit          = SPI_FIRSTBIT_MSB;
     hspi.Init.TIMode            = SPI_TIMODE_DISABLE;
     hspi.Init.CRCCalculation    = SPI_CRCCALCULATION_DISABLE;
@@ -238,6 +264,10 @@ int8_t SPI_WIFI_ResetModule(void)
 int8_t SPI_WIFI_DeInit(void)
 {
   HAL_SPI_DeInit( &hspi );
+#if (ES_WIFI_USE_SPI_DMA == 1)
+  HAL_NVIC_DisableIRQ(DMA2_Channel2_IRQn);
+  HAL_DMA_DeInit(&hdma_tx);
+#endif
 #ifdef  WIFI_USE_CMSIS_OS
   osMutexDelete(spi_mutex);
   osMutexDelete(es_wifi_mutex);
@@ -348,6 +378,16 @@ int16_t SPI_WIFI_ReceiveData(uint8_t *pData, uint16_t len, uint32_t timeout)
   {
     if((length < len) || (!len))
     {
+#if (ES_WIFI_USE_SPI_DMA == 1)
+      /* The payload length is only known from the data ready pin, so each
+         word is read in turn. A polled word takes under 2us, far less than
+         an interrupt and wake-up per word. */
+      if (HAL_SPI_Receive(&hspi, tmp, 1, timeout) != HAL_OK) {
+        WIFI_DISABLE_NSS();
+        UNLOCK_SPI();
+        return ES_WIFI_ERROR_SPI_FAILED;
+      }
+#else
       spi_rx_event=1;
       if (HAL_SPI_Receive_IT(&hspi, tmp, 1) != HAL_OK) {
         WIFI_DISABLE_NSS();
@@ -356,6 +396,7 @@ int16_t SPI_WIFI_ReceiveData(uint8_t *pData, uint16_t len, uint32_t timeout)
       }
   
       wait_spi_rx_event(timeout);
+#endif
 
       pData[0] = tmp[0];
       pData[1] = tmp[1];
@@ -402,7 +443,14 @@ int16_t SPI_WIFI_SendData( uint8_t *pdata,  uint16_t len, uint32_t timeout)
   if (len > 1)
   {
     spi_tx_event=1;
+#if (ES_WIFI_USE_SPI_DMA == 1)
+    /* The DMA moves half-words, so it needs an aligned buffer. */
+    if( (((uint32_t)pdata & 1U) == 0U) ?
+        (HAL_SPI_Transmit_DMA(&hspi, (uint8_t *)pdata , len/2) != HAL_OK) :
+        (HAL_SPI_Transmit_IT(&hspi, (uint8_t *)pdata , len/2) != HAL_OK) )
+#else
     if( HAL_SPI_Transmit_IT(&hspi, (uint8_t *)pdata , len/2) != HAL_OK)
+#endif
     {
       WIFI_DISABLE_NSS();
       UNLOCK_SPI();
@@ -268,7 +268,7 @@ WIFI_Status_t WIFI_GetHostAddress(const char *location, uint8_t *ipaddr)
 }
 /**
   * @brief  Configure and start a client connection
-  * @param  type : Connection type TCP/UDP
+  * @param  type : Connection type TCP/UDP, or TCP with the TLS of the module
   * @param  name : name of the connection
   * @param  ipaddr : IP address of the remote host
   * @param  port : Remote port
@@ -283,7 +283,8 @@ WIFI_Status_t WIFI_OpenClientConnection(uint32_t socket, WIFI_Protocol_t type, c
   conn.Number = socket;
   conn.RemotePort = port;
   conn.LocalPort = local_port;
-  conn.Type = (type == WIFI_TCP_PROTOCOL)? ES_WIFI_TCP_CONNECTION : ES_WIFI_UDP_CONNECTION;
+  conn.Type = (type == WIFI_TCP_PROTOCOL)? ES_WIFI_TCP_CONNECTION :
+              (type == WIFI_TCP_SSL_PROTOCOL)? ES_WIFI_TCP_SSL_CONNECTION : ES_WIFI_UDP_CONNECTION;
   conn.RemoteIP[0] = ipaddr[0];
   conn.RemoteIP[1] = ipaddr[1];
   conn.RemoteIP[2] = ipaddr[2];
@@ -312,6 +313,23 @@ WIFI_Status_t WIFI_CloseClientConnection(uint32_t socket)
   return ret;
 }
 
+/**
+  * @brief  Store the root CA the module checks TLS servers against
+  * @param  ca : PEM certificates, without a terminator
+  * @param  length : length of the certificates
+  * @retval Operation status
+  */
+WIFI_Status_t WIFI_StoreCA(uint8_t *ca, uint16_t length)
+{
+  WIFI_Status_t ret = WIFI_STATUS_ERROR;
+
+  if(ES_WIFI_StoreCA(&EsWifiObj, ES_WIFI_FUNCTION_TLS, 0, ca, length)== ES_WIFI_STATUS_OK)
+  {
+    ret = WIFI_STATUS_OK;
+  }
+  return ret;
+}
+
 /**
   * @brief  Configure and start a Server
   * @param  type : Connection type TCP/UDP
@@ -533,6 +551,21 @@ WIFI_Status_t WIFI_SetModuleDefault(void)
   return ret;
 }
 
+/**
+  * @brief  Let the radio sleep between beacons while connected
+  * @param  enable : 1 to enable power save, 0 to disable it
+  * @retval Operation status
+  */
+WIFI_Status_t WIFI_SetPowerSave(uint8_t enable)
+{
+  WIFI_Status_t ret = WIFI_STATUS_ERROR;
+
+  if(ES_WIFI_SetPowerSaveMode(&EsWifiObj, enable) == ES_WIFI_STATUS_OK)
+  {
+      ret = WIFI_STATUS_OK;
+  }
+  return ret;
+}
 
 /**
   * @brief  Update module firmware
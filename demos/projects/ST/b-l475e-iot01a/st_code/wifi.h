@@ -50,6 +50,7 @@ typedef enum {
 typedef enum {
   WIFI_TCP_PROTOCOL = 0,
   WIFI_UDP_PROTOCOL = 1,
+  WIFI_TCP_SSL_PROTOCOL = 2,
 }WIFI_Protocol_t;
 
 typedef enum {
@@ -139,6 +140,7 @@ WIFI_Status_t       WIFI_Ping(uint8_t *ipaddr, uint16_t count, uint16_t interval
 WIFI_Status_t       WIFI_GetHostAddress(const char *location, uint8_t *ipaddr);
 WIFI_Status_t       WIFI_OpenClientConnection(uint32_t socket, WIFI_Protocol_t type, const char *name, uint8_t *ipaddr, uint16_t port, uint16_t local_port);
 WIFI_Status_t       WIFI_CloseClientConnection(uint32_t socket);
+WIFI_Status_t       WIFI_StoreCA(uint8_t *ca, uint16_t length);
 
 WIFI_Status_t       WIFI_StartServer(uint32_t socket, WIFI_Protocol_t type, uint16_t backlog, const char *name, uint16_t port);
 WIFI_Status_t       WIFI_WaitServerConnection(int socket,uint32_t Timeout,uint8_t *remoteipaddr, uint16_t *remoteport);
@@ -155,6 +157,7 @@ WIFI_Status_t       WIFI_StopClient(void);
 WIFI_Status_t       WIFI_SetOEMProperties(const char *name, uint8_t *Mac);
 WIFI_Status_t       WIFI_ResetModule(void);
 WIFI_Status_t       WIFI_SetModuleDefault(void);
+WIFI_Status_t       WIFI_SetPowerSave(uint8_t enable);
 WIFI_Status_t       WIFI_ModuleFirmwareUpdate(const char *url);
 WIFI_Status_t       WIFI_GetModuleID(char *Id);
 WIFI_Status_t       WIFI_GetModuleFwRevision(char *rev);
@@ -0,0 +1,125 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/*
+ * CM4 image of the dual-core sample.
+ *
+ * The CM4 waits in stop mode until the CM7 has configured the clocks. It then
+ * takes a reading every cm4READING_INTERVAL_MS, serialises it as telemetry
+ * and pushes it into the ring shared with the CM7, which publishes it. The
+ * readings are simulated, as the board has no environment sensor.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "stm32h7xx_hal.h"
+
+#include "dual_core_ring.h"
+
+/* Time between readings, in milliseconds. */
+#define cm4READING_INTERVAL_MS    ( 2000U )
+
+/* Telemetry of one reading, given in hundredths of a degree. */
+#define cm4MESSAGE                "{\"temperature\":%d.%02d,\"dropped\":%u}"
+
+/* Readings lost because the ring was full. */
+static uint32_t ulDropped = 0;
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Stop until the CM7 releases the boot semaphore.
+ */
+static void prvWaitForCM7( void )
+{
+    __HAL_RCC_HSEM_CLK_ENABLE();
+
+    HAL_HSEM_ActivateNotification( __HAL_HSEM_SEMID_TO_MASK( dualcoreHSEM_BOOT_ID ) );
+
+    /* Stopping the D2 domain lets the CM7 know that it can go on booting. */
+    HAL_PWREx_ClearPendingEvent();
+    HAL_PWREx_EnterSTOPMode( PWR_MAINREGULATOR_ON, PWR_STOPENTRY_WFE, PWR_D2_DOMAIN );
+
+    __HAL_HSEM_CLEAR_FLAG( __HAL_HSEM_SEMID_TO_MASK( dualcoreHSEM_BOOT_ID ) );
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Simulated temperature in hundredths of a degree, drifting around 22 degrees.
+ */
+static int32_t prvReadTemperature( void )
+{
+    static uint32_t ulRand = 1;
+    static int32_t lTemperature = 2200;
+
+    ulRand = ( 0x015a4e35UL * ulRand ) + 1UL;
+    lTemperature += ( int32_t ) ( ( ulRand >> 16 ) % 21U ) - 10;
+
+    if( ( lTemperature < 1500 ) || ( lTemperature > 3000 ) )
+    {
+        lTemperature = 2200;
+    }
+
+    return lTemperature;
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Tell the CM7 that the ring has new messages.
+ */
+static void prvNotifyCM7( void )
+{
+    /* Releasing a taken semaphore raises the HSEM interrupt of the CM7. */
+    if( HAL_HSEM_FastTake( dualcoreHSEM_TELEMETRY_ID ) == HAL_OK )
+    {
+        HAL_HSEM_Release( dualcoreHSEM_TELEMETRY_ID, 0 );
+    }
+}
+/*-----------------------------------------------------------*/
+
+int main( void )
+{
+    uint8_t ucMessage[ dualcoreMESSAGE_SIZE ];
+    int32_t lTemperature;
+    int lMessageLength;
+
+    prvWaitForCM7();
+
+    /* The system clock is the one set up by the CM7. */
+    SystemCoreClockUpdate();
+    HAL_Init();
+
+    DualCoreRing_Init( dualcoreRING );
+
+    for( ; ; )
+    {
+        lTemperature = prvReadTemperature();
+        lMessageLength = snprintf( ( char * ) ucMessage, sizeof( ucMessage ), cm4MESSAGE,
+                                   ( int ) ( lTemperature / 100 ), ( int ) ( lTemperature % 100 ),
+                                   ( unsigned int ) ulDropped );
+
+        if( ( lMessageLength > 0 ) && ( ( uint32_t ) lMessageLength < sizeof( ucMessage ) ) )
+        {
+            if( DualCoreRing_Push( dualcoreRING, ucMessage, ( uint32_t ) lMessageLength ) )
+            {
+                prvNotifyCM7();
+            }
+            else
+            {
+                ulDropped++;
+            }
+        }
+
+        HAL_Delay( cm4READING_INTERVAL_MS );
+    }
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief HAL time base of the CM4.
+ */
+void SysTick_Handler( void )
+{
+    HAL_IncTick();
+}
+/*-----------------------------------------------------------*/
@@ -34,13 +34,19 @@
 #define configUSE_PREEMPTION                         1
 #define configUSE_IDLE_HOOK                          1
 #define configUSE_TICK_HOOK                          0
-#define configUSE_TICKLESS_IDLE                      0
+
+/* Defined as 1 by the BOARD_LOW_POWER CMake option. */
+#ifndef configUSE_TICKLESS_IDLE
+    #define configUSE_TICKLESS_IDLE    0
+#endif
+
 #define configUSE_DAEMON_TASK_STARTUP_HOOK           1
 #define configCPU_CLOCK_HZ                           ( SystemCoreClock )
 #define configTICK_RATE_HZ                           ( ( TickType_t ) 1000 )
 #define configMAX_PRIORITIES                         ( 7 )
 #define configMINIMAL_STACK_SIZE                     ( ( uint16_t ) 90 )
-#define configTOTAL_HEAP_SIZE                        ( ( size_t ) ( 60 * 1024 ) )
+/* Without the 33 KB of TLS record buffers, see mbedtls_config.h. */
+#define configTOTAL_HEAP_SIZE                        ( ( size_t ) ( 27 * 1024 ) )
 #define configMAX_TASK_NAME_LEN                      ( 16 )
 #define configUSE_TRACE_FACILITY                     1
 #define configUSE_16_BIT_TICKS                       0
@@ -52,7 +58,12 @@
 #define configUSE_MALLOC_FAILED_HOOK                 1
 #define configUSE_APPLICATION_TASK_TAG               1
 #define configUSE_COUNTING_SEMAPHORES                1
-#define configGENERATE_RUN_TIME_STATS                0
+
+/* Defined as 1 by the BOARD_RUNTIME_STATS CMake option. */
+#ifndef configGENERATE_RUN_TIME_STATS
+    #define configGENERATE_RUN_TIME_STATS    0
+#endif
+
 #define configOVERRIDE_DEFAULT_TICK_CONFIGURATION    1
 #define configRECORD_STACK_HIGH_ADDRESS              1
 #define configUSE_STATS_FORMATTING_FUNCTIONS         1
@@ -130,4 +141,37 @@
 extern int uxRand( void );
 #define configRAND32()    iMainRand32()
 
+/* Low-power profile. With tickless idle the port stops SysTick while every
+ * task is blocked and sleeps the core until the next timeout or interrupt.
+ * TIM6 drives the HAL time base, so it is stopped around the sleep as well,
+ * or it would wake the core every millisecond. */
+#if ( configUSE_TICKLESS_IDLE == 1 )
+    extern void vMainPreSleepProcessing( uint32_t ulExpectedIdleTime );
+    extern void vMainPostSleepProcessing( uint32_t ulExpectedIdleTime );
+    #define configPRE_SLEEP_PROCESSING( x )     vMainPreSleepProcessing( x )
+    #define configPOST_SLEEP_PROCESSING( x )    vMainPostSleepProcessing( x )
+#endif
+
+/* Run-time stats. TIM2, a 32-bit timer apart from the TIM6 time base, counts
+ * at 100 kHz the time each task runs, for the diagnostics of the samples. */
+#if ( configGENERATE_RUN_TIME_STATS == 1 )
+    extern void vMainConfigureTimerForRunTimeStats( void );
+    extern uint32_t ulMainGetRunTimeCounterValue( void );
+    #define portCONFIGURE_TIMER_FOR_RUN_TIME_STATS()    vMainConfigureTimerForRunTimeStats()
+    #define portGET_RUN_TIME_COUNTER_VALUE()            ulMainGetRunTimeCounterValue()
+#endif
+
+/* Heap trace of the samples, set by the SAMPLE_HEAP_TRACE CMake option. The
+ * hooks are expanded in pvPortMalloc(), so the return address is in the
+ * function that called it. */
+#if ( democonfigHEAP_TRACE == 1 )
+    extern void HeapTrace_Malloc( void * pvAddress,
+                                  size_t xSize,
+                                  const void * pvCaller );
+    extern void HeapTrace_Free( void * pvAddress,
+                                size_t xSize );
+    #define traceMALLOC( pvAddress, uiSize )    HeapTrace_Malloc( ( pvAddress ), ( uiSize ), __builtin_return_address( 0 ) )
+    #define traceFREE( pvAddress, uiSize )      HeapTrace_Free( ( pvAddress ), ( uiSize ) )
+#endif
+
 #endif /* FREERTOS_CONFIG_H */
@@ -0,0 +1,119 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+#include "dual_core_link.h"
+
+#include "main.h"
+
+/* FreeRTOS includes. */
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "dual_core_ring.h"
+#include "sample_azure_iot_multitask_data_if.h"
+
+/* Loops to wait for the D2 domain clock to change, as in the ST dual-core examples. */
+#define dualcoreBOOT_TIMEOUT               ( 0xFFFF )
+
+/* Longest wait for a notification, in case one was missed. */
+#define dualcoreTELEMETRY_WAIT_TICKS       ( pdMS_TO_TICKS( 1000U ) )
+
+/* Task woken by the CM4, the one producer reading from the ring. */
+static TaskHandle_t xReaderTask = NULL;
+/*-----------------------------------------------------------*/
+
+void vDualCoreLinkWaitForCM4( void )
+{
+    int32_t lTimeout = dualcoreBOOT_TIMEOUT;
+
+    /* The CM4 stops, and with it the D2 domain clock, until the CM7 wakes it. */
+    while( ( __HAL_RCC_GET_FLAG( RCC_FLAG_D2CKRDY ) != RESET ) && ( lTimeout-- > 0 ) )
+    {
+    }
+
+    if( lTimeout < 0 )
+    {
+        Error_Handler();
+    }
+}
+/*-----------------------------------------------------------*/
+
+void vDualCoreLinkStartCM4( void )
+{
+    int32_t lTimeout = dualcoreBOOT_TIMEOUT;
+
+    /* Not ready until the CM4 has initialized it. Retained SRAM may still
+     * hold the ring of an earlier run. */
+    dualcoreRING->ulMagic = 0;
+
+    __HAL_RCC_HSEM_CLK_ENABLE();
+
+    /* A release of the boot semaphore wakes the CM4. */
+    HAL_HSEM_FastTake( dualcoreHSEM_BOOT_ID );
+    HAL_HSEM_Release( dualcoreHSEM_BOOT_ID, 0 );
+
+    while( ( __HAL_RCC_GET_FLAG( RCC_FLAG_D2CKRDY ) == RESET ) && ( lTimeout-- > 0 ) )
+    {
+    }
+
+    if( lTimeout < 0 )
+    {
+        Error_Handler();
+    }
+
+    /* The interrupt wakes the reader task, so it must not preempt the kernel. */
+    HAL_NVIC_SetPriority( HSEM1_IRQn, configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY, 0 );
+    HAL_NVIC_EnableIRQ( HSEM1_IRQn );
+    HAL_HSEM_ActivateNotification( __HAL_HSEM_SEMID_TO_MASK( dualcoreHSEM_TELEMETRY_ID ) );
+}
+/*-----------------------------------------------------------*/
+
+void HSEM1_IRQHandler( void )
+{
+    HAL_HSEM_IRQHandler();
+}
+/*-----------------------------------------------------------*/
+
+void HAL_HSEM_FreeCallback( uint32_t SemMask )
+{
+    BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+
+    /* The HAL disables the notification before calling back. */
+    HAL_HSEM_ActivateNotification( SemMask );
+
+    if( xReaderTask != NULL )
+    {
+        vTaskNotifyGiveFromISR( xReaderTask, &xHigherPriorityTaskWoken );
+    }
+
+    portYIELD_FROM_ISR( xHigherPriorityTaskWoken );
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Implements the sample interface with the readings of the CM4.
+ */
+uint32_t ulReadTelemetry( uint32_t ulProducer,
+                          uint8_t * pucTelemetryData,
+                          uint32_t ulTelemetryDataSize,
+                          uint32_t * pulTelemetryDataLength )
+{
+    ( void ) ulProducer;
+
+    configASSERT( democonfigMULTITASK_PRODUCER_COUNT == 1 );
+
+    xReaderTask = xTaskGetCurrentTaskHandle();
+
+    /* Notifications only say the ring changed, so it is read before waiting
+     * and none that came in the meantime is lost. */
+    *pulTelemetryDataLength = DualCoreRing_Pop( dualcoreRING, pucTelemetryData, ulTelemetryDataSize );
+
+    if( *pulTelemetryDataLength == 0 )
+    {
+        ( void ) ulTaskNotifyTake( pdTRUE, dualcoreTELEMETRY_WAIT_TICKS );
+        *pulTelemetryDataLength = DualCoreRing_Pop( dualcoreRING, pucTelemetryData, ulTelemetryDataSize );
+    }
+
+    return 0;
+}
+/*-----------------------------------------------------------*/
@@ -0,0 +1,28 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @file dual_core_link.h
+ *
+ * @brief CM7 side of the dual-core build.
+ *
+ * The CM7 clocks the system and then wakes the CM4, which acquires and
+ * serialises sensor readings into the shared ring of dual_core_ring.h. The
+ * CM7 runs the network stack and the hub client and publishes the readings
+ * through the multi-task sample, as its telemetry source.
+ */
+
+#ifndef DUAL_CORE_LINK_H
+#define DUAL_CORE_LINK_H
+
+/**
+ * @brief Wait for the CM4 to stop in its boot code. Call before HAL_Init().
+ */
+void vDualCoreLinkWaitForCM4( void );
+
+/**
+ * @brief Wake the CM4 once the clocks are configured.
+ */
+void vDualCoreLinkStartCM4( void );
+
+#endif /* DUAL_CORE_LINK_H */
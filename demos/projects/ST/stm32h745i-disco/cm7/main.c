@@ -11,6 +11,31 @@
 #include "FreeRTOS.h"
 #include "task.h"
 #include "lwip.h"
+#include "lwip/tcpip.h"
+#include "lwip/apps/sntp.h"
+
+/* Startup timing. */
+#include "azure_sample_startup.h"
+
+/* Random bytes read ahead of the handshakes. */
+#include "azure_sample_entropy_pool.h"
+
+/* Logs written by a task of low priority. */
+#include "azure_sample_deferred_log.h"
+
+/* Logs written as tokens. */
+#include "azure_sample_token_log.h"
+
+/* Unix time from the SNTP client of lwIP. */
+#include "azure_sample_time_sync.h"
+
+/* Demo Specific configs. */
+#include "demo_config.h"
+
+#ifdef BOARD_DUAL_CORE
+    #include "dual_core_link.h"
+    #include "dual_core_ring.h"
+#endif /* BOARD_DUAL_CORE */
 
 /*-----------------------------------------------------------*/
 
@@ -28,7 +53,6 @@ static void MPU_Config( void );
 static void MX_RNG_Init( void );
 static void MX_USART3_UART_Init( void );
 static char cPrintString[ 512 ];
-static uint64_t ulGlobalEntryTime = 1673769600;
 
 /*
  * Prototypes for the demos that can be started from this project.
@@ -40,6 +64,14 @@ extern void vStartDemoTask( void );
  */
 uint64_t ullGetUnixTime( void );
 
+#ifdef democonfigTIME_SYNC
+
+/**
+ * @brief Starts the SNTP client of lwIP.
+ */
+    static void prvStartSntp( void * pvArgument );
+#endif /* democonfigTIME_SYNC */
+
 /**
  * @brief Initializes the STM32L475 IoT node board.
  *
@@ -55,27 +87,67 @@ static void prvMiscInitialization( void );
  */
 static void prvInitializeHeap( void );
 
+/**
+ * @brief Reads the RNG for the entropy pool, waiting for each word.
+ */
+static int prvReadRng( uint8_t * pucBuffer,
+                       size_t xLength );
+
+/**
+ * @brief Writes a log to the UART, waiting for it.
+ */
+static void prvWriteUart( const char * pcText,
+                          size_t xLength );
+
+/*-----------------------------------------------------------*/
+
+#ifdef BOARD_TCM
+
+    /* Set by tcm/tcm_sections.ld. */
+    extern uint32_t __itcm_start__[], __itcm_end__[], __itcm_load__[];
+    extern uint32_t __dtcm_data_start__[], __dtcm_data_end__[], __dtcm_data_load__[];
+
+    static void prvTcmInit( void )
+    {
+        memcpy( __itcm_start__, __itcm_load__,
+                ( size_t ) ( ( uint8_t * ) __itcm_end__ - ( uint8_t * ) __itcm_start__ ) );
+        memcpy( __dtcm_data_start__, __dtcm_data_load__,
+                ( size_t ) ( ( uint8_t * ) __dtcm_data_end__ - ( uint8_t * ) __dtcm_data_start__ ) );
+
+        /* The copied code is fetched only after this. */
+        __DSB();
+        __ISB();
+    }
+/*-----------------------------------------------------------*/
+#endif /* BOARD_TCM */
+
+static void prvWriteUart( const char * pcText,
+                          size_t xLength )
+{
+    while( HAL_OK != HAL_UART_Transmit( &huart3, ( uint8_t * ) pcText, xLength, 30000 ) )
+    {
+    }
+}
 /*-----------------------------------------------------------*/
 
 void vLoggingPrintf( const char * pcFormat,
                      ... )
 {
-    size_t xLength = 0;
-
     va_list vargs;
 
     va_start( vargs, pcFormat );
 
-    xLength = vsnprintf( cPrintString, sizeof( cPrintString ), pcFormat, vargs );
+    #if ( democonfigDEFERRED_LOG == 1 )
+        DeferredLog_VPrintf( pcFormat, vargs );
+    #else
+        size_t xLength = vsnprintf( cPrintString, sizeof( cPrintString ), pcFormat, vargs );
 
-    if( xLength > 0 )
-    {
-        xLength = xLength > sizeof( cPrintString ) ? sizeof( cPrintString ) : xLength;
-
-        while( HAL_OK != HAL_UART_Transmit( &huart3, ( uint8_t * ) cPrintString, xLength, 30000 ) )
+        if( xLength > 0 )
         {
+            xLength = xLength > sizeof( cPrintString ) ? sizeof( cPrintString ) : xLength;
+            prvWriteUart( cPrintString, xLength );
         }
-    }
+    #endif /* democonfigDEFERRED_LOG == 1 */
 
     va_end( vargs );
 }
@@ -89,6 +161,21 @@ int main( void )
      * running.  */
     prvMiscInitialization();
 
+    /* The RNG is read into the pool while the network comes up. */
+    ( void ) EntropyPool_Init( prvReadRng );
+
+    /* The fallback time until SNTP answers. */
+    TimeSync_Init();
+
+    #if ( democonfigDEFERRED_LOG == 1 )
+        /* The logs made until the scheduler starts are written then. */
+        ( void ) DeferredLog_Init( prvWriteUart );
+    #endif
+
+    #if ( democonfigTOKEN_LOG == 1 )
+        TokenLog_Init( prvWriteUart );
+    #endif
+
     /* Start the scheduler.  Initialization that requires the OS to be running,
      * including the WiFi initialization, is performed in the RTOS daemon task
      * startup hook. */
@@ -101,12 +188,10 @@ int main( void )
 
 int uxRand( void )
 {
-    HAL_StatusTypeDef status = HAL_OK;
     uint32_t random_number = 0;
+    size_t xLength;
 
-    status = HAL_RNG_GenerateRandomNumber( &xHrng, &random_number );
-
-    if( HAL_OK != status )
+    if( EntropyPool_Poll( NULL, ( unsigned char * ) &random_number, sizeof( random_number ), &xLength ) != 0 )
     {
         return 0;
     }
@@ -117,6 +202,13 @@ int uxRand( void )
 void vApplicationDaemonTaskStartupHook( void )
 {
     MX_LWIP_Init();
+    StartupProfile_Mark( eStartupPhaseNetworkUp );
+
+    #ifdef democonfigTIME_SYNC
+        /* Queries the time while the demo provisions and connects, rather
+         * than before it. */
+        ( void ) tcpip_callback( prvStartSntp, NULL );
+    #endif
 
     /* Demos that use the network are created after the network is
      * up. */
@@ -218,6 +310,11 @@ static void prvMiscInitialization( void )
 {
     /* USER CODE END Boot_Mode_Sequence_0 */
 
+    #ifdef BOARD_TCM
+        /* Before anything calls into mbedTLS. */
+        prvTcmInit();
+    #endif
+
     /* MPU Configuration--------------------------------------------------------*/
     MPU_Config();
 
@@ -228,7 +325,9 @@ static void prvMiscInitialization( void )
     SCB_EnableDCache();
 
     /* USER CODE BEGIN Boot_Mode_Sequence_1 */
-    /* Add core if want to wait for CPU2 boots */
+    #ifdef BOARD_DUAL_CORE
+        vDualCoreLinkWaitForCM4();
+    #endif /* BOARD_DUAL_CORE */
 
     /* Reset of all peripherals, Initializes the Flash interface and the Systick. */
     HAL_Init();
@@ -236,6 +335,11 @@ static void prvMiscInitialization( void )
     /* Configure the system clock. */
     SystemClock_Config();
 
+    #ifdef BOARD_DUAL_CORE
+        /* The CM4 runs on the clocks set up above. */
+        vDualCoreLinkStartCM4();
+    #endif /* BOARD_DUAL_CORE */
+
     MX_GPIO_Init();
     MX_RNG_Init();
     MX_USART3_UART_Init();
@@ -348,8 +452,16 @@ static void MPU_Config( void )
     MPU_InitStruct.AccessPermission = MPU_REGION_FULL_ACCESS;
     MPU_InitStruct.DisableExec = MPU_INSTRUCTION_ACCESS_DISABLE;
     MPU_InitStruct.IsShareable = MPU_ACCESS_NOT_SHAREABLE;
-    MPU_InitStruct.IsCacheable = MPU_ACCESS_NOT_CACHEABLE;
-    MPU_InitStruct.IsBufferable = MPU_ACCESS_NOT_BUFFERABLE;
+
+    #ifdef BOARD_ETH_DCACHE
+        /* Write-back, write-allocate: ethernetif.c keeps the RX buffers and
+         * the lwIP heap coherent with the DMA by cache maintenance. */
+        MPU_InitStruct.IsCacheable = MPU_ACCESS_CACHEABLE;
+        MPU_InitStruct.IsBufferable = MPU_ACCESS_BUFFERABLE;
+    #else
+        MPU_InitStruct.IsCacheable = MPU_ACCESS_NOT_CACHEABLE;
+        MPU_InitStruct.IsBufferable = MPU_ACCESS_NOT_BUFFERABLE;
+    #endif
 
     HAL_MPU_ConfigRegion( &MPU_InitStruct );
 
@@ -358,7 +470,7 @@ static void MPU_Config( void )
     MPU_InitStruct.Enable = MPU_REGION_ENABLE;
     MPU_InitStruct.Number = MPU_REGION_NUMBER1;
     MPU_InitStruct.BaseAddress = 0x30040000;
-    MPU_InitStruct.Size = MPU_REGION_SIZE_256B;
+    MPU_InitStruct.Size = MPU_REGION_SIZE_512B; /* RX and TX DMA descriptors. */
     MPU_InitStruct.SubRegionDisable = 0x0;
     MPU_InitStruct.TypeExtField = MPU_TEX_LEVEL0;
     MPU_InitStruct.AccessPermission = MPU_REGION_FULL_ACCESS;
@@ -368,6 +480,24 @@ static void MPU_Config( void )
     MPU_InitStruct.IsBufferable = MPU_ACCESS_NOT_BUFFERABLE;
 
     HAL_MPU_ConfigRegion( &MPU_InitStruct );
+
+    #ifdef BOARD_DUAL_CORE
+        /* The ring shared with the CM4, which does not see the CM7 cache. */
+        MPU_InitStruct.Enable = MPU_REGION_ENABLE;
+        MPU_InitStruct.Number = MPU_REGION_NUMBER2;
+        MPU_InitStruct.BaseAddress = dualcoreSHARED_RAM_ADDRESS;
+        MPU_InitStruct.Size = MPU_REGION_SIZE_8KB;
+        MPU_InitStruct.SubRegionDisable = 0x0;
+        MPU_InitStruct.TypeExtField = MPU_TEX_LEVEL1;
+        MPU_InitStruct.AccessPermission = MPU_REGION_FULL_ACCESS;
+        MPU_InitStruct.DisableExec = MPU_INSTRUCTION_ACCESS_DISABLE;
+        MPU_InitStruct.IsShareable = MPU_ACCESS_SHAREABLE;
+        MPU_InitStruct.IsCacheable = MPU_ACCESS_NOT_CACHEABLE;
+        MPU_InitStruct.IsBufferable = MPU_ACCESS_NOT_BUFFERABLE;
+
+        HAL_MPU_ConfigRegion( &MPU_InitStruct );
+    #endif /* BOARD_DUAL_CORE */
+
     /* Enables the MPU */
     HAL_MPU_Enable( MPU_PRIVILEGED_DEFAULT );
 }
@@ -511,8 +641,59 @@ void vApplicationStackOverflowHook( TaskHandle_t xTask,
 void vApplicationIdleHook( void )
 {
 }
+/*-----------------------------------------------------------*/
 
+#if ( configUSE_TICKLESS_IDLE == 1 )
+
+/* Called by the port with interrupts masked, just before it sleeps with the
+ * tick stopped. */
+    void vMainPreSleepProcessing( uint32_t ulExpectedIdleTime )
+    {
+        ( void ) ulExpectedIdleTime;
+
+        HAL_SuspendTick();
+    }
+/*-----------------------------------------------------------*/
+
+    void vMainPostSleepProcessing( uint32_t ulExpectedIdleTime )
+    {
+        ( void ) ulExpectedIdleTime;
+
+        HAL_ResumeTick();
+    }
 /*-----------------------------------------------------------*/
+#endif /* configUSE_TICKLESS_IDLE == 1 */
+
+#if ( configGENERATE_RUN_TIME_STATS == 1 )
+
+/* Rate of the run-time stats counter. The counter of a task wraps after
+ * about 12 hours, and the diagnostics only take differences. */
+    #define mainRUN_TIME_STATS_HZ    ( 100000U )
+
+/* Called by the kernel as the scheduler starts. TIM2 runs free, without an
+ * interrupt, so it keeps counting through the sleeps of tickless idle. */
+    void vMainConfigureTimerForRunTimeStats( void )
+    {
+        /* The timers run at twice PCLK1, as in HAL_InitTick(). */
+        uint32_t ulTimerClock = 2U * HAL_RCC_GetPCLK1Freq();
+
+        __HAL_RCC_TIM2_CLK_ENABLE();
+
+        TIM2->CR1 = 0;
+        TIM2->PSC = ( ulTimerClock / mainRUN_TIME_STATS_HZ ) - 1U;
+        TIM2->ARR = UINT32_MAX;
+        TIM2->CNT = 0;
+        TIM2->EGR = TIM_EGR_UG; /* Loads the prescaler. */
+        TIM2->CR1 = TIM_CR1_CEN;
+    }
+/*-----------------------------------------------------------*/
+
+    uint32_t ulMainGetRunTimeCounterValue( void )
+    {
+        return TIM2->CNT;
+    }
+/*-----------------------------------------------------------*/
+#endif /* configGENERATE_RUN_TIME_STATS == 1 */
 
 void prvGetRegistersFromStack( uint32_t * pulFaultStackAddress )
 {
@@ -605,54 +786,70 @@ void HAL_TIM_PeriodElapsedCallback( TIM_HandleTypeDef * htim )
 }
 /*-----------------------------------------------------------*/
 
-int mbedtls_hardware_poll( void * data,
-                           unsigned char * output,
-                           size_t len,
-                           size_t * olen )
+static int prvReadRng( uint8_t * pucBuffer,
+                       size_t xLength )
 {
-    HAL_StatusTypeDef status = HAL_OK;
     uint32_t random_number = 0;
+    size_t xCopy;
 
-    status = HAL_RNG_GenerateRandomNumber( &xHrng, &random_number );
-    ( ( void ) data );
-    *olen = 0;
-
-    if( ( len < sizeof( uint32_t ) ) || ( HAL_OK != status ) )
+    while( xLength > 0 )
     {
-        return 0;
-    }
+        if( HAL_RNG_GenerateRandomNumber( &xHrng, &random_number ) != HAL_OK )
+        {
+            return -1;
+        }
 
-    memcpy( output, &random_number, sizeof( uint32_t ) );
-    *olen = sizeof( uint32_t );
+        xCopy = ( xLength < sizeof( random_number ) ) ? xLength : sizeof( random_number );
+        memcpy( pucBuffer, &random_number, xCopy );
+        pucBuffer += xCopy;
+        xLength -= xCopy;
+    }
 
     return 0;
 }
 /*-----------------------------------------------------------*/
 
+int mbedtls_hardware_poll( void * data,
+                           unsigned char * output,
+                           size_t len,
+                           size_t * olen )
+{
+    return EntropyPool_Poll( data, output, len, olen );
+}
+/*-----------------------------------------------------------*/
+
 int mbedtls_platform_entropy_poll( void * data,
                                    unsigned char * output,
                                    size_t len,
                                    size_t * olen )
 {
-    return mbedtls_hardware_poll( data, output, len, olen );
+    return EntropyPool_Poll( data, output, len, olen );
 }
 /*-----------------------------------------------------------*/
 
 uint64_t ullGetUnixTime( void )
 {
-    TickType_t xTickCount = 0;
-    uint64_t ulTime = 0UL;
-
-    /* Get the current tick count. */
-    xTickCount = xTaskGetTickCount();
+    return TimeSync_GetUnixTimeMs() / 1000U;
+}
+/*-----------------------------------------------------------*/
 
-    /* Convert the ticks to milliseconds. */
-    ulTime = ( uint64_t ) xTickCount / configTICK_RATE_HZ;
+#ifdef democonfigTIME_SYNC
+    /* Called in the tcpip thread, as the SNTP client is. */
+    static void prvStartSntp( void * pvArgument )
+    {
+        ( void ) pvArgument;
 
-    /* Reduce ulGlobalEntryTimeMs from obtained time so as to always return the
-     * elapsed time in the application. */
-    ulTime = ( uint64_t ) ( ulTime + ulGlobalEntryTime );
+        sntp_setoperatingmode( SNTP_OPMODE_POLL );
+        sntp_setservername( 0, democonfigTIME_SYNC_SERVER );
+        sntp_init();
+    }
+#endif /* democonfigTIME_SYNC */
+/*-----------------------------------------------------------*/
 
-    return ulTime;
+/* Called in the tcpip thread by the SNTP client, see lwipopts.h. */
+void vMainSntpSetTime( uint32_t ulSeconds,
+                       uint32_t ulMicroseconds )
+{
+    TimeSync_Report( ( ( uint64_t ) ulSeconds * 1000U ) + ( ulMicroseconds / 1000U ), xTaskGetTickCount() );
 }
 /*-----------------------------------------------------------*/
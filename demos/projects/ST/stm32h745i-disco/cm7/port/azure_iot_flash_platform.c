@@ -5,6 +5,8 @@
 #include "azure_iot_flash_platform.h"
 #include "azure_iot_flash_platform_port.h"
 #include "stm32h7xx_hal.h"
+#include "FreeRTOS.h"
+#include "task.h"
 /* Logging */
 #include "azure_iot.h"
 #include "azure/core/az_base64.h"
@@ -13,10 +15,84 @@
 #define azureiotflashH745_WORD_SIZE    32
 #define azureiotflashSHA_256_SIZE      32
 
-static uint8_t ucPartitionReadBuffer[ 32 ];
+/* Set to 0 to hash the image by reading it back in AzureIoTPlatform_VerifyImage()
+ * instead of finishing the hash of the written blocks. */
+#ifndef azureiotflashSTREAMING_HASH
+    #define azureiotflashSTREAMING_HASH    1
+#endif
+
+/* Set to 1 to also read the image back when the streamed hash matches. */
+#ifndef azureiotflashREAD_BACK_CHECK
+    #define azureiotflashREAD_BACK_CHECK    0
+#endif
+
+/* ulHashedLength value once a block was written out of order. */
+#define azureiotflashHASH_INVALID      0xffffffffUL
+
+/* Set to 0 to mass erase the update bank in AzureIoTPlatform_Init()
+ * instead of erasing each sector just before it is first written. */
+#ifndef azureiotflashLAZY_ERASE
+    #define azureiotflashLAZY_ERASE    1
+#endif
+
+/* Called between the slices of an erase, a write or a hash, each of which
+ * keeps the CPU for up to a sector erase, about a second, so the image can be
+ * written with an independent watchdog running. Define it to refresh the
+ * watchdog, such as HAL_IWDG_Refresh( &hiwdg ). */
+#ifndef azureiotflashWATCHDOG_KICK
+    #define azureiotflashWATCHDOG_KICK()    do {} while( 0 )
+#endif
+
+/* Bytes programmed or hashed between two yields. */
+#ifndef azureiotflashSLICE_SIZE
+    #define azureiotflashSLICE_SIZE    ( 16 * 1024 )
+#endif
+
+/* The last sector of the update bank holds the download journal, so images
+ * end before it. Records are written at sector aligned offsets, where a
+ * resumed download can erase the rest of the image without losing data. */
+#define azureiotflashJOURNAL_OFFSET    ( FLASH_BANK_SIZE - FLASH_SECTOR_SIZE )
+#define azureiotflashJOURNAL_MAGIC     0x4a524e4cUL
+
+/* Three flash words, the magic in the last, so a record cut short by power
+ * loss is not taken as written. */
+typedef struct AzureADUJournalRecord
+{
+    uint32_t ulImageFileSize;
+    uint32_t ulOffset;
+    uint8_t ucManifestHash[ azureiotflashSHA_256_SIZE ]; /* Identifies the image being downloaded. */
+    uint8_t ucWrittenHash[ azureiotflashSHA_256_SIZE ];  /* SHA256 of the first ulOffset bytes. */
+    uint32_t ulReserved[ 5 ];
+    uint32_t ulMagic;
+} AzureADUJournalRecord_t;
+
+#define azureiotflashJOURNAL_RECORDS    ( FLASH_SECTOR_SIZE / sizeof( AzureADUJournalRecord_t ) )
+
 static uint8_t ucDecodedManifestHash[ azureiotflashSHA_256_SIZE ];
 static uint8_t ucCalculatedHash[ azureiotflashSHA_256_SIZE ];
 
+/* Running hash of the bytes passed to AzureIoTPlatform_WriteBlock(). */
+static mbedtls_md_context_t xWrittenHashContext;
+static uint32_t ulHashedLength;
+
+/* Everything below this offset in the update bank has been erased. */
+static uint32_t ulErasedLength;
+
+/* Bytes of the flash word at ulFlashWordOffset that have not been programmed
+ * yet. Blocks need not be flash word sized, so a partial word is carried
+ * over to the next AzureIoTPlatform_WriteBlock() call. Held as words so the
+ * HAL can read it as the programming source. */
+static uint32_t ulFlashWord[ azureiotflashH745_WORD_SIZE / sizeof( uint32_t ) ];
+static uint32_t ulFlashWordOffset;
+static uint32_t ulFlashWordLength;
+
+static uint8_t ucJournalManifestHash[ azureiotflashSHA_256_SIZE ];
+
+/* Offset of the latest journal record of the download, and the slot the
+ * next record goes to. */
+static uint32_t ulJournalOffset;
+static uint32_t ulJournalNextRecord;
+
 static AzureIoTResult_t prvBase64Decode( uint8_t * base64Encoded,
                                          size_t ulBase64EncodedLength,
                                          uint8_t * pucOutputBuffer,
@@ -40,13 +116,169 @@ static AzureIoTResult_t prvBase64Decode( uint8_t * base64Encoded,
     return eAzureIoTSuccess;
 }
 
+static void prvStartWrittenHash( void )
+{
+    mbedtls_md_free( &xWrittenHashContext );
+    mbedtls_md_init( &xWrittenHashContext );
+    mbedtls_md_setup( &xWrittenHashContext, mbedtls_md_info_from_type( MBEDTLS_MD_SHA256 ), 0 );
+    mbedtls_md_starts( &xWrittenHashContext );
+    ulHashedLength = 0;
+}
+
+/* Between two slices: the other tasks, the network stack and whatever calls
+ * AzureIoTHubClient_ProcessLoop() in the pipelined download, get to run and
+ * the watchdog is refreshed. */
+static void prvYield( void )
+{
+    azureiotflashWATCHDOG_KICK();
+    vTaskDelay( 1 );
+}
+
+/* The partition is memory mapped, so it is hashed in place rather than copied
+ * out. The first ulLength bytes are added to pxContext. */
+static void prvHashRange( AzureADUImage_t * const pxAduImage,
+                          mbedtls_md_context_t * pxContext,
+                          uint32_t ulLength )
+{
+    uint32_t ulOffset;
+    uint32_t ulHashSize;
+
+    for( ulOffset = 0; ulOffset < ulLength; ulOffset += ulHashSize )
+    {
+        ulHashSize = ulLength - ulOffset;
+        ulHashSize = ulHashSize < azureiotflashSLICE_SIZE ? ulHashSize : azureiotflashSLICE_SIZE;
+
+        mbedtls_md_update( pxContext, ( const unsigned char * ) pxAduImage->xUpdatePartition + ulOffset, ulHashSize );
+        prvYield();
+    }
+}
+
+static AzureIoTResult_t prvHashPartition( AzureADUImage_t * const pxAduImage,
+                                          uint8_t * pucHash )
+{
+    mbedtls_md_context_t ctx;
+
+    mbedtls_md_init( &ctx );
+    mbedtls_md_setup( &ctx, mbedtls_md_info_from_type( MBEDTLS_MD_SHA256 ), 0 );
+    mbedtls_md_starts( &ctx );
+
+    prvHashRange( pxAduImage, &ctx, pxAduImage->ulImageFileSize );
+
+    mbedtls_md_finish( &ctx, pucHash );
+    mbedtls_md_free( &ctx );
+
+    return eAzureIoTSuccess;
+}
+
+/* Finish a copy of the running hash, so it can keep absorbing later blocks. */
+static void prvGetWrittenHash( uint8_t * pucHash )
+{
+    mbedtls_md_context_t xCopy;
+
+    mbedtls_md_init( &xCopy );
+    mbedtls_md_setup( &xCopy, mbedtls_md_info_from_type( MBEDTLS_MD_SHA256 ), 0 );
+    mbedtls_md_clone( &xCopy, &xWrittenHashContext );
+    mbedtls_md_finish( &xCopy, pucHash );
+    mbedtls_md_free( &xCopy );
+}
+
+/* Erase one sector of the update bank. The caller has unlocked the flash. */
+static AzureIoTResult_t prvEraseSector( uint32_t ulSector )
+{
+    static FLASH_EraseInitTypeDef xEraseInitStruct;
+    uint32_t ulPageError;
+
+    /* With memory remapping, always erase bank 2 */
+    xEraseInitStruct.Banks = FLASH_BANK_2;
+    xEraseInitStruct.VoltageRange = FLASH_VOLTAGE_RANGE_3;
+    xEraseInitStruct.TypeErase = FLASH_TYPEERASE_SECTORS;
+    xEraseInitStruct.NbSectors = 1;
+    xEraseInitStruct.Sector = ulSector;
+
+    if( HAL_FLASHEx_Erase( &xEraseInitStruct, &ulPageError ) != HAL_OK )
+    {
+        /* Error occurred during page erase. */
+        AZLogError( ( "Error erasing flash bank" ) );
+        return eAzureIoTErrorFailed;
+    }
+
+    return eAzureIoTSuccess;
+}
+
+/* Erase the update bank up to ulEraseEnd, one sector at a time, yielding
+ * after each. ulErasedLength is moved on with every sector, so an erase cut
+ * short by an error is picked up by the next block. */
+static AzureIoTResult_t prvErase( uint32_t ulEraseEnd )
+{
+    while( ulErasedLength < ulEraseEnd )
+    {
+        if( prvEraseSector( ulErasedLength / FLASH_SECTOR_SIZE ) != eAzureIoTSuccess )
+        {
+            return eAzureIoTErrorFailed;
+        }
+
+        ulErasedLength += FLASH_SECTOR_SIZE;
+        prvYield();
+    }
+
+    return eAzureIoTSuccess;
+}
+
+/* The latest complete record of the journal, or NULL. Records are written in
+ * slot order, so the first slot still erased ends the scan and is where the
+ * next record goes. */
+static const AzureADUJournalRecord_t * prvFindJournalRecord( AzureADUImage_t * const pxAduImage )
+{
+    const AzureADUJournalRecord_t * pxRecords = ( const AzureADUJournalRecord_t * ) ( pxAduImage->xUpdatePartition + azureiotflashJOURNAL_OFFSET );
+    const AzureADUJournalRecord_t * pxLatest = NULL;
+
+    for( ulJournalNextRecord = 0; ulJournalNextRecord < azureiotflashJOURNAL_RECORDS; ulJournalNextRecord++ )
+    {
+        if( pxRecords[ ulJournalNextRecord ].ulImageFileSize == 0xffffffffUL )
+        {
+            break;
+        }
+
+        if( pxRecords[ ulJournalNextRecord ].ulMagic == azureiotflashJOURNAL_MAGIC )
+        {
+            pxLatest = &pxRecords[ ulJournalNextRecord ];
+        }
+    }
+
+    return pxLatest;
+}
+
+/* Program the staged flash word, padding a partial one with the erased value. */
+static AzureIoTResult_t prvFlushFlashWord( AzureADUImage_t * const pxAduImage )
+{
+    AzureIoTResult_t xResult = eAzureIoTSuccess;
+
+    if( ulFlashWordLength == 0 )
+    {
+        return eAzureIoTSuccess;
+    }
+
+    memset( ( uint8_t * ) ulFlashWord + ulFlashWordLength, 0xFF, azureiotflashH745_WORD_SIZE - ulFlashWordLength );
+
+    if( HAL_FLASH_Program( FLASH_TYPEPROGRAM_FLASHWORD, ( uint32_t ) ( pxAduImage->xUpdatePartition + ulFlashWordOffset ), ( uint32_t ) ulFlashWord ) != HAL_OK )
+    {
+        /* Error occurred while writing data in Flash memory */
+        xResult = eAzureIoTErrorFailed;
+    }
+
+    ulFlashWordOffset += azureiotflashH745_WORD_SIZE;
+    ulFlashWordLength = 0;
+
+    return xResult;
+}
+
 AzureIoTResult_t AzureIoTPlatform_Init( AzureADUImage_t * const pxAduImage )
 {
     pxAduImage->ulCurrentOffset = 0;
     pxAduImage->ulImageFileSize = 0;
 
-    static FLASH_EraseInitTypeDef xEraseInitStruct;
-    uint32_t ulPageError;
+    prvStartWrittenHash();
+
     FLASH_OBProgramInitTypeDef xOptionBytes;
     AzureIoTResult_t xResult = eAzureIoTSuccess;
 
@@ -56,70 +288,315 @@ AzureIoTResult_t AzureIoTPlatform_Init( AzureADUImage_t * const pxAduImage )
     HAL_FLASHEx_OBGetConfig( &xOptionBytes );
 
     pxAduImage->xUpdatePartition = ( uint8_t * ) ( FLASH_BASE + FLASH_BANK_SIZE );
-    /* With memory remapping, always erase bank 2 */
-    xEraseInitStruct.Banks = FLASH_BANK_2;
-    xEraseInitStruct.VoltageRange = FLASH_VOLTAGE_RANGE_3;
-    xEraseInitStruct.TypeErase = FLASH_TYPEERASE_MASSERASE;
+    ulFlashWordOffset = 0;
+    ulFlashWordLength = 0;
+
+    ulErasedLength = 0;
+
+    #if ( azureiotflashLAZY_ERASE == 0 )
+        /* By sector rather than a bank erase, which would hold the CPU for
+         * seconds without a yield. */
+        HAL_FLASH_Unlock();
+        xResult = prvErase( azureiotflashJOURNAL_OFFSET );
+        HAL_FLASH_Lock();
+    #endif
+
+    return xResult;
+}
+
+AzureIoTResult_t AzureIoTPlatform_ResumeInit( AzureADUImage_t * const pxAduImage,
+                                              uint8_t * pucSHA256Hash,
+                                              uint32_t ulSHA256HashLength )
+{
+    const AzureADUJournalRecord_t * pxRecord;
+    AzureIoTResult_t xResult = eAzureIoTSuccess;
+    uint32_t ulOutputSize;
+
+    if( pxAduImage->ulImageFileSize > azureiotflashJOURNAL_OFFSET )
+    {
+        AZLogError( ( "Image does not fit in the update bank\r\n" ) );
+        return eAzureIoTErrorFailed;
+    }
+
+    if( prvBase64Decode( pucSHA256Hash, ulSHA256HashLength, ucJournalManifestHash,
+                         azureiotflashSHA_256_SIZE, ( size_t * ) &ulOutputSize ) != eAzureIoTSuccess )
+    {
+        AZLogError( ( "Unable to decode base64 SHA256\r\n" ) );
+        return eAzureIoTErrorFailed;
+    }
+
+    /* Clear OPTVERR bit set on virgin samples. */
+    __HAL_FLASH_CLEAR_FLAG( FLASH_FLAG_OPERR );
+
+    pxAduImage->xUpdatePartition = ( uint8_t * ) ( FLASH_BASE + FLASH_BANK_SIZE );
+    pxAduImage->ulCurrentOffset = 0;
+    prvStartWrittenHash();
+
+    pxRecord = prvFindJournalRecord( pxAduImage );
+
+    if( ( pxRecord != NULL ) &&
+        ( pxRecord->ulImageFileSize == pxAduImage->ulImageFileSize ) &&
+        ( pxRecord->ulOffset <= pxAduImage->ulImageFileSize ) &&
+        ( ( pxRecord->ulOffset % FLASH_SECTOR_SIZE ) == 0 ) &&
+        ( memcmp( pxRecord->ucManifestHash, ucJournalManifestHash, azureiotflashSHA_256_SIZE ) == 0 ) )
+    {
+        /* Only trust what is in flash, not just what the journal says was written. */
+        prvHashRange( pxAduImage, &xWrittenHashContext, pxRecord->ulOffset );
+        ulHashedLength = pxRecord->ulOffset;
+        prvGetWrittenHash( ucCalculatedHash );
+
+        if( memcmp( ucCalculatedHash, pxRecord->ucWrittenHash, azureiotflashSHA_256_SIZE ) == 0 )
+        {
+            pxAduImage->ulCurrentOffset = pxRecord->ulOffset;
+        }
+        else
+        {
+            AZLogWarn( ( "Image in flash does not match the download journal\r\n" ) );
+            prvStartWrittenHash();
+        }
+    }
+
+    AZLogInfo( ( "Download starting at %u of %u bytes\r\n", pxAduImage->ulCurrentOffset, pxAduImage->ulImageFileSize ) );
+
+    /* Blocks written after the latest record may be in the sectors from the
+     * resume point on, so those are erased again before they are written. */
+    ulErasedLength = pxAduImage->ulCurrentOffset;
+    ulFlashWordOffset = pxAduImage->ulCurrentOffset;
+    ulFlashWordLength = 0;
+    ulJournalOffset = pxAduImage->ulCurrentOffset;
 
     HAL_FLASH_Unlock();
 
-    /* Erase non-boot bank */
-    if( HAL_FLASHEx_Erase( &xEraseInitStruct, &ulPageError ) != HAL_OK )
+    /* A download starting over gets an empty journal. */
+    if( ( pxAduImage->ulCurrentOffset == 0 ) && ( ulJournalNextRecord > 0 ) )
     {
-        /* Error occurred during page erase. */
-        AZLogError( ( "Error erasing flash bank" ) );
-        xResult = eAzureIoTErrorFailed;
+        xResult = prvEraseSector( azureiotflashJOURNAL_OFFSET / FLASH_SECTOR_SIZE );
+        ulJournalNextRecord = 0;
+    }
+
+    #if ( azureiotflashLAZY_ERASE == 0 )
+        if( xResult == eAzureIoTSuccess )
+        {
+            xResult = prvErase( azureiotflashJOURNAL_OFFSET );
+        }
+    #endif
+
+    HAL_FLASH_Lock();
+
+    return xResult;
+}
+
+AzureIoTResult_t AzureIoTPlatform_SaveProgress( AzureADUImage_t * const pxAduImage )
+{
+    static AzureADUJournalRecord_t xRecord;
+    uint32_t ulRecordAddress;
+    uint32_t ulWord;
+    AzureIoTResult_t xResult = eAzureIoTSuccess;
+
+    if( ( pxAduImage->ulCurrentOffset <= ulJournalOffset ) ||
+        ( ( pxAduImage->ulCurrentOffset != pxAduImage->ulImageFileSize ) &&
+          ( ( pxAduImage->ulCurrentOffset % FLASH_SECTOR_SIZE ) != 0 ) ) )
+    {
+        return eAzureIoTSuccess;
+    }
+
+    if( ulHashedLength != pxAduImage->ulCurrentOffset )
+    {
+        AZLogError( ( "Blocks were not written in order, progress not recorded\r\n" ) );
+        return eAzureIoTErrorFailed;
+    }
+
+    memset( &xRecord, 0xFF, sizeof( xRecord ) );
+    xRecord.ulImageFileSize = pxAduImage->ulImageFileSize;
+    xRecord.ulOffset = pxAduImage->ulCurrentOffset;
+    memcpy( xRecord.ucManifestHash, ucJournalManifestHash, azureiotflashSHA_256_SIZE );
+    prvGetWrittenHash( xRecord.ucWrittenHash );
+    xRecord.ulMagic = azureiotflashJOURNAL_MAGIC;
+
+    HAL_FLASH_Unlock();
+
+    /* The journal records bytes in flash, so the tail of the image is
+     * programmed first. Sector aligned offsets have no staged word. */
+    xResult = prvFlushFlashWord( pxAduImage );
+
+    if( ( xResult == eAzureIoTSuccess ) && ( ulJournalNextRecord == azureiotflashJOURNAL_RECORDS ) )
+    {
+        xResult = prvEraseSector( azureiotflashJOURNAL_OFFSET / FLASH_SECTOR_SIZE );
+        ulJournalNextRecord = 0;
+    }
+
+    ulRecordAddress = ( uint32_t ) ( pxAduImage->xUpdatePartition + azureiotflashJOURNAL_OFFSET ) +
+                      ulJournalNextRecord * sizeof( xRecord );
+
+    for( ulWord = 0; ( xResult == eAzureIoTSuccess ) && ( ulWord < sizeof( xRecord ) / azureiotflashH745_WORD_SIZE ); ulWord++ )
+    {
+        if( HAL_FLASH_Program( FLASH_TYPEPROGRAM_FLASHWORD, ulRecordAddress + ulWord * azureiotflashH745_WORD_SIZE,
+                               ( uint32_t ) &xRecord + ulWord * azureiotflashH745_WORD_SIZE ) != HAL_OK )
+        {
+            AZLogError( ( "Error writing the download journal\r\n" ) );
+            xResult = eAzureIoTErrorFailed;
+        }
     }
 
     HAL_FLASH_Lock();
 
+    /* A slot written in part is skipped, not written again. */
+    ulJournalNextRecord++;
+
+    if( xResult == eAzureIoTSuccess )
+    {
+        ulJournalOffset = pxAduImage->ulCurrentOffset;
+    }
+
     return xResult;
 }
 
 int64_t AzureIoTPlatform_GetSingleFlashBootBankSize()
 {
-    return FLASH_BANK_SIZE;
+    return azureiotflashJOURNAL_OFFSET;
 }
 
-AzureIoTResult_t AzureIoTPlatform_WriteBlock( AzureADUImage_t * const pxAduImage,
-                                              uint32_t ulOffset,
-                                              uint8_t * const pData,
-                                              uint32_t ulBlockSize )
+static AzureIoTResult_t prvWriteBlock( AzureADUImage_t * const pxAduImage,
+                                       uint32_t ulOffset,
+                                       uint8_t * const pData,
+                                       uint32_t ulBlockSize )
 {
-    uint8_t * pucNextWriteAddr = pxAduImage->xUpdatePartition + ulOffset;
     uint8_t * pucNextReadAddr = pData;
-    AzureIoTResult_t xResult = eAzureIoTSuccess;
+    uint32_t ulRemaining = ulBlockSize;
+    uint32_t ulCopySize;
+    uint32_t ulEraseEnd;
+    uint32_t ulSliceEnd;
 
-    /* end address of the block */
-    uint8_t * pucBlockEndAddr = pxAduImage->xUpdatePartition + ulOffset + ulBlockSize;
+    if( ulOffset != ulFlashWordOffset + ulFlashWordLength )
+    {
+        /* The block does not continue the staged word, so finish that word
+         * and start a new one, which has to be aligned. */
+        if( prvFlushFlashWord( pxAduImage ) != eAzureIoTSuccess )
+        {
+            return eAzureIoTErrorFailed;
+        }
 
-    HAL_FLASH_Unlock();
+        if( ( ulOffset % azureiotflashH745_WORD_SIZE ) != 0 )
+        {
+            AZLogError( ( "Block does not start on a flash word" ) );
+            return eAzureIoTErrorFailed;
+        }
+
+        ulFlashWordOffset = ulOffset;
+    }
 
-    while( pucNextWriteAddr < pucBlockEndAddr )
+    /* Blocks arrive in order, so only the sectors past the erased ones need
+     * erasing. With democonfigADU_PIPELINED_DOWNLOAD this runs in the flash
+     * write task, alongside the next chunk's download. */
+    if( ulOffset + ulBlockSize > ulErasedLength )
     {
-        if( HAL_FLASH_Program( FLASH_TYPEPROGRAM_FLASHWORD, ( uint32_t ) pucNextWriteAddr, ( uint32_t ) pucNextReadAddr ) != HAL_OK )
+        ulEraseEnd = ( ( ulOffset + ulBlockSize + FLASH_SECTOR_SIZE - 1 ) / FLASH_SECTOR_SIZE ) * FLASH_SECTOR_SIZE;
+
+        if( ulEraseEnd > azureiotflashJOURNAL_OFFSET )
         {
-            /* Error occurred while writing data in Flash memory */
-            xResult = eAzureIoTErrorFailed;
-            break;
+            AZLogError( ( "Block does not fit in the update bank" ) );
+            return eAzureIoTErrorFailed;
         }
 
-        pucNextWriteAddr += azureiotflashH745_WORD_SIZE;
-        pucNextReadAddr += azureiotflashH745_WORD_SIZE;
+        if( prvErase( ulEraseEnd ) != eAzureIoTSuccess )
+        {
+            return eAzureIoTErrorFailed;
+        }
+    }
+
+    if( ulOffset == ulHashedLength )
+    {
+        mbedtls_md_update( &xWrittenHashContext, ( const unsigned char * ) pData, ulBlockSize );
+        ulHashedLength += ulBlockSize;
+    }
+    else
+    {
+        ulHashedLength = azureiotflashHASH_INVALID;
     }
 
+    ulSliceEnd = ulFlashWordOffset + azureiotflashSLICE_SIZE;
+
+    /* Copy through the aligned word even when pData is whole words, as the
+     * HTTP buffer offers no alignment guarantee. */
+    while( ulRemaining > 0 )
+    {
+        ulCopySize = azureiotflashH745_WORD_SIZE - ulFlashWordLength;
+        ulCopySize = ulRemaining < ulCopySize ? ulRemaining : ulCopySize;
+
+        memcpy( ( uint8_t * ) ulFlashWord + ulFlashWordLength, pucNextReadAddr, ulCopySize );
+        ulFlashWordLength += ulCopySize;
+        pucNextReadAddr += ulCopySize;
+        ulRemaining -= ulCopySize;
+
+        if( ( ulFlashWordLength == azureiotflashH745_WORD_SIZE ) &&
+            ( prvFlushFlashWord( pxAduImage ) != eAzureIoTSuccess ) )
+        {
+            return eAzureIoTErrorFailed;
+        }
+
+        /* A large block is programmed in slices too. */
+        if( ( ulFlashWordOffset >= ulSliceEnd ) && ( ulRemaining > 0 ) )
+        {
+            prvYield();
+            ulSliceEnd = ulFlashWordOffset + azureiotflashSLICE_SIZE;
+        }
+    }
+
+    return eAzureIoTSuccess;
+}
+
+/* The download can stop after any block, cancelled or failed, without the
+ * platform being told, so the flash is only unlocked for each block. */
+AzureIoTResult_t AzureIoTPlatform_WriteBlock( AzureADUImage_t * const pxAduImage,
+                                              uint32_t ulOffset,
+                                              uint8_t * const pData,
+                                              uint32_t ulBlockSize )
+{
+    AzureIoTResult_t xResult;
+
+    HAL_FLASH_Unlock();
+    xResult = prvWriteBlock( pxAduImage, ulOffset, pData, ulBlockSize );
     HAL_FLASH_Lock();
 
     return xResult;
 }
 
+static AzureIoTResult_t prvCompareHash( void )
+{
+    if( memcmp( ucDecodedManifestHash, ucCalculatedHash, azureiotflashSHA_256_SIZE ) == 0 )
+    {
+        AZLogInfo( ( "SHAs match\r\n" ) );
+        return eAzureIoTSuccess;
+    }
+
+    AZLogError( ( "SHAs do not match\r\n" ) );
+    AZLogInfo( ( "Wanted: " ) );
+
+    for( int i = 0; i < azureiotflashSHA_256_SIZE; ++i )
+    {
+        AZLogInfo( ( "%x", ucDecodedManifestHash[ i ] ) );
+    }
+
+    AZLogInfo( ( "\r\n" ) );
+    AZLogInfo( ( "Calculated: " ) );
+
+    for( int i = 0; i < azureiotflashSHA_256_SIZE; ++i )
+    {
+        AZLogInfo( ( "%x", ucCalculatedHash[ i ] ) );
+    }
+
+    AZLogInfo( ( "\r\n" ) );
+
+    return eAzureIoTErrorFailed;
+}
+
 AzureIoTResult_t AzureIoTPlatform_VerifyImage( AzureADUImage_t * const pxAduImage,
                                                uint8_t * pucSHA256Hash,
                                                uint32_t ulSHA256HashLength )
 {
     int xResult;
     uint32_t ulOutputSize;
-    uint32_t ulReadSize;
+    int xReadBack = 1;
 
     AZLogInfo( ( "Base64 Encoded Hash from ADU: %.*s", ulSHA256HashLength, pucSHA256Hash ) );
     xResult = prvBase64Decode( pucSHA256Hash, ulSHA256HashLength, ucDecodedManifestHash, azureiotflashSHA_256_SIZE, ( size_t * ) &ulOutputSize );
@@ -130,55 +607,44 @@ AzureIoTResult_t AzureIoTPlatform_VerifyImage( AzureADUImage_t * const pxAduImag
         return eAzureIoTErrorFailed;
     }
 
-    mbedtls_md_context_t ctx;
-    mbedtls_md_type_t md_type = MBEDTLS_MD_SHA256;
-
-    mbedtls_md_init( &ctx );
-    mbedtls_md_setup( &ctx, mbedtls_md_info_from_type( md_type ), 0 );
-    mbedtls_md_starts( &ctx );
-
-    AZLogInfo( ( "Starting the mbedtls calculation: image size %d\r\n", pxAduImage->ulImageFileSize ) );
+    /* The download is over: program the tail. */
+    HAL_FLASH_Unlock();
+    xResult = prvFlushFlashWord( pxAduImage );
+    HAL_FLASH_Lock();
 
-    for( size_t ulOffset = 0; ulOffset < pxAduImage->ulImageFileSize; ulOffset += sizeof( ucPartitionReadBuffer ) )
+    if( xResult != eAzureIoTSuccess )
     {
-        ulReadSize = pxAduImage->ulImageFileSize - ulOffset < sizeof( ucPartitionReadBuffer ) ? pxAduImage->ulImageFileSize - ulOffset : sizeof( ucPartitionReadBuffer );
-
-        memcpy( ucPartitionReadBuffer, ( pxAduImage->xUpdatePartition + ulOffset ), ulReadSize );
-
-        mbedtls_md_update( &ctx, ( const unsigned char * ) ucPartitionReadBuffer, ulReadSize );
+        AZLogError( ( "Error writing the end of the image\r\n" ) );
+        return eAzureIoTErrorFailed;
     }
 
-    AZLogInfo( ( "mbedtls calculation completed\r\n" ) );
-
-    mbedtls_md_finish( &ctx, ucCalculatedHash );
-    mbedtls_md_free( &ctx );
+    #if ( azureiotflashSTREAMING_HASH == 1 )
+        if( ulHashedLength == pxAduImage->ulImageFileSize )
+        {
+            mbedtls_md_finish( &xWrittenHashContext, ucCalculatedHash );
+            /* The context is finished, so a second call has to read the image back. */
+            ulHashedLength = azureiotflashHASH_INVALID;
+            xResult = prvCompareHash();
+            xReadBack = ( xResult == eAzureIoTSuccess ) && ( azureiotflashREAD_BACK_CHECK == 1 );
+        }
+        else
+        {
+            AZLogWarn( ( "Blocks were not written in order, reading the image back\r\n" ) );
+        }
+    #endif /* azureiotflashSTREAMING_HASH == 1 */
 
-    if( memcmp( ucDecodedManifestHash, ucCalculatedHash, azureiotflashSHA_256_SIZE ) == 0 )
-    {
-        AZLogInfo( ( "SHAs match\r\n" ) );
-        xResult = eAzureIoTSuccess;
-    }
-    else
+    if( xReadBack )
     {
-        AZLogError( ( "SHAs do not match\r\n" ) );
-        AZLogInfo( ( "Wanted: " ) );
+        AZLogInfo( ( "Starting the mbedtls calculation: image size %d\r\n", pxAduImage->ulImageFileSize ) );
 
-        for( int i = 0; i < azureiotflashSHA_256_SIZE; ++i )
-        {
-            AZLogInfo( ( "%x", ucDecodedManifestHash[ i ] ) );
-        }
+        xResult = prvHashPartition( pxAduImage, ucCalculatedHash );
 
-        AZLogInfo( ( "\r\n" ) );
-        AZLogInfo( ( "Calculated: " ) );
+        AZLogInfo( ( "mbedtls calculation completed\r\n" ) );
 
-        for( int i = 0; i < azureiotflashSHA_256_SIZE; ++i )
+        if( xResult == eAzureIoTSuccess )
         {
-            AZLogInfo( ( "%x", ucCalculatedHash[ i ] ) );
+            xResult = prvCompareHash();
         }
-
-        AZLogInfo( ( "\r\n" ) );
-
-        xResult = eAzureIoTErrorFailed;
     }
 
     return xResult;
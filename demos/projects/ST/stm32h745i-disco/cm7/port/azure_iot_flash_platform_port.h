@@ -20,4 +20,31 @@ typedef struct AzureADUImageContext
 
 typedef AzureADUImageContext_t AzureADUImage_t;
 
+/**
+ * @brief Prepare the update bank for a download that may continue an earlier one.
+ *
+ * Used instead of AzureIoTPlatform_Init(). pxAduImage->ulImageFileSize must be set.
+ * If the progress journal in the last sector of the update bank records the
+ * same image and the flash contents up to the recorded offset still hash to
+ * the journaled value, ulCurrentOffset is set to that offset and only the
+ * sectors after it are erased. Otherwise the download starts from zero.
+ *
+ * @param[in] pxAduImage The image context.
+ * @param[in] pucSHA256Hash The base64 encoded SHA256 of the image from the update manifest.
+ * @param[in] ulSHA256HashLength The length of \p pucSHA256Hash.
+ */
+AzureIoTResult_t AzureIoTPlatform_ResumeInit( AzureADUImage_t * const pxAduImage,
+                                              uint8_t * pucSHA256Hash,
+                                              uint32_t ulSHA256HashLength );
+
+/**
+ * @brief Record pxAduImage->ulCurrentOffset and the hash of the bytes written so far.
+ *
+ * Only sector aligned offsets and the end of the image are recorded, so a
+ * resumed download never has to program a flash word twice.
+ *
+ * @param[in] pxAduImage The image context.
+ */
+AzureIoTResult_t AzureIoTPlatform_SaveProgress( AzureADUImage_t * const pxAduImage );
+
 #endif /* AZURE_IOT_FLASH_PLATFORM_PORT_H */
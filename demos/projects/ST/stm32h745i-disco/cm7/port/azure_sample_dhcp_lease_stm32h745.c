@@ -0,0 +1,55 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "azure_sample_dhcp_lease.h"
+
+#include "stm32h7xx_hal.h"
+
+/* The record is at the start of the backup SRAM, which keeps it across
+ * resets and brownouts, and across power loss with a battery on VBAT. */
+#define dhcpleaseBKPSRAM    ( ( DHCPLeaseRecord_t * ) D3_BKPSRAM_BASE )
+
+/* The D-cache is cleaned by whole lines. */
+#define dhcpleaseCACHE_LINE_SIZE    32
+
+static bool xBackupReady = false;
+/*-----------------------------------------------------------*/
+
+static void prvBackupInit( void )
+{
+    if( !xBackupReady )
+    {
+        HAL_PWR_EnableBkUpAccess();
+        __HAL_RCC_BKPRAM_CLK_ENABLE();
+        ( void ) HAL_PWREx_EnableBkUpReg();
+        xBackupReady = true;
+    }
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t DHCPLease_PlatformRead( DHCPLeaseRecord_t * pxRecord )
+{
+    prvBackupInit();
+    memcpy( pxRecord, dhcpleaseBKPSRAM, sizeof( *pxRecord ) );
+
+    return eAzureIoTSuccess;
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t DHCPLease_PlatformWrite( const DHCPLeaseRecord_t * pxRecord )
+{
+    prvBackupInit();
+    memcpy( dhcpleaseBKPSRAM, pxRecord, sizeof( *pxRecord ) );
+
+    /* The backup SRAM is cacheable, and a reset would lose what is still
+     * only in the cache. */
+    SCB_CleanDCache_by_Addr( ( uint32_t * ) D3_BKPSRAM_BASE,
+                             ( ( sizeof( *pxRecord ) + dhcpleaseCACHE_LINE_SIZE - 1 ) /
+                               dhcpleaseCACHE_LINE_SIZE ) * dhcpleaseCACHE_LINE_SIZE );
+
+    return eAzureIoTSuccess;
+}
+/*-----------------------------------------------------------*/
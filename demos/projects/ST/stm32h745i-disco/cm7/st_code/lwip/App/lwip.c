@@ -34,6 +34,9 @@
 
 /* USER CODE BEGIN 0 */
 
+/* DHCP lease asked for again at boot. */
+#include "azure_sample_dhcp_lease.h"
+
 /* USER CODE END 0 */
 /* Private function prototypes -----------------------------------------------*/
 static void ethernet_link_status_updated(struct netif *netif);
@@ -62,10 +65,6 @@ uint8_t GATEWAY_ADDRESS[4];
   */
 void MX_LWIP_Init(void)
 {
-	struct dhcp * pxDHCP;
-	    TickType_t xTimeoutTick;
-	    const ip_addr_t * pxIP;
-
   /* Initilialize the LwIP stack with RTOS */
   tcpip_init( NULL, NULL );
 
@@ -98,15 +97,10 @@ void MX_LWIP_Init(void)
 /* USER CODE BEGIN 3 */
 
   netifapi_dhcp_start( &gnetif );
-  pxDHCP = netif_dhcp_data( &gnetif );
-
-  xTimeoutTick = xTaskGetTickCount() + 5000 * configTICK_RATE_HZ;
+  ( void ) DHCPLease_Start( &gnetif );
 
-  while( pxDHCP->state != DHCP_STATE_BOUND &&
-         xTimeoutTick > xTaskGetTickCount() )
-  {
-    vTaskDelay( 100 );
-  }
+  /* Goes on the moment the address is bound. */
+  ( void ) DHCPLease_WaitBound( &gnetif, 5000 * configTICK_RATE_HZ );
 
 /* USER CODE END 3 */
 }
@@ -52,6 +52,69 @@
 
 /* USER CODE BEGIN 1 */
 
+/* Set to 1 to hand the DMA buffers straight to lwIP. A spare buffer is
+   swapped into the descriptor in place of each received one, and the buffer
+   goes back to the spare list when lwIP frees the pbuf. Set to 0 to copy
+   every frame into a pbuf from RxPool instead. */
+#ifndef ETH_RX_ZERO_COPY
+  #define ETH_RX_ZERO_COPY 1
+#endif
+
+/* Number of received frames lwIP can hold before the driver drops input,
+   when ETH_RX_ZERO_COPY is 0. */
+#ifndef ETH_RX_POOL_SIZE
+  #define ETH_RX_POOL_SIZE 10
+#endif
+
+/* Number of DMA receive buffers. With ETH_RX_ZERO_COPY the buffers beyond
+   ETH_RX_DESC_CNT are the ones lwIP can hold at a time. */
+#ifndef ETH_RX_BUFFER_CNT
+  #if (ETH_RX_ZERO_COPY == 1)
+    #define ETH_RX_BUFFER_CNT (2 * ETH_RX_DESC_CNT)
+  #else
+    #define ETH_RX_BUFFER_CNT ETH_RX_DESC_CNT
+  #endif
+#endif
+
+#if (ETH_RX_ZERO_COPY == 1) && (ETH_RX_BUFFER_CNT <= ETH_RX_DESC_CNT)
+  #error "ETH_RX_ZERO_COPY needs ETH_RX_BUFFER_CNT above ETH_RX_DESC_CNT"
+#endif
+
+/* D2 SRAM layout at 0x30040000: RX descriptors, TX descriptors from 0x100,
+   RX buffers from 0x200 up to the lwIP heap at LWIP_RAM_HEAP_POINTER. */
+#if (ETH_RX_DESC_CNT > 10) || (ETH_TX_DESC_CNT > 10)
+  #error "ETH_RX_DESC_CNT and ETH_TX_DESC_CNT must not exceed 10"
+#endif
+#if (0x30040200 + (ETH_RX_BUFFER_CNT * ETH_RX_BUFFER_SIZE)) > LWIP_RAM_HEAP_POINTER
+  #error "RX buffers overlap the lwIP heap, reduce ETH_RX_BUFFER_CNT"
+#endif
+
+/* With BOARD_ETH_DCACHE the D2 SRAM is cached, see MPU_Config() in main.c.
+   Invalidating an RX buffer must not drop a line it shares with other data,
+   so each buffer starts and ends on a cache line. */
+#define ETH_DCACHE_LINE_SIZE 32U
+
+#ifdef BOARD_ETH_DCACHE
+  #if (ETH_RX_BUFFER_SIZE % ETH_DCACHE_LINE_SIZE) != 0
+    #error "ETH_RX_BUFFER_SIZE must be a multiple of the 32 byte cache line"
+  #endif
+  #if (LWIP_RAM_HEAP_POINTER % ETH_DCACHE_LINE_SIZE) != 0
+    #error "LWIP_RAM_HEAP_POINTER must be aligned to the 32 byte cache line"
+  #endif
+#endif
+
+/* Set to 1 to mask the RX interrupt from the first frame until the input
+   task has drained the ring, so a burst costs one wake-up instead of one per
+   frame. ETH_RX_MODERATION_DELAY_MS additionally lets a burst build up
+   before draining; keep it short enough for the RX ring to absorb. */
+#ifndef ETH_RX_IRQ_MODERATION
+  #define ETH_RX_IRQ_MODERATION 0
+#endif
+
+#ifndef ETH_RX_MODERATION_DELAY_MS
+  #define ETH_RX_MODERATION_DELAY_MS 0
+#endif
+
 /* USER CODE END 1 */
 
 /* Private variables ---------------------------------------------------------*/
@@ -79,22 +142,22 @@
 
 #pragma location=0x30040000
 ETH_DMADescTypeDef  DMARxDscrTab[ETH_RX_DESC_CNT]; /* Ethernet Rx DMA Descriptors */
-#pragma location=0x30040060
+#pragma location=0x30040100
 ETH_DMADescTypeDef  DMATxDscrTab[ETH_TX_DESC_CNT]; /* Ethernet Tx DMA Descriptors */
 #pragma location=0x30040200
-uint8_t Rx_Buff[ETH_RX_DESC_CNT][ETH_RX_BUFFER_SIZE]; /* Ethernet Receive Buffers */
+uint8_t Rx_Buff[ETH_RX_BUFFER_CNT][ETH_RX_BUFFER_SIZE]; /* Ethernet Receive Buffers */
 
 #elif defined ( __CC_ARM )  /* MDK ARM Compiler */
 
 __attribute__((at(0x30040000))) ETH_DMADescTypeDef  DMARxDscrTab[ETH_RX_DESC_CNT]; /* Ethernet Rx DMA Descriptors */
-__attribute__((at(0x30040060))) ETH_DMADescTypeDef  DMATxDscrTab[ETH_TX_DESC_CNT]; /* Ethernet Tx DMA Descriptors */
-__attribute__((at(0x30040200))) uint8_t Rx_Buff[ETH_RX_DESC_CNT][ETH_RX_BUFFER_SIZE]; /* Ethernet Receive Buffer */
+__attribute__((at(0x30040100))) ETH_DMADescTypeDef  DMATxDscrTab[ETH_TX_DESC_CNT]; /* Ethernet Tx DMA Descriptors */
+__attribute__((at(0x30040200))) uint8_t Rx_Buff[ETH_RX_BUFFER_CNT][ETH_RX_BUFFER_SIZE]; /* Ethernet Receive Buffer */
 
 #elif defined ( __GNUC__ ) /* GNU Compiler */ 
 
 ETH_DMADescTypeDef DMARxDscrTab[ETH_RX_DESC_CNT] __attribute__((section(".RxDecripSection"))); /* Ethernet Rx DMA Descriptors */
 ETH_DMADescTypeDef DMATxDscrTab[ETH_TX_DESC_CNT] __attribute__((section(".TxDecripSection")));   /* Ethernet Tx DMA Descriptors */
-uint8_t Rx_Buff[ETH_RX_DESC_CNT][ETH_RX_BUFFER_SIZE] __attribute__((section(".RxArraySection"))); /* Ethernet Receive Buffers */
+uint8_t Rx_Buff[ETH_RX_BUFFER_CNT][ETH_RX_BUFFER_SIZE] __attribute__((section(".RxArraySection"), aligned(ETH_DCACHE_LINE_SIZE))); /* Ethernet Receive Buffers */
 
 #endif
 
@@ -103,13 +166,20 @@ uint8_t Rx_Buff[ETH_RX_DESC_CNT][ETH_RX_BUFFER_SIZE] __attribute__((section(".Rx
 /* USER CODE END 2 */
 
 osSemaphoreId RxPktSemaphore = NULL; /* Semaphore to signal incoming packets */
+#if (ETH_RX_ZERO_COPY == 1)
+/* One pbuf per DMA buffer: RxPbuf[i] wraps Rx_Buff[i] */
+struct pbuf_custom RxPbuf[ETH_RX_BUFFER_CNT];
+/* Indexes of the buffers neither in the ring nor held by lwIP */
+osMessageQId RxFreeQId;
+#else
 /* Memory Pool Declaration */
 osPoolDef_t RxPool = {
-  .pool_sz = 10,
+  .pool_sz = ETH_RX_POOL_SIZE,
   .item_sz = sizeof(struct pbuf_custom) + ETH_RX_BUFFER_SIZE,
   .pool = NULL
 };
 osPoolId RXPoolId;
+#endif
 
 /* Global Ethernet handle */
 ETH_HandleTypeDef heth;
@@ -283,6 +353,10 @@ void HAL_ETH_MspDeInit(ETH_HandleTypeDef* ethHandle)
   */
 void HAL_ETH_RxCpltCallback(ETH_HandleTypeDef *heth)
 {
+#if (ETH_RX_IRQ_MODERATION == 1)
+  /* The input task re-enables it once the ring is empty. */
+  __HAL_ETH_DMA_DISABLE_IT(heth, ETH_DMACIER_RIE);
+#endif
   osSemaphoreRelease(RxPktSemaphore);
 }
 
@@ -369,8 +443,19 @@ static void low_level_init(struct netif *netif)
   osSemaphoreDef(SEM);
   RxPktSemaphore = osSemaphoreCreate(osSemaphore(SEM) , 1 );
 
+#if (ETH_RX_ZERO_COPY == 1)
+  /* the buffers past the ring start out spare */
+  osMessageQDef(RxFreeQ, ETH_RX_BUFFER_CNT, uint32_t);
+  RxFreeQId = osMessageCreate(osMessageQ(RxFreeQ), NULL);
+
+  for(idx = ETH_RX_DESC_CNT; idx < ETH_RX_BUFFER_CNT; idx ++)
+  {
+    osMessagePut(RxFreeQId, idx, 0);
+  }
+#else
   /* create a Memory pool for RX frames */
   RXPoolId = osPoolCreate(&RxPool);
+#endif
 
   /* create the task that handles the ETH_MAC */
 /* USER CODE BEGIN OS_THREAD_DEF_CREATE_CMSIS_RTOS_V1 */
@@ -482,6 +567,13 @@ static err_t low_level_output(struct netif *netif, struct pbuf *p)
     Txbuffer[i].buffer = q->payload;
     Txbuffer[i].len = q->len;
     framelen += q->len;
+
+#if !defined(DUAL_CORE) || defined(CORE_CM7)
+    /* Write the payload back for the DMA to read: the lwIP heap is cached
+       with BOARD_ETH_DCACHE, and references into the D1 SRAM always are */
+    SCB_CleanDCache_by_Addr((uint32_t *)((uint32_t)q->payload & ~(ETH_DCACHE_LINE_SIZE - 1U)),
+                            q->len + ((uint32_t)q->payload & (ETH_DCACHE_LINE_SIZE - 1U)));
+#endif
     
     if(i>0)
     {
@@ -512,6 +604,56 @@ static err_t low_level_output(struct netif *netif, struct pbuf *p)
  * @return a pbuf filled with the received packet (including MAC header)
  *         NULL on memory error
    */
+#if (ETH_RX_ZERO_COPY == 1)
+static struct pbuf * low_level_input(struct netif *netif)
+{
+  struct pbuf *p = NULL;
+  ETH_BufferTypeDef RxBuff;
+  uint32_t framelength = 0;
+  uint32_t idx;
+  uint32_t desc;
+  osEvent event;
+
+  if (HAL_ETH_GetRxDataBuffer(&heth, &RxBuff) == HAL_OK)
+  {
+    HAL_ETH_GetRxDataLength(&heth, &framelength);
+
+    /* With no spare buffer the received one stays in the ring and the frame
+       is dropped: TCP retransmits it. */
+    event = osMessageGet(RxFreeQId, 0);
+
+    if (event.status == osEventMessage)
+    {
+      /* HAL_ETH_BuildRxDescriptors() re-arms descriptors from BackupAddr0,
+         so pointing it at the spare buffer keeps the received one out of
+         the ring until lwIP frees it. */
+      for(desc = 0; desc < ETH_RX_DESC_CNT; desc ++)
+      {
+        if (DMARxDscrTab[desc].BackupAddr0 == (uint32_t)RxBuff.buffer)
+        {
+          DMARxDscrTab[desc].BackupAddr0 = (uint32_t)Rx_Buff[event.value.v];
+          break;
+        }
+      }
+
+#if !defined(DUAL_CORE) || defined(CORE_CM7)
+      /* Invalidate data cache so the CPU sees what the DMA wrote */
+      SCB_InvalidateDCache_by_Addr((uint32_t *)RxBuff.buffer, framelength);
+#endif
+
+      idx = (RxBuff.buffer - &Rx_Buff[0][0]) / ETH_RX_BUFFER_SIZE;
+      RxPbuf[idx].custom_free_function = pbuf_free_custom;
+
+      p = pbuf_alloced_custom(PBUF_RAW, framelength, PBUF_REF, &RxPbuf[idx], RxBuff.buffer, ETH_RX_BUFFER_SIZE);
+    }
+
+    /* Build Rx descriptor to be ready for next data reception */
+    HAL_ETH_BuildRxDescriptors(&heth);
+  }
+
+  return p;
+}
+#else
 static struct pbuf * low_level_input(struct netif *netif)
 {
   struct pbuf *p = NULL;
@@ -523,9 +665,6 @@ static struct pbuf * low_level_input(struct netif *netif)
   if (HAL_ETH_GetRxDataBuffer(&heth, &RxBuff) == HAL_OK) 
   {
     HAL_ETH_GetRxDataLength(&heth, &framelength);
-    
-    /* Build Rx descriptor to be ready for next data reception */
-    HAL_ETH_BuildRxDescriptors(&heth);
 
 #if !defined(DUAL_CORE) || defined(CORE_CM7)
     /* Invalidate data cache for ETH Rx Buffers */
@@ -533,16 +672,28 @@ static struct pbuf * low_level_input(struct netif *netif)
 #endif
 
     custom_pbuf  = (struct pbuf_custom*)osPoolAlloc(RXPoolId);
-    payload = custom_pbuf + sizeof(struct pbuf_custom);
-    custom_pbuf->custom_free_function = pbuf_free_custom;
-    memcpy(payload, RxBuff.buffer, framelength);
 
-    p = pbuf_alloced_custom(PBUF_RAW, framelength, PBUF_REF, custom_pbuf, payload, ETH_RX_BUFFER_SIZE);
+    /* All pool buffers are held by lwIP: drop the frame and let TCP
+       retransmit it. */
+    if (custom_pbuf != NULL)
+    {
+      /* The payload follows the pbuf_custom header in the pool item. */
+      payload = (uint8_t *)custom_pbuf + sizeof(struct pbuf_custom);
+      custom_pbuf->custom_free_function = pbuf_free_custom;
+      memcpy(payload, RxBuff.buffer, framelength);
+
+      p = pbuf_alloced_custom(PBUF_RAW, framelength, PBUF_REF, custom_pbuf, payload, ETH_RX_BUFFER_SIZE);
+    }
+
+    /* Build Rx descriptor to be ready for next data reception, only once
+       the frame is copied out of its buffer */
+    HAL_ETH_BuildRxDescriptors(&heth);
   }
   
   
   return p;
 }
+#endif
 
 /**
  * This function should be called when a packet is ready to be read
@@ -562,6 +713,9 @@ void ethernetif_input(void const * argument)
   {
     if (osSemaphoreWait(RxPktSemaphore, TIME_WAITING_FOR_INPUT) == osOK)
     {
+#if (ETH_RX_IRQ_MODERATION == 1) && (ETH_RX_MODERATION_DELAY_MS > 0)
+      osDelay(ETH_RX_MODERATION_DELAY_MS);
+#endif
       do
       {
         LOCK_TCPIP_CORE();
@@ -575,6 +729,11 @@ void ethernetif_input(void const * argument)
         }
         UNLOCK_TCPIP_CORE();
       } while(p!=NULL);
+#if (ETH_RX_IRQ_MODERATION == 1)
+      /* A frame that arrived since the last read leaves RI set, so the
+         interrupt fires again straight away. */
+      __HAL_ETH_DMA_ENABLE_IT(&heth, ETH_DMACIER_RIE);
+#endif
     }
   }
   
@@ -659,7 +818,19 @@ err_t ethernetif_init(struct netif *netif)
   */
 void pbuf_free_custom(struct pbuf *p)
 {
+#if (ETH_RX_ZERO_COPY == 1)
+  uint32_t idx = (struct pbuf_custom*)p - RxPbuf;
+
+#if !defined(DUAL_CORE) || defined(CORE_CM7)
+  /* Drop any lines lwIP dirtied, e.g. an echo reply built in place, so they
+     are not written back over the next DMA reception */
+  SCB_InvalidateDCache_by_Addr((uint32_t *)Rx_Buff[idx], ETH_RX_BUFFER_SIZE);
+#endif
+
+  osMessagePut(RxFreeQId, idx, 0);
+#else
   osPoolFree(RXPoolId, (void*)p);
+#endif
 }
 
 /* USER CODE BEGIN 6 */
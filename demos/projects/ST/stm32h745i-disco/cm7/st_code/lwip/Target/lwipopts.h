@@ -70,6 +70,8 @@
 #define TCP_WND_UPDATE_THRESHOLD 536
 /*----- Default Value for LWIP_NETIF_LINK_CALLBACK: 0 ---*/
 #define LWIP_NETIF_LINK_CALLBACK 1
+/*----- Default Value for LWIP_NETIF_STATUS_CALLBACK: 0 ---*/
+#define LWIP_NETIF_STATUS_CALLBACK 1
 /*----- Value in opt.h for TCPIP_THREAD_STACKSIZE: 0 -----*/
 #define TCPIP_THREAD_STACKSIZE 1024
 /*----- Value in opt.h for TCPIP_THREAD_PRIO: 1 -----*/
@@ -100,6 +102,8 @@
 #define CHECKSUM_GEN_UDP 0
 /*----- Value in opt.h for CHECKSUM_GEN_TCP: 1 -----*/
 #define CHECKSUM_GEN_TCP 0
+/*----- Value in opt.h for CHECKSUM_GEN_ICMP: 1 -----*/
+#define CHECKSUM_GEN_ICMP 0
 /*----- Value in opt.h for CHECKSUM_GEN_ICMP6: 1 -----*/
 #define CHECKSUM_GEN_ICMP6 0
 /*----- Value in opt.h for CHECKSUM_CHECK_IP: 1 -----*/
@@ -108,6 +112,8 @@
 #define CHECKSUM_CHECK_UDP 0
 /*----- Value in opt.h for CHECKSUM_CHECK_TCP: 1 -----*/
 #define CHECKSUM_CHECK_TCP 0
+/*----- Value in opt.h for CHECKSUM_CHECK_ICMP: 1 -----*/
+#define CHECKSUM_CHECK_ICMP 0
 /*----- Value in opt.h for CHECKSUM_CHECK_ICMP6: 1 -----*/
 #define CHECKSUM_CHECK_ICMP6 0
 /*-----------------------------------------------------------------------------*/
@@ -118,6 +124,39 @@
 #define LWIP_NETIF_API 1
 #define LWIP_SO_RCVTIMEO 1
 #define LWIP_SO_SNDTIMEO 1
+
+/* SNTP: the time goes to the clock of azure_sample_time_sync.c, from main.c,
+ * queried each hour as democonfigTIME_SYNC_INTERVAL_MS.
+ * Its timer is one more timeout. */
+#include <stdint.h>
+void vMainSntpSetTime( uint32_t ulSeconds,
+                       uint32_t ulMicroseconds );
+#define SNTP_SERVER_DNS 1
+#define SNTP_CHECK_RESPONSE 1
+#define SNTP_STARTUP_DELAY 0
+#define SNTP_UPDATE_DELAY ( 60 * 60 * 1000 )
+#define SNTP_SET_SYSTEM_TIME_US( sec, us ) vMainSntpSetTime( ( sec ), ( us ) )
+#define MEMP_NUM_SYS_TIMEOUT ( LWIP_NUM_SYS_TIMEOUT_INTERNAL + 1 )
+
+/* lwipconfigBULK_PROFILE==1: size TCP for large downloads such as ADU
+ * images. Full-size segments and an 8 segment window replace the 536 byte
+ * segments and 4 segment window lwIP defaults to, and the RX buffers grow so
+ * the window fits: ETH_RX_BUFFER_CNT for the zero-copy RX path, which is as
+ * many as the D2 SRAM layout holds, or ETH_RX_POOL_SIZE for the copying
+ * one. MEM_SIZE is bounded by the D2 SRAM region it lives in
+ * and is left as is. */
+#ifndef lwipconfigBULK_PROFILE
+  #define lwipconfigBULK_PROFILE 0
+#endif
+
+#if (lwipconfigBULK_PROFILE == 1)
+  #define TCP_MSS             1460
+  #define TCP_WND             (8 * TCP_MSS)
+  #define TCP_QUEUE_OOSEQ     1
+  #define TCP_OOSEQ_MAX_PBUFS 4
+  #define ETH_RX_POOL_SIZE    16
+  #define ETH_RX_BUFFER_CNT   10
+#endif
 //#define LWIP_TIMEVAL_PRIVATE (0)
 
  extern int uxRand();
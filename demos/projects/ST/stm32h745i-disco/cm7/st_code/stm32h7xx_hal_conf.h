@@ -51,7 +51,7 @@
 /* #define HAL_SDRAM_MODULE_ENABLED   */
 /* #define HAL_HASH_MODULE_ENABLED   */
 /* #define HAL_HRTIM_MODULE_ENABLED   */
-/* #define HAL_HSEM_MODULE_ENABLED   */
+#define HAL_HSEM_MODULE_ENABLED
 /* #define HAL_GFXMMU_MODULE_ENABLED   */
 /* #define HAL_JPEG_MODULE_ENABLED   */
 /* #define HAL_OPAMP_MODULE_ENABLED   */
@@ -208,8 +208,14 @@
 #define  USE_HAL_WWDG_REGISTER_CALLBACKS    0U /* WWDG register callback disabled    */
 
 /* ########################### Ethernet Configuration ######################### */
+/* Each ring holds up to 10 descriptors in its slot of the D2 SRAM section,
+   see the .lwip_sec layout in the linker script. */
+#ifndef ETH_TX_DESC_CNT
 #define ETH_TX_DESC_CNT         4  /* number of Ethernet Tx DMA descriptors */
+#endif
+#ifndef ETH_RX_DESC_CNT
 #define ETH_RX_DESC_CNT         4  /* number of Ethernet Rx DMA descriptors */
+#endif
 
 #define ETH_MAC_ADDR0    ((uint8_t)0x02)
 #define ETH_MAC_ADDR1    ((uint8_t)0x00)
@@ -0,0 +1,81 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+#include "dual_core_ring.h"
+
+#include <string.h>
+
+#include "stm32h7xx.h"
+
+/*-----------------------------------------------------------*/
+
+void DualCoreRing_Init( DualCoreRing_t * pxRing )
+{
+    pxRing->ulHead = 0;
+    pxRing->ulTail = 0;
+
+    /* The indexes must be visible before the CM7 sees the ring as ready. */
+    __DMB();
+    pxRing->ulMagic = dualcoreRING_MAGIC;
+}
+/*-----------------------------------------------------------*/
+
+bool DualCoreRing_Push( DualCoreRing_t * pxRing,
+                        const uint8_t * pucMessage,
+                        uint32_t ulMessageLength )
+{
+    uint32_t ulHead = pxRing->ulHead;
+    DualCoreMessage_t * pxSlot;
+
+    if( ( ulMessageLength > dualcoreMESSAGE_SIZE ) ||
+        ( ( ulHead - pxRing->ulTail ) >= dualcoreRING_SLOTS ) )
+    {
+        return false;
+    }
+
+    pxSlot = &pxRing->xSlots[ ulHead % dualcoreRING_SLOTS ];
+    memcpy( pxSlot->ucPayload, pucMessage, ulMessageLength );
+    pxSlot->ulLength = ulMessageLength;
+
+    /* The slot must be written before the CM7 sees the new head. */
+    __DMB();
+    pxRing->ulHead = ulHead + 1;
+
+    return true;
+}
+/*-----------------------------------------------------------*/
+
+uint32_t DualCoreRing_Pop( DualCoreRing_t * pxRing,
+                           uint8_t * pucBuffer,
+                           uint32_t ulBufferSize )
+{
+    uint32_t ulTail = pxRing->ulTail;
+    uint32_t ulLength;
+    DualCoreMessage_t * pxSlot;
+
+    if( ( pxRing->ulMagic != dualcoreRING_MAGIC ) || ( pxRing->ulHead == ulTail ) )
+    {
+        return 0;
+    }
+
+    /* The head must be read before the slot it covers. */
+    __DMB();
+    pxSlot = &pxRing->xSlots[ ulTail % dualcoreRING_SLOTS ];
+    ulLength = pxSlot->ulLength;
+
+    if( ( ulLength > dualcoreMESSAGE_SIZE ) || ( ulLength > ulBufferSize ) )
+    {
+        ulLength = 0;
+    }
+    else
+    {
+        memcpy( pucBuffer, pxSlot->ucPayload, ulLength );
+    }
+
+    /* The slot must be read before the CM4 may reuse it. */
+    __DMB();
+    pxRing->ulTail = ulTail + 1;
+
+    return ulLength;
+}
+/*-----------------------------------------------------------*/
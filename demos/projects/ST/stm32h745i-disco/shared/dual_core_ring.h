@@ -0,0 +1,79 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @file dual_core_ring.h
+ *
+ * @brief Telemetry ring shared by the two cores of the STM32H745.
+ *
+ * The CM4 serialises sensor readings into the ring and the CM7 publishes
+ * them. The ring sits at the start of D3 SRAM, which both cores see at the
+ * same address and which the CM7 maps as non-cacheable. The head is only
+ * written by the CM4 and the tail only by the CM7, so no lock is needed.
+ * After a push the CM4 takes and releases dualcoreHSEM_TELEMETRY_ID, which
+ * interrupts the CM7.
+ */
+
+#ifndef DUAL_CORE_RING_H
+#define DUAL_CORE_RING_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Shared D3 SRAM, left out of both linker scripts. */
+#define dualcoreSHARED_RAM_ADDRESS    ( 0x38000000UL )
+#define dualcoreSHARED_RAM_SIZE       ( 8 * 1024 )
+
+/* Released by the CM7 to wake the CM4 at boot. */
+#define dualcoreHSEM_BOOT_ID          ( 0U )
+
+/* Released by the CM4 after it pushed telemetry. */
+#define dualcoreHSEM_TELEMETRY_ID     ( 1U )
+
+#define dualcoreRING_SLOTS            ( 16U )
+#define dualcoreMESSAGE_SIZE          ( 124U )
+
+/* Set by the CM4 once the ring is initialized. */
+#define dualcoreRING_MAGIC            ( 0x52494E47UL )
+
+typedef struct DualCoreMessage
+{
+    uint32_t ulLength;
+    uint8_t ucPayload[ dualcoreMESSAGE_SIZE ];
+} DualCoreMessage_t;
+
+typedef struct DualCoreRing
+{
+    volatile uint32_t ulMagic;
+    volatile uint32_t ulHead; /* Messages pushed, written by the CM4. */
+    volatile uint32_t ulTail; /* Messages popped, written by the CM7. */
+    DualCoreMessage_t xSlots[ dualcoreRING_SLOTS ];
+} DualCoreRing_t;
+
+#define dualcoreRING    ( ( DualCoreRing_t * ) dualcoreSHARED_RAM_ADDRESS )
+
+/**
+ * @brief Empty the ring and mark it ready. Called by the CM4.
+ */
+void DualCoreRing_Init( DualCoreRing_t * pxRing );
+
+/**
+ * @brief Add a message. Called by the CM4.
+ *
+ * @return false if the ring is full or the message larger than dualcoreMESSAGE_SIZE.
+ */
+bool DualCoreRing_Push( DualCoreRing_t * pxRing,
+                        const uint8_t * pucMessage,
+                        uint32_t ulMessageLength );
+
+/**
+ * @brief Take the oldest message. Called by the CM7.
+ *
+ * @return Length of the message copied to \p pucBuffer, 0 if there was none.
+ * Messages larger than \p ulBufferSize are dropped.
+ */
+uint32_t DualCoreRing_Pop( DualCoreRing_t * pxRing,
+                           uint8_t * pucBuffer,
+                           uint32_t ulBufferSize );
+
+#endif /* DUAL_CORE_RING_H */
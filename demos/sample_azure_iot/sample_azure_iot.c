@@ -12,12 +12,11 @@
 /* Demo Specific configs. */
 #include "demo_config.h"
 
-/* Azure Provisioning/IoT Hub library includes */
+/* Azure IoT Hub library includes */
 #include "azure_iot_hub_client.h"
-#include "azure_iot_provisioning_client.h"
 
-/* Exponential backoff retry include. */
-#include "backoff_algorithm.h"
+/* Connections, provisioning and reconnects. */
+#include "azure_sample_connection_manager.h"
 
 /* Transport interface implementation include header for TLS. */
 #include "transport_tls_socket.h"
@@ -25,6 +24,33 @@
 /* Crypto helper header. */
 #include "azure_sample_crypto.h"
 
+/* Telemetry batching helper header. */
+#include "azure_sample_telemetry_batch.h"
+
+/* Latency histogram of the measurement mode. */
+#include "azure_sample_latency.h"
+
+/* Task creation, pinned to a core where configured. */
+#include "azure_sample_task.h"
+
+/* Trace points of the samples. */
+#include "azure_sample_trace.h"
+
+/* Startup timing. */
+#include "azure_sample_startup.h"
+
+/* Subscriptions in one SUBSCRIBE. */
+#include "azure_sample_subscribe_batch.h"
+
+/* Cloud-to-device messages handled by a consumer task. */
+#include "azure_sample_c2d_queue.h"
+
+/* Scripted disconnects and leak checks of the soak runs. */
+#include "azure_sample_soak.h"
+
+/* A deep sleep between the batches of telemetry. */
+#include "azure_sample_deep_sleep.h"
+
 /*-----------------------------------------------------------*/
 
 /* Compile time error for undefined configs. */
@@ -50,23 +76,6 @@
 
 /*-----------------------------------------------------------*/
 
-/**
- * @brief The maximum number of retries for network operation with server.
- */
-#define sampleazureiotRETRY_MAX_ATTEMPTS                      ( 5U )
-
-/**
- * @brief The maximum back-off delay (in milliseconds) for retrying failed operation
- *  with server.
- */
-#define sampleazureiotRETRY_MAX_BACKOFF_DELAY_MS              ( 5000U )
-
-/**
- * @brief The base back-off delay (in milliseconds) to use for network operation retry
- * attempts.
- */
-#define sampleazureiotRETRY_BACKOFF_BASE_MS                   ( 500U )
-
 /**
  * @brief Timeout for receiving CONNACK packet in milliseconds.
  */
@@ -75,18 +84,33 @@
 /**
  * @brief The Telemetry message published in this example.
  */
-#define sampleazureiotMESSAGE                                 "Hello World : %d !"
+#if ( democonfigTELEMETRY_BATCH_COUNT > 1 )
+    /* Batched readings must be JSON values. */
+    #define sampleazureiotMESSAGE                             "{\"message\":\"Hello World : %d !\"}"
+#else
+    #define sampleazureiotMESSAGE                             "Hello World : %d !"
+#endif
 
 /**
  * @brief The reported property payload to send to IoT Hub
  */
 #define sampleazureiotPROPERTY                                "{ \"PropertyIterationForCurrentConnection\": \"%d\" }"
 
+/**
+ * @brief The command that raises an alarm, and the urgent reading it sends.
+ */
+#define sampleazureiotALARM_COMMAND                           "raiseAlarm"
+#define sampleazureiotALARM_READING                           "{\"alarm\":true}"
+
 /**
  * @brief Time in ticks to wait between each cycle of the demo implemented
  * by prvMQTTDemoTask().
  */
-#define sampleazureiotDELAY_BETWEEN_DEMO_ITERATIONS_TICKS     ( pdMS_TO_TICKS( 5000U ) )
+#if ( democonfigSOAK == 1 )
+    #define sampleazureiotDELAY_BETWEEN_DEMO_ITERATIONS_TICKS    ( pdMS_TO_TICKS( democonfigSOAK_CYCLE_DELAY_MS ) )
+#else
+    #define sampleazureiotDELAY_BETWEEN_DEMO_ITERATIONS_TICKS    ( pdMS_TO_TICKS( 5000U ) )
+#endif
 
 /**
  * @brief Timeout for MQTT_ProcessLoop in milliseconds.
@@ -102,6 +126,22 @@
  */
 #define sampleazureiotDELAY_BETWEEN_PUBLISHES_TICKS           ( pdMS_TO_TICKS( 2000U ) )
 
+/**
+ * @brief Process loop timeout between publishes with tickless idle.
+ *
+ * Rather than wait in vTaskDelay(), the task blocks on the socket until the
+ * next publish is due, so the core sleeps with the tick stopped while
+ * messages from IoT Hub and keep alive are still handled as they come.
+ */
+#define sampleazureiotLOW_POWER_PROCESS_LOOP_TIMEOUT_MS \
+    ( sampleazureiotPROCESS_LOOP_TIMEOUT_MS + ( sampleazureiotDELAY_BETWEEN_PUBLISHES_TICKS * portTICK_PERIOD_MS ) )
+
+#if ( configUSE_TICKLESS_IDLE == 1 )
+    #define sampleazureiotLOOP_PROCESS_LOOP_TIMEOUT_MS    sampleazureiotLOW_POWER_PROCESS_LOOP_TIMEOUT_MS
+#else
+    #define sampleazureiotLOOP_PROCESS_LOOP_TIMEOUT_MS    sampleazureiotPROCESS_LOOP_TIMEOUT_MS
+#endif
+
 /**
  * @brief Transport timeout in milliseconds for transport send and receive.
  */
@@ -126,16 +166,63 @@
 uint64_t ullGetUnixTime( void );
 /*-----------------------------------------------------------*/
 
-/* Define buffer for IoT Hub info.  */
-#ifdef democonfigENABLE_DPS_SAMPLE
-    static uint8_t ucSampleIotHubHostname[ 128 ];
-    static uint8_t ucSampleIotHubDeviceId[ 128 ];
-    static AzureIoTProvisioningClient_t xAzureIoTProvisioningClient;
-#endif /* democonfigENABLE_DPS_SAMPLE */
-
 static uint8_t ucPropertyBuffer[ 32 ];
 static uint8_t ucScratchBuffer[ 128 ];
 
+/* Telemetry is published through a batch, which sends each reading on its
+ * own unless democonfigTELEMETRY_BATCH_COUNT > 1. */
+static TelemetryBatch_t xTelemetryBatch;
+#if ( democonfigTELEMETRY_BATCH_COUNT > 1 )
+    static uint8_t ucTelemetryBatchBuffer[ democonfigTELEMETRY_BATCH_BUFFER_SIZE ];
+    #define sampleazureiotTELEMETRY_BATCH_BUFFER    ucTelemetryBatchBuffer
+#else
+    #define sampleazureiotTELEMETRY_BATCH_BUFFER    NULL
+#endif
+
+#if ( democonfigTELEMETRY_COMPRESSION == 1 )
+
+/* Properties of gzip compressed batches, the telemetry properties and the content encoding. */
+    static uint8_t ucCompressedPropertyBuffer[ 48 ];
+    static AzureIoTMessageProperties_t xCompressedPropertyBag;
+#endif /* democonfigTELEMETRY_COMPRESSION == 1 */
+
+/* Telemetry messages in flight, so a message does not wait for the PUBACK
+ * of the one before it. */
+static PublishWindow_t xPublishWindow;
+
+#if ( democonfigRATE_LIMIT == 1 )
+
+/* Tokens of the telemetry, kept across connections so reconnecting does not
+ * refill the bucket or forget a throttled rate. */
+    static RateLimiter_t xRateLimiter;
+#endif /* democonfigRATE_LIMIT == 1 */
+
+#if ( democonfigSUBSCRIBE_BATCH == 1 )
+
+/* Holds the subscriptions of a connect, to send them in one SUBSCRIBE. */
+    static SubscribeBatch_t xSubscribeBatch;
+#endif /* democonfigSUBSCRIBE_BATCH == 1 */
+
+#if ( democonfigC2D_QUEUE == 1 )
+
+/* Cloud-to-device messages copied by the callback for the consumer task. */
+    static CloudMessageQueue_t xCloudMessageQueue;
+#endif /* democonfigC2D_QUEUE == 1 */
+
+#if ( democonfigLATENCY_MEASUREMENT == 1 )
+
+/* Properties of a stamped message: those of the telemetry, its sequence
+ * number and the device uptime in milliseconds. */
+    static uint8_t ucLatencyPropertyBuffer[ 64 ];
+    static uint8_t ucLatencyValueBuffer[ 12 ];
+    static PreparedTelemetry_t xLatencyTelemetry;
+
+/* Kept across connections, so the cloud side can tell lost messages. */
+    static uint32_t ulLatencySequence;
+    static LatencyHistogram_t xLatencyHistogram;
+    static TickType_t xLatencyReportTime;
+#endif /* democonfigLATENCY_MEASUREMENT == 1 */
+
 /* Each compilation unit must define the NetworkContext struct. */
 struct NetworkContext
 {
@@ -143,27 +230,10 @@ struct NetworkContext
 };
 
 static AzureIoTHubClient_t xAzureIoTHubClient;
-/*-----------------------------------------------------------*/
 
-#ifdef democonfigENABLE_DPS_SAMPLE
-
-/**
- * @brief Gets the IoT Hub endpoint and deviceId from Provisioning service.
- *   This function will block for Provisioning service for result or return failure.
- *
- * @param[in] pXNetworkCredentials  Network credential used to connect to Provisioning service
- * @param[out] ppucIothubHostname  Pointer to uint8_t* IoT Hub hostname return from Provisioning Service
- * @param[in,out] pulIothubHostnameLength  Length of hostname
- * @param[out] ppucIothubDeviceId  Pointer to uint8_t* deviceId return from Provisioning Service
- * @param[in,out] pulIothubDeviceIdLength  Length of deviceId
- */
-    static uint32_t prvIoTHubInfoGet( NetworkCredentials_t * pXNetworkCredentials,
-                                      uint8_t ** ppucIothubHostname,
-                                      uint32_t * pulIothubHostnameLength,
-                                      uint8_t ** ppucIothubDeviceId,
-                                      uint32_t * pulIothubDeviceIdLength );
-
-#endif /* democonfigENABLE_DPS_SAMPLE */
+/* Connects to the provisioning service and IoT Hub. */
+static ConnectionManager_t xConnectionManager;
+/*-----------------------------------------------------------*/
 
 /**
  * @brief The task used to demonstrate the MQTT API.
@@ -172,28 +242,11 @@ static AzureIoTHubClient_t xAzureIoTHubClient;
  * used in this example.
  */
 static void prvAzureDemoTask( void * pvParameters );
-
-/**
- * @brief Connect to endpoint with reconnection retries.
- *
- * If connection fails, retry is attempted after a timeout.
- * Timeout value will exponentially increase until maximum
- * timeout value is reached or the number of attempts are exhausted.
- *
- * @param pcHostName Hostname of the endpoint to connect to.
- * @param ulPort Endpoint port.
- * @param pxNetworkCredentials Pointer to Network credentials.
- * @param pxNetworkContext Point to Network context created.
- * @return uint32_t The status of the final connection attempt.
- */
-static uint32_t prvConnectToServerWithBackoffRetries( const char * pcHostName,
-                                                      uint32_t ulPort,
-                                                      NetworkCredentials_t * pxNetworkCredentials,
-                                                      NetworkContext_t * pxNetworkContext );
 /*-----------------------------------------------------------*/
 
 /**
- * @brief Static buffer used to hold MQTT messages being sent and received.
+ * @brief Buffer of the hub client, for the topics of the messages it sends and
+ * the MQTT packets it receives, see democonfigNETWORK_BUFFER_SIZE.
  */
 static uint8_t ucMQTTMessageBuffer[ democonfigNETWORK_BUFFER_SIZE ];
 
@@ -207,12 +260,52 @@ static void prvHandleCloudMessage( AzureIoTHubClientCloudToDeviceMessageRequest_
 {
     ( void ) pvContext;
 
-    LogInfo( ( "Cloud message payload : %.*s \r\n",
-               pxMessage->ulPayloadLength,
-               ( const char * ) pxMessage->pvMessagePayload ) );
+    #if ( democonfigC2D_QUEUE == 1 )
+        /* Waits for a slot while the queue is full, which holds back the
+         * PUBACK and so the messages IoT Hub sends after this one. */
+        if( CloudMessageQueue_Put( &xCloudMessageQueue, pxMessage ) != eAzureIoTSuccess )
+        {
+            LogError( ( "Cloud message of %u bytes not handled, %u so far.",
+                        ( unsigned ) pxMessage->ulPayloadLength,
+                        ( unsigned ) xCloudMessageQueue.ulDropped ) );
+        }
+    #else
+        LogInfo( ( "Cloud message payload : %.*s \r\n",
+                   pxMessage->ulPayloadLength,
+                   ( const char * ) pxMessage->pvMessagePayload ) );
+    #endif /* democonfigC2D_QUEUE == 1 */
 }
 /*-----------------------------------------------------------*/
 
+#if ( democonfigC2D_QUEUE == 1 )
+
+/**
+ * @brief Handles the cloud messages queued by prvHandleCloudMessage(), in order.
+ */
+    static void prvCloudMessageTask( void * pvParameters )
+    {
+        CloudMessage_t * pxCloudMessage;
+
+        ( void ) pvParameters;
+
+        for( ; ; )
+        {
+            pxCloudMessage = CloudMessageQueue_Take( &xCloudMessageQueue, portMAX_DELAY );
+
+            if( pxCloudMessage != NULL )
+            {
+                LogInfo( ( "Cloud message payload : %.*s \r\n",
+                           pxCloudMessage->ulPayloadLength,
+                           ( const char * ) pxCloudMessage->ucPayload ) );
+
+                CloudMessageQueue_Release( &xCloudMessageQueue, pxCloudMessage );
+            }
+        }
+    }
+/*-----------------------------------------------------------*/
+
+#endif /* democonfigC2D_QUEUE == 1 */
+
 /**
  * @brief Command message callback handler
  */
@@ -225,6 +318,20 @@ static void prvHandleCommand( AzureIoTHubClientCommandRequest_t * pxMessage,
 
     AzureIoTHubClient_t * xHandle = ( AzureIoTHubClient_t * ) pvContext;
 
+    #if ( democonfigTELEMETRY_URGENT == 1 )
+
+        /* Stands in for an alarm of the device: the reading goes out on the
+         * next process loop, whatever routine telemetry is waiting. */
+        if( ( pxMessage->usCommandNameLength == sizeof( sampleazureiotALARM_COMMAND ) - 1 ) &&
+            ( memcmp( pxMessage->pucCommandName, sampleazureiotALARM_COMMAND,
+                      sizeof( sampleazureiotALARM_COMMAND ) - 1 ) == 0 ) &&
+            ( TelemetryBatch_RaiseUrgent( &xTelemetryBatch, ( const uint8_t * ) sampleazureiotALARM_READING,
+                                          sizeof( sampleazureiotALARM_READING ) - 1 ) != eAzureIoTSuccess ) )
+        {
+            LogError( ( "Alarm dropped, the one before is not sent yet\r\n" ) );
+        }
+    #endif /* democonfigTELEMETRY_URGENT == 1 */
+
     if( AzureIoTHubClient_SendCommandResponse( xHandle, pxMessage, 200,
                                                NULL, 0 ) != eAzureIoTSuccess )
     {
@@ -245,6 +352,7 @@ static void prvHandlePropertiesMessage( AzureIoTHubClientPropertiesResponse_t *
     {
         case eAzureIoTHubPropertiesRequestedMessage:
             LogInfo( ( "Device property document GET received" ) );
+            StartupProfile_Mark( eStartupPhasePropertiesReceived );
             break;
 
         case eAzureIoTHubPropertiesReportedResponseMessage:
@@ -253,6 +361,7 @@ static void prvHandlePropertiesMessage( AzureIoTHubClientPropertiesResponse_t *
 
         case eAzureIoTHubPropertiesWritablePropertyMessage:
             LogInfo( ( "Device property desired property received" ) );
+            stackprofileMARK( eStackPhaseProperties );
             break;
 
         default:
@@ -266,25 +375,136 @@ static void prvHandlePropertiesMessage( AzureIoTHubClientPropertiesResponse_t *
 /*-----------------------------------------------------------*/
 
 /**
- * @brief Setup transport credentials.
+ * @brief Telemetry PUBACK callback, called from the process loop.
  */
-static uint32_t prvSetupNetworkCredentials( NetworkCredentials_t * pxNetworkCredentials )
+static void prvTelemetryAckCallback( uint16_t usPacketID )
 {
-    pxNetworkCredentials->xDisableSni = pdFALSE;
-    /* Set the credentials for establishing a TLS connection. */
-    pxNetworkCredentials->pucRootCa = ( const unsigned char * ) democonfigROOT_CA_PEM;
-    pxNetworkCredentials->xRootCaSize = sizeof( democonfigROOT_CA_PEM );
-    #ifdef democonfigCLIENT_CERTIFICATE_PEM
-        pxNetworkCredentials->pucClientCert = ( const unsigned char * ) democonfigCLIENT_CERTIFICATE_PEM;
-        pxNetworkCredentials->xClientCertSize = sizeof( democonfigCLIENT_CERTIFICATE_PEM );
-        pxNetworkCredentials->pucPrivateKey = ( const unsigned char * ) democonfigCLIENT_PRIVATE_KEY_PEM;
-        pxNetworkCredentials->xPrivateKeySize = sizeof( democonfigCLIENT_PRIVATE_KEY_PEM );
+    static char cStartupProfile[ 320 ];
+
+    #if ( democonfigSTACK_PROFILE == 1 )
+        static char cStackProfile[ 512 ];
     #endif
+    uint32_t ulMs;
+
+    PublishWindow_Acknowledge( &xPublishWindow, usPacketID );
 
-    return 0;
+    /* The first PUBACK ends the startup. */
+    if( !StartupProfile_Get( eStartupPhaseFirstPuback, &ulMs ) )
+    {
+        StartupProfile_Mark( eStartupPhaseFirstPuback );
+        ( void ) StartupProfile_Format( cStartupProfile, sizeof( cStartupProfile ) );
+        LogInfo( ( "Startup: %s\r\n", cStartupProfile ) );
+    }
+
+    /* Logged again whenever a task went deeper, through the updates and
+     * reconnects that follow. */
+    #if ( democonfigSTACK_PROFILE == 1 )
+        if( StackProfile_Mark( eStackPhaseTelemetry ) )
+        {
+            ( void ) StackProfile_Format( cStackProfile, sizeof( cStackProfile ) );
+            LogInfo( ( "Stacks: %s\r\n", cStackProfile ) );
+        }
+    #endif
 }
 /*-----------------------------------------------------------*/
 
+#if ( democonfigLATENCY_MEASUREMENT == 1 )
+
+/**
+ * @brief Adds the publish to PUBACK time of a message to the histogram.
+ */
+    static void prvLatencyAckCallback( void * pvContext,
+                                       uint16_t usPacketID,
+                                       TickType_t xRoundTrip )
+    {
+        ( void ) pvContext;
+        ( void ) usPacketID;
+
+        LatencyHistogram_Add( &xLatencyHistogram, xRoundTrip );
+    }
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Appends a property with a decimal value.
+ */
+    static AzureIoTResult_t prvAppendNumberProperty( AzureIoTMessageProperties_t * pxProperties,
+                                                     const char * pcName,
+                                                     uint32_t ulNameLength,
+                                                     uint32_t ulValue )
+    {
+        int lLength = snprintf( ( char * ) ucLatencyValueBuffer, sizeof( ucLatencyValueBuffer ),
+                                "%u", ( unsigned ) ulValue );
+
+        return AzureIoTMessage_PropertiesAppend( pxProperties, ( const uint8_t * ) pcName, ulNameLength,
+                                                 ucLatencyValueBuffer, ( uint32_t ) lLength );
+    }
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Sends a message on its own, with its sequence number and the device
+ * uptime in its properties.
+ *
+ * The properties are part of the topic, so it is prepared again for each message.
+ */
+    static AzureIoTResult_t prvSendStampedTelemetry( const uint8_t * pucMessage,
+                                                     uint32_t ulMessageLength )
+    {
+        AzureIoTMessageProperties_t xProperties;
+        AzureIoTResult_t xResult;
+        uint32_t ulUptimeMs = ( uint32_t ) ( ( uint64_t ) xTaskGetTickCount() * 1000U / configTICK_RATE_HZ );
+
+        if( ( ( xResult = AzureIoTMessage_PropertiesInit( &xProperties, ucLatencyPropertyBuffer,
+                                                          0, sizeof( ucLatencyPropertyBuffer ) ) ) != eAzureIoTSuccess ) ||
+            ( ( xResult = AzureIoTMessage_PropertiesAppend( &xProperties, ( uint8_t * ) "name", sizeof( "name" ) - 1,
+                                                            ( uint8_t * ) "value", sizeof( "value" ) - 1 ) ) != eAzureIoTSuccess ) ||
+            ( ( xResult = prvAppendNumberProperty( &xProperties, "seq", sizeof( "seq" ) - 1,
+                                                   ulLatencySequence ) ) != eAzureIoTSuccess ) ||
+            ( ( xResult = prvAppendNumberProperty( &xProperties, "uptimeMs", sizeof( "uptimeMs" ) - 1,
+                                                   ulUptimeMs ) ) != eAzureIoTSuccess ) ||
+            ( ( xResult = PreparedTelemetry_Init( &xLatencyTelemetry, &xAzureIoTHubClient,
+                                                  &xProperties ) ) != eAzureIoTSuccess ) ||
+            ( ( xResult = PublishWindow_Send( &xPublishWindow, pucMessage, ulMessageLength, &xLatencyTelemetry,
+                                              pdMS_TO_TICKS( democonfigPUBLISH_WINDOW_TIMEOUT_MS ) ) ) != eAzureIoTSuccess ) )
+        {
+            return xResult;
+        }
+
+        ulLatencySequence++;
+
+        return eAzureIoTSuccess;
+    }
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Logs the latency percentiles once the report interval has passed,
+ * and starts the next interval.
+ */
+    static void prvLatencyReport( void )
+    {
+        TickType_t xNow = xTaskGetTickCount();
+
+        if( ( xNow - xLatencyReportTime ) < pdMS_TO_TICKS( democonfigLATENCY_REPORT_INTERVAL_MS ) )
+        {
+            return;
+        }
+
+        LogInfo( ( "PUBACK latency of %u messages: p50 %u ms, p95 %u ms, p99 %u ms, max %u ms\r\n",
+                   ( unsigned ) xLatencyHistogram.ulCount,
+                   ( unsigned ) LatencyHistogram_Percentile( &xLatencyHistogram, 50 ),
+                   ( unsigned ) LatencyHistogram_Percentile( &xLatencyHistogram, 95 ),
+                   ( unsigned ) LatencyHistogram_Percentile( &xLatencyHistogram, 99 ),
+                   ( unsigned ) xLatencyHistogram.ulMaxMs ) );
+
+        LatencyHistogram_Reset( &xLatencyHistogram );
+        xLatencyReportTime = xNow;
+    }
+/*-----------------------------------------------------------*/
+
+    #define sampleazureiotPUBLISH_ACK_CALLBACK    prvLatencyAckCallback
+#else
+    #define sampleazureiotPUBLISH_ACK_CALLBACK    NULL
+#endif /* democonfigLATENCY_MEASUREMENT == 1 */
+
 /**
  * @brief Azure IoT demo task that gets started in the platform specific project.
  *  In this demo task, middleware API's are used to connect to Azure IoT Hub.
@@ -294,7 +514,6 @@ static void prvAzureDemoTask( void * pvParameters )
     int lPublishCount = 0;
     uint32_t ulScratchBufferLength = 0U;
     const int lMaxPublishCount = 5;
-    NetworkCredentials_t xNetworkCredentials = { 0 };
     AzureIoTTransportInterface_t xTransport;
     NetworkContext_t xNetworkContext = { 0 };
     TlsTransportParams_t xTlsTransportParams = { 0 };
@@ -303,6 +522,11 @@ static void prvAzureDemoTask( void * pvParameters )
     AzureIoTHubClientOptions_t xHubOptions = { 0 };
     AzureIoTMessageProperties_t xPropertyBag;
     bool xSessionPresent;
+    SoakDisconnect_t eDisconnect;
+
+    #if ( democonfigC2D_QUEUE == 1 )
+        BaseType_t xTaskCreated;
+    #endif /* democonfigC2D_QUEUE == 1 */
 
     #ifdef democonfigENABLE_DPS_SAMPLE
         uint8_t * pucIotHubHostname = NULL;
@@ -318,49 +542,86 @@ static void prvAzureDemoTask( void * pvParameters )
 
     ( void ) pvParameters;
 
+    #if ( democonfigC2D_QUEUE == 1 )
+        xResult = CloudMessageQueue_Init( &xCloudMessageQueue );
+        configASSERT( xResult == eAzureIoTSuccess );
+
+        xTaskCreated = sampletaskCREATE( prvCloudMessageTask, "CloudMessages", democonfigDEMO_STACKSIZE,
+                                         NULL, tskIDLE_PRIORITY, NULL, democonfigDEMO_TASK_CORE );
+        configASSERT( xTaskCreated == pdPASS );
+    #endif /* democonfigC2D_QUEUE == 1 */
+
+    #if ( democonfigRATE_LIMIT == 1 )
+        xResult = RateLimiter_Init( &xRateLimiter, democonfigRATE_LIMIT_PER_MINUTE, democonfigRATE_LIMIT_BURST );
+        configASSERT( xResult == eAzureIoTSuccess );
+    #endif /* democonfigRATE_LIMIT == 1 */
+
     /* Initialize Azure IoT Middleware.  */
     configASSERT( AzureIoT_Init() == eAzureIoTSuccess );
 
-    ulStatus = prvSetupNetworkCredentials( &xNetworkCredentials );
-    configASSERT( ulStatus == 0 );
+    xResult = ConnectionManager_Init( &xConnectionManager,
+                                      ucMQTTMessageBuffer, sizeof( ucMQTTMessageBuffer ),
+                                      sampleazureiotTRANSPORT_SEND_RECV_TIMEOUT_MS );
+    configASSERT( xResult == eAzureIoTSuccess );
 
-    #ifdef democonfigENABLE_DPS_SAMPLE
-        /* Run DPS.  */
-        if( ( ulStatus = prvIoTHubInfoGet( &xNetworkCredentials, &pucIotHubHostname,
-                                           &pulIothubHostnameLength, &pucIotHubDeviceId,
-                                           &pulIothubDeviceIdLength ) ) != 0 )
-        {
-            LogError( ( "Failed on sample_dps_entry!: error code = 0x%08x\r\n", ulStatus ) );
-            return;
-        }
-    #endif /* democonfigENABLE_DPS_SAMPLE */
+    /* A wake is already spread by the time the board slept. */
+    if( !deepsleepWOKE() )
+    {
+        ConnectionManager_WaitInitialDelay( &xConnectionManager );
+    }
 
     xNetworkContext.pParams = &xTlsTransportParams;
 
     for( ; ; )
     {
+        #ifdef democonfigENABLE_DPS_SAMPLE
+
+            /* The assigned hub and device ID are kept across iterations, and
+             * only looked up again once the hub refuses them. */
+            if( pucIotHubHostname == NULL )
+            {
+                /* Run DPS.  */
+                if( ( ulStatus = ConnectionManager_Provision( &xConnectionManager, NULL, 0,
+                                                              sampleazureiotProvisioning_Registration_TIMEOUT_MS,
+                                                              &pucIotHubHostname, &pulIothubHostnameLength,
+                                                              &pucIotHubDeviceId, &pulIothubDeviceIdLength ) ) != 0 )
+                {
+                    LogError( ( "Failed on sample_dps_entry!: error code = 0x%08x\r\n", ulStatus ) );
+                    return;
+                }
+            }
+        #endif /* democonfigENABLE_DPS_SAMPLE */
+
         /* Attempt to establish TLS session with IoT Hub. If connection fails,
          * retry after a timeout. Timeout value will be exponentially increased
          * until  the maximum number of attempts are reached or the maximum timeout
          * value is reached. The function returns a failure status if the TCP
          * connection cannot be established to the IoT Hub after the configured
          * number of attempts. */
-        ulStatus = prvConnectToServerWithBackoffRetries( ( const char * ) pucIotHubHostname,
-                                                         democonfigIOTHUB_PORT,
-                                                         &xNetworkCredentials, &xNetworkContext );
+        soakCONNECT_BEGIN();
+        ulStatus = ConnectionManager_ConnectHub( &xConnectionManager, democonfigIOTHUB_PORT, &xNetworkContext,
+                                                 &pucIotHubHostname, &pulIothubHostnameLength,
+                                                 &pucIotHubDeviceId, &pulIothubDeviceIdLength );
         configASSERT( ulStatus == 0 );
+        StartupProfile_Mark( eStartupPhaseHubConnected );
 
         /* Fill in Transport Interface send and receive function pointers. */
         xTransport.pxNetworkContext = &xNetworkContext;
         xTransport.xSend = TLS_Socket_Send;
         xTransport.xRecv = TLS_Socket_Recv;
 
+        #if ( democonfigSUBSCRIBE_BATCH == 1 )
+            xResult = SubscribeBatch_Init( &xSubscribeBatch, &xTransport );
+            configASSERT( xResult == eAzureIoTSuccess );
+        #endif /* democonfigSUBSCRIBE_BATCH == 1 */
+
         /* Init IoT Hub option */
         xResult = AzureIoTHubClient_OptionsInit( &xHubOptions );
         configASSERT( xResult == eAzureIoTSuccess );
 
         xHubOptions.pucModuleID = ( const uint8_t * ) democonfigMODULE_ID;
         xHubOptions.ulModuleIDLength = sizeof( democonfigMODULE_ID ) - 1;
+        xHubOptions.xTelemetryCallback = prvTelemetryAckCallback;
 
         xResult = AzureIoTHubClient_Init( &xAzureIoTHubClient,
                                           pucIotHubHostname, pulIothubHostnameLength,
@@ -386,8 +647,40 @@ static void prvAzureDemoTask( void * pvParameters )
         xResult = AzureIoTHubClient_Connect( &xAzureIoTHubClient,
                                              false, &xSessionPresent,
                                              sampleazureiotCONNACK_RECV_TIMEOUT_MS );
+
+        #ifdef democonfigENABLE_DPS_SAMPLE
+            if( xResult == eAzureIoTErrorServerError )
+            {
+                /* The device was moved to another hub or its credentials
+                 * changed, so register with the provisioning service again. */
+                LogWarn( ( "IoT Hub refused the connection, provisioning again.\r\n" ) );
+                TLS_Socket_Disconnect( &xNetworkContext );
+                pucIotHubHostname = NULL;
+                ConnectionManager_ForgetAssignment( &xConnectionManager );
+                vTaskDelay( sampleazureiotDELAY_BETWEEN_DEMO_ITERATIONS_TICKS );
+                continue;
+            }
+        #endif /* democonfigENABLE_DPS_SAMPLE */
         configASSERT( xResult == eAzureIoTSuccess );
+        StartupProfile_Mark( eStartupPhaseMqttConnected );
+        soakCONNECTED();
+
+        #if ( democonfigSUBSCRIBE_BATCH == 1 )
+            /* The subscribe calls return at once, and the subscriptions and
+             * the property GET go out together at the end of the batch. A
+             * session kept through the deep sleep already holds the
+             * subscriptions, so only the GET goes out. */
+            if( deepsleepSUBSCRIBED( xSessionPresent ) )
+            {
+                SubscribeBatch_BeginResumed( &xSubscribeBatch );
+            }
+            else
+            {
+                SubscribeBatch_Begin( &xSubscribeBatch );
+            }
+        #endif /* democonfigSUBSCRIBE_BATCH == 1 */
 
+        sampletraceBEGIN( eSampleTraceSubscribe, 0 );
         xResult = AzureIoTHubClient_SubscribeCloudToDeviceMessage( &xAzureIoTHubClient, prvHandleCloudMessage,
                                                                    &xAzureIoTHubClient, sampleazureiotSUBSCRIBE_TIMEOUT );
         configASSERT( xResult == eAzureIoTSuccess );
@@ -398,12 +691,20 @@ static void prvAzureDemoTask( void * pvParameters )
 
         xResult = AzureIoTHubClient_SubscribeProperties( &xAzureIoTHubClient, prvHandlePropertiesMessage,
                                                          &xAzureIoTHubClient, sampleazureiotSUBSCRIBE_TIMEOUT );
+        sampletraceEND( eSampleTraceSubscribe, xResult );
         configASSERT( xResult == eAzureIoTSuccess );
 
         /* Get property document after initial connection */
         xResult = AzureIoTHubClient_RequestPropertiesAsync( &xAzureIoTHubClient );
         configASSERT( xResult == eAzureIoTSuccess );
 
+        #if ( democonfigSUBSCRIBE_BATCH == 1 )
+            xResult = SubscribeBatch_End( &xSubscribeBatch );
+            configASSERT( xResult == eAzureIoTSuccess );
+            deepsleepSET_SUBSCRIBED();
+        #endif /* democonfigSUBSCRIBE_BATCH == 1 */
+        StartupProfile_Mark( eStartupPhaseSubscribed );
+
         /* Create a bag of properties for the telemetry */
         xResult = AzureIoTMessage_PropertiesInit( &xPropertyBag, ucPropertyBuffer, 0, sizeof( ucPropertyBuffer ) );
         configASSERT( xResult == eAzureIoTSuccess );
@@ -412,21 +713,58 @@ static void prvAzureDemoTask( void * pvParameters )
                                                     ( uint8_t * ) "value", sizeof( "value" ) - 1 );
         configASSERT( xResult == eAzureIoTSuccess );
 
+        xResult = PublishWindow_Init( &xPublishWindow, &xAzureIoTHubClient,
+                                      sampleazureiotPROCESS_LOOP_TIMEOUT_MS, sampleazureiotPUBLISH_ACK_CALLBACK, NULL );
+        configASSERT( xResult == eAzureIoTSuccess );
+
+        #if ( democonfigRATE_LIMIT == 1 )
+            PublishWindow_SetRateLimiter( &xPublishWindow, &xRateLimiter );
+        #endif /* democonfigRATE_LIMIT == 1 */
+
+        xResult = TelemetryBatch_Init( &xTelemetryBatch, &xAzureIoTHubClient, &xPropertyBag, &xPublishWindow,
+                                       sampleazureiotTELEMETRY_BATCH_BUFFER, democonfigTELEMETRY_BATCH_BUFFER_SIZE,
+                                       democonfigTELEMETRY_BATCH_COUNT, pdMS_TO_TICKS( democonfigTELEMETRY_BATCH_MAX_AGE_MS ) );
+        configASSERT( xResult == eAzureIoTSuccess );
+
+        #if ( democonfigTELEMETRY_COMPRESSION == 1 )
+            xResult = AzureIoTMessage_PropertiesInit( &xCompressedPropertyBag, ucCompressedPropertyBuffer,
+                                                      0, sizeof( ucCompressedPropertyBuffer ) );
+            configASSERT( xResult == eAzureIoTSuccess );
+
+            xResult = AzureIoTMessage_PropertiesAppend( &xCompressedPropertyBag, ( uint8_t * ) "name", sizeof( "name" ) - 1,
+                                                        ( uint8_t * ) "value", sizeof( "value" ) - 1 );
+            configASSERT( xResult == eAzureIoTSuccess );
+
+            xResult = TelemetryCompress_AppendMessageProperties( &xCompressedPropertyBag );
+            configASSERT( xResult == eAzureIoTSuccess );
+
+            xResult = TelemetryBatch_EnableCompression( &xTelemetryBatch, &xCompressedPropertyBag );
+            configASSERT( xResult == eAzureIoTSuccess );
+        #endif /* democonfigTELEMETRY_COMPRESSION == 1 */
+
         /* Publish messages with QoS1, send and process Keep alive messages. */
         for( lPublishCount = 0; lPublishCount < lMaxPublishCount; lPublishCount++ )
         {
             ulScratchBufferLength = snprintf( ( char * ) ucScratchBuffer, sizeof( ucScratchBuffer ),
                                               sampleazureiotMESSAGE, lPublishCount );
-            xResult = AzureIoTHubClient_SendTelemetry( &xAzureIoTHubClient,
-                                                       ucScratchBuffer, ulScratchBufferLength,
-                                                       &xPropertyBag, eAzureIoTHubMessageQoS1, NULL );
+            #if ( democonfigLATENCY_MEASUREMENT == 1 )
+                xResult = prvSendStampedTelemetry( ucScratchBuffer, ulScratchBufferLength );
+            #else
+                xResult = TelemetryBatch_Add( &xTelemetryBatch, ucScratchBuffer, ulScratchBufferLength );
+            #endif /* democonfigLATENCY_MEASUREMENT == 1 */
             configASSERT( xResult == eAzureIoTSuccess );
 
             LogInfo( ( "Attempt to receive publish message from IoT Hub.\r\n" ) );
-            xResult = AzureIoTHubClient_ProcessLoop( &xAzureIoTHubClient,
-                                                     sampleazureiotPROCESS_LOOP_TIMEOUT_MS );
+            xResult = AzureIoTHubClient_ProcessLoop( &xAzureIoTHubClient, sampleazureiotLOOP_PROCESS_LOOP_TIMEOUT_MS );
+            configASSERT( xResult == eAzureIoTSuccess );
+
+            xResult = TelemetryBatch_Process( &xTelemetryBatch );
             configASSERT( xResult == eAzureIoTSuccess );
 
+            #if ( democonfigLATENCY_MEASUREMENT == 1 )
+                prvLatencyReport();
+            #endif /* democonfigLATENCY_MEASUREMENT == 1 */
+
             if( lPublishCount % 2 == 0 )
             {
                 /* Send reported property every other cycle */
@@ -438,195 +776,69 @@ static void prvAzureDemoTask( void * pvParameters )
                 configASSERT( xResult == eAzureIoTSuccess );
             }
 
-            /* Leave Connection Idle for some time. */
-            LogInfo( ( "Keeping Connection Idle...\r\n\r\n" ) );
-            vTaskDelay( sampleazureiotDELAY_BETWEEN_PUBLISHES_TICKS );
+            #if ( configUSE_TICKLESS_IDLE == 0 ) && ( democonfigDEEP_SLEEP == 0 )
+                /* Leave Connection Idle for some time. */
+                LogInfo( ( "Keeping Connection Idle...\r\n\r\n" ) );
+                vTaskDelay( sampleazureiotDELAY_BETWEEN_PUBLISHES_TICKS );
+            #endif /* configUSE_TICKLESS_IDLE == 0 && democonfigDEEP_SLEEP == 0 */
         }
 
-        xResult = AzureIoTHubClient_UnsubscribeProperties( &xAzureIoTHubClient );
-        configASSERT( xResult == eAzureIoTSuccess );
-
-        xResult = AzureIoTHubClient_UnsubscribeCommand( &xAzureIoTHubClient );
-        configASSERT( xResult == eAzureIoTSuccess );
-
-        xResult = AzureIoTHubClient_UnsubscribeCloudToDeviceMessage( &xAzureIoTHubClient );
-        configASSERT( xResult == eAzureIoTSuccess );
-
-        /* Send an MQTT Disconnect packet over the already connected TLS over
-         * TCP connection. There is no corresponding response for the disconnect
-         * packet. After sending disconnect, client must close the network
-         * connection. */
-        xResult = AzureIoTHubClient_Disconnect( &xAzureIoTHubClient );
+        /* Publish what is left in the batch before disconnecting. */
+        xResult = TelemetryBatch_Flush( &xTelemetryBatch );
         configASSERT( xResult == eAzureIoTSuccess );
 
-        /* Close the network connection.  */
-        TLS_Socket_Disconnect( &xNetworkContext );
-
-        /* Wait for some time between two iterations to ensure that we do not
-         * bombard the IoT Hub. */
-        LogInfo( ( "Demo completed successfully.\r\n" ) );
-        LogInfo( ( "Short delay before starting the next iteration.... \r\n\r\n" ) );
-        vTaskDelay( sampleazureiotDELAY_BETWEEN_DEMO_ITERATIONS_TICKS );
-    }
-}
-/*-----------------------------------------------------------*/
-
-#ifdef democonfigENABLE_DPS_SAMPLE
-
-/**
- * @brief Get IoT Hub endpoint and device Id info, when Provisioning service is used.
- *   This function will block for Provisioning service for result or return failure.
- */
-    static uint32_t prvIoTHubInfoGet( NetworkCredentials_t * pXNetworkCredentials,
-                                      uint8_t ** ppucIothubHostname,
-                                      uint32_t * pulIothubHostnameLength,
-                                      uint8_t ** ppucIothubDeviceId,
-                                      uint32_t * pulIothubDeviceIdLength )
-    {
-        NetworkContext_t xNetworkContext = { 0 };
-        TlsTransportParams_t xTlsTransportParams = { 0 };
-        AzureIoTResult_t xResult;
-        AzureIoTTransportInterface_t xTransport;
-        uint32_t ucSamplepIothubHostnameLength = sizeof( ucSampleIotHubHostname );
-        uint32_t ucSamplepIothubDeviceIdLength = sizeof( ucSampleIotHubDeviceId );
-        uint32_t ulStatus;
-
-        /* Set the pParams member of the network context with desired transport. */
-        xNetworkContext.pParams = &xTlsTransportParams;
-
-        ulStatus = prvConnectToServerWithBackoffRetries( democonfigENDPOINT, democonfigIOTHUB_PORT,
-                                                         pXNetworkCredentials, &xNetworkContext );
-        configASSERT( ulStatus == 0 );
-
-        /* Fill in Transport Interface send and receive function pointers. */
-        xTransport.pxNetworkContext = &xNetworkContext;
-        xTransport.xSend = TLS_Socket_Send;
-        xTransport.xRecv = TLS_Socket_Recv;
-
-        #ifdef democonfigUSE_HSM
-
-            /* Redefine the democonfigREGISTRATION_ID macro using registration ID
-             * generated dynamically using the HSM */
-
-            /* We use a pointer instead of a buffer so that the getRegistrationId
-             * function can allocate the necessary memory depending on the HSM */
-            char * registration_id = NULL;
-            ulStatus = getRegistrationId( &registration_id );
-            configASSERT( ulStatus == 0 );
-#undef democonfigREGISTRATION_ID
-        #define democonfigREGISTRATION_ID    registration_id
-        #endif
-
-        xResult = AzureIoTProvisioningClient_Init( &xAzureIoTProvisioningClient,
-                                                   ( const uint8_t * ) democonfigENDPOINT,
-                                                   sizeof( democonfigENDPOINT ) - 1,
-                                                   ( const uint8_t * ) democonfigID_SCOPE,
-                                                   sizeof( democonfigID_SCOPE ) - 1,
-                                                   ( const uint8_t * ) democonfigREGISTRATION_ID,
-                                                   #ifdef democonfigUSE_HSM
-                                                       strlen( democonfigREGISTRATION_ID ),
-                                                   #else
-                                                       sizeof( democonfigREGISTRATION_ID ) - 1,
-                                                   #endif
-                                                   NULL, ucMQTTMessageBuffer, sizeof( ucMQTTMessageBuffer ),
-                                                   ullGetUnixTime,
-                                                   &xTransport );
+        xResult = PublishWindow_WaitForAll( &xPublishWindow, pdMS_TO_TICKS( democonfigPUBLISH_WINDOW_TIMEOUT_MS ) );
         configASSERT( xResult == eAzureIoTSuccess );
 
-        #ifdef democonfigDEVICE_SYMMETRIC_KEY
-            xResult = AzureIoTProvisioningClient_SetSymmetricKey( &xAzureIoTProvisioningClient,
-                                                                  ( const uint8_t * ) democonfigDEVICE_SYMMETRIC_KEY,
-                                                                  sizeof( democonfigDEVICE_SYMMETRIC_KEY ) - 1,
-                                                                  Crypto_HMAC );
-            configASSERT( xResult == eAzureIoTSuccess );
-        #endif /* democonfigDEVICE_SYMMETRIC_KEY */
+        /* Soak runs also drop the connection as a lost network does, with
+         * nothing sent, and register again. */
+        eDisconnect = soakDISCONNECT();
 
-        do
+        if( eDisconnect != eSoakDisconnectAbrupt )
         {
-            xResult = AzureIoTProvisioningClient_Register( &xAzureIoTProvisioningClient,
-                                                           sampleazureiotProvisioning_Registration_TIMEOUT_MS );
-        } while( xResult == eAzureIoTErrorPending );
+            /* The session keeps the subscriptions through the deep sleep. */
+            #if ( democonfigDEEP_SLEEP == 0 )
+                xResult = AzureIoTHubClient_UnsubscribeProperties( &xAzureIoTHubClient );
+                configASSERT( xResult == eAzureIoTSuccess );
 
-        configASSERT( xResult == eAzureIoTSuccess );
+                xResult = AzureIoTHubClient_UnsubscribeCommand( &xAzureIoTHubClient );
+                configASSERT( xResult == eAzureIoTSuccess );
 
-        xResult = AzureIoTProvisioningClient_GetDeviceAndHub( &xAzureIoTProvisioningClient,
-                                                              ucSampleIotHubHostname, &ucSamplepIothubHostnameLength,
-                                                              ucSampleIotHubDeviceId, &ucSamplepIothubDeviceIdLength );
-        configASSERT( xResult == eAzureIoTSuccess );
+                xResult = AzureIoTHubClient_UnsubscribeCloudToDeviceMessage( &xAzureIoTHubClient );
+                configASSERT( xResult == eAzureIoTSuccess );
+            #endif /* democonfigDEEP_SLEEP == 0 */
 
-        AzureIoTProvisioningClient_Deinit( &xAzureIoTProvisioningClient );
+            /* Send an MQTT Disconnect packet over the already connected TLS over
+             * TCP connection. There is no corresponding response for the disconnect
+             * packet. After sending disconnect, client must close the network
+             * connection. */
+            xResult = AzureIoTHubClient_Disconnect( &xAzureIoTHubClient );
+            configASSERT( xResult == eAzureIoTSuccess );
+        }
 
         /* Close the network connection.  */
         TLS_Socket_Disconnect( &xNetworkContext );
 
-        *ppucIothubHostname = ucSampleIotHubHostname;
-        *pulIothubHostnameLength = ucSamplepIothubHostnameLength;
-        *ppucIothubDeviceId = ucSampleIotHubDeviceId;
-        *pulIothubDeviceIdLength = ucSamplepIothubDeviceIdLength;
-
-        return 0;
-    }
-
-#endif /* democonfigENABLE_DPS_SAMPLE */
-/*-----------------------------------------------------------*/
-
-/**
- * @brief Connect to server with backoff retries.
- */
-static uint32_t prvConnectToServerWithBackoffRetries( const char * pcHostName,
-                                                      uint32_t port,
-                                                      NetworkCredentials_t * pxNetworkCredentials,
-                                                      NetworkContext_t * pxNetworkContext )
-{
-    TlsTransportStatus_t xNetworkStatus;
-    BackoffAlgorithmStatus_t xBackoffAlgStatus = BackoffAlgorithmSuccess;
-    BackoffAlgorithmContext_t xReconnectParams;
-    uint16_t usNextRetryBackOff = 0U;
-
-    /* Initialize reconnect attempts and interval. */
-    BackoffAlgorithm_InitializeParams( &xReconnectParams,
-                                       sampleazureiotRETRY_BACKOFF_BASE_MS,
-                                       sampleazureiotRETRY_MAX_BACKOFF_DELAY_MS,
-                                       sampleazureiotRETRY_MAX_ATTEMPTS );
-
-    /* Attempt to connect to IoT Hub. If connection fails, retry after
-     * a timeout. Timeout value will exponentially increase till maximum
-     * attempts are reached.
-     */
-    do
-    {
-        LogInfo( ( "Creating a TLS connection to %s:%u.\r\n", pcHostName, port ) );
-        /* Attempt to create a mutually authenticated TLS connection. */
-        xNetworkStatus = TLS_Socket_Connect( pxNetworkContext,
-                                             pcHostName, port,
-                                             pxNetworkCredentials,
-                                             sampleazureiotTRANSPORT_SEND_RECV_TIMEOUT_MS,
-                                             sampleazureiotTRANSPORT_SEND_RECV_TIMEOUT_MS );
-
-        if( xNetworkStatus != eTLSTransportSuccess )
-        {
-            /* Generate a random number and calculate backoff value (in milliseconds) for
-             * the next connection retry.
-             * Note: It is recommended to seed the random number generator with a device-specific
-             * entropy source so that possibility of multiple devices retrying failed network operations
-             * at similar intervals can be avoided. */
-            xBackoffAlgStatus = BackoffAlgorithm_GetNextBackoff( &xReconnectParams, configRAND32(), &usNextRetryBackOff );
-
-            if( xBackoffAlgStatus == BackoffAlgorithmRetriesExhausted )
-            {
-                LogError( ( "Connection to the IoT Hub failed, all attempts exhausted." ) );
-            }
-            else if( xBackoffAlgStatus == BackoffAlgorithmSuccess )
+        #ifdef democonfigENABLE_DPS_SAMPLE
+            if( eDisconnect == eSoakDisconnectReprovision )
             {
-                LogWarn( ( "Connection to the IoT Hub failed [%d]. "
-                           "Retrying connection with backoff and jitter [%d]ms.",
-                           xNetworkStatus, usNextRetryBackOff ) );
-                vTaskDelay( pdMS_TO_TICKS( usNextRetryBackOff ) );
+                pucIotHubHostname = NULL;
+                ConnectionManager_ForgetAssignment( &xConnectionManager );
             }
-        }
-    } while( ( xNetworkStatus != eTLSTransportSuccess ) && ( xBackoffAlgStatus == BackoffAlgorithmSuccess ) );
+        #endif /* democonfigENABLE_DPS_SAMPLE */
+
+        soakCYCLE_END();
+
+        #if ( democonfigDEEP_SLEEP == 1 )
+            DeepSleep_Enter();
+        #endif /* democonfigDEEP_SLEEP == 1 */
 
-    return xNetworkStatus == eTLSTransportSuccess ? 0 : 1;
+        /* Wait for some time between two iterations to ensure that we do not
+         * bombard the IoT Hub. */
+        LogInfo( ( "Demo completed successfully.\r\n" ) );
+        LogInfo( ( "Short delay before starting the next iteration.... \r\n\r\n" ) );
+        vTaskDelay( sampleazureiotDELAY_BETWEEN_DEMO_ITERATIONS_TICKS );
+    }
 }
 /*-----------------------------------------------------------*/
 
@@ -635,13 +847,16 @@ static uint32_t prvConnectToServerWithBackoffRetries( const char * pcHostName,
  */
 void vStartDemoTask( void )
 {
+    SampleTrace_Init();
+
     /* This example uses a single application task, which in turn is used to
      * connect, subscribe, publish, unsubscribe and disconnect from the IoT Hub */
-    xTaskCreate( prvAzureDemoTask,         /* Function that implements the task. */
-                 "AzureDemoTask",          /* Text name for the task - only used for debugging. */
-                 democonfigDEMO_STACKSIZE, /* Size of stack (in words, not bytes) to allocate for the task. */
-                 NULL,                     /* Task parameter - not used in this case. */
-                 tskIDLE_PRIORITY,         /* Task priority, must be between 0 and configMAX_PRIORITIES - 1. */
-                 NULL );                   /* Used to pass out a handle to the created task - not used in this case. */
+    sampletaskCREATE( prvAzureDemoTask,          /* Function that implements the task. */
+                      "AzureDemoTask",           /* Text name for the task - only used for debugging. */
+                      democonfigDEMO_STACKSIZE,  /* Size of stack (in words, not bytes) to allocate for the task. */
+                      NULL,                      /* Task parameter - not used in this case. */
+                      tskIDLE_PRIORITY,          /* Task priority, must be between 0 and configMAX_PRIORITIES - 1. */
+                      NULL,                      /* Used to pass out a handle to the created task - not used in this case. */
+                      democonfigDEMO_TASK_CORE ); /* Core the task is pinned to, if democonfigPIN_TASKS_TO_CORE is defined. */
 }
 /*-----------------------------------------------------------*/
@@ -8,11 +8,11 @@
 /* Kernel includes. */
 #include "FreeRTOS.h"
 #include "task.h"
+#include "queue.h"
 
-/* Azure Provisioning/IoT Hub library includes */
+/* Azure IoT Hub library includes */
 #include "azure_iot_hub_client.h"
 #include "azure_iot_hub_client_properties.h"
-#include "azure_iot_provisioning_client.h"
 #include "azure_iot_adu_client.h"
 #include "azure_iot_flash_platform.h"
 #include "azure_iot_http.h"
@@ -21,8 +21,21 @@
 #include "azure_iot_json_reader.h"
 #include "azure_iot_json_writer.h"
 
-/* Exponential backoff retry include. */
-#include "backoff_algorithm.h"
+/* Connections, provisioning and reconnects. */
+#include "azure_sample_connection_manager.h"
+
+/* Command response buffers. */
+#include "azure_sample_command_response.h"
+
+/* Buffers only held during a download. */
+#include "azure_sample_buffer_arena.h"
+
+/* Download progress, reported when it changes. */
+#include "azure_sample_reported_properties.h"
+
+/* Subscriptions in one SUBSCRIBE, or not sent again to a session that has them. */
+#include "azure_sample_subscribe_batch.h"
+#include "azure_sample_hub_session.h"
 
 /* Transport interface implementation include header for TLS. */
 #include "transport_tls_socket.h"
@@ -31,11 +44,24 @@
 /* Crypto helper header. */
 #include "azure_sample_crypto.h"
 
+/* Compressed and delta update image decoder. */
+#include "sample_azure_iot_adu_decoder.h"
+
 /* Demo Specific configs. */
 #include "demo_config.h"
 
-/* Data Interface Definition */
+/* Data Interface Definition, and the Device Update component next to the thermostat. */
 #include "sample_azure_iot_pnp_data_if.h"
+#include "sample_azure_iot_adu_component.h"
+
+/* Task creation, pinned to a core where configured. */
+#include "azure_sample_task.h"
+
+/* Trace points of the samples. */
+#include "azure_sample_trace.h"
+
+/* The peak clock while the image is verified. */
+#include "azure_sample_perf_governor.h"
 /*-----------------------------------------------------------*/
 
 /* Compile time error for undefined configs. */
@@ -61,21 +87,18 @@
 /*-----------------------------------------------------------*/
 
 /**
- * @brief The maximum number of retries for network operation with server.
- */
-#define sampleazureiotRETRY_MAX_ATTEMPTS                      ( 5U )
-
-/**
- * @brief The maximum back-off delay (in milliseconds) for retrying failed operation
- *  with server.
- */
-#define sampleazureiotRETRY_MAX_BACKOFF_DELAY_MS              ( 5000U )
-
-/**
- * @brief The base back-off delay (in milliseconds) to use for network operation retry
- * attempts.
+ * @brief Seeds the reconnect jitter, so that devices do not retry in step.
+ *
+ * An HSM only gives its registration ID once provisioning starts, so then
+ * configRAND32() alone seeds it.
  */
-#define sampleazureiotRETRY_BACKOFF_BASE_MS                   ( 500U )
+#ifndef democonfigENABLE_DPS_SAMPLE
+    #define sampleazureiotRECONNECT_IDENTITY    democonfigDEVICE_ID
+#elif !defined( democonfigUSE_HSM )
+    #define sampleazureiotRECONNECT_IDENTITY    democonfigREGISTRATION_ID
+#else
+    #define sampleazureiotRECONNECT_IDENTITY    ""
+#endif
 
 /**
  * @brief Timeout for receiving CONNACK packet in milliseconds.
@@ -107,6 +130,24 @@
  */
 #define sampleazureiotDELAY_BETWEEN_PUBLISHES_TICKS           ( pdMS_TO_TICKS( 2000U ) )
 
+/**
+ * @brief Answer commands as soon as they arrive.
+ *
+ * The task waits for the next publish in the process loop rather than in
+ * vTaskDelay(), so a command is read, and its response sent from the command
+ * callback, within a network round trip instead of up to
+ * sampleazureiotDELAY_BETWEEN_PUBLISHES_TICKS later.
+ */
+#ifndef democonfigCOMMAND_IMMEDIATE_RESPONSE
+    #define democonfigCOMMAND_IMMEDIATE_RESPONSE    0
+#endif
+
+/**
+ * @brief Response to a command that finds every response buffer in use.
+ */
+#define sampleazureiotCOMMAND_BUSY_STATUS                     ( 503 )
+#define sampleazureiotCOMMAND_BUSY_PAYLOAD                    "{}"
+
 /**
  * @brief Transport timeout in milliseconds for transport send and receive.
  */
@@ -128,12 +169,191 @@
  */
 #define sampleazureiotADU_DOWNLOAD_TIMEOUT_SEC                ( 10 )
 
+/**
+ * @brief Receive buffer requested for the image download socket.
+ *
+ * A larger buffer lets stacks that size the TCP window from it keep more
+ * of each democonfigCHUNK_DOWNLOAD_SIZE range in flight. Only the download
+ * socket uses it, so the MQTT connection keeps the stack default. 0 keeps
+ * the default for the download as well.
+ */
+#ifndef democonfigADU_DOWNLOAD_RECEIVE_BUFFER_SIZE
+    #define democonfigADU_DOWNLOAD_RECEIVE_BUFFER_SIZE        ( 0U )
+#endif
+
+/**
+ * @brief Set to 1 to write each downloaded chunk to flash from a separate
+ * task while the next chunk is fetched, so the download takes about the
+ * longer of the network and flash times instead of their sum. Costs a second
+ * download buffer.
+ */
+#ifndef democonfigADU_PIPELINED_DOWNLOAD
+    #define democonfigADU_PIPELINED_DOWNLOAD                  ( 0 )
+#endif
+
+/**
+ * @brief Set to 1 to continue an interrupted download, after a reconnect or a
+ * reboot, from the last chunk recorded in the port's download journal instead of
+ * erasing the update bank and starting again. The port must provide
+ * AzureIoTPlatform_ResumeInit() and AzureIoTPlatform_SaveProgress().
+ */
+#ifndef democonfigADU_RESUMABLE_DOWNLOAD
+    #define democonfigADU_RESUMABLE_DOWNLOAD                  ( 0 )
+#endif
+
+/**
+ * @brief Set to 1 to accept compressed and delta encoded update files, as
+ * described in sample_azure_iot_adu_decoder.h. Plain images still work.
+ */
+#ifndef democonfigADU_IMAGE_DECODER
+    #define democonfigADU_IMAGE_DECODER                       ( 0 )
+#endif
+
+/**
+ * @brief Memory mapped address of the running image, which delta updates
+ * are applied to. NULL rejects delta updates.
+ */
+#ifndef democonfigADU_DELTA_SOURCE_IMAGE
+    #define democonfigADU_DELTA_SOURCE_IMAGE                  ( NULL )
+#endif
+
+#if ( democonfigADU_IMAGE_DECODER == 1 ) && ( democonfigADU_RESUMABLE_DOWNLOAD == 1 )
+    #error "democonfigADU_IMAGE_DECODER cannot resume a download, as the decoder state is not journaled"
+#endif
+
+#if ( democonfigADU_MAX_FILES > 1 ) && ( ( democonfigADU_IMAGE_DECODER == 1 ) || ( democonfigADU_RESUMABLE_DOWNLOAD == 1 ) )
+    #error "democonfigADU_MAX_FILES above 1 downloads plain files, which neither the decoder nor the resume journal handle"
+#endif
+
+/**
+ * @brief Set to 1 to download the update image from its own task.
+ *
+ * The demo task then keeps sending telemetry and servicing commands while the
+ * image downloads. It hears about progress and completion on a queue, and passes
+ * a cancel on to the download task within one pass of its loop, where inline
+ * downloads only notice it every sampleazureiotADU_DOWNLOAD_TIMEOUT_SEC.
+ */
+#ifndef democonfigADU_DOWNLOAD_TASK
+    #define democonfigADU_DOWNLOAD_TASK                       ( 0 )
+#endif
+
+/**
+ * @brief Priority of the download task. The demo task runs at tskIDLE_PRIORITY,
+ * so raise that one to have the download yield to it.
+ */
+#ifndef democonfigADU_DOWNLOAD_TASK_PRIORITY
+    #define democonfigADU_DOWNLOAD_TASK_PRIORITY              ( tskIDLE_PRIORITY )
+#endif
+
+/**
+ * @brief Set to 1 to size each range request from the measured throughput
+ * instead of always asking for democonfigCHUNK_DOWNLOAD_SIZE bytes.
+ *
+ * The size starts at democonfigADU_MIN_CHUNK_DOWNLOAD_SIZE and doubles while
+ * throughput keeps improving, up to democonfigCHUNK_DOWNLOAD_SIZE, which
+ * still sizes the download buffer. It halves when a request is slow or gets
+ * no response.
+ */
+#ifndef democonfigADU_ADAPTIVE_CHUNK_SIZE
+    #define democonfigADU_ADAPTIVE_CHUNK_SIZE                 ( 0 )
+#endif
+
+/**
+ * @brief Smallest range requested when democonfigADU_ADAPTIVE_CHUNK_SIZE is 1.
+ */
+#ifndef democonfigADU_MIN_CHUNK_DOWNLOAD_SIZE
+    #define democonfigADU_MIN_CHUNK_DOWNLOAD_SIZE             ( 1024U )
+#endif
+
+/**
+ * @brief Set to 1 to download the update image over TLS. The session is
+ * cached, so a reconnect part way through a download takes an abbreviated
+ * handshake.
+ */
+#ifndef democonfigADU_DOWNLOAD_USE_TLS
+    #define democonfigADU_DOWNLOAD_USE_TLS                    ( 0 )
+#endif
+
+/**
+ * @brief Root CA the image download server is verified against when
+ * democonfigADU_DOWNLOAD_USE_TLS is 1.
+ */
+#ifndef democonfigADU_DOWNLOAD_ROOT_CA_PEM
+    #define democonfigADU_DOWNLOAD_ROOT_CA_PEM                democonfigROOT_CA_PEM
+#endif
+
+/**
+ * @brief Port the image is downloaded from.
+ */
+#ifndef democonfigADU_DOWNLOAD_PORT
+    #if ( democonfigADU_DOWNLOAD_USE_TLS == 1 )
+        #define democonfigADU_DOWNLOAD_PORT                   ( 443U )
+    #else
+        #define democonfigADU_DOWNLOAD_PORT                   ( 80U )
+    #endif
+#endif
+
+/**
+ * @brief Report the download progress as the aduDownloadedBytes and
+ * aduDownloadSize reported properties, each time another this many percent of
+ * the file is downloaded. 0 does not report progress.
+ */
+#ifndef democonfigADU_PROGRESS_REPORT_PERCENT
+    #define democonfigADU_PROGRESS_REPORT_PERCENT             ( 0U )
+#endif
+
+/**
+ * @brief Least time between two progress reports, in seconds, however fast the
+ * download. The end of each file is reported regardless.
+ */
+#ifndef democonfigADU_PROGRESS_REPORT_INTERVAL_SEC
+    #define democonfigADU_PROGRESS_REPORT_INTERVAL_SEC        ( 30U )
+#endif
+
+/**
+ * @brief Set to 1 to send the range requests of the image, and parse their
+ * responses, in the sample rather than through AzureIoTHTTP_Request().
+ *
+ * The response headers are received into the header buffer and parsed as
+ * they arrive, and the body is received straight into the chunk buffer,
+ * which then only needs democonfigCHUNK_DOWNLOAD_SIZE bytes instead of room
+ * for the headers as well. The server must answer with 206 and a
+ * Content-Length, as range requests are answered.
+ */
+#ifndef democonfigADU_STREAMED_RESPONSE
+    #define democonfigADU_STREAMED_RESPONSE                   ( 0 )
+#endif
+
 /**
  * @brief Buffer size for ADU HTTP download headers
  *
  */
 #define ADU_HEADER_BUFFER_SIZE                                512
 
+/**
+ * @brief Size of the buffer each chunk of the image is received into, with its headers.
+ */
+#if ( democonfigADU_STREAMED_RESPONSE == 1 )
+    #define sampleaduDOWNLOAD_BUFFER_SIZE                     ( democonfigCHUNK_DOWNLOAD_SIZE )
+#else
+    #define sampleaduDOWNLOAD_BUFFER_SIZE                     ( democonfigCHUNK_DOWNLOAD_SIZE + 1024 )
+#endif /* democonfigADU_STREAMED_RESPONSE == 1 */
+
+/**
+ * @brief Number of times in a row the image download reconnects after a
+ * failed request before giving up.
+ *
+ * This stays bounded even when democonfigRECONNECT_MAX_ATTEMPTS is 0, so that
+ * a download that cannot finish is reported rather than retried forever.
+ */
+#define sampleaduHTTP_MAX_RECONNECTS                          ( 5U )
+
+/**
+ * @brief A range request taking longer than this (in milliseconds) shrinks
+ * the adaptive chunk size, keeping requests well inside the transport timeout.
+ */
+#define sampleaduCHUNK_SLOW_REQUEST_MS                        ( sampleazureiotTRANSPORT_SEND_RECV_TIMEOUT_MS / 2 )
+
 #define democonfigADU_UPDATE_ID                               "{\"provider\":\"" democonfigADU_UPDATE_PROVIDER "\",\"name\":\"" democonfigADU_UPDATE_NAME "\",\"version\":\"" democonfigADU_UPDATE_VERSION "\"}"
 
 #ifdef democonfigADU_UPDATE_NEW_VERSION
@@ -151,9 +371,6 @@ uint64_t ullGetUnixTime( void );
 
 /* Define buffer for IoT Hub info.  */
 #ifdef democonfigENABLE_DPS_SAMPLE
-    static uint8_t ucSampleIotHubHostname[ 128 ];
-    static uint8_t ucSampleIotHubDeviceId[ 128 ];
-    static AzureIoTProvisioningClient_t xAzureIoTProvisioningClient;
     #define sampleazureiotMODEL_ID_STR    "modelId"
 #endif /* democonfigENABLE_DPS_SAMPLE */
 
@@ -164,6 +381,22 @@ struct NetworkContext
 };
 
 AzureIoTHubClient_t xAzureIoTHubClient;
+
+/* Connects to the provisioning service and IoT Hub. */
+static ConnectionManager_t xConnectionManager;
+
+#if ( democonfigSUBSCRIBE_BATCH == 1 )
+
+/* Holds the subscriptions of a connect, answered at once when the session
+ * the hub resumed already has them. */
+    static SubscribeBatch_t xSubscribeBatch;
+#endif /* democonfigSUBSCRIBE_BATCH == 1 */
+
+/* What the MQTT session of the hub holds, over the reconnects. */
+static HubSession_t xHubSession;
+
+/* The image download reconnects from its own task. */
+static ReconnectPolicy_t xHTTPReconnectPolicy;
 AzureIoTADUClient_t xAzureIoTADUClient;
 AzureIoTADUUpdateRequest_t xAzureIoTAduUpdateRequest;
 bool xProcessUpdateRequest = false;
@@ -186,14 +419,187 @@ static AzureADUImage_t xImage;
 static uint8_t ucScratchBuffer[ 700 ];
 
 /* Command buffers */
-static uint8_t ucCommandResponsePayloadBuffer[ 128 ];
+static CommandResponsePool_t xCommandResponsePool;
 
 /* Reported Properties buffers */
 static uint8_t ucReportedPropertiesUpdate[ 1500 ];
 static uint32_t ulReportedPropertiesUpdateLength;
 
-static uint8_t ucAduDownloadBuffer[ democonfigCHUNK_DOWNLOAD_SIZE + 1024 ];
-static uint8_t ucAduDownloadHeaderBuffer[ ADU_HEADER_BUFFER_SIZE ];
+/* Agent state waiting for the end of the pass of the demo loop, so that the
+ * states the sample goes through within one pass are sent as the last one. */
+static BaseType_t xAduAgentStatePending = pdFALSE;
+static AzureIoTADUAgentState_t xAduPendingAgentState;
+static BaseType_t xAduPendingAgentStateHasRequest;
+
+#if ( democonfigADU_PROGRESS_REPORT_PERCENT > 0 )
+    #define sampleaduPROPERTY_DOWNLOADED_BYTES    "aduDownloadedBytes"
+    #define sampleaduPROPERTY_DOWNLOAD_SIZE       "aduDownloadSize"
+
+    static ReportedProperty_t xAduProgressProperties[] =
+    {
+        {
+            {
+                NULL, 0,
+                ( const uint8_t * ) sampleaduPROPERTY_DOWNLOADED_BYTES,
+                sizeof( sampleaduPROPERTY_DOWNLOADED_BYTES ) - 1
+            },
+            eReportedPropertyInt32, 0
+        },
+        {
+            {
+                NULL, 0,
+                ( const uint8_t * ) sampleaduPROPERTY_DOWNLOAD_SIZE,
+                sizeof( sampleaduPROPERTY_DOWNLOAD_SIZE ) - 1
+            },
+            eReportedPropertyInt32, 0
+        }
+    };
+
+    #define sampleaduREPORTED_DOWNLOADED_BYTES    0
+    #define sampleaduREPORTED_DOWNLOAD_SIZE       1
+
+    static ReportedProperties_t xAduProgressStore = reportedpropertiesINIT( xAduProgressProperties );
+    static uint32_t ulAduReportedPercent;
+    static uint64_t ullAduReportedTime;
+#endif /* democonfigADU_PROGRESS_REPORT_PERCENT > 0 */
+
+/* Lent by xDownloadArena for each download, and NULL otherwise, so the heap
+ * has that RAM the rest of the time. */
+static BufferArena_t xDownloadArena;
+static uint8_t * pucAduDownloadBuffer;
+static uint8_t * pucAduDownloadHeaderBuffer;
+
+#if ( democonfigADU_IMAGE_DECODER == 1 )
+    /* Hash the written image is verified against, which for an encoded file
+     * comes from its header rather than the manifest. */
+    static uint8_t ucAduImageHash[ sampleaduDECODER_HASH_BASE64_SIZE ];
+    static uint32_t ulAduImageHashLength;
+#endif /* democonfigADU_IMAGE_DECODER == 1 */
+
+/* What prvDownloadUpdateImageIntoFlash() fetches for each file of the update,
+ * taken from the update request before the download starts. */
+typedef struct AduDownloadRequest
+{
+    uint8_t * pucHost;
+    uint32_t ulHostLength;
+    uint8_t * pucPath;
+    uint32_t ulPathLength;
+    const uint8_t * pucHash;
+    uint32_t ulHashLength;
+    const uint8_t * pucFileName;
+    uint32_t ulFileNameLength;
+    int64_t llSize;
+} AduDownloadRequest_t;
+
+/* Indexed as xUpdateManifest.pxFiles, whose first file is the image. */
+static AduDownloadRequest_t xAduDownloadRequests[ democonfigADU_MAX_FILES ];
+static uint32_t ulAduDownloadRequestCount;
+
+#if ( democonfigADU_MIRROR == 1 )
+    /* The cache host the download tries first, taken with the requests so
+     * that the property changing during a download does not affect it. */
+    static uint8_t ucAduDownloadMirrorHost[ sampleaduMIRROR_HOST_SIZE ];
+    static uint32_t ulAduDownloadMirrorHostLength;
+    static AduDownloadRequest_t xAduMirrorRequest;
+#endif /* democonfigADU_MIRROR == 1 */
+
+#if ( democonfigADU_PREWARM_CONNECTION == 1 )
+    /* Size of the host connected to ahead of the download, with its null terminator. */
+    #define sampleaduPREWARM_HOST_SIZE    ( 128U )
+
+    /* Idle when the download connection is not the prewarm task's, Connecting
+     * while the task opens it, Ready once open for the download to take it. */
+    typedef enum AduPrewarmState
+    {
+        eAduPrewarmIdle = 0,
+        eAduPrewarmConnecting,
+        eAduPrewarmReady
+    } AduPrewarmState_t;
+
+    static TaskHandle_t xAduPrewarmTask = NULL;
+    static volatile AduPrewarmState_t xAduPrewarmState = eAduPrewarmIdle;
+    static volatile BaseType_t xAduPrewarmCancelled = pdFALSE;
+    static char cAduPrewarmHost[ sampleaduPREWARM_HOST_SIZE ];
+#endif /* democonfigADU_PREWARM_CONNECTION == 1 */
+
+#if ( democonfigADU_DOWNLOAD_TASK == 1 )
+    /* Sent by the download task to the demo task. Progress overwrites progress,
+     * and nothing follows the final event of a download. */
+    typedef struct AduDownloadEvent
+    {
+        BaseType_t xDone;
+        AzureIoTResult_t xResult;
+        int32_t lOffset;
+    } AduDownloadEvent_t;
+
+    #define sampleaduDOWNLOAD_NOTIFY_START     ( 1UL << 0 )
+    #define sampleaduDOWNLOAD_NOTIFY_CANCEL    ( 1UL << 1 )
+
+    /* The update request is reparsed by the demo task whenever the service
+     * sends one, so the download works from its own copy. */
+    static uint8_t ucAduFileUrlBuffer[ sizeof( ucScratchBuffer ) ];
+    static uint8_t ucAduManifestHashes[ democonfigADU_MAX_FILES ][ sampleaduDECODER_HASH_BASE64_SIZE ];
+    static TaskHandle_t xAduDownloadTask = NULL;
+    static QueueHandle_t xAduDownloadEventQueue = NULL;
+    static StaticQueue_t xAduDownloadEventQueueBuffer;
+    static uint8_t ucAduDownloadEventQueueStorage[ sizeof( AduDownloadEvent_t ) ];
+    static BaseType_t xAduDownloadInProgress = pdFALSE;
+    static BaseType_t xAduDownloadCancelSent = pdFALSE;
+#endif /* democonfigADU_DOWNLOAD_TASK == 1 */
+
+/* The image download connection, kept open across the range requests of a
+ * download and only replaced when the server closes it. */
+static AzureIoTTransportInterface_t xAduHTTPTransport;
+static NetworkContext_t xAduHTTPNetworkContext;
+static BaseType_t xAduHTTPConnected = pdFALSE;
+
+#if ( democonfigADU_ADAPTIVE_CHUNK_SIZE == 1 )
+    /* Current range request size, and the throughput (bytes per second) it last gave. */
+    static uint32_t ulAduChunkSize;
+    static uint64_t ullAduChunkRate;
+#endif /* democonfigADU_ADAPTIVE_CHUNK_SIZE == 1 */
+
+#if ( democonfigADU_DOWNLOAD_SHAPING == 1 )
+    /* The token bucket of the range requests: bytes that may be requested,
+     * negative after a request took more, as of xAduTokensTicks. */
+    static int64_t llAduTokens;
+    static TickType_t xAduTokensTicks;
+
+    /* Set by the demo task around its publishes, and to the packet ID of its
+     * last telemetry until the PUBACK, for the download task to wait on. */
+    static volatile BaseType_t xAduPublishing = pdFALSE;
+    static volatile uint16_t usAduPendingPuback = 0;
+    static volatile TickType_t xAduPublishTicks;
+#endif /* democonfigADU_DOWNLOAD_SHAPING == 1 */
+
+#if ( democonfigADU_DOWNLOAD_USE_TLS == 1 )
+    static TlsTransportParams_t xAduHTTPTransportParams;
+    static NetworkCredentials_t xAduHTTPNetworkCredentials;
+    /* Separate from the session cache of xConnectionManager, which is sized for the DPS and IoT Hub endpoints. */
+    static TlsSessionCache_t xAduTlsSessionCache;
+#else
+    static SocketTransportParams_t xAduHTTPTransportParams;
+#endif /* democonfigADU_DOWNLOAD_USE_TLS == 1 */
+
+#if ( democonfigADU_PIPELINED_DOWNLOAD == 1 )
+    typedef struct AduFlashWrite
+    {
+        uint8_t * pucData;
+        uint32_t ulLength;
+        int32_t lOffset;
+    } AduFlashWrite_t;
+
+    /* The next chunk is received here while the previous one is written. */
+    static uint8_t * pucAduDownloadBuffer2;
+    static QueueHandle_t xAduFlashWriteQueue = NULL;
+    static QueueHandle_t xAduFlashResultQueue = NULL;
+    static StaticQueue_t xAduFlashWriteQueueBuffer;
+    static StaticQueue_t xAduFlashResultQueueBuffer;
+    static uint8_t ucAduFlashWriteQueueStorage[ sizeof( AduFlashWrite_t ) ];
+    static uint8_t ucAduFlashResultQueueStorage[ sizeof( AzureIoTResult_t ) ];
+    static AduFlashWrite_t xAduPendingWrite;
+    static BaseType_t xAduWritePending = pdFALSE;
+#endif /* democonfigADU_PIPELINED_DOWNLOAD == 1 */
 
 const uint8_t sampleaduDEFAULT_RESULT_DETAILS[] = "Ok";
 
@@ -212,27 +618,22 @@ static AzureIoTHubClientComponent_t pnp_components[ sampleaduPNP_COMPONENTS_LIST
 /* as they will reboot before getting to the place where this is used. */
 bool xDidDeviceUpdate = false;
 
-/*-----------------------------------------------------------*/
+/* Workflow of the update whose image is downloaded, to tell a deployment
+ * that replaces it from a redelivery of its own request. */
+#define sampleaduWORKFLOW_ID_SIZE    64
+static uint8_t ucAduDownloadWorkflowId[ sampleaduWORKFLOW_ID_SIZE ];
+static uint32_t ulAduDownloadWorkflowIdLength;
 
-#ifdef democonfigENABLE_DPS_SAMPLE
+#if ( democonfigADU_SCHEDULED_SWAP == 1 )
+    /* A verified image waits in the update bank for prvAduSwapIfDue(). */
+    static BaseType_t xAduSwapStaged = pdFALSE;
+    static uint32_t ulAduSwapSpreadSec;
 
-/**
- * @brief Gets the IoT Hub endpoint and deviceId from Provisioning service.
- *   This function will block for Provisioning service for result or return failure.
- *
- * @param[in] pXNetworkCredentials  Network credential used to connect to Provisioning service
- * @param[out] ppucIothubHostname  Pointer to uint8_t* IoT Hub hostname return from Provisioning Service
- * @param[in,out] pulIothubHostnameLength  Length of hostname
- * @param[out] ppucIothubDeviceId  Pointer to uint8_t* deviceId return from Provisioning Service
- * @param[in,out] pulIothubDeviceIdLength  Length of deviceId
- */
-    static uint32_t prvIoTHubInfoGet( NetworkCredentials_t * pXNetworkCredentials,
-                                      uint8_t ** ppucIothubHostname,
-                                      uint32_t * pulIothubHostnameLength,
-                                      uint8_t ** ppucIothubDeviceId,
-                                      uint32_t * pulIothubDeviceIdLength );
+    /* The last command or writable property, which an idle swap waits on. */
+    static TickType_t xAduLastActivityTicks;
+#endif /* democonfigADU_SCHEDULED_SWAP == 1 */
 
-#endif /* democonfigENABLE_DPS_SAMPLE */
+/*-----------------------------------------------------------*/
 
 /**
  * @brief The task used to demonstrate the Azure IoT Hub API.
@@ -242,30 +643,69 @@ bool xDidDeviceUpdate = false;
  */
 static void prvAzureDemoTask( void * pvParameters );
 
+#ifdef democonfigENABLE_DPS_SAMPLE
+
 /**
- * @brief Connect to endpoint with reconnection retries.
+ * @brief Create the registration payload, with the model ID of ADU.
  *
- * If connection fails, retry is attempted after a timeout.
- * Timeout value will exponentially increase until maximum
- * timeout value is reached or the number of attempts are exhausted.
- *
- * @param pcHostName Hostname of the endpoint to connect to.
- * @param ulPort Endpoint port.
- * @param pxNetworkCredentials Pointer to Network credentials.
- * @param pxNetworkContext Point to Network context created.
- * @return uint32_t The status of the final connection attempt.
- */
-static uint32_t prvConnectToServerWithBackoffRetries( const char * pcHostName,
-                                                      uint32_t ulPort,
-                                                      NetworkCredentials_t * pxNetworkCredentials,
-                                                      NetworkContext_t * pxNetworkContext );
+ * @param[out] pucBuffer The buffer for the payload.
+ * @param[in] ulBufferLength Length of \p pucBuffer.
+ * @param[out] plOutBufferLength Length of the payload.
+ */
+    static AzureIoTResult_t prvCreateProvisioningPayload( uint8_t * pucBuffer,
+                                                          uint32_t ulBufferLength,
+                                                          int32_t * plOutBufferLength );
+
+#endif /* democonfigENABLE_DPS_SAMPLE */
 /*-----------------------------------------------------------*/
 
 /**
- * @brief Static buffer used to hold MQTT messages being sent and received.
+ * @brief Buffer of the hub client, for the topics of the messages it sends and
+ * the MQTT packets it receives, see democonfigNETWORK_BUFFER_SIZE.
  */
 static uint8_t ucMQTTMessageBuffer[ democonfigNETWORK_BUFFER_SIZE ];
 
+#if ( democonfigADU_DOWNLOAD_SHAPING == 1 )
+
+/**
+ * @brief Mark the start of a publish of the demo task.
+ */
+    static void prvAduPublishBegin( void )
+    {
+        xAduPublishing = pdTRUE;
+    }
+
+/**
+ * @brief Mark the end of a publish of the demo task.
+ *
+ * @param[in] usPacketID Packet ID of QoS 1 telemetry, whose PUBACK is then
+ * waited for, or 0.
+ */
+    static void prvAduPublishEnd( uint16_t usPacketID )
+    {
+        if( usPacketID != 0 )
+        {
+            xAduPublishTicks = xTaskGetTickCount();
+            usAduPendingPuback = usPacketID;
+        }
+
+        xAduPublishing = pdFALSE;
+    }
+
+/**
+ * @brief Clear the pending PUBACK the download waits for.
+ */
+    static void prvTelemetryAckCallback( uint16_t usPacketID )
+    {
+        if( usAduPendingPuback == usPacketID )
+        {
+            usAduPendingPuback = 0;
+        }
+    }
+
+#endif /* democonfigADU_DOWNLOAD_SHAPING == 1 */
+/*-----------------------------------------------------------*/
+
 /**
  * @brief Internal function for handling Command requests.
  *
@@ -277,15 +717,43 @@ static void prvHandleCommand( AzureIoTHubClientCommandRequest_t * pxMessage,
     AzureIoTHubClient_t * pxHandle = ( AzureIoTHubClient_t * ) pvContext;
     uint32_t ulResponseStatus = 0;
     AzureIoTResult_t xResult;
+    uint8_t * pucResponseBuffer = CommandResponsePool_Acquire( &xCommandResponsePool );
+    const uint8_t * pucResponsePayload;
+    uint32_t ulCommandResponsePayloadLength;
 
-    uint32_t ulCommandResponsePayloadLength = ulHandleCommand( pxMessage,
-                                                               &ulResponseStatus,
-                                                               ucCommandResponsePayloadBuffer,
-                                                               sizeof( ucCommandResponsePayloadBuffer ) );
+    #if ( democonfigADU_SCHEDULED_SWAP == 1 )
+        xAduLastActivityTicks = xTaskGetTickCount();
+    #endif /* democonfigADU_SCHEDULED_SWAP == 1 */
 
-    if( ( xResult = AzureIoTHubClient_SendCommandResponse( pxHandle, pxMessage, ulResponseStatus,
-                                                           ucCommandResponsePayloadBuffer,
-                                                           ulCommandResponsePayloadLength ) ) != eAzureIoTSuccess )
+    if( pucResponseBuffer == NULL )
+    {
+        LogWarn( ( "No free command response buffer, asking to retry." ) );
+        ulResponseStatus = sampleazureiotCOMMAND_BUSY_STATUS;
+        pucResponsePayload = ( const uint8_t * ) sampleazureiotCOMMAND_BUSY_PAYLOAD;
+        ulCommandResponsePayloadLength = sizeof( sampleazureiotCOMMAND_BUSY_PAYLOAD ) - 1;
+    }
+    else
+    {
+        ulCommandResponsePayloadLength = ulHandleCommand( pxMessage,
+                                                          &ulResponseStatus,
+                                                          pucResponseBuffer,
+                                                          democonfigCOMMAND_RESPONSE_BUFFER_SIZE );
+        pucResponsePayload = pucResponseBuffer;
+    }
+
+    #if ( democonfigADU_DOWNLOAD_SHAPING == 1 )
+        prvAduPublishBegin();
+    #endif /* democonfigADU_DOWNLOAD_SHAPING == 1 */
+
+    xResult = AzureIoTHubClient_SendCommandResponse( pxHandle, pxMessage, ulResponseStatus,
+                                                     pucResponsePayload,
+                                                     ulCommandResponsePayloadLength );
+
+    #if ( democonfigADU_DOWNLOAD_SHAPING == 1 )
+        prvAduPublishEnd( 0 );
+    #endif /* democonfigADU_DOWNLOAD_SHAPING == 1 */
+
+    if( xResult != eAzureIoTSuccess )
     {
         LogError( ( "Error sending command response: result 0x%08x", ( uint16_t ) xResult ) );
     }
@@ -293,15 +761,36 @@ static void prvHandleCommand( AzureIoTHubClientCommandRequest_t * pxMessage,
     {
         LogInfo( ( "Successfully sent command response %u", ( uint16_t ) ulResponseStatus ) );
     }
+
+    CommandResponsePool_Release( &xCommandResponsePool, pucResponseBuffer );
 }
 
 
 static void prvDispatchPropertiesUpdate( AzureIoTHubClientPropertiesResponse_t * pxMessage )
 {
-    vHandleWritableProperties( pxMessage,
-                               ucReportedPropertiesUpdate,
-                               sizeof( ucReportedPropertiesUpdate ),
-                               &ulReportedPropertiesUpdateLength );
+    AzureIoTResult_t xResult;
+    uint32_t ulVersion = ulHandleWritableProperties( pxMessage,
+                                                     ucReportedPropertiesUpdate,
+                                                     sizeof( ucReportedPropertiesUpdate ),
+                                                     &ulReportedPropertiesUpdateLength );
+
+    /* The Device Update component sent its own response, so this is only the
+     * one of the thermostat, if it had properties. */
+    if( ulReportedPropertiesUpdateLength > 0 )
+    {
+        xResult = AzureIoTHubClient_SendPropertiesReported( &xAzureIoTHubClient,
+                                                            ucReportedPropertiesUpdate,
+                                                            ulReportedPropertiesUpdateLength,
+                                                            NULL );
+        configASSERT( xResult == eAzureIoTSuccess );
+    }
+
+    /* A patch was missed, so the whole document is read again. */
+    if( HubSession_PropertiesReceived( &xHubSession, pxMessage, ulVersion ) )
+    {
+        xResult = AzureIoTHubClient_RequestPropertiesAsync( &xAzureIoTHubClient );
+        configASSERT( xResult == eAzureIoTSuccess );
+    }
 }
 /*-----------------------------------------------------------*/
 
@@ -328,11 +817,21 @@ static void prvHandleProperties( AzureIoTHubClientPropertiesResponse_t * pxMessa
 
         case eAzureIoTHubPropertiesWritablePropertyMessage:
             LogDebug( ( "Device writeable property received" ) );
+
+            #if ( democonfigADU_SCHEDULED_SWAP == 1 )
+                xAduLastActivityTicks = xTaskGetTickCount();
+            #endif /* democonfigADU_SCHEDULED_SWAP == 1 */
+
             prvDispatchPropertiesUpdate( pxMessage );
             break;
 
         case eAzureIoTHubPropertiesReportedResponseMessage:
             LogDebug( ( "Device reported property response received" ) );
+            vHandleReportedPropertiesResponse( pxMessage );
+
+            #if ( democonfigADU_PROGRESS_REPORT_PERCENT > 0 )
+                ReportedProperties_HandleResponse( &xAduProgressStore, pxMessage );
+            #endif /* democonfigADU_PROGRESS_REPORT_PERCENT > 0 */
             break;
 
         default:
@@ -343,234 +842,1945 @@ static void prvHandleProperties( AzureIoTHubClientPropertiesResponse_t * pxMessa
 /*-----------------------------------------------------------*/
 
 /**
- * @brief Setup transport credentials.
+ * @brief Close the image download connection, if one is open.
  */
-static uint32_t prvSetupNetworkCredentials( NetworkCredentials_t * pxNetworkCredentials )
+static void prvDisconnectHTTP( void )
 {
-    pxNetworkCredentials->xDisableSni = pdFALSE;
-    /* Set the credentials for establishing a TLS connection. */
-    pxNetworkCredentials->pucRootCa = ( const unsigned char * ) democonfigROOT_CA_PEM;
-    pxNetworkCredentials->xRootCaSize = sizeof( democonfigROOT_CA_PEM );
-    #ifdef democonfigCLIENT_CERTIFICATE_PEM
-        pxNetworkCredentials->pucClientCert = ( const unsigned char * ) democonfigCLIENT_CERTIFICATE_PEM;
-        pxNetworkCredentials->xClientCertSize = sizeof( democonfigCLIENT_CERTIFICATE_PEM );
-        pxNetworkCredentials->pucPrivateKey = ( const unsigned char * ) democonfigCLIENT_PRIVATE_KEY_PEM;
-        pxNetworkCredentials->xPrivateKeySize = sizeof( democonfigCLIENT_PRIVATE_KEY_PEM );
-    #endif
+    if( xAduHTTPConnected == pdTRUE )
+    {
+        #if ( democonfigADU_DOWNLOAD_USE_TLS == 1 )
+            TLS_Socket_Disconnect( &xAduHTTPNetworkContext );
+        #else
+            Azure_Socket_Close( &xAduHTTPNetworkContext );
+        #endif /* democonfigADU_DOWNLOAD_USE_TLS == 1 */
 
-    return 0;
+        xAduHTTPConnected = pdFALSE;
+    }
 }
 /*-----------------------------------------------------------*/
 
-static void prvConnectHTTP( AzureIoTTransportInterface_t * pxHTTPTransport,
-                            const char * pucURL )
-{
-    SocketTransportStatus_t xStatus;
-    TickType_t xRecvTimeout = sampleazureiotTRANSPORT_SEND_RECV_TIMEOUT_MS;
-    TickType_t xSendTimeout = sampleazureiotTRANSPORT_SEND_RECV_TIMEOUT_MS;
-
-    LogInfo( ( "Connecting socket to %s", pucURL ) );
-    xStatus = Azure_Socket_Connect( pxHTTPTransport->pxNetworkContext, pucURL, 80, xRecvTimeout, xSendTimeout );
-
-    LogInfo( ( " xStatus: %i", xStatus ) );
-
-    configASSERT( xStatus == eSocketTransportSuccess );
-}
-
 /**
- * @brief Parses the full ADU file URL into a host (FQDN) and its path.
- *
- * @param xFileUrl ADU file Url to be parsed.
- * @param pucBuffer Buffer to be used for pxHost and pxPath.
- * @param ulBufferSize Size of pucBuffer
- * @param pucHost Where the host part of the url is stored, including a null terminator.
- *               The size of this span is equal to the length of the host address plus the
- *               size of the null-terminator char.
- * @param pulHostLength The length of the content pointed by pucHost.
- * @param pucPath Where the path part of the url is stored.
- * @param pulPathLength The length of the content pointed by pucPath.
+ * @brief Open the image download connection to pucURL, replacing any open one.
  */
-static void prvParseAduFileUrl( AzureIoTADUUpdateManifestFileUrl_t xFileUrl,
-                                uint8_t * pucBuffer,
-                                uint32_t ulBufferSize,
-                                uint8_t ** pucHost,
-                                uint32_t * pulHostLength,
-                                uint8_t ** pucPath,
-                                uint32_t * pulPathLength )
+static AzureIoTResult_t prvConnectHTTP( const char * pucURL )
 {
-    configASSERT( ulBufferSize >= xFileUrl.ulUrlLength );
-
-    /* Skipping the http protocol prefix. */
-    uint8_t * pucUrl = xFileUrl.pucUrl + sizeof( "http://" ) - 1;
-    char * pcPathStart = strstr( ( const char * ) pucUrl, "/" );
-    configASSERT( pcPathStart != NULL );
-
-    *pucHost = pucBuffer;
-    /* Adding an extra space for the null-terminator. */
-    *pulHostLength = pcPathStart - ( char * ) pucUrl + 1;
-    *pucPath = pucBuffer + *pulHostLength;
+    prvDisconnectHTTP();
 
-    /* Discouting the size of host and http prefix from ulUrlLength */
-    *pulPathLength = xFileUrl.ulUrlLength - ( *pulHostLength - 1 ) - ( sizeof( "http://" ) - 1 );
+    xAduHTTPTransport.pxNetworkContext = &xAduHTTPNetworkContext;
+    xAduHTTPNetworkContext.pParams = &xAduHTTPTransportParams;
 
-    ( void ) memcpy( *pucHost, pucUrl, *pulHostLength - 1 );
-    ( void ) memset( *pucHost + *pulHostLength - 1, 0, 1 );
-    ( void ) memcpy( *pucPath, pcPathStart, *pulPathLength );
-}
+    #if ( democonfigADU_DOWNLOAD_USE_TLS == 1 )
+        TlsTransportStatus_t xStatus;
 
-static AzureIoTResult_t prvDownloadUpdateImageIntoFlash( int32_t ullTimeoutInSec )
-{
-    AzureIoTResult_t xResult;
-    AzureIoTHTTPResult_t xHttpResult;
-    AzureIoTHTTP_t xHTTP;
-    char * pucOutDataPtr;
-    uint32_t ulOutHttpDataBufferLength;
-    uint8_t * pucFileUrlHost;
-    uint32_t ulFileUrlHostLength;
-    uint8_t * pucFileUrlPath;
-    uint32_t ulFileUrlPathLength;
-    uint64_t ullPreviousTimeout;
-    uint64_t ullCurrentTime;
+        xAduHTTPTransport.xSend = TLS_Socket_Send;
+        xAduHTTPTransport.xRecv = TLS_Socket_Recv;
 
-    /*HTTP Connection */
-    AzureIoTTransportInterface_t xHTTPTransport;
-    NetworkContext_t xHTTPNetworkContext = { 0 };
-    SocketTransportParams_t xHTTPSocketTransportParams = { 0 };
+        xAduHTTPNetworkCredentials.xDisableSni = pdFALSE;
+        xAduHTTPNetworkCredentials.pxSessionCache = &xAduTlsSessionCache;
+        xAduHTTPNetworkCredentials.pucRootCa = ( const unsigned char * ) democonfigADU_DOWNLOAD_ROOT_CA_PEM;
+        xAduHTTPNetworkCredentials.xRootCaSize = sizeof( democonfigADU_DOWNLOAD_ROOT_CA_PEM );
 
-    /* Fill in Transport Interface send and receive function pointers. */
-    xHTTPTransport.pxNetworkContext = &xHTTPNetworkContext;
-    xHTTPTransport.xSend = Azure_Socket_Send;
-    xHTTPTransport.xRecv = Azure_Socket_Recv;
+        LogInfo( ( "Creating a TLS connection to %s:%u.", pucURL, ( uint16_t ) democonfigADU_DOWNLOAD_PORT ) );
+        xStatus = TLS_Socket_Connect( &xAduHTTPNetworkContext, pucURL, democonfigADU_DOWNLOAD_PORT,
+                                      &xAduHTTPNetworkCredentials,
+                                      sampleazureiotTRANSPORT_SEND_RECV_TIMEOUT_MS,
+                                      sampleazureiotTRANSPORT_SEND_RECV_TIMEOUT_MS );
 
-    xHTTPNetworkContext.pParams = &xHTTPSocketTransportParams;
+        LogInfo( ( " xStatus: %i", xStatus ) );
 
-    AzureIoTPlatform_Init( &xImage );
+        if( xStatus != eTLSTransportSuccess )
+        {
+            return eAzureIoTErrorFailed;
+        }
+    #else /* democonfigADU_DOWNLOAD_USE_TLS == 1 */
+        SocketTransportStatus_t xStatus;
 
-    LogInfo( ( "[ADU] Step: eAzureIoTADUUpdateStepFirmwareDownloadStarted" ) );
+        xAduHTTPTransport.xSend = Azure_Socket_Send;
+        xAduHTTPTransport.xRecv = Azure_Socket_Recv;
+        xAduHTTPTransportParams.ulReceiveBufferSize = democonfigADU_DOWNLOAD_RECEIVE_BUFFER_SIZE;
 
-    LogInfo( ( "[ADU] Send property update." ) );
+        LogInfo( ( "Connecting socket to %s", pucURL ) );
+        xStatus = Azure_Socket_Connect( &xAduHTTPNetworkContext, pucURL, democonfigADU_DOWNLOAD_PORT,
+                                        sampleazureiotTRANSPORT_SEND_RECV_TIMEOUT_MS,
+                                        sampleazureiotTRANSPORT_SEND_RECV_TIMEOUT_MS );
 
-    xResult = AzureIoTADUClient_SendAgentState( &xAzureIoTADUClient,
-                                                &xAzureIoTHubClient,
-                                                &xADUDeviceProperties,
-                                                &xAzureIoTAduUpdateRequest,
-                                                eAzureIoTADUAgentStateDeploymentInProgress,
-                                                NULL,
-                                                ucScratchBuffer,
-                                                sizeof( ucScratchBuffer ),
-                                                NULL );
+        LogInfo( ( " xStatus: %i", xStatus ) );
 
-    LogInfo( ( "[ADU] Invoke HTTP Connect Callback." ) );
+        if( xStatus != eSocketTransportSuccess )
+        {
+            return eAzureIoTErrorFailed;
+        }
+    #endif /* democonfigADU_DOWNLOAD_USE_TLS == 1 */
 
-    prvParseAduFileUrl(
-        xAzureIoTAduUpdateRequest.pxFileUrls[ 0 ],
-        ucScratchBuffer, sizeof( ucScratchBuffer ),
-        &pucFileUrlHost, &ulFileUrlHostLength,
-        &pucFileUrlPath, &ulFileUrlPathLength );
+    xAduHTTPConnected = pdTRUE;
 
-    prvConnectHTTP( &xHTTPTransport, ( const char * ) pucFileUrlHost );
+    return eAzureIoTSuccess;
+}
+/*-----------------------------------------------------------*/
 
-    /* Range Check */
-    xHttpResult = AzureIoTHTTP_RequestSizeInit( &xHTTP, &xHTTPTransport,
-                                                ( const char * ) pucFileUrlHost,
-                                                ulFileUrlHostLength - 1, /* minus the null-terminator. */
-                                                ( const char * ) pucFileUrlPath,
-                                                ulFileUrlPathLength,
-                                                ( char * ) ucAduDownloadHeaderBuffer,
-                                                sizeof( ucAduDownloadHeaderBuffer ) );
+/**
+ * @brief Case insensitive comparison of pcText against the lower case pcLower.
+ */
+static BaseType_t prvHTTPHeaderMatches( const char * pcText,
+                                        const char * pcLower,
+                                        uint32_t ulLength )
+{
+    uint32_t ulIndex;
+    char cChar;
 
-    if( xHttpResult != eAzureIoTHTTPSuccess )
+    for( ulIndex = 0; ulIndex < ulLength; ulIndex++ )
     {
-        return eAzureIoTErrorFailed;
-    }
+        cChar = pcText[ ulIndex ];
 
-    if( ( xImage.ulImageFileSize = AzureIoTHTTP_RequestSize( &xHTTP, ( char * ) ucAduDownloadBuffer,
-                                                             sizeof( ucAduDownloadBuffer ) ) ) != -1 )
+        if( ( cChar >= 'A' ) && ( cChar <= 'Z' ) )
+        {
+            cChar = ( char ) ( cChar - 'A' + 'a' );
+        }
+
+        if( cChar != pcLower[ ulIndex ] )
+        {
+            return pdFALSE;
+        }
+    }
+
+    return pdTRUE;
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Find the value of a response header.
+ *
+ * @param pcHeaders Start of the response, up to the body.
+ * @param ulLength Length of \p pcHeaders.
+ * @param pcLowerName The name, lower case, as "\r\nname:".
+ * @param ulNameLength Length of \p pcLowerName.
+ * @param pulValue Set to the offset of the value, past its leading spaces.
+ */
+static BaseType_t prvHTTPFindHeader( const char * pcHeaders,
+                                     uint32_t ulLength,
+                                     const char * pcLowerName,
+                                     uint32_t ulNameLength,
+                                     uint32_t * pulValue )
+{
+    uint32_t ulStart;
+    uint32_t ulValue;
+
+    for( ulStart = 0; ulStart + ulNameLength <= ulLength; ulStart++ )
+    {
+        if( prvHTTPHeaderMatches( &pcHeaders[ ulStart ], pcLowerName, ulNameLength ) == pdTRUE )
+        {
+            ulValue = ulStart + ulNameLength;
+
+            while( ( ulValue < ulLength ) && ( ( pcHeaders[ ulValue ] == ' ' ) || ( pcHeaders[ ulValue ] == '\t' ) ) )
+            {
+                ulValue++;
+            }
+
+            *pulValue = ulValue;
+
+            return pdTRUE;
+        }
+    }
+
+    return pdFALSE;
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Check whether a response's headers say the server closes the connection after it.
+ *
+ * @param pcHeaders Start of the response, up to the body.
+ * @param ulLength Length of \p pcHeaders.
+ */
+static BaseType_t prvHTTPResponseClosesConnection( const char * pcHeaders,
+                                                   uint32_t ulLength )
+{
+    static const char cConnection[] = "\r\nconnection:";
+    static const char cClose[] = "close";
+    uint32_t ulValue;
+
+    return ( ( prvHTTPFindHeader( pcHeaders, ulLength, cConnection, sizeof( cConnection ) - 1, &ulValue ) == pdTRUE ) &&
+             ( ulValue + sizeof( cClose ) - 1 <= ulLength ) &&
+             ( prvHTTPHeaderMatches( &pcHeaders[ ulValue ], cClose, sizeof( cClose ) - 1 ) == pdTRUE ) ) ? pdTRUE : pdFALSE;
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Parse the decimal number at pcText[ *pulIndex ], moving *pulIndex past it.
+ */
+static BaseType_t prvHTTPParseDecimal( const char * pcText,
+                                       uint32_t ulLength,
+                                       uint32_t * pulIndex,
+                                       uint32_t * pulValue )
+{
+    uint32_t ulIndex = *pulIndex;
+    uint32_t ulValue = 0;
+
+    while( ( ulIndex < ulLength ) && ( pcText[ ulIndex ] >= '0' ) && ( pcText[ ulIndex ] <= '9' ) &&
+           ( ulValue <= ( UINT32_MAX - 9U ) / 10U ) )
+    {
+        ulValue = ulValue * 10U + ( uint32_t ) ( pcText[ ulIndex ] - '0' );
+        ulIndex++;
+    }
+
+    if( ulIndex == *pulIndex )
+    {
+        return pdFALSE;
+    }
+
+    *pulIndex = ulIndex;
+    *pulValue = ulValue;
+
+    return pdTRUE;
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Check that the "Content-Range: bytes <start>-<end>/<size>" of a
+ * response is a range of a file of ulSize bytes, the size the manifest gave.
+ *
+ * @param pcHeaders Start of the response, up to the body.
+ * @param ulLength Length of \p pcHeaders.
+ * @param ulSize Size of the file.
+ */
+static BaseType_t prvHTTPRangeOfSize( const char * pcHeaders,
+                                      uint32_t ulLength,
+                                      uint32_t ulSize )
+{
+    static const char cContentRange[] = "\r\ncontent-range:";
+    static const char cBytes[] = "bytes ";
+    uint32_t ulValue;
+    uint32_t ulNumber;
+
+    if( ( prvHTTPFindHeader( pcHeaders, ulLength, cContentRange, sizeof( cContentRange ) - 1, &ulValue ) == pdFALSE ) ||
+        ( ulValue + sizeof( cBytes ) - 1 > ulLength ) ||
+        ( prvHTTPHeaderMatches( &pcHeaders[ ulValue ], cBytes, sizeof( cBytes ) - 1 ) == pdFALSE ) )
+    {
+        return pdFALSE;
+    }
+
+    ulValue += sizeof( cBytes ) - 1;
+
+    if( ( prvHTTPParseDecimal( pcHeaders, ulLength, &ulValue, &ulNumber ) == pdFALSE ) ||
+        ( ulValue >= ulLength ) || ( pcHeaders[ ulValue++ ] != '-' ) ||
+        ( prvHTTPParseDecimal( pcHeaders, ulLength, &ulValue, &ulNumber ) == pdFALSE ) ||
+        ( ulValue >= ulLength ) || ( pcHeaders[ ulValue++ ] != '/' ) ||
+        ( prvHTTPParseDecimal( pcHeaders, ulLength, &ulValue, &ulNumber ) == pdFALSE ) )
+    {
+        return pdFALSE;
+    }
+
+    return ( ulNumber == ulSize ) ? pdTRUE : pdFALSE;
+}
+/*-----------------------------------------------------------*/
+
+#if ( democonfigADU_STREAMED_RESPONSE == 1 )
+
+/**
+ * @brief Append text to the request being built.
+ */
+    static BaseType_t prvHTTPAppendText( uint8_t * pucRequest,
+                                         uint32_t ulRequestSize,
+                                         uint32_t * pulUsed,
+                                         const void * pvText,
+                                         uint32_t ulLength )
+    {
+        if( ulRequestSize - *pulUsed < ulLength )
+        {
+            return pdFALSE;
+        }
+
+        ( void ) memcpy( pucRequest + *pulUsed, pvText, ulLength );
+        *pulUsed += ulLength;
+
+        return pdTRUE;
+    }
+
+/**
+ * @brief Append a decimal number to the request being built.
+ */
+    static BaseType_t prvHTTPAppendDecimal( uint8_t * pucRequest,
+                                            uint32_t ulRequestSize,
+                                            uint32_t * pulUsed,
+                                            uint32_t ulValue )
+    {
+        char cDigits[ 10 ];
+        uint32_t ulDigits = sizeof( cDigits );
+
+        do
+        {
+            cDigits[ --ulDigits ] = ( char ) ( '0' + ( ulValue % 10U ) );
+            ulValue /= 10U;
+        } while( ulValue > 0U );
+
+        return prvHTTPAppendText( pucRequest, ulRequestSize, pulUsed, &cDigits[ ulDigits ], sizeof( cDigits ) - ulDigits );
+    }
+
+/**
+ * @brief Send a range request for a chunk of a file on the download
+ *        connection, and receive the body of its response into pucBody.
+ *
+ * The headers are received into pucAduDownloadHeaderBuffer, which holds the
+ * request until it is sent, and scanned for their end as they arrive. Only
+ * the start of the body that arrives with them is copied; the rest of it is
+ * received in place.
+ *
+ * @param pxRequest The file.
+ * @param lStart Offset of the first byte of the chunk.
+ * @param lEnd Offset of the last byte of the chunk.
+ * @param pucBody Buffer the body is received into.
+ * @param ulBodySize Size of \p pucBody.
+ * @param pulBodyLength Set to the length of the body.
+ * @param pxServerClosing Set to whether the server closes the connection after the response.
+ * @return eAzureIoTHTTPNoResponse if the connection failed or did not answer,
+ * eAzureIoTHTTPInvalidResponse if the response is not the chunk.
+ */
+    static AzureIoTHTTPResult_t prvAduStreamRangeRequest( const AduDownloadRequest_t * pxRequest,
+                                                          int32_t lStart,
+                                                          int32_t lEnd,
+                                                          uint8_t * pucBody,
+                                                          uint32_t ulBodySize,
+                                                          uint32_t * pulBodyLength,
+                                                          BaseType_t * pxServerClosing )
+    {
+        static const char cContentLength[] = "\r\ncontent-length:";
+        static const char cContentRange[] = "\r\ncontent-range:";
+        static const char cBytes[] = "bytes ";
+        uint8_t * pucHeaders = pucAduDownloadHeaderBuffer;
+        const char * pcHeaders = ( const char * ) pucAduDownloadHeaderBuffer;
+        uint32_t ulUsed = 0;
+        uint32_t ulSent = 0;
+        uint32_t ulScanned = 0;
+        uint32_t ulHeaderLength = 0;
+        uint32_t ulValue;
+        uint32_t ulContentLength;
+        uint32_t ulRangeStart;
+        uint32_t ulReceived;
+        int32_t lResult;
+
+        if( ( prvHTTPAppendText( pucHeaders, ADU_HEADER_BUFFER_SIZE, &ulUsed, "GET ", 4 ) == pdFALSE ) ||
+            ( prvHTTPAppendText( pucHeaders, ADU_HEADER_BUFFER_SIZE, &ulUsed, pxRequest->pucPath, pxRequest->ulPathLength ) == pdFALSE ) ||
+            ( prvHTTPAppendText( pucHeaders, ADU_HEADER_BUFFER_SIZE, &ulUsed, " HTTP/1.1\r\nHost: ", 17 ) == pdFALSE ) ||
+            ( prvHTTPAppendText( pucHeaders, ADU_HEADER_BUFFER_SIZE, &ulUsed, pxRequest->pucHost, pxRequest->ulHostLength - 1 ) == pdFALSE ) ||
+            ( prvHTTPAppendText( pucHeaders, ADU_HEADER_BUFFER_SIZE, &ulUsed, "\r\nRange: bytes=", 15 ) == pdFALSE ) ||
+            ( prvHTTPAppendDecimal( pucHeaders, ADU_HEADER_BUFFER_SIZE, &ulUsed, ( uint32_t ) lStart ) == pdFALSE ) ||
+            ( prvHTTPAppendText( pucHeaders, ADU_HEADER_BUFFER_SIZE, &ulUsed, "-", 1 ) == pdFALSE ) ||
+            ( prvHTTPAppendDecimal( pucHeaders, ADU_HEADER_BUFFER_SIZE, &ulUsed, ( uint32_t ) lEnd ) == pdFALSE ) ||
+            ( prvHTTPAppendText( pucHeaders, ADU_HEADER_BUFFER_SIZE, &ulUsed, "\r\n\r\n", 4 ) == pdFALSE ) )
+        {
+            LogError( ( "[ADU] Range request does not fit in %u bytes.", ( unsigned int ) ADU_HEADER_BUFFER_SIZE ) );
+            return eAzureIoTHTTPInsufficientMemory;
+        }
+
+        while( ulSent < ulUsed )
+        {
+            lResult = xAduHTTPTransport.xSend( xAduHTTPTransport.pxNetworkContext, pucHeaders + ulSent, ulUsed - ulSent );
+
+            if( lResult <= 0 )
+            {
+                return eAzureIoTHTTPNoResponse;
+            }
+
+            ulSent += ( uint32_t ) lResult;
+        }
+
+        /* Receive until the blank line that ends the headers. Only the last
+         * bytes scanned and the new ones can complete it. */
+        ulUsed = 0;
+
+        while( ulHeaderLength == 0 )
+        {
+            if( ulUsed == ADU_HEADER_BUFFER_SIZE )
+            {
+                LogError( ( "[ADU] Response headers do not fit in %u bytes.", ( unsigned int ) ADU_HEADER_BUFFER_SIZE ) );
+                return eAzureIoTHTTPInvalidResponse;
+            }
+
+            lResult = xAduHTTPTransport.xRecv( xAduHTTPTransport.pxNetworkContext, pucHeaders + ulUsed, ADU_HEADER_BUFFER_SIZE - ulUsed );
+
+            if( lResult <= 0 )
+            {
+                return eAzureIoTHTTPNoResponse;
+            }
+
+            ulUsed += ( uint32_t ) lResult;
+
+            for( ; ulScanned + 4 <= ulUsed; ulScanned++ )
+            {
+                if( memcmp( &pucHeaders[ ulScanned ], "\r\n\r\n", 4 ) == 0 )
+                {
+                    ulHeaderLength = ulScanned + 4;
+                    break;
+                }
+            }
+        }
+
+        /* "HTTP/1.1 206 ", a partial content answer to the range. */
+        if( ( ulHeaderLength < 13 ) || ( memcmp( pcHeaders, "HTTP/1.", 7 ) != 0 ) ||
+            ( memcmp( &pcHeaders[ 8 ], " 206", 4 ) != 0 ) )
+        {
+            LogError( ( "[ADU] Range request answered with %.*s", 12, pcHeaders ) );
+            return eAzureIoTHTTPInvalidResponse;
+        }
+
+        /* "Content-Range: bytes <start>-<end>/<size>" must be the chunk asked for. */
+        if( ( prvHTTPFindHeader( pcHeaders, ulHeaderLength, cContentRange, sizeof( cContentRange ) - 1, &ulValue ) == pdFALSE ) ||
+            ( ulValue + sizeof( cBytes ) - 1 > ulHeaderLength ) ||
+            ( prvHTTPHeaderMatches( &pcHeaders[ ulValue ], cBytes, sizeof( cBytes ) - 1 ) == pdFALSE ) )
+        {
+            LogError( ( "[ADU] Response has no byte range." ) );
+            return eAzureIoTHTTPInvalidResponse;
+        }
+
+        ulValue += sizeof( cBytes ) - 1;
+
+        if( ( prvHTTPParseDecimal( pcHeaders, ulHeaderLength, &ulValue, &ulRangeStart ) == pdFALSE ) ||
+            ( ulRangeStart != ( uint32_t ) lStart ) ||
+            ( prvHTTPFindHeader( pcHeaders, ulHeaderLength, cContentLength, sizeof( cContentLength ) - 1, &ulValue ) == pdFALSE ) ||
+            ( prvHTTPParseDecimal( pcHeaders, ulHeaderLength, &ulValue, &ulContentLength ) == pdFALSE ) ||
+            ( ulContentLength > ulBodySize ) || ( ulContentLength > ( uint32_t ) ( lEnd - lStart + 1 ) ) ||
+            ( ulUsed - ulHeaderLength > ulContentLength ) )
+        {
+            LogError( ( "[ADU] Response is not the range requested." ) );
+            return eAzureIoTHTTPInvalidResponse;
+        }
+
+        if( prvHTTPRangeOfSize( pcHeaders, ulHeaderLength, ( uint32_t ) pxRequest->llSize ) == pdFALSE )
+        {
+            LogError( ( "[ADU] File is not the %u bytes of the manifest.", ( unsigned int ) pxRequest->llSize ) );
+            return eAzureIoTHTTPInvalidResponse;
+        }
+
+        *pxServerClosing = prvHTTPResponseClosesConnection( pcHeaders, ulHeaderLength );
+
+        ulReceived = ulUsed - ulHeaderLength;
+        ( void ) memcpy( pucBody, &pucHeaders[ ulHeaderLength ], ulReceived );
+
+        while( ulReceived < ulContentLength )
+        {
+            lResult = xAduHTTPTransport.xRecv( xAduHTTPTransport.pxNetworkContext, pucBody + ulReceived, ulContentLength - ulReceived );
+
+            if( lResult <= 0 )
+            {
+                return eAzureIoTHTTPNoResponse;
+            }
+
+            ulReceived += ( uint32_t ) lResult;
+        }
+
+        *pulBodyLength = ulContentLength;
+
+        return eAzureIoTHTTPSuccess;
+    }
+
+#endif /* democonfigADU_STREAMED_RESPONSE == 1 */
+
+/**
+ * @brief Parses the full ADU file URL into a host (FQDN) and its path.
+ *
+ * @param xFileUrl ADU file Url to be parsed.
+ * @param pucBuffer Buffer to be used for pxHost and pxPath.
+ * @param ulBufferSize Size of pucBuffer
+ * @param pucHost Where the host part of the url is stored, including a null terminator.
+ *               The size of this span is equal to the length of the host address plus the
+ *               size of the null-terminator char.
+ * @param pulHostLength The length of the content pointed by pucHost.
+ * @param pucPath Where the path part of the url is stored.
+ * @param pulPathLength The length of the content pointed by pucPath.
+ */
+static void prvParseAduFileUrl( AzureIoTADUUpdateManifestFileUrl_t xFileUrl,
+                                uint8_t * pucBuffer,
+                                uint32_t ulBufferSize,
+                                uint8_t ** pucHost,
+                                uint32_t * pulHostLength,
+                                uint8_t ** pucPath,
+                                uint32_t * pulPathLength )
+{
+    configASSERT( ulBufferSize >= xFileUrl.ulUrlLength );
+
+    /* Skipping the protocol prefix. The scheme does not pick the transport,
+     * democonfigADU_DOWNLOAD_USE_TLS does. */
+    uint32_t ulPrefixLength = ( strncmp( ( const char * ) xFileUrl.pucUrl, "https://", sizeof( "https://" ) - 1 ) == 0 ) ?
+                              sizeof( "https://" ) - 1 : sizeof( "http://" ) - 1;
+    uint8_t * pucUrl = xFileUrl.pucUrl + ulPrefixLength;
+    char * pcPathStart = strstr( ( const char * ) pucUrl, "/" );
+    configASSERT( pcPathStart != NULL );
+
+    *pucHost = pucBuffer;
+    /* Adding an extra space for the null-terminator. */
+    *pulHostLength = pcPathStart - ( char * ) pucUrl + 1;
+    *pucPath = pucBuffer + *pulHostLength;
+
+    /* Discouting the size of host and protocol prefix from ulUrlLength */
+    *pulPathLength = xFileUrl.ulUrlLength - ( *pulHostLength - 1 ) - ulPrefixLength;
+
+    ( void ) memcpy( *pucHost, pucUrl, *pulHostLength - 1 );
+    ( void ) memset( *pucHost + *pulHostLength - 1, 0, 1 );
+    ( void ) memcpy( *pucPath, pcPathStart, *pulPathLength );
+}
+
+/**
+ * @brief Find the URL of a file of the update manifest, which the update
+ *        request lists by file id.
+ */
+static AzureIoTADUUpdateManifestFileUrl_t * prvAduFindFileUrl( const AzureIoTADUUpdateManifestFile_t * pxFile )
+{
+    uint32_t ulUrlIndex;
+
+    for( ulUrlIndex = 0; ulUrlIndex < xAzureIoTAduUpdateRequest.ulFileUrlCount; ulUrlIndex++ )
+    {
+        if( ( xAzureIoTAduUpdateRequest.pxFileUrls[ ulUrlIndex ].ulIdLength == pxFile->ulIdLength ) &&
+            ( memcmp( xAzureIoTAduUpdateRequest.pxFileUrls[ ulUrlIndex ].pucId, pxFile->pucId, pxFile->ulIdLength ) == 0 ) )
+        {
+            return &xAzureIoTAduUpdateRequest.pxFileUrls[ ulUrlIndex ];
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Fill xAduDownloadRequests from the current update request.
+ *
+ * @param pucBuffer Buffer the host, path and name of each file are kept in for the download.
+ * @param ulBufferSize Size of pucBuffer.
+ */
+static AzureIoTResult_t prvAduPrepareDownloadRequest( uint8_t * pucBuffer,
+                                                      uint32_t ulBufferSize )
+{
+    AzureIoTADUUpdateManifestFile_t * pxFile;
+    AzureIoTADUUpdateManifestFileUrl_t * pxFileUrl;
+    AduDownloadRequest_t * pxRequest;
+    uint32_t ulUsed = 0;
+    uint32_t ulFileIndex;
+
+    if( xAzureIoTAduUpdateRequest.xUpdateManifest.ulFilesCount > democonfigADU_MAX_FILES )
+    {
+        LogError( ( "[ADU] Update has more than %u files.", ( unsigned int ) democonfigADU_MAX_FILES ) );
+        return eAzureIoTErrorOutOfMemory;
+    }
+
+    for( ulFileIndex = 0; ulFileIndex < xAzureIoTAduUpdateRequest.xUpdateManifest.ulFilesCount; ulFileIndex++ )
+    {
+        pxFile = &xAzureIoTAduUpdateRequest.xUpdateManifest.pxFiles[ ulFileIndex ];
+        pxRequest = &xAduDownloadRequests[ ulFileIndex ];
+
+        pxFileUrl = prvAduFindFileUrl( pxFile );
+
+        if( pxFileUrl == NULL )
+        {
+            LogError( ( "[ADU] No URL for file %.*s.", ( int16_t ) pxFile->ulFileNameLength, pxFile->pucFileName ) );
+            return eAzureIoTErrorFailed;
+        }
+
+        /* The host gets a null terminator. */
+        if( ulBufferSize - ulUsed < pxFileUrl->ulUrlLength + 1 + pxFile->ulFileNameLength )
+        {
+            LogError( ( "[ADU] File URLs do not fit in the download request." ) );
+            return eAzureIoTErrorOutOfMemory;
+        }
+
+        prvParseAduFileUrl(
+            *pxFileUrl,
+            pucBuffer + ulUsed, ulBufferSize - ulUsed,
+            &pxRequest->pucHost, &pxRequest->ulHostLength,
+            &pxRequest->pucPath, &pxRequest->ulPathLength );
+        ulUsed += pxRequest->ulHostLength + pxRequest->ulPathLength;
+
+        ( void ) memcpy( pucBuffer + ulUsed, pxFile->pucFileName, pxFile->ulFileNameLength );
+        pxRequest->pucFileName = pucBuffer + ulUsed;
+        pxRequest->ulFileNameLength = pxFile->ulFileNameLength;
+        ulUsed += pxFile->ulFileNameLength;
+
+        #if ( democonfigADU_DOWNLOAD_TASK == 1 )
+            if( pxFile->pxHashes[ 0 ].ulHashLength > sizeof( ucAduManifestHashes[ 0 ] ) )
+            {
+                LogError( ( "[ADU] Manifest hash does not fit in the download request." ) );
+                return eAzureIoTErrorOutOfMemory;
+            }
+
+            ( void ) memcpy( ucAduManifestHashes[ ulFileIndex ],
+                             pxFile->pxHashes[ 0 ].pucHash,
+                             pxFile->pxHashes[ 0 ].ulHashLength );
+            pxRequest->pucHash = ucAduManifestHashes[ ulFileIndex ];
+        #else
+            pxRequest->pucHash = pxFile->pxHashes[ 0 ].pucHash;
+        #endif /* democonfigADU_DOWNLOAD_TASK == 1 */
+
+        pxRequest->ulHashLength = pxFile->pxHashes[ 0 ].ulHashLength;
+        pxRequest->llSize = pxFile->llSizeInBytes;
+    }
+
+    ulAduDownloadRequestCount = ulFileIndex;
+
+    #if ( democonfigADU_MIRROR == 1 )
+        ( void ) memcpy( ucAduDownloadMirrorHost, ucAduMirrorHost, ulAduMirrorHostLength + 1 );
+        ulAduDownloadMirrorHostLength = ulAduMirrorHostLength;
+    #endif /* democonfigADU_MIRROR == 1 */
+
+    return eAzureIoTSuccess;
+}
+
+/**
+ * @brief Set the agent state sent at the end of the pass of the demo loop,
+ *        replacing any set before in the pass.
+ *
+ * @param xState The state.
+ * @param xHasRequest Whether the state is about the current update request.
+ */
+static void prvAduQueueAgentState( AzureIoTADUAgentState_t xState,
+                                   BaseType_t xHasRequest )
+{
+    xAduPendingAgentState = xState;
+    xAduPendingAgentStateHasRequest = xHasRequest;
+    xAduAgentStatePending = pdTRUE;
+}
+
+/**
+ * @brief Send the agent state set with prvAduQueueAgentState(), if any.
+ */
+static AzureIoTResult_t prvAduFlushAgentState( void )
+{
+    if( xAduAgentStatePending == pdFALSE )
+    {
+        return eAzureIoTSuccess;
+    }
+
+    xAduAgentStatePending = pdFALSE;
+
+    LogInfo( ( "[ADU] Send property update." ) );
+
+    return AzureIoTADUClient_SendAgentState( &xAzureIoTADUClient,
+                                             &xAzureIoTHubClient,
+                                             &xADUDeviceProperties,
+                                             ( xAduPendingAgentStateHasRequest == pdTRUE ) ? &xAzureIoTAduUpdateRequest : NULL,
+                                             xAduPendingAgentState,
+                                             NULL,
+                                             ucScratchBuffer,
+                                             sizeof( ucScratchBuffer ),
+                                             NULL );
+}
+
+/**
+ * @brief Mark the download progress for the next report, once it moved on by
+ *        democonfigADU_PROGRESS_REPORT_PERCENT since the last one and
+ *        democonfigADU_PROGRESS_REPORT_INTERVAL_SEC passed.
+ *
+ * @param lOffset Bytes of the file downloaded.
+ * @param lSize Size of the file.
+ */
+static void prvAduReportProgress( int32_t lOffset,
+                                  int32_t lSize )
+{
+    #if ( democonfigADU_PROGRESS_REPORT_PERCENT > 0 )
+        uint32_t ulPercent = ( lSize > 0 ) ? ( uint32_t ) ( ( ( uint64_t ) lOffset * 100U ) / ( uint64_t ) lSize ) : 100U;
+        uint64_t ullNow = ullGetUnixTime();
+
+        /* The next file of the update starts from 0 again. */
+        if( ulPercent < ulAduReportedPercent )
+        {
+            ulAduReportedPercent = 0;
+        }
+
+        if( ( ( ulPercent >= 100U ) && ( ulAduReportedPercent < 100U ) ) ||
+            ( ( ulPercent >= ulAduReportedPercent + democonfigADU_PROGRESS_REPORT_PERCENT ) &&
+              ( ullNow - ullAduReportedTime >= democonfigADU_PROGRESS_REPORT_INTERVAL_SEC ) ) )
+        {
+            ReportedProperties_SetInt32( &xAduProgressStore, sampleaduREPORTED_DOWNLOADED_BYTES, lOffset );
+            ReportedProperties_SetInt32( &xAduProgressStore, sampleaduREPORTED_DOWNLOAD_SIZE, lSize );
+            ulAduReportedPercent = ulPercent;
+            ullAduReportedTime = ullNow;
+        }
+    #else
+        ( void ) lOffset;
+        ( void ) lSize;
+    #endif /* democonfigADU_PROGRESS_REPORT_PERCENT > 0 */
+}
+
+/**
+ * @brief Send the download progress marked by prvAduReportProgress(), if due.
+ */
+static void prvAduSendProgress( void )
+{
+    #if ( democonfigADU_PROGRESS_REPORT_PERCENT > 0 )
+        if( ReportedProperties_Send( &xAduProgressStore, &xAzureIoTHubClient,
+                                     ucReportedPropertiesUpdate, sizeof( ucReportedPropertiesUpdate ) ) != eAzureIoTSuccess )
+        {
+            LogWarn( ( "[ADU] Could not report the download progress." ) );
+        }
+    #endif /* democonfigADU_PROGRESS_REPORT_PERCENT > 0 */
+}
+
+/**
+ * @brief Tell the service the download has started, at the end of the pass of the demo loop.
+ */
+static AzureIoTResult_t prvAduSendDownloadStarted( void )
+{
+    LogInfo( ( "[ADU] Step: eAzureIoTADUUpdateStepFirmwareDownloadStarted" ) );
+
+    prvAduQueueAgentState( eAzureIoTADUAgentStateDeploymentInProgress, pdTRUE );
+
+    #if ( democonfigADU_PROGRESS_REPORT_PERCENT > 0 )
+        ulAduReportedPercent = 0;
+        ullAduReportedTime = 0;
+    #endif /* democonfigADU_PROGRESS_REPORT_PERCENT > 0 */
+
+    return eAzureIoTSuccess;
+}
+
+#if ( democonfigADU_ADAPTIVE_CHUNK_SIZE == 1 )
+
+/**
+ * @brief Start a download at the smallest chunk size.
+ */
+    static void prvAduResetChunkSize( void )
+    {
+        ulAduChunkSize = ( democonfigADU_MIN_CHUNK_DOWNLOAD_SIZE < democonfigCHUNK_DOWNLOAD_SIZE ) ?
+                         democonfigADU_MIN_CHUNK_DOWNLOAD_SIZE : democonfigCHUNK_DOWNLOAD_SIZE;
+        ullAduChunkRate = 0;
+
+        LogInfo( ( "[ADU] Chunk size %u bytes.", ( unsigned int ) ulAduChunkSize ) );
+    }
+
+/**
+ * @brief Halve the chunk size, after a failed or slow request.
+ */
+    static void prvAduShrinkChunkSize( void )
+    {
+        uint32_t ulMinSize = ( democonfigADU_MIN_CHUNK_DOWNLOAD_SIZE < democonfigCHUNK_DOWNLOAD_SIZE ) ?
+                             democonfigADU_MIN_CHUNK_DOWNLOAD_SIZE : democonfigCHUNK_DOWNLOAD_SIZE;
+
+        /* The rate measured at the old size no longer applies. */
+        ullAduChunkRate = 0;
+
+        if( ulAduChunkSize > ulMinSize )
+        {
+            ulAduChunkSize = ( ulAduChunkSize / 2 > ulMinSize ) ? ulAduChunkSize / 2 : ulMinSize;
+            LogInfo( ( "[ADU] Chunk size %u bytes.", ( unsigned int ) ulAduChunkSize ) );
+        }
+    }
+
+/**
+ * @brief Adapt the chunk size to a request that returned a full chunk.
+ *
+ * @param[in] ulLength Bytes received.
+ * @param[in] xElapsed Time the request took.
+ */
+    static void prvAduAdaptChunkSize( uint32_t ulLength,
+                                      TickType_t xElapsed )
+    {
+        uint64_t ullRate;
+
+        if( xElapsed > pdMS_TO_TICKS( sampleaduCHUNK_SLOW_REQUEST_MS ) )
+        {
+            prvAduShrinkChunkSize();
+            return;
+        }
+
+        ullRate = ( ( uint64_t ) ulLength * configTICK_RATE_HZ ) / ( ( xElapsed > 0 ) ? xElapsed : 1 );
+
+        /* Keep growing while a larger request pays off. Once it stops, hold the
+         * size and compare later requests against the rate before the last step. */
+        if( ( ullRate > ullAduChunkRate ) && ( ulAduChunkSize < democonfigCHUNK_DOWNLOAD_SIZE ) )
+        {
+            ullAduChunkRate = ullRate;
+            ulAduChunkSize = ( ulAduChunkSize * 2 < democonfigCHUNK_DOWNLOAD_SIZE ) ?
+                             ulAduChunkSize * 2 : democonfigCHUNK_DOWNLOAD_SIZE;
+            LogInfo( ( "[ADU] Chunk size %u bytes (%u bytes/s).",
+                       ( unsigned int ) ulAduChunkSize, ( unsigned int ) ullRate ) );
+        }
+    }
+#endif /* democonfigADU_ADAPTIVE_CHUNK_SIZE == 1 */
+
+/**
+ * @brief Record how much of the image is in flash, so an interrupted download can resume from there.
+ */
+static void prvAduSaveProgress( void )
+{
+    #if ( democonfigADU_RESUMABLE_DOWNLOAD == 1 )
+        /* Losing a record only means re-downloading a little more later. */
+        if( AzureIoTPlatform_SaveProgress( &xImage ) != eAzureIoTSuccess )
+        {
+            LogWarn( ( "[ADU] Could not record download progress." ) );
+        }
+    #endif /* democonfigADU_RESUMABLE_DOWNLOAD == 1 */
+}
+
+#if ( democonfigADU_IMAGE_DECODER == 1 )
+
+/**
+ * @brief Writes each block of the decoded image to flash, in order.
+ */
+    static AzureIoTResult_t prvAduWriteDecodedBlock( const uint8_t * pucData,
+                                                     uint32_t ulLength )
+    {
+        AzureIoTResult_t xResult;
+
+        sampletraceBEGIN( eSampleTraceFlashWrite, xImage.ulCurrentOffset );
+        xResult = AzureIoTPlatform_WriteBlock( &xImage,
+                                               ( uint32_t ) xImage.ulCurrentOffset,
+                                               ( uint8_t * ) pucData,
+                                               ulLength );
+        sampletraceEND( eSampleTraceFlashWrite, xResult );
+
+        if( xResult != eAzureIoTSuccess )
+        {
+            LogError( ( "[ADU] Error writing to flash." ) );
+        }
+        else
+        {
+            xImage.ulCurrentOffset += ( int32_t ) ulLength;
+        }
+
+        return xResult;
+    }
+
+#endif /* democonfigADU_IMAGE_DECODER == 1 */
+
+#if ( democonfigADU_PIPELINED_DOWNLOAD == 1 )
+
+/**
+ * @brief Writes the chunks queued by prvDownloadUpdateImageIntoFlash() to flash.
+ */
+    static void prvAduFlashWriteTask( void * pvParameters )
+    {
+        AduFlashWrite_t xWrite;
+        AzureIoTResult_t xResult;
+
+        ( void ) pvParameters;
+
+        for( ; ; )
+        {
+            if( xQueueReceive( xAduFlashWriteQueue, &xWrite, portMAX_DELAY ) == pdTRUE )
+            {
+                sampletraceBEGIN( eSampleTraceFlashWrite, xWrite.lOffset );
+                xResult = AzureIoTPlatform_WriteBlock( &xImage, ( uint32_t ) xWrite.lOffset,
+                                                       xWrite.pucData, xWrite.ulLength );
+                sampletraceEND( eSampleTraceFlashWrite, xResult );
+                ( void ) xQueueSend( xAduFlashResultQueue, &xResult, portMAX_DELAY );
+            }
+        }
+    }
+
+/**
+ * @brief Wait for the chunk being written, if any, and advance the image offset past it.
+ */
+    static AzureIoTResult_t prvAduWaitForFlashWrite( void )
+    {
+        AzureIoTResult_t xResult = eAzureIoTSuccess;
+
+        if( xAduWritePending == pdTRUE )
+        {
+            ( void ) xQueueReceive( xAduFlashResultQueue, &xResult, portMAX_DELAY );
+            xAduWritePending = pdFALSE;
+
+            if( xResult == eAzureIoTSuccess )
+            {
+                xImage.ulCurrentOffset = xAduPendingWrite.lOffset + ( int32_t ) xAduPendingWrite.ulLength;
+                prvAduSaveProgress();
+            }
+            else
+            {
+                LogError( ( "[ADU] Error writing to flash." ) );
+            }
+        }
+
+        return xResult;
+    }
+
+/**
+ * @brief Hand a downloaded chunk to the flash write task, once the previous one is written.
+ */
+    static AzureIoTResult_t prvAduStartFlashWrite( uint8_t * pucData,
+                                                   uint32_t ulLength,
+                                                   int32_t lOffset )
+    {
+        AzureIoTResult_t xResult = prvAduWaitForFlashWrite();
+
+        if( xResult == eAzureIoTSuccess )
+        {
+            xAduPendingWrite.pucData = pucData;
+            xAduPendingWrite.ulLength = ulLength;
+            xAduPendingWrite.lOffset = lOffset;
+            xAduWritePending = pdTRUE;
+            ( void ) xQueueSend( xAduFlashWriteQueue, &xAduPendingWrite, portMAX_DELAY );
+        }
+
+        return xResult;
+    }
+
+#endif /* democonfigADU_PIPELINED_DOWNLOAD == 1 */
+
+#if ( democonfigADU_DOWNLOAD_TASK == 1 )
+
+/**
+ * @brief Pass download progress, or its result once it ends, to the demo task.
+ */
+    static void prvAduSendDownloadEvent( BaseType_t xDone,
+                                         AzureIoTResult_t xResult,
+                                         int32_t lOffset )
+    {
+        AduDownloadEvent_t xEvent;
+
+        xEvent.xDone = xDone;
+        xEvent.xResult = xResult;
+        xEvent.lOffset = lOffset;
+
+        ( void ) xQueueOverwrite( xAduDownloadEventQueue, &xEvent );
+    }
+
+/**
+ * @brief Check, without waiting, whether the demo task cancelled the download.
+ */
+    static BaseType_t prvAduDownloadCancelled( void )
+    {
+        uint32_t ulNotification = 0;
+
+        ( void ) xTaskNotifyWait( 0, sampleaduDOWNLOAD_NOTIFY_CANCEL, &ulNotification, 0 );
+
+        return ( ulNotification & sampleaduDOWNLOAD_NOTIFY_CANCEL ) != 0 ? pdTRUE : pdFALSE;
+    }
+
+#endif /* democonfigADU_DOWNLOAD_TASK == 1 */
+
+/**
+ * @brief Note the workflow of the update request whose image is downloaded.
+ */
+static void prvAduSaveDownloadWorkflow( void )
+{
+    uint32_t ulLength = xAzureIoTAduUpdateRequest.xWorkflow.ulIDLength;
+
+    ulLength = ( ulLength < sizeof( ucAduDownloadWorkflowId ) ) ? ulLength : sizeof( ucAduDownloadWorkflowId );
+    memcpy( ucAduDownloadWorkflowId, xAzureIoTAduUpdateRequest.xWorkflow.pucID, ulLength );
+    ulAduDownloadWorkflowIdLength = xAzureIoTAduUpdateRequest.xWorkflow.ulIDLength;
+}
+
+/**
+ * @brief Whether the update request is still the one whose image is
+ * downloaded, neither cancelled nor replaced by another deployment, which
+ * comes with the same action and a workflow of its own.
+ */
+static bool prvAduDownloadIsCurrent( void )
+{
+    uint32_t ulLength = ( ulAduDownloadWorkflowIdLength < sizeof( ucAduDownloadWorkflowId ) ) ?
+                        ulAduDownloadWorkflowIdLength : sizeof( ucAduDownloadWorkflowId );
+
+    return xProcessUpdateRequest &&
+           ( xAzureIoTAduUpdateRequest.xWorkflow.xAction == eAzureIoTADUActionApplyDownload ) &&
+           ( xAzureIoTAduUpdateRequest.xWorkflow.ulIDLength == ulAduDownloadWorkflowIdLength ) &&
+           ( memcmp( xAzureIoTAduUpdateRequest.xWorkflow.pucID, ucAduDownloadWorkflowId, ulLength ) == 0 );
+}
+/*-----------------------------------------------------------*/
+
+#if ( democonfigADU_DOWNLOAD_SHAPING == 1 )
+
+/**
+ * @brief Fill the token bucket for the download of a file.
+ */
+    static void prvAduResetTokens( void )
+    {
+        llAduTokens = democonfigADU_DOWNLOAD_BURST;
+        xAduTokensTicks = xTaskGetTickCount();
+    }
+
+/**
+ * @brief Milliseconds until the download window opens, 0 when it is open.
+ */
+    static uint32_t prvAduWindowWaitMs( void )
+    {
+        uint32_t ulStart = ulAduDownloadWindowStart;
+        uint32_t ulEnd = ulAduDownloadWindowEnd;
+        uint32_t ulNow = ( uint32_t ) ( ullGetUnixTime() % sampleaduSECONDS_PER_DAY );
+        BaseType_t xOpen;
+
+        if( ulStart == ulEnd )
+        {
+            return 0;
+        }
+
+        /* A start after the end is a window over midnight. */
+        xOpen = ( ulStart < ulEnd ) ? ( ( ulNow >= ulStart ) && ( ulNow < ulEnd ) ) :
+                ( ( ulNow >= ulStart ) || ( ulNow < ulEnd ) );
+
+        if( xOpen )
+        {
+            return 0;
+        }
+
+        return ( ( ulStart + sampleaduSECONDS_PER_DAY - ulNow ) % sampleaduSECONDS_PER_DAY ) * 1000U;
+    }
+
+/**
+ * @brief Milliseconds until the token bucket allows the next request, 0 when
+ * it does.
+ */
+    static uint32_t prvAduTokensWaitMs( void )
+    {
+        uint32_t ulRate = ulAduDownloadRateLimit;
+        TickType_t xNow = xTaskGetTickCount();
+        TickType_t xElapsed = xNow - xAduTokensTicks;
+
+        if( ulRate == 0 )
+        {
+            llAduTokens = democonfigADU_DOWNLOAD_BURST;
+            xAduTokensTicks = xNow;
+            return 0;
+        }
+
+        /* Only the ticks turned into whole tokens are taken off, so a slow
+         * rate is not rounded down to nothing. */
+        if( ( ( uint64_t ) ulRate * xElapsed ) >= configTICK_RATE_HZ )
+        {
+            llAduTokens += ( int64_t ) ( ( ( uint64_t ) ulRate * xElapsed ) / configTICK_RATE_HZ );
+            xAduTokensTicks = xNow;
+
+            if( llAduTokens > democonfigADU_DOWNLOAD_BURST )
+            {
+                llAduTokens = democonfigADU_DOWNLOAD_BURST;
+            }
+        }
+
+        if( llAduTokens > 0 )
+        {
+            return 0;
+        }
+
+        return ( uint32_t ) ( ( ( uint64_t ) ( 1 - llAduTokens ) * 1000U + ulRate - 1U ) / ulRate );
+    }
+
+/**
+ * @brief Whether the demo task is publishing, or waiting for a PUBACK that
+ * is not overdue.
+ */
+    static BaseType_t prvAduPublishPending( void )
+    {
+        #if ( democonfigADU_DOWNLOAD_TASK == 1 )
+            if( xAduPublishing == pdTRUE )
+            {
+                return pdTRUE;
+            }
+
+            return ( ( usAduPendingPuback != 0 ) &&
+                     ( ( xTaskGetTickCount() - xAduPublishTicks ) < pdMS_TO_TICKS( democonfigADU_DOWNLOAD_PUBLISH_WAIT_MS ) ) ) ?
+                   pdTRUE : pdFALSE;
+        #else
+            /* The publishes happen between the requests. */
+            return pdFALSE;
+        #endif /* democonfigADU_DOWNLOAD_TASK == 1 */
+    }
+
+/**
+ * @brief Wait for the next range request to be allowed: the download window
+ * open, tokens in the bucket and no publish of the demo task pending.
+ *
+ * Without the download task, IoT Hub is serviced while waiting.
+ *
+ * @return pdFALSE when the deployment was cancelled while waiting.
+ */
+    static BaseType_t prvAduWaitForDownloadTurn( void )
+    {
+        BaseType_t xPausedForWindow = pdFALSE;
+        uint32_t ulWaitMs;
+
+        for( ; ; )
+        {
+            ulWaitMs = prvAduWindowWaitMs();
+
+            if( ( ulWaitMs > 0 ) && ( xPausedForWindow == pdFALSE ) )
+            {
+                LogInfo( ( "[ADU] Outside the download window, pausing for %u s.", ( unsigned int ) ( ulWaitMs / 1000U ) ) );
+                xPausedForWindow = pdTRUE;
+            }
+
+            if( ulWaitMs == 0 )
+            {
+                ulWaitMs = prvAduTokensWaitMs();
+            }
+
+            if( ( ulWaitMs == 0 ) && ( prvAduPublishPending() == pdTRUE ) )
+            {
+                ulWaitMs = 10U;
+            }
+
+            if( ulWaitMs == 0 )
+            {
+                break;
+            }
+
+            /* A short step, for a cancel or new settings to be seen. */
+            ulWaitMs = ( ulWaitMs < sampleazureiotPROCESS_LOOP_TIMEOUT_MS ) ? ulWaitMs : sampleazureiotPROCESS_LOOP_TIMEOUT_MS;
+
+            #if ( democonfigADU_DOWNLOAD_TASK == 1 )
+                vTaskDelay( pdMS_TO_TICKS( ulWaitMs ) + 1 );
+
+                if( prvAduDownloadCancelled() == pdTRUE )
+                {
+                    return pdFALSE;
+                }
+            #else
+                ( void ) AzureIoTHubClient_ProcessLoop( &xAzureIoTHubClient, ulWaitMs );
+                prvAduSendProgress();
+
+                if( !prvAduDownloadIsCurrent() )
+                {
+                    return pdFALSE;
+                }
+            #endif /* democonfigADU_DOWNLOAD_TASK == 1 */
+        }
+
+        if( xPausedForWindow == pdTRUE )
+        {
+            LogInfo( ( "[ADU] Download window open, resuming." ) );
+        }
+
+        return pdTRUE;
+    }
+
+#endif /* democonfigADU_DOWNLOAD_SHAPING == 1 */
+
+/**
+ * @brief Download one file of the update into its flash region, over the
+ *        download connection.
+ *
+ * @param pxRequest The file.
+ * @param ulFileIndex Index of the file in the update manifest.
+ * @param ullTimeoutInSec How often IoT Hub is serviced, without the download task.
+ * @param xFromMirror pdTRUE when the host is the cache, which fails on the first
+ *        error, so that the file comes from its own URL instead.
+ */
+static AzureIoTResult_t prvDownloadFile( const AduDownloadRequest_t * pxRequest,
+                                         uint32_t ulFileIndex,
+                                         int32_t ullTimeoutInSec,
+                                         BaseType_t xFromMirror )
+{
+    AzureIoTResult_t xResult;
+    AzureIoTHTTPResult_t xHttpResult;
+    char * pucOutDataPtr;
+    uint32_t ulOutHttpDataBufferLength;
+    uint8_t * pucFileUrlHost;
+    uint32_t ulFileUrlHostLength;
+    uint8_t * pucFileUrlPath;
+    uint32_t ulFileUrlPathLength;
+    uint8_t * pucChunkBuffer = pucAduDownloadBuffer;
+    int32_t lRequestOffset;
+    uint32_t ulReconnects = 0;
+    uint32_t ulReconnectDelay = 0;
+    BaseType_t xServerClosing;
+    uint32_t ulChunkSize = democonfigCHUNK_DOWNLOAD_SIZE;
+
+    #if ( democonfigADU_STREAMED_RESPONSE == 0 )
+        AzureIoTHTTP_t xHTTP;
+    #endif /* democonfigADU_STREAMED_RESPONSE == 0 */
+
+    #if ( democonfigADU_ADAPTIVE_CHUNK_SIZE == 1 )
+        TickType_t xRequestStart;
+    #endif /* democonfigADU_ADAPTIVE_CHUNK_SIZE == 1 */
+
+    #if ( democonfigADU_DOWNLOAD_TASK == 1 )
+        ( void ) ullTimeoutInSec;
+    #else
+        uint64_t ullPreviousTimeout;
+        uint64_t ullCurrentTime;
+    #endif /* democonfigADU_DOWNLOAD_TASK == 1 */
+
+    #if ( democonfigADU_MAX_FILES > 1 )
+        if( AzureIoTPlatform_InitFileRegion( &xImage, ulFileIndex,
+                                             pxRequest->pucFileName,
+                                             pxRequest->ulFileNameLength ) != eAzureIoTSuccess )
+        {
+            LogError( ( "[ADU] Error preparing the flash region of %.*s.",
+                        ( int16_t ) pxRequest->ulFileNameLength, pxRequest->pucFileName ) );
+            return eAzureIoTErrorFailed;
+        }
+    #else /* democonfigADU_MAX_FILES > 1 */
+        ( void ) ulFileIndex;
+
+        #if ( democonfigADU_RESUMABLE_DOWNLOAD == 0 )
+            AzureIoTPlatform_Init( &xImage );
+        #endif /* democonfigADU_RESUMABLE_DOWNLOAD == 0 */
+    #endif /* democonfigADU_MAX_FILES > 1 */
+
+    pucFileUrlHost = pxRequest->pucHost;
+    ulFileUrlHostLength = pxRequest->ulHostLength;
+    pucFileUrlPath = pxRequest->pucPath;
+    ulFileUrlPathLength = pxRequest->ulPathLength;
+
+    /* The size is the one of the manifest, with no round trip to ask the
+     * server. Each range response is checked against it. */
+    if( ( pxRequest->llSize <= 0 ) || ( pxRequest->llSize > INT32_MAX ) )
+    {
+        LogError( ( "[ADU] Manifest gives no size for the file." ) );
+        return eAzureIoTErrorFailed;
+    }
+
+    xImage.ulImageFileSize = ( uint32_t ) pxRequest->llSize;
+
+    #if ( democonfigADU_RESUMABLE_DOWNLOAD == 1 )
+        /* Needs the image size, so the erase can stop at the end of the image. */
+        if( AzureIoTPlatform_ResumeInit( &xImage,
+                                         ( uint8_t * ) pxRequest->pucHash,
+                                         pxRequest->ulHashLength ) != eAzureIoTSuccess )
+        {
+            LogError( ( "[ADU] Error preparing the update partition." ) );
+            return eAzureIoTErrorFailed;
+        }
+    #endif /* democonfigADU_RESUMABLE_DOWNLOAD == 1 */
+
+    #if ( democonfigADU_IMAGE_DECODER == 1 )
+        SampleAduDecoder_Init( prvAduWriteDecodedBlock,
+                               ( const uint8_t * ) democonfigADU_DELTA_SOURCE_IMAGE,
+                               ( uint32_t ) AzureIoTPlatform_GetSingleFlashBootBankSize() );
+    #endif /* democonfigADU_IMAGE_DECODER == 1 */
+
+    LogInfo( ( "[ADU] Send HTTP request." ) );
+
+    #if ( democonfigADU_DOWNLOAD_TASK == 0 )
+        ullPreviousTimeout = ullGetUnixTime();
+    #endif /* democonfigADU_DOWNLOAD_TASK == 0 */
+
+    lRequestOffset = xImage.ulCurrentOffset;
+
+    #if ( democonfigADU_DOWNLOAD_SHAPING == 1 )
+        prvAduResetTokens();
+    #endif /* democonfigADU_DOWNLOAD_SHAPING == 1 */
+
+    /* With democonfigADU_PIPELINED_DOWNLOAD, lRequestOffset runs one chunk
+     * ahead of xImage.ulCurrentOffset while that chunk is being written. */
+    while( lRequestOffset < xImage.ulImageFileSize )
+    {
+        #if ( democonfigADU_DOWNLOAD_TASK == 1 )
+            /* The demo task keeps servicing IoT Hub, and says when to stop. */
+            if( prvAduDownloadCancelled() == pdTRUE )
+            {
+                LogInfo( ( "Deployment was cancelled" ) );
+                break;
+            }
+        #else /* democonfigADU_DOWNLOAD_TASK == 1 */
+            ullCurrentTime = ullGetUnixTime();
+
+            if( ullCurrentTime - ullPreviousTimeout > ullTimeoutInSec )
+            {
+                LogInfo( ( "%u second timeout. Taking a break from downloading image.", ( uint16_t ) ullTimeoutInSec ) );
+                LogInfo( ( "Receiving messages from IoT Hub." ) );
+                xResult = AzureIoTHubClient_ProcessLoop( &xAzureIoTHubClient,
+                                                         sampleazureiotPROCESS_LOOP_TIMEOUT_MS );
+                prvAduSendProgress();
+
+                ullPreviousTimeout = ullGetUnixTime();
+
+                if( !prvAduDownloadIsCurrent() )
+                {
+                    LogInfo( ( "Deployment was cancelled or replaced" ) );
+                    break;
+                }
+            }
+        #endif /* democonfigADU_DOWNLOAD_TASK == 1 */
+
+        #if ( democonfigADU_DOWNLOAD_SHAPING == 1 )
+            if( prvAduWaitForDownloadTurn() == pdFALSE )
+            {
+                LogInfo( ( "Deployment was cancelled" ) );
+                break;
+            }
+        #endif /* democonfigADU_DOWNLOAD_SHAPING == 1 */
+
+        #if ( democonfigADU_STREAMED_RESPONSE == 0 )
+            /* Only rebuilds the request headers, the connection is reused. */
+            AzureIoTHTTP_Init( &xHTTP, &xAduHTTPTransport,
+                               ( const char * ) pucFileUrlHost,
+                               ulFileUrlHostLength - 1, /* minus the null-terminator. */
+                               ( const char * ) pucFileUrlPath,
+                               ulFileUrlPathLength,
+                               ( char * ) pucAduDownloadHeaderBuffer,
+                               ADU_HEADER_BUFFER_SIZE );
+        #endif /* democonfigADU_STREAMED_RESPONSE == 0 */
+
+        #if ( democonfigADU_ADAPTIVE_CHUNK_SIZE == 1 )
+            /* A file that fits in one chunk still comes in one request. */
+            ulChunkSize = ( xImage.ulImageFileSize <= democonfigCHUNK_DOWNLOAD_SIZE ) ?
+                          democonfigCHUNK_DOWNLOAD_SIZE : ulAduChunkSize;
+            xRequestStart = xTaskGetTickCount();
+        #endif /* democonfigADU_ADAPTIVE_CHUNK_SIZE == 1 */
+
+        sampletraceBEGIN( eSampleTraceAduChunkFetch, lRequestOffset );
+        #if ( democonfigADU_STREAMED_RESPONSE == 1 )
+            xHttpResult = prvAduStreamRangeRequest( pxRequest, lRequestOffset,
+                                                    lRequestOffset + ( int32_t ) ulChunkSize - 1,
+                                                    pucChunkBuffer,
+                                                    sampleaduDOWNLOAD_BUFFER_SIZE,
+                                                    &ulOutHttpDataBufferLength,
+                                                    &xServerClosing );
+            pucOutDataPtr = ( char * ) pucChunkBuffer;
+        #else
+            xHttpResult = AzureIoTHTTP_Request( &xHTTP, lRequestOffset,
+                                                lRequestOffset + ( int32_t ) ulChunkSize - 1,
+                                                ( char * ) pucChunkBuffer,
+                                                sampleaduDOWNLOAD_BUFFER_SIZE,
+                                                &pucOutDataPtr,
+                                                &ulOutHttpDataBufferLength );
+        #endif /* democonfigADU_STREAMED_RESPONSE == 1 */
+        sampletraceEND( eSampleTraceAduChunkFetch,
+                        ( xHttpResult == eAzureIoTHTTPSuccess ) ? ulOutHttpDataBufferLength : 0 );
+
+        if( xHttpResult == eAzureIoTHTTPSuccess )
+        {
+            ulReconnects = 0;
+            ReconnectPolicy_Reset( &xHTTPReconnectPolicy );
+
+            #if ( democonfigADU_DOWNLOAD_SHAPING == 1 )
+                llAduTokens -= ( int64_t ) ulOutHttpDataBufferLength;
+            #endif /* democonfigADU_DOWNLOAD_SHAPING == 1 */
+
+            #if ( democonfigADU_ADAPTIVE_CHUNK_SIZE == 1 )
+                /* The last, short, chunk of the image says nothing about the link. */
+                if( ulOutHttpDataBufferLength >= ulChunkSize )
+                {
+                    prvAduAdaptChunkSize( ulOutHttpDataBufferLength, xTaskGetTickCount() - xRequestStart );
+                }
+            #endif /* democonfigADU_ADAPTIVE_CHUNK_SIZE == 1 */
+
+            #if ( democonfigADU_STREAMED_RESPONSE == 0 )
+                /* The response headers sit in front of the body. Check them before
+                 * the buffer is handed to the flash writer. */
+                xServerClosing = prvHTTPResponseClosesConnection( ( const char * ) pucChunkBuffer,
+                                                                  ( uint32_t ) ( ( uint8_t * ) pucOutDataPtr - pucChunkBuffer ) );
+
+                if( prvHTTPRangeOfSize( ( const char * ) pucChunkBuffer,
+                                        ( uint32_t ) ( ( uint8_t * ) pucOutDataPtr - pucChunkBuffer ),
+                                        xImage.ulImageFileSize ) == pdFALSE )
+                {
+                    LogError( ( "[ADU] File is not the %u bytes of the manifest.", ( unsigned int ) xImage.ulImageFileSize ) );
+                    return eAzureIoTErrorFailed;
+                }
+            #endif /* democonfigADU_STREAMED_RESPONSE == 0 */
+
+            #if ( democonfigADU_IMAGE_DECODER == 1 )
+                /* The decoder writes the image out as it is rebuilt. */
+                if( SampleAduDecoder_Process( ( uint8_t * ) pucOutDataPtr, ulOutHttpDataBufferLength ) != eAzureIoTSuccess )
+                {
+                    return eAzureIoTErrorFailed;
+                }
+            #elif ( democonfigADU_PIPELINED_DOWNLOAD == 1 )
+                /* Write in the background and receive the next chunk into the other buffer. */
+                if( prvAduStartFlashWrite( ( uint8_t * ) pucOutDataPtr, ulOutHttpDataBufferLength,
+                                           lRequestOffset ) != eAzureIoTSuccess )
+                {
+                    return eAzureIoTErrorFailed;
+                }
+
+                pucChunkBuffer = ( pucChunkBuffer == pucAduDownloadBuffer ) ? pucAduDownloadBuffer2 : pucAduDownloadBuffer;
+            #else /* democonfigADU_IMAGE_DECODER == 1 */
+                /* Write bytes to the flash */
+                sampletraceBEGIN( eSampleTraceFlashWrite, xImage.ulCurrentOffset );
+                xResult = AzureIoTPlatform_WriteBlock( &xImage,
+                                                       ( uint32_t ) xImage.ulCurrentOffset,
+                                                       ( uint8_t * ) pucOutDataPtr,
+                                                       ulOutHttpDataBufferLength );
+                sampletraceEND( eSampleTraceFlashWrite, xResult );
+
+                if( xResult != eAzureIoTSuccess )
+                {
+                    LogError( ( "[ADU] Error writing to flash." ) );
+                    return eAzureIoTErrorFailed;
+                }
+
+                /* Advance the offset */
+                xImage.ulCurrentOffset += ( int32_t ) ulOutHttpDataBufferLength;
+                prvAduSaveProgress();
+            #endif /* democonfigADU_IMAGE_DECODER == 1 */
+
+            lRequestOffset += ( int32_t ) ulOutHttpDataBufferLength;
+
+            #if ( democonfigADU_DOWNLOAD_TASK == 1 )
+                prvAduSendDownloadEvent( pdFALSE, eAzureIoTSuccess, lRequestOffset );
+            #else
+                prvAduReportProgress( lRequestOffset, ( int32_t ) xImage.ulImageFileSize );
+            #endif /* democonfigADU_DOWNLOAD_TASK == 1 */
+
+            /* Reconnect ahead of the next request rather than have it fail,
+             * or leave that to the next file. */
+            if( ( xServerClosing == pdTRUE ) && ( lRequestOffset >= xImage.ulImageFileSize ) )
+            {
+                prvDisconnectHTTP();
+            }
+            else if( xServerClosing == pdTRUE )
+            {
+                LogInfo( ( "[ADU] Server closed the connection, reconnecting." ) );
+
+                if( prvConnectHTTP( ( const char * ) pucFileUrlHost ) != eAzureIoTSuccess )
+                {
+                    LogError( ( "[ADU] Failed to reconnect to HTTP server!" ) );
+                    return eAzureIoTErrorFailed;
+                }
+            }
+        }
+        else if( xFromMirror == pdTRUE )
+        {
+            LogWarn( ( "[ADU] Mirror request failed: %i", xHttpResult ) );
+            return eAzureIoTErrorFailed;
+        }
+        else if( xHttpResult == eAzureIoTHTTPNoResponse )
+        {
+            if( ++ulReconnects > sampleaduHTTP_MAX_RECONNECTS )
+            {
+                LogError( ( "[ADU] No response after %u reconnects.", ( uint16_t ) sampleaduHTTP_MAX_RECONNECTS ) );
+                return eAzureIoTErrorFailed;
+            }
+
+            #if ( democonfigADU_ADAPTIVE_CHUNK_SIZE == 1 )
+                prvAduShrinkChunkSize();
+            #endif /* democonfigADU_ADAPTIVE_CHUNK_SIZE == 1 */
+
+            /* Wait the same jittered backoff as the hub connect, so that a
+             * fleet downloading one update does not reconnect in step. */
+            if( ReconnectPolicy_NextDelay( &xHTTPReconnectPolicy, &ulReconnectDelay ) != eAzureIoTSuccess )
+            {
+                LogError( ( "[ADU] Reconnect attempts exhausted." ) );
+                return eAzureIoTErrorFailed;
+            }
+
+            LogInfo( ( "[ADU] Reconnecting in %u ms...", ( unsigned int ) ulReconnectDelay ) );
+            vTaskDelay( pdMS_TO_TICKS( ulReconnectDelay ) );
+            LogInfo( ( "[ADU] Invoke HTTP Connect Callback." ) );
+
+            if( prvConnectHTTP( ( const char * ) pucFileUrlHost ) != eAzureIoTSuccess )
+            {
+                LogError( ( "[ADU] Failed to reconnect to HTTP server!" ) );
+                return eAzureIoTErrorFailed;
+            }
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    #if ( democonfigADU_PIPELINED_DOWNLOAD == 1 )
+        /* The last chunk, or the one in flight on cancel, must land before
+         * the image is verified or the buffers are reused. */
+        if( prvAduWaitForFlashWrite() != eAzureIoTSuccess )
+        {
+            return eAzureIoTErrorFailed;
+        }
+    #endif /* democonfigADU_PIPELINED_DOWNLOAD == 1 */
+
+    #if ( democonfigADU_IMAGE_DECODER == 1 )
+        if( lRequestOffset >= xImage.ulImageFileSize )
+        {
+            /* From here on the image is what was rebuilt, not what was downloaded. */
+            if( SampleAduDecoder_Finish( pxRequest->pucHash,
+                                         pxRequest->ulHashLength,
+                                         ucAduImageHash, &ulAduImageHashLength,
+                                         ( uint32_t * ) &xImage.ulImageFileSize ) != eAzureIoTSuccess )
+            {
+                return eAzureIoTErrorFailed;
+            }
+        }
+    #endif /* democonfigADU_IMAGE_DECODER == 1 */
+
+    #if ( democonfigADU_STREAMED_RESPONSE == 0 )
+        AzureIoTHTTP_Deinit( &xHTTP );
+    #endif /* democonfigADU_STREAMED_RESPONSE == 0 */
+
+    return eAzureIoTSuccess;
+}
+/*-----------------------------------------------------------*/
+
+#if ( democonfigADU_PREWARM_CONNECTION == 1 )
+
+/**
+ * @brief Open the download connection when vAduPrewarmDownload() asks, and
+ * drop it if the update was rejected in the meantime.
+ */
+    static void prvAduPrewarmTask( void * pvParameters )
     {
-        LogInfo( ( "[ADU] HTTP Range Request was successful: size %u bytes", ( uint16_t ) xImage.ulImageFileSize ) );
+        BaseType_t xDrop;
+        TickType_t xStart;
+
+        ( void ) pvParameters;
+
+        for( ; ; )
+        {
+            ( void ) ulTaskNotifyTake( pdTRUE, portMAX_DELAY );
+
+            xStart = xTaskGetTickCount();
+            xDrop = ( prvConnectHTTP( cAduPrewarmHost ) != eAzureIoTSuccess ) ? pdTRUE : pdFALSE;
+
+            taskENTER_CRITICAL();
+            {
+                xDrop = ( xDrop == pdTRUE ) || ( xAduPrewarmCancelled == pdTRUE );
+
+                if( xDrop == pdFALSE )
+                {
+                    xAduPrewarmState = eAduPrewarmReady;
+                }
+            }
+            taskEXIT_CRITICAL();
+
+            if( xDrop == pdTRUE )
+            {
+                prvDisconnectHTTP();
+                xAduPrewarmCancelled = pdFALSE;
+                xAduPrewarmState = eAduPrewarmIdle;
+                LogInfo( ( "[ADU] Dropped the connection to %s opened ahead.", cAduPrewarmHost ) );
+            }
+            else
+            {
+                LogInfo( ( "[ADU] Connected to %s ahead of the download in %u ms.", cAduPrewarmHost,
+                           ( unsigned int ) ( ( xTaskGetTickCount() - xStart ) * portTICK_PERIOD_MS ) ) );
+            }
+        }
     }
-    else
+/*-----------------------------------------------------------*/
+
+    void vAduPrewarmDownload( void )
+    {
+        const AzureIoTADUUpdateManifestFile_t * pxFile;
+        const AzureIoTADUUpdateManifestFileUrl_t * pxFileUrl;
+        const char * pcHost;
+        const char * pcPathStart;
+        uint32_t ulHostLength;
+        uint32_t ulPrefixLength;
+
+        /* The connection belongs to the update in progress, if any, and the
+         * redeliveries of its request during the download land here. */
+        if( xProcessUpdateRequest || ( xAduPrewarmState != eAduPrewarmIdle ) ||
+            ( xAzureIoTAduUpdateRequest.xUpdateManifest.ulFilesCount == 0 ) )
+        {
+            return;
+        }
+
+        #if ( democonfigADU_DOWNLOAD_TASK == 1 )
+            if( xAduDownloadInProgress == pdTRUE )
+            {
+                return;
+            }
+        #endif /* democonfigADU_DOWNLOAD_TASK == 1 */
+
+        #if ( democonfigADU_MIRROR == 1 )
+            if( ulAduMirrorHostLength > 0 )
+            {
+                /* The cache is tried first. */
+                pcHost = ( const char * ) ucAduMirrorHost;
+                ulHostLength = ulAduMirrorHostLength;
+            }
+            else
+        #endif /* democonfigADU_MIRROR == 1 */
+        {
+            /* The files are downloaded from the last, the image coming last. */
+            pxFile = &xAzureIoTAduUpdateRequest.xUpdateManifest.pxFiles[ xAzureIoTAduUpdateRequest.xUpdateManifest.ulFilesCount - 1 ];
+            pxFileUrl = prvAduFindFileUrl( pxFile );
+
+            if( pxFileUrl == NULL )
+            {
+                return;
+            }
+
+            ulPrefixLength = ( strncmp( ( const char * ) pxFileUrl->pucUrl, "https://", sizeof( "https://" ) - 1 ) == 0 ) ?
+                             sizeof( "https://" ) - 1 : sizeof( "http://" ) - 1;
+            pcHost = ( const char * ) pxFileUrl->pucUrl + ulPrefixLength;
+            pcPathStart = memchr( pcHost, '/', pxFileUrl->ulUrlLength - ulPrefixLength );
+
+            if( pcPathStart == NULL )
+            {
+                return;
+            }
+
+            ulHostLength = ( uint32_t ) ( pcPathStart - pcHost );
+        }
+
+        if( ulHostLength >= sizeof( cAduPrewarmHost ) )
+        {
+            return;
+        }
+
+        if( xAduPrewarmTask == NULL )
+        {
+            BaseType_t xTaskCreated;
+
+            xTaskCreated = sampletaskCREATE( prvAduPrewarmTask, "AduPrewarm", democonfigDEMO_STACKSIZE,
+                                             NULL, tskIDLE_PRIORITY, &xAduPrewarmTask, democonfigADU_TASK_CORE );
+            configASSERT( xTaskCreated == pdPASS );
+        }
+
+        ( void ) memcpy( cAduPrewarmHost, pcHost, ulHostLength );
+        cAduPrewarmHost[ ulHostLength ] = '\0';
+        xAduPrewarmCancelled = pdFALSE;
+        xAduPrewarmState = eAduPrewarmConnecting;
+
+        LogInfo( ( "[ADU] Connecting to %s while the manifest is verified.", cAduPrewarmHost ) );
+        ( void ) xTaskNotifyGive( xAduPrewarmTask );
+    }
+/*-----------------------------------------------------------*/
+
+    void vAduCancelPrewarm( void )
+    {
+        BaseType_t xDisconnect = pdFALSE;
+
+        taskENTER_CRITICAL();
+        {
+            if( xAduPrewarmState == eAduPrewarmConnecting )
+            {
+                /* The task drops it once connected. */
+                xAduPrewarmCancelled = pdTRUE;
+            }
+            else if( xAduPrewarmState == eAduPrewarmReady )
+            {
+                xDisconnect = pdTRUE;
+            }
+        }
+        taskEXIT_CRITICAL();
+
+        if( xDisconnect == pdTRUE )
+        {
+            prvDisconnectHTTP();
+            xAduPrewarmState = eAduPrewarmIdle;
+            LogInfo( ( "[ADU] Dropped the connection to %s opened ahead.", cAduPrewarmHost ) );
+        }
+    }
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Wait for the connection opened ahead, and take it over.
+ *
+ * @return pdTRUE when it is open to pcHost.
+ */
+    static BaseType_t prvAduTakePrewarm( const char * pcHost )
+    {
+        /* Bounded by the connect timeouts of the transport. */
+        while( xAduPrewarmState == eAduPrewarmConnecting )
+        {
+            vTaskDelay( pdMS_TO_TICKS( 10 ) );
+        }
+
+        if( xAduPrewarmState != eAduPrewarmReady )
+        {
+            return pdFALSE;
+        }
+
+        xAduPrewarmState = eAduPrewarmIdle;
+
+        return ( ( xAduHTTPConnected == pdTRUE ) && ( strcmp( cAduPrewarmHost, pcHost ) == 0 ) ) ? pdTRUE : pdFALSE;
+    }
+
+#endif /* democonfigADU_PREWARM_CONNECTION == 1 */
+
+/**
+ * @brief Connect to the host of pxRequest, unless already connected to it.
+ *
+ * @param pxRequest The file to download next.
+ * @param ppxConnectedRequest The file the connection was opened for, updated.
+ */
+static AzureIoTResult_t prvAduConnectForRequest( const AduDownloadRequest_t * pxRequest,
+                                                 const AduDownloadRequest_t ** ppxConnectedRequest )
+{
+    const AduDownloadRequest_t * pxConnectedRequest = *ppxConnectedRequest;
+
+    #if ( democonfigADU_PREWARM_CONNECTION == 1 )
+        if( prvAduTakePrewarm( ( const char * ) pxRequest->pucHost ) == pdTRUE )
+        {
+            LogInfo( ( "[ADU] Using the connection opened ahead." ) );
+            *ppxConnectedRequest = pxRequest;
+            return eAzureIoTSuccess;
+        }
+    #endif /* democonfigADU_PREWARM_CONNECTION == 1 */
+
+    /* The files of an update are usually on one server, which then keeps
+     * the connection, and TLS session, of the first file. */
+    if( ( xAduHTTPConnected == pdTRUE ) && ( pxConnectedRequest != NULL ) &&
+        ( pxConnectedRequest->ulHostLength == pxRequest->ulHostLength ) &&
+        ( memcmp( pxConnectedRequest->pucHost, pxRequest->pucHost, pxRequest->ulHostLength ) == 0 ) )
+    {
+        return eAzureIoTSuccess;
+    }
+
+    LogInfo( ( "[ADU] Invoke HTTP Connect Callback." ) );
+
+    if( prvConnectHTTP( ( const char * ) pxRequest->pucHost ) != eAzureIoTSuccess )
     {
-        LogError( ( "[ADU] Error getting the headers. " ) );
+        prvDisconnectHTTP();
         return eAzureIoTErrorFailed;
     }
 
-    LogInfo( ( "[ADU] Send HTTP request." ) );
+    *ppxConnectedRequest = pxRequest;
+
+    return eAzureIoTSuccess;
+}
 
-    ullPreviousTimeout = ullGetUnixTime();
+#if ( democonfigADU_MIRROR == 1 )
 
-    while( xImage.ulCurrentOffset < xImage.ulImageFileSize )
+/**
+ * @brief Download one file of the update from the cache, if one is set.
+ *
+ * A cache that does not answer, or does not have the file, fails the download
+ * after its first error, with the connection closed, for the file to come
+ * from its own URL. Whoever serves it, the file is checked against the hash of
+ * the signed manifest.
+ */
+    static AzureIoTResult_t prvAduDownloadFromMirror( const AduDownloadRequest_t * pxRequest,
+                                                      uint32_t ulFileIndex,
+                                                      int32_t ullTimeoutInSec,
+                                                      const AduDownloadRequest_t ** ppxConnectedRequest )
     {
-        ullCurrentTime = ullGetUnixTime();
+        AzureIoTResult_t xResult = eAzureIoTErrorFailed;
 
-        if( ullCurrentTime - ullPreviousTimeout > ullTimeoutInSec )
+        if( ulAduDownloadMirrorHostLength == 0 )
         {
-            LogInfo( ( "%u second timeout. Taking a break from downloading image.", ( uint16_t ) ullTimeoutInSec ) );
-            LogInfo( ( "Receiving messages from IoT Hub." ) );
-            xResult = AzureIoTHubClient_ProcessLoop( &xAzureIoTHubClient,
-                                                     sampleazureiotPROCESS_LOOP_TIMEOUT_MS );
+            return eAzureIoTErrorFailed;
+        }
+
+        /* Same path, on the cache. */
+        xAduMirrorRequest = *pxRequest;
+        xAduMirrorRequest.pucHost = ucAduDownloadMirrorHost;
+        xAduMirrorRequest.ulHostLength = ulAduDownloadMirrorHostLength + 1;
+
+        if( prvAduConnectForRequest( &xAduMirrorRequest, ppxConnectedRequest ) == eAzureIoTSuccess )
+        {
+            xResult = prvDownloadFile( &xAduMirrorRequest, ulFileIndex, ullTimeoutInSec, pdTRUE );
+        }
+
+        if( xResult != eAzureIoTSuccess )
+        {
+            #if ( democonfigADU_PIPELINED_DOWNLOAD == 1 )
+                /* The chunk in flight still reads its buffer. */
+                ( void ) prvAduWaitForFlashWrite();
+            #endif /* democonfigADU_PIPELINED_DOWNLOAD == 1 */
+
+            prvDisconnectHTTP();
+            LogWarn( ( "[ADU] Mirror %s failed for %.*s, using the update URL.",
+                       ( const char * ) ucAduDownloadMirrorHost,
+                       ( int16_t ) pxRequest->ulFileNameLength, pxRequest->pucFileName ) );
+        }
+
+        return xResult;
+    }
+
+#endif /* democonfigADU_MIRROR == 1 */
+
+/**
+ * @brief Download every file of the update, the image last, over one
+ *        connection to the server.
+ *
+ * Each file but the image is checked against its hash as soon as it is in
+ * flash, as the next file reuses xImage. The image is checked before it is
+ * enabled.
+ */
+static AzureIoTResult_t prvDownloadImage( int32_t ullTimeoutInSec )
+{
+    AzureIoTResult_t xResult;
+    const AduDownloadRequest_t * pxRequest;
+    const AduDownloadRequest_t * pxConnectedRequest = NULL;
+    uint32_t ulFileIndex;
+
+    #if ( democonfigADU_PIPELINED_DOWNLOAD == 1 )
+        if( xAduFlashWriteQueue == NULL )
+        {
+            BaseType_t xTaskCreated;
+
+            xAduFlashWriteQueue = xQueueCreateStatic( 1, sizeof( AduFlashWrite_t ),
+                                                      ucAduFlashWriteQueueStorage, &xAduFlashWriteQueueBuffer );
+            xAduFlashResultQueue = xQueueCreateStatic( 1, sizeof( AzureIoTResult_t ),
+                                                       ucAduFlashResultQueueStorage, &xAduFlashResultQueueBuffer );
+            configASSERT( ( xAduFlashWriteQueue != NULL ) && ( xAduFlashResultQueue != NULL ) );
+
+            xTaskCreated = sampletaskCREATE( prvAduFlashWriteTask, "AduFlashWrite", democonfigDEMO_STACKSIZE,
+                                             NULL, tskIDLE_PRIORITY, NULL, democonfigADU_TASK_CORE );
+            configASSERT( xTaskCreated == pdPASS );
+        }
+    #endif /* democonfigADU_PIPELINED_DOWNLOAD == 1 */
+
+    #if ( democonfigADU_DOWNLOAD_TASK == 0 )
+        /* With the download task, the demo task sends this and fills the request.
+         * Without it, the download holds up the pass, so the state goes now. */
+        ( void ) prvAduSendDownloadStarted();
+        xResult = prvAduFlushAgentState();
+
+        if( prvAduPrepareDownloadRequest( ucScratchBuffer, sizeof( ucScratchBuffer ) ) != eAzureIoTSuccess )
+        {
+            return eAzureIoTErrorFailed;
+        }
+    #endif /* democonfigADU_DOWNLOAD_TASK == 0 */
+
+    ReconnectPolicy_Reset( &xHTTPReconnectPolicy );
+
+    #if ( democonfigADU_ADAPTIVE_CHUNK_SIZE == 1 )
+        prvAduResetChunkSize();
+    #endif /* democonfigADU_ADAPTIVE_CHUNK_SIZE == 1 */
 
-            ullPreviousTimeout = ullGetUnixTime();
+    for( ulFileIndex = ulAduDownloadRequestCount; ulFileIndex-- > 0; )
+    {
+        pxRequest = &xAduDownloadRequests[ ulFileIndex ];
+
+        LogInfo( ( "[ADU] Downloading file %.*s.", ( int16_t ) pxRequest->ulFileNameLength, pxRequest->pucFileName ) );
 
-            if( xAzureIoTAduUpdateRequest.xWorkflow.xAction == eAzureIoTADUActionCancel )
+        #if ( democonfigADU_MIRROR == 1 )
+            xResult = prvAduDownloadFromMirror( pxRequest, ulFileIndex, ullTimeoutInSec, &pxConnectedRequest );
+        #else
+            xResult = eAzureIoTErrorFailed;
+        #endif /* democonfigADU_MIRROR == 1 */
+
+        if( xResult != eAzureIoTSuccess )
+        {
+            if( prvAduConnectForRequest( pxRequest, &pxConnectedRequest ) != eAzureIoTSuccess )
             {
-                LogInfo( ( "Deployment was cancelled" ) );
-                break;
+                LogError( ( "[ADU] Failed to connect to HTTP server!" ) );
+                return eAzureIoTErrorFailed;
+            }
+
+            if( prvDownloadFile( pxRequest, ulFileIndex, ullTimeoutInSec, pdFALSE ) != eAzureIoTSuccess )
+            {
+                prvDisconnectHTTP();
+                return eAzureIoTErrorFailed;
+            }
+        }
+
+        /* Cancelled, or stopped part way, which the image check then reports. */
+        if( xImage.ulCurrentOffset < xImage.ulImageFileSize )
+        {
+            break;
+        }
+
+        if( ulFileIndex != 0 )
+        {
+            sampletraceBEGIN( eSampleTraceFlashVerify, ulFileIndex );
+            perfgovernorBOOST();
+            xResult = AzureIoTPlatform_VerifyImage( &xImage, ( uint8_t * ) pxRequest->pucHash, pxRequest->ulHashLength );
+            perfgovernorRELEASE();
+            sampletraceEND( eSampleTraceFlashVerify, xResult );
+
+            if( xResult != eAzureIoTSuccess )
+            {
+                LogError( ( "[ADU] File hash from ADU did not match calculated hash" ) );
+                prvDisconnectHTTP();
+                return eAzureIoTErrorFailed;
+            }
+        }
+    }
+
+    prvDisconnectHTTP();
+
+    return eAzureIoTSuccess;
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Download the update image into flash, with the download buffers
+ *        lent for the time of the download.
+ */
+static AzureIoTResult_t prvDownloadUpdateImageIntoFlash( int32_t ullTimeoutInSec )
+{
+    AzureIoTResult_t xResult;
+    uint32_t ulArenaSize = bufferarenaREGION_SIZE( sampleaduDOWNLOAD_BUFFER_SIZE ) +
+                           bufferarenaREGION_SIZE( ADU_HEADER_BUFFER_SIZE );
+
+    #if ( democonfigADU_PIPELINED_DOWNLOAD == 1 )
+        ulArenaSize += bufferarenaREGION_SIZE( sampleaduDOWNLOAD_BUFFER_SIZE );
+    #endif /* democonfigADU_PIPELINED_DOWNLOAD == 1 */
+
+    if( BufferArena_Enter( &xDownloadArena, eBufferArenaPhaseDownload, ulArenaSize ) != eAzureIoTSuccess )
+    {
+        LogError( ( "[ADU] No memory for the download buffers: %u bytes", ( unsigned int ) ulArenaSize ) );
+        return eAzureIoTErrorOutOfMemory;
+    }
+
+    pucAduDownloadBuffer = BufferArena_Lend( &xDownloadArena, sampleaduDOWNLOAD_BUFFER_SIZE );
+    pucAduDownloadHeaderBuffer = BufferArena_Lend( &xDownloadArena, ADU_HEADER_BUFFER_SIZE );
+
+    #if ( democonfigADU_PIPELINED_DOWNLOAD == 1 )
+        pucAduDownloadBuffer2 = BufferArena_Lend( &xDownloadArena, sampleaduDOWNLOAD_BUFFER_SIZE );
+    #endif /* democonfigADU_PIPELINED_DOWNLOAD == 1 */
+
+    xResult = prvDownloadImage( ullTimeoutInSec );
+
+    #if ( democonfigADU_PIPELINED_DOWNLOAD == 1 )
+        /* A download that failed part way may have left a write in flight,
+         * which still reads its chunk. */
+        ( void ) prvAduWaitForFlashWrite();
+        pucAduDownloadBuffer2 = NULL;
+    #endif /* democonfigADU_PIPELINED_DOWNLOAD == 1 */
+
+    pucAduDownloadBuffer = NULL;
+    pucAduDownloadHeaderBuffer = NULL;
+    BufferArena_Leave( &xDownloadArena );
+
+    return xResult;
+}
+
+#if ( democonfigADU_DOWNLOAD_TASK == 1 )
+
+/**
+ * @brief Runs each download the demo task starts, so it can keep servicing IoT Hub meanwhile.
+ */
+    static void prvAduDownloadTask( void * pvParameters )
+    {
+        uint32_t ulNotification;
+        AzureIoTResult_t xResult;
+
+        ( void ) pvParameters;
+
+        for( ; ; )
+        {
+            /* Clearing every bit drops a cancel left over from the last download. */
+            ( void ) xTaskNotifyWait( 0, ~0UL, &ulNotification, portMAX_DELAY );
+
+            if( ( ulNotification & sampleaduDOWNLOAD_NOTIFY_START ) != 0 )
+            {
+                xResult = prvDownloadUpdateImageIntoFlash( sampleazureiotADU_DOWNLOAD_TIMEOUT_SEC );
+                prvAduSendDownloadEvent( pdTRUE, xResult, xImage.ulCurrentOffset );
             }
         }
+    }
+
+#endif /* democonfigADU_DOWNLOAD_TASK == 1 */
+
+/**
+ * @brief Reset the device into the enabled image.
+ */
+static AzureIoTResult_t prvResetDevice( void )
+{
+    LogInfo( ( "[ADU] Reset the device" ) );
+
+    if( AzureIoTPlatform_ResetDevice( &xImage ) != eAzureIoTSuccess )
+    {
+        LogError( ( "[ADU] Failed resetting the device." ) );
+        return eAzureIoTErrorFailed;
+    }
+
+    /* If a device resets, it will not get here. */
+    /* For linux devices, this will mark the device as updated and we will change the version as if */
+    /* it did update. */
+    LogInfo( ( "[ADU] DEVICE HAS UPDATED" ) );
+    xDidDeviceUpdate = true;
 
-        AzureIoTHTTP_Init( &xHTTP, &xHTTPTransport,
-                           ( const char * ) pucFileUrlHost,
-                           ulFileUrlHostLength - 1, /* minus the null-terminator. */
-                           ( const char * ) pucFileUrlPath,
-                           ulFileUrlPathLength,
-                           ( char * ) ucAduDownloadHeaderBuffer,
-                           sizeof( ucAduDownloadHeaderBuffer ) );
+    return eAzureIoTSuccess;
+}
+/*-----------------------------------------------------------*/
 
-        if( ( xHttpResult = AzureIoTHTTP_Request( &xHTTP, xImage.ulCurrentOffset,
-                                                  xImage.ulCurrentOffset + democonfigCHUNK_DOWNLOAD_SIZE - 1,
-                                                  ( char * ) ucAduDownloadBuffer,
-                                                  sizeof( ucAduDownloadBuffer ),
-                                                  &pucOutDataPtr,
-                                                  &ulOutHttpDataBufferLength ) ) == eAzureIoTHTTPSuccess )
-        {
-            /* Write bytes to the flash */
-            xResult = AzureIoTPlatform_WriteBlock( &xImage,
-                                                   ( uint32_t ) xImage.ulCurrentOffset,
-                                                   ( uint8_t * ) pucOutDataPtr,
-                                                   ulOutHttpDataBufferLength );
+#if ( democonfigADU_SCHEDULED_SWAP == 1 )
 
-            if( xResult != eAzureIoTSuccess )
-            {
-                LogError( ( "[ADU] Error writing to flash." ) );
-                return eAzureIoTErrorFailed;
-            }
+/**
+ * @brief Wait for the time or idle moment to swap the staged image in.
+ */
+    static void prvAduScheduleSwap( void )
+    {
+        xAduSwapStaged = pdTRUE;
+        /* Nothing more is downloaded until the swap, whatever the service resends. */
+        xDidDeviceUpdate = true;
+        xAduLastActivityTicks = xTaskGetTickCount();
+        ulAduSwapSpreadSec = configRAND32() % ( democonfigADU_SWAP_SPREAD_SEC + 1U );
 
-            /* Advance the offset */
-            xImage.ulCurrentOffset += ( int32_t ) ulOutHttpDataBufferLength;
-        }
-        else if( xHttpResult == eAzureIoTHTTPNoResponse )
+        if( ullAduSwapAt != 0 )
         {
-            LogInfo( ( "[ADU] Reconnecting..." ) );
-            LogInfo( ( "[ADU] Invoke HTTP Connect Callback." ) );
-            prvConnectHTTP( &xHTTPTransport, ( const char * ) pucFileUrlHost );
-
-            if( xResult != eAzureIoTSuccess )
-            {
-                LogError( ( "[ADU] Failed to reconnect to HTTP server!" ) );
-                return eAzureIoTErrorFailed;
-            }
+            LogInfo( ( "[ADU] Image staged, swapping %u s after %u",
+                       ( unsigned int ) ulAduSwapSpreadSec, ( unsigned int ) ullAduSwapAt ) );
         }
         else
         {
-            break;
+            LogInfo( ( "[ADU] Image staged, swapping once idle for %u s", ( unsigned int ) democonfigADU_SWAP_IDLE_SEC ) );
         }
     }
-
-    AzureIoTHTTP_Deinit( &xHTTP );
-
-    return eAzureIoTSuccess;
-}
+#endif /* democonfigADU_SCHEDULED_SWAP == 1 */
+/*-----------------------------------------------------------*/
 
 static AzureIoTResult_t prvEnableImageAndResetDevice()
 {
@@ -580,23 +2790,42 @@ static AzureIoTResult_t prvEnableImageAndResetDevice()
     /* Call into platform specific image verification */
     LogInfo( ( "[ADU] Image validated against hash from ADU" ) );
 
-    if( AzureIoTPlatform_VerifyImage(
+    sampletraceBEGIN( eSampleTraceFlashVerify, 0 );
+    perfgovernorBOOST();
+    #if ( democonfigADU_IMAGE_DECODER == 1 )
+        xResult = AzureIoTPlatform_VerifyImage( &xImage, ucAduImageHash, ulAduImageHashLength );
+    #else
+        xResult = AzureIoTPlatform_VerifyImage(
             &xImage,
             xAzureIoTAduUpdateRequest.xUpdateManifest.pxFiles[ 0 ].pxHashes[ 0 ].pucHash,
-            xAzureIoTAduUpdateRequest.xUpdateManifest.pxFiles[ 0 ].pxHashes[ 0 ].ulHashLength
-            ) != eAzureIoTSuccess )
+            xAzureIoTAduUpdateRequest.xUpdateManifest.pxFiles[ 0 ].pxHashes[ 0 ].ulHashLength );
+    #endif /* democonfigADU_IMAGE_DECODER == 1 */
+    perfgovernorRELEASE();
+    sampletraceEND( eSampleTraceFlashVerify, xResult );
+
+    if( xResult != eAzureIoTSuccess )
     {
         LogError( ( "[ADU] File hash from ADU did not match calculated hash" ) );
         return eAzureIoTErrorFailed;
     }
 
-    LogInfo( ( "[ADU] Enable the update image" ) );
+    #if ( democonfigADU_SCHEDULED_SWAP == 1 )
+        LogInfo( ( "[ADU] Stage the update image" ) );
 
-    if( AzureIoTPlatform_EnableImage( &xImage ) != eAzureIoTSuccess )
-    {
-        LogError( ( "[ADU] Image could not be enabled" ) );
-        return eAzureIoTErrorFailed;
-    }
+        if( AzureIoTPlatform_StageImage( &xImage, ullAduSwapAt ) != eAzureIoTSuccess )
+        {
+            LogError( ( "[ADU] Image could not be staged" ) );
+            return eAzureIoTErrorFailed;
+        }
+    #else
+        LogInfo( ( "[ADU] Enable the update image" ) );
+
+        if( AzureIoTPlatform_EnableImage( &xImage ) != eAzureIoTSuccess )
+        {
+            LogError( ( "[ADU] Image could not be enabled" ) );
+            return eAzureIoTErrorFailed;
+        }
+    #endif /* democonfigADU_SCHEDULED_SWAP == 1 */
 
     /*
      * In a production implementation the application would fill the final lResultCode
@@ -628,6 +2857,9 @@ static AzureIoTResult_t prvEnableImageAndResetDevice()
 
     LogInfo( ( "[ADU] Send property update." ) );
 
+    /* The results go out before the reset, in place of any state set in this pass. */
+    xAduAgentStatePending = pdFALSE;
+
     xResult = AzureIoTADUClient_SendAgentState( &xAzureIoTADUClient,
                                                 &xAzureIoTHubClient,
                                                 &xADUDeviceProperties,
@@ -644,21 +2876,25 @@ static AzureIoTResult_t prvEnableImageAndResetDevice()
         return xResult;
     }
 
-    LogInfo( ( "[ADU] Reset the device" ) );
-
-    if( AzureIoTPlatform_ResetDevice( &xImage ) != eAzureIoTSuccess )
+    /* The last chance to see the peaks of the download and the checks. */
+    #if ( democonfigSTACK_PROFILE == 1 )
     {
-        LogError( ( "[ADU] Failed resetting the device." ) );
-        return eAzureIoTErrorFailed;
+        static char cStackProfile[ 512 ];
+
+        ( void ) StackProfile_Mark( eStackPhaseAdu );
+        ( void ) StackProfile_Format( cStackProfile, sizeof( cStackProfile ) );
+        LogInfo( ( "[ADU] Stacks: %s", cStackProfile ) );
     }
+    #endif /* democonfigSTACK_PROFILE == 1 */
 
-    /* If a device resets, it will not get here. */
-    /* For linux devices, this will mark the device as updated and we will change the version as if */
-    /* it did update. */
-    LogInfo( ( "[ADU] DEVICE HAS UPDATED" ) );
-    xDidDeviceUpdate = true;
+    #if ( democonfigADU_SCHEDULED_SWAP == 1 )
+        /* The device keeps serving until prvAduSwapIfDue() swaps. */
+        prvAduScheduleSwap();
 
-    return eAzureIoTSuccess;
+        return eAzureIoTSuccess;
+    #else
+        return prvResetDevice();
+    #endif /* democonfigADU_SCHEDULED_SWAP == 1 */
 }
 
 /* This code is only run on the simulator. Devices will not reach this code since they reboot. */
@@ -672,18 +2908,160 @@ static AzureIoTResult_t prvSpoofNewVersion( void )
     #endif
     LogInfo( ( "[ADU] Device Version %.*s",
                ( int16_t ) xADUDeviceProperties.ulCurrentUpdateIdLength, xADUDeviceProperties.ucCurrentUpdateId ) );
-    return AzureIoTADUClient_SendAgentState( &xAzureIoTADUClient,
-                                             &xAzureIoTHubClient,
-                                             &xADUDeviceProperties,
-                                             NULL,
-                                             eAzureIoTADUAgentStateIdle,
-                                             NULL,
-                                             ucScratchBuffer,
-                                             sizeof( ucScratchBuffer ),
-                                             NULL );
+    prvAduQueueAgentState( eAzureIoTADUAgentStateIdle, pdFALSE );
+
+    return eAzureIoTSuccess;
+}
+
+#if ( democonfigADU_SCHEDULED_SWAP == 1 )
+
+/**
+ * @brief Swap the staged image in, once swapAt, with the spread of this
+ * device, passed, or when swapAt is 0, once the device was idle long enough.
+ */
+    static void prvAduSwapIfDue( void )
+    {
+        if( xAduSwapStaged == pdFALSE )
+        {
+            return;
+        }
+
+        if( ullAduSwapAt != 0 )
+        {
+            if( ullGetUnixTime() < ( ullAduSwapAt + ulAduSwapSpreadSec ) )
+            {
+                return;
+            }
+        }
+        else if( ( xTaskGetTickCount() - xAduLastActivityTicks ) < pdMS_TO_TICKS( democonfigADU_SWAP_IDLE_SEC * 1000U ) )
+        {
+            return;
+        }
+
+        LogInfo( ( "[ADU] Swap in the staged image" ) );
+        xAduSwapStaged = pdFALSE;
+
+        if( AzureIoTPlatform_SwapImage( &xImage ) != eAzureIoTSuccess )
+        {
+            /* The next deployment downloads it again. */
+            LogError( ( "[ADU] Staged image could not be swapped in" ) );
+            xDidDeviceUpdate = false;
+            return;
+        }
+
+        if( prvResetDevice() == eAzureIoTSuccess )
+        {
+            ( void ) prvSpoofNewVersion();
+        }
+    }
+
+#endif /* democonfigADU_SCHEDULED_SWAP == 1 */
+
+/**
+ * @brief Install the downloaded image, unless the update was cancelled or replaced meanwhile.
+ */
+static void prvAduFinishUpdate( void )
+{
+    AzureIoTResult_t xResult;
+
+    LogInfo( ( "Checking for ADU twin updates one more time before committing to update." ) );
+    xResult = AzureIoTHubClient_ProcessLoop( &xAzureIoTHubClient,
+                                             sampleazureiotPROCESS_LOOP_TIMEOUT_MS );
+    configASSERT( xResult == eAzureIoTSuccess );
+
+    /* The download ran alongside _ProcessLoop() calls, */
+    /* which could bring in a new or cancelled update. */
+    /* Check the request again in case a new version came in that was invalid, */
+    /* or another deployment, whose image is not the one downloaded. */
+    if( prvAduDownloadIsCurrent() )
+    {
+        xResult = prvEnableImageAndResetDevice();
+        configASSERT( xResult == eAzureIoTSuccess );
+
+        #if ( democonfigADU_SCHEDULED_SWAP == 0 )
+            xResult = prvSpoofNewVersion();
+            configASSERT( xResult == eAzureIoTSuccess );
+        #endif /* democonfigADU_SCHEDULED_SWAP == 0 */
+    }
+    else if( xProcessUpdateRequest && ( xAzureIoTAduUpdateRequest.xWorkflow.xAction == eAzureIoTADUActionApplyDownload ) )
+    {
+        /* Left for the next pass, which downloads its own image. */
+        LogInfo( ( "[ADU] Update replaced during the download, starting over." ) );
+    }
+    else
+    {
+        prvAduQueueAgentState( eAzureIoTADUAgentStateIdle, pdTRUE );
+
+        xProcessUpdateRequest = false;
+    }
 }
 
+#if ( democonfigADU_DOWNLOAD_TASK == 1 )
+
+/**
+ * @brief Hand the current update request to the download task.
+ */
+    static void prvAduStartDownload( void )
+    {
+        AzureIoTResult_t xResult;
+
+        if( xAduDownloadTask == NULL )
+        {
+            BaseType_t xTaskCreated;
+
+            xAduDownloadEventQueue = xQueueCreateStatic( 1, sizeof( AduDownloadEvent_t ),
+                                                         ucAduDownloadEventQueueStorage, &xAduDownloadEventQueueBuffer );
+            configASSERT( xAduDownloadEventQueue != NULL );
+
+            xTaskCreated = sampletaskCREATE( prvAduDownloadTask, "AduDownload", democonfigDEMO_STACKSIZE,
+                                             NULL, democonfigADU_DOWNLOAD_TASK_PRIORITY, &xAduDownloadTask,
+                                             democonfigADU_TASK_CORE );
+            configASSERT( xTaskCreated == pdPASS );
+        }
+
+        xResult = prvAduSendDownloadStarted();
+        configASSERT( xResult == eAzureIoTSuccess );
+
+        xResult = prvAduPrepareDownloadRequest( ucAduFileUrlBuffer, sizeof( ucAduFileUrlBuffer ) );
+        configASSERT( xResult == eAzureIoTSuccess );
+
+        prvAduSaveDownloadWorkflow();
+        xAduDownloadInProgress = pdTRUE;
+        xAduDownloadCancelSent = pdFALSE;
+        ( void ) xTaskNotify( xAduDownloadTask, sampleaduDOWNLOAD_NOTIFY_START, eSetBits );
+    }
+
+/**
+ * @brief Pass on a cancel, and pick up progress and the result of the running download.
+ */
+    static void prvAduServiceDownload( void )
+    {
+        AduDownloadEvent_t xEvent;
+
+        if( ( xAduDownloadCancelSent == pdFALSE ) && !prvAduDownloadIsCurrent() )
+        {
+            LogInfo( ( "[ADU] Cancelling the download." ) );
+            ( void ) xTaskNotify( xAduDownloadTask, sampleaduDOWNLOAD_NOTIFY_CANCEL, eSetBits );
+            xAduDownloadCancelSent = pdTRUE;
+        }
+
+        if( xQueueReceive( xAduDownloadEventQueue, &xEvent, 0 ) == pdTRUE )
+        {
+            LogInfo( ( "[ADU] Downloaded %u of %u bytes.",
+                       ( unsigned int ) xEvent.lOffset, ( unsigned int ) xImage.ulImageFileSize ) );
+            prvAduReportProgress( xEvent.lOffset, ( int32_t ) xImage.ulImageFileSize );
+
+            if( xEvent.xDone == pdTRUE )
+            {
+                xAduDownloadInProgress = pdFALSE;
+                configASSERT( xEvent.xResult == eAzureIoTSuccess );
+
+                prvAduFinishUpdate();
+            }
+        }
+    }
 
+#endif /* democonfigADU_DOWNLOAD_TASK == 1 */
 /*-----------------------------------------------------------*/
 
 /**
@@ -700,7 +3078,6 @@ static void prvAzureDemoTask( void * pvParameters )
 
     uint32_t ulScratchBufferLength = 0U;
     /* MQTT Connection */
-    NetworkCredentials_t xNetworkCredentials = { 0 };
     AzureIoTTransportInterface_t xTransport;
     NetworkContext_t xNetworkContext = { 0 };
     TlsTransportParams_t xTlsTransportParams = { 0 };
@@ -710,12 +3087,15 @@ static void prvAzureDemoTask( void * pvParameters )
     AzureIoTHubClientOptions_t xHubOptions = { 0 };
     AzureIoTADUClientOptions_t xADUOptions = { 0 };
     bool xSessionPresent;
+    uint32_t ulReportedPropertiesRequestId;
+    uint16_t usTelemetryPacketID = 0;
 
     #ifdef democonfigENABLE_DPS_SAMPLE
         uint8_t * pucIotHubHostname = NULL;
         uint8_t * pucIotHubDeviceId = NULL;
         uint32_t pulIothubHostnameLength = 0;
         uint32_t pulIothubDeviceIdLength = 0;
+        int32_t lOutProvisioningPayloadLength;
     #else
         uint8_t * pucIotHubHostname = ( uint8_t * ) democonfigHOSTNAME;
         uint8_t * pucIotHubDeviceId = ( uint8_t * ) democonfigDEVICE_ID;
@@ -725,17 +3105,53 @@ static void prvAzureDemoTask( void * pvParameters )
 
     ( void ) pvParameters;
 
+    #if ( democonfigADU_SCHEDULED_SWAP == 1 )
+        /* Does not return when the last boot of a new image did not confirm it. */
+        if( AzureIoTPlatform_BootCheck() != eAzureIoTSuccess )
+        {
+            LogError( ( "[ADU] Failed to record the boot of the image" ) );
+        }
+
+        if( AzureIoTPlatform_GetStagedImage( &xImage, &ullAduSwapAt ) )
+        {
+            LogInfo( ( "[ADU] An image staged before the reboot is waiting for its swap" ) );
+            prvAduScheduleSwap();
+        }
+    #endif /* democonfigADU_SCHEDULED_SWAP == 1 */
+
+    xResult = CommandResponsePool_Init( &xCommandResponsePool );
+    configASSERT( xResult == eAzureIoTSuccess );
+
     /* Initialize Azure IoT Middleware.  */
     configASSERT( AzureIoT_Init() == eAzureIoTSuccess );
 
-    ulStatus = prvSetupNetworkCredentials( &xNetworkCredentials );
-    configASSERT( ulStatus == 0 );
+    xResult = ConnectionManager_Init( &xConnectionManager,
+                                      ucMQTTMessageBuffer, sizeof( ucMQTTMessageBuffer ),
+                                      sampleazureiotTRANSPORT_SEND_RECV_TIMEOUT_MS );
+    configASSERT( xResult == eAzureIoTSuccess );
+
+    vSetPnPComponents( &xADUPnPComponent, 1 );
+
+    xResult = ReconnectPolicy_Init( &xHTTPReconnectPolicy,
+                                    ( const uint8_t * ) sampleazureiotRECONNECT_IDENTITY,
+                                    sizeof( sampleazureiotRECONNECT_IDENTITY ) - 1,
+                                    configRAND32() );
+    configASSERT( xResult == eAzureIoTSuccess );
+
+    ConnectionManager_WaitInitialDelay( &xConnectionManager );
 
     #ifdef democonfigENABLE_DPS_SAMPLE
+        xResult = prvCreateProvisioningPayload( ucScratchBuffer,
+                                                sizeof( ucScratchBuffer ),
+                                                &lOutProvisioningPayloadLength );
+        configASSERT( xResult == eAzureIoTSuccess );
+
         /* Run DPS.  */
-        if( ( ulStatus = prvIoTHubInfoGet( &xNetworkCredentials, &pucIotHubHostname,
-                                           &pulIothubHostnameLength, &pucIotHubDeviceId,
-                                           &pulIothubDeviceIdLength ) ) != 0 )
+        if( ( ulStatus = ConnectionManager_Provision( &xConnectionManager,
+                                                      ucScratchBuffer, ( uint32_t ) lOutProvisioningPayloadLength,
+                                                      sampleazureiotProvisioning_Registration_TIMEOUT_MS,
+                                                      &pucIotHubHostname, &pulIothubHostnameLength,
+                                                      &pucIotHubDeviceId, &pulIothubDeviceIdLength ) ) != 0 )
         {
             LogError( ( "Failed on sample_dps_entry!: error code = 0x%08x", ulStatus ) );
             return;
@@ -752,9 +3168,8 @@ static void prvAzureDemoTask( void * pvParameters )
          * value is reached. The function returns a failure status if the TCP
          * connection cannot be established to the IoT Hub after the configured
          * number of attempts. */
-        ulStatus = prvConnectToServerWithBackoffRetries( ( const char * ) pucIotHubHostname,
-                                                         democonfigIOTHUB_PORT,
-                                                         &xNetworkCredentials, &xNetworkContext );
+        ulStatus = ConnectionManager_ConnectHubNoFailover( &xConnectionManager, ( const char * ) pucIotHubHostname,
+                                                           democonfigIOTHUB_PORT, &xNetworkContext );
         configASSERT( ulStatus == 0 );
 
         /* Fill in Transport Interface send and receive function pointers. */
@@ -762,6 +3177,11 @@ static void prvAzureDemoTask( void * pvParameters )
         xTransport.xSend = TLS_Socket_Send;
         xTransport.xRecv = TLS_Socket_Recv;
 
+        #if ( democonfigSUBSCRIBE_BATCH == 1 )
+            xResult = SubscribeBatch_Init( &xSubscribeBatch, &xTransport );
+            configASSERT( xResult == eAzureIoTSuccess );
+        #endif /* democonfigSUBSCRIBE_BATCH == 1 */
+
         /* Init IoT Hub option */
         xResult = AzureIoTHubClient_OptionsInit( &xHubOptions );
         configASSERT( xResult == eAzureIoTSuccess );
@@ -771,6 +3191,10 @@ static void prvAzureDemoTask( void * pvParameters )
         xHubOptions.pucModelID = ( const uint8_t * ) AzureIoTADUModelID;
         xHubOptions.ulModelIDLength = AzureIoTADUModelIDLength;
 
+        #if ( democonfigADU_DOWNLOAD_SHAPING == 1 )
+            xHubOptions.xTelemetryCallback = prvTelemetryAckCallback;
+        #endif /* democonfigADU_DOWNLOAD_SHAPING == 1 */
+
         #ifdef sampleaduPNP_COMPONENTS_LIST_LENGTH
             #if sampleaduPNP_COMPONENTS_LIST_LENGTH > 0
                 xHubOptions.pxComponentList = sampleaduPNP_COMPONENTS_LIST;
@@ -811,28 +3235,65 @@ static void prvAzureDemoTask( void * pvParameters )
                                              sampleazureiotCONNACK_RECV_TIMEOUT_MS );
         configASSERT( xResult == eAzureIoTSuccess );
 
+        #if ( democonfigSUBSCRIBE_BATCH == 1 )
+            /* The subscribe calls return at once, and are not sent to a
+             * session that already holds the subscriptions. */
+            if( HubSession_Resume( &xHubSession, xSessionPresent ) )
+            {
+                SubscribeBatch_BeginResumed( &xSubscribeBatch );
+            }
+            else
+            {
+                SubscribeBatch_Begin( &xSubscribeBatch );
+            }
+        #else
+            /* The subscriptions are sent again, but the properties need not be. */
+            ( void ) HubSession_Resume( &xHubSession, xSessionPresent );
+        #endif /* democonfigSUBSCRIBE_BATCH == 1 */
+
+        sampletraceBEGIN( eSampleTraceSubscribe, 0 );
         xResult = AzureIoTHubClient_SubscribeCommand( &xAzureIoTHubClient, prvHandleCommand,
                                                       &xAzureIoTHubClient, sampleazureiotSUBSCRIBE_TIMEOUT );
         configASSERT( xResult == eAzureIoTSuccess );
 
         xResult = AzureIoTHubClient_SubscribeProperties( &xAzureIoTHubClient, prvHandleProperties,
                                                          &xAzureIoTHubClient, sampleazureiotSUBSCRIBE_TIMEOUT );
+        sampletraceEND( eSampleTraceSubscribe, xResult );
         configASSERT( xResult == eAzureIoTSuccess );
 
-        xResult = AzureIoTADUClient_SendAgentState( &xAzureIoTADUClient,
-                                                    &xAzureIoTHubClient,
-                                                    &xADUDeviceProperties,
-                                                    NULL,
-                                                    eAzureIoTADUAgentStateIdle,
-                                                    NULL,
-                                                    ucScratchBuffer,
-                                                    sizeof( ucScratchBuffer ),
-                                                    NULL );
-        configASSERT( xResult == eAzureIoTSuccess );
+        /* Ended before the agent state is reported, which is sent on its own. */
+        #if ( democonfigSUBSCRIBE_BATCH == 1 )
+            xResult = SubscribeBatch_End( &xSubscribeBatch );
+            configASSERT( xResult == eAzureIoTSuccess );
+        #endif /* democonfigSUBSCRIBE_BATCH == 1 */
 
-        /* Get property document after initial connection */
-        xResult = AzureIoTHubClient_RequestPropertiesAsync( &xAzureIoTHubClient );
-        configASSERT( xResult == eAzureIoTSuccess );
+        HubSession_SetSubscribed( &xHubSession );
+
+        #if ( democonfigADU_SCHEDULED_SWAP == 1 )
+            /* Reaching IoT Hub is what a new image has to show before it is kept. */
+            if( AzureIoTPlatform_IsImageOnTrial() && ( AzureIoTPlatform_ConfirmImage() == eAzureIoTSuccess ) )
+            {
+                LogInfo( ( "[ADU] Image confirmed, the previous one stays in the other bank" ) );
+            }
+
+            /* A staged image keeps the deployment in progress, as reported with its results. */
+            if( xAduSwapStaged == pdFALSE )
+        #endif /* democonfigADU_SCHEDULED_SWAP == 1 */
+        {
+            /* Replaces any state left from the last connection. */
+            prvAduQueueAgentState( eAzureIoTADUAgentStateIdle, pdFALSE );
+            xResult = prvAduFlushAgentState();
+            configASSERT( xResult == eAzureIoTSuccess );
+        }
+
+        /* Get property document after initial connection, or in a new
+         * session. In a resumed one, a patch missed while the link was down
+         * shows as a gap in the versions, and the document is asked for then. */
+        if( HubSession_NeedsProperties( &xHubSession ) )
+        {
+            xResult = AzureIoTHubClient_RequestPropertiesAsync( &xAzureIoTHubClient );
+            configASSERT( xResult == eAzureIoTSuccess );
+        }
 
         /* Publish messages with QoS1, send and process Keep alive messages. */
         for( ; ; )
@@ -841,9 +3302,17 @@ static void prvAzureDemoTask( void * pvParameters )
             if( ( ulCreateTelemetry( ucScratchBuffer, sizeof( ucScratchBuffer ), &ulScratchBufferLength ) == 0 ) &&
                 ( ulScratchBufferLength > 0 ) )
             {
+                #if ( democonfigADU_DOWNLOAD_SHAPING == 1 )
+                    prvAduPublishBegin();
+                #endif /* democonfigADU_DOWNLOAD_SHAPING == 1 */
+
                 xResult = AzureIoTHubClient_SendTelemetry( &xAzureIoTHubClient,
                                                            ucScratchBuffer, ulScratchBufferLength,
-                                                           NULL, eAzureIoTHubMessageQoS1, NULL );
+                                                           NULL, eAzureIoTHubMessageQoS1, &usTelemetryPacketID );
+
+                #if ( democonfigADU_DOWNLOAD_SHAPING == 1 )
+                    prvAduPublishEnd( ( xResult == eAzureIoTSuccess ) ? usTelemetryPacketID : 0 );
+                #endif /* democonfigADU_DOWNLOAD_SHAPING == 1 */
                 configASSERT( xResult == eAzureIoTSuccess );
             }
 
@@ -852,7 +3321,16 @@ static void prvAzureDemoTask( void * pvParameters )
 
             if( ulReportedPropertiesUpdateLength > 0 )
             {
-                xResult = AzureIoTHubClient_SendPropertiesReported( &xAzureIoTHubClient, ucReportedPropertiesUpdate, ulReportedPropertiesUpdateLength, NULL );
+                #if ( democonfigADU_DOWNLOAD_SHAPING == 1 )
+                    prvAduPublishBegin();
+                #endif /* democonfigADU_DOWNLOAD_SHAPING == 1 */
+
+                xResult = AzureIoTHubClient_SendPropertiesReported( &xAzureIoTHubClient, ucReportedPropertiesUpdate, ulReportedPropertiesUpdateLength, &ulReportedPropertiesRequestId );
+
+                #if ( democonfigADU_DOWNLOAD_SHAPING == 1 )
+                    prvAduPublishEnd( 0 );
+                #endif /* democonfigADU_DOWNLOAD_SHAPING == 1 */
+                vReportedPropertiesUpdateSent( ulReportedPropertiesRequestId, xResult );
                 configASSERT( xResult == eAzureIoTSuccess );
             }
 
@@ -861,57 +3339,33 @@ static void prvAzureDemoTask( void * pvParameters )
                                                      sampleazureiotPROCESS_LOOP_TIMEOUT_MS );
             configASSERT( xResult == eAzureIoTSuccess );
 
+            #if ( democonfigADU_DOWNLOAD_TASK == 1 )
+                if( xAduDownloadInProgress == pdTRUE )
+                {
+                    prvAduServiceDownload();
+                }
+                else
+            #endif /* democonfigADU_DOWNLOAD_TASK == 1 */
+
             if( xProcessUpdateRequest && !xDidDeviceUpdate )
             {
                 if( xAzureIoTAduUpdateRequest.xWorkflow.xAction == eAzureIoTADUActionCancel )
                 {
-                    xResult = AzureIoTADUClient_SendAgentState( &xAzureIoTADUClient,
-                                                                &xAzureIoTHubClient,
-                                                                &xADUDeviceProperties,
-                                                                &xAzureIoTAduUpdateRequest,
-                                                                eAzureIoTADUAgentStateIdle,
-                                                                NULL,
-                                                                ucScratchBuffer,
-                                                                sizeof( ucScratchBuffer ),
-                                                                NULL );
+                    prvAduQueueAgentState( eAzureIoTADUAgentStateIdle, pdTRUE );
 
                     xProcessUpdateRequest = false;
                 }
                 else if( xAzureIoTAduUpdateRequest.xWorkflow.xAction == eAzureIoTADUActionApplyDownload )
                 {
-                    xResult = prvDownloadUpdateImageIntoFlash( sampleazureiotADU_DOWNLOAD_TIMEOUT_SEC );
-                    configASSERT( xResult == eAzureIoTSuccess );
-
-                    LogInfo( ( "Checking for ADU twin updates one more time before committing to update." ) );
-                    xResult = AzureIoTHubClient_ProcessLoop( &xAzureIoTHubClient,
-                                                             sampleazureiotPROCESS_LOOP_TIMEOUT_MS );
-                    configASSERT( xResult == eAzureIoTSuccess );
-
-                    /* In prvDownloadUpdateImageIntoFlash, we make a call to the _ProcessLoop() function */
-                    /* which could bring in a new or cancelled update. */
-                    /* Check xProcessUpdateRequest and the action again in case a new version came in that was invalid. */
-                    if( xProcessUpdateRequest && ( xAzureIoTAduUpdateRequest.xWorkflow.xAction == eAzureIoTADUActionApplyDownload ) )
-                    {
-                        xResult = prvEnableImageAndResetDevice();
+                    #if ( democonfigADU_DOWNLOAD_TASK == 1 )
+                        prvAduStartDownload();
+                    #else
+                        prvAduSaveDownloadWorkflow();
+                        xResult = prvDownloadUpdateImageIntoFlash( sampleazureiotADU_DOWNLOAD_TIMEOUT_SEC );
                         configASSERT( xResult == eAzureIoTSuccess );
 
-                        xResult = prvSpoofNewVersion();
-                        configASSERT( xResult == eAzureIoTSuccess );
-                    }
-                    else
-                    {
-                        xResult = AzureIoTADUClient_SendAgentState( &xAzureIoTADUClient,
-                                                                    &xAzureIoTHubClient,
-                                                                    &xADUDeviceProperties,
-                                                                    &xAzureIoTAduUpdateRequest,
-                                                                    eAzureIoTADUAgentStateIdle,
-                                                                    NULL,
-                                                                    ucScratchBuffer,
-                                                                    sizeof( ucScratchBuffer ),
-                                                                    NULL );
-
-                        xProcessUpdateRequest = false;
-                    }
+                        prvAduFinishUpdate();
+                    #endif /* democonfigADU_DOWNLOAD_TASK == 1 */
                 }
                 else
                 {
@@ -919,9 +3373,31 @@ static void prvAzureDemoTask( void * pvParameters )
                 }
             }
 
-            /* Leave Connection Idle for some time. */
-            LogInfo( ( "Keeping Connection Idle..." ) );
-            vTaskDelay( sampleazureiotDELAY_BETWEEN_PUBLISHES_TICKS );
+            /* One agent state and progress report per pass, however many
+             * transitions it went through. */
+            xResult = prvAduFlushAgentState();
+
+            if( xResult != eAzureIoTSuccess )
+            {
+                LogError( ( "[ADU] Failed sending agent state." ) );
+            }
+
+            prvAduSendProgress();
+
+            #if ( democonfigADU_SCHEDULED_SWAP == 1 )
+                prvAduSwapIfDue();
+            #endif /* democonfigADU_SCHEDULED_SWAP == 1 */
+
+            #if ( democonfigCOMMAND_IMMEDIATE_RESPONSE == 1 )
+                /* Stay in the process loop, so that commands are answered as they arrive. */
+                xResult = AzureIoTHubClient_ProcessLoop( &xAzureIoTHubClient,
+                                                         sampleazureiotDELAY_BETWEEN_PUBLISHES_TICKS * portTICK_PERIOD_MS );
+                configASSERT( xResult == eAzureIoTSuccess );
+            #else
+                /* Leave Connection Idle for some time. */
+                LogInfo( ( "Keeping Connection Idle..." ) );
+                vTaskDelay( sampleazureiotDELAY_BETWEEN_PUBLISHES_TICKS );
+            #endif /* democonfigCOMMAND_IMMEDIATE_RESPONSE == 1 */
         }
 
         xResult = AzureIoTHubClient_UnsubscribeProperties( &xAzureIoTHubClient );
@@ -992,177 +3468,24 @@ static void prvAzureDemoTask( void * pvParameters )
         return xResult;
     }
 
-/**
- * @brief Get IoT Hub endpoint and device Id info, when Provisioning service is used.
- *   This function will block for Provisioning service for result or return failure.
- */
-    static uint32_t prvIoTHubInfoGet( NetworkCredentials_t * pXNetworkCredentials,
-                                      uint8_t ** ppucIothubHostname,
-                                      uint32_t * pulIothubHostnameLength,
-                                      uint8_t ** ppucIothubDeviceId,
-                                      uint32_t * pulIothubDeviceIdLength )
-    {
-        NetworkContext_t xNetworkContext = { 0 };
-        TlsTransportParams_t xTlsTransportParams = { 0 };
-        AzureIoTResult_t xResult;
-        AzureIoTTransportInterface_t xTransport;
-        int32_t lOutProvisioningPayloadLength;
-        uint32_t ucSamplepIothubHostnameLength = sizeof( ucSampleIotHubHostname );
-        uint32_t ucSamplepIothubDeviceIdLength = sizeof( ucSampleIotHubDeviceId );
-        uint32_t ulStatus;
-
-        /* Set the pParams member of the network context with desired transport. */
-        xNetworkContext.pParams = &xTlsTransportParams;
-
-        ulStatus = prvConnectToServerWithBackoffRetries( democonfigENDPOINT, democonfigIOTHUB_PORT,
-                                                         pXNetworkCredentials, &xNetworkContext );
-        configASSERT( ulStatus == 0 );
-
-        /* Fill in Transport Interface send and receive function pointers. */
-        xTransport.pxNetworkContext = &xNetworkContext;
-        xTransport.xSend = TLS_Socket_Send;
-        xTransport.xRecv = TLS_Socket_Recv;
-
-        xResult = AzureIoTProvisioningClient_Init( &xAzureIoTProvisioningClient,
-                                                   ( const uint8_t * ) democonfigENDPOINT,
-                                                   sizeof( democonfigENDPOINT ) - 1,
-                                                   ( const uint8_t * ) democonfigID_SCOPE,
-                                                   sizeof( democonfigID_SCOPE ) - 1,
-                                                   ( const uint8_t * ) democonfigREGISTRATION_ID,
-                                                   sizeof( democonfigREGISTRATION_ID ) - 1,
-                                                   NULL, ucMQTTMessageBuffer, sizeof( ucMQTTMessageBuffer ),
-                                                   ullGetUnixTime,
-                                                   &xTransport );
-        configASSERT( xResult == eAzureIoTSuccess );
-
-        #ifdef democonfigDEVICE_SYMMETRIC_KEY
-            xResult = AzureIoTProvisioningClient_SetSymmetricKey( &xAzureIoTProvisioningClient,
-                                                                  ( const uint8_t * ) democonfigDEVICE_SYMMETRIC_KEY,
-                                                                  sizeof( democonfigDEVICE_SYMMETRIC_KEY ) - 1,
-                                                                  Crypto_HMAC );
-            configASSERT( xResult == eAzureIoTSuccess );
-        #endif /* democonfigDEVICE_SYMMETRIC_KEY */
-
-        xResult = prvCreateProvisioningPayload( ucScratchBuffer,
-                                                sizeof( ucScratchBuffer ),
-                                                &lOutProvisioningPayloadLength );
-        configASSERT( xResult == eAzureIoTSuccess );
-
-        xResult = AzureIoTProvisioningClient_SetRegistrationPayload( &xAzureIoTProvisioningClient,
-                                                                     ( const uint8_t * ) ucScratchBuffer,
-                                                                     ( uint32_t ) lOutProvisioningPayloadLength );
-        configASSERT( xResult == eAzureIoTSuccess );
-
-        do
-        {
-            xResult = AzureIoTProvisioningClient_Register( &xAzureIoTProvisioningClient,
-                                                           sampleazureiotProvisioning_Registration_TIMEOUT_MS );
-        } while( xResult == eAzureIoTErrorPending );
-
-        if( xResult == eAzureIoTSuccess )
-        {
-            LogInfo( ( "Successfully acquired IoT Hub name and Device ID" ) );
-        }
-        else
-        {
-            LogInfo( ( "Error getting IoT Hub name and Device ID: 0x%08x", ( uint16_t ) xResult ) );
-        }
-
-        configASSERT( xResult == eAzureIoTSuccess );
-
-        xResult = AzureIoTProvisioningClient_GetDeviceAndHub( &xAzureIoTProvisioningClient,
-                                                              ucSampleIotHubHostname, &ucSamplepIothubHostnameLength,
-                                                              ucSampleIotHubDeviceId, &ucSamplepIothubDeviceIdLength );
-        configASSERT( xResult == eAzureIoTSuccess );
-
-        AzureIoTProvisioningClient_Deinit( &xAzureIoTProvisioningClient );
-
-        /* Close the network connection.  */
-        TLS_Socket_Disconnect( &xNetworkContext );
-
-        *ppucIothubHostname = ucSampleIotHubHostname;
-        *pulIothubHostnameLength = ucSamplepIothubHostnameLength;
-        *ppucIothubDeviceId = ucSampleIotHubDeviceId;
-        *pulIothubDeviceIdLength = ucSamplepIothubDeviceIdLength;
-
-        return 0;
-    }
-
 #endif /* democonfigENABLE_DPS_SAMPLE */
 /*-----------------------------------------------------------*/
 
-/**
- * @brief Connect to server with backoff retries.
- */
-static uint32_t prvConnectToServerWithBackoffRetries( const char * pcHostName,
-                                                      uint32_t port,
-                                                      NetworkCredentials_t * pxNetworkCredentials,
-                                                      NetworkContext_t * pxNetworkContext )
-{
-    TlsTransportStatus_t xNetworkStatus;
-    BackoffAlgorithmStatus_t xBackoffAlgStatus = BackoffAlgorithmSuccess;
-    BackoffAlgorithmContext_t xReconnectParams;
-    uint16_t usNextRetryBackOff = 0U;
-
-    /* Initialize reconnect attempts and interval. */
-    BackoffAlgorithm_InitializeParams( &xReconnectParams,
-                                       sampleazureiotRETRY_BACKOFF_BASE_MS,
-                                       sampleazureiotRETRY_MAX_BACKOFF_DELAY_MS,
-                                       sampleazureiotRETRY_MAX_ATTEMPTS );
-
-    /* Attempt to connect to IoT Hub. If connection fails, retry after
-     * a timeout. Timeout value will exponentially increase till maximum
-     * attempts are reached.
-     */
-    do
-    {
-        LogInfo( ( "Creating a TLS connection to %s:%u.", pcHostName, ( uint16_t ) port ) );
-        /* Attempt to create a mutually authenticated TLS connection. */
-        xNetworkStatus = TLS_Socket_Connect( pxNetworkContext,
-                                             pcHostName, port,
-                                             pxNetworkCredentials,
-                                             sampleazureiotTRANSPORT_SEND_RECV_TIMEOUT_MS,
-                                             sampleazureiotTRANSPORT_SEND_RECV_TIMEOUT_MS );
-
-        if( xNetworkStatus != eTLSTransportSuccess )
-        {
-            /* Generate a random number and calculate backoff value (in milliseconds) for
-             * the next connection retry.
-             * Note: It is recommended to seed the random number generator with a device-specific
-             * entropy source so that possibility of multiple devices retrying failed network operations
-             * at similar intervals can be avoided. */
-            xBackoffAlgStatus = BackoffAlgorithm_GetNextBackoff( &xReconnectParams, configRAND32(), &usNextRetryBackOff );
-
-            if( xBackoffAlgStatus == BackoffAlgorithmRetriesExhausted )
-            {
-                LogError( ( "Connection to the IoT Hub failed, all attempts exhausted." ) );
-            }
-            else if( xBackoffAlgStatus == BackoffAlgorithmSuccess )
-            {
-                LogWarn( ( "Connection to the IoT Hub failed [%d]. "
-                           "Retrying connection with backoff and jitter [%d]ms.",
-                           xNetworkStatus, usNextRetryBackOff ) );
-                vTaskDelay( pdMS_TO_TICKS( usNextRetryBackOff ) );
-            }
-        }
-    } while( ( xNetworkStatus != eTLSTransportSuccess ) && ( xBackoffAlgStatus == BackoffAlgorithmSuccess ) );
-
-    return xNetworkStatus == eTLSTransportSuccess ? 0 : 1;
-}
-/*-----------------------------------------------------------*/
-
 /*
  * @brief Create the task that demonstrates the AzureIoTHub demo
  */
 void vStartDemoTask( void )
 {
+    SampleTrace_Init();
+
     /* This example uses a single application task, which in turn is used to
      * connect, subscribe, publish, unsubscribe and disconnect from the IoT Hub */
-    xTaskCreate( prvAzureDemoTask,         /* Function that implements the task. */
-                 "AzureDemoTask",          /* Text name for the task - only used for debugging. */
-                 democonfigDEMO_STACKSIZE, /* Size of stack (in words, not bytes) to allocate for the task. */
-                 NULL,                     /* Task parameter - not used in this case. */
-                 tskIDLE_PRIORITY,         /* Task priority, must be between 0 and configMAX_PRIORITIES - 1. */
-                 NULL );                   /* Used to pass out a handle to the created task - not used in this case. */
+    sampletaskCREATE( prvAzureDemoTask,          /* Function that implements the task. */
+                      "AzureDemoTask",           /* Text name for the task - only used for debugging. */
+                      democonfigDEMO_STACKSIZE,  /* Size of stack (in words, not bytes) to allocate for the task. */
+                      NULL,                      /* Task parameter - not used in this case. */
+                      tskIDLE_PRIORITY,          /* Task priority, must be between 0 and configMAX_PRIORITIES - 1. */
+                      NULL,                      /* Used to pass out a handle to the created task - not used in this case. */
+                      democonfigDEMO_TASK_CORE ); /* Core the task is pinned to, if democonfigPIN_TASKS_TO_CORE is defined. */
 }
 /*-----------------------------------------------------------*/
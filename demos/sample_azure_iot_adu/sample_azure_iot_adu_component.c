@@ -0,0 +1,660 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+#include "sample_azure_iot_adu_component.h"
+
+/* Standard includes. */
+#include <string.h>
+
+#include "azure_iot_flash_platform.h"
+
+#include "azure_iot_jws.h"
+#include "sample_azure_iot_adu_jws.h"
+#include "sample_azure_iot_adu_root_keys.h"
+
+#include "mbedtls/md.h"
+
+/* FreeRTOS */
+/* This task provides taskDISABLE_INTERRUPTS, used by configASSERT */
+#include "FreeRTOS.h"
+#include "task.h"
+
+/* The peak clock while the manifest is verified. */
+#include "azure_sample_perf_governor.h"
+
+/* The attribute of the large buffers. */
+#include "azure_sample_placement.h"
+
+/*-----------------------------------------------------------*/
+
+#define sampleazureiotUPDATE_HANDLER    "microsoft/swupdate:1"
+
+#define sampleaduPROPERTY_MIRROR_HOST    "mirrorHost"
+#define sampleaduPROPERTY_SWAP_AT        "swapAt"
+#define sampleaduPROPERTY_RATE_LIMIT     "downloadRateLimit"
+#define sampleaduPROPERTY_WINDOW_START   "downloadWindowStart"
+#define sampleaduPROPERTY_WINDOW_END     "downloadWindowEnd"
+#define sampleaduPROPERTY_STATUS_OK      200
+#define sampleaduPROPERTY_STATUS_BAD     400
+
+/**
+ * @brief Number of verified update manifests remembered, so the service
+ * redelivering one (on every reconnect and property GET) skips the RSA
+ * verification. 0 verifies every delivery.
+ */
+#ifndef sampleaduVERIFIED_MANIFEST_CACHE_SIZE
+    #define sampleaduVERIFIED_MANIFEST_CACHE_SIZE    2
+#endif
+
+#define sampleaduMANIFEST_DIGEST_SIZE    32
+
+/**
+ * @brief Set to 1 to verify update manifests with SampleAduJWS_ManifestAuthenticate(),
+ * which works on the JWS in place instead of decoding it into the
+ * azureiotjwsSCRATCH_BUFFER_SIZE scratch buffer.
+ */
+#ifndef democonfigADU_STREAMING_JWS
+    #define democonfigADU_STREAMING_JWS    0
+#endif
+
+#if ( democonfigADU_STREAMING_JWS == 0 )
+
+/**
+ * @brief Buffer for ADU to copy values into.
+ *
+ */
+    static uint8_t ucADUScratchBuffer[ azureiotjwsSCRATCH_BUFFER_SIZE ] democonfigLARGE_BUFFER_ATTR;
+#endif /* democonfigADU_STREAMING_JWS == 0 */
+
+#if ( sampleaduVERIFIED_MANIFEST_CACHE_SIZE > 0 )
+    /* SHA256 of the manifest and signature of each manifest that passed verification. */
+    static uint8_t ucVerifiedManifestDigests[ sampleaduVERIFIED_MANIFEST_CACHE_SIZE ][ sampleaduMANIFEST_DIGEST_SIZE ];
+    static uint32_t ulVerifiedManifestCount;
+    static uint32_t ulVerifiedManifestNext;
+#endif /* sampleaduVERIFIED_MANIFEST_CACHE_SIZE > 0 */
+
+#if ( democonfigADU_MIRROR == 1 )
+    #ifdef democonfigADU_MIRROR_HOST
+        uint8_t ucAduMirrorHost[ sampleaduMIRROR_HOST_SIZE ] = democonfigADU_MIRROR_HOST;
+        uint32_t ulAduMirrorHostLength = sizeof( democonfigADU_MIRROR_HOST ) - 1;
+    #else
+        uint8_t ucAduMirrorHost[ sampleaduMIRROR_HOST_SIZE ];
+        uint32_t ulAduMirrorHostLength = 0;
+    #endif /* democonfigADU_MIRROR_HOST */
+#endif /* democonfigADU_MIRROR == 1 */
+
+#if ( democonfigADU_SCHEDULED_SWAP == 1 )
+    uint64_t ullAduSwapAt = 0;
+#endif /* democonfigADU_SCHEDULED_SWAP == 1 */
+
+#if ( democonfigADU_DOWNLOAD_SHAPING == 1 )
+    uint32_t ulAduDownloadRateLimit = democonfigADU_DOWNLOAD_RATE_LIMIT;
+    uint32_t ulAduDownloadWindowStart = democonfigADU_DOWNLOAD_WINDOW_START;
+    uint32_t ulAduDownloadWindowEnd = democonfigADU_DOWNLOAD_WINDOW_END;
+#endif /* democonfigADU_DOWNLOAD_SHAPING == 1 */
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Verifies if the current image version matches the "installedCriteria" version in the
+ *        installation step of the ADU Update Manifest.
+ *
+ * @param pxAduUpdateRequest Parsed update request, with the ADU update manifest.
+ * @return true If the current image version matches the installedCriteria.
+ * @return false If the current image version does not match the installedCriteria.
+ */
+static bool prvDoesInstalledCriteriaMatchCurrentVersion( const AzureIoTADUUpdateRequest_t * pxAduUpdateRequest )
+{
+    /*
+     * In a production solution, each step should be validated against the version of
+     * each component the update step applies to (matching through the `handler` name).
+     */
+    if( ( ( sizeof( democonfigADU_UPDATE_VERSION ) - 1 ) ==
+          pxAduUpdateRequest->xUpdateManifest.xInstructions.pxSteps[ 0 ].ulInstalledCriteriaLength ) &&
+        ( strncmp(
+              ( const char * ) democonfigADU_UPDATE_VERSION,
+              ( const char * ) pxAduUpdateRequest->xUpdateManifest.xInstructions.pxSteps[ 0 ].pucInstalledCriteria,
+              ( size_t ) pxAduUpdateRequest->xUpdateManifest.xInstructions.pxSteps[ 0 ].ulInstalledCriteriaLength ) == 0 ) )
+    {
+        return true;
+    }
+    else
+    {
+        return false;
+    }
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Verifies that the handler is supported
+ *
+ * @param pxAduUpdateRequest Parsed update request, with the ADU update manifest.
+ * @return true If the handler for the update step matches the supported handler.
+ * @return false If the handler for the update step does not match the supported handler.
+ */
+static bool prvIsADUHandlerSupported( const AzureIoTADUUpdateRequest_t * pxAduUpdateRequest )
+{
+    if( ( ( sizeof( sampleazureiotUPDATE_HANDLER ) - 1 ) ==
+          pxAduUpdateRequest->xUpdateManifest.xInstructions.pxSteps->ulHandlerLength ) &&
+        ( strncmp(
+              ( const char * ) sampleazureiotUPDATE_HANDLER,
+              ( const char * ) pxAduUpdateRequest->xUpdateManifest.xInstructions.pxSteps->pucHandler,
+              ( size_t ) pxAduUpdateRequest->xUpdateManifest.xInstructions.pxSteps->ulHandlerLength ) == 0 ) )
+    {
+        return true;
+    }
+    else
+    {
+        return false;
+    }
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Check that each file of the update fits in the flash region it is downloaded to.
+ *
+ * @param[in] pxAduUpdateRequest    The parsed update request.
+ */
+static bool prvDoFilesFitInFlash( AzureIoTADUUpdateRequest_t * pxAduUpdateRequest )
+{
+    AzureIoTADUUpdateManifestFile_t * pxFile;
+    int64_t llRegionSize;
+
+    if( ( pxAduUpdateRequest->xUpdateManifest.ulFilesCount == 0 ) ||
+        ( pxAduUpdateRequest->xUpdateManifest.ulFilesCount > democonfigADU_MAX_FILES ) )
+    {
+        LogInfo( ( "[ADU] Update has %u files, %u are supported",
+                   ( unsigned int ) pxAduUpdateRequest->xUpdateManifest.ulFilesCount,
+                   ( unsigned int ) democonfigADU_MAX_FILES ) );
+        return false;
+    }
+
+    for( uint32_t ulFileIndex = 0; ulFileIndex < pxAduUpdateRequest->xUpdateManifest.ulFilesCount; ulFileIndex++ )
+    {
+        pxFile = &pxAduUpdateRequest->xUpdateManifest.pxFiles[ ulFileIndex ];
+
+        #if ( democonfigADU_MAX_FILES > 1 )
+            llRegionSize = AzureIoTPlatform_GetFileRegionSize( ulFileIndex, pxFile->pucFileName, pxFile->ulFileNameLength );
+        #else
+            llRegionSize = AzureIoTPlatform_GetSingleFlashBootBankSize();
+        #endif /* democonfigADU_MAX_FILES > 1 */
+
+        if( ( pxFile->llSizeInBytes < 0 ) || ( llRegionSize < pxFile->llSizeInBytes ) )
+        {
+            LogInfo( ( "[ADU] File %.*s does not fit in its flash region",
+                       ( int16_t ) pxFile->ulFileNameLength, pxFile->pucFileName ) );
+            return false;
+        }
+    }
+
+    return true;
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Sample function to decide if an update request should be accepted or rejected.
+ *
+ * @remark The user application can implement any logic to decide if an update request
+ *         should be accepted or not. Factors would be if the device is currently busy,
+ *         if it is within business hours, or any other factor the user would like to
+ *         take into account. Rejected update requests get redelivered upon reconnection
+ *         with the Azure IoT Hub.
+ *
+ * @param[in] pxAduUpdateRequest    The parsed update request.
+ * @return An #AzureIoTADURequestDecision_t with the decision to accept or reject the update.
+ */
+static AzureIoTADURequestDecision_t prvUserDecideShouldStartUpdate( AzureIoTADUUpdateRequest_t * pxAduUpdateRequest )
+{
+    if( !prvIsADUHandlerSupported( pxAduUpdateRequest ) )
+    {
+        LogInfo( ( "[ADU] Rejecting update request (update handler not supported)" ) );
+        return eAzureIoTADURequestDecisionReject;
+    }
+
+    if( prvDoesInstalledCriteriaMatchCurrentVersion( pxAduUpdateRequest ) )
+    {
+        LogInfo( ( "[ADU] Rejecting update request (installed criteria matches current version)" ) );
+        return eAzureIoTADURequestDecisionReject;
+    }
+    else if( !prvDoFilesFitInFlash( pxAduUpdateRequest ) )
+    {
+        LogInfo( ( "[ADU] Rejecting update request (file size larger than its flash region)" ) );
+        return eAzureIoTADURequestDecisionReject;
+    }
+    else
+    {
+        LogInfo( ( "[ADU] Accepting update request" ) );
+        return eAzureIoTADURequestDecisionAccept;
+    }
+}
+/*-----------------------------------------------------------*/
+
+#if ( sampleaduVERIFIED_MANIFEST_CACHE_SIZE > 0 )
+
+/**
+ * @brief Digest identifying a manifest together with its signature.
+ */
+    static void prvManifestDigest( AzureIoTADUUpdateRequest_t * pxAduUpdateRequest,
+                                   uint8_t pucDigest[ sampleaduMANIFEST_DIGEST_SIZE ] )
+    {
+        mbedtls_md_context_t xContext;
+        uint8_t ucLength[ 4 ];
+
+        /* The manifest length keeps the boundary between the two parts unambiguous. */
+        ucLength[ 0 ] = ( uint8_t ) ( pxAduUpdateRequest->ulUpdateManifestLength >> 24 );
+        ucLength[ 1 ] = ( uint8_t ) ( pxAduUpdateRequest->ulUpdateManifestLength >> 16 );
+        ucLength[ 2 ] = ( uint8_t ) ( pxAduUpdateRequest->ulUpdateManifestLength >> 8 );
+        ucLength[ 3 ] = ( uint8_t ) ( pxAduUpdateRequest->ulUpdateManifestLength );
+
+        mbedtls_md_init( &xContext );
+        mbedtls_md_setup( &xContext, mbedtls_md_info_from_type( MBEDTLS_MD_SHA256 ), 0 );
+        mbedtls_md_starts( &xContext );
+        mbedtls_md_update( &xContext, ucLength, sizeof( ucLength ) );
+        mbedtls_md_update( &xContext, pxAduUpdateRequest->pucUpdateManifest, pxAduUpdateRequest->ulUpdateManifestLength );
+        mbedtls_md_update( &xContext, pxAduUpdateRequest->pucUpdateManifestSignature, pxAduUpdateRequest->ulUpdateManifestSignatureLength );
+        mbedtls_md_finish( &xContext, pucDigest );
+        mbedtls_md_free( &xContext );
+    }
+
+/**
+ * @brief Check whether a manifest with this digest was verified before.
+ */
+    static bool prvIsManifestVerified( const uint8_t pucDigest[ sampleaduMANIFEST_DIGEST_SIZE ] )
+    {
+        for( uint32_t ulIndex = 0; ulIndex < ulVerifiedManifestCount; ulIndex++ )
+        {
+            if( memcmp( ucVerifiedManifestDigests[ ulIndex ], pucDigest, sampleaduMANIFEST_DIGEST_SIZE ) == 0 )
+            {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+/**
+ * @brief Remember a verified manifest, replacing the oldest once the cache is full.
+ */
+    static void prvAddVerifiedManifest( const uint8_t pucDigest[ sampleaduMANIFEST_DIGEST_SIZE ] )
+    {
+        ( void ) memcpy( ucVerifiedManifestDigests[ ulVerifiedManifestNext ], pucDigest, sampleaduMANIFEST_DIGEST_SIZE );
+        ulVerifiedManifestNext = ( ulVerifiedManifestNext + 1 ) % sampleaduVERIFIED_MANIFEST_CACHE_SIZE;
+
+        if( ulVerifiedManifestCount < sampleaduVERIFIED_MANIFEST_CACHE_SIZE )
+        {
+            ulVerifiedManifestCount++;
+        }
+    }
+
+#endif /* sampleaduVERIFIED_MANIFEST_CACHE_SIZE > 0 */
+
+/**
+ * @brief Verify the JWS signature of an update manifest, unless the same one was verified before.
+ */
+static AzureIoTResult_t prvAuthenticateManifest( AzureIoTADUUpdateRequest_t * pxAduUpdateRequest )
+{
+    AzureIoTResult_t xAzIoTResult;
+
+    #if ( sampleaduVERIFIED_MANIFEST_CACHE_SIZE > 0 )
+        uint8_t ucDigest[ sampleaduMANIFEST_DIGEST_SIZE ];
+
+        prvManifestDigest( pxAduUpdateRequest, ucDigest );
+
+        if( prvIsManifestVerified( ucDigest ) )
+        {
+            LogInfo( ( "JWS Manifest already verified" ) );
+            return eAzureIoTSuccess;
+        }
+    #endif /* sampleaduVERIFIED_MANIFEST_CACHE_SIZE > 0 */
+
+    LogInfo( ( "Verifying JWS Manifest" ) );
+    perfgovernorBOOST();
+    #if ( democonfigADU_STREAMING_JWS == 1 )
+        xAzIoTResult = SampleAduJWS_ManifestAuthenticate( pxAduUpdateRequest->pucUpdateManifest,
+                                                          pxAduUpdateRequest->ulUpdateManifestLength,
+                                                          pxAduUpdateRequest->pucUpdateManifestSignature,
+                                                          pxAduUpdateRequest->ulUpdateManifestSignatureLength,
+                                                          &xADURootKeys[ 0 ],
+                                                          ulADURootKeysLength );
+    #else
+        xAzIoTResult = AzureIoTJWS_ManifestAuthenticate( pxAduUpdateRequest->pucUpdateManifest,
+                                                         pxAduUpdateRequest->ulUpdateManifestLength,
+                                                         pxAduUpdateRequest->pucUpdateManifestSignature,
+                                                         pxAduUpdateRequest->ulUpdateManifestSignatureLength,
+                                                         &xADURootKeys[ 0 ],
+                                                         ulADURootKeysLength,
+                                                         ucADUScratchBuffer,
+                                                         sizeof( ucADUScratchBuffer ) );
+    #endif /* democonfigADU_STREAMING_JWS == 1 */
+    perfgovernorRELEASE();
+
+    #if ( sampleaduVERIFIED_MANIFEST_CACHE_SIZE > 0 )
+        if( xAzIoTResult == eAzureIoTSuccess )
+        {
+            prvAddVerifiedManifest( ucDigest );
+        }
+    #endif /* sampleaduVERIFIED_MANIFEST_CACHE_SIZE > 0 */
+
+    return xAzIoTResult;
+}
+/*-----------------------------------------------------------*/
+
+#if ( democonfigADU_MIRROR == 1 )
+
+/**
+ * @brief Take the host of the cache from the mirrorHost property, and acknowledge it
+ * in the response of the whole message.
+ *
+ * @param pxReader Reader on the name of the property, left on the token after the value.
+ */
+    static AzureIoTResult_t prvHandleMirrorHost( AzureIoTJSONReader_t * pxReader,
+                                                 uint32_t ulVersion,
+                                                 uint8_t * pucResponseBuffer,
+                                                 uint32_t ulResponseBufferSize )
+    {
+        AzureIoTResult_t xResult;
+        ReportedProperty_t xAck =
+        {
+            {
+                ( const uint8_t * ) AZ_IOT_ADU_CLIENT_PROPERTIES_COMPONENT_NAME,
+                sizeof( AZ_IOT_ADU_CLIENT_PROPERTIES_COMPONENT_NAME ) - 1,
+                ( const uint8_t * ) sampleaduPROPERTY_MIRROR_HOST,
+                sizeof( sampleaduPROPERTY_MIRROR_HOST ) - 1
+            },
+            eReportedPropertyString
+        };
+        uint8_t ucHost[ sampleaduMIRROR_HOST_SIZE ];
+        uint32_t ulHostLength = 0;
+        int32_t lStatus = sampleaduPROPERTY_STATUS_OK;
+
+        /* The version goes in with the response of the whole message. */
+        ( void ) ulVersion;
+        ( void ) pucResponseBuffer;
+        ( void ) ulResponseBufferSize;
+
+        if( ( xResult = AzureIoTJSONReader_NextToken( pxReader ) ) != eAzureIoTSuccess )
+        {
+            return xResult;
+        }
+
+        /* The terminator needs the last byte. */
+        if( AzureIoTJSONReader_GetTokenString( pxReader, ucHost, sizeof( ucHost ) - 1, &ulHostLength ) == eAzureIoTSuccess )
+        {
+            ( void ) memcpy( ucAduMirrorHost, ucHost, ulHostLength );
+            ucAduMirrorHost[ ulHostLength ] = '\0';
+            ulAduMirrorHostLength = ulHostLength;
+            LogInfo( ( "[ADU] Mirror host: %.*s", ( int16_t ) ulHostLength, ucHost ) );
+        }
+        else
+        {
+            LogError( ( "[ADU] Mirror host is not a string of less than %u characters", ( unsigned int ) sizeof( ucHost ) ) );
+            lStatus = sampleaduPROPERTY_STATUS_BAD;
+        }
+
+        if( ( xResult = AzureIoTJSONReader_NextToken( pxReader ) ) != eAzureIoTSuccess )
+        {
+            return xResult;
+        }
+
+        xAck.xValue.xString.pucValue = ucAduMirrorHost;
+        xAck.xValue.xString.ulLength = ulAduMirrorHostLength;
+
+        return xAckWritableProperty( &xAck, lStatus, NULL, 0 );
+    }
+
+#endif /* democonfigADU_MIRROR == 1 */
+
+#if ( democonfigADU_SCHEDULED_SWAP == 1 )
+
+/**
+ * @brief Take the time to swap a staged image at from the swapAt property, and
+ * acknowledge it in the response of the whole message.
+ *
+ * @param pxReader Reader on the name of the property, left on the token after the value.
+ */
+    static AzureIoTResult_t prvHandleSwapAt( AzureIoTJSONReader_t * pxReader )
+    {
+        AzureIoTResult_t xResult;
+        ReportedProperty_t xAck =
+        {
+            {
+                ( const uint8_t * ) AZ_IOT_ADU_CLIENT_PROPERTIES_COMPONENT_NAME,
+                sizeof( AZ_IOT_ADU_CLIENT_PROPERTIES_COMPONENT_NAME ) - 1,
+                ( const uint8_t * ) sampleaduPROPERTY_SWAP_AT,
+                sizeof( sampleaduPROPERTY_SWAP_AT ) - 1
+            },
+            eReportedPropertyInt32
+        };
+        int32_t lSwapAt;
+        int32_t lStatus = sampleaduPROPERTY_STATUS_OK;
+
+        if( ( xResult = AzureIoTJSONReader_NextToken( pxReader ) ) != eAzureIoTSuccess )
+        {
+            return xResult;
+        }
+
+        if( ( AzureIoTJSONReader_GetTokenInt32( pxReader, &lSwapAt ) == eAzureIoTSuccess ) && ( lSwapAt >= 0 ) )
+        {
+            ullAduSwapAt = ( uint64_t ) lSwapAt;
+            LogInfo( ( "[ADU] Swap at: %d", ( int ) lSwapAt ) );
+        }
+        else
+        {
+            LogError( ( "[ADU] Swap at is not a Unix time in seconds" ) );
+            lStatus = sampleaduPROPERTY_STATUS_BAD;
+        }
+
+        if( ( xResult = AzureIoTJSONReader_NextToken( pxReader ) ) != eAzureIoTSuccess )
+        {
+            return xResult;
+        }
+
+        xAck.xValue.lInt32 = ( int32_t ) ullAduSwapAt;
+
+        return xAckWritableProperty( &xAck, lStatus, NULL, 0 );
+    }
+
+#endif /* democonfigADU_SCHEDULED_SWAP == 1 */
+
+#if ( democonfigADU_DOWNLOAD_SHAPING == 1 )
+
+/**
+ * @brief Take a setting of the download shaping from its property, and
+ * acknowledge it in the response of the whole message.
+ *
+ * @param pxReader Reader on the name of the property, left on the token after the value.
+ * @param pcName Name of the property.
+ * @param ulNameLength Length of \p pcName.
+ * @param pulSetting The setting.
+ * @param ulMaximum Largest value accepted.
+ */
+    static AzureIoTResult_t prvHandleDownloadShaping( AzureIoTJSONReader_t * pxReader,
+                                                      const char * pcName,
+                                                      uint32_t ulNameLength,
+                                                      uint32_t * pulSetting,
+                                                      uint32_t ulMaximum )
+    {
+        AzureIoTResult_t xResult;
+        ReportedProperty_t xAck =
+        {
+            {
+                ( const uint8_t * ) AZ_IOT_ADU_CLIENT_PROPERTIES_COMPONENT_NAME,
+                sizeof( AZ_IOT_ADU_CLIENT_PROPERTIES_COMPONENT_NAME ) - 1,
+                ( const uint8_t * ) pcName,
+                ulNameLength
+            },
+            eReportedPropertyInt32
+        };
+        int32_t lValue;
+        int32_t lStatus = sampleaduPROPERTY_STATUS_OK;
+
+        if( ( xResult = AzureIoTJSONReader_NextToken( pxReader ) ) != eAzureIoTSuccess )
+        {
+            return xResult;
+        }
+
+        if( ( AzureIoTJSONReader_GetTokenInt32( pxReader, &lValue ) == eAzureIoTSuccess ) &&
+            ( lValue >= 0 ) && ( ( uint32_t ) lValue <= ulMaximum ) )
+        {
+            /* Read by the download between its requests. */
+            *pulSetting = ( uint32_t ) lValue;
+            LogInfo( ( "[ADU] %.*s: %d", ( int16_t ) ulNameLength, pcName, ( int ) lValue ) );
+        }
+        else
+        {
+            LogError( ( "[ADU] %.*s is not a number from 0 to %u", ( int16_t ) ulNameLength, pcName,
+                        ( unsigned int ) ulMaximum ) );
+            lStatus = sampleaduPROPERTY_STATUS_BAD;
+        }
+
+        if( ( xResult = AzureIoTJSONReader_NextToken( pxReader ) ) != eAzureIoTSuccess )
+        {
+            return xResult;
+        }
+
+        xAck.xValue.lInt32 = ( int32_t ) *pulSetting;
+
+        return xAckWritableProperty( &xAck, lStatus, NULL, 0 );
+    }
+
+#endif /* democonfigADU_DOWNLOAD_SHAPING == 1 */
+
+/**
+ * @brief Handles the writable properties of the Device Update component.
+ *
+ * @remark AzureIoTADUClient_SendResponse() publishes the response to the
+ *         update request itself, from the response buffer.
+ */
+static AzureIoTResult_t prvHandleADUProperty( AzureIoTJSONReader_t * pxReader,
+                                              uint32_t ulVersion,
+                                              uint8_t * pucResponseBuffer,
+                                              uint32_t ulResponseBufferSize )
+{
+    AzureIoTResult_t xAzIoTResult;
+    AzureIoTADURequestDecision_t xRequestDecision;
+
+    #if ( democonfigADU_MIRROR == 1 )
+        if( AzureIoTJSONReader_TokenIsTextEqual( pxReader, ( const uint8_t * ) sampleaduPROPERTY_MIRROR_HOST,
+                                                 sizeof( sampleaduPROPERTY_MIRROR_HOST ) - 1 ) )
+        {
+            return prvHandleMirrorHost( pxReader, ulVersion, pucResponseBuffer, ulResponseBufferSize );
+        }
+    #endif /* democonfigADU_MIRROR == 1 */
+
+    #if ( democonfigADU_SCHEDULED_SWAP == 1 )
+        if( AzureIoTJSONReader_TokenIsTextEqual( pxReader, ( const uint8_t * ) sampleaduPROPERTY_SWAP_AT,
+                                                 sizeof( sampleaduPROPERTY_SWAP_AT ) - 1 ) )
+        {
+            return prvHandleSwapAt( pxReader );
+        }
+    #endif /* democonfigADU_SCHEDULED_SWAP == 1 */
+
+    #if ( democonfigADU_DOWNLOAD_SHAPING == 1 )
+        if( AzureIoTJSONReader_TokenIsTextEqual( pxReader, ( const uint8_t * ) sampleaduPROPERTY_RATE_LIMIT,
+                                                 sizeof( sampleaduPROPERTY_RATE_LIMIT ) - 1 ) )
+        {
+            return prvHandleDownloadShaping( pxReader, sampleaduPROPERTY_RATE_LIMIT,
+                                             sizeof( sampleaduPROPERTY_RATE_LIMIT ) - 1,
+                                             &ulAduDownloadRateLimit, INT32_MAX );
+        }
+
+        if( AzureIoTJSONReader_TokenIsTextEqual( pxReader, ( const uint8_t * ) sampleaduPROPERTY_WINDOW_START,
+                                                 sizeof( sampleaduPROPERTY_WINDOW_START ) - 1 ) )
+        {
+            return prvHandleDownloadShaping( pxReader, sampleaduPROPERTY_WINDOW_START,
+                                             sizeof( sampleaduPROPERTY_WINDOW_START ) - 1,
+                                             &ulAduDownloadWindowStart, sampleaduSECONDS_PER_DAY - 1 );
+        }
+
+        if( AzureIoTJSONReader_TokenIsTextEqual( pxReader, ( const uint8_t * ) sampleaduPROPERTY_WINDOW_END,
+                                                 sizeof( sampleaduPROPERTY_WINDOW_END ) - 1 ) )
+        {
+            return prvHandleDownloadShaping( pxReader, sampleaduPROPERTY_WINDOW_END,
+                                             sizeof( sampleaduPROPERTY_WINDOW_END ) - 1,
+                                             &ulAduDownloadWindowEnd, sampleaduSECONDS_PER_DAY - 1 );
+        }
+    #endif /* democonfigADU_DOWNLOAD_SHAPING == 1 */
+
+    xAzIoTResult = AzureIoTADUClient_ParseRequest(
+        &xAzureIoTADUClient,
+        pxReader,
+        &xAzureIoTAduUpdateRequest );
+
+    if( xAzIoTResult != eAzureIoTSuccess )
+    {
+        LogError( ( "AzureIoTADUClient_ParseRequest failed: result 0x%08x", ( uint16_t ) xAzIoTResult ) );
+        return xAzIoTResult;
+    }
+
+    if( xAzureIoTAduUpdateRequest.xWorkflow.xAction == eAzureIoTADUActionApplyDownload )
+    {
+        #if ( democonfigADU_PREWARM_CONNECTION == 1 )
+            /* The DNS lookup and connect overlap the signature check. */
+            vAduPrewarmDownload();
+        #endif /* democonfigADU_PREWARM_CONNECTION == 1 */
+
+        xAzIoTResult = prvAuthenticateManifest( &xAzureIoTAduUpdateRequest );
+
+        if( xAzIoTResult != eAzureIoTSuccess )
+        {
+            LogError( ( "AzureIoTJWS_ManifestAuthenticate failed: JWS was not validated successfully: result 0x%08x", ( uint16_t ) xAzIoTResult ) );
+
+            #if ( democonfigADU_PREWARM_CONNECTION == 1 )
+                vAduCancelPrewarm();
+            #endif /* democonfigADU_PREWARM_CONNECTION == 1 */
+            return xAzIoTResult;
+        }
+
+        xRequestDecision = prvUserDecideShouldStartUpdate( &xAzureIoTAduUpdateRequest );
+
+        #if ( democonfigADU_PREWARM_CONNECTION == 1 )
+            if( xRequestDecision != eAzureIoTADURequestDecisionAccept )
+            {
+                vAduCancelPrewarm();
+            }
+        #endif /* democonfigADU_PREWARM_CONNECTION == 1 */
+
+        xAzIoTResult = AzureIoTADUClient_SendResponse(
+            &xAzureIoTADUClient,
+            &xAzureIoTHubClient,
+            xRequestDecision,
+            ulVersion,
+            pucResponseBuffer,
+            ulResponseBufferSize,
+            NULL );
+
+        if( xAzIoTResult != eAzureIoTSuccess )
+        {
+            LogError( ( "AzureIoTADUClient_GetResponse failed: result 0x%08x", ( uint16_t ) xAzIoTResult ) );
+            return xAzIoTResult;
+        }
+
+        if( xRequestDecision == eAzureIoTADURequestDecisionAccept )
+        {
+            xProcessUpdateRequest = true;
+        }
+    }
+    else if( xAzureIoTAduUpdateRequest.xWorkflow.xAction == eAzureIoTADUActionCancel )
+    {
+        /*Nothing to do here but set process to "true", where we will then send state as "Idle" */
+        xProcessUpdateRequest = true;
+
+        LogInfo( ( "ADU manifest received: action cancelled" ) );
+    }
+    else
+    {
+        xProcessUpdateRequest = false;
+
+        LogInfo( ( "ADU manifest received: action unknown" ) );
+    }
+
+    return eAzureIoTSuccess;
+}
+/*-----------------------------------------------------------*/
+
+const PnPComponent_t xADUPnPComponent =
+{
+    ( const uint8_t * ) AZ_IOT_ADU_CLIENT_PROPERTIES_COMPONENT_NAME,
+    sizeof( AZ_IOT_ADU_CLIENT_PROPERTIES_COMPONENT_NAME ) - 1,
+    prvHandleADUProperty
+};
+/*-----------------------------------------------------------*/
@@ -0,0 +1,209 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @file sample_azure_iot_adu_component.h
+ *
+ * @brief The Device Update component of the ADU sample, handled next to the
+ * thermostat of sample_azure_iot_pnp_simulated_data.c.
+ *
+ * Its handler verifies the update manifests, decides whether to start the
+ * update and sends the response to the request. The update itself is then
+ * run by the sample, once xProcessUpdateRequest is set.
+ */
+
+#ifndef SAMPLE_AZURE_IOT_ADU_COMPONENT_H
+#define SAMPLE_AZURE_IOT_ADU_COMPONENT_H
+
+#include <stdbool.h>
+
+#include "azure_iot_adu_client.h"
+
+#include "sample_azure_iot_pnp_data_if.h"
+
+/**
+ * @brief Most files of an update manifest that are downloaded.
+ *
+ * 1, the default, downloads pxFiles[ 0 ] into the update bank. Above 1, every
+ * file of the manifest is downloaded, each into the flash region the port
+ * picks for it with AzureIoTPlatform_InitFileRegion(), and checked against its
+ * own hash. pxFiles[ 0 ] is still the image that is enabled. The port must
+ * provide AzureIoTPlatform_GetFileRegionSize() and
+ * AzureIoTPlatform_InitFileRegion().
+ */
+#ifndef democonfigADU_MAX_FILES
+    #define democonfigADU_MAX_FILES    1
+#endif
+
+/**
+ * @brief Set to 1 to download update files from a cache on the local network
+ * first, such as one serving the files of the updates to all the devices of
+ * a site, and from the URL of the update only when the cache does not have
+ * them or does not answer.
+ *
+ * The host of the cache is democonfigADU_MIRROR_HOST, if defined, and is then
+ * set by the mirrorHost writable property of the Device Update component. An
+ * empty host stops using the cache. The cache is reached on the port, and
+ * with the TLS settings, of the update URLs. The files keep their path, and are
+ * checked against the hashes of the signed manifest whatever host served
+ * them.
+ */
+#ifndef democonfigADU_MIRROR
+    #define democonfigADU_MIRROR    0
+#endif
+
+/**
+ * @brief Size of the host of the cache, with its null terminator.
+ */
+#define sampleaduMIRROR_HOST_SIZE    ( 64U )
+
+/**
+ * @brief Set to 1 to stage a verified image and keep running, instead of
+ * enabling it and resetting the device as soon as it is verified.
+ *
+ * The swapAt writable property of the Device Update component gives the Unix
+ * time, in seconds, to swap at, each device adding a random part of
+ * democonfigADU_SWAP_SPREAD_SEC so that a fleet does not go offline at the
+ * same moment. With swapAt at 0, the default, the swap is at the first moment
+ * the device got no command or writable property for democonfigADU_SWAP_IDLE_SEC.
+ * The new image is on trial until it connected to IoT Hub, and rolls back to
+ * the previous one, still in the other bank, if it restarts before then. The
+ * port must provide AzureIoTPlatform_StageImage(), AzureIoTPlatform_GetStagedImage(),
+ * AzureIoTPlatform_SwapImage(), AzureIoTPlatform_BootCheck() and
+ * AzureIoTPlatform_ConfirmImage(), as the B-L475E-IOT01A port does.
+ */
+#ifndef democonfigADU_SCHEDULED_SWAP
+    #define democonfigADU_SCHEDULED_SWAP    0
+#endif
+
+/**
+ * @brief Seconds without a command or writable property before a staged image
+ * is swapped in, when swapAt is 0.
+ */
+#ifndef democonfigADU_SWAP_IDLE_SEC
+    #define democonfigADU_SWAP_IDLE_SEC    ( 60U )
+#endif
+
+/**
+ * @brief Longest random delay added to swapAt, in seconds.
+ */
+#ifndef democonfigADU_SWAP_SPREAD_SEC
+    #define democonfigADU_SWAP_SPREAD_SEC    ( 600U )
+#endif
+
+/**
+ * @brief Set to 1 to shape the image download, so that it leaves room on a
+ * slow shared link for telemetry and commands.
+ *
+ * The range requests are paced by a token bucket at the downloadRateLimit
+ * writable property of the Device Update component, in bytes per second, with
+ * bursts up to democonfigADU_DOWNLOAD_BURST. They only go out between the
+ * downloadWindowStart and downloadWindowEnd properties, in seconds past
+ * midnight UTC, the window running over midnight when the start is the later;
+ * the download pauses outside it and goes on when it opens again. With
+ * democonfigADU_DOWNLOAD_TASK, the next request also waits while the demo task
+ * is publishing, and for the PUBACK of its telemetry, up to
+ * democonfigADU_DOWNLOAD_PUBLISH_WAIT_MS. Without the download task the
+ * publishes already happen between requests.
+ */
+#ifndef democonfigADU_DOWNLOAD_SHAPING
+    #define democonfigADU_DOWNLOAD_SHAPING    0
+#endif
+
+/**
+ * @brief Download rate until downloadRateLimit is set, in bytes per second. 0
+ * does not limit the rate.
+ */
+#ifndef democonfigADU_DOWNLOAD_RATE_LIMIT
+    #define democonfigADU_DOWNLOAD_RATE_LIMIT    ( 0U )
+#endif
+
+/**
+ * @brief Bytes the download may take in one go after it was idle, the size of
+ * the token bucket. At least a chunk, or every request waits.
+ */
+#ifndef democonfigADU_DOWNLOAD_BURST
+    #define democonfigADU_DOWNLOAD_BURST    ( democonfigCHUNK_DOWNLOAD_SIZE )
+#endif
+
+/**
+ * @brief Download window until downloadWindowStart and downloadWindowEnd are
+ * set, in seconds past midnight UTC. The same start and end, the default, is
+ * no window.
+ */
+#ifndef democonfigADU_DOWNLOAD_WINDOW_START
+    #define democonfigADU_DOWNLOAD_WINDOW_START    ( 0U )
+#endif
+
+#ifndef democonfigADU_DOWNLOAD_WINDOW_END
+    #define democonfigADU_DOWNLOAD_WINDOW_END    ( 0U )
+#endif
+
+/**
+ * @brief Longest a range request waits on the publishes of the demo task, in
+ * milliseconds, so that a lost PUBACK does not stall the download.
+ */
+#ifndef democonfigADU_DOWNLOAD_PUBLISH_WAIT_MS
+    #define democonfigADU_DOWNLOAD_PUBLISH_WAIT_MS    ( 2000U )
+#endif
+
+/**
+ * @brief Set to 1 to resolve and connect to the host of the update files from
+ * a task of its own as soon as an update request is parsed, while the
+ * manifest is verified, so that the download starts on an open connection
+ * once the manifest is accepted. The connection is closed if the manifest is
+ * rejected. Costs a task of democonfigDEMO_STACKSIZE.
+ */
+#ifndef democonfigADU_PREWARM_CONNECTION
+    #define democonfigADU_PREWARM_CONNECTION    0
+#endif
+
+/**
+ * @brief Seconds in a day, the end of the download window.
+ */
+#define sampleaduSECONDS_PER_DAY    ( 24U * 60U * 60U )
+
+extern AzureIoTADUClient_t xAzureIoTADUClient;
+extern AzureIoTADUUpdateRequest_t xAzureIoTAduUpdateRequest;
+extern bool xProcessUpdateRequest;
+
+#if ( democonfigADU_MIRROR == 1 )
+    /* The host of the cache, null terminated, and its length without the terminator. 0 when none is set. */
+    extern uint8_t ucAduMirrorHost[ sampleaduMIRROR_HOST_SIZE ];
+    extern uint32_t ulAduMirrorHostLength;
+#endif /* democonfigADU_MIRROR == 1 */
+
+#if ( democonfigADU_SCHEDULED_SWAP == 1 )
+    /* Unix time in seconds to swap a staged image at, or 0 for the first idle moment. */
+    extern uint64_t ullAduSwapAt;
+#endif /* democonfigADU_SCHEDULED_SWAP == 1 */
+
+#if ( democonfigADU_DOWNLOAD_SHAPING == 1 )
+    /* Download rate in bytes per second, 0 for none, and window in seconds past midnight UTC. */
+    extern uint32_t ulAduDownloadRateLimit;
+    extern uint32_t ulAduDownloadWindowStart;
+    extern uint32_t ulAduDownloadWindowEnd;
+#endif /* democonfigADU_DOWNLOAD_SHAPING == 1 */
+
+#if ( democonfigADU_PREWARM_CONNECTION == 1 )
+
+/**
+ * @brief Start connecting to the host of the update request just parsed, in
+ * the background, when no update is being processed.
+ */
+    void vAduPrewarmDownload( void );
+
+/**
+ * @brief Close the connection vAduPrewarmDownload() opened, or is opening,
+ * as the update request was not accepted.
+ */
+    void vAduCancelPrewarm( void );
+
+#endif /* democonfigADU_PREWARM_CONNECTION == 1 */
+
+/**
+ * @brief The Device Update component, given to vSetPnPComponents().
+ */
+extern const PnPComponent_t xADUPnPComponent;
+
+#endif /* SAMPLE_AZURE_IOT_ADU_COMPONENT_H */
@@ -0,0 +1,484 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+#include "sample_azure_iot_adu_decoder.h"
+
+#include <string.h>
+
+#include "azure/core/az_base64.h"
+
+#include "mbedtls/md.h"
+
+/* Demo Specific configs. */
+#include "demo_config.h"
+#include "azure_sample_placement.h"
+
+#define sampleaduDECODER_HEADER_SIZE     80
+#define sampleaduDECODER_COMMAND_SIZE    9
+#define sampleaduDECODER_OP_COPY         0x00
+#define sampleaduDECODER_OP_INSERT       0x01
+#define sampleaduDECODER_MIN_BITS        4
+
+typedef enum SampleAduInflateState
+{
+    eSampleAduInflateTag = 0, /* The next bit says literal (1) or back reference (0). */
+    eSampleAduInflateLiteral, /* 8 bits of literal. */
+    eSampleAduInflateIndex,   /* Window bits of back reference offset - 1. */
+    eSampleAduInflateCount    /* Lookahead bits of back reference length - 1. */
+} SampleAduInflateState_t;
+/*-----------------------------------------------------------*/
+
+static SampleAduDecoderWrite_t xDecoderWrite;
+static const uint8_t * pucDecoderSourceImage;
+static uint32_t ulDecoderMaxImageSize;
+
+/* Hash of the file as downloaded, which is what the manifest describes. */
+static mbedtls_md_context_t xDecoderFileHash;
+
+static uint8_t ucDecoderHeader[ sampleaduDECODER_HEADER_SIZE ];
+static uint32_t ulDecoderHeaderLength;
+static SampleAduImageHeader_t xDecoderHeader;
+static uint8_t ucDecoderFlags;
+
+static SampleAduInflateState_t xInflateState;
+static uint32_t ulInflateBits;
+static uint32_t ulInflateBitCount;
+static uint32_t ulInflateIndex;
+static uint8_t ucInflateWindow[ 1 << sampleaduDECODER_MAX_WINDOW_BITS ] democonfigLARGE_BUFFER_ATTR;
+static uint32_t ulInflateWindowHead;
+
+static uint8_t ucDeltaCommand[ sampleaduDECODER_COMMAND_SIZE ];
+static uint32_t ulDeltaCommandLength;
+static uint32_t ulDeltaInsertRemaining;
+
+static uint8_t ucDecoderOutput[ sampleaduDECODER_OUTPUT_BUFFER_SIZE ] democonfigLARGE_BUFFER_ATTR;
+static uint32_t ulDecoderOutputLength;
+static uint32_t ulDecoderImageLength;
+/*-----------------------------------------------------------*/
+
+static uint32_t prvReadLE32( const uint8_t * pucData )
+{
+    return ( uint32_t ) pucData[ 0 ] |
+           ( ( uint32_t ) pucData[ 1 ] << 8 ) |
+           ( ( uint32_t ) pucData[ 2 ] << 16 ) |
+           ( ( uint32_t ) pucData[ 3 ] << 24 );
+}
+/*-----------------------------------------------------------*/
+
+static AzureIoTResult_t prvFlushOutput( void )
+{
+    AzureIoTResult_t xResult = eAzureIoTSuccess;
+
+    if( ulDecoderOutputLength > 0 )
+    {
+        xResult = xDecoderWrite( ucDecoderOutput, ulDecoderOutputLength );
+        ulDecoderOutputLength = 0;
+    }
+
+    return xResult;
+}
+/*-----------------------------------------------------------*/
+
+static AzureIoTResult_t prvOutput( const uint8_t * pucData,
+                                   uint32_t ulLength )
+{
+    uint32_t ulCopySize;
+    uint32_t ulLimit = ( ucDecoderFlags != 0 ) ? xDecoderHeader.ulImageSize : ulDecoderMaxImageSize;
+
+    if( ulLength > ulLimit - ulDecoderImageLength )
+    {
+        LogError( ( "[ADU] Decoded image is larger than %u bytes.", ulLimit ) );
+        return eAzureIoTErrorFailed;
+    }
+
+    ulDecoderImageLength += ulLength;
+
+    while( ulLength > 0 )
+    {
+        ulCopySize = sizeof( ucDecoderOutput ) - ulDecoderOutputLength;
+        ulCopySize = ulLength < ulCopySize ? ulLength : ulCopySize;
+
+        memcpy( ucDecoderOutput + ulDecoderOutputLength, pucData, ulCopySize );
+        ulDecoderOutputLength += ulCopySize;
+        pucData += ulCopySize;
+        ulLength -= ulCopySize;
+
+        if( ( ulDecoderOutputLength == sizeof( ucDecoderOutput ) ) &&
+            ( prvFlushOutput() != eAzureIoTSuccess ) )
+        {
+            return eAzureIoTErrorFailed;
+        }
+    }
+
+    return eAzureIoTSuccess;
+}
+/*-----------------------------------------------------------*/
+
+static AzureIoTResult_t prvDeltaByte( uint8_t ucByte )
+{
+    uint32_t ulFirst;
+    uint32_t ulSecond;
+
+    if( ulDeltaInsertRemaining > 0 )
+    {
+        ulDeltaInsertRemaining--;
+        return prvOutput( &ucByte, 1 );
+    }
+
+    ucDeltaCommand[ ulDeltaCommandLength++ ] = ucByte;
+
+    if( ulDeltaCommandLength < sampleaduDECODER_COMMAND_SIZE )
+    {
+        return eAzureIoTSuccess;
+    }
+
+    ulDeltaCommandLength = 0;
+    ulFirst = prvReadLE32( &ucDeltaCommand[ 1 ] );
+    ulSecond = prvReadLE32( &ucDeltaCommand[ 5 ] );
+
+    switch( ucDeltaCommand[ 0 ] )
+    {
+        case sampleaduDECODER_OP_COPY:
+
+            if( ( ulFirst > xDecoderHeader.ulSourceSize ) ||
+                ( ulSecond > xDecoderHeader.ulSourceSize - ulFirst ) )
+            {
+                LogError( ( "[ADU] Delta copy is outside the running image." ) );
+                return eAzureIoTErrorFailed;
+            }
+
+            return prvOutput( pucDecoderSourceImage + ulFirst, ulSecond );
+
+        case sampleaduDECODER_OP_INSERT:
+            ulDeltaInsertRemaining = ulFirst;
+            return eAzureIoTSuccess;
+
+        default:
+            LogError( ( "[ADU] Unknown delta command 0x%02x.", ucDeltaCommand[ 0 ] ) );
+            return eAzureIoTErrorFailed;
+    }
+}
+/*-----------------------------------------------------------*/
+
+static AzureIoTResult_t prvPayloadByte( uint8_t ucByte )
+{
+    if( ( ucDecoderFlags & sampleaduDECODER_FLAG_DELTA ) != 0 )
+    {
+        return prvDeltaByte( ucByte );
+    }
+
+    return prvOutput( &ucByte, 1 );
+}
+/*-----------------------------------------------------------*/
+
+static AzureIoTResult_t prvInflateEmit( uint8_t ucByte )
+{
+    ucInflateWindow[ ulInflateWindowHead ] = ucByte;
+    ulInflateWindowHead = ( ulInflateWindowHead + 1 ) & ( ( 1UL << xDecoderHeader.ucWindowBits ) - 1 );
+
+    return prvPayloadByte( ucByte );
+}
+/*-----------------------------------------------------------*/
+
+/* heatshrink stores fields most significant bit first. A field is complete
+ * once ulInflateBitCount bits have been gathered into ulInflateBits. */
+static AzureIoTResult_t prvInflateBit( uint32_t ulBit )
+{
+    uint32_t ulMask = ( 1UL << xDecoderHeader.ucWindowBits ) - 1;
+    uint32_t ulCount;
+    uint32_t ulNeeded;
+
+    if( xInflateState == eSampleAduInflateTag )
+    {
+        xInflateState = ( ulBit != 0 ) ? eSampleAduInflateLiteral : eSampleAduInflateIndex;
+        ulInflateBits = 0;
+        ulInflateBitCount = 0;
+        return eAzureIoTSuccess;
+    }
+
+    ulInflateBits = ( ulInflateBits << 1 ) | ulBit;
+    ulInflateBitCount++;
+
+    ulNeeded = ( xInflateState == eSampleAduInflateLiteral ) ? 8 :
+               ( xInflateState == eSampleAduInflateIndex ) ? xDecoderHeader.ucWindowBits :
+               xDecoderHeader.ucLookaheadBits;
+
+    if( ulInflateBitCount < ulNeeded )
+    {
+        return eAzureIoTSuccess;
+    }
+
+    switch( xInflateState )
+    {
+        case eSampleAduInflateLiteral:
+            xInflateState = eSampleAduInflateTag;
+            return prvInflateEmit( ( uint8_t ) ulInflateBits );
+
+        case eSampleAduInflateIndex:
+            ulInflateIndex = ulInflateBits + 1;
+            ulInflateBits = 0;
+            ulInflateBitCount = 0;
+            xInflateState = eSampleAduInflateCount;
+            return eAzureIoTSuccess;
+
+        default:
+            xInflateState = eSampleAduInflateTag;
+
+            for( ulCount = ulInflateBits + 1; ulCount > 0; ulCount-- )
+            {
+                if( prvInflateEmit( ucInflateWindow[ ( ulInflateWindowHead - ulInflateIndex ) & ulMask ] ) != eAzureIoTSuccess )
+                {
+                    return eAzureIoTErrorFailed;
+                }
+            }
+
+            return eAzureIoTSuccess;
+    }
+}
+/*-----------------------------------------------------------*/
+
+static AzureIoTResult_t prvParseHeader( void )
+{
+    mbedtls_md_context_t xSourceHash;
+    uint8_t ucHash[ sampleaduDECODER_SHA256_SIZE ];
+
+    xDecoderHeader.ulMagic = prvReadLE32( &ucDecoderHeader[ 0 ] );
+    xDecoderHeader.ucFlags = ucDecoderHeader[ 4 ];
+    xDecoderHeader.ucWindowBits = ucDecoderHeader[ 5 ];
+    xDecoderHeader.ucLookaheadBits = ucDecoderHeader[ 6 ];
+    xDecoderHeader.ucReserved = ucDecoderHeader[ 7 ];
+    xDecoderHeader.ulImageSize = prvReadLE32( &ucDecoderHeader[ 8 ] );
+    xDecoderHeader.ulSourceSize = prvReadLE32( &ucDecoderHeader[ 12 ] );
+    memcpy( xDecoderHeader.ucImageHash, &ucDecoderHeader[ 16 ], sampleaduDECODER_SHA256_SIZE );
+    memcpy( xDecoderHeader.ucSourceHash, &ucDecoderHeader[ 48 ], sampleaduDECODER_SHA256_SIZE );
+
+    if( ( xDecoderHeader.ucFlags == 0 ) ||
+        ( ( xDecoderHeader.ucFlags & ~( sampleaduDECODER_FLAG_COMPRESSED | sampleaduDECODER_FLAG_DELTA ) ) != 0 ) ||
+        ( xDecoderHeader.ucReserved != 0 ) ||
+        ( xDecoderHeader.ulImageSize > ulDecoderMaxImageSize ) )
+    {
+        LogError( ( "[ADU] Unsupported encoded image header." ) );
+        return eAzureIoTErrorFailed;
+    }
+
+    if( ( ( xDecoderHeader.ucFlags & sampleaduDECODER_FLAG_COMPRESSED ) != 0 ) &&
+        ( ( xDecoderHeader.ucWindowBits < sampleaduDECODER_MIN_BITS ) ||
+          ( xDecoderHeader.ucWindowBits > sampleaduDECODER_MAX_WINDOW_BITS ) ||
+          ( xDecoderHeader.ucLookaheadBits < sampleaduDECODER_MIN_BITS - 1 ) ||
+          ( xDecoderHeader.ucLookaheadBits >= xDecoderHeader.ucWindowBits ) ) )
+    {
+        LogError( ( "[ADU] Unsupported compression window %u/%u.",
+                    xDecoderHeader.ucWindowBits, xDecoderHeader.ucLookaheadBits ) );
+        return eAzureIoTErrorFailed;
+    }
+
+    if( ( xDecoderHeader.ucFlags & sampleaduDECODER_FLAG_DELTA ) != 0 )
+    {
+        if( ( pucDecoderSourceImage == NULL ) ||
+            ( xDecoderHeader.ulSourceSize > ulDecoderMaxImageSize ) )
+        {
+            LogError( ( "[ADU] Delta images are not supported on this device." ) );
+            return eAzureIoTErrorFailed;
+        }
+
+        /* A delta against a different base would rebuild garbage, so check it up front. */
+        mbedtls_md_init( &xSourceHash );
+        mbedtls_md_setup( &xSourceHash, mbedtls_md_info_from_type( MBEDTLS_MD_SHA256 ), 0 );
+        mbedtls_md_starts( &xSourceHash );
+        mbedtls_md_update( &xSourceHash, pucDecoderSourceImage, xDecoderHeader.ulSourceSize );
+        mbedtls_md_finish( &xSourceHash, ucHash );
+        mbedtls_md_free( &xSourceHash );
+
+        if( memcmp( ucHash, xDecoderHeader.ucSourceHash, sampleaduDECODER_SHA256_SIZE ) != 0 )
+        {
+            LogError( ( "[ADU] Delta was not made against the running image." ) );
+            return eAzureIoTErrorFailed;
+        }
+    }
+
+    ucDecoderFlags = xDecoderHeader.ucFlags;
+
+    LogInfo( ( "[ADU] Encoded image: flags 0x%02x, %u bytes once decoded.",
+               ucDecoderFlags, xDecoderHeader.ulImageSize ) );
+
+    return eAzureIoTSuccess;
+}
+/*-----------------------------------------------------------*/
+
+void SampleAduDecoder_Init( SampleAduDecoderWrite_t xWrite,
+                            const uint8_t * pucSourceImage,
+                            uint32_t ulMaxImageSize )
+{
+    xDecoderWrite = xWrite;
+    pucDecoderSourceImage = pucSourceImage;
+    ulDecoderMaxImageSize = ulMaxImageSize;
+
+    mbedtls_md_free( &xDecoderFileHash );
+    mbedtls_md_init( &xDecoderFileHash );
+    mbedtls_md_setup( &xDecoderFileHash, mbedtls_md_info_from_type( MBEDTLS_MD_SHA256 ), 0 );
+    mbedtls_md_starts( &xDecoderFileHash );
+
+    ulDecoderHeaderLength = 0;
+    ucDecoderFlags = 0;
+    memset( &xDecoderHeader, 0, sizeof( xDecoderHeader ) );
+
+    xInflateState = eSampleAduInflateTag;
+    ulInflateWindowHead = 0;
+    memset( ucInflateWindow, 0, sizeof( ucInflateWindow ) );
+
+    ulDeltaCommandLength = 0;
+    ulDeltaInsertRemaining = 0;
+
+    ulDecoderOutputLength = 0;
+    ulDecoderImageLength = 0;
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t SampleAduDecoder_Process( const uint8_t * pucData,
+                                           uint32_t ulLength )
+{
+    uint32_t ulCopySize;
+    uint32_t ulIndex;
+    int32_t lBit;
+
+    mbedtls_md_update( &xDecoderFileHash, pucData, ulLength );
+
+    /* Gather the header until the magic shows whether the file is encoded. */
+    if( ulDecoderHeaderLength < sampleaduDECODER_HEADER_SIZE )
+    {
+        ulCopySize = sampleaduDECODER_HEADER_SIZE - ulDecoderHeaderLength;
+        ulCopySize = ulLength < ulCopySize ? ulLength : ulCopySize;
+
+        memcpy( ucDecoderHeader + ulDecoderHeaderLength, pucData, ulCopySize );
+        ulDecoderHeaderLength += ulCopySize;
+        pucData += ulCopySize;
+        ulLength -= ulCopySize;
+
+        if( ( ulDecoderHeaderLength >= sizeof( uint32_t ) ) &&
+            ( prvReadLE32( ucDecoderHeader ) != sampleaduDECODER_MAGIC ) )
+        {
+            /* A plain image: write out what was held back, then pass the rest through. */
+            ulCopySize = ulDecoderHeaderLength;
+            ulDecoderHeaderLength = sampleaduDECODER_HEADER_SIZE;
+
+            if( prvOutput( ucDecoderHeader, ulCopySize ) != eAzureIoTSuccess )
+            {
+                return eAzureIoTErrorFailed;
+            }
+        }
+        else if( ulDecoderHeaderLength < sampleaduDECODER_HEADER_SIZE )
+        {
+            return eAzureIoTSuccess;
+        }
+        else if( prvParseHeader() != eAzureIoTSuccess )
+        {
+            return eAzureIoTErrorFailed;
+        }
+    }
+
+    if( ( ucDecoderFlags & sampleaduDECODER_FLAG_COMPRESSED ) != 0 )
+    {
+        for( ulIndex = 0; ulIndex < ulLength; ulIndex++ )
+        {
+            for( lBit = 7; lBit >= 0; lBit-- )
+            {
+                if( prvInflateBit( ( pucData[ ulIndex ] >> lBit ) & 1 ) != eAzureIoTSuccess )
+                {
+                    return eAzureIoTErrorFailed;
+                }
+            }
+        }
+    }
+    else if( ( ucDecoderFlags & sampleaduDECODER_FLAG_DELTA ) != 0 )
+    {
+        for( ulIndex = 0; ulIndex < ulLength; ulIndex++ )
+        {
+            if( prvDeltaByte( pucData[ ulIndex ] ) != eAzureIoTSuccess )
+            {
+                return eAzureIoTErrorFailed;
+            }
+        }
+    }
+    else if( ulLength > 0 )
+    {
+        return prvOutput( pucData, ulLength );
+    }
+
+    return eAzureIoTSuccess;
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t SampleAduDecoder_Finish( const uint8_t * pucManifestHash,
+                                          uint32_t ulManifestHashLength,
+                                          uint8_t pucImageHash[ sampleaduDECODER_HASH_BASE64_SIZE ],
+                                          uint32_t * pulImageHashLength,
+                                          uint32_t * pulImageSize )
+{
+    uint8_t ucHash[ sampleaduDECODER_SHA256_SIZE ];
+    uint8_t ucManifestHash[ sampleaduDECODER_SHA256_SIZE ];
+    int32_t lLength = 0;
+
+    if( ulDecoderHeaderLength < sampleaduDECODER_HEADER_SIZE )
+    {
+        /* Too short to tell: a truncated header, or a tiny plain file. */
+        if( ( ulDecoderHeaderLength >= sizeof( uint32_t ) ) ||
+            ( prvOutput( ucDecoderHeader, ulDecoderHeaderLength ) != eAzureIoTSuccess ) )
+        {
+            return eAzureIoTErrorFailed;
+        }
+    }
+
+    if( prvFlushOutput() != eAzureIoTSuccess )
+    {
+        return eAzureIoTErrorFailed;
+    }
+
+    mbedtls_md_finish( &xDecoderFileHash, ucHash );
+
+    if( az_result_failed( az_base64_decode( az_span_create( ucManifestHash, sizeof( ucManifestHash ) ),
+                                            az_span_create( ( uint8_t * ) pucManifestHash, ( int32_t ) ulManifestHashLength ),
+                                            &lLength ) ) ||
+        ( lLength != sampleaduDECODER_SHA256_SIZE ) ||
+        ( memcmp( ucHash, ucManifestHash, sampleaduDECODER_SHA256_SIZE ) != 0 ) )
+    {
+        LogError( ( "[ADU] Downloaded file does not match the manifest hash." ) );
+        return eAzureIoTErrorFailed;
+    }
+
+    if( ucDecoderFlags == 0 )
+    {
+        /* A plain image is verified against the manifest hash itself. */
+        if( ulManifestHashLength >= sampleaduDECODER_HASH_BASE64_SIZE )
+        {
+            return eAzureIoTErrorFailed;
+        }
+
+        memcpy( pucImageHash, pucManifestHash, ulManifestHashLength );
+        *pulImageHashLength = ulManifestHashLength;
+    }
+    else
+    {
+        if( ( ulDecoderImageLength != xDecoderHeader.ulImageSize ) ||
+            ( ulDeltaInsertRemaining != 0 ) ||
+            ( ulDeltaCommandLength != 0 ) )
+        {
+            LogError( ( "[ADU] Encoded image ended early: %u of %u bytes.",
+                        ulDecoderImageLength, xDecoderHeader.ulImageSize ) );
+            return eAzureIoTErrorFailed;
+        }
+
+        if( az_result_failed( az_base64_encode( az_span_create( pucImageHash, sampleaduDECODER_HASH_BASE64_SIZE ),
+                                                az_span_create( xDecoderHeader.ucImageHash, sampleaduDECODER_SHA256_SIZE ),
+                                                &lLength ) ) )
+        {
+            return eAzureIoTErrorFailed;
+        }
+
+        *pulImageHashLength = ( uint32_t ) lLength;
+    }
+
+    *pulImageSize = ulDecoderImageLength;
+
+    return eAzureIoTSuccess;
+}
+/*-----------------------------------------------------------*/
@@ -0,0 +1,110 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @file sample_azure_iot_adu_decoder.h
+ *
+ * @brief Streaming decoder for compressed and delta encoded ADU images.
+ *
+ * An encoded update file starts with a SampleAduImageHeader_t, followed by
+ * the payload. Files without the header are written through unchanged, so
+ * plain images keep working.
+ *
+ * With sampleaduDECODER_FLAG_COMPRESSED the payload is a heatshrink stream,
+ * as produced by `heatshrink -e -w <window bits> -l <lookahead bits>`.
+ *
+ * With sampleaduDECODER_FLAG_DELTA the (decompressed) payload is a list of
+ * commands that rebuild the new image from the one currently running:
+ *
+ *  - COPY:   0x00, source offset (uint32 LE), length (uint32 LE)
+ *  - INSERT: 0x01, length (uint32 LE), 0 (uint32 LE), then length literal bytes
+ *
+ * The decoder checks the SHA256 of the downloaded file against the update
+ * manifest, and hands back the SHA256 of the rebuilt image from the header
+ * for the flash port to verify.
+ */
+
+#ifndef SAMPLE_AZURE_IOT_ADU_DECODER_H
+#define SAMPLE_AZURE_IOT_ADU_DECODER_H
+
+#include <stdint.h>
+
+#include "azure_iot_result.h"
+
+#define sampleaduDECODER_MAGIC               0x45554441UL /* "ADUE" */
+#define sampleaduDECODER_FLAG_COMPRESSED     0x01
+#define sampleaduDECODER_FLAG_DELTA          0x02
+#define sampleaduDECODER_SHA256_SIZE         32
+
+/* Base64 of a SHA256, plus a terminator. */
+#define sampleaduDECODER_HASH_BASE64_SIZE    45
+
+/**
+ * @brief Largest heatshrink window accepted. The window buffer is 2^bits bytes.
+ */
+#ifndef sampleaduDECODER_MAX_WINDOW_BITS
+    #define sampleaduDECODER_MAX_WINDOW_BITS    10
+#endif
+
+/**
+ * @brief Size of the buffer the decoded image is gathered in before it is written to flash.
+ */
+#ifndef sampleaduDECODER_OUTPUT_BUFFER_SIZE
+    #define sampleaduDECODER_OUTPUT_BUFFER_SIZE    1024
+#endif
+
+/**
+ * @brief Header of an encoded update file. Multi-byte fields are little endian.
+ */
+typedef struct SampleAduImageHeader
+{
+    uint32_t ulMagic;                                     /**< sampleaduDECODER_MAGIC. */
+    uint8_t ucFlags;                                      /**< sampleaduDECODER_FLAG_* bits. */
+    uint8_t ucWindowBits;                                 /**< heatshrink window size, in bits. */
+    uint8_t ucLookaheadBits;                              /**< heatshrink lookahead size, in bits. */
+    uint8_t ucReserved;                                   /**< Must be 0. */
+    uint32_t ulImageSize;                                 /**< Size of the rebuilt image. */
+    uint32_t ulSourceSize;                                /**< Size of the image a delta applies to. */
+    uint8_t ucImageHash[ sampleaduDECODER_SHA256_SIZE ];  /**< SHA256 of the rebuilt image. */
+    uint8_t ucSourceHash[ sampleaduDECODER_SHA256_SIZE ]; /**< SHA256 of the image a delta applies to. */
+} SampleAduImageHeader_t;
+
+/**
+ * @brief Called with each block of the decoded image, in order.
+ */
+typedef AzureIoTResult_t ( * SampleAduDecoderWrite_t )( const uint8_t * pucData,
+                                                        uint32_t ulLength );
+
+/**
+ * @brief Start decoding a new update file.
+ *
+ * @param[in] xWrite Receives the decoded image.
+ * @param[in] pucSourceImage Memory mapped running image that deltas apply to, or NULL if deltas are not supported.
+ * @param[in] ulMaxImageSize Largest image the update bank can hold.
+ */
+void SampleAduDecoder_Init( SampleAduDecoderWrite_t xWrite,
+                            const uint8_t * pucSourceImage,
+                            uint32_t ulMaxImageSize );
+
+/**
+ * @brief Decode the next part of the downloaded file.
+ */
+AzureIoTResult_t SampleAduDecoder_Process( const uint8_t * pucData,
+                                           uint32_t ulLength );
+
+/**
+ * @brief Finish decoding and check the downloaded file against the manifest hash.
+ *
+ * @param[in] pucManifestHash Base64 SHA256 of the downloaded file, from the update manifest.
+ * @param[in] ulManifestHashLength Length of \p pucManifestHash.
+ * @param[out] pucImageHash Receives the base64 SHA256 the written image must match.
+ * @param[out] pulImageHashLength Length written to \p pucImageHash.
+ * @param[out] pulImageSize Size of the written image.
+ */
+AzureIoTResult_t SampleAduDecoder_Finish( const uint8_t * pucManifestHash,
+                                          uint32_t ulManifestHashLength,
+                                          uint8_t pucImageHash[ sampleaduDECODER_HASH_BASE64_SIZE ],
+                                          uint32_t * pulImageHashLength,
+                                          uint32_t * pulImageSize );
+
+#endif /* SAMPLE_AZURE_IOT_ADU_DECODER_H */
@@ -0,0 +1,899 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+#include "sample_azure_iot_adu_jws.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "mbedtls/md.h"
+
+#include "azure_sample_crypto.h"
+
+/* Demo Specific configs. */
+#include "demo_config.h"
+
+#define sampleaduJWS_SHA256_SIZE          32
+#define sampleaduJWS_ALGORITHM            "RS256"
+
+/* Longest JSON key compared against, longer keys are skipped. */
+#define sampleaduJWS_MAX_KEY_LENGTH       8
+
+/* Longest "alg" or "kid" value kept. */
+#define sampleaduJWS_MAX_TEXT_LENGTH      32
+
+#define sampleaduJWS_MAX_EXPONENT_SIZE    8
+
+typedef enum SampleAduJsonState
+{
+    eSampleAduJsonStart = 0, /* Expecting the opening brace. */
+    eSampleAduJsonKeyStart,  /* Expecting a key, or the closing brace. */
+    eSampleAduJsonKey,       /* In a key. */
+    eSampleAduJsonColon,     /* Expecting the colon after a key. */
+    eSampleAduJsonValueStart,
+    eSampleAduJsonString,    /* In a string value. */
+    eSampleAduJsonLiteral,   /* In a number, true, false or null. */
+    eSampleAduJsonNext,      /* Expecting a comma, or the closing brace. */
+    eSampleAduJsonEnd
+} SampleAduJsonState_t;
+
+typedef enum SampleAduJsonEvent
+{
+    eSampleAduJsonNone = 0,
+    eSampleAduJsonValueChar, /* Next character of the value of the current key. */
+    eSampleAduJsonValueEnd,  /* The value of the current key is complete. */
+    eSampleAduJsonError
+} SampleAduJsonEvent_t;
+
+/* Scanner for a flat JSON object, fed one character at a time. Nested
+ * objects and arrays are not used by ADU signatures and are rejected. */
+typedef struct SampleAduJsonScanner
+{
+    SampleAduJsonState_t xState;
+    bool xEscape;
+    char cKey[ sampleaduJWS_MAX_KEY_LENGTH ];
+    uint32_t ulKeyLength;
+} SampleAduJsonScanner_t;
+
+typedef struct SampleAduBase64
+{
+    uint32_t ulBits;
+    uint32_t ulBitCount;
+} SampleAduBase64_t;
+
+/* A base64url encoded JSON segment of a JWS. */
+typedef struct SampleAduJsonSegment
+{
+    SampleAduBase64_t xBase64;
+    SampleAduJsonScanner_t xJson;
+} SampleAduJsonSegment_t;
+
+/* A JSON value kept while scanning, as text or base64 decoded. */
+typedef struct SampleAduJWSField
+{
+    const char * pcKey;
+    bool xDecode;
+    uint8_t * pucValue;
+    uint32_t ulSize;
+    uint32_t ulLength;
+    bool xComplete;
+    SampleAduBase64_t xBase64;
+} SampleAduJWSField_t;
+/*-----------------------------------------------------------*/
+
+/* Signature being decoded, first of the signing key, then of the manifest. */
+static uint8_t ucSignature[ sampleaduJWS_MAX_RSA_SIZE ];
+static uint32_t ulSignatureLength;
+static SampleAduBase64_t xSignatureBase64;
+
+static uint8_t ucSigningKeyN[ sampleaduJWS_MAX_RSA_SIZE ];
+static uint8_t ucSigningKeyE[ sampleaduJWS_MAX_EXPONENT_SIZE ];
+static uint8_t ucSigningKeyAlg[ sampleaduJWS_MAX_TEXT_LENGTH ];
+static uint8_t ucSigningKeyHeaderAlg[ sampleaduJWS_MAX_TEXT_LENGTH ];
+static uint8_t ucSigningKeyHeaderKid[ sampleaduJWS_MAX_TEXT_LENGTH ];
+static uint8_t ucHeaderAlg[ sampleaduJWS_MAX_TEXT_LENGTH ];
+static uint8_t ucPayloadHash[ sampleaduJWS_SHA256_SIZE ];
+
+/* Outer JWS header. "sjwk" is fed to prvSigningKeyFeed() instead. */
+static SampleAduJWSField_t xHeaderFields[] =
+{
+    { "alg", false, ucHeaderAlg, sizeof( ucHeaderAlg ) }
+};
+
+/* Header of the signing key JWS. */
+static SampleAduJWSField_t xSigningKeyHeaderFields[] =
+{
+    { "alg", false, ucSigningKeyHeaderAlg, sizeof( ucSigningKeyHeaderAlg ) },
+    { "kid", false, ucSigningKeyHeaderKid, sizeof( ucSigningKeyHeaderKid ) }
+};
+
+/* Payload of the signing key JWS, the JWK of the key. */
+static SampleAduJWSField_t xSigningKeyFields[] =
+{
+    { "n",   true,  ucSigningKeyN,   sizeof( ucSigningKeyN )   },
+    { "e",   true,  ucSigningKeyE,   sizeof( ucSigningKeyE )   },
+    { "alg", false, ucSigningKeyAlg, sizeof( ucSigningKeyAlg ) }
+};
+
+/* Outer JWS payload. */
+static SampleAduJWSField_t xPayloadFields[] =
+{
+    { "sha256", true, ucPayloadHash, sizeof( ucPayloadHash ) }
+};
+
+/* Signing key JWS, nested in the "sjwk" value of the outer header. */
+static mbedtls_md_context_t xSigningKeyHash;
+static uint32_t ulSigningKeySegment;
+static SampleAduJsonSegment_t xSigningKeySegment;
+static bool xSigningKeyComplete;
+/*-----------------------------------------------------------*/
+
+static void prvJsonInit( SampleAduJsonScanner_t * pxJson )
+{
+    pxJson->xState = eSampleAduJsonStart;
+    pxJson->xEscape = false;
+    pxJson->ulKeyLength = 0;
+}
+/*-----------------------------------------------------------*/
+
+static bool prvJsonIsSpace( char cChar )
+{
+    return cChar == ' ' || cChar == '\t' || cChar == '\r' || cChar == '\n';
+}
+/*-----------------------------------------------------------*/
+
+static bool prvJsonKeyIs( const SampleAduJsonScanner_t * pxJson,
+                          const char * pcKey )
+{
+    uint32_t ulLength = ( uint32_t ) strlen( pcKey );
+
+    return pxJson->ulKeyLength == ulLength && memcmp( pxJson->cKey, pcKey, ulLength ) == 0;
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Take the next character of a string, handling the escapes that can
+ * appear in ids and base64. Returns false while in the middle of an escape.
+ */
+static bool prvJsonUnescape( SampleAduJsonScanner_t * pxJson,
+                             char * pcChar,
+                             bool * pxEnd,
+                             bool * pxError )
+{
+    if( pxJson->xEscape )
+    {
+        pxJson->xEscape = false;
+
+        if( ( *pcChar != '"' ) && ( *pcChar != '\\' ) && ( *pcChar != '/' ) )
+        {
+            *pxError = true;
+        }
+
+        return true;
+    }
+
+    if( *pcChar == '\\' )
+    {
+        pxJson->xEscape = true;
+        return false;
+    }
+
+    *pxEnd = ( *pcChar == '"' );
+
+    return true;
+}
+/*-----------------------------------------------------------*/
+
+static SampleAduJsonEvent_t prvJsonFeed( SampleAduJsonScanner_t * pxJson,
+                                         char cChar,
+                                         char * pcValue )
+{
+    bool xEnd = false;
+    bool xError = false;
+
+    switch( pxJson->xState )
+    {
+        case eSampleAduJsonKey:
+
+            if( !prvJsonUnescape( pxJson, &cChar, &xEnd, &xError ) )
+            {
+                return eSampleAduJsonNone;
+            }
+
+            if( xError )
+            {
+                return eSampleAduJsonError;
+            }
+
+            if( xEnd )
+            {
+                pxJson->xState = eSampleAduJsonColon;
+            }
+            else
+            {
+                /* Keys too long to be one we look for can never match. */
+                if( pxJson->ulKeyLength < sizeof( pxJson->cKey ) )
+                {
+                    pxJson->cKey[ pxJson->ulKeyLength ] = cChar;
+                }
+
+                if( pxJson->ulKeyLength <= sizeof( pxJson->cKey ) )
+                {
+                    pxJson->ulKeyLength++;
+                }
+            }
+
+            return eSampleAduJsonNone;
+
+        case eSampleAduJsonString:
+
+            if( !prvJsonUnescape( pxJson, &cChar, &xEnd, &xError ) )
+            {
+                return eSampleAduJsonNone;
+            }
+
+            if( xError )
+            {
+                return eSampleAduJsonError;
+            }
+
+            if( xEnd )
+            {
+                pxJson->xState = eSampleAduJsonNext;
+                return eSampleAduJsonValueEnd;
+            }
+
+            *pcValue = cChar;
+            return eSampleAduJsonValueChar;
+
+        case eSampleAduJsonLiteral:
+
+            if( ( cChar != ',' ) && ( cChar != '}' ) && !prvJsonIsSpace( cChar ) )
+            {
+                if( ( cChar == '"' ) || ( cChar == '{' ) || ( cChar == '[' ) || ( cChar == ':' ) )
+                {
+                    return eSampleAduJsonError;
+                }
+
+                *pcValue = cChar;
+                return eSampleAduJsonValueChar;
+            }
+
+            /* The character ending the literal is handled as the start of what follows it. */
+            pxJson->xState = eSampleAduJsonNext;
+
+            if( !prvJsonIsSpace( cChar ) )
+            {
+                ( void ) prvJsonFeed( pxJson, cChar, pcValue );
+            }
+
+            return eSampleAduJsonValueEnd;
+
+        default:
+            break;
+    }
+
+    if( prvJsonIsSpace( cChar ) )
+    {
+        return eSampleAduJsonNone;
+    }
+
+    switch( pxJson->xState )
+    {
+        case eSampleAduJsonStart:
+
+            if( cChar != '{' )
+            {
+                return eSampleAduJsonError;
+            }
+
+            pxJson->xState = eSampleAduJsonKeyStart;
+            break;
+
+        case eSampleAduJsonKeyStart:
+
+            if( cChar == '}' )
+            {
+                pxJson->xState = eSampleAduJsonEnd;
+            }
+            else if( cChar == '"' )
+            {
+                pxJson->ulKeyLength = 0;
+                pxJson->xState = eSampleAduJsonKey;
+            }
+            else
+            {
+                return eSampleAduJsonError;
+            }
+
+            break;
+
+        case eSampleAduJsonColon:
+
+            if( cChar != ':' )
+            {
+                return eSampleAduJsonError;
+            }
+
+            pxJson->xState = eSampleAduJsonValueStart;
+            break;
+
+        case eSampleAduJsonValueStart:
+
+            if( cChar == '"' )
+            {
+                pxJson->xState = eSampleAduJsonString;
+            }
+            else if( ( cChar == '{' ) || ( cChar == '[' ) || ( cChar == ',' ) || ( cChar == '}' ) )
+            {
+                return eSampleAduJsonError;
+            }
+            else
+            {
+                pxJson->xState = eSampleAduJsonLiteral;
+                *pcValue = cChar;
+                return eSampleAduJsonValueChar;
+            }
+
+            break;
+
+        case eSampleAduJsonNext:
+
+            if( cChar == ',' )
+            {
+                pxJson->xState = eSampleAduJsonKeyStart;
+            }
+            else if( cChar == '}' )
+            {
+                pxJson->xState = eSampleAduJsonEnd;
+            }
+            else
+            {
+                return eSampleAduJsonError;
+            }
+
+            break;
+
+        default:
+            /* Nothing but whitespace may follow the object. */
+            return eSampleAduJsonError;
+    }
+
+    return eSampleAduJsonNone;
+}
+/*-----------------------------------------------------------*/
+
+static void prvBase64Init( SampleAduBase64_t * pxBase64 )
+{
+    pxBase64->ulBits = 0;
+    pxBase64->ulBitCount = 0;
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Decode the next base64 character. Both the url safe and the standard
+ * alphabet are accepted, padding is skipped.
+ *
+ * @return 1 when a byte was decoded into \p pucByte, 0 when more input is needed, -1 on error.
+ */
+static int32_t prvBase64Feed( SampleAduBase64_t * pxBase64,
+                              char cChar,
+                              uint8_t * pucByte )
+{
+    uint32_t ulValue;
+
+    if( ( cChar >= 'A' ) && ( cChar <= 'Z' ) )
+    {
+        ulValue = ( uint32_t ) ( cChar - 'A' );
+    }
+    else if( ( cChar >= 'a' ) && ( cChar <= 'z' ) )
+    {
+        ulValue = ( uint32_t ) ( cChar - 'a' ) + 26;
+    }
+    else if( ( cChar >= '0' ) && ( cChar <= '9' ) )
+    {
+        ulValue = ( uint32_t ) ( cChar - '0' ) + 52;
+    }
+    else if( ( cChar == '-' ) || ( cChar == '+' ) )
+    {
+        ulValue = 62;
+    }
+    else if( ( cChar == '_' ) || ( cChar == '/' ) )
+    {
+        ulValue = 63;
+    }
+    else if( cChar == '=' )
+    {
+        return 0;
+    }
+    else
+    {
+        return -1;
+    }
+
+    pxBase64->ulBits = ( pxBase64->ulBits << 6 ) | ulValue;
+    pxBase64->ulBitCount += 6;
+
+    if( pxBase64->ulBitCount < 8 )
+    {
+        return 0;
+    }
+
+    pxBase64->ulBitCount -= 8;
+    *pucByte = ( uint8_t ) ( pxBase64->ulBits >> pxBase64->ulBitCount );
+    pxBase64->ulBits &= ( 1U << pxBase64->ulBitCount ) - 1U;
+
+    return 1;
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Check the encoding did not end on a lone character.
+ */
+static bool prvBase64Finish( const SampleAduBase64_t * pxBase64 )
+{
+    return pxBase64->ulBitCount < 6;
+}
+/*-----------------------------------------------------------*/
+
+static void prvSegmentInit( SampleAduJsonSegment_t * pxSegment )
+{
+    prvBase64Init( &pxSegment->xBase64 );
+    prvJsonInit( &pxSegment->xJson );
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Decode the next character of a segment and scan the decoded byte.
+ */
+static SampleAduJsonEvent_t prvSegmentFeed( SampleAduJsonSegment_t * pxSegment,
+                                            char cChar,
+                                            char * pcValue )
+{
+    uint8_t ucByte;
+    int32_t lDecoded = prvBase64Feed( &pxSegment->xBase64, cChar, &ucByte );
+
+    if( lDecoded < 0 )
+    {
+        return eSampleAduJsonError;
+    }
+    else if( lDecoded == 0 )
+    {
+        return eSampleAduJsonNone;
+    }
+
+    return prvJsonFeed( &pxSegment->xJson, ( char ) ucByte, pcValue );
+}
+/*-----------------------------------------------------------*/
+
+static bool prvSegmentFinish( const SampleAduJsonSegment_t * pxSegment )
+{
+    return prvBase64Finish( &pxSegment->xBase64 ) &&
+           ( pxSegment->xJson.xState == eSampleAduJsonEnd );
+}
+/*-----------------------------------------------------------*/
+
+static void prvFieldsInit( SampleAduJWSField_t * pxFields,
+                           uint32_t ulFieldCount )
+{
+    for( uint32_t ulIndex = 0; ulIndex < ulFieldCount; ulIndex++ )
+    {
+        pxFields[ ulIndex ].ulLength = 0;
+        pxFields[ ulIndex ].xComplete = false;
+        prvBase64Init( &pxFields[ ulIndex ].xBase64 );
+    }
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Keep the value of the current key if it is one of \p pxFields.
+ */
+static bool prvFieldsFeed( SampleAduJWSField_t * pxFields,
+                           uint32_t ulFieldCount,
+                           const SampleAduJsonScanner_t * pxJson,
+                           SampleAduJsonEvent_t xEvent,
+                           char cValue )
+{
+    SampleAduJWSField_t * pxField = NULL;
+    uint8_t ucByte = ( uint8_t ) cValue;
+    int32_t lDecoded = 1;
+
+    for( uint32_t ulIndex = 0; ulIndex < ulFieldCount; ulIndex++ )
+    {
+        if( prvJsonKeyIs( pxJson, pxFields[ ulIndex ].pcKey ) )
+        {
+            pxField = &pxFields[ ulIndex ];
+            break;
+        }
+    }
+
+    if( pxField == NULL )
+    {
+        return true;
+    }
+
+    /* A repeated key must not extend or replace a value already taken. */
+    if( pxField->xComplete )
+    {
+        return false;
+    }
+
+    if( xEvent == eSampleAduJsonValueEnd )
+    {
+        pxField->xComplete = true;
+        return !pxField->xDecode || prvBase64Finish( &pxField->xBase64 );
+    }
+
+    if( pxField->xDecode )
+    {
+        lDecoded = prvBase64Feed( &pxField->xBase64, cValue, &ucByte );
+    }
+
+    if( lDecoded < 0 )
+    {
+        return false;
+    }
+    else if( lDecoded > 0 )
+    {
+        if( pxField->ulLength == pxField->ulSize )
+        {
+            LogError( ( "[ADU] JWS \"%s\" is larger than %u bytes.", pxField->pcKey, pxField->ulSize ) );
+            return false;
+        }
+
+        pxField->pucValue[ pxField->ulLength++ ] = ucByte;
+    }
+
+    return true;
+}
+/*-----------------------------------------------------------*/
+
+static bool prvFieldIs( const SampleAduJWSField_t * pxField,
+                        const char * pcValue )
+{
+    uint32_t ulLength = ( uint32_t ) strlen( pcValue );
+
+    return pxField->ulLength == ulLength && memcmp( pxField->pucValue, pcValue, ulLength ) == 0;
+}
+/*-----------------------------------------------------------*/
+
+static bool prvSignatureFeed( char cChar )
+{
+    uint8_t ucByte;
+    int32_t lDecoded = prvBase64Feed( &xSignatureBase64, cChar, &ucByte );
+
+    if( lDecoded < 0 )
+    {
+        return false;
+    }
+    else if( lDecoded > 0 )
+    {
+        if( ulSignatureLength == sizeof( ucSignature ) )
+        {
+            LogError( ( "[ADU] JWS signature is larger than %u bytes.", ( uint32_t ) sizeof( ucSignature ) ) );
+            return false;
+        }
+
+        ucSignature[ ulSignatureLength++ ] = ucByte;
+    }
+
+    return true;
+}
+/*-----------------------------------------------------------*/
+
+static void prvSigningKeyInit( void )
+{
+    mbedtls_md_init( &xSigningKeyHash );
+    ( void ) mbedtls_md_setup( &xSigningKeyHash, mbedtls_md_info_from_type( MBEDTLS_MD_SHA256 ), 0 );
+    ( void ) mbedtls_md_starts( &xSigningKeyHash );
+
+    ulSigningKeySegment = 0;
+    xSigningKeyComplete = false;
+    prvSegmentInit( &xSigningKeySegment );
+    prvFieldsInit( xSigningKeyHeaderFields, sizeof( xSigningKeyHeaderFields ) / sizeof( xSigningKeyHeaderFields[ 0 ] ) );
+    prvFieldsInit( xSigningKeyFields, sizeof( xSigningKeyFields ) / sizeof( xSigningKeyFields[ 0 ] ) );
+
+    ulSignatureLength = 0;
+    prvBase64Init( &xSignatureBase64 );
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Process the next character of the signing key JWS: the header and
+ * JWK segments are hashed and scanned, the signature is decoded.
+ */
+static bool prvSigningKeyFeed( SampleAduJsonEvent_t xEvent,
+                               char cChar )
+{
+    SampleAduJsonEvent_t xSegmentEvent;
+    char cValue;
+
+    if( xSigningKeyComplete )
+    {
+        return false;
+    }
+
+    if( xEvent == eSampleAduJsonValueEnd )
+    {
+        xSigningKeyComplete = true;
+        return ulSigningKeySegment == 2 && prvBase64Finish( &xSignatureBase64 );
+    }
+
+    if( ulSigningKeySegment == 2 )
+    {
+        return prvSignatureFeed( cChar );
+    }
+
+    if( cChar == '.' )
+    {
+        if( !prvSegmentFinish( &xSigningKeySegment ) )
+        {
+            return false;
+        }
+
+        /* The signing input is the header and payload, with the dot between them. */
+        if( ulSigningKeySegment == 0 )
+        {
+            ( void ) mbedtls_md_update( &xSigningKeyHash, ( const uint8_t * ) &cChar, 1 );
+        }
+
+        prvSegmentInit( &xSigningKeySegment );
+        ulSigningKeySegment++;
+
+        return true;
+    }
+
+    ( void ) mbedtls_md_update( &xSigningKeyHash, ( const uint8_t * ) &cChar, 1 );
+
+    xSegmentEvent = prvSegmentFeed( &xSigningKeySegment, cChar, &cValue );
+
+    if( xSegmentEvent == eSampleAduJsonError )
+    {
+        return false;
+    }
+    else if( xSegmentEvent == eSampleAduJsonNone )
+    {
+        return true;
+    }
+
+    if( ulSigningKeySegment == 0 )
+    {
+        return prvFieldsFeed( xSigningKeyHeaderFields, sizeof( xSigningKeyHeaderFields ) / sizeof( xSigningKeyHeaderFields[ 0 ] ),
+                              &xSigningKeySegment.xJson, xSegmentEvent, cValue );
+    }
+
+    return prvFieldsFeed( xSigningKeyFields, sizeof( xSigningKeyFields ) / sizeof( xSigningKeyFields[ 0 ] ),
+                          &xSigningKeySegment.xJson, xSegmentEvent, cValue );
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Scan the outer JWS header, processing the signing key JWS on the way.
+ */
+static bool prvScanHeader( const uint8_t * pucHeader,
+                           uint32_t ulHeaderLength )
+{
+    SampleAduJsonSegment_t xSegment;
+    SampleAduJsonEvent_t xEvent;
+    char cValue;
+    bool xResult = true;
+
+    prvSegmentInit( &xSegment );
+    prvFieldsInit( xHeaderFields, sizeof( xHeaderFields ) / sizeof( xHeaderFields[ 0 ] ) );
+
+    for( uint32_t ulIndex = 0; ( ulIndex < ulHeaderLength ) && xResult; ulIndex++ )
+    {
+        xEvent = prvSegmentFeed( &xSegment, ( char ) pucHeader[ ulIndex ], &cValue );
+
+        if( xEvent == eSampleAduJsonError )
+        {
+            xResult = false;
+        }
+        else if( xEvent == eSampleAduJsonNone )
+        {
+            /* Nothing to do. */
+        }
+        else if( prvJsonKeyIs( &xSegment.xJson, "sjwk" ) )
+        {
+            xResult = prvSigningKeyFeed( xEvent, cValue );
+        }
+        else
+        {
+            xResult = prvFieldsFeed( xHeaderFields, sizeof( xHeaderFields ) / sizeof( xHeaderFields[ 0 ] ),
+                                     &xSegment.xJson, xEvent, cValue );
+        }
+    }
+
+    return xResult && prvSegmentFinish( &xSegment ) && xSigningKeyComplete;
+}
+/*-----------------------------------------------------------*/
+
+static bool prvScanPayload( const uint8_t * pucPayload,
+                            uint32_t ulPayloadLength )
+{
+    SampleAduJsonSegment_t xSegment;
+    SampleAduJsonEvent_t xEvent;
+    char cValue;
+    bool xResult = true;
+
+    prvSegmentInit( &xSegment );
+    prvFieldsInit( xPayloadFields, sizeof( xPayloadFields ) / sizeof( xPayloadFields[ 0 ] ) );
+
+    for( uint32_t ulIndex = 0; ( ulIndex < ulPayloadLength ) && xResult; ulIndex++ )
+    {
+        xEvent = prvSegmentFeed( &xSegment, ( char ) pucPayload[ ulIndex ], &cValue );
+
+        if( xEvent == eSampleAduJsonError )
+        {
+            xResult = false;
+        }
+        else if( xEvent != eSampleAduJsonNone )
+        {
+            xResult = prvFieldsFeed( xPayloadFields, sizeof( xPayloadFields ) / sizeof( xPayloadFields[ 0 ] ),
+                                     &xSegment.xJson, xEvent, cValue );
+        }
+    }
+
+    return xResult && prvSegmentFinish( &xSegment );
+}
+/*-----------------------------------------------------------*/
+
+static bool prvVerifyRS256( const uint8_t * pucN,
+                            uint32_t ulNLength,
+                            const uint8_t * pucE,
+                            uint32_t ulELength,
+                            const uint8_t pucHash[ sampleaduJWS_SHA256_SIZE ] )
+{
+    /* The root key stays imported from one manifest to the next. */
+    return Crypto_RSAVerify( pucN, ulNLength, pucE, ulELength,
+                             pucHash, sampleaduJWS_SHA256_SIZE,
+                             ucSignature, ulSignatureLength ) == 0;
+}
+/*-----------------------------------------------------------*/
+
+static AzureIoTJWS_RootKey_t * prvFindRootKey( AzureIoTJWS_RootKey_t * pxRootKeys,
+                                               uint32_t ulRootKeysLength )
+{
+    const SampleAduJWSField_t * pxKid = &xSigningKeyHeaderFields[ 1 ];
+
+    for( uint32_t ulIndex = 0; ulIndex < ulRootKeysLength; ulIndex++ )
+    {
+        if( ( pxRootKeys[ ulIndex ].ulRootKeyIdLength == pxKid->ulLength ) &&
+            ( memcmp( pxRootKeys[ ulIndex ].pucRootKeyId, pxKid->pucValue, pxKid->ulLength ) == 0 ) )
+        {
+            return &pxRootKeys[ ulIndex ];
+        }
+    }
+
+    return NULL;
+}
+/*-----------------------------------------------------------*/
+
+static void prvSHA256( const uint8_t * pucData,
+                       uint32_t ulLength,
+                       uint8_t pucHash[ sampleaduJWS_SHA256_SIZE ] )
+{
+    ( void ) Crypto_SHA256( pucData, ulLength, pucHash, sampleaduJWS_SHA256_SIZE );
+}
+/*-----------------------------------------------------------*/
+
+AzureIoTResult_t SampleAduJWS_ManifestAuthenticate( const uint8_t * pucManifest,
+                                                    uint32_t ulManifestLength,
+                                                    const uint8_t * pucJWS,
+                                                    uint32_t ulJWSLength,
+                                                    AzureIoTJWS_RootKey_t * pxRootKeys,
+                                                    uint32_t ulRootKeysLength )
+{
+    AzureIoTJWS_RootKey_t * pxRootKey;
+    uint8_t ucHash[ sampleaduJWS_SHA256_SIZE ];
+    uint32_t ulHeaderEnd = 0;
+    uint32_t ulPayloadEnd = 0;
+    uint32_t ulDots = 0;
+    bool xHeaderValid;
+
+    if( ( pucManifest == NULL ) || ( pucJWS == NULL ) || ( pxRootKeys == NULL ) )
+    {
+        return eAzureIoTErrorInvalidArgument;
+    }
+
+    for( uint32_t ulIndex = 0; ulIndex < ulJWSLength; ulIndex++ )
+    {
+        if( pucJWS[ ulIndex ] == '.' )
+        {
+            if( ulDots == 0 )
+            {
+                ulHeaderEnd = ulIndex;
+            }
+            else
+            {
+                ulPayloadEnd = ulIndex;
+            }
+
+            ulDots++;
+        }
+    }
+
+    if( ulDots != 2 )
+    {
+        LogError( ( "[ADU] JWS does not have three segments." ) );
+        return eAzureIoTErrorFailed;
+    }
+
+    /* The signing key JWS is processed as the header is scanned, leaving its
+     * signature in ucSignature. */
+    prvSigningKeyInit();
+    xHeaderValid = prvScanHeader( pucJWS, ulHeaderEnd );
+    ( void ) mbedtls_md_finish( &xSigningKeyHash, ucHash );
+    mbedtls_md_free( &xSigningKeyHash );
+
+    if( !xHeaderValid ||
+        !prvFieldIs( &xHeaderFields[ 0 ], sampleaduJWS_ALGORITHM ) ||
+        !prvFieldIs( &xSigningKeyHeaderFields[ 0 ], sampleaduJWS_ALGORITHM ) ||
+        ( xSigningKeyFields[ 0 ].ulLength == 0 ) ||
+        ( xSigningKeyFields[ 1 ].ulLength == 0 ) )
+    {
+        LogError( ( "[ADU] JWS header or signing key is not valid." ) );
+        return eAzureIoTErrorFailed;
+    }
+
+    if( xSigningKeyFields[ 2 ].xComplete && !prvFieldIs( &xSigningKeyFields[ 2 ], sampleaduJWS_ALGORITHM ) )
+    {
+        LogError( ( "[ADU] JWS signing key is not an " sampleaduJWS_ALGORITHM " key." ) );
+        return eAzureIoTErrorFailed;
+    }
+
+    pxRootKey = prvFindRootKey( pxRootKeys, ulRootKeysLength );
+
+    if( pxRootKey == NULL )
+    {
+        LogError( ( "[ADU] JWS signing key is not signed by a known root key." ) );
+        return eAzureIoTErrorFailed;
+    }
+
+    if( !prvVerifyRS256( pxRootKey->pucRootKeyN, pxRootKey->ulRootKeyNLength,
+                         pxRootKey->pucRootKeyExponent, pxRootKey->ulRootKeyExponentLength, ucHash ) )
+    {
+        LogError( ( "[ADU] JWS signing key signature is not valid." ) );
+        return eAzureIoTErrorFailed;
+    }
+
+    if( !prvScanPayload( &pucJWS[ ulHeaderEnd + 1 ], ulPayloadEnd - ulHeaderEnd - 1 ) ||
+        ( xPayloadFields[ 0 ].ulLength != sampleaduJWS_SHA256_SIZE ) )
+    {
+        LogError( ( "[ADU] JWS payload is not valid." ) );
+        return eAzureIoTErrorFailed;
+    }
+
+    ulSignatureLength = 0;
+    prvBase64Init( &xSignatureBase64 );
+
+    for( uint32_t ulIndex = ulPayloadEnd + 1; ulIndex < ulJWSLength; ulIndex++ )
+    {
+        if( !prvSignatureFeed( ( char ) pucJWS[ ulIndex ] ) )
+        {
+            LogError( ( "[ADU] JWS signature is not valid base64." ) );
+            return eAzureIoTErrorFailed;
+        }
+    }
+
+    prvSHA256( pucJWS, ulPayloadEnd, ucHash );
+
+    if( !prvBase64Finish( &xSignatureBase64 ) ||
+        !prvVerifyRS256( ucSigningKeyN, xSigningKeyFields[ 0 ].ulLength,
+                         ucSigningKeyE, xSigningKeyFields[ 1 ].ulLength, ucHash ) )
+    {
+        LogError( ( "[ADU] JWS signature is not valid." ) );
+        return eAzureIoTErrorFailed;
+    }
+
+    prvSHA256( pucManifest, ulManifestLength, ucHash );
+
+    if( memcmp( ucHash, ucPayloadHash, sizeof( ucHash ) ) != 0 )
+    {
+        LogError( ( "[ADU] Update manifest does not match the JWS." ) );
+        return eAzureIoTErrorFailed;
+    }
+
+    return eAzureIoTSuccess;
+}
+/*-----------------------------------------------------------*/
@@ -0,0 +1,49 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @file sample_azure_iot_adu_jws.h
+ *
+ * @brief Low memory authentication of ADU update manifests.
+ *
+ * Makes the same checks as AzureIoTJWS_ManifestAuthenticate(), but walks the
+ * JWS in place: signing inputs are hashed straight from the received text,
+ * and the base64url segments are decoded a character at a time through a
+ * small JSON scanner, keeping only the fields the checks need. No decoded
+ * copy of the header, payload or signing key JWS is ever held, so the
+ * azureiotjwsSCRATCH_BUFFER_SIZE buffer is not needed.
+ */
+
+#ifndef SAMPLE_AZURE_IOT_ADU_JWS_H
+#define SAMPLE_AZURE_IOT_ADU_JWS_H
+
+#include <stdint.h>
+
+#include "azure_iot_result.h"
+#include "azure_iot_jws.h"
+
+/**
+ * @brief Largest RSA modulus accepted, in bytes.
+ */
+#ifndef sampleaduJWS_MAX_RSA_SIZE
+    #define sampleaduJWS_MAX_RSA_SIZE    512
+#endif
+
+/**
+ * @brief Authenticate an update manifest against its JWS signature.
+ *
+ * @param[in] pucManifest The update manifest.
+ * @param[in] ulManifestLength Length of \p pucManifest.
+ * @param[in] pucJWS The update manifest signature.
+ * @param[in] ulJWSLength Length of \p pucJWS.
+ * @param[in] pxRootKeys Root keys the signing key may be signed with.
+ * @param[in] ulRootKeysLength Number of \p pxRootKeys.
+ */
+AzureIoTResult_t SampleAduJWS_ManifestAuthenticate( const uint8_t * pucManifest,
+                                                    uint32_t ulManifestLength,
+                                                    const uint8_t * pucJWS,
+                                                    uint32_t ulJWSLength,
+                                                    AzureIoTJWS_RootKey_t * pxRootKeys,
+                                                    uint32_t ulRootKeysLength );
+
+#endif /* SAMPLE_AZURE_IOT_ADU_JWS_H */
@@ -0,0 +1,27 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @file sample_azure_iot_adu_root_keys.h
+ *
+ * @brief Root keys of Device Update, which sign the keys update manifests are signed with.
+ */
+
+#ifndef SAMPLE_AZURE_IOT_ADU_ROOT_KEYS_H
+#define SAMPLE_AZURE_IOT_ADU_ROOT_KEYS_H
+
+#include <stdint.h>
+
+#include "azure_iot_jws.h"
+
+/**
+ * @brief The root keys, the newest first.
+ */
+extern AzureIoTJWS_RootKey_t xADURootKeys[];
+
+/**
+ * @brief Number of entries of #xADURootKeys.
+ */
+extern const uint32_t ulADURootKeysLength;
+
+#endif /* SAMPLE_AZURE_IOT_ADU_ROOT_KEYS_H */
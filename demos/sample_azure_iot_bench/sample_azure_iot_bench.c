@@ -0,0 +1,556 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @file sample_azure_iot_bench.c
+ * @brief Microbenchmarks of the transport, crypto, JSON and JWS code of the samples.
+ *
+ * Measured, in order:
+ * - Crypto_HMAC() in operations per second, signing with one key as SAS token
+ *   renewals do, and alternating two keys so the key is set up each time.
+ * - Building a telemetry message with the JSON writer, per message.
+ * - AzureIoTJWS_ManifestAuthenticate() and SampleAduJWS_ManifestAuthenticate()
+ *   on democonfigBENCH_JWS_MANIFEST and democonfigBENCH_JWS_SIGNATURE, an
+ *   update manifest and its signature as received from Device Update.
+ * - Against the TLS server democonfigBENCH_TLS_HOSTNAME: full and resumed
+ *   handshakes, then TLS_Socket_Send() and TLS_Socket_Recv() throughput for
+ *   each record size of democonfigBENCH_RECORD_SIZES. The server must send
+ *   back what it receives, for example:
+ *   socat OPENSSL-LISTEN:4433,reuseaddr,fork,cert=server.pem,verify=0 EXEC:cat
+ *
+ * The JWS and TLS runs are skipped when their configs are not defined.
+ *
+ * The results are printed to stdout as one JSON object, so runs can be
+ * compared to catch regressions. Times are in microseconds, from
+ * democonfigBENCH_TIME_US().
+ */
+
+/* Standard includes. */
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Kernel includes. */
+#include "FreeRTOS.h"
+#include "task.h"
+
+/* Demo Specific configs. */
+#include "demo_config.h"
+
+/* Azure JSON and JWS includes. */
+#include "azure_iot_json_writer.h"
+#include "azure_iot_jws.h"
+
+/* Transport interface implementation include header for TLS. */
+#include "transport_tls_socket.h"
+
+/* Crypto helper header. */
+#include "azure_sample_crypto.h"
+
+/* Manifest authentication and root keys of the ADU sample. */
+#include "sample_azure_iot_adu_jws.h"
+#include "sample_azure_iot_adu_root_keys.h"
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Crypto_HMAC() calls of each HMAC run.
+ */
+#ifndef democonfigBENCH_HMAC_ITERATIONS
+    #define democonfigBENCH_HMAC_ITERATIONS    ( 10000U )
+#endif
+
+/**
+ * @brief Telemetry messages built by the JSON run.
+ */
+#ifndef democonfigBENCH_JSON_ITERATIONS
+    #define democonfigBENCH_JSON_ITERATIONS    ( 100000U )
+#endif
+
+/**
+ * @brief Authentications of each JWS run.
+ */
+#ifndef democonfigBENCH_JWS_ITERATIONS
+    #define democonfigBENCH_JWS_ITERATIONS    ( 10U )
+#endif
+
+/**
+ * @brief Port of the TLS server.
+ */
+#ifndef democonfigBENCH_TLS_PORT
+    #define democonfigBENCH_TLS_PORT    ( 4433 )
+#endif
+
+/**
+ * @brief Handshakes of each handshake run.
+ */
+#ifndef democonfigBENCH_HANDSHAKES
+    #define democonfigBENCH_HANDSHAKES    ( 10U )
+#endif
+
+/**
+ * @brief Sizes passed to TLS_Socket_Send(), in the order they are measured.
+ */
+#ifndef democonfigBENCH_RECORD_SIZES
+    #define democonfigBENCH_RECORD_SIZES    { 64, 256, 1024, 4096 }
+#endif
+
+/**
+ * @brief Largest entry of democonfigBENCH_RECORD_SIZES, which sizes the record buffers.
+ */
+#ifndef democonfigBENCH_MAX_RECORD_SIZE
+    #define democonfigBENCH_MAX_RECORD_SIZE    4096
+#endif
+
+/**
+ * @brief Bytes sent, and received back, for each record size.
+ */
+#ifndef democonfigBENCH_TRANSFER_SIZE
+    #define democonfigBENCH_TRANSFER_SIZE    ( 256 * 1024U )
+#endif
+
+/**
+ * @brief Microsecond clock used for the measurements.
+ * Defaults to the tick count, so runs shorter than a tick read as 0.
+ */
+#ifndef democonfigBENCH_TIME_US
+    #define democonfigBENCH_TIME_US()    ( ( uint64_t ) xTaskGetTickCount() * 1000000ULL / configTICK_RATE_HZ )
+#endif
+
+/**
+ * @brief Called once the results are printed.
+ */
+#ifndef democonfigBENCH_DONE
+    #define democonfigBENCH_DONE()    vTaskDelete( NULL )
+#endif
+
+#if defined( democonfigBENCH_TLS_HOSTNAME ) && !defined( democonfigBENCH_TLS_ROOT_CA_PEM )
+    #error "Define the root CA of the benchmark TLS server (democonfigBENCH_TLS_ROOT_CA_PEM) in demo_config.h."
+#endif
+
+#define samplebenchTRANSPORT_TIMEOUT_MS    ( 5000U )
+#define samplebenchDOUBLE_DIGITS           2
+#define samplebenchTELEMETRY_SIZE          256
+/*-----------------------------------------------------------*/
+
+/* Each compilation unit must define the NetworkContext struct. */
+struct NetworkContext
+{
+    void * pParams;
+};
+
+typedef struct SampleBenchTime
+{
+    uint64_t ullMinUs;
+    uint64_t ullMaxUs;
+    uint64_t ullTotalUs;
+    uint32_t ulCount;
+} SampleBenchTime_t;
+/*-----------------------------------------------------------*/
+
+#ifdef democonfigBENCH_TLS_HOSTNAME
+    static const uint32_t ulBenchRecordSizes[] = democonfigBENCH_RECORD_SIZES;
+    static uint8_t ucBenchSendBuffer[ democonfigBENCH_MAX_RECORD_SIZE ];
+    static uint8_t ucBenchRecvBuffer[ democonfigBENCH_MAX_RECORD_SIZE ];
+    static TlsSessionCache_t xBenchSessionCache;
+#endif /* democonfigBENCH_TLS_HOSTNAME */
+
+#if defined( democonfigBENCH_JWS_MANIFEST ) && defined( democonfigBENCH_JWS_SIGNATURE )
+    static uint8_t ucBenchJWSScratchBuffer[ azureiotjwsSCRATCH_BUFFER_SIZE ];
+#endif
+
+/* What the samples sign: the key of a device and the string of its SAS token. */
+static const uint8_t ucBenchKey[] = "0123456789abcdef0123456789abcdef";
+static const uint8_t ucBenchOtherKey[] = "fedcba9876543210fedcba9876543210";
+static const uint8_t ucBenchSasString[] = "contoso.azure-devices.net%2Fdevices%2Fthermostat-01\n1700000000";
+static uint8_t ucBenchTelemetry[ samplebenchTELEMETRY_SIZE ];
+/*-----------------------------------------------------------*/
+
+static void prvTimeAdd( SampleBenchTime_t * pxTime,
+                        uint64_t ullUs )
+{
+    if( ( pxTime->ulCount == 0 ) || ( ullUs < pxTime->ullMinUs ) )
+    {
+        pxTime->ullMinUs = ullUs;
+    }
+
+    if( ullUs > pxTime->ullMaxUs )
+    {
+        pxTime->ullMaxUs = ullUs;
+    }
+
+    pxTime->ullTotalUs += ullUs;
+    pxTime->ulCount++;
+}
+/*-----------------------------------------------------------*/
+
+static void prvPrintTime( const char * pcName,
+                          const SampleBenchTime_t * pxTime )
+{
+    printf( "\"%s\":{\"count\":%u,\"minUs\":%llu,\"avgUs\":%llu,\"maxUs\":%llu}",
+            pcName, ( unsigned ) pxTime->ulCount,
+            ( unsigned long long ) pxTime->ullMinUs,
+            ( unsigned long long ) ( ( pxTime->ulCount > 0 ) ? pxTime->ullTotalUs / pxTime->ulCount : 0 ),
+            ( unsigned long long ) pxTime->ullMaxUs );
+}
+/*-----------------------------------------------------------*/
+
+/* Operations per second, 0 when they took less than a tick of the clock. */
+static uint64_t prvPerSecond( uint64_t ullCount,
+                              uint64_t ullUs )
+{
+    return ( ullUs > 0 ) ? ullCount * 1000000ULL / ullUs : 0;
+}
+/*-----------------------------------------------------------*/
+
+static void prvBenchHMAC( void )
+{
+    uint8_t ucOutput[ 32 ];
+    uint32_t ulBytesCopied;
+    uint32_t ulFailures = 0;
+    uint64_t ullSameKeyUs;
+    uint64_t ullNewKeyUs;
+    uint64_t ullStart;
+    uint32_t ulIndex;
+
+    ullStart = democonfigBENCH_TIME_US();
+
+    for( ulIndex = 0; ulIndex < democonfigBENCH_HMAC_ITERATIONS; ulIndex++ )
+    {
+        ulFailures += ( Crypto_HMAC( ucBenchKey, sizeof( ucBenchKey ) - 1,
+                                     ucBenchSasString, sizeof( ucBenchSasString ) - 1,
+                                     ucOutput, sizeof( ucOutput ), &ulBytesCopied ) != 0 ) ? 1 : 0;
+    }
+
+    ullSameKeyUs = democonfigBENCH_TIME_US() - ullStart;
+    ullStart = democonfigBENCH_TIME_US();
+
+    for( ulIndex = 0; ulIndex < democonfigBENCH_HMAC_ITERATIONS; ulIndex++ )
+    {
+        ulFailures += ( Crypto_HMAC( ( ulIndex & 1U ) ? ucBenchOtherKey : ucBenchKey, sizeof( ucBenchKey ) - 1,
+                                     ucBenchSasString, sizeof( ucBenchSasString ) - 1,
+                                     ucOutput, sizeof( ucOutput ), &ulBytesCopied ) != 0 ) ? 1 : 0;
+    }
+
+    ullNewKeyUs = democonfigBENCH_TIME_US() - ullStart;
+
+    printf( "\"hmac\":{\"iterations\":%u,\"failures\":%u,\"sameKeyOpsPerSec\":%llu,\"newKeyOpsPerSec\":%llu}",
+            ( unsigned ) democonfigBENCH_HMAC_ITERATIONS, ( unsigned ) ulFailures,
+            ( unsigned long long ) prvPerSecond( democonfigBENCH_HMAC_ITERATIONS, ullSameKeyUs ),
+            ( unsigned long long ) prvPerSecond( democonfigBENCH_HMAC_ITERATIONS, ullNewKeyUs ) );
+}
+/*-----------------------------------------------------------*/
+
+/* The message of the PnP sample, with a few more readings. */
+static int32_t prvBuildTelemetry( uint32_t ulIteration )
+{
+    AzureIoTJSONWriter_t xWriter;
+    double xTemperature = 20.0 + ( double ) ( ulIteration % 100U ) / 10.0;
+
+    if( ( AzureIoTJSONWriter_Init( &xWriter, ucBenchTelemetry, sizeof( ucBenchTelemetry ) ) != eAzureIoTSuccess ) ||
+        ( AzureIoTJSONWriter_AppendBeginObject( &xWriter ) != eAzureIoTSuccess ) ||
+        ( AzureIoTJSONWriter_AppendPropertyWithDoubleValue( &xWriter, ( const uint8_t * ) "temperature", sizeof( "temperature" ) - 1,
+                                                            xTemperature, samplebenchDOUBLE_DIGITS ) != eAzureIoTSuccess ) ||
+        ( AzureIoTJSONWriter_AppendPropertyWithDoubleValue( &xWriter, ( const uint8_t * ) "humidity", sizeof( "humidity" ) - 1,
+                                                            45.25, samplebenchDOUBLE_DIGITS ) != eAzureIoTSuccess ) ||
+        ( AzureIoTJSONWriter_AppendPropertyWithDoubleValue( &xWriter, ( const uint8_t * ) "pressure", sizeof( "pressure" ) - 1,
+                                                            1013.5, samplebenchDOUBLE_DIGITS ) != eAzureIoTSuccess ) ||
+        ( AzureIoTJSONWriter_AppendPropertyWithInt32Value( &xWriter, ( const uint8_t * ) "sequence", sizeof( "sequence" ) - 1,
+                                                           ( int32_t ) ulIteration ) != eAzureIoTSuccess ) ||
+        ( AzureIoTJSONWriter_AppendPropertyWithStringValue( &xWriter, ( const uint8_t * ) "status", sizeof( "status" ) - 1,
+                                                            ( const uint8_t * ) "ok", sizeof( "ok" ) - 1 ) != eAzureIoTSuccess ) ||
+        ( AzureIoTJSONWriter_AppendEndObject( &xWriter ) != eAzureIoTSuccess ) )
+    {
+        return -1;
+    }
+
+    return AzureIoTJSONWriter_GetBytesUsed( &xWriter );
+}
+/*-----------------------------------------------------------*/
+
+static void prvBenchJSON( void )
+{
+    uint32_t ulFailures = 0;
+    int32_t lLength = 0;
+    uint64_t ullUs;
+    uint64_t ullStart;
+    uint32_t ulIndex;
+
+    ullStart = democonfigBENCH_TIME_US();
+
+    for( ulIndex = 0; ulIndex < democonfigBENCH_JSON_ITERATIONS; ulIndex++ )
+    {
+        if( ( lLength = prvBuildTelemetry( ulIndex ) ) < 0 )
+        {
+            ulFailures++;
+        }
+    }
+
+    ullUs = democonfigBENCH_TIME_US() - ullStart;
+
+    printf( "\"jsonTelemetry\":{\"iterations\":%u,\"failures\":%u,\"bytes\":%d,\"nsPerMessage\":%llu}",
+            ( unsigned ) democonfigBENCH_JSON_ITERATIONS, ( unsigned ) ulFailures, ( int ) lLength,
+            ( unsigned long long ) ( ullUs * 1000ULL / democonfigBENCH_JSON_ITERATIONS ) );
+}
+/*-----------------------------------------------------------*/
+
+static void prvBenchJWS( void )
+{
+    #if defined( democonfigBENCH_JWS_MANIFEST ) && defined( democonfigBENCH_JWS_SIGNATURE )
+        SampleBenchTime_t xDecoded = { 0 };
+        SampleBenchTime_t xStreaming = { 0 };
+        AzureIoTResult_t xDecodedResult = eAzureIoTSuccess;
+        AzureIoTResult_t xStreamingResult = eAzureIoTSuccess;
+        uint64_t ullStart;
+        uint32_t ulIndex;
+
+        for( ulIndex = 0; ulIndex < democonfigBENCH_JWS_ITERATIONS; ulIndex++ )
+        {
+            ullStart = democonfigBENCH_TIME_US();
+            xDecodedResult = AzureIoTJWS_ManifestAuthenticate( ( const uint8_t * ) democonfigBENCH_JWS_MANIFEST,
+                                                               sizeof( democonfigBENCH_JWS_MANIFEST ) - 1,
+                                                               ( uint8_t * ) democonfigBENCH_JWS_SIGNATURE,
+                                                               sizeof( democonfigBENCH_JWS_SIGNATURE ) - 1,
+                                                               &xADURootKeys[ 0 ], ulADURootKeysLength,
+                                                               ucBenchJWSScratchBuffer, sizeof( ucBenchJWSScratchBuffer ) );
+            prvTimeAdd( &xDecoded, democonfigBENCH_TIME_US() - ullStart );
+
+            ullStart = democonfigBENCH_TIME_US();
+            xStreamingResult = SampleAduJWS_ManifestAuthenticate( ( const uint8_t * ) democonfigBENCH_JWS_MANIFEST,
+                                                                  sizeof( democonfigBENCH_JWS_MANIFEST ) - 1,
+                                                                  ( const uint8_t * ) democonfigBENCH_JWS_SIGNATURE,
+                                                                  sizeof( democonfigBENCH_JWS_SIGNATURE ) - 1,
+                                                                  &xADURootKeys[ 0 ], ulADURootKeysLength );
+            prvTimeAdd( &xStreaming, democonfigBENCH_TIME_US() - ullStart );
+        }
+
+        /* A failed check returns early, so its time says nothing. */
+        printf( "\"jws\":{\"decodedResult\":%u,\"streamingResult\":%u,",
+                ( unsigned ) xDecodedResult, ( unsigned ) xStreamingResult );
+        prvPrintTime( "decoded", &xDecoded );
+        printf( "," );
+        prvPrintTime( "streaming", &xStreaming );
+        printf( "}" );
+    #else
+        printf( "\"jws\":{\"skipped\":true}" );
+    #endif /* defined( democonfigBENCH_JWS_MANIFEST ) && defined( democonfigBENCH_JWS_SIGNATURE ) */
+}
+/*-----------------------------------------------------------*/
+
+#ifdef democonfigBENCH_TLS_HOSTNAME
+
+    static TlsTransportStatus_t prvConnect( NetworkContext_t * pxNetworkContext,
+                                            TlsTransportParams_t * pxTlsTransportParams,
+                                            TransportStats_t * pxStats,
+                                            bool xResume )
+    {
+        NetworkCredentials_t xNetworkCredentials = { 0 };
+
+        xNetworkCredentials.pucRootCa = ( const uint8_t * ) democonfigBENCH_TLS_ROOT_CA_PEM;
+        xNetworkCredentials.xRootCaSize = sizeof( democonfigBENCH_TLS_ROOT_CA_PEM );
+        xNetworkCredentials.pxSessionCache = xResume ? &xBenchSessionCache : NULL;
+
+        memset( pxTlsTransportParams, 0, sizeof( *pxTlsTransportParams ) );
+        memset( pxStats, 0, sizeof( *pxStats ) );
+        pxTlsTransportParams->pxStats = pxStats;
+        pxNetworkContext->pParams = pxTlsTransportParams;
+
+        return TLS_Socket_Connect( pxNetworkContext, democonfigBENCH_TLS_HOSTNAME, democonfigBENCH_TLS_PORT,
+                                   &xNetworkCredentials, samplebenchTRANSPORT_TIMEOUT_MS, samplebenchTRANSPORT_TIMEOUT_MS );
+    }
+/*-----------------------------------------------------------*/
+
+/* The handshake time from the transport statistics, in whole milliseconds,
+ * is printed with the connect time, which includes the TCP connect. */
+    static void prvBenchHandshakes( const char * pcName,
+                                    bool xResume )
+    {
+        NetworkContext_t xNetworkContext = { 0 };
+        TlsTransportParams_t xTlsTransportParams;
+        TransportStats_t xStats;
+        SampleBenchTime_t xConnect = { 0 };
+        SampleBenchTime_t xHandshake = { 0 };
+        uint32_t ulResumed = 0;
+        uint32_t ulFailures = 0;
+        uint64_t ullStart;
+        uint32_t ulIndex;
+
+        /* The first connection saves the session the others resume. */
+        if( xResume && ( prvConnect( &xNetworkContext, &xTlsTransportParams, &xStats, true ) == eTLSTransportSuccess ) )
+        {
+            TLS_Socket_Disconnect( &xNetworkContext );
+        }
+
+        for( ulIndex = 0; ulIndex < democonfigBENCH_HANDSHAKES; ulIndex++ )
+        {
+            ullStart = democonfigBENCH_TIME_US();
+
+            if( prvConnect( &xNetworkContext, &xTlsTransportParams, &xStats, xResume ) != eTLSTransportSuccess )
+            {
+                ulFailures++;
+                continue;
+            }
+
+            prvTimeAdd( &xConnect, democonfigBENCH_TIME_US() - ullStart );
+            prvTimeAdd( &xHandshake, ( uint64_t ) xStats.ulHandshakeTimeMs * 1000U );
+            ulResumed += xStats.ulSessionResumed;
+            TLS_Socket_Disconnect( &xNetworkContext );
+        }
+
+        printf( "\"%s\":{\"failures\":%u,\"resumed\":%u,", pcName, ( unsigned ) ulFailures, ( unsigned ) ulResumed );
+        prvPrintTime( "connect", &xConnect );
+        printf( "," );
+        prvPrintTime( "handshake", &xHandshake );
+        printf( "}" );
+    }
+/*-----------------------------------------------------------*/
+
+/* Sends a record and reads it back from the server, one at a time, so the
+ * socket buffers never fill. */
+    static bool prvBenchRecordSize( NetworkContext_t * pxNetworkContext,
+                                    uint32_t ulRecordSize )
+    {
+        uint64_t ullSendUs = 0;
+        uint64_t ullRecvUs = 0;
+        uint64_t ullStart;
+        uint32_t ulRecords = democonfigBENCH_TRANSFER_SIZE / ulRecordSize;
+        uint32_t ulIndex;
+        uint32_t ulReceived;
+        int32_t lResult;
+
+        for( ulIndex = 0; ulIndex < ulRecords; ulIndex++ )
+        {
+            ullStart = democonfigBENCH_TIME_US();
+            lResult = TLS_Socket_Send( pxNetworkContext, ucBenchSendBuffer, ulRecordSize );
+            ullSendUs += democonfigBENCH_TIME_US() - ullStart;
+
+            if( lResult != ( int32_t ) ulRecordSize )
+            {
+                return false;
+            }
+
+            for( ulReceived = 0; ulReceived < ulRecordSize; ulReceived += ( uint32_t ) lResult )
+            {
+                ullStart = democonfigBENCH_TIME_US();
+                lResult = TLS_Socket_Recv( pxNetworkContext, ucBenchRecvBuffer, ulRecordSize - ulReceived );
+                ullRecvUs += democonfigBENCH_TIME_US() - ullStart;
+
+                if( lResult <= 0 )
+                {
+                    return false;
+                }
+            }
+        }
+
+        /* The receive time includes the wait for the server to send the record back. */
+        printf( "{\"recordSize\":%u,\"records\":%u,\"sendBytesPerSec\":%llu,\"recvBytesPerSec\":%llu,\"roundTripUs\":%llu}",
+                ( unsigned ) ulRecordSize, ( unsigned ) ulRecords,
+                ( unsigned long long ) prvPerSecond( ( uint64_t ) ulRecords * ulRecordSize, ullSendUs ),
+                ( unsigned long long ) prvPerSecond( ( uint64_t ) ulRecords * ulRecordSize, ullRecvUs ),
+                ( unsigned long long ) ( ( ullSendUs + ullRecvUs ) / ( ulRecords > 0 ? ulRecords : 1 ) ) );
+
+        return true;
+    }
+/*-----------------------------------------------------------*/
+
+    static void prvBenchThroughput( void )
+    {
+        NetworkContext_t xNetworkContext = { 0 };
+        TlsTransportParams_t xTlsTransportParams;
+        TransportStats_t xStats;
+        uint32_t ulIndex;
+        bool xFirst = true;
+
+        printf( "\"throughput\":[" );
+
+        if( prvConnect( &xNetworkContext, &xTlsTransportParams, &xStats, true ) == eTLSTransportSuccess )
+        {
+            for( ulIndex = 0; ulIndex < sizeof( ucBenchSendBuffer ); ulIndex++ )
+            {
+                ucBenchSendBuffer[ ulIndex ] = ( uint8_t ) ( ulIndex * 2654435761UL >> 24 );
+            }
+
+            for( ulIndex = 0; ulIndex < sizeof( ulBenchRecordSizes ) / sizeof( ulBenchRecordSizes[ 0 ] ); ulIndex++ )
+            {
+                if( ( ulBenchRecordSizes[ ulIndex ] == 0 ) || ( ulBenchRecordSizes[ ulIndex ] > sizeof( ucBenchSendBuffer ) ) )
+                {
+                    continue;
+                }
+
+                printf( xFirst ? "" : "," );
+                xFirst = false;
+
+                if( !prvBenchRecordSize( &xNetworkContext, ulBenchRecordSizes[ ulIndex ] ) )
+                {
+                    printf( "{\"recordSize\":%u,\"failed\":true}", ( unsigned ) ulBenchRecordSizes[ ulIndex ] );
+                    break;
+                }
+            }
+
+            TLS_Socket_Disconnect( &xNetworkContext );
+        }
+
+        printf( "]" );
+    }
+/*-----------------------------------------------------------*/
+
+#endif /* democonfigBENCH_TLS_HOSTNAME */
+
+static void prvBenchTLS( void )
+{
+    #ifdef democonfigBENCH_TLS_HOSTNAME
+        printf( "\"tls\":{" );
+        prvBenchHandshakes( "fullHandshake", false );
+        printf( "," );
+        prvBenchHandshakes( "resumedHandshake", true );
+        printf( "," );
+        prvBenchThroughput();
+        printf( "}" );
+
+        TLS_Socket_SessionCacheClear( &xBenchSessionCache );
+    #else
+        printf( "\"tls\":{\"skipped\":true}" );
+    #endif /* democonfigBENCH_TLS_HOSTNAME */
+}
+/*-----------------------------------------------------------*/
+
+static void prvBenchTask( void * pvParameters )
+{
+    ( void ) pvParameters;
+
+    if( Crypto_Init() != 0 )
+    {
+        LogError( ( "[Bench] Crypto_Init failed" ) );
+        democonfigBENCH_DONE();
+        return;
+    }
+
+    printf( "{" );
+    prvBenchHMAC();
+    printf( "," );
+    prvBenchJSON();
+    printf( "," );
+    prvBenchJWS();
+    printf( "," );
+    prvBenchTLS();
+    printf( "}\n" );
+    fflush( stdout );
+
+    democonfigBENCH_DONE();
+}
+/*-----------------------------------------------------------*/
+
+/*
+ * @brief Create the task that runs the benchmarks.
+ */
+void vStartDemoTask( void )
+{
+    /* This example uses a single application task, which runs the benchmarks once. */
+    xTaskCreate( prvBenchTask,              /* Function that implements the task. */
+                 "BenchTask",               /* Text name for the task - only used for debugging. */
+                 democonfigDEMO_STACKSIZE,  /* Size of stack (in words, not bytes) to allocate for the task. */
+                 NULL,                      /* Task parameter - not used in this case. */
+                 tskIDLE_PRIORITY,          /* Task priority, must be between 0 and configMAX_PRIORITIES - 1. */
+                 NULL );                    /* Used to pass out a handle to the created task - not used in this case. */
+}
+/*-----------------------------------------------------------*/
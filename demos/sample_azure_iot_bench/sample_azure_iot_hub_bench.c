@@ -0,0 +1,302 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @file sample_azure_iot_hub_bench.c
+ * @brief CPU cost of the hub client, over the loopback transport.
+ *
+ * The client connects to the scripted broker of transport_loopback.h, which
+ * answers at once, so no network or TLS time is part of what is measured:
+ * - AzureIoTHubClient_SendTelemetry() and PreparedTelemetry_Send() of a QoS 1
+ *   message, each followed by the AzureIoTHubClient_ProcessLoop() receiving
+ *   its PUBACK, timed separately. The two only differ with
+ *   democonfigPREPARED_TELEMETRY_DIRECT set to 1.
+ * - AzureIoTHubClient_ProcessLoop() with nothing to receive.
+ * - Sends and process loops back to back, as the maximum message rate.
+ *
+ * The results are printed to stdout as one JSON object, times being in
+ * nanoseconds per call, from democonfigBENCH_TIME_US().
+ */
+
+/* Standard includes. */
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Kernel includes. */
+#include "FreeRTOS.h"
+#include "task.h"
+
+/* Demo Specific configs. */
+#include "demo_config.h"
+
+/* Azure IoT Hub library includes */
+#include "azure_iot_hub_client.h"
+
+/* Transport interface implementation include header for the loopback broker. */
+#include "transport_loopback.h"
+
+/* Telemetry sends with the topic rendered once. */
+#include "azure_sample_prepared_telemetry.h"
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Messages sent by each run.
+ */
+#ifndef democonfigHUB_BENCH_MESSAGES
+    #define democonfigHUB_BENCH_MESSAGES    ( 10000U )
+#endif
+
+/**
+ * @brief Size of the telemetry payload.
+ */
+#ifndef democonfigHUB_BENCH_PAYLOAD_SIZE
+    #define democonfigHUB_BENCH_PAYLOAD_SIZE    ( 128U )
+#endif
+
+/**
+ * @brief Microsecond clock used for the measurements.
+ * Defaults to the tick count, so runs shorter than a tick read as 0.
+ */
+#ifndef democonfigBENCH_TIME_US
+    #define democonfigBENCH_TIME_US()    ( ( uint64_t ) xTaskGetTickCount() * 1000000ULL / configTICK_RATE_HZ )
+#endif
+
+/**
+ * @brief Called once the results are printed.
+ */
+#ifndef democonfigBENCH_DONE
+    #define democonfigBENCH_DONE()    vTaskDelete( NULL )
+#endif
+
+#define samplehubbenchHOSTNAME                "loopback.azure-devices.net"
+#define samplehubbenchDEVICE_ID               "bench-device"
+#define samplehubbenchCONNACK_RECV_TIMEOUT_MS ( 1000U )
+#define samplehubbenchSUBSCRIBE_TIMEOUT_MS    ( 1000U )
+
+typedef enum SampleHubBenchSend
+{
+    eSampleHubBenchSendTelemetry = 0,
+    eSampleHubBenchPreparedTelemetry
+} SampleHubBenchSend_t;
+/*-----------------------------------------------------------*/
+
+/* Each compilation unit must define the NetworkContext struct. */
+struct NetworkContext
+{
+    void * pParams;
+};
+/*-----------------------------------------------------------*/
+
+static AzureIoTHubClient_t xAzureIoTHubClient;
+static PreparedTelemetry_t xPreparedTelemetry;
+static LoopbackTransportParams_t xLoopbackTransportParams;
+static AzureIoTMessageProperties_t xPropertyBag;
+static uint8_t ucMQTTMessageBuffer[ democonfigNETWORK_BUFFER_SIZE ];
+static uint8_t ucPropertyBuffer[ 32 ];
+static uint8_t ucPayload[ democonfigHUB_BENCH_PAYLOAD_SIZE ];
+static uint32_t ulAcknowledged;
+
+uint64_t ullGetUnixTime( void );
+/*-----------------------------------------------------------*/
+
+static void prvTelemetryAckCallback( uint16_t usPacketID )
+{
+    ( void ) usPacketID;
+
+    ulAcknowledged++;
+}
+/*-----------------------------------------------------------*/
+
+static void prvHandlePropertiesMessage( AzureIoTHubClientPropertiesResponse_t * pxMessage,
+                                        void * pvContext )
+{
+    ( void ) pxMessage;
+    ( void ) pvContext;
+}
+/*-----------------------------------------------------------*/
+
+static AzureIoTResult_t prvSend( SampleHubBenchSend_t xSend )
+{
+    uint16_t usPacketID;
+
+    if( xSend == eSampleHubBenchPreparedTelemetry )
+    {
+        return PreparedTelemetry_Send( &xPreparedTelemetry, ucPayload, sizeof( ucPayload ),
+                                       eAzureIoTHubMessageQoS1, &usPacketID );
+    }
+
+    return AzureIoTHubClient_SendTelemetry( &xAzureIoTHubClient, ucPayload, sizeof( ucPayload ),
+                                            &xPropertyBag, eAzureIoTHubMessageQoS1, &usPacketID );
+}
+/*-----------------------------------------------------------*/
+
+static void prvBenchSend( const char * pcName,
+                          SampleHubBenchSend_t xSend )
+{
+    uint64_t ullSendUs = 0;
+    uint64_t ullLoopUs = 0;
+    uint64_t ullStart;
+    uint64_t ullSent;
+    uint32_t ulFailures = 0;
+    uint32_t ulIndex;
+
+    ulAcknowledged = 0;
+
+    for( ulIndex = 0; ulIndex < democonfigHUB_BENCH_MESSAGES; ulIndex++ )
+    {
+        ullStart = democonfigBENCH_TIME_US();
+        ulFailures += ( prvSend( xSend ) != eAzureIoTSuccess ) ? 1 : 0;
+        ullSent = democonfigBENCH_TIME_US();
+        ulFailures += ( AzureIoTHubClient_ProcessLoop( &xAzureIoTHubClient, 0 ) != eAzureIoTSuccess ) ? 1 : 0;
+        ullLoopUs += democonfigBENCH_TIME_US() - ullSent;
+        ullSendUs += ullSent - ullStart;
+    }
+
+    printf( "\"%s\":{\"messages\":%u,\"acknowledged\":%u,\"failures\":%u,\"nsPerSend\":%llu,\"nsPerProcessLoop\":%llu}",
+            pcName, ( unsigned ) democonfigHUB_BENCH_MESSAGES, ( unsigned ) ulAcknowledged, ( unsigned ) ulFailures,
+            ( unsigned long long ) ( ullSendUs * 1000ULL / democonfigHUB_BENCH_MESSAGES ),
+            ( unsigned long long ) ( ullLoopUs * 1000ULL / democonfigHUB_BENCH_MESSAGES ) );
+}
+/*-----------------------------------------------------------*/
+
+static void prvBenchIdleProcessLoop( void )
+{
+    uint64_t ullStart;
+    uint64_t ullUs;
+    uint32_t ulFailures = 0;
+    uint32_t ulIndex;
+
+    ullStart = democonfigBENCH_TIME_US();
+
+    for( ulIndex = 0; ulIndex < democonfigHUB_BENCH_MESSAGES; ulIndex++ )
+    {
+        ulFailures += ( AzureIoTHubClient_ProcessLoop( &xAzureIoTHubClient, 0 ) != eAzureIoTSuccess ) ? 1 : 0;
+    }
+
+    ullUs = democonfigBENCH_TIME_US() - ullStart;
+
+    printf( "\"idleProcessLoop\":{\"calls\":%u,\"failures\":%u,\"nsPerProcessLoop\":%llu}",
+            ( unsigned ) democonfigHUB_BENCH_MESSAGES, ( unsigned ) ulFailures,
+            ( unsigned long long ) ( ullUs * 1000ULL / democonfigHUB_BENCH_MESSAGES ) );
+}
+/*-----------------------------------------------------------*/
+
+static void prvBenchMaxRate( void )
+{
+    uint64_t ullStart;
+    uint64_t ullUs;
+    uint32_t ulFailures = 0;
+    uint32_t ulIndex;
+
+    ulAcknowledged = 0;
+    ullStart = democonfigBENCH_TIME_US();
+
+    for( ulIndex = 0; ulIndex < democonfigHUB_BENCH_MESSAGES; ulIndex++ )
+    {
+        ulFailures += ( prvSend( eSampleHubBenchSendTelemetry ) != eAzureIoTSuccess ) ? 1 : 0;
+        ulFailures += ( AzureIoTHubClient_ProcessLoop( &xAzureIoTHubClient, 0 ) != eAzureIoTSuccess ) ? 1 : 0;
+    }
+
+    ullUs = democonfigBENCH_TIME_US() - ullStart;
+
+    printf( "\"maxRate\":{\"messages\":%u,\"acknowledged\":%u,\"failures\":%u,\"messagesPerSec\":%llu,\"payloadBytes\":%u}",
+            ( unsigned ) democonfigHUB_BENCH_MESSAGES, ( unsigned ) ulAcknowledged, ( unsigned ) ulFailures,
+            ( unsigned long long ) ( ( ullUs > 0 ) ? democonfigHUB_BENCH_MESSAGES * 1000000ULL / ullUs : 0 ),
+            ( unsigned ) ( democonfigHUB_BENCH_MESSAGES * sizeof( ucPayload ) ) );
+}
+/*-----------------------------------------------------------*/
+
+static void prvHubBenchTask( void * pvParameters )
+{
+    NetworkContext_t xNetworkContext = { 0 };
+    AzureIoTTransportInterface_t xTransport;
+    AzureIoTHubClientOptions_t xHubOptions = { 0 };
+    AzureIoTResult_t xResult;
+    bool xSessionPresent;
+    uint32_t ulIndex;
+
+    ( void ) pvParameters;
+
+    /* Initialize Azure IoT Middleware.  */
+    configASSERT( AzureIoT_Init() == eAzureIoTSuccess );
+
+    for( ulIndex = 0; ulIndex < sizeof( ucPayload ); ulIndex++ )
+    {
+        ucPayload[ ulIndex ] = ( uint8_t ) ( 'a' + ulIndex % 26U );
+    }
+
+    xNetworkContext.pParams = &xLoopbackTransportParams;
+    Loopback_Connect( &xNetworkContext );
+
+    xTransport.pxNetworkContext = &xNetworkContext;
+    xTransport.xSend = Loopback_Send;
+    xTransport.xRecv = Loopback_Recv;
+
+    xResult = AzureIoTHubClient_OptionsInit( &xHubOptions );
+    configASSERT( xResult == eAzureIoTSuccess );
+
+    xHubOptions.xTelemetryCallback = prvTelemetryAckCallback;
+
+    xResult = AzureIoTHubClient_Init( &xAzureIoTHubClient,
+                                      ( const uint8_t * ) samplehubbenchHOSTNAME, sizeof( samplehubbenchHOSTNAME ) - 1,
+                                      ( const uint8_t * ) samplehubbenchDEVICE_ID, sizeof( samplehubbenchDEVICE_ID ) - 1,
+                                      &xHubOptions,
+                                      ucMQTTMessageBuffer, sizeof( ucMQTTMessageBuffer ),
+                                      ullGetUnixTime,
+                                      &xTransport );
+    configASSERT( xResult == eAzureIoTSuccess );
+
+    xResult = AzureIoTHubClient_Connect( &xAzureIoTHubClient, false, &xSessionPresent,
+                                         samplehubbenchCONNACK_RECV_TIMEOUT_MS );
+    configASSERT( xResult == eAzureIoTSuccess );
+
+    /* Check that the broker answers subscribes, as the samples make them. */
+    xResult = AzureIoTHubClient_SubscribeProperties( &xAzureIoTHubClient, prvHandlePropertiesMessage, NULL,
+                                                     samplehubbenchSUBSCRIBE_TIMEOUT_MS );
+    configASSERT( xResult == eAzureIoTSuccess );
+
+    /* The same properties as the hub sample, so the topics are alike. */
+    xResult = AzureIoTMessage_PropertiesInit( &xPropertyBag, ucPropertyBuffer, 0, sizeof( ucPropertyBuffer ) );
+    configASSERT( xResult == eAzureIoTSuccess );
+
+    xResult = AzureIoTMessage_PropertiesAppend( &xPropertyBag, ( uint8_t * ) "name", sizeof( "name" ) - 1,
+                                                ( uint8_t * ) "value", sizeof( "value" ) - 1 );
+    configASSERT( xResult == eAzureIoTSuccess );
+
+    xResult = PreparedTelemetry_Init( &xPreparedTelemetry, &xAzureIoTHubClient, &xPropertyBag );
+    configASSERT( xResult == eAzureIoTSuccess );
+
+    printf( "{\"payloadSize\":%u,", ( unsigned ) sizeof( ucPayload ) );
+    prvBenchSend( "sendTelemetry", eSampleHubBenchSendTelemetry );
+    printf( "," );
+    prvBenchSend( "preparedTelemetry", eSampleHubBenchPreparedTelemetry );
+    printf( "," );
+    prvBenchIdleProcessLoop();
+    printf( "," );
+    prvBenchMaxRate();
+    printf( ",\"brokerPublishes\":%u}\n", ( unsigned ) xLoopbackTransportParams.ulPublishCount );
+    fflush( stdout );
+
+    ( void ) AzureIoTHubClient_Disconnect( &xAzureIoTHubClient );
+    Loopback_Disconnect( &xNetworkContext );
+
+    democonfigBENCH_DONE();
+}
+/*-----------------------------------------------------------*/
+
+/*
+ * @brief Create the task that runs the benchmarks.
+ */
+void vStartDemoTask( void )
+{
+    /* This example uses a single application task, which runs the benchmarks once. */
+    xTaskCreate( prvHubBenchTask,           /* Function that implements the task. */
+                 "HubBenchTask",            /* Text name for the task - only used for debugging. */
+                 democonfigDEMO_STACKSIZE,  /* Size of stack (in words, not bytes) to allocate for the task. */
+                 NULL,                      /* Task parameter - not used in this case. */
+                 tskIDLE_PRIORITY,          /* Task priority, must be between 0 and configMAX_PRIORITIES - 1. */
+                 NULL );                    /* Used to pass out a handle to the created task - not used in this case. */
+}
+/*-----------------------------------------------------------*/
@@ -0,0 +1,306 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @file sample_azure_iot_flash_bench.c
+ * @brief Throughput benchmark for the AzureIoTPlatform_* flash ports.
+ *
+ * For each block size in democonfigFLASH_BENCH_BLOCK_SIZES, a synthetic image
+ * of democonfigFLASH_BENCH_IMAGE_SIZE bytes is written to the update partition
+ * the way the ADU sample writes a download: AzureIoTPlatform_Init(), then
+ * AzureIoTPlatform_WriteBlock() for each block in order, then
+ * AzureIoTPlatform_VerifyImage() against the SHA256 of the image. The time of
+ * each step, the write throughput and the per call write latency are logged,
+ * to choose democonfigCHUNK_DOWNLOAD_SIZE for a board from measurements.
+ *
+ * The image is never enabled, so the running image and the boot bank are
+ * left alone.
+ */
+
+/* Standard includes. */
+#include <string.h>
+#include <stdio.h>
+
+/* Kernel includes. */
+#include "FreeRTOS.h"
+#include "task.h"
+
+/* Demo Specific configs. */
+#include "demo_config.h"
+
+/* Task creation, pinned to a core where configured. */
+#include "azure_sample_task.h"
+
+/* Azure flash platform includes. */
+#include "azure_iot_flash_platform.h"
+
+/* mbed TLS includes. */
+#include "mbedtls/base64.h"
+#include "mbedtls/md.h"
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Size of the synthetic image written for each block size.
+ * Capped at the size of the update bank.
+ */
+#ifndef democonfigFLASH_BENCH_IMAGE_SIZE
+    #define democonfigFLASH_BENCH_IMAGE_SIZE    ( 128 * 1024 )
+#endif
+
+/**
+ * @brief Block sizes passed to AzureIoTPlatform_WriteBlock(), in the order they are measured.
+ */
+#ifndef democonfigFLASH_BENCH_BLOCK_SIZES
+    #define democonfigFLASH_BENCH_BLOCK_SIZES    { 256, 512, 1024, 2048, 4096 }
+#endif
+
+/**
+ * @brief Largest entry of democonfigFLASH_BENCH_BLOCK_SIZES, which sizes the block buffer.
+ */
+#ifndef democonfigFLASH_BENCH_MAX_BLOCK_SIZE
+    #define democonfigFLASH_BENCH_MAX_BLOCK_SIZE    4096
+#endif
+
+/**
+ * @brief Microsecond clock used for the measurements.
+ * Defaults to the tick count, so single calls shorter than a tick read as 0.
+ */
+#ifndef democonfigFLASH_BENCH_TIME_US
+    #define democonfigFLASH_BENCH_TIME_US()    ( ( uint64_t ) xTaskGetTickCount() * 1000000ULL / configTICK_RATE_HZ )
+#endif
+
+/**
+ * @brief Called once the results are logged.
+ */
+#ifndef democonfigFLASH_BENCH_DONE
+    #define democonfigFLASH_BENCH_DONE()    vTaskDelete( NULL )
+#endif
+
+#define sampleflashbenchSHA256_SIZE           32
+#define sampleflashbenchSHA256_BASE64_SIZE    45
+/*-----------------------------------------------------------*/
+
+typedef struct SampleFlashBenchResult
+{
+    uint32_t ulBlockSize;
+    uint32_t ulImageSize;
+    uint64_t ullInitUs;
+    uint64_t ullWriteUs;
+    uint64_t ullMaxWriteUs;
+    uint32_t ulWriteCount;
+    uint64_t ullVerifyUs;
+    AzureIoTResult_t xResult;
+} SampleFlashBenchResult_t;
+/*-----------------------------------------------------------*/
+
+static const uint32_t ulBenchBlockSizes[] = democonfigFLASH_BENCH_BLOCK_SIZES;
+static uint8_t ucBenchBlock[ democonfigFLASH_BENCH_MAX_BLOCK_SIZE ];
+static SampleFlashBenchResult_t xBenchResults[ sizeof( ulBenchBlockSizes ) / sizeof( ulBenchBlockSizes[ 0 ] ) ];
+static AzureADUImage_t xBenchImage;
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Fill a block with data that depends on its offset, so the image is
+ * not all one value and every block size writes the same image.
+ */
+static void prvFillBlock( uint32_t ulOffset,
+                          uint8_t * pucBlock,
+                          uint32_t ulLength )
+{
+    for( uint32_t ulIndex = 0; ulIndex < ulLength; ulIndex++ )
+    {
+        uint32_t ulValue = ( ulOffset + ulIndex ) * 2654435761UL;
+
+        pucBlock[ ulIndex ] = ( uint8_t ) ( ulValue >> 24 );
+    }
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Base64 SHA256 of the synthetic image, as the update manifest would carry it.
+ */
+static void prvImageHash( uint32_t ulImageSize,
+                          uint8_t * pucHash,
+                          size_t * pxHashLength )
+{
+    mbedtls_md_context_t xContext;
+    uint8_t ucHash[ sampleflashbenchSHA256_SIZE ];
+
+    mbedtls_md_init( &xContext );
+    mbedtls_md_setup( &xContext, mbedtls_md_info_from_type( MBEDTLS_MD_SHA256 ), 0 );
+    mbedtls_md_starts( &xContext );
+
+    for( uint32_t ulOffset = 0; ulOffset < ulImageSize; ulOffset += sizeof( ucBenchBlock ) )
+    {
+        uint32_t ulLength = ulImageSize - ulOffset;
+
+        if( ulLength > sizeof( ucBenchBlock ) )
+        {
+            ulLength = sizeof( ucBenchBlock );
+        }
+
+        prvFillBlock( ulOffset, ucBenchBlock, ulLength );
+        mbedtls_md_update( &xContext, ucBenchBlock, ulLength );
+    }
+
+    mbedtls_md_finish( &xContext, ucHash );
+    mbedtls_md_free( &xContext );
+
+    mbedtls_base64_encode( pucHash, sampleflashbenchSHA256_BASE64_SIZE, pxHashLength, ucHash, sizeof( ucHash ) );
+}
+/*-----------------------------------------------------------*/
+
+static void prvRunBenchmark( uint32_t ulBlockSize,
+                             uint32_t ulImageSize,
+                             const uint8_t * pucHash,
+                             size_t xHashLength,
+                             SampleFlashBenchResult_t * pxResult )
+{
+    uint64_t ullStart;
+    uint64_t ullCallStart;
+    uint64_t ullCallTime;
+
+    memset( pxResult, 0, sizeof( *pxResult ) );
+    pxResult->ulBlockSize = ulBlockSize;
+    pxResult->ulImageSize = ulImageSize;
+
+    ullStart = democonfigFLASH_BENCH_TIME_US();
+    pxResult->xResult = AzureIoTPlatform_Init( &xBenchImage );
+    pxResult->ullInitUs = democonfigFLASH_BENCH_TIME_US() - ullStart;
+
+    if( pxResult->xResult != eAzureIoTSuccess )
+    {
+        LogError( ( "[FlashBench] AzureIoTPlatform_Init failed: result 0x%08x", pxResult->xResult ) );
+        return;
+    }
+
+    xBenchImage.ulImageFileSize = ulImageSize;
+
+    for( uint32_t ulOffset = 0; ulOffset < ulImageSize; ulOffset += ulBlockSize )
+    {
+        uint32_t ulLength = ulImageSize - ulOffset;
+
+        if( ulLength > ulBlockSize )
+        {
+            ulLength = ulBlockSize;
+        }
+
+        /* Filling the block is kept out of the measured time. */
+        prvFillBlock( ulOffset, ucBenchBlock, ulLength );
+
+        ullCallStart = democonfigFLASH_BENCH_TIME_US();
+        pxResult->xResult = AzureIoTPlatform_WriteBlock( &xBenchImage, ulOffset, ucBenchBlock, ulLength );
+        ullCallTime = democonfigFLASH_BENCH_TIME_US() - ullCallStart;
+
+        if( pxResult->xResult != eAzureIoTSuccess )
+        {
+            LogError( ( "[FlashBench] AzureIoTPlatform_WriteBlock failed at offset %u: result 0x%08x",
+                        ( unsigned int ) ulOffset, pxResult->xResult ) );
+            return;
+        }
+
+        xBenchImage.ulCurrentOffset = ulOffset + ulLength;
+        pxResult->ullWriteUs += ullCallTime;
+        pxResult->ulWriteCount++;
+
+        if( ullCallTime > pxResult->ullMaxWriteUs )
+        {
+            pxResult->ullMaxWriteUs = ullCallTime;
+        }
+    }
+
+    ullStart = democonfigFLASH_BENCH_TIME_US();
+    pxResult->xResult = AzureIoTPlatform_VerifyImage( &xBenchImage, ( uint8_t * ) pucHash, ( uint32_t ) xHashLength );
+    pxResult->ullVerifyUs = democonfigFLASH_BENCH_TIME_US() - ullStart;
+
+    if( pxResult->xResult != eAzureIoTSuccess )
+    {
+        LogError( ( "[FlashBench] AzureIoTPlatform_VerifyImage failed: result 0x%08x", pxResult->xResult ) );
+    }
+}
+/*-----------------------------------------------------------*/
+
+static void prvLogResult( const SampleFlashBenchResult_t * pxResult )
+{
+    /* Bytes per microsecond is MB/s; kept in thousandths to print without floats. */
+    uint32_t ulMilliMBps = 0;
+    uint32_t ulAverageUs = 0;
+
+    if( pxResult->ullWriteUs > 0 )
+    {
+        ulMilliMBps = ( uint32_t ) ( ( uint64_t ) pxResult->ulImageSize * 1000ULL / pxResult->ullWriteUs );
+    }
+
+    if( pxResult->ulWriteCount > 0 )
+    {
+        ulAverageUs = ( uint32_t ) ( pxResult->ullWriteUs / pxResult->ulWriteCount );
+    }
+
+    LogInfo( ( "[FlashBench] block %5u: %s, init %u ms, write %u ms (%u.%03u MB/s), "
+               "per call avg %u us max %u us, verify %u ms",
+               ( unsigned int ) pxResult->ulBlockSize,
+               pxResult->xResult == eAzureIoTSuccess ? "ok" : "FAILED",
+               ( unsigned int ) ( pxResult->ullInitUs / 1000 ),
+               ( unsigned int ) ( pxResult->ullWriteUs / 1000 ),
+               ( unsigned int ) ( ulMilliMBps / 1000 ),
+               ( unsigned int ) ( ulMilliMBps % 1000 ),
+               ( unsigned int ) ulAverageUs,
+               ( unsigned int ) pxResult->ullMaxWriteUs,
+               ( unsigned int ) ( pxResult->ullVerifyUs / 1000 ) ) );
+}
+/*-----------------------------------------------------------*/
+
+static void prvFlashBenchTask( void * pvParameters )
+{
+    uint8_t ucHash[ sampleflashbenchSHA256_BASE64_SIZE ];
+    size_t xHashLength = 0;
+    uint32_t ulImageSize = democonfigFLASH_BENCH_IMAGE_SIZE;
+    int64_t llBankSize = AzureIoTPlatform_GetSingleFlashBootBankSize();
+
+    ( void ) pvParameters;
+
+    if( ( llBankSize > 0 ) && ( ( int64_t ) ulImageSize > llBankSize ) )
+    {
+        ulImageSize = ( uint32_t ) llBankSize;
+    }
+
+    LogInfo( ( "[FlashBench] Writing %u byte images, update bank is %d bytes",
+               ( unsigned int ) ulImageSize, ( int ) llBankSize ) );
+
+    prvImageHash( ulImageSize, ucHash, &xHashLength );
+
+    for( uint32_t ulIndex = 0; ulIndex < sizeof( ulBenchBlockSizes ) / sizeof( ulBenchBlockSizes[ 0 ] ); ulIndex++ )
+    {
+        if( ( ulBenchBlockSizes[ ulIndex ] == 0 ) || ( ulBenchBlockSizes[ ulIndex ] > sizeof( ucBenchBlock ) ) )
+        {
+            LogError( ( "[FlashBench] Skipping block size %u, the buffer holds %u bytes",
+                        ( unsigned int ) ulBenchBlockSizes[ ulIndex ], ( unsigned int ) sizeof( ucBenchBlock ) ) );
+            continue;
+        }
+
+        prvRunBenchmark( ulBenchBlockSizes[ ulIndex ], ulImageSize, ucHash, xHashLength, &xBenchResults[ ulIndex ] );
+        prvLogResult( &xBenchResults[ ulIndex ] );
+    }
+
+    LogInfo( ( "[FlashBench] Done" ) );
+
+    democonfigFLASH_BENCH_DONE();
+}
+/*-----------------------------------------------------------*/
+
+/*
+ * @brief Create the task that runs the flash benchmark.
+ */
+void vStartDemoTask( void )
+{
+    /* This example uses a single application task, which runs the benchmark once. */
+    sampletaskCREATE( prvFlashBenchTask,         /* Function that implements the task. */
+                      "FlashBenchTask",          /* Text name for the task - only used for debugging. */
+                      democonfigDEMO_STACKSIZE,  /* Size of stack (in words, not bytes) to allocate for the task. */
+                      NULL,                      /* Task parameter - not used in this case. */
+                      tskIDLE_PRIORITY,          /* Task priority, must be between 0 and configMAX_PRIORITIES - 1. */
+                      NULL,                      /* Used to pass out a handle to the created task - not used in this case. */
+                      democonfigDEMO_TASK_CORE ); /* Core the task is pinned to, if democonfigPIN_TASKS_TO_CORE is defined. */
+}
+/*-----------------------------------------------------------*/
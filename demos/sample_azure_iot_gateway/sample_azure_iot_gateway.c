@@ -0,0 +1,456 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @file sample_azure_iot_gateway.c
+ * @brief Gateway connecting the IoT Hub identities of its leaf devices.
+ *
+ * Each leaf device has its own identity, and so its own hub client, MQTT
+ * session and TLS connection, but everything else is shared: one network task
+ * services all the connections, and they are all made with the same network
+ * credentials, so they share one TLS configuration, parsed root CA and
+ * session cache, and the random number generator of azure_sample_crypto.h.
+ * What a leaf device adds is its MQTT buffer, of
+ * democonfigGATEWAY_NETWORK_BUFFER_SIZE, its hub client, and the TLS session
+ * and record buffers of its connection.
+ *
+ * The network task connects the leaf devices one after the other, then polls
+ * their connections, and runs the process loop of a leaf device only once it
+ * has data to read or its keep alive is due. Connecting a leaf device blocks
+ * the others until its CONNACK.
+ *
+ * Device IDs are generated from democonfigGATEWAY_DEVICE_ID_FORMAT and their
+ * keys are derived from democonfigGATEWAY_GROUP_SYMMETRIC_KEY the way a DPS
+ * group enrollment derives them, so the devices can be created in the hub up
+ * front with the same derived keys.
+ */
+
+/* Standard includes. */
+#include <string.h>
+#include <stdio.h>
+
+/* Kernel includes. */
+#include "FreeRTOS.h"
+#include "task.h"
+
+/* Demo Specific configs. */
+#include "demo_config.h"
+
+/* Azure IoT Hub library includes */
+#include "azure_iot_hub_client.h"
+
+/* Transport interface implementation include header for TLS. */
+#include "transport_tls_socket.h"
+
+/* Crypto helper header. */
+#include "azure_sample_crypto.h"
+
+/* Task creation, pinned to a core where configured. */
+#include "azure_sample_task.h"
+
+/* mbed TLS includes. */
+#include "mbedtls/base64.h"
+
+/*-----------------------------------------------------------*/
+
+/* Compile time error for undefined configs. */
+#ifndef democonfigHOSTNAME
+    #error "Define the config democonfigHOSTNAME by following the instructions in file demo_config.h."
+#endif
+
+#ifndef democonfigROOT_CA_PEM
+    #error "Please define Root CA certificate of the IoT Hub(democonfigROOT_CA_PEM) in demo_config.h."
+#endif
+
+#ifndef democonfigGATEWAY_GROUP_SYMMETRIC_KEY
+    #error "Please define the key the leaf device keys are derived from (democonfigGATEWAY_GROUP_SYMMETRIC_KEY) in demo_config.h."
+#endif
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Number of leaf devices.
+ */
+#ifndef democonfigGATEWAY_IDENTITY_COUNT
+    #define democonfigGATEWAY_IDENTITY_COUNT    ( 8U )
+#endif
+
+/**
+ * @brief printf format of the leaf device IDs, given the device number.
+ */
+#ifndef democonfigGATEWAY_DEVICE_ID_FORMAT
+    #define democonfigGATEWAY_DEVICE_ID_FORMAT    "leafdevice-%02u"
+#endif
+
+/**
+ * @brief Size of the MQTT buffer of each leaf device.
+ */
+#ifndef democonfigGATEWAY_NETWORK_BUFFER_SIZE
+    #define democonfigGATEWAY_NETWORK_BUFFER_SIZE    democonfigNETWORK_BUFFER_SIZE
+#endif
+
+/**
+ * @brief Time between telemetry messages of each leaf device, in milliseconds.
+ */
+#ifndef democonfigGATEWAY_TELEMETRY_INTERVAL_MS
+    #define democonfigGATEWAY_TELEMETRY_INTERVAL_MS    ( 5000U )
+#endif
+
+/**
+ * @brief Time between two polls of the connections, in milliseconds.
+ */
+#ifndef democonfigGATEWAY_POLL_INTERVAL_MS
+    #define democonfigGATEWAY_POLL_INTERVAL_MS    ( 20U )
+#endif
+
+/**
+ * @brief Longest time the process loop of a leaf device is not run, in
+ * milliseconds, so that its keep alive goes out even when it receives nothing.
+ */
+#define sampleazureiotgatewayKEEP_ALIVE_SERVICE_MS    ( 1000U )
+
+/**
+ * @brief Delay before a leaf device reconnects after losing its connection.
+ */
+#define sampleazureiotgatewayRECONNECT_DELAY_MS       ( 5000U )
+
+/**
+ * @brief Timeout for receiving CONNACK packet in milliseconds.
+ */
+#define sampleazureiotCONNACK_RECV_TIMEOUT_MS         ( 10 * 1000U )
+
+/**
+ * @brief Transport receive timeout in milliseconds. It is short, as the
+ * process loop of a leaf device with nothing to read holds up the others for
+ * as long.
+ */
+#define sampleazureiotgatewayRECV_TIMEOUT_MS          ( 100U )
+
+/**
+ * @brief Transport send timeout in milliseconds.
+ */
+#define sampleazureiotgatewaySEND_TIMEOUT_MS          ( 2000U )
+
+/**
+ * @brief The Telemetry message published by each leaf device.
+ */
+#define sampleazureiotgatewayMESSAGE                  "{\"leaf\":%u,\"seq\":%u}"
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Unix time.
+ *
+ * @return Time in milliseconds.
+ */
+uint64_t ullGetUnixTime( void );
+/*-----------------------------------------------------------*/
+
+/* Each compilation unit must define the NetworkContext struct. */
+struct NetworkContext
+{
+    void * pParams;
+};
+
+/**
+ * @brief What a leaf device holds on its own.
+ */
+typedef struct GatewayIdentity
+{
+    uint32_t ulNumber;
+    uint8_t ucDeviceId[ 64 ];
+    uint32_t ulDeviceIdLength;
+    uint8_t ucDeviceKey[ 64 ];
+    uint32_t ulDeviceKeyLength;
+    BaseType_t xConnected;
+    TickType_t xNextConnect;   /* Tick count of the next connect attempt, when not connected. */
+    TickType_t xNextTelemetry; /* Tick count of the next telemetry message, when connected. */
+    TickType_t xLastServiced;  /* Tick count of the last process loop. */
+    uint32_t ulSequence;
+    AzureIoTHubClient_t xHubClient;
+    NetworkContext_t xNetworkContext;
+    TlsTransportParams_t xTlsTransportParams;
+    AzureIoTTransportInterface_t xTransport;
+    uint8_t ucMQTTMessageBuffer[ democonfigGATEWAY_NETWORK_BUFFER_SIZE ];
+} GatewayIdentity_t;
+/*-----------------------------------------------------------*/
+
+static GatewayIdentity_t xGatewayIdentities[ democonfigGATEWAY_IDENTITY_COUNT ];
+
+/* The credentials of every connection, and what they share. */
+static NetworkCredentials_t xNetworkCredentials;
+static TlsSharedConfig_t xSharedConfig;
+static TlsSessionCache_t xSessionCache;
+
+/* Decoded democonfigGATEWAY_GROUP_SYMMETRIC_KEY. */
+static uint8_t ucGroupKey[ 64 ];
+static size_t xGroupKeyLength;
+
+static uint8_t ucScratchBuffer[ 64 ];
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Generate the device ID and derive its key from the group key:
+ * base64( HMAC-SHA256( group key, device ID ) ).
+ */
+static uint32_t prvSetupIdentity( GatewayIdentity_t * pxIdentity )
+{
+    uint8_t ucDigest[ 32 ];
+    uint32_t ulDigestLength = 0;
+    size_t xKeyLength = 0;
+    int lLength;
+
+    lLength = snprintf( ( char * ) pxIdentity->ucDeviceId, sizeof( pxIdentity->ucDeviceId ),
+                        democonfigGATEWAY_DEVICE_ID_FORMAT, ( unsigned ) pxIdentity->ulNumber );
+
+    if( ( lLength <= 0 ) || ( ( size_t ) lLength >= sizeof( pxIdentity->ucDeviceId ) ) )
+    {
+        return 1;
+    }
+
+    pxIdentity->ulDeviceIdLength = ( uint32_t ) lLength;
+
+    if( ( Crypto_HMAC( ucGroupKey, ( uint32_t ) xGroupKeyLength,
+                       pxIdentity->ucDeviceId, pxIdentity->ulDeviceIdLength,
+                       ucDigest, sizeof( ucDigest ), &ulDigestLength ) != 0 ) ||
+        ( mbedtls_base64_encode( pxIdentity->ucDeviceKey, sizeof( pxIdentity->ucDeviceKey ),
+                                 &xKeyLength, ucDigest, ulDigestLength ) != 0 ) )
+    {
+        return 1;
+    }
+
+    pxIdentity->ulDeviceKeyLength = ( uint32_t ) xKeyLength;
+
+    pxIdentity->xNetworkContext.pParams = &pxIdentity->xTlsTransportParams;
+    pxIdentity->xTransport.pxNetworkContext = &pxIdentity->xNetworkContext;
+    pxIdentity->xTransport.xSend = TLS_Socket_Send;
+    pxIdentity->xTransport.xRecv = TLS_Socket_Recv;
+
+    return 0;
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Open the TLS connection and the MQTT session of a leaf device.
+ */
+static uint32_t prvConnectIdentity( GatewayIdentity_t * pxIdentity )
+{
+    AzureIoTHubClientOptions_t xHubOptions = { 0 };
+    AzureIoTResult_t xResult;
+    bool xSessionPresent;
+
+    if( TLS_Socket_Connect( &pxIdentity->xNetworkContext, democonfigHOSTNAME,
+                            democonfigIOTHUB_PORT, &xNetworkCredentials,
+                            sampleazureiotgatewayRECV_TIMEOUT_MS,
+                            sampleazureiotgatewaySEND_TIMEOUT_MS ) != eTLSTransportSuccess )
+    {
+        return 1;
+    }
+
+    xResult = AzureIoTHubClient_OptionsInit( &xHubOptions );
+
+    if( xResult == eAzureIoTSuccess )
+    {
+        xHubOptions.pucModuleID = ( const uint8_t * ) democonfigMODULE_ID;
+        xHubOptions.ulModuleIDLength = sizeof( democonfigMODULE_ID ) - 1;
+
+        xResult = AzureIoTHubClient_Init( &pxIdentity->xHubClient,
+                                          ( const uint8_t * ) democonfigHOSTNAME, sizeof( democonfigHOSTNAME ) - 1,
+                                          pxIdentity->ucDeviceId, pxIdentity->ulDeviceIdLength,
+                                          &xHubOptions,
+                                          pxIdentity->ucMQTTMessageBuffer, sizeof( pxIdentity->ucMQTTMessageBuffer ),
+                                          ullGetUnixTime,
+                                          &pxIdentity->xTransport );
+    }
+
+    if( xResult == eAzureIoTSuccess )
+    {
+        xResult = AzureIoTHubClient_SetSymmetricKey( &pxIdentity->xHubClient,
+                                                     pxIdentity->ucDeviceKey, pxIdentity->ulDeviceKeyLength,
+                                                     Crypto_HMAC );
+    }
+
+    if( xResult == eAzureIoTSuccess )
+    {
+        xResult = AzureIoTHubClient_Connect( &pxIdentity->xHubClient,
+                                             true, &xSessionPresent,
+                                             sampleazureiotCONNACK_RECV_TIMEOUT_MS );
+
+        if( xResult != eAzureIoTSuccess )
+        {
+            AzureIoTHubClient_Deinit( &pxIdentity->xHubClient );
+        }
+    }
+
+    if( xResult != eAzureIoTSuccess )
+    {
+        TLS_Socket_Disconnect( &pxIdentity->xNetworkContext );
+
+        return 1;
+    }
+
+    return 0;
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Close the MQTT session and the TLS connection of a leaf device, and
+ * schedule its reconnect, with up to the same delay again of jitter so that
+ * the leaf devices that dropped together do not return together.
+ */
+static void prvDisconnectIdentity( GatewayIdentity_t * pxIdentity )
+{
+    const TickType_t xDelay = pdMS_TO_TICKS( sampleazureiotgatewayRECONNECT_DELAY_MS );
+
+    if( pxIdentity->xConnected == pdTRUE )
+    {
+        ( void ) AzureIoTHubClient_Disconnect( &pxIdentity->xHubClient );
+        AzureIoTHubClient_Deinit( &pxIdentity->xHubClient );
+        TLS_Socket_Disconnect( &pxIdentity->xNetworkContext );
+        pxIdentity->xConnected = pdFALSE;
+    }
+
+    pxIdentity->xNextConnect = xTaskGetTickCount() + xDelay +
+                               ( TickType_t ) ( configRAND32() % ( xDelay + 1U ) );
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Connect, publish for and receive for a leaf device, whatever is due.
+ */
+static void prvServiceIdentity( GatewayIdentity_t * pxIdentity )
+{
+    TickType_t xNow = xTaskGetTickCount();
+    AzureIoTResult_t xResult;
+    uint32_t ulLength;
+
+    if( pxIdentity->xConnected == pdFALSE )
+    {
+        /* Signed difference, so the comparison survives tick count wrap. */
+        if( ( int32_t ) ( xNow - pxIdentity->xNextConnect ) < 0 )
+        {
+            return;
+        }
+
+        if( prvConnectIdentity( pxIdentity ) != 0 )
+        {
+            LogError( ( "Leaf device %.*s failed to connect.",
+                        ( int ) pxIdentity->ulDeviceIdLength, pxIdentity->ucDeviceId ) );
+            prvDisconnectIdentity( pxIdentity );
+
+            return;
+        }
+
+        LogInfo( ( "Leaf device %.*s connected.",
+                   ( int ) pxIdentity->ulDeviceIdLength, pxIdentity->ucDeviceId ) );
+        xNow = xTaskGetTickCount();
+        pxIdentity->xConnected = pdTRUE;
+        pxIdentity->xNextTelemetry = xNow;
+        pxIdentity->xLastServiced = xNow;
+    }
+
+    if( ( int32_t ) ( xNow - pxIdentity->xNextTelemetry ) >= 0 )
+    {
+        ulLength = ( uint32_t ) snprintf( ( char * ) ucScratchBuffer, sizeof( ucScratchBuffer ),
+                                          sampleazureiotgatewayMESSAGE,
+                                          ( unsigned ) pxIdentity->ulNumber,
+                                          ( unsigned ) pxIdentity->ulSequence++ );
+        xResult = AzureIoTHubClient_SendTelemetry( &pxIdentity->xHubClient,
+                                                   ucScratchBuffer, ulLength,
+                                                   NULL, eAzureIoTHubMessageQoS1, NULL );
+
+        if( xResult != eAzureIoTSuccess )
+        {
+            prvDisconnectIdentity( pxIdentity );
+
+            return;
+        }
+
+        pxIdentity->xNextTelemetry = xNow + pdMS_TO_TICKS( democonfigGATEWAY_TELEMETRY_INTERVAL_MS );
+    }
+
+    /* Run the process loop only when it does not block on an idle connection,
+     * or when the keep alive may be due. */
+    if( ( TLS_Socket_WaitReadable( &pxIdentity->xNetworkContext, 0 ) > 0 ) ||
+        ( ( xNow - pxIdentity->xLastServiced ) >= pdMS_TO_TICKS( sampleazureiotgatewayKEEP_ALIVE_SERVICE_MS ) ) )
+    {
+        xResult = AzureIoTHubClient_ProcessLoop( &pxIdentity->xHubClient, 0 );
+        pxIdentity->xLastServiced = xNow;
+
+        if( xResult != eAzureIoTSuccess )
+        {
+            LogWarn( ( "Leaf device %.*s lost its connection.",
+                       ( int ) pxIdentity->ulDeviceIdLength, pxIdentity->ucDeviceId ) );
+            prvDisconnectIdentity( pxIdentity );
+        }
+    }
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief The network task of the gateway, servicing all the leaf devices.
+ */
+static void prvGatewayTask( void * pvParameters )
+{
+    uint32_t ulIndex;
+
+    ( void ) pvParameters;
+
+    /* Initialize Azure IoT Middleware.  */
+    configASSERT( AzureIoT_Init() == eAzureIoTSuccess );
+
+    if( mbedtls_base64_decode( ucGroupKey, sizeof( ucGroupKey ), &xGroupKeyLength,
+                               ( const uint8_t * ) democonfigGATEWAY_GROUP_SYMMETRIC_KEY,
+                               sizeof( democonfigGATEWAY_GROUP_SYMMETRIC_KEY ) - 1 ) != 0 )
+    {
+        LogError( ( "democonfigGATEWAY_GROUP_SYMMETRIC_KEY is not a valid base64 key." ) );
+        vTaskDelete( NULL );
+    }
+
+    xNetworkCredentials.pucRootCa = ( const unsigned char * ) democonfigROOT_CA_PEM;
+    xNetworkCredentials.xRootCaSize = sizeof( democonfigROOT_CA_PEM );
+    xNetworkCredentials.pxSessionCache = &xSessionCache;
+    xNetworkCredentials.pxSharedConfig = &xSharedConfig;
+
+    for( ulIndex = 0; ulIndex < democonfigGATEWAY_IDENTITY_COUNT; ulIndex++ )
+    {
+        xGatewayIdentities[ ulIndex ].ulNumber = ulIndex;
+
+        if( prvSetupIdentity( &xGatewayIdentities[ ulIndex ] ) != 0 )
+        {
+            LogError( ( "Leaf device %u: failed to derive the device key.", ( unsigned ) ulIndex ) );
+            vTaskDelete( NULL );
+        }
+
+        xGatewayIdentities[ ulIndex ].xNextConnect = xTaskGetTickCount();
+    }
+
+    LogInfo( ( "Starting %u leaf devices, with %u bytes of the gateway each.",
+               ( unsigned ) democonfigGATEWAY_IDENTITY_COUNT,
+               ( unsigned ) sizeof( GatewayIdentity_t ) ) );
+
+    for( ; ; )
+    {
+        for( ulIndex = 0; ulIndex < democonfigGATEWAY_IDENTITY_COUNT; ulIndex++ )
+        {
+            prvServiceIdentity( &xGatewayIdentities[ ulIndex ] );
+        }
+
+        vTaskDelay( pdMS_TO_TICKS( democonfigGATEWAY_POLL_INTERVAL_MS ) );
+    }
+}
+/*-----------------------------------------------------------*/
+
+/*
+ * @brief Create the network task of the gateway.
+ */
+void vStartDemoTask( void )
+{
+    sampletaskCREATE( prvGatewayTask,            /* Function that implements the task. */
+                      "AzureGatewayTask",        /* Text name for the task - only used for debugging. */
+                      democonfigDEMO_STACKSIZE,  /* Size of stack (in words, not bytes) to allocate for the task. */
+                      NULL,                      /* Task parameter - not used in this case. */
+                      tskIDLE_PRIORITY,          /* Task priority, must be between 0 and configMAX_PRIORITIES - 1. */
+                      NULL,                      /* Used to pass out a handle to the created task - not used in this case. */
+                      democonfigDEMO_TASK_CORE ); /* Core the task is pinned to, if democonfigPIN_TASKS_TO_CORE is defined. */
+}
+/*-----------------------------------------------------------*/
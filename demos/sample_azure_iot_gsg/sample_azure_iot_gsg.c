@@ -8,18 +8,24 @@
 /* Kernel includes. */
 #include "FreeRTOS.h"
 #include "task.h"
+#include "timers.h"
 
-/* Azure Provisioning/IoT Hub library includes */
+/* Azure IoT Hub library includes */
 #include "azure_iot_hub_client.h"
 #include "azure_iot_hub_client_properties.h"
-#include "azure_iot_provisioning_client.h"
 
 /* Azure JSON includes */
 #include "azure_iot_json_reader.h"
 #include "azure_iot_json_writer.h"
 
-/* Exponential backoff retry include. */
-#include "backoff_algorithm.h"
+/* Single pass property dispatch. */
+#include "azure_sample_properties.h"
+#include "azure_sample_properties_stream.h"
+#include "azure_sample_commands.h"
+#include "azure_sample_reported_properties.h"
+
+/* Connections, provisioning and reconnects. */
+#include "azure_sample_connection_manager.h"
 
 /* Transport interface implementation include header for TLS. */
 #include "transport_tls_socket.h"
@@ -30,6 +36,12 @@
 /* Demo specific configs. */
 #include "demo_config.h"
 
+/* Telemetry batching helper header. */
+#include "azure_sample_telemetry_batch.h"
+
+/* Task creation, pinned to a core where configured. */
+#include "azure_sample_task.h"
+
 /* Board specific implementation */
 #include "sample_gsg_device.h"
 
@@ -57,23 +69,6 @@
 #endif
 /*-----------------------------------------------------------*/
 
-/**
- * @brief The maximum number of retries for network operation with server.
- */
-#define sampleazureiotgsgRETRY_MAX_ATTEMPTS                      ( 5U )
-
-/**
- * @brief The maximum back-off delay (in milliseconds) for retrying failed operation
- *  with server.
- */
-#define sampleazureiotgsgRETRY_MAX_BACKOFF_DELAY_MS              ( 5000U )
-
-/**
- * @brief The base back-off delay (in milliseconds) to use for network operation retry
- * attempts.
- */
-#define sampleazureiotgsgRETRY_BACKOFF_BASE_MS                   ( 500U )
-
 /**
  * @brief Timeout for receiving CONNACK packet in milliseconds.
  */
@@ -103,9 +98,26 @@
  * @brief Wait timeout for subscribe to finish.
  */
 #define sampleazureiotgsgSUBSCRIBE_TIMEOUT                       ( 10 * 1000U )
+
+/**
+ * @brief Timeout for MQTT_ProcessLoop while waiting for a telemetry PUBACK, in milliseconds.
+ */
+#define sampleazureiotgsgPROCESS_LOOP_TIMEOUT_MS                 ( 500U )
+
+/**
+ * @brief Longest the main loop blocks in the process loop when no telemetry is due, in milliseconds.
+ *
+ * The process loop sleeps on the socket, so the task only wakes for data from
+ * IoT Hub, keep alive, or the telemetry timer. This also bounds how late a
+ * batch older than democonfigTELEMETRY_BATCH_MAX_AGE_MS is published.
+ */
+#define sampleazureiotgsgIDLE_PROCESS_LOOP_TIMEOUT_MS            ( 10 * 1000U )
 /*-----------------------------------------------------------*/
 
 #define sampleazureiotgsgTELEMETRY_INTERVAL_PROPERTY             ( "telemetryInterval" )
+#define sampleazureiotgsgTELEMETRY_HEARTBEAT_PROPERTY            ( "telemetryHeartbeatSecs" )
+#define sampleazureiotgsgTELEMETRY_DEADBANDS_PROPERTY            ( "telemetryDeadbands" )
+#define sampleazureiotgsgDEADBAND_DECIMALS                       ( 2 )
 #define sampleazureiotgsgLED_STATE_PROPERTY                      ( "ledState" )
 #define sampleazureiotgsgSET_LED_STATE_COMMAND                   ( "setLedState" )
 
@@ -120,6 +132,21 @@
 #define sampleazureiotgsgTOTAL_MEMORY_PROPERTY_NAME              ( "totalMemory" )
 
 #define sampleazureiotgsgTRUE                                    ( "true" )
+
+#define sampleazureiotgsgCOMMAND_SUCCESS_STATUS                  ( 200 )
+#define sampleazureiotgsgCOMMAND_RESPONSE_SIZE                   ( 8 )
+
+/* Writable properties received in a document. */
+#define sampleazureiotgsgRECEIVED_INTERVAL                       ( 1U << 0 )
+#define sampleazureiotgsgRECEIVED_HEARTBEAT                      ( 1U << 1 )
+#define sampleazureiotgsgRECEIVED_DEADBANDS                      ( 1U << 2 )
+
+/**
+ * @brief Size of the buffer for the values kept from a property document
+ * larger than the MQTT buffer: telemetryInterval, telemetryHeartbeatSecs and
+ * the telemetryDeadbands object.
+ */
+#define sampleazureiotgsgPROPERTIES_STREAM_BUFFER_SIZE           ( 320 )
 /*-----------------------------------------------------------*/
 
 /* Each compilation unit must define the NetworkContext struct. */
@@ -130,26 +157,79 @@ struct NetworkContext
 /*-----------------------------------------------------------*/
 
 
-/* Define buffer for IoT Hub info.  */
-#ifdef democonfigENABLE_DPS_SAMPLE
-
-    static uint8_t ucSampleIotHubHostname[ 128 ];
-    static uint8_t ucSampleIotHubDeviceId[ 128 ];
-    static AzureIoTProvisioningClient_t xAzureIoTProvisioningClient;
-
-#endif /* democonfigENABLE_DPS_SAMPLE */
-
 /* Scratch buffer */
 static uint8_t ucScratchBuffer[ 128 ];
 
+/* Telemetry is published through a batch, which sends each reading on its
+ * own unless democonfigTELEMETRY_BATCH_COUNT > 1. */
+static TelemetryBatch_t xTelemetryBatch;
+#if ( democonfigTELEMETRY_BATCH_COUNT > 1 )
+    static uint8_t ucTelemetryBatchBuffer[ democonfigTELEMETRY_BATCH_BUFFER_SIZE ];
+    #define sampleazureiotgsgTELEMETRY_BATCH_BUFFER    ucTelemetryBatchBuffer
+#else
+    #define sampleazureiotgsgTELEMETRY_BATCH_BUFFER    NULL
+#endif
+
+/* Telemetry messages in flight, so a message does not wait for the PUBACK
+ * of the one before it. */
+static PublishWindow_t xPublishWindow;
+
 /* Property buffer */
-static uint8_t ucPropertyPayloadBuffer[ 400 ];
+static uint8_t ucPropertyPayloadBuffer[ 512 ];
 
 /* Device properties */
 static int32_t lTelemetryInterval = 5;
 static bool xLedState = false;
 
+#define sampleazureiotgsgDEVICE_INFO_PROPERTY( pcName, xType )                              \
+    {                                                                                       \
+        {                                                                                   \
+            ( const uint8_t * ) sampleazureiotgsgDEVICE_INFORMATION_NAME,                   \
+            sizeof( sampleazureiotgsgDEVICE_INFORMATION_NAME ) - 1,                         \
+            ( const uint8_t * ) pcName, sizeof( pcName ) - 1                                \
+        },                                                                                  \
+        xType, 0                                                                            \
+    }
+
+/* Reported properties, in the order of the indexes below. */
+static ReportedProperty_t xReportedProperties[] =
+{
+    {
+        { NULL, 0, ( const uint8_t * ) sampleazureiotgsgLED_STATE_PROPERTY, sizeof( sampleazureiotgsgLED_STATE_PROPERTY ) - 1 },
+        eReportedPropertyBool, 0
+    },
+    sampleazureiotgsgDEVICE_INFO_PROPERTY( sampleazureiotgsgMANUFACTURER_PROPERTY_NAME, eReportedPropertyString ),
+    sampleazureiotgsgDEVICE_INFO_PROPERTY( sampleazureiotgsgMODEL_PROPERTY_NAME, eReportedPropertyString ),
+    sampleazureiotgsgDEVICE_INFO_PROPERTY( sampleazureiotgsgSOFTWARE_VERSION_PROPERTY_NAME, eReportedPropertyString ),
+    sampleazureiotgsgDEVICE_INFO_PROPERTY( sampleazureiotgsgOS_NAME_PROPERTY_NAME, eReportedPropertyString ),
+    sampleazureiotgsgDEVICE_INFO_PROPERTY( sampleazureiotgsgPROCESSOR_ARCHITECTURE_PROPERTY_NAME, eReportedPropertyString ),
+    sampleazureiotgsgDEVICE_INFO_PROPERTY( sampleazureiotgsgPROCESSOR_MANUFACTURER_PROPERTY_NAME, eReportedPropertyString ),
+    sampleazureiotgsgDEVICE_INFO_PROPERTY( sampleazureiotgsgTOTAL_STORAGE_PROPERTY_NAME, eReportedPropertyDouble ),
+    sampleazureiotgsgDEVICE_INFO_PROPERTY( sampleazureiotgsgTOTAL_MEMORY_PROPERTY_NAME, eReportedPropertyDouble )
+};
+
+#define sampleazureiotgsgLED_STATE_INDEX                 0
+#define sampleazureiotgsgMANUFACTURER_INDEX              1
+#define sampleazureiotgsgMODEL_INDEX                     2
+#define sampleazureiotgsgSOFTWARE_VERSION_INDEX          3
+#define sampleazureiotgsgOS_NAME_INDEX                   4
+#define sampleazureiotgsgPROCESSOR_ARCHITECTURE_INDEX    5
+#define sampleazureiotgsgPROCESSOR_MANUFACTURER_INDEX    6
+#define sampleazureiotgsgTOTAL_STORAGE_INDEX             7
+#define sampleazureiotgsgTOTAL_MEMORY_INDEX              8
+
+/* Sends only the reported properties that changed, from the main loop. */
+static ReportedProperties_t xReportedPropertiesStore = reportedpropertiesINIT( xReportedProperties );
+
 static AzureIoTHubClient_t xAzureIoTHubClient;
+
+/* Connects to the provisioning service and IoT Hub. */
+static ConnectionManager_t xConnectionManager;
+
+/* Fires every lTelemetryInterval seconds and notifies the demo task. */
+static TimerHandle_t xTelemetryTimer;
+static StaticTimer_t xTelemetryTimerBuffer;
+static TaskHandle_t xDemoTaskHandle;
 /*-----------------------------------------------------------*/
 
 /**
@@ -161,52 +241,69 @@ uint64_t ullGetUnixTime( void );
 /*-----------------------------------------------------------*/
 
 /**
- * @brief Static buffer used to hold MQTT messages being sent and received.
+ * @brief Buffer of the hub client, for the topics of the messages it sends and
+ * the MQTT packets it receives, see democonfigNETWORK_BUFFER_SIZE.
  */
 static uint8_t ucMQTTMessageBuffer[ democonfigNETWORK_BUFFER_SIZE ];
 /*-----------------------------------------------------------*/
 
-static void prvReportLedState()
+static void prvTelemetryTimerCallback( TimerHandle_t xTimer )
 {
-    AzureIoTResult_t xResult;
-    AzureIoTJSONWriter_t xWriter;
-    int32_t lBytesWritten;
+    ( void ) xTimer;
 
-    /* Update reported property */
-    xResult = AzureIoTJSONWriter_Init( &xWriter, ucPropertyPayloadBuffer, sizeof( ucPropertyPayloadBuffer ) );
-    configASSERT( xResult == eAzureIoTSuccess );
-
-    xResult = AzureIoTJSONWriter_AppendBeginObject( &xWriter );
-    configASSERT( xResult == eAzureIoTSuccess );
+    xTaskNotifyGive( xDemoTaskHandle );
+}
+/*-----------------------------------------------------------*/
 
-    xResult = AzureIoTJSONWriter_AppendPropertyName( &xWriter, ( uint8_t * ) sampleazureiotgsgLED_STATE_PROPERTY,
-                                                     sizeof( sampleazureiotgsgLED_STATE_PROPERTY ) - 1 );
-    configASSERT( xResult == eAzureIoTSuccess );
+/* Applies lTelemetryInterval to the telemetry timer, restarting its period.
+ * Property updates can arrive while subscribing, before the timer exists;
+ * the timer picks up the interval when it is started. */
+static void prvUpdateTelemetryTimer( void )
+{
+    TickType_t xPeriod = pdMS_TO_TICKS( ( lTelemetryInterval > 0 ? ( uint32_t ) lTelemetryInterval : 1U ) * 1000U );
+    BaseType_t xStatus;
 
-    xResult = AzureIoTJSONWriter_AppendBool( &xWriter, xLedState );
-    configASSERT( xResult == eAzureIoTSuccess );
+    if( xTelemetryTimer == NULL )
+    {
+        return;
+    }
 
-    xResult = AzureIoTJSONWriter_AppendEndObject( &xWriter );
-    configASSERT( xResult == eAzureIoTSuccess );
+    xStatus = xTimerChangePeriod( xTelemetryTimer, xPeriod, portMAX_DELAY );
+    configASSERT( xStatus == pdPASS );
+}
+/*-----------------------------------------------------------*/
 
-    lBytesWritten = AzureIoTJSONWriter_GetBytesUsed( &xWriter );
+/* Time until the telemetry timer fires or reported properties are due, capped at
+ * sampleazureiotgsgIDLE_PROCESS_LOOP_TIMEOUT_MS, as a process loop timeout. */
+static uint32_t prvGetProcessLoopTimeoutMs( void )
+{
+    TickType_t xRemaining = xTimerGetExpiryTime( xTelemetryTimer ) - xTaskGetTickCount();
 
-    if( lBytesWritten < 0 )
+    /* An expiry time already passed wraps to more than a period. */
+    if( xRemaining > xTimerGetPeriod( xTelemetryTimer ) )
     {
-        LogError( ( "Error getting the bytes written for the properties confirmation JSON" ) );
-        return;
+        return 0;
     }
 
-    xResult = AzureIoTHubClient_SendPropertiesReported( &xAzureIoTHubClient, ucPropertyPayloadBuffer, lBytesWritten, NULL );
+    /* Changed reported properties are due at the end of their window. */
+    if( xRemaining > ReportedProperties_TimeUntilDue( &xReportedPropertiesStore ) )
+    {
+        xRemaining = ReportedProperties_TimeUntilDue( &xReportedPropertiesStore );
+    }
 
-    if( xResult != eAzureIoTSuccess )
+    if( xRemaining > pdMS_TO_TICKS( sampleazureiotgsgIDLE_PROCESS_LOOP_TIMEOUT_MS ) )
     {
-        LogError( ( "There was an error sending the reported properties: 0x%08x", xResult ) );
+        return sampleazureiotgsgIDLE_PROCESS_LOOP_TIMEOUT_MS;
     }
+
+    return ( uint32_t ) ( xRemaining * portTICK_PERIOD_MS );
 }
 /*-----------------------------------------------------------*/
 
-static void prvReportTelemetryInterval( uint32_t ulVersion )
+/* Acknowledges the writable properties received, sampleazureiotgsgRECEIVED_* bits,
+ * in one document. */
+static void prvReportWritableProperties( uint32_t ulVersion,
+                                         uint32_t ulReceived )
 {
     AzureIoTResult_t xResult;
     AzureIoTJSONWriter_t xWriter;
@@ -218,22 +315,65 @@ static void prvReportTelemetryInterval( uint32_t ulVersion )
     xResult = AzureIoTJSONWriter_AppendBeginObject( &xWriter );
     configASSERT( xResult == eAzureIoTSuccess );
 
-    xResult = AzureIoTHubClientProperties_BuilderBeginResponseStatus( &xAzureIoTHubClient,
-                                                                      &xWriter,
-                                                                      ( uint8_t * ) sampleazureiotgsgTELEMETRY_INTERVAL_PROPERTY,
-                                                                      sizeof( sampleazureiotgsgTELEMETRY_INTERVAL_PROPERTY ) - 1,
-                                                                      200,
-                                                                      ulVersion,
-                                                                      ( uint8_t * ) sampleazureiotgsgPROPERTY_SUCCESS,
-                                                                      sizeof( sampleazureiotgsgPROPERTY_SUCCESS ) - 1 );
-    configASSERT( xResult == eAzureIoTSuccess );
+    if( ( ulReceived & sampleazureiotgsgRECEIVED_INTERVAL ) != 0 )
+    {
+        xResult = AzureIoTHubClientProperties_BuilderBeginResponseStatus( &xAzureIoTHubClient,
+                                                                          &xWriter,
+                                                                          ( uint8_t * ) sampleazureiotgsgTELEMETRY_INTERVAL_PROPERTY,
+                                                                          sizeof( sampleazureiotgsgTELEMETRY_INTERVAL_PROPERTY ) - 1,
+                                                                          200,
+                                                                          ulVersion,
+                                                                          ( uint8_t * ) sampleazureiotgsgPROPERTY_SUCCESS,
+                                                                          sizeof( sampleazureiotgsgPROPERTY_SUCCESS ) - 1 );
+        configASSERT( xResult == eAzureIoTSuccess );
 
-    xResult = AzureIoTJSONWriter_AppendInt32( &xWriter, lTelemetryInterval );
-    configASSERT( xResult == eAzureIoTSuccess );
+        xResult = AzureIoTJSONWriter_AppendInt32( &xWriter, lTelemetryInterval );
+        configASSERT( xResult == eAzureIoTSuccess );
 
-    xResult = AzureIoTHubClientProperties_BuilderEndResponseStatus( &xAzureIoTHubClient,
-                                                                    &xWriter );
-    configASSERT( xResult == eAzureIoTSuccess );
+        xResult = AzureIoTHubClientProperties_BuilderEndResponseStatus( &xAzureIoTHubClient,
+                                                                        &xWriter );
+        configASSERT( xResult == eAzureIoTSuccess );
+    }
+
+    if( ( ulReceived & sampleazureiotgsgRECEIVED_HEARTBEAT ) != 0 )
+    {
+        xResult = AzureIoTHubClientProperties_BuilderBeginResponseStatus( &xAzureIoTHubClient,
+                                                                          &xWriter,
+                                                                          ( uint8_t * ) sampleazureiotgsgTELEMETRY_HEARTBEAT_PROPERTY,
+                                                                          sizeof( sampleazureiotgsgTELEMETRY_HEARTBEAT_PROPERTY ) - 1,
+                                                                          200,
+                                                                          ulVersion,
+                                                                          ( uint8_t * ) sampleazureiotgsgPROPERTY_SUCCESS,
+                                                                          sizeof( sampleazureiotgsgPROPERTY_SUCCESS ) - 1 );
+        configASSERT( xResult == eAzureIoTSuccess );
+
+        xResult = AzureIoTJSONWriter_AppendInt32( &xWriter, TelemetryFilter_GetHeartbeat( &xTelemetryFilter ) );
+        configASSERT( xResult == eAzureIoTSuccess );
+
+        xResult = AzureIoTHubClientProperties_BuilderEndResponseStatus( &xAzureIoTHubClient,
+                                                                        &xWriter );
+        configASSERT( xResult == eAzureIoTSuccess );
+    }
+
+    if( ( ulReceived & sampleazureiotgsgRECEIVED_DEADBANDS ) != 0 )
+    {
+        xResult = AzureIoTHubClientProperties_BuilderBeginResponseStatus( &xAzureIoTHubClient,
+                                                                          &xWriter,
+                                                                          ( uint8_t * ) sampleazureiotgsgTELEMETRY_DEADBANDS_PROPERTY,
+                                                                          sizeof( sampleazureiotgsgTELEMETRY_DEADBANDS_PROPERTY ) - 1,
+                                                                          200,
+                                                                          ulVersion,
+                                                                          ( uint8_t * ) sampleazureiotgsgPROPERTY_SUCCESS,
+                                                                          sizeof( sampleazureiotgsgPROPERTY_SUCCESS ) - 1 );
+        configASSERT( xResult == eAzureIoTSuccess );
+
+        xResult = TelemetryFilter_AppendDeadbands( &xTelemetryFilter, &xWriter, sampleazureiotgsgDEADBAND_DECIMALS );
+        configASSERT( xResult == eAzureIoTSuccess );
+
+        xResult = AzureIoTHubClientProperties_BuilderEndResponseStatus( &xAzureIoTHubClient,
+                                                                        &xWriter );
+        configASSERT( xResult == eAzureIoTSuccess );
+    }
 
     xResult = AzureIoTJSONWriter_AppendEndObject( &xWriter );
     configASSERT( xResult == eAzureIoTSuccess );
@@ -257,75 +397,25 @@ static void prvReportTelemetryInterval( uint32_t ulVersion )
 }
 /*-----------------------------------------------------------*/
 
-static void prvReportDeviceInfo()
+/* The values of the device information, which do not change. */
+static void prvSetDeviceInfo( void )
 {
-    AzureIoTResult_t xResult;
-    AzureIoTJSONWriter_t xWriter;
-    int32_t lBytesWritten;
-
-    /* Update reported property */
-    xResult = AzureIoTJSONWriter_Init( &xWriter, ucPropertyPayloadBuffer, sizeof( ucPropertyPayloadBuffer ) );
-    configASSERT( xResult == eAzureIoTSuccess );
-
-    xResult = AzureIoTJSONWriter_AppendBeginObject( &xWriter );
-    configASSERT( xResult == eAzureIoTSuccess );
-
-    xResult = AzureIoTHubClientProperties_BuilderBeginComponent( &xAzureIoTHubClient, &xWriter, ( const uint8_t * ) sampleazureiotgsgDEVICE_INFORMATION_NAME, strlen( sampleazureiotgsgDEVICE_INFORMATION_NAME ) );
-    configASSERT( xResult == eAzureIoTSuccess );
-
-    xResult = AzureIoTJSONWriter_AppendPropertyWithStringValue( &xWriter, ( uint8_t * ) sampleazureiotgsgMANUFACTURER_PROPERTY_NAME, sizeof( sampleazureiotgsgMANUFACTURER_PROPERTY_NAME ) - 1,
-                                                                ( uint8_t * ) pcManufacturerPropertyValue, strlen( pcManufacturerPropertyValue ) );
-    configASSERT( xResult == eAzureIoTSuccess );
-
-    xResult = AzureIoTJSONWriter_AppendPropertyWithStringValue( &xWriter, ( uint8_t * ) sampleazureiotgsgMODEL_PROPERTY_NAME, sizeof( sampleazureiotgsgMODEL_PROPERTY_NAME ) - 1,
-                                                                ( uint8_t * ) pcModelPropertyValue, strlen( pcModelPropertyValue ) );
-    configASSERT( xResult == eAzureIoTSuccess );
-
-    xResult = AzureIoTJSONWriter_AppendPropertyWithStringValue( &xWriter, ( uint8_t * ) sampleazureiotgsgSOFTWARE_VERSION_PROPERTY_NAME, sizeof( sampleazureiotgsgSOFTWARE_VERSION_PROPERTY_NAME ) - 1,
-                                                                ( uint8_t * ) pcSoftwareVersionPropertyValue, strlen( pcSoftwareVersionPropertyValue ) );
-    configASSERT( xResult == eAzureIoTSuccess );
-
-    xResult = AzureIoTJSONWriter_AppendPropertyWithStringValue( &xWriter, ( uint8_t * ) sampleazureiotgsgOS_NAME_PROPERTY_NAME, sizeof( sampleazureiotgsgOS_NAME_PROPERTY_NAME ) - 1,
-                                                                ( uint8_t * ) pcOsNamePropertyValue, strlen( pcOsNamePropertyValue ) );
-    configASSERT( xResult == eAzureIoTSuccess );
-
-    xResult = AzureIoTJSONWriter_AppendPropertyWithStringValue( &xWriter, ( uint8_t * ) sampleazureiotgsgPROCESSOR_ARCHITECTURE_PROPERTY_NAME, sizeof( sampleazureiotgsgPROCESSOR_ARCHITECTURE_PROPERTY_NAME ) - 1,
-                                                                ( uint8_t * ) pcProcessorArchitecturePropertyValue, strlen( pcProcessorArchitecturePropertyValue ) );
-    configASSERT( xResult == eAzureIoTSuccess );
-
-    xResult = AzureIoTJSONWriter_AppendPropertyWithStringValue( &xWriter, ( uint8_t * ) sampleazureiotgsgPROCESSOR_MANUFACTURER_PROPERTY_NAME, sizeof( sampleazureiotgsgPROCESSOR_MANUFACTURER_PROPERTY_NAME ) - 1,
-                                                                ( uint8_t * ) pcProcessorManufacturerPropertyValue, strlen( pcProcessorManufacturerPropertyValue ) );
-    configASSERT( xResult == eAzureIoTSuccess );
-
-    xResult = AzureIoTJSONWriter_AppendPropertyWithDoubleValue( &xWriter, ( uint8_t * ) sampleazureiotgsgTOTAL_STORAGE_PROPERTY_NAME, sizeof( sampleazureiotgsgTOTAL_STORAGE_PROPERTY_NAME ) - 1,
-                                                                xTotalStoragePropertyValue, 0 );
-    configASSERT( xResult == eAzureIoTSuccess );
-
-    xResult = AzureIoTJSONWriter_AppendPropertyWithDoubleValue( &xWriter, ( uint8_t * ) sampleazureiotgsgTOTAL_MEMORY_PROPERTY_NAME, sizeof( sampleazureiotgsgTOTAL_MEMORY_PROPERTY_NAME ) - 1,
-                                                                xTotalMemoryPropertyValue, 0 );
-    configASSERT( xResult == eAzureIoTSuccess );
-
-    xResult = AzureIoTHubClientProperties_BuilderEndComponent( &xAzureIoTHubClient, &xWriter );
-    configASSERT( xResult == eAzureIoTSuccess );
-
-    xResult = AzureIoTJSONWriter_AppendEndObject( &xWriter );
-    configASSERT( xResult == eAzureIoTSuccess );
-
-    lBytesWritten = AzureIoTJSONWriter_GetBytesUsed( &xWriter );
-
-    if( lBytesWritten < 0 )
-    {
-        LogError( ( "Error getting the bytes written for the device properties JSON" ) );
-        return;
-    }
-
-    xResult = AzureIoTHubClient_SendPropertiesReported( &xAzureIoTHubClient, ucPropertyPayloadBuffer, lBytesWritten, NULL );
-
-    if( xResult != eAzureIoTSuccess )
-    {
-        LogError( ( "There was an error sending the device properties: 0x%08x", xResult ) );
-    }
+    ReportedProperties_SetString( &xReportedPropertiesStore, sampleazureiotgsgMANUFACTURER_INDEX,
+                                  ( const uint8_t * ) pcManufacturerPropertyValue, strlen( pcManufacturerPropertyValue ) );
+    ReportedProperties_SetString( &xReportedPropertiesStore, sampleazureiotgsgMODEL_INDEX,
+                                  ( const uint8_t * ) pcModelPropertyValue, strlen( pcModelPropertyValue ) );
+    ReportedProperties_SetString( &xReportedPropertiesStore, sampleazureiotgsgSOFTWARE_VERSION_INDEX,
+                                  ( const uint8_t * ) pcSoftwareVersionPropertyValue, strlen( pcSoftwareVersionPropertyValue ) );
+    ReportedProperties_SetString( &xReportedPropertiesStore, sampleazureiotgsgOS_NAME_INDEX,
+                                  ( const uint8_t * ) pcOsNamePropertyValue, strlen( pcOsNamePropertyValue ) );
+    ReportedProperties_SetString( &xReportedPropertiesStore, sampleazureiotgsgPROCESSOR_ARCHITECTURE_INDEX,
+                                  ( const uint8_t * ) pcProcessorArchitecturePropertyValue, strlen( pcProcessorArchitecturePropertyValue ) );
+    ReportedProperties_SetString( &xReportedPropertiesStore, sampleazureiotgsgPROCESSOR_MANUFACTURER_INDEX,
+                                  ( const uint8_t * ) pcProcessorManufacturerPropertyValue, strlen( pcProcessorManufacturerPropertyValue ) );
+    ReportedProperties_SetDouble( &xReportedPropertiesStore, sampleazureiotgsgTOTAL_STORAGE_INDEX, xTotalStoragePropertyValue );
+    ReportedProperties_SetDouble( &xReportedPropertiesStore, sampleazureiotgsgTOTAL_MEMORY_INDEX, xTotalMemoryPropertyValue );
 }
+/*-----------------------------------------------------------*/
 
 static void prvInvokeSetLedStateCommand( const void * pvMessagePayload,
                                          uint32_t ulMessageLength )
@@ -336,6 +426,37 @@ static void prvInvokeSetLedStateCommand( const void * pvMessagePayload,
 }
 /*-----------------------------------------------------------*/
 
+static uint32_t prvHandleSetLedState( AzureIoTHubClientCommandRequest_t * pxMessage,
+                                      uint32_t * pulResponseStatus,
+                                      uint8_t * pucResponsePayload,
+                                      uint32_t ulResponsePayloadSize )
+{
+    ( void ) pucResponsePayload;
+    ( void ) ulResponsePayloadSize;
+
+    prvInvokeSetLedStateCommand( pxMessage->pvMessagePayload, pxMessage->ulPayloadLength );
+    *pulResponseStatus = sampleazureiotgsgCOMMAND_SUCCESS_STATUS;
+
+    return 0;
+}
+/*-----------------------------------------------------------*/
+
+static const CommandHandlerEntry_t xCommandHandlers[] =
+{
+    {
+        {
+            NULL, 0,
+            ( const uint8_t * ) sampleazureiotgsgSET_LED_STATE_COMMAND,
+            sizeof( sampleazureiotgsgSET_LED_STATE_COMMAND ) - 1
+        },
+        prvHandleSetLedState
+    }
+};
+
+static uint8_t ucCommandSlots[ dispatchtableSLOT_COUNT( sizeof( xCommandHandlers ) / sizeof( xCommandHandlers[ 0 ] ) ) ];
+static DispatchTable_t xCommandTable = dispatchtableINIT( xCommandHandlers, ucCommandSlots );
+/*-----------------------------------------------------------*/
+
 /**
  * @brief Command message callback handler
  */
@@ -343,130 +464,160 @@ static void prvHandleCommand( AzureIoTHubClientCommandRequest_t * pxMessage,
                               void * pvContext )
 {
     AzureIoTHubClient_t * pxHandle = ( AzureIoTHubClient_t * ) pvContext;
+    uint8_t ucResponsePayload[ sampleazureiotgsgCOMMAND_RESPONSE_SIZE ];
+    uint32_t ulResponseStatus = 0;
+    uint32_t ulResponsePayloadLength;
 
     LogInfo( ( "Received direct command: %.*s", pxMessage->usCommandNameLength, pxMessage->pucCommandName ) );
 
-    if( strncmp( sampleazureiotgsgSET_LED_STATE_COMMAND, ( const char * ) pxMessage->pucCommandName, strlen( sampleazureiotgsgSET_LED_STATE_COMMAND ) ) == 0 )
-    {
-        prvInvokeSetLedStateCommand( pxMessage->pvMessagePayload, pxMessage->ulPayloadLength );
+    ulResponsePayloadLength = CommandsDispatch_Process( &xCommandTable, pxMessage, &ulResponseStatus,
+                                                        ucResponsePayload, sizeof( ucResponsePayload ) );
 
-        if( AzureIoTHubClient_SendCommandResponse( pxHandle, pxMessage, 200, NULL, 0 ) != eAzureIoTSuccess )
-        {
-            LogInfo( ( "Error sending command response" ) );
-        }
+    if( AzureIoTHubClient_SendCommandResponse( pxHandle, pxMessage, ulResponseStatus,
+                                               ( ulResponsePayloadLength > 0 ) ? ucResponsePayload : NULL,
+                                               ulResponsePayloadLength ) != eAzureIoTSuccess )
+    {
+        LogError( ( "Error sending command response" ) );
+    }
 
+    /* setLedState is the only command, so a success changed the LED. */
+    if( ulResponseStatus == sampleazureiotgsgCOMMAND_SUCCESS_STATUS )
+    {
         /* Update the associated reported property */
-        prvReportLedState();
+        ReportedProperties_SetBool( &xReportedPropertiesStore, sampleazureiotgsgLED_STATE_INDEX, xLedState );
     }
     else
     {
         LogInfo( ( "Received command is not for this device" ) );
-
-        if( AzureIoTHubClient_SendCommandResponse( pxHandle, pxMessage, 404, NULL, 0 ) != eAzureIoTSuccess )
-        {
-            LogError( ( "Error sending command response" ) );
-        }
     }
 }
 /*-----------------------------------------------------------*/
 
-static void prvSkipPropertyAndValue( AzureIoTJSONReader_t * pxReader )
+static AzureIoTResult_t prvHandleTelemetryInterval( AzureIoTJSONReader_t * pxReader,
+                                                    void * pvContext )
 {
     AzureIoTResult_t xResult;
+    int32_t lNewTelemetryInterval;
 
-    xResult = AzureIoTJSONReader_NextToken( pxReader );
-    configASSERT( xResult == eAzureIoTSuccess );
+    if( ( xResult = AzureIoTJSONReader_GetTokenInt32( pxReader, &lNewTelemetryInterval ) ) != eAzureIoTSuccess )
+    {
+        LogError( ( "Error getting the property: result 0x%08x", xResult ) );
+    }
+    else
+    {
+        /* Applied once the version is known, as it usually comes last. */
+        lTelemetryInterval = lNewTelemetryInterval;
+        *( uint32_t * ) pvContext |= sampleazureiotgsgRECEIVED_INTERVAL;
+    }
 
-    xResult = AzureIoTJSONReader_SkipChildren( pxReader );
-    configASSERT( xResult == eAzureIoTSuccess );
+    return xResult;
+}
+/*-----------------------------------------------------------*/
 
-    xResult = AzureIoTJSONReader_NextToken( pxReader );
-    configASSERT( xResult == eAzureIoTSuccess );
+static AzureIoTResult_t prvHandleTelemetryHeartbeat( AzureIoTJSONReader_t * pxReader,
+                                                     void * pvContext )
+{
+    int32_t lHeartbeatSecs;
+
+    if( ( AzureIoTJSONReader_GetTokenInt32( pxReader, &lHeartbeatSecs ) != eAzureIoTSuccess ) ||
+        ( TelemetryFilter_SetHeartbeat( &xTelemetryFilter, lHeartbeatSecs ) != eAzureIoTSuccess ) )
+    {
+        /* Left unacknowledged, the other properties are still applied. */
+        LogError( ( "Invalid %s value", sampleazureiotgsgTELEMETRY_HEARTBEAT_PROPERTY ) );
+        return AzureIoTJSONReader_SkipChildren( pxReader );
+    }
+
+    *( uint32_t * ) pvContext |= sampleazureiotgsgRECEIVED_HEARTBEAT;
+
+    return eAzureIoTSuccess;
+}
+/*-----------------------------------------------------------*/
+
+static AzureIoTResult_t prvHandleTelemetryDeadbands( AzureIoTJSONReader_t * pxReader,
+                                                     void * pvContext )
+{
+    if( TelemetryFilter_ParseDeadbands( &xTelemetryFilter, pxReader ) != eAzureIoTSuccess )
+    {
+        /* The reader was left on the value, which is skipped as a whole. */
+        LogError( ( "Invalid %s value", sampleazureiotgsgTELEMETRY_DEADBANDS_PROPERTY ) );
+        return AzureIoTJSONReader_SkipChildren( pxReader );
+    }
+
+    *( uint32_t * ) pvContext |= sampleazureiotgsgRECEIVED_DEADBANDS;
+
+    return eAzureIoTSuccess;
 }
 /*-----------------------------------------------------------*/
 
+static const PropertyHandlerEntry_t xPropertyHandlers[] =
+{
+    {
+        {
+            NULL, 0,
+            ( const uint8_t * ) sampleazureiotgsgTELEMETRY_INTERVAL_PROPERTY,
+            sizeof( sampleazureiotgsgTELEMETRY_INTERVAL_PROPERTY ) - 1
+        },
+        prvHandleTelemetryInterval
+    },
+    {
+        {
+            NULL, 0,
+            ( const uint8_t * ) sampleazureiotgsgTELEMETRY_HEARTBEAT_PROPERTY,
+            sizeof( sampleazureiotgsgTELEMETRY_HEARTBEAT_PROPERTY ) - 1
+        },
+        prvHandleTelemetryHeartbeat
+    },
+    {
+        {
+            NULL, 0,
+            ( const uint8_t * ) sampleazureiotgsgTELEMETRY_DEADBANDS_PROPERTY,
+            sizeof( sampleazureiotgsgTELEMETRY_DEADBANDS_PROPERTY ) - 1
+        },
+        prvHandleTelemetryDeadbands
+    }
+};
+
+static uint8_t ucPropertySlots[ dispatchtableSLOT_COUNT( sizeof( xPropertyHandlers ) / sizeof( xPropertyHandlers[ 0 ] ) ) ];
+static DispatchTable_t xPropertyTable = dispatchtableINIT( xPropertyHandlers, ucPropertySlots );
+
+/* Parses property documents that do not fit the MQTT buffer as they are received. */
+static PropertiesStream_t xPropertiesStream;
+static uint8_t ucPropertiesStreamBuffer[ sampleazureiotgsgPROPERTIES_STREAM_BUFFER_SIZE ];
+/*-----------------------------------------------------------*/
+
 /**
  * @brief Properties callback handler
  */
-static AzureIoTResult_t prvProcessProperties( AzureIoTHubClientPropertiesResponse_t * pxMessage,
-                                              AzureIoTHubClientPropertyType_t xPropertyType )
+static AzureIoTResult_t prvProcessProperties( AzureIoTHubClientPropertiesResponse_t * pxMessage )
 {
     AzureIoTResult_t xResult;
-    AzureIoTJSONReader_t xReader;
-    const uint8_t * pucComponentName = NULL;
-    uint32_t ulComponentNameLength = 0;
     uint32_t ulVersion;
-    int32_t lNewTelemetryInterval;
+    uint32_t ulReceived = 0;
 
-    xResult = AzureIoTJSONReader_Init( &xReader, pxMessage->pvMessagePayload, pxMessage->ulPayloadLength );
-    configASSERT( xResult == eAzureIoTSuccess );
-
-    xResult = AzureIoTHubClientProperties_GetPropertiesVersion( &xAzureIoTHubClient, &xReader, pxMessage->xMessageType, &ulVersion );
+    /* The version and the properties are read in the same pass, or were
+     * while the document was received. */
+    xResult = PropertiesStream_Process( &xPropertiesStream, pxMessage,
+                                        &ulReceived, &ulVersion );
 
     if( xResult != eAzureIoTSuccess )
     {
-        LogError( ( "Error getting the property version" ) );
+        LogError( ( "There was an error parsing the properties: 0x%08x", xResult ) );
     }
     else
     {
-        /* Reset JSON reader to the beginning */
-        xResult = AzureIoTJSONReader_Init( &xReader, pxMessage->pvMessagePayload, pxMessage->ulPayloadLength );
-        configASSERT( xResult == eAzureIoTSuccess );
+        LogInfo( ( "Successfully parsed properties" ) );
 
-        while( ( xResult = AzureIoTHubClientProperties_GetNextComponentProperty( &xAzureIoTHubClient, &xReader,
-                                                                                 pxMessage->xMessageType, xPropertyType,
-                                                                                 &pucComponentName, &ulComponentNameLength ) ) == eAzureIoTSuccess )
+        if( ( ulReceived & sampleazureiotgsgRECEIVED_INTERVAL ) != 0 )
         {
-            if( ulComponentNameLength > 0 )
-            {
-                LogInfo( ( "Unknown component name received %s", pucComponentName ) );
-
-                /* Unknown component name arrived (there are none for this device).
-                 * We have to skip over the property and value to continue iterating */
-                prvSkipPropertyAndValue( &xReader );
-            }
-            else if( AzureIoTJSONReader_TokenIsTextEqual( &xReader,
-                                                          ( uint8_t * ) sampleazureiotgsgTELEMETRY_INTERVAL_PROPERTY,
-                                                          sizeof( sampleazureiotgsgTELEMETRY_INTERVAL_PROPERTY ) - 1 ) )
-            {
-                xResult = AzureIoTJSONReader_NextToken( &xReader );
-                configASSERT( xResult == eAzureIoTSuccess );
+            prvUpdateTelemetryTimer();
 
-                /* Get telemetry interval */
-                xResult = AzureIoTJSONReader_GetTokenInt32( &xReader, &lNewTelemetryInterval );
-
-                if( xResult != eAzureIoTSuccess )
-                {
-                    LogError( ( "Error getting the property: result 0x%08x", xResult ) );
-                    break;
-                }
-
-                xResult = AzureIoTJSONReader_NextToken( &xReader );
-                configASSERT( xResult == eAzureIoTSuccess );
-
-                /* Update the property and report back */
-                lTelemetryInterval = lNewTelemetryInterval;
-                prvReportTelemetryInterval( ulVersion );
-
-                LogInfo( ( "TelemetryInterval Property received: %d.", lTelemetryInterval ) );
-            }
-            else
-            {
-                LogInfo( ( "Unknown property arrived: skipping over it." ) );
-
-                /* Unknown property arrived. We have to skip over the property and value to continue iterating. */
-                prvSkipPropertyAndValue( &xReader );
-            }
+            LogInfo( ( "TelemetryInterval Property received: %d.", lTelemetryInterval ) );
         }
 
-        if( xResult != eAzureIoTErrorEndOfProperties )
+        /* Every property of the document is acknowledged in one publish. */
+        if( ulReceived != 0 )
         {
-            LogError( ( "There was an error parsing the properties: 0x%08x", xResult ) );
-        }
-        else
-        {
-            LogInfo( ( "Successfully parsed properties" ) );
-            xResult = eAzureIoTSuccess;
+            prvReportWritableProperties( ulVersion, ulReceived );
         }
     }
 
@@ -493,7 +644,7 @@ static void prvHandleProperties( AzureIoTHubClientPropertiesResponse_t * pxMessa
         case eAzureIoTHubPropertiesRequestedMessage:
             LogInfo( ( "Device property document GET received" ) );
 
-            xResult = prvProcessProperties( pxMessage, eAzureIoTHubClientPropertyWritable );
+            xResult = prvProcessProperties( pxMessage );
 
             if( xResult != eAzureIoTSuccess )
             {
@@ -505,7 +656,7 @@ static void prvHandleProperties( AzureIoTHubClientPropertiesResponse_t * pxMessa
         case eAzureIoTHubPropertiesWritablePropertyMessage:
             LogInfo( ( "Device writeable property received" ) );
 
-            xResult = prvProcessProperties( pxMessage, eAzureIoTHubClientPropertyWritable );
+            xResult = prvProcessProperties( pxMessage );
 
             if( xResult != eAzureIoTSuccess )
             {
@@ -516,6 +667,7 @@ static void prvHandleProperties( AzureIoTHubClientPropertiesResponse_t * pxMessa
 
         case eAzureIoTHubPropertiesReportedResponseMessage:
             LogInfo( ( "Device reported property response received" ) );
+            ReportedProperties_HandleResponse( &xReportedPropertiesStore, pxMessage );
 
             break;
 
@@ -526,165 +678,31 @@ static void prvHandleProperties( AzureIoTHubClientPropertiesResponse_t * pxMessa
 /*-----------------------------------------------------------*/
 
 /**
- * @brief Setup transport credentials.
- */
-static uint32_t prvSetupNetworkCredentials( NetworkCredentials_t * pxNetworkCredentials )
-{
-    pxNetworkCredentials->xDisableSni = pdFALSE;
-    /* Set the credentials for establishing a TLS connection. */
-    pxNetworkCredentials->pucRootCa = ( const unsigned char * ) democonfigROOT_CA_PEM;
-    pxNetworkCredentials->xRootCaSize = sizeof( democonfigROOT_CA_PEM );
-    #ifdef democonfigCLIENT_CERTIFICATE_PEM
-        pxNetworkCredentials->pucClientCert = ( const unsigned char * ) democonfigCLIENT_CERTIFICATE_PEM;
-        pxNetworkCredentials->xClientCertSize = sizeof( democonfigCLIENT_CERTIFICATE_PEM );
-        pxNetworkCredentials->pucPrivateKey = ( const unsigned char * ) democonfigCLIENT_PRIVATE_KEY_PEM;
-        pxNetworkCredentials->xPrivateKeySize = sizeof( democonfigCLIENT_PRIVATE_KEY_PEM );
-    #endif
-
-    return 0;
-}
-/*-----------------------------------------------------------*/
-
-/**
- * @brief Connect to server with backoff retries.
+ * @brief Telemetry PUBACK callback, called from the process loop.
  */
-static uint32_t prvConnectToServerWithBackoffRetries( const char * pcHostName,
-                                                      uint32_t port,
-                                                      NetworkCredentials_t * pxNetworkCredentials,
-                                                      NetworkContext_t * pxNetworkContext )
+static void prvTelemetryAckCallback( uint16_t usPacketID )
 {
-    TlsTransportStatus_t xNetworkStatus;
-    BackoffAlgorithmStatus_t xBackoffAlgStatus = BackoffAlgorithmSuccess;
-    BackoffAlgorithmContext_t xReconnectParams;
-    uint16_t usNextRetryBackOff = 0U;
-
-    /* Initialize reconnect attempts and interval. */
-    BackoffAlgorithm_InitializeParams( &xReconnectParams,
-                                       sampleazureiotgsgRETRY_BACKOFF_BASE_MS,
-                                       sampleazureiotgsgRETRY_MAX_BACKOFF_DELAY_MS,
-                                       sampleazureiotgsgRETRY_MAX_ATTEMPTS );
-
-    /* Attempt to connect to IoT Hub. If connection fails, retry after
-     * a timeout. Timeout value will exponentially increase till maximum
-     * attempts are reached.
-     */
-    do
-    {
-        LogInfo( ( "Creating a TLS connection to %s:%u.\r\n", pcHostName, port ) );
-        /* Attempt to create a mutually authenticated TLS connection. */
-        xNetworkStatus = TLS_Socket_Connect( pxNetworkContext,
-                                             pcHostName, port,
-                                             pxNetworkCredentials,
-                                             sampleazureiotgsgTRANSPORT_SEND_RECV_TIMEOUT_MS,
-                                             sampleazureiotgsgTRANSPORT_SEND_RECV_TIMEOUT_MS );
-
-        if( xNetworkStatus != eTLSTransportSuccess )
-        {
-            /* Generate a random number and calculate backoff value (in milliseconds) for
-             * the next connection retry.
-             * Note: It is recommended to seed the random number generator with a device-specific
-             * entropy source so that possibility of multiple devices retrying failed network operations
-             * at similar intervals can be avoided. */
-            xBackoffAlgStatus = BackoffAlgorithm_GetNextBackoff( &xReconnectParams, configRAND32(), &usNextRetryBackOff );
-
-            if( xBackoffAlgStatus == BackoffAlgorithmRetriesExhausted )
-            {
-                LogError( ( "Connection to the IoT Hub failed, all attempts exhausted." ) );
-            }
-            else if( xBackoffAlgStatus == BackoffAlgorithmSuccess )
-            {
-                LogWarn( ( "Connection to the IoT Hub failed [%d]. "
-                           "Retrying connection with backoff and jitter [%d]ms.",
-                           xNetworkStatus, usNextRetryBackOff ) );
-                vTaskDelay( pdMS_TO_TICKS( usNextRetryBackOff ) );
-            }
-        }
-    } while( ( xNetworkStatus != eTLSTransportSuccess ) && ( xBackoffAlgStatus == BackoffAlgorithmSuccess ) );
-
-    return xNetworkStatus == eTLSTransportSuccess ? 0 : 1;
+    PublishWindow_Acknowledge( &xPublishWindow, usPacketID );
 }
 /*-----------------------------------------------------------*/
 
 #ifdef democonfigENABLE_DPS_SAMPLE
 
 /**
- * @brief Gets the IoT Hub endpoint and deviceId from Provisioning service.
- *   This function will block for Provisioning service for result or return failure.
+ * @brief Create the registration payload, with the model ID of the device.
  *
- * @param[in] pXNetworkCredentials  Network credential used to connect to Provisioning service
- * @param[out] ppucIothubHostname  Pointer to uint8_t* IoT Hub hostname return from Provisioning Service
- * @param[in,out] pulIothubHostnameLength  Length of hostname
- * @param[out] ppucIothubDeviceId  Pointer to uint8_t* deviceId return from Provisioning Service
- * @param[in,out] pulIothubDeviceIdLength  Length of deviceId
+ * @param[out] pucBuffer The buffer for the payload.
+ * @param[in] ulBufferLength Length of \p pucBuffer.
+ * @return The length of the payload.
  */
-    static uint32_t prvIoTHubInfoGet( NetworkCredentials_t * pXNetworkCredentials,
-                                      uint8_t ** ppucIothubHostname,
-                                      uint32_t * pulIothubHostnameLength,
-                                      uint8_t ** ppucIothubDeviceId,
-                                      uint32_t * pulIothubDeviceIdLength )
+    static uint32_t prvCreateProvisioningPayload( uint8_t * pucBuffer,
+                                                  uint32_t ulBufferLength )
     {
-        NetworkContext_t xNetworkContext = { 0 };
-        TlsTransportParams_t xTlsTransportParams = { 0 };
         AzureIoTResult_t xResult;
         AzureIoTJSONWriter_t xWriter;
-        AzureIoTTransportInterface_t xTransport;
-        uint32_t ulSamplepIothubHostnameLength = sizeof( ucSampleIotHubHostname );
-        uint32_t ulSamplepIothubDeviceIdLength = sizeof( ucSampleIotHubDeviceId );
-        uint32_t ulStatus;
         int32_t lBytesWritten;
 
-        /* Set the pParams member of the network context with desired transport. */
-        xNetworkContext.pParams = &xTlsTransportParams;
-
-        ulStatus = prvConnectToServerWithBackoffRetries( democonfigENDPOINT, democonfigIOTHUB_PORT,
-                                                         pXNetworkCredentials, &xNetworkContext );
-        configASSERT( ulStatus == 0 );
-
-        /* Fill in Transport Interface send and receive function pointers. */
-        xTransport.pxNetworkContext = &xNetworkContext;
-        xTransport.xSend = TLS_Socket_Send;
-        xTransport.xRecv = TLS_Socket_Recv;
-
-        #ifdef democonfigUSE_HSM
-
-            /* Redefine the democonfigREGISTRATION_ID macro using registration ID
-             * generated dynamically using the HSM */
-
-            /* We use a pointer instead of a buffer so that the getRegistrationId
-             * function can allocate the necessary memory depending on the HSM */
-            char * registration_id = NULL;
-            ulStatus = getRegistrationId( &registration_id );
-            configASSERT( ulStatus == 0 );
-#undef democonfigREGISTRATION_ID
-        #define democonfigREGISTRATION_ID    registration_id
-        #endif
-
-        xResult = AzureIoTProvisioningClient_Init( &xAzureIoTProvisioningClient,
-                                                   ( const uint8_t * ) democonfigENDPOINT,
-                                                   sizeof( democonfigENDPOINT ) - 1,
-                                                   ( const uint8_t * ) democonfigID_SCOPE,
-                                                   sizeof( democonfigID_SCOPE ) - 1,
-                                                   ( const uint8_t * ) democonfigREGISTRATION_ID,
-                                                   #ifdef democonfigUSE_HSM
-                                                       strlen( democonfigREGISTRATION_ID ),
-                                                   #else
-                                                       sizeof( democonfigREGISTRATION_ID ) - 1,
-                                                   #endif
-                                                   NULL, ucMQTTMessageBuffer, sizeof( ucMQTTMessageBuffer ),
-                                                   ullGetUnixTime,
-                                                   &xTransport );
-        configASSERT( xResult == eAzureIoTSuccess );
-
-        #ifdef democonfigDEVICE_SYMMETRIC_KEY
-            xResult = AzureIoTProvisioningClient_SetSymmetricKey( &xAzureIoTProvisioningClient,
-                                                                  ( const uint8_t * ) democonfigDEVICE_SYMMETRIC_KEY,
-                                                                  sizeof( democonfigDEVICE_SYMMETRIC_KEY ) - 1,
-                                                                  Crypto_HMAC );
-            configASSERT( xResult == eAzureIoTSuccess );
-        #endif /* democonfigDEVICE_SYMMETRIC_KEY */
-
-        /* Create the DPS payload */
-        xResult = AzureIoTJSONWriter_Init( &xWriter, ( uint8_t * ) &ucScratchBuffer, sizeof( ucScratchBuffer ) - 1 );
+        xResult = AzureIoTJSONWriter_Init( &xWriter, pucBuffer, ulBufferLength );
         configASSERT( xResult == eAzureIoTSuccess );
 
         xResult = AzureIoTJSONWriter_AppendBeginObject( &xWriter );
@@ -702,45 +720,7 @@ static uint32_t prvConnectToServerWithBackoffRetries( const char * pcHostName,
         lBytesWritten = AzureIoTJSONWriter_GetBytesUsed( &xWriter );
         configASSERT( lBytesWritten > 0 );
 
-        xResult = AzureIoTProvisioningClient_SetRegistrationPayload( &xAzureIoTProvisioningClient,
-                                                                     ( const uint8_t * ) ucScratchBuffer,
-                                                                     lBytesWritten );
-        configASSERT( xResult == eAzureIoTSuccess );
-
-        /* Register the device with DPS */
-        do
-        {
-            xResult = AzureIoTProvisioningClient_Register( &xAzureIoTProvisioningClient,
-                                                           sampleazureiotgsgPROVISIONING_REGISTRATION_TIMEOUT_MS );
-        } while( xResult == eAzureIoTErrorPending );
-
-        if( xResult == eAzureIoTSuccess )
-        {
-            LogInfo( ( "Successfully acquired IoT Hub name and Device ID" ) );
-        }
-        else
-        {
-            LogInfo( ( "Error geting IoT Hub name and Device ID: 0x%08", xResult ) );
-        }
-
-        configASSERT( xResult == eAzureIoTSuccess );
-
-        xResult = AzureIoTProvisioningClient_GetDeviceAndHub( &xAzureIoTProvisioningClient,
-                                                              ucSampleIotHubHostname, &ulSamplepIothubHostnameLength,
-                                                              ucSampleIotHubDeviceId, &ulSamplepIothubDeviceIdLength );
-        configASSERT( xResult == eAzureIoTSuccess );
-
-        AzureIoTProvisioningClient_Deinit( &xAzureIoTProvisioningClient );
-
-        /* Close the network connection.  */
-        TLS_Socket_Disconnect( &xNetworkContext );
-
-        *ppucIothubHostname = ucSampleIotHubHostname;
-        *pulIothubHostnameLength = ulSamplepIothubHostnameLength;
-        *ppucIothubDeviceId = ucSampleIotHubDeviceId;
-        *pulIothubDeviceIdLength = ulSamplepIothubDeviceIdLength;
-
-        return 0;
+        return ( uint32_t ) lBytesWritten;
     }
 /*-----------------------------------------------------------*/
 
@@ -756,7 +736,6 @@ static uint32_t prvConnectToServerWithBackoffRetries( const char * pcHostName,
 static void prvAzureDemoTask( void * pvParameters )
 {
     uint32_t ulScratchBufferLength = 0U;
-    NetworkCredentials_t xNetworkCredentials = { 0 };
     AzureIoTTransportInterface_t xTransport;
     NetworkContext_t xNetworkContext = { 0 };
     TlsTransportParams_t xTlsTransportParams = { 0 };
@@ -764,7 +743,6 @@ static void prvAzureDemoTask( void * pvParameters )
     uint32_t ulStatus;
     AzureIoTHubClientOptions_t xHubOptions = { 0 };
     bool xSessionPresent;
-    uint64_t lastTelemetryTime;
 
     #ifdef democonfigENABLE_DPS_SAMPLE
         uint8_t * pucIotHubHostname = NULL;
@@ -783,14 +761,22 @@ static void prvAzureDemoTask( void * pvParameters )
     /* Initialize Azure IoT Middleware. */
     configASSERT( AzureIoT_Init() == eAzureIoTSuccess );
 
-    ulStatus = prvSetupNetworkCredentials( &xNetworkCredentials );
-    configASSERT( ulStatus == 0 );
+    xResult = ConnectionManager_Init( &xConnectionManager,
+                                      ucMQTTMessageBuffer, sizeof( ucMQTTMessageBuffer ),
+                                      sampleazureiotgsgTRANSPORT_SEND_RECV_TIMEOUT_MS );
+    configASSERT( xResult == eAzureIoTSuccess );
+
+    ConnectionManager_WaitInitialDelay( &xConnectionManager );
 
     #ifdef democonfigENABLE_DPS_SAMPLE
+        ulScratchBufferLength = prvCreateProvisioningPayload( ucScratchBuffer, sizeof( ucScratchBuffer ) - 1 );
+
         /* Run DPS.  */
-        if( ( ulStatus = prvIoTHubInfoGet( &xNetworkCredentials, &pucIotHubHostname,
-                                           &pulIothubHostnameLength, &pucIotHubDeviceId,
-                                           &pulIothubDeviceIdLength ) ) != 0 )
+        if( ( ulStatus = ConnectionManager_Provision( &xConnectionManager,
+                                                      ucScratchBuffer, ulScratchBufferLength,
+                                                      sampleazureiotgsgPROVISIONING_REGISTRATION_TIMEOUT_MS,
+                                                      &pucIotHubHostname, &pulIothubHostnameLength,
+                                                      &pucIotHubDeviceId, &pulIothubDeviceIdLength ) ) != 0 )
         {
             LogError( ( "Failed on sample_dps_entry!: error code = 0x%08x\r\n", ulStatus ) );
             return;
@@ -805,9 +791,8 @@ static void prvAzureDemoTask( void * pvParameters )
      * value is reached. The function returns a failure status if the TCP
      * connection cannot be established to the IoT Hub after the configured
      * number of attempts. */
-    ulStatus = prvConnectToServerWithBackoffRetries( ( const char * ) pucIotHubHostname,
-                                                     democonfigIOTHUB_PORT,
-                                                     &xNetworkCredentials, &xNetworkContext );
+    ulStatus = ConnectionManager_ConnectHubNoFailover( &xConnectionManager, ( const char * ) pucIotHubHostname,
+                                                       democonfigIOTHUB_PORT, &xNetworkContext );
     configASSERT( ulStatus == 0 );
 
     /* Fill in Transport Interface send and receive function pointers. */
@@ -815,12 +800,19 @@ static void prvAzureDemoTask( void * pvParameters )
     xTransport.xSend = TLS_Socket_Send;
     xTransport.xRecv = TLS_Socket_Recv;
 
+    /* The sample only takes writable properties from a property document. */
+    xResult = PropertiesStream_Init( &xPropertiesStream, &xTransport, democonfigNETWORK_RX_BUFFER_SIZE,
+                                     eAzureIoTHubClientPropertyWritable, &xPropertyTable,
+                                     ucPropertiesStreamBuffer, sizeof( ucPropertiesStreamBuffer ) );
+    configASSERT( xResult == eAzureIoTSuccess );
+
     /* Init IoT Hub option */
     xResult = AzureIoTHubClient_OptionsInit( &xHubOptions );
     configASSERT( xResult == eAzureIoTSuccess );
 
     xHubOptions.pucModuleID = ( const uint8_t * ) democonfigMODULE_ID;
     xHubOptions.ulModuleIDLength = sizeof( democonfigMODULE_ID ) - 1;
+    xHubOptions.xTelemetryCallback = prvTelemetryAckCallback;
     xHubOptions.pucModelID = ( const uint8_t * ) pcModelId;
     xHubOptions.ulModelIDLength = strlen( pcModelId );
 
@@ -862,38 +854,57 @@ static void prvAzureDemoTask( void * pvParameters )
     xResult = AzureIoTHubClient_RequestPropertiesAsync( &xAzureIoTHubClient );
     configASSERT( xResult == eAzureIoTSuccess );
 
-    lastTelemetryTime = ullGetUnixTime();
+    xResult = PublishWindow_Init( &xPublishWindow, &xAzureIoTHubClient,
+                                  sampleazureiotgsgPROCESS_LOOP_TIMEOUT_MS, NULL, NULL );
+    configASSERT( xResult == eAzureIoTSuccess );
+
+    xResult = TelemetryBatch_Init( &xTelemetryBatch, &xAzureIoTHubClient, NULL, &xPublishWindow,
+                                   sampleazureiotgsgTELEMETRY_BATCH_BUFFER, democonfigTELEMETRY_BATCH_BUFFER_SIZE,
+                                   democonfigTELEMETRY_BATCH_COUNT, pdMS_TO_TICKS( democonfigTELEMETRY_BATCH_MAX_AGE_MS ) );
+    configASSERT( xResult == eAzureIoTSuccess );
+
+    xDemoTaskHandle = xTaskGetCurrentTaskHandle();
+    xTelemetryTimer = xTimerCreateStatic( "Telemetry", pdMS_TO_TICKS( 1000U ), pdTRUE,
+                                          NULL, prvTelemetryTimerCallback, &xTelemetryTimerBuffer );
+    configASSERT( xTelemetryTimer != NULL );
+
+    /* Sets the period from lTelemetryInterval and starts the timer. */
+    prvUpdateTelemetryTimer();
 
-    /* Report properties */
-    prvReportLedState();
-    prvReportTelemetryInterval( 0 );
-    prvReportDeviceInfo();
+    /* Report properties. The LED state and device information go out with
+     * the first update, they are all marked until then. */
+    ReportedProperties_SetBool( &xReportedPropertiesStore, sampleazureiotgsgLED_STATE_INDEX, xLedState );
+    prvSetDeviceInfo();
+    prvReportWritableProperties( 0, sampleazureiotgsgRECEIVED_INTERVAL );
 
-    /* Loop forever */
+    /* Loop forever, blocking in the process loop until data arrives or telemetry is due. */
     while( true )
     {
-        uint64_t currentTime = ullGetUnixTime();
-
-        if( currentTime > ( lastTelemetryTime + lTelemetryInterval ) )
+        /* Ticks missed while busy are collapsed into one reading. */
+        if( ulTaskNotifyTake( pdTRUE, 0 ) > 0 )
         {
-            /* Advance the time */
-            while( currentTime > ( lastTelemetryTime + lTelemetryInterval ) )
-            {
-                lastTelemetryTime += lTelemetryInterval;
-            }
-
             ulScratchBufferLength = ulCreateTelemetry( ucScratchBuffer, sizeof( ucScratchBuffer ) - 1 );
 
-            xResult = AzureIoTHubClient_SendTelemetry( &xAzureIoTHubClient,
-                                                       ucScratchBuffer, ulScratchBufferLength,
-                                                       NULL, eAzureIoTHubMessageQoS1, NULL );
-            configASSERT( xResult == eAzureIoTSuccess );
+            /* Nothing is sent when no reading changed past its deadband. */
+            if( ulScratchBufferLength > 0 )
+            {
+                xResult = TelemetryBatch_Add( &xTelemetryBatch, ucScratchBuffer, ulScratchBufferLength );
+                configASSERT( xResult == eAzureIoTSuccess );
+            }
         }
 
-        /* :TODO: the processloop runs for 10 seconds */
-        xResult = AzureIoTHubClient_ProcessLoop( &xAzureIoTHubClient, 0 );
+        xResult = AzureIoTHubClient_ProcessLoop( &xAzureIoTHubClient, prvGetProcessLoopTimeoutMs() );
+
+        configASSERT( xResult == eAzureIoTSuccess );
 
+        xResult = TelemetryBatch_Process( &xTelemetryBatch );
         configASSERT( xResult == eAzureIoTSuccess );
+
+        if( ReportedProperties_Send( &xReportedPropertiesStore, &xAzureIoTHubClient,
+                                     ucPropertyPayloadBuffer, sizeof( ucPropertyPayloadBuffer ) ) != eAzureIoTSuccess )
+        {
+            LogError( ( "There was an error sending the reported properties" ) );
+        }
     }
 }
 /*-----------------------------------------------------------*/
@@ -905,11 +916,12 @@ void vStartDemoTask( void )
 {
     /* This example uses a single application task, which in turn is used to
      * connect, subscribe, publish, unsubscribe and disconnect from the IoT Hub */
-    xTaskCreate( prvAzureDemoTask,         /* Function that implements the task. */
-                 "AzureDemoTask",          /* Text name for the task - only used for debugging. */
-                 democonfigDEMO_STACKSIZE, /* Size of stack (in words, not bytes) to allocate for the task. */
-                 NULL,                     /* Task parameter - not used in this case. */
-                 tskIDLE_PRIORITY,         /* Task priority, must be between 0 and configMAX_PRIORITIES - 1. */
-                 NULL );                   /* Used to pass out a handle to the created task - not used in this case. */
+    sampletaskCREATE( prvAzureDemoTask,          /* Function that implements the task. */
+                      "AzureDemoTask",           /* Text name for the task - only used for debugging. */
+                      democonfigDEMO_STACKSIZE,  /* Size of stack (in words, not bytes) to allocate for the task. */
+                      NULL,                      /* Task parameter - not used in this case. */
+                      tskIDLE_PRIORITY + 1,      /* Task priority, must be between 0 and configMAX_PRIORITIES - 1. */
+                      NULL,                      /* Used to pass out a handle to the created task - not used in this case. */
+                      democonfigDEMO_TASK_CORE ); /* Core the task is pinned to, if democonfigPIN_TASKS_TO_CORE is defined. */
 }
 /*-----------------------------------------------------------*/
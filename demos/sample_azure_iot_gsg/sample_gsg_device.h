@@ -7,6 +7,8 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+#include "azure_sample_telemetry_filter.h"
+
 extern const char * pcModelId;
 
 extern const char * pcManufacturerPropertyValue;
@@ -18,8 +20,13 @@ extern const char * pcProcessorManufacturerPropertyValue;
 extern const double xTotalStoragePropertyValue;
 extern const double xTotalMemoryPropertyValue;
 
+/* Filter of the telemetry fields of the device, whose heartbeat and
+ * deadbands are set through writable properties. */
+extern TelemetryFilter_t xTelemetryFilter;
+
 void vSetLedState( bool xLevel );
 
+/* Returns 0 when no field is to be sent. */
 uint32_t ulCreateTelemetry( uint8_t * pucTelemetryData,
                             uint32_t ulTelemetryDataLength );
 
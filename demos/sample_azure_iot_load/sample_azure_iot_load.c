@@ -0,0 +1,850 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @file sample_azure_iot_load.c
+ * @brief Load generator running many simulated devices against IoT Hub.
+ *
+ * Each device runs in its own task with its own hub client, network context,
+ * TLS session cache and MQTT buffer. Devices publish QoS 1 telemetry at a fixed
+ * rate, and a report task periodically logs the aggregate message rate,
+ * connect latency and PUBACK latency percentiles.
+ *
+ * Device IDs are generated from democonfigLOAD_DEVICE_ID_FORMAT and their keys
+ * are derived from democonfigLOAD_GROUP_SYMMETRIC_KEY the way a DPS group
+ * enrollment derives them, so the devices can be provisioned with DPS or be
+ * created in the hub up front with the same derived keys.
+ */
+
+/* Standard includes. */
+#include <string.h>
+#include <stdio.h>
+
+/* Kernel includes. */
+#include "FreeRTOS.h"
+#include "task.h"
+
+/* Demo Specific configs. */
+#include "demo_config.h"
+
+/* Azure Provisioning/IoT Hub library includes */
+#include "azure_iot_hub_client.h"
+#include "azure_iot_provisioning_client.h"
+
+/* Transport interface implementation include header for TLS. */
+#include "transport_tls_socket.h"
+
+/* Crypto helper header. */
+#include "azure_sample_crypto.h"
+
+/* Telemetry topic rendered once per connection. */
+#include "azure_sample_prepared_telemetry.h"
+
+/* mbed TLS includes. */
+#include "mbedtls/base64.h"
+
+/*-----------------------------------------------------------*/
+
+/* Compile time error for undefined configs. */
+#if !defined( democonfigHOSTNAME ) && !defined( democonfigENABLE_DPS_SAMPLE )
+    #error "Define the config democonfigHOSTNAME by following the instructions in file demo_config.h."
+#endif
+
+#if !defined( democonfigENDPOINT ) && defined( democonfigENABLE_DPS_SAMPLE )
+    #error "Define the config dps endpoint by following the instructions in file demo_config.h."
+#endif
+
+#ifndef democonfigROOT_CA_PEM
+    #error "Please define Root CA certificate of the IoT Hub(democonfigROOT_CA_PEM) in demo_config.h."
+#endif
+
+#ifndef democonfigLOAD_GROUP_SYMMETRIC_KEY
+    #error "Please define the key the device keys are derived from (democonfigLOAD_GROUP_SYMMETRIC_KEY) in demo_config.h."
+#endif
+
+#if ( configNUM_THREAD_LOCAL_STORAGE_POINTERS < 1 )
+    #error "The load generator needs configNUM_THREAD_LOCAL_STORAGE_POINTERS of at least 1."
+#endif
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Number of simulated devices.
+ */
+#ifndef democonfigLOAD_DEVICE_COUNT
+    #define democonfigLOAD_DEVICE_COUNT    ( 10U )
+#endif
+
+/**
+ * @brief printf format of the device IDs, given the device number.
+ */
+#ifndef democonfigLOAD_DEVICE_ID_FORMAT
+    #define democonfigLOAD_DEVICE_ID_FORMAT    "loaddevice-%05u"
+#endif
+
+/**
+ * @brief Number of the first device, to split a device range across hosts.
+ */
+#ifndef democonfigLOAD_DEVICE_ID_OFFSET
+    #define democonfigLOAD_DEVICE_ID_OFFSET    ( 0U )
+#endif
+
+/**
+ * @brief Time between telemetry messages of each device, in milliseconds.
+ */
+#ifndef democonfigLOAD_TELEMETRY_INTERVAL_MS
+    #define democonfigLOAD_TELEMETRY_INTERVAL_MS    ( 1000U )
+#endif
+
+/**
+ * @brief Size of each telemetry payload in bytes.
+ */
+#ifndef democonfigLOAD_PAYLOAD_SIZE
+    #define democonfigLOAD_PAYLOAD_SIZE    ( 128U )
+#endif
+
+/**
+ * @brief Delay between the start of consecutive devices, in milliseconds, so
+ * the hub and DPS see a connect ramp instead of a single burst.
+ */
+#ifndef democonfigLOAD_CONNECT_SPACING_MS
+    #define democonfigLOAD_CONNECT_SPACING_MS    ( 50U )
+#endif
+
+/**
+ * @brief Interval of the aggregate report, in milliseconds.
+ */
+#ifndef democonfigLOAD_REPORT_INTERVAL_MS
+    #define democonfigLOAD_REPORT_INTERVAL_MS    ( 10000U )
+#endif
+
+#if ( democonfigLOAD_PAYLOAD_SIZE < 32U )
+    #error "democonfigLOAD_PAYLOAD_SIZE must be at least 32 bytes."
+#endif
+
+/**
+ * @brief Messages a device can have waiting for PUBACK. A device skips its
+ * send slot when all of them are in flight.
+ */
+#define sampleazureiotloadMAX_INFLIGHT                ( 8U )
+
+/**
+ * @brief Width and number of the latency histogram buckets. The last bucket
+ * also counts everything above the histogram range.
+ */
+#define sampleazureiotloadHISTOGRAM_BUCKET_MS         ( 5U )
+#define sampleazureiotloadHISTOGRAM_BUCKETS           ( 2000U )
+
+/**
+ * @brief Delay before a device reconnects after losing its connection.
+ */
+#define sampleazureiotloadRECONNECT_DELAY_MS          ( 5000U )
+
+/**
+ * @brief Thread local storage slot holding the device of a task, used to
+ * attribute PUBACKs as the acknowledgement callback has no context.
+ */
+#define sampleazureiotloadTLS_INDEX                   ( 0 )
+
+/**
+ * @brief Timeout for receiving CONNACK packet in milliseconds.
+ */
+#define sampleazureiotCONNACK_RECV_TIMEOUT_MS         ( 10 * 1000U )
+
+/**
+ * @brief Transport timeout in milliseconds for transport send and receive.
+ */
+#define sampleazureiotTRANSPORT_SEND_RECV_TIMEOUT_MS  ( 2000U )
+
+/**
+ * @brief Timeout for each provisioning registration poll in milliseconds.
+ */
+#define sampleazureiotProvisioning_Registration_TIMEOUT_MS    ( 3 * 1000U )
+
+/**
+ * @brief Longest single wait in the process loop, in milliseconds.
+ */
+#define sampleazureiotloadMAX_PROCESS_LOOP_MS         ( 500U )
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Unix time.
+ *
+ * @return Time in milliseconds.
+ */
+uint64_t ullGetUnixTime( void );
+/*-----------------------------------------------------------*/
+
+/* Each compilation unit must define the NetworkContext struct. */
+struct NetworkContext
+{
+    void * pParams;
+};
+
+typedef struct LoadInflight
+{
+    uint16_t usPacketID;  /* 0 when the slot is free. */
+    TickType_t xSendTime; /* Tick count when the message was sent. */
+} LoadInflight_t;
+
+typedef struct LoadDevice
+{
+    uint32_t ulNumber;
+    uint8_t ucDeviceId[ 128 ];
+    uint32_t ulDeviceIdLength;
+    uint8_t ucDeviceKey[ 64 ];
+    uint32_t ulDeviceKeyLength;
+    uint8_t ucHostname[ 128 ];
+    uint32_t ulHostnameLength;
+    uint32_t ulSequence;
+    AzureIoTHubClient_t xHubClient;
+    PreparedTelemetry_t xTelemetry;
+    #ifdef democonfigENABLE_DPS_SAMPLE
+        AzureIoTProvisioningClient_t xProvisioningClient;
+    #endif /* democonfigENABLE_DPS_SAMPLE */
+    NetworkCredentials_t xNetworkCredentials;
+    NetworkContext_t xNetworkContext;
+    TlsTransportParams_t xTlsTransportParams;
+    AzureIoTTransportInterface_t xTransport;
+    TlsSessionCache_t xSessionCache;
+    LoadInflight_t xInflight[ sampleazureiotloadMAX_INFLIGHT ];
+    uint8_t ucPayload[ democonfigLOAD_PAYLOAD_SIZE ];
+    uint8_t ucMQTTMessageBuffer[ democonfigNETWORK_BUFFER_SIZE ];
+} LoadDevice_t;
+
+typedef struct LoadHistogram
+{
+    uint32_t ulBuckets[ sampleazureiotloadHISTOGRAM_BUCKETS ];
+    uint32_t ulCount;
+    uint32_t ulMaxMs;
+} LoadHistogram_t;
+
+typedef struct LoadStats
+{
+    uint32_t ulConnected;
+    uint32_t ulConnectFailures;
+    uint32_t ulDisconnects;
+    uint32_t ulSent;
+    uint32_t ulAcked;
+    uint32_t ulSendFailures;
+    uint32_t ulSkipped;
+    LoadHistogram_t xConnectLatency;
+    LoadHistogram_t xPubackLatency;
+    #ifdef democonfigENABLE_DPS_SAMPLE
+        LoadHistogram_t xProvisioningLatency;
+    #endif /* democonfigENABLE_DPS_SAMPLE */
+} LoadStats_t;
+/*-----------------------------------------------------------*/
+
+static LoadDevice_t xLoadDevices[ democonfigLOAD_DEVICE_COUNT ];
+
+/* Updated by every device task inside critical sections. */
+static LoadStats_t xLoadStats;
+
+/* Decoded democonfigLOAD_GROUP_SYMMETRIC_KEY. */
+static uint8_t ucGroupKey[ 64 ];
+static size_t xGroupKeyLength;
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Add a sample to a histogram. Must be called inside a critical section.
+ */
+static void prvHistogramAdd( LoadHistogram_t * pxHistogram,
+                             uint32_t ulLatencyMs )
+{
+    uint32_t ulBucket = ulLatencyMs / sampleazureiotloadHISTOGRAM_BUCKET_MS;
+
+    if( ulBucket >= sampleazureiotloadHISTOGRAM_BUCKETS )
+    {
+        ulBucket = sampleazureiotloadHISTOGRAM_BUCKETS - 1U;
+    }
+
+    pxHistogram->ulBuckets[ ulBucket ]++;
+    pxHistogram->ulCount++;
+
+    if( ulLatencyMs > pxHistogram->ulMaxMs )
+    {
+        pxHistogram->ulMaxMs = ulLatencyMs;
+    }
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Get a percentile from a histogram, as the upper edge of the bucket it
+ * falls in. Must be called inside a critical section.
+ */
+static uint32_t prvHistogramPercentile( const LoadHistogram_t * pxHistogram,
+                                        uint32_t ulPercentile )
+{
+    uint64_t ullRank;
+    uint64_t ullSeen = 0;
+    uint32_t ulBucket;
+
+    if( pxHistogram->ulCount == 0U )
+    {
+        return 0U;
+    }
+
+    /* Rank of the sample at the percentile, rounded up. */
+    ullRank = ( ( uint64_t ) pxHistogram->ulCount * ulPercentile + 99U ) / 100U;
+
+    for( ulBucket = 0; ulBucket < sampleazureiotloadHISTOGRAM_BUCKETS - 1U; ulBucket++ )
+    {
+        ullSeen += pxHistogram->ulBuckets[ ulBucket ];
+
+        if( ullSeen >= ullRank )
+        {
+            return ( ulBucket + 1U ) * sampleazureiotloadHISTOGRAM_BUCKET_MS;
+        }
+    }
+
+    return pxHistogram->ulMaxMs;
+}
+/*-----------------------------------------------------------*/
+
+static uint32_t prvTicksToMs( TickType_t xTicks )
+{
+    return ( uint32_t ) ( ( uint64_t ) xTicks * 1000U / configTICK_RATE_HZ );
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief PUBACK callback, called from the process loop of the device task.
+ */
+static void prvTelemetryAckCallback( uint16_t usPacketID )
+{
+    LoadDevice_t * pxDevice = ( LoadDevice_t * ) pvTaskGetThreadLocalStoragePointer( NULL, sampleazureiotloadTLS_INDEX );
+    uint32_t ulIndex;
+
+    if( pxDevice == NULL )
+    {
+        return;
+    }
+
+    for( ulIndex = 0; ulIndex < sampleazureiotloadMAX_INFLIGHT; ulIndex++ )
+    {
+        if( pxDevice->xInflight[ ulIndex ].usPacketID == usPacketID )
+        {
+            pxDevice->xInflight[ ulIndex ].usPacketID = 0;
+
+            taskENTER_CRITICAL();
+            xLoadStats.ulAcked++;
+            prvHistogramAdd( &xLoadStats.xPubackLatency,
+                             prvTicksToMs( xTaskGetTickCount() - pxDevice->xInflight[ ulIndex ].xSendTime ) );
+            taskEXIT_CRITICAL();
+            break;
+        }
+    }
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Generate the device ID and derive its key from the group key:
+ * base64( HMAC-SHA256( group key, device ID ) ).
+ */
+static uint32_t prvSetupDeviceIdentity( LoadDevice_t * pxDevice )
+{
+    uint8_t ucDigest[ 32 ];
+    uint32_t ulDigestLength = 0;
+    size_t xKeyLength = 0;
+    int lLength;
+
+    lLength = snprintf( ( char * ) pxDevice->ucDeviceId, sizeof( pxDevice->ucDeviceId ),
+                        democonfigLOAD_DEVICE_ID_FORMAT, ( unsigned ) pxDevice->ulNumber );
+
+    if( ( lLength <= 0 ) || ( ( size_t ) lLength >= sizeof( pxDevice->ucDeviceId ) ) )
+    {
+        return 1;
+    }
+
+    pxDevice->ulDeviceIdLength = ( uint32_t ) lLength;
+
+    if( ( Crypto_HMAC( ucGroupKey, ( uint32_t ) xGroupKeyLength,
+                       pxDevice->ucDeviceId, pxDevice->ulDeviceIdLength,
+                       ucDigest, sizeof( ucDigest ), &ulDigestLength ) != 0 ) ||
+        ( mbedtls_base64_encode( pxDevice->ucDeviceKey, sizeof( pxDevice->ucDeviceKey ),
+                                 &xKeyLength, ucDigest, ulDigestLength ) != 0 ) )
+    {
+        return 1;
+    }
+
+    pxDevice->ulDeviceKeyLength = ( uint32_t ) xKeyLength;
+
+    return 0;
+}
+/*-----------------------------------------------------------*/
+
+#ifdef democonfigENABLE_DPS_SAMPLE
+
+/**
+ * @brief Register the device with DPS and keep the hub and device ID it was
+ * assigned.
+ */
+    static uint32_t prvProvisionDevice( LoadDevice_t * pxDevice )
+    {
+        AzureIoTResult_t xResult;
+        TickType_t xStart = xTaskGetTickCount();
+        uint32_t ulHostnameLength = sizeof( pxDevice->ucHostname );
+        uint32_t ulDeviceIdLength = sizeof( pxDevice->ucDeviceId );
+        uint32_t ulStatus = 1;
+
+        if( TLS_Socket_Connect( &pxDevice->xNetworkContext, democonfigENDPOINT, democonfigIOTHUB_PORT,
+                                &pxDevice->xNetworkCredentials,
+                                sampleazureiotTRANSPORT_SEND_RECV_TIMEOUT_MS,
+                                sampleazureiotTRANSPORT_SEND_RECV_TIMEOUT_MS ) != eTLSTransportSuccess )
+        {
+            return 1;
+        }
+
+        xResult = AzureIoTProvisioningClient_Init( &pxDevice->xProvisioningClient,
+                                                   ( const uint8_t * ) democonfigENDPOINT,
+                                                   sizeof( democonfigENDPOINT ) - 1,
+                                                   ( const uint8_t * ) democonfigID_SCOPE,
+                                                   sizeof( democonfigID_SCOPE ) - 1,
+                                                   pxDevice->ucDeviceId, pxDevice->ulDeviceIdLength,
+                                                   NULL, pxDevice->ucMQTTMessageBuffer,
+                                                   sizeof( pxDevice->ucMQTTMessageBuffer ),
+                                                   ullGetUnixTime,
+                                                   &pxDevice->xTransport );
+
+        if( xResult == eAzureIoTSuccess )
+        {
+            xResult = AzureIoTProvisioningClient_SetSymmetricKey( &pxDevice->xProvisioningClient,
+                                                                  pxDevice->ucDeviceKey,
+                                                                  pxDevice->ulDeviceKeyLength,
+                                                                  Crypto_HMAC );
+
+            while( xResult == eAzureIoTSuccess )
+            {
+                xResult = AzureIoTProvisioningClient_Register( &pxDevice->xProvisioningClient,
+                                                               sampleazureiotProvisioning_Registration_TIMEOUT_MS );
+
+                if( xResult != eAzureIoTErrorPending )
+                {
+                    break;
+                }
+
+                xResult = eAzureIoTSuccess;
+            }
+
+            if( ( xResult == eAzureIoTSuccess ) &&
+                ( AzureIoTProvisioningClient_GetDeviceAndHub( &pxDevice->xProvisioningClient,
+                                                              pxDevice->ucHostname, &ulHostnameLength,
+                                                              pxDevice->ucDeviceId, &ulDeviceIdLength ) == eAzureIoTSuccess ) )
+            {
+                /* The hub host name is used as a C string for the TLS connection. */
+                pxDevice->ucHostname[ ulHostnameLength < sizeof( pxDevice->ucHostname ) ?
+                                      ulHostnameLength : sizeof( pxDevice->ucHostname ) - 1 ] = '\0';
+                pxDevice->ulHostnameLength = ulHostnameLength;
+                pxDevice->ulDeviceIdLength = ulDeviceIdLength;
+                ulStatus = 0;
+            }
+
+            AzureIoTProvisioningClient_Deinit( &pxDevice->xProvisioningClient );
+        }
+
+        TLS_Socket_Disconnect( &pxDevice->xNetworkContext );
+
+        if( ulStatus == 0 )
+        {
+            taskENTER_CRITICAL();
+            prvHistogramAdd( &xLoadStats.xProvisioningLatency, prvTicksToMs( xTaskGetTickCount() - xStart ) );
+            taskEXIT_CRITICAL();
+        }
+
+        return ulStatus;
+    }
+
+#endif /* democonfigENABLE_DPS_SAMPLE */
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Open the TLS connection and the MQTT session with the hub. The
+ * connect latency covers both.
+ */
+static uint32_t prvConnectDevice( LoadDevice_t * pxDevice )
+{
+    AzureIoTHubClientOptions_t xHubOptions = { 0 };
+    AzureIoTResult_t xResult;
+    TickType_t xStart = xTaskGetTickCount();
+    bool xSessionPresent;
+
+    if( TLS_Socket_Connect( &pxDevice->xNetworkContext, ( const char * ) pxDevice->ucHostname,
+                            democonfigIOTHUB_PORT, &pxDevice->xNetworkCredentials,
+                            sampleazureiotTRANSPORT_SEND_RECV_TIMEOUT_MS,
+                            sampleazureiotTRANSPORT_SEND_RECV_TIMEOUT_MS ) != eTLSTransportSuccess )
+    {
+        return 1;
+    }
+
+    xResult = AzureIoTHubClient_OptionsInit( &xHubOptions );
+
+    if( xResult == eAzureIoTSuccess )
+    {
+        xHubOptions.pucModuleID = ( const uint8_t * ) democonfigMODULE_ID;
+        xHubOptions.ulModuleIDLength = sizeof( democonfigMODULE_ID ) - 1;
+        xHubOptions.xTelemetryCallback = prvTelemetryAckCallback;
+
+        xResult = AzureIoTHubClient_Init( &pxDevice->xHubClient,
+                                          pxDevice->ucHostname, pxDevice->ulHostnameLength,
+                                          pxDevice->ucDeviceId, pxDevice->ulDeviceIdLength,
+                                          &xHubOptions,
+                                          pxDevice->ucMQTTMessageBuffer, sizeof( pxDevice->ucMQTTMessageBuffer ),
+                                          ullGetUnixTime,
+                                          &pxDevice->xTransport );
+    }
+
+    if( xResult == eAzureIoTSuccess )
+    {
+        xResult = AzureIoTHubClient_SetSymmetricKey( &pxDevice->xHubClient,
+                                                     pxDevice->ucDeviceKey, pxDevice->ulDeviceKeyLength,
+                                                     Crypto_HMAC );
+    }
+
+    if( xResult == eAzureIoTSuccess )
+    {
+        xResult = PreparedTelemetry_Init( &pxDevice->xTelemetry, &pxDevice->xHubClient, NULL );
+    }
+
+    if( xResult == eAzureIoTSuccess )
+    {
+        xResult = AzureIoTHubClient_Connect( &pxDevice->xHubClient,
+                                             true, &xSessionPresent,
+                                             sampleazureiotCONNACK_RECV_TIMEOUT_MS );
+
+        if( xResult != eAzureIoTSuccess )
+        {
+            AzureIoTHubClient_Deinit( &pxDevice->xHubClient );
+        }
+    }
+
+    if( xResult != eAzureIoTSuccess )
+    {
+        TLS_Socket_Disconnect( &pxDevice->xNetworkContext );
+
+        return 1;
+    }
+
+    taskENTER_CRITICAL();
+    xLoadStats.ulConnected++;
+    prvHistogramAdd( &xLoadStats.xConnectLatency, prvTicksToMs( xTaskGetTickCount() - xStart ) );
+    taskEXIT_CRITICAL();
+
+    return 0;
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Send one telemetry message if a PUBACK slot is free.
+ */
+static AzureIoTResult_t prvSendTelemetry( LoadDevice_t * pxDevice )
+{
+    LoadInflight_t * pxSlot = NULL;
+    AzureIoTResult_t xResult;
+    uint32_t ulIndex;
+    int lLength;
+
+    for( ulIndex = 0; ulIndex < sampleazureiotloadMAX_INFLIGHT; ulIndex++ )
+    {
+        if( pxDevice->xInflight[ ulIndex ].usPacketID == 0 )
+        {
+            pxSlot = &pxDevice->xInflight[ ulIndex ];
+            break;
+        }
+    }
+
+    if( pxSlot == NULL )
+    {
+        taskENTER_CRITICAL();
+        xLoadStats.ulSkipped++;
+        taskEXIT_CRITICAL();
+
+        return eAzureIoTSuccess;
+    }
+
+    /* A fixed width sequence number keeps every payload the configured size;
+     * the rest is padding. */
+    lLength = snprintf( ( char * ) pxDevice->ucPayload, sizeof( pxDevice->ucPayload ),
+                        "{\"seq\":%010u,\"pad\":\"", ( unsigned ) pxDevice->ulSequence++ );
+    ( void ) memset( &pxDevice->ucPayload[ lLength ], 'x', sizeof( pxDevice->ucPayload ) - lLength - 2 );
+    pxDevice->ucPayload[ sizeof( pxDevice->ucPayload ) - 2 ] = '"';
+    pxDevice->ucPayload[ sizeof( pxDevice->ucPayload ) - 1 ] = '}';
+
+    pxSlot->xSendTime = xTaskGetTickCount();
+    xResult = PreparedTelemetry_Send( &pxDevice->xTelemetry,
+                                      pxDevice->ucPayload, sizeof( pxDevice->ucPayload ),
+                                      eAzureIoTHubMessageQoS1, &pxSlot->usPacketID );
+
+    taskENTER_CRITICAL();
+
+    if( xResult == eAzureIoTSuccess )
+    {
+        xLoadStats.ulSent++;
+    }
+    else
+    {
+        pxSlot->usPacketID = 0;
+        xLoadStats.ulSendFailures++;
+    }
+
+    taskEXIT_CRITICAL();
+
+    return xResult;
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Publish at the configured rate until the connection fails.
+ */
+static void prvRunDevice( LoadDevice_t * pxDevice )
+{
+    const TickType_t xInterval = pdMS_TO_TICKS( democonfigLOAD_TELEMETRY_INTERVAL_MS );
+    TickType_t xNextSend = xTaskGetTickCount();
+    TickType_t xNow;
+    TickType_t xWait;
+    uint32_t ulWaitMs;
+
+    ( void ) memset( pxDevice->xInflight, 0, sizeof( pxDevice->xInflight ) );
+
+    for( ; ; )
+    {
+        xNow = xTaskGetTickCount();
+
+        /* Signed difference, so the comparison survives tick count wrap. */
+        if( ( int32_t ) ( xNow - xNextSend ) >= 0 )
+        {
+            if( prvSendTelemetry( pxDevice ) != eAzureIoTSuccess )
+            {
+                break;
+            }
+
+            xNextSend += xInterval;
+
+            /* A device that fell behind resumes the rate instead of bursting. */
+            if( ( int32_t ) ( xNow - xNextSend ) >= 0 )
+            {
+                xNextSend = xNow + xInterval;
+            }
+        }
+
+        xWait = xNextSend - xNow;
+        ulWaitMs = prvTicksToMs( xWait );
+
+        if( ulWaitMs > sampleazureiotloadMAX_PROCESS_LOOP_MS )
+        {
+            ulWaitMs = sampleazureiotloadMAX_PROCESS_LOOP_MS;
+        }
+
+        if( AzureIoTHubClient_ProcessLoop( &pxDevice->xHubClient, ulWaitMs ) != eAzureIoTSuccess )
+        {
+            break;
+        }
+    }
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Wait before reconnecting, with up to the same again of jitter so
+ * devices that dropped together do not return together.
+ */
+static void prvReconnectDelay( void )
+{
+    const TickType_t xDelay = pdMS_TO_TICKS( sampleazureiotloadRECONNECT_DELAY_MS );
+
+    vTaskDelay( xDelay + ( TickType_t ) ( configRAND32() % ( xDelay + 1U ) ) );
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Task of one simulated device.
+ */
+static void prvLoadDeviceTask( void * pvParameters )
+{
+    LoadDevice_t * pxDevice = ( LoadDevice_t * ) pvParameters;
+
+    vTaskSetThreadLocalStoragePointer( NULL, sampleazureiotloadTLS_INDEX, pxDevice );
+
+    pxDevice->xNetworkCredentials.pxSessionCache = &pxDevice->xSessionCache;
+    pxDevice->xNetworkCredentials.pucRootCa = ( const unsigned char * ) democonfigROOT_CA_PEM;
+    pxDevice->xNetworkCredentials.xRootCaSize = sizeof( democonfigROOT_CA_PEM );
+    pxDevice->xNetworkContext.pParams = &pxDevice->xTlsTransportParams;
+    pxDevice->xTransport.pxNetworkContext = &pxDevice->xNetworkContext;
+    pxDevice->xTransport.xSend = TLS_Socket_Send;
+    pxDevice->xTransport.xRecv = TLS_Socket_Recv;
+
+    #ifndef democonfigENABLE_DPS_SAMPLE
+        ( void ) strcpy( ( char * ) pxDevice->ucHostname, democonfigHOSTNAME );
+        pxDevice->ulHostnameLength = sizeof( democonfigHOSTNAME ) - 1;
+    #endif /* democonfigENABLE_DPS_SAMPLE */
+
+    if( prvSetupDeviceIdentity( pxDevice ) != 0 )
+    {
+        LogError( ( "Device %u: failed to derive the device key.", ( unsigned ) pxDevice->ulNumber ) );
+        vTaskDelete( NULL );
+    }
+
+    /* Ramp the devices up one after the other. */
+    vTaskDelay( pdMS_TO_TICKS( democonfigLOAD_CONNECT_SPACING_MS ) *
+                ( pxDevice->ulNumber - democonfigLOAD_DEVICE_ID_OFFSET ) );
+
+    #ifdef democonfigENABLE_DPS_SAMPLE
+        while( prvProvisionDevice( pxDevice ) != 0 )
+        {
+            taskENTER_CRITICAL();
+            xLoadStats.ulConnectFailures++;
+            taskEXIT_CRITICAL();
+
+            prvReconnectDelay();
+        }
+    #endif /* democonfigENABLE_DPS_SAMPLE */
+
+    for( ; ; )
+    {
+        if( prvConnectDevice( pxDevice ) == 0 )
+        {
+            prvRunDevice( pxDevice );
+
+            ( void ) AzureIoTHubClient_Disconnect( &pxDevice->xHubClient );
+            AzureIoTHubClient_Deinit( &pxDevice->xHubClient );
+            TLS_Socket_Disconnect( &pxDevice->xNetworkContext );
+
+            taskENTER_CRITICAL();
+            xLoadStats.ulConnected--;
+            xLoadStats.ulDisconnects++;
+            taskEXIT_CRITICAL();
+        }
+        else
+        {
+            taskENTER_CRITICAL();
+            xLoadStats.ulConnectFailures++;
+            taskEXIT_CRITICAL();
+        }
+
+        prvReconnectDelay();
+    }
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Start the devices, then log the aggregate statistics periodically.
+ */
+static void prvLoadReportTask( void * pvParameters )
+{
+    uint32_t ulIndex;
+    uint32_t ulLastAcked = 0;
+    uint32_t ulAcked;
+    uint32_t ulConnected;
+    uint32_t ulConnectFailures;
+    uint32_t ulDisconnects;
+    uint32_t ulSent;
+    uint32_t ulSendFailures;
+    uint32_t ulSkipped;
+    uint32_t ulConnectP[ 4 ];
+    uint32_t ulPubackP[ 4 ];
+    TickType_t xLastReport;
+    TickType_t xNow;
+
+    #ifdef democonfigENABLE_DPS_SAMPLE
+        uint32_t ulProvisioningP[ 4 ];
+    #endif /* democonfigENABLE_DPS_SAMPLE */
+
+    ( void ) pvParameters;
+
+    /* Initialize Azure IoT Middleware.  */
+    configASSERT( AzureIoT_Init() == eAzureIoTSuccess );
+
+    if( mbedtls_base64_decode( ucGroupKey, sizeof( ucGroupKey ), &xGroupKeyLength,
+                               ( const uint8_t * ) democonfigLOAD_GROUP_SYMMETRIC_KEY,
+                               sizeof( democonfigLOAD_GROUP_SYMMETRIC_KEY ) - 1 ) != 0 )
+    {
+        LogError( ( "democonfigLOAD_GROUP_SYMMETRIC_KEY is not a valid base64 key." ) );
+        vTaskDelete( NULL );
+    }
+
+    LogInfo( ( "Starting %u devices, one message of %u bytes every %u ms each.",
+               ( unsigned ) democonfigLOAD_DEVICE_COUNT,
+               ( unsigned ) democonfigLOAD_PAYLOAD_SIZE,
+               ( unsigned ) democonfigLOAD_TELEMETRY_INTERVAL_MS ) );
+
+    for( ulIndex = 0; ulIndex < democonfigLOAD_DEVICE_COUNT; ulIndex++ )
+    {
+        xLoadDevices[ ulIndex ].ulNumber = democonfigLOAD_DEVICE_ID_OFFSET + ulIndex;
+
+        if( xTaskCreate( prvLoadDeviceTask, "AzureLoadDevice", democonfigDEMO_STACKSIZE,
+                         &xLoadDevices[ ulIndex ], tskIDLE_PRIORITY, NULL ) != pdPASS )
+        {
+            LogError( ( "Could only start %u devices.", ( unsigned ) ulIndex ) );
+            break;
+        }
+    }
+
+    xLastReport = xTaskGetTickCount();
+
+    for( ; ; )
+    {
+        vTaskDelay( pdMS_TO_TICKS( democonfigLOAD_REPORT_INTERVAL_MS ) );
+
+        taskENTER_CRITICAL();
+        ulConnected = xLoadStats.ulConnected;
+        ulConnectFailures = xLoadStats.ulConnectFailures;
+        ulDisconnects = xLoadStats.ulDisconnects;
+        ulSent = xLoadStats.ulSent;
+        ulAcked = xLoadStats.ulAcked;
+        ulSendFailures = xLoadStats.ulSendFailures;
+        ulSkipped = xLoadStats.ulSkipped;
+        ulConnectP[ 0 ] = prvHistogramPercentile( &xLoadStats.xConnectLatency, 50 );
+        ulConnectP[ 1 ] = prvHistogramPercentile( &xLoadStats.xConnectLatency, 90 );
+        ulConnectP[ 2 ] = prvHistogramPercentile( &xLoadStats.xConnectLatency, 99 );
+        ulConnectP[ 3 ] = xLoadStats.xConnectLatency.ulMaxMs;
+        ulPubackP[ 0 ] = prvHistogramPercentile( &xLoadStats.xPubackLatency, 50 );
+        ulPubackP[ 1 ] = prvHistogramPercentile( &xLoadStats.xPubackLatency, 90 );
+        ulPubackP[ 2 ] = prvHistogramPercentile( &xLoadStats.xPubackLatency, 99 );
+        ulPubackP[ 3 ] = xLoadStats.xPubackLatency.ulMaxMs;
+        #ifdef democonfigENABLE_DPS_SAMPLE
+            ulProvisioningP[ 0 ] = prvHistogramPercentile( &xLoadStats.xProvisioningLatency, 50 );
+            ulProvisioningP[ 1 ] = prvHistogramPercentile( &xLoadStats.xProvisioningLatency, 90 );
+            ulProvisioningP[ 2 ] = prvHistogramPercentile( &xLoadStats.xProvisioningLatency, 99 );
+            ulProvisioningP[ 3 ] = xLoadStats.xProvisioningLatency.ulMaxMs;
+        #endif /* democonfigENABLE_DPS_SAMPLE */
+        taskEXIT_CRITICAL();
+
+        xNow = xTaskGetTickCount();
+
+        LogInfo( ( "Load: %u/%u connected, %u connect failures, %u disconnects",
+                   ( unsigned ) ulConnected, ( unsigned ) democonfigLOAD_DEVICE_COUNT,
+                   ( unsigned ) ulConnectFailures, ( unsigned ) ulDisconnects ) );
+        LogInfo( ( "Load: %u sent, %u acked, %u send failures, %u skipped, %u msg/s",
+                   ( unsigned ) ulSent, ( unsigned ) ulAcked, ( unsigned ) ulSendFailures, ( unsigned ) ulSkipped,
+                   ( unsigned ) ( ( uint64_t ) ( ulAcked - ulLastAcked ) * 1000U /
+                                  ( prvTicksToMs( xNow - xLastReport ) + 1U ) ) ) );
+        #ifdef democonfigENABLE_DPS_SAMPLE
+            LogInfo( ( "Load: provisioning ms p50 %u p90 %u p99 %u max %u",
+                       ( unsigned ) ulProvisioningP[ 0 ], ( unsigned ) ulProvisioningP[ 1 ],
+                       ( unsigned ) ulProvisioningP[ 2 ], ( unsigned ) ulProvisioningP[ 3 ] ) );
+        #endif /* democonfigENABLE_DPS_SAMPLE */
+        LogInfo( ( "Load: connect ms p50 %u p90 %u p99 %u max %u",
+                   ( unsigned ) ulConnectP[ 0 ], ( unsigned ) ulConnectP[ 1 ],
+                   ( unsigned ) ulConnectP[ 2 ], ( unsigned ) ulConnectP[ 3 ] ) );
+        LogInfo( ( "Load: puback ms p50 %u p90 %u p99 %u max %u",
+                   ( unsigned ) ulPubackP[ 0 ], ( unsigned ) ulPubackP[ 1 ],
+                   ( unsigned ) ulPubackP[ 2 ], ( unsigned ) ulPubackP[ 3 ] ) );
+
+        ulLastAcked = ulAcked;
+        xLastReport = xNow;
+    }
+}
+/*-----------------------------------------------------------*/
+
+/*
+ * @brief Create the task that starts the simulated devices and reports on them
+ */
+void vStartDemoTask( void )
+{
+    xTaskCreate( prvLoadReportTask,        /* Function that implements the task. */
+                 "AzureLoadTask",          /* Text name for the task - only used for debugging. */
+                 democonfigDEMO_STACKSIZE, /* Size of stack (in words, not bytes) to allocate for the task. */
+                 NULL,                     /* Task parameter - not used in this case. */
+                 tskIDLE_PRIORITY + 1,     /* Above the devices, so reports keep their pace under load. */
+                 NULL );                   /* Used to pass out a handle to the created task - not used in this case. */
+}
+/*-----------------------------------------------------------*/
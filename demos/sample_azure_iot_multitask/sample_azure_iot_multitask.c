@@ -0,0 +1,537 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/*
+ * Sample with the hub client split across tasks.
+ *
+ * The network task owns the hub client: it connects, subscribes and then
+ * serves the connection with HubTask_Run(), reconnecting when that fails.
+ * Telemetry producer tasks get their readings from ulReadTelemetry(), queue
+ * them with HubTask_SendTelemetry() and never touch the client, and commands are handled by a worker task, so
+ * neither a slow sensor read nor a slow command delays the process loop. Nor
+ * does a stalled network delay the producers: their readings are dropped
+ * once the telemetry ring is full, and the network task logs how many.
+ *
+ * Before the SAS token of the connection expires, the network task makes the
+ * next connection while the current one still serves, and only then moves the
+ * client over, telemetry queued meanwhile going out on the new connection.
+ */
+
+/* Standard includes. */
+#include <string.h>
+#include <stdio.h>
+
+/* Kernel includes. */
+#include "FreeRTOS.h"
+#include "task.h"
+
+/* Demo Specific configs. */
+#include "demo_config.h"
+
+/* Azure IoT Hub library includes */
+#include "azure_iot_hub_client.h"
+
+/* Connections, provisioning and reconnects. */
+#include "azure_sample_connection_manager.h"
+
+/* Transport interface implementation include header for TLS. */
+#include "transport_tls_socket.h"
+
+/* Crypto helper header. */
+#include "azure_sample_crypto.h"
+
+/* Hub client shared between tasks. */
+#include "azure_sample_hub_task.h"
+
+/* Telemetry source. */
+#include "sample_azure_iot_multitask_data_if.h"
+
+/* Keepalive learnt per network. */
+#include "azure_sample_keepalive.h"
+
+/*-----------------------------------------------------------*/
+
+/* Compile time error for undefined configs. */
+#if !defined( democonfigHOSTNAME ) && !defined( democonfigENABLE_DPS_SAMPLE )
+    #error "Define the config democonfigHOSTNAME by following the instructions in file demo_config.h."
+#endif
+
+#if !defined( democonfigENDPOINT ) && defined( democonfigENABLE_DPS_SAMPLE )
+    #error "Define the config dps endpoint by following the instructions in file demo_config.h."
+#endif
+
+#ifndef democonfigROOT_CA_PEM
+    #error "Please define Root CA certificate of the IoT Hub(democonfigROOT_CA_PEM) in demo_config.h."
+#endif
+
+#if defined( democonfigDEVICE_SYMMETRIC_KEY ) && defined( democonfigCLIENT_CERTIFICATE_PEM )
+    #error "Please define only one auth democonfigDEVICE_SYMMETRIC_KEY or democonfigCLIENT_CERTIFICATE_PEM in demo_config.h."
+#endif
+
+#if !defined( democonfigDEVICE_SYMMETRIC_KEY ) && !defined( democonfigCLIENT_CERTIFICATE_PEM )
+    #error "Please define one auth democonfigDEVICE_SYMMETRIC_KEY or democonfigCLIENT_CERTIFICATE_PEM in demo_config.h."
+#endif
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Timeout for receiving CONNACK packet in milliseconds.
+ */
+#define sampleazureiotCONNACK_RECV_TIMEOUT_MS                 ( 10 * 1000U )
+
+/**
+ * @brief Time in ticks to wait before reconnecting after the connection failed.
+ */
+#define sampleazureiotDELAY_BETWEEN_DEMO_ITERATIONS_TICKS     ( pdMS_TO_TICKS( 5000U ) )
+
+/**
+ * @brief Transport timeout in milliseconds for transport send and receive.
+ */
+#define sampleazureiotTRANSPORT_SEND_RECV_TIMEOUT_MS          ( 2000U )
+
+/**
+ * @brief Transport timeout in milliseconds for transport send and receive.
+ */
+#define sampleazureiotProvisioning_Registration_TIMEOUT_MS    ( 3 * 1000U )
+
+/**
+ * @brief Wait timeout for subscribe to finish.
+ */
+#define sampleazureiotSUBSCRIBE_TIMEOUT                       ( 10 * 1000U )
+
+/**
+ * @brief Period in milliseconds of the connection renewal, 0 to never renew.
+ *
+ * The hub checks the SAS token of a connection when it connects, and drops the
+ * connection once the token expires, an hour later by default. A certificate
+ * does not expire so, left at its default, only symmetric keys renew.
+ */
+#ifndef democonfigHUB_RENEW_PERIOD_MS
+    #ifdef democonfigDEVICE_SYMMETRIC_KEY
+        #define democonfigHUB_RENEW_PERIOD_MS    ( 50 * 60 * 1000U )
+    #else
+        #define democonfigHUB_RENEW_PERIOD_MS    ( 0U )
+    #endif
+#endif
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Unix time.
+ *
+ * @return Time in milliseconds.
+ */
+uint64_t ullGetUnixTime( void );
+/*-----------------------------------------------------------*/
+
+/* Each compilation unit must define the NetworkContext struct. */
+struct NetworkContext
+{
+    void * pParams;
+};
+
+static AzureIoTHubClient_t xAzureIoTHubClient;
+
+/* The client runs on one of them, the other taking the renewed connection. */
+static NetworkContext_t xNetworkContexts[ 2 ];
+static TlsTransportParams_t xTlsTransportParams[ 2 ];
+
+/* Connects to the provisioning service and IoT Hub. */
+static ConnectionManager_t xConnectionManager;
+
+/* The queues between the network task and the others. */
+static HubTask_t xHubTask;
+
+#if ( democonfigADAPTIVE_KEEPALIVE == 1 )
+    /* When the client last connected, to learn from how long it lasted. */
+    static TickType_t xConnectedTick;
+#endif /* democonfigADAPTIVE_KEEPALIVE == 1 */
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Buffer of the hub client, for the topics of the messages it sends and
+ * the MQTT packets it receives, see democonfigNETWORK_BUFFER_SIZE.
+ */
+static uint8_t ucMQTTMessageBuffer[ democonfigNETWORK_BUFFER_SIZE ];
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Command handler, run by the command worker task.
+ *
+ * Echoes the command payload back, which is JSON like every command payload.
+ */
+static uint32_t prvHandleCommand( const HubTaskCommand_t * pxCommand,
+                                  uint8_t * pucResponse,
+                                  uint32_t ulResponseSize,
+                                  uint32_t * pulResponseLength,
+                                  void * pvContext )
+{
+    ( void ) pvContext;
+
+    LogInfo( ( "Command %.*s payload : %.*s \r\n",
+               pxCommand->usCommandNameLength, ( const char * ) pxCommand->ucCommandName,
+               pxCommand->ulPayloadLength, ( const char * ) pxCommand->ucPayload ) );
+
+    if( pxCommand->ulPayloadLength <= ulResponseSize )
+    {
+        memcpy( pucResponse, pxCommand->ucPayload, pxCommand->ulPayloadLength );
+        *pulResponseLength = pxCommand->ulPayloadLength;
+    }
+
+    return 200;
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Property mesage callback handler, called from the network task.
+ */
+static void prvHandlePropertiesMessage( AzureIoTHubClientPropertiesResponse_t * pxMessage,
+                                        void * pvContext )
+{
+    ( void ) pvContext;
+
+    LogInfo( ( "Property document payload : %.*s \r\n",
+               pxMessage->ulPayloadLength,
+               ( const char * ) pxMessage->pvMessagePayload ) );
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Init the hub client on the connection of the transport, then connect
+ * and subscribe.
+ */
+static AzureIoTResult_t prvHubClientConnect( uint8_t * pucIotHubHostname,
+                                             uint32_t ulIothubHostnameLength,
+                                             uint8_t * pucIotHubDeviceId,
+                                             uint32_t ulIothubDeviceIdLength,
+                                             AzureIoTTransportInterface_t * pxTransport )
+{
+    AzureIoTHubClientOptions_t xHubOptions = { 0 };
+    AzureIoTResult_t xResult;
+    bool xSessionPresent;
+
+    /* Init IoT Hub option */
+    xResult = AzureIoTHubClient_OptionsInit( &xHubOptions );
+
+    if( xResult != eAzureIoTSuccess )
+    {
+        return xResult;
+    }
+
+    xHubOptions.pucModuleID = ( const uint8_t * ) democonfigMODULE_ID;
+    xHubOptions.ulModuleIDLength = sizeof( democonfigMODULE_ID ) - 1;
+
+    #if ( democonfigADAPTIVE_KEEPALIVE == 1 )
+        /* Taken by the connect, from KeepAlive_Seconds(). */
+        KeepAlive_Select();
+        LogInfo( ( "Keepalive of %u seconds.\r\n", ( unsigned int ) KeepAlive_Seconds() ) );
+    #endif /* democonfigADAPTIVE_KEEPALIVE == 1 */
+
+    xResult = AzureIoTHubClient_Init( &xAzureIoTHubClient,
+                                      pucIotHubHostname, ulIothubHostnameLength,
+                                      pucIotHubDeviceId, ulIothubDeviceIdLength,
+                                      &xHubOptions,
+                                      ucMQTTMessageBuffer, sizeof( ucMQTTMessageBuffer ),
+                                      ullGetUnixTime,
+                                      pxTransport );
+
+    if( xResult != eAzureIoTSuccess )
+    {
+        return xResult;
+    }
+
+    #ifdef democonfigDEVICE_SYMMETRIC_KEY
+        xResult = AzureIoTHubClient_SetSymmetricKey( &xAzureIoTHubClient,
+                                                     ( const uint8_t * ) democonfigDEVICE_SYMMETRIC_KEY,
+                                                     sizeof( democonfigDEVICE_SYMMETRIC_KEY ) - 1,
+                                                     Crypto_HMAC );
+
+        if( xResult != eAzureIoTSuccess )
+        {
+            return xResult;
+        }
+    #endif /* democonfigDEVICE_SYMMETRIC_KEY */
+
+    LogInfo( ( "Creating an MQTT connection to %s.\r\n", pucIotHubHostname ) );
+
+    /* The session is kept across renewals, so the hub still holds the
+     * subscriptions, but the callbacks are set again on the new client. */
+    xResult = AzureIoTHubClient_Connect( &xAzureIoTHubClient,
+                                         false, &xSessionPresent,
+                                         sampleazureiotCONNACK_RECV_TIMEOUT_MS );
+
+    if( xResult != eAzureIoTSuccess )
+    {
+        return xResult;
+    }
+
+    #if ( democonfigADAPTIVE_KEEPALIVE == 1 )
+        xConnectedTick = xTaskGetTickCount();
+    #endif /* democonfigADAPTIVE_KEEPALIVE == 1 */
+
+    /* Commands are copied to the command queue by the hub task. */
+    xResult = AzureIoTHubClient_SubscribeCommand( &xAzureIoTHubClient, HubTask_CommandCallback,
+                                                  &xHubTask, sampleazureiotSUBSCRIBE_TIMEOUT );
+
+    if( xResult != eAzureIoTSuccess )
+    {
+        return xResult;
+    }
+
+    return AzureIoTHubClient_SubscribeProperties( &xAzureIoTHubClient, prvHandlePropertiesMessage,
+                                                  &xAzureIoTHubClient, sampleazureiotSUBSCRIBE_TIMEOUT );
+}
+/*-----------------------------------------------------------*/
+
+#if ( democonfigHUB_RENEW_PERIOD_MS > 0 )
+
+/**
+ * @brief Move the hub client to a new connection, made while the current
+ * one still serves.
+ *
+ * The hub takes one connection per device, so the client only moves over once
+ * the TLS handshake of the new connection, resumed from the session cache when
+ * it can be, is done. Telemetry queued while it connects and subscribes goes
+ * out on the new connection.
+ *
+ * @return eAzureIoTSuccess when the client runs on the new connection, or
+ * still on the current one if the new could not be made, else the error that
+ * lost the connection.
+ */
+    static AzureIoTResult_t prvRenewConnection( uint8_t * pucIotHubHostname,
+                                                uint32_t ulIothubHostnameLength,
+                                                uint8_t * pucIotHubDeviceId,
+                                                uint32_t ulIothubDeviceIdLength,
+                                                AzureIoTTransportInterface_t * pxTransport )
+    {
+        NetworkContext_t * pxCurrent = pxTransport->pxNetworkContext;
+        NetworkContext_t * pxNext = ( pxCurrent == &xNetworkContexts[ 0 ] ) ?
+                                    &xNetworkContexts[ 1 ] : &xNetworkContexts[ 0 ];
+        TlsTransportStatus_t xNetworkStatus;
+        AzureIoTResult_t xResult = eAzureIoTSuccess;
+
+        LogInfo( ( "Renewing the connection to %s.\r\n", pucIotHubHostname ) );
+
+        xNetworkStatus = TLS_Socket_ConnectStart( pxNext, ( const char * ) pucIotHubHostname,
+                                                  democonfigIOTHUB_PORT, &xConnectionManager.xNetworkCredentials,
+                                                  sampleazureiotTRANSPORT_SEND_RECV_TIMEOUT_MS,
+                                                  sampleazureiotTRANSPORT_SEND_RECV_TIMEOUT_MS );
+
+        /* One process loop of the current connection between handshake
+         * messages. */
+        if( xNetworkStatus == eTLSTransportSuccess )
+        {
+            do
+            {
+                xResult = HubTask_RunFor( &xHubTask, 0 );
+
+                if( xResult != eAzureIoTSuccess )
+                {
+                    TLS_Socket_Disconnect( pxNext );
+
+                    return xResult;
+                }
+
+                xNetworkStatus = TLS_Socket_ConnectStep( pxNext );
+            } while( xNetworkStatus == eTLSTransportInProgress );
+        }
+
+        if( xNetworkStatus != eTLSTransportSuccess )
+        {
+            /* Kept until the hub drops it, then connected again from scratch. */
+            LogWarn( ( "Renewing the connection failed [%d], keeping the current one.\r\n",
+                       xNetworkStatus ) );
+
+            return eAzureIoTSuccess;
+        }
+
+        #if ( democonfigADAPTIVE_KEEPALIVE == 1 )
+            ( void ) KeepAlive_Report( ( xTaskGetTickCount() - xConnectedTick ) / configTICK_RATE_HZ, false );
+        #endif /* democonfigADAPTIVE_KEEPALIVE == 1 */
+
+        /* The connect on the new connection drops the current one anyway, so
+         * it is closed without a disconnect. */
+        TLS_Socket_Disconnect( pxCurrent );
+        pxTransport->pxNetworkContext = pxNext;
+
+        return prvHubClientConnect( pucIotHubHostname, ulIothubHostnameLength,
+                                    pucIotHubDeviceId, ulIothubDeviceIdLength,
+                                    pxTransport );
+    }
+
+#endif /* democonfigHUB_RENEW_PERIOD_MS > 0 */
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Network task, the only task that calls the hub client.
+ */
+static void prvNetworkTask( void * pvParameters )
+{
+    AzureIoTTransportInterface_t xTransport;
+    HubTaskTelemetryStats_t xTelemetryStats;
+    AzureIoTResult_t xResult;
+    uint32_t ulStatus;
+
+    #ifdef democonfigENABLE_DPS_SAMPLE
+        uint8_t * pucIotHubHostname = NULL;
+        uint8_t * pucIotHubDeviceId = NULL;
+        uint32_t pulIothubHostnameLength = 0;
+        uint32_t pulIothubDeviceIdLength = 0;
+    #else
+        uint8_t * pucIotHubHostname = ( uint8_t * ) democonfigHOSTNAME;
+        uint8_t * pucIotHubDeviceId = ( uint8_t * ) democonfigDEVICE_ID;
+        uint32_t pulIothubHostnameLength = sizeof( democonfigHOSTNAME ) - 1;
+        uint32_t pulIothubDeviceIdLength = sizeof( democonfigDEVICE_ID ) - 1;
+    #endif /* democonfigENABLE_DPS_SAMPLE */
+
+    ( void ) pvParameters;
+
+    /* Initialize Azure IoT Middleware.  */
+    configASSERT( AzureIoT_Init() == eAzureIoTSuccess );
+
+    xResult = ConnectionManager_Init( &xConnectionManager,
+                                      ucMQTTMessageBuffer, sizeof( ucMQTTMessageBuffer ),
+                                      sampleazureiotTRANSPORT_SEND_RECV_TIMEOUT_MS );
+    configASSERT( xResult == eAzureIoTSuccess );
+
+    ConnectionManager_WaitInitialDelay( &xConnectionManager );
+
+    #ifdef democonfigENABLE_DPS_SAMPLE
+        /* Run DPS.  */
+        if( ( ulStatus = ConnectionManager_Provision( &xConnectionManager, NULL, 0,
+                                                      sampleazureiotProvisioning_Registration_TIMEOUT_MS,
+                                                      &pucIotHubHostname, &pulIothubHostnameLength,
+                                                      &pucIotHubDeviceId, &pulIothubDeviceIdLength ) ) != 0 )
+        {
+            LogError( ( "Failed on sample_dps_entry!: error code = 0x%08x\r\n", ulStatus ) );
+            vTaskDelete( NULL );
+        }
+    #endif /* democonfigENABLE_DPS_SAMPLE */
+
+    xNetworkContexts[ 0 ].pParams = &xTlsTransportParams[ 0 ];
+    xNetworkContexts[ 1 ].pParams = &xTlsTransportParams[ 1 ];
+
+    /* Fill in Transport Interface send and receive function pointers. */
+    xTransport.pxNetworkContext = &xNetworkContexts[ 0 ];
+    xTransport.xSend = TLS_Socket_Send;
+    xTransport.xRecv = TLS_Socket_Recv;
+
+    for( ; ; )
+    {
+        ulStatus = ConnectionManager_ConnectHub( &xConnectionManager, democonfigIOTHUB_PORT, xTransport.pxNetworkContext,
+                                                 &pucIotHubHostname, &pulIothubHostnameLength,
+                                                 &pucIotHubDeviceId, &pulIothubDeviceIdLength );
+        configASSERT( ulStatus == 0 );
+
+        xResult = prvHubClientConnect( pucIotHubHostname, pulIothubHostnameLength,
+                                       pucIotHubDeviceId, pulIothubDeviceIdLength,
+                                       &xTransport );
+        configASSERT( xResult == eAzureIoTSuccess );
+
+        xResult = AzureIoTHubClient_RequestPropertiesAsync( &xAzureIoTHubClient );
+        configASSERT( xResult == eAzureIoTSuccess );
+
+        /* Serve queued telemetry, command responses and the process loop
+         * until the connection fails. */
+        #if ( democonfigHUB_RENEW_PERIOD_MS > 0 )
+            do
+            {
+                xResult = HubTask_RunFor( &xHubTask, pdMS_TO_TICKS( democonfigHUB_RENEW_PERIOD_MS ) );
+
+                if( xResult == eAzureIoTSuccess )
+                {
+                    xResult = prvRenewConnection( pucIotHubHostname, pulIothubHostnameLength,
+                                                  pucIotHubDeviceId, pulIothubDeviceIdLength,
+                                                  &xTransport );
+                }
+            } while( xResult == eAzureIoTSuccess );
+        #else
+            xResult = HubTask_Run( &xHubTask );
+        #endif /* democonfigHUB_RENEW_PERIOD_MS > 0 */
+
+        HubTask_GetTelemetryStats( &xHubTask, &xTelemetryStats );
+        LogWarn( ( "Connection lost: error code = 0x%08x, %u telemetry messages queued, %u dropped.\r\n",
+                   xResult, ( unsigned int ) xTelemetryStats.ulQueued, ( unsigned int ) xTelemetryStats.ulDropped ) );
+
+        #if ( democonfigADAPTIVE_KEEPALIVE == 1 )
+            ( void ) KeepAlive_Report( ( xTaskGetTickCount() - xConnectedTick ) / configTICK_RATE_HZ, true );
+        #endif /* democonfigADAPTIVE_KEEPALIVE == 1 */
+
+        ( void ) AzureIoTHubClient_Disconnect( &xAzureIoTHubClient );
+        TLS_Socket_Disconnect( xTransport.pxNetworkContext );
+
+        /* Telemetry queued meanwhile waits for the next connection. */
+        vTaskDelay( sampleazureiotDELAY_BETWEEN_DEMO_ITERATIONS_TICKS );
+    }
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Telemetry producer task, which only queues its readings.
+ */
+static void prvProducerTask( void * pvParameters )
+{
+    uint32_t ulProducer = ( uint32_t ) ( uintptr_t ) pvParameters;
+    uint8_t ucMessage[ democonfigHUB_TASK_TELEMETRY_SIZE ];
+    uint32_t ulMessageLength;
+
+    for( ; ; )
+    {
+        /* Blocks until the next reading is due. */
+        if( ulReadTelemetry( ulProducer, ucMessage, sizeof( ucMessage ), &ulMessageLength ) != 0 )
+        {
+            LogError( ( "Failed to read telemetry of producer %u.\r\n", ( unsigned int ) ulProducer ) );
+        }
+        else if( ulMessageLength > 0 )
+        {
+            /* Never waits. A reading that finds the ring full is counted, and
+             * logged by the network task. */
+            ( void ) HubTask_SendTelemetry( &xHubTask, ucMessage, ulMessageLength );
+        }
+    }
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Command worker task.
+ */
+static void prvCommandWorkerTask( void * pvParameters )
+{
+    ( void ) pvParameters;
+
+    HubTask_RunCommandWorker( &xHubTask );
+}
+/*-----------------------------------------------------------*/
+
+
+/*
+ * @brief Create the tasks that demonstrate the AzureIoTHub demo
+ */
+void vStartDemoTask( void )
+{
+    uint32_t ulProducer;
+    AzureIoTResult_t xResult;
+
+    /* The queues must exist before any task uses them. */
+    xResult = HubTask_Init( &xHubTask, &xAzureIoTHubClient, prvHandleCommand, NULL );
+    configASSERT( xResult == eAzureIoTSuccess );
+
+    /* The network task runs above the others, so queued work goes out as
+     * soon as it is between process loop calls. */
+    xTaskCreate( prvNetworkTask,           /* Function that implements the task. */
+                 "AzureNetworkTask",       /* Text name for the task - only used for debugging. */
+                 democonfigDEMO_STACKSIZE, /* Size of stack (in words, not bytes) to allocate for the task. */
+                 NULL,                     /* Task parameter - not used in this case. */
+                 tskIDLE_PRIORITY + 1,     /* Task priority, must be between 0 and configMAX_PRIORITIES - 1. */
+                 NULL );                   /* Used to pass out a handle to the created task - not used in this case. */
+
+    for( ulProducer = 0; ulProducer < democonfigMULTITASK_PRODUCER_COUNT; ulProducer++ )
+    {
+        xTaskCreate( prvProducerTask, "AzureProducerTask", democonfigDEMO_STACKSIZE,
+                     ( void * ) ( uintptr_t ) ulProducer, tskIDLE_PRIORITY, NULL );
+    }
+
+    xTaskCreate( prvCommandWorkerTask, "AzureCommandTask", democonfigDEMO_STACKSIZE,
+                 NULL, tskIDLE_PRIORITY, NULL );
+}
+/*-----------------------------------------------------------*/
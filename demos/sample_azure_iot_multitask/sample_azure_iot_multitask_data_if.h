@@ -0,0 +1,44 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/**
+ * @brief Defines the interface through which sample_azure_iot_multitask.c gets its telemetry.
+ *        The module implementing it reads the device sensors, or simulates them, and
+ *        serialises each reading for the producer tasks.
+ */
+
+#ifndef SAMPLE_AZURE_IOT_MULTITASK_DATA_IF_H
+#define SAMPLE_AZURE_IOT_MULTITASK_DATA_IF_H
+
+#include <stdint.h>
+
+#include "demo_config.h"
+
+/**
+ * @brief Number of telemetry producer tasks.
+ */
+#ifndef democonfigMULTITASK_PRODUCER_COUNT
+    #define democonfigMULTITASK_PRODUCER_COUNT    2
+#endif
+
+/**
+ * @brief Waits for the next reading of a producer and provides it as a telemetry payload.
+ *
+ * @remark This function must be implemented by the specific sample.
+ *         `ulReadTelemetry` is called in a loop by each producer task, so it
+ *         blocks until the reading is due.
+ *         If `pulTelemetryDataLength` returned is zero, telemetry is not send to the Azure IoT Hub.
+ *
+ * @param[in]   ulProducer              Index of the calling producer task.
+ * @param[out]  pucTelemetryData        Pointer to uint8_t* that will contain the Telemetry payload.
+ * @param[in]   ulTelemetryDataSize     Size of `pucTelemetryData`
+ * @param[out]  pulTelemetryDataLength  The number of bytes written in `pucTelemetryData`
+ *
+ * @return uint32_t Zero if successful, non-zero if any failure occurs.
+ */
+uint32_t ulReadTelemetry( uint32_t ulProducer,
+                          uint8_t * pucTelemetryData,
+                          uint32_t ulTelemetryDataSize,
+                          uint32_t * pulTelemetryDataLength );
+
+#endif /* SAMPLE_AZURE_IOT_MULTITASK_DATA_IF_H */
@@ -0,0 +1,55 @@
+/* Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License. */
+
+/* Standard includes. */
+#include <stdio.h>
+
+/* Kernel includes. */
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "sample_azure_iot_multitask_data_if.h"
+
+/**
+ * @brief The Telemetry message published by each producer task.
+ */
+#define sampleazureiotMESSAGE                         "{\"producer\":%u,\"reading\":%u}"
+
+/**
+ * @brief Time in ticks between the readings of a producer task.
+ */
+#define sampleazureiotDELAY_BETWEEN_READINGS_TICKS    ( pdMS_TO_TICKS( 2000U ) )
+/*-----------------------------------------------------------*/
+
+static uint32_t ulReadings[ democonfigMULTITASK_PRODUCER_COUNT ];
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Implements the sample interface for generating telemetry payload.
+ */
+uint32_t ulReadTelemetry( uint32_t ulProducer,
+                          uint8_t * pucTelemetryData,
+                          uint32_t ulTelemetryDataSize,
+                          uint32_t * pulTelemetryDataLength )
+{
+    int result;
+
+    vTaskDelay( sampleazureiotDELAY_BETWEEN_READINGS_TICKS );
+
+    result = snprintf( ( char * ) pucTelemetryData, ulTelemetryDataSize,
+                       sampleazureiotMESSAGE, ( unsigned int ) ulProducer,
+                       ( unsigned int ) ulReadings[ ulProducer ]++ );
+
+    if( ( result >= 0 ) && ( ( uint32_t ) result < ulTelemetryDataSize ) )
+    {
+        *pulTelemetryDataLength = ( uint32_t ) result;
+        result = 0;
+    }
+    else
+    {
+        result = 1;
+    }
+
+    return ( uint32_t ) result;
+}
+/*-----------------------------------------------------------*/
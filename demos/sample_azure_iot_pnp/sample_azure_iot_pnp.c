@@ -9,17 +9,20 @@
 #include "FreeRTOS.h"
 #include "task.h"
 
-/* Azure Provisioning/IoT Hub library includes */
+/* Azure IoT Hub library includes */
 #include "azure_iot_hub_client.h"
 #include "azure_iot_hub_client_properties.h"
-#include "azure_iot_provisioning_client.h"
 
 /* Azure JSON includes */
 #include "azure_iot_json_reader.h"
 #include "azure_iot_json_writer.h"
 
-/* Exponential backoff retry include. */
-#include "backoff_algorithm.h"
+/* Connections, provisioning and reconnects. */
+#include "azure_sample_connection_manager.h"
+
+/* Command response buffers. */
+#include "azure_sample_command_response.h"
+#include "azure_sample_deferred_command.h"
 
 /* Transport interface implementation include header for TLS. */
 #include "transport_tls_socket.h"
@@ -30,9 +33,34 @@
 /* Demo Specific configs. */
 #include "demo_config.h"
 
+/* Telemetry batching, store and forward, and encoding helper headers. */
+#include "azure_sample_telemetry_batch.h"
+#include "azure_sample_telemetry_store.h"
+#include "azure_sample_telemetry_spool.h"
+#include "azure_sample_cbor_writer.h"
+
+/* Task creation, pinned to a core where configured. */
+#include "azure_sample_task.h"
+
+/* Trace points of the samples. */
+#include "azure_sample_trace.h"
+
+/* Startup timing. */
+#include "azure_sample_startup.h"
+
 /* Data Interface Definition */
 #include "sample_azure_iot_pnp_data_if.h"
 
+/* A deep sleep between the batches of telemetry. */
+#include "azure_sample_deep_sleep.h"
+
+/* Subscriptions in one SUBSCRIBE, or not sent again to a session that has them. */
+#include "azure_sample_subscribe_batch.h"
+#include "azure_sample_hub_session.h"
+
+/* The attribute of the large buffers. */
+#include "azure_sample_placement.h"
+
 /*-----------------------------------------------------------*/
 
 /* Compile time error for undefined configs. */
@@ -57,23 +85,6 @@
 #endif
 /*-----------------------------------------------------------*/
 
-/**
- * @brief The maximum number of retries for network operation with server.
- */
-#define sampleazureiotRETRY_MAX_ATTEMPTS                      ( 5U )
-
-/**
- * @brief The maximum back-off delay (in milliseconds) for retrying failed operation
- *  with server.
- */
-#define sampleazureiotRETRY_MAX_BACKOFF_DELAY_MS              ( 5000U )
-
-/**
- * @brief The base back-off delay (in milliseconds) to use for network operation retry
- * attempts.
- */
-#define sampleazureiotRETRY_BACKOFF_BASE_MS                   ( 500U )
-
 /**
  * @brief Timeout for receiving CONNACK packet in milliseconds.
  */
@@ -104,6 +115,53 @@
  */
 #define sampleazureiotDELAY_BETWEEN_PUBLISHES_TICKS           ( pdMS_TO_TICKS( 2000U ) )
 
+/**
+ * @brief Answer commands as soon as they arrive.
+ *
+ * The task waits for the next publish in the process loop rather than in
+ * vTaskDelay(), so a command is read, and its response sent from the command
+ * callback, within a network round trip instead of up to
+ * sampleazureiotDELAY_BETWEEN_PUBLISHES_TICKS later.
+ */
+#ifndef democonfigCOMMAND_IMMEDIATE_RESPONSE
+    #define democonfigCOMMAND_IMMEDIATE_RESPONSE    0
+#endif
+
+/**
+ * @brief Set to 1 to handle commands in a worker task, for commands that take
+ * seconds, such as the ones driving an actuator.
+ *
+ * The command callback only copies the command into a slot of
+ * xDeferredCommands, and the response is sent after the process loop once
+ * the worker has it. Set democonfigCOMMAND_IMMEDIATE_RESPONSE as well to not
+ * add the delay between publishes to the response time.
+ */
+#ifndef democonfigDEFERRED_COMMANDS
+    #define democonfigDEFERRED_COMMANDS    0
+#endif
+
+/**
+ * @brief Process loop timeout between publishes with tickless idle.
+ *
+ * Rather than wait in vTaskDelay(), the task blocks on the socket until the
+ * next publish is due, so the core sleeps with the tick stopped while
+ * messages from IoT Hub and keep alive are still handled as they come.
+ */
+#define sampleazureiotLOW_POWER_PROCESS_LOOP_TIMEOUT_MS \
+    ( sampleazureiotPROCESS_LOOP_TIMEOUT_MS + ( sampleazureiotDELAY_BETWEEN_PUBLISHES_TICKS * portTICK_PERIOD_MS ) )
+
+#if ( configUSE_TICKLESS_IDLE == 1 ) || ( democonfigCOMMAND_IMMEDIATE_RESPONSE == 1 )
+    #define sampleazureiotLOOP_PROCESS_LOOP_TIMEOUT_MS    sampleazureiotLOW_POWER_PROCESS_LOOP_TIMEOUT_MS
+#else
+    #define sampleazureiotLOOP_PROCESS_LOOP_TIMEOUT_MS    sampleazureiotPROCESS_LOOP_TIMEOUT_MS
+#endif
+
+/**
+ * @brief Response to a command that finds every response buffer in use.
+ */
+#define sampleazureiotCOMMAND_BUSY_STATUS                     ( 503 )
+#define sampleazureiotCOMMAND_BUSY_PAYLOAD                    "{}"
+
 /**
  * @brief Transport timeout in milliseconds for transport send and receive.
  */
@@ -128,13 +186,6 @@
 uint64_t ullGetUnixTime( void );
 /*-----------------------------------------------------------*/
 
-/* Define buffer for IoT Hub info.  */
-#ifdef democonfigENABLE_DPS_SAMPLE
-    static uint8_t ucSampleIotHubHostname[ 128 ];
-    static uint8_t ucSampleIotHubDeviceId[ 128 ];
-    static AzureIoTProvisioningClient_t xAzureIoTProvisioningClient;
-#endif /* democonfigENABLE_DPS_SAMPLE */
-
 /* Each compilation unit must define the NetworkContext struct. */
 struct NetworkContext
 {
@@ -143,37 +194,112 @@ struct NetworkContext
 
 AzureIoTHubClient_t xAzureIoTHubClient;
 
+/* Connects to the provisioning service and IoT Hub. */
+static ConnectionManager_t xConnectionManager;
+
+/**
+ * @brief Largest telemetry message ulCreateTelemetry() can write.
+ */
+#ifndef democonfigTELEMETRY_MESSAGE_SIZE
+    #define democonfigTELEMETRY_MESSAGE_SIZE    512
+#endif
+
 /* Telemetry buffers */
-static uint8_t ucScratchBuffer[ 512 ];
+static uint8_t ucScratchBuffer[ democonfigTELEMETRY_MESSAGE_SIZE ];
+
+#if ( democonfigTELEMETRY_STORE_SIZE > 0 )
+
+/* Telemetry is kept in a store until IoT Hub acknowledges it, so readings
+ * taken while disconnected are sent after reconnecting. */
+    static TelemetryStore_t xTelemetryStore;
+    static uint8_t ucTelemetryStoreBuffer[ democonfigTELEMETRY_STORE_SIZE ] democonfigLARGE_BUFFER_ATTR;
+    static uint8_t ucTelemetryStoreMessage[ democonfigTELEMETRY_STORE_MESSAGE_SIZE ] democonfigLARGE_BUFFER_ATTR;
+
+    #if ( democonfigTELEMETRY_SPOOL == 1 )
+
+/* The readings are logged in flash, the store only holding the oldest, so a
+ * backlog survives a reset and can be longer than the store. */
+        static TelemetrySpool_t xTelemetrySpool;
+        #define sampleazureiotTELEMETRY_BACKING    ( &xTelemetrySpool.xBacking )
+    #else
+        #define sampleazureiotTELEMETRY_BACKING    NULL
+    #endif /* democonfigTELEMETRY_SPOOL == 1 */
+#else
+
+/* Telemetry is published through a batch, which sends each reading on its
+ * own unless democonfigTELEMETRY_BATCH_COUNT > 1. */
+    static TelemetryBatch_t xTelemetryBatch;
+    #if ( democonfigTELEMETRY_BATCH_COUNT > 1 )
+        static uint8_t ucTelemetryBatchBuffer[ democonfigTELEMETRY_BATCH_BUFFER_SIZE ];
+        #define sampleazureiotTELEMETRY_BATCH_BUFFER    ucTelemetryBatchBuffer
+    #else
+        #define sampleazureiotTELEMETRY_BATCH_BUFFER    NULL
+    #endif
+
+    #if ( democonfigTELEMETRY_COMPRESSION == 1 )
+
+/* Content encoding of gzip compressed batches. */
+        static uint8_t ucCompressedPropertiesBuffer[ 32 ];
+        static AzureIoTMessageProperties_t xCompressedProperties;
+    #endif /* democonfigTELEMETRY_COMPRESSION == 1 */
+
+/* Telemetry messages in flight, so a message does not wait for the PUBACK
+ * of the one before it. */
+    static PublishWindow_t xPublishWindow;
+#endif /* democonfigTELEMETRY_STORE_SIZE > 0 */
+
+#if ( democonfigTELEMETRY_SPOOL == 1 ) && ( democonfigTELEMETRY_STORE_SIZE == 0 )
+    #error "The telemetry spool holds the readings of the telemetry store, set democonfigTELEMETRY_STORE_SIZE."
+#endif
+
+#if ( democonfigDEEP_SLEEP == 1 )
+    #if ( democonfigTELEMETRY_STORE_SIZE > 0 )
+        #error "The telemetry store is lost in the deep sleep, set democonfigTELEMETRY_STORE_SIZE to 0."
+    #endif
+
+    #if ( democonfigSUBSCRIBE_BATCH == 0 )
+        #error "The subscriptions the session kept through the deep sleep are answered by the subscribe batch, set democonfigSUBSCRIBE_BATCH to 1."
+    #endif
+#endif /* democonfigDEEP_SLEEP == 1 */
+
+#if ( democonfigSUBSCRIBE_BATCH == 1 )
+
+/* Holds the subscriptions of a connect, answered at once when the session
+ * the hub resumed already has them. */
+    static SubscribeBatch_t xSubscribeBatch;
+#endif /* democonfigSUBSCRIBE_BATCH == 1 */
+
+/* What the MQTT session of the hub holds, over the reconnects. */
+static HubSession_t xHubSession;
+
+#if ( democonfigTELEMETRY_CBOR == 1 )
+    #if ( democonfigTELEMETRY_BATCH_COUNT > 1 ) || \
+    ( ( democonfigTELEMETRY_STORE_SIZE > 0 ) && ( democonfigTELEMETRY_STORE_RECORDS_PER_MESSAGE > 1 ) )
+        #error "CBOR telemetry is sent one reading per message, set democonfigTELEMETRY_BATCH_COUNT and democonfigTELEMETRY_STORE_RECORDS_PER_MESSAGE to 1."
+    #endif
+
+/* Content type and encoding of CBOR telemetry. */
+    static uint8_t ucTelemetryPropertiesBuffer[ 64 ];
+    static AzureIoTMessageProperties_t xTelemetryProperties;
+    #define sampleazureiotTELEMETRY_PROPERTIES    ( &xTelemetryProperties )
+#else
+    #define sampleazureiotTELEMETRY_PROPERTIES    NULL
+#endif /* democonfigTELEMETRY_CBOR == 1 */
 
 /* Command buffers */
-static uint8_t ucCommandResponsePayloadBuffer[ 256 ];
+static CommandResponsePool_t xCommandResponsePool;
+
+#if ( democonfigDEFERRED_COMMANDS == 1 )
+    /* Commands waiting for, or in, the worker task. */
+    static DeferredCommands_t xDeferredCommands;
+#endif /* democonfigDEFERRED_COMMANDS == 1 */
 
 /* Reported Properties buffers */
-static uint8_t ucReportedPropertiesUpdate[ 380 ];
+static uint8_t ucReportedPropertiesUpdate[ 512 ];
 static uint32_t ulReportedPropertiesUpdateLength;
+static uint32_t ulReportedPropertiesRequestId;
 /*-----------------------------------------------------------*/
 
-#ifdef democonfigENABLE_DPS_SAMPLE
-
-/**
- * @brief Gets the IoT Hub endpoint and deviceId from Provisioning service.
- *   This function will block for Provisioning service for result or return failure.
- *
- * @param[in] pXNetworkCredentials  Network credential used to connect to Provisioning service
- * @param[out] ppucIothubHostname  Pointer to uint8_t* IoT Hub hostname return from Provisioning Service
- * @param[in,out] pulIothubHostnameLength  Length of hostname
- * @param[out] ppucIothubDeviceId  Pointer to uint8_t* deviceId return from Provisioning Service
- * @param[in,out] pulIothubDeviceIdLength  Length of deviceId
- */
-    static uint32_t prvIoTHubInfoGet( NetworkCredentials_t * pXNetworkCredentials,
-                                      uint8_t ** ppucIothubHostname,
-                                      uint32_t * pulIothubHostnameLength,
-                                      uint8_t ** ppucIothubDeviceId,
-                                      uint32_t * pulIothubDeviceIdLength );
-
-#endif /* democonfigENABLE_DPS_SAMPLE */
-
 /**
  * @brief The task used to demonstrate the Azure IoT Hub API.
  *
@@ -181,28 +307,11 @@ static uint32_t ulReportedPropertiesUpdateLength;
  * used in this example.
  */
 static void prvAzureDemoTask( void * pvParameters );
-
-/**
- * @brief Connect to endpoint with reconnection retries.
- *
- * If connection fails, retry is attempted after a timeout.
- * Timeout value will exponentially increase until maximum
- * timeout value is reached or the number of attempts are exhausted.
- *
- * @param pcHostName Hostname of the endpoint to connect to.
- * @param ulPort Endpoint port.
- * @param pxNetworkCredentials Pointer to Network credentials.
- * @param pxNetworkContext Point to Network context created.
- * @return uint32_t The status of the final connection attempt.
- */
-static uint32_t prvConnectToServerWithBackoffRetries( const char * pcHostName,
-                                                      uint32_t ulPort,
-                                                      NetworkCredentials_t * pxNetworkCredentials,
-                                                      NetworkContext_t * pxNetworkContext );
 /*-----------------------------------------------------------*/
 
 /**
- * @brief Static buffer used to hold MQTT messages being sent and received.
+ * @brief Buffer of the hub client, for the topics of the messages it sends and
+ * the MQTT packets it receives, see democonfigNETWORK_BUFFER_SIZE.
  */
 static uint8_t ucMQTTMessageBuffer[ democonfigNETWORK_BUFFER_SIZE ];
 
@@ -217,14 +326,39 @@ static void prvHandleCommand( AzureIoTHubClientCommandRequest_t * pxMessage,
     AzureIoTHubClient_t * pxHandle = ( AzureIoTHubClient_t * ) pvContext;
     uint32_t ulResponseStatus = 0;
     AzureIoTResult_t xResult;
+    uint8_t * pucResponseBuffer = NULL;
+    const uint8_t * pucResponsePayload;
+    uint32_t ulCommandResponsePayloadLength;
+
+    #if ( democonfigDEFERRED_COMMANDS == 1 )
+        /* Answered after the process loop, once the worker has handled it.
+         * With no slot for it, the command is asked to retry. */
+        if( DeferredCommands_Defer( &xDeferredCommands, pxMessage ) == eAzureIoTSuccess )
+        {
+            return;
+        }
+    #else
+        pucResponseBuffer = CommandResponsePool_Acquire( &xCommandResponsePool );
+    #endif /* democonfigDEFERRED_COMMANDS == 1 */
 
-    uint32_t ulCommandResponsePayloadLength = ulHandleCommand( pxMessage,
-                                                               &ulResponseStatus,
-                                                               ucCommandResponsePayloadBuffer,
-                                                               sizeof( ucCommandResponsePayloadBuffer ) );
+    if( pucResponseBuffer == NULL )
+    {
+        LogWarn( ( "No free command buffer, asking to retry." ) );
+        ulResponseStatus = sampleazureiotCOMMAND_BUSY_STATUS;
+        pucResponsePayload = ( const uint8_t * ) sampleazureiotCOMMAND_BUSY_PAYLOAD;
+        ulCommandResponsePayloadLength = sizeof( sampleazureiotCOMMAND_BUSY_PAYLOAD ) - 1;
+    }
+    else
+    {
+        ulCommandResponsePayloadLength = ulHandleCommand( pxMessage,
+                                                          &ulResponseStatus,
+                                                          pucResponseBuffer,
+                                                          democonfigCOMMAND_RESPONSE_BUFFER_SIZE );
+        pucResponsePayload = pucResponseBuffer;
+    }
 
     if( ( xResult = AzureIoTHubClient_SendCommandResponse( pxHandle, pxMessage, ulResponseStatus,
-                                                           ucCommandResponsePayloadBuffer,
+                                                           pucResponsePayload,
                                                            ulCommandResponsePayloadLength ) ) != eAzureIoTSuccess )
     {
         LogError( ( "Error sending command response: result 0x%08x", ( uint16_t ) xResult ) );
@@ -233,19 +367,35 @@ static void prvHandleCommand( AzureIoTHubClientCommandRequest_t * pxMessage,
     {
         LogInfo( ( "Successfully sent command response %d", ( int16_t ) ulResponseStatus ) );
     }
+
+    CommandResponsePool_Release( &xCommandResponsePool, pucResponseBuffer );
 }
 
+#if ( democonfigDEFERRED_COMMANDS == 1 )
+
+/**
+ * @brief Runs the commands deferred by prvHandleCommand(), for as long as they take.
+ */
+    static void prvCommandWorkerTask( void * pvParameters )
+    {
+        ( void ) pvParameters;
+
+        DeferredCommands_RunWorker( &xDeferredCommands, ulHandleCommand );
+    }
+
+#endif /* democonfigDEFERRED_COMMANDS == 1 */
+
 
 static void prvDispatchPropertiesUpdate( AzureIoTHubClientPropertiesResponse_t * pxMessage )
 {
-    vHandleWritableProperties( pxMessage,
-                               ucReportedPropertiesUpdate,
-                               sizeof( ucReportedPropertiesUpdate ),
-                               &ulReportedPropertiesUpdateLength );
+    uint32_t ulVersion = ulHandleWritableProperties( pxMessage,
+                                                     ucReportedPropertiesUpdate,
+                                                     sizeof( ucReportedPropertiesUpdate ),
+                                                     &ulReportedPropertiesUpdateLength );
 
     if( ulReportedPropertiesUpdateLength == 0 )
     {
-        LogError( ( "Failed to send response to writable properties update, length of response is zero." ) );
+        LogInfo( ( "No writable property to acknowledge." ) );
     }
     else
     {
@@ -255,6 +405,13 @@ static void prvDispatchPropertiesUpdate( AzureIoTHubClientPropertiesResponse_t *
                                                                              NULL );
         configASSERT( xResult == eAzureIoTSuccess );
     }
+
+    /* A patch was missed, so the whole document is read again. */
+    if( HubSession_PropertiesReceived( &xHubSession, pxMessage, ulVersion ) )
+    {
+        AzureIoTResult_t xResult = AzureIoTHubClient_RequestPropertiesAsync( &xAzureIoTHubClient );
+        configASSERT( xResult == eAzureIoTSuccess );
+    }
 }
 /*-----------------------------------------------------------*/
 
@@ -276,16 +433,19 @@ static void prvHandleProperties( AzureIoTHubClientPropertiesResponse_t * pxMessa
     {
         case eAzureIoTHubPropertiesRequestedMessage:
             LogDebug( ( "Device property document GET received" ) );
+            StartupProfile_Mark( eStartupPhasePropertiesReceived );
             prvDispatchPropertiesUpdate( pxMessage );
             break;
 
         case eAzureIoTHubPropertiesWritablePropertyMessage:
             LogDebug( ( "Device writeable property received" ) );
             prvDispatchPropertiesUpdate( pxMessage );
+            stackprofileMARK( eStackPhaseProperties );
             break;
 
         case eAzureIoTHubPropertiesReportedResponseMessage:
             LogDebug( ( "Device reported property response received" ) );
+            vHandleReportedPropertiesResponse( pxMessage );
             break;
 
         default:
@@ -296,22 +456,61 @@ static void prvHandleProperties( AzureIoTHubClientPropertiesResponse_t * pxMessa
 /*-----------------------------------------------------------*/
 
 /**
- * @brief Setup transport credentials.
+ * @brief Take a reading and queue it for sending.
+ */
+static AzureIoTResult_t prvAddTelemetry( void )
+{
+    uint32_t ulScratchBufferLength = 0U;
+
+    if( ( ulCreateTelemetry( ucScratchBuffer, sizeof( ucScratchBuffer ), &ulScratchBufferLength ) != 0 ) ||
+        ( ulScratchBufferLength == 0 ) )
+    {
+        return eAzureIoTSuccess;
+    }
+
+    #if ( democonfigTELEMETRY_STORE_SIZE > 0 )
+        return TelemetryStore_Add( &xTelemetryStore, ucScratchBuffer, ulScratchBufferLength );
+    #else
+        return TelemetryBatch_Add( &xTelemetryBatch, ucScratchBuffer, ulScratchBufferLength );
+    #endif
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Telemetry PUBACK callback, called from the process loop.
  */
-static uint32_t prvSetupNetworkCredentials( NetworkCredentials_t * pxNetworkCredentials )
+static void prvTelemetryAckCallback( uint16_t usPacketID )
 {
-    pxNetworkCredentials->xDisableSni = pdFALSE;
-    /* Set the credentials for establishing a TLS connection. */
-    pxNetworkCredentials->pucRootCa = ( const unsigned char * ) democonfigROOT_CA_PEM;
-    pxNetworkCredentials->xRootCaSize = sizeof( democonfigROOT_CA_PEM );
-    #ifdef democonfigCLIENT_CERTIFICATE_PEM
-        pxNetworkCredentials->pucClientCert = ( const unsigned char * ) democonfigCLIENT_CERTIFICATE_PEM;
-        pxNetworkCredentials->xClientCertSize = sizeof( democonfigCLIENT_CERTIFICATE_PEM );
-        pxNetworkCredentials->pucPrivateKey = ( const unsigned char * ) democonfigCLIENT_PRIVATE_KEY_PEM;
-        pxNetworkCredentials->xPrivateKeySize = sizeof( democonfigCLIENT_PRIVATE_KEY_PEM );
+    static char cStartupProfile[ 320 ];
+
+    #if ( democonfigSTACK_PROFILE == 1 )
+        static char cStackProfile[ 512 ];
     #endif
+    uint32_t ulMs;
 
-    return 0;
+    #if ( democonfigTELEMETRY_STORE_SIZE > 0 )
+        TelemetryStore_Acknowledge( &xTelemetryStore, usPacketID );
+    #else
+        PublishWindow_Acknowledge( &xPublishWindow, usPacketID );
+    #endif
+
+    /* The first PUBACK ends the startup. */
+    if( !StartupProfile_Get( eStartupPhaseFirstPuback, &ulMs ) )
+    {
+        StartupProfile_Mark( eStartupPhaseFirstPuback );
+        ( void ) StartupProfile_Format( cStartupProfile, sizeof( cStartupProfile ) );
+        LogInfo( ( "Startup: %s\r\n", cStartupProfile ) );
+    }
+
+    /* Logged again whenever a task went deeper, through the updates and
+     * reconnects that follow. */
+    #if ( democonfigSTACK_PROFILE == 1 )
+        if( StackProfile_Mark( eStackPhaseTelemetry ) )
+        {
+            ( void ) StackProfile_Format( cStackProfile, sizeof( cStackProfile ) );
+            LogInfo( ( "Stacks: %s\r\n", cStackProfile ) );
+        }
+    #endif
 }
 /*-----------------------------------------------------------*/
 
@@ -322,8 +521,6 @@ static uint32_t prvSetupNetworkCredentials( NetworkCredentials_t * pxNetworkCred
  */
 static void prvAzureDemoTask( void * pvParameters )
 {
-    uint32_t ulScratchBufferLength = 0U;
-    NetworkCredentials_t xNetworkCredentials = { 0 };
     AzureIoTTransportInterface_t xTransport;
     NetworkContext_t xNetworkContext = { 0 };
     TlsTransportParams_t xTlsTransportParams = { 0 };
@@ -332,6 +529,14 @@ static void prvAzureDemoTask( void * pvParameters )
     AzureIoTHubClientOptions_t xHubOptions = { 0 };
     bool xSessionPresent;
 
+    #if ( democonfigSUBSCRIBE_BATCH == 1 )
+        bool xSessionResumed;
+    #endif
+
+    #if ( democonfigDEFERRED_COMMANDS == 1 )
+        BaseType_t xTaskCreated;
+    #endif /* democonfigDEFERRED_COMMANDS == 1 */
+
     #ifdef democonfigENABLE_DPS_SAMPLE
         uint8_t * pucIotHubHostname = NULL;
         uint8_t * pucIotHubDeviceId = NULL;
@@ -346,43 +551,124 @@ static void prvAzureDemoTask( void * pvParameters )
 
     ( void ) pvParameters;
 
+    xResult = CommandResponsePool_Init( &xCommandResponsePool );
+    configASSERT( xResult == eAzureIoTSuccess );
+
+    #if ( democonfigDEFERRED_COMMANDS == 1 )
+        xResult = DeferredCommands_Init( &xDeferredCommands );
+        configASSERT( xResult == eAzureIoTSuccess );
+
+        xTaskCreated = sampletaskCREATE( prvCommandWorkerTask, "CommandWorker", democonfigDEMO_STACKSIZE,
+                                         NULL, tskIDLE_PRIORITY, NULL, democonfigDEMO_TASK_CORE );
+        configASSERT( xTaskCreated == pdPASS );
+    #endif /* democonfigDEFERRED_COMMANDS == 1 */
+
     /* Initialize Azure IoT Middleware.  */
     configASSERT( AzureIoT_Init() == eAzureIoTSuccess );
 
-    ulStatus = prvSetupNetworkCredentials( &xNetworkCredentials );
-    configASSERT( ulStatus == 0 );
+    xResult = ConnectionManager_Init( &xConnectionManager,
+                                      ucMQTTMessageBuffer, sizeof( ucMQTTMessageBuffer ),
+                                      sampleazureiotTRANSPORT_SEND_RECV_TIMEOUT_MS );
+    configASSERT( xResult == eAzureIoTSuccess );
 
-    #ifdef democonfigENABLE_DPS_SAMPLE
-        /* Run DPS.  */
-        if( ( ulStatus = prvIoTHubInfoGet( &xNetworkCredentials, &pucIotHubHostname,
-                                           &pulIothubHostnameLength, &pucIotHubDeviceId,
-                                           &pulIothubDeviceIdLength ) ) != 0 )
-        {
-            LogError( ( "Failed on sample_dps_entry!: error code = 0x%08x\r\n", ulStatus ) );
-            return;
-        }
-    #endif /* democonfigENABLE_DPS_SAMPLE */
+    /* A wake is already spread by the time the board slept. */
+    if( !deepsleepWOKE() )
+    {
+        ConnectionManager_WaitInitialDelay( &xConnectionManager );
+    }
 
     xNetworkContext.pParams = &xTlsTransportParams;
 
+    #if ( democonfigTELEMETRY_CBOR == 1 )
+        xResult = AzureIoTMessage_PropertiesInit( &xTelemetryProperties, ucTelemetryPropertiesBuffer,
+                                                  0, sizeof( ucTelemetryPropertiesBuffer ) );
+        configASSERT( xResult == eAzureIoTSuccess );
+
+        xResult = CBORWriter_AppendMessageProperties( &xTelemetryProperties );
+        configASSERT( xResult == eAzureIoTSuccess );
+    #endif /* democonfigTELEMETRY_CBOR == 1 */
+
+    #if ( democonfigTELEMETRY_STORE_SIZE == 0 ) && ( democonfigTELEMETRY_COMPRESSION == 1 )
+        xResult = AzureIoTMessage_PropertiesInit( &xCompressedProperties, ucCompressedPropertiesBuffer,
+                                                  0, sizeof( ucCompressedPropertiesBuffer ) );
+        configASSERT( xResult == eAzureIoTSuccess );
+
+        xResult = TelemetryCompress_AppendMessageProperties( &xCompressedProperties );
+        configASSERT( xResult == eAzureIoTSuccess );
+    #endif /* ( democonfigTELEMETRY_STORE_SIZE == 0 ) && ( democonfigTELEMETRY_COMPRESSION == 1 ) */
+
+    #if ( democonfigTELEMETRY_STORE_SIZE > 0 )
+        #if ( democonfigTELEMETRY_SPOOL == 1 )
+            xResult = TelemetrySpool_Init( &xTelemetrySpool );
+            configASSERT( xResult == eAzureIoTSuccess );
+        #endif /* democonfigTELEMETRY_SPOOL == 1 */
+
+        xResult = TelemetryStore_Init( &xTelemetryStore,
+                                       ucTelemetryStoreBuffer, sizeof( ucTelemetryStoreBuffer ),
+                                       ucTelemetryStoreMessage, sizeof( ucTelemetryStoreMessage ),
+                                       democonfigTELEMETRY_STORE_RECORDS_PER_MESSAGE,
+                                       sampleazureiotTELEMETRY_BACKING );
+        configASSERT( xResult == eAzureIoTSuccess );
+    #endif /* democonfigTELEMETRY_STORE_SIZE > 0 */
+
     for( ; ; )
     {
+        #ifdef democonfigENABLE_DPS_SAMPLE
+
+            /* The assigned hub and device ID are kept across iterations, and
+             * only looked up again once the hub refuses them. */
+            if( pucIotHubHostname == NULL )
+            {
+                /* Run DPS.  */
+                if( ( ulStatus = ConnectionManager_Provision( &xConnectionManager,
+                                                              ( const uint8_t * ) sampleazureiotPROVISIONING_PAYLOAD,
+                                                              sizeof( sampleazureiotPROVISIONING_PAYLOAD ) - 1,
+                                                              sampleazureiotProvisioning_Registration_TIMEOUT_MS,
+                                                              &pucIotHubHostname, &pulIothubHostnameLength,
+                                                              &pucIotHubDeviceId, &pulIothubDeviceIdLength ) ) != 0 )
+                {
+                    LogError( ( "Failed on sample_dps_entry!: error code = 0x%08x\r\n", ulStatus ) );
+                    return;
+                }
+            }
+        #endif /* democonfigENABLE_DPS_SAMPLE */
+
         /* Attempt to establish TLS session with IoT Hub. If connection fails,
          * retry after a timeout. Timeout value will be exponentially increased
          * until  the maximum number of attempts are reached or the maximum timeout
          * value is reached. The function returns a failure status if the TCP
          * connection cannot be established to the IoT Hub after the configured
          * number of attempts. */
-        ulStatus = prvConnectToServerWithBackoffRetries( ( const char * ) pucIotHubHostname,
-                                                         democonfigIOTHUB_PORT,
-                                                         &xNetworkCredentials, &xNetworkContext );
+        ulStatus = ConnectionManager_ConnectHub( &xConnectionManager, democonfigIOTHUB_PORT, &xNetworkContext,
+                                                 &pucIotHubHostname, &pulIothubHostnameLength,
+                                                 &pucIotHubDeviceId, &pulIothubDeviceIdLength );
+
+        #if ( democonfigTELEMETRY_STORE_SIZE > 0 )
+            /* Keep taking readings while IoT Hub cannot be reached. */
+            while( ulStatus != 0 )
+            {
+                xResult = prvAddTelemetry();
+                configASSERT( xResult == eAzureIoTSuccess );
+
+                vTaskDelay( sampleazureiotDELAY_BETWEEN_PUBLISHES_TICKS );
+                ulStatus = ConnectionManager_ConnectHub( &xConnectionManager, democonfigIOTHUB_PORT, &xNetworkContext,
+                                                         &pucIotHubHostname, &pulIothubHostnameLength,
+                                                         &pucIotHubDeviceId, &pulIothubDeviceIdLength );
+            }
+        #endif /* democonfigTELEMETRY_STORE_SIZE > 0 */
         configASSERT( ulStatus == 0 );
+        StartupProfile_Mark( eStartupPhaseHubConnected );
 
         /* Fill in Transport Interface send and receive function pointers. */
         xTransport.pxNetworkContext = &xNetworkContext;
         xTransport.xSend = TLS_Socket_Send;
         xTransport.xRecv = TLS_Socket_Recv;
 
+        #if ( democonfigSUBSCRIBE_BATCH == 1 )
+            xResult = SubscribeBatch_Init( &xSubscribeBatch, &xTransport );
+            configASSERT( xResult == eAzureIoTSuccess );
+        #endif /* democonfigSUBSCRIBE_BATCH == 1 */
+
         /* Init IoT Hub option */
         xResult = AzureIoTHubClient_OptionsInit( &xHubOptions );
         configASSERT( xResult == eAzureIoTSuccess );
@@ -399,6 +685,8 @@ static void prvAzureDemoTask( void * pvParameters )
             #endif /* > 0 */
         #endif /* democonfigPNP_COMPONENTS_LIST_LENGTH */
 
+        xHubOptions.xTelemetryCallback = prvTelemetryAckCallback;
+
         xResult = AzureIoTHubClient_Init( &xAzureIoTHubClient,
                                           pucIotHubHostname, pulIothubHostnameLength,
                                           pucIotHubDeviceId, pulIothubDeviceIdLength,
@@ -423,68 +711,191 @@ static void prvAzureDemoTask( void * pvParameters )
         xResult = AzureIoTHubClient_Connect( &xAzureIoTHubClient,
                                              false, &xSessionPresent,
                                              sampleazureiotCONNACK_RECV_TIMEOUT_MS );
+
+        #ifdef democonfigENABLE_DPS_SAMPLE
+            if( xResult == eAzureIoTErrorServerError )
+            {
+                /* The device was moved to another hub or its credentials
+                 * changed, so register with the provisioning service again. */
+                LogWarn( ( "IoT Hub refused the connection, provisioning again.\r\n" ) );
+                TLS_Socket_Disconnect( &xNetworkContext );
+                pucIotHubHostname = NULL;
+                ConnectionManager_ForgetAssignment( &xConnectionManager );
+                vTaskDelay( sampleazureiotDELAY_BETWEEN_DEMO_ITERATIONS_TICKS );
+                continue;
+            }
+        #endif /* democonfigENABLE_DPS_SAMPLE */
         configASSERT( xResult == eAzureIoTSuccess );
+        StartupProfile_Mark( eStartupPhaseMqttConnected );
+
+        #if ( democonfigSUBSCRIBE_BATCH == 1 )
+            /* Both are told of the CONNACK, as each forgets the session it
+             * kept when the hub did not. */
+            xSessionResumed = HubSession_Resume( &xHubSession, xSessionPresent );
+            xSessionResumed = deepsleepSUBSCRIBED( xSessionPresent ) || xSessionResumed;
+
+            /* The subscribe calls return at once, and are not sent to a
+             * session that already holds the subscriptions. */
+            if( xSessionResumed )
+            {
+                SubscribeBatch_BeginResumed( &xSubscribeBatch );
+            }
+            else
+            {
+                SubscribeBatch_Begin( &xSubscribeBatch );
+            }
+        #else
+            /* The subscriptions are sent again, but the properties need not be. */
+            ( void ) HubSession_Resume( &xHubSession, xSessionPresent );
+        #endif /* democonfigSUBSCRIBE_BATCH == 1 */
 
+        sampletraceBEGIN( eSampleTraceSubscribe, 0 );
         xResult = AzureIoTHubClient_SubscribeCommand( &xAzureIoTHubClient, prvHandleCommand,
                                                       &xAzureIoTHubClient, sampleazureiotSUBSCRIBE_TIMEOUT );
         configASSERT( xResult == eAzureIoTSuccess );
 
         xResult = AzureIoTHubClient_SubscribeProperties( &xAzureIoTHubClient, prvHandleProperties,
                                                          &xAzureIoTHubClient, sampleazureiotSUBSCRIBE_TIMEOUT );
+        sampletraceEND( eSampleTraceSubscribe, xResult );
         configASSERT( xResult == eAzureIoTSuccess );
+        StartupProfile_Mark( eStartupPhaseSubscribed );
 
-        /* Get property document after initial connection */
-        xResult = AzureIoTHubClient_RequestPropertiesAsync( &xAzureIoTHubClient );
-        configASSERT( xResult == eAzureIoTSuccess );
+        /* Get property document after initial connection, or in a new
+         * session. In a resumed one, a patch missed while the link was down
+         * shows as a gap in the versions, and the document is asked for then. */
+        if( HubSession_NeedsProperties( &xHubSession ) )
+        {
+            xResult = AzureIoTHubClient_RequestPropertiesAsync( &xAzureIoTHubClient );
+            configASSERT( xResult == eAzureIoTSuccess );
+        }
+
+        #if ( democonfigSUBSCRIBE_BATCH == 1 )
+            xResult = SubscribeBatch_End( &xSubscribeBatch );
+            configASSERT( xResult == eAzureIoTSuccess );
+        #endif /* democonfigSUBSCRIBE_BATCH == 1 */
+
+        HubSession_SetSubscribed( &xHubSession );
+        deepsleepSET_SUBSCRIBED();
+
+        #if ( democonfigTELEMETRY_STORE_SIZE > 0 )
+            /* The client does not resend messages that were not acknowledged
+             * before the connection dropped, so the store sends them again. */
+            TelemetryStore_Resend( &xTelemetryStore );
+        #else
+            xResult = PublishWindow_Init( &xPublishWindow, &xAzureIoTHubClient,
+                                          sampleazureiotPROCESS_LOOP_TIMEOUT_MS, NULL, NULL );
+            configASSERT( xResult == eAzureIoTSuccess );
+
+            xResult = TelemetryBatch_Init( &xTelemetryBatch, &xAzureIoTHubClient, sampleazureiotTELEMETRY_PROPERTIES, &xPublishWindow,
+                                           sampleazureiotTELEMETRY_BATCH_BUFFER, democonfigTELEMETRY_BATCH_BUFFER_SIZE,
+                                           democonfigTELEMETRY_BATCH_COUNT, pdMS_TO_TICKS( democonfigTELEMETRY_BATCH_MAX_AGE_MS ) );
+            configASSERT( xResult == eAzureIoTSuccess );
+
+            #if ( democonfigTELEMETRY_COMPRESSION == 1 )
+                xResult = TelemetryBatch_EnableCompression( &xTelemetryBatch, &xCompressedProperties );
+                configASSERT( xResult == eAzureIoTSuccess );
+            #endif /* democonfigTELEMETRY_COMPRESSION == 1 */
+        #endif /* democonfigTELEMETRY_STORE_SIZE > 0 */
 
         /* Publish messages with QoS1, send and process Keep alive messages. */
         for( ; ; )
         {
             /* Hook for sending Telemetry */
-            if( ( ulCreateTelemetry( ucScratchBuffer, sizeof( ucScratchBuffer ), &ulScratchBufferLength ) == 0 ) &&
-                ( ulScratchBufferLength > 0 ) )
-            {
-                xResult = AzureIoTHubClient_SendTelemetry( &xAzureIoTHubClient,
-                                                           ucScratchBuffer, ulScratchBufferLength,
-                                                           NULL, eAzureIoTHubMessageQoS1, NULL );
-                configASSERT( xResult == eAzureIoTSuccess );
-            }
+            xResult = prvAddTelemetry();
+            configASSERT( xResult == eAzureIoTSuccess );
+
+            #if ( democonfigTELEMETRY_STORE_SIZE > 0 )
+                /* Send the oldest stored readings, a few messages at a time so a
+                 * backlog does not hold up the rest of the loop. */
+                xResult = TelemetryStore_Drain( &xTelemetryStore, &xAzureIoTHubClient, sampleazureiotTELEMETRY_PROPERTIES,
+                                                democonfigTELEMETRY_STORE_MESSAGES_PER_DRAIN );
+
+                if( xResult != eAzureIoTSuccess )
+                {
+                    LogError( ( "Failed to send stored telemetry, reconnecting: error code = 0x%08x\r\n", xResult ) );
+                    break;
+                }
+            #endif /* democonfigTELEMETRY_STORE_SIZE > 0 */
 
             /* Hook for sending update to reported properties */
             ulReportedPropertiesUpdateLength = ulCreateReportedPropertiesUpdate( ucReportedPropertiesUpdate, sizeof( ucReportedPropertiesUpdate ) );
 
             if( ulReportedPropertiesUpdateLength > 0 )
             {
-                xResult = AzureIoTHubClient_SendPropertiesReported( &xAzureIoTHubClient, ucReportedPropertiesUpdate, ulReportedPropertiesUpdateLength, NULL );
+                xResult = AzureIoTHubClient_SendPropertiesReported( &xAzureIoTHubClient, ucReportedPropertiesUpdate, ulReportedPropertiesUpdateLength, &ulReportedPropertiesRequestId );
+                vReportedPropertiesUpdateSent( ulReportedPropertiesRequestId, xResult );
                 configASSERT( xResult == eAzureIoTSuccess );
             }
 
             LogInfo( ( "Attempt to receive publish message from IoT Hub.\r\n" ) );
-            xResult = AzureIoTHubClient_ProcessLoop( &xAzureIoTHubClient,
-                                                     sampleazureiotPROCESS_LOOP_TIMEOUT_MS );
-            configASSERT( xResult == eAzureIoTSuccess );
+            xResult = AzureIoTHubClient_ProcessLoop( &xAzureIoTHubClient, sampleazureiotLOOP_PROCESS_LOOP_TIMEOUT_MS );
+
+            #if ( democonfigDEFERRED_COMMANDS == 1 )
+                if( xResult == eAzureIoTSuccess )
+                {
+                    xResult = DeferredCommands_Send( &xDeferredCommands, &xAzureIoTHubClient );
+                }
+            #endif /* democonfigDEFERRED_COMMANDS == 1 */
+
+            #if ( democonfigTELEMETRY_STORE_SIZE > 0 )
+                if( xResult != eAzureIoTSuccess )
+                {
+                    LogError( ( "Connection lost, reconnecting: error code = 0x%08x\r\n", xResult ) );
+                    break;
+                }
+            #else
+                configASSERT( xResult == eAzureIoTSuccess );
 
-            /* Leave Connection Idle for some time. */
-            LogInfo( ( "Keeping Connection Idle...\r\n\r\n" ) );
-            vTaskDelay( sampleazureiotDELAY_BETWEEN_PUBLISHES_TICKS );
+                xResult = TelemetryBatch_Process( &xTelemetryBatch );
+                configASSERT( xResult == eAzureIoTSuccess );
+            #endif /* democonfigTELEMETRY_STORE_SIZE > 0 */
+
+            #if ( democonfigDEEP_SLEEP == 1 )
+                /* One batch of telemetry a wake. */
+                break;
+            #elif ( configUSE_TICKLESS_IDLE == 0 ) && ( democonfigCOMMAND_IMMEDIATE_RESPONSE == 0 )
+                /* Leave Connection Idle for some time. */
+                LogInfo( ( "Keeping Connection Idle...\r\n\r\n" ) );
+                vTaskDelay( sampleazureiotDELAY_BETWEEN_PUBLISHES_TICKS );
+            #endif /* democonfigDEEP_SLEEP == 1 */
         }
 
-        xResult = AzureIoTHubClient_UnsubscribeProperties( &xAzureIoTHubClient );
-        configASSERT( xResult == eAzureIoTSuccess );
+        #if ( democonfigTELEMETRY_STORE_SIZE == 0 )
+            /* Publish what is left in the batch before disconnecting. */
+            xResult = TelemetryBatch_Flush( &xTelemetryBatch );
+            configASSERT( xResult == eAzureIoTSuccess );
 
-        xResult = AzureIoTHubClient_UnsubscribeCommand( &xAzureIoTHubClient );
-        configASSERT( xResult == eAzureIoTSuccess );
+            xResult = PublishWindow_WaitForAll( &xPublishWindow, pdMS_TO_TICKS( democonfigPUBLISH_WINDOW_TIMEOUT_MS ) );
+            configASSERT( xResult == eAzureIoTSuccess );
 
-        /* Send an MQTT Disconnect packet over the already connected TLS over
-         * TCP connection. There is no corresponding response for the disconnect
-         * packet. After sending disconnect, client must close the network
-         * connection. */
-        xResult = AzureIoTHubClient_Disconnect( &xAzureIoTHubClient );
-        configASSERT( xResult == eAzureIoTSuccess );
+            /* The session keeps the subscriptions through the deep sleep. */
+            #if ( democonfigDEEP_SLEEP == 0 )
+                xResult = AzureIoTHubClient_UnsubscribeProperties( &xAzureIoTHubClient );
+                configASSERT( xResult == eAzureIoTSuccess );
+
+                xResult = AzureIoTHubClient_UnsubscribeCommand( &xAzureIoTHubClient );
+                configASSERT( xResult == eAzureIoTSuccess );
+            #endif /* democonfigDEEP_SLEEP == 0 */
+
+            /* Send an MQTT Disconnect packet over the already connected TLS over
+             * TCP connection. There is no corresponding response for the disconnect
+             * packet. After sending disconnect, client must close the network
+             * connection. */
+            xResult = AzureIoTHubClient_Disconnect( &xAzureIoTHubClient );
+            configASSERT( xResult == eAzureIoTSuccess );
+        #else
+            /* The loop only ends when the connection is lost, so there is
+             * nothing to send a disconnect over. The stored readings are kept. */
+            ( void ) AzureIoTHubClient_Disconnect( &xAzureIoTHubClient );
+        #endif /* democonfigTELEMETRY_STORE_SIZE == 0 */
 
         /* Close the network connection.  */
         TLS_Socket_Disconnect( &xNetworkContext );
 
+        #if ( democonfigDEEP_SLEEP == 1 )
+            DeepSleep_Enter();
+        #endif /* democonfigDEEP_SLEEP == 1 */
+
         /* Wait for some time between two iterations to ensure that we do not
          * bombard the IoT Hub. */
         LogInfo( ( "Demo completed successfully.\r\n" ) );
@@ -494,191 +905,21 @@ static void prvAzureDemoTask( void * pvParameters )
 }
 /*-----------------------------------------------------------*/
 
-#ifdef democonfigENABLE_DPS_SAMPLE
-
-/**
- * @brief Get IoT Hub endpoint and device Id info, when Provisioning service is used.
- *   This function will block for Provisioning service for result or return failure.
- */
-    static uint32_t prvIoTHubInfoGet( NetworkCredentials_t * pXNetworkCredentials,
-                                      uint8_t ** ppucIothubHostname,
-                                      uint32_t * pulIothubHostnameLength,
-                                      uint8_t ** ppucIothubDeviceId,
-                                      uint32_t * pulIothubDeviceIdLength )
-    {
-        NetworkContext_t xNetworkContext = { 0 };
-        TlsTransportParams_t xTlsTransportParams = { 0 };
-        AzureIoTResult_t xResult;
-        AzureIoTTransportInterface_t xTransport;
-        uint32_t ucSamplepIothubHostnameLength = sizeof( ucSampleIotHubHostname );
-        uint32_t ucSamplepIothubDeviceIdLength = sizeof( ucSampleIotHubDeviceId );
-        uint32_t ulStatus;
-
-        /* Set the pParams member of the network context with desired transport. */
-        xNetworkContext.pParams = &xTlsTransportParams;
-
-        ulStatus = prvConnectToServerWithBackoffRetries( democonfigENDPOINT, democonfigIOTHUB_PORT,
-                                                         pXNetworkCredentials, &xNetworkContext );
-        configASSERT( ulStatus == 0 );
-
-        /* Fill in Transport Interface send and receive function pointers. */
-        xTransport.pxNetworkContext = &xNetworkContext;
-        xTransport.xSend = TLS_Socket_Send;
-        xTransport.xRecv = TLS_Socket_Recv;
-
-        #ifdef democonfigUSE_HSM
-
-            /* Redefine the democonfigREGISTRATION_ID macro using registration ID
-             * generated dynamically using the HSM */
-
-            /* We use a pointer instead of a buffer so that the getRegistrationId
-             * function can allocate the necessary memory depending on the HSM */
-            char * registration_id = NULL;
-            ulStatus = getRegistrationId( &registration_id );
-            configASSERT( ulStatus == 0 );
-#undef democonfigREGISTRATION_ID
-        #define democonfigREGISTRATION_ID    registration_id
-        #endif
-
-        xResult = AzureIoTProvisioningClient_Init( &xAzureIoTProvisioningClient,
-                                                   ( const uint8_t * ) democonfigENDPOINT,
-                                                   sizeof( democonfigENDPOINT ) - 1,
-                                                   ( const uint8_t * ) democonfigID_SCOPE,
-                                                   sizeof( democonfigID_SCOPE ) - 1,
-                                                   ( const uint8_t * ) democonfigREGISTRATION_ID,
-                                                   #ifdef democonfigUSE_HSM
-                                                       strlen( democonfigREGISTRATION_ID ),
-                                                   #else
-                                                       sizeof( democonfigREGISTRATION_ID ) - 1,
-                                                   #endif
-                                                   NULL, ucMQTTMessageBuffer, sizeof( ucMQTTMessageBuffer ),
-                                                   ullGetUnixTime,
-                                                   &xTransport );
-        configASSERT( xResult == eAzureIoTSuccess );
-
-        #ifdef democonfigDEVICE_SYMMETRIC_KEY
-            xResult = AzureIoTProvisioningClient_SetSymmetricKey( &xAzureIoTProvisioningClient,
-                                                                  ( const uint8_t * ) democonfigDEVICE_SYMMETRIC_KEY,
-                                                                  sizeof( democonfigDEVICE_SYMMETRIC_KEY ) - 1,
-                                                                  Crypto_HMAC );
-            configASSERT( xResult == eAzureIoTSuccess );
-        #endif /* democonfigDEVICE_SYMMETRIC_KEY */
-
-        xResult = AzureIoTProvisioningClient_SetRegistrationPayload( &xAzureIoTProvisioningClient,
-                                                                     ( const uint8_t * ) sampleazureiotPROVISIONING_PAYLOAD,
-                                                                     sizeof( sampleazureiotPROVISIONING_PAYLOAD ) - 1 );
-        configASSERT( xResult == eAzureIoTSuccess );
-
-        do
-        {
-            xResult = AzureIoTProvisioningClient_Register( &xAzureIoTProvisioningClient,
-                                                           sampleazureiotProvisioning_Registration_TIMEOUT_MS );
-        } while( xResult == eAzureIoTErrorPending );
-
-        if( xResult == eAzureIoTSuccess )
-        {
-            LogInfo( ( "Successfully acquired IoT Hub name and Device ID" ) );
-        }
-        else
-        {
-            LogInfo( ( "Error geting IoT Hub name and Device ID: 0x%08x", ( uint16_t ) xResult ) );
-        }
-
-        configASSERT( xResult == eAzureIoTSuccess );
-
-        xResult = AzureIoTProvisioningClient_GetDeviceAndHub( &xAzureIoTProvisioningClient,
-                                                              ucSampleIotHubHostname, &ucSamplepIothubHostnameLength,
-                                                              ucSampleIotHubDeviceId, &ucSamplepIothubDeviceIdLength );
-        configASSERT( xResult == eAzureIoTSuccess );
-
-        AzureIoTProvisioningClient_Deinit( &xAzureIoTProvisioningClient );
-
-        /* Close the network connection.  */
-        TLS_Socket_Disconnect( &xNetworkContext );
-
-        *ppucIothubHostname = ucSampleIotHubHostname;
-        *pulIothubHostnameLength = ucSamplepIothubHostnameLength;
-        *ppucIothubDeviceId = ucSampleIotHubDeviceId;
-        *pulIothubDeviceIdLength = ucSamplepIothubDeviceIdLength;
-
-        return 0;
-    }
-
-#endif /* democonfigENABLE_DPS_SAMPLE */
-/*-----------------------------------------------------------*/
-
-/**
- * @brief Connect to server with backoff retries.
- */
-static uint32_t prvConnectToServerWithBackoffRetries( const char * pcHostName,
-                                                      uint32_t port,
-                                                      NetworkCredentials_t * pxNetworkCredentials,
-                                                      NetworkContext_t * pxNetworkContext )
-{
-    TlsTransportStatus_t xNetworkStatus;
-    BackoffAlgorithmStatus_t xBackoffAlgStatus = BackoffAlgorithmSuccess;
-    BackoffAlgorithmContext_t xReconnectParams;
-    uint16_t usNextRetryBackOff = 0U;
-
-    /* Initialize reconnect attempts and interval. */
-    BackoffAlgorithm_InitializeParams( &xReconnectParams,
-                                       sampleazureiotRETRY_BACKOFF_BASE_MS,
-                                       sampleazureiotRETRY_MAX_BACKOFF_DELAY_MS,
-                                       sampleazureiotRETRY_MAX_ATTEMPTS );
-
-    /* Attempt to connect to IoT Hub. If connection fails, retry after
-     * a timeout. Timeout value will exponentially increase till maximum
-     * attempts are reached.
-     */
-    do
-    {
-        LogInfo( ( "Creating a TLS connection to %s:%u.\r\n", pcHostName, ( uint16_t ) port ) );
-        /* Attempt to create a mutually authenticated TLS connection. */
-        xNetworkStatus = TLS_Socket_Connect( pxNetworkContext,
-                                             pcHostName, port,
-                                             pxNetworkCredentials,
-                                             sampleazureiotTRANSPORT_SEND_RECV_TIMEOUT_MS,
-                                             sampleazureiotTRANSPORT_SEND_RECV_TIMEOUT_MS );
-
-        if( xNetworkStatus != eTLSTransportSuccess )
-        {
-            /* Generate a random number and calculate backoff value (in milliseconds) for
-             * the next connection retry.
-             * Note: It is recommended to seed the random number generator with a device-specific
-             * entropy source so that possibility of multiple devices retrying failed network operations
-             * at similar intervals can be avoided. */
-            xBackoffAlgStatus = BackoffAlgorithm_GetNextBackoff( &xReconnectParams, configRAND32(), &usNextRetryBackOff );
-
-            if( xBackoffAlgStatus == BackoffAlgorithmRetriesExhausted )
-            {
-                LogError( ( "Connection to the IoT Hub failed, all attempts exhausted." ) );
-            }
-            else if( xBackoffAlgStatus == BackoffAlgorithmSuccess )
-            {
-                LogWarn( ( "Connection to the IoT Hub failed [%d]. "
-                           "Retrying connection with backoff and jitter [%d]ms.",
-                           xNetworkStatus, usNextRetryBackOff ) );
-                vTaskDelay( pdMS_TO_TICKS( usNextRetryBackOff ) );
-            }
-        }
-    } while( ( xNetworkStatus != eTLSTransportSuccess ) && ( xBackoffAlgStatus == BackoffAlgorithmSuccess ) );
-
-    return xNetworkStatus == eTLSTransportSuccess ? 0 : 1;
-}
-/*-----------------------------------------------------------*/
-
 /*
  * @brief Create the task that demonstrates the AzureIoTHub demo
  */
 void vStartDemoTask( void )
 {
+    SampleTrace_Init();
+
     /* This example uses a single application task, which in turn is used to
      * connect, subscribe, publish, unsubscribe and disconnect from the IoT Hub */
-    xTaskCreate( prvAzureDemoTask,         /* Function that implements the task. */
-                 "AzureDemoTask",          /* Text name for the task - only used for debugging. */
-                 democonfigDEMO_STACKSIZE, /* Size of stack (in words, not bytes) to allocate for the task. */
-                 NULL,                     /* Task parameter - not used in this case. */
-                 tskIDLE_PRIORITY,         /* Task priority, must be between 0 and configMAX_PRIORITIES - 1. */
-                 NULL );                   /* Used to pass out a handle to the created task - not used in this case. */
+    sampletaskCREATE( prvAzureDemoTask,          /* Function that implements the task. */
+                      "AzureDemoTask",           /* Text name for the task - only used for debugging. */
+                      democonfigDEMO_STACKSIZE,  /* Size of stack (in words, not bytes) to allocate for the task. */
+                      NULL,                      /* Task parameter - not used in this case. */
+                      tskIDLE_PRIORITY,          /* Task priority, must be between 0 and configMAX_PRIORITIES - 1. */
+                      NULL,                      /* Used to pass out a handle to the created task - not used in this case. */
+                      democonfigDEMO_TASK_CORE ); /* Core the task is pinned to, if democonfigPIN_TASKS_TO_CORE is defined. */
 }
 /*-----------------------------------------------------------*/
@@ -14,8 +14,11 @@
 #include <stdint.h>
 
 #include "azure_iot_hub_client_properties.h"
+#include "azure_iot_json_reader.h"
 #include "demo_config.h"
 
+#include "azure_sample_reported_properties.h"
+
 /**
  * @brief The payload to send to the Device Provisioning Service (DO NOT MODIFY)
  */
@@ -23,6 +26,69 @@
 
 extern AzureIoTHubClient_t xAzureIoTHubClient;
 
+/**
+ * @brief Handles a writable property of a component added with `vSetPnPComponents`.
+ *
+ * @param[in] pxReader                  Reader on the name of the property, as left by
+ *                                      AzureIoTHubClientProperties_GetNextComponentProperty().
+ *                                      It must be left on the token after the value.
+ * @param[in] ulVersion                 Version of the writable properties.
+ * @param[in] pucResponseBuffer         Buffer the handler may write and send its response from.
+ * @param[in] ulResponseBufferSize      Size of `pucResponseBuffer`.
+ *
+ * @return An #AzureIoTResult_t, which stops the handling of the message when not eAzureIoTSuccess.
+ */
+typedef AzureIoTResult_t ( * PnPComponentPropertyHandler_t )( AzureIoTJSONReader_t * pxReader,
+                                                               uint32_t ulVersion,
+                                                               uint8_t * pucResponseBuffer,
+                                                               uint32_t ulResponseBufferSize );
+
+/**
+ * @brief A component handled next to the thermostat, such as the Device Update
+ *        component of the ADU sample. Its name must also be in the component
+ *        list of the hub client options.
+ */
+typedef struct PnPComponent
+{
+    const uint8_t * pucName;
+    uint32_t ulNameLength;
+    PnPComponentPropertyHandler_t xPropertyHandler;
+} PnPComponent_t;
+
+/**
+ * @brief Adds components to the ones handled by `ulHandleWritableProperties`.
+ *
+ * @remark Implemented by the thermostat of sample_azure_iot_pnp_simulated_data.c,
+ *         and called by the sample before it connects. The properties of the
+ *         components are handled before the thermostat writes its response.
+ *
+ * @param[in] pxComponents      The components, kept until the next call.
+ * @param[in] ulComponentCount  Number of `pxComponents`.
+ */
+void vSetPnPComponents( const PnPComponent_t * pxComponents,
+                        uint32_t ulComponentCount );
+
+/**
+ * @brief Acknowledges a writable property of the message `ulHandleWritableProperties` is handling.
+ *
+ * @remark Implemented by the thermostat of sample_azure_iot_pnp_simulated_data.c,
+ *         and called by the property handlers of the components. The
+ *         acknowledgements of the whole message go out in one response,
+ *         written once the message is parsed.
+ *
+ * @param[in] pxProperty            The name, component included, and the value acknowledged.
+ *                                  A string value must stay valid until the message is handled.
+ * @param[in] lStatus               The status of the property, such as 200 when it is accepted.
+ * @param[in] pucDescription        Description of the status, or NULL.
+ * @param[in] ulDescriptionLength   Length of `pucDescription`.
+ *
+ * @return eAzureIoTErrorOutOfMemory when the response has no room for another property.
+ */
+AzureIoTResult_t xAckWritableProperty( const ReportedProperty_t * pxProperty,
+                                       int32_t lStatus,
+                                       const uint8_t * pucDescription,
+                                       uint32_t ulDescriptionLength );
+
 /**
  * @brief Provides the payload to be sent as telemetry to the Azure IoT Hub.
  *
@@ -57,6 +123,27 @@ uint32_t ulCreateTelemetry( uint8_t * pucTelemetryData,
 uint32_t ulCreateReportedPropertiesUpdate( uint8_t * pucPropertiesData,
                                            uint32_t ulPropertiesDataSize );
 
+/**
+ * @brief Informs the sample that the payload from `ulCreateReportedPropertiesUpdate` was sent.
+ *
+ * @remark This function must be implemented by the specific sample.
+ *         Properties sent in an update that failed or was refused can be sent again.
+ *
+ * @param[in] ulRequestId Request ID of the update, matched by its response.
+ * @param[in] xResult     Result of sending the update.
+ */
+void vReportedPropertiesUpdateSent( uint32_t ulRequestId,
+                                    AzureIoTResult_t xResult );
+
+/**
+ * @brief Handles the response of the Azure IoT Hub to a reported properties update.
+ *
+ * @remark This function must be implemented by the specific sample.
+ *
+ * @param[in] pxMessage Pointer to a structure that holds the request ID and the status of the update.
+ */
+void vHandleReportedPropertiesResponse( AzureIoTHubClientPropertiesResponse_t * pxMessage );
+
 /**
  * @brief Handles a Command received from the Azure IoT Hub.
  *
@@ -78,15 +165,17 @@ uint32_t ulHandleCommand( AzureIoTHubClientCommandRequest_t * pxMessage,
  * @brief Handles a properties message received from the Azure IoT Hub (writable or get response).
  *
  * @remark This function must be implemented by the specific sample.
+ *         `pulWritablePropertyResponseBufferLength` is zero when there is no response to send.
  *
  * @param[in]  pxMessage                               Pointer to a structure that holds the Writable Properties received.
  * @param[out] pucWritablePropertyResponseBuffer       Buffer where to write the response for the property update.
  * @param[out] ulWritablePropertyResponseBufferSize    Size of `pucWritablePropertyResponseBuffer`.
  * @param[out] pulWritablePropertyResponseBufferLength Number of bytes written into `pucWritablePropertyResponseBuffer`.
+ * @return The `$version` of the writable properties of the message, 0 if it could not be read.
  */
-void vHandleWritableProperties( AzureIoTHubClientPropertiesResponse_t * pxMessage,
-                                uint8_t * pucWritablePropertyResponseBuffer,
-                                uint32_t ulWritablePropertyResponseBufferSize,
-                                uint32_t * pulWritablePropertyResponseBufferLength );
+uint32_t ulHandleWritableProperties( AzureIoTHubClientPropertiesResponse_t * pxMessage,
+                                     uint8_t * pucWritablePropertyResponseBuffer,
+                                     uint32_t ulWritablePropertyResponseBufferSize,
+                                     uint32_t * pulWritablePropertyResponseBufferLength );
 
 #endif /* ifndef SAMPLE_AZURE_IOT_PNP_DATA_IF_H */
@@ -4,13 +4,22 @@
 #include "sample_azure_iot_pnp_data_if.h"
 
 /* Standard includes. */
+#include <math.h>
+#include <stdint.h>
 #include <string.h>
-#include <stdio.h>
 
 /* Azure JSON includes */
 #include "azure_iot_json_reader.h"
 #include "azure_iot_json_writer.h"
 
+/* Single pass property dispatch, and command dispatch by name. */
+#include "azure_sample_properties.h"
+#include "azure_sample_commands.h"
+#include "azure_sample_reported_properties.h"
+#include "azure_sample_decimal.h"
+#include "azure_sample_diagnostics.h"
+#include "azure_sample_heap_trace.h"
+
 /* FreeRTOS */
 /* This task provides taskDISABLE_INTERRUPTS, used by configASSERT */
 #include "FreeRTOS.h"
@@ -43,6 +52,58 @@
 #define sampleazureiotDEFAULT_START_TEMP_CELSIUS          22.0
 #define sampleazureiotDOUBLE_DECIMAL_PLACE_DIGITS         2
 
+/**
+ * @brief Temperatures are summed for the average in hundredths of a degree,
+ * the decimals of the report, so the sum stays exact however many there are.
+ */
+#define sampleazureiotTEMPERATURE_DECIMALS                2U
+#define sampleazureiotTEMPERATURE_SCALE                   100
+
+/**
+ * @brief 1 to hold the thermostat temperatures in hundredths of a degree,
+ * converted to text only when written to JSON, for the parts whose FPU has no
+ * double precision. The received target temperature is converted once.
+ * Temperatures are then logged with sampleazureiotTEMPERATURE_DECIMALS decimals.
+ */
+#ifndef democonfigPNP_FIXED_POINT_TEMPERATURE
+    #define democonfigPNP_FIXED_POINT_TEMPERATURE         0
+#endif
+
+#if ( democonfigPNP_FIXED_POINT_TEMPERATURE == 1 )
+    typedef int32_t Temperature_t;
+
+    #define sampleazureiotDEFAULT_START_TEMPERATURE \
+    ( ( Temperature_t ) ( sampleazureiotDEFAULT_START_TEMP_CELSIUS * sampleazureiotTEMPERATURE_SCALE ) )
+    #define sampleazureiotTEMPERATURE_HUNDREDTHS( xTemperature )         ( ( int64_t ) ( xTemperature ) )
+    #define sampleazureiotTEMPERATURE_FROM_HUNDREDTHS( llHundredths )    ( ( Temperature_t ) ( llHundredths ) )
+    #define sampleazureiotTEMPERATURE_CELSIUS( xTemperature ) \
+    ( ( double ) ( xTemperature ) / sampleazureiotTEMPERATURE_SCALE )
+#else
+    typedef double Temperature_t;
+
+    #define sampleazureiotDEFAULT_START_TEMPERATURE                      sampleazureiotDEFAULT_START_TEMP_CELSIUS
+    #define sampleazureiotTEMPERATURE_HUNDREDTHS( xTemperature ) \
+    ( ( int64_t ) llround( ( xTemperature ) * sampleazureiotTEMPERATURE_SCALE ) )
+    #define sampleazureiotTEMPERATURE_FROM_HUNDREDTHS( llHundredths ) \
+    ( ( double ) ( llHundredths ) / sampleazureiotTEMPERATURE_SCALE )
+    #define sampleazureiotTEMPERATURE_CELSIUS( xTemperature )            ( xTemperature )
+#endif /* democonfigPNP_FIXED_POINT_TEMPERATURE == 1 */
+
+/**
+ * @brief The getMaxMinReport response up to the start time, which only it
+ * does not know. Its size fits the three temperatures at any value.
+ */
+#define sampleazureiotMAX_MIN_REPORT_PREFIX_SIZE                     \
+    ( sizeof( "{\"" sampleazureiotCOMMAND_MAX_TEMP "\":" ) +          \
+      sizeof( ",\"" sampleazureiotCOMMAND_MIN_TEMP "\":" ) +          \
+      sizeof( ",\"" sampleazureiotCOMMAND_TEMP_VERSION "\":" ) +      \
+      sizeof( ",\"" sampleazureiotCOMMAND_START_TIME "\":\"" ) +      \
+      3 * decimalBUFFER_SIZE( sampleazureiotDOUBLE_DECIMAL_PLACE_DIGITS ) )
+
+/* Faking the end time to simplify dependencies on <time.h> */
+#define sampleazureiotMAX_MIN_REPORT_SUFFIX \
+    "\",\"" sampleazureiotCOMMAND_END_TIME "\":\"" sampleazureiotCOMMAND_FAKE_END_TIME "\"}"
+
 /**
  * @brief Property Values
  */
@@ -51,43 +112,212 @@
 #define sampleazureiotPROPERTY_TARGET_TEMPERATURE_TEXT    "targetTemperature"
 #define sampleazureiotPROPERTY_MAX_TEMPERATURE_TEXT       "maxTempSinceLastReboot"
 
+/**
+ * @brief Most writable properties acknowledged in the response to one message.
+ */
+#ifndef democonfigWRITABLE_PROPERTY_ACK_COUNT
+    #define democonfigWRITABLE_PROPERTY_ACK_COUNT         8
+#endif
+
+/**
+ * @brief Diagnostics values, reported on their own component every
+ * democonfigDIAGNOSTICS_INTERVAL_SECS. The shares of the CPU are -1 when they
+ * are not known.
+ */
+#define sampleazureiotDIAGNOSTICS_COMPONENT               "diagnostics"
+#define sampleazureiotPROPERTY_FREE_HEAP_TEXT             "freeHeap"
+#define sampleazureiotPROPERTY_MIN_FREE_HEAP_TEXT         "minFreeHeap"
+#define sampleazureiotPROPERTY_TASK_COUNT_TEXT            "taskCount"
+#define sampleazureiotPROPERTY_MIN_STACK_FREE_TEXT        "minStackFree"
+#define sampleazureiotPROPERTY_MIN_STACK_TASK_TEXT        "minStackTask"
+#define sampleazureiotPROPERTY_LARGEST_FREE_BLOCK_TEXT    "largestFreeBlock"
+#define sampleazureiotPROPERTY_FREE_BLOCKS_TEXT           "freeBlocks"
+#define sampleazureiotPROPERTY_IDLE_CPU_TEXT              "idleCpu"
+#define sampleazureiotPROPERTY_BUSIEST_CPU_TEXT           "busiestTaskCpu"
+#define sampleazureiotPROPERTY_BUSIEST_TASK_TEXT          "busiestTask"
+
 /**
  * @brief Telemetry values
  */
 #define sampleazureiotTELEMETRY_NAME                      "temperature"
 
 /**
- *@brief The Telemetry message published in this example.
+ *@brief The Telemetry message published in this example, around the
+ * temperature written with sampleazureiotTELEMETRY_DECIMALS decimals.
  */
-#define sampleazureiotMESSAGE                             "{\"" sampleazureiotTELEMETRY_NAME "\":%0.2f}"
+#define sampleazureiotMESSAGE_PREFIX                      "{\"" sampleazureiotTELEMETRY_NAME "\":"
+#define sampleazureiotMESSAGE_SUFFIX                      "}"
+#define sampleazureiotTELEMETRY_DECIMALS                  ( 2U )
+
+/**
+ *@brief Decimals of the temperatures logged.
+ */
+#define sampleazureiotLOG_DECIMALS                        ( 6U )
+
+/* The fixed-point telemetry is written straight from the hundredths. */
+#if ( democonfigPNP_FIXED_POINT_TEMPERATURE == 1 ) && ( sampleazureiotTELEMETRY_DECIMALS != sampleazureiotTEMPERATURE_DECIMALS )
+    #error "sampleazureiotTELEMETRY_DECIMALS must be sampleazureiotTEMPERATURE_DECIMALS with democonfigPNP_FIXED_POINT_TEMPERATURE"
+#endif
 
 
 /* Device values */
-static double xDeviceCurrentTemperature = sampleazureiotDEFAULT_START_TEMP_CELSIUS;
-static double xDeviceMaximumTemperature = sampleazureiotDEFAULT_START_TEMP_CELSIUS;
-static double xDeviceMinimumTemperature = sampleazureiotDEFAULT_START_TEMP_CELSIUS;
-static double xDeviceTemperatureSummation = sampleazureiotDEFAULT_START_TEMP_CELSIUS;
+static Temperature_t xDeviceCurrentTemperature = sampleazureiotDEFAULT_START_TEMPERATURE;
+static Temperature_t xDeviceMaximumTemperature = sampleazureiotDEFAULT_START_TEMPERATURE;
+static Temperature_t xDeviceMinimumTemperature = sampleazureiotDEFAULT_START_TEMPERATURE;
+static int64_t llDeviceTemperatureSummation =
+    ( int64_t ) ( sampleazureiotDEFAULT_START_TEMP_CELSIUS * sampleazureiotTEMPERATURE_SCALE );
 static uint32_t ulDeviceTemperatureCount = sampleazureiotDEFAULT_START_TEMP_COUNT;
-static double xDeviceAverageTemperature = sampleazureiotDEFAULT_START_TEMP_CELSIUS;
+static int64_t llDeviceAverageTemperature =
+    ( int64_t ) ( sampleazureiotDEFAULT_START_TEMP_CELSIUS * sampleazureiotTEMPERATURE_SCALE );
 
 /* Command buffers */
 static uint8_t ucCommandStartTimeValueBuffer[ 32 ];
+
+/* The getMaxMinReport response up to the start time, rendered again only when
+ * the temperatures change. */
+static uint8_t ucMaxMinReportPrefix[ sampleazureiotMAX_MIN_REPORT_PREFIX_SIZE ];
+static uint32_t ulMaxMinReportPrefixLength;
+
+/* Components handled next to the thermostat, see vSetPnPComponents(). */
+static const PnPComponent_t * pxPnPComponents;
+static uint32_t ulPnPComponentCount;
+
+typedef struct WritablePropertyAck
+{
+    ReportedProperty_t xProperty;
+    int32_t lStatus;
+    const uint8_t * pucDescription;
+    uint32_t ulDescriptionLength;
+} WritablePropertyAck_t;
+
+/* The acknowledgements of the message being handled, written in one response. */
+static WritablePropertyAck_t xWritablePropertyAcks[ democonfigWRITABLE_PROPERTY_ACK_COUNT ];
+static uint32_t ulWritablePropertyAckCount;
+
+static ReportedProperty_t xTargetTemperatureAck =
+{
+    {
+        NULL, 0,
+        ( const uint8_t * ) sampleazureiotPROPERTY_TARGET_TEMPERATURE_TEXT,
+        sizeof( sampleazureiotPROPERTY_TARGET_TEMPERATURE_TEXT ) - 1
+    },
+    eReportedPropertyDouble,
+    sampleazureiotDOUBLE_DECIMAL_PLACE_DIGITS
+};
+
+/* The target temperature of a properties message, if it has one. */
+typedef struct TargetTemperature
+{
+    double xValue;
+    bool xReceived;
+} TargetTemperature_t;
+
+#if ( democonfigDIAGNOSTICS_INTERVAL_SECS > 0 )
+    static TaskStatus_t xDiagnosticsStatus[ democonfigDIAGNOSTICS_MAX_TASKS ];
+    static DiagnosticsTask_t xDiagnosticsPrevious[ democonfigDIAGNOSTICS_MAX_TASKS ];
+    static Diagnostics_t xDiagnostics = diagnosticsINIT( xDiagnosticsStatus, xDiagnosticsPrevious );
+
+/* Used in turn, as the reported properties keep the names of the snapshot
+ * before, to tell whether they changed. */
+    static DiagnosticsSnapshot_t xDiagnosticsSnapshots[ 2 ];
+    static uint32_t ulDiagnosticsSnapshot;
+    static TickType_t xDiagnosticsTime;
+    static bool xDiagnosticsSampled;
+#endif /* democonfigDIAGNOSTICS_INTERVAL_SECS > 0 */
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Append text to the response, or fail if it does not fit.
+ */
+static bool prvAppendText( uint8_t * pucBuffer,
+                           uint32_t ulBufferSize,
+                           uint32_t * pulLength,
+                           const uint8_t * pucText,
+                           uint32_t ulTextLength )
+{
+    if( ulTextLength > ulBufferSize - *pulLength )
+    {
+        return false;
+    }
+
+    ( void ) memcpy( pucBuffer + *pulLength, pucText, ulTextLength );
+    *pulLength += ulTextLength;
+
+    return true;
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Append a temperature in hundredths of a degree, the decimals of the report.
+ */
+static bool prvAppendTemperature( uint8_t * pucBuffer,
+                                  uint32_t ulBufferSize,
+                                  uint32_t * pulLength,
+                                  int64_t llHundredths )
+{
+    uint32_t ulTextLength = Decimal_FormatScaled( llHundredths, sampleazureiotTEMPERATURE_DECIMALS,
+                                                  pucBuffer + *pulLength, ulBufferSize - *pulLength );
+
+    *pulLength += ulTextLength;
+
+    return ( ulTextLength > 0 );
+}
 /*-----------------------------------------------------------*/
 
+#define sampleazureiotAPPEND_LITERAL( pucBuffer, ulBufferSize, pulLength, pcText ) \
+    prvAppendText( ( pucBuffer ), ( ulBufferSize ), ( pulLength ), ( const uint8_t * ) ( pcText ), sizeof( pcText ) - 1 )
+
 /**
- * @brief Generate max min payload.
+ * @brief Render the max min report up to the start time, once the
+ * temperatures change.
+ */
+static void prvRenderMaxMinReport( void )
+{
+    uint32_t ulLength = 0;
+    bool xRendered;
+
+    xRendered = sampleazureiotAPPEND_LITERAL( ucMaxMinReportPrefix, sizeof( ucMaxMinReportPrefix ), &ulLength,
+                                              "{\"" sampleazureiotCOMMAND_MAX_TEMP "\":" ) &&
+                prvAppendTemperature( ucMaxMinReportPrefix, sizeof( ucMaxMinReportPrefix ), &ulLength,
+                                      sampleazureiotTEMPERATURE_HUNDREDTHS( xDeviceMaximumTemperature ) ) &&
+                sampleazureiotAPPEND_LITERAL( ucMaxMinReportPrefix, sizeof( ucMaxMinReportPrefix ), &ulLength,
+                                              ",\"" sampleazureiotCOMMAND_MIN_TEMP "\":" ) &&
+                prvAppendTemperature( ucMaxMinReportPrefix, sizeof( ucMaxMinReportPrefix ), &ulLength,
+                                      sampleazureiotTEMPERATURE_HUNDREDTHS( xDeviceMinimumTemperature ) ) &&
+                sampleazureiotAPPEND_LITERAL( ucMaxMinReportPrefix, sizeof( ucMaxMinReportPrefix ), &ulLength,
+                                              ",\"" sampleazureiotCOMMAND_TEMP_VERSION "\":" ) &&
+                prvAppendTemperature( ucMaxMinReportPrefix, sizeof( ucMaxMinReportPrefix ), &ulLength,
+                                      llDeviceAverageTemperature ) &&
+                sampleazureiotAPPEND_LITERAL( ucMaxMinReportPrefix, sizeof( ucMaxMinReportPrefix ), &ulLength,
+                                              ",\"" sampleazureiotCOMMAND_START_TIME "\":\"" );
+
+    /* The buffer fits any temperature, so this does not fail. */
+    configASSERT( xRendered );
+    ulMaxMinReportPrefixLength = xRendered ? ulLength : 0;
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Generate max min payload, from the rendered report and the start
+ * time of the request.
  */
 static AzureIoTResult_t prvInvokeMaxMinCommand( AzureIoTJSONReader_t * pxReader,
-                                                AzureIoTJSONWriter_t * pxWriter )
+                                                uint8_t * pucBuffer,
+                                                uint32_t ulBufferSize,
+                                                uint32_t * pulLength )
 {
     AzureIoTResult_t xResult;
     uint32_t ulSinceTimeLength;
+    uint32_t ulIndex;
+
+    *pulLength = 0;
 
     /* Get the start time */
     if( ( xResult = AzureIoTJSONReader_NextToken( pxReader ) )
         != eAzureIoTSuccess )
     {
         LogError( ( "Error getting next token: result 0x%08x", xResult ) );
+        return xResult;
     }
     else if( ( xResult = AzureIoTJSONReader_GetTokenString( pxReader,
                                                             ucCommandStartTimeValueBuffer,
@@ -96,71 +326,91 @@ static AzureIoTResult_t prvInvokeMaxMinCommand( AzureIoTJSONReader_t * pxReader,
              != eAzureIoTSuccess )
     {
         LogError( ( "Error getting token string: result 0x%08x", xResult ) );
+        return xResult;
     }
-    else if( ( xResult = AzureIoTJSONWriter_AppendBeginObject( pxWriter ) )
-             != eAzureIoTSuccess )
-    {
-        LogError( ( "Error appending begin object: result 0x%08x", xResult ) );
-    }
-    else if( ( xResult = AzureIoTJSONWriter_AppendPropertyWithDoubleValue( pxWriter, ( const uint8_t * ) sampleazureiotCOMMAND_MAX_TEMP,
-                                                                           sizeof( sampleazureiotCOMMAND_MAX_TEMP ) - 1,
-                                                                           xDeviceMaximumTemperature, sampleazureiotDOUBLE_DECIMAL_PLACE_DIGITS ) )
-             != eAzureIoTSuccess )
-    {
-        LogError( ( "Error appending max temp: result 0x%08x", xResult ) );
-    }
-    else if( ( xResult = AzureIoTJSONWriter_AppendPropertyWithDoubleValue( pxWriter, ( const uint8_t * ) sampleazureiotCOMMAND_MIN_TEMP,
-                                                                           sizeof( sampleazureiotCOMMAND_MIN_TEMP ) - 1,
-                                                                           xDeviceMinimumTemperature, sampleazureiotDOUBLE_DECIMAL_PLACE_DIGITS ) )
-             != eAzureIoTSuccess )
-    {
-        LogError( ( "Error appending min temp: result 0x%08x", xResult ) );
-    }
-    else if( ( xResult = AzureIoTJSONWriter_AppendPropertyWithDoubleValue( pxWriter, ( const uint8_t * ) sampleazureiotCOMMAND_TEMP_VERSION,
-                                                                           sizeof( sampleazureiotCOMMAND_TEMP_VERSION ) - 1,
-                                                                           xDeviceAverageTemperature, sampleazureiotDOUBLE_DECIMAL_PLACE_DIGITS ) )
-             != eAzureIoTSuccess )
+
+    /* The start time is copied in as is, so one that would need escaping,
+     * which no timestamp does, is refused. */
+    for( ulIndex = 0; ulIndex < ulSinceTimeLength; ulIndex++ )
     {
-        LogError( ( "Error appending average temp: result 0x%08x", xResult ) );
+        if( ( ucCommandStartTimeValueBuffer[ ulIndex ] < ' ' ) ||
+            ( ucCommandStartTimeValueBuffer[ ulIndex ] == '"' ) ||
+            ( ucCommandStartTimeValueBuffer[ ulIndex ] == '\\' ) )
+        {
+            LogError( ( "Error in the start time: it is not a timestamp" ) );
+            return eAzureIoTErrorInvalidArgument;
+        }
     }
-    else if( ( xResult = AzureIoTJSONWriter_AppendPropertyWithStringValue( pxWriter, ( const uint8_t * ) sampleazureiotCOMMAND_START_TIME,
-                                                                           sizeof( sampleazureiotCOMMAND_START_TIME ) - 1,
-                                                                           ucCommandStartTimeValueBuffer, ulSinceTimeLength ) )
-             != eAzureIoTSuccess )
+
+    if( ulMaxMinReportPrefixLength == 0 )
     {
-        LogError( ( "Error appending start time: result 0x%08x", xResult ) );
+        prvRenderMaxMinReport();
     }
-    /* Faking the end time to simplify dependencies on <time.h> */
-    else if( ( xResult = AzureIoTJSONWriter_AppendPropertyWithStringValue( pxWriter, ( const uint8_t * ) sampleazureiotCOMMAND_END_TIME,
-                                                                           sizeof( sampleazureiotCOMMAND_END_TIME ) - 1,
-                                                                           ( const uint8_t * ) sampleazureiotCOMMAND_FAKE_END_TIME,
-                                                                           sizeof( sampleazureiotCOMMAND_FAKE_END_TIME ) - 1 ) )
-             != eAzureIoTSuccess )
+
+    if( ulMaxMinReportPrefixLength == 0 )
     {
-        LogError( ( "Error appending end time: result 0x%08x", xResult ) );
+        LogError( ( "Error rendering the max min report" ) );
+        xResult = eAzureIoTErrorFailed;
     }
-    else if( ( xResult = AzureIoTJSONWriter_AppendEndObject( pxWriter ) )
-             != eAzureIoTSuccess )
+    else if( !prvAppendText( pucBuffer, ulBufferSize, pulLength,
+                             ucMaxMinReportPrefix, ulMaxMinReportPrefixLength ) ||
+             !prvAppendText( pucBuffer, ulBufferSize, pulLength,
+                             ucCommandStartTimeValueBuffer, ulSinceTimeLength ) ||
+             !sampleazureiotAPPEND_LITERAL( pucBuffer, ulBufferSize, pulLength,
+                                            sampleazureiotMAX_MIN_REPORT_SUFFIX ) )
     {
-        LogError( ( "Error appending end object: result 0x%08x", xResult ) );
+        LogError( ( "Error writing the max min report: it does not fit %u bytes", ( unsigned ) ulBufferSize ) );
+        xResult = eAzureIoTErrorOutOfMemory;
     }
 
     return xResult;
 }
 /*-----------------------------------------------------------*/
 
-static void prvSkipPropertyAndValue( AzureIoTJSONReader_t * pxReader )
+/**
+ * @brief Log one of the device temperatures.
+ */
+static void prvLogTemperature( const char * pcName,
+                               Temperature_t xTemperature )
 {
-    AzureIoTResult_t xResult;
+    uint8_t ucText[ decimalBUFFER_SIZE( sampleazureiotLOG_DECIMALS ) ];
+
+    #if ( democonfigPNP_FIXED_POINT_TEMPERATURE == 1 )
+        uint32_t ulLength = Decimal_FormatScaled( xTemperature, sampleazureiotTEMPERATURE_DECIMALS,
+                                                  ucText, sizeof( ucText ) );
+    #else
+        uint32_t ulLength = Decimal_Format( xTemperature, sampleazureiotLOG_DECIMALS,
+                                            ucText, sizeof( ucText ) );
+    #endif
+
+    ( void ) ulLength;
+    LogInfo( ( "%s Temperature: %.*s", pcName, ( int ) ulLength, ucText ) );
+}
+/*-----------------------------------------------------------*/
 
-    xResult = AzureIoTJSONReader_NextToken( pxReader );
-    configASSERT( xResult == eAzureIoTSuccess );
+/**
+ * @brief Convert a received temperature, in degrees Celsius.
+ */
+static Temperature_t prvTemperatureFromCelsius( double xCelsius )
+{
+    #if ( democonfigPNP_FIXED_POINT_TEMPERATURE == 1 )
+        /* Clamped to what the hundredths in an int32_t hold, some 21 million
+         * degrees, so a nonsensical target cannot overflow them. */
+        const double xLimit = ( double ) INT32_MAX / sampleazureiotTEMPERATURE_SCALE;
 
-    xResult = AzureIoTJSONReader_SkipChildren( pxReader );
-    configASSERT( xResult == eAzureIoTSuccess );
+        if( xCelsius > xLimit )
+        {
+            xCelsius = xLimit;
+        }
+        else if( xCelsius < -xLimit )
+        {
+            xCelsius = -xLimit;
+        }
 
-    xResult = AzureIoTJSONReader_NextToken( pxReader );
-    configASSERT( xResult == eAzureIoTSuccess );
+        return ( Temperature_t ) lround( xCelsius * sampleazureiotTEMPERATURE_SCALE );
+    #else
+        return xCelsius;
+    #endif
 }
 /*-----------------------------------------------------------*/
 
@@ -172,7 +422,7 @@ static void prvUpdateLocalProperties( double xNewTemperatureValue,
                                       bool * pxOutMaxTempChanged )
 {
     *pxOutMaxTempChanged = false;
-    xDeviceCurrentTemperature = xNewTemperatureValue;
+    xDeviceCurrentTemperature = prvTemperatureFromCelsius( xNewTemperatureValue );
 
     /* Update maximum or minimum temperatures. */
     if( xDeviceCurrentTemperature > xDeviceMaximumTemperature )
@@ -185,277 +435,531 @@ static void prvUpdateLocalProperties( double xNewTemperatureValue,
         xDeviceMinimumTemperature = xDeviceCurrentTemperature;
     }
 
-    /* Calculate the new average temperature. */
+    /* Calculate the new average temperature, rounded to the nearest
+     * hundredth with the halves away from zero. */
     ulDeviceTemperatureCount++;
-    xDeviceTemperatureSummation += xDeviceCurrentTemperature;
-    xDeviceAverageTemperature = xDeviceTemperatureSummation / ulDeviceTemperatureCount;
+    llDeviceTemperatureSummation += sampleazureiotTEMPERATURE_HUNDREDTHS( xDeviceCurrentTemperature );
+
+    if( llDeviceTemperatureSummation < 0 )
+    {
+        llDeviceAverageTemperature = ( llDeviceTemperatureSummation - ( int64_t ) ( ulDeviceTemperatureCount / 2 ) ) /
+                                     ( int64_t ) ulDeviceTemperatureCount;
+    }
+    else
+    {
+        llDeviceAverageTemperature = ( llDeviceTemperatureSummation + ( int64_t ) ( ulDeviceTemperatureCount / 2 ) ) /
+                                     ( int64_t ) ulDeviceTemperatureCount;
+    }
+
+    prvRenderMaxMinReport();
 
     LogInfo( ( "Client updated desired temperature variables locally." ) );
-    LogInfo( ( "Current Temperature: %2f", xDeviceCurrentTemperature ) );
-    LogInfo( ( "Maximum Temperature: %2f", xDeviceMaximumTemperature ) );
-    LogInfo( ( "Minimum Temperature: %2f", xDeviceMinimumTemperature ) );
-    LogInfo( ( "Average Temperature: %2f", xDeviceAverageTemperature ) );
+    prvLogTemperature( "Current", xDeviceCurrentTemperature );
+    prvLogTemperature( "Maximum", xDeviceMaximumTemperature );
+    prvLogTemperature( "Minimum", xDeviceMinimumTemperature );
+    prvLogTemperature( "Average", sampleazureiotTEMPERATURE_FROM_HUNDREDTHS( llDeviceAverageTemperature ) );
 }
 /*-----------------------------------------------------------*/
 
+/* A property of the diagnostics component. */
+#define sampleazureiotDIAGNOSTICS_PROPERTY( pcName, xType )          \
+    {                                                                \
+        {                                                            \
+            ( const uint8_t * ) sampleazureiotDIAGNOSTICS_COMPONENT, \
+            sizeof( sampleazureiotDIAGNOSTICS_COMPONENT ) - 1,       \
+            ( const uint8_t * ) ( pcName ), sizeof( pcName ) - 1     \
+        },                                                           \
+        ( xType ), 0                                                 \
+    }
+
+static ReportedProperty_t xReportedProperties[] =
+{
+    {
+        {
+            NULL, 0,
+            ( const uint8_t * ) sampleazureiotPROPERTY_MAX_TEMPERATURE_TEXT,
+            sizeof( sampleazureiotPROPERTY_MAX_TEMPERATURE_TEXT ) - 1
+        },
+        eReportedPropertyDouble, sampleazureiotDOUBLE_DECIMAL_PLACE_DIGITS
+    },
+    #if ( democonfigDIAGNOSTICS_INTERVAL_SECS > 0 )
+        sampleazureiotDIAGNOSTICS_PROPERTY( sampleazureiotPROPERTY_FREE_HEAP_TEXT, eReportedPropertyInt32 ),
+        sampleazureiotDIAGNOSTICS_PROPERTY( sampleazureiotPROPERTY_MIN_FREE_HEAP_TEXT, eReportedPropertyInt32 ),
+        sampleazureiotDIAGNOSTICS_PROPERTY( sampleazureiotPROPERTY_TASK_COUNT_TEXT, eReportedPropertyInt32 ),
+        sampleazureiotDIAGNOSTICS_PROPERTY( sampleazureiotPROPERTY_MIN_STACK_FREE_TEXT, eReportedPropertyInt32 ),
+        sampleazureiotDIAGNOSTICS_PROPERTY( sampleazureiotPROPERTY_MIN_STACK_TASK_TEXT, eReportedPropertyString ),
+        sampleazureiotDIAGNOSTICS_PROPERTY( sampleazureiotPROPERTY_LARGEST_FREE_BLOCK_TEXT, eReportedPropertyInt32 ),
+        sampleazureiotDIAGNOSTICS_PROPERTY( sampleazureiotPROPERTY_FREE_BLOCKS_TEXT, eReportedPropertyInt32 ),
+        #if ( configGENERATE_RUN_TIME_STATS == 1 )
+            sampleazureiotDIAGNOSTICS_PROPERTY( sampleazureiotPROPERTY_IDLE_CPU_TEXT, eReportedPropertyInt32 ),
+            sampleazureiotDIAGNOSTICS_PROPERTY( sampleazureiotPROPERTY_BUSIEST_CPU_TEXT, eReportedPropertyInt32 ),
+            sampleazureiotDIAGNOSTICS_PROPERTY( sampleazureiotPROPERTY_BUSIEST_TASK_TEXT, eReportedPropertyString ),
+        #endif
+    #endif /* democonfigDIAGNOSTICS_INTERVAL_SECS > 0 */
+};
+
+#define sampleazureiotREPORTED_MAX_TEMPERATURE       0
+#define sampleazureiotREPORTED_FREE_HEAP             1
+#define sampleazureiotREPORTED_MIN_FREE_HEAP         2
+#define sampleazureiotREPORTED_TASK_COUNT            3
+#define sampleazureiotREPORTED_MIN_STACK_FREE        4
+#define sampleazureiotREPORTED_MIN_STACK_TASK        5
+#define sampleazureiotREPORTED_LARGEST_FREE_BLOCK    6
+#define sampleazureiotREPORTED_FREE_BLOCKS           7
+#define sampleazureiotREPORTED_IDLE_CPU              8
+#define sampleazureiotREPORTED_BUSIEST_CPU           9
+#define sampleazureiotREPORTED_BUSIEST_TASK          10
+
+static ReportedProperties_t xReportedPropertiesStore = reportedpropertiesINIT( xReportedProperties );
+/*-----------------------------------------------------------*/
+
+#if ( democonfigDIAGNOSTICS_INTERVAL_SECS > 0 )
+
+    #if ( democonfigHEAP_TRACE == 1 )
+
 /**
- * @brief Gets the reported properties payload with the maximum temperature value.
+ * @brief Log the heap trace, with the call site holding the most.
  */
-static uint32_t prvGetNewMaxTemp( double xUpdatedTemperature,
-                                  uint8_t * ucReportedPropertyPayloadBuffer,
-                                  uint32_t ulReportedPropertyPayloadBufferSize )
-{
-    AzureIoTResult_t xResult;
-    AzureIoTJSONWriter_t xWriter;
-    int32_t lBytesWritten;
+        static void prvLogHeapTrace( void )
+        {
+            HeapTraceSample_t xSample;
+            HeapTraceStats_t xStats;
+            HeapTraceSite_t xSite;
+            HeapTraceSite_t xLargestSite = { 0 };
+            uint32_t ulIndex;
 
-    /* Initialize the JSON writer with the buffer to which we will write the payload with the new temperature. */
-    xResult = AzureIoTJSONWriter_Init( &xWriter, ucReportedPropertyPayloadBuffer, ulReportedPropertyPayloadBufferSize );
-    configASSERT( xResult == eAzureIoTSuccess );
+            HeapTrace_Sample( &xSample );
+            HeapTrace_GetStats( &xStats );
 
-    xResult = AzureIoTJSONWriter_AppendBeginObject( &xWriter );
-    configASSERT( xResult == eAzureIoTSuccess );
+            for( ulIndex = 0; ulIndex <= democonfigHEAP_TRACE_MAX_SITES; ulIndex++ )
+            {
+                if( HeapTrace_GetSite( ulIndex, &xSite ) && ( xSite.ulPeakLiveBytes > xLargestSite.ulPeakLiveBytes ) )
+                {
+                    xLargestSite = xSite;
+                }
+            }
 
-    xResult = AzureIoTJSONWriter_AppendPropertyName( &xWriter, ( const uint8_t * ) sampleazureiotPROPERTY_MAX_TEMPERATURE_TEXT,
-                                                     sizeof( sampleazureiotPROPERTY_MAX_TEMPERATURE_TEXT ) - 1 );
-    configASSERT( xResult == eAzureIoTSuccess );
+            LogInfo( ( "Heap: %u free in %u blocks, largest %u, %u allocations, %u failed (last %u with largest %u)",
+                       ( unsigned ) xSample.ulFreeBytes, ( unsigned ) xSample.ulFreeBlocks,
+                       ( unsigned ) xSample.ulLargestFreeBlock, ( unsigned ) xStats.ulAllocations,
+                       ( unsigned ) xStats.ulFailures, ( unsigned ) xStats.ulLastFailureSize,
+                       ( unsigned ) xStats.ulLastFailureLargestBlock ) );
+            LogInfo( ( "Heap: most held by %p, %u bytes now, %u at most, %u allocations",
+                       xLargestSite.pvCaller, ( unsigned ) xLargestSite.ulLiveBytes,
+                       ( unsigned ) xLargestSite.ulPeakLiveBytes, ( unsigned ) xLargestSite.ulAllocations ) );
+        }
+/*-----------------------------------------------------------*/
+    #endif /* democonfigHEAP_TRACE == 1 */
 
-    xResult = AzureIoTJSONWriter_AppendDouble( &xWriter, xUpdatedTemperature, sampleazureiotDOUBLE_DECIMAL_PLACE_DIGITS );
-    configASSERT( xResult == eAzureIoTSuccess );
+/**
+ * @brief Sample the diagnostics when they are due, for the reported properties.
+ */
+    static void prvUpdateDiagnostics( void )
+    {
+        DiagnosticsSnapshot_t * pxSnapshot = &xDiagnosticsSnapshots[ ulDiagnosticsSnapshot ];
+        TickType_t xNow = xTaskGetTickCount();
 
-    xResult = AzureIoTJSONWriter_AppendEndObject( &xWriter );
-    configASSERT( xResult == eAzureIoTSuccess );
+        if( xDiagnosticsSampled &&
+            ( ( xNow - xDiagnosticsTime ) < ( TickType_t ) ( democonfigDIAGNOSTICS_INTERVAL_SECS * configTICK_RATE_HZ ) ) )
+        {
+            return;
+        }
+
+        xDiagnosticsSampled = true;
+        xDiagnosticsTime = xNow;
+
+        if( Diagnostics_Sample( &xDiagnostics, pxSnapshot ) != eAzureIoTSuccess )
+        {
+            LogError( ( "Failed to sample diagnostics, more than %u tasks", ( unsigned ) democonfigDIAGNOSTICS_MAX_TASKS ) );
+            return;
+        }
+
+        ulDiagnosticsSnapshot ^= 1U;
+
+        #if ( democonfigHEAP_TRACE == 1 )
+            prvLogHeapTrace();
+        #endif
+
+        ReportedProperties_SetInt32( &xReportedPropertiesStore, sampleazureiotREPORTED_FREE_HEAP,
+                                     ( int32_t ) pxSnapshot->ulFreeHeap );
+        ReportedProperties_SetInt32( &xReportedPropertiesStore, sampleazureiotREPORTED_MIN_FREE_HEAP,
+                                     ( int32_t ) pxSnapshot->ulMinimumEverFreeHeap );
+        ReportedProperties_SetInt32( &xReportedPropertiesStore, sampleazureiotREPORTED_TASK_COUNT,
+                                     ( int32_t ) pxSnapshot->ulTaskCount );
+        ReportedProperties_SetInt32( &xReportedPropertiesStore, sampleazureiotREPORTED_MIN_STACK_FREE,
+                                     ( int32_t ) pxSnapshot->ulMinimumStackFree );
+        ReportedProperties_SetString( &xReportedPropertiesStore, sampleazureiotREPORTED_MIN_STACK_TASK,
+                                      ( const uint8_t * ) pxSnapshot->cMinimumStackTask,
+                                      pxSnapshot->ulMinimumStackTaskLength );
+        ReportedProperties_SetInt32( &xReportedPropertiesStore, sampleazureiotREPORTED_LARGEST_FREE_BLOCK,
+                                     ( int32_t ) pxSnapshot->ulLargestFreeBlock );
+        ReportedProperties_SetInt32( &xReportedPropertiesStore, sampleazureiotREPORTED_FREE_BLOCKS,
+                                     ( int32_t ) pxSnapshot->ulFreeBlocks );
+
+        #if ( configGENERATE_RUN_TIME_STATS == 1 )
+            ReportedProperties_SetInt32( &xReportedPropertiesStore, sampleazureiotREPORTED_IDLE_CPU,
+                                         pxSnapshot->lIdleCpu );
+            ReportedProperties_SetInt32( &xReportedPropertiesStore, sampleazureiotREPORTED_BUSIEST_CPU,
+                                         pxSnapshot->lBusiestCpu );
+            ReportedProperties_SetString( &xReportedPropertiesStore, sampleazureiotREPORTED_BUSIEST_TASK,
+                                          ( const uint8_t * ) pxSnapshot->cBusiestTask,
+                                          pxSnapshot->ulBusiestTaskLength );
+        #endif /* configGENERATE_RUN_TIME_STATS == 1 */
+    }
+/*-----------------------------------------------------------*/
+#endif /* democonfigDIAGNOSTICS_INTERVAL_SECS > 0 */
 
-    lBytesWritten = AzureIoTJSONWriter_GetBytesUsed( &xWriter );
-    configASSERT( lBytesWritten > 0 );
+static bool prvSameAckComponent( const DispatchName_t * pxName,
+                                 const uint8_t * pucComponentName,
+                                 uint32_t ulComponentNameLength )
+{
+    if( ( pxName->pucComponentName == NULL ) || ( pxName->ulComponentNameLength == 0 ) )
+    {
+        return pucComponentName == NULL;
+    }
 
-    return lBytesWritten;
+    return ( pucComponentName != NULL ) &&
+           ( pxName->ulComponentNameLength == ulComponentNameLength ) &&
+           ( memcmp( pxName->pucComponentName, pucComponentName, ulComponentNameLength ) == 0 );
 }
 /*-----------------------------------------------------------*/
 
 /**
- * @brief Generate an update for the device's target temperature property online,
- *        acknowledging the update from the IoT Hub.
+ * @brief Write the acknowledgements of a message in one response, each in its
+ *        component, as the properties came.
+ *
+ * @return Length of the response, 0 if there is nothing to acknowledge or it
+ *         does not fit.
  */
-static uint32_t prvGenerateAckForIncomingTemperature( double xUpdatedTemperature,
-                                                      uint32_t ulVersion,
-                                                      uint8_t * pucResponseBuffer,
-                                                      uint32_t ulResponseBufferSize )
+static uint32_t prvBuildWritablePropertyAcks( uint32_t ulVersion,
+                                              uint8_t * pucResponseBuffer,
+                                              uint32_t ulResponseBufferSize )
 {
     AzureIoTResult_t xResult;
     AzureIoTJSONWriter_t xWriter;
+    const WritablePropertyAck_t * pxAck;
+    const uint8_t * pucComponentName = NULL;
+    uint32_t ulComponentNameLength = 0;
+    uint32_t ulIndex;
     int32_t lBytesWritten;
 
-    /* Building the acknowledgement payload for the temperature property to signal we successfully received and accept it. */
-    xResult = AzureIoTJSONWriter_Init( &xWriter, pucResponseBuffer, ulResponseBufferSize );
-    configASSERT( xResult == eAzureIoTSuccess );
+    if( ulWritablePropertyAckCount == 0 )
+    {
+        return 0;
+    }
 
-    xResult = AzureIoTJSONWriter_AppendBeginObject( &xWriter );
-    configASSERT( xResult == eAzureIoTSuccess );
+    if( ( ( xResult = AzureIoTJSONWriter_Init( &xWriter, pucResponseBuffer, ulResponseBufferSize ) ) != eAzureIoTSuccess ) ||
+        ( ( xResult = AzureIoTJSONWriter_AppendBeginObject( &xWriter ) ) != eAzureIoTSuccess ) )
+    {
+        LogError( ( "Error writing the properties acknowledgement: result 0x%08x", xResult ) );
+        return 0;
+    }
 
-    xResult = AzureIoTHubClientProperties_BuilderBeginResponseStatus( &xAzureIoTHubClient,
-                                                                      &xWriter,
-                                                                      ( const uint8_t * ) sampleazureiotPROPERTY_TARGET_TEMPERATURE_TEXT,
-                                                                      sizeof( sampleazureiotPROPERTY_TARGET_TEMPERATURE_TEXT ) - 1,
-                                                                      sampleazureiotPROPERTY_STATUS_SUCCESS,
-                                                                      ulVersion,
-                                                                      ( const uint8_t * ) sampleazureiotPROPERTY_SUCCESS,
-                                                                      sizeof( sampleazureiotPROPERTY_SUCCESS ) - 1 );
-    configASSERT( xResult == eAzureIoTSuccess );
+    for( ulIndex = 0; ulIndex < ulWritablePropertyAckCount; ulIndex++ )
+    {
+        pxAck = &xWritablePropertyAcks[ ulIndex ];
 
-    xResult = AzureIoTJSONWriter_AppendDouble( &xWriter, xUpdatedTemperature, sampleazureiotDOUBLE_DECIMAL_PLACE_DIGITS );
-    configASSERT( xResult == eAzureIoTSuccess );
+        if( !prvSameAckComponent( &pxAck->xProperty.xName, pucComponentName, ulComponentNameLength ) )
+        {
+            if( ( pucComponentName != NULL ) &&
+                ( ( xResult = AzureIoTHubClientProperties_BuilderEndComponent( &xAzureIoTHubClient, &xWriter ) ) != eAzureIoTSuccess ) )
+            {
+                break;
+            }
 
-    xResult = AzureIoTHubClientProperties_BuilderEndResponseStatus( &xAzureIoTHubClient,
-                                                                    &xWriter );
-    configASSERT( xResult == eAzureIoTSuccess );
+            pucComponentName = ( pxAck->xProperty.xName.ulComponentNameLength > 0 ) ? pxAck->xProperty.xName.pucComponentName : NULL;
+            ulComponentNameLength = pxAck->xProperty.xName.ulComponentNameLength;
 
-    xResult = AzureIoTJSONWriter_AppendEndObject( &xWriter );
-    configASSERT( xResult == eAzureIoTSuccess );
+            if( ( pucComponentName != NULL ) &&
+                ( ( xResult = AzureIoTHubClientProperties_BuilderBeginComponent( &xAzureIoTHubClient, &xWriter,
+                                                                                 pucComponentName,
+                                                                                 ulComponentNameLength ) ) != eAzureIoTSuccess ) )
+            {
+                break;
+            }
+        }
+
+        if( ( ( xResult = AzureIoTHubClientProperties_BuilderBeginResponseStatus( &xAzureIoTHubClient, &xWriter,
+                                                                                  pxAck->xProperty.xName.pucName,
+                                                                                  pxAck->xProperty.xName.ulNameLength,
+                                                                                  pxAck->lStatus, ulVersion,
+                                                                                  pxAck->pucDescription,
+                                                                                  pxAck->ulDescriptionLength ) ) != eAzureIoTSuccess ) ||
+            ( ( xResult = ReportedProperties_AppendValue( &xWriter, &pxAck->xProperty ) ) != eAzureIoTSuccess ) ||
+            ( ( xResult = AzureIoTHubClientProperties_BuilderEndResponseStatus( &xAzureIoTHubClient, &xWriter ) ) != eAzureIoTSuccess ) )
+        {
+            break;
+        }
+    }
 
-    lBytesWritten = AzureIoTJSONWriter_GetBytesUsed( &xWriter );
-    configASSERT( lBytesWritten > 0 );
+    if( ( xResult == eAzureIoTSuccess ) && ( pucComponentName != NULL ) )
+    {
+        xResult = AzureIoTHubClientProperties_BuilderEndComponent( &xAzureIoTHubClient, &xWriter );
+    }
+
+    if( ( xResult != eAzureIoTSuccess ) ||
+        ( ( xResult = AzureIoTJSONWriter_AppendEndObject( &xWriter ) ) != eAzureIoTSuccess ) ||
+        ( ( lBytesWritten = AzureIoTJSONWriter_GetBytesUsed( &xWriter ) ) <= 0 ) )
+    {
+        LogError( ( "Error writing the properties acknowledgement: result 0x%08x", xResult ) );
+        return 0;
+    }
 
     return ( uint32_t ) lBytesWritten;
 }
 /*-----------------------------------------------------------*/
 
+AzureIoTResult_t xAckWritableProperty( const ReportedProperty_t * pxProperty,
+                                       int32_t lStatus,
+                                       const uint8_t * pucDescription,
+                                       uint32_t ulDescriptionLength )
+{
+    WritablePropertyAck_t * pxAck;
+
+    if( ulWritablePropertyAckCount == democonfigWRITABLE_PROPERTY_ACK_COUNT )
+    {
+        LogError( ( "No room to acknowledge property %.*s", ( int16_t ) pxProperty->xName.ulNameLength, pxProperty->xName.pucName ) );
+        return eAzureIoTErrorOutOfMemory;
+    }
+
+    pxAck = &xWritablePropertyAcks[ ulWritablePropertyAckCount++ ];
+    pxAck->xProperty = *pxProperty;
+    pxAck->lStatus = lStatus;
+    pxAck->pucDescription = pucDescription;
+    pxAck->ulDescriptionLength = ulDescriptionLength;
+
+    return eAzureIoTSuccess;
+}
+/*-----------------------------------------------------------*/
+
+static AzureIoTResult_t prvHandleTargetTemperature( AzureIoTJSONReader_t * pxReader,
+                                                    void * pvContext )
+{
+    TargetTemperature_t * pxTarget = ( TargetTemperature_t * ) pvContext;
+
+    pxTarget->xReceived = true;
+
+    return AzureIoTJSONReader_GetTokenDouble( pxReader, &pxTarget->xValue );
+}
+/*-----------------------------------------------------------*/
+
+static const PropertyHandlerEntry_t xPropertyHandlers[] =
+{
+    {
+        {
+            NULL, 0,
+            ( const uint8_t * ) sampleazureiotPROPERTY_TARGET_TEMPERATURE_TEXT,
+            sizeof( sampleazureiotPROPERTY_TARGET_TEMPERATURE_TEXT ) - 1
+        },
+        prvHandleTargetTemperature
+    }
+};
+
+static uint8_t ucPropertySlots[ dispatchtableSLOT_COUNT( sizeof( xPropertyHandlers ) / sizeof( xPropertyHandlers[ 0 ] ) ) ];
+static DispatchTable_t xPropertyTable = dispatchtableINIT( xPropertyHandlers, ucPropertySlots );
+/*-----------------------------------------------------------*/
+
 /**
  * @brief Properties callback handler
  */
 static AzureIoTResult_t prvProcessProperties( AzureIoTHubClientPropertiesResponse_t * pxMessage,
                                               AzureIoTHubClientPropertyType_t xPropertyType,
-                                              double * pxOutTemperature,
+                                              TargetTemperature_t * pxOutTemperature,
                                               uint32_t * ulOutVersion )
 {
     AzureIoTResult_t xResult;
-    AzureIoTJSONReader_t xReader;
-    const uint8_t * pucComponentName = NULL;
-    uint32_t ulComponentNameLength = 0;
 
-    *pxOutTemperature = 0.0;
+    pxOutTemperature->xValue = 0.0;
+    pxOutTemperature->xReceived = false;
 
-    xResult = AzureIoTJSONReader_Init( &xReader, pxMessage->pvMessagePayload, pxMessage->ulPayloadLength );
-    configASSERT( xResult == eAzureIoTSuccess );
-
-    xResult = AzureIoTHubClientProperties_GetPropertiesVersion( &xAzureIoTHubClient, &xReader, pxMessage->xMessageType, ulOutVersion );
+    /* The version and the properties are read in the same pass. */
+    xResult = PropertiesDispatch_Process( pxMessage, xPropertyType, &xPropertyTable,
+                                          pxOutTemperature, ulOutVersion );
 
     if( xResult != eAzureIoTSuccess )
     {
-        LogError( ( "Error getting the property version: result 0x%08x", xResult ) );
+        LogError( ( "There was an error parsing the properties: result 0x%08x", xResult ) );
     }
     else
     {
-        /* Reset JSON reader to the beginning */
-        xResult = AzureIoTJSONReader_Init( &xReader, pxMessage->pvMessagePayload, pxMessage->ulPayloadLength );
-        configASSERT( xResult == eAzureIoTSuccess );
+        LogInfo( ( "Successfully parsed properties" ) );
+    }
 
-        while( ( xResult = AzureIoTHubClientProperties_GetNextComponentProperty( &xAzureIoTHubClient, &xReader,
-                                                                                 pxMessage->xMessageType, xPropertyType,
-                                                                                 &pucComponentName, &ulComponentNameLength ) ) == eAzureIoTSuccess )
-        {
-            if( ulComponentNameLength > 0 )
-            {
-                LogInfo( ( "Unknown component name received" ) );
+    return xResult;
+}
+/*-----------------------------------------------------------*/
 
-                /* Unknown component name arrived (there are none for this device).
-                 * We have to skip over the property and value to continue iterating */
-                prvSkipPropertyAndValue( &xReader );
-            }
-            else if( AzureIoTJSONReader_TokenIsTextEqual( &xReader,
-                                                          ( const uint8_t * ) sampleazureiotPROPERTY_TARGET_TEMPERATURE_TEXT,
-                                                          sizeof( sampleazureiotPROPERTY_TARGET_TEMPERATURE_TEXT ) - 1 ) )
-            {
-                xResult = AzureIoTJSONReader_NextToken( &xReader );
-                configASSERT( xResult == eAzureIoTSuccess );
+static AzureIoTResult_t prvSkipPropertyAndValue( AzureIoTJSONReader_t * pxReader )
+{
+    AzureIoTResult_t xResult;
+
+    if( ( ( xResult = AzureIoTJSONReader_NextToken( pxReader ) ) == eAzureIoTSuccess ) &&
+        ( ( xResult = AzureIoTJSONReader_SkipChildren( pxReader ) ) == eAzureIoTSuccess ) )
+    {
+        xResult = AzureIoTJSONReader_NextToken( pxReader );
+    }
 
-                /* Get desired temperature */
-                xResult = AzureIoTJSONReader_GetTokenDouble( &xReader, pxOutTemperature );
+    return xResult;
+}
+/*-----------------------------------------------------------*/
 
-                if( xResult != eAzureIoTSuccess )
-                {
-                    LogError( ( "Error getting the property version: result 0x%08x", xResult ) );
-                    break;
-                }
+static const PnPComponent_t * prvFindComponent( const uint8_t * pucComponentName,
+                                                uint32_t ulComponentNameLength )
+{
+    uint32_t ulIndex;
 
-                xResult = AzureIoTJSONReader_NextToken( &xReader );
-                configASSERT( xResult == eAzureIoTSuccess );
-            }
-            else
-            {
-                LogInfo( ( "Unknown property arrived: skipping over it." ) );
+    if( pucComponentName == NULL )
+    {
+        return NULL;
+    }
 
-                /* Unknown property arrived. We have to skip over the property and value to continue iterating. */
-                prvSkipPropertyAndValue( &xReader );
-            }
+    for( ulIndex = 0; ulIndex < ulPnPComponentCount; ulIndex++ )
+    {
+        if( ( pxPnPComponents[ ulIndex ].ulNameLength == ulComponentNameLength ) &&
+            ( memcmp( pxPnPComponents[ ulIndex ].pucName, pucComponentName, ulComponentNameLength ) == 0 ) )
+        {
+            return &pxPnPComponents[ ulIndex ];
         }
+    }
+
+    return NULL;
+}
+/*-----------------------------------------------------------*/
 
-        if( xResult != eAzureIoTErrorEndOfProperties )
+/**
+ * @brief Hand the writable properties of the added components to their handlers.
+ *        The properties of the thermostat were read by prvProcessProperties().
+ */
+static void prvHandleComponentProperties( AzureIoTHubClientPropertiesResponse_t * pxMessage,
+                                          uint32_t ulVersion,
+                                          uint8_t * pucResponseBuffer,
+                                          uint32_t ulResponseBufferSize )
+{
+    AzureIoTResult_t xResult;
+    AzureIoTJSONReader_t xReader;
+    const uint8_t * pucComponentName = NULL;
+    uint32_t ulComponentNameLength = 0;
+    const PnPComponent_t * pxComponent;
+
+    if( ( xResult = AzureIoTJSONReader_Init( &xReader, pxMessage->pvMessagePayload, pxMessage->ulPayloadLength ) ) != eAzureIoTSuccess )
+    {
+        LogError( ( "AzureIoTJSONReader_Init failed: result 0x%08x", ( uint16_t ) xResult ) );
+        return;
+    }
+
+    while( AzureIoTHubClientProperties_GetNextComponentProperty( &xAzureIoTHubClient, &xReader,
+                                                                 pxMessage->xMessageType, eAzureIoTHubClientPropertyWritable,
+                                                                 &pucComponentName, &ulComponentNameLength ) == eAzureIoTSuccess )
+    {
+        pxComponent = prvFindComponent( pucComponentName, ulComponentNameLength );
+
+        if( pxComponent != NULL )
         {
-            LogError( ( "There was an error parsing the properties: result 0x%08x", xResult ) );
+            LogInfo( ( "Properties component name: %.*s", ( int16_t ) ulComponentNameLength, pucComponentName ) );
+            xResult = pxComponent->xPropertyHandler( &xReader, ulVersion, pucResponseBuffer, ulResponseBufferSize );
         }
         else
         {
-            LogInfo( ( "Successfully parsed properties" ) );
-            xResult = eAzureIoTSuccess;
+            xResult = prvSkipPropertyAndValue( &xReader );
+        }
+
+        if( xResult != eAzureIoTSuccess )
+        {
+            LogError( ( "There was an error handling component properties: result 0x%08x", ( uint16_t ) xResult ) );
+            return;
         }
     }
+}
+/*-----------------------------------------------------------*/
 
-    return xResult;
+void vSetPnPComponents( const PnPComponent_t * pxComponents,
+                        uint32_t ulComponentCount )
+{
+    pxPnPComponents = pxComponents;
+    ulPnPComponentCount = ulComponentCount;
 }
 /*-----------------------------------------------------------*/
 
 /**
  * @brief Property message callback handler
  */
-void vHandleWritableProperties( AzureIoTHubClientPropertiesResponse_t * pxMessage,
-                                uint8_t * pucWritablePropertyResponseBuffer,
-                                uint32_t ulWritablePropertyResponseBufferSize,
-                                uint32_t * pulWritablePropertyResponseBufferLength )
+uint32_t ulHandleWritableProperties( AzureIoTHubClientPropertiesResponse_t * pxMessage,
+                                     uint8_t * pucWritablePropertyResponseBuffer,
+                                     uint32_t ulWritablePropertyResponseBufferSize,
+                                     uint32_t * pulWritablePropertyResponseBufferLength )
 {
     AzureIoTResult_t xResult;
-    double xIncomingTemperature;
+    TargetTemperature_t xIncomingTemperature;
     uint32_t ulVersion;
     bool xWasMaxTemperatureChanged = false;
 
+    *pulWritablePropertyResponseBufferLength = 0;
+
     xResult = prvProcessProperties( pxMessage, eAzureIoTHubClientPropertyWritable, &xIncomingTemperature, &ulVersion );
 
-    if( xResult == eAzureIoTSuccess )
+    if( xResult != eAzureIoTSuccess )
     {
-        prvUpdateLocalProperties( xIncomingTemperature, ulVersion, &xWasMaxTemperatureChanged );
-        *pulWritablePropertyResponseBufferLength = prvGenerateAckForIncomingTemperature(
-            xIncomingTemperature,
-            ulVersion,
-            pucWritablePropertyResponseBuffer,
-            ulWritablePropertyResponseBufferSize );
+        LogError( ( "There was an error processing incoming properties: result 0x%08x", xResult ) );
+        return 0;
     }
-    else
+
+    ulWritablePropertyAckCount = 0;
+
+    /* The components may send responses of their own from the buffer before
+     * the acknowledgements are written there. */
+    if( ulPnPComponentCount > 0 )
     {
-        LogError( ( "There was an error processing incoming properties: result 0x%08x", xResult ) );
+        prvHandleComponentProperties( pxMessage, ulVersion, pucWritablePropertyResponseBuffer,
+                                      ulWritablePropertyResponseBufferSize );
     }
+
+    if( xIncomingTemperature.xReceived )
+    {
+        prvUpdateLocalProperties( xIncomingTemperature.xValue, ulVersion, &xWasMaxTemperatureChanged );
+
+        xTargetTemperatureAck.xValue.xDouble = xIncomingTemperature.xValue;
+        ( void ) xAckWritableProperty( &xTargetTemperatureAck, sampleazureiotPROPERTY_STATUS_SUCCESS,
+                                       ( const uint8_t * ) sampleazureiotPROPERTY_SUCCESS,
+                                       sizeof( sampleazureiotPROPERTY_SUCCESS ) - 1 );
+    }
+
+    /* Every property of the message is acknowledged in the one response. */
+    *pulWritablePropertyResponseBufferLength = prvBuildWritablePropertyAcks( ulVersion,
+                                                                             pucWritablePropertyResponseBuffer,
+                                                                             ulWritablePropertyResponseBufferSize );
+
+    return ulVersion;
 }
 /*-----------------------------------------------------------*/
 
-/**
- * @brief Command message callback handler
- */
-uint32_t ulHandleCommand( AzureIoTHubClientCommandRequest_t * pxMessage,
-                          uint32_t * pulResponseStatus,
-                          uint8_t * pucCommandResponsePayloadBuffer,
-                          uint32_t ulCommandResponsePayloadBufferSize )
+static uint32_t prvHandleMaxMinReport( AzureIoTHubClientCommandRequest_t * pxMessage,
+                                       uint32_t * pulResponseStatus,
+                                       uint8_t * pucCommandResponsePayloadBuffer,
+                                       uint32_t ulCommandResponsePayloadBufferSize )
 {
     AzureIoTResult_t xResult;
     AzureIoTJSONReader_t xReader;
-    AzureIoTJSONWriter_t xWriter;
-    int32_t lCommandNameLength;
-    int32_t ulCommandResponsePayloadLength;
+    uint32_t ulCommandResponsePayloadLength;
 
-    LogInfo( ( "Command payload : %.*s \r\n",
-               ( int16_t ) pxMessage->ulPayloadLength,
-               ( const char * ) pxMessage->pvMessagePayload ) );
+    /*Initialize the reader from which we pull the "since". */
+    xResult = AzureIoTJSONReader_Init( &xReader, pxMessage->pvMessagePayload, pxMessage->ulPayloadLength );
+    configASSERT( xResult == eAzureIoTSuccess );
 
-    lCommandNameLength = sizeof( sampleazureiotCOMMAND_MAX_MIN_REPORT ) - 1;
+    /* Read the "since" value and copy it, between the rendered report and
+     * its end, into the response payload. */
+    xResult = prvInvokeMaxMinCommand( &xReader, pucCommandResponsePayloadBuffer,
+                                      ulCommandResponsePayloadBufferSize,
+                                      &ulCommandResponsePayloadLength );
 
-    if( ( lCommandNameLength == pxMessage->usCommandNameLength ) &&
-        ( strncmp( sampleazureiotCOMMAND_MAX_MIN_REPORT, ( const char * ) pxMessage->pucCommandName, lCommandNameLength ) == 0 ) )
+    if( xResult == eAzureIoTSuccess )
     {
-        /* Is for max min report */
-
-        /*Initialize the reader from which we pull the "since". */
-        xResult = AzureIoTJSONReader_Init( &xReader, pxMessage->pvMessagePayload, pxMessage->ulPayloadLength );
-        configASSERT( xResult == eAzureIoTSuccess );
-
-        /* Initialize the JSON writer with a buffer to which we will write the response payload. */
-        xResult = AzureIoTJSONWriter_Init( &xWriter, pucCommandResponsePayloadBuffer, ulCommandResponsePayloadBufferSize );
-        configASSERT( xResult == eAzureIoTSuccess );
-
-        /* Read from the writer the "since" value and use it to construct the response payload in the writer. */
-        xResult = prvInvokeMaxMinCommand( &xReader, &xWriter );
-
-        if( xResult == eAzureIoTSuccess )
-        {
-            ulCommandResponsePayloadLength = AzureIoTJSONWriter_GetBytesUsed( &xWriter );
-
-            *pulResponseStatus = AZ_IOT_STATUS_OK;
-        }
-        else
-        {
-            LogError( ( "Error generating command payload: result 0x%08x", xResult ) );
-
-            *pulResponseStatus = 501;
-            ulCommandResponsePayloadLength = sizeof( sampleazureiotCOMMAND_EMPTY_PAYLOAD ) - 1;
-            configASSERT( ulCommandResponsePayloadBufferSize >= ulCommandResponsePayloadLength );
-            ( void ) memcpy( pucCommandResponsePayloadBuffer, sampleazureiotCOMMAND_EMPTY_PAYLOAD, ulCommandResponsePayloadLength );
-        }
+        *pulResponseStatus = AZ_IOT_STATUS_OK;
     }
     else
     {
-        /* Not for max min report (not for this device) */
-        LogInfo( ( "Received command is not for this device: %.*s",
-                   pxMessage->usCommandNameLength,
-                   pxMessage->pucCommandName ) );
+        LogError( ( "Error generating command payload: result 0x%08x", xResult ) );
 
-        *pulResponseStatus = AZ_IOT_STATUS_NOT_FOUND;
+        *pulResponseStatus = 501;
         ulCommandResponsePayloadLength = sizeof( sampleazureiotCOMMAND_EMPTY_PAYLOAD ) - 1;
         configASSERT( ulCommandResponsePayloadBufferSize >= ulCommandResponsePayloadLength );
         ( void ) memcpy( pucCommandResponsePayloadBuffer, sampleazureiotCOMMAND_EMPTY_PAYLOAD, ulCommandResponsePayloadLength );
@@ -465,6 +969,39 @@ uint32_t ulHandleCommand( AzureIoTHubClientCommandRequest_t * pxMessage,
 }
 /*-----------------------------------------------------------*/
 
+static const CommandHandlerEntry_t xCommandHandlers[] =
+{
+    {
+        {
+            NULL, 0,
+            ( const uint8_t * ) sampleazureiotCOMMAND_MAX_MIN_REPORT,
+            sizeof( sampleazureiotCOMMAND_MAX_MIN_REPORT ) - 1
+        },
+        prvHandleMaxMinReport
+    }
+};
+
+static uint8_t ucCommandSlots[ dispatchtableSLOT_COUNT( sizeof( xCommandHandlers ) / sizeof( xCommandHandlers[ 0 ] ) ) ];
+static DispatchTable_t xCommandTable = dispatchtableINIT( xCommandHandlers, ucCommandSlots );
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Command message callback handler
+ */
+uint32_t ulHandleCommand( AzureIoTHubClientCommandRequest_t * pxMessage,
+                          uint32_t * pulResponseStatus,
+                          uint8_t * pucCommandResponsePayloadBuffer,
+                          uint32_t ulCommandResponsePayloadBufferSize )
+{
+    LogInfo( ( "Command payload : %.*s \r\n",
+               ( int16_t ) pxMessage->ulPayloadLength,
+               ( const char * ) pxMessage->pvMessagePayload ) );
+
+    return CommandsDispatch_Process( &xCommandTable, pxMessage, pulResponseStatus,
+                                     pucCommandResponsePayloadBuffer, ulCommandResponsePayloadBufferSize );
+}
+/*-----------------------------------------------------------*/
+
 /**
  * @brief Implements the sample interface for generating Telemetry payload.
  */
@@ -472,20 +1009,36 @@ uint32_t ulCreateTelemetry( uint8_t * pucTelemetryData,
                             uint32_t ulTelemetryDataSize,
                             uint32_t * ulTelemetryDataLength )
 {
-    int result = snprintf( ( char * ) pucTelemetryData, ulTelemetryDataSize,
-                           sampleazureiotMESSAGE, xDeviceCurrentTemperature );
+    uint32_t ulLength = sizeof( sampleazureiotMESSAGE_PREFIX ) - 1;
+    uint32_t ulValueLength;
 
-    if( ( result >= 0 ) && ( result < ulTelemetryDataSize ) )
+    if( ulTelemetryDataSize < ulLength + sizeof( sampleazureiotMESSAGE_SUFFIX ) - 1 )
     {
-        *ulTelemetryDataLength = result;
-        result = 0;
+        return 1;
     }
-    else
+
+    ( void ) memcpy( pucTelemetryData, sampleazureiotMESSAGE_PREFIX, ulLength );
+
+    #if ( democonfigPNP_FIXED_POINT_TEMPERATURE == 1 )
+        ulValueLength = Decimal_FormatScaled( xDeviceCurrentTemperature, sampleazureiotTELEMETRY_DECIMALS,
+                                              pucTelemetryData + ulLength,
+                                              ulTelemetryDataSize - ulLength - ( sizeof( sampleazureiotMESSAGE_SUFFIX ) - 1 ) );
+    #else
+        ulValueLength = Decimal_Format( xDeviceCurrentTemperature, sampleazureiotTELEMETRY_DECIMALS,
+                                        pucTelemetryData + ulLength,
+                                        ulTelemetryDataSize - ulLength - ( sizeof( sampleazureiotMESSAGE_SUFFIX ) - 1 ) );
+    #endif
+
+    if( ulValueLength == 0 )
     {
-        result = 1;
+        return 1;
     }
 
-    return result;
+    ulLength += ulValueLength;
+    ( void ) memcpy( pucTelemetryData + ulLength, sampleazureiotMESSAGE_SUFFIX, sizeof( sampleazureiotMESSAGE_SUFFIX ) - 1 );
+    *ulTelemetryDataLength = ulLength + sizeof( sampleazureiotMESSAGE_SUFFIX ) - 1;
+
+    return 0;
 }
 /*-----------------------------------------------------------*/
 
@@ -495,7 +1048,41 @@ uint32_t ulCreateTelemetry( uint8_t * pucTelemetryData,
 uint32_t ulCreateReportedPropertiesUpdate( uint8_t * pucPropertiesData,
                                            uint32_t ulPropertiesDataSize )
 {
-    return prvGetNewMaxTemp( xDeviceCurrentTemperature, pucPropertiesData, ulPropertiesDataSize );
+    AzureIoTResult_t xResult;
+    uint32_t ulLength;
+
+    /* Only sent when it changed, rather than on every loop. */
+    ReportedProperties_SetDouble( &xReportedPropertiesStore, sampleazureiotREPORTED_MAX_TEMPERATURE,
+                                  sampleazureiotTEMPERATURE_CELSIUS( xDeviceCurrentTemperature ) );
+
+    #if ( democonfigDIAGNOSTICS_INTERVAL_SECS > 0 )
+        prvUpdateDiagnostics();
+    #endif
+
+    xResult = ReportedProperties_Build( &xReportedPropertiesStore, &xAzureIoTHubClient,
+                                        pucPropertiesData, ulPropertiesDataSize, &ulLength );
+    configASSERT( xResult == eAzureIoTSuccess );
+
+    return ulLength;
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Implements the sample interface for tracking the reported properties update sent.
+ */
+void vReportedPropertiesUpdateSent( uint32_t ulRequestId,
+                                    AzureIoTResult_t xResult )
+{
+    ReportedProperties_Sent( &xReportedPropertiesStore, ulRequestId, xResult );
+}
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Implements the sample interface for the response to a reported properties update.
+ */
+void vHandleReportedPropertiesResponse( AzureIoTHubClientPropertiesResponse_t * pxMessage )
+{
+    ReportedProperties_HandleResponse( &xReportedPropertiesStore, pxMessage );
 }
 
 /*-----------------------------------------------------------*/